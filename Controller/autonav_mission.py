@@ -0,0 +1,149 @@
+"""
+Assembles AutoNav missions and uploads them to the mission store of the
+drone, which then flies them on its own (firmware autonav_mission.h).
+
+    python autonav_mission.py assemble mission.txt -o mission.bin
+    python autonav_mission.py upload mission.txt [--ip 192.168.4.1] [--start]
+
+A mission is one instruction per line, distances in mm relative to where
+the mission starts, durations in ms, '#' comments and 'name:' labels:
+
+    on_obstacle jump home
+    takeoff 800 2000
+    lap:
+    goto 1000 0 3000
+    goto 1000 1000 3000
+    alt 1200 1000
+    hold 2000
+    jump lap 3
+    home:
+    goto 0 0 4000
+    land
+
+on_obstacle takes hold (the default), land or jump LABEL. A jump without a
+count loops forever, the end of the program hovers in place.
+"""
+
+import argparse
+import logging
+import struct
+import sys
+
+from drone_connection import (AUTONAV_CRTP_CHANNEL, AUTONAV_CRTP_PORT, CRTP_LINK_BITS,
+                              MEM_WRITE_MAX_LEN, AutoNavCommand, UdpMemoryClient, _checksum)
+
+MEM_TYPE_AUTONAV_MISSION = 0x27
+AUTONAV_MISSION_SIZE = 512
+
+# Opcode and argument formats, matching autonav_op_t
+OPS = {
+    'end': (0x00, ''),
+    'takeoff': (0x01, 'HH'),
+    'goto': (0x02, 'hhH'),
+    'alt': (0x03, 'HH'),
+    'hold': (0x04, 'H'),
+    'land': (0x05, ''),
+    'jump': (0x06, 'HB'),
+    'on_obstacle': (0x07, 'BH'),
+}
+OBSTACLE_ACTIONS = {'hold': 0, 'land': 1, 'jump': 2}
+
+
+def assemble(source: str) -> bytes:
+    """Two passes, the first places the labels."""
+    lines = []
+    for number, line in enumerate(source.splitlines(), 1):
+        words = line.split('#')[0].split()
+        if words:
+            lines.append((number, words))
+
+    labels = {}
+    for pass_number in range(2):
+        def resolve(label):
+            if pass_number and label not in labels:
+                raise ValueError(f'line {number}: unknown label {label}')
+            return labels.get(label, 0)
+
+        program = bytearray()
+        for number, words in lines:
+            if len(words) == 1 and words[0].endswith(':'):
+                labels[words[0][:-1]] = len(program)
+                continue
+            op, args = words[0].lower(), words[1:]
+            if op not in OPS:
+                raise ValueError(f'line {number}: unknown instruction {op}')
+            code, fmt = OPS[op]
+
+            if op == 'jump':
+                if len(args) not in (1, 2):
+                    raise ValueError(f'line {number}: jump LABEL [COUNT]')
+                values = [resolve(args[0]), int(args[1]) if len(args) > 1 else 0]
+            elif op == 'on_obstacle':
+                action = args[0] if args else None
+                if action not in OBSTACLE_ACTIONS or len(args) != (2 if action == 'jump' else 1):
+                    raise ValueError(f'line {number}: on_obstacle hold, land or jump LABEL')
+                values = [OBSTACLE_ACTIONS[action], resolve(args[1]) if action == 'jump' else 0]
+            else:
+                if len(args) != len(fmt):
+                    raise ValueError(f'line {number}: {op} takes {len(fmt)} arguments')
+                values = [int(a) for a in args]
+            program += struct.pack('<B' + fmt, code, *values)
+
+    if len(program) > AUTONAV_MISSION_SIZE:
+        raise ValueError(f'{len(program)} bytes, the store holds {AUTONAV_MISSION_SIZE}')
+    return bytes(program)
+
+
+class MissionUploader(UdpMemoryClient):
+
+    def upload(self, program: bytes, start: bool):
+        self.open()
+        try:
+            memories = self._find_memories((MEM_TYPE_AUTONAV_MISSION,))
+            if MEM_TYPE_AUTONAV_MISSION not in memories:
+                raise RuntimeError('No mission memory, the firmware has no autonav missions')
+            mem_id = memories[MEM_TYPE_AUTONAV_MISSION][0]
+
+            # The write at 0 clears the store, it goes first
+            for addr in range(0, len(program), MEM_WRITE_MAX_LEN):
+                if not self._write(mem_id, addr, program[addr:addr + MEM_WRITE_MAX_LEN]):
+                    raise RuntimeError('Mission refused, a mission is flying')
+            if start:
+                raw = bytes([(AUTONAV_CRTP_PORT << 4) | CRTP_LINK_BITS | AUTONAV_CRTP_CHANNEL,
+                             AutoNavCommand.MISSION])
+                self.sock.sendto(raw + bytes([_checksum(raw)]), self.addr)
+        finally:
+            self.close()
+
+
+def main() -> int:
+    parser = argparse.ArgumentParser(description='AutoNav missions of the ESP-Drone')
+    commands = parser.add_subparsers(dest='command', required=True)
+
+    assemble_parser = commands.add_parser('assemble', help='write the bytecode, e.g. for the simulator')
+    assemble_parser.add_argument('source')
+    assemble_parser.add_argument('-o', '--output', required=True)
+
+    upload_parser = commands.add_parser('upload', help='upload to the mission store of the drone')
+    upload_parser.add_argument('source')
+    upload_parser.add_argument('--ip', default='192.168.4.1')
+    upload_parser.add_argument('--port', type=int, default=2390)
+    upload_parser.add_argument('--start', action='store_true', help='fly it once uploaded')
+
+    args = parser.parse_args()
+    logging.basicConfig(level=logging.INFO)
+
+    with open(args.source) as f:
+        program = assemble(f.read())
+    print(f'{len(program)} bytes')
+
+    if args.command == 'assemble':
+        with open(args.output, 'wb') as f:
+            f.write(program)
+    else:
+        MissionUploader(args.ip, args.port).upload(program, args.start)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,360 @@
+"""
+Native CRTP client of the Wi-Fi link of the ESP-Drone, without cflib.
+
+It owns the UDP socket of a connection. Setpoints, AutoNav commands and the
+AutoNav status go straight through it, cflib's BatchedUdpDriver hands it
+everything else, the TOC, param and log traffic. The drone sees a single
+client, so the pilot session of the firmware does not change.
+
+    client = CrtpUdpClient(('192.168.4.1', 2390))
+    client.add_port_handler(0x0D, lambda raw: print(raw.hex()))
+    client.open()
+    client.send(bytes([0xDC, 1]))
+"""
+
+import queue
+import socket
+import struct
+import threading
+import time
+
+# Wi-Fi link control (matches firmware wifi_esp32.h)
+WIFI_CTRL_HEADER = 0xFF  # CRTP null packet header
+WIFI_CTRL_BATCH = 0x42
+WIFI_CTRL_ECHO = 0x45
+WIFI_CTRL_SEQ = 0x53
+WIFI_CTRL_LARGE = 0x4C
+CRTP_LARGE_MAX_DATA_SIZE = 1024
+WIFI_ECHO_PERIOD = 1.0  # s
+
+CRTP_LINK_BITS = 0x0C  # Set by cflib in every header
+
+# A packet dropped by a full port queue of the firmware (matches crtp.h)
+CRTP_PORT_LINK = 0x0F
+CRTP_LINK_BUSY_CHANNEL = 3
+CRTP_LINK_BUSY_FORMAT = struct.Struct('<BBH')
+BUSY_HOLDOFF = 0.02  # s, the packets of a busy port wait this long after the signal
+
+# Time synchronization (matches firmware time_sync.h)
+CRTP_PORT_TIME_SYNC = 0x09
+TIME_SYNC_CHANNEL = 0
+TIME_SYNC_PING = 0
+TIME_SYNC_SAMPLE = 1
+TIME_SYNC_PING_FORMAT = struct.Struct('<BBQ')
+TIME_SYNC_ANSWER_FORMAT = struct.Struct('<BBQQQ')
+TIME_SYNC_SAMPLE_FORMAT = struct.Struct('<BQQI')
+TIME_SYNC_PERIOD = 0.5  # s
+TIME_SYNC_PROBES = 10  # Unanswered pings before a firmware without TIME_SYNC is given up
+DATAGRAM_MAX_SIZE = 2048
+RECEIVE_POLL_PERIOD = 0.2  # s, the receive thread sees close() within it
+
+
+def _checksum(data: bytes) -> int:
+    return sum(data) % 256
+
+
+def _split_datagram(datagram: bytes):
+    """Split a datagram from the drone into raw CRTP packets (header + data)."""
+    if len(datagram) < 2 or _checksum(datagram[:-1]) != datagram[-1]:
+        return []
+    body = datagram[:-1]
+
+    # The batch ack is the only batched mode datagram of three bytes
+    if len(body) <= 3 or body[0] != WIFI_CTRL_HEADER or body[1] != WIFI_CTRL_BATCH:
+        return [body]
+
+    packets = []
+    i = 2
+    while i < len(body):
+        length = body[i]
+        packets.append(body[i + 1:i + 1 + length])
+        i += 1 + length
+    return packets
+
+
+def _is_batch_ack(raw: bytes) -> bool:
+    return len(raw) >= 3 and raw[0] == WIFI_CTRL_HEADER and raw[1] == WIFI_CTRL_BATCH
+
+
+def _is_echo_reply(raw: bytes) -> bool:
+    return len(raw) >= 6 and raw[0] == WIFI_CTRL_HEADER and raw[1] == WIFI_CTRL_ECHO
+
+
+class CrtpUdpClient:
+    """
+    CRTP over the UDP link of the firmware, with a receive thread of its own.
+
+    The receive thread reads every datagram into one preallocated buffer and
+    splits it into packets. The packets of a port with a handler are given to
+    the handler on that thread, the handler returns True when the packet is
+    consumed. The other packets are queued for receive().
+
+    The client asks the firmware to batch its packets, and measures the
+    round trip time of the link with an echo request about once per second:
+    rtt_ms is the last one and rtt_mean_ms its average. Once the firmware
+    answered an echo, every datagram sent to it carries a sequence number,
+    from which it counts the lost ones (log group wifiLink).
+
+    The client also pings the time synchronization of the firmware every
+    TIME_SYNC_PERIOD and sends back the samples, the drone then logs the unix
+    time of the host in timeSync.hostUs. sync_delay_us is the last delay of
+    the link the pings measured.
+
+    When a port queue of the firmware is full it drops the packet and says
+    so, busy_dropped has the count per port. The next packet of that port
+    waits BUSY_HOLDOFF from the signal, cflib resends what was dropped.
+
+    With a capture, every CRTP packet is also written to it.
+
+    Opened without a receive thread, the socket does not block and the owner
+    calls read() whenever it is readable and poll() now and then, as the
+    Fleet of fleet.py does for many clients on one thread.
+    """
+
+    def __init__(self, addr, capture=None):
+        self.addr = addr
+        self.capture = capture
+        self.batched = False
+        self.sequenced = False
+        self.rtt_ms = None
+        self.rtt_mean_ms = None
+        self.sync_delay_us = None
+        self._sock = None
+        self._thread = None
+        self._running = False
+        self._handlers = {}
+        self._packets = queue.Queue()
+        self._echoed = threading.Event()
+        self._sequence = 0
+        self._last_echo = 0.0
+        self._tx_lock = threading.Lock()
+        self._rx_buf = bytearray(DATAGRAM_MAX_SIZE)
+        self._rx_view = memoryview(self._rx_buf)
+        self._echo_buf = bytearray(2 + 8 + 1)
+        self._echo_buf[0] = WIFI_CTRL_HEADER
+        self._echo_buf[1] = WIFI_CTRL_ECHO
+        self._sync_seq = 0
+        self._sync_unanswered = 0
+        self._last_sync = 0.0
+        self.busy_dropped = {}
+        self._busy_until = {}
+
+    def add_port_handler(self, port: int, handler):
+        """
+        Handle the packets of a CRTP port on the receive thread.
+
+        handler(raw) gets the CRTP header and data, and returns True when it
+        consumed the packet, else it is queued for receive().
+        """
+        self._handlers[port] = handler
+
+    def open(self, receive_thread: bool = True):
+        self._sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self._sock.connect(self.addr)
+        if receive_thread:
+            self._sock.settimeout(RECEIVE_POLL_PERIOD)
+            self._running = True
+            self._thread = threading.Thread(target=self._run, name='crtp-udp', daemon=True)
+            self._thread.start()
+        else:
+            self._sock.setblocking(False)
+        self._send_datagram(bytes([WIFI_CTRL_HEADER, WIFI_CTRL_BATCH, 1]))
+        self._send_echo()
+
+    def close(self):
+        """Stop the receive thread and close the socket, returns once both are done."""
+        self._running = False
+        if self._thread:
+            self._thread.join()
+            self._thread = None
+        if self._sock:
+            self._sock.close()
+            self._sock = None
+
+    def wait_for_echo(self, timeout: float) -> bool:
+        """
+        Wait for the firmware to answer an echo, the link is up once it did.
+        The request is repeated, a lost one does not cost the whole timeout.
+        """
+        deadline = time.monotonic() + timeout
+        while not self._echoed.is_set():
+            remaining = deadline - time.monotonic()
+            if remaining <= 0:
+                return False
+            if self._echoed.wait(min(0.2, remaining)):
+                break
+            self._send_echo()
+        return True
+
+    def send(self, raw: bytes):
+        """Send a CRTP packet, header and data."""
+        busy_until = self._busy_until.get(raw[0] >> 4)
+        if busy_until is not None:
+            wait = busy_until - time.monotonic()
+            if wait > 0:
+                time.sleep(wait)
+        if self.capture:
+            self.capture.record(self.capture.SENT, raw)
+        with self._tx_lock:
+            if self.sequenced:
+                raw = bytes([WIFI_CTRL_HEADER, WIFI_CTRL_SEQ, self._sequence]) + bytes(raw)
+                self._sequence = (self._sequence + 1) & 0xFF
+            self._send_datagram(raw)
+            self._echo_if_due()
+
+    def send_prebuilt(self, buf: bytearray, view: memoryview):
+        """
+        Send a CRTP packet built in place, without allocating a datagram.
+
+        buf is [3 bytes of room][CRTP header + data][1 byte of room] and view
+        a memoryview of it. The room is filled with the sequence number and
+        the checksum.
+        """
+        with self._tx_lock:
+            start = 3
+            if self.sequenced:
+                buf[0] = WIFI_CTRL_HEADER
+                buf[1] = WIFI_CTRL_SEQ
+                buf[2] = self._sequence
+                self._sequence = (self._sequence + 1) & 0xFF
+                start = 0
+            buf[-1] = sum(view[start:-1]) & 0xFF
+            self._send_to_socket(view[start:])
+            self._echo_if_due()
+        if self.capture:
+            self.capture.record(self.capture.SENT, view[3:-1])
+
+    def fileno(self) -> int:
+        """The socket, for a selector of the owner."""
+        return self._sock.fileno()
+
+    def poll(self):
+        """Echo the link if it is due, when nothing was sent for a while, and ping the time sync."""
+        with self._tx_lock:
+            self._echo_if_due()
+        if self._sync_unanswered < TIME_SYNC_PROBES and time.monotonic() - self._last_sync >= TIME_SYNC_PERIOD:
+            self._last_sync = time.monotonic()
+            self._sync_seq = (self._sync_seq + 1) & 0xFF
+            self._sync_unanswered += 1
+            header = (CRTP_PORT_TIME_SYNC << 4) | CRTP_LINK_BITS | TIME_SYNC_CHANNEL
+            self.send(bytes([header]) + TIME_SYNC_PING_FORMAT.pack(TIME_SYNC_PING, self._sync_seq,
+                                                                   time.time_ns() // 1000))
+
+    def read(self) -> bool:
+        """
+        Handle the next datagram of the socket, False when there was none.
+        """
+        try:
+            length = self._sock.recv_into(self._rx_buf)
+        except (BlockingIOError, socket.timeout):
+            return False
+        except OSError:
+            # The drone is not there (yet), e.g. an ICMP port unreachable
+            return False
+        self._handle_datagram(length)
+        return True
+
+    def receive(self, timeout: float = None):
+        """The next packet without a handler, None after timeout (0 does not wait)."""
+        try:
+            if timeout == 0:
+                return self._packets.get_nowait()
+            return self._packets.get(timeout=timeout)
+        except queue.Empty:
+            return None
+
+    def _send_to_socket(self, data):
+        try:
+            self._sock.send(data)
+        except ConnectionRefusedError:
+            # The ICMP port unreachable of an earlier datagram, the drone is
+            # not there (yet), this one is lost as any other on the link
+            pass
+
+    def _send_datagram(self, raw: bytes):
+        self._send_to_socket(raw + bytes([_checksum(raw)]))
+
+    def _send_echo(self):
+        with self._tx_lock:
+            self._send_echo_locked()
+
+    def _echo_if_due(self):
+        if time.monotonic() - self._last_echo >= WIFI_ECHO_PERIOD:
+            self._send_echo_locked()
+
+    def _send_echo_locked(self):
+        self._last_echo = time.monotonic()
+        struct.pack_into('<Q', self._echo_buf, 2, time.monotonic_ns() // 1000)
+        self._echo_buf[-1] = sum(self._echo_buf[:-1]) & 0xFF
+        self._send_to_socket(self._echo_buf)
+
+    def _handle_echo_reply(self, raw: bytes):
+        if len(raw) != 2 + 8 + 4:
+            return
+        sent_us, = struct.unpack_from('<Q', raw, 2)
+        self.rtt_ms = (time.monotonic_ns() // 1000 - sent_us) / 1000.0
+        if self.rtt_mean_ms is None:
+            self.rtt_mean_ms = self.rtt_ms
+        else:
+            self.rtt_mean_ms += (self.rtt_ms - self.rtt_mean_ms) / 8
+        self.sequenced = True
+        self._echoed.set()
+
+    def _handle_time_sync(self, raw: bytes):
+        received_us = time.time_ns() // 1000
+        if len(raw) != 1 + TIME_SYNC_ANSWER_FORMAT.size:
+            return
+        _, seq, t1, t2, t3 = TIME_SYNC_ANSWER_FORMAT.unpack_from(raw, 1)
+        delay_us = (received_us - t1) - (t3 - t2)
+        if seq != self._sync_seq or delay_us < 0:
+            # Late, the answer of a ping that was already given up
+            return
+        self._sync_unanswered = 0
+        self.sync_delay_us = delay_us
+        # The host time at t2, the middle of the round trip
+        self.send(raw[:1] + TIME_SYNC_SAMPLE_FORMAT.pack(TIME_SYNC_SAMPLE, t2, t1 + delay_us // 2,
+                                                         min(delay_us, 0xFFFFFFFF)))
+
+    def _handle_busy(self, raw: bytes):
+        if len(raw) != 1 + CRTP_LINK_BUSY_FORMAT.size:
+            return
+        port, _, dropped = CRTP_LINK_BUSY_FORMAT.unpack_from(raw, 1)
+        self.busy_dropped[port] = dropped
+        self._busy_until[port] = time.monotonic() + BUSY_HOLDOFF
+
+    def _handle_datagram(self, length: int):
+        for raw in _split_datagram(self._rx_view[:length]):
+            # The buffer is reused for the next datagram
+            raw = bytes(raw)
+            if not raw:
+                continue
+            if self.capture and not _is_batch_ack(raw):
+                self.capture.record(self.capture.ECHO if _is_echo_reply(raw)
+                                    else self.capture.RECEIVED, raw)
+            if _is_batch_ack(raw):
+                self.batched = raw[2] != 0
+            elif _is_echo_reply(raw):
+                self._handle_echo_reply(raw)
+            elif raw[0] >> 4 == CRTP_PORT_TIME_SYNC:
+                self._handle_time_sync(raw)
+            elif raw[0] >> 4 == CRTP_PORT_LINK and raw[0] & 0x03 == CRTP_LINK_BUSY_CHANNEL:
+                self._handle_busy(raw)
+            else:
+                handler = self._handlers.get(raw[0] >> 4)
+                if handler is None or not handler(raw):
+                    self._packets.put(raw)
+
+    def _run(self):
+        sock = self._sock
+        while self._running:
+            try:
+                length = sock.recv_into(self._rx_buf)
+            except socket.timeout:
+                self.poll()
+                continue
+            except OSError:
+                # The drone is not there (yet), e.g. an ICMP port unreachable
+                time.sleep(RECEIVE_POLL_PERIOD)
+                continue
+            self._handle_datagram(length)
+            self.poll()
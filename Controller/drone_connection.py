@@ -2,14 +2,37 @@
 Drone connection module using cflib (Crazyflie Python Library).
 
 This module provides a simple interface to connect to the ESP-Drone
-over Wi-Fi (UDP) and send AutoNav commands.
+over Wi-Fi (UDP) and send AutoNav commands. Over Wi-Fi the setpoints and
+the AutoNav commands and status go through the CrtpUdpClient of crtp_udp.py
+instead of the queues and threads of cflib, which keeps the TOC, param and
+log management.
 """
 
+import json
+import os
+import re
+import socket
 import struct
 import logging
+import queue
+import threading
+import time
+from typing import NamedTuple
 import cflib.crtp
 from cflib.crazyflie import Crazyflie
+from cflib.crazyflie.log import LogTocElement
+from cflib.crazyflie.param import ParamTocElement
 from cflib.crazyflie.syncCrazyflie import SyncCrazyflie
+from cflib.crazyflie.toc import Toc
+from cflib.crazyflie.toccache import TocCache
+from cflib.crtp.crtpdriver import CRTPDriver
+from cflib.crtp.crtpstack import CRTPPacket
+from cflib.crtp.exceptions import WrongUriType
+from cflib.crtp.udpdriver import UdpDriver
+import trajectory
+from crtp_udp import (CRTP_LARGE_MAX_DATA_SIZE, CRTP_LINK_BITS, WIFI_CTRL_HEADER, WIFI_CTRL_LARGE,
+                      CrtpUdpClient, _checksum, _is_batch_ack, _split_datagram)
+from telemetry import TelemetryPipeline
 
 # AutoNav CRTP configuration (matches firmware)
 AUTONAV_CRTP_PORT = 0x0D  # CRTP_PORT_PLATFORM
@@ -24,55 +47,816 @@ class AutoNavCommand:
     TRI = 4
     PENTAGON = 5  # Shape ID 5 for pentagon
     SET_ALT_MM = 5
+    MISSION = 6  # Fly the uploaded mission, see autonav_mission.py
     OVERRIDE_ON = 10
     OVERRIDE_OFF = 11
 
 
+# AutoNav status, pushed by the firmware every 100 ms (autonav_status_t)
+class AutoNavStatus(NamedTuple):
+    state: int        # AUTONAV_STATE_NAMES of telemetry.py
+    alt_mm: int       # latest down range, 0 if none
+    obstacle_mm: int  # nearest obstacle all around, 0xFFFF if none
+    cmd_age_ms: int   # since the last command, saturates at 0xFFFF
+    hold_ms: int      # held in front of an obstacle, 0 when not holding
+
+    FORMAT = struct.Struct('<BHHHH')
+
+
+# Manual control setpoint (matches firmware crtp_commander_rpyt.c)
+CRTP_PORT_SETPOINT = 0x03
+# Generic setpoints (matches firmware crtp_commander_generic.c)
+CRTP_PORT_SETPOINT_GENERIC = 0x07
+GENERIC_SETPOINT_STOP = 0
+
+
+# TOC memories (matches firmware mem.h)
+CRTP_PORT_MEM = 0x04
+MEM_SETTINGS_CH = 0
+MEM_READ_CH = 1
+MEM_CMD_GET_NBR = 1
+MEM_CMD_GET_INFO = 2
+MEM_TYPE_LOG_TOC = 0x20
+MEM_TYPE_PARAM_TOC = 0x21
+MEM_TOC_BLOB_VERSION = 1
+MEM_TOC_BLOB_HEADER_SIZE = 7
+MEM_READ_MAX_LEN = 24
+MEM_READ_HEADER_SIZE = 6
+
+# Trajectory upload to flash (matches firmware crtp_commander_high_level.c)
+MEM_WRITE_CH = 2
+MEM_TYPE_TRAJ_FLASH = 0x23
+MEM_WRITE_MAX_LEN = 24
+CRTP_PORT_SETPOINT_HL = 0x08
+HL_COMMAND_DEFINE_TRAJECTORY = 6
+TRAJECTORY_LOCATION_FLASH = 2
+TRAJECTORY_TYPE_POLY4D = 0
+TRAJECTORY_TYPE_POLY4D_COMPRESSED = 1
+
+# Deferred debug prints (matches firmware debug_deferred.h and console.c)
+CRTP_PORT_CONSOLE = 0x00
+CONSOLE_RECORD_CH = 1
+CONSOLE_NO_RECORD_START = 0xFF
+DLOG_RECORD_HEADER_SIZE = 7
+DLOG_TABLE_VERSION = 1
+
+# Link capture of tools/linkcap/linkcap.py
+LINK_CAPTURE_VERSION = 1
+
+# USB CDC link of the S2 and S3 (matches firmware usbcdclink.h)
+USBCDC_URI_SCHEME = 'usbcdc://'
+USBCDC_FRAME_SYNC = 0xA5
+USBCDC_MAX_LENGTH = 31  # CRTP header and data
+
+DEFAULT_TOC_CACHE_DIR = os.path.join(os.path.expanduser('~'), '.cache', 'esp-drone', 'toc')
+
+
+class DeferredLogDecoder:
+    """
+    Formats the deferred debug prints of the firmware, with the table
+    extracted from the firmware .elf by tools/dlog/dlog.py.
+
+    Records are a byte stream spread over console channel 1 packets. The
+    first byte of every packet is the offset of the first record starting
+    in it, a record cut by a lost packet is dropped there.
+    """
+
+    _SPEC = re.compile(r'%([-+ #0]*\d*(?:\.\d+)?)(hh|h|ll|l|z|j|t)?([diouxXcfFeEgGsp%])')
+
+    def __init__(self, table_path: str):
+        with open(table_path) as f:
+            table = json.load(f)
+        if table.get('version') != DLOG_TABLE_VERSION:
+            raise ValueError(f'Unknown dlog table version {table.get("version")}')
+        self.formats = {int(k): v for k, v in table['formats'].items()}
+        self.strings = {int(k): v for k, v in table['strings'].items()}
+        self.pending = bytearray()
+        self.synced = False
+        self.logger = logging.getLogger('drone')
+
+    def feed(self, data: bytes):
+        """Handle the data of a console channel 1 packet."""
+        if not data:
+            return
+        start, payload = data[0], bytes(data[1:])
+
+        if start == CONSOLE_NO_RECORD_START:
+            if self.synced:
+                self.pending += payload
+        else:
+            if self.synced:
+                self.pending += payload[:start]
+                if self._record_length(self.pending) != len(self.pending):
+                    self.pending = bytearray()
+            self.pending = self.pending + payload[start:] if self.synced else bytearray(payload[start:])
+            self.synced = True
+
+        self._decode_records()
+
+    @staticmethod
+    def _record_length(data) -> int:
+        return DLOG_RECORD_HEADER_SIZE + 4 * data[0] if data else 0
+
+    def _decode_records(self):
+        while len(self.pending) >= DLOG_RECORD_HEADER_SIZE and \
+              len(self.pending) >= self._record_length(self.pending):
+            length = self._record_length(self.pending)
+            record, self.pending = bytes(self.pending[:length]), self.pending[length:]
+            count, fmt_id, timestamp = struct.unpack_from('<BHI', record)
+            args = struct.unpack_from(f'<{count}I', record, DLOG_RECORD_HEADER_SIZE)
+            self.logger.info(f'[{timestamp}] {self.format(fmt_id, args).rstrip()}')
+
+    def format(self, fmt_id: int, args) -> str:
+        fmt = self.formats.get(fmt_id)
+        if fmt is None:
+            return f'<unknown print {fmt_id}> {" ".join(f"0x{a:08x}" for a in args)}'
+
+        words = iter(args)
+
+        def convert(match):
+            flags, _, conv = match.groups()
+            if conv == '%':
+                return '%'
+            word = next(words, 0)
+            if conv in 'di':
+                value = struct.unpack('<i', struct.pack('<I', word))[0]
+            elif conv in 'fFeEgG':
+                value = struct.unpack('<f', struct.pack('<I', word))[0]
+            elif conv == 's':
+                value = self.strings.get(word, f'<0x{word:08x}>')
+            elif conv == 'p':
+                return f'0x{word:08x}'
+            elif conv == 'c':
+                value = chr(word & 0xFF)
+            else:
+                value = word
+            return ('%' + flags + conv.replace('F', 'f')) % value
+
+        return self._SPEC.sub(convert, fmt)
+
+
+class LinkCaptureWriter:
+    """
+    Writes the CRTP packets sent and received by CrtpUdpClient to a link
+    capture, in the format of Firmware/esp-drone/tools/linkcap/linkcap.py.
+
+    Packets are timestamped as they leave and reach the socket. The echo
+    replies are kept too, the capture of the firmware is aligned with them.
+    """
+
+    SENT = 0
+    RECEIVED = 5
+    ECHO = 6
+
+    def __init__(self, path: str):
+        self.origin_us = time.monotonic_ns() // 1000
+        self._lock = threading.Lock()
+        self._file = open(path, 'wb')
+        self._file.write(struct.pack('<4sBBHQ', b'LCAP', LINK_CAPTURE_VERSION, 0, 0, self.origin_us))
+
+    def record(self, event: int, raw):
+        timestamp = (time.monotonic_ns() // 1000 - self.origin_us) & 0xFFFFFFFF
+        data = bytes(raw[1:])
+        with self._lock:
+            self._file.write(struct.pack('<IBBBB', timestamp, event, raw[0], len(data),
+                                         sum(data) & 0xFF) + data)
+
+    def flush(self):
+        with self._lock:
+            self._file.flush()
+
+
+class BatchedUdpDriver(UdpDriver):
+    """
+    cflib UDP driver on top of a CrtpUdpClient, which owns the socket.
+
+    The client asks the firmware to pack several CRTP packets into one
+    datagram, firmware without batching keeps sending one packet per
+    datagram. It also measures the round trip time and numbers the
+    datagrams, see CrtpUdpClient. The client is the driver's client
+    attribute, for the packets that bypass cflib.
+
+    Deferred debug prints are handed to dlog_decoder instead of cflib, whose
+    console would take them for text.
+
+    With a capture, every CRTP packet is also written to it.
+    """
+
+    dlog_decoder = None
+    capture = None
+
+    def connect(self, uri, linkQualityCallback, linkErrorCallback):
+        match = re.fullmatch(r'udp://([^:/]+):(\d+)/?', uri)
+        if not match:
+            raise WrongUriType('Not an UDP URI')
+        self.addr = (match.group(1), int(match.group(2)))
+        self.client = CrtpUdpClient(self.addr, self.capture)
+        self.client.add_port_handler(CRTP_PORT_CONSOLE, self._handle_console)
+        self.client.open()
+
+    def _handle_console(self, raw: bytes) -> bool:
+        if (raw[0] & 0x03) != CONSOLE_RECORD_CH:
+            return False
+        if self.dlog_decoder:
+            self.dlog_decoder.feed(raw[1:])
+        return True
+
+    def send_packet(self, pk):
+        self.client.send(bytes([pk.header]) + bytes(pk.datat))
+
+    def send_prebuilt(self, buf: bytearray, view: memoryview):
+        """See CrtpUdpClient.send_prebuilt()."""
+        self.client.send_prebuilt(buf, view)
+
+    def receive_packet(self, time=0):
+        raw = self.client.receive(None if time < 0 else time)
+        return CRTPPacket(raw[0], list(raw[1:])) if raw else None
+
+    def close(self):
+        self.client.close()
+
+
+class UsbCdcDriver(CRTPDriver):
+    """
+    cflib driver for the USB CDC link of the firmware on the ESP32-S2 and S3,
+    with URIs like usbcdc:///dev/ttyACM0 or usbcdc://COM5. Needs pyserial.
+
+    The firmware takes CRTP over USB while the port is open, the packets are
+    framed as [sync][length][header + data][checksum] on the byte stream. A
+    thread reads the port, frames that do not check out are dropped.
+
+    Deferred debug prints and the capture are handled like BatchedUdpDriver
+    does, send_prebuilt() takes the same buffers.
+    """
+
+    dlog_decoder = None
+    capture = None
+
+    def __init__(self):
+        super().__init__()
+        self._serial = None
+        self._reader = None
+        self._packets = queue.Queue()
+        self._tx_lock = threading.Lock()
+        self._link_error_callback = None
+
+    def connect(self, uri, linkQualityCallback, linkErrorCallback):
+        if not uri.startswith(USBCDC_URI_SCHEME):
+            raise WrongUriType('Not a USB CDC URI')
+        import serial
+
+        self._link_error_callback = linkErrorCallback
+        # Opening the port sets DTR, which hands the link over to the USB
+        self._serial = serial.Serial(uri[len(USBCDC_URI_SCHEME):], timeout=0.1)
+        self._reader = threading.Thread(target=self._read, daemon=True)
+        self._reader.start()
+
+    def _write_frame(self, raw):
+        frame = bytes([USBCDC_FRAME_SYNC, len(raw)]) + bytes(raw) + bytes([_checksum(raw)])
+        with self._tx_lock:
+            self._serial.write(frame)
+        if self.capture:
+            self.capture.record(LinkCaptureWriter.SENT, raw)
+
+    def send_packet(self, pk):
+        self._write_frame(bytes([pk.header]) + bytes(pk.datat))
+
+    def send_prebuilt(self, buf: bytearray, view: memoryview):
+        """Send a packet built for CrtpUdpClient.send_prebuilt()."""
+        self._write_frame(view[3:-1])
+
+    def _handle(self, raw: bytes):
+        if self.capture:
+            self.capture.record(LinkCaptureWriter.RECEIVED, raw)
+        if raw[0] >> 4 == CRTP_PORT_CONSOLE and (raw[0] & 0x03) == CONSOLE_RECORD_CH:
+            if self.dlog_decoder:
+                self.dlog_decoder.feed(raw[1:])
+        else:
+            self._packets.put(CRTPPacket(raw[0], list(raw[1:])))
+
+    def _read(self):
+        stream = bytearray()
+        serial_port = self._serial
+        try:
+            while serial_port.is_open:
+                stream += serial_port.read(max(1, serial_port.in_waiting))
+                while True:
+                    start = stream.find(USBCDC_FRAME_SYNC)
+                    if start < 0:
+                        stream.clear()
+                        break
+                    del stream[:start]
+                    if len(stream) < 2:
+                        break
+                    length = stream[1]
+                    if length == 0 or length > USBCDC_MAX_LENGTH:
+                        del stream[:1]
+                        continue
+                    if len(stream) < 2 + length + 1:
+                        break
+                    raw = bytes(stream[2:2 + length])
+                    if _checksum(raw) != stream[2 + length]:
+                        # Not a frame, look for the next sync byte
+                        del stream[:1]
+                        continue
+                    del stream[:2 + length + 1]
+                    self._handle(raw)
+        except Exception as e:
+            if self._serial is serial_port and self._link_error_callback:
+                self._link_error_callback(f'USB CDC link: {e}')
+
+    def receive_packet(self, wait=0):
+        try:
+            if wait == 0:
+                return self._packets.get_nowait()
+            return self._packets.get(timeout=None if wait < 0 else wait)
+        except queue.Empty:
+            return None
+
+    def get_status(self):
+        return 'Ok' if self._serial and self._serial.is_open else 'Closed'
+
+    def get_name(self):
+        return 'usbcdc'
+
+    def scan_interface(self, address=None):
+        return []
+
+    def close(self):
+        serial_port, self._serial = self._serial, None
+        if serial_port:
+            serial_port.close()
+        if self._reader:
+            self._reader.join(timeout=1.0)
+            self._reader = None
+
+
+def _use_batched_udp_driver():
+    """
+    Replace the cflib UDP driver and add the USB CDC one, init_drivers() must
+    have been called.
+    """
+    has_instances = False
+    for i, driver in enumerate(cflib.crtp.CLASSES):
+        if driver is UdpDriver:
+            cflib.crtp.CLASSES[i] = BatchedUdpDriver
+        elif isinstance(driver, UdpDriver):
+            cflib.crtp.CLASSES[i] = BatchedUdpDriver()
+            has_instances = True
+    cflib.crtp.CLASSES.append(UsbCdcDriver() if has_instances else UsbCdcDriver)
+
+
+class ManualControlSender:
+    """
+    Sends the manual control setpoint from a thread of its own, so its timing
+    does not depend on the GUI.
+
+    A new setpoint is sent right away, several within MIN_INTERVAL are
+    coalesced into one. An unchanged setpoint is repeated every
+    HEARTBEAT_PERIOD on a monotonic schedule, well within the commander
+    watchdog of the firmware. The packet is built once and the setpoint
+    packed into it in place.
+
+    The driver is the CrtpUdpClient or the UsbCdcDriver of the link.
+    """
+
+    MIN_INTERVAL = 0.01     # s, 100 Hz at most
+    HEARTBEAT_PERIOD = 0.05  # s
+
+    _SETPOINT = struct.Struct('<fffH')
+
+    def __init__(self, driver, logger: logging.Logger):
+        self.driver = driver
+        self.logger = logger
+        # [seq room][header][roll, pitch, yawrate, thrust][checksum]
+        self._buf = bytearray(3 + 1 + self._SETPOINT.size + 1)
+        self._buf[3] = (CRTP_PORT_SETPOINT << 4) | CRTP_LINK_BITS
+        self._view = memoryview(self._buf)
+        self._condition = threading.Condition()
+        self._setpoint = None   # Nothing is sent before the first set()
+        self._changed = False
+        self._running = True
+        self._thread = threading.Thread(target=self._run, name='manual-control', daemon=True)
+        self._thread.start()
+
+    def set(self, roll: float, pitch: float, yawrate: float, thrust: int):
+        setpoint = (roll, pitch, yawrate, thrust)
+        with self._condition:
+            if setpoint != self._setpoint:
+                self._setpoint = setpoint
+                self._changed = True
+                self._condition.notify()
+
+    def stop(self):
+        """Stop sending, returns once the thread is done."""
+        with self._condition:
+            self._running = False
+            self._condition.notify()
+        self._thread.join()
+
+    def _wait(self, last_send: float, next_heartbeat: float):
+        """
+        Wait for the next send.
+
+        Returns:
+            (setpoint, changed), setpoint is None once stopped
+        """
+        with self._condition:
+            while self._running:
+                now = time.monotonic()
+                if self._changed:
+                    deadline = min(next_heartbeat, last_send + self.MIN_INTERVAL)
+                elif self._setpoint is not None:
+                    deadline = next_heartbeat
+                else:
+                    deadline = None
+                if deadline is not None and now >= deadline:
+                    changed = self._changed
+                    self._changed = False
+                    return self._setpoint, changed
+                self._condition.wait(None if deadline is None else deadline - now)
+        return None, False
+
+    def _run(self):
+        last_send = 0.0
+        next_heartbeat = time.monotonic()
+
+        while True:
+            setpoint, changed = self._wait(last_send, next_heartbeat)
+            if setpoint is None:
+                return
+
+            roll, pitch, yawrate, thrust = setpoint
+            # Pitch is sent inverted, as by cflib's commander
+            self._SETPOINT.pack_into(self._buf, 4, roll, -pitch, yawrate, thrust)
+            try:
+                self.driver.send_prebuilt(self._buf, self._view)
+            except OSError as e:
+                self.logger.error(f"Failed to send manual control: {e}")
+
+            now = time.monotonic()
+            last_send = now
+            # A change restarts the heartbeats, a late heartbeat is not caught up on
+            next_heartbeat += self.HEARTBEAT_PERIOD
+            if changed or next_heartbeat <= now:
+                next_heartbeat = now + self.HEARTBEAT_PERIOD
+
+
+class UdpMemoryClient:
+    """
+    Reads and writes the memories of the firmware on the mem port, over its
+    own socket and without cflib. A firmware with CONFIG_CRTP_LARGE_FRAMES
+    answers the reads in datagrams of up to 1 KB, else they are cut to the
+    classic packets.
+    """
+
+    WINDOW = 16
+
+    def __init__(self, ip_address: str, port: int, timeout: float = 0.3, retries: int = 5):
+        self.addr = (ip_address, port)
+        self.timeout = timeout
+        self.retries = retries
+        self.logger = logging.getLogger(__name__)
+        self.sock = None
+        self.read_max_len = MEM_READ_MAX_LEN
+
+    def open(self):
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self._negotiate_large_frames()
+
+    def close(self):
+        self.sock.close()
+
+    def _negotiate_large_frames(self):
+        """Ask for large frames, older firmware does not answer."""
+        raw = struct.pack('<BBH', WIFI_CTRL_HEADER, WIFI_CTRL_LARGE, CRTP_LARGE_MAX_DATA_SIZE)
+        self.sock.sendto(raw + bytes([_checksum(raw)]), self.addr)
+        deadline = time.monotonic() + self.timeout
+        while time.monotonic() < deadline:
+            self.sock.settimeout(deadline - time.monotonic())
+            try:
+                datagram, _ = self.sock.recvfrom(2048)
+            except socket.timeout:
+                break
+            for raw in _split_datagram(datagram):
+                if len(raw) == 4 and raw[0] == WIFI_CTRL_HEADER and raw[1] == WIFI_CTRL_LARGE:
+                    accepted = struct.unpack('<H', raw[2:4])[0]
+                    if accepted > MEM_READ_HEADER_SIZE + MEM_READ_MAX_LEN:
+                        self.read_max_len = accepted - MEM_READ_HEADER_SIZE
+                    self.logger.info(f'Large frames of {accepted} bytes')
+                    return
+        self.logger.info('No large frames, classic reads')
+
+    def _send(self, channel: int, data: bytes):
+        header = (CRTP_PORT_MEM << 4) | 0x0C | channel
+        raw = bytes([header]) + data
+        self.sock.sendto(raw + bytes([_checksum(raw)]), self.addr)
+
+    def _receive(self, deadline: float):
+        """Mem port packets received before deadline, as (channel, payload)."""
+        remaining = deadline - time.monotonic()
+        if remaining <= 0:
+            return []
+        self.sock.settimeout(remaining)
+        try:
+            datagram, _ = self.sock.recvfrom(2048)
+        except socket.timeout:
+            return []
+        return [(raw[0] & 0x03, raw[1:]) for raw in _split_datagram(datagram)
+                if raw and not _is_batch_ack(raw) and raw[0] >> 4 == CRTP_PORT_MEM]
+
+    def _request(self, data: bytes, min_len: int) -> bytes:
+        """Send a settings request and return the matching reply."""
+        for _ in range(self.retries):
+            self._send(MEM_SETTINGS_CH, data)
+            deadline = time.monotonic() + self.timeout
+            while time.monotonic() < deadline:
+                for channel, payload in self._receive(deadline):
+                    if channel == MEM_SETTINGS_CH and len(payload) >= min_len and \
+                       payload[:len(data)] == data:
+                        return payload
+        raise TimeoutError(f'No reply to mem request {data.hex()}')
+
+    def _find_memories(self, mem_types):
+        """Map of memory type to (memory id, size) for the memories of mem_types."""
+        nbr = self._request(bytes([MEM_CMD_GET_NBR]), 2)[1]
+        memories = {}
+        for mem_id in range(nbr):
+            info = self._request(bytes([MEM_CMD_GET_INFO, mem_id]), 7)
+            mem_type = info[2]
+            if mem_type in mem_types:
+                memories[mem_type] = (mem_id, struct.unpack('<I', info[3:7])[0])
+        return memories
+
+    def _read(self, mem_id: int, start: int, length: int) -> bytes:
+        """Read memory, keeping up to WINDOW reads in flight."""
+        chunks = {}
+        addrs = list(range(start, start + length, self.read_max_len))
+        for _ in range(self.retries):
+            missing = [a for a in addrs if a not in chunks]
+            for i in range(0, len(missing), self.WINDOW):
+                wanted = set(missing[i:i + self.WINDOW])
+                for addr in wanted:
+                    size = min(self.read_max_len, start + length - addr)
+                    # The 16 bit length of the large reads
+                    fmt = '<BIB' if size <= MEM_READ_MAX_LEN else '<BIH'
+                    self._send(MEM_READ_CH, struct.pack(fmt, mem_id, addr, size))
+
+                deadline = time.monotonic() + self.timeout
+                while wanted and time.monotonic() < deadline:
+                    for channel, payload in self._receive(deadline):
+                        if channel != MEM_READ_CH or len(payload) < 6 or payload[0] != mem_id:
+                            continue
+                        addr, status = struct.unpack('<IB', payload[1:6])
+                        if status == 0 and addr in wanted:
+                            chunks[addr] = payload[6:]
+                            wanted.discard(addr)
+            if len(chunks) == len(addrs):
+                return b''.join(chunks[a] for a in addrs)
+        raise TimeoutError(f'Could not read memory {mem_id}')
+
+    def _write(self, mem_id: int, addr: int, data: bytes) -> bool:
+        """Write up to MEM_WRITE_MAX_LEN bytes, True if the firmware took them."""
+        request = struct.pack('<BI', mem_id, addr)
+        for _ in range(self.retries):
+            self._send(MEM_WRITE_CH, request + data)
+            deadline = time.monotonic() + self.timeout
+            while time.monotonic() < deadline:
+                for channel, payload in self._receive(deadline):
+                    if channel == MEM_WRITE_CH and len(payload) >= 6 and payload[:5] == request:
+                        return payload[5] == 0
+        raise TimeoutError(f'No reply to the write of memory {mem_id}')
+
+
+class TocPrefetcher(UdpMemoryClient):
+    """
+    Reads the log and param TOCs from the TOC memories of the firmware into
+    the cflib TOC cache, before cflib connects.
+
+    cflib looks the TOCs up in the cache by CRC and only downloads them one
+    variable at a time on a miss. A TOC that is already cached costs a
+    single read of its header.
+    """
+
+    def __init__(self, ip_address: str, port: int, cache_dir: str,
+                 timeout: float = 0.3, retries: int = 5):
+        super().__init__(ip_address, port, timeout, retries)
+        self.cache = TocCache(rw_cache=cache_dir)
+
+    def run(self) -> bool:
+        """
+        Returns:
+            bool: True if both TOCs are in the cache
+        """
+        self.open()
+        try:
+            memories = self._find_memories((MEM_TYPE_LOG_TOC, MEM_TYPE_PARAM_TOC))
+            cached = 0
+            for mem_type, element_class in ((MEM_TYPE_LOG_TOC, LogTocElement),
+                                             (MEM_TYPE_PARAM_TOC, ParamTocElement)):
+                if mem_type in memories and self._fetch(*memories[mem_type], element_class):
+                    cached += 1
+            return cached == 2
+        finally:
+            self.close()
+
+    def _fetch(self, mem_id: int, size: int, element_class) -> bool:
+        header = self._read(mem_id, 0, MEM_TOC_BLOB_HEADER_SIZE)
+        version, crc, count = struct.unpack('<BIH', header)
+        if version != MEM_TOC_BLOB_VERSION:
+            self.logger.info(f'Unknown TOC blob version {version}')
+            return False
+        if self.cache.fetch(crc):
+            return True
+
+        blob = self._read(mem_id, MEM_TOC_BLOB_HEADER_SIZE, size - MEM_TOC_BLOB_HEADER_SIZE)
+        toc = Toc()
+        group = b''
+        ident = 0
+        i = 0
+        while i < len(blob):
+            end = blob.index(b'\0', i + 1)
+            type_byte, name = blob[i], blob[i + 1:end]
+            i = end + 1
+            if type_byte & 0x80:
+                group = name
+                continue
+            # Same bytes as the TOC item reply of the firmware
+            toc.add_element(element_class(ident, bytes([type_byte]) + group + b'\0' + name + b'\0'))
+            ident += 1
+
+        if ident != count:
+            self.logger.info(f'TOC blob has {ident} variables, expected {count}')
+            return False
+
+        self.cache.insert(crc, toc.toc)
+        self.logger.info(f'Cached TOC {crc:08X} with {count} variables')
+        return True
+
+
+class TrajectoryUploader:
+    """
+    Writes a trajectory to the traj flash partition of the firmware, through
+    the MEM_TYPE_TRAJ_FLASH memory of a connected Crazyflie.
+
+    The write at address 0 starts the upload and is acked before the rest is
+    sent, then up to WINDOW writes are kept in flight. The firmware erases
+    the flash sectors as the writes reach them and refuses writes while
+    armed or flying a high-level trajectory.
+    """
+
+    WINDOW = 16
+
+    def __init__(self, cf: Crazyflie, timeout: float = 0.5, retries: int = 5):
+        self.cf = cf
+        self.timeout = timeout
+        self.retries = retries
+        self.acks = {}
+        self.ack_condition = threading.Condition()
+
+    def upload(self, data: bytes):
+        mems = self.cf.mem.get_mems(MEM_TYPE_TRAJ_FLASH)
+        if not mems:
+            raise RuntimeError('The firmware has no trajectory flash memory')
+        mem_id = mems[0].id
+        if len(data) > mems[0].size:
+            raise ValueError(f'Trajectory of {len(data)} bytes, the flash holds {mems[0].size}')
+
+        self.cf.add_port_callback(CRTP_PORT_MEM, self._packet_received)
+        try:
+            self._write(mem_id, data, [0])
+            self._write(mem_id, data, list(range(MEM_WRITE_MAX_LEN, len(data), MEM_WRITE_MAX_LEN)))
+        finally:
+            self.cf.remove_port_callback(CRTP_PORT_MEM, self._packet_received)
+
+    def _packet_received(self, packet):
+        if packet.channel != MEM_WRITE_CH or len(packet.data) < 6:
+            return
+        mem_id, addr, status = struct.unpack('<BIB', packet.data[:6])
+        with self.ack_condition:
+            self.acks[(mem_id, addr)] = status
+            self.ack_condition.notify()
+
+    def _write(self, mem_id: int, data: bytes, addrs):
+        done = set()
+        for _ in range(self.retries):
+            missing = [a for a in addrs if a not in done]
+            for i in range(0, len(missing), self.WINDOW):
+                wanted = set(missing[i:i + self.WINDOW])
+                with self.ack_condition:
+                    for addr in wanted:
+                        self.acks.pop((mem_id, addr), None)
+                for addr in wanted:
+                    packet = CRTPPacket()
+                    packet.set_header(CRTP_PORT_MEM, MEM_WRITE_CH)
+                    packet.data = struct.pack('<BI', mem_id, addr) + data[addr:addr + MEM_WRITE_MAX_LEN]
+                    self.cf.send_packet(packet)
+
+                deadline = time.monotonic() + self.timeout
+                with self.ack_condition:
+                    while wanted and time.monotonic() < deadline:
+                        for addr in list(wanted):
+                            status = self.acks.get((mem_id, addr))
+                            if status is None:
+                                continue
+                            if status != 0:
+                                raise RuntimeError(f'Trajectory write at {addr} refused ({status})')
+                            done.add(addr)
+                            wanted.discard(addr)
+                        if wanted:
+                            self.ack_condition.wait(deadline - time.monotonic())
+            if len(done) == len(addrs):
+                return
+        raise TimeoutError('Trajectory upload timed out')
+
+
 class DroneConnection:
     """Manages connection to ESP-Drone and AutoNav command sending."""
 
-    def __init__(self):
-        """Initialize the drone connection manager."""
+    def __init__(self, toc_cache_dir: str = DEFAULT_TOC_CACHE_DIR, dlog_table: str = None,
+                 capture_path: str = None):
+        """
+        Initialize the drone connection manager.
+
+        Args:
+            toc_cache_dir: Directory of the persistent log/param TOC cache
+            dlog_table: dlog_table.json of the firmware build, to show its
+                deferred debug prints
+            capture_path: File to capture the link traffic to, for
+                tools/linkcap/linkcap.py of the firmware
+        """
+        self.toc_cache_dir = toc_cache_dir
+        os.makedirs(toc_cache_dir, exist_ok=True)
         self.scf = None
         self.cf = None
         self.connected = False
         self.uri = None
+        self.control_sender = None
+        self.telemetry = None
+        self.link_client = None     # CrtpUdpClient of a Wi-Fi connection
+        self.autonav_status = None  # Latest AutoNavStatus, None before the first
 
         # Initialize cflib drivers (only needs to be done once)
         cflib.crtp.init_drivers()
+        _use_batched_udp_driver()
 
         # Setup logging
         logging.basicConfig(level=logging.INFO)
         self.logger = logging.getLogger(__name__)
 
+        if dlog_table:
+            BatchedUdpDriver.dlog_decoder = UsbCdcDriver.dlog_decoder = DeferredLogDecoder(dlog_table)
+        if capture_path:
+            BatchedUdpDriver.capture = UsbCdcDriver.capture = LinkCaptureWriter(capture_path)
+
     def connect(self, ip_address: str, port: int = 2390) -> bool:
         """
-        Connect to the drone via Wi-Fi (UDP).
+        Connect to the drone via Wi-Fi (UDP), or over USB on the S2 and S3.
 
         Args:
-            ip_address: Drone's IP address (e.g., "192.168.4.1")
-            port: UDP port (default: 2390, from firmware)
+            ip_address: Drone's IP address (e.g., "192.168.4.1"), or a
+                usbcdc:// URI of its serial port (e.g. "usbcdc:///dev/ttyACM0")
+            port: UDP port (default: 2390, from firmware), unused over USB
 
         Returns:
             bool: True if connection successful, False otherwise
         """
         try:
-            # Build UDP URI for cflib
-            self.uri = f"udp://{ip_address}:{port}"
+            if ip_address.startswith(USBCDC_URI_SCHEME):
+                # The TOCs come fast enough over USB, no prefetch
+                self.uri = ip_address
+            else:
+                # Build UDP URI for cflib
+                self.uri = f"udp://{ip_address}:{port}"
             self.logger.info(f"Connecting to drone at {self.uri}...")
 
+            # Fill the TOC cache so cflib does not download the TOCs
+            if self.uri.startswith('udp://'):
+                try:
+                    TocPrefetcher(ip_address, port, self.toc_cache_dir).run()
+                except (OSError, TimeoutError) as e:
+                    self.logger.info(f"TOC prefetch skipped: {e}")
+
             # Create SyncCrazyflie instance for synchronous operations
-            self.scf = SyncCrazyflie(self.uri, connection_timeout=5.0)
+            cf = Crazyflie(rw_cache=self.toc_cache_dir)
+            self.scf = SyncCrazyflie(self.uri, cf=cf, connection_timeout=5.0)
             self.scf.open_link()
             self.cf = self.scf.cf
+            if isinstance(self.cf.link, BatchedUdpDriver):
+                self.link_client = self.cf.link.client
+                self.link_client.add_port_handler(AUTONAV_CRTP_PORT, self._handle_autonav_status)
 
             # Verify connection by checking if we can get parameters
             # The drone should respond to parameter requests if it's actually connected
             self.logger.info("Verifying drone connection...")
 
-            # Try to access the parameter table of contents (TOC)
-            # This will fail if the drone is not actually responding
-            if not self.cf.param.is_updated:
+            if self.link_client and self.link_client.wait_for_echo(1.0):
+                # The firmware answered an echo of the link, the param values
+                # are left to download in the background
+                pass
+            elif not self.cf.param.is_updated:
+                # Try to access the parameter table of contents (TOC)
+                # This will fail if the drone is not actually responding
                 # Wait up to 3 seconds for parameter TOC to be fetched
                 import time
                 timeout = 3.0
@@ -85,6 +869,12 @@ class DroneConnection:
 
             self.connected = True
             self.logger.info(f"Successfully connected and verified {self.uri}")
+
+            self.telemetry = TelemetryPipeline(self.cf, self.logger)
+            try:
+                self.telemetry.start()
+            except Exception as e:
+                self.logger.error(f"Telemetry not started: {e}")
             return True
 
         except Exception as e:
@@ -98,10 +888,17 @@ class DroneConnection:
                     pass
                 self.scf = None
             self.cf = None
+            self.link_client = None
             return False
 
     def disconnect(self):
         """Disconnect from the drone."""
+        self._stop_control_sender()
+        if BatchedUdpDriver.capture:
+            BatchedUdpDriver.capture.flush()
+        if self.telemetry:
+            self.telemetry.stop()
+            self.telemetry = None
         if self.scf:
             try:
                 self.scf.close_link()
@@ -112,11 +909,19 @@ class DroneConnection:
         self.connected = False
         self.scf = None
         self.cf = None
+        self.link_client = None
+        self.autonav_status = None
 
     def is_connected(self) -> bool:
         """Check if connected to drone."""
         return self.connected and self.cf is not None
 
+    def _handle_autonav_status(self, raw: bytes) -> bool:
+        """On the receive thread of the client, the firmware pushes nothing else on the port."""
+        if len(raw) == 1 + AutoNavStatus.FORMAT.size:
+            self.autonav_status = AutoNavStatus(*AutoNavStatus.FORMAT.unpack_from(raw, 1))
+        return True
+
     def _send_autonav_command(self, command: int, payload: bytes = b''):
         """
         Send an AutoNav command to the drone.
@@ -133,12 +938,17 @@ class DroneConnection:
             # Build CRTP packet data: [command_byte] + payload
             data = bytes([command]) + payload
 
-            # Send via cflib's send_packet
-            self.cf.send_packet(
-                data=data,
-                port=AUTONAV_CRTP_PORT,
-                channel=AUTONAV_CRTP_CHANNEL
-            )
+            if self.link_client:
+                # Straight to the socket, not behind the cflib queues
+                header = (AUTONAV_CRTP_PORT << 4) | CRTP_LINK_BITS | AUTONAV_CRTP_CHANNEL
+                self.link_client.send(bytes([header]) + data)
+            else:
+                # Send via cflib's send_packet
+                self.cf.send_packet(
+                    data=data,
+                    port=AUTONAV_CRTP_PORT,
+                    channel=AUTONAV_CRTP_CHANNEL
+                )
             self.logger.debug(f"Sent AutoNav command: {command}, payload: {payload.hex()}")
 
         except Exception as e:
@@ -183,6 +993,11 @@ class DroneConnection:
         payload = struct.pack('<H', altitude_mm)
         self._send_autonav_command(AutoNavCommand.SET_ALT_MM, payload)
 
+    def send_mission(self):
+        """Fly the mission uploaded with autonav_mission.py."""
+        self.logger.info("Starting the uploaded mission")
+        self._send_autonav_command(AutoNavCommand.MISSION)
+
     def send_manual_override(self, enable: bool):
         """
         Enable or disable manual override mode.
@@ -195,12 +1010,18 @@ class DroneConnection:
         self.logger.info(f"Manual override {mode}")
         self._send_autonav_command(cmd)
 
+    def _stop_control_sender(self):
+        if self.control_sender:
+            self.control_sender.stop()
+            self.control_sender = None
+
     def send_manual_control(self, roll: float, pitch: float, yawrate: float, thrust: int):
         """
-        Send manual control setpoint to the drone.
+        Set the manual control setpoint of the drone.
 
-        This must be called continuously (every 10ms recommended) to maintain control.
-        If setpoints stop arriving, the drone will automatically stop for safety.
+        The setpoint is sent by a ManualControlSender right away and repeated
+        until the next call or send_stop_setpoint(), so this only needs to be
+        called when the input changes.
 
         Args:
             roll: Roll angle in degrees (-30 to 30, positive = right)
@@ -219,8 +1040,9 @@ class DroneConnection:
             yawrate = max(-200, min(200, yawrate))
             thrust = max(0, min(65535, thrust))
 
-            # Send setpoint via cflib commander
-            self.cf.commander.send_setpoint(roll, pitch, yawrate, thrust)
+            if self.control_sender is None:
+                self.control_sender = ManualControlSender(self.link_client or self.cf.link, self.logger)
+            self.control_sender.set(roll, pitch, yawrate, thrust)
 
         except Exception as e:
             self.logger.error(f"Failed to send manual control: {e}")
@@ -232,11 +1054,70 @@ class DroneConnection:
         This is the proper way to stop manual control - it tells the drone
         to stop the motors safely.
         """
+        self._stop_control_sender()
         if not self.is_connected():
             return
 
         try:
-            self.cf.commander.send_stop_setpoint()
+            if self.link_client:
+                # The stop of the generic setpoints, as cflib's commander sends it
+                self.link_client.send(bytes([(CRTP_PORT_SETPOINT_GENERIC << 4) | CRTP_LINK_BITS,
+                                             GENERIC_SETPOINT_STOP]))
+            else:
+                self.cf.commander.send_stop_setpoint()
             self.logger.info("Sent stop setpoint")
         except Exception as e:
             self.logger.error(f"Failed to send stop setpoint: {e}")
+
+    def upload_trajectory(self, trajectory_id: int, data: bytes, n_pieces: int = 0,
+                          compressed: bool = True):
+        """
+        Upload a trajectory to the flash of the drone and define it, it can
+        then be started with cf.high_level_commander.start_trajectory().
+
+        Args:
+            trajectory_id: Id the trajectory is defined with
+            data: The trajectory, in the compressed or poly4d format
+            n_pieces: Number of pieces, for poly4d trajectories only
+            compressed: True if data is a compressed trajectory
+        """
+        if not self.is_connected():
+            raise RuntimeError('Cannot upload a trajectory: not connected')
+
+        TrajectoryUploader(self.cf).upload(data)
+
+        trajectory_type = TRAJECTORY_TYPE_POLY4D_COMPRESSED if compressed else TRAJECTORY_TYPE_POLY4D
+        packet = CRTPPacket()
+        packet.set_header(CRTP_PORT_SETPOINT_HL, 0)
+        packet.data = struct.pack('<BBBBIB', HL_COMMAND_DEFINE_TRAJECTORY, trajectory_id,
+                                  TRAJECTORY_LOCATION_FLASH, trajectory_type, 0, n_pieces)
+        self.cf.send_packet(packet)
+        self.logger.info(f"Uploaded trajectory {trajectory_id} ({len(data)} bytes) to flash")
+
+    def fly_waypoints(self, waypoints, trajectory_id: int = 1, speed: float = 0.5,
+                      relative: bool = True) -> float:
+        """
+        Fit a trajectory through waypoints, upload it and start it on the
+        high-level commander. The drone must be flying, e.g. after
+        cf.high_level_commander.takeoff().
+
+        Args:
+            waypoints: (x, y, z) or (x, y, z, yaw) in m and rad
+            trajectory_id: Id the trajectory is defined with
+            speed: Max speed in m/s
+            relative: Fly the trajectory from the current position
+
+        Returns:
+            float: Duration of the trajectory in s
+        """
+        pieces = trajectory.fit_waypoints(waypoints, speed=speed)
+        if len(pieces) > 255:
+            raise ValueError(f'Trajectory of {len(pieces)} pieces, at most 255')
+
+        self.upload_trajectory(trajectory_id, trajectory.pack_poly4d(pieces),
+                               n_pieces=len(pieces), compressed=False)
+        self.cf.high_level_commander.start_trajectory(trajectory_id, relative=relative)
+
+        duration = trajectory.trajectory_duration(pieces)
+        self.logger.info(f"Started trajectory {trajectory_id}: {len(pieces)} pieces, {duration:.1f} s")
+        return duration
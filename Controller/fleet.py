@@ -0,0 +1,280 @@
+"""
+Flies a fleet of ESP-Drones from one process, over one selector loop.
+
+    python fleet.py status 192.168.1.21 192.168.1.22 esp-drone-a1b2c3.local
+    python fleet.py shape 1 192.168.1.21 192.168.1.22 [--delay 0.5]
+    python fleet.py stop 192.168.1.21 192.168.1.22
+
+The drones join one network as stations (WIFI_STATION of the firmware) and
+are given as host[:port], the mDNS names work where the host resolves them.
+Every drone gets a CrtpUdpClient of crtp_udp.py without a receive thread, a
+single thread reads all their sockets. The AutoNav status they push goes
+into one TelemetryRing per drone of a shared FleetTelemetry.
+
+A command for the fleet is built for every drone before it is due and then
+sent to all of them back to back, so 10 drones start within a millisecond
+or so of the host plus the spread of the network.
+"""
+
+import argparse
+import logging
+import selectors
+import socket
+import struct
+import sys
+import threading
+import time
+
+from crtp_udp import CRTP_LINK_BITS, RECEIVE_POLL_PERIOD, CrtpUdpClient
+from drone_connection import AUTONAV_CRTP_CHANNEL, AUTONAV_CRTP_PORT, AutoNavCommand, AutoNavStatus
+from telemetry import AUTONAV_STATE_NAMES, TelemetryRing
+
+DEFAULT_PORT = 2390
+FLEET_TELEMETRY_CAPACITY = 600  # 60 s of AutoNav status at 10 Hz
+SPIN_PERIOD = 0.002  # s, the end of the wait for a command spins instead of sleeping
+
+
+def parse_address(text: str):
+    """host[:port] to a socket address, the host is resolved once."""
+    host, _, port = text.partition(':')
+    return socket.gethostbyname(host), int(port) if port else DEFAULT_PORT
+
+
+class FleetTelemetry:
+    """
+    The AutoNav status of every drone of a fleet, one TelemetryRing each.
+
+    The fleet thread appends, with the host time the status arrived at as
+    the status carries none. Any thread takes snapshots.
+    """
+
+    def __init__(self, capacity: int = FLEET_TELEMETRY_CAPACITY):
+        self.capacity = capacity
+        self._rings = {}
+
+    def add_drone(self, name: str) -> TelemetryRing:
+        ring = TelemetryRing(AutoNavStatus._fields, self.capacity)
+        self._rings[name] = ring
+        return ring
+
+    def names(self):
+        return tuple(self._rings)
+
+    def latest(self, name: str, n: int):
+        """The last n status of a drone, see TelemetryRing.latest()."""
+        return self._rings[name].latest(n)
+
+    def last(self):
+        """The newest AutoNavStatus of every drone, None for those without one yet."""
+        last = {}
+        for name, ring in self._rings.items():
+            values = ring.last()
+            last[name] = AutoNavStatus(*(int(v) for v in values)) if values is not None else None
+        return last
+
+
+class FleetDrone:
+
+    def __init__(self, name: str, addr, ring: TelemetryRing):
+        self.name = name
+        self.ring = ring
+        self.client = CrtpUdpClient(addr)
+        self.client.add_port_handler(AUTONAV_CRTP_PORT, self._handle_status)
+        # [3 bytes of room][CRTP packet][checksum], see CrtpUdpClient.send_prebuilt()
+        self._command_buf = bytearray()
+        self._command_view = None
+
+    def _handle_status(self, raw: bytes) -> bool:
+        """On the fleet thread, the firmware pushes nothing else on the port."""
+        if len(raw) == 1 + AutoNavStatus.FORMAT.size:
+            self.ring.append(time.monotonic(), AutoNavStatus.FORMAT.unpack_from(raw, 1))
+        return True
+
+    def prepare(self, raw: bytes):
+        if len(self._command_buf) != 3 + len(raw) + 1:
+            self._command_buf = bytearray(3 + len(raw) + 1)
+            self._command_view = memoryview(self._command_buf)
+        self._command_buf[3:-1] = raw
+
+    def send_prepared(self):
+        self.client.send_prebuilt(self._command_buf, self._command_view)
+
+
+class Fleet:
+    """
+    Many drone links on one thread.
+
+    open() connects all the drones and returns the names of those that
+    answered, the others stay in the fleet and are commanded too, a drone
+    that comes up later gets the next command. The methods are meant for a
+    single thread, e.g. the GUI, the fleet thread only receives.
+    """
+
+    def __init__(self, addresses, capacity: int = FLEET_TELEMETRY_CAPACITY,
+                 logger: logging.Logger = None):
+        self.logger = logger or logging.getLogger(__name__)
+        self.telemetry = FleetTelemetry(capacity)
+        self.drones = {}
+        for address in addresses:
+            if address in self.drones:
+                raise ValueError(f'{address} is twice in the fleet')
+            self.drones[address] = FleetDrone(address, parse_address(address),
+                                              self.telemetry.add_drone(address))
+        self._selector = None
+        self._thread = None
+        self._running = False
+
+    def open(self, timeout: float = 2.0):
+        """Connect every drone, returns the names of those that answered within timeout."""
+        self._selector = selectors.DefaultSelector()
+        for drone in self.drones.values():
+            drone.client.open(receive_thread=False)
+            self._selector.register(drone.client, selectors.EVENT_READ, drone.client)
+        self._running = True
+        self._thread = threading.Thread(target=self._run, name='fleet', daemon=True)
+        self._thread.start()
+
+        # The echo requests went out on open, the waits share one deadline
+        deadline = time.monotonic() + timeout
+        answered = [name for name, drone in self.drones.items()
+                    if drone.client.wait_for_echo(max(0.0, deadline - time.monotonic()))]
+        missing = sorted(set(self.drones) - set(answered))
+        if missing:
+            self.logger.warning(f'No answer from {", ".join(missing)}')
+        return answered
+
+    def close(self):
+        self._running = False
+        if self._thread:
+            self._thread.join()
+            self._thread = None
+        for drone in self.drones.values():
+            drone.client.close()
+        if self._selector:
+            self._selector.close()
+            self._selector = None
+
+    def rtt_ms(self):
+        """The mean round trip time of every drone link, None before an echo."""
+        return {name: drone.client.rtt_mean_ms for name, drone in self.drones.items()}
+
+    def broadcast(self, command: int, payload: bytes = b'', at: float = None, names=None) -> float:
+        """
+        Send an AutoNav command to the fleet, or to the drones of names.
+
+        Args:
+            command: AutoNav command code
+            payload: Optional additional data
+            at: time.monotonic() to send at, now if None
+
+        Returns:
+            The spread of the sends in seconds, first to last drone
+        """
+        drones = [self.drones[name] for name in names] if names else list(self.drones.values())
+        header = (AUTONAV_CRTP_PORT << 4) | CRTP_LINK_BITS | AUTONAV_CRTP_CHANNEL
+        raw = bytes([header, command]) + payload
+        for drone in drones:
+            drone.prepare(raw)
+
+        if at is not None:
+            wait = at - time.monotonic() - SPIN_PERIOD
+            if wait > 0:
+                time.sleep(wait)
+            while time.monotonic() < at:
+                pass
+
+        start = time.perf_counter()
+        for drone in drones:
+            drone.send_prepared()
+        spread = time.perf_counter() - start
+        self.logger.debug(f'AutoNav command {command} to {len(drones)} drones within {spread * 1e3:.3f} ms')
+        return spread
+
+    def send_shape(self, shape_id: int, at: float = None) -> float:
+        """Start the same shape on every drone at once, see DroneConnection.send_shape()."""
+        return self.broadcast(shape_id, at=at)
+
+    def send_stop(self) -> float:
+        return self.broadcast(AutoNavCommand.STOP)
+
+    def send_altitude(self, altitude_mm: int, at: float = None) -> float:
+        return self.broadcast(AutoNavCommand.SET_ALT_MM, struct.pack('<H', altitude_mm), at=at)
+
+    def send_mission(self, at: float = None) -> float:
+        """Fly the missions uploaded to each drone with autonav_mission.py."""
+        return self.broadcast(AutoNavCommand.MISSION, at=at)
+
+    def _run(self):
+        selector = self._selector
+        clients = [drone.client for drone in self.drones.values()]
+        while self._running:
+            for key, _ in selector.select(RECEIVE_POLL_PERIOD):
+                # Drain the socket, the batches of a drone may queue up
+                while key.data.read():
+                    pass
+            for client in clients:
+                client.poll()
+
+
+def print_status(fleet: Fleet):
+    rtt = fleet.rtt_ms()
+    for name, status in fleet.telemetry.last().items():
+        link = f'{rtt[name]:5.1f} ms' if rtt[name] is not None else '   no link'
+        if status is None:
+            print(f'{name:24} {link}  no status')
+            continue
+        state = AUTONAV_STATE_NAMES[status.state] if status.state < len(AUTONAV_STATE_NAMES) else status.state
+        obstacle = f'{status.obstacle_mm / 1000:.2f} m' if status.obstacle_mm != 0xFFFF else '-'
+        print(f'{name:24} {link}  {state:14} alt {status.alt_mm / 1000:.2f} m  obstacle {obstacle}')
+
+
+def main() -> int:
+    parser = argparse.ArgumentParser(description='AutoNav commands to a fleet of ESP-Drones')
+    commands = parser.add_subparsers(dest='command', required=True)
+
+    status_parser = commands.add_parser('status', help='show the AutoNav status of the drones')
+    status_parser.add_argument('--duration', type=float, default=10.0, help='s')
+    shape_parser = commands.add_parser('shape', help='fly the same shape on every drone at once')
+    shape_parser.add_argument('shape_id', type=int, choices=range(1, 6))
+    alt_parser = commands.add_parser('alt', help='set the target altitude of every drone')
+    alt_parser.add_argument('altitude_mm', type=int)
+    mission_parser = commands.add_parser('mission', help='fly the uploaded missions at once')
+    stop_parser = commands.add_parser('stop', help='stop every drone')
+    for command_parser in (shape_parser, alt_parser, mission_parser):
+        command_parser.add_argument('--delay', type=float, default=0.5,
+                                    help='s from the connection to the command')
+    for command_parser in (status_parser, shape_parser, alt_parser, mission_parser, stop_parser):
+        command_parser.add_argument('drones', nargs='+', help='host[:port]')
+
+    args = parser.parse_args()
+    logging.basicConfig(level=logging.INFO)
+
+    fleet = Fleet(args.drones)
+    try:
+        answered = fleet.open()
+        print(f'{len(answered)} of {len(fleet.drones)} drones answered')
+        if args.command == 'status':
+            deadline = time.monotonic() + args.duration
+            while time.monotonic() < deadline:
+                time.sleep(1.0)
+                print_status(fleet)
+            return 0
+
+        if args.command == 'stop':
+            spread = fleet.send_stop()
+        else:
+            at = time.monotonic() + args.delay
+            if args.command == 'shape':
+                spread = fleet.send_shape(args.shape_id, at=at)
+            elif args.command == 'alt':
+                spread = fleet.send_altitude(args.altitude_mm, at=at)
+            else:
+                spread = fleet.send_mission(at=at)
+        print(f'Sent to {len(fleet.drones)} drones within {spread * 1e3:.3f} ms')
+        return 0
+    finally:
+        fleet.close()
+
+
+if __name__ == '__main__':
+    sys.exit(main())
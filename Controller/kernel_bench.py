@@ -0,0 +1,157 @@
+"""
+Runs the kernel benchmarks of a drone built with CONFIG_KERNEL_BENCH_SERVICE
+and compares the results of firmware builds and chips.
+
+    python kernel_bench.py run [--ip 192.168.4.1] [--runs 5] [-o results.json]
+    python kernel_bench.py compare base.json new.json [more.json...]
+
+The benchmarks only run while the drone is not flying, and take a few
+seconds. A run prints min, median and max CPU cycles per call of every
+kernel, compare prints the median of each file and its change against the
+first one.
+"""
+
+import argparse
+import json
+import logging
+import struct
+import sys
+import time
+
+from drone_connection import UdpMemoryClient
+
+MEM_TYPE_KERNEL_BENCH = 0x26
+KERNEL_BENCH_MEM_MAGIC = 0x48434e42
+KERNEL_BENCH_MEM_VERSION = 1
+KERNEL_BENCH_MAX_RUNS = 15
+HEADER_FORMAT = '<IBBBBHHI'
+HEADER_SIZE = struct.calcsize(HEADER_FORMAT)
+RECORD_FORMAT = '<24sIffff'
+RECORD_SIZE = struct.calcsize(RECORD_FORMAT)
+
+STATE_RUNNING = 1
+STATE_DONE = 2
+STATE_ABORTED = 3
+
+# esp_chip_model_t
+CHIP_MODELS = {1: 'ESP32', 2: 'ESP32-S2', 9: 'ESP32-S3', 5: 'ESP32-C3'}
+
+
+class KernelBenchClient(UdpMemoryClient):
+
+    def run(self, runs: int, poll_period: float = 0.5, max_duration: float = 120.0) -> dict:
+        self.open()
+        try:
+            memories = self._find_memories((MEM_TYPE_KERNEL_BENCH,))
+            if MEM_TYPE_KERNEL_BENCH not in memories:
+                raise RuntimeError('No kernel benchmark memory, build with CONFIG_KERNEL_BENCH_SERVICE')
+            mem_id = memories[MEM_TYPE_KERNEL_BENCH][0]
+
+            if not self._write(mem_id, 0, bytes([runs])):
+                raise RuntimeError('Benchmarks refused, flying or already running')
+
+            deadline = time.monotonic() + max_duration
+            while True:
+                header = self._read_header(mem_id)
+                if header['state'] != STATE_RUNNING:
+                    break
+                if time.monotonic() > deadline:
+                    raise TimeoutError('Benchmarks still running')
+                time.sleep(poll_period)
+
+            if header['state'] == STATE_ABORTED:
+                self.logger.warning('Flying during the runs, the results are partial')
+            data = self._read(mem_id, HEADER_SIZE, header['records'] * RECORD_SIZE)
+        finally:
+            self.close()
+
+        kernels = {}
+        for i in range(header['records']):
+            name, calls, ns, cycles_min, cycles_median, cycles_max = \
+                struct.unpack_from(RECORD_FORMAT, data, i * RECORD_SIZE)
+            kernels[name.rstrip(b'\0').decode()] = {
+                'calls': calls, 'ns': ns,
+                'min': cycles_min, 'median': cycles_median, 'max': cycles_max,
+            }
+
+        return {
+            'chip': CHIP_MODELS.get(header['chip_model'], str(header['chip_model'])),
+            'cpu_mhz': header['cpu_mhz'],
+            'runs': header['runs'],
+            'complete': header['state'] == STATE_DONE,
+            'kernels': kernels,
+        }
+
+    def _read_header(self, mem_id: int) -> dict:
+        magic, version, state, runs, records, record_size, cpu_mhz, chip_model = \
+            struct.unpack(HEADER_FORMAT, self._read(mem_id, 0, HEADER_SIZE))
+        if magic != KERNEL_BENCH_MEM_MAGIC or version != KERNEL_BENCH_MEM_VERSION or \
+           record_size != RECORD_SIZE:
+            raise RuntimeError(f'Unknown kernel benchmark memory version {version}')
+        return {'state': state, 'runs': runs, 'records': records,
+                'cpu_mhz': cpu_mhz, 'chip_model': chip_model}
+
+
+def print_results(results: dict):
+    print(f"# {results['chip']} at {results['cpu_mhz']} MHz, {results['runs']} runs")
+    print(f"{'# kernel':<24} {'ns/call':>10} {'min':>10} {'median':>10} {'max':>10}")
+    for name, kernel in results['kernels'].items():
+        print(f"{name:<24} {kernel['ns']:>10.1f} {kernel['min']:>10.1f} "
+              f"{kernel['median']:>10.1f} {kernel['max']:>10.1f}")
+
+
+def compare(paths):
+    files = []
+    for path in paths:
+        with open(path) as f:
+            files.append(json.load(f))
+
+    print(f"{'# median cycles':<24}" + ''.join(f' {path[-20:]:>20}' for path in paths))
+    print(f"{'# chip':<24}" + ''.join(f" {r['chip'] + '@' + str(r['cpu_mhz']):>20}" for r in files))
+    names = list(dict.fromkeys(name for r in files for name in r['kernels']))
+    for name in names:
+        line = f'{name:<24}'
+        base = files[0]['kernels'].get(name)
+        for results in files:
+            kernel = results['kernels'].get(name)
+            if kernel is None:
+                line += f" {'-':>20}"
+            elif results is files[0] or base is None or base['median'] <= 0:
+                line += f" {kernel['median']:>20.1f}"
+            else:
+                change = 100.0 * (kernel['median'] - base['median']) / base['median']
+                line += f" {kernel['median']:>11.1f} ({change:+6.1f}%)"
+        print(line)
+
+
+def main() -> int:
+    parser = argparse.ArgumentParser(description='On-target kernel benchmarks of the ESP-Drone')
+    commands = parser.add_subparsers(dest='command', required=True)
+
+    run_parser = commands.add_parser('run', help='run the benchmarks on the drone')
+    run_parser.add_argument('--ip', default='192.168.4.1')
+    run_parser.add_argument('--port', type=int, default=2390)
+    run_parser.add_argument('--runs', type=int, default=5, choices=range(1, KERNEL_BENCH_MAX_RUNS + 1),
+                            metavar=f'1..{KERNEL_BENCH_MAX_RUNS}')
+    run_parser.add_argument('-o', '--output', help='save the results as JSON, for compare')
+
+    compare_parser = commands.add_parser('compare', help='compare saved results')
+    compare_parser.add_argument('results', nargs='+')
+
+    args = parser.parse_args()
+    logging.basicConfig(level=logging.INFO)
+
+    if args.command == 'compare':
+        compare(args.results)
+        return 0
+
+    results = KernelBenchClient(args.ip, args.port).run(args.runs)
+    print_results(results)
+    if args.output:
+        with open(args.output, 'w') as f:
+            json.dump(results, f, indent=2)
+    return 0 if results['complete'] else 1
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -5,16 +5,23 @@ Desktop controller for ESP-Drone using Wi-Fi (UDP) communication.
 Supports AutoNav autonomous flight commands.
 """
 
+import numpy as np
 import tkinter as tk
 from tkinter import ttk, messagebox
 import sv_ttk as sv
 from drone_connection import DroneConnection
+from telemetry import AUTONAV_STATE_NAMES
 
 # Default drone settings (ESP32 AP mode defaults)
 DEFAULT_IP = "192.168.4.1"
 DEFAULT_PORT = 2390
 DEFAULT_ALTITUDE_MM = 1200  # 1.2 meters
 
+# Telemetry display
+TELEMETRY_REFRESH_MS = 50   # 20 Hz, independent of the log rates
+TELEMETRY_WINDOW_S = 10.0   # Time span of the altitude plot
+TELEMETRY_MAX_ALTITUDE_M = 2.0
+
 
 class DroneControllerApp:
     """Main application class for the drone controller."""
@@ -43,7 +50,7 @@ class DroneControllerApp:
         """Setup the user interface."""
         # Window configuration
         self.root.title("ESP-Drone Controller")
-        self.root.geometry('900x650')
+        self.root.geometry('900x850')
 
         # Connection Frame
         self.create_connection_frame()
@@ -57,6 +64,9 @@ class DroneControllerApp:
         # Status Frame
         self.create_status_frame()
 
+        # Telemetry Frame
+        self.create_telemetry_frame()
+
     def create_connection_frame(self):
         """Create the connection controls frame."""
         frame = ttk.LabelFrame(self.root, text='Drone Communication', padding=10)
@@ -154,6 +164,74 @@ class DroneControllerApp:
                                            foreground="cyan")
         # Don't pack yet - only show when manual control is active
 
+    def create_telemetry_frame(self):
+        """Create the live telemetry frame."""
+        frame = ttk.LabelFrame(self.root, text="Telemetry", padding=10)
+        frame.pack(fill="both", expand=True, padx=10, pady=5)
+
+        self.telemetry_label = ttk.Label(frame, text="Altitude: -   Battery: -   AutoNav: -")
+        self.telemetry_label.pack(anchor='w')
+
+        self.telemetry_canvas = tk.Canvas(frame, height=160, background='#1c1c1c',
+                                          highlightthickness=0)
+        self.telemetry_canvas.pack(fill='both', expand=True, pady=(5, 0))
+        self.altitude_line = self.telemetry_canvas.create_line(0, 0, 0, 0, fill='cyan', width=2)
+        self.telemetry_timer = None
+
+    def refresh_telemetry(self):
+        """Pull the latest telemetry snapshot and redraw, at TELEMETRY_REFRESH_MS."""
+        telemetry = self.drone.telemetry
+        if telemetry is not None:
+            self.draw_altitude(telemetry)
+            self.telemetry_label.config(text=self.telemetry_text(telemetry, self.drone.autonav_status))
+
+        self.telemetry_timer = self.root.after(TELEMETRY_REFRESH_MS, self.refresh_telemetry)
+
+    @staticmethod
+    def telemetry_text(telemetry, autonav_status=None) -> str:
+        parts = []
+        for variable, label, fmt in (('stateEstimate.z', 'Altitude', '{:.2f} m'),
+                                     ('pm.vbat', 'Battery', '{:.2f} V'),
+                                     ('autonav.state', 'AutoNav', None)):
+            ring, column = telemetry.ring_of(variable)
+            values = ring.last() if ring else None
+            if values is None:
+                parts.append(f"{label}: -")
+            elif fmt is None:
+                state = int(values[column])
+                name = AUTONAV_STATE_NAMES[state] if state < len(AUTONAV_STATE_NAMES) else str(state)
+                parts.append(f"{label}: {name}")
+            else:
+                parts.append(f"{label}: " + fmt.format(values[column]))
+        # The status AutoNav pushes over Wi-Fi
+        if autonav_status is not None and autonav_status.obstacle_mm != 0xFFFF:
+            parts.append(f"Obstacle: {autonav_status.obstacle_mm / 1000:.2f} m")
+        return "   ".join(parts)
+
+    def draw_altitude(self, telemetry):
+        """Plot the altitude of the last TELEMETRY_WINDOW_S, one point per pixel at most."""
+        ring, column = telemetry.ring_of('stateEstimate.z')
+        if ring is None:
+            return
+
+        width = max(self.telemetry_canvas.winfo_width(), 2)
+        height = max(self.telemetry_canvas.winfo_height(), 2)
+        rate = ring.capacity / telemetry.HISTORY
+        times, values = ring.latest(int(TELEMETRY_WINDOW_S * rate))
+        if len(times) < 2:
+            return
+
+        step = max(1, len(times) // width)
+        times = times[::step]
+        altitudes = values[::step, column]
+
+        x = (times - times[-1] + TELEMETRY_WINDOW_S) * (width / TELEMETRY_WINDOW_S)
+        y = height - altitudes.clip(0.0, TELEMETRY_MAX_ALTITUDE_M) * (height / TELEMETRY_MAX_ALTITUDE_M)
+        points = np.empty(2 * len(x))
+        points[0::2] = x
+        points[1::2] = y
+        self.telemetry_canvas.coords(self.altitude_line, *points.tolist())
+
     def connect(self):
         """Connect to the drone."""
         ip = self.ip_entry.get().strip()
@@ -176,6 +254,8 @@ class DroneControllerApp:
             self.status_label.config(text=f"Status: Connected to {ip}:{port}",
                                    foreground="green")
             self.enable_controls(True)
+            if self.telemetry_timer is None:
+                self.refresh_telemetry()
             messagebox.showinfo("Success", f"Connected to drone at {ip}:{port}")
         else:
             self.status_label.config(text="Status: Connection Failed", foreground="red")
@@ -189,6 +269,9 @@ class DroneControllerApp:
     def disconnect(self):
         """Disconnect from the drone."""
         self.drone.disconnect()
+        if self.telemetry_timer:
+            self.root.after_cancel(self.telemetry_timer)
+            self.telemetry_timer = None
         self.status_label.config(text="Status: Disconnected", foreground="red")
         self.enable_controls(False)
 
@@ -275,6 +358,7 @@ class DroneControllerApp:
 
         key = event.keysym.lower()
         self.pressed_keys.add(key)
+        self.update_control()
 
     def on_key_release(self, event):
         """Handle key release events."""
@@ -283,6 +367,7 @@ class DroneControllerApp:
 
         key = event.keysym.lower()
         self.pressed_keys.discard(key)
+        self.update_control()
 
     def toggle_manual_control(self):
         """Toggle manual keyboard control on/off."""
@@ -334,7 +419,7 @@ class DroneControllerApp:
         for btn in self.shape_buttons:
             btn.config(state='disabled')
 
-        # Start the control loop (100 Hz = every 10ms)
+        # Start the thrust loop (100 Hz = every 10ms)
         self.send_control_loop()
 
     def stop_manual_control(self):
@@ -350,7 +435,7 @@ class DroneControllerApp:
             self.root.after_cancel(self.control_timer)
             self.control_timer = None
 
-        # Send stop setpoint
+        # Stop the sender and send the stop setpoint
         self.drone.send_stop_setpoint()
 
         # Send manual override OFF to resume autonomous flight capability
@@ -366,8 +451,8 @@ class DroneControllerApp:
         for btn in self.shape_buttons:
             btn.config(state='normal')
 
-    def send_control_loop(self):
-        """Continuously send control setpoints based on pressed keys."""
+    def update_control(self):
+        """Hand the setpoint of the pressed keys to the sender of the connection."""
         if not self.manual_control_active:
             return
 
@@ -394,12 +479,6 @@ class DroneControllerApp:
         if 'right' in self.pressed_keys:
             yawrate = self.max_yawrate
 
-        # Thrust control (Arrow keys up/down)
-        if 'up' in self.pressed_keys:
-            self.current_thrust = min(60000, self.current_thrust + self.thrust_step)
-        if 'down' in self.pressed_keys:
-            self.current_thrust = max(10001, self.current_thrust - self.thrust_step)
-
         # Reset (Space)
         if 'space' in self.pressed_keys:
             roll = 0.0
@@ -407,10 +486,23 @@ class DroneControllerApp:
             yawrate = 0.0
             self.current_thrust = self.base_thrust
 
-        # Send the control setpoint
+        # Sent right away by the sender thread, which also repeats it
         self.drone.send_manual_control(roll, pitch, yawrate, int(self.current_thrust))
 
-        # Schedule next update (10ms = 100 Hz)
+    def send_control_loop(self):
+        """Ramp the thrust while the up/down keys are held."""
+        if not self.manual_control_active:
+            return
+
+        # Thrust control (Arrow keys up/down)
+        if 'up' in self.pressed_keys:
+            self.current_thrust = min(60000, self.current_thrust + self.thrust_step)
+        if 'down' in self.pressed_keys:
+            self.current_thrust = max(10001, self.current_thrust - self.thrust_step)
+
+        self.update_control()
+
+        # Schedule next update (10ms = 100 Hz), only the ramp depends on this timer
         self.control_timer = self.root.after(10, self.send_control_loop)
 
 
@@ -0,0 +1,170 @@
+"""
+Telemetry of the ESP-Drone, received from cflib log blocks.
+
+The log callbacks run on the cflib receive thread and only write into
+preallocated ring buffers, the GUI pulls snapshots of them at its own rate.
+"""
+
+import logging
+import threading
+import time
+
+import numpy as np
+from cflib.crazyflie import Crazyflie
+from cflib.crazyflie.log import LogConfig
+
+# AutoNav states (matches firmware autonav.h)
+AUTONAV_STATE_NAMES = ('IDLE', 'RUNNING', 'HOLD_OBSTACLE', 'LANDING', 'LANDED', 'OVERRIDE')
+
+# The host time of a log block, with the firmware TIME_SYNC (time_sync.h)
+TIME_SYNC_VARIABLE = 'timeSync.hostUs'
+
+
+def host_time_of(host_us: int) -> float:
+    """
+    The unix time in s of a timeSync.hostUs, which only keeps the low 32 bits
+    of the us, of a sample of the last half hour.
+    """
+    now_us = time.time_ns() // 1000
+    age_us = (now_us - host_us) & 0xFFFFFFFF
+    if age_us >= 0x80000000:
+        # A little ahead of the host, the error of the synchronization
+        age_us -= 0x100000000
+    return (now_us - age_us) / 1e6
+
+
+class TelemetryRing:
+    """
+    Ring buffer of the last samples of a log block, one column per variable.
+
+    A single thread appends, any thread takes snapshots. The buffers are
+    allocated once, a full ring overwrites its oldest samples.
+    """
+
+    def __init__(self, fields, capacity: int):
+        self.fields = tuple(fields)
+        self.capacity = capacity
+        self._time = np.zeros(capacity, dtype=np.float64)
+        self._values = np.zeros((capacity, len(self.fields)), dtype=np.float32)
+        self._count = 0
+        self._lock = threading.Lock()
+
+    @property
+    def count(self) -> int:
+        """Number of samples appended since the ring was created."""
+        return self._count
+
+    def append(self, timestamp: float, values):
+        """
+        Args:
+            timestamp: Time of the sample in seconds, see TelemetryPipeline
+            values: One value per field, in the order of fields
+        """
+        with self._lock:
+            i = self._count % self.capacity
+            self._time[i] = timestamp
+            self._values[i] = values
+            self._count += 1
+
+    def latest(self, n: int):
+        """
+        Copy of the last n samples, oldest first.
+
+        Returns:
+            (time, values): arrays of shape (m,) and (m, len(fields)), m <= n
+        """
+        with self._lock:
+            n = min(n, self._count, self.capacity)
+            end = self._count % self.capacity
+            start = end - n
+            if start >= 0:
+                return self._time[start:end].copy(), self._values[start:end].copy()
+            # The samples wrap around the end of the buffers
+            return (np.concatenate((self._time[start:], self._time[:end])),
+                    np.concatenate((self._values[start:], self._values[:end])))
+
+    def last(self):
+        """The newest values, None before the first sample."""
+        with self._lock:
+            if self._count == 0:
+                return None
+            return self._values[(self._count - 1) % self.capacity].copy()
+
+
+class TelemetryPipeline:
+    """
+    Subscribes to the telemetry log blocks and feeds one TelemetryRing per
+    block.
+
+    Variables missing from the TOC of the firmware are left out of their
+    block, a block without any variable is not started.
+
+    The samples are timed by the drone in s since boot, or in unix time of
+    the host once the drone synchronized with it, when the firmware logs
+    timeSync.hostUs. It is then added to every block, for 4 bytes of each.
+    """
+
+    # name: (period in ms, [(variable, type)])
+    BLOCKS = {
+        'fast': (10, [('stateEstimate.z', 'float')]),
+        'slow': (100, [('pm.vbat', 'float'), ('autonav.state', 'uint8_t')]),
+    }
+    HISTORY = 30.0  # s kept in the rings
+
+    def __init__(self, cf: Crazyflie, logger: logging.Logger = None):
+        self.cf = cf
+        self.logger = logger or logging.getLogger(__name__)
+        self.rings = {}
+        self._configs = []
+
+    def start(self):
+        toc = self.cf.log.toc
+        has_host_time = toc.get_element_by_complete_name(TIME_SYNC_VARIABLE) is not None
+        for name, (period_ms, variables) in self.BLOCKS.items():
+            available = [(var, var_type) for var, var_type in variables
+                         if toc.get_element_by_complete_name(var) is not None]
+            if not available:
+                self.logger.info(f"Telemetry block {name} has no variable in the TOC")
+                continue
+
+            config = LogConfig(name=f'telemetry.{name}', period_in_ms=period_ms)
+            for var, var_type in available:
+                config.add_variable(var, var_type)
+            if has_host_time:
+                config.add_variable(TIME_SYNC_VARIABLE, 'uint32_t')
+
+            fields = [var for var, _ in available]
+            ring = TelemetryRing(fields, int(self.HISTORY * 1000 / period_ms))
+            self.rings[name] = ring
+            config.data_received_cb.add_callback(self._make_callback(ring))
+
+            self.cf.log.add_config(config)
+            config.start()
+            self._configs.append(config)
+
+    def stop(self):
+        for config in self._configs:
+            try:
+                config.delete()
+            except Exception as e:
+                self.logger.debug(f"Could not delete log block {config.name}: {e}")
+        self._configs = []
+
+    @staticmethod
+    def _make_callback(ring: TelemetryRing):
+        fields = ring.fields
+
+        def received(timestamp, data, logconf):
+            # cflib receive thread, nothing but the ring is touched here
+            host_us = data.get(TIME_SYNC_VARIABLE)
+            ring.append(host_time_of(host_us) if host_us else timestamp / 1000.0,
+                        [data[field] for field in fields])
+
+        return received
+
+    def ring_of(self, variable: str):
+        """The ring and the column of a variable, (None, None) if it is not logged."""
+        for ring in self.rings.values():
+            if variable in ring.fields:
+                return ring, ring.fields.index(variable)
+        return None, None
@@ -0,0 +1,119 @@
+"""
+Fits waypoint lists to poly4d trajectories for the high-level commander of
+the ESP-Drone.
+
+A trajectory is uploaded once with DroneConnection.upload_trajectory() and
+flown by the drone on its own, instead of streaming setpoints over Wi-Fi.
+"""
+
+import math
+import struct
+
+# Matches firmware pptraj.h: struct poly4d { float p[4][PP_SIZE]; float duration; }
+PP_SIZE = 8
+POLY4D = struct.Struct('<' + 'f' * (4 * PP_SIZE + 1))
+
+# Coefficients 4..7 of the degree 7 polynomial on [0, 1] with zero acceleration
+# and jerk at both ends, as multiples of A = p1 - p0 - v0 and B = v1 - v0
+# (velocities in units of the piece)
+_HERMITE7 = ((35.0, -15.0), (-84.0, 39.0), (70.0, -34.0), (-20.0, 10.0))
+
+# Samples per piece for the speed check
+_SPEED_SAMPLES = 32
+
+
+class Piece:
+    """One piece of a trajectory: x, y, z and yaw polynomials in t, ascending powers."""
+
+    def __init__(self, duration: float, coeffs):
+        self.duration = duration
+        self.coeffs = coeffs
+
+    def eval(self, t: float, axis: int, derivative: int = 0) -> float:
+        value = 0.0
+        for k in range(PP_SIZE - 1, derivative - 1, -1):
+            factor = math.prod(range(k - derivative + 1, k + 1))
+            value = value * t + factor * self.coeffs[axis][k]
+        return value
+
+    def max_speed(self) -> float:
+        speed = 0.0
+        for i in range(_SPEED_SAMPLES + 1):
+            t = self.duration * i / _SPEED_SAMPLES
+            speed = max(speed, math.sqrt(sum(self.eval(t, axis, 1) ** 2 for axis in range(3))))
+        return speed
+
+
+def _hermite7(p0: float, p1: float, v0: float, v1: float, duration: float):
+    """Coefficients in t of the piece from p0 at speed v0 to p1 at speed v1."""
+    a = p1 - p0 - v0 * duration
+    b = (v1 - v0) * duration
+    normalized = [p0, v0 * duration, 0.0, 0.0] + [ca * a + cb * b for ca, cb in _HERMITE7]
+    return [c / duration ** k for k, c in enumerate(normalized)]
+
+
+def _waypoint_velocities(points, durations):
+    """Catmull-Rom velocities, the trajectory starts and ends at rest."""
+    velocities = [[0.0] * 4 for _ in points]
+    for i in range(1, len(points) - 1):
+        span = durations[i - 1] + durations[i]
+        velocities[i] = [(points[i + 1][axis] - points[i - 1][axis]) / span for axis in range(4)]
+    return velocities
+
+
+def fit_waypoints(waypoints, speed: float = 0.5, min_duration: float = 0.5, iterations: int = 4):
+    """
+    Fit a smooth trajectory through waypoints, one piece per leg.
+
+    The pieces are degree 7 polynomials that match position and velocity at
+    the waypoints, with zero acceleration and jerk there. The legs are
+    stretched until the speed stays below speed.
+
+    Args:
+        waypoints: (x, y, z) or (x, y, z, yaw) in m and rad, at least two
+        speed: Max speed in m/s
+        min_duration: Shortest leg in s
+        iterations: Rounds of stretching the legs that are too fast
+
+    Returns:
+        list of Piece
+    """
+    points = [tuple(map(float, w)) + (0.0,) * (4 - len(w)) for w in waypoints]
+    if len(points) < 2:
+        raise ValueError('A trajectory needs at least two waypoints')
+
+    durations = []
+    for p0, p1 in zip(points, points[1:]):
+        distance = math.dist(p0[:3], p1[:3])
+        durations.append(max(min_duration, distance / speed))
+
+    for _ in range(iterations):
+        velocities = _waypoint_velocities(points, durations)
+        pieces = [Piece(durations[i], [_hermite7(points[i][axis], points[i + 1][axis],
+                                                 velocities[i][axis], velocities[i + 1][axis],
+                                                 durations[i]) for axis in range(4)])
+                  for i in range(len(durations))]
+
+        stretched = False
+        for i, piece in enumerate(pieces):
+            ratio = piece.max_speed() / speed
+            if ratio > 1.001:
+                durations[i] *= ratio
+                stretched = True
+        if not stretched:
+            break
+
+    return pieces
+
+
+def pack_poly4d(pieces) -> bytes:
+    """The pieces in the poly4d format of the firmware, for upload_trajectory(compressed=False)."""
+    data = bytearray()
+    for piece in pieces:
+        values = [c for axis in piece.coeffs for c in axis] + [piece.duration]
+        data += POLY4D.pack(*values)
+    return bytes(data)
+
+
+def trajectory_duration(pieces) -> float:
+    return sum(piece.duration for piece in pieces)
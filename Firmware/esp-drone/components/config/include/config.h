@@ -96,8 +96,21 @@
 #define PM_TASK_PRI             0
 #define USDLOG_TASK_PRI         1
 #define USDWRITE_TASK_PRI       0
+#define FLIGHTREC_TASK_PRI      1
+#define KERNEL_BENCH_TASK_PRI   1
+#define STORAGE_TASK_PRI        1
+#define WORKER_TASK_PRI         2
+#define DYN_NOTCH_TASK_PRI      1
+#define THERMAL_CAMERA_TASK_PRI 1
+#define CTRL_BANK_TASK_PRI      2
+#define EST_SHADOW_TASK_PRI     2
+#define DECK_PROBE_TASK_PRI     2
+#define CONSOLE_TASK_PRI        1
 #define PCA9685_TASK_PRI        2
 #define CMD_HIGH_LEVEL_TASK_PRI 2
+#define AUTONAV_TASK_PRI        2
+#define AUTONAV_CRTP_TASK_PRI   2
+#define COLAV_TASK_PRI          1
 #define BQ_OSD_TASK_PRI         1
 #define GTGPS_DECK_TASK_PRI     1
 #define LIGHTHOUSE_TASK_PRI     3
@@ -105,7 +118,6 @@
 #define OA_DECK_TASK_PRI        3
 #define UART1_TEST_TASK_PRI     1
 #define UART2_TEST_TASK_PRI     1
-#define LEDSEQCMD_TASK_PRI      1
 //if task watchdog triggered,KALMAN_TASK_PRI should set lower or set lower flow frequency
 #ifdef TARGET_MCU_ESP32
   #define KALMAN_TASK_PRI         2
@@ -128,6 +140,7 @@
 #define UDP_TX_TASK_PRI         3
 #define UDP_RX_TASK_PRI         3
 #define UDP_RX2_TASK_PRI        3
+#define I2C_ASYNC_TASK_PRI      4
 
 // Not compiled
 #if 0
@@ -135,10 +148,54 @@
   #define PID_CTRL_TASK_PRI       2
 #endif
 
+// Task core affinity. Wi-Fi and lwIP are pinned to core 0 (sdkconfig), the
+// link and CRTP tasks stay next to them while the flight critical pipeline
+// (sensors -> estimator -> stabilizer) owns core 1.
+#if defined(CONFIG_FREERTOS_UNICORE)
+  #define FLIGHT_TASK_CORE        tskNO_AFFINITY
+  #define NETWORK_TASK_CORE       tskNO_AFFINITY
+#else
+  #define FLIGHT_TASK_CORE        1
+  #define NETWORK_TASK_CORE       0
+#endif
+
+#define STABILIZER_TASK_CORE    FLIGHT_TASK_CORE
+#define SENSORS_TASK_CORE       FLIGHT_TASK_CORE
+#ifdef CONFIG_KALMAN_CORE_SPLIT
+  #define KALMAN_TASK_CORE      NETWORK_TASK_CORE
+#else
+  #define KALMAN_TASK_CORE      FLIGHT_TASK_CORE
+#endif
+#define I2C_ASYNC_TASK_CORE     FLIGHT_TASK_CORE
+#define CRTP_TX_TASK_CORE       NETWORK_TASK_CORE
+#define CRTP_RX_TASK_CORE       NETWORK_TASK_CORE
+#define UDP_TX_TASK_CORE        NETWORK_TASK_CORE
+#define UDP_RX_TASK_CORE        NETWORK_TASK_CORE
+#define LOG_TASK_CORE           NETWORK_TASK_CORE
+#define PARAM_TASK_CORE         NETWORK_TASK_CORE
+#define MEM_TASK_CORE           NETWORK_TASK_CORE
+#define FLIGHTREC_TASK_CORE     NETWORK_TASK_CORE
+// Timed where the flight tasks run
+#define KERNEL_BENCH_TASK_CORE  FLIGHT_TASK_CORE
+#define STORAGE_TASK_CORE       NETWORK_TASK_CORE
+#define DYN_NOTCH_TASK_CORE     NETWORK_TASK_CORE
+#define THERMAL_CAMERA_TASK_CORE NETWORK_TASK_CORE
+#define CTRL_BANK_TASK_CORE     NETWORK_TASK_CORE
+#define EST_SHADOW_TASK_CORE    NETWORK_TASK_CORE
+#define CONSOLE_TASK_CORE       NETWORK_TASK_CORE
+
+
+// Budget of a cycle of the periodic tasks for the deadline monitor, in us
+#define STABILIZER_TASK_BUDGET_US   500
+#define SENSORS_TASK_BUDGET_US      600
+#define KALMAN_TASK_BUDGET_US       1000
+#define FLOW_TASK_BUDGET_US         1000
+#define ZRANGER2_TASK_BUDGET_US     2000
+#define MULTIRANGER_TASK_BUDGET_US  2000
+
 
 // Task names
 #define SYSTEM_TASK_NAME        "SYSTEM"
-#define LEDSEQCMD_TASK_NAME     "LEDSEQCMD"
 #define ADC_TASK_NAME           "ADC"
 #define PM_TASK_NAME            "PWRMGNT"
 #define CRTP_TX_TASK_NAME       "CRTP-TX"
@@ -165,8 +222,21 @@
 #define FLOW_TASK_NAME          "FLOW"
 #define USDLOG_TASK_NAME        "USDLOG"
 #define USDWRITE_TASK_NAME      "USDWRITE"
+#define FLIGHTREC_TASK_NAME     "FLIGHTREC"
+#define KERNEL_BENCH_TASK_NAME  "KBENCH"
+#define STORAGE_TASK_NAME       "STORAGE"
+#define WORKER_TASK_NAME        "WORKER"
+#define DYN_NOTCH_TASK_NAME     "DYNNOTCH"
+#define THERMAL_CAMERA_TASK_NAME "THERMAL"
+#define CTRL_BANK_TASK_NAME     "CTRLBANK"
+#define EST_SHADOW_TASK_NAME    "ESTSHADOW"
+#define DECK_PROBE_TASK_NAME    "DECKPROBE"
+#define CONSOLE_TASK_NAME       "CONSOLE"
 #define PCA9685_TASK_NAME       "PCA9685"
 #define CMD_HIGH_LEVEL_TASK_NAME "CMDHL"
+#define AUTONAV_TASK_NAME       "AUTONAV"
+#define AUTONAV_CRTP_TASK_NAME  "autonav_crtp"
+#define COLAV_TASK_NAME         "COLAV"
 #define MULTIRANGER_TASK_NAME   "MR"
 #define BQ_OSD_TASK_NAME        "BQ_OSDTASK"
 #define GTGPS_DECK_TASK_NAME    "GTGPS"
@@ -180,12 +250,12 @@
 #define AI_DECK_GAP_TASK_NAME   "AI-DECK-GAP"
 #define AI_DECK_NINA_TASK_NAME  "AI-DECK-NINA"
 #define UART2_TASK_NAME         "UART2"
+#define I2C_ASYNC_TASK_NAME     "I2C_ASYNC"
 
 #define configBASE_STACK_SIZE CONFIG_BASE_STACK_SIZE
 
 //Task stack sizes
 #define SYSTEM_TASK_STACKSIZE         (6 * configBASE_STACK_SIZE)
-#define LEDSEQCMD_TASK_STACKSIZE      (2 * configBASE_STACK_SIZE)
 #define ADC_TASK_STACKSIZE            (1 * configBASE_STACK_SIZE)
 #define PM_TASK_STACKSIZE             (4 * configBASE_STACK_SIZE)
 #define CRTP_TX_TASK_STACKSIZE        (2 * configBASE_STACK_SIZE)
@@ -212,12 +282,27 @@
 #define FLOW_TASK_STACKSIZE           (3 * configBASE_STACK_SIZE)
 #define USDLOG_TASK_STACKSIZE         (2 * configBASE_STACK_SIZE)
 #define USDWRITE_TASK_STACKSIZE       (2 * configBASE_STACK_SIZE)
+#define FLIGHTREC_TASK_STACKSIZE      (3 * configBASE_STACK_SIZE)
+// Runs the controllers as the stabilizer does
+#define KERNEL_BENCH_TASK_STACKSIZE   (5 * configBASE_STACK_SIZE)
+#define STORAGE_TASK_STACKSIZE        (3 * configBASE_STACK_SIZE)
+#define WORKER_TASK_STACKSIZE         (3 * configBASE_STACK_SIZE)
+#define DYN_NOTCH_TASK_STACKSIZE      (2 * configBASE_STACK_SIZE)
+#define THERMAL_CAMERA_TASK_STACKSIZE (2 * configBASE_STACK_SIZE)
+#define CTRL_BANK_TASK_STACKSIZE      (2 * configBASE_STACK_SIZE)
+#define EST_SHADOW_TASK_STACKSIZE     (2 * configBASE_STACK_SIZE)
+#define DECK_PROBE_TASK_STACKSIZE     (3 * configBASE_STACK_SIZE)
+#define CONSOLE_TASK_STACKSIZE        (1 * configBASE_STACK_SIZE)
 #define PCA9685_TASK_STACKSIZE        (2 * configBASE_STACK_SIZE)
 #define CMD_HIGH_LEVEL_TASK_STACKSIZE (2 * configBASE_STACK_SIZE)
+#define AUTONAV_TASK_STACKSIZE        (2 * configBASE_STACK_SIZE)
+#define AUTONAV_CRTP_TASK_STACKSIZE   2048  // Bytes on every target, not scaled by the base
+#define COLAV_TASK_STACKSIZE          (2 * configBASE_STACK_SIZE)
 #define MULTIRANGER_TASK_STACKSIZE    (2 * configBASE_STACK_SIZE)
 #define ACTIVEMARKER_TASK_STACKSIZE   (1 * configBASE_STACK_SIZE)
 #define AI_DECK_TASK_STACKSIZE        (1 * configBASE_STACK_SIZE)
 #define UART2_TASK_STACKSIZE          (1 * configBASE_STACK_SIZE)
+#define I2C_ASYNC_TASK_STACKSIZE      (2 * configBASE_STACK_SIZE)
 
 //The radio channel. From 0 to 125
 //TODO:
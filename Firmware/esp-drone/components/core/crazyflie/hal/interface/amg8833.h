@@ -31,6 +31,7 @@
 #include <stdbool.h>
 
 #include "i2cdev.h"
+#include "FreeRTOS.h"
 #include "task.h"
 #include "num.h"
 
@@ -86,37 +87,39 @@ typedef struct {
 typedef AMG8833_Dev_t *AMG8833_DEV;
 
 // Initiate thermal sensor
-bool begin(AMG8833_Dev_t *dev, I2C_Dev *I2Cx);
+bool amg8833Begin(AMG8833_Dev_t *dev, I2C_Dev *I2Cx);
 
 // Data capture
-void readPixels(AMG8833_Dev_t *dev, float *buf, uint8_t size);
-float readThermistor(AMG8833_Dev_t *dev);
+void amg8833ReadPixels(AMG8833_Dev_t *dev, float *buf, uint8_t size);
+// All the pixels in centi-degrees Celsius, no float conversion
+bool amg8833ReadPixelsCenti(AMG8833_Dev_t *dev, int16_t *buf);
+float amg8833ReadThermistor(AMG8833_Dev_t *dev);
 
 // Interrupts
-bool enableInterrupt(AMG8833_Dev_t *dev);
-bool disableInterrupt(AMG8833_Dev_t *dev);
-void setInterruptMode(AMG8833_Dev_t *dev, uint8_t mode);
-void getInterrupt(AMG8833_Dev_t *dev, uint8_t *buf, uint8_t size);
-void clearInterrupt(AMG8833_Dev_t *dev);
+bool amg8833EnableInterrupt(AMG8833_Dev_t *dev);
+bool amg8833DisableInterrupt(AMG8833_Dev_t *dev);
+void amg8833SetInterruptMode(AMG8833_Dev_t *dev, uint8_t mode);
+void amg8833GetInterrupt(AMG8833_Dev_t *dev, uint8_t *buf, uint8_t size);
+void amg8833ClearInterrupt(AMG8833_Dev_t *dev);
 // This will automatically set hysteresis to 95% of the high value
-void setInterruptLevels_N(AMG8833_Dev_t *dev, float high, float low);
+void amg8833SetInterruptLevels_N(AMG8833_Dev_t *dev, float high, float low);
 // This will manually set hysteresis
-void setInterruptLevels_H(AMG8833_Dev_t *dev, float high, float low, float hysteresis);
+void amg8833SetInterruptLevels_H(AMG8833_Dev_t *dev, float high, float low, float hysteresis);
 
 // Modes
-void setMovingAverageMode(AMG8833_Dev_t *dev, bool mode);
+void amg8833SetMovingAverageMode(AMG8833_Dev_t *dev, bool mode);
 
 // Read operations
-uint8_t read8(AMG8833_Dev_t *dev, uint8_t reg);
-void read(AMG8833_Dev_t *dev, uint8_t reg, uint8_t *buf, uint8_t num);
+uint8_t amg8833Read8(AMG8833_Dev_t *dev, uint8_t reg);
+void amg8833Read(AMG8833_Dev_t *dev, uint8_t reg, uint8_t *buf, uint8_t num);
 
 // Write operations
-bool write8(AMG8833_Dev_t *dev, uint16_t reg, uint8_t value);
-void write(AMG8833_Dev_t *dev, uint8_t reg, uint8_t *buf, uint8_t num);
+bool amg8833Write8(AMG8833_Dev_t *dev, uint8_t reg, uint8_t value);
+void amg8833Write(AMG8833_Dev_t *dev, uint8_t reg, uint8_t *buf, uint8_t num);
 
 // Supportive calculations
 float signedMag12ToFloat(uint16_t val);
 float int12ToFloat(uint16_t val);
-uint8_t min(uint8_t a, uint8_t b);
+uint8_t amg8833Min(uint8_t a, uint8_t b);
 
 #endif /* __AMG8833_H__ */
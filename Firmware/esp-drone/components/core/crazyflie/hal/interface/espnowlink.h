@@ -0,0 +1,54 @@
+/*
+ *    ||          ____  _ __
+ * +------+      / __ )(_) /_______________ _____  ___
+ * | 0xBC |     / __  / / __/ ___/ ___/ __ `/_  / / _ \
+ * +------+    / /_/ / / /_/ /__/ /  / /_/ / / /_/  __/
+ *  ||  ||    /_____/_/\__/\___/_/   \__,_/ /___/\___/
+ *
+ * ESP-Drone Firmware
+ *
+ * Copyright 2019-2020  Espressif Systems (Shanghai)
+ * Copyright (C) 2012 BitCraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * espnowlink.h: ESP-NOW implementation of the CRTP link
+ *
+ * With CONFIG_ESPNOW_LINK the CRTP packets go as ESP-NOW vendor action
+ * frames instead of UDP datagrams, without the association, the IP stack or
+ * the UDP tasks in the way. A frame is [seq][CRTP header][CRTP data], seq
+ * counts up by one per frame and wraps, one counter per sender. A frame that
+ * repeats the seq of the last one of its sender, or is up to
+ * ESPNOW_SEQ_REORDER_WINDOW behind it, is dropped as a duplicate.
+ *
+ * Frames sent to the broadcast address are taken like the others, so one
+ * transmitter can give setpoints to a whole swarm on the channel. Replies go
+ * to the peer of the last unicast frame only, never to the broadcast address.
+ */
+
+#ifndef __ESPNOWLINK_H__
+#define __ESPNOWLINK_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "crtp.h"
+
+// Senders whose seq is followed, the oldest one makes room for a new one
+#define ESPNOW_MAX_PEERS 8
+#define ESPNOW_SEQ_REORDER_WINDOW 16
+
+void espnowlinkInit(void);
+bool espnowlinkTest(void);
+struct crtpLinkOperations *espnowlinkGetLink(void);
+
+#endif
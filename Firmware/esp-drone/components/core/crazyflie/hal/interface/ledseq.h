@@ -61,6 +61,7 @@ typedef struct ledseqContext_s {
   ledseqStep_t* const sequence;
   struct ledseqContext_s* nextContext;
   int state;
+  int request;  // Pending run or stop, taken by the sequencer tick
   const led_t led;
 } ledseqContext_t;
 
@@ -87,34 +88,35 @@ void ledseqEnable(bool enable);
 void ledseqRegisterSequence(ledseqContext_t* context);
 
 /**
- * @brief Run a LED sequence. This function is non-blocking any may fail to start the sequence.
+ * @brief Run a LED sequence. This function is non-blocking, lock free and
+ *        never fails, the sequence starts on the next tick of the sequencer.
+ *        A sequence that is still running is not restarted.
  *
  * @param context The context for the sequence to start
- * @return true If the sequence was started
- * @return false If the sequence did not start
+ * @return true Always
  */
 bool ledseqRun(ledseqContext_t* context);
 
 /**
- * @brief Run a LED sequence. This function is blocking and may take some time,
- *        but is quaranteed to mark the sequence as started.
+ * @brief Run a LED sequence. Same as ledseqRun(), kept for the callers that
+ *        must not lose the request.
  *
  * @param context The context for the sequence to start
  */
 void ledseqRunBlocking(ledseqContext_t* context);
 
 /**
- * @brief Stop a LED sequence. This function is non-blocking any may fail to stop the sequence.
+ * @brief Stop a LED sequence. This function is non-blocking, lock free and
+ *        never fails, the sequence stops on the next tick of the sequencer.
  *
  * @param context The context for the sequence to stop
- * @return true If the sequence was stopped
- * @return false If the sequence did not stop
+ * @return true Always
  */
 bool ledseqStop(ledseqContext_t* context);
 
 /**
- * @brief Stop a LED sequence. This function is blocking and may take some time,
- *        but is quaranteed to mark the sequence as started.
+ * @brief Stop a LED sequence. Same as ledseqStop(), kept for the callers that
+ *        must not lose the request.
  *
  * @param context The context for the sequence to stop
  */
@@ -121,6 +121,16 @@ void pmSyslinkUpdate(SyslinkPacket *slp);
  */
 float pmGetBatteryVoltage(void);
 
+/**
+ * Returns the state of charge in %, compensated for the load of the motors
+ */
+float pmGetStateOfCharge(void);
+
+/**
+ * Returns the flight time left in s at the average current of the flights
+ */
+float pmGetFlightTimeLeft(void);
+
 /**
  * Returns the min battery voltage i volts as a float
  */
@@ -53,9 +53,21 @@ bool sensorsReadAcc(Axis3f *acc);
 bool sensorsReadMag(Axis3f *mag);
 bool sensorsReadBaro(baro_t *baro);
 
+/**
+ * Timestamp in us of the interrupt of the last gyro sample, from
+ * usecTimestamp(). 0 if the sensors do not have one.
+ */
+uint64_t sensorsGyroTimestamp(void);
+
 /**
  * Set acc mode, one of accModes enum
  */
 void sensorsSetAccMode(accModes accMode);
 
+/**
+ * Range in mm of the front sensor of the ranger array, UINT16_MAX if nothing
+ * is in range. False without a fresh reading.
+ */
+bool sensorsGetFrontTofMm(uint16_t *rangeMm);
+
 #endif //__SENSORS_H__
@@ -35,6 +35,7 @@ bool sensorsBmi088Bmp388ManufacturingTest(void);
 void sensorsBmi088Bmp388Acquire(sensorData_t *sensors, const uint32_t tick);
 void sensorsBmi088Bmp388WaitDataReady(void);
 bool sensorsBmi088Bmp388ReadGyro(Axis3f *gyro);
+uint64_t sensorsBmi088Bmp388GyroTimestamp(void);
 bool sensorsBmi088Bmp388ReadAcc(Axis3f *acc);
 bool sensorsBmi088Bmp388ReadMag(Axis3f *mag);
 bool sensorsBmi088Bmp388ReadBaro(baro_t *baro);
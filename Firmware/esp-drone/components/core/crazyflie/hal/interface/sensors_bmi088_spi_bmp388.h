@@ -35,6 +35,7 @@ bool sensorsBmi088SpiBmp388ManufacturingTest(void);
 void sensorsBmi088SpiBmp388Acquire(sensorData_t *sensors, const uint32_t tick);
 void sensorsBmi088SpiBmp388WaitDataReady(void);
 bool sensorsBmi088SpiBmp388ReadGyro(Axis3f *gyro);
+uint64_t sensorsBmi088SpiBmp388GyroTimestamp(void);
 bool sensorsBmi088SpiBmp388ReadAcc(Axis3f *acc);
 bool sensorsBmi088SpiBmp388ReadMag(Axis3f *mag);
 bool sensorsBmi088SpiBmp388ReadBaro(baro_t *baro);
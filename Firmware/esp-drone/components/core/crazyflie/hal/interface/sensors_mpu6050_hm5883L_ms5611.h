@@ -36,6 +36,7 @@ bool sensorsMpu6050Hmc5883lMs5611ManufacturingTest(void);
 void sensorsMpu6050Hmc5883lMs5611Acquire(sensorData_t *sensors, const uint32_t tick);
 void sensorsMpu6050Hmc5883lMs5611WaitDataReady(void);
 bool sensorsMpu6050Hmc5883lMs5611ReadGyro(Axis3f *gyro);
+uint64_t sensorsMpu6050Hmc5883lMs5611GyroTimestamp(void);
 bool sensorsMpu6050Hmc5883lMs5611ReadAcc(Axis3f *acc);
 bool sensorsMpu6050Hmc5883lMs5611ReadMag(Axis3f *mag);
 bool sensorsMpu6050Hmc5883lMs5611ReadBaro(baro_t *baro);
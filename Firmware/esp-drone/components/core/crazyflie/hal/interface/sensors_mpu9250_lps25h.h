@@ -35,6 +35,7 @@ bool sensorsMpu9250Lps25hManufacturingTest(void);
 void sensorsMpu9250Lps25hAcquire(sensorData_t *sensors, const uint32_t tick);
 void sensorsMpu9250Lps25hWaitDataReady(void);
 bool sensorsMpu9250Lps25hReadGyro(Axis3f *gyro);
+uint64_t sensorsMpu9250Lps25hGyroTimestamp(void);
 bool sensorsMpu9250Lps25hReadAcc(Axis3f *acc);
 bool sensorsMpu9250Lps25hReadMag(Axis3f *mag);
 bool sensorsMpu9250Lps25hReadBaro(baro_t *baro);
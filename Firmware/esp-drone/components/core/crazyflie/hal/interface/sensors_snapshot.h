@@ -0,0 +1,68 @@
+/**
+ *
+ * ESP-Drone Firmware
+ *
+ * Copyright 2019-2020  Espressif Systems (Shanghai)
+ * Copyright (C) 2011-2012 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * sensors_snapshot.h - The samples of the sensors task, published as a whole
+ *
+ * The sensors drivers publish their sensorData_t with a seqlock once per IMU
+ * sample, and again for a baro sample, with a count of the samples of each
+ * sensor. sensorsReadGyro() and the others copy the latest snapshot wait-free
+ * and take a sample only if it is newer than the one taken last, so a sample
+ * still goes to a single reader as with the queues of one item before. The
+ * IMU samples no reader took are counted.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "stabilizer_types.h"
+
+typedef struct {
+  sensorData_t data;
+  uint32_t imuSeq;          // Acc and gyro samples since the start
+  uint32_t magSeq;
+  uint32_t baroSeq;
+} sensorsSnapshot_t;
+
+/**
+ * Take the sample seq of a sensor unless it or a newer one was taken already,
+ * readers on both cores may race for it.
+ *
+ * @param takenSeq - the sequence of the last sample taken of the sensor
+ * @param seq - the sequence of the sample in the snapshot
+ * @param missed - incremented by the samples published between the two, or NULL
+ * @return true if the sample is new, false if it is stale
+ */
+static inline bool sensorsSnapshotTake(uint32_t *takenSeq, uint32_t seq, uint32_t *missed)
+{
+  uint32_t taken = __atomic_load_n(takenSeq, __ATOMIC_RELAXED);
+
+  do {
+    if ((int32_t)(seq - taken) <= 0) {
+      return false;
+    }
+  } while (!__atomic_compare_exchange_n(takenSeq, &taken, seq, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+  if (missed) {
+    *missed += seq - taken - 1;
+  }
+  return true;
+}
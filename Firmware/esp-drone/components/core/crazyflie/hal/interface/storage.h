@@ -42,7 +42,7 @@ void storageInit();
 /**
  * Test the storage subsystem
  * 
- * Check the key/buffer table health. If the table is not healthy, format it.
+ * Read the key/buffer table into its RAM index. If the table is not healthy, format it.
  */
 bool storageTest();
 
@@ -50,11 +50,11 @@ bool storageTest();
  * Store a buffer in a key. If the key already exist in the table,
  * it will be replaced.
  * 
- * This function can take a lot of time to complete: if there is no space for the new buffer,
- * the memory is going to be defragmented before the new buffer is written.
+ * The new buffer is appended to the table. If there is no free space left for it, the
+ * memory is compacted first, which can take a lot of time and is not done while flying.
  * 
- * This function can fail either if there is no place left in memory or if the memory
- * is corrupted.
+ * This function can fail either if there is no place left in memory, if it is flying
+ * with no free space left, or if the memory is corrupted.
  * 
  * @param[key] Null terminated string for the key. Its length must be between 1 and 255.
  * @param[buffer] Pointer to the buffer to store
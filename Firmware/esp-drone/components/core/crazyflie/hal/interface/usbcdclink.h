@@ -0,0 +1,82 @@
+/*
+ *    ||          ____  _ __
+ * +------+      / __ )(_) /_______________ _____  ___
+ * | 0xBC |     / __  / / __/ ___/ ___/ __ `/_  / / _ \
+ * +------+    / /_/ / / /_/ /__/ /  / /_/ / / /_/  __/
+ *  ||  ||    /_____/_/\__/\___/_/   \__,_/ /___/\___/
+ *
+ * ESP-Drone Firmware
+ *
+ * Copyright 2019-2020  Espressif Systems (Shanghai)
+ * Copyright (C) 2012 BitCraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * usbcdclink.h: USB CDC implementation of the CRTP link, ESP32-S2 and S3
+ *
+ * With CONFIG_USB_CDC_LINK the native USB of the chip is a CDC ACM serial
+ * port, over TinyUSB. The CRTP packets are framed on the byte stream as
+ * [USBCDC_FRAME_SYNC][length][CRTP header][CRTP data][checksum], length
+ * counts the header and the data, the checksum is the sum of both modulo
+ * 256 like the one of the UDP datagrams. A frame that does not check out is
+ * dropped and the receiver looks for the next sync byte.
+ *
+ * A host asks for large frames with the CRTP packet
+ * [USBCDC_CTRL_HEADER][USBCDC_CTRL_LARGE][max:2], answered with
+ * [USBCDC_CTRL_HEADER][USBCDC_CTRL_LARGE][accepted:2], little endian sizes of
+ * CRTP data as for the UDP link. Replies too large for a CRTP packet then
+ * come as [USBCDC_FRAME_SYNC_LARGE][length:2][CRTP header][data][checksum],
+ * length little endian. With CONFIG_CRTP_LARGE_FRAMES only, else 0 is
+ * accepted. Closing the port ends the large frames.
+ *
+ * The link takes over from the radio link when the host opens the port (sets
+ * DTR) and hands it back when the host closes it or the cable is pulled.
+ * There is no packet rate limit like the one of the datagrams, the CRTP TX
+ * queue drains at the speed of the USB, so log blocks, TOC and flight
+ * recorder downloads go as fast as the services produce them.
+ */
+
+#ifndef __USBCDCLINK_H__
+#define __USBCDCLINK_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "crtp.h"
+
+#define USBCDC_FRAME_SYNC 0xA5
+// Sync, length and checksum
+#define USBCDC_FRAME_OVERHEAD 3
+#define USBCDC_FRAME_SYNC_LARGE 0xA6
+// Sync, two bytes of length and checksum
+#define USBCDC_FRAME_LARGE_OVERHEAD 4
+
+// The CRTP null packet header, as WIFI_CTRL_HEADER
+#define USBCDC_CTRL_HEADER 0xFF
+#define USBCDC_CTRL_LARGE  0x4C
+
+#ifdef CONFIG_USB_CDC_LINK
+/**
+ * Start the USB device.
+ *
+ * @param radioLink The link in use while the port is closed
+ */
+void usbcdclinkInit(struct crtpLinkOperations *radioLink);
+bool usbcdclinkTest(void);
+struct crtpLinkOperations *usbcdclinkGetLink(void);
+#else
+#define usbcdclinkInit(radioLink)
+#define usbcdclinkTest() true
+#endif
+
+#endif
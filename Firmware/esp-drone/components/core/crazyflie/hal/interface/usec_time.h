@@ -34,7 +34,9 @@
 void initUsecTimer(void);
 
 /**
- * Get microsecond-resolution timestamp.
+ * Get microsecond-resolution timestamp, the time since the esp_timer started.
+ * Use it for all the timestamps of samples, measurements and packets that are
+ * compared with each other. Can be called from an ISR.
  */
 uint64_t usecTimestamp(void);
 
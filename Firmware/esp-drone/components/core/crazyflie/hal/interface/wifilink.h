@@ -29,6 +29,7 @@
 #define __WIFILINK_H__
 
 #include <stdbool.h>
+#include <stdint.h>
 #include "crtp.h"
 
 #define SYSLINK_MTU 64
@@ -76,4 +77,10 @@ void wifilinkInit();
 bool wifilinkTest();
 struct crtpLinkOperations *wifilinkGetLink();
 
+/**
+ * Number of CRTP packets received since boot. It is only incremented by the
+ * receive path, the link LED and the crtpLink log group sample it.
+ */
+uint32_t wifilinkGetActivityCount(void);
+
 #endif
@@ -28,6 +28,8 @@
 
 const float AMG88xx_TEMP_CONVERSION = 0.25;
 const float AMG88xx_THRM_CONVERSION = 0.0625;
+// Centi-degrees per pixel count, 0.25 degrees
+#define AMG88xx_TEMP_CENTI 25
 
 static uint8_t mode = 1;
 
@@ -38,20 +40,20 @@ static uint8_t mode = 1;
  @param  I2Cx I2C driver instance
  @returns True if device is set up, false on any failure
 **************************************************************************/
-bool begin(AMG8833_Dev_t *dev, I2C_Dev *I2Cx)
+bool amg8833Begin(AMG8833_Dev_t *dev, I2C_Dev *I2Cx)
 {
   // Set I2C parameters
   dev->I2Cx = I2Cx;
   dev->devAddr = AMG88xx_ADDRESS;
   bool i2c_complete = i2cdevInit(dev->I2Cx);
   // Enter normal mode
-  bool mode_selected = write8(dev, AMG88xx_PCTL, AMG88xx_NORMAL_MODE);
+  bool mode_selected = amg8833Write8(dev, AMG88xx_PCTL, AMG88xx_NORMAL_MODE);
   // Software reset
-  bool software_resetted = write8(dev, AMG88xx_RST, AMG88xx_INITIAL_RESET);
+  bool software_resetted = amg8833Write8(dev, AMG88xx_RST, AMG88xx_INITIAL_RESET);
   //disable interrupts by default
-  bool interrupts_set = disableInterrupt(dev);
+  bool interrupts_set = amg8833DisableInterrupt(dev);
   //set to 10 FPS
-  bool fps_set = write8(dev, AMG88xx_FPSC, (AMG88xx_FPS_10 & 0x01));
+  bool fps_set = amg8833Write8(dev, AMG88xx_FPSC, (AMG88xx_FPS_10 & 0x01));
   vTaskDelay(M2T(10));
   return i2c_complete && mode_selected && software_resetted &&
     interrupts_set && fps_set;
@@ -65,13 +67,13 @@ bool begin(AMG8833_Dev_t *dev, I2C_Dev *I2Cx)
  @param  size Optionsl number of bytes to read (up to 64). Default is 64 bytes.
  @return up to 64 bytes of pixel data in buf
 **************************************************************************/
-void readPixels(AMG8833_Dev_t *dev, float *buf, uint8_t size)
+void amg8833ReadPixels(AMG8833_Dev_t *dev, float *buf, uint8_t size)
 {
   uint16_t recast;
   float converted;
-  uint8_t bytesToRead = min((uint8_t) (size << 1), (uint8_t) (AMG88xx_PIXEL_ARRAY_SIZE << 1));
-  uint8_t rawArray[bytesToRead];
-  read(dev, AMG88xx_PIXEL_OFFSET, rawArray, bytesToRead);
+  uint8_t rawArray[AMG88xx_PIXEL_ARRAY_SIZE << 1];
+  size = amg8833Min(size, AMG88xx_PIXEL_ARRAY_SIZE);
+  amg8833Read(dev, AMG88xx_PIXEL_OFFSET, rawArray, size << 1);
 
   for (int i = 0; i < size; i++) {
     uint8_t pos = i << 1;
@@ -81,16 +83,39 @@ void readPixels(AMG8833_Dev_t *dev, float *buf, uint8_t size)
   }
 }
 
+/**************************************************************************
+ Read all the pixels in centi-degrees Celsius, in integers all the way. The
+ -20 to 80 degrees the pixels measure fit an int16_t with room to spare.
+
+ @param  dev Thermal camera struct
+ @param  buf the array to place the AMG88xx_PIXEL_ARRAY_SIZE pixels in
+ @returns true if the pixels were read
+**************************************************************************/
+bool amg8833ReadPixelsCenti(AMG8833_Dev_t *dev, int16_t *buf)
+{
+  uint8_t rawArray[AMG88xx_PIXEL_ARRAY_SIZE << 1];
+  if (!i2cdevReadReg8(dev->I2Cx, dev->devAddr, AMG88xx_PIXEL_OFFSET, sizeof(rawArray), rawArray)) {
+    return false;
+  }
+
+  for (int i = 0; i < AMG88xx_PIXEL_ARRAY_SIZE; i++) {
+    // The 12 bit two's complement count, sign extended
+    int16_t count = (int16_t)(((uint16_t)rawArray[2 * i + 1] << 12) | ((uint16_t)rawArray[2 * i] << 4)) >> 4;
+    buf[i] = count * AMG88xx_TEMP_CENTI;
+  }
+  return true;
+}
+
 /**************************************************************************
  Read the onboard thermistor
 
  @param  pdev Thermal camera struct
  @returns a the floating point temperature in degrees Celsius
 **************************************************************************/
-float readThermistor(AMG8833_Dev_t *dev)
+float amg8833ReadThermistor(AMG8833_Dev_t *dev)
 {
   uint8_t raw[2];
-  read(dev, AMG88xx_TTHL, raw, 2);
+  amg8833Read(dev, AMG88xx_TTHL, raw, 2);
   uint16_t recast = ((uint16_t) raw[1] << 8) | ((uint16_t) raw[0]);
   return signedMag12ToFloat(recast) * AMG88xx_THRM_CONVERSION;
 }
@@ -100,11 +125,11 @@ float readThermistor(AMG8833_Dev_t *dev)
 
  @param  pdev Thermal camera struct
 **************************************************************************/
-bool enableInterrupt(AMG8833_Dev_t *dev)
+bool amg8833EnableInterrupt(AMG8833_Dev_t *dev)
 {
   // 0 = Difference interrupt mode
   // 1 = absolute value interrupt mode
-  return write8(dev, AMG88xx_INTC, (mode << 1 | 1) & 0x03);
+  return amg8833Write8(dev, AMG88xx_INTC, (mode << 1 | 1) & 0x03);
 }
 
 /**************************************************************************
@@ -112,11 +137,11 @@ bool enableInterrupt(AMG8833_Dev_t *dev)
 
  @param  pdev Thermal camera struct
 **************************************************************************/
-bool disableInterrupt(AMG8833_Dev_t *dev)
+bool amg8833DisableInterrupt(AMG8833_Dev_t *dev)
 {
   // 0 = Difference interrupt mode
   // 1 = absolute value interrupt mode
-  return write8(dev, AMG88xx_INTC, (mode << 1 | 0) & 0x03);
+  return amg8833Write8(dev, AMG88xx_INTC, (mode << 1 | 0) & 0x03);
 }
 
 /**************************************************************************
@@ -126,10 +151,10 @@ bool disableInterrupt(AMG8833_Dev_t *dev)
  @param  mode passing AMG88xx_DIFFERENCE sets the device to difference
  mode, AMG88xx_ABSOLUTE_VALUE sets to absolute value mode.
 **************************************************************************/
-void setInterruptMode(AMG8833_Dev_t *dev, uint8_t m)
+void amg8833SetInterruptMode(AMG8833_Dev_t *dev, uint8_t m)
 {
   mode = m;
-  write8(dev, AMG88xx_INTC, (mode << 1 | 1) & 0x03);
+  amg8833Write8(dev, AMG88xx_INTC, (mode << 1 | 1) & 0x03);
 }
 
 /**************************************************************************
@@ -141,10 +166,10 @@ void setInterruptMode(AMG8833_Dev_t *dev, uint8_t m)
  @param  size Optional number of bytes to read. Default is 8 bytes.
  @returns up to 8 bytes of data in buf
 **************************************************************************/
-void getInterrupt(AMG8833_Dev_t *dev, uint8_t *buf, uint8_t size)
+void amg8833GetInterrupt(AMG8833_Dev_t *dev, uint8_t *buf, uint8_t size)
 {
-  uint8_t bytesToRead = min(size, (uint8_t) 8);
-  read(dev, AMG88xx_INT_OFFSET, buf, bytesToRead);
+  uint8_t bytesToRead = amg8833Min(size, (uint8_t) 8);
+  amg8833Read(dev, AMG88xx_INT_OFFSET, buf, bytesToRead);
 }
 
 /**************************************************************************
@@ -152,9 +177,9 @@ void getInterrupt(AMG8833_Dev_t *dev, uint8_t *buf, uint8_t size)
 
  @param  pdev Thermal camera struct
 **************************************************************************/
-void clearInterrupt(AMG8833_Dev_t *dev)
+void amg8833ClearInterrupt(AMG8833_Dev_t *dev)
 {
-  write8(dev, AMG88xx_RST, AMG88xx_FLAG_RESET);
+  amg8833Write8(dev, AMG88xx_RST, AMG88xx_FLAG_RESET);
 }
 
 /**************************************************************************
@@ -164,9 +189,9 @@ void clearInterrupt(AMG8833_Dev_t *dev)
  @param  high the value above which an interrupt will be triggered
  @param  low the value below which an interrupt will be triggered
 **************************************************************************/
-void setInterruptLevels_N(AMG8833_Dev_t *dev, float high, float low)
+void amg8833SetInterruptLevels_N(AMG8833_Dev_t *dev, float high, float low)
 {
-  setInterruptLevels_H(dev, high, low, high * 0.95f);
+  amg8833SetInterruptLevels_H(dev, high, low, high * 0.95f);
 }
 
 /**************************************************************************
@@ -177,23 +202,23 @@ void setInterruptLevels_N(AMG8833_Dev_t *dev, float high, float low)
  @param  low the value below which an interrupt will be triggered
  @param  hysteresis the hysteresis value for interrupt detection
 **************************************************************************/
-void setInterruptLevels_H(AMG8833_Dev_t *dev, float high, float low,
+void amg8833SetInterruptLevels_H(AMG8833_Dev_t *dev, float high, float low,
   float hysteresis)
 {
   int highConv = high / AMG88xx_TEMP_CONVERSION;
   highConv = constrain(highConv, -4095, 4095);
-  write8(dev, AMG88xx_INTHL, (highConv & 0xFF));
-  write8(dev, AMG88xx_INTHH, ((highConv & 0xF) >> 4));
+  amg8833Write8(dev, AMG88xx_INTHL, (highConv & 0xFF));
+  amg8833Write8(dev, AMG88xx_INTHH, ((highConv & 0xF) >> 4));
 
   int lowConv = low / AMG88xx_TEMP_CONVERSION;
   lowConv = constrain(lowConv, -4095, 4095);
-  write8(dev, AMG88xx_INTLL, (lowConv & 0xFF));
-  write8(dev, AMG88xx_INTLH, (((lowConv & 0xF) >> 4) & 0xF));
+  amg8833Write8(dev, AMG88xx_INTLL, (lowConv & 0xFF));
+  amg8833Write8(dev, AMG88xx_INTLH, (((lowConv & 0xF) >> 4) & 0xF));
 
   int hysConv = hysteresis / AMG88xx_TEMP_CONVERSION;
   hysConv = constrain(hysConv, -4095, 4095);
-  write8(dev, AMG88xx_IHYSL, (hysConv & 0xFF));
-  write8(dev, AMG88xx_IHYSH, (((hysConv & 0xF) >> 4) & 0xF));
+  amg8833Write8(dev, AMG88xx_IHYSL, (hysConv & 0xFF));
+  amg8833Write8(dev, AMG88xx_IHYSH, (((hysConv & 0xF) >> 4) & 0xF));
 }
 
 /**************************************************************************
@@ -202,9 +227,9 @@ void setInterruptLevels_H(AMG8833_Dev_t *dev, float high, float low,
  @param  pdev Thermal camera struct
  @param  mode If false, no moving average. If true, twice the moving average
 **************************************************************************/
-void setMovingAverageMode(AMG8833_Dev_t *dev, bool mode)
+void amg8833SetMovingAverageMode(AMG8833_Dev_t *dev, bool mode)
 {
-  write8(dev, AMG88xx_AVE, (mode << 5));
+  amg8833Write8(dev, AMG88xx_AVE, (mode << 5));
 }
 
 /**************************************************************************
@@ -214,10 +239,10 @@ void setMovingAverageMode(AMG8833_Dev_t *dev, bool mode)
  @param  reg the register to read
  @returns one byte of register data
 **************************************************************************/
-uint8_t read8(AMG8833_Dev_t *dev, uint8_t reg)
+uint8_t amg8833Read8(AMG8833_Dev_t *dev, uint8_t reg)
 {
   uint8_t ret;
-  read(dev, reg, &ret, 1);
+  amg8833Read(dev, reg, &ret, 1);
   return ret;
 }
 
@@ -229,7 +254,7 @@ uint8_t read8(AMG8833_Dev_t *dev, uint8_t reg)
  @param  buf integer buffer to save read bytes
  @param  num number of bytes need to be read
 **************************************************************************/
-void read(AMG8833_Dev_t *dev, uint8_t reg, uint8_t *buf, uint8_t num)
+void amg8833Read(AMG8833_Dev_t *dev, uint8_t reg, uint8_t *buf, uint8_t num)
 {
   i2cdevReadReg8(dev->I2Cx, dev->devAddr, reg, num, buf);
 }
@@ -242,9 +267,10 @@ void read(AMG8833_Dev_t *dev, uint8_t reg, uint8_t *buf, uint8_t num)
  @param  value the value to write
  @returns result of the write operation
 **************************************************************************/
-bool write8(AMG8833_Dev_t *dev, uint16_t reg, uint8_t value)
+bool amg8833Write8(AMG8833_Dev_t *dev, uint8_t reg, uint8_t value)
 {
-  return (i2cdevWrite16(dev->I2Cx, dev->devAddr, reg, 1, &value));
+  // The registers have 8 bit addresses
+  return i2cdevWriteByte(dev->I2Cx, dev->devAddr, reg, value);
 }
 
 /**************************************************************************
@@ -255,10 +281,10 @@ bool write8(AMG8833_Dev_t *dev, uint16_t reg, uint8_t value)
  @param  buf integer buffer containing data to write
  @param  num number of bytes need to be written
 **************************************************************************/
-void write(AMG8833_Dev_t *dev, uint8_t reg, uint8_t *buf, uint8_t num)
+void amg8833Write(AMG8833_Dev_t *dev, uint8_t reg, uint8_t *buf, uint8_t num)
 {
   for (int i = 0; i < num; i++) {
-    write8(dev, reg, buf[i]);
+    amg8833Write8(dev, reg, buf[i]);
   }
 }
 
@@ -297,7 +323,7 @@ float int12ToFloat(uint16_t val)
  @param  b second integer value
  @returns the minimum of a and b integers
 **************************************************************************/
-uint8_t min(uint8_t a, uint8_t b)
+uint8_t amg8833Min(uint8_t a, uint8_t b)
 {
   return (a < b) ? a : b;
 }
@@ -0,0 +1,328 @@
+/*
+ *    ||          ____  _ __
+ * +------+      / __ )(_) /_______________ _____  ___
+ * | 0xBC |     / __  / / __/ ___/ ___/ __ `/_  / / _ \
+ * +------+    / /_/ / / /_/ /__/ /  / /_/ / / /_/  __/
+ *  ||  ||    /_____/_/\__/\___/_/   \__,_/ /___/\___/
+ *
+ * ESP-Drone Firmware
+ *
+ * Copyright 2019-2020  Espressif Systems (Shanghai)
+ * Copyright (C) 2012 BitCraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * espnowlink.c: ESP-NOW implementation of the CRTP link
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "sdkconfig.h"
+
+#ifdef CONFIG_ESPNOW_LINK
+
+#include "esp_now.h"
+#include "esp_wifi.h"
+
+#include "config.h"
+#include "espnowlink.h"
+#include "crtp.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+#include "semphr.h"
+#include "stm32_legacy.h"
+#include "log.h"
+
+#define DEBUG_MODULE "ESPNOW"
+#include "debug_cf.h"
+
+#define ESPNOW_ACTIVITY_TIMEOUT_MS (1000)
+#define ESPNOW_RX_QUEUE_SIZE       16
+// Frames handed to the Wi-Fi driver and not sent yet
+#define ESPNOW_TX_IN_FLIGHT        4
+#define ESPNOW_TX_WAIT_MS          10
+// The seq and the CRTP header
+#define ESPNOW_FRAME_HEADER_SIZE   2
+
+typedef struct {
+    uint8_t mac[ESP_NOW_ETH_ALEN];
+    uint8_t lastSeq;
+    uint32_t lastTick;
+    bool isActive;
+} espnowPeer_t;
+
+static const uint8_t broadcastMac[ESP_NOW_ETH_ALEN] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+
+static bool isInit = false;
+
+// Written by the Wi-Fi task only
+static espnowPeer_t peers[ESPNOW_MAX_PEERS];
+
+// The peer replies go to, the last one that sent a unicast frame
+static portMUX_TYPE replyLock = portMUX_INITIALIZER_UNLOCKED;
+static uint8_t replyMac[ESP_NOW_ETH_ALEN];
+static bool hasReplyPeer;
+
+static xQueueHandle rxQueue;
+static SemaphoreHandle_t txSlots;
+static uint8_t txSeq;
+static uint8_t txFrame[ESPNOW_FRAME_HEADER_SIZE + CRTP_MAX_DATA_SIZE];
+static uint8_t txPeerMac[ESP_NOW_ETH_ALEN];
+
+static uint32_t lastPacketTick;
+
+static uint32_t rxCount;
+static uint32_t rxBroadcastCount;
+static uint32_t rxDuplicateCount;
+static uint32_t rxDropCount;
+static uint32_t txCount;
+static uint32_t txFailCount;
+
+static int espnowlinkSendPacket(CRTPPacket *p);
+static int espnowlinkSetEnable(bool enable);
+static int espnowlinkReceiveCRTPPacket(CRTPPacket *p);
+
+static bool espnowlinkIsConnected(void)
+{
+    return (xTaskGetTickCount() - lastPacketTick) < M2T(ESPNOW_ACTIVITY_TIMEOUT_MS);
+}
+
+static struct crtpLinkOperations espnowlinkOp = {
+    .setEnable         = espnowlinkSetEnable,
+    .sendPacket        = espnowlinkSendPacket,
+    .receivePacket     = espnowlinkReceiveCRTPPacket,
+    .isConnected       = espnowlinkIsConnected,
+};
+
+/* The peer of the sender, a new sender takes the slot of the least recent one */
+static espnowPeer_t *espnowlinkPeerOf(const uint8_t *mac, bool *isNew)
+{
+    espnowPeer_t *oldest = &peers[0];
+
+    for (int i = 0; i < ESPNOW_MAX_PEERS; i++) {
+        if (peers[i].isActive && memcmp(peers[i].mac, mac, ESP_NOW_ETH_ALEN) == 0) {
+            *isNew = false;
+            return &peers[i];
+        }
+        if (!peers[i].isActive) {
+            oldest = &peers[i];
+            break;
+        }
+        if ((int32_t)(peers[i].lastTick - oldest->lastTick) < 0) {
+            oldest = &peers[i];
+        }
+    }
+
+    memcpy(oldest->mac, mac, ESP_NOW_ETH_ALEN);
+    oldest->isActive = true;
+    *isNew = true;
+    return oldest;
+}
+
+/* A repeat or a late frame of the sender, a seq far behind is a sender that started over */
+static bool espnowlinkIsDuplicate(const uint8_t *mac, uint8_t seq)
+{
+    bool isNew;
+    espnowPeer_t *peer = espnowlinkPeerOf(mac, &isNew);
+    const int8_t ahead = (int8_t)(seq - peer->lastSeq);
+
+    peer->lastTick = xTaskGetTickCount();
+    if (!isNew && ahead <= 0 && ahead > -ESPNOW_SEQ_REORDER_WINDOW) {
+        return true;
+    }
+
+    peer->lastSeq = seq;
+    return false;
+}
+
+/* Runs in the Wi-Fi task, must not block */
+static void espnowlinkRecvCb(const esp_now_recv_info_t *info, const uint8_t *data, int len)
+{
+    if (len < ESPNOW_FRAME_HEADER_SIZE || len > ESPNOW_FRAME_HEADER_SIZE + CRTP_MAX_DATA_SIZE) {
+        return;
+    }
+
+    if (espnowlinkIsDuplicate(info->src_addr, data[0])) {
+        rxDuplicateCount++;
+        return;
+    }
+
+    if (memcmp(info->des_addr, broadcastMac, ESP_NOW_ETH_ALEN) == 0) {
+        rxBroadcastCount++;
+    } else {
+        portENTER_CRITICAL(&replyLock);
+        memcpy(replyMac, info->src_addr, ESP_NOW_ETH_ALEN);
+        hasReplyPeer = true;
+        portEXIT_CRITICAL(&replyLock);
+    }
+
+    CRTPPacket packet;
+    packet.header = data[1];
+    packet.size = len - ESPNOW_FRAME_HEADER_SIZE;
+    memcpy(packet.data, &data[ESPNOW_FRAME_HEADER_SIZE], packet.size);
+
+    lastPacketTick = xTaskGetTickCount();
+    rxCount++;
+
+    // The setpoints go straight to the commander, the latency is what this link is for
+    if (crtpIsPortDirect(packet.port)) {
+        crtpDispatchDirect(&packet);
+    } else if (xQueueSend(rxQueue, &packet, 0) != pdTRUE) {
+        rxDropCount++;
+    }
+}
+
+static void espnowlinkSendCb(const uint8_t *mac, esp_now_send_status_t status)
+{
+    if (status != ESP_NOW_SEND_SUCCESS) {
+        txFailCount++;
+    }
+    xSemaphoreGive(txSlots);
+}
+
+static int espnowlinkReceiveCRTPPacket(CRTPPacket *p)
+{
+    if (xQueueReceive(rxQueue, p, M2T(100)) != pdTRUE) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Adds the peer to the driver before the first frame to it, there is room for one at a time */
+static bool espnowlinkSetTxPeer(const uint8_t *mac)
+{
+    if (memcmp(mac, txPeerMac, ESP_NOW_ETH_ALEN) == 0 && esp_now_is_peer_exist(mac)) {
+        return true;
+    }
+
+    if (esp_now_is_peer_exist(txPeerMac)) {
+        esp_now_del_peer(txPeerMac);
+    }
+
+    esp_now_peer_info_t peer = {
+        .channel = 0, // The channel of the Wi-Fi network
+#ifdef CONFIG_WIFI_STATION
+        .ifidx = WIFI_IF_STA,
+#else
+        .ifidx = WIFI_IF_AP,
+#endif
+        .encrypt = false,
+    };
+    memcpy(peer.peer_addr, mac, ESP_NOW_ETH_ALEN);
+    if (esp_now_add_peer(&peer) != ESP_OK) {
+        return false;
+    }
+
+    memcpy(txPeerMac, mac, ESP_NOW_ETH_ALEN);
+    return true;
+}
+
+static int espnowlinkSendPacket(CRTPPacket *p)
+{
+    uint8_t mac[ESP_NOW_ETH_ALEN];
+    bool hasPeer;
+
+    ASSERT(p->size <= CRTP_MAX_DATA_SIZE);
+
+    portENTER_CRITICAL(&replyLock);
+    memcpy(mac, replyMac, ESP_NOW_ETH_ALEN);
+    hasPeer = hasReplyPeer;
+    portEXIT_CRITICAL(&replyLock);
+
+    // Nobody to reply to, like a UDP link nobody connected to
+    if (!hasPeer) {
+        return true;
+    }
+
+    if (!espnowlinkSetTxPeer(mac)) {
+        return false;
+    }
+
+    // Kept in the CRTP TX queue while the driver is busy
+    if (xSemaphoreTake(txSlots, M2T(ESPNOW_TX_WAIT_MS)) != pdTRUE) {
+        return false;
+    }
+
+    txFrame[0] = txSeq;
+    txFrame[1] = p->header;
+    memcpy(&txFrame[ESPNOW_FRAME_HEADER_SIZE], p->data, p->size);
+
+    if (esp_now_send(mac, txFrame, ESPNOW_FRAME_HEADER_SIZE + p->size) != ESP_OK) {
+        xSemaphoreGive(txSlots);
+        return false;
+    }
+
+    txSeq++;
+    txCount++;
+    return true;
+}
+
+static int espnowlinkSetEnable(bool enable)
+{
+    return 0;
+}
+
+/*
+ * Public functions
+ */
+
+void espnowlinkInit(void)
+{
+    if (isInit) {
+        return;
+    }
+
+    // Runs after wifiInit(), the frames go out on the channel of the access point
+    if (esp_now_init() != ESP_OK) {
+        DEBUG_PRINT("ESP-NOW init failed\n");
+        return;
+    }
+
+    rxQueue = xQueueCreate(ESPNOW_RX_QUEUE_SIZE, sizeof(CRTPPacket));
+    txSlots = xSemaphoreCreateCounting(ESPNOW_TX_IN_FLIGHT, ESPNOW_TX_IN_FLIGHT);
+
+    esp_now_register_recv_cb(espnowlinkRecvCb);
+    esp_now_register_send_cb(espnowlinkSendCb);
+
+    isInit = true;
+}
+
+bool espnowlinkTest(void)
+{
+    return isInit;
+}
+
+struct crtpLinkOperations *espnowlinkGetLink(void)
+{
+    return &espnowlinkOp;
+}
+
+/**
+ * rxBcast counts the frames sent to the broadcast address, dup the repeated
+ * and late ones, rxDrop the ones the CRTP RX queue had no room for.
+ * txFail counts the frames the peer did not ack.
+ */
+LOG_GROUP_START(espnow)
+LOG_ADD(LOG_UINT32, rx, &rxCount)
+LOG_ADD(LOG_UINT32, rxBcast, &rxBroadcastCount)
+LOG_ADD(LOG_UINT32, dup, &rxDuplicateCount)
+LOG_ADD(LOG_UINT32, rxDrop, &rxDropCount)
+LOG_ADD(LOG_UINT32, tx, &txCount)
+LOG_ADD(LOG_UINT32, txFail, &txFailCount)
+LOG_GROUP_STOP(espnow)
+
+#endif // CONFIG_ESPNOW_LINK
@@ -32,7 +32,6 @@
 
 #include "FreeRTOS.h"
 #include "timers.h"
-#include "semphr.h"
 #include "static_mem.h"
 
 #include "led.h"
@@ -171,28 +170,39 @@ ledseqContext_t seq_testFailed = {
   .led = SYS_LED,
 };
 
-struct ledseqCmd_s {
-  enum {run, stop} command;
-  ledseqContext_t *sequence;
-};
+/* Led sequence handling machine implementation
+ *
+ * A single periodic timer runs all the LEDs. Every LEDSEQ_TICK_MS it applies
+ * the run and stop requests posted since the last tick, then plays the steps
+ * of the LEDs whose current step has ended. The duration of a step is rounded
+ * up to whole ticks, so the 1 ms link blink lasts one tick.
+ *
+ * Requests are a single word per sequence, written by any task and taken by the
+ * timer: posting one takes no lock and cannot fail, and the requests of a
+ * sequence between two ticks collapse into the last one. A run request for a
+ * sequence that is still playing is absorbed by it, so the link sequences,
+ * started on every packet, blink at most once per two ticks.
+ */
+#define LEDSEQ_TICK_MS      10
 
-/* Led sequence handling machine implementation */
-static void runLedseq(xTimerHandle xTimer);
+#define LEDSEQ_REQUEST_NONE 0
+#define LEDSEQ_REQUEST_RUN  1
+#define LEDSEQ_REQUEST_STOP 2
+
+static void ledseqTick(xTimerHandle xTimer);
 static void updateActive(led_t led);
 
 NO_DMA_CCM_SAFE_ZERO_INIT static ledseqContext_t* activeSeq[LED_NUM];
+// Tick at which the current step of each led ends
+NO_DMA_CCM_SAFE_ZERO_INIT static uint32_t stepEnd[LED_NUM];
+static uint32_t tickCount;
 
-NO_DMA_CCM_SAFE_ZERO_INIT static xTimerHandle timer[LED_NUM];
-NO_DMA_CCM_SAFE_ZERO_INIT static StaticTimer_t timerBuffer[LED_NUM];
-
-static xSemaphoreHandle ledseqMutex;
-static xQueueHandle ledseqCmdQueue;
+static xTimerHandle timer;
+static StaticTimer_t timerBuffer;
 
 static bool isInit = false;
 static bool ledseqEnabled = false;
 
-static void lesdeqCmdTask(void* param);
-
 void ledseqInit() {
   if(isInit) {
     return;
@@ -216,35 +226,13 @@ void ledseqInit() {
     activeSeq[i] = 0;
   }
 
-  //Init the soft timers that runs the led sequences for each leds
-  for(int i=0; i<LED_NUM; i++) {
-    timer[i] = xTimerCreateStatic("ledseqTimer", M2T(1000), pdFALSE, (void*)i, runLedseq, &timerBuffer[i]);
-  }
-
-  ledseqMutex = xSemaphoreCreateMutex();
-
-  ledseqCmdQueue = xQueueCreate(10, sizeof(struct ledseqCmd_s));
-  xTaskCreate(lesdeqCmdTask, LEDSEQCMD_TASK_NAME, LEDSEQCMD_TASK_STACKSIZE, NULL, LEDSEQCMD_TASK_PRI, NULL);
+  //The soft timer that runs the led sequences of all the leds
+  timer = xTimerCreateStatic("ledseqTimer", M2T(LEDSEQ_TICK_MS), pdTRUE, NULL, ledseqTick, &timerBuffer);
+  xTimerStart(timer, 0);
 
   isInit = true;
 }
 
-static void lesdeqCmdTask(void* param) {
-  struct ledseqCmd_s command;
-  while(1) {
-    xQueueReceive(ledseqCmdQueue, &command, portMAX_DELAY);
-
-    switch(command.command) {
-      case run:
-        ledseqRunBlocking(command.sequence);
-        break;
-      case stop:
-        ledseqStopBlocking(command.sequence);
-        break;
-    }
-  }
-}
-
 bool ledseqTest(void) {
   bool status;
 
@@ -264,27 +252,12 @@ void ledseqEnable(bool enable) {
 }
 
 bool ledseqRun(ledseqContext_t *context) {
-  struct ledseqCmd_s command;
-  command.command = run;
-  command.sequence = context;
-  if (xQueueSend(ledseqCmdQueue, &command, 0) == pdPASS) {
-    return true;
-  }
-  return false;
+  __atomic_store_n(&context->request, LEDSEQ_REQUEST_RUN, __ATOMIC_RELEASE);
+  return true;
 }
 
 void ledseqRunBlocking(ledseqContext_t *context) {
-  const led_t led = context->led;
-
-  xSemaphoreTake(ledseqMutex, portMAX_DELAY);
-  context->state = 0;  //Reset the seq. to its first step
-  updateActive(led);
-  xSemaphoreGive(ledseqMutex);
-
-  // Run the first step if the new seq is the active sequence
-  if(activeSeq[led] == context) {
-    runLedseq(timer[led]);
-  }
+  ledseqRun(context);
 }
 
 void ledseqSetChargeLevel(const float chargeLevel) {
@@ -296,52 +269,21 @@ void ledseqSetChargeLevel(const float chargeLevel) {
 }
 
 bool ledseqStop(ledseqContext_t *context) {
-  struct ledseqCmd_s command;
-  command.command = stop;
-  command.sequence = context;
-  if (xQueueSend(ledseqCmdQueue, &command, 0) == pdPASS) {
-    return true;
-  }
-  return false;
+  __atomic_store_n(&context->request, LEDSEQ_REQUEST_STOP, __ATOMIC_RELEASE);
+  return true;
 }
 
 void ledseqStopBlocking(ledseqContext_t *context) {
-  const led_t led = context->led;
-
-  xSemaphoreTake(ledseqMutex, portMAX_DELAY);
-  context->state = LEDSEQ_STOP;  //Stop the seq.
-  updateActive(led);
-  xSemaphoreGive(ledseqMutex);
-
-  //Run the next active sequence (if any...)
-  runLedseq(timer[led]);
+  ledseqStop(context);
 }
 
-/* Center of the led sequence machine. This function is executed by the FreeRTOS
- * timers and runs the sequences
- */
-static void runLedseq( xTimerHandle xTimer ) {
-  if (!ledseqEnabled) {
-    return;
-  }
-
-  led_t led = (led_t)pvTimerGetTimerID(xTimer);
+/* Plays the steps of the active sequence of a led up to the next timed step */
+static void runLedseq(led_t led) {
   ledseqContext_t* context = activeSeq[led];
-  if (NO_CONTEXT == context) {
-    return;
-  }
-
-  bool leave = false;
-  while(!leave) {
-    if (context->state == LEDSEQ_STOP) {
-      return;
-    }
 
+  while (context != NO_CONTEXT && context->state != LEDSEQ_STOP) {
     const ledseqStep_t* step = &context->sequence[context->state];
-
-    xSemaphoreTake(ledseqMutex, portMAX_DELAY);
     context->state++;
-    led_t led = context->led;
 
     switch(step->action) {
       case LEDSEQ_LOOP:
@@ -350,23 +292,62 @@ static void runLedseq( xTimerHandle xTimer ) {
       case LEDSEQ_STOP:
         context->state = LEDSEQ_STOP;
         updateActive(led);
+        ledSet(led, false);
+        //Go on with the next active sequence (if any...)
+        context = activeSeq[led];
+        stepEnd[led] = tickCount;
         break;
       default:  //The step is a LED action and a time
         ledSet(led, step->value);
         if (step->action == 0) {
           break;
         }
-        xTimerChangePeriod(xTimer, M2T(step->action), 0);
-        xTimerStart(xTimer, 0);
-        leave = true;
-        break;
+        stepEnd[led] = tickCount + (step->action + LEDSEQ_TICK_MS - 1) / LEDSEQ_TICK_MS;
+        return;
+    }
+  }
+}
+
+/* Center of the led sequence machine. This function is executed by the FreeRTOS
+ * timer and runs the sequences
+ */
+static void ledseqTick(xTimerHandle xTimer) {
+  bool changed[LED_NUM] = {false};
+
+  tickCount++;
+
+  for (ledseqContext_t* context = sequences; context != NO_CONTEXT; context = context->nextContext) {
+    const int request = __atomic_exchange_n(&context->request, LEDSEQ_REQUEST_NONE, __ATOMIC_ACQUIRE);
+
+    if (request == LEDSEQ_REQUEST_RUN && context->state == LEDSEQ_STOP) {
+      context->state = 0;  //Reset the seq. to its first step
+      changed[context->led] = true;
+    } else if (request == LEDSEQ_REQUEST_STOP && context->state != LEDSEQ_STOP) {
+      context->state = LEDSEQ_STOP;
+      changed[context->led] = true;
+    }
+  }
+
+  for (int led = 0; led < LED_NUM; led++) {
+    if (changed[led]) {
+      const ledseqContext_t* previous = activeSeq[led];
+      updateActive(led);
+      // A new sequence on the led starts right away
+      if (activeSeq[led] != previous) {
+        ledSet(led, false);
+        stepEnd[led] = tickCount;
+      }
+    }
+
+    if (ledseqEnabled && (int32_t)(tickCount - stepEnd[led]) >= 0) {
+      runLedseq(led);
     }
-    xSemaphoreGive(ledseqMutex);
   }
 }
 
 void ledseqRegisterSequence(ledseqContext_t* context) {
   context->state = LEDSEQ_STOP;
+  context->request = LEDSEQ_REQUEST_NONE;
   context->nextContext = NO_CONTEXT;
 
   if (sequences == NO_CONTEXT) {
@@ -394,7 +375,6 @@ void ledseqRegisterSequence(ledseqContext_t* context) {
 
 static void updateActive(led_t led) {
   activeSeq[led] = NO_CONTEXT;
-  ledSet(led, false);
 
   for (ledseqContext_t* sequence = sequences; sequence != 0; sequence = sequence->nextContext) {
     if (sequence->led == led && sequence->state != LEDSEQ_STOP) {
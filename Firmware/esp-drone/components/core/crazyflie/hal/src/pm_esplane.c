@@ -27,6 +27,7 @@
 
 #include <string.h>
 #include <stdbool.h>
+#include <math.h>
 
 #include "FreeRTOS.h"
 #include "task.h"
@@ -37,9 +38,11 @@
 #include "adc_esp32.h"
 #include "led.h"
 #include "log.h"
+#include "param.h"
 #include "ledseq.h"
 #include "commander.h"
 #include "sound.h"
+#include "motors.h"
 #include "stm32_legacy.h"
 //#include "deck.h"
 #define DEBUG_MODULE "PM"
@@ -66,12 +69,10 @@ typedef struct _PmSyslinkInfo
 }  __attribute__((packed)) PmSyslinkInfo;
 
 static float     batteryVoltage;
-static uint16_t  batteryVoltageMV;
 static float     batteryVoltageMin = 6.0;
 static float     batteryVoltageMax = 0.0;
 
 static float     extBatteryVoltage;
-static uint16_t  extBatteryVoltageMV;
 static uint16_t extBatVoltDeckPin;
 static bool      isExtBatVoltDeckPinSet = false;
 static float     extBatVoltMultiplier;
@@ -93,9 +94,29 @@ static PmSyslinkInfo pmSyslinkInfo;
 
 static uint8_t batteryLevel;
 
+// Load compensated state of charge. The current is estimated from the motor
+// commands, the voltage drop it causes on the internal resistance is added
+// back before the voltage is looked up in the discharge curve. The charge is
+// counted from the current and pulled slowly toward the voltage estimate.
+#define PM_UPDATE_PERIOD_MS     100
+#define PM_SOC_VOLTAGE_GAIN     0.002f  // Per update, about 50 s
+#define PM_CURRENT_AVERAGE_GAIN 0.02f   // Per update, about 5 s
+#define PM_FLIGHT_CURRENT_MIN   0.5f    // [A] below, the motors are idle
+
+static float batteryCapacity = 0.3f;     // [Ah]
+static float batteryResistance = 0.15f;  // [Ohm] internal, with the wiring
+static float motorsCurrentMax = 8.0f;    // [A] all the motors at full command
+static float hoverCurrent = 3.5f;        // [A] for the prediction before the first flight
+
+static float batteryCurrent;             // [A] estimated
+static float batteryVoltageOpenCircuit;  // [V]
+static float stateOfCharge = -1.0f;      // [%], negative until the first update
+static float flightCurrent;              // [A] average while flying
+static float flightTimeLeft;             // [s] at the flight current
+
 static void pmSetBatteryVoltage(float voltage);
 
-const static float bat671723HS25C[10] =
+const static float bat671723HS25C[11] =
 {
   3.00, // 00%
   3.78, // 10%
@@ -106,7 +127,8 @@ const static float bat671723HS25C[10] =
   3.96, // 60%
   4.00, // 70%
   4.04, // 80%
-  4.10  // 90%
+  4.10, // 90%
+  4.20  // 100%, only for the state of charge
 };
 
 STATIC_MEM_TASK_ALLOC(pmTask, PM_TASK_STACKSIZE);
@@ -140,7 +162,6 @@ bool pmTest(void)
 static void pmSetBatteryVoltage(float voltage)
 {
   batteryVoltage = voltage;
-  batteryVoltageMV = (uint16_t)(voltage * 1000);
   if (batteryVoltageMax < voltage)
   {
     batteryVoltageMax = voltage;
@@ -186,6 +207,60 @@ static int32_t pmBatteryChargeFromVoltage(float voltage)
 }
 
 
+/* State of charge in % by linear interpolation of the discharge curve */
+static float pmStateOfChargeFromVoltage(float voltage)
+{
+  if (voltage <= bat671723HS25C[0]) {
+    return 0.0f;
+  }
+  for (int i = 1; i < 11; i++) {
+    if (voltage < bat671723HS25C[i]) {
+      return 10.0f * (i - 1 + (voltage - bat671723HS25C[i - 1]) / (bat671723HS25C[i] - bat671723HS25C[i - 1]));
+    }
+  }
+
+  return 100.0f;
+}
+
+static void pmUpdateStateOfCharge(float voltage)
+{
+  const float dt = PM_UPDATE_PERIOD_MS / 1000.0f;
+  float command = 0;
+
+  for (int i = 0; i < NBR_OF_MOTORS; i++) {
+    command += motorsGetRatio(i);
+  }
+  command /= NBR_OF_MOTORS * (float)UINT16_MAX;
+  // Roughly the power of a propeller for its command
+  batteryCurrent = motorsCurrentMax * command * sqrtf(command);
+  batteryVoltageOpenCircuit = voltage + batteryCurrent * batteryResistance;
+
+  const float voltageStateOfCharge = pmStateOfChargeFromVoltage(batteryVoltageOpenCircuit);
+  if (stateOfCharge < 0) {
+    stateOfCharge = voltageStateOfCharge;
+    flightCurrent = hoverCurrent;
+  } else {
+    stateOfCharge -= 100.0f * batteryCurrent * dt / (3600.0f * batteryCapacity);
+    stateOfCharge += PM_SOC_VOLTAGE_GAIN * (voltageStateOfCharge - stateOfCharge);
+    stateOfCharge = fminf(fmaxf(stateOfCharge, 0.0f), 100.0f);
+  }
+
+  if (batteryCurrent > PM_FLIGHT_CURRENT_MIN) {
+    flightCurrent += PM_CURRENT_AVERAGE_GAIN * (batteryCurrent - flightCurrent);
+  }
+  flightTimeLeft = stateOfCharge / 100.0f * batteryCapacity * 3600.0f / flightCurrent;
+}
+
+float pmGetStateOfCharge(void)
+{
+  return stateOfCharge;
+}
+
+float pmGetFlightTimeLeft(void)
+{
+  return flightTimeLeft;
+}
+
 float pmGetBatteryVoltage(void)
 {
   return batteryVoltage;
@@ -329,12 +404,15 @@ void pmTask(void *param)
   systemWaitStart();
 
   while (1) {
-  vTaskDelay(M2T(100));
+  vTaskDelay(M2T(PM_UPDATE_PERIOD_MS));
   extBatteryVoltage = pmMeasureExtBatteryVoltage();
-  extBatteryVoltageMV = (uint16_t)(extBatteryVoltage * 1000);
   extBatteryCurrent = pmMeasureExtBatteryCurrent();
   pmSetBatteryVoltage(extBatteryVoltage);
+#ifdef ENABLE_THRUST_BAT_COMPENSATED
+  motorsSetBatteryVoltage(extBatteryVoltage);
+#endif
   batteryLevel = pmBatteryChargeFromVoltage(pmGetBatteryVoltage()) * 10;
+  pmUpdateStateOfCharge(pmGetBatteryVoltage());
 #ifdef DEBUG_EP2
   DEBUG_PRINTD("batteryLevel=%u extBatteryVoltageMV=%u \n", batteryLevel, extBatteryVoltageMV);
 #endif
@@ -424,11 +502,17 @@ void pmTask(void *param)
   }
 }
 
+// A voltage in V, as mV
+static uint16_t logVoltageMV(uint32_t timestamp, void *data)
+{
+  return (uint16_t)(*(float *)data * 1000);
+}
+
 LOG_GROUP_START(pm)
 LOG_ADD(LOG_FLOAT, vbat, &batteryVoltage)
-LOG_ADD(LOG_UINT16, vbatMV, &batteryVoltageMV)
+LOG_ADD_BY_GETTER(LOG_UINT16, vbatMV, logVoltageMV, &batteryVoltage)
 LOG_ADD(LOG_FLOAT, extVbat, &extBatteryVoltage)
-LOG_ADD(LOG_UINT16, extVbatMV, &extBatteryVoltageMV)
+LOG_ADD_BY_GETTER(LOG_UINT16, extVbatMV, logVoltageMV, &extBatteryVoltage)
 LOG_ADD(LOG_FLOAT, extCurr, &extBatteryCurrent)
 LOG_ADD(LOG_FLOAT, chargeCurrent, &pmSyslinkInfo.chargeCurrent)
 LOG_ADD(LOG_INT8, state, &pmState)
@@ -436,4 +520,18 @@ LOG_ADD(LOG_UINT8, batteryLevel, &batteryLevel)
 #ifdef PM_SYSTLINK_INLCUDE_TEMP
 LOG_ADD(LOG_FLOAT, temp, &temp)
 #endif
+LOG_ADD(LOG_FLOAT, current, &batteryCurrent)
+LOG_ADD(LOG_FLOAT, vOpenCircuit, &batteryVoltageOpenCircuit)
+LOG_ADD(LOG_FLOAT, soc, &stateOfCharge)
+LOG_ADD(LOG_FLOAT, flightTime, &flightTimeLeft)
 LOG_GROUP_STOP(pm)
+
+/**
+ * The battery and motor model of the state of charge
+ */
+PARAM_GROUP_START(pm)
+PARAM_ADD(PARAM_FLOAT, capacity, &batteryCapacity)
+PARAM_ADD(PARAM_FLOAT, resistance, &batteryResistance)
+PARAM_ADD(PARAM_FLOAT, currMax, &motorsCurrentMax)
+PARAM_ADD(PARAM_FLOAT, hoverCurr, &hoverCurrent)
+PARAM_GROUP_STOP(pm)
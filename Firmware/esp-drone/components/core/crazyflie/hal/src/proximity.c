@@ -24,7 +24,6 @@
  * proximity.c - Implementation of hardware abstraction layer for proximity sensors
  */
 
-#include <string.h>
 #include "FreeRTOS.h"
 #include "task.h"
 
@@ -38,6 +37,7 @@
 
 #include "stm32_legacy.h"
 #include "static_mem.h"
+#include "streamStats.h"
 
 /* Flag indicating if the proximityInit() function has been called or not. */
 static bool isInit = false;
@@ -48,8 +48,8 @@ static uint32_t proximityDistanceAvg    = 0; /* Average distance in millimeters,
 static uint32_t proximityDistanceMedian = 0; /* Median distance in millimeters, initialized to zero. */
 static uint32_t proximityAccuracy       = 0; /* The accuracy as reported by the sensor driver for the latest sample. */
 
-/* The most recent samples in chronological order. Must be initialized before use. */
-static uint32_t proximitySWin[PROXIMITY_SWIN_SIZE];
+/* The most recent samples, with their running median and average. */
+STREAM_STATS_DEFINE(proximitySWin, PROXIMITY_SWIN_SIZE);
 
 #if defined(PROXIMITY_ENABLED)
 
@@ -65,70 +65,6 @@ LOG_GROUP_STOP(proximity)
 
 STATIC_MEM_TASK_ALLOC(proximityTask, PROXIMITY_TASK_STACKSIZE);
 
-/**
- * This function returns the median value of an array.
- *
- * Internal sorting function by Bill Gentles Nov. 12 2010, seen
- * on http://forum.arduino.cc/index.php?topic=20920.0
- *
- * @param proximitySWin Array of chronologically sequenced samples.
- *
- * @return Median value from the array.
- */
-static uint32_t proximitySWinMedian(uint32_t *proximitySWin)
-{
-  /* The most recent samples, sorted in increasing sample value order. Must be initialized before use. */
-  uint32_t proximitySorted[PROXIMITY_SWIN_SIZE];
-
-  /* Create a copy of the chronologically sequenced buffer. */
-  memcpy(proximitySorted, proximitySWin, sizeof(uint32_t)*PROXIMITY_SWIN_SIZE);
-
-  /* Now sort this copy. */
-  uint8_t n;
-  for (n = 1; n < PROXIMITY_SWIN_SIZE; ++n) {
-    uint32_t valn = proximitySorted[n];
-    int8_t m; /* May reach value of -1 */
-    for (m = n - 1; (m >= 0) && (valn < proximitySorted[m]); m--)
-    {
-      proximitySorted[m + 1] = proximitySorted[m];
-    }
-    proximitySorted[m + 1] = valn;
-  }
-
-  /* Return the median value of the samples. */
-  return proximitySorted[PROXIMITY_SWIN_SIZE / 2];
-}
-
-/**
- * This function adds a distance measurement to the sliding window, discarding the oldest sample.
- * After having added the new sample, a new average value of the samples is calculated and returned.
- *
- * @param distance The new sample to add to the sliding window.
- *
- * @return The new average value of the samples in the sliding window (after adding the new sample).
- */
-static uint32_t proximitySWinAdd(uint32_t distance)
-{
-  /* Discard oldest sample, move remaining samples one slot to the left. */
-  memmove(&proximitySWin[0], &proximitySWin[1], (PROXIMITY_SWIN_SIZE - 1) * sizeof(uint32_t));
-
-  /* Add the new sample in the last (right-most) slot. */
-  proximitySWin[PROXIMITY_SWIN_SIZE - 1] = distance;
-
-  /**
-   * Calculate the new average distance. Sum all the samples into a uint64_t,
-   * so that we only do a single division at the end.
-   */
-  uint64_t proximityNewAvg = 0;
-  uint8_t n;
-  for (n = 0; n < PROXIMITY_SWIN_SIZE; n++) {
-    proximityNewAvg += proximitySWin[n];
-  }
-  proximityNewAvg = proximityNewAvg / PROXIMITY_SWIN_SIZE;
-
-  return (uint32_t)proximityNewAvg;
-}
-
 /**
  * Proximity task running at PROXIMITY_TASK_FREQ Hz.
  *
@@ -158,11 +94,11 @@ static void proximityTask(void* param)
     proximityDistance = maxSonarReadDistance(MAXSONAR_MB1040_AN, &proximityAccuracy);
 #endif
 
-    /* Get the latest average value calculated. */
-    proximityDistanceAvg = proximitySWinAdd(proximityDistance);
+    /* Add the new sample to the sliding window, discarding the oldest sample. */
+    streamStatsAdd(&proximitySWin, proximityDistance);
 
-    /* Get the latest median value calculated. */
-    proximityDistanceMedian = proximitySWinMedian(proximitySWin);
+    proximityDistanceAvg = streamStatsMean(&proximitySWin);
+    proximityDistanceMedian = streamStatsMedian(&proximitySWin);
   }
 }
 #endif
@@ -175,8 +111,8 @@ void proximityInit(void)
   if(isInit)
     return;
 
-  /* Initialise the sliding window to zero. */
-  memset(&proximitySWin, 0, sizeof(uint32_t)*PROXIMITY_SWIN_SIZE);
+  /* Start with an empty sliding window. */
+  streamStatsReset(&proximitySWin);
 
 #if defined(PROXIMITY_ENABLED)
   /* Only start the task if the proximity subsystem is enabled in conf.h */
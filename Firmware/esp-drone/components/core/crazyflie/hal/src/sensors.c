@@ -30,6 +30,7 @@
 
 #include "sensors.h"
 #include "platform.h"
+#include "multiranger.h"
 #include "debug_cf.h"
 
 // https://gcc.gnu.org/onlinedocs/cpp/Stringizing.html
@@ -65,6 +66,7 @@ typedef struct {
   void (*acquire)(sensorData_t *sensors, const uint32_t tick);
   void (*waitDataReady)(void);
   bool (*readGyro)(Axis3f *gyro);
+  uint64_t (*gyroTimestamp)(void);
   bool (*readAcc)(Axis3f *acc);
   bool (*readMag)(Axis3f *mag);
   bool (*readBaro)(baro_t *baro);
@@ -72,9 +74,24 @@ typedef struct {
   void (*dataAvailableCallback)(void);
 } sensorsImplementation_t;
 
+#ifdef CONFIG_SENSORS_SINGLE_BACKEND
+
+// The build holds a single backend, its functions are called directly
+#if defined(SENSOR_INCLUDED_BMI088_SPI_BMP388)
+  #define SENSORS_BACKEND(name) sensorsBmi088SpiBmp388##name
+#else
+  #define SENSORS_BACKEND(name) sensorsMpu6050Hmc5883lMs5611##name
+#endif
+#define SENSORS_CALL(member, name) SENSORS_BACKEND(name)
+
+#else
+
+#define SENSORS_CALL(member, name) activeImplementation->member
+
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wunused-function"
 static void nullFunction(void) {}
+static uint64_t nullTimestamp(void) { return 0; }
 #pragma GCC diagnostic pop
 
 static const sensorsImplementation_t sensorImplementations[SensorImplementation_COUNT] = {
@@ -88,6 +105,7 @@ static const sensorsImplementation_t sensorImplementations[SensorImplementation_
     .acquire = sensorsBmi088Bmp388Acquire,
     .waitDataReady = sensorsBmi088Bmp388WaitDataReady,
     .readGyro = sensorsBmi088Bmp388ReadGyro,
+    .gyroTimestamp = sensorsBmi088Bmp388GyroTimestamp,
     .readAcc = sensorsBmi088Bmp388ReadAcc,
     .readMag = sensorsBmi088Bmp388ReadMag,
     .readBaro = sensorsBmi088Bmp388ReadBaro,
@@ -105,6 +123,7 @@ static const sensorsImplementation_t sensorImplementations[SensorImplementation_
     .acquire = sensorsBmi088SpiBmp388Acquire,
     .waitDataReady = sensorsBmi088SpiBmp388WaitDataReady,
     .readGyro = sensorsBmi088SpiBmp388ReadGyro,
+    .gyroTimestamp = sensorsBmi088SpiBmp388GyroTimestamp,
     .readAcc = sensorsBmi088SpiBmp388ReadAcc,
     .readMag = sensorsBmi088SpiBmp388ReadMag,
     .readBaro = sensorsBmi088SpiBmp388ReadBaro,
@@ -122,6 +141,7 @@ static const sensorsImplementation_t sensorImplementations[SensorImplementation_
     .acquire = sensorsMpu6050Hmc5883lMs5611Acquire,
     .waitDataReady = sensorsMpu6050Hmc5883lMs5611WaitDataReady,
     .readGyro = sensorsMpu6050Hmc5883lMs5611ReadGyro,
+    .gyroTimestamp = sensorsMpu6050Hmc5883lMs5611GyroTimestamp,
     .readAcc = sensorsMpu6050Hmc5883lMs5611ReadAcc,
     .readMag = sensorsMpu6050Hmc5883lMs5611ReadMag,
     .readBaro = sensorsMpu6050Hmc5883lMs5611ReadBaro,
@@ -139,6 +159,7 @@ static const sensorsImplementation_t sensorImplementations[SensorImplementation_
     .acquire = sensorsMpu9250Lps25hAcquire,
     .waitDataReady = sensorsMpu9250Lps25hWaitDataReady,
     .readGyro = sensorsMpu9250Lps25hReadGyro,
+    .gyroTimestamp = sensorsMpu9250Lps25hGyroTimestamp,
     .readAcc = sensorsMpu9250Lps25hReadAcc,
     .readMag = sensorsMpu9250Lps25hReadMag,
     .readBaro = sensorsMpu9250Lps25hReadBaro,
@@ -156,6 +177,7 @@ static const sensorsImplementation_t sensorImplementations[SensorImplementation_
     .acquire = sensorsBoschAcquire,
     .waitDataReady = sensorsBoschWaitDataReady,
     .readGyro = sensorsBoschReadGyro,
+    .gyroTimestamp = nullTimestamp,
     .readAcc = sensorsBoschReadAcc,
     .readMag = sensorsBoschReadMag,
     .readBaro = sensorsBoschReadBaro,
@@ -166,14 +188,21 @@ static const sensorsImplementation_t sensorImplementations[SensorImplementation_
 };
 
 static const sensorsImplementation_t* activeImplementation;
-static bool isInit = false;
 static const sensorsImplementation_t* findImplementation(SensorImplementation_t implementation);
 
+#endif // CONFIG_SENSORS_SINGLE_BACKEND
+
+static bool isInit = false;
+
 void sensorsInit(void) {
   if (isInit) {
     return;
   }
 
+#ifdef CONFIG_SENSORS_SINGLE_BACKEND
+  SENSORS_BACKEND(Init)();
+#else
+
 #ifndef SENSORS_FORCE
   SensorImplementation_t sensorImplementation = platformConfigGetSensorImplementation();
 #else
@@ -184,54 +213,68 @@ void sensorsInit(void) {
   activeImplementation = findImplementation(sensorImplementation);
 
   activeImplementation->init();
+#endif
 
   isInit = true;
 }
 
 bool sensorsTest(void) {
-  return activeImplementation->test();
+  return SENSORS_CALL(test, Test)();
 }
 
 bool sensorsAreCalibrated(void) {
-  return activeImplementation->areCalibrated();
+  return SENSORS_CALL(areCalibrated, AreCalibrated)();
 }
 
 bool sensorsManufacturingTest(void){
-  return activeImplementation->manufacturingTest;
+  return SENSORS_CALL(manufacturingTest, ManufacturingTest)();
 }
 
 void sensorsAcquire(sensorData_t *sensors, const uint32_t tick) {
-  activeImplementation->acquire(sensors, tick);
+  SENSORS_CALL(acquire, Acquire)(sensors, tick);
 }
 
 void sensorsWaitDataReady(void) {
-  activeImplementation->waitDataReady();
+  SENSORS_CALL(waitDataReady, WaitDataReady)();
 }
 
 bool sensorsReadGyro(Axis3f *gyro) {
-  return activeImplementation->readGyro(gyro);
+  return SENSORS_CALL(readGyro, ReadGyro)(gyro);
+}
+
+uint64_t sensorsGyroTimestamp(void) {
+  return SENSORS_CALL(gyroTimestamp, GyroTimestamp)();
 }
 
 bool sensorsReadAcc(Axis3f *acc) {
-  return activeImplementation->readAcc(acc);
+  return SENSORS_CALL(readAcc, ReadAcc)(acc);
 }
 
 bool sensorsReadMag(Axis3f *mag) {
-  return activeImplementation->readMag(mag);
+  return SENSORS_CALL(readMag, ReadMag)(mag);
 }
 
 bool sensorsReadBaro(baro_t *baro) {
-  return activeImplementation->readBaro(baro);
+  return SENSORS_CALL(readBaro, ReadBaro)(baro);
 }
 
 void sensorsSetAccMode(accModes accMode) {
-  activeImplementation->setAccMode(accMode);
+  SENSORS_CALL(setAccMode, SetAccMode)(accMode);
+}
+
+bool sensorsGetFrontTofMm(uint16_t *rangeMm) {
+  return multirangerGetRangeMm(rangeFront, rangeMm);
 }
 
 void __attribute__((used)) EXTI14_Callback(void) {
+#if !defined(CONFIG_SENSORS_SINGLE_BACKEND)
   activeImplementation->dataAvailableCallback();
+#elif defined(SENSOR_INCLUDED_BMI088_SPI_BMP388)
+  sensorsBmi088SpiBmp388DataAvailableCallback();
+#endif
 }
 
+#ifndef CONFIG_SENSORS_SINGLE_BACKEND
 static const sensorsImplementation_t* findImplementation(SensorImplementation_t implementation) {
   const sensorsImplementation_t* result = 0;
 
@@ -244,3 +287,4 @@ static const sensorsImplementation_t* findImplementation(SensorImplementation_t
 
   return result;
 }
+#endif
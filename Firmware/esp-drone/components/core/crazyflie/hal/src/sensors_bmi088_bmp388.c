@@ -118,6 +118,7 @@ static StaticSemaphore_t dataReadyBuffer;
 static bool isInit = false;
 static sensorData_t sensorData;
 static volatile uint64_t imuIntTimestamp;
+static volatile uint64_t gyroTimestamp;  // Of the sample in gyroDataQueue
 
 static Axis3i16 gyroRaw;
 static Axis3i16 accelRaw;
@@ -242,6 +243,11 @@ bool sensorsBmi088Bmp388ReadGyro(Axis3f *gyro)
   return (pdTRUE == xQueueReceive(gyroDataQueue, gyro, 0));
 }
 
+uint64_t sensorsBmi088Bmp388GyroTimestamp(void)
+{
+  return gyroTimestamp;
+}
+
 bool sensorsBmi088Bmp388ReadAcc(Axis3f *acc)
 {
   return (pdTRUE == xQueueReceive(accelerometerDataQueue, acc, 0));
@@ -329,6 +335,7 @@ static void sensorsTask(void *param)
       }
     }
     xQueueOverwrite(accelerometerDataQueue, &sensorData.acc);
+    gyroTimestamp = sensorData.interruptTimestamp;
     xQueueOverwrite(gyroDataQueue, &sensorData.gyro);
     if (isBarometerPresent)
     {
@@ -22,100 +22,141 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  *
  *
- * sensors_bmi088_bmp388.c: IMU sensor accusation for the *88 bosch sensors
+ * sensors_bmi088_spi_bmp388.c: IMU sensor acquisition for the BMI088 on the
+ * deck SPI bus
+ *
+ * The gyro pushes its samples into its FIFO in stream mode, with a watermark
+ * of one millisecond of samples on INT3. Every interrupt the task drains the
+ * FIFO by DMA, and runs every gyro sample through the bias and the filters at
+ * the gyro rate. The accelerometer is read once per batch at its 1600 Hz ODR,
+ * and the stabilizer is released once per batch at 1 kHz.
+ *
+ * There is no BMP388 driver in this tree, the barometer queue stays empty.
  */
 
+#include "sdkconfig.h"
+
+#ifdef CONFIG_SENSORS_BMI088_SPI
+
 #define DEBUG_MODULE "IMU"
 
 #include <math.h>
 #include <string.h>
 
-#include "stm32fxxx.h"
-
-#include "sensors_bmi088_spi_bmp388.h"
-#include "imu.h"
-
 #include "FreeRTOS.h"
 #include "semphr.h"
 #include "task.h"
+#include "queue.h"
+#include "driver/gpio.h"
 
+#include "sensors_bmi088_spi_bmp388.h"
+#include "sensors_snapshot.h"
 #include "system.h"
-#include "configblock.h"
 #include "param.h"
 #include "log.h"
-#include "debug.h"
 #include "imu.h"
-#include "nvicconf.h"
 #include "ledseq.h"
 #include "sound.h"
 #include "filter.h"
-#include "i2cdev.h"
-#include "bmi088.h"
-#include "bmp3.h"
-#include "bstdr_types.h"
+#include "welford.h"
+#include "dyn_notch.h"
+#include "config.h"
+#include "deck_digital.h"
+#include "deck_spi.h"
+#include "usec_time.h"
+#include "stm32_legacy.h"
+#include "flowdeck_v1v2.h"
+#include "debug_cf.h"
 #include "static_mem.h"
-
-/* Defines for the SPI and GPIO pins used to drive the SPI Flash */
-#define BMI088_ACC_GPIO_CS             GPIO_Pin_1
-#define BMI088_ACC_GPIO_CS_PORT        GPIOB
-#define BMI088_ACC_GPIO_CS_PERIF       RCC_AHB1Periph_GPIOB
-#define BMI088_GYR_GPIO_CS             GPIO_Pin_0
-#define BMI088_GYR_GPIO_CS_PORT        GPIOB
-#define BMI088_GYR_GPIO_CS_PERIF       RCC_AHB1Periph_GPIOB
-
-#define BMI088_SPI                     SPI2
-#define BMI088_SPI_AF                  GPIO_AF_SPI2
-#define BMI088_SPI_CLK                 RCC_APB1Periph_SPI2
-#define BMI088_GPIO_SPI_PORT           GPIOB
-#define BMI088_GPIO_SPI_CLK            RCC_AHB1Periph_GPIOB
-#define BMI088_GPIO_SPI_SCK            GPIO_Pin_13
-#define BMI088_GPIO_SPI_SCK_SRC        GPIO_PinSource13
-#define BMI088_GPIO_SPI_MISO           GPIO_Pin_14
-#define BMI088_GPIO_SPI_MISO_SRC       GPIO_PinSource14
-#define BMI088_GPIO_SPI_MOSI           GPIO_Pin_15
-#define BMI088_GPIO_SPI_MOSI_SRC       GPIO_PinSource15
-
-#define BMI088_SPI_DMA_IRQ_PRIO        NVIC_HIGH_PRI
-#define BMI088_SPI_DMA                 DMA1
-#define BMI088_SPI_DMA_CLK             RCC_AHB1Periph_DMA1
-#define BMI088_SPI_DMA_CLK_INIT        RCC_AHB1PeriphClockCmd
-
-#define BMI088_SPI_RX_DMA_STREAM       DMA1_Stream3
-#define BMI088_SPI_RX_DMA_IRQ          DMA1_Stream3_IRQn
-#define BMI088_SPI_RX_DMA_IRQHandler   DMA1_Stream3_IRQHandler
-#define BMI088_SPI_RX_DMA_CHANNEL      DMA_Channel_0
-#define BMI088_SPI_RX_DMA_FLAG_TCIF    DMA_FLAG_TCIF3
-
-#define BMI088_SPI_TX_DMA_STREAM       DMA1_Stream4
-#define BMI088_SPI_TX_DMA_IRQ          DMA1_Stream4_IRQn
-#define BMI088_SPI_TX_DMA_IRQHandler   DMA1_Stream4_IRQHandler
-#define BMI088_SPI_TX_DMA_CHANNEL      DMA_Channel_0
-#define BMI088_SPI_TX_DMA_FLAG_TCIF    DMA_FLAG_TCIF4
-
-#define DUMMY_BYTE    0x00
-
+#include "seqlock.h"
+#include "deadlinemonitor.h"
+#include "sysview_markers.h"
+
+/* BMI088 registers, the gyro and the accelerometer are two SPI slaves */
+#define BMI088_SPI_READ                 0x80
+
+#define BMI088_GYRO_CHIP_ID             0x00
+#define BMI088_GYRO_CHIP_ID_VALUE       0x0F
+#define BMI088_GYRO_FIFO_STATUS         0x0E
+#define BMI088_GYRO_FIFO_OVERRUN        0x80
+#define BMI088_GYRO_FIFO_FRAMES_MASK    0x7F
+#define BMI088_GYRO_RANGE               0x0F
+#define BMI088_GYRO_RANGE_2000_DPS      0x00
+#define BMI088_GYRO_BANDWIDTH           0x10
+#define BMI088_GYRO_ODR_2000_BW_230     0x01
+#define BMI088_GYRO_ODR_1000_BW_116     0x02
+#define BMI088_GYRO_SOFTRESET           0x14
+#define BMI088_GYRO_INT_CTRL            0x15
+#define BMI088_GYRO_INT_CTRL_FIFO       0x40
+#define BMI088_GYRO_INT3_INT4_IO_CONF   0x16
+#define BMI088_GYRO_INT3_PUSH_PULL_HIGH 0x01
+#define BMI088_GYRO_INT3_INT4_IO_MAP    0x18
+#define BMI088_GYRO_INT3_FIFO           0x04
+#define BMI088_GYRO_FIFO_WM_ENABLE      0x1E
+#define BMI088_GYRO_FIFO_WM_INT_ON      0x88
+#define BMI088_GYRO_SELF_TEST           0x3C
+#define BMI088_GYRO_SELF_TEST_TRIG      0x01
+#define BMI088_GYRO_SELF_TEST_RDY       0x02
+#define BMI088_GYRO_SELF_TEST_FAIL      0x04
+#define BMI088_GYRO_FIFO_CONFIG_0       0x3D
+#define BMI088_GYRO_FIFO_CONFIG_1       0x3E
+#define BMI088_GYRO_FIFO_STREAM_XYZ     0x80
+#define BMI088_GYRO_FIFO_DATA           0x3F
+#define BMI088_GYRO_FIFO_FRAME_LEN      6
+#define BMI088_GYRO_FIFO_MAX_FRAMES     100
+
+#define BMI088_ACC_CHIP_ID              0x00
+#define BMI088_ACC_CHIP_ID_VALUE        0x1E
+#define BMI088_ACC_X_LSB                0x12
+#define BMI088_ACC_CONF                 0x40
+#define BMI088_ACC_BWP_NORMAL_1600_HZ   0xAC
+#define BMI088_ACC_BWP_OSR4_1600_HZ     0x8C
+#define BMI088_ACC_RANGE                0x41
+#define BMI088_ACC_RANGE_24G            0x03
+#define BMI088_ACC_PWR_CONF             0x7C
+#define BMI088_ACC_PWR_CONF_ACTIVE      0x00
+#define BMI088_ACC_PWR_CTRL             0x7D
+#define BMI088_ACC_PWR_CTRL_ON          0x04
+#define BMI088_ACC_SOFTRESET            0x7E
+#define BMI088_SOFTRESET_CMD            0xB6
+// An accelerometer read starts with a dummy byte
+#define BMI088_ACC_DUMMY_LEN            1
+
+#define SENSORS_BMI088_SPI_SPEED        SPI_BAUDRATE_10MHZ
+#define SENSORS_BMI088_CS_ACC           CONFIG_BMI088_PIN_CS_ACC
+#define SENSORS_BMI088_CS_GYRO          CONFIG_BMI088_PIN_CS_GYRO
+#define SENSORS_BMI088_INT_GYRO         CONFIG_BMI088_PIN_INT_GYRO
+
+#ifdef CONFIG_BMI088_GYRO_RATE_2000
+#define SENSORS_BMI088_GYRO_RATE_HZ     2000
+#define SENSORS_BMI088_GYRO_ODR_CFG     BMI088_GYRO_ODR_2000_BW_230
+#else
+#define SENSORS_BMI088_GYRO_RATE_HZ     1000
+#define SENSORS_BMI088_GYRO_ODR_CFG     BMI088_GYRO_ODR_1000_BW_116
+#endif
+// One batch per stabilizer tick
 #define SENSORS_READ_RATE_HZ            1000
-#define SENSORS_STARTUP_TIME_MS         1000
-#define SENSORS_READ_BARO_HZ            50
-#define SENSORS_READ_MAG_HZ             20
-#define SENSORS_DELAY_BARO              (SENSORS_READ_RATE_HZ/SENSORS_READ_BARO_HZ)
-#define SENSORS_DELAY_MAG               (SENSORS_READ_RATE_HZ/SENSORS_READ_MAG_HZ)
+#define SENSORS_GYRO_BATCH_FRAMES       (SENSORS_BMI088_GYRO_RATE_HZ / SENSORS_READ_RATE_HZ)
+// Max frames drained per wakeup, leaves room to catch up after being preempted
+#define SENSORS_GYRO_MAX_FRAMES         16
+// A missed edge must not stop the sensors, the FIFO is drained after this
+#define SENSORS_DATA_TIMEOUT_MS         5
 
 #define SENSORS_BMI088_GYRO_FS_CFG      BMI088_GYRO_RANGE_2000_DPS
 #define SENSORS_BMI088_DEG_PER_LSB_CFG  (2.0f *2000.0f) / 65536.0f
 
 #define SENSORS_BMI088_ACCEL_CFG        24
-#define SENSORS_BMI088_ACCEL_FS_CFG     BMI088_ACCEL_RANGE_24G
+#define SENSORS_BMI088_ACCEL_FS_CFG     BMI088_ACC_RANGE_24G
 #define SENSORS_BMI088_G_PER_LSB_CFG    (2.0f * (float)SENSORS_BMI088_ACCEL_CFG) / 65536.0f
-#define SENSORS_BMI088_1G_IN_LSB        (65536 / SENSORS_BMI088_ACCEL_CFG / 2)
 
 #define SENSORS_VARIANCE_MAN_TEST_TIMEOUT   M2T(1000) // Timeout in ms
-#define SENSORS_MAN_TEST_LEVEL_MAX          5.0f      // Max degrees off
+#define SENSORS_SELF_TEST_TIMEOUT_MS    50
 
 #define GYRO_NBR_OF_AXES                3
 #define GYRO_MIN_BIAS_TIMEOUT_MS        M2T(1*1000)
 
-// Number of samples used in variance calculation. Changing this effects the threshold
+// Number of still samples the bias is the mean of. Changing this effects the
+// threshold, the variances are sums of the squared deviations of a window.
 #define SENSORS_NBR_OF_BIAS_SAMPLES  512
 
 // Variance threshold to take zero bias for gyro
@@ -126,21 +167,8 @@
 
 #define SENSORS_ACC_SCALE_SAMPLES  200
 
-/* Usefull macro */
-#define ACC_EN_CS() GPIO_ResetBits(BMI088_ACC_GPIO_CS_PORT, BMI088_ACC_GPIO_CS)
-#define ACC_DIS_CS() GPIO_SetBits(BMI088_ACC_GPIO_CS_PORT, BMI088_ACC_GPIO_CS)
-#define GYR_EN_CS() GPIO_ResetBits(BMI088_GYR_GPIO_CS_PORT, BMI088_GYR_GPIO_CS)
-#define GYR_DIS_CS() GPIO_SetBits(BMI088_GYR_GPIO_CS_PORT, BMI088_GYR_GPIO_CS)
-
-/* Defines and buffers for full duplex SPI DMA transactions */
-/* The buffers must not be placed in CCM */
-#define SPI_MAX_DMA_TRANSACTION_SIZE    15
-static uint8_t spiTxBuffer[SPI_MAX_DMA_TRANSACTION_SIZE + 1];
-static uint8_t spiRxBuffer[SPI_MAX_DMA_TRANSACTION_SIZE + 1];
-static xSemaphoreHandle spiTxDMAComplete;
-static StaticSemaphore_t spiTxDMACompleteBuffer;
-static xSemaphoreHandle spiRxDMAComplete;
-static StaticSemaphore_t spiRxDMACompleteBuffer;
+#define PITCH_CALIB (CONFIG_PITCH_CALIB / 100.0f)
+#define ROLL_CALIB (CONFIG_ROLL_CALIB / 100.0f)
 
 typedef struct
 {
@@ -148,36 +176,35 @@ typedef struct
   Axis3f     variance;
   Axis3f     mean;
   bool       isBiasValueFound;
-  bool       isBufferFilled;
-  Axis3i16*  bufHead;
-  Axis3i16   buffer[SENSORS_NBR_OF_BIAS_SAMPLES];
+  welford_t  stats[GYRO_NBR_OF_AXES];  // Of the window so far
 } BiasObj;
 
-/* initialize necessary variables */
-static struct bmi088_dev bmi088Dev;
-static struct bmp3_dev   bmp388Dev;
-
-static xQueueHandle accelerometerDataQueue;
-STATIC_MEM_QUEUE_ALLOC(accelerometerDataQueue, 1, sizeof(Axis3f));
-static xQueueHandle gyroDataQueue;
-STATIC_MEM_QUEUE_ALLOC(gyroDataQueue, 1, sizeof(Axis3f));
-static xQueueHandle magnetometerDataQueue;
-STATIC_MEM_QUEUE_ALLOC(magnetometerDataQueue, 1, sizeof(Axis3f));
-static xQueueHandle barometerDataQueue;
-STATIC_MEM_QUEUE_ALLOC(barometerDataQueue, 1, sizeof(baro_t));
+// No mag nor baro yet, their sequences stay 0 and their reads false
+SEQLOCK_ALLOC(snapshotLock, sizeof(sensorsSnapshot_t));
+static uint32_t imuSeq;  // Sensors task only
+// Readers, the sequence of the samples taken last
+static uint32_t takenGyroSeq;
+static uint32_t takenAccSeq;
+static uint32_t takenMagSeq;
+static uint32_t takenBaroSeq;
+static uint32_t imuMissedCount;
 
 static xSemaphoreHandle sensorsDataReady;
-static StaticSemaphore_t sensorsDataReadyBuffer;
 static xSemaphoreHandle dataReady;
-static StaticSemaphore_t dataReadyBuffer;
 
 static bool isInit = false;
 static sensorData_t sensorData;
 static volatile uint64_t imuIntTimestamp;
 
+// The hot path transfers, with their DMA buffers
+static spiTransfer_t gyroFifoTransfer;
+static spiTransfer_t accTransfer;
+static uint8_t gyroFramesRead;
+static uint32_t gyroFifoOverruns;
+
 static Axis3i16 gyroRaw;
 static Axis3i16 accelRaw;
-NO_DMA_CCM_SAFE_ZERO_INIT static BiasObj gyroBiasRunning;
+static BiasObj gyroBiasRunning;
 static Axis3f gyroBias;
 #if defined(SENSORS_GYRO_BIAS_CALCULATE_STDDEV) && defined (GYRO_BIAS_LIGHT_WEIGHT)
 static Axis3f gyroBiasStdDev;
@@ -188,16 +215,23 @@ static float accScale = 1;
 static bool accScaleFound = false;
 static uint32_t accScaleSumCount = 0;
 
-
-// Low Pass filtering
+// Low Pass filtering, the gyro at its sample rate
 #define GYRO_LPF_CUTOFF_FREQ  80
 #define ACCEL_LPF_CUTOFF_FREQ 30
-static lpf2pData accLpf[3];
-static lpf2pData gyroLpf[3];
-static void applyAxis3fLpf(lpf2pData *data, Axis3f* in);
+static biquad3Data accLpf;
+static biquad3Data gyroLpf;
+// The dynamic notch analyses 1 kHz samples
+#if defined(CONFIG_GYRO_DYN_NOTCH) && SENSORS_BMI088_GYRO_RATE_HZ == DYN_NOTCH_SAMPLE_RATE
+#define SENSORS_GYRO_DYN_NOTCH
+static uint8_t gyroDynNotchStage;
+#endif
+static void gyroLpfInit(void);
+static void accLpfInit(float cutoffFreq);
+static void applyAxis3fLpf(biquad3Data *data, Axis3f* in);
 
 static bool isBarometerPresent = false;
-static uint8_t baroMeasDelayMin = SENSORS_DELAY_BARO;
+static bool isBmi088TestPassed = false;
+static bool isPmw3901Present = false;
 
 // Pre-calculated values for accelerometer alignment
 static float cosPitch;
@@ -205,15 +239,13 @@ static float sinPitch;
 static float cosRoll;
 static float sinRoll;
 
-#ifdef GYRO_GYRO_BIAS_LIGHT_WEIGHT
+#ifdef GYRO_BIAS_LIGHT_WEIGHT
 static bool processGyroBiasNoBuffer(int16_t gx, int16_t gy, int16_t gz, Axis3f *gyroBiasOut);
 #else
 static bool processGyroBias(int16_t gx, int16_t gy, int16_t gz,  Axis3f *gyroBiasOut);
 #endif
 static bool processAccScale(int16_t ax, int16_t ay, int16_t az);
 static void sensorsBiasObjInit(BiasObj* bias);
-static void sensorsCalculateVarianceAndMean(BiasObj* bias, Axis3f* varOut, Axis3f* meanOut);
-static void sensorsCalculateBiasMean(BiasObj* bias, Axis3i32* meanOut);
 static void sensorsAddBiasValue(BiasObj* bias, int16_t x, int16_t y, int16_t z);
 static bool sensorsFindBiasValue(BiasObj* bias);
 static void sensorsAccAlignToGravity(Axis3f* in, Axis3f* out);
@@ -223,339 +255,245 @@ STATIC_MEM_TASK_ALLOC(sensorsTask, SENSORS_TASK_STACKSIZE);
 /***********************
  * SPI private methods *
  ***********************/
-static char spiSendByte(char byte)
-{
-  /* Loop while DR register in not emplty */
-  while (SPI_I2S_GetFlagStatus(BMI088_SPI, SPI_I2S_FLAG_TXE) == RESET);
 
-  /* Send byte through the SPI peripheral */
-  SPI_I2S_SendData(BMI088_SPI, byte);
+static void spiReadRegisters(uint32_t csPin, uint8_t reg, uint8_t *data, size_t len, size_t dummyLen)
+{
+  uint8_t address = reg | BMI088_SPI_READ;
+  uint8_t buffer[BMI088_ACC_DUMMY_LEN + 8];
 
-  /* Wait to receive a byte */
-  while (SPI_I2S_GetFlagStatus(BMI088_SPI, SPI_I2S_FLAG_RXNE) == RESET);
+  ASSERT(len + dummyLen <= sizeof(buffer));
+  spiBeginTransaction(SENSORS_BMI088_SPI_SPEED);
+  digitalWrite(csPin, LOW);
+  spiExchange(1, true, &address, &address);
+  spiExchange(len + dummyLen, false, NULL, buffer);
+  digitalWrite(csPin, HIGH);
+  spiEndTransaction();
 
-  /* Return the byte read from the SPI bus */
-  return SPI_I2S_ReceiveData(BMI088_SPI);
+  memcpy(data, &buffer[dummyLen], len);
 }
 
-static char spiReceiveByte()
+static uint8_t spiReadRegister(uint32_t csPin, uint8_t reg, size_t dummyLen)
 {
-  return spiSendByte(DUMMY_BYTE);
+  uint8_t data = 0;
+
+  spiReadRegisters(csPin, reg, &data, 1, dummyLen);
+  return data;
 }
 
-static void spiDMATransaction(uint8_t reg_addr, uint8_t *reg_data, uint16_t len)
+static void spiWriteRegister(uint32_t csPin, uint8_t reg, uint8_t value)
 {
-  ASSERT(len < SPI_MAX_DMA_TRANSACTION_SIZE);
-
-  // Disable peripheral before setting up for duplex DMA
-  SPI_Cmd(BMI088_SPI, DISABLE);
+  uint8_t data[2] = { reg & ~BMI088_SPI_READ, value };
 
-  // DMA already configured, just need to set memory addresses and read command byte
-  spiTxBuffer[0] = reg_addr;
-  BMI088_SPI_TX_DMA_STREAM->M0AR = (uint32_t)&spiTxBuffer[0];
-  BMI088_SPI_TX_DMA_STREAM->NDTR = len + 1;
-
-  BMI088_SPI_RX_DMA_STREAM->M0AR = (uint32_t)&spiRxBuffer[0];
-  BMI088_SPI_RX_DMA_STREAM->NDTR = len + 1;
+  spiBeginTransaction(SENSORS_BMI088_SPI_SPEED);
+  digitalWrite(csPin, LOW);
+  spiExchange(sizeof(data), true, data, data);
+  digitalWrite(csPin, HIGH);
+  spiEndTransaction();
+}
 
-  // Enable SPI DMA Interrupts
-  DMA_ITConfig(BMI088_SPI_TX_DMA_STREAM, DMA_IT_TC, ENABLE);
-  DMA_ITConfig(BMI088_SPI_RX_DMA_STREAM, DMA_IT_TC, ENABLE);
+/* A full duplex DMA read, the register address goes out in the first byte */
+static bool spiDmaRead(uint32_t csPin, spiTransfer_t *transfer, size_t length)
+{
+  bool done;
 
-  // Clear DMA Flags
-  DMA_ClearFlag(BMI088_SPI_TX_DMA_STREAM, DMA_FLAG_FEIF4|DMA_FLAG_DMEIF4|
-                DMA_FLAG_TEIF4|DMA_FLAG_HTIF4|DMA_FLAG_TCIF4);
-  DMA_ClearFlag(BMI088_SPI_RX_DMA_STREAM, DMA_FLAG_FEIF3|DMA_FLAG_DMEIF3|
-                DMA_FLAG_TEIF3|DMA_FLAG_HTIF3|DMA_FLAG_TCIF3);
+  transfer->length = length;
+  spiBeginTransaction(SENSORS_BMI088_SPI_SPEED);
+  digitalWrite(csPin, LOW);
+  done = spiQueueExchange(transfer) && spiWaitExchange(portMAX_DELAY) != NULL;
+  digitalWrite(csPin, HIGH);
+  spiEndTransaction();
 
-  // Enable DMA Streams
-  DMA_Cmd(BMI088_SPI_TX_DMA_STREAM,ENABLE);
-  DMA_Cmd(BMI088_SPI_RX_DMA_STREAM,ENABLE);
+  return done;
+}
 
-  // Enable SPI DMA requests
-  SPI_I2S_DMACmd(BMI088_SPI, SPI_I2S_DMAReq_Tx, ENABLE);
-  SPI_I2S_DMACmd(BMI088_SPI, SPI_I2S_DMAReq_Rx, ENABLE);
+static bool spiDmaTransferInit(spiTransfer_t *transfer, uint8_t reg, size_t maxLength)
+{
+  uint8_t *tx = spiDmaMalloc(maxLength);
 
-  // Enable peripheral to begin the transaction
-  SPI_Cmd(BMI088_SPI, ENABLE);
+  transfer->rxBuffer = spiDmaMalloc(maxLength);
+  if (tx == NULL || transfer->rxBuffer == NULL) {
+    return false;
+  }
 
-  // Wait for completion
-  // TODO: Better error handling rather than passing up invalid data
-  xSemaphoreTake(spiTxDMAComplete, portMAX_DELAY);
-  xSemaphoreTake(spiRxDMAComplete, portMAX_DELAY);
+  memset(tx, 0, maxLength);
+  tx[0] = reg | BMI088_SPI_READ;
+  transfer->txBuffer = tx;
 
-  // Copy the data (discarding the dummy byte) into the buffer
-  // TODO: Avoid this memcpy either by figuring out how to configure the STM SPI to discard the byte or handle it higher up
-  memcpy(reg_data, &spiRxBuffer[1], len);
+  return true;
 }
 
-// Communication routines
+/*****************
+ * Sensor access *
+ *****************/
 
-static bstdr_ret_t spi_burst_read(uint8_t dev_id, uint8_t reg_addr, uint8_t *reg_data, uint16_t len)
+static void processGyroSample(const uint8_t *frame)
 {
-  /**< Burst read code comes here */
-  if (dev_id == BMI088_ACCEL_I2C_ADDR_PRIMARY)
-  {
-    ACC_EN_CS();
-  }
-  else
-  {
-    GYR_EN_CS();
-  }
+  gyroRaw.x = (((int16_t)frame[1]) << 8) | frame[0];
+  gyroRaw.y = (((int16_t)frame[3]) << 8) | frame[2];
+  gyroRaw.z = (((int16_t)frame[5]) << 8) | frame[4];
 
-  if (len <= 1 || len > SPI_MAX_DMA_TRANSACTION_SIZE)
-  {
-    spiSendByte(reg_addr);
-    for (int i = 0; i < len; i++)
-    {
-      reg_data[i] = spiReceiveByte();
-    }
-  }
-  else
-  {
-    spiDMATransaction(reg_addr, reg_data, len);
-  }
+  /* calibrate if necessary */
+#ifdef GYRO_BIAS_LIGHT_WEIGHT
+  gyroBiasFound = processGyroBiasNoBuffer(gyroRaw.x, gyroRaw.y, gyroRaw.z, &gyroBias);
+#else
+  gyroBiasFound = processGyroBias(gyroRaw.x, gyroRaw.y, gyroRaw.z, &gyroBias);
+#endif
 
-  if (dev_id == BMI088_ACCEL_I2C_ADDR_PRIMARY)
-  {
-    ACC_DIS_CS();
-  }
-  else
-  {
-    GYR_DIS_CS();
+  sensorData.gyro.x =  (gyroRaw.x - gyroBias.x) * SENSORS_BMI088_DEG_PER_LSB_CFG;
+  sensorData.gyro.y =  (gyroRaw.y - gyroBias.y) * SENSORS_BMI088_DEG_PER_LSB_CFG;
+  sensorData.gyro.z =  (gyroRaw.z - gyroBias.z) * SENSORS_BMI088_DEG_PER_LSB_CFG;
+#ifdef SENSORS_GYRO_DYN_NOTCH
+  float notchFreq;
+  dynNotchAddSample(&sensorData.gyro);
+  if (dynNotchGetCenterFreq(&notchFreq)) {
+    biquad3SetNotch(&gyroLpf, gyroDynNotchStage, SENSORS_BMI088_GYRO_RATE_HZ, notchFreq, CONFIG_GYRO_NOTCH_BANDWIDTH);
   }
-
-  return BSTDR_OK;
+#endif
+  applyAxis3fLpf(&gyroLpf, &sensorData.gyro);
 }
 
-static bstdr_ret_t spi_burst_write(uint8_t dev_id, uint8_t reg_addr, uint8_t *reg_data, uint16_t len)
+/**
+ * Drain the gyro FIFO in one DMA read and process every sample in order.
+ * @return Number of samples processed
+ */
+static uint8_t sensorsReadGyroFifo(void)
 {
-  if (dev_id == BMI088_ACCEL_I2C_ADDR_PRIMARY)
-  {
-    ACC_EN_CS();
-  }
-  else
-  {
-    GYR_EN_CS();
+  uint8_t status = spiReadRegister(SENSORS_BMI088_CS_GYRO, BMI088_GYRO_FIFO_STATUS, 0);
+  uint8_t nbrOfFrames = status & BMI088_GYRO_FIFO_FRAMES_MASK;
+
+  if (status & BMI088_GYRO_FIFO_OVERRUN) {
+    // In stream mode the oldest samples were overwritten, the frames are still aligned
+    gyroFifoOverruns++;
   }
-  spiSendByte(reg_addr);
-  for (int i = 0; i < len; i++)
-  {
-    spiSendByte(reg_data[i]);
+
+  if (nbrOfFrames > SENSORS_GYRO_MAX_FRAMES) {
+    nbrOfFrames = SENSORS_GYRO_MAX_FRAMES;
   }
 
-  if (dev_id == BMI088_ACCEL_I2C_ADDR_PRIMARY)
-  {
-    ACC_DIS_CS();
+  if (nbrOfFrames == 0 ||
+      !spiDmaRead(SENSORS_BMI088_CS_GYRO, &gyroFifoTransfer, 1 + nbrOfFrames * BMI088_GYRO_FIFO_FRAME_LEN)) {
+    gyroFramesRead = 0;
+    return 0;
   }
-  else
-  {
-    GYR_DIS_CS();
+
+  for (uint8_t i = 0; i < nbrOfFrames; i++) {
+    processGyroSample(&gyroFifoTransfer.rxBuffer[1 + i * BMI088_GYRO_FIFO_FRAME_LEN]);
   }
 
-  return BSTDR_OK;
+  gyroFramesRead = nbrOfFrames;
+  return nbrOfFrames;
 }
 
-/***********************
- * I2C private methods *
- ***********************/
-static bstdr_ret_t i2c_burst_read(uint8_t dev_id, uint8_t reg_addr, uint8_t *reg_data, uint16_t len)
+static void sensorsReadAccSample(void)
 {
-  /**< Burst read code comes here */
-  if (i2cdevReadReg8(I2C3_DEV, dev_id, reg_addr, (uint16_t) len, reg_data))
-  {
-    return BSTDR_OK;
-  }
-  else
-  {
-    return BSTDR_E_CON_ERROR;
-  }
-}
+  Axis3f accScaled;
 
-static bstdr_ret_t i2c_burst_write(uint8_t dev_id, uint8_t reg_addr, uint8_t *reg_data, uint16_t len)
-{
-  /**< Burst write code comes here */
-  if (i2cdevWriteReg8(I2C3_DEV, dev_id,reg_addr,(uint16_t) len, reg_data))
-  {
-    return BSTDR_OK;
-  }
-  else
-  {
-    return BSTDR_E_CON_ERROR;
+  if (!spiDmaRead(SENSORS_BMI088_CS_ACC, &accTransfer, 1 + BMI088_ACC_DUMMY_LEN + 6)) {
+    return;
   }
-}
 
+  const uint8_t *data = &accTransfer.rxBuffer[1 + BMI088_ACC_DUMMY_LEN];
+  accelRaw.x = (((int16_t)data[1]) << 8) | data[0];
+  accelRaw.y = (((int16_t)data[3]) << 8) | data[2];
+  accelRaw.z = (((int16_t)data[5]) << 8) | data[4];
 
-static void bmi088_ms_delay(uint32_t period)
-{
-  /**< Delay code comes */
-  vTaskDelay(M2T(period));
-}
+  if (gyroBiasFound)
+  {
+     processAccScale(accelRaw.x, accelRaw.y, accelRaw.z);
+  }
 
-static void spiConfigure(void)
-{
-  SPI_InitTypeDef  SPI_InitStructure;
-
-  SPI_Cmd(BMI088_SPI, DISABLE);
-  SPI_I2S_DeInit(BMI088_SPI);
-
-  SPI_InitStructure.SPI_Direction = SPI_Direction_2Lines_FullDuplex;
-  SPI_InitStructure.SPI_Mode = SPI_Mode_Master;
-  SPI_InitStructure.SPI_DataSize = SPI_DataSize_8b;
-  SPI_InitStructure.SPI_CPOL = SPI_CPOL_Low;
-  SPI_InitStructure.SPI_CPHA = SPI_CPHA_1Edge;
-  SPI_InitStructure.SPI_NSS = SPI_NSS_Soft;
-  SPI_InitStructure.SPI_FirstBit = SPI_FirstBit_MSB;
-  SPI_InitStructure.SPI_CRCPolynomial = 0; // Not used
-
-  SPI_InitStructure.SPI_BaudRatePrescaler = SPI_BaudRatePrescaler_4; //~10.5 MHz
-  SPI_Init(BMI088_SPI, &SPI_InitStructure);
-  /* Enable the SPI  */
-  SPI_Cmd(BMI088_SPI, ENABLE);
+  accScaled.x = accelRaw.x * SENSORS_BMI088_G_PER_LSB_CFG / accScale;
+  accScaled.y = accelRaw.y * SENSORS_BMI088_G_PER_LSB_CFG / accScale;
+  accScaled.z = accelRaw.z * SENSORS_BMI088_G_PER_LSB_CFG / accScale;
+  sensorsAccAlignToGravity(&accScaled, &sensorData.acc);
+  applyAxis3fLpf(&accLpf, &sensorData.acc);
 }
 
-/* Initialisation */
-static void spiInit(void)
+static void sensorsPublish(void)
 {
-  GPIO_InitTypeDef GPIO_InitStructure;
-
-  if (isInit)
-    return;
+  const sensorsSnapshot_t snapshot = {
+    .data = sensorData,
+    .imuSeq = imuSeq,
+  };
 
-  /* Enable SPI and GPIO clocks */
-  RCC_AHB1PeriphClockCmd(BMI088_GPIO_SPI_CLK | BMI088_ACC_GPIO_CS_PERIF, ENABLE);
-  /* Enable SPI and GPIO clocks */
-  RCC_APB1PeriphClockCmd(BMI088_SPI_CLK, ENABLE);
-
-  /* Configure SPI pins: SCK, MISO and MOSI */
-  GPIO_InitStructure.GPIO_Pin = BMI088_GPIO_SPI_SCK |  BMI088_GPIO_SPI_MOSI;
-  GPIO_InitStructure.GPIO_Mode = GPIO_Mode_AF;
-  GPIO_InitStructure.GPIO_OType = GPIO_OType_PP;
-  GPIO_InitStructure.GPIO_Speed = GPIO_Speed_50MHz;
-  GPIO_Init(BMI088_GPIO_SPI_PORT, &GPIO_InitStructure);
-
-  //* Configure MISO */
-  GPIO_InitStructure.GPIO_Pin = BMI088_GPIO_SPI_MISO;
-  GPIO_InitStructure.GPIO_Mode = GPIO_Mode_AF;
-  GPIO_Init(BMI088_GPIO_SPI_PORT, &GPIO_InitStructure);
-
-  /* Configure I/O for the Chip select */
-  GPIO_InitStructure.GPIO_Pin = BMI088_ACC_GPIO_CS;
-  GPIO_InitStructure.GPIO_Mode = GPIO_Mode_OUT;
-  GPIO_Init(BMI088_ACC_GPIO_CS_PORT, &GPIO_InitStructure);
-  /* Configure I/O for the Chip select */
-  GPIO_InitStructure.GPIO_Pin = BMI088_GYR_GPIO_CS;
-  GPIO_InitStructure.GPIO_Mode = GPIO_Mode_OUT;
-  GPIO_Init(BMI088_GYR_GPIO_CS_PORT, &GPIO_InitStructure);
-
-
-  /*!< Connect SPI pins to AF5 */
-  GPIO_PinAFConfig(BMI088_GPIO_SPI_PORT, BMI088_GPIO_SPI_SCK_SRC, BMI088_SPI_AF);
-  GPIO_PinAFConfig(BMI088_GPIO_SPI_PORT, BMI088_GPIO_SPI_MISO_SRC, BMI088_SPI_AF);
-  GPIO_PinAFConfig(BMI088_GPIO_SPI_PORT, BMI088_GPIO_SPI_MOSI_SRC, BMI088_SPI_AF);
-
-  /* disable the chip select */
-  ACC_DIS_CS();
-
-  spiConfigure();
+  seqlockWrite(&snapshotLock, &snapshot);
 }
 
-static void spiDMAInit(void)
+bool sensorsBmi088SpiBmp388ReadGyro(Axis3f *gyro)
 {
-  DMA_InitTypeDef  DMA_InitStructure;
-  NVIC_InitTypeDef NVIC_InitStructure;
-
-  /*!< Enable DMA Clocks */
-  BMI088_SPI_DMA_CLK_INIT(BMI088_SPI_DMA_CLK, ENABLE);
-
-  /* Configure DMA Initialization Structure */
-  DMA_InitStructure.DMA_FIFOMode = DMA_FIFOMode_Disable;
-  DMA_InitStructure.DMA_FIFOThreshold = DMA_FIFOThreshold_1QuarterFull;
-  DMA_InitStructure.DMA_MemoryBurst = DMA_MemoryBurst_Single;
-  DMA_InitStructure.DMA_MemoryDataSize = DMA_MemoryDataSize_Byte;
-  DMA_InitStructure.DMA_MemoryInc = DMA_MemoryInc_Enable;
-  DMA_InitStructure.DMA_Mode = DMA_Mode_Normal;
-  DMA_InitStructure.DMA_PeripheralBaseAddr = (uint32_t)(&(BMI088_SPI->DR));
-  DMA_InitStructure.DMA_PeripheralBurst = DMA_PeripheralBurst_Single;
-  DMA_InitStructure.DMA_PeripheralDataSize = DMA_PeripheralDataSize_Byte;
-  DMA_InitStructure.DMA_PeripheralInc = DMA_PeripheralInc_Disable;
-  DMA_InitStructure.DMA_Priority = DMA_Priority_High;
-  DMA_InitStructure.DMA_BufferSize = 0; // set later
-  DMA_InitStructure.DMA_Memory0BaseAddr = 0; // set later
-
-  // Configure TX DMA
-  DMA_InitStructure.DMA_Channel = BMI088_SPI_TX_DMA_CHANNEL;
-  DMA_InitStructure.DMA_DIR = DMA_DIR_MemoryToPeripheral;
-  DMA_Cmd(BMI088_SPI_TX_DMA_STREAM,DISABLE);
-  DMA_Init(BMI088_SPI_TX_DMA_STREAM, &DMA_InitStructure);
-
-  // Configure RX DMA
-  DMA_InitStructure.DMA_Channel = BMI088_SPI_RX_DMA_CHANNEL;
-  DMA_InitStructure.DMA_DIR = DMA_DIR_PeripheralToMemory;
-  DMA_Cmd(BMI088_SPI_RX_DMA_STREAM, DISABLE);
-  DMA_Init(BMI088_SPI_RX_DMA_STREAM, &DMA_InitStructure);
-
-  // Configure interrupts
-  NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = NVIC_HIGH_PRI;
-  NVIC_InitStructure.NVIC_IRQChannelSubPriority = 0;
-  NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
-
-  NVIC_InitStructure.NVIC_IRQChannel = BMI088_SPI_TX_DMA_IRQ;
-  NVIC_Init(&NVIC_InitStructure);
-
-  NVIC_InitStructure.NVIC_IRQChannel = BMI088_SPI_RX_DMA_IRQ;
-  NVIC_Init(&NVIC_InitStructure);
-
-  spiTxDMAComplete = xSemaphoreCreateBinaryStatic(&spiTxDMACompleteBuffer);
-  spiRxDMAComplete = xSemaphoreCreateBinaryStatic(&spiRxDMACompleteBuffer);
-}
+  sensorsSnapshot_t snapshot;
 
-static uint16_t sensorsGyroGet(Axis3i16* dataOut)
-{
-  return bmi088_get_gyro_data((struct bmi088_sensor_data*)dataOut, &bmi088Dev);
+  seqlockRead(&snapshotLock, &snapshot);
+  if (!sensorsSnapshotTake(&takenGyroSeq, snapshot.imuSeq, &imuMissedCount)) {
+    return false;
+  }
+  *gyro = snapshot.data.gyro;
+  return true;
 }
 
-static void sensorsAccelGet(Axis3i16* dataOut)
+uint64_t sensorsBmi088SpiBmp388GyroTimestamp(void)
 {
-  bmi088_get_accel_data((struct bmi088_sensor_data*)dataOut, &bmi088Dev);
-}
+  sensorsSnapshot_t snapshot;
 
-static void sensorsScaleBaro(baro_t* baroScaled, float pressure,
-                             float temperature)
-{
-  baroScaled->pressure = pressure*0.01f;
-  baroScaled->temperature = temperature;
-  baroScaled->asl = ((powf((1015.7f / baroScaled->pressure), 0.1902630958f)
-      - 1.0f) * (25.0f + 273.15f)) / 0.0065f;
-}
-
-bool sensorsBmi088SpiBmp388ReadGyro(Axis3f *gyro)
-{
-  return (pdTRUE == xQueueReceive(gyroDataQueue, gyro, 0));
+  seqlockRead(&snapshotLock, &snapshot);
+  return snapshot.data.interruptTimestamp;
 }
 
 bool sensorsBmi088SpiBmp388ReadAcc(Axis3f *acc)
 {
-  return (pdTRUE == xQueueReceive(accelerometerDataQueue, acc, 0));
+  sensorsSnapshot_t snapshot;
+
+  seqlockRead(&snapshotLock, &snapshot);
+  if (!sensorsSnapshotTake(&takenAccSeq, snapshot.imuSeq, NULL)) {
+    return false;
+  }
+  *acc = snapshot.data.acc;
+  return true;
 }
 
 bool sensorsBmi088SpiBmp388ReadMag(Axis3f *mag)
 {
-  return (pdTRUE == xQueueReceive(magnetometerDataQueue, mag, 0));
+  sensorsSnapshot_t snapshot;
+
+  seqlockRead(&snapshotLock, &snapshot);
+  if (!sensorsSnapshotTake(&takenMagSeq, snapshot.magSeq, NULL)) {
+    return false;
+  }
+  *mag = snapshot.data.mag;
+  return true;
 }
 
 bool sensorsBmi088SpiBmp388ReadBaro(baro_t *baro)
 {
-  return (pdTRUE == xQueueReceive(barometerDataQueue, baro, 0));
+  sensorsSnapshot_t snapshot;
+
+  seqlockRead(&snapshotLock, &snapshot);
+  if (!sensorsSnapshotTake(&takenBaroSeq, snapshot.baroSeq, NULL)) {
+    return false;
+  }
+  *baro = snapshot.data.baro;
+  return true;
 }
 
 void sensorsBmi088SpiBmp388Acquire(sensorData_t *sensors, const uint32_t tick)
 {
-  sensorsReadGyro(&sensors->gyro);
-  sensorsReadAcc(&sensors->acc);
-  sensorsReadMag(&sensors->mag);
-  sensorsReadBaro(&sensors->baro);
-  sensors->interruptTimestamp = sensorData.interruptTimestamp;
+  sensorsSnapshot_t snapshot;
+
+  // One copy for all of them, the samples taken stay consistent
+  seqlockRead(&snapshotLock, &snapshot);
+  if (sensorsSnapshotTake(&takenGyroSeq, snapshot.imuSeq, &imuMissedCount)) {
+    sensors->gyro = snapshot.data.gyro;
+  }
+  if (sensorsSnapshotTake(&takenAccSeq, snapshot.imuSeq, NULL)) {
+    sensors->acc = snapshot.data.acc;
+  }
+  if (sensorsSnapshotTake(&takenMagSeq, snapshot.magSeq, NULL)) {
+    sensors->mag = snapshot.data.mag;
+  }
+  if (sensorsSnapshotTake(&takenBaroSeq, snapshot.baroSeq, NULL)) {
+    sensors->baro = snapshot.data.baro;
+  }
+  sensors->interruptTimestamp = snapshot.data.interruptTimestamp;
 }
 
 bool sensorsBmi088SpiBmp388AreCalibrated()
@@ -566,68 +504,28 @@ bool sensorsBmi088SpiBmp388AreCalibrated()
 static void sensorsTask(void *param)
 {
   systemWaitStart();
+  deadlineMonitorRegister(dmSensors, 1000000 / SENSORS_READ_RATE_HZ, SENSORS_TASK_BUDGET_US);
 
-  Axis3f accScaled;
-  /* wait an additional second the keep bus free
-   * this is only required by the z-ranger, since the
-   * configuration will be done after system start-up */
-  //vTaskDelayUntil(&lastWakeTime, M2T(1500));
   while (1)
   {
-    if (pdTRUE == xSemaphoreTake(sensorsDataReady, portMAX_DELAY))
-    {
-      sensorData.interruptTimestamp = imuIntTimestamp;
-
-      /* get data from chosen sensors */
-      sensorsGyroGet(&gyroRaw);
-      sensorsAccelGet(&accelRaw);
-
-      /* calibrate if necessary */
-#ifdef GYRO_BIAS_LIGHT_WEIGHT
-      gyroBiasFound = processGyroBiasNoBuffer(gyroRaw.x, gyroRaw.y, gyroRaw.z, &gyroBias);
-#else
-      gyroBiasFound = processGyroBias(gyroRaw.x, gyroRaw.y, gyroRaw.z, &gyroBias);
-#endif
-      if (gyroBiasFound)
-      {
-         processAccScale(accelRaw.x, accelRaw.y, accelRaw.z);
-      }
-      /* Gyro */
-      sensorData.gyro.x =  (gyroRaw.x - gyroBias.x) * SENSORS_BMI088_DEG_PER_LSB_CFG;
-      sensorData.gyro.y =  (gyroRaw.y - gyroBias.y) * SENSORS_BMI088_DEG_PER_LSB_CFG;
-      sensorData.gyro.z =  (gyroRaw.z - gyroBias.z) * SENSORS_BMI088_DEG_PER_LSB_CFG;
-      applyAxis3fLpf((lpf2pData*)(&gyroLpf), &sensorData.gyro);
-
-      /* Acelerometer */
-      accScaled.x = accelRaw.x * SENSORS_BMI088_G_PER_LSB_CFG / accScale;
-      accScaled.y = accelRaw.y * SENSORS_BMI088_G_PER_LSB_CFG / accScale;
-      accScaled.z = accelRaw.z * SENSORS_BMI088_G_PER_LSB_CFG / accScale;
-      sensorsAccAlignToGravity(&accScaled, &sensorData.acc);
-      applyAxis3fLpf((lpf2pData*)(&accLpf), &sensorData.acc);
-    }
+    // On a timeout the FIFO is drained all the same
+    xSemaphoreTake(sensorsDataReady, M2T(SENSORS_DATA_TIMEOUT_MS));
+    deadlineMonitorCheckIn(dmSensors);
+    sensorData.interruptTimestamp = imuIntTimestamp;
 
-    if (isBarometerPresent)
-    {
-      static uint8_t baroMeasDelay = SENSORS_DELAY_BARO;
-      if (--baroMeasDelay == 0)
-      {
-        uint8_t sensor_comp = BMP3_PRESS | BMP3_TEMP;
-        struct bmp3_data data;
-        baro_t* baro388 = &sensorData.baro;
-        /* Temperature and Pressure data are read and stored in the bmp3_data instance */
-        bmp3_get_sensor_data(sensor_comp, &data, &bmp388Dev);
-        sensorsScaleBaro(baro388, data.pressure, data.temperature);
-        baroMeasDelay = baroMeasDelayMin;
-      }
-    }
-    xQueueOverwrite(accelerometerDataQueue, &sensorData.acc);
-    xQueueOverwrite(gyroDataQueue, &sensorData.gyro);
-    if (isBarometerPresent)
+    if (sensorsReadGyroFifo() == 0)
     {
-      xQueueOverwrite(barometerDataQueue, &sensorData.baro);
+      deadlineMonitorCheckOut(dmSensors);
+      continue;
     }
+    sensorsReadAccSample();
+
+    imuSeq++;
+    sensorsPublish();
 
+    SYSVIEW_MARKER_POINT(svSensorsRead);
     xSemaphoreGive(dataReady);
+    deadlineMonitorCheckOut(dmSensors);
   }
 }
 
@@ -636,251 +534,154 @@ void sensorsBmi088SpiBmp388WaitDataReady(void)
   xSemaphoreTake(dataReady, portMAX_DELAY);
 }
 
-static void sensorsDeviceInit(void)
+static bool sensorsBmi088Init(void)
 {
-  if (isInit)
-    return;
+  pinMode(SENSORS_BMI088_CS_ACC, OUTPUT);
+  digitalWrite(SENSORS_BMI088_CS_ACC, HIGH);
+  pinMode(SENSORS_BMI088_CS_GYRO, OUTPUT);
+  digitalWrite(SENSORS_BMI088_CS_GYRO, HIGH);
+  spiBegin();
 
-  bstdr_ret_t rslt;
-  isBarometerPresent = false;
-
-  // Wait for sensors to startup
-  vTaskDelay(M2T(SENSORS_STARTUP_TIME_MS));
-
-  /* BMI088 */
-  bmi088Dev.accel_id = BMI088_ACCEL_I2C_ADDR_PRIMARY;
-  bmi088Dev.gyro_id = BMI088_GYRO_I2C_ADDR_PRIMARY;
-  bmi088Dev.interface = BMI088_SPI_INTF;
-  bmi088Dev.read = spi_burst_read;
-  bmi088Dev.write = spi_burst_write;
-  bmi088Dev.delay_ms = bmi088_ms_delay;
-
-  /* BMI088 GYRO */
-  rslt = bmi088_gyro_init(&bmi088Dev); // initialize the device
-  if (rslt == BSTDR_OK)
-  {
-    struct bmi088_int_cfg intConfig;
-
-    DEBUG_PRINT("BMI088 Gyro SPI connection [OK].\n");
-    /* set power mode of gyro */
-    bmi088Dev.gyro_cfg.power = BMI088_GYRO_PM_NORMAL;
-    rslt |= bmi088_set_gyro_power_mode(&bmi088Dev);
-    /* set bandwidth and range of gyro */
-    bmi088Dev.gyro_cfg.bw = BMI088_GYRO_BW_116_ODR_1000_HZ;
-    bmi088Dev.gyro_cfg.range = SENSORS_BMI088_GYRO_FS_CFG;
-    bmi088Dev.gyro_cfg.odr = BMI088_GYRO_BW_116_ODR_1000_HZ;
-    rslt |= bmi088_set_gyro_meas_conf(&bmi088Dev);
-
-    intConfig.gyro_int_channel = BMI088_INT_CHANNEL_3;
-    intConfig.gyro_int_type = BMI088_GYRO_DATA_RDY_INT;
-    intConfig.gyro_int_pin_3_cfg.enable_int_pin = 1;
-    intConfig.gyro_int_pin_3_cfg.lvl = 1;
-    intConfig.gyro_int_pin_3_cfg.output_mode = 0;
-    /* Setting the interrupt configuration */
-    rslt = bmi088_set_gyro_int_config(&intConfig, &bmi088Dev);
-
-    bmi088Dev.delay_ms(50);
-    struct bmi088_sensor_data gyr;
-    rslt |= bmi088_get_gyro_data(&gyr, &bmi088Dev);
-
-  }
-  else
+  /* Gyro: 2000 dps, streamed into the FIFO with a watermark interrupt per batch */
+  spiWriteRegister(SENSORS_BMI088_CS_GYRO, BMI088_GYRO_SOFTRESET, BMI088_SOFTRESET_CMD);
+  vTaskDelay(M2T(30));
+  if (spiReadRegister(SENSORS_BMI088_CS_GYRO, BMI088_GYRO_CHIP_ID, 0) != BMI088_GYRO_CHIP_ID_VALUE)
   {
-#ifndef SENSORS_IGNORE_IMU_FAIL
-    DEBUG_PRINT("BMI088 Gyro SPI connection [FAIL]\n");
-    isInit = false;
-#endif
+    DEBUG_PRINTE("BMI088 gyro SPI connection [FAIL]\n");
+    return false;
   }
+  DEBUG_PRINTI("BMI088 gyro SPI connection [OK]\n");
 
-  /* BMI088 ACCEL */
-  rslt |= bmi088_accel_switch_control(&bmi088Dev, BMI088_ACCEL_POWER_ENABLE);
-  bmi088Dev.delay_ms(5);
+  spiWriteRegister(SENSORS_BMI088_CS_GYRO, BMI088_GYRO_RANGE, SENSORS_BMI088_GYRO_FS_CFG);
+  spiWriteRegister(SENSORS_BMI088_CS_GYRO, BMI088_GYRO_BANDWIDTH, SENSORS_BMI088_GYRO_ODR_CFG);
+  spiWriteRegister(SENSORS_BMI088_CS_GYRO, BMI088_GYRO_FIFO_CONFIG_1, BMI088_GYRO_FIFO_STREAM_XYZ);
+  spiWriteRegister(SENSORS_BMI088_CS_GYRO, BMI088_GYRO_FIFO_CONFIG_0, SENSORS_GYRO_BATCH_FRAMES);
+  spiWriteRegister(SENSORS_BMI088_CS_GYRO, BMI088_GYRO_FIFO_WM_ENABLE, BMI088_GYRO_FIFO_WM_INT_ON);
+  spiWriteRegister(SENSORS_BMI088_CS_GYRO, BMI088_GYRO_INT3_INT4_IO_CONF, BMI088_GYRO_INT3_PUSH_PULL_HIGH);
+  spiWriteRegister(SENSORS_BMI088_CS_GYRO, BMI088_GYRO_INT3_INT4_IO_MAP, BMI088_GYRO_INT3_FIFO);
 
-  rslt = bmi088_accel_init(&bmi088Dev); // initialize the device
-  if (rslt == BSTDR_OK)
+  /* Accelerometer: the rising edge of CSB1 of the first read selects SPI */
+  spiReadRegister(SENSORS_BMI088_CS_ACC, BMI088_ACC_CHIP_ID, BMI088_ACC_DUMMY_LEN);
+  spiWriteRegister(SENSORS_BMI088_CS_ACC, BMI088_ACC_SOFTRESET, BMI088_SOFTRESET_CMD);
+  vTaskDelay(M2T(2));
+  spiReadRegister(SENSORS_BMI088_CS_ACC, BMI088_ACC_CHIP_ID, BMI088_ACC_DUMMY_LEN);
+  if (spiReadRegister(SENSORS_BMI088_CS_ACC, BMI088_ACC_CHIP_ID, BMI088_ACC_DUMMY_LEN) != BMI088_ACC_CHIP_ID_VALUE)
   {
-    DEBUG_PRINT("BMI088 Accel SPI connection [OK]\n");
-    /* set power mode of accel */
-    bmi088Dev.accel_cfg.power = BMI088_ACCEL_PM_ACTIVE;
-    rslt |= bmi088_set_accel_power_mode(&bmi088Dev);
-    bmi088Dev.delay_ms(10);
-
-    /* set bandwidth and range of accel */
-    bmi088Dev.accel_cfg.bw = BMI088_ACCEL_BW_OSR4;
-    bmi088Dev.accel_cfg.range = SENSORS_BMI088_ACCEL_FS_CFG;
-    bmi088Dev.accel_cfg.odr = BMI088_ACCEL_ODR_1600_HZ;
-    rslt |= bmi088_set_accel_meas_conf(&bmi088Dev);
-
-    struct bmi088_sensor_data acc;
-    rslt |= bmi088_get_accel_data(&acc, &bmi088Dev);
-  }
-  else
-  {
-#ifndef SENSORS_IGNORE_IMU_FAIL
-    DEBUG_PRINT("BMI088 Accel SPI connection [FAIL]\n");
-    isInit = false;
-#endif
+    DEBUG_PRINTE("BMI088 accel SPI connection [FAIL]\n");
+    return false;
   }
+  DEBUG_PRINTI("BMI088 accel SPI connection [OK]\n");
 
-  /* BMP388 */
-  bmp388Dev.dev_id = BMP3_I2C_ADDR_SEC;
-  bmp388Dev.intf = BMP3_I2C_INTF;
-  bmp388Dev.read = i2c_burst_read;
-  bmp388Dev.write = i2c_burst_write;
-  bmp388Dev.delay_ms = bmi088_ms_delay;
-
-  int i = 3;
-  do {
-    bmp388Dev.delay_ms(1);
-    // For some reason it often doesn't work first time
-    rslt = bmp3_init(&bmp388Dev);
-  } while (rslt != BMP3_OK && i-- > 0);
-
-  if (rslt == BMP3_OK)
-  {
-    isBarometerPresent = true;
-    DEBUG_PRINT("BMP388 I2C connection [OK]\n");
-    /* Used to select the settings user needs to change */
-    uint16_t settings_sel;
-    /* Select the pressure and temperature sensor to be enabled */
-    bmp388Dev.settings.press_en = BMP3_ENABLE;
-    bmp388Dev.settings.temp_en = BMP3_ENABLE;
-    /* Select the output data rate and oversampling settings for pressure and temperature */
-    bmp388Dev.settings.odr_filter.press_os = BMP3_OVERSAMPLING_8X;
-    bmp388Dev.settings.odr_filter.temp_os = BMP3_NO_OVERSAMPLING;
-    bmp388Dev.settings.odr_filter.odr = BMP3_ODR_50_HZ;
-    bmp388Dev.settings.odr_filter.iir_filter = BMP3_IIR_FILTER_COEFF_3;
-    /* Assign the settings which needs to be set in the sensor */
-    settings_sel = BMP3_PRESS_EN_SEL | BMP3_TEMP_EN_SEL | BMP3_PRESS_OS_SEL | BMP3_TEMP_OS_SEL | BMP3_ODR_SEL | BMP3_IIR_FILTER_SEL;
-    rslt = bmp3_set_sensor_settings(settings_sel, &bmp388Dev);
-
-    /* Set the power mode to normal mode */
-    bmp388Dev.settings.op_mode = BMP3_NORMAL_MODE;
-    rslt = bmp3_set_op_mode(&bmp388Dev);
-
-
-    bmp388Dev.delay_ms(20); // wait before first read out
-    // read out data
-    /* Variable used to select the sensor component */
-    uint8_t sensor_comp;
-    /* Variable used to store the compensated data */
-    struct bmp3_data data;
-
-    /* Sensor component selection */
-    sensor_comp = BMP3_PRESS | BMP3_TEMP;
-    /* Temperature and Pressure data are read and stored in the bmp3_data instance */
-    rslt = bmp3_get_sensor_data(sensor_comp, &data, &bmp388Dev);
-
-    /* Print the temperature and pressure data */
-//    DEBUG_PRINT("BMP388 T:%0.2f  P:%0.2f\n",data.temperature, data.pressure/100.0f);
-    baroMeasDelayMin = SENSORS_DELAY_BARO;
-  }
-  else
-  {
-#ifndef SENSORS_IGNORE_BAROMETER_FAIL
-    DEBUG_PRINT("BMP388 I2C connection [FAIL]\n");
-    isInit = false;
-    return;
-#endif
-  }
+  spiWriteRegister(SENSORS_BMI088_CS_ACC, BMI088_ACC_PWR_CTRL, BMI088_ACC_PWR_CTRL_ON);
+  vTaskDelay(M2T(5));
+  spiWriteRegister(SENSORS_BMI088_CS_ACC, BMI088_ACC_PWR_CONF, BMI088_ACC_PWR_CONF_ACTIVE);
+  vTaskDelay(M2T(5));
+  spiWriteRegister(SENSORS_BMI088_CS_ACC, BMI088_ACC_RANGE, SENSORS_BMI088_ACCEL_FS_CFG);
+  sensorsBmi088SpiBmp388SetAccMode(ACC_MODE_FLIGHT);
+
+  return spiDmaTransferInit(&gyroFifoTransfer, BMI088_GYRO_FIFO_DATA,
+                            1 + SENSORS_GYRO_MAX_FRAMES * BMI088_GYRO_FIFO_FRAME_LEN) &&
+         spiDmaTransferInit(&accTransfer, BMI088_ACC_X_LSB, 1 + BMI088_ACC_DUMMY_LEN + 6);
+}
+
+static void sensorsDeviceInit(void)
+{
+  isBarometerPresent = false;
 
-  // Init second order filer for accelerometer and gyro
-  for (uint8_t i = 0; i < 3; i++)
+  // Wait for sensors to startup
+  while (xTaskGetTickCount() < 2000){
+    vTaskDelay(M2T(50));
+  };
+
+  if (!sensorsBmi088Init())
   {
-    lpf2pInit(&gyroLpf[i], 1000, GYRO_LPF_CUTOFF_FREQ);
-    lpf2pInit(&accLpf[i],  1000, ACCEL_LPF_CUTOFF_FREQ);
+    // Please check your hardware !
+    assert(0);
   }
 
-  cosPitch = cosf(configblockGetCalibPitch() * (float) M_PI / 180);
-  sinPitch = sinf(configblockGetCalibPitch() * (float) M_PI / 180);
-  cosRoll = cosf(configblockGetCalibRoll() * (float) M_PI / 180);
-  sinRoll = sinf(configblockGetCalibRoll() * (float) M_PI / 180);
+  gyroLpfInit();
 
-  isInit = true;
+  // The decks were probed and their drivers started by deckInit()
+  isPmw3901Present = flowdeck2Test();
+
+  cosPitch = cosf(PITCH_CALIB * (float)M_PI / 180);
+  sinPitch = sinf(PITCH_CALIB * (float)M_PI / 180);
+  cosRoll = cosf(ROLL_CALIB * (float)M_PI / 180);
+  sinRoll = sinf(ROLL_CALIB * (float)M_PI / 180);
 }
 
 static void sensorsTaskInit(void)
 {
-  accelerometerDataQueue = STATIC_MEM_QUEUE_CREATE(accelerometerDataQueue);
-  gyroDataQueue = STATIC_MEM_QUEUE_CREATE(gyroDataQueue);
-  magnetometerDataQueue = STATIC_MEM_QUEUE_CREATE(magnetometerDataQueue);
-  barometerDataQueue = STATIC_MEM_QUEUE_CREATE(barometerDataQueue);
+  STATIC_MEM_TASK_CREATE_PINNED(sensorsTask, sensorsTask, SENSORS_TASK_NAME, NULL, SENSORS_TASK_PRI, SENSORS_TASK_CORE);
+}
 
-  STATIC_MEM_TASK_CREATE(sensorsTask, sensorsTask, SENSORS_TASK_NAME, NULL, SENSORS_TASK_PRI);
+static void IRAM_ATTR sensorsGyroIsrHandler(void *arg)
+{
+  sensorsBmi088SpiBmp388DataAvailableCallback();
 }
 
 static void sensorsInterruptInit(void)
 {
-  GPIO_InitTypeDef GPIO_InitStructure;
-  EXTI_InitTypeDef EXTI_InitStructure;
-
-  sensorsDataReady = xSemaphoreCreateBinaryStatic(&sensorsDataReadyBuffer);
-  dataReady = xSemaphoreCreateBinaryStatic(&dataReadyBuffer);
-
-  // Enable the interrupt on PC14
-  GPIO_InitStructure.GPIO_Pin = GPIO_Pin_14;
-  GPIO_InitStructure.GPIO_Mode = GPIO_Mode_IN;
-  GPIO_InitStructure.GPIO_PuPd = GPIO_PuPd_NOPULL; //GPIO_PuPd_DOWN;
-  GPIO_Init(GPIOC, &GPIO_InitStructure);
-
-  SYSCFG_EXTILineConfig(EXTI_PortSourceGPIOC, EXTI_PinSource14);
-
-  EXTI_InitStructure.EXTI_Line = EXTI_Line14;
-  EXTI_InitStructure.EXTI_Mode = EXTI_Mode_Interrupt;
-  EXTI_InitStructure.EXTI_Trigger = EXTI_Trigger_Rising;
-  EXTI_InitStructure.EXTI_LineCmd = ENABLE;
-  portDISABLE_INTERRUPTS();
-  EXTI_Init(&EXTI_InitStructure);
-  EXTI_ClearITPendingBit(EXTI_Line14);
-  portENABLE_INTERRUPTS();
+  gpio_config_t io_conf = {
+    // INT3 rises on the FIFO watermark
+#if ESP_IDF_VERSION_MAJOR > 4
+    .intr_type = GPIO_INTR_POSEDGE,
+#else
+    .intr_type = GPIO_PIN_INTR_POSEDGE,
+#endif
+    .pin_bit_mask = (1ULL << SENSORS_BMI088_INT_GYRO),
+    .mode = GPIO_MODE_INPUT,
+    .pull_down_en = 1,
+    .pull_up_en = 0,
+  };
+
+  sensorsDataReady = xSemaphoreCreateBinary();
+  dataReady = xSemaphoreCreateBinary();
+  gpio_config(&io_conf);
+  gpio_install_isr_service(0);
+  gpio_isr_handler_add(SENSORS_BMI088_INT_GYRO, sensorsGyroIsrHandler, NULL);
+
+  // Only now that the edge can be seen
+  spiWriteRegister(SENSORS_BMI088_CS_GYRO, BMI088_GYRO_INT_CTRL, BMI088_GYRO_INT_CTRL_FIFO);
 }
 
 void sensorsBmi088SpiBmp388Init(void)
 {
   if (isInit)
-    {
-      return;
-    }
-
-  i2cdevInit(I2C3_DEV);
-  spiInit();
-  spiDMAInit();
+  {
+    return;
+  }
 
   sensorsBiasObjInit(&gyroBiasRunning);
   sensorsDeviceInit();
   sensorsInterruptInit();
   sensorsTaskInit();
+#ifdef SENSORS_GYRO_DYN_NOTCH
+  dynNotchInit();
+#endif
+
+  isInit = true;
 }
 
 static bool gyroSelftest()
 {
-  bool testStatus = true;
-
-  int i = 3;
-  uint16_t readResult = BMI088_OK;
-  do {
-    readResult = sensorsGyroGet(&gyroRaw);
-  } while (readResult != BMI088_OK && i-- > 0);
+  uint8_t result = 0;
 
-  if ((readResult != BMI088_OK) || (gyroRaw.x == 0 && gyroRaw.y == 0 && gyroRaw.z == 0))
+  spiWriteRegister(SENSORS_BMI088_CS_GYRO, BMI088_GYRO_SELF_TEST, BMI088_GYRO_SELF_TEST_TRIG);
+  for (int i = 0; i < SENSORS_SELF_TEST_TIMEOUT_MS && !(result & BMI088_GYRO_SELF_TEST_RDY); i++)
   {
-    DEBUG_PRINT("BMI088 gyro returning x=0 y=0 z=0 [FAILED]\n");
-    testStatus = false;
+    vTaskDelay(M2T(1));
+    result = spiReadRegister(SENSORS_BMI088_CS_GYRO, BMI088_GYRO_SELF_TEST, 0);
   }
 
-  int8_t gyroResult = 0;
-  bmi088_perform_gyro_selftest(&gyroResult, &bmi088Dev);
-  if (gyroResult == BMI088_SELFTEST_PASS)
-  {
-    DEBUG_PRINT("BMI088 gyro self-test [OK]\n");
-  }
-  else
+  if ((result & BMI088_GYRO_SELF_TEST_RDY) && !(result & BMI088_GYRO_SELF_TEST_FAIL))
   {
-    DEBUG_PRINT("BMI088 gyro self-test [FAILED]\n");
-    testStatus = false;
+    DEBUG_PRINTI("BMI088 gyro self-test [OK]\n");
+    return true;
   }
 
-  return testStatus;
+  DEBUG_PRINTE("BMI088 gyro self-test [FAILED]\n");
+  return false;
 }
 
 bool sensorsBmi088SpiBmp388Test(void)
@@ -889,22 +690,16 @@ bool sensorsBmi088SpiBmp388Test(void)
 
   if (!isInit)
   {
-    DEBUG_PRINT("Uninitialized\n");
+    DEBUG_PRINTE("Uninitialized\n");
     testStatus = false;
   }
 
-  if (! gyroSelftest())
-  {
-    testStatus = false;
-  }
+  isBmi088TestPassed = gyroSelftest();
+  testStatus &= isBmi088TestPassed;
 
   return testStatus;
 }
 
-/**
- * Calculates accelerometer scale out of SENSORS_ACC_SCALE_SAMPLES samples. Should be called when
- * platform is stable.
- */
 static bool processAccScale(int16_t ax, int16_t ay, int16_t az)
 {
   if (!accScaleFound)
@@ -970,8 +765,8 @@ static bool processGyroBiasNoBuffer(int16_t gx, int16_t gy, int16_t gz, Axis3f *
 }
 #else
 /**
- * Calculates the bias first when the gyro variance is below threshold. Requires a buffer
- * but calibrates platform first when it is stable.
+ * Calculates the bias first when the gyro variance is below threshold. Calibrates
+ * the platform first when it is stable.
  */
 static bool processGyroBias(int16_t gx, int16_t gy, int16_t gz, Axis3f *gyroBiasOut)
 {
@@ -997,78 +792,33 @@ static bool processGyroBias(int16_t gx, int16_t gy, int16_t gz, Axis3f *gyroBias
 
 static void sensorsBiasObjInit(BiasObj* bias)
 {
-  bias->isBufferFilled = false;
-  bias->bufHead = bias->buffer;
-}
-
-/**
- * Calculates the variance and mean for the bias buffer.
- */
-static void sensorsCalculateVarianceAndMean(BiasObj* bias, Axis3f* varOut, Axis3f* meanOut)
-{
-  uint32_t i;
-  int64_t sum[GYRO_NBR_OF_AXES] = {0};
-  int64_t sumSq[GYRO_NBR_OF_AXES] = {0};
-
-  for (i = 0; i < SENSORS_NBR_OF_BIAS_SAMPLES; i++)
+  for (int i = 0; i < GYRO_NBR_OF_AXES; i++)
   {
-    sum[0] += bias->buffer[i].x;
-    sum[1] += bias->buffer[i].y;
-    sum[2] += bias->buffer[i].z;
-    sumSq[0] += bias->buffer[i].x * bias->buffer[i].x;
-    sumSq[1] += bias->buffer[i].y * bias->buffer[i].y;
-    sumSq[2] += bias->buffer[i].z * bias->buffer[i].z;
+    welfordReset(&bias->stats[i]);
   }
-
-  varOut->x = (sumSq[0] - ((int64_t)sum[0] * sum[0]) / SENSORS_NBR_OF_BIAS_SAMPLES);
-  varOut->y = (sumSq[1] - ((int64_t)sum[1] * sum[1]) / SENSORS_NBR_OF_BIAS_SAMPLES);
-  varOut->z = (sumSq[2] - ((int64_t)sum[2] * sum[2]) / SENSORS_NBR_OF_BIAS_SAMPLES);
-
-  meanOut->x = (float)sum[0] / SENSORS_NBR_OF_BIAS_SAMPLES;
-  meanOut->y = (float)sum[1] / SENSORS_NBR_OF_BIAS_SAMPLES;
-  meanOut->z = (float)sum[2] / SENSORS_NBR_OF_BIAS_SAMPLES;
 }
 
 /**
- * Calculates the mean for the bias buffer.
- */
-static void __attribute__((used)) sensorsCalculateBiasMean(BiasObj* bias, Axis3i32* meanOut)
-{
-  uint32_t i;
-  int32_t sum[GYRO_NBR_OF_AXES] = {0};
-
-  for (i = 0; i < SENSORS_NBR_OF_BIAS_SAMPLES; i++)
-  {
-    sum[0] += bias->buffer[i].x;
-    sum[1] += bias->buffer[i].y;
-    sum[2] += bias->buffer[i].z;
-  }
-
-  meanOut->x = sum[0] / SENSORS_NBR_OF_BIAS_SAMPLES;
-  meanOut->y = sum[1] / SENSORS_NBR_OF_BIAS_SAMPLES;
-  meanOut->z = sum[2] / SENSORS_NBR_OF_BIAS_SAMPLES;
-}
-
-/**
- * Adds a new value to the variance buffer and if it is full
- * replaces the oldest one. Thus a circular buffer.
+ * Adds a new value to the running mean and variance of the window.
  */
 static void sensorsAddBiasValue(BiasObj* bias, int16_t x, int16_t y, int16_t z)
 {
-  bias->bufHead->x = x;
-  bias->bufHead->y = y;
-  bias->bufHead->z = z;
-  bias->bufHead++;
+  welfordAdd(&bias->stats[0], x);
+  welfordAdd(&bias->stats[1], y);
+  welfordAdd(&bias->stats[2], z);
 
-  if (bias->bufHead >= &bias->buffer[SENSORS_NBR_OF_BIAS_SAMPLES])
-  {
-    bias->bufHead = bias->buffer;
-    bias->isBufferFilled = true;
-  }
+  bias->variance.x = welfordSumOfSquares(&bias->stats[0]);
+  bias->variance.y = welfordSumOfSquares(&bias->stats[1]);
+  bias->variance.z = welfordSumOfSquares(&bias->stats[2]);
+  bias->mean.x = welfordMean(&bias->stats[0]);
+  bias->mean.y = welfordMean(&bias->stats[1]);
+  bias->mean.z = welfordMean(&bias->stats[2]);
 }
 
 /**
- * Checks if the variances is below the predefined thresholds.
+ * Checks if the variances stay below the predefined thresholds, every sample.
+ * The variance of a window only grows, so the window starts over as soon as
+ * it goes above one, and the platform is still once the window is full.
  * The bias value should have been added before calling this.
  * @param bias  The bias object
  */
@@ -1077,14 +827,15 @@ static bool sensorsFindBiasValue(BiasObj* bias)
   static int32_t varianceSampleTime;
   bool foundBias = false;
 
-  if (bias->isBufferFilled)
+  if (bias->variance.x >= GYRO_VARIANCE_THRESHOLD_X ||
+      bias->variance.y >= GYRO_VARIANCE_THRESHOLD_Y ||
+      bias->variance.z >= GYRO_VARIANCE_THRESHOLD_Z)
   {
-    sensorsCalculateVarianceAndMean(bias, &bias->variance, &bias->mean);
-
-    if (bias->variance.x < GYRO_VARIANCE_THRESHOLD_X &&
-        bias->variance.y < GYRO_VARIANCE_THRESHOLD_Y &&
-        bias->variance.z < GYRO_VARIANCE_THRESHOLD_Z &&
-        (varianceSampleTime + GYRO_MIN_BIAS_TIMEOUT_MS < xTaskGetTickCount()))
+    sensorsBiasObjInit(bias);
+  }
+  else if (bias->stats[0].count >= SENSORS_NBR_OF_BIAS_SAMPLES)
+  {
+    if (varianceSampleTime + GYRO_MIN_BIAS_TIMEOUT_MS < xTaskGetTickCount())
     {
       varianceSampleTime = xTaskGetTickCount();
       bias->bias.x = bias->mean.x;
@@ -1093,28 +844,28 @@ static bool sensorsFindBiasValue(BiasObj* bias)
       foundBias = true;
       bias->isBiasValueFound = true;
     }
+    sensorsBiasObjInit(bias);
   }
 
   return foundBias;
 }
 
+
 bool sensorsBmi088SpiBmp388ManufacturingTest(void)
 {
-  bool testStatus = true;
-  if (! gyroSelftest())
-  {
-    testStatus = false;
-  }
+  bool testStatus = gyroSelftest();
+  uint32_t startTick = xTaskGetTickCount();
 
-  int8_t accResult = 0;
-  bmi088_perform_accel_selftest(&accResult, &bmi088Dev);
-  if (accResult == BMI088_SELFTEST_PASS)
+  // The sensors task calibrates the gyro, wait for it
+  while (testStatus && !gyroBiasFound &&
+         xTaskGetTickCount() - startTick < SENSORS_VARIANCE_MAN_TEST_TIMEOUT)
   {
-    DEBUG_PRINT("BMI088 acc self-test [OK]\n");
+    vTaskDelay(M2T(10));
   }
-  else
+
+  if (!gyroBiasFound)
   {
-    DEBUG_PRINT("BMI088 acc self-test [FAILED]\n");
+    DEBUG_PRINTE("Gyro variance test [FAIL]\n");
     testStatus = false;
   }
 
@@ -1151,109 +902,76 @@ void sensorsBmi088SpiBmp388SetAccMode(accModes accMode)
   switch (accMode)
   {
     case ACC_MODE_PROPTEST:
-//      bmi088_accel_soft_reset(&bmi088Dev);
-      /* set bandwidth and range of accel (280Hz cut-off according to datasheet) */
-      bmi088Dev.accel_cfg.bw = BMI088_ACCEL_BW_NORMAL;
-      bmi088Dev.accel_cfg.range = SENSORS_BMI088_ACCEL_FS_CFG;
-      bmi088Dev.accel_cfg.odr = BMI088_ACCEL_ODR_1600_HZ;
-      if (bmi088_set_accel_meas_conf(&bmi088Dev) != BMI088_OK)
-      {
-        DEBUG_PRINT("ACC config [FAIL]\n");
-      }
-      for (uint8_t i = 0; i < 3; i++)
-      {
-        lpf2pInit(&accLpf[i],  1000, 500);
-      }
+      /* 280Hz cut-off according to datasheet */
+      spiWriteRegister(SENSORS_BMI088_CS_ACC, BMI088_ACC_CONF, BMI088_ACC_BWP_NORMAL_1600_HZ);
+      accLpfInit(500);
       break;
     case ACC_MODE_FLIGHT:
     default:
-      /* set bandwidth and range of accel (145Hz cut-off according to datasheet) */
-      bmi088Dev.accel_cfg.bw = BMI088_ACCEL_BW_OSR4;
-      bmi088Dev.accel_cfg.range = SENSORS_BMI088_ACCEL_FS_CFG;
-      bmi088Dev.accel_cfg.odr = BMI088_ACCEL_ODR_1600_HZ;
-      if (bmi088_set_accel_meas_conf(&bmi088Dev) != BMI088_OK)
-      {
-        DEBUG_PRINT("ACC config [FAIL]\n");
-      }
-      for (uint8_t i = 0; i < 3; i++)
-      {
-        lpf2pInit(&accLpf[i],  1000, ACCEL_LPF_CUTOFF_FREQ);
-      }
+      /* 145Hz cut-off according to datasheet */
+      spiWriteRegister(SENSORS_BMI088_CS_ACC, BMI088_ACC_CONF, BMI088_ACC_BWP_OSR4_1600_HZ);
+      accLpfInit(ACCEL_LPF_CUTOFF_FREQ);
       break;
   }
 }
 
-static void applyAxis3fLpf(lpf2pData *data, Axis3f* in)
+static void gyroLpfInit(void)
 {
-  for (uint8_t i = 0; i < 3; i++) {
-    in->axis[i] = lpf2pApply(&data[i], in->axis[i]);
-  }
+  biquad3Init(&gyroLpf);
+  biquad3AddLpf(&gyroLpf, SENSORS_BMI088_GYRO_RATE_HZ, GYRO_LPF_CUTOFF_FREQ);
+#if CONFIG_GYRO_NOTCH_FREQ > 0
+  biquad3AddNotch(&gyroLpf, SENSORS_BMI088_GYRO_RATE_HZ, CONFIG_GYRO_NOTCH_FREQ, CONFIG_GYRO_NOTCH_BANDWIDTH);
+#endif
+#ifdef SENSORS_GYRO_DYN_NOTCH
+  gyroDynNotchStage = gyroLpf.numStages;
+  biquad3AddNotch(&gyroLpf, SENSORS_BMI088_GYRO_RATE_HZ, CONFIG_GYRO_DYN_NOTCH_MAX_FREQ, CONFIG_GYRO_NOTCH_BANDWIDTH);
+#endif
 }
 
-void sensorsBmi088SpiBmp388DataAvailableCallback(void)
+static void accLpfInit(float cutoffFreq)
 {
-  portBASE_TYPE xHigherPriorityTaskWoken = pdFALSE;
-  imuIntTimestamp = usecTimestamp();
-  xSemaphoreGiveFromISR(sensorsDataReady, &xHigherPriorityTaskWoken);
-
-  if (xHigherPriorityTaskWoken)
-  {
-    portYIELD();
-  }
+  biquad3Init(&accLpf);
+  biquad3AddLpf(&accLpf, SENSORS_READ_RATE_HZ, cutoffFreq);
 }
 
-void __attribute__((used)) BMI088_SPI_TX_DMA_IRQHandler(void)
+static void applyAxis3fLpf(biquad3Data *data, Axis3f* in)
 {
-  portBASE_TYPE xHigherPriorityTaskWoken = pdFALSE;
-
-  // Stop and cleanup DMA stream
-  DMA_ITConfig(BMI088_SPI_TX_DMA_STREAM, DMA_IT_TC, DISABLE);
-  DMA_ClearITPendingBit(BMI088_SPI_TX_DMA_STREAM, BMI088_SPI_TX_DMA_FLAG_TCIF);
-
-  // Clear stream flags
-  DMA_ClearFlag(BMI088_SPI_TX_DMA_STREAM,BMI088_SPI_TX_DMA_FLAG_TCIF);
-
-  // Disable SPI DMA requests
-  SPI_I2S_DMACmd(BMI088_SPI, SPI_I2S_DMAReq_Tx, DISABLE);
-
-  // Disable streams
-  DMA_Cmd(BMI088_SPI_TX_DMA_STREAM, DISABLE);
-
-  // Give the semaphore, allowing the SPI transaction to complete
-  xSemaphoreGiveFromISR(spiTxDMAComplete, &xHigherPriorityTaskWoken);
-
-  if (xHigherPriorityTaskWoken)
-  {
-    portYIELD();
-  }
+  biquad3Apply(data, in->axis);
 }
 
-void __attribute__((used)) BMI088_SPI_RX_DMA_IRQHandler(void)
+void IRAM_ATTR sensorsBmi088SpiBmp388DataAvailableCallback(void)
 {
   portBASE_TYPE xHigherPriorityTaskWoken = pdFALSE;
-
-  // Stop and cleanup DMA stream
-  DMA_ITConfig(BMI088_SPI_RX_DMA_STREAM, DMA_IT_TC, DISABLE);
-  DMA_ClearITPendingBit(BMI088_SPI_RX_DMA_STREAM, BMI088_SPI_RX_DMA_FLAG_TCIF);
-
-  // Clear stream flags
-  DMA_ClearFlag(BMI088_SPI_RX_DMA_STREAM, BMI088_SPI_RX_DMA_FLAG_TCIF);
-
-  // Disable SPI DMA requests
-  SPI_I2S_DMACmd(BMI088_SPI, SPI_I2S_DMAReq_Rx, DISABLE);
-
-  // Disable streams
-  DMA_Cmd(BMI088_SPI_RX_DMA_STREAM, DISABLE);
-
-  // Give the semaphore, allowing the SPI transaction to complete
-  xSemaphoreGiveFromISR(spiRxDMAComplete, &xHigherPriorityTaskWoken);
+  imuIntTimestamp = usecTimestamp();
+  SYSVIEW_MARKER_POINT(svSensorsIsr);
+  xSemaphoreGiveFromISR(sensorsDataReady, &xHigherPriorityTaskWoken);
 
   if (xHigherPriorityTaskWoken)
   {
-    portYIELD();
+    portYIELD_FROM_ISR();
   }
 }
 
+/**
+ * The IMU samples published and those no reader took
+ */
+LOG_GROUP_START(imu_snapshot)
+LOG_ADD(LOG_UINT32, samples, &imuSeq)
+LOG_ADD(LOG_UINT32, missed, &imuMissedCount)
+LOG_GROUP_STOP(imu_snapshot)
+
+LOG_GROUP_START(imu_fifo)
+LOG_ADD(LOG_UINT8, frames, &gyroFramesRead)
+LOG_ADD(LOG_UINT32, resets, &gyroFifoOverruns)
+LOG_GROUP_STOP(imu_fifo)
+
 PARAM_GROUP_START(imu_sensors)
 PARAM_ADD(PARAM_UINT8 | PARAM_RONLY, BMP388, &isBarometerPresent)
 PARAM_GROUP_STOP(imu_sensors)
+
+PARAM_GROUP_START(imu_tests)
+PARAM_ADD(PARAM_UINT8 | PARAM_RONLY, bmi088, &isBmi088TestPassed)
+PARAM_ADD(PARAM_UINT8 | PARAM_RONLY, pmw3901, &isPmw3901Present)
+PARAM_GROUP_STOP(imu_tests)
+
+#endif // CONFIG_SENSORS_BMI088_SPI
@@ -760,11 +760,11 @@ static void calcVarianceAndMean(BiasObj* bias, Axis3f* variance, Axis3f* mean)
     }
   calcMean(bias, mean);
 
-  variance->x = fabs(sumSquared[0] / SENSORS_NBR_OF_BIAS_SAMPLES
+  variance->x = fabsf(sumSquared[0] / SENSORS_NBR_OF_BIAS_SAMPLES
                      - mean->x * mean->x);
-  variance->y = fabs(sumSquared[1] / SENSORS_NBR_OF_BIAS_SAMPLES
+  variance->y = fabsf(sumSquared[1] / SENSORS_NBR_OF_BIAS_SAMPLES
                      - mean->y * mean->y);
-  variance->z = fabs(sumSquared[2] / SENSORS_NBR_OF_BIAS_SAMPLES
+  variance->z = fabsf(sumSquared[2] / SENSORS_NBR_OF_BIAS_SAMPLES
                      - mean->z * mean->z);
 }
 
@@ -26,6 +26,10 @@
  *
  * 2016.06.15: Initial version by Mike Hamer, http://mikehamer.info
  */
+#include "platform.h"
+
+#ifdef SENSOR_INCLUDED_MPU6050_HMC5883L_MS5611
+
 #include <math.h>
 
 #include "FreeRTOS.h"
@@ -38,6 +42,7 @@
 #include "driver/gpio.h"
 
 #include "sensors_mpu6050_hm5883L_ms5611.h"
+#include "sensors_snapshot.h"
 #include "system.h"
 #include "configblock.h"
 #include "param.h"
@@ -48,10 +53,15 @@
 #include "ledseq.h"
 #include "sound.h"
 #include "filter.h"
+#include "welford.h"
+#include "dyn_notch.h"
 #include "config.h"
+#include "cf_math.h"
+#include "num.h"
 #include "stm32_legacy.h"
 
 #include "i2cdev.h"
+#include "i2cdev_async.h"
 // #include "lps25h.h"
 #include "mpu6050.h"
 #include "hmc5883l.h"
@@ -60,11 +70,15 @@
 #include "zranger.h"
 #include "zranger2.h"
 #include "vl53l1x.h"
+#include "deadlinemonitor.h"
+#include "sysview_markers.h"
 #include "flowdeck_v1v2.h"
 #define DEBUG_MODULE "SENSORS"
 #include "debug_cf.h"
 #include "static_mem.h"
-#include "crtp_commander.h"
+#include "seqlock.h"
+#include "worker.h"
+#include "nvs.h"
 
 /**
  * Enable 250Hz digital LPF mode. However does not work with
@@ -102,49 +116,113 @@
 #define GPIO_INTA_MPU6050_IO CONFIG_MPU_PIN_INT
 #define SENSORS_MPU6050_BUFF_LEN 14
 #define SENSORS_MAG_BUFF_LEN 8
-#define SENSORS_BARO_BUFF_S_P_LEN MS5611_D1D2_SIZE
-#define SENSORS_BARO_BUFF_T_LEN MS5611_D1D2_SIZE
-#define SENSORS_BARO_BUFF_LEN (SENSORS_BARO_BUFF_S_P_LEN + SENSORS_BARO_BUFF_T_LEN)
+// The HMC5883L outputs at 15 Hz, see hmc5883lInit(). Its slave bytes are
+// fetched at twice that rate instead of with every IMU sample.
+#define SENSORS_MAG_OUTPUT_RATE_HZ 15
+#define SENSORS_MAG_READ_DIVIDER (1000 / (2 * SENSORS_MAG_OUTPUT_RATE_HZ))
+
+#ifdef CONFIG_SENSORS_MPU6050_FIFO
+#ifdef CONFIG_SENSORS_MPU6050_GYRO_OVERSAMPLE
+// Only the gyro is pushed, 24 kB/s of the 400 kHz I2C0 at 4 kHz. The accel
+// and temp registers are read once per wakeup, they output at 1 kHz anyway.
+#define SENSORS_MPU6050_FIFO_FRAME_LEN 6
+#define SENSORS_MPU6050_ACCEL_TEMP_LEN 8
+#define SENSORS_GYRO_OVERSAMPLE_RATE_HZ 4000
+#define SENSORS_GYRO_DECIMATION (SENSORS_GYRO_OVERSAMPLE_RATE_HZ / 1000)
+// Linear phase, (taps - 1) / 2 samples of group delay. 3 samples per output
+// suppress 1 kHz, which would alias to 0 Hz, by 50 dB and 750 Hz by 20 dB.
+#define SENSORS_GYRO_DECIMATE_TAPS (3 * SENSORS_GYRO_DECIMATION)
+#define SENSORS_GYRO_DECIMATE_CUTOFF_HZ 400
+#else
+// Accel, temp and gyro are pushed in register order, same layout as a direct read
+#define SENSORS_MPU6050_FIFO_FRAME_LEN SENSORS_MPU6050_BUFF_LEN
+#define SENSORS_GYRO_DECIMATION 1
+#endif
+#define SENSORS_MPU6050_FIFO_SIZE 1024
+// Max frames drained per wakeup, leaves room to catch up after being preempted
+#define SENSORS_MPU6050_FIFO_MAX_FRAMES (16 * SENSORS_GYRO_DECIMATION)
+#define SENSORS_MPU6050_FIFO_MAX_SAMPLES (SENSORS_MPU6050_FIFO_MAX_FRAMES / SENSORS_GYRO_DECIMATION)
+#endif
 
 #define GYRO_NBR_OF_AXES 3
 #define GYRO_MIN_BIAS_TIMEOUT_MS M2T(1 * 1000)
-// Number of samples used in variance calculation. Changing this effects the threshold
+// Number of still samples the bias is the mean of. Changing this effects the
+// threshold, the variances are sums of the squared deviations of a window.
 #define SENSORS_NBR_OF_BIAS_SAMPLES 1024
 // Variance threshold to take zero bias for gyro
 #define GYRO_VARIANCE_BASE 5000
 #define GYRO_VARIANCE_THRESHOLD_X (GYRO_VARIANCE_BASE)
 #define GYRO_VARIANCE_THRESHOLD_Y (GYRO_VARIANCE_BASE)
 #define GYRO_VARIANCE_THRESHOLD_Z (GYRO_VARIANCE_BASE)
+// The last good calibration is kept in NVS with the IMU temperature it was
+// taken at. At boot it is used right away if the temperature is close, and is
+// refined whenever the platform is still. Drift is written back.
+#define SENSORS_CALIB_STORE_NAMESPACE "sensors"
+#define SENSORS_CALIB_STORE_KEY "imuCalib"
+#define SENSORS_CALIB_TEMP_TOLERANCE 5.0f // [deg C]
+#define SENSORS_CALIB_STORE_BIAS_DRIFT 2.0f // [LSB]
+#define SENSORS_CALIB_STORE_TEMP_DRIFT 2.0f // [deg C]
+// MPU6050 die temperature from the TEMP_OUT registers
+#define SENSORS_TEMP_DEG_PER_LSB (1.0f / 340.0f)
+#define SENSORS_TEMP_OFFSET 36.53f
+// Device bring-up, then up to 3 s of self test retries
+#define SENSORS_TEST_TIMEOUT_MS 8000
 #define ESP_INTR_FLAG_DEFAULT 0
 
-#define PITCH_CALIB (CONFIG_PITCH_CALIB*1.0/100)
-#define ROLL_CALIB (CONFIG_ROLL_CALIB*1.0/100)
+#define PITCH_CALIB (CONFIG_PITCH_CALIB / 100.0f)
+#define ROLL_CALIB (CONFIG_ROLL_CALIB / 100.0f)
 
 typedef struct {
     Axis3f bias;
     Axis3f variance;
     Axis3f mean;
     bool isBiasValueFound;
-    bool isBufferFilled;
-    Axis3i16 *bufHead;
-    Axis3i16 buffer[SENSORS_NBR_OF_BIAS_SAMPLES];
+    welford_t stats[GYRO_NBR_OF_AXES];  // Of the window so far
 } BiasObj;
 
-static xQueueHandle accelerometerDataQueue;
-STATIC_MEM_QUEUE_ALLOC(accelerometerDataQueue, 1, sizeof(Axis3f));
-static xQueueHandle gyroDataQueue;
-STATIC_MEM_QUEUE_ALLOC(gyroDataQueue, 1, sizeof(Axis3f));
-static xQueueHandle magnetometerDataQueue;
-STATIC_MEM_QUEUE_ALLOC(magnetometerDataQueue, 1, sizeof(Axis3f));
-static xQueueHandle barometerDataQueue;
-STATIC_MEM_QUEUE_ALLOC(barometerDataQueue, 1, sizeof(baro_t));
+SEQLOCK_ALLOC(snapshotLock, sizeof(sensorsSnapshot_t));
+// Sensors task only
+static uint32_t imuSeq;
+static uint32_t magSeq;
+static uint32_t baroSeq;
+// Readers, the sequence of the samples taken last
+static uint32_t takenGyroSeq;
+static uint32_t takenAccSeq;
+static uint32_t takenMagSeq;
+static uint32_t takenBaroSeq;
+static uint32_t imuMissedCount;
 
 static xSemaphoreHandle sensorsDataReady;
 static xSemaphoreHandle dataReady;
+static xSemaphoreHandle sensorsTestDone;
+static bool isDeviceTestPassed = false;
 
 static bool isInit = false;
 static sensorData_t sensorData;
 static volatile uint64_t imuIntTimestamp;
+#ifdef CONFIG_SENSORS_MPU6050_FIFO
+static volatile uint32_t imuIntPendingCount;
+static uint8_t fifoBuffer[SENSORS_MPU6050_FIFO_MAX_FRAMES * SENSORS_MPU6050_FIFO_FRAME_LEN];
+static uint8_t fifoFramesRead;
+static uint32_t fifoResetCount;
+static uint8_t fifoCountBuffer[2];
+static I2cdevTransaction fifoCountXfer;
+static bool isFifoCountXferPrepared = false;
+#ifdef CONFIG_SENSORS_MPU6050_GYRO_OVERSAMPLE
+// Per axis, in the order of the registers
+static xtensa_fir_decimate_instance_f32 gyroDecimator[GYRO_NBR_OF_AXES];
+static float gyroDecimateCoeffs[SENSORS_GYRO_DECIMATE_TAPS];
+static float gyroDecimateState[GYRO_NBR_OF_AXES][SENSORS_GYRO_DECIMATE_TAPS + SENSORS_MPU6050_FIFO_MAX_FRAMES - 1];
+static float gyroDecimateIn[SENSORS_MPU6050_FIFO_MAX_FRAMES];
+static float gyroDecimateOut[GYRO_NBR_OF_AXES][SENSORS_MPU6050_FIFO_MAX_SAMPLES];
+#endif
+#else
+static I2cdevTransaction imuReadXfer;
+static bool isImuReadXferPrepared = false;
+static I2cdevTransaction imuMagReadXfer;
+static bool isImuMagReadXferPrepared = false;
+#endif
+static uint16_t magReadCount;
 
 static Axis3i16 gyroRaw;
 static Axis3i16 accelRaw;
@@ -156,13 +234,31 @@ static Axis3f gyroBiasStdDev;
 static bool gyroBiasFound = false;
 static float accScaleSum = 0;
 static float accScale = 1;
+static uint32_t accScaleSumCount = 0;
+static bool accScaleFound = false;
+static float imuTemperature;
+
+typedef struct {
+    Axis3f gyroBias;   // [LSB]
+    float accScale;
+    float temperature; // [deg C]
+} sensorsCalibration_t;
+
+static sensorsCalibration_t storedCalibration;
+static bool isStoredCalibrationLoaded = false;
+static bool isCalibrationStored = false;
 
 // Low Pass filtering
 #define GYRO_LPF_CUTOFF_FREQ 80
 #define ACCEL_LPF_CUTOFF_FREQ 30
-static lpf2pData accLpf[3];
-static lpf2pData gyroLpf[3];
-static void applyAxis3fLpf(lpf2pData *data, Axis3f *in);
+static biquad3Data accLpf;
+static biquad3Data gyroLpf;
+#ifdef CONFIG_GYRO_DYN_NOTCH
+static uint8_t gyroDynNotchStage;
+#endif
+static void gyroLpfInit(void);
+static void accLpfInit(float cutoffFreq);
+static void applyAxis3fLpf(biquad3Data *data, Axis3f *in);
 
 static bool isBarometerPresent = false;
 static bool isMagnetometerPresent = false;
@@ -189,13 +285,39 @@ float sinPitch;
 float cosRoll;
 float sinRoll;
 
+/*
+ * The raw samples are turned into units in one pass, acc = accTransform * raw
+ * and gyro = gyroScale * raw + gyroOffset. The acc matrix folds the axis
+ * signs, the scale and the rotation of the calibration angles, the gyro the
+ * signs, the scale and the bias. Computed again by sensorsUpdateImuTransform()
+ * once the bias or the acc scale changed.
+ */
+static float accTransform[3][3];
+static Axis3f gyroScale;
+static Axis3f gyroOffset;
+static bool isImuTransformStale = true;
+
 // This buffer needs to hold data from all sensors
-static uint8_t buffer[SENSORS_MPU6050_BUFF_LEN + SENSORS_MAG_BUFF_LEN + SENSORS_BARO_BUFF_LEN] = {0};
+static uint8_t buffer[SENSORS_MPU6050_BUFF_LEN + SENSORS_MAG_BUFF_LEN] = {0};
 
 static void processAccGyroMeasurements(const uint8_t *buffer);
 static void processMagnetometerMeasurements(const uint8_t *buffer);
-static void processBarometerMeasurements(const uint8_t *buffer);
+static void sensorsUpdateBarometer(void);
+static void sensorsDeviceInit(void);
+static void sensorsInterruptInit(void);
+static bool sensorsDeviceTest(void);
 static void sensorsSetupSlaveRead(void);
+static void sensorsLoadCalibration(void);
+static bool sensorsApplyStoredCalibration(void);
+static void sensorsCheckCalibrationDrift(void);
+static void sensorsStoreCalibration(void *arg);
+#ifdef CONFIG_SENSORS_MPU6050_FIFO
+static uint8_t sensorsReadFifo(void);
+#endif
+#ifdef CONFIG_SENSORS_MPU6050_GYRO_OVERSAMPLE
+static void gyroDecimatorInit(void);
+static void gyroDecimate(uint16_t nbrOfFrames);
+#endif
 
 #ifdef GYRO_GYRO_BIAS_LIGHT_WEIGHT
 static bool processGyroBiasNoBuffer(int16_t gx, int16_t gy, int16_t gz, Axis3f *gyroBiasOut);
@@ -203,41 +325,100 @@ static bool processGyroBiasNoBuffer(int16_t gx, int16_t gy, int16_t gz, Axis3f *
 static bool processGyroBias(int16_t gx, int16_t gy, int16_t gz, Axis3f *gyroBiasOut);
 #endif
 static bool processAccScale(int16_t ax, int16_t ay, int16_t az);
+static void sensorsRestartAccScale(void);
 static void sensorsBiasObjInit(BiasObj *bias);
-static void sensorsCalculateVarianceAndMean(BiasObj *bias, Axis3f *varOut, Axis3f *meanOut);
-static void sensorsCalculateBiasMean(BiasObj *bias, Axis3i32 *meanOut);
 static void sensorsAddBiasValue(BiasObj *bias, int16_t x, int16_t y, int16_t z);
 static bool sensorsFindBiasValue(BiasObj *bias);
-static void sensorsAccAlignToGravity(Axis3f *in, Axis3f *out);
+static void sensorsUpdateImuTransform(void);
 
 STATIC_MEM_TASK_ALLOC(sensorsTask, SENSORS_TASK_STACKSIZE);
+static void sensorsPublish(void)
+{
+    const sensorsSnapshot_t snapshot = {
+        .data = sensorData,
+        .imuSeq = imuSeq,
+        .magSeq = magSeq,
+        .baroSeq = baroSeq,
+    };
+
+    seqlockWrite(&snapshotLock, &snapshot);
+}
+
 bool sensorsMpu6050Hmc5883lMs5611ReadGyro(Axis3f *gyro)
 {
-    return (pdTRUE == xQueueReceive(gyroDataQueue, gyro, 0));
+    sensorsSnapshot_t snapshot;
+
+    seqlockRead(&snapshotLock, &snapshot);
+    if (!sensorsSnapshotTake(&takenGyroSeq, snapshot.imuSeq, &imuMissedCount)) {
+        return false;
+    }
+    *gyro = snapshot.data.gyro;
+    return true;
+}
+
+uint64_t sensorsMpu6050Hmc5883lMs5611GyroTimestamp(void)
+{
+    sensorsSnapshot_t snapshot;
+
+    seqlockRead(&snapshotLock, &snapshot);
+    return snapshot.data.interruptTimestamp;
 }
 
 bool sensorsMpu6050Hmc5883lMs5611ReadAcc(Axis3f *acc)
 {
-    return (pdTRUE == xQueueReceive(accelerometerDataQueue, acc, 0));
+    sensorsSnapshot_t snapshot;
+
+    seqlockRead(&snapshotLock, &snapshot);
+    if (!sensorsSnapshotTake(&takenAccSeq, snapshot.imuSeq, NULL)) {
+        return false;
+    }
+    *acc = snapshot.data.acc;
+    return true;
 }
 
 bool sensorsMpu6050Hmc5883lMs5611ReadMag(Axis3f *mag)
 {
-    return (pdTRUE == xQueueReceive(magnetometerDataQueue, mag, 0));
+    sensorsSnapshot_t snapshot;
+
+    seqlockRead(&snapshotLock, &snapshot);
+    if (!sensorsSnapshotTake(&takenMagSeq, snapshot.magSeq, NULL)) {
+        return false;
+    }
+    *mag = snapshot.data.mag;
+    return true;
 }
 
 bool sensorsMpu6050Hmc5883lMs5611ReadBaro(baro_t *baro)
 {
-    return (pdTRUE == xQueueReceive(barometerDataQueue, baro, 0));
+    sensorsSnapshot_t snapshot;
+
+    seqlockRead(&snapshotLock, &snapshot);
+    if (!sensorsSnapshotTake(&takenBaroSeq, snapshot.baroSeq, NULL)) {
+        return false;
+    }
+    *baro = snapshot.data.baro;
+    return true;
 }
 
 void sensorsMpu6050Hmc5883lMs5611Acquire(sensorData_t *sensors, const uint32_t tick)
 {
-    sensorsReadGyro(&sensors->gyro);
-    sensorsReadAcc(&sensors->acc);
-    sensorsReadMag(&sensors->mag);
-    sensorsReadBaro(&sensors->baro);
-    sensors->interruptTimestamp = sensorData.interruptTimestamp;
+    sensorsSnapshot_t snapshot;
+
+    // One copy for all of them, the samples taken stay consistent
+    seqlockRead(&snapshotLock, &snapshot);
+    if (sensorsSnapshotTake(&takenGyroSeq, snapshot.imuSeq, &imuMissedCount)) {
+        sensors->gyro = snapshot.data.gyro;
+    }
+    if (sensorsSnapshotTake(&takenAccSeq, snapshot.imuSeq, NULL)) {
+        sensors->acc = snapshot.data.acc;
+    }
+    if (sensorsSnapshotTake(&takenMagSeq, snapshot.magSeq, NULL)) {
+        sensors->mag = snapshot.data.mag;
+    }
+    if (sensorsSnapshotTake(&takenBaroSeq, snapshot.baroSeq, NULL)) {
+        sensors->baro = snapshot.data.baro;
+    }
+    sensors->interruptTimestamp = snapshot.data.interruptTimestamp;
 }
 
 bool sensorsMpu6050Hmc5883lMs5611AreCalibrated()
@@ -245,55 +426,135 @@ bool sensorsMpu6050Hmc5883lMs5611AreCalibrated()
     return gyroBiasFound;
 }
 
+/* The reads of every sample go ahead of the other queued transfers of the
+ * bus, see i2cdev_async.h */
+static bool sensorsImuExecute(I2cdevTransaction *xfer)
+{
+    I2cdevAsyncRequest request = {
+        .direction = i2cRead,
+        .devAddress = MPU6050_ADDRESS_AD0_LOW,
+        .transaction = xfer,
+    };
+
+    return i2cdevAsyncTransfer(I2C0_DEV, &request, i2cdevAsyncPrioHigh);
+}
+
+static bool sensorsImuRead(uint8_t memAddress, uint16_t len, uint8_t *data)
+{
+    I2cdevAsyncRequest request = {
+        .direction = i2cRead,
+        .devAddress = MPU6050_ADDRESS_AD0_LOW,
+        .memAddress = memAddress,
+        .len = len,
+        .data = data,
+    };
+
+    return i2cdevAsyncTransfer(I2C0_DEV, &request, i2cdevAsyncPrioHigh);
+}
+
 static void sensorsTask(void *param)
 {
-    //TODO:
-    systemWaitStart();
-    vTaskDelay(M2T(200));
+    // Bring-up, self tests and gyro calibration run here, in parallel with the
+    // rest of the boot. The samples are processed before the system starts.
+    sensorsDeviceInit();
+    sensorsInterruptInit();
+    isDeviceTestPassed = sensorsDeviceTest();
+    xSemaphoreGive(sensorsTestDone);
+    sensorsLoadCalibration();
+
     DEBUG_PRINTD("xTaskCreate sensorsTask IN");
     sensorsSetupSlaveRead(); //
     DEBUG_PRINTD("xTaskCreate sensorsTask SetupSlave done");
 
+    // Build the hot loop I2C read once, it is replayed on every sample
+#ifdef CONFIG_SENSORS_MPU6050_FIFO
+    isFifoCountXferPrepared = i2cdevPrepareReadReg8(&fifoCountXfer, I2C0_DEV, MPU6050_ADDRESS_AD0_LOW,
+                                                    MPU6050_RA_FIFO_COUNTH, sizeof(fifoCountBuffer), fifoCountBuffer);
+#else
+    // The slave bytes follow the IMU registers, the longer read is used at the mag rate
+    isImuReadXferPrepared = i2cdevPrepareReadReg8(&imuReadXfer, I2C0_DEV, MPU6050_ADDRESS_AD0_LOW,
+                                                  MPU6050_RA_ACCEL_XOUT_H, SENSORS_MPU6050_BUFF_LEN, buffer);
+    isImuMagReadXferPrepared = i2cdevPrepareReadReg8(&imuMagReadXfer, I2C0_DEV, MPU6050_ADDRESS_AD0_LOW,
+                                                     MPU6050_RA_ACCEL_XOUT_H,
+                                                     SENSORS_MPU6050_BUFF_LEN + SENSORS_MAG_BUFF_LEN, buffer);
+#endif
+
+#ifdef CONFIG_SENSORS_MPU6050_FIFO
+    deadlineMonitorRegister(dmSensors, 1000 * CONFIG_SENSORS_MPU6050_FIFO_BATCH, SENSORS_TASK_BUDGET_US);
+#else
+    deadlineMonitorRegister(dmSensors, 1000, SENSORS_TASK_BUDGET_US);
+#endif
+
     while (1) {
 
         /* mpu6050 interrupt trigger: data is ready to be read */
         if (pdTRUE == xSemaphoreTake(sensorsDataReady, portMAX_DELAY)) {
+            deadlineMonitorCheckIn(dmSensors);
             sensorData.interruptTimestamp = imuIntTimestamp;
 
-            /* sensors step 1-read data from I2C */
-            uint8_t dataLen = (uint8_t)(SENSORS_MPU6050_BUFF_LEN +
-                                        (isMagnetometerPresent ? SENSORS_MAG_BUFF_LEN : 0) +
-                                        (isBarometerPresent ? SENSORS_BARO_BUFF_LEN : 0));
-            i2cdevReadReg8(I2C0_DEV, MPU6050_ADDRESS_AD0_LOW, MPU6050_RA_ACCEL_XOUT_H, dataLen, buffer);
+#ifdef CONFIG_SENSORS_MPU6050_FIFO
+            /* sensors step 1+2-drain the FIFO, every sample goes through the acc/gyro processing */
+            uint8_t nbrOfSamples = sensorsReadFifo();
+
+            if (nbrOfSamples == 0) {
+                deadlineMonitorCheckOut(dmSensors);
+                continue;
+            }
+
+            magReadCount += nbrOfSamples;
+            bool isMagRead = isMagnetometerPresent && magReadCount >= SENSORS_MAG_READ_DIVIDER;
+
+            if (isMagRead) {
+                sensorsImuRead(MPU6050_RA_EXT_SENS_DATA_00, SENSORS_MAG_BUFF_LEN, &buffer[SENSORS_MPU6050_BUFF_LEN]);
+            }
+#else
+            /* sensors step 1-read data from I2C, the mag slave bytes only at the mag rate */
+            magReadCount++;
+            bool isMagRead = isMagnetometerPresent && magReadCount >= SENSORS_MAG_READ_DIVIDER;
+            I2cdevTransaction *readXfer = isMagRead ? &imuMagReadXfer : &imuReadXfer;
+            uint8_t dataLen = (uint8_t)(SENSORS_MPU6050_BUFF_LEN + (isMagRead ? SENSORS_MAG_BUFF_LEN : 0));
+
+            if (isMagRead ? isImuMagReadXferPrepared : isImuReadXferPrepared) {
+                sensorsImuExecute(readXfer);
+            } else {
+                sensorsImuRead(MPU6050_RA_ACCEL_XOUT_H, dataLen, buffer);
+            }
 
             /* sensors step 2-process the respective data */
             processAccGyroMeasurements(&(buffer[0]));
+#endif
 
-            if (isMagnetometerPresent) {
+            if (isMagRead) {
+                magReadCount = 0;
                 processMagnetometerMeasurements(&(buffer[SENSORS_MPU6050_BUFF_LEN]));
             }
 
-            if (isBarometerPresent) {
-                processBarometerMeasurements(&(buffer[isMagnetometerPresent ? SENSORS_MPU6050_BUFF_LEN + SENSORS_MAG_BUFF_LEN : SENSORS_MPU6050_BUFF_LEN]));
+            /* sensors step 3- publish the sensors data in the snapshot */
+            imuSeq++;
+            if (isMagRead) {
+                magSeq++;
             }
+            sensorsPublish();
 
-            /* sensors step 3- queue sensors data  on the output queues */
-            xQueueOverwrite(accelerometerDataQueue, &sensorData.acc);
-            xQueueOverwrite(gyroDataQueue, &sensorData.gyro);
-
-            if (isMagnetometerPresent) {
-                xQueueOverwrite(magnetometerDataQueue, &sensorData.mag);
+            /* sensors step 4- Unlock stabilizer task */
+            SYSVIEW_MARKER_POINT(svSensorsRead);
+#ifdef CONFIG_SENSORS_MPU6050_FIFO
+            // One release per sample keeps the stabilizer tick in step with the sample rate
+            for (uint8_t i = 0; i < nbrOfSamples; i++) {
+                xSemaphoreGive(dataReady);
             }
+#else
+            xSemaphoreGive(dataReady);
+#endif
 
+            /* sensors step 5- baro conversions, in the slack after the release */
             if (isBarometerPresent) {
-                xQueueOverwrite(barometerDataQueue, &sensorData.baro);
+                sensorsUpdateBarometer();
             }
-
-            /* sensors step 4- Unlock stabilizer task */
-            xSemaphoreGive(dataReady);
 #ifdef DEBUG_EP2
             DEBUG_PRINT_LOCAL("ax = %f,  ay = %f,  az = %f,  gx = %f,  gy = %f,  gz = %f , hx = %f , hy = %f, hz =%f \n", sensorData.acc.x, sensorData.acc.y, sensorData.acc.z, sensorData.gyro.x, sensorData.gyro.y, sensorData.gyro.z, sensorData.mag.x, sensorData.mag.y, sensorData.mag.z);
 #endif
+            deadlineMonitorCheckOut(dmSensors);
         }
     }
 }
@@ -303,46 +564,153 @@ void sensorsMpu6050Hmc5883lMs5611WaitDataReady(void)
     xSemaphoreTake(dataReady, portMAX_DELAY);
 }
 
-void processBarometerMeasurements(const uint8_t *buffer)
+#ifdef CONFIG_SENSORS_MPU6050_FIFO
+static void sensorsResetFifo(void)
 {
-    //TODO: replace it to MS5611
-    DEBUG_PRINTW("processBarometerMeasurements NEED TODO");
-//   static uint32_t rawPressure = 0;
-//   static int16_t rawTemp = 0;
+    mpu6050SetFIFOEnabled(false);
+    mpu6050ResetFIFO();
+    mpu6050SetFIFOEnabled(true);
+}
+
+/**
+ * Reads all complete frames from the MPU6050 FIFO in one burst and
+ * processes them in order. A partial frame is left for the next call, and
+ * when oversampling so are the frames short of a whole decimated sample.
+ * @return Number of 1 kHz samples processed
+ */
+static uint8_t sensorsReadFifo(void)
+{
+    uint16_t fifoCount;
+
+    if (isFifoCountXferPrepared && sensorsImuExecute(&fifoCountXfer)) {
+        fifoCount = (((uint16_t)fifoCountBuffer[0]) << 8) | fifoCountBuffer[1];
+    } else {
+        fifoCount = mpu6050GetFIFOCount();
+    }
 
-// Check if there is a new pressure update
+    if (fifoCount > SENSORS_MPU6050_FIFO_SIZE - SENSORS_MPU6050_FIFO_FRAME_LEN) {
+        // FIFO is (about to be) full, the oldest bytes are dropped and frame alignment is lost
+        sensorsResetFifo();
+        fifoResetCount++;
+        DEBUG_PRINTW("mpu6050 FIFO overflow, reset");
+        return 0;
+    }
+
+    uint16_t nbrOfFrames = fifoCount / SENSORS_MPU6050_FIFO_FRAME_LEN;
+
+    if (nbrOfFrames > SENSORS_MPU6050_FIFO_MAX_FRAMES) {
+        nbrOfFrames = SENSORS_MPU6050_FIFO_MAX_FRAMES;
+    }
+    nbrOfFrames -= nbrOfFrames % SENSORS_GYRO_DECIMATION;
+
+    if (nbrOfFrames > 0) {
+        sensorsImuRead(MPU6050_RA_FIFO_R_W, nbrOfFrames * SENSORS_MPU6050_FIFO_FRAME_LEN, fifoBuffer);
 
-// Check if there is a new temp update
+#ifdef CONFIG_SENSORS_MPU6050_GYRO_OVERSAMPLE
+        // The latest accel and temp go with every decimated gyro sample of the read
+        sensorsImuRead(MPU6050_RA_ACCEL_XOUT_H, SENSORS_MPU6050_ACCEL_TEMP_LEN, buffer);
+        gyroDecimate(nbrOfFrames);
 
-//   sensorData.baro.pressure = (float) rawPressure / LPS25H_LSB_PER_MBAR;
-//   sensorData.baro.temperature = LPS25H_TEMP_OFFSET + ((float) rawTemp / LPS25H_LSB_PER_CELSIUS);
-//   sensorData.baro.asl = lps25hPressureToAltitude(&sensorData.baro.pressure);
+        for (uint16_t i = 0; i < nbrOfFrames / SENSORS_GYRO_DECIMATION; i++) {
+            // Back into the register layout, processAccGyroMeasurements() swaps the axes
+            for (int axis = 0; axis < GYRO_NBR_OF_AXES; axis++) {
+                const int16_t value = (int16_t)lroundf(constrain(gyroDecimateOut[axis][i], INT16_MIN, INT16_MAX));
+
+                buffer[SENSORS_MPU6050_ACCEL_TEMP_LEN + 2 * axis] = (uint8_t)((uint16_t)value >> 8);
+                buffer[SENSORS_MPU6050_ACCEL_TEMP_LEN + 2 * axis + 1] = (uint8_t)value;
+            }
+            processAccGyroMeasurements(buffer);
+        }
+#else
+        for (uint16_t i = 0; i < nbrOfFrames; i++) {
+            processAccGyroMeasurements(&fifoBuffer[i * SENSORS_MPU6050_FIFO_FRAME_LEN]);
+        }
+#endif
+    }
+
+    fifoFramesRead = (uint8_t)nbrOfFrames;
+    return (uint8_t)(nbrOfFrames / SENSORS_GYRO_DECIMATION);
 }
+#endif
 
-void processMagnetometerMeasurements(const uint8_t *buffer)
+#ifdef CONFIG_SENSORS_MPU6050_GYRO_OVERSAMPLE
+/**
+ * Hamming windowed sinc, normalized to a unity gain at DC. It is symmetric,
+ * the time reversed order xtensa_fir_decimate_f32() expects is the same.
+ */
+static void gyroDecimatorInit(void)
 {
-    //TODO: replace it to hmc5883l
-    if (buffer[7] & (1 << HMC5883L_STATUS_READY_BIT)) {
-        int16_t headingx = (((int16_t)buffer[2]) << 8) | buffer[1]; //hmc5883 different from
-        int16_t headingz = (((int16_t)buffer[4]) << 8) | buffer[3];
-        int16_t headingy = (((int16_t)buffer[6]) << 8) | buffer[5];
-
-        sensorData.mag.x = (float)headingx / MAG_GAUSS_PER_LSB; //to gauss
-        sensorData.mag.y = (float)headingy / MAG_GAUSS_PER_LSB;
-        sensorData.mag.z = (float)headingz / MAG_GAUSS_PER_LSB;
-        DEBUG_PRINTI("hmc5883l DATA ready");
-    } else {
+    const float cutoff = 2.0f * SENSORS_GYRO_DECIMATE_CUTOFF_HZ / SENSORS_GYRO_OVERSAMPLE_RATE_HZ;
+    float sum = 0.0f;
+
+    for (int i = 0; i < SENSORS_GYRO_DECIMATE_TAPS; i++) {
+        const float t = i - (SENSORS_GYRO_DECIMATE_TAPS - 1) / 2.0f;
+        const float sinc = (t == 0.0f) ? cutoff : sinf((float)M_PI * cutoff * t) / ((float)M_PI * t);
+        const float window = 0.54f - 0.46f * cosf(2.0f * (float)M_PI * i / (SENSORS_GYRO_DECIMATE_TAPS - 1));
+
+        gyroDecimateCoeffs[i] = sinc * window;
+        sum += gyroDecimateCoeffs[i];
+    }
+    for (int i = 0; i < SENSORS_GYRO_DECIMATE_TAPS; i++) {
+        gyroDecimateCoeffs[i] /= sum;
+    }
 
-        DEBUG_PRINTW("hmc5883l DATA not ready");
+    for (int axis = 0; axis < GYRO_NBR_OF_AXES; axis++) {
+        xtensa_fir_decimate_init_f32(&gyroDecimator[axis], SENSORS_GYRO_DECIMATE_TAPS, SENSORS_GYRO_DECIMATION,
+                                     gyroDecimateCoeffs, gyroDecimateState[axis], SENSORS_MPU6050_FIFO_MAX_FRAMES);
     }
 }
 
+/**
+ * Filters the raw gyro of the FIFO frames axis by axis into gyroDecimateOut,
+ * in LSB, one sample per SENSORS_GYRO_DECIMATION frames.
+ */
+static void gyroDecimate(uint16_t nbrOfFrames)
+{
+    for (int axis = 0; axis < GYRO_NBR_OF_AXES; axis++) {
+        for (uint16_t i = 0; i < nbrOfFrames; i++) {
+            const uint8_t *frame = &fifoBuffer[i * SENSORS_MPU6050_FIFO_FRAME_LEN + 2 * axis];
+
+            gyroDecimateIn[i] = (int16_t)((((int16_t)frame[0]) << 8) | frame[1]);
+        }
+        xtensa_fir_decimate_f32(&gyroDecimator[axis], gyroDecimateIn, gyroDecimateOut[axis], nbrOfFrames);
+    }
+}
+#endif
+
+/**
+ * At most a read and a command on I2C0 per call, the conversions run while
+ * the next IMU samples are awaited, see ms5611Update().
+ */
+static void sensorsUpdateBarometer(void)
+{
+    if (ms5611Update(xTaskGetTickCount(), &sensorData.baro.pressure, &sensorData.baro.temperature)) {
+        sensorData.baro.asl = ms5611PressureToAltitude(&sensorData.baro.pressure);
+        baroSeq++;
+        sensorsPublish();
+    }
+}
+
+/**
+ * The slave reads the HMC5883L at 100 Hz and the ready bit is cleared by the
+ * first read of a new output, so it is mostly seen low here. The output
+ * registers always hold the latest sample and are taken as they are.
+ */
+void processMagnetometerMeasurements(const uint8_t *buffer)
+{
+    int16_t headingx = (((int16_t)buffer[2]) << 8) | buffer[1]; //hmc5883 different from
+    int16_t headingz = (((int16_t)buffer[4]) << 8) | buffer[3];
+    int16_t headingy = (((int16_t)buffer[6]) << 8) | buffer[5];
+
+    sensorData.mag.x = (float)headingx / MAG_GAUSS_PER_LSB; //to gauss
+    sensorData.mag.y = (float)headingy / MAG_GAUSS_PER_LSB;
+    sensorData.mag.z = (float)headingz / MAG_GAUSS_PER_LSB;
+}
+
 void processAccGyroMeasurements(const uint8_t *buffer)
 {
     /*  Note the ordering to correct the rotated 90º IMU coordinate system */
 
-    Axis3f accScaled;
-
 #ifdef CONFIG_TARGET_ESPLANE_V1
     /* sensors step 2.1 read from buffer */
     /*
@@ -368,6 +736,7 @@ void processAccGyroMeasurements(const uint8_t *buffer)
     gyroRaw.x = (((int16_t)buffer[10]) << 8) | buffer[11];
     gyroRaw.z = (((int16_t)buffer[12]) << 8) | buffer[13];
 #endif
+    imuTemperature = (int16_t)((((int16_t)buffer[6]) << 8) | buffer[7]) * SENSORS_TEMP_DEG_PER_LSB + SENSORS_TEMP_OFFSET;
 
 #ifdef GYRO_BIAS_LIGHT_WEIGHT
     gyroBiasFound = processGyroBiasNoBuffer(gyroRaw.x, gyroRaw.y, gyroRaw.z, &gyroBias);
@@ -381,32 +750,29 @@ void processAccGyroMeasurements(const uint8_t *buffer)
         processAccScale(accelRaw.x, accelRaw.y, accelRaw.z);
     }
 
-    /* sensors step 2.4 convert  digtal value to physical angle */
-#ifdef CONFIG_TARGET_ESPLANE_V1
-    //sensorData.gyro.x = (gyroRaw.x - gyroBias.x) * SENSORS_DEG_PER_LSB_CFG;
-    sensorData.gyro.x = -(gyroRaw.x - gyroBias.x) * SENSORS_DEG_PER_LSB_CFG;
-#else
-    sensorData.gyro.x = -(gyroRaw.x - gyroBias.x) * SENSORS_DEG_PER_LSB_CFG;
-#endif
+    if (isImuTransformStale) {
+        sensorsUpdateImuTransform();
+    }
 
-    sensorData.gyro.y = (gyroRaw.y - gyroBias.y) * SENSORS_DEG_PER_LSB_CFG;
-    sensorData.gyro.z = (gyroRaw.z - gyroBias.z) * SENSORS_DEG_PER_LSB_CFG;
+    /* sensors step 2.4 convert  digtal value to physical angle */
+    sensorData.gyro.x = gyroRaw.x * gyroScale.x + gyroOffset.x;
+    sensorData.gyro.y = gyroRaw.y * gyroScale.y + gyroOffset.y;
+    sensorData.gyro.z = gyroRaw.z * gyroScale.z + gyroOffset.z;
     /* sensors step 2.5 low pass filter */
-    applyAxis3fLpf((lpf2pData *)(&gyroLpf), &sensorData.gyro);
-
-#ifdef CONFIG_TARGET_ESPLANE_V1
-    //accScaled.x = (accelRaw.x) * SENSORS_G_PER_LSB_CFG / accScale;
-    accScaled.x = -(accelRaw.x) * SENSORS_G_PER_LSB_CFG / accScale;
-#else
-    accScaled.x = -(accelRaw.x) * SENSORS_G_PER_LSB_CFG / accScale;   
+#ifdef CONFIG_GYRO_DYN_NOTCH
+    float notchFreq;
+    dynNotchAddSample(&sensorData.gyro);
+    if (dynNotchGetCenterFreq(&notchFreq)) {
+        biquad3SetNotch(&gyroLpf, gyroDynNotchStage, 1000, notchFreq, CONFIG_GYRO_NOTCH_BANDWIDTH);
+    }
 #endif
+    applyAxis3fLpf(&gyroLpf, &sensorData.gyro);
 
-    accScaled.y = (accelRaw.y) * SENSORS_G_PER_LSB_CFG / accScale;
-    accScaled.z = (accelRaw.z) * SENSORS_G_PER_LSB_CFG / accScale;
-
-    /* sensors step 2.6 Compensate for a miss-aligned accelerometer. */
-    sensorsAccAlignToGravity(&accScaled, &sensorData.acc);
-    applyAxis3fLpf((lpf2pData *)(&accLpf), &sensorData.acc);
+    /* sensors step 2.6 scale, and compensate for a miss-aligned accelerometer */
+    sensorData.acc.x = accelRaw.x * accTransform[0][0] + accelRaw.y * accTransform[0][1] + accelRaw.z * accTransform[0][2];
+    sensorData.acc.y = accelRaw.x * accTransform[1][0] + accelRaw.y * accTransform[1][1] + accelRaw.z * accTransform[1][2];
+    sensorData.acc.z = accelRaw.x * accTransform[2][0] + accelRaw.y * accTransform[2][1] + accelRaw.z * accTransform[2][2];
+    applyAxis3fLpf(&accLpf, &sensorData.acc);
 }
 static void sensorsDeviceInit(void)
 {
@@ -452,7 +818,15 @@ static void sensorsDeviceInit(void)
 
     // Set digital low-pass bandwidth for gyro and acc
     // board ESP32_S2_DRONE_V1_2 has more vibrations, bandwidth should be lower
-#ifdef SENSORS_MPU6050_DLPF_256HZ
+#if defined(CONFIG_SENSORS_MPU6050_GYRO_OVERSAMPLE)
+    // The widest DLPF that still has an 8 kHz gyro rate, the FIR decimation
+    // does the anti-aliasing. Set output rate (1): 8000 / (1 + 1) = 4000Hz
+    mpu6050SetRate(8000 / SENSORS_GYRO_OVERSAMPLE_RATE_HZ - 1);
+    mpu6050SetDLPFMode(MPU6050_DLPF_BW_256);
+    gyroDecimatorInit();
+    gyroLpfInit();
+    accLpfInit(ACCEL_LPF_CUTOFF_FREQ);
+#elif defined(SENSORS_MPU6050_DLPF_256HZ)
     // 256Hz digital low-pass filter only works with little vibrations
     // Set output rate (15): 8000 / (1 + 7) = 1000Hz
     mpu6050SetRate(7);
@@ -465,18 +839,14 @@ static void sensorsDeviceInit(void)
     mpu6050SetRate(0);
     mpu6050SetDLPFMode(MPU6050_DLPF_BW_42);
     // Init second order filer for accelerometer
-    for (uint8_t i = 0; i < 3; i++) {
-        lpf2pInit(&gyroLpf[i], 1000, GYRO_LPF_CUTOFF_FREQ);
-        lpf2pInit(&accLpf[i], 1000, ACCEL_LPF_CUTOFF_FREQ);
-    }
+    gyroLpfInit();
+    accLpfInit(ACCEL_LPF_CUTOFF_FREQ);
 #else
     mpu6050SetRate(0);
     mpu6050SetDLPFMode(MPU6050_DLPF_BW_98);
     // Init second order filer for accelerometer
-    for (uint8_t i = 0; i < 3; i++) {
-        lpf2pInit(&gyroLpf[i], 1000, GYRO_LPF_CUTOFF_FREQ);
-        lpf2pInit(&accLpf[i], 1000, ACCEL_LPF_CUTOFF_FREQ);
-    }
+    gyroLpfInit();
+    accLpfInit(ACCEL_LPF_CUTOFF_FREQ);
 #endif
 
 #ifdef SENSORS_ENABLE_MAG_HM5883L
@@ -492,9 +862,7 @@ static void sensorsDeviceInit(void)
 
 #endif
 #ifdef SENSORS_ENABLE_PRESSURE_MS5611
-    ms5611Init(I2C0_DEV);
-
-    if (false) {
+    if (ms5611Init(I2C0_DEV)) {
         isBarometerPresent = true;
         DEBUG_PRINTI("MS5611 I2C connection [OK].\n");
     } else {
@@ -504,43 +872,15 @@ static void sensorsDeviceInit(void)
 
 #endif
 
+    // The decks were probed and their drivers started by deckInit()
 #ifdef SENSORS_ENABLE_RANGE_VL53L1X
-    zRanger2Init();
-
-    if (zRanger2Test() == true) {
-        isVl53l1xPresent = true;
-        DEBUG_PRINTI("VL53L1X I2C connection [OK].\n");
-    } else {
-        //TODO: Should sensor test fail hard if no connection
-        DEBUG_PRINTW("VL53L1X I2C connection [FAIL].\n");
-    }
-
+    isVl53l1xPresent = zRanger2Test();
 #endif
-
 #ifdef SENSORS_ENABLE_RANGE_VL53L0X
-    zRangerInit();
-
-    if (zRangerTest() == true) {
-        isVl53l0xPresent = true;
-        DEBUG_PRINTI("VL53L0X I2C connection [OK].\n");
-    } else {
-        //TODO: Should sensor test fail hard if no connection
-        DEBUG_PRINTW("VL53L0X I2C connection [FAIL].\n");
-    }
-
+    isVl53l0xPresent = zRangerTest();
 #endif
-
 #ifdef SENSORS_ENABLE_FLOW_PMW3901
-    flowdeck2Init();
-
-    if (flowdeck2Test() == true) {
-        isPmw3901Present = true;
-        setCommandermode(POSHOLD_MODE);
-        DEBUG_PRINTI("PMW3901 SPI connection [OK].\n");
-    } else {
-        //TODO: Should sensor test fail hard if no connection
-        DEBUG_PRINTW("PMW3901 SPI connection [FAIL].\n");
-    }
+    isPmw3901Present = flowdeck2Test();
 #endif
 
     DEBUG_PRINTI("sensors init done");
@@ -555,7 +895,7 @@ static void sensorsDeviceInit(void)
     sinPitch = sinf(PITCH_CALIB * (float)M_PI / 180);
     cosRoll = cosf(ROLL_CALIB * (float)M_PI / 180);
     sinRoll = sinf(ROLL_CALIB * (float)M_PI / 180);
-    DEBUG_PRINTI("pitch_calib = %f,roll_calib = %f",PITCH_CALIB,ROLL_CALIB);
+    DEBUG_PRINTI("pitch_calib = %f,roll_calib = %f", (double)PITCH_CALIB, (double)ROLL_CALIB);
 }
 
 static void sensorsSetupSlaveRead(void)
@@ -569,7 +909,10 @@ static void sensorsSetupSlaveRead(void)
     mpu6050SetSlave4MasterDelay(9); // read slaves at 100Hz = (500Hz / (1 + 4))
 #endif
 
-    mpu6050SetI2CBypassEnabled(false);
+    // The slaves can't send the conversion commands of the MS5611. With it the
+    // auxiliary bus stays bypassed onto I2C0, and the magnetometer isn't read.
+    mpu6050SetI2CBypassEnabled(isBarometerPresent);
+    isMagnetometerPresent = isMagnetometerPresent && !isBarometerPresent;
     mpu6050SetWaitForExternalSensorEnabled(true);     // the slave data isn't so important for the state estimation
     mpu6050SetInterruptMode(0);                       // active high
     mpu6050SetInterruptDrive(0);                      // push pull
@@ -592,30 +935,25 @@ static void sensorsSetupSlaveRead(void)
 
 #endif
 
-#ifdef SENSORS_ENABLE_PRESSURE_MS5611
-
-    if (isBarometerPresent) {
-        // Configure the LPS25H as a slave and enable read
-        // Setting up two reads works for LPS25H fifo avg filter as well as the
-        // auto inc wraps back to LPS25H_PRESS_OUT_L after LPS25H_PRESS_OUT_H is read.
-        mpu6050SetSlaveAddress(1, 0x80 | MS5611_ADDR_CSB_LOW);
-        mpu6050SetSlaveRegister(1, MS5611_D1);
-        mpu6050SetSlaveDataLength(1, MS5611_D1D2_SIZE);
-        mpu6050SetSlaveDelayEnabled(1, true);
-        mpu6050SetSlaveEnabled(1, true);
-
-        mpu6050SetSlaveAddress(2, 0x80 | MS5611_ADDR_CSB_LOW); //temperature
-        mpu6050SetSlaveRegister(2, MS5611_D2);
-        mpu6050SetSlaveDataLength(2, MS5611_D1D2_SIZE);
-        mpu6050SetSlaveDelayEnabled(2, true);
-        mpu6050SetSlaveEnabled(2, true);
-        DEBUG_PRINTD("mpu6050SetSlaveAddress MS5611 done \n");
-    }
+    // Enable sensors after configuration
+    mpu6050SetI2CMasterModeEnabled(!isBarometerPresent);
 
+#ifdef CONFIG_SENSORS_MPU6050_FIFO
+#ifdef CONFIG_SENSORS_MPU6050_GYRO_OVERSAMPLE
+    // Push only the gyro to the FIFO at the sample rate
+    mpu6050SetAccelFIFOEnabled(false);
+    mpu6050SetTempFIFOEnabled(false);
+#else
+    // Push accel, temp and gyro to the FIFO at the sample rate
+    mpu6050SetAccelFIFOEnabled(true);
+    mpu6050SetTempFIFOEnabled(true);
+#endif
+    mpu6050SetXGyroFIFOEnabled(true);
+    mpu6050SetYGyroFIFOEnabled(true);
+    mpu6050SetZGyroFIFOEnabled(true);
+    sensorsResetFifo();
+    imuIntPendingCount = 0;
 #endif
-
-    // Enable sensors after configuration
-    mpu6050SetI2CMasterModeEnabled(true);
 
     mpu6050SetIntDataReadyEnabled(true);
 
@@ -624,12 +962,15 @@ static void sensorsSetupSlaveRead(void)
 
 static void sensorsTaskInit(void)
 {
-  accelerometerDataQueue = STATIC_MEM_QUEUE_CREATE(accelerometerDataQueue);
-  gyroDataQueue = STATIC_MEM_QUEUE_CREATE(gyroDataQueue);
-  magnetometerDataQueue = STATIC_MEM_QUEUE_CREATE(magnetometerDataQueue);
-  barometerDataQueue = STATIC_MEM_QUEUE_CREATE(barometerDataQueue);
+  sensorsDataReady = xSemaphoreCreateBinary();
+#ifdef CONFIG_SENSORS_MPU6050_FIFO
+  dataReady = xSemaphoreCreateCounting(SENSORS_MPU6050_FIFO_MAX_SAMPLES, 0);
+#else
+  dataReady = xSemaphoreCreateBinary();
+#endif
+  sensorsTestDone = xSemaphoreCreateBinary();
 
-  STATIC_MEM_TASK_CREATE(sensorsTask, sensorsTask, SENSORS_TASK_NAME, NULL, SENSORS_TASK_PRI);
+  STATIC_MEM_TASK_CREATE_PINNED(sensorsTask, sensorsTask, SENSORS_TASK_NAME, NULL, SENSORS_TASK_PRI, SENSORS_TASK_CORE);
   DEBUG_PRINTD("xTaskCreate sensorsTask \n");
 }
 
@@ -637,6 +978,14 @@ static void IRAM_ATTR sensors_inta_isr_handler(void *arg)
 {
     portBASE_TYPE xHigherPriorityTaskWoken = pdFALSE;
     imuIntTimestamp = usecTimestamp(); //This function returns the number of microseconds since esp_timer was initialized
+    SYSVIEW_MARKER_POINT(svSensorsIsr);
+#ifdef CONFIG_SENSORS_MPU6050_FIFO
+    // Samples are buffered in the FIFO, only wake the task once per batch
+    if (++imuIntPendingCount < CONFIG_SENSORS_MPU6050_FIFO_BATCH * SENSORS_GYRO_DECIMATION) {
+        return;
+    }
+    imuIntPendingCount = 0;
+#endif
     xSemaphoreGiveFromISR(sensorsDataReady, &xHigherPriorityTaskWoken);
 
     if (xHigherPriorityTaskWoken) {
@@ -664,8 +1013,6 @@ static void sensorsInterruptInit(void)
         //enable pull-up mode
         .pull_up_en = 1,
     };
-    sensorsDataReady = xSemaphoreCreateBinary();
-    dataReady = xSemaphoreCreateBinary();
     gpio_config(&io_conf);
     //install gpio isr service
     //portDISABLE_INTERRUPTS();
@@ -687,22 +1034,37 @@ void sensorsMpu6050Hmc5883lMs5611Init(void)
     }
 
     sensorsBiasObjInit(&gyroBiasRunning);
-    sensorsDeviceInit();
-    sensorsInterruptInit();
     sensorsTaskInit();
+#ifdef CONFIG_GYRO_DYN_NOTCH
+    dynNotchInit();
+#endif
     isInit = true;
 }
 
 bool sensorsMpu6050Hmc5883lMs5611Test(void)
 {
-
     bool testStatus = true;
 
     if (!isInit) {
         DEBUG_PRINTE("Error while initializing sensor task\r\n");
+        return false;
+    }
+
+    // The sensors task runs the device tests once it has brought the devices up
+    if (xSemaphoreTake(sensorsTestDone, M2T(SENSORS_TEST_TIMEOUT_MS)) == pdTRUE) {
+        xSemaphoreGive(sensorsTestDone);
+    } else {
+        DEBUG_PRINTE("Sensors self test timeout\n");
         testStatus = false;
     }
 
+    return testStatus && isDeviceTestPassed;
+}
+
+static bool sensorsDeviceTest(void)
+{
+    bool testStatus = true;
+
     // Try for 3 seconds so the quad has stabilized enough to pass the test
     for (int i = 0; i < 300; i++) {
         if (mpu6050SelfTest() == true) {
@@ -742,24 +1104,31 @@ bool sensorsMpu6050Hmc5883lMs5611Test(void)
 
 /**
  * Calculates accelerometer scale out of SENSORS_ACC_SCALE_SAMPLES samples. Should be called when
- * platform is stable.
+ * platform is stable. Measured again after every refinement of the gyro bias.
  */
 static bool processAccScale(int16_t ax, int16_t ay, int16_t az)
 {
-    static bool accBiasFound = false;
-    static uint32_t accScaleSumCount = 0;
-
-    if (!accBiasFound) {
+    if (!accScaleFound) {
         accScaleSum += sqrtf(powf(ax * SENSORS_G_PER_LSB_CFG, 2) + powf(ay * SENSORS_G_PER_LSB_CFG, 2) + powf(az * SENSORS_G_PER_LSB_CFG, 2));
         accScaleSumCount++;
 
         if (accScaleSumCount == SENSORS_ACC_SCALE_SAMPLES) {
             accScale = accScaleSum / SENSORS_ACC_SCALE_SAMPLES;
-            accBiasFound = true;
+            accScaleFound = true;
+            isImuTransformStale = true;
+            sensorsCheckCalibrationDrift();
         }
     }
 
-    return accBiasFound;
+    return accScaleFound;
+}
+
+static void sensorsRestartAccScale(void)
+{
+    // The current scale is used until the new one is found
+    accScaleSum = 0;
+    accScaleSumCount = 0;
+    accScaleFound = false;
 }
 
 #ifdef GYRO_BIAS_LIGHT_WEIGHT
@@ -799,6 +1168,7 @@ static bool processGyroBiasNoBuffer(int16_t gx, int16_t gy, int16_t gz, Axis3f *
             gyroBiasStdDev.z = sqrtf((float)(gyroBiasSampleSumSquares.z) / SENSORS_BIAS_SAMPLES - (gyroBiasOut->z * gyroBiasOut->z));
 #endif
             gyroBiasNoBuffFound = true;
+            isImuTransformStale = true;
         }
     }
 
@@ -806,15 +1176,19 @@ static bool processGyroBiasNoBuffer(int16_t gx, int16_t gy, int16_t gz, Axis3f *
 }
 #else
 /**
- * Calculates the bias first when the gyro variance is below threshold. Requires a buffer
- * but calibrates platform first when it is stable.
+ * Calculates the bias first when the gyro variance is below threshold. Calibrates
+ * the platform first when it is stable.
  */
 static bool processGyroBias(int16_t gx, int16_t gy, int16_t gz, Axis3f *gyroBiasOut)
 {
     sensorsAddBiasValue(&gyroBiasRunning, gx, gy, gz);
 
     if (!gyroBiasRunning.isBiasValueFound) {
-        sensorsFindBiasValue(&gyroBiasRunning);
+        if (sensorsApplyStoredCalibration()) {
+            DEBUG_PRINTI("Stored calibration taken at %.1f C\n", (double)storedCalibration.temperature);
+        } else if (sensorsFindBiasValue(&gyroBiasRunning)) {
+            sensorsRestartAccScale();
+        }
 
         if (gyroBiasRunning.isBiasValueFound) {
             //TODO:
@@ -822,6 +1196,9 @@ static bool processGyroBias(int16_t gx, int16_t gy, int16_t gz, Axis3f *gyroBias
             ledseqRun(&seq_calibrated);
             DEBUG_PRINTI("isBiasValueFound!");
         }
+    } else if (sensorsFindBiasValue(&gyroBiasRunning)) {
+        // Still again for a full window, refine in the background
+        sensorsRestartAccScale();
     }
 
     gyroBiasOut->x = gyroBiasRunning.bias.x;
@@ -834,75 +1211,32 @@ static bool processGyroBias(int16_t gx, int16_t gy, int16_t gz, Axis3f *gyroBias
 
 static void sensorsBiasObjInit(BiasObj *bias)
 {
-    bias->isBufferFilled = false;
-    bias->bufHead = bias->buffer;
-}
-
-/**
- * Calculates the variance and mean for the bias buffer.
- */
-static void sensorsCalculateVarianceAndMean(BiasObj *bias, Axis3f *varOut, Axis3f *meanOut)
-{
-    uint32_t i;
-    int64_t sum[GYRO_NBR_OF_AXES] = {0};
-    int64_t sumSq[GYRO_NBR_OF_AXES] = {0};
-
-    for (i = 0; i < SENSORS_NBR_OF_BIAS_SAMPLES; i++) {
-        sum[0] += bias->buffer[i].x;
-        sum[1] += bias->buffer[i].y;
-        sum[2] += bias->buffer[i].z;
-        sumSq[0] += bias->buffer[i].x * bias->buffer[i].x;
-        sumSq[1] += bias->buffer[i].y * bias->buffer[i].y;
-        sumSq[2] += bias->buffer[i].z * bias->buffer[i].z;
+    for (int i = 0; i < GYRO_NBR_OF_AXES; i++) {
+        welfordReset(&bias->stats[i]);
     }
-
-    varOut->x = (sumSq[0] - ((int64_t)sum[0] * sum[0]) / SENSORS_NBR_OF_BIAS_SAMPLES);
-    varOut->y = (sumSq[1] - ((int64_t)sum[1] * sum[1]) / SENSORS_NBR_OF_BIAS_SAMPLES);
-    varOut->z = (sumSq[2] - ((int64_t)sum[2] * sum[2]) / SENSORS_NBR_OF_BIAS_SAMPLES);
-
-    meanOut->x = (float)sum[0] / SENSORS_NBR_OF_BIAS_SAMPLES;
-    meanOut->y = (float)sum[1] / SENSORS_NBR_OF_BIAS_SAMPLES;
-    meanOut->z = (float)sum[2] / SENSORS_NBR_OF_BIAS_SAMPLES;
 }
 
 /**
- * Calculates the mean for the bias buffer.
- */
-static void __attribute__((used)) sensorsCalculateBiasMean(BiasObj *bias, Axis3i32 *meanOut)
-{
-    uint32_t i;
-    int32_t sum[GYRO_NBR_OF_AXES] = {0};
-
-    for (i = 0; i < SENSORS_NBR_OF_BIAS_SAMPLES; i++) {
-        sum[0] += bias->buffer[i].x;
-        sum[1] += bias->buffer[i].y;
-        sum[2] += bias->buffer[i].z;
-    }
-
-    meanOut->x = sum[0] / SENSORS_NBR_OF_BIAS_SAMPLES;
-    meanOut->y = sum[1] / SENSORS_NBR_OF_BIAS_SAMPLES;
-    meanOut->z = sum[2] / SENSORS_NBR_OF_BIAS_SAMPLES;
-}
-
-/**
- * Adds a new value to the variance buffer and if it is full
- * replaces the oldest one. Thus a circular buffer.
+ * Adds a new value to the running mean and variance of the window.
  */
 static void sensorsAddBiasValue(BiasObj *bias, int16_t x, int16_t y, int16_t z)
 {
-    bias->bufHead->x = x;
-    bias->bufHead->y = y;
-    bias->bufHead->z = z;
-    bias->bufHead++;
-
-    if (bias->bufHead >= &bias->buffer[SENSORS_NBR_OF_BIAS_SAMPLES]) {
-        bias->bufHead = bias->buffer;
-        bias->isBufferFilled = true;
-    }
+    welfordAdd(&bias->stats[0], x);
+    welfordAdd(&bias->stats[1], y);
+    welfordAdd(&bias->stats[2], z);
+
+    bias->variance.x = welfordSumOfSquares(&bias->stats[0]);
+    bias->variance.y = welfordSumOfSquares(&bias->stats[1]);
+    bias->variance.z = welfordSumOfSquares(&bias->stats[2]);
+    bias->mean.x = welfordMean(&bias->stats[0]);
+    bias->mean.y = welfordMean(&bias->stats[1]);
+    bias->mean.z = welfordMean(&bias->stats[2]);
 }
 
 /**
- * Checks if the variances is below the predefined thresholds.
+ * Checks if the variances stay below the predefined thresholds, every sample.
+ * The variance of a window only grows, so the window starts over as soon as
+ * it goes above one, and the platform is still once the window is full.
  * The bias value should have been added before calling this.
  * @param bias  The bias object
  */
@@ -911,25 +1245,97 @@ static bool sensorsFindBiasValue(BiasObj *bias)
     static int32_t varianceSampleTime;
     bool foundBias = false;
 
-    if (bias->isBufferFilled) {
-        sensorsCalculateVarianceAndMean(bias, &bias->variance, &bias->mean);
-
-        if (bias->variance.x < GYRO_VARIANCE_THRESHOLD_X &&
-                bias->variance.y < GYRO_VARIANCE_THRESHOLD_Y &&
-                bias->variance.z < GYRO_VARIANCE_THRESHOLD_Z &&
-                (varianceSampleTime + GYRO_MIN_BIAS_TIMEOUT_MS < xTaskGetTickCount())) {
+    if (bias->variance.x >= GYRO_VARIANCE_THRESHOLD_X ||
+            bias->variance.y >= GYRO_VARIANCE_THRESHOLD_Y ||
+            bias->variance.z >= GYRO_VARIANCE_THRESHOLD_Z) {
+        sensorsBiasObjInit(bias);
+    } else if (bias->stats[0].count >= SENSORS_NBR_OF_BIAS_SAMPLES) {
+        if (varianceSampleTime + GYRO_MIN_BIAS_TIMEOUT_MS < xTaskGetTickCount()) {
             varianceSampleTime = xTaskGetTickCount();
             bias->bias.x = bias->mean.x;
             bias->bias.y = bias->mean.y;
             bias->bias.z = bias->mean.z;
             foundBias = true;
             bias->isBiasValueFound = true;
+            isImuTransformStale = true;
         }
+        sensorsBiasObjInit(bias);
     }
 
     return foundBias;
 }
 
+/**
+ * Takes the stored calibration while no bias is found, if it was taken at
+ * about the temperature of the IMU now. The platform does not have to be still.
+ */
+static bool sensorsApplyStoredCalibration(void)
+{
+    if (!isStoredCalibrationLoaded ||
+            fabsf(imuTemperature - storedCalibration.temperature) > SENSORS_CALIB_TEMP_TOLERANCE) {
+        return false;
+    }
+    gyroBiasRunning.bias = storedCalibration.gyroBias;
+    gyroBiasRunning.isBiasValueFound = true;
+    accScale = storedCalibration.accScale;
+    accScaleFound = true;
+    isImuTransformStale = true;
+
+    return true;
+}
+
+/**
+ * Schedules a write of the calibration if it drifted away from the stored one.
+ */
+static void sensorsCheckCalibrationDrift(void)
+{
+    if (isCalibrationStored &&
+            fabsf(gyroBiasRunning.bias.x - storedCalibration.gyroBias.x) < SENSORS_CALIB_STORE_BIAS_DRIFT &&
+            fabsf(gyroBiasRunning.bias.y - storedCalibration.gyroBias.y) < SENSORS_CALIB_STORE_BIAS_DRIFT &&
+            fabsf(gyroBiasRunning.bias.z - storedCalibration.gyroBias.z) < SENSORS_CALIB_STORE_BIAS_DRIFT &&
+            fabsf(imuTemperature - storedCalibration.temperature) < SENSORS_CALIB_STORE_TEMP_DRIFT) {
+        return;
+    }
+
+    storedCalibration.gyroBias = gyroBiasRunning.bias;
+    storedCalibration.accScale = accScale;
+    storedCalibration.temperature = imuTemperature;
+    isCalibrationStored = true;
+    // Written by the worker, flash writes stall the caller
+    workerScheduleWithPriority(WORKER_PRIORITY_LOW, sensorsStoreCalibration, NULL);
+}
+
+static void sensorsLoadCalibration(void)
+{
+    nvs_handle_t handle;
+    size_t length = sizeof(storedCalibration);
+
+    if (nvs_open(SENSORS_CALIB_STORE_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+        // Nothing stored yet
+        return;
+    }
+
+    isStoredCalibrationLoaded = (nvs_get_blob(handle, SENSORS_CALIB_STORE_KEY, &storedCalibration, &length) == ESP_OK &&
+                                 length == sizeof(storedCalibration));
+    // Compared against for drift from now on
+    isCalibrationStored = isStoredCalibrationLoaded;
+    nvs_close(handle);
+}
+
+static void sensorsStoreCalibration(void *arg)
+{
+    nvs_handle_t handle;
+
+    if (nvs_open(SENSORS_CALIB_STORE_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK) {
+        return;
+    }
+
+    if (nvs_set_blob(handle, SENSORS_CALIB_STORE_KEY, &storedCalibration, sizeof(storedCalibration)) == ESP_OK) {
+        nvs_commit(handle);
+    }
+    nvs_close(handle);
+}
+
 bool sensorsMpu6050Hmc5883lMs5611ManufacturingTest(void)
 {
     bool testStatus = false;
@@ -984,24 +1390,40 @@ bool sensorsMpu6050Hmc5883lMs5611ManufacturingTest(void)
  * data gathered from the UI and written in the config-block to
  * rotate the accelerometer to be aligned with gravity.
  */
-static void sensorsAccAlignToGravity(Axis3f *in, Axis3f *out)
+/**
+ * Folds the axis signs, the scales, the gyro bias and the rotation of
+ * sensorsAccAlignToGravity() of the other sensor drivers into the transform
+ * of processAccGyroMeasurements(). The accelerometer is rotated around x by
+ * the roll and then around y by the pitch calibration angle.
+ */
+static void sensorsUpdateImuTransform(void)
 {
-    Axis3f rx;
-    Axis3f ry;
-
-    // Rotate around x-axis
-    rx.x = in->x;
-    rx.y = in->y * cosRoll - in->z * sinRoll;
-    rx.z = in->y * sinRoll + in->z * cosRoll;
-
-    // Rotate around y-axis
-    ry.x = rx.x * cosPitch - rx.z * sinPitch;
-    ry.y = rx.y;
-    ry.z = -rx.x * sinPitch + rx.z * cosPitch;
-
-    out->x = ry.x;
-    out->y = ry.y;
-    out->z = ry.z;
+    const float rotation[3][3] = {
+        { cosPitch, -sinPitch * sinRoll, -sinPitch * cosRoll },
+        { 0,         cosRoll,            -sinRoll            },
+        { -sinPitch, cosPitch * sinRoll,  cosPitch * cosRoll },
+    };
+    // The x axis of the IMU is reversed
+    const float accAxisScale[3] = {
+        -SENSORS_G_PER_LSB_CFG / accScale,
+        SENSORS_G_PER_LSB_CFG / accScale,
+        SENSORS_G_PER_LSB_CFG / accScale,
+    };
+
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            accTransform[i][j] = rotation[i][j] * accAxisScale[j];
+        }
+    }
+
+    gyroScale.x = -SENSORS_DEG_PER_LSB_CFG;
+    gyroScale.y = SENSORS_DEG_PER_LSB_CFG;
+    gyroScale.z = SENSORS_DEG_PER_LSB_CFG;
+    gyroOffset.x = -gyroScale.x * gyroBias.x;
+    gyroOffset.y = -gyroScale.y * gyroBias.y;
+    gyroOffset.z = -gyroScale.z * gyroBias.z;
+
+    isImuTransformStale = false;
 }
 
 /** set different low pass filters in different environment
@@ -1013,36 +1435,54 @@ void sensorsMpu6050Hmc5883lMs5611SetAccMode(accModes accMode)
     switch (accMode)
     {
     case ACC_MODE_PROPTEST:
+        // The oversampling is already at the 256 Hz DLPF, its 4 kHz rate is kept
+#ifndef CONFIG_SENSORS_MPU6050_GYRO_OVERSAMPLE
         mpu6050SetRate(7);
         mpu6050SetDLPFMode(MPU6050_DLPF_BW_256);
-        for (uint8_t i = 0; i < 3; i++)
-        {
-            lpf2pInit(&accLpf[i], 1000, 250);
-        }
+#endif
+        accLpfInit(250);
         break;
     case ACC_MODE_FLIGHT:
     default:
+#if defined(CONFIG_SENSORS_MPU6050_GYRO_OVERSAMPLE)
+        accLpfInit(ACCEL_LPF_CUTOFF_FREQ);
+#elif defined(CONFIG_TARGET_ESP32_S2_DRONE_V1_2)
         mpu6050SetRate(0);
-#ifdef CONFIG_TARGET_ESP32_S2_DRONE_V1_2
         mpu6050SetDLPFMode(MPU6050_DLPF_BW_42);
-        for (uint8_t i = 0; i < 3; i++) {
-        lpf2pInit(&accLpf[i], 1000, ACCEL_LPF_CUTOFF_FREQ);
-        }
+        accLpfInit(ACCEL_LPF_CUTOFF_FREQ);
 #else
+        mpu6050SetRate(0);
         mpu6050SetDLPFMode(MPU6050_DLPF_BW_98);
-        for (uint8_t i = 0; i < 3; i++) {
-        lpf2pInit(&accLpf[i], 1000, ACCEL_LPF_CUTOFF_FREQ);
-        }
+        accLpfInit(ACCEL_LPF_CUTOFF_FREQ);
 #endif
         break;
     }
 }
 
-static void applyAxis3fLpf(lpf2pData *data, Axis3f *in)
+static void gyroLpfInit(void)
 {
-    for (uint8_t i = 0; i < 3; i++) {
-        in->axis[i] = lpf2pApply(&data[i], in->axis[i]);
-    }
+    biquad3Init(&gyroLpf);
+    biquad3AddLpf(&gyroLpf, 1000, GYRO_LPF_CUTOFF_FREQ);
+#if CONFIG_GYRO_NOTCH_FREQ > 0
+    // Frame or propeller resonance, after the low pass so that it sees less noise
+    biquad3AddNotch(&gyroLpf, 1000, CONFIG_GYRO_NOTCH_FREQ, CONFIG_GYRO_NOTCH_BANDWIDTH);
+#endif
+#ifdef CONFIG_GYRO_DYN_NOTCH
+    // Moved by dyn_notch, it starts at the top of its band
+    gyroDynNotchStage = gyroLpf.numStages;
+    biquad3AddNotch(&gyroLpf, 1000, CONFIG_GYRO_DYN_NOTCH_MAX_FREQ, CONFIG_GYRO_NOTCH_BANDWIDTH);
+#endif
+}
+
+static void accLpfInit(float cutoffFreq)
+{
+    biquad3Init(&accLpf);
+    biquad3AddLpf(&accLpf, 1000, cutoffFreq);
+}
+
+static void applyAxis3fLpf(biquad3Data *data, Axis3f *in)
+{
+    biquad3Apply(data, in->axis);
 }
 
 #ifdef GYRO_ADD_RAW_AND_VARIANCE_LOG_VALUES
@@ -1056,6 +1496,22 @@ LOG_ADD(LOG_FLOAT, zVariance, &gyroBiasRunning.variance.z)
 LOG_GROUP_STOP(gyro)
 #endif
 
+/**
+ * The IMU samples published and those no reader took, the FIFO frames but
+ * the last of a read are not published
+ */
+LOG_GROUP_START(imu_snapshot)
+LOG_ADD(LOG_UINT32, samples, &imuSeq)
+LOG_ADD(LOG_UINT32, missed, &imuMissedCount)
+LOG_GROUP_STOP(imu_snapshot)
+
+#ifdef CONFIG_SENSORS_MPU6050_FIFO
+LOG_GROUP_START(imu_fifo)
+LOG_ADD(LOG_UINT8, frames, &fifoFramesRead)
+LOG_ADD(LOG_UINT32, resets, &fifoResetCount)
+LOG_GROUP_STOP(imu_fifo)
+#endif
+
 //TODO:
 PARAM_GROUP_START(imu_sensors)
 PARAM_ADD(PARAM_UINT8 | PARAM_RONLY, HMC5883L, &isMagnetometerPresent)
@@ -1068,3 +1524,5 @@ PARAM_ADD(PARAM_UINT8 | PARAM_RONLY, HMC5883L, &isMagnetometerPresent)
 PARAM_ADD(PARAM_UINT8 | PARAM_RONLY, pmw3901, &isPmw3901Present)
 PARAM_ADD(PARAM_UINT8 | PARAM_RONLY, MS5611, &isBarometerPresent) // TODO: Rename MS5611 to LPS25H. Client needs to be updated at the same time.
 PARAM_GROUP_STOP(imu_tests)
+
+#endif // SENSOR_INCLUDED_MPU6050_HMC5883L_MS5611
@@ -121,6 +121,7 @@ static StaticSemaphore_t dataReadyBuffer;
 static bool isInit = false;
 static sensorData_t sensorData;
 static volatile uint64_t imuIntTimestamp;
+static volatile uint64_t gyroTimestamp;  // Of the sample in gyroDataQueue
 
 static Axis3i16 gyroRaw;
 static Axis3i16 accelRaw;
@@ -181,6 +182,11 @@ bool sensorsMpu9250Lps25hReadGyro(Axis3f *gyro)
   return (pdTRUE == xQueueReceive(gyroDataQueue, gyro, 0));
 }
 
+uint64_t sensorsMpu9250Lps25hGyroTimestamp(void)
+{
+  return gyroTimestamp;
+}
+
 bool sensorsMpu9250Lps25hReadAcc(Axis3f *acc)
 {
   return (pdTRUE == xQueueReceive(accelerometerDataQueue, acc, 0));
@@ -239,6 +245,7 @@ static void sensorsTask(void *param)
       }
 
       xQueueOverwrite(accelerometerDataQueue, &sensorData.acc);
+      gyroTimestamp = sensorData.interruptTimestamp;
       xQueueOverwrite(gyroDataQueue, &sensorData.gyro);
       if (isMagnetometerPresent)
       {
@@ -24,120 +24,175 @@
  *
  * storage.c: Key/Buffer persistant storage
  *
+ * The items are kept in a kve log, see kve_log.h, in the kve flash
+ * partition. While the flash is written or erased the caches are off on both
+ * cores: items are written in flash page sized chunks, one per FreeRTOS tick,
+ * and the sectors are only erased while the drone is not flying. The storage
+ * task compacts the log in the background, one item or one sector erase at a
+ * time, before the stores run out of free sectors.
  */
 
+#include "sdkconfig.h"
 #include "storage.h"
 
-#include "kve/kve.h"
+#ifdef CONFIG_STORAGE
+
+#include "kve/kve_log.h"
 
 #include "FreeRTOS.h"
 #include "semphr.h"
+#include "task.h"
 
-#include "i2cdev.h"
-#include "eeprom.h"
+#include "esp_partition.h"
 
-#define TRACE_MEMORY_ACCESS 0
+#include "config.h"
+#include "stabilizer.h"
+#include "static_mem.h"
+#include "stm32_legacy.h"
 
-#if !TRACE_MEMORY_ACCESS
 #define DEBUG_MODULE "STORAGE"
-#endif
-#include "debug.h"
+#include "debug_cf.h"
 
 // Memory organization
 
-// Low level memory access 
+#define KVE_PARTITION_TYPE     0x40
+#define KVE_PARTITION_SUBTYPE  0x02
+#define KVE_PARTITION_LABEL    "kve"
+
+#define KVE_SECTOR_SIZE        4096
+#define KVE_MAX_SECTORS        16
+#define KVE_FLASH_PAGE_SIZE    256
 
-// ToDo: Shall we handle partition elsewhere?
-#define KVE_PARTITION_START (1024)
-#define KVE_PARTITION_LENGTH (7*1024)
+// Number of items the RAM index of the table can hold
+#define KVE_INDEX_LENGTH (128)
+
+#define STORAGE_POLL_MS 100
 
 static SemaphoreHandle_t storageMutex;
+static const esp_partition_t *partition;
 
-static size_t readEeprom(size_t address, void* data, size_t length)
-{
-  if (length == 0) {
-    return 0;
-  }
+// Low level memory access
 
-  bool success = eepromReadBuffer(data, KVE_PARTITION_START + address, length);
+static bool readFlash(size_t address, void* data, size_t length)
+{
+  return esp_partition_read(partition, address, data, length) == ESP_OK;
+}
 
-#if TRACE_MEMORY_ACCESS
-  DEBUG_PRINT("R %s @%04x l%d: ", success?" OK ":"FAIL", address, length);
+static bool writeFlash(size_t address, const void* data, size_t length)
+{
+  // One flash page per chunk, so each cache stall is short
+  for (size_t done = 0; done < length; ) {
+    size_t chunk = KVE_FLASH_PAGE_SIZE - ((address + done) % KVE_FLASH_PAGE_SIZE);
 
-  for (int i=0; i < length; i++) {
-    DEBUG_PRINT("%02x ", ((char*)data)[i]);
-  }
+    if (chunk > length - done) {
+      chunk = length - done;
+    }
 
-  DEBUG_PRINT("\n");
-#endif
+    if (esp_partition_write(partition, address + done, (const uint8_t*)data + done, chunk) != ESP_OK) {
+      DEBUG_PRINT("Write failed at 0x%x\n", (unsigned int)(address + done));
+      return false;
+    }
 
-  if (success) {
-    return length;
-  } else {
-    return 0;
+    done += chunk;
+    if (done < length) {
+      vTaskDelay(1);
+    }
   }
+
+  return true;
 }
 
-static size_t writeEeprom(size_t address, const void* data, size_t length)
+static bool eraseFlash(size_t address)
 {
-  if (length == 0) {
-    return 0;
-  }
+  return esp_partition_erase_range(partition, address, KVE_SECTOR_SIZE) == ESP_OK;
+}
 
-  bool success = eepromWriteBuffer(data, KVE_PARTITION_START + address, length);
+static kveIndexEntry_t kveIndexEntries[KVE_INDEX_LENGTH];
 
-#if TRACE_MEMORY_ACCESS
-  DEBUG_PRINT("W %s @%04x: ", success?" OK ":"FAIL", address);
+static kveIndex_t kveIndex = {
+  .entries = kveIndexEntries,
+  .length = KVE_INDEX_LENGTH,
+};
 
-  for (int i=0; i < length; i++) {
-    DEBUG_PRINT("%02x ", ((char*)data)[i]);
-  }
+static kveLogSector_t kveSectors[KVE_MAX_SECTORS];
+
+static kveLog_t kve = {
+  .sectorSize = KVE_SECTOR_SIZE,
+  .read = readFlash,
+  .write = writeFlash,
+  .erase = eraseFlash,
+  .sectors = kveSectors,
+  .index = &kveIndex,
+};
+
+static bool isInit = false;
+static bool isMounted = false;
 
-  DEBUG_PRINT("\n");
-#endif
+STATIC_MEM_TASK_ALLOC(storageTask, STORAGE_TASK_STACKSIZE);
 
-  if (success) {
-    return length;
-  } else {
-    return 0;
+// Compact while the flash may be erased, false if there was nothing to do
+static bool compactStep(void)
+{
+  bool isCompacting = false;
+
+  xSemaphoreTake(storageMutex, portMAX_DELAY);
+  if (isMounted && !stabilizerIsFlying() && kveLogNeedsCompaction(&kve)) {
+    isCompacting = kveLogCompactStep(&kve);
   }
+  xSemaphoreGive(storageMutex);
+
+  return isCompacting;
 }
 
-static void flushEeprom(void)
+static void storageTask(void *param)
 {
-  // NOP for now, lets fix the EEPROM write first!
-}
+  while (true) {
+    vTaskDelay(M2T(STORAGE_POLL_MS));
 
-static kveMemory_t kve = {
-  .memorySize = KVE_PARTITION_LENGTH,
-  .read = readEeprom,
-  .write = writeEeprom,
-  .flush = flushEeprom,
-};
+    while (compactStep()) {
+      vTaskDelay(1);
+    }
+  }
+}
 
 // Public API
 
-static bool isInit = false;
-
 void storageInit()
 {
+  partition = esp_partition_find_first(KVE_PARTITION_TYPE, KVE_PARTITION_SUBTYPE, KVE_PARTITION_LABEL);
+  if (partition == NULL) {
+    DEBUG_PRINT("No %s partition, the storage is disabled\n", KVE_PARTITION_LABEL);
+    return;
+  }
+
+  kve.memorySize = partition->size - partition->size % KVE_SECTOR_SIZE;
+  if (kve.memorySize > KVE_MAX_SECTORS * KVE_SECTOR_SIZE) {
+    kve.memorySize = KVE_MAX_SECTORS * KVE_SECTOR_SIZE;
+  }
+
   storageMutex = xSemaphoreCreateMutex();
 
+  STATIC_MEM_TASK_CREATE_PINNED(storageTask, storageTask, STORAGE_TASK_NAME, NULL, STORAGE_TASK_PRI, STORAGE_TASK_CORE);
+
   isInit = true;
 }
 
 bool storageTest()
 {
-  bool pass = kveCheck(&kve);
+  if (!isInit) {
+    return false;
+  }
+
+  xSemaphoreTake(storageMutex, portMAX_DELAY);
+
+  bool pass = kveLogMount(&kve);
 
   DEBUG_PRINT("Storage check %s.\n", pass?"[OK]":"[FAIL]");
 
   if (!pass) {
     DEBUG_PRINT("Reformating storage ...\n");
 
-    kveFormat(&kve);
-
-    pass = kveCheck(&kve);
+    pass = kveLogFormat(&kve) && kveLogMount(&kve);
     DEBUG_PRINT("Storage check %s.\n", pass?"[OK]":"[FAIL]");
 
     if (pass == false) {
@@ -145,6 +200,10 @@ bool storageTest()
     }
   }
 
+  isMounted = pass;
+
+  xSemaphoreGive(storageMutex);
+
   return pass;
 }
 
@@ -156,7 +215,12 @@ bool storageStore(char* key, const void* buffer, size_t length)
 
   xSemaphoreTake(storageMutex, portMAX_DELAY);
 
-  bool result = kveStore(&kve, key, buffer, length);
+  bool result = isMounted && kveLogStore(&kve, key, buffer, length);
+
+  // Out of free sectors, compact now unless the flash may not be erased
+  while (isMounted && !result && !stabilizerIsFlying() && kveLogNeedsCompaction(&kve) && kveLogCompactStep(&kve)) {
+    result = kveLogStore(&kve, key, buffer, length);
+  }
 
   xSemaphoreGive(storageMutex);
 
@@ -171,7 +235,7 @@ size_t storageFetch(char *key, void* buffer, size_t length)
 
   xSemaphoreTake(storageMutex, portMAX_DELAY);
 
-  size_t result = kveFetch(&kve, key, buffer, length);
+  size_t result = isMounted ? kveLogFetch(&kve, key, buffer, length) : 0;
 
   xSemaphoreGive(storageMutex);
 
@@ -186,9 +250,11 @@ bool storageDelete(char* key)
 
   xSemaphoreTake(storageMutex, portMAX_DELAY);
 
-  bool result = kveDelete(&kve, key);
+  bool result = isMounted && kveLogDelete(&kve, key);
 
   xSemaphoreGive(storageMutex);
 
   return result;
 }
+
+#endif // CONFIG_STORAGE
@@ -0,0 +1,430 @@
+/*
+ *    ||          ____  _ __
+ * +------+      / __ )(_) /_______________ _____  ___
+ * | 0xBC |     / __  / / __/ ___/ ___/ __ `/_  / / _ \
+ * +------+    / /_/ / / /_/ /__/ /  / /_/ / / /_/  __/
+ *  ||  ||    /_____/_/\__/\___/_/   \__,_/ /___/\___/
+ *
+ * ESP-Drone Firmware
+ *
+ * Copyright 2019-2020  Espressif Systems (Shanghai)
+ * Copyright (C) 2012 BitCraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * usbcdclink.c: USB CDC implementation of the CRTP link
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "sdkconfig.h"
+
+#ifdef CONFIG_USB_CDC_LINK
+
+#ifndef CONFIG_TINYUSB_CDC_ENABLED
+#error "The USB CDC link needs the CDC class of TinyUSB, CONFIG_TINYUSB_CDC_ENABLED"
+#endif
+
+#include "tinyusb.h"
+#include "tusb_cdc_acm.h"
+
+#include "config.h"
+#include "usbcdclink.h"
+#include "crtp.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+#include "semphr.h"
+#include "link_capture.h"
+#include "stm32_legacy.h"
+#include "log.h"
+
+#define DEBUG_MODULE "USBCDC"
+#include "debug_cf.h"
+
+#define USBCDC_ACTIVITY_TIMEOUT_MS (1000)
+#define USBCDC_RX_QUEUE_SIZE       16
+#define USBCDC_RX_CHUNK            64
+#define USBCDC_ITF                 TINYUSB_CDC_ACM_0
+// Max time a large frame waits for the TX FIFO to drain
+#define USBCDC_LARGE_TX_TIMEOUT_MS 50
+
+#ifdef CONFIG_CRTP_LARGE_FRAMES
+#define USBCDC_LARGE_MAX_DATA_SIZE CRTP_LARGE_MAX_DATA_SIZE
+#else
+#define USBCDC_LARGE_MAX_DATA_SIZE 0
+#endif
+
+typedef enum {
+    rxWaitSync,
+    rxWaitLength,
+    rxWaitFrame,
+} usbcdcRxState_t;
+
+static bool isInit = false;
+
+static struct crtpLinkOperations *radioLink;
+// Set while the port is open and the link is the one of CRTP
+static bool isActive;
+
+// Written by the TinyUSB task only
+static usbcdcRxState_t rxState;
+static uint8_t rxLength;
+static uint8_t rxCount;
+// CRTP header, data and checksum
+static uint8_t rxFrame[1 + CRTP_MAX_DATA_SIZE + 1];
+
+static xQueueHandle rxQueue;
+
+// CRTP TX task only
+static uint8_t txFrame[USBCDC_FRAME_OVERHEAD + 1 + CRTP_MAX_DATA_SIZE];
+// Of the large frames, 0 if the host asked for none. Written by the TinyUSB task
+static uint16_t maxDataSize;
+// Held while a frame is written to the TX FIFO, the large ones come from the
+// tasks of the services
+static SemaphoreHandle_t txMutex;
+
+static uint32_t lastPacketTick;
+
+static uint32_t rxPacketCount;
+static uint32_t rxErrorCount;
+static uint32_t rxDropCount;
+static uint32_t txPacketCount;
+static uint32_t txFullCount;
+static uint32_t txLargeCount;
+
+static int usbcdclinkSendPacket(CRTPPacket *p);
+static int usbcdclinkSetEnable(bool enable);
+static int usbcdclinkReceiveCRTPPacket(CRTPPacket *p);
+#ifdef CONFIG_CRTP_LARGE_FRAMES
+static uint16_t usbcdclinkGetMaxDataSize(void);
+static int usbcdclinkSendLargePacket(uint8_t header, const uint8_t *data, uint16_t size);
+#endif
+
+static bool usbcdclinkIsConnected(void)
+{
+    return (xTaskGetTickCount() - lastPacketTick) < M2T(USBCDC_ACTIVITY_TIMEOUT_MS);
+}
+
+static struct crtpLinkOperations usbcdclinkOp = {
+    .setEnable         = usbcdclinkSetEnable,
+    .sendPacket        = usbcdclinkSendPacket,
+    .receivePacket     = usbcdclinkReceiveCRTPPacket,
+    .isConnected       = usbcdclinkIsConnected,
+#ifdef CONFIG_CRTP_LARGE_FRAMES
+    .getMaxDataSize    = usbcdclinkGetMaxDataSize,
+    .sendLargePacket   = usbcdclinkSendLargePacket,
+#endif
+};
+
+/* From the TinyUSB task or the CRTP RX task, only one of them switches */
+static void usbcdclinkSetActive(bool active)
+{
+    if (__atomic_exchange_n(&isActive, active, __ATOMIC_RELAXED) == active) {
+        return;
+    }
+
+    crtpSetLink(active ? &usbcdclinkOp : radioLink);
+    DEBUG_PRINT("CRTP over %s\n", active ? "USB" : "the radio");
+}
+
+/* Answers the large frames request of the host, true if the packet was one */
+static bool usbcdclinkHandleControl(const CRTPPacket *packet)
+{
+    if (packet->header != USBCDC_CTRL_HEADER || packet->size < 3 || packet->data[0] != USBCDC_CTRL_LARGE) {
+        return false;
+    }
+
+    const uint16_t requested = packet->data[1] | (packet->data[2] << 8);
+    uint16_t accepted = requested < USBCDC_LARGE_MAX_DATA_SIZE ? requested : USBCDC_LARGE_MAX_DATA_SIZE;
+    CRTPPacket ack = {.size = 3};
+
+    if (accepted <= CRTP_MAX_DATA_SIZE) {
+        accepted = 0;
+    }
+    maxDataSize = accepted;
+
+    ack.header = USBCDC_CTRL_HEADER;
+    ack.data[0] = USBCDC_CTRL_LARGE;
+    ack.data[1] = accepted & 0xFF;
+    ack.data[2] = accepted >> 8;
+    crtpSendPacket(&ack);
+    return true;
+}
+
+static void usbcdclinkHandleFrame(void)
+{
+    CRTPPacket packet;
+    uint8_t sum = 0;
+
+    for (int i = 0; i < rxLength; i++) {
+        sum += rxFrame[i];
+    }
+    if (sum != rxFrame[rxLength]) {
+        rxErrorCount++;
+        return;
+    }
+
+    packet.header = rxFrame[0];
+    packet.size = rxLength - 1;
+    memcpy(packet.data, &rxFrame[1], packet.size);
+
+    linkCapturePacket(lcRx, packet.raw, packet.size);
+    lastPacketTick = xTaskGetTickCount();
+    rxPacketCount++;
+
+    if (usbcdclinkHandleControl(&packet)) {
+        // Consumed by the link
+    } else if (crtpIsPortDirect(packet.port)) {
+        crtpDispatchDirect(&packet);
+    } else if (xQueueSend(rxQueue, &packet, 0) != pdTRUE) {
+        rxDropCount++;
+    }
+}
+
+static void usbcdclinkRxByte(uint8_t byte)
+{
+    switch (rxState) {
+    case rxWaitSync:
+        if (byte == USBCDC_FRAME_SYNC) {
+            rxState = rxWaitLength;
+        }
+        break;
+    case rxWaitLength:
+        if (byte == 0 || byte > 1 + CRTP_MAX_DATA_SIZE) {
+            rxErrorCount++;
+            rxState = (byte == USBCDC_FRAME_SYNC) ? rxWaitLength : rxWaitSync;
+            break;
+        }
+        rxLength = byte;
+        rxCount = 0;
+        rxState = rxWaitFrame;
+        break;
+    case rxWaitFrame:
+        rxFrame[rxCount++] = byte;
+        if (rxCount == rxLength + 1) {
+            usbcdclinkHandleFrame();
+            rxState = rxWaitSync;
+        }
+        break;
+    }
+}
+
+/* Runs in the TinyUSB task, must not block */
+static void usbcdclinkRxCb(int itf, cdcacm_event_t *event)
+{
+    uint8_t chunk[USBCDC_RX_CHUNK];
+    size_t size;
+
+    while (tinyusb_cdcacm_read(itf, chunk, sizeof(chunk), &size) == ESP_OK && size > 0) {
+        for (size_t i = 0; i < size; i++) {
+            usbcdclinkRxByte(chunk[i]);
+        }
+    }
+}
+
+static void usbcdclinkLineStateCb(int itf, cdcacm_event_t *event)
+{
+    // A frame cut by the host closing the port is not continued by the next one
+    rxState = rxWaitSync;
+    maxDataSize = 0;
+    usbcdclinkSetActive(event->line_state_changed_data.dtr);
+}
+
+static int usbcdclinkReceiveCRTPPacket(CRTPPacket *p)
+{
+    if (xQueueReceive(rxQueue, p, M2T(100)) != pdTRUE) {
+        // Pulling the cable does not always clear DTR
+        if (!tud_mounted()) {
+            usbcdclinkSetActive(false);
+        }
+        return -1;
+    }
+
+    linkCapturePacket(lcDequeued, p->raw, p->size);
+    return 0;
+}
+
+static int usbcdclinkSendPacket(CRTPPacket *p)
+{
+    const size_t frameSize = USBCDC_FRAME_OVERHEAD + 1 + p->size;
+    uint8_t sum = p->header;
+
+    ASSERT(p->size <= CRTP_MAX_DATA_SIZE);
+
+    // A large frame is on its way, the packet is retried
+    if (xSemaphoreTake(txMutex, 0) != pdTRUE) {
+        return false;
+    }
+
+    // A frame is queued whole or not at all, half a frame would desync the host
+    if (tud_cdc_n_write_available(USBCDC_ITF) < frameSize) {
+        tinyusb_cdcacm_write_flush(USBCDC_ITF, 0);
+        xSemaphoreGive(txMutex);
+        txFullCount++;
+        return false;
+    }
+
+    txFrame[0] = USBCDC_FRAME_SYNC;
+    txFrame[1] = 1 + p->size;
+    txFrame[2] = p->header;
+    for (int i = 0; i < p->size; i++) {
+        txFrame[3 + i] = p->data[i];
+        sum += p->data[i];
+    }
+    txFrame[3 + p->size] = sum;
+
+    linkCapturePacket(lcTx, p->raw, p->size);
+    tinyusb_cdcacm_write_queue(USBCDC_ITF, txFrame, frameSize);
+    // The rest of the FIFO goes out as the transfers complete
+    tinyusb_cdcacm_write_flush(USBCDC_ITF, 0);
+    xSemaphoreGive(txMutex);
+
+    txPacketCount++;
+    return true;
+}
+
+#ifdef CONFIG_CRTP_LARGE_FRAMES
+static uint16_t usbcdclinkGetMaxDataSize(void)
+{
+    return maxDataSize > CRTP_MAX_DATA_SIZE ? maxDataSize : CRTP_MAX_DATA_SIZE;
+}
+
+/* Queues all the bytes, waiting for the FIFO to drain, false if the host stopped reading */
+static bool usbcdclinkWriteAll(const uint8_t *data, size_t size)
+{
+    while (size > 0) {
+        const size_t queued = tinyusb_cdcacm_write_queue(USBCDC_ITF, data, size);
+
+        data += queued;
+        size -= queued;
+        if (size > 0 && tinyusb_cdcacm_write_flush(USBCDC_ITF, M2T(USBCDC_LARGE_TX_TIMEOUT_MS)) != ESP_OK &&
+            tud_cdc_n_write_available(USBCDC_ITF) == 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * From the task of the service. The frame is larger than the TX FIFO, it is
+ * written while the FIFO drains, with the TX task kept out. A host that stops
+ * reading in the middle gets a cut frame, which fails its checksum. The frame
+ * is not captured, its size does not fit a record.
+ */
+static int usbcdclinkSendLargePacket(uint8_t header, const uint8_t *data, uint16_t size)
+{
+    const uint16_t length = 1 + size;
+    const uint8_t start[] = {USBCDC_FRAME_SYNC_LARGE, length & 0xFF, length >> 8, header};
+    uint8_t sum = header;
+    bool isSent;
+
+    if (!tud_mounted() || size > maxDataSize) {
+        return false;
+    }
+
+    for (int i = 0; i < size; i++) {
+        sum += data[i];
+    }
+
+    if (xSemaphoreTake(txMutex, M2T(USBCDC_LARGE_TX_TIMEOUT_MS)) != pdTRUE) {
+        return false;
+    }
+
+    isSent = usbcdclinkWriteAll(start, sizeof(start)) && usbcdclinkWriteAll(data, size) &&
+             usbcdclinkWriteAll(&sum, 1);
+    tinyusb_cdcacm_write_flush(USBCDC_ITF, 0);
+    xSemaphoreGive(txMutex);
+
+    if (isSent) {
+        txLargeCount++;
+    }
+    return isSent;
+}
+#endif
+
+static int usbcdclinkSetEnable(bool enable)
+{
+    return 0;
+}
+
+/*
+ * Public functions
+ */
+
+void usbcdclinkInit(struct crtpLinkOperations *link)
+{
+    if (isInit) {
+        return;
+    }
+
+    radioLink = link;
+    rxQueue = xQueueCreate(USBCDC_RX_QUEUE_SIZE, sizeof(CRTPPacket));
+    txMutex = xSemaphoreCreateMutex();
+
+    // The default descriptors of the TinyUSB component, one CDC ACM port
+    const tinyusb_config_t usbConfig = {
+        .external_phy = false,
+    };
+    if (tinyusb_driver_install(&usbConfig) != ESP_OK) {
+        DEBUG_PRINT("TinyUSB init failed\n");
+        return;
+    }
+
+    const tinyusb_config_cdcacm_t acmConfig = {
+        .usb_dev = TINYUSB_USBDEV_0,
+        .cdc_port = USBCDC_ITF,
+        .callback_rx = usbcdclinkRxCb,
+        .callback_rx_wanted_char = NULL,
+        .callback_line_state_changed = usbcdclinkLineStateCb,
+        .callback_line_coding_changed = NULL,
+    };
+    if (tusb_cdc_acm_init(&acmConfig) != ESP_OK) {
+        DEBUG_PRINT("CDC ACM init failed\n");
+        return;
+    }
+
+    isInit = true;
+}
+
+bool usbcdclinkTest(void)
+{
+    return isInit;
+}
+
+struct crtpLinkOperations *usbcdclinkGetLink(void)
+{
+    return &usbcdclinkOp;
+}
+
+/**
+ * rxErr counts the frames with a bad length or checksum, rxDrop the ones the
+ * CRTP RX queue had no room for. txFull counts the sends retried because
+ * the TX FIFO of the port was full, the host is not reading. txLarge counts
+ * the large frames sent, maxSize is the largest data the host accepts in one.
+ */
+LOG_GROUP_START(usbCdc)
+LOG_ADD(LOG_UINT8, active, &isActive)
+LOG_ADD(LOG_UINT32, rx, &rxPacketCount)
+LOG_ADD(LOG_UINT32, rxErr, &rxErrorCount)
+LOG_ADD(LOG_UINT32, rxDrop, &rxDropCount)
+LOG_ADD(LOG_UINT32, tx, &txPacketCount)
+LOG_ADD(LOG_UINT32, txFull, &txFullCount)
+LOG_ADD(LOG_UINT32, txLarge, &txLargeCount)
+LOG_ADD(LOG_UINT16, maxSize, &maxDataSize)
+LOG_GROUP_STOP(usbCdc)
+
+#endif // CONFIG_USB_CDC_LINK
@@ -24,18 +24,72 @@
  *
  *
  * usec_time.c - microsecond-resolution timer and timestamps.
+ *
+ * With CONFIG_USEC_TIME_CYCLE_COUNTER the timestamps are interpolated with the
+ * cycle counter of the CPU from an anchor on the esp_timer. Every core has its
+ * own anchor as the cycle counters of the cores are not in sync, and takes a
+ * new one from the esp_timer every USEC_ANCHOR_PERIOD_MS. The interpolation
+ * rounds down, so the timestamps never go back at a new anchor.
  */
 
+#include <stdbool.h>
+
+#include "sdkconfig.h"
 #include "usec_time.h"
 #include "esp_timer.h"
+
+#ifdef CONFIG_USEC_TIME_CYCLE_COUNTER
+#include "esp_attr.h"
+#include "esp_cpu.h"
+#include "freertos/FreeRTOS.h"
+
+// Well below the 17.9 s wrap of the 32 bit counter at 240 MHz
+#define USEC_ANCHOR_PERIOD_MS      100
+#define USEC_ANCHOR_PERIOD_CYCLES  (CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ * 1000u * USEC_ANCHOR_PERIOD_MS)
+// us = cycles * USEC_PER_CYCLE >> 32
+#define USEC_PER_CYCLE             ((uint32_t)((1ull << 32) / CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ))
+
+typedef struct {
+    uint32_t cycles;
+    uint64_t us;
+    bool isValid;
+} usecAnchor_t;
+
+static usecAnchor_t anchors[portNUM_PROCESSORS];
+#endif
+
 void initUsecTimer(void)
 {
 
 }
 
+#ifdef CONFIG_USEC_TIME_CYCLE_COUNTER
+uint64_t IRAM_ATTR usecTimestamp(void)
+{
+    uint64_t us;
+
+    // Neither an interrupt nor a move to the other core between the reads
+    const UBaseType_t state = portSET_INTERRUPT_MASK_FROM_ISR();
+    usecAnchor_t *anchor = &anchors[xPortGetCoreID()];
+    const uint32_t elapsed = esp_cpu_get_cycle_count() - anchor->cycles;
+
+    if (anchor->isValid && elapsed < USEC_ANCHOR_PERIOD_CYCLES) {
+        us = anchor->us + (((uint64_t)elapsed * USEC_PER_CYCLE) >> 32);
+    } else {
+        us = (uint64_t)esp_timer_get_time();
+        anchor->cycles = esp_cpu_get_cycle_count();
+        anchor->us = us;
+        anchor->isValid = true;
+    }
+    portCLEAR_INTERRUPT_MASK_FROM_ISR(state);
+
+    return us;
+}
+#else
 uint64_t usecTimestamp(void)
 {
     return (uint64_t)esp_timer_get_time();
 }
+#endif
 
 
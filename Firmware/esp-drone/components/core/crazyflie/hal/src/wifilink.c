@@ -26,6 +26,7 @@
  */
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <string.h>
 
 #include "config.h"
@@ -38,30 +39,49 @@
 #include "FreeRTOS.h"
 #include "task.h"
 #include "queue.h"
+#include "timers.h"
 #include "queuemonitor.h"
+#include "link_capture.h"
 #include "semphr.h"
 #include "stm32_legacy.h"
+#include "log.h"
 
 #define DEBUG_MODULE "WIFILINK"
 #include "debug_cf.h"
 #include "static_mem.h"
 
 #define WIFI_ACTIVITY_TIMEOUT_MS (1000)
+// The link LED blinks at most once per period while packets come in
+#define WIFI_ACTIVITY_SAMPLE_MS  (100)
+
+// A received UDP packet is turned into a CRTP packet in place, the UDP size
+// and data line up with the CRTP size and raw packet
+typedef union {
+    UDPPacket udp;
+    CRTPPacket crtp;
+} WifiPacket;
+
+_Static_assert(offsetof(UDPPacket, data) == offsetof(CRTPPacket, raw), "UDP and CRTP packet layout differ");
 
 static bool isInit = false;
-static xQueueHandle crtpPacketDelivery;
-STATIC_MEM_QUEUE_ALLOC(crtpPacketDelivery, 16, sizeof(CRTPPacket));
-static uint8_t sendBuffer[64];
 
-static UDPPacket wifiIn;
-static CRTPPacket p;
 static uint32_t lastPacketTick;
 
+// Incremented by the UDP receive task and the CRTP RX task
+static uint32_t activityCount;
+static uint32_t lastActivityCount;
+static uint16_t packetRate;
+static xTimerHandle activityTimer;
+NO_DMA_CCM_SAFE_ZERO_INIT static StaticTimer_t activityTimerBuffer;
+
 static int wifilinkSendPacket(CRTPPacket *p);
 static int wifilinkSetEnable(bool enable);
 static int wifilinkReceiveCRTPPacket(CRTPPacket *p);
-
-STATIC_MEM_TASK_ALLOC(wifilinkTask, USBLINK_TASK_STACKSIZE);
+static int wifilinkReceiveCRTPPacketRef(CRTPPacket **p);
+static void wifilinkReleaseCRTPPacket(CRTPPacket *p);
+#ifdef CONFIG_CRTP_LARGE_FRAMES
+static int wifilinkSendLargePacket(uint8_t header, const uint8_t *data, uint16_t size);
+#endif
 
 static bool wifilinkIsConnected(void)
 {
@@ -73,6 +93,12 @@ static struct crtpLinkOperations wifilinkOp = {
     .sendPacket        = wifilinkSendPacket,
     .receivePacket     = wifilinkReceiveCRTPPacket,
     .isConnected       = wifilinkIsConnected,
+    .receivePacketRef  = wifilinkReceiveCRTPPacketRef,
+    .releasePacket     = wifilinkReleaseCRTPPacket,
+#ifdef CONFIG_CRTP_LARGE_FRAMES
+    .getMaxDataSize    = wifiGetMaxDataSize,
+    .sendLargePacket   = wifilinkSendLargePacket,
+#endif
 };
 
 #ifdef CONFIG_ENABLE_LEGACY_APP
@@ -89,76 +115,132 @@ static bool detectOldVersionApp(UDPPacket *in)
 }
 #endif
 
-static void wifilinkTask(void *param)
+/* The port of the CRTP packet a received packet turns into */
+static uint8_t wifilinkPortOf(WifiPacket *in)
 {
-    while (1) {
-        /* command step - receive  03 Fetch a wifi packet off the queue */
-        wifiGetDataBlocking(&wifiIn);
-        lastPacketTick = xTaskGetTickCount();
 #ifdef CONFIG_ENABLE_LEGACY_APP
-        float rch, pch, ych;
-        uint16_t tch;
-        if (detectOldVersionApp(&wifiIn)) {
-            rch  = (1.0) * (float)(((((uint16_t)wifiIn.data[1] << 8) + (uint16_t)wifiIn.data[2]) - 296) * 15.0 / 150.0); //-15~+15
-            pch  = (-1.0) * (float)(((((uint16_t)wifiIn.data[3] << 8) + (uint16_t)wifiIn.data[4]) - 296) * 15.0 / 150.0); //-15~+15
-            tch  = (((uint16_t)wifiIn.data[5] << 8) + (uint16_t)wifiIn.data[6]) * 59000.0 / 600.0;
-            ych  = (float)(((((uint16_t)wifiIn.data[7] << 8) + (uint16_t)wifiIn.data[8]) - 296) * 15.0 / 150.0); //-15~+15
-            p.size = wifiIn.size + 1 ; //add cksum size
-            p.header = CRTP_HEADER(CRTP_PORT_SETPOINT, 0x00); //head redefine
-
-            memcpy(&p.data[0], &rch, 4);
-            memcpy(&p.data[4], &pch, 4);
-            memcpy(&p.data[8], &ych, 4);
-            memcpy(&p.data[12], &tch, 2);
-        } else
+    if (detectOldVersionApp(&in->udp)) {
+        return CRTP_PORT_SETPOINT;
+    }
 #endif
-        {
-            /* command step - receive  04 copy CRTP part from packet, the size not contain head */
-            p.size = wifiIn.size - 1;
-            memcpy(&p.raw, wifiIn.data, wifiIn.size);
-        }
+    return in->crtp.port;
+}
 
-        /* command step - receive 05 send to crtpPacketDelivery queue */
-        xQueueSend(crtpPacketDelivery, &p, 0) ;
+/* Turns a received packet into a CRTP packet in place, only once per packet */
+static CRTPPacket *wifilinkToCrtp(WifiPacket *in)
+{
+    lastPacketTick = xTaskGetTickCount();
+#ifdef CONFIG_ENABLE_LEGACY_APP
+    float rch, pch, ych;
+    uint16_t tch;
+    if (detectOldVersionApp(&in->udp)) {
+        rch  = (float)((((uint16_t)in->udp.data[1] << 8) + (uint16_t)in->udp.data[2]) - 296) * (15.0f / 150.0f); //-15~+15
+        pch  = -(float)((((uint16_t)in->udp.data[3] << 8) + (uint16_t)in->udp.data[4]) - 296) * (15.0f / 150.0f); //-15~+15
+        tch  = (float)(((uint16_t)in->udp.data[5] << 8) + (uint16_t)in->udp.data[6]) * (59000.0f / 600.0f);
+        ych  = (float)((((uint16_t)in->udp.data[7] << 8) + (uint16_t)in->udp.data[8]) - 296) * (15.0f / 150.0f); //-15~+15
+        // All input is read above, the packet can be overwritten
+        in->crtp.size = in->udp.size + 1 ; //add cksum size
+        in->crtp.header = CRTP_HEADER(CRTP_PORT_SETPOINT, 0x00); //head redefine
+
+        memcpy(&in->crtp.data[0], &rch, 4);
+        memcpy(&in->crtp.data[4], &pch, 4);
+        memcpy(&in->crtp.data[8], &ych, 4);
+        memcpy(&in->crtp.data[12], &tch, 2);
+    } else
+#endif
+    {
+        /* command step - receive  04 the CRTP part is the packet, the size not contain head */
+        in->crtp.size = in->udp.size - 1;
     }
 
+    __atomic_fetch_add(&activityCount, 1, __ATOMIC_RELAXED);
+    return &in->crtp;
 }
 
-static int wifilinkReceiveCRTPPacket(CRTPPacket *p)
+/* Runs in the UDP receive task, the packets of the direct ports skip the
+ * queue to the CRTP RX task */
+static bool wifilinkDirectRx(UDPPacket *packet)
 {
-    if (xQueueReceive(crtpPacketDelivery, p, M2T(100)) == pdTRUE) {
-        ledseqRun(&seq_linkUp);
-        return 0;
+    WifiPacket *in = (WifiPacket *)packet;
+
+    linkCapturePacket(lcRx, in->udp.data, in->udp.size - 1);
+    if (!crtpIsPortDirect(wifilinkPortOf(in))) {
+        return false;
     }
 
-    return -1;
+    crtpDispatchDirect(wifilinkToCrtp(in));
+    return true;
 }
 
-static int wifilinkSendPacket(CRTPPacket *p)
+static int wifilinkReceiveCRTPPacketRef(CRTPPacket **p)
 {
-    int dataSize;
+    /* command step - receive  03 Fetch a wifi packet off the queue */
+    WifiPacket *in = (WifiPacket *)wifiGetPacketWait(M2T(100));
 
-    ASSERT(p->size < SYSLINK_MTU);
+    if (in == NULL) {
+        return -1;
+    }
 
-    sendBuffer[0] = p->header;
+    *p = wifilinkToCrtp(in);
+    linkCapturePacket(lcDequeued, (*p)->raw, (*p)->size);
+    return 0;
+}
 
-    if (p->size <= CRTP_MAX_DATA_SIZE) {
-        memcpy(&sendBuffer[1], p->data, p->size);
+static void wifilinkReleaseCRTPPacket(CRTPPacket *p)
+{
+    wifiReleasePacket(&((WifiPacket *)p)->udp);
+}
+
+static int wifilinkReceiveCRTPPacket(CRTPPacket *p)
+{
+    CRTPPacket *in;
+
+    if (wifilinkReceiveCRTPPacketRef(&in) != 0) {
+        return -1;
     }
 
-    dataSize = p->size + 1;
+    memcpy(p, in, sizeof(CRTPPacket));
+    wifilinkReleaseCRTPPacket(in);
+    return 0;
+}
 
+static int wifilinkSendPacket(CRTPPacket *p)
+{
+    ASSERT(p->size <= CRTP_MAX_DATA_SIZE);
+    linkCapturePacket(lcTx, p->raw, p->size);
 
     /*ledseqRun(&seq_linkDown);*/
 
-    return wifiSendData(dataSize, sendBuffer);
+    return wifiSendPacket(p->header, p->data, p->size);
 }
 
+#ifdef CONFIG_CRTP_LARGE_FRAMES
+/* From the task of the service, the frame is not captured, its size does
+ * not fit a record */
+static int wifilinkSendLargePacket(uint8_t header, const uint8_t *data, uint16_t size)
+{
+    return wifiSendLargeData(header, data, size);
+}
+#endif
+
 static int wifilinkSetEnable(bool enable)
 {
+    wifiSetRxHook(enable ? wifilinkDirectRx : NULL);
     return 0;
 }
 
+/* Samples the packet count at a low rate, away from the receive path */
+static void wifilinkActivityTimer(xTimerHandle timer)
+{
+    const uint32_t count = wifilinkGetActivityCount();
+
+    if (count != lastActivityCount) {
+        ledseqRun(&seq_linkUp);
+    }
+    packetRate = (count - lastActivityCount) * 1000 / WIFI_ACTIVITY_SAMPLE_MS;
+    lastActivityCount = count;
+}
+
 /*
  * Public functions
  */
@@ -169,11 +251,9 @@ void wifilinkInit()
         return;
     }
 
-
-    crtpPacketDelivery = STATIC_MEM_QUEUE_CREATE(crtpPacketDelivery);
-    DEBUG_QUEUE_MONITOR_REGISTER(crtpPacketDelivery);
-
-    STATIC_MEM_TASK_CREATE(wifilinkTask, wifilinkTask,WIFILINK_TASK_NAME,NULL, WIFILINK_TASK_PRI);
+    activityTimer = xTimerCreateStatic("wifiActivity", M2T(WIFI_ACTIVITY_SAMPLE_MS), pdTRUE, NULL,
+                                       wifilinkActivityTimer, &activityTimerBuffer);
+    xTimerStart(activityTimer, 0);
 
     isInit = true;
 }
@@ -187,3 +267,13 @@ struct crtpLinkOperations *wifilinkGetLink()
 {
     return &wifilinkOp;
 }
+
+uint32_t wifilinkGetActivityCount(void)
+{
+    return __atomic_load_n(&activityCount, __ATOMIC_RELAXED);
+}
+
+LOG_GROUP_START(crtpLink)
+LOG_ADD(LOG_UINT32, rx, &activityCount)
+LOG_ADD(LOG_UINT16, rxRate, &packetRate)
+LOG_GROUP_STOP(crtpLink)
@@ -3,6 +3,9 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+// No app heartbeat for this long while flying -> land
+#define SAFETY_TIMEOUT_MS 30000
+
 // --- States ---
 typedef enum {
   AUTONAV_IDLE = 0,
@@ -25,10 +28,14 @@ typedef enum {
 
 // API
 void autonavInit(void);
-void autonavUpdate(uint32_t tickMs);
+void autonavUpdate(uint32_t tickMs);       // run by the autonav task
+void autonavNotify(void);                  // wake the autonav task
 
 void autonavStartShape(uint8_t shapeId);   // 0 = stop, others = shapes
+bool autonavStartMission(void);            // the one in the mission store, false if invalid
+void autonavStop(void);
 void autonavKickSafety(void);
+void autonavSetTargetAltMm(uint16_t mm);
 void autonavSetObstacle(bool detected);
 
 autonav_state_t autonavGetState(void);
@@ -13,12 +13,24 @@ typedef enum {
   AUTONAV_CMD_OVAL        = 3,
   AUTONAV_CMD_TRI         = 4,
   AUTONAV_CMD_SET_ALT_MM  = 5,  // arg0: uint16 altitude (mm)
+  AUTONAV_CMD_MISSION     = 6,  // fly the uploaded mission, see autonav_mission.h
   AUTONAV_CMD_OVERRIDE_ON = 10, // manual override
   AUTONAV_CMD_OVERRIDE_OFF= 11  // resume autonav
 } autonav_cmd_t;
 
-// Minimal status the drone can send back (optional)
+// Status the drone pushes every AUTONAV_STATUS_PERIOD_MS (same port/ch)
+#define AUTONAV_STATUS_PERIOD_MS 100
+
 typedef struct __attribute__((packed)) {
-  uint8_t state;   // autonav_state_t
-  uint16_t altMm;  // latest down-ToF (mm) if available, else 0
+  uint8_t state;       // autonav_state_t
+  uint16_t altMm;      // latest down range (mm), 0 if none
+  uint16_t obstacleMm; // nearest obstacle all around (mm), 0xFFFF if none
+  uint16_t cmdAgeMs;   // since the last app command, saturates at 0xFFFF
+  uint16_t holdMs;     // held in front of an obstacle, 0 when not holding
 } autonav_status_t;
+
+// Start the task serving the port, called by autonavInit()
+void autonav_crtp_start(void);
+
+// Fill a status from the cached state, see autonav.c
+void autonavGetStatus(autonav_status_t* status);
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Missions are uploaded through the MEM_TYPE_AUTONAV_MISSION memory and
+// started by AUTONAV_CMD_MISSION, the autonav task then flies them without
+// the app. A write at address 0 starts a new mission and clears the rest of
+// the store, so the tail of a longer one never runs. The store is in RAM.
+#define AUTONAV_MISSION_SIZE      512
+// Counted jumps of a mission, the others loop forever
+#define AUTONAV_MISSION_MAX_LOOPS 4
+
+// --- Bytecode, little endian, positions relative to where the mission starts ---
+typedef enum {
+  AUTONAV_OP_END         = 0x00, // hover in place, the app takes over
+  AUTONAV_OP_TAKEOFF     = 0x01, // uint16 alt (mm), uint16 duration (ms)
+  AUTONAV_OP_GOTO        = 0x02, // int16 x, int16 y (mm), uint16 duration (ms), at the mission altitude
+  AUTONAV_OP_ALT         = 0x03, // uint16 alt (mm), uint16 duration (ms), in place
+  AUTONAV_OP_HOLD        = 0x04, // uint16 duration (ms)
+  AUTONAV_OP_LAND        = 0x05, // ends the mission
+  AUTONAV_OP_JUMP        = 0x06, // uint16 address, uint8 count (0 = forever)
+  AUTONAV_OP_ON_OBSTACLE = 0x07, // uint8 autonav_obstacle_action_t, uint16 address for a jump
+} autonav_op_t;
+
+// What the mission does when an obstacle blocks the way
+typedef enum {
+  AUTONAV_OBSTACLE_HOLD = 0,  // hold until clear, land after OBSTACLE_MAX_WAIT_MS (default)
+  AUTONAV_OBSTACLE_LAND = 1,
+  AUTONAV_OBSTACLE_JUMP = 2,  // the code jumped to flies on while this obstacle stays
+} autonav_obstacle_action_t;
+
+typedef struct {
+  autonav_op_t op;
+  uint16_t next;      // address of the next instruction
+  int16_t x, y;       // GOTO (mm)
+  uint16_t altMm;     // TAKEOFF, ALT
+  uint16_t durationMs;
+  uint16_t target;    // JUMP, ON_OBSTACLE
+  uint8_t count;      // JUMP
+  uint8_t action;     // ON_OBSTACLE
+} autonav_mission_op_t;
+
+// Registers the memory, at boot before memInit()
+void autonavMissionInit(void);
+
+// Copy into the store, as the memory does, refused while the mission is running
+bool autonavMissionWrite(uint32_t addr, uint32_t len, const uint8_t* data);
+
+// Check the whole store: known instructions, none cut by the end, jumps to
+// instructions and at most AUTONAV_MISSION_MAX_LOOPS counted jumps
+bool autonavMissionValidate(void);
+
+// Decode the instruction at addr of a validated mission
+bool autonavMissionFetch(uint16_t addr, autonav_mission_op_t* op);
+
+// The store is read only while the autonav flies the mission
+void autonavMissionLock(bool locked);
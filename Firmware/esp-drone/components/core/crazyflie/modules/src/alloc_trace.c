@@ -0,0 +1,150 @@
+/**
+ *
+ * ESP-Drone Firmware
+ *
+ * Copyright 2019-2020  Espressif Systems (Shanghai)
+ * Copyright (C) 2011-2012 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * alloc_trace.c - The heap allocations made once the flight tasks run
+ *
+ * esp_heap_trace_alloc_hook() is called by the heap of the IDF after every
+ * allocation, from any task or interrupt and possibly with the flash cache
+ * disabled: it is in IRAM, only takes the lock of the records and calls
+ * nothing from the flash.
+ */
+#define DEBUG_MODULE "ALLOC"
+
+#include <inttypes.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "esp_attr.h"
+#include "esp_heap_caps.h"
+#include "esp_debug_helpers.h"
+#include "esp_timer.h"
+
+#include "alloc_trace.h"
+#include "log.h"
+#include "debug_cf.h"
+
+#ifdef CONFIG_ALLOC_TRACE
+
+#define ALLOC_TRACE_TASK_NAME_LEN 8
+
+typedef struct {
+  uint32_t timeMs;  // Since the end of the boot
+  uint32_t size;
+  uint32_t caps;
+  char task[ALLOC_TRACE_TASK_NAME_LEN];
+  uint32_t pc[ALLOC_TRACE_DEPTH];
+} allocTraceRecord_t;
+
+static volatile bool isStarted;
+static int64_t startUs;
+static portMUX_TYPE recordsLock = portMUX_INITIALIZER_UNLOCKED;
+
+static DRAM_ATTR allocTraceRecord_t records[ALLOC_TRACE_RECORDS];
+static uint32_t allocCount;
+static uint32_t allocBytes;
+static uint32_t largestSize;
+
+void allocTraceStart(void)
+{
+  startUs = esp_timer_get_time();
+  isStarted = true;
+  DEBUG_PRINTI("Tracing the heap allocations");
+}
+
+static void IRAM_ATTR backtrace(uint32_t *pc)
+{
+  esp_backtrace_frame_t frame;
+  int i = 0;
+
+  esp_backtrace_get_start(&frame.pc, &frame.sp, &frame.next_pc);
+  // The first frame is this function, the hook is the next one
+  while (i < ALLOC_TRACE_DEPTH && esp_backtrace_get_next_frame(&frame)) {
+    pc[i++] = esp_cpu_process_stack_pc(frame.pc);
+  }
+  while (i < ALLOC_TRACE_DEPTH) {
+    pc[i++] = 0;
+  }
+}
+
+void IRAM_ATTR esp_heap_trace_alloc_hook(void *ptr, size_t size, uint32_t caps)
+{
+  if (!isStarted || ptr == NULL) {
+    return;
+  }
+
+  portENTER_CRITICAL_SAFE(&recordsLock);
+  const uint32_t index = allocCount++;
+  allocBytes += size;
+  if (size > largestSize) {
+    largestSize = size;
+  }
+  portEXIT_CRITICAL_SAFE(&recordsLock);
+
+  // The first ones are kept, a leak or a periodic allocation shows among them
+  if (index >= ALLOC_TRACE_RECORDS) {
+    return;
+  }
+
+  allocTraceRecord_t *record = &records[index];
+  const char *name = xPortInIsrContext() ? "ISR" : pcTaskGetName(NULL);
+  int i;
+
+  record->timeMs = (uint32_t)((esp_timer_get_time() - startUs) / 1000);
+  record->size = size;
+  record->caps = caps;
+  for (i = 0; i < ALLOC_TRACE_TASK_NAME_LEN - 1 && name[i] != '\0'; i++) {
+    record->task[i] = name[i];
+  }
+  record->task[i] = '\0';
+  backtrace(record->pc);
+}
+
+void allocTraceDump(void)
+{
+  const uint32_t count = allocCount;
+
+  if (!isStarted) {
+    DEBUG_PRINTI("No heap allocation traced during the boot");
+    return;
+  }
+
+  DEBUG_PRINTI("%" PRIu32 " heap allocations, %" PRIu32 " bytes since the boot", count, allocBytes);
+  for (uint32_t i = 0; i < count && i < ALLOC_TRACE_RECORDS; i++) {
+    const allocTraceRecord_t *r = &records[i];
+
+    DEBUG_PRINTI("%" PRIu32 " ms %" PRIu32 " B caps 0x%" PRIx32 " %s", r->timeMs, r->size, r->caps, r->task);
+    DEBUG_PRINTI("Backtrace: 0x%08" PRIx32 " 0x%08" PRIx32 " 0x%08" PRIx32 " 0x%08" PRIx32 " 0x%08" PRIx32 " 0x%08" PRIx32,
+                 r->pc[0], r->pc[1], r->pc[2], r->pc[3], r->pc[4], r->pc[5]);
+  }
+  if (count > ALLOC_TRACE_RECORDS) {
+    DEBUG_PRINTI("%" PRIu32 " more not recorded", count - ALLOC_TRACE_RECORDS);
+  }
+}
+
+/**
+ * The heap allocations since the end of the boot, 0 while the flight makes none
+ */
+LOG_GROUP_START(allocTrace)
+LOG_ADD(LOG_UINT32, count, &allocCount)
+LOG_ADD(LOG_UINT32, bytes, &allocBytes)
+LOG_ADD(LOG_UINT32, largest, &largestSize)
+LOG_GROUP_STOP(allocTrace)
+
+#endif // CONFIG_ALLOC_TRACE
@@ -25,6 +25,7 @@
 /* app_channel.c: App realtime communication channel with the ground */
 
 #include "app_channel.h"
+#include "app_message.h"
 
 #include <string.h>
 
@@ -93,10 +94,20 @@ void appchannelInit()
   rxQueue = xQueueCreate(10, sizeof(CRTPPacket));
 
   overflow = false;
+
+#ifdef CONFIG_APP_MESSAGE
+  appMessageInit();
+#endif
 }
 
 void appchannelIncomingPacket(CRTPPacket *p)
 {
+#ifdef CONFIG_APP_MESSAGE
+  // The channel carries the frames of the message layer
+  appMessageIncomingPacket(p);
+  return;
+#endif
+
   int res = xQueueSend(rxQueue, p, 0);
 
   if (res != pdTRUE) {
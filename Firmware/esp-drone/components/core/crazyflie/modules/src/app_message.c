@@ -0,0 +1,345 @@
+/**
+ *
+ * ESP-Drone Firmware
+ *
+ * Copyright 2019-2020  Espressif Systems (Shanghai)
+ * Copyright (C) 2011-2012 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * app_message.c - Messages of up to CONFIG_APP_MESSAGE_MAX_SIZE bytes over
+ * the app channel, fragmented and acked
+ */
+
+#include "app_message.h"
+
+#ifdef CONFIG_APP_MESSAGE
+
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "semphr.h"
+#include "queue.h"
+#include "task.h"
+
+#include "crtp.h"
+#include "platformservice.h"
+#include "log.h"
+#include "stm32_legacy.h"
+
+// Time without an ack after which the sender goes back to the first fragment not acked
+#define APP_MESSAGE_RETRY_MS 100
+#define APP_MESSAGE_ACK_EVERY (APP_MESSAGE_WINDOW / 2)
+
+#define APP_MESSAGE_FRAGMENTS(length) (((length) + APP_MESSAGE_FRAGMENT_SIZE - 1) / APP_MESSAGE_FRAGMENT_SIZE)
+
+#if APP_MESSAGE_FRAGMENTS(CONFIG_APP_MESSAGE_MAX_SIZE) > APP_MESSAGE_MAX_FRAGMENTS
+#error "CONFIG_APP_MESSAGE_MAX_SIZE does not fit in APP_MESSAGE_MAX_FRAGMENTS fragments"
+#endif
+
+// Written by the CRTP task only, but for rxBufferHeld which the app clears
+static uint8_t rxBuffers[CONFIG_APP_MESSAGE_BUFFERS][CONFIG_APP_MESSAGE_MAX_SIZE];
+static volatile bool rxBufferHeld[CONFIG_APP_MESSAGE_BUFFERS];
+static xQueueHandle rxReadyQueue;
+
+static struct {
+  bool isActive;
+  uint8_t buffer;
+  uint8_t id;
+  uint8_t count;
+  uint8_t next;
+  uint8_t sinceAck;
+  bool gapAcked;
+} rx;
+
+// The last message received, its repeats are acked again in case the ack was lost
+static bool rxHasLast;
+static uint8_t rxLastId;
+static uint8_t rxLastCount;
+// The message whose lost start was acked
+static bool rxHasStartAck;
+static uint8_t rxStartAckId;
+
+static SemaphoreHandle_t txMutex;
+static xQueueHandle txAckQueue;
+static uint8_t txId;
+static CRTPPacket txPacket;
+static CRTPPacket ackPacket;
+
+static uint32_t sentCount;
+static uint32_t receivedCount;
+static uint32_t retryCount;
+static uint32_t rxOverflowCount;
+
+static void sendAck(uint8_t id, uint8_t index, uint8_t count)
+{
+  const appMessageHeader_t header = {
+    .kind = APP_MESSAGE_ACK,
+    .id = id,
+    .index = index,
+    .count = count,
+  };
+  memcpy(ackPacket.data, &header, sizeof(header));
+  ackPacket.size = sizeof(header);
+
+  // From the CRTP task, a lost ack only makes the sender retry
+  platformserviceSendAppchannelPacket(&ackPacket);
+}
+
+static int freeBuffer(void)
+{
+  // A message the sender gave up on leaves its buffer to the next one
+  if (rx.isActive) {
+    return rx.buffer;
+  }
+
+  for (int i = 0; i < CONFIG_APP_MESSAGE_BUFFERS; i++) {
+    if (!rxBufferHeld[i]) {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+static bool startMessage(const appMessageHeader_t *header)
+{
+  if (header->count > APP_MESSAGE_FRAGMENTS(CONFIG_APP_MESSAGE_MAX_SIZE)) {
+    rxOverflowCount++;
+    return false;
+  }
+
+  const int buffer = freeBuffer();
+  if (buffer < 0) {
+    // Not acked, the sender retries until the app releases a buffer
+    rxOverflowCount++;
+    return false;
+  }
+  rx.buffer = buffer;
+  rxBufferHeld[buffer] = true;
+
+  rx.isActive = true;
+  rx.id = header->id;
+  rx.count = header->count;
+  rx.next = 0;
+  rx.sinceAck = 0;
+  rx.gapAcked = false;
+  return true;
+}
+
+static void handleData(const appMessageHeader_t *header, const uint8_t *payload, size_t length)
+{
+  if (header->count == 0 || header->index >= header->count) {
+    return;
+  }
+
+  if (!rx.isActive || header->id != rx.id) {
+    if (rxHasLast && header->id == rxLastId) {
+      sendAck(rxLastId, rxLastCount, rxLastCount);
+      return;
+    }
+    if (header->index != 0) {
+      // The start of the message was lost, have it sent again, once
+      if (freeBuffer() >= 0 && !(rxHasStartAck && header->id == rxStartAckId)) {
+        sendAck(header->id, 0, header->count);
+        rxHasStartAck = true;
+        rxStartAckId = header->id;
+      }
+      return;
+    }
+    if (!startMessage(header)) {
+      return;
+    }
+  }
+
+  if (header->index != rx.next) {
+    // One ack per gap, the sender goes back on an ack that does not move
+    if (!rx.gapAcked) {
+      sendAck(rx.id, rx.next, rx.count);
+      rx.gapAcked = true;
+    }
+    return;
+  }
+
+  const bool isLast = header->index == rx.count - 1;
+  const size_t offset = (size_t)header->index * APP_MESSAGE_FRAGMENT_SIZE;
+  if ((!isLast && length != APP_MESSAGE_FRAGMENT_SIZE) || offset + length > CONFIG_APP_MESSAGE_MAX_SIZE) {
+    return;
+  }
+
+  memcpy(&rxBuffers[rx.buffer][offset], payload, length);
+  rx.next++;
+  rx.gapAcked = false;
+
+  if (isLast) {
+    const appMessage_t message = {
+      .data = rxBuffers[rx.buffer],
+      .length = offset + length,
+      .buffer = rx.buffer,
+    };
+    // There is room for all the buffers in the queue
+    xQueueSend(rxReadyQueue, &message, 0);
+    receivedCount++;
+
+    rx.isActive = false;
+    rxHasLast = true;
+    rxLastId = rx.id;
+    rxLastCount = rx.count;
+    sendAck(rx.id, rx.count, rx.count);
+  } else if (++rx.sinceAck >= APP_MESSAGE_ACK_EVERY) {
+    rx.sinceAck = 0;
+    sendAck(rx.id, rx.next, rx.count);
+  }
+}
+
+void appMessageIncomingPacket(CRTPPacket *p)
+{
+  if (p->size < sizeof(appMessageHeader_t)) {
+    return;
+  }
+
+  appMessageHeader_t header;
+  memcpy(&header, p->data, sizeof(header));
+
+  switch (header.kind) {
+    case APP_MESSAGE_DATA:
+      handleData(&header, &p->data[sizeof(header)], p->size - sizeof(header));
+      break;
+    case APP_MESSAGE_ACK:
+      xQueueSend(txAckQueue, &header, 0);
+      break;
+    default:
+      break;
+  }
+}
+
+static void sendFragment(const uint8_t *data, size_t length, uint8_t index, uint8_t count)
+{
+  const size_t offset = (size_t)index * APP_MESSAGE_FRAGMENT_SIZE;
+  const size_t fragmentLength = (length - offset < APP_MESSAGE_FRAGMENT_SIZE) ? length - offset : APP_MESSAGE_FRAGMENT_SIZE;
+  const appMessageHeader_t header = {
+    .kind = APP_MESSAGE_DATA,
+    .id = txId,
+    .index = index,
+    .count = count,
+  };
+
+  memcpy(txPacket.data, &header, sizeof(header));
+  memcpy(&txPacket.data[sizeof(header)], &data[offset], fragmentLength);
+  txPacket.size = sizeof(header) + fragmentLength;
+  platformserviceSendAppchannelPacketBlock(&txPacket);
+}
+
+bool appMessageSend(const void *data, size_t length, int timeout_ms)
+{
+  if (length > CONFIG_APP_MESSAGE_MAX_SIZE) {
+    return false;
+  }
+
+  // An empty message is one empty fragment
+  const uint8_t count = (length == 0) ? 1 : APP_MESSAGE_FRAGMENTS(length);
+  const TickType_t start = xTaskGetTickCount();
+  bool isAcked = false;
+
+  xSemaphoreTake(txMutex, portMAX_DELAY);
+
+  txId++;
+  xQueueReset(txAckQueue);
+
+  uint8_t acked = 0;
+  uint8_t next = 0;
+  // Going back once per ack that does not move, the rest of the window may
+  // bring more of them
+  bool hasGoneBack = false;
+  while (true) {
+    while (next < count && next < acked + APP_MESSAGE_WINDOW) {
+      sendFragment(data, length, next, count);
+      next++;
+    }
+
+    TickType_t wait = M2T(APP_MESSAGE_RETRY_MS);
+    if (timeout_ms >= 0) {
+      const TickType_t elapsed = xTaskGetTickCount() - start;
+      if (elapsed >= M2T(timeout_ms)) {
+        break;
+      }
+      if (M2T(timeout_ms) - elapsed < wait) {
+        wait = M2T(timeout_ms) - elapsed;
+      }
+    }
+
+    appMessageHeader_t ack;
+    if (xQueueReceive(txAckQueue, &ack, wait) == pdTRUE) {
+      if (ack.id != txId || ack.index > count) {
+        continue;
+      }
+      if (ack.index == count) {
+        isAcked = true;
+        break;
+      }
+      if (ack.index > acked) {
+        acked = ack.index;
+        hasGoneBack = false;
+      } else if (ack.index == acked && next > acked && !hasGoneBack) {
+        // No progress, the receiver saw a gap
+        next = acked;
+        hasGoneBack = true;
+        retryCount++;
+      }
+    } else {
+      next = acked;
+      hasGoneBack = false;
+      retryCount++;
+    }
+  }
+
+  if (isAcked) {
+    sentCount++;
+  }
+
+  xSemaphoreGive(txMutex);
+
+  return isAcked;
+}
+
+bool appMessageReceive(appMessage_t *message, int timeout_ms)
+{
+  const TickType_t wait = (timeout_ms < 0) ? portMAX_DELAY : M2T(timeout_ms);
+
+  return xQueueReceive(rxReadyQueue, message, wait) == pdTRUE;
+}
+
+void appMessageRelease(appMessage_t *message)
+{
+  if (message->data) {
+    rxBufferHeld[message->buffer] = false;
+    message->data = NULL;
+  }
+}
+
+void appMessageInit(void)
+{
+  txMutex = xSemaphoreCreateMutex();
+  txAckQueue = xQueueCreate(4, sizeof(appMessageHeader_t));
+  rxReadyQueue = xQueueCreate(CONFIG_APP_MESSAGE_BUFFERS, sizeof(appMessage_t));
+}
+
+LOG_GROUP_START(appMsg)
+  LOG_ADD(LOG_UINT32, sent, &sentCount)
+  LOG_ADD(LOG_UINT32, received, &receivedCount)
+  LOG_ADD(LOG_UINT32, retries, &retryCount)
+  LOG_ADD(LOG_UINT32, rxOverflow, &rxOverflowCount)
+LOG_GROUP_STOP(appMsg)
+
+#endif // CONFIG_APP_MESSAGE
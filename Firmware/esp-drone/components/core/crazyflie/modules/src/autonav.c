@@ -1,222 +1,601 @@
 #include "autonav.h"
+#include "autonav_crtp.h"
+#include "autonav_mission.h"
 #include <string.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/timers.h"
 #include "commander.h"          // commanderSetSetpoint(...)
+#include "crtp_commander_high_level.h"
+#include "pptraj.h"             // piecewise_plan_7th_order_no_jerk(...)
 #include "stabilizer.h"         // setpoint_t
-#include "esp_timer.h"          // esp_timer_get_time()
+#include "usec_time.h"          // usecTimestamp()
 #include <math.h>
+#include "sdkconfig.h"
+
+#include "config.h"
+#include "system.h"
+#include "range.h"
+#include "obstacle_map.h"
+#include "static_mem.h"
+#include "log.h"
+#include "stm32_legacy.h"
 
 // ---- CONFIG ----
 #define AUTONAV_DEFAULT_ALT_MM        1200
-#define SAFETY_TIMEOUT_MS             30000   // 30s no heartbeat -> land
-#define OBSTACLE_THR_MM               800     // front ToF < 0.8m => hold
+#define OBSTACLE_THR_MM               800     // obstacle < 0.8m around => hold
+#define FRONT_TOF_FOV                 (27.0f * (float)M_PI / 180.0f)
 #define OBSTACLE_MAX_WAIT_MS          30000   // 30s blocked -> land
-#define LOOP_DT_S                     (0.01f) // if autonavUpdate() called at 100 Hz
-#define HOVER_THRUST_BASE             30000.0f// set for your frame after bench test
-
-// Altitude PID (thrust control)
-#define Z_KP 1.0f
-#define Z_KI 0.04f
-#define Z_KD 0.08f
+#define AUTONAV_ACTIVE_PERIOD_MS      100     // wake-up when flying and no range arrives
+// Notification bits of the autonav task
+#define EVENT_WAKE                    (1 << 0)  // new range or app command
+#define EVENT_SAFETY_TIMEOUT          (1 << 1)  // no app heartbeat for SAFETY_TIMEOUT_MS
+#define EVENT_OBSTACLE_TIMEOUT        (1 << 2)  // held for OBSTACLE_MAX_WAIT_MS
 // Trajectory timing
 #define SEGMENT_TIME_MS 3000   // ms per edge (3s)
-#define SHAPE_SPEED     0.2f   // m/s horizontal speed (tune!)
-
-static uint64_t shapeStartUs = 0;
+#define SHAPE_SPEED     0.2f   // m/s average horizontal speed (tune!)
+#define SHAPE_SIDE_M    (SHAPE_SPEED * SEGMENT_TIME_MS / 1000.0f)
+#define OVAL_PIECES     8
+#define OVAL_PERIOD_S   (2.0f * (float)M_PI)
+
+// Shapes are flown by the high-level commander, as a poly4d trajectory in
+// the end of its trajectory memory, relative to where the shape starts.
+// Every edge of a polygon starts and ends at rest and has no jerk at the
+// corners, the oval is continuous up to the acceleration.
+#define AUTONAV_TRAJECTORY_ID   (NUM_TRAJECTORY_DEFINITIONS - 1)
+#define AUTONAV_MAX_PIECES      OVAL_PIECES
+// Instructions that take no time run in a row, up to this many per update so
+// that a jump loop without a motion does not hog the task
+#define MISSION_OPS_PER_UPDATE  16
 // ---- EXTERNAL SENSOR HOOKS ----
 // Implement these in your sensor drivers or glue once and they’re reusable.
-extern bool sensorsGetDownTofMm(uint16_t* out_mm);   // downward VL53L0X/L1X
 extern bool sensorsGetFrontTofMm(uint16_t* out_mm);  // forward VL53L1X
 // Optionally: extern void motorsShutDown(void);
 
 // ---- STATE ----
-static autonav_state_t s_state = AUTONAV_IDLE;
-static uint16_t s_targetAltMm = AUTONAV_DEFAULT_ALT_MM;
-static uint8_t  s_shapeId = 0;
-
-static uint64_t s_lastCmdUs = 0;     // heartbeat updated by autonavKickSafety()
-static uint64_t s_obstEnterUs = 0;   // when we entered HOLD_OBSTACLE
-static float z_i = 0.f, z_prevErr = 0.f;
-static float altFilt = AUTONAV_DEFAULT_ALT_MM;
+// Everything a flight changes, in one place so that autonavInit() starts the
+// next flight from scratch whatever the last one left behind
+typedef struct {
+  autonav_state_t state;
+  uint16_t targetAltMm;
+  uint8_t  shapeId;
+
+  struct poly4d pieces[AUTONAV_MAX_PIECES];
+  uint8_t nPieces;
+
+  uint64_t lastCmdUs;     // heartbeat updated by autonavKickSafety()
+  uint64_t obstEnterUs;   // when we entered HOLD_OBSTACLE
+
+  // Mission being flown, see autonav_mission.h
+  struct {
+    bool active;
+    uint16_t pc;          // current instruction
+    bool isStarted;       // its trajectory or hold was issued
+    uint64_t holdEndUs;
+    float origin[2];      // where the mission started (m)
+    float pos[2];         // last waypoint (m)
+    float altM;
+    float yaw;
+    uint8_t obstacleAction;
+    uint16_t obstacleTarget;
+    bool isObstacleHandled; // the current obstacle triggered a jump already
+    uint16_t loopPc[AUTONAV_MISSION_MAX_LOOPS];
+    uint8_t loopLeft[AUTONAV_MISSION_MAX_LOOPS];
+    uint8_t nLoops;
+  } mission;
+} autonavContext_t;
+
+static autonavContext_t s_nav = {
+  .state = AUTONAV_IDLE,
+  .targetAltMm = AUTONAV_DEFAULT_ALT_MM,
+};
+
+static TaskHandle_t taskHandle;
+// One shot deadlines, the failsafes do not wait for an update to notice them
+static TimerHandle_t safetyTimer;
+static StaticTimer_t safetyTimerBuffer;
+static TimerHandle_t obstacleTimer;
+static StaticTimer_t obstacleTimerBuffer;
+static logVarId_t posXId, posYId, posZId, yawId;
+STATIC_MEM_TASK_ALLOC(autonavTask, AUTONAV_TASK_STACKSIZE);
+
+static void autonavTask(void *param);
 
 // ---- utils ----
-static inline uint64_t nowUs(void){ return (uint64_t)esp_timer_get_time(); }
-static inline uint64_t msSince(uint64_t t0){ return (nowUs() - t0) / 1000ULL; }
+static inline uint64_t nowUs(void){ return usecTimestamp(); }
+static inline uint64_t msSince(uint64_t now, uint64_t t0){ return (now - t0) / 1000ULL; }
+
+static inline uint16_t saturateMs(uint64_t ms){ return ms < UINT16_MAX ? (uint16_t)ms : UINT16_MAX; }
+
+static inline bool isFlying(void){ return s_nav.state == AUTONAV_RUNNING || s_nav.state == AUTONAV_HOLD_OBSTACLE; }
+
+void autonavSetTargetAltMm(uint16_t mm){ s_nav.targetAltMm = mm; }
+autonav_state_t autonavGetState(void){ return s_nav.state; }
 
-void autonavSetTargetAltMm(uint16_t mm){ s_targetAltMm = mm; }
-autonav_state_t autonavGetState(void){ return s_state; }
+// From the cached state only, the range and the map are those of the last
+// measurements, so that it is cheap and never waits for a sensor
+void autonavGetStatus(autonav_status_t* status){
+  const uint64_t now = nowUs();
+  const autonav_state_t state = s_nav.state;
 
-void autonavKickSafety(void){ s_lastCmdUs = nowUs(); }
-void autonavEnterOverride(void) { s_state = AUTONAV_OVERRIDE; }
-void autonavExitOverride(void)  { s_lastCmdUs = nowUs(); s_state = AUTONAV_RUNNING; }
-bool autonavIsOverride(void)    { return s_state == AUTONAV_OVERRIDE; }
+  status->state = (uint8_t)state;
+  status->altMm = (uint16_t)rangeGet(rangeDown);
+  status->obstacleMm = obstacleMapNearest(0.0f, 2.0f * (float)M_PI);
+  status->cmdAgeMs = saturateMs(msSince(now, s_nav.lastCmdUs));
+  status->holdMs = state == AUTONAV_HOLD_OBSTACLE ? saturateMs(msSince(now, s_nav.obstEnterUs)) : 0;
+}
+
+void autonavKickSafety(void){
+  s_nav.lastCmdUs = nowUs();
+  if (safetyTimer){
+    xTimerReset(safetyTimer, 0);
+  }
+}
+void autonavEnterOverride(void) { s_nav.state = AUTONAV_OVERRIDE; }
+void autonavExitOverride(void)  { s_nav.lastCmdUs = nowUs(); s_nav.state = AUTONAV_RUNNING; }
+bool autonavIsOverride(void)    { return s_nav.state == AUTONAV_OVERRIDE; }
+
+static void timeoutCallback(TimerHandle_t timer){
+  xTaskNotify(taskHandle, (uint32_t)(uintptr_t)pvTimerGetTimerID(timer), eSetBits);
+}
 
 void autonavInit(void){
   autonav_crtp_start();
-  s_state = AUTONAV_IDLE;
-  s_targetAltMm = AUTONAV_DEFAULT_ALT_MM;
-  s_shapeId = 0;
-  s_lastCmdUs = nowUs();
-  s_obstEnterUs = 0;
-  z_i = 0.f; z_prevErr = 0.f; altFilt = (float)s_targetAltMm;
+  memset(&s_nav, 0, sizeof(s_nav));
+  s_nav.state = AUTONAV_IDLE;
+  s_nav.targetAltMm = AUTONAV_DEFAULT_ALT_MM;
+  s_nav.lastCmdUs = nowUs();
+  obstacleMapInit();
+  autonavMissionLock(false);
+
+  posXId = logGetVarId("stateEstimate", "x");
+  posYId = logGetVarId("stateEstimate", "y");
+  posZId = logGetVarId("stateEstimate", "z");
+  yawId = logGetVarId("stateEstimate", "yaw");
+
+  if (taskHandle == NULL){
+    taskHandle = STATIC_MEM_TASK_CREATE(autonavTask, autonavTask, AUTONAV_TASK_NAME, NULL, AUTONAV_TASK_PRI);
+    safetyTimer = xTimerCreateStatic("autonavSafety", M2T(SAFETY_TIMEOUT_MS), pdFALSE,
+      (void*)EVENT_SAFETY_TIMEOUT, timeoutCallback, &safetyTimerBuffer);
+    obstacleTimer = xTimerCreateStatic("autonavObstacle", M2T(OBSTACLE_MAX_WAIT_MS), pdFALSE,
+      (void*)EVENT_OBSTACLE_TIMEOUT, timeoutCallback, &obstacleTimerBuffer);
+  }
+  xTimerStop(obstacleTimer, 0);
+  xTimerReset(safetyTimer, 0);
+}
+
+void autonavNotify(void){
+  if (taskHandle){
+    xTaskNotify(taskHandle, EVENT_WAKE, eSetBits);
+  }
+}
+
+// New down range in the estimator, react to the front ToF within the same
+// sensor period. Nothing to do on the ground.
+void rangeDownUpdated(void){
+  if (isFlying()){
+    autonavNotify();
+  }
+}
+
+// One rest to rest piece per edge, edges given as heading and length
+static uint8_t buildPolygon(const float* headings, const float* lengths, int edges){
+  struct piecewise_traj edge;
+  struct vec p0 = vzero();
+
+  for (int i = 0; i < edges; i++){
+    struct vec p1 = vadd(p0, mkvec(lengths[i] * cosf(headings[i]), lengths[i] * sinf(headings[i]), 0));
+    edge.pieces = &s_nav.pieces[i];
+    piecewise_plan_7th_order_no_jerk(&edge, SEGMENT_TIME_MS / 1000.0f,
+      p0, 0, vzero(), 0, vzero(),
+      p1, 0, vzero(), 0, vzero());
+    p0 = p1;
+  }
+  return edges;
+}
+
+// Same path as the former velocity oval, in OVAL_PIECES pieces
+static uint8_t buildOval(void){
+  struct piecewise_traj piece;
+  const float w = 2.0f * (float)M_PI / OVAL_PERIOD_S;
+
+  for (int i = 0; i < OVAL_PIECES; i++){
+    struct vec p[2], v[2], a[2];
+    for (int j = 0; j < 2; j++){
+      float th = (i + j) * (2.0f * (float)M_PI / OVAL_PIECES);
+      p[j] = mkvec(SHAPE_SPEED / w * sinf(th), SHAPE_SPEED / 2 / w * (1.0f - cosf(th)), 0);
+      v[j] = mkvec(SHAPE_SPEED * cosf(th), SHAPE_SPEED / 2 * sinf(th), 0);
+      a[j] = mkvec(-SHAPE_SPEED * w * sinf(th), SHAPE_SPEED / 2 * w * cosf(th), 0);
+    }
+    piece.pieces = &s_nav.pieces[i];
+    piecewise_plan_7th_order_no_jerk(&piece, OVAL_PERIOD_S / OVAL_PIECES,
+      p[0], 0, v[0], 0, a[0],
+      p[1], 0, v[1], 0, a[1]);
+  }
+  return OVAL_PIECES;
+}
+
+static uint8_t buildShape(uint8_t shapeId){
+  const float L = SHAPE_SIDE_M;
+  const float pi = (float)M_PI;
+
+  switch (shapeId){
+    case 1: { // Square
+      const float h[] = {0, pi / 2, pi, -pi / 2};
+      const float l[] = {L, L, L, L};
+      return buildPolygon(h, l, 4);
+    }
+    case 2: { // Rectangle
+      const float h[] = {0, pi / 2, pi, -pi / 2};
+      const float l[] = {L, L / 2, L, L / 2};
+      return buildPolygon(h, l, 4);
+    }
+    case 3: { // Triangle
+      const float h[] = {0, 2 * pi / 3, -2 * pi / 3};
+      const float l[] = {L, L, L};
+      return buildPolygon(h, l, 3);
+    }
+    case 5: { // Pentagon
+      float h[5], l[5];
+      for (int i = 0; i < 5; i++){ h[i] = i * (2 * pi / 5); l[i] = L; }
+      return buildPolygon(h, l, 5);
+    }
+    case 4: // Oval
+      return buildOval();
+    default:
+      return 0;
+  }
+}
+
+// (Re)start the shape from the current setpoint
+static void startShapeTrajectory(void){
+  commanderEnableHighLevel(true);
+  // Hand over to the high-level commander now rather than after the timeout
+  commanderNotifySetpointsStop(0);
+  crtpCommanderHighLevelStartTrajectory(AUTONAV_TRAJECTORY_ID, 1.0f, true, false);
+}
+
+static void missionEnd(void){
+  s_nav.mission.active = false;
+  autonavMissionLock(false);
 }
 
 void autonavStartShape(uint8_t shapeId){
-    s_shapeId = shapeId;
-    s_state = AUTONAV_RUNNING;
-    shapeStartUs = nowUs();
+    missionEnd();
+    s_nav.shapeId = shapeId;
+    s_nav.nPieces = buildShape(shapeId);
+    if (s_nav.nPieces == 0){
+      autonavStop();
+      return;
+    }
+
+    const uint32_t size = s_nav.nPieces * sizeof(struct poly4d);
+    const uint32_t offset = crtpCommanderHighLevelTrajectoryMemSize() - sizeof(s_nav.pieces);
+    if (!crtpCommanderHighLevelWriteTrajectory(offset, size, (const uint8_t*)s_nav.pieces) ||
+        crtpCommanderHighLevelDefineTrajectory(AUTONAV_TRAJECTORY_ID, CRTP_CHL_TRAJECTORY_TYPE_POLY4D, offset, s_nav.nPieces) != 0){
+      autonavStop();
+      return;
+    }
+
+    startShapeTrajectory();
+    s_nav.state = AUTONAV_RUNNING;
     autonavKickSafety();
 }
 
 void autonavStop(void){
-  s_shapeId = 0;
-  s_state = AUTONAV_IDLE;
+  missionEnd();
+  if (s_nav.state == AUTONAV_RUNNING || s_nav.state == AUTONAV_HOLD_OBSTACLE){
+    crtpCommanderHighLevelStop();
+    commanderEnableHighLevel(false);
+  }
+  s_nav.shapeId = 0;
+  s_nav.state = AUTONAV_IDLE;
+}
+
+// Fly the mission from where the drone is now, on the ground or in the air
+bool autonavStartMission(void){
+  autonavMissionLock(true);
+  if (!autonavMissionValidate()){
+    autonavMissionLock(false);
+    return false;
+  }
+
+  memset(&s_nav.mission, 0, sizeof(s_nav.mission));
+  s_nav.mission.active = true;
+  s_nav.mission.origin[0] = logGetFloat(posXId);
+  s_nav.mission.origin[1] = logGetFloat(posYId);
+  s_nav.mission.pos[0] = s_nav.mission.origin[0];
+  s_nav.mission.pos[1] = s_nav.mission.origin[1];
+  s_nav.mission.altM = logGetFloat(posZId);
+  s_nav.mission.yaw = logGetFloat(yawId) * (float)M_PI / 180.0f;
+
+  s_nav.shapeId = 0;
+  commanderEnableHighLevel(true);
+  commanderNotifySetpointsStop(0);
+  s_nav.state = AUTONAV_RUNNING;
+  autonavKickSafety();
+  return true;
+}
+
+// Trajectories, only the waypoints and the altitudes are in the mission so
+// that one restarted after an obstacle ends at the same place
+static void missionGoTo(float durationS){
+  crtpCommanderHighLevelGoTo(s_nav.mission.pos[0], s_nav.mission.pos[1], s_nav.mission.altM,
+    s_nav.mission.yaw, durationS, false);
 }
 
-// Simple thrust controller to hold altitude at s_targetAltMm using down ToF
-static uint16_t zHoldThrustCmd(bool* tofOkOut){
-  uint16_t altMm;
-  bool ok = sensorsGetDownTofMm(&altMm);
-  if (tofOkOut) *tofOkOut = ok;
+// Counted jumps, the counter restarts once the loop is left
+static bool missionJumpTaken(uint16_t pc, uint8_t count){
+  int i = 0;
 
-  if (!ok){
-    // No valid ToF: gentle hover-ish thrust (don’t climb)
-    return (uint16_t)(HOVER_THRUST_BASE * 0.93f);
+  if (count == 0){
+    return true;
+  }
+  while (i < s_nav.mission.nLoops && s_nav.mission.loopPc[i] != pc){
+    i++;
+  }
+  if (i == s_nav.mission.nLoops){
+    s_nav.mission.loopPc[i] = pc;
+    s_nav.mission.loopLeft[i] = count;
+    s_nav.mission.nLoops++;
+  }
+  if (s_nav.mission.loopLeft[i] > 0){
+    s_nav.mission.loopLeft[i]--;
+    return true;
   }
 
-  // Low-pass filter ToF to reduce noise
-  altFilt = 0.9f * altFilt + 0.1f * (float)altMm;
+  s_nav.mission.nLoops--;
+  s_nav.mission.loopPc[i] = s_nav.mission.loopPc[s_nav.mission.nLoops];
+  s_nav.mission.loopLeft[i] = s_nav.mission.loopLeft[s_nav.mission.nLoops];
+  return false;
+}
 
-  float err = ((float)s_targetAltMm) - altFilt;
-  z_i += err * LOOP_DT_S;
-  if (z_i > 400.f) z_i = 400.f;      // anti-windup
-  if (z_i < -400.f) z_i = -400.f;
-  float z_d = (err - z_prevErr) / LOOP_DT_S;
-  z_prevErr = err;
+static void commandLand(void);
 
-  float thrust = HOVER_THRUST_BASE + (Z_KP*err + Z_KI*z_i + Z_KD*z_d);
+// Issue the current instruction, or wait for it to be done and go to the next
+static void missionStep(uint64_t now){
+  autonav_mission_op_t op;
 
-  if (thrust < 20000.f) thrust = 20000.f;
-  if (thrust > 65000.f) thrust = 65000.f;
+  for (int i = 0; i < MISSION_OPS_PER_UPDATE && s_nav.mission.active; i++){
+    autonavMissionFetch(s_nav.mission.pc, &op);
 
-  return (uint16_t)thrust;
+    if (s_nav.mission.isStarted){
+      const bool isDone = op.op == AUTONAV_OP_HOLD ? now >= s_nav.mission.holdEndUs :
+        crtpCommanderHighLevelIsTrajectoryFinished();
+      if (!isDone){
+        return;
+      }
+      s_nav.mission.isStarted = false;
+      s_nav.mission.pc = op.next;
+      continue;
+    }
+
+    switch (op.op){
+      case AUTONAV_OP_END:
+        // Hover at the last point, the heartbeat timeout counts from here
+        missionEnd();
+        autonavKickSafety();
+        return;
+      case AUTONAV_OP_TAKEOFF:
+        s_nav.mission.altM = op.altMm / 1000.0f;
+        crtpCommanderHighLevelTakeoffYaw(s_nav.mission.altM, op.durationMs / 1000.0f, s_nav.mission.yaw);
+        s_nav.mission.isStarted = true;
+        break;
+      case AUTONAV_OP_GOTO:
+        s_nav.mission.pos[0] = s_nav.mission.origin[0] + op.x / 1000.0f;
+        s_nav.mission.pos[1] = s_nav.mission.origin[1] + op.y / 1000.0f;
+        missionGoTo(op.durationMs / 1000.0f);
+        s_nav.mission.isStarted = true;
+        break;
+      case AUTONAV_OP_ALT:
+        s_nav.mission.altM = op.altMm / 1000.0f;
+        missionGoTo(op.durationMs / 1000.0f);
+        s_nav.mission.isStarted = true;
+        break;
+      case AUTONAV_OP_HOLD:
+        s_nav.mission.holdEndUs = now + op.durationMs * 1000ULL;
+        s_nav.mission.isStarted = true;
+        break;
+      case AUTONAV_OP_LAND:
+        missionEnd();
+        commandLand();
+        return;
+      case AUTONAV_OP_JUMP:
+        s_nav.mission.pc = missionJumpTaken(s_nav.mission.pc, op.count) ? op.target : op.next;
+        break;
+      case AUTONAV_OP_ON_OBSTACLE:
+        s_nav.mission.obstacleAction = op.action;
+        s_nav.mission.obstacleTarget = op.target;
+        s_nav.mission.pc = op.next;
+        break;
+    }
+  }
 }
 
-// Land command: ramp down thrust safely
-static void commandLand(setpoint_t* sp){
-  memset(sp, 0, sizeof(*sp));
-  sp->thrust = 0; // If you have a real land sequence, call it instead.
-  s_state = AUTONAV_LANDING;
+// What the mission does about an obstacle, false to hold as without a mission
+static bool missionObstacle(uint64_t now, bool blocked){
+  if (!blocked){
+    s_nav.mission.isObstacleHandled = false;
+    return false;
+  }
+
+  switch (s_nav.mission.obstacleAction){
+    case AUTONAV_OBSTACLE_LAND:
+      missionEnd();
+      commandLand();
+      return true;
+    case AUTONAV_OBSTACLE_JUMP:
+      // The code jumped to flies on as long as this obstacle stays
+      if (!s_nav.mission.isObstacleHandled){
+        s_nav.mission.isObstacleHandled = true;
+        s_nav.mission.pc = s_nav.mission.obstacleTarget;
+        s_nav.mission.isStarted = false;
+      }
+      missionStep(now);
+      return true;
+    default:
+      return false;
+  }
 }
 
-void autonavUpdate(uint32_t tickMs){
-  // 1) 30s safety timeout: if no app heartbeat, land.
-  if (msSince(s_lastCmdUs) > SAFETY_TIMEOUT_MS && s_state != AUTONAV_LANDING && s_state != AUTONAV_LANDED){
-    s_state = AUTONAV_LANDING;
+// Hold the target altitude in place. Height comes from the state estimate,
+// the down ranger deck driver feeds it with rangeEnqueueDownRangeInEstimator()
+// and the position controller closes the loop at the stabilizer rate.
+static void altHoldSetpoint(setpoint_t* sp){
+  sp->mode.z = modeAbs;
+  sp->position.z = s_nav.mission.active ? s_nav.mission.altM : s_nav.targetAltMm / 1000.0f;
+  sp->mode.x = modeVelocity;
+  sp->mode.y = modeVelocity;
+  sp->velocity_body = true;
+  sp->mode.yaw = modeVelocity;
+}
+
+// Land command: the high-level commander descends from the state estimate
+// at its default landing velocity, hlCommander.vland
+static void commandLand(void){
+  commanderEnableHighLevel(true);
+  // Hand over to the high-level commander now, as for the shapes
+  commanderNotifySetpointsStop(0);
+  crtpCommanderHighLevelLandWithVelocity(0.0f, 0.0f, false);
+  s_nav.state = AUTONAV_LANDING;
+}
+
+// The deadlines of the timers. A heartbeat or a cleared obstacle may come
+// between the expiry and here, the timer then runs again or the drone no
+// longer holds.
+static void autonavTimeouts(uint32_t events){
+  // 30s safety timeout: if no app heartbeat, land. A mission flies on its
+  // own, the timeout starts at its end.
+  if ((events & EVENT_SAFETY_TIMEOUT) && !xTimerIsTimerActive(safetyTimer) &&
+      isFlying() && !s_nav.mission.active){
+    commandLand();
   }
 
+  // Blocked too long -> land
+  if ((events & EVENT_OBSTACLE_TIMEOUT) && s_nav.state == AUTONAV_HOLD_OBSTACLE){
+    missionEnd();
+    commandLand();
+  }
+}
+
+void autonavUpdate(uint32_t tickMs){
+  const uint64_t now = nowUs();
+
+  // 1) The timeouts come as events, see autonavTimeouts()
+
   // 2) Build setpoint
   setpoint_t sp; memset(&sp, 0, sizeof(sp));
 
-  // Thrust for Z-hold (or idle/land)
-  bool zOk = false;
-  uint16_t thrust = zHoldThrustCmd(&zOk);
-
-  // 3) Obstacle logic (front ToF)
+  // 3) Obstacle logic, the front ToF and the ranger array meet in the map
+#ifndef CONFIG_MULTIRANGER
+  // The front ToF of the array is already in the map
   uint16_t frontMm = 0xFFFF;
-  bool frontOk = sensorsGetFrontTofMm(&frontMm);
-  bool blocked = (frontOk && frontMm < OBSTACLE_THR_MM);
-  if (s_state == AUTONAV_OVERRIDE) {
+  if (sensorsGetFrontTofMm(&frontMm)){
+    obstacleMapUpdate(0.0f, FRONT_TOF_FOV, frontMm);
+  }
+#endif
+  bool blocked = obstacleMapNearest(0.0f, 2.0f * (float)M_PI) < OBSTACLE_THR_MM;
+  if (s_nav.state == AUTONAV_OVERRIDE) {
     // Manual override: don't generate autonomous setpoints
     autonavKickSafety();   // keep safety timer alive
     return;
 }
-  switch (s_state){
+  switch (s_nav.state){
     case AUTONAV_IDLE:
-      // Keep it idle on ground (no thrust), or very low to avoid spin-ups.
-      sp.thrust = 0;
-      break;
+    case AUTONAV_LANDED:
+      // On the ground, leave the commander to whoever else is flying
+      return;
 
     case AUTONAV_RUNNING:
-    if (blocked){
-        s_state = AUTONAV_HOLD_OBSTACLE;
-        s_obstEnterUs = nowUs();
-    } else {
-        sp.thrust = thrust;   // keep altitude at 1.2 m
-
-        // --- Shape logic ---
-        uint32_t tMs = msSince(shapeStartUs);
-        uint32_t seg = (tMs / SEGMENT_TIME_MS);
-
-        switch(s_shapeId){
-            case 1: // Square
-                seg %= 4;
-                if (seg == 0) { sp.velocity.x = SHAPE_SPEED; sp.velocity.y = 0; }
-                if (seg == 1) { sp.velocity.x = 0; sp.velocity.y = SHAPE_SPEED; }
-                if (seg == 2) { sp.velocity.x = -SHAPE_SPEED; sp.velocity.y = 0; }
-                if (seg == 3) { sp.velocity.x = 0; sp.velocity.y = -SHAPE_SPEED; }
-                break;
-
-            case 2: // Rectangle
-                seg %= 4;
-                if (seg == 0) { sp.velocity.x = SHAPE_SPEED; sp.velocity.y = 0; }
-                if (seg == 1) { sp.velocity.x = 0; sp.velocity.y = SHAPE_SPEED/2; }
-                if (seg == 2) { sp.velocity.x = -SHAPE_SPEED; sp.velocity.y = 0; }
-                if (seg == 3) { sp.velocity.x = 0; sp.velocity.y = -SHAPE_SPEED/2; }
-                break;
-
-            case 3: // Triangle
-                seg %= 3;
-                if (seg == 0) { sp.velocity.x = SHAPE_SPEED; sp.velocity.y = 0; }
-                if (seg == 1) { sp.velocity.x = -SHAPE_SPEED/2; sp.velocity.y = SHAPE_SPEED*0.87f; }
-                if (seg == 2) { sp.velocity.x = -SHAPE_SPEED/2; sp.velocity.y = -SHAPE_SPEED*0.87f; }
-                break;
-
-            case 4: // Oval (approximate with sine wave)
-                sp.velocity.x = SHAPE_SPEED * cosf(tMs/1000.0f);
-                sp.velocity.y = (SHAPE_SPEED/2) * sinf(tMs/1000.0f);
-                break;
-	     case 5: // Pentagon
-                seg %= 5;
-                {
-                    float angle = seg * (2.0f * M_PI / 5.0f);  // 72° per side
-                    sp.velocity.x = SHAPE_SPEED * cosf(angle);
-                    sp.velocity.y = SHAPE_SPEED * sinf(angle);
-                }
-                break;
-        }
+    if (s_nav.mission.active && missionObstacle(now, blocked)){
+        return;
+    } else if (blocked){
+        // Stop and hold where we are, the setpoint preempts the shape
+        s_nav.state = AUTONAV_HOLD_OBSTACLE;
+        s_nav.obstEnterUs = now;
+        xTimerReset(obstacleTimer, 0);
+        altHoldSetpoint(&sp);
+        break;
+    } else if (s_nav.mission.active){
+        missionStep(now);
+    } else if (s_nav.shapeId != 0 && crtpCommanderHighLevelIsTrajectoryFinished()){
+        // Shapes loop, the next lap starts where this one ended
+        startShapeTrajectory();
     }
-    break;
+    // The high-level commander flies the shape, a setpoint would preempt it
+    return;
     case AUTONAV_HOLD_OBSTACLE:
-      // Stop XY, hold Z = 1.2m
-      sp.thrust = thrust;
-
       if (!blocked){
-        // Obstacle cleared -> resume path
-        s_state = AUTONAV_RUNNING;
-      } else if (msSince(s_obstEnterUs) > OBSTACLE_MAX_WAIT_MS){
-        // Blocked too long -> land
-        s_state = AUTONAV_LANDING;
+        // Obstacle cleared -> fly the shape or the mission step again from here
+        s_nav.state = AUTONAV_RUNNING;
+        xTimerStop(obstacleTimer, 0);
+        if (s_nav.mission.active){
+          commanderNotifySetpointsStop(0);
+          s_nav.mission.isStarted = false;
+          missionStep(now);
+        } else if (s_nav.shapeId != 0){
+          startShapeTrajectory();
+        } else {
+          commanderNotifySetpointsStop(0);
+        }
+        return;
+      } else {
+        altHoldSetpoint(&sp);
       }
       break;
 
     case AUTONAV_LANDING:
-      commandLand(&sp);
-      // After sending zero thrust once, mark as landed.
-      s_state = AUTONAV_LANDED;
-      break;
-
-    case AUTONAV_LANDED:
-      sp.thrust = 0;
-      break;
+      // The planner stops once on the ground, and the commander cuts the motors
+      if (crtpCommanderHighLevelIsStopped()){
+        commanderEnableHighLevel(false);
+        s_nav.state = AUTONAV_LANDED;
+      }
+      return;
   case AUTONAV_OVERRIDE:
     // Manual override: don’t run auto-nav logic, let commander take over.
     break;
   }
 
   // Send setpoint (roll/pitch/yaw zeroed; you’ll add XY later)
-  commanderSetSetpoint(&sp, tickMs);
+  commanderSetSetpoint(&sp, COMMANDER_PRIORITY_CRTP);
+}
+
+// Runs on new range measurements, app commands and timeouts, and at
+// AUTONAV_ACTIVE_PERIOD_MS when flying so the setpoints do not depend on the
+// ranger, and while landing. Sleeps when on the ground.
+static void autonavTask(void *param){
+  systemWaitStart();
+
+  while (true){
+    const bool isActive = isFlying() || s_nav.state == AUTONAV_LANDING;
+    uint32_t events = 0;
+    xTaskNotifyWait(0, UINT32_MAX, &events, isActive ? M2T(AUTONAV_ACTIVE_PERIOD_MS) : portMAX_DELAY);
+    autonavTimeouts(events);
+    autonavUpdate(T2M(xTaskGetTickCount()));
+  }
+}
+
+
+
+static uint8_t logState(uint32_t timestamp, void* data){
+  return (uint8_t)s_nav.state;
 }
 
+// Time since the last app command, the app is lost at SAFETY_TIMEOUT_MS
+static uint16_t logCmdAge(uint32_t timestamp, void* data){
+  return saturateMs(msSince(nowUs(), s_nav.lastCmdUs));
+}
+
+// Time held in front of an obstacle, landing at OBSTACLE_MAX_WAIT_MS
+static uint16_t logHoldTime(uint32_t timestamp, void* data){
+  return s_nav.state == AUTONAV_HOLD_OBSTACLE ? saturateMs(msSince(nowUs(), s_nav.obstEnterUs)) : 0;
+}
 
+// The altitude and the obstacle distance are range.zrange and obstMap.nearest
+LOG_GROUP_START(autonav)
+LOG_ADD_BY_GETTER(LOG_UINT8, state, logState, NULL)
+LOG_ADD(LOG_UINT16, targetAlt, &s_nav.targetAltMm)
+LOG_ADD_BY_GETTER(LOG_UINT16, cmdAge, logCmdAge, NULL)
+LOG_ADD_BY_GETTER(LOG_UINT16, holdTime, logHoldTime, NULL)
+LOG_ADD(LOG_UINT16, missionPc, &s_nav.mission.pc)
+LOG_GROUP_STOP(autonav)
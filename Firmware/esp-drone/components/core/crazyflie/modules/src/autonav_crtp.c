@@ -5,6 +5,9 @@
 
 #include "autonav.h"
 #include "autonav_crtp.h"
+#include "config.h"
+#include "static_mem.h"
+#include "stm32_legacy.h"
 
 // --- Optional: use CRTP if available, otherwise compile to no-op ---
 #if __has_include("crtp.h")
@@ -14,8 +17,7 @@
   #define AUTONAV_HAVE_CRTP 0
 #endif
 
-// If you have a down-ToF accessor, declare it so we can export status
-extern bool sensorsGetDownTofMm(uint16_t* out_mm);
+STATIC_MEM_TASK_ALLOC(autonavCrtpTask, AUTONAV_CRTP_TASK_STACKSIZE);
 
 // Small helper
 static inline uint16_t u16le(const uint8_t *p) { return (uint16_t)(p[0] | (p[1] << 8)); }
@@ -55,6 +57,11 @@ static void autonav_handle_packet(const CRTPPacket* pk)
       autonavKickSafety();
       break;
 
+    case AUTONAV_CMD_MISSION:
+      autonavStartMission();
+      autonavKickSafety();
+      break;
+
     case AUTONAV_CMD_SET_ALT_MM: {
       if (pk->size >= 3) {
         uint16_t mm = u16le(&pk->data[1]);
@@ -78,31 +85,46 @@ static void autonav_handle_packet(const CRTPPacket* pk)
       break;
   }
 
-  // Optional: send back a tiny status frame (same port/ch)
+  // Act on the command now rather than on the next range measurement
+  autonavNotify();
+}
+
+// The status goes out on its own period rather than as the reply of each
+// command, from cached values and without waiting for room in the TX queue:
+// a full queue drops a status, never delays the next command, STOP included
+static void autonav_send_status(void)
+{
   CRTPPacket out = {0};
+  autonav_status_t s;
+
   out.port = AUTONAV_CRTP_PORT;
   out.channel = AUTONAV_CRTP_CH;
   out.size = sizeof(autonav_status_t);
-  autonav_status_t s = {0};
-  s.state = (uint8_t)autonavGetState();
-  uint16_t alt = 0;
-  (void)sensorsGetDownTofMm(&alt);
-  s.altMm = alt;
+  autonavGetStatus(&s);
 
   memcpy(out.data, &s, sizeof(s));
-  crtpSendPacketBlock(&out);
+  crtpSendPacket(&out);
 }
 #endif // AUTONAV_HAVE_CRTP
 
 static void autonav_crtp_task(void *arg)
 {
 #if AUTONAV_HAVE_CRTP
-  // Passive receiver loop: pull packets and parse ours
+  TickType_t lastStatus = xTaskGetTickCount();
+
+  // Commands as they come, the status in between on its period
   for (;;) {
-    CRTPPacket pk = {0};
-    if (crtpReceivePacketBlock(&pk) == 0) {
+    CRTPPacket pk;
+    const TickType_t elapsed = xTaskGetTickCount() - lastStatus;
+    const int waitMs = elapsed < M2T(AUTONAV_STATUS_PERIOD_MS) ? T2M(M2T(AUTONAV_STATUS_PERIOD_MS) - elapsed) : 0;
+
+    if (crtpReceivePacketWait(AUTONAV_CRTP_PORT, &pk, waitMs) == pdTRUE) {
       autonav_handle_packet(&pk);
     }
+    if (xTaskGetTickCount() - lastStatus >= M2T(AUTONAV_STATUS_PERIOD_MS)) {
+      lastStatus = xTaskGetTickCount();
+      autonav_send_status();
+    }
   }
 #else
   // No CRTP on this platform build: keep task alive, do nothing.
@@ -115,5 +137,8 @@ void autonav_crtp_start(void)
   static bool started = false;
   if (started) return;
   started = true;
-  xTaskCreate(autonav_crtp_task, "autonav_crtp", 2048, NULL, tskIDLE_PRIORITY+2, NULL);
+#if AUTONAV_HAVE_CRTP
+  crtpInitTaskQueue(AUTONAV_CRTP_PORT);
+#endif
+  STATIC_MEM_TASK_CREATE(autonavCrtpTask, autonav_crtp_task, AUTONAV_CRTP_TASK_NAME, NULL, AUTONAV_CRTP_TASK_PRI);
 }
@@ -0,0 +1,151 @@
+#include "autonav_mission.h"
+#include <string.h>
+
+#include "mem.h"
+
+// Instruction sizes, opcode included
+static const uint8_t opSize[] = {
+  [AUTONAV_OP_END]         = 1,
+  [AUTONAV_OP_TAKEOFF]     = 5,
+  [AUTONAV_OP_GOTO]        = 7,
+  [AUTONAV_OP_ALT]         = 5,
+  [AUTONAV_OP_HOLD]        = 3,
+  [AUTONAV_OP_LAND]        = 1,
+  [AUTONAV_OP_JUMP]        = 4,
+  [AUTONAV_OP_ON_OBSTACLE] = 4,
+};
+#define NBR_OF_OPS (sizeof(opSize) / sizeof(opSize[0]))
+
+static bool isInit;
+static uint8_t store[AUTONAV_MISSION_SIZE];
+static volatile bool isLocked;
+
+static uint32_t handleMemGetSize(void) { return AUTONAV_MISSION_SIZE; }
+static bool handleMemRead(const uint32_t memAddr, const uint8_t readLen, uint8_t* buffer);
+static bool handleMemWrite(const uint32_t memAddr, const uint8_t writeLen, const uint8_t* buffer);
+static const MemoryHandlerDef_t memDef = {
+  .type = MEM_TYPE_AUTONAV_MISSION,
+  .getSize = handleMemGetSize,
+  .read = handleMemRead,
+  .write = handleMemWrite,
+};
+
+void autonavMissionInit(void){
+  if (isInit){
+    return;
+  }
+
+  memoryRegisterHandler(&memDef);
+  isInit = true;
+}
+
+void autonavMissionLock(bool locked){ isLocked = locked; }
+
+bool autonavMissionWrite(uint32_t addr, uint32_t len, const uint8_t* data){
+  if (isLocked || addr + len > AUTONAV_MISSION_SIZE){
+    return false;
+  }
+
+  if (addr == 0){
+    memset(store, AUTONAV_OP_END, sizeof(store));
+  }
+  memcpy(&store[addr], data, len);
+  return true;
+}
+
+static inline uint16_t u16At(uint16_t addr){ return (uint16_t)(store[addr] | (store[addr + 1] << 8)); }
+
+static bool decode(uint16_t addr, autonav_mission_op_t* op){
+  if (addr >= AUTONAV_MISSION_SIZE || store[addr] >= NBR_OF_OPS || opSize[store[addr]] == 0){
+    return false;
+  }
+  const uint8_t size = opSize[store[addr]];
+  if (addr + size > AUTONAV_MISSION_SIZE){
+    return false;
+  }
+
+  memset(op, 0, sizeof(*op));
+  op->op = (autonav_op_t)store[addr];
+  op->next = addr + size;
+  switch (op->op){
+    case AUTONAV_OP_TAKEOFF:
+    case AUTONAV_OP_ALT:
+      op->altMm = u16At(addr + 1);
+      op->durationMs = u16At(addr + 3);
+      break;
+    case AUTONAV_OP_GOTO:
+      op->x = (int16_t)u16At(addr + 1);
+      op->y = (int16_t)u16At(addr + 3);
+      op->durationMs = u16At(addr + 5);
+      break;
+    case AUTONAV_OP_HOLD:
+      op->durationMs = u16At(addr + 1);
+      break;
+    case AUTONAV_OP_JUMP:
+      op->target = u16At(addr + 1);
+      op->count = store[addr + 3];
+      break;
+    case AUTONAV_OP_ON_OBSTACLE:
+      op->action = store[addr + 1];
+      op->target = u16At(addr + 2);
+      break;
+    default:
+      break;
+  }
+  return true;
+}
+
+bool autonavMissionValidate(void){
+  // Where the instructions start, the jumps must land on one
+  uint8_t isStart[AUTONAV_MISSION_SIZE / 8] = {0};
+  autonav_mission_op_t op;
+  int loops = 0;
+
+  for (uint16_t addr = 0; addr < AUTONAV_MISSION_SIZE; addr = op.next){
+    if (!decode(addr, &op)){
+      return false;
+    }
+    isStart[addr / 8] |= 1 << (addr % 8);
+    if (op.op == AUTONAV_OP_JUMP && op.count > 0){
+      loops++;
+    }
+    if (op.op == AUTONAV_OP_ON_OBSTACLE && op.action > AUTONAV_OBSTACLE_JUMP){
+      return false;
+    }
+    // The planner needs time for a trajectory
+    const bool isMotion = op.op == AUTONAV_OP_TAKEOFF || op.op == AUTONAV_OP_GOTO || op.op == AUTONAV_OP_ALT;
+    if (isMotion && op.durationMs == 0){
+      return false;
+    }
+  }
+  if (loops > AUTONAV_MISSION_MAX_LOOPS){
+    return false;
+  }
+
+  for (uint16_t addr = 0; addr < AUTONAV_MISSION_SIZE; addr = op.next){
+    decode(addr, &op);
+    const bool isJump = op.op == AUTONAV_OP_JUMP ||
+      (op.op == AUTONAV_OP_ON_OBSTACLE && op.action == AUTONAV_OBSTACLE_JUMP);
+    if (isJump && (op.target >= AUTONAV_MISSION_SIZE || !(isStart[op.target / 8] & (1 << (op.target % 8))))){
+      return false;
+    }
+  }
+  return true;
+}
+
+bool autonavMissionFetch(uint16_t addr, autonav_mission_op_t* op){
+  return decode(addr, op);
+}
+
+static bool handleMemRead(const uint32_t memAddr, const uint8_t readLen, uint8_t* buffer){
+  if (memAddr + readLen > AUTONAV_MISSION_SIZE){
+    return false;
+  }
+
+  memcpy(buffer, &store[memAddr], readLen);
+  return true;
+}
+
+static bool handleMemWrite(const uint32_t memAddr, const uint8_t writeLen, const uint8_t* buffer){
+  return autonavMissionWrite(memAddr, writeLen, buffer);
+}
@@ -48,6 +48,46 @@ static struct vec3_s svec2vec(struct vec v)
   return vv;
 }
 
+// Projects v into the polytope Ax <= B, as vprojectpolytope() does. For half
+// spaces Dykstra's algorithm keeps one multiplier per face, duals[i] times the
+// unit row i being the correction of face i, and x = v - sum of them. Any
+// multipliers >= 0 are a valid start, so the ones of the previous solve warm
+// start this one. Adds the iterations to *iters.
+static struct vec projectPolytopeWarm(
+  struct vec v, float const A[], float const B[], float duals[], int nRows,
+  float tolerance, int maxIters, int *iters)
+{
+  if (vinpolytope(v, A, B, nRows, tolerance)) {
+    return v;
+  }
+
+  struct vec x = v;
+  for (int i = 0; i < nRows; ++i) {
+    x = vsub(x, vscl(duals[i], vloadf(A + 3 * i)));
+  }
+
+  // The stopping criterion of vprojectpolytope(), the corrections of the
+  // faces are along the unit rows.
+  float const tolerance2 = nRows * fsqr(tolerance) / 10.0f;
+
+  for (int iter = 0; iter < maxIters; ++iter) {
+    float c = 0.0f;
+    for (int i = 0; i < nRows; ++i) {
+      struct vec const ai = vloadf(A + 3 * i);
+      struct vec const y = vadd(x, vscl(duals[i], ai));
+      float const dual = fmaxf(0.0f, vdot(ai, y) - B[i]);
+      x = vsub(y, vscl(dual, ai));
+      c += fsqr(dual - duals[i]);
+      duals[i] = dual;
+    }
+    ++*iters;
+    if (c < tolerance2) {
+      break;
+    }
+  }
+  return x;
+}
+
 // Computes a new goal position inside our buffered Voronoi cell.
 //
 // "Sidestep" dentoes a behavior to avoid deadlock when two robots are
@@ -65,14 +105,15 @@ static struct vec3_s svec2vec(struct vec v)
 //     so we should go ahead and begin the sidestep.
 //   A: LHS matrix for polytope inequality Ax <= B. Dimension [nRows * 3].
 //   B: RHS vector for polytope inequality Ax <= B. Dimension [nRows].
-//   projectionWorkspace: Additional scratch area. Dimension [nRows * 3].
+//   duals: Multipliers of the projection, see projectPolytopeWarm(). Dimension [nRows].
 //   nRows: Number of rows in our cell polytope inequality.
+//   iters: Iterations of the projection are added here.
 //
 static struct vec sidestepGoal(
   collision_avoidance_params_t const *params,
   struct vec goal,
   bool modifyIfInside,
-  float const A[], float const B[], float projectionWorkspace[], int nRows)
+  float const A[], float const B[], float duals[], int nRows, int *iters)
 {
   float const rayScale = rayintersectpolytope(vzero(), goal, A, B, nRows, NULL);
   if (rayScale >= 1.0f && !modifyIfInside) {
@@ -86,11 +127,12 @@ static struct vec sidestepGoal(
     goal = vadd(goal, vscl(sidestepAmount, sidestepDir));
   }
   // Otherwise no sidestep, but still project
-  return vprojectpolytope(
+  return projectPolytopeWarm(
     goal,
-    A, B, projectionWorkspace, nRows,
+    A, B, duals, nRows,
     params->voronoiProjectionTolerance,
-    params->voronoiProjectionMaxIters
+    params->voronoiProjectionMaxIters,
+    iters
   );
 }
 
@@ -109,7 +151,20 @@ void collisionAvoidanceUpdateSetpointCore(
   int const nRows = nOthers + 6;
   float *A = workspace;
   float *B = workspace + 3 * nRows;
-  float *projectionWorkspace = workspace + 4 * nRows;
+
+  // Warm start from the previous solve when it had the same faces
+  float *duals = workspace + 4 * nRows;
+  if (collisionState->duals != NULL && collisionState->dualsCapacity >= nRows) {
+    duals = collisionState->duals;
+  }
+  if (duals != collisionState->duals || collisionState->dualsRows != nRows) {
+    memset(duals, 0, nRows * sizeof(float));
+  }
+  if (duals == collisionState->duals) {
+    collisionState->dualsRows = nRows;
+  }
+  int *iters = &collisionState->projectionIters;
+  *iters = 0;
 
   // Compute the cell in a stretched coordinate system for downwash awareness.
   // See header for details.
@@ -161,7 +216,7 @@ void collisionAvoidanceUpdateSetpointCore(
     if (vinpolytope(vzero(), A, B, nRows, inPolytopeTolerance)) {
       // Typical case - our current position is within our cell.
       struct vec pseudoGoal = vscl(params->horizonSecs, setVel);
-      pseudoGoal = sidestepGoal(params, pseudoGoal, true, A, B, projectionWorkspace, nRows);
+      pseudoGoal = sidestepGoal(params, pseudoGoal, true, A, B, duals, nRows, iters);
       if (vinpolytope(pseudoGoal, A, B, nRows, inPolytopeTolerance)) {
         setVel = vdiv(pseudoGoal, params->horizonSecs);
       }
@@ -173,11 +228,12 @@ void collisionAvoidanceUpdateSetpointCore(
     else {
       // Atypical case - our current position is not within our cell. Forget
       // about the original goal velocity and try to move towards our cell.
-      struct vec nearestInCell = vprojectpolytope(
+      struct vec nearestInCell = projectPolytopeWarm(
         vzero(),
-        A, B, projectionWorkspace, nRows,
+        A, B, duals, nRows,
         params->voronoiProjectionTolerance,
-        params->voronoiProjectionMaxIters
+        params->voronoiProjectionMaxIters,
+        iters
       );
       if (vinpolytope(nearestInCell, A, B, nRows, inPolytopeTolerance)) {
         setVel = vclampnorm(nearestInCell, params->maxSpeed);
@@ -193,7 +249,7 @@ void collisionAvoidanceUpdateSetpointCore(
 
     struct vec const setPosRelative = vsub(setPos, ourPos);
     struct vec const setPosRelativeNew = sidestepGoal(
-      params, setPosRelative, false, A, B, projectionWorkspace, nRows);
+      params, setPosRelative, false, A, B, duals, nRows, iters);
 
     if (!vinpolytope(setPosRelativeNew, A, B, nRows, inPolytopeTolerance)) {
       // If the projection algorithm failed to converge, then either
@@ -255,19 +311,27 @@ void collisionAvoidanceUpdateSetpointCore(
 
 //
 // Everything below this comment will only be compiled in a firware build made
-// with the standard Makefile. Everything depending on FreeRTOS, ARM, params,
-// etc. must go here.
+// with the standard Makefile or with ESP-IDF. Everything depending on
+// FreeRTOS, params, etc. must go here.
 //
-#ifdef CRAZYFLIE_FW
+#if defined(CRAZYFLIE_FW) || defined(ESP_PLATFORM)
 
 #include "FreeRTOS.h"
 #include "task.h"
+#include "queue.h"
 
+#include "config.h"
 #include "param.h"
 #include "log.h"
+#include "obstacle_map.h"
+#include "static_mem.h"
+#include "stm32_legacy.h"
+#include "system.h"
+#include "usec_time.h"
 
 
 static uint8_t collisionAvoidanceEnable = 0;
+static uint8_t collisionAvoidanceObstacles = 1;
 
 static collision_avoidance_params_t params = {
   .ellipsoidRadii = { .x = 0.3, .y = 0.3, .z = 0.9 },
@@ -281,47 +345,38 @@ static collision_avoidance_params_t params = {
   .voronoiProjectionMaxIters = 100,
 };
 
+// Each face of the Voronoi cell is defined by a linear inequality a^T x <= b.
+// The algorithm for projecting a point into a convex polytope requires 1 more
+// float of working space per face. The six extra faces come from the overall
+// flight area bounding box, and there is up to one face per obstacle map
+// sector.
+#define MAX_CELL_ROWS (PEER_LOCALIZATION_MAX_NEIGHBORS + OBSTACLE_MAP_SECTORS + 6)
+static float workspace[5 * MAX_CELL_ROWS];
+static float duals[MAX_CELL_ROWS];
+
 static collision_avoidance_state_t collisionState = {
   .lastFeasibleSetPosition = { .x = NAN, .y = NAN, .z = NAN },
+  .duals = duals,
+  .dualsCapacity = MAX_CELL_ROWS,
 };
 
-void collisionAvoidanceInit()
-{
-}
-
-bool collisionAvoidanceTest()
-{
-  return true;
-}
-
-// Each face of the Voronoi cell is defined by a linear inequality a^T x <= b.
-// The algorithm for projecting a point into a convex polytope requires 3 more
-// floats of working space per face. The six extra faces come from the overall
-// flight area bounding box.
-#define MAX_CELL_ROWS (PEER_LOCALIZATION_MAX_NEIGHBORS + 6)
-static float workspace[7 * MAX_CELL_ROWS];
-
 // Latency counter for logging.
 static uint32_t latency = 0;
 
-void collisionAvoidanceUpdateSetpoint(
-  setpoint_t *setpoint, sensorData_t const *sensorData, state_t const *state, uint32_t tick)
+// Fills the workspace with the positions of the neighbors and the obstacles
+static int collectOthers(state_t const *state, TickType_t time)
 {
-  if (!collisionAvoidanceEnable) {
-    return;
-  }
-
-  TickType_t const time = xTaskGetTickCount();
   bool doAgeFilter = params.maxPeerLocAgeMillis >= 0;
 
   // Counts the actual number of neighbors after we filter stale measurements.
   int nOthers = 0;
+  int const nNeighbors = peerLocalizationGetNeighborCount();
 
-  for (int i = 0; i < PEER_LOCALIZATION_MAX_NEIGHBORS; ++i) {
+  for (int i = 0; i < nNeighbors; ++i) {
 
     peerLocalizationOtherPosition_t const *otherPos = peerLocalizationGetPositionByIdx(i);
 
-    if (otherPos == NULL || otherPos->id == 0) {
+    if (otherPos == NULL) {
       continue;
     }
 
@@ -335,18 +390,231 @@ void collisionAvoidanceUpdateSetpoint(
     ++nOthers;
   }
 
+  // Obstacles do not move, so a neighbor twice as far puts the cell face at
+  // the obstacle minus our radius. The setpoint then slides along the
+  // obstacle through the sidestep instead of stopping in front of it.
+  if (collisionAvoidanceObstacles) {
+    float const yaw = radians(state->attitude.yaw);
+
+    for (int i = 0; i < OBSTACLE_MAP_SECTORS; ++i) {
+      uint16_t const rangeMm = obstacleMapSectorRange(i);
+
+      if (rangeMm == OBSTACLE_MAP_NONE) {
+        continue;
+      }
+
+      float const bearing = yaw + obstacleMapSectorBearing(i);
+      float const distance = 2.0f * rangeMm / 1000.0f;
+      workspace[3 * nOthers + 0] = state->position.x + distance * cosf(bearing);
+      workspace[3 * nOthers + 1] = state->position.y + distance * sinf(bearing);
+      workspace[3 * nOthers + 2] = state->position.z;
+      ++nOthers;
+    }
+  }
+
+  return nOthers;
+}
+
+void collisionAvoidanceUpdateSetpoint(
+  setpoint_t *setpoint, sensorData_t const *sensorData, state_t const *state, uint32_t tick)
+{
+  if (!collisionAvoidanceEnable) {
+    return;
+  }
+
+  TickType_t const time = xTaskGetTickCount();
+  int const nOthers = collectOthers(state, time);
+
   collisionAvoidanceUpdateSetpointCore(&params, &collisionState, nOthers, workspace, workspace, setpoint, sensorData, state);
 
   latency = xTaskGetTickCount() - time;
 }
 
+#ifdef CONFIG_COLLISION_AVOIDANCE_TASK
+
+#define COLAV_RATE            CONFIG_COLLISION_AVOIDANCE_RATE_HZ
+// A solve older than this many periods is not applied any more
+#define COLAV_MAX_AGE_PERIODS 3
+// Share of the new delta per stabilizer loop, about one period to settle
+#define COLAV_FILTER_GAIN     ((float)COLAV_RATE / RATE_MAIN_LOOP)
+
+typedef struct {
+  setpoint_t setpoint;
+  state_t state;
+  uint32_t tick;
+} colAvInput_t;
+
+// What the solve changed on its setpoint
+typedef struct {
+  struct vec3_s positionDelta;
+  struct vec3_s velocityDelta;
+  stab_mode_t modeX;
+  uint32_t tick;
+} colAvResult_t;
+
+STATIC_MEM_QUEUE_ALLOC(colAvInputQueue, 1, sizeof(colAvInput_t));
+static xQueueHandle inputQueue;
+STATIC_MEM_QUEUE_ALLOC(colAvResultQueue, 1, sizeof(colAvResult_t));
+static xQueueHandle resultQueue;
+
+STATIC_MEM_TASK_ALLOC(collisionAvoidanceTask, COLAV_TASK_STACKSIZE);
+static void collisionAvoidanceTask(void *param);
+
+// Time budget of one solve, the iterations of the projection are capped to fit
+static uint32_t budgetUs = CONFIG_COLLISION_AVOIDANCE_BUDGET_US;
+static float usPerIter;
+static int32_t iterCap;
+
+static uint32_t solveUs;
+static int32_t solveIters;
+static uint32_t staleCount;
+
+// Stabilizer task only
+static struct vec3_s positionDelta;
+static struct vec3_s velocityDelta;
+
+static void startTask(void)
+{
+  inputQueue = STATIC_MEM_QUEUE_CREATE(colAvInputQueue);
+  resultQueue = STATIC_MEM_QUEUE_CREATE(colAvResultQueue);
+  STATIC_MEM_TASK_CREATE(collisionAvoidanceTask, collisionAvoidanceTask, COLAV_TASK_NAME, NULL, COLAV_TASK_PRI);
+}
+
+static void updateIterCap(uint32_t us, int iters)
+{
+  // Slow to follow, one slow solve does not halve the next ones
+  if (iters > 0) {
+    float const sample = (float)us / iters;
+    usPerIter = (usPerIter == 0.0f) ? sample : usPerIter + 0.1f * (sample - usPerIter);
+  }
+
+  int32_t cap = params.voronoiProjectionMaxIters;
+  if (usPerIter > 0.0f && budgetUs / usPerIter < cap) {
+    cap = budgetUs / usPerIter;
+  }
+  iterCap = cap > 1 ? cap : 1;
+}
+
+static void collisionAvoidanceTask(void *param)
+{
+  systemWaitStart();
+
+  TickType_t lastWakeTime = xTaskGetTickCount();
+  iterCap = params.voronoiProjectionMaxIters;
+
+  while (1) {
+    vTaskDelayUntil(&lastWakeTime, F2T(COLAV_RATE));
+
+    colAvInput_t input;
+    if (!collisionAvoidanceEnable || xQueuePeek(inputQueue, &input, 0) != pdTRUE) {
+      continue;
+    }
+
+    uint64_t const start = usecTimestamp();
+    int const nOthers = collectOthers(&input.state, xTaskGetTickCount());
+
+    collision_avoidance_params_t budgeted = params;
+    if (budgeted.voronoiProjectionMaxIters > iterCap) {
+      budgeted.voronoiProjectionMaxIters = iterCap;
+    }
+    setpoint_t avoided = input.setpoint;
+    collisionAvoidanceUpdateSetpointCore(&budgeted, &collisionState, nOthers, workspace, workspace, &avoided, NULL, &input.state);
+
+    solveUs = usecTimestamp() - start;
+    solveIters = collisionState.projectionIters;
+    updateIterCap(solveUs, solveIters);
+
+    colAvResult_t const result = {
+      .positionDelta = {
+        .x = avoided.position.x - input.setpoint.position.x,
+        .y = avoided.position.y - input.setpoint.position.y,
+        .z = avoided.position.z - input.setpoint.position.z,
+      },
+      .velocityDelta = {
+        .x = avoided.velocity.x - input.setpoint.velocity.x,
+        .y = avoided.velocity.y - input.setpoint.velocity.y,
+        .z = avoided.velocity.z - input.setpoint.velocity.z,
+      },
+      .modeX = input.setpoint.mode.x,
+      .tick = input.tick,
+    };
+    xQueueOverwrite(resultQueue, &result);
+    latency = T2M(xTaskGetTickCount() - lastWakeTime);
+  }
+}
+
+static void filterDelta(struct vec3_s *filtered, struct vec3_s const *delta)
+{
+  filtered->x += COLAV_FILTER_GAIN * (delta->x - filtered->x);
+  filtered->y += COLAV_FILTER_GAIN * (delta->y - filtered->y);
+  filtered->z += COLAV_FILTER_GAIN * (delta->z - filtered->z);
+}
+
+void collisionAvoidanceFilterSetpoint(setpoint_t *setpoint, state_t const *state, uint32_t tick)
+{
+  if (!collisionAvoidanceEnable) {
+    return;
+  }
+
+  if (RATE_DO_EXECUTE(COLAV_RATE, tick)) {
+    colAvInput_t const input = { .setpoint = *setpoint, .state = *state, .tick = tick };
+    xQueueOverwrite(inputQueue, &input);
+  }
+
+  colAvResult_t result;
+  if (xQueuePeek(resultQueue, &result, 0) != pdTRUE) {
+    return;
+  }
+
+  if (tick - result.tick > COLAV_MAX_AGE_PERIODS * (RATE_MAIN_LOOP / COLAV_RATE) ||
+      result.modeX != setpoint->mode.x) {
+    // Start over from the setpoint when the solves come back
+    static struct vec3_s const zero;
+    positionDelta = zero;
+    velocityDelta = zero;
+    staleCount++;
+    return;
+  }
+
+  filterDelta(&positionDelta, &result.positionDelta);
+  filterDelta(&velocityDelta, &result.velocityDelta);
+
+  setpoint->position.x += positionDelta.x;
+  setpoint->position.y += positionDelta.y;
+  setpoint->position.z += positionDelta.z;
+  setpoint->velocity.x += velocityDelta.x;
+  setpoint->velocity.y += velocityDelta.y;
+  setpoint->velocity.z += velocityDelta.z;
+}
+
+#endif // CONFIG_COLLISION_AVOIDANCE_TASK
+
+void collisionAvoidanceInit()
+{
+#ifdef CONFIG_COLLISION_AVOIDANCE_TASK
+  startTask();
+#endif
+}
+
+bool collisionAvoidanceTest()
+{
+  return true;
+}
+
 LOG_GROUP_START(colAv)
   LOG_ADD(LOG_UINT32, latency, &latency)
+#ifdef CONFIG_COLLISION_AVOIDANCE_TASK
+  LOG_ADD(LOG_UINT32, solveUs, &solveUs)
+  LOG_ADD(LOG_INT32, iters, &solveIters)
+  LOG_ADD(LOG_INT32, iterCap, &iterCap)
+  LOG_ADD(LOG_UINT32, stale, &staleCount)
+#endif
 LOG_GROUP_STOP(colAv)
 
 
 PARAM_GROUP_START(colAv)
   PARAM_ADD(PARAM_UINT8, enable, &collisionAvoidanceEnable)
+  PARAM_ADD(PARAM_UINT8, obstacles, &collisionAvoidanceObstacles)
 
   PARAM_ADD(PARAM_FLOAT, ellipsoidX, &params.ellipsoidRadii.x)
   PARAM_ADD(PARAM_FLOAT, ellipsoidY, &params.ellipsoidRadii.y)
@@ -366,6 +634,9 @@ PARAM_GROUP_START(colAv)
   PARAM_ADD(PARAM_INT32, maxPeerLocAge, &params.maxPeerLocAgeMillis)
   PARAM_ADD(PARAM_FLOAT, vorTol, &params.voronoiProjectionTolerance)
   PARAM_ADD(PARAM_INT32, vorIters, &params.voronoiProjectionMaxIters)
+#ifdef CONFIG_COLLISION_AVOIDANCE_TASK
+  PARAM_ADD(PARAM_UINT32, budgetUs, &budgetUs)
+#endif
 PARAM_GROUP_STOP(colAv)
 
-#endif  // CRAZYFLIE_FW
+#endif  // CRAZYFLIE_FW or ESP_PLATFORM
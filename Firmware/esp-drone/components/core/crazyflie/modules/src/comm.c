@@ -25,6 +25,9 @@
  */
 
 #include <stdbool.h>
+
+#include "sdkconfig.h"
+
 #define DEBUG_MODULE "COMM"
 #include "comm.h"
 #include "config.h"
@@ -37,8 +40,11 @@
 #include "log.h"
 #include  "wifi_esp32.h"
 #include "wifilink.h"
+#include "espnowlink.h"
+#include "usbcdclink.h"
 #include "platformservice.h"
 #include "crtp_localization_service.h"
+#include "time_sync.h"
 
 static bool isInit;
 
@@ -53,12 +59,20 @@ void commInit(void)
     //crtpInit();
     //consoleInit();
 
+#ifdef CONFIG_ESPNOW_LINK
+    espnowlinkInit();
+    crtpSetLink(espnowlinkGetLink());
+    usbcdclinkInit(espnowlinkGetLink());
+#else
     crtpSetLink(wifilinkGetLink());
+    usbcdclinkInit(wifilinkGetLink());
+#endif
     crtpserviceInit();
     platformserviceInit();
     logInit();
     paramInit();
-    //locSrvInit();
+    timeSyncInit();
+    locSrvInit();
 
   //setup CRTP communication channel
   //TODO: check for USB first and prefer USB over radio
@@ -73,6 +87,10 @@ bool commTest(void)
 {
 	bool pass = isInit;
 	pass &= wifilinkTest();
+#ifdef CONFIG_ESPNOW_LINK
+	pass &= espnowlinkTest();
+#endif
+	pass &= usbcdclinkTest();
 	DEBUG_PRINTI("wifilinkTest = %d ", pass);
 	pass &= crtpTest();
 	DEBUG_PRINTI("crtpTest = %d ", pass);
@@ -23,11 +23,12 @@
  *
  *
  */
+#include <stddef.h>
 #include <string.h>
 
 #include "FreeRTOS.h"
 #include "task.h"
-#include "queue.h"
+#include "queuemonitor.h"
 
 #include "commander.h"
 #include "crtp_commander.h"
@@ -36,32 +37,77 @@
 #include "cf_math.h"
 #include "param.h"
 #include "stm32_legacy.h"
-#include "static_mem.h"
 
 static bool isInit;
 const static setpoint_t nullSetpoint;
-static setpoint_t tempSetpoint;
 static state_t lastState;
 const static int priorityDisable = COMMANDER_PRIORITY_DISABLE;
 
 static uint32_t lastUpdate;
 static bool enableHighLevel = false;
 
-static QueueHandle_t setpointQueue;
-STATIC_MEM_QUEUE_ALLOC(setpointQueue, 1, sizeof(setpoint_t));
-static QueueHandle_t priorityQueue;
-STATIC_MEM_QUEUE_ALLOC(priorityQueue, 1, sizeof(int));
+/*
+ * Failsafe landing. When the setpoints of a flight with height control stop
+ * coming, the high-level planner lands from the state estimate instead of
+ * leveling and then cutting the motors. The landing is posted to the
+ * high-level commander task and planned there, planning in the stabilizer
+ * could wait on a command being planned. Until it is planned the commander
+ * levels as without it. Only the stabilizer task touches the state below, a
+ * new setpoint ends the landing.
+ */
+static bool failsafeLandEnable = true;
+static float failsafeLandVelocity = 0.3f;
+static bool isFailsafeLanding;
+static bool isFailsafeLandPlanned;
+static bool failsafeKeepsXY;
+
+/*
+ * The current setpoint and its priority, written together. Writers are
+ * serialized by the lock and make the sequence odd while they write, the
+ * stabilizer reads without locking and retries if the sequence was odd or
+ * changed during the copy. A writer can not be preempted inside the lock, so
+ * the reader only retries while a writer runs on the other core.
+ */
+typedef struct {
+  uint32_t sequence;
+  setpoint_t setpoint;
+  int priority;
+} setpointMailbox_t;
+
+static setpointMailbox_t mailbox;
+static portMUX_TYPE mailboxLock = portMUX_INITIALIZER_UNLOCKED;
+
+static void mailboxWriteBegin(void)
+{
+  portENTER_CRITICAL(&mailboxLock);
+  __atomic_store_n(&mailbox.sequence, mailbox.sequence + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void mailboxWriteEnd(void)
+{
+  __atomic_store_n(&mailbox.sequence, mailbox.sequence + 1, __ATOMIC_RELEASE);
+  portEXIT_CRITICAL(&mailboxLock);
+}
+
+static void mailboxReadSetpoint(setpoint_t *setpoint)
+{
+  uint32_t sequence;
+
+  do {
+    sequence = __atomic_load_n(&mailbox.sequence, __ATOMIC_ACQUIRE);
+    memcpy(setpoint, &mailbox.setpoint, sizeof(setpoint_t));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  } while ((sequence & 1) || __atomic_load_n(&mailbox.sequence, __ATOMIC_RELAXED) != sequence);
+}
 
 /* Public functions */
 void commanderInit(void)
 {
-  setpointQueue = STATIC_MEM_QUEUE_CREATE(setpointQueue);
-  ASSERT(setpointQueue);
-  xQueueSend(setpointQueue, &nullSetpoint, 0);
-
-  priorityQueue = STATIC_MEM_QUEUE_CREATE(priorityQueue);
-  ASSERT(priorityQueue);
-  xQueueSend(priorityQueue, &priorityDisable, 0);
+  mailboxWriteBegin();
+  mailbox.setpoint = nullSetpoint;
+  mailbox.priority = priorityDisable;
+  mailboxWriteEnd();
 
   crtpCommanderInit();
   crtpCommanderHighLevelInit();
@@ -70,22 +116,58 @@ void commanderInit(void)
   isInit = true;
 }
 
+static void setpointAccepted(void)
+{
+  queueMonitorSent(qmSetpoint, NULL, pdTRUE);
+  // Send the high-level planner to idle so it will forget its current state
+  // and start over if we switch from low-level to high-level in the future.
+  // Streamed setpoints find it idle, only the first one pays for the stop.
+  if (!crtpCommanderHighLevelIsStopped()) {
+    crtpCommanderHighLevelStop();
+  }
+}
+
 void commanderSetSetpoint(setpoint_t *setpoint, int priority)
 {
-  int currentPriority;
+  bool isAccepted = false;
+  const uint32_t timestamp = xTaskGetTickCount();
 
-  const BaseType_t peekResult = xQueuePeek(priorityQueue, &currentPriority, 0);
-  ASSERT(peekResult == pdTRUE);
+  mailboxWriteBegin();
+  if (priority >= mailbox.priority) {
+    setpoint->timestamp = timestamp;
+    mailbox.setpoint = *setpoint;
+    mailbox.priority = priority;
+    isAccepted = true;
+  }
+  mailboxWriteEnd();
 
-  if (priority >= currentPriority) {
-    setpoint->timestamp = xTaskGetTickCount();
-    // This is a potential race but without effect on functionality
-    xQueueOverwrite(setpointQueue, setpoint);
-    xQueueOverwrite(priorityQueue, &priority);
-    // Send the high-level planner to idle so it will forget its current state
-    // and start over if we switch from low-level to high-level in the future.
-    crtpCommanderHighLevelStop();
+  if (isAccepted) {
+    setpointAccepted();
+  }
+}
+
+bool commanderDecodeSetpoint(commanderSetpointDecoder_t decoder, const void *data, int priority)
+{
+  bool isAccepted = false;
+  const uint32_t timestamp = xTaskGetTickCount();
+
+  mailboxWriteBegin();
+  if (priority >= mailbox.priority) {
+    setpoint_t *setpoint = &mailbox.setpoint;
+    // The quaternion is left as it was, it is only read with mode.quat
+    memset(setpoint, 0, offsetof(setpoint_t, attitudeQuaternion));
+    memset(&setpoint->thrust, 0, sizeof(setpoint_t) - offsetof(setpoint_t, thrust));
+    decoder(setpoint, data);
+    setpoint->timestamp = timestamp;
+    mailbox.priority = priority;
+    isAccepted = true;
+  }
+  mailboxWriteEnd();
+
+  if (isAccepted) {
+    setpointAccepted();
   }
+  return isAccepted;
 }
 
 void commanderNotifySetpointsStop(int remainValidMillisecs)
@@ -95,19 +177,82 @@ void commanderNotifySetpointsStop(int remainValidMillisecs)
     COMMANDER_WDT_TIMEOUT_SHUTDOWN - M2T(remainValidMillisecs),
     currentTime
   );
-  xQueuePeek(setpointQueue, &tempSetpoint, 0);
-  tempSetpoint.timestamp = currentTime - timeSetback;
-  xQueueOverwrite(setpointQueue, &tempSetpoint);
+  mailboxWriteBegin();
+  mailbox.setpoint.timestamp = currentTime - timeSetback;
+  mailboxWriteEnd();
   crtpCommanderHighLevelTellState(&lastState);
 }
 
+static void levelSetpoint(setpoint_t *setpoint)
+{
+  setpoint->mode.x = modeDisable;
+  setpoint->mode.y = modeDisable;
+  setpoint->mode.roll = modeAbs;
+  setpoint->mode.pitch = modeAbs;
+  setpoint->mode.yaw = modeVelocity;
+  setpoint->attitude.roll = 0;
+  setpoint->attitude.pitch = 0;
+  setpoint->attitudeRate.yaw = 0;
+}
+
+/*
+ * Post a landing at failsafeLandVelocity from the state estimate, for the
+ * last setpoint that timed out. Without height control there is no height
+ * to descend from, the commander levels and then shuts down as before.
+ */
+static bool failsafeLandStart(const setpoint_t *setpoint, const state_t *state)
+{
+  if (!failsafeLandEnable || setpoint->mode.z == modeDisable ||
+      state->position.z < COMMANDER_FAILSAFE_MIN_HEIGHT) {
+    return false;
+  }
+
+  crtpCommanderHighLevelTellState(state);
+  if (!crtpCommanderHighLevelPostLandWithVelocity(0.0f, failsafeLandVelocity, false)) {
+    return false;
+  }
+
+  // Hold the position only if the flight did, the estimate may have no x-y
+  failsafeKeepsXY = setpoint->mode.x != modeDisable && setpoint->mode.y != modeDisable;
+  isFailsafeLandPlanned = false;
+  return true;
+}
+
+static void failsafeLandGetSetpoint(setpoint_t *setpoint, const state_t *state, bool isShutdown)
+{
+  if (crtpCommanderHighLevelIsStopped()) {
+    if (!isFailsafeLandPlanned && !isShutdown) {
+      // Not planned yet, leveling and keeping Z as it is meanwhile
+      levelSetpoint(setpoint);
+      return;
+    }
+    // Landed, or the planner was stopped
+    memcpy(setpoint, &nullSetpoint, sizeof(nullSetpoint));
+    return;
+  }
+
+  isFailsafeLandPlanned = true;
+  crtpCommanderHighLevelGetSetpoint(setpoint, state);
+  if (!failsafeKeepsXY) {
+    levelSetpoint(setpoint);
+  }
+}
+
 void commanderGetSetpoint(setpoint_t *setpoint, const state_t *state)
 {
-  xQueuePeek(setpointQueue, setpoint, 0);
+  mailboxReadSetpoint(setpoint);
+  queueMonitorPeeked(qmSetpoint, pdTRUE);
   lastUpdate = setpoint->timestamp;
   uint32_t currentTime = xTaskGetTickCount();
 
-  if ((currentTime - setpoint->timestamp) > COMMANDER_WDT_TIMEOUT_SHUTDOWN) {
+  if ((currentTime - setpoint->timestamp) <= COMMANDER_WDT_TIMEOUT_STABILIZE) {
+    // The setpoints are back, commanderSetSetpoint() stopped the planner
+    isFailsafeLanding = false;
+  }
+
+  if (isFailsafeLanding) {
+    failsafeLandGetSetpoint(setpoint, state, (currentTime - setpoint->timestamp) > COMMANDER_WDT_TIMEOUT_SHUTDOWN);
+  } else if ((currentTime - setpoint->timestamp) > COMMANDER_WDT_TIMEOUT_SHUTDOWN) {
     if (enableHighLevel) {
       crtpCommanderHighLevelGetSetpoint(setpoint, state);
     }
@@ -115,17 +260,17 @@ void commanderGetSetpoint(setpoint_t *setpoint, const state_t *state)
       memcpy(setpoint, &nullSetpoint, sizeof(nullSetpoint));
     }
   } else if ((currentTime - setpoint->timestamp) > COMMANDER_WDT_TIMEOUT_STABILIZE) {
-    xQueueOverwrite(priorityQueue, &priorityDisable);
-    // Leveling ...
-    setpoint->mode.x = modeDisable;
-    setpoint->mode.y = modeDisable;
-    setpoint->mode.roll = modeAbs;
-    setpoint->mode.pitch = modeAbs;
-    setpoint->mode.yaw = modeVelocity;
-    setpoint->attitude.roll = 0;
-    setpoint->attitude.pitch = 0;
-    setpoint->attitudeRate.yaw = 0;
-    // Keep Z as it is
+    mailboxWriteBegin();
+    mailbox.priority = priorityDisable;
+    mailboxWriteEnd();
+    if (failsafeLandStart(setpoint, state)) {
+      isFailsafeLanding = true;
+      failsafeLandGetSetpoint(setpoint, state, false);
+    } else {
+      // Leveling ...
+      levelSetpoint(setpoint);
+      // Keep Z as it is
+    }
   }
   // This copying is not strictly necessary because stabilizer.c already keeps
   // a static state_t containing the most recent state estimate. However, it is
@@ -133,6 +278,11 @@ void commanderGetSetpoint(setpoint_t *setpoint, const state_t *state)
   lastState = *state;
 }
 
+void commanderEnableHighLevel(bool enable)
+{
+  enableHighLevel = enable;
+}
+
 bool commanderTest(void)
 {
   return isInit;
@@ -143,16 +293,18 @@ uint32_t commanderGetInactivityTime(void)
   return xTaskGetTickCount() - lastUpdate;
 }
 
-int commanderGetActivePriority(void)
+bool commanderIsFailsafeLanding(void)
 {
-  int priority;
-
-  const BaseType_t peekResult = xQueuePeek(priorityQueue, &priority, 0);
-  ASSERT(peekResult == pdTRUE);
+  return isFailsafeLanding;
+}
 
-  return priority;
+int commanderGetActivePriority(void)
+{
+  return __atomic_load_n(&mailbox.priority, __ATOMIC_RELAXED);
 }
 
 PARAM_GROUP_START(commander)
 PARAM_ADD(PARAM_UINT8, enHighLevel, &enableHighLevel)
+PARAM_ADD(PARAM_UINT8, fsLand, &failsafeLandEnable)
+PARAM_ADD(PARAM_FLOAT, fsLandVel, &failsafeLandVelocity)
 PARAM_GROUP_STOP(commander)
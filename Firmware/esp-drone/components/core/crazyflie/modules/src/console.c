@@ -25,30 +25,71 @@
  */
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
 
 /*FreeRtos includes*/
 #include "FreeRTOS.h"
-#include "semphr.h"
+#include "task.h"
 
+#include "config.h"
+#include "console.h"
 #include "crtp.h"
-
-#ifdef STM32F40_41xxx
-#include "stm32f4xx.h"
-#else
+#include "static_mem.h"
 #include "stm32_legacy.h"
-#ifndef SCB_ICSR_VECTACTIVE_Msk
-#define SCB_ICSR_VECTACTIVE_Msk 0x1FFUL
-#endif
-#endif
+
+/*
+ * Characters are queued in a lock-free multi producer, single consumer ring.
+ * A producer reserves slots by moving the head forward with a CAS, then
+ * publishes each byte by setting the slot's valid bit. The console task
+ * consumes slots in order and clears them before moving the tail, so a
+ * producer never overwrites an unread byte. Putting a character never
+ * blocks nor calls the scheduler, from a task or from an interrupt. When the
+ * ring is full the character is dropped and a marker is sent later.
+ *
+ * Deferred debug records use a second ring and are sent on channel 1. They
+ * are a byte stream, the first data byte of every packet is the offset of
+ * the first record starting in the packet, or CONSOLE_NO_RECORD_START, so
+ * that the client can find the records again after a lost packet.
+ */
+#define CONSOLE_RING_LENGTH     1024  // Must be a power of 2
+#define CONSOLE_SLOT_VALID      0x100
+#define CONSOLE_SLOT_START      0x200 // First byte of a record
+#define CONSOLE_POLL_MS         10
+
+#define CONSOLE_TEXT_CHANNEL      0
+#define CONSOLE_RECORD_CHANNEL    1
+#define CONSOLE_NO_RECORD_START   0xff
+
+typedef struct {
+  uint16_t *slots;
+  uint32_t head;          // Next slot to reserve, moved by the producers
+  uint32_t tail;          // Next slot to read, moved by the console task
+  uint32_t droppedCount;  // Bytes or records dropped because the ring was full
+} consoleRing_t;
+
+static uint16_t textSlots[CONSOLE_RING_LENGTH];
+static consoleRing_t textRing = {.slots = textSlots};
 
 static CRTPPacket messageToPrint;
 static bool messageSendingIsPending = false;
-static xSemaphoreHandle synch = NULL;
+
+#ifdef CONFIG_DEBUG_DEFERRED
+static uint16_t recordSlots[CONSOLE_RING_LENGTH];
+static consoleRing_t recordRing = {.slots = recordSlots};
+
+static CRTPPacket recordMessage;
+static bool recordSendingIsPending = false;
+#endif
+
+static TaskHandle_t taskHandle;
 
 static const char bufferFullMsg[] = "<F>\n";
 static bool isInit;
 
+STATIC_MEM_TASK_ALLOC(consoleTask, CONSOLE_TASK_STACKSIZE);
+static void consoleTask(void *param);
+
 static void addBufferFullMarker();
 
 
@@ -77,9 +118,14 @@ void consoleInit()
     return;
 
   messageToPrint.size = 0;
-  messageToPrint.header = CRTP_HEADER(CRTP_PORT_CONSOLE, 0);
-  vSemaphoreCreateBinary(synch);
+  messageToPrint.header = CRTP_HEADER(CRTP_PORT_CONSOLE, CONSOLE_TEXT_CHANNEL);
   messageSendingIsPending = false;
+#ifdef CONFIG_DEBUG_DEFERRED
+  recordMessage.size = 0;
+  recordMessage.header = CRTP_HEADER(CRTP_PORT_CONSOLE, CONSOLE_RECORD_CHANNEL);
+#endif
+
+  taskHandle = STATIC_MEM_TASK_CREATE_PINNED(consoleTask, consoleTask, CONSOLE_TASK_NAME, NULL, CONSOLE_TASK_PRI, CONSOLE_TASK_CORE);
 
   isInit = true;
 }
@@ -89,63 +135,61 @@ bool consoleTest(void)
   return isInit;
 }
 
-int consolePutchar(int ch)
+/* Reserves and writes length bytes in one go, nothing is written if they
+ * do not all fit. */
+static bool consoleRingWrite(consoleRing_t *ring, const uint8_t *data, uint32_t length, uint16_t firstFlags)
 {
-  bool isInInterrupt = false; //bool isInInterrupt = (SCB->ICSR & SCB_ICSR_VECTACTIVE_Msk) != 0;
+  uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
 
-  if (!isInit) {
-    return 0;
-  }
+  do {
+    if (head + length - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) > CONSOLE_RING_LENGTH) {
+      __atomic_fetch_add(&ring->droppedCount, 1, __ATOMIC_RELAXED);
+      return false;
+    }
+  } while (!__atomic_compare_exchange_n(&ring->head, &head, head + length, true, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
 
-  if (isInInterrupt) {
-    return consolePutcharFromISR(ch);
+  for (uint32_t i = 0; i < length; i++) {
+    const uint16_t value = CONSOLE_SLOT_VALID | (i == 0 ? firstFlags : 0) | data[i];
+    __atomic_store_n(&ring->slots[(head + i) & (CONSOLE_RING_LENGTH - 1)], value, __ATOMIC_RELEASE);
   }
 
-  if (xSemaphoreTake(synch, portMAX_DELAY) == pdTRUE)
-  {
-    // Try to send if we already have a pending message
-    if (messageSendingIsPending) 
-    {
-      consoleSendMessage();
-    }
+  return true;
+}
 
-    if (! messageSendingIsPending) 
-    {
-      if (messageToPrint.size < CRTP_MAX_DATA_SIZE)
-      {
-        messageToPrint.data[messageToPrint.size] = (unsigned char)ch;
-        messageToPrint.size++;
-      }
+/* Returns the next slot value and frees the slot, or 0 if the next byte is
+ * not written yet. */
+static uint16_t consoleRingRead(consoleRing_t *ring)
+{
+  const uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+  uint16_t *slot = &ring->slots[tail & (CONSOLE_RING_LENGTH - 1)];
+  const uint16_t value = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
 
-      if (ch == '\n' || messageToPrint.size >= CRTP_MAX_DATA_SIZE)
-      {
-        if (crtpGetFreeTxQueuePackets() == 1)
-        {
-          addBufferFullMarker();
-        }
-        messageSendingIsPending = true;
-        consoleSendMessage();
-      }
-    }
-    xSemaphoreGive(synch);
+  // Empty, or reserved but not written yet
+  if ((value & CONSOLE_SLOT_VALID) == 0) {
+    return 0;
   }
 
-  return (unsigned char)ch;
+  __atomic_store_n(slot, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+
+  return value;
 }
 
-int consolePutcharFromISR(int ch) {
-  BaseType_t higherPriorityTaskWoken;
+int consolePutchar(int ch)
+{
+  const uint8_t data = (unsigned char)ch;
 
-  if (xSemaphoreTakeFromISR(synch, &higherPriorityTaskWoken) == pdTRUE) {
-    if (messageToPrint.size < CRTP_MAX_DATA_SIZE)
-    {
-      messageToPrint.data[messageToPrint.size] = (unsigned char)ch;
-      messageToPrint.size++;
-    }
-    xSemaphoreGiveFromISR(synch, &higherPriorityTaskWoken);
+  if (!isInit) {
+    return 0;
   }
 
-  return ch;
+  consoleRingWrite(&textRing, &data, 1, 0);
+
+  return data;
+}
+
+int consolePutcharFromISR(int ch) {
+  return consolePutchar(ch);
 }
 
 int consolePuts(char *str)
@@ -160,13 +204,113 @@ int consolePuts(char *str)
 
 void consoleFlush(void)
 {
-  if (xSemaphoreTake(synch, portMAX_DELAY) == pdTRUE)
-  {
-    consoleSendMessage();
-    xSemaphoreGive(synch);
+  if (isInit) {
+    xTaskNotifyGive(taskHandle);
+  }
+}
+
+#ifdef CONFIG_DEBUG_DEFERRED
+bool consoleWriteRecord(const uint8_t *data, uint32_t length)
+{
+  if (!isInit) {
+    return false;
   }
+
+  return consoleRingWrite(&recordRing, data, length, CONSOLE_SLOT_START);
 }
 
+/* Moves record bytes to the record message, returns true if it is full. */
+static bool consoleFillRecordMessage(void)
+{
+  if (recordMessage.size == 0) {
+    recordMessage.data[0] = CONSOLE_NO_RECORD_START;
+    recordMessage.size = 1;
+  }
+
+  while (recordMessage.size < CRTP_MAX_DATA_SIZE) {
+    const uint16_t value = consoleRingRead(&recordRing);
+    if (value == 0) {
+      break;
+    }
+
+    if ((value & CONSOLE_SLOT_START) && recordMessage.data[0] == CONSOLE_NO_RECORD_START) {
+      recordMessage.data[0] = recordMessage.size - 1;
+    }
+    recordMessage.data[recordMessage.size++] = value & 0xff;
+  }
+
+  return recordMessage.size >= CRTP_MAX_DATA_SIZE;
+}
+
+static void consoleSendRecords(void)
+{
+  while (true) {
+    if (!recordSendingIsPending) {
+      // Records are not split in lines, send what is there on every round
+      recordSendingIsPending = consoleFillRecordMessage() || recordMessage.size > 1;
+      if (!recordSendingIsPending) {
+        return;
+      }
+    }
+
+    // Keep the message pending and retry on the next round if the link is busy
+    if (crtpSendPacket(&recordMessage) != pdTRUE) {
+      return;
+    }
+    recordMessage.size = 0;
+    recordSendingIsPending = false;
+  }
+}
+#endif
+
+/* Moves characters from the ring to the message until it has to be sent.
+ * Returns true if the message is complete. */
+static bool consoleFillMessage(void)
+{
+  while (messageToPrint.size < CRTP_MAX_DATA_SIZE) {
+    const uint16_t value = consoleRingRead(&textRing);
+    if (value == 0) {
+      break;
+    }
+
+    const char ch = value & 0xff;
+    messageToPrint.data[messageToPrint.size++] = ch;
+    if (ch == '\n') {
+      return true;
+    }
+  }
+
+  return messageToPrint.size >= CRTP_MAX_DATA_SIZE;
+}
+
+static void consoleTask(void *param)
+{
+  uint32_t reportedDropped = 0;
+
+  while (true) {
+    const bool flush = ulTaskNotifyTake(pdTRUE, M2T(CONSOLE_POLL_MS)) != 0;
+
+    do {
+      if (!messageSendingIsPending) {
+        messageSendingIsPending = consoleFillMessage() || (flush && messageToPrint.size > 0);
+
+        uint32_t dropped = __atomic_load_n(&textRing.droppedCount, __ATOMIC_RELAXED);
+#ifdef CONFIG_DEBUG_DEFERRED
+        dropped += __atomic_load_n(&recordRing.droppedCount, __ATOMIC_RELAXED);
+#endif
+        if (messageSendingIsPending && (dropped != reportedDropped || crtpGetFreeTxQueuePacketsOfPort(CRTP_PORT_CONSOLE) == 1)) {
+          reportedDropped = dropped;
+          addBufferFullMarker();
+        }
+      }
+    // Keep the message pending and retry on the next round if the link is busy
+    } while (messageSendingIsPending && consoleSendMessage());
+
+#ifdef CONFIG_DEBUG_DEFERRED
+    consoleSendRecords();
+#endif
+  }
+}
 
 static int findMarkerStart()
 {
@@ -12,18 +12,26 @@ static ControllerType currentController = ControllerTypeAny;
 
 static void initController();
 
+// The modules with file scope state a controller uses besides its own, two
+// controllers that share one can not run at the same time
+#define SHARES_ATTITUDE_PID   (1 << 0)
+#define SHARES_POSITION_PID   (1 << 1)
+
 typedef struct {
   void (*init)(void);
   bool (*test)(void);
   void (*update)(control_t *control, setpoint_t *setpoint, const sensorData_t *sensors, const state_t *state, const uint32_t tick);
   const char* name;
+  uint8_t shares;
 } ControllerFcns;
 
 static ControllerFcns controllerFunctions[] = {
   {.init = 0, .test = 0, .update = 0, .name = "None"}, // Any
-  {.init = controllerPidInit, .test = controllerPidTest, .update = controllerPid, .name = "PID"},
+  {.init = controllerPidInit, .test = controllerPidTest, .update = controllerPid, .name = "PID",
+   .shares = SHARES_ATTITUDE_PID | SHARES_POSITION_PID},
   {.init = controllerMellingerInit, .test = controllerMellingerTest, .update = controllerMellinger, .name = "Mellinger"},
-  {.init = controllerINDIInit, .test = controllerINDITest, .update = controllerINDI, .name = "INDI"},
+  {.init = controllerINDIInit, .test = controllerINDITest, .update = controllerINDI, .name = "INDI",
+   .shares = SHARES_ATTITUDE_PID | SHARES_POSITION_PID},
 };
 
 
@@ -68,3 +76,36 @@ void controller(control_t *control, setpoint_t *setpoint, const sensorData_t *se
 const char* controllerGetName() {
   return controllerFunctions[currentController].name;
 }
+
+static bool isValidController(ControllerType controller) {
+  return controller > ControllerTypeAny && controller < ControllerType_COUNT;
+}
+
+void controllerSwitchWarm(ControllerType controller) {
+  if (!isValidController(controller)) {
+    return;
+  }
+
+  currentController = controller;
+  DEBUG_PRINTD("Switched to the running %s (%d) controller\n", controllerGetName(), currentController);
+}
+
+void controllerInitOther(ControllerType controller) {
+  if (isValidController(controller)) {
+    controllerFunctions[controller].init();
+  }
+}
+
+void controllerOther(ControllerType controller, control_t *control, setpoint_t *setpoint, const sensorData_t *sensors, const state_t *state, const uint32_t tick) {
+  if (isValidController(controller)) {
+    controllerFunctions[controller].update(control, setpoint, sensors, state, tick);
+  }
+}
+
+bool controllerCanRunTogether(ControllerType a, ControllerType b) {
+  if (!isValidController(a) || !isValidController(b) || a == b) {
+    return false;
+  }
+
+  return (controllerFunctions[a].shares & controllerFunctions[b].shares) == 0;
+}
@@ -0,0 +1,280 @@
+/**
+ *
+ * ESP-Drone Firmware
+ *
+ * Copyright 2019-2020  Espressif Systems (Shanghai)
+ * Copyright (C) 2011-2012 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * controller_bank.c - Keeps a standby controller warm next to the current one
+ *
+ * Every ATTITUDE_RATE loop the stabilizer copies the inputs of the controller
+ * into one of two frames and hands it to the bank task, which runs the
+ * standby controller on it. A frame that is ready while the task is still
+ * busy with the other one is dropped. The controllers are only switched while
+ * the task owns no frame, so the stabilizer never touches a controller the
+ * task is running.
+ *
+ * The standby controller runs at ATTITUDE_RATE on even ticks, every rate of
+ * the controllers divides it, so their slower loops run on the same ticks as
+ * when they are the current controller.
+ */
+#define DEBUG_MODULE "CTRLBANK"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "config.h"
+#include "controller_bank.h"
+#include "log.h"
+#include "param.h"
+#include "static_mem.h"
+#include "usec_time.h"
+#include "debug_cf.h"
+
+#ifdef CONFIG_CONTROLLER_BANK
+
+#define CONTROLLER_BANK_WARMUP_FRAMES   (CONTROLLER_BANK_WARMUP_MS * ATTITUDE_RATE / 1000)
+// The CPU times are averaged over one second
+#define CONTROLLER_BANK_MEAN_FRAMES     ATTITUDE_RATE
+
+typedef struct {
+  setpoint_t setpoint;
+  sensorData_t sensors;
+  state_t state;
+  uint32_t tick;
+  uint8_t controller;
+  // Init the controller before this update
+  bool init;
+} bankFrame_t;
+
+static bool isInit = false;
+
+// Frame i belongs to the bank task while frameReady[i] is set, to the
+// stabilizer task otherwise
+static bankFrame_t frames[2];
+static bool frameReady[2];
+
+// Stabilizer task only
+static uint8_t activeFrame;
+static ControllerType running = ControllerTypeAny;
+static uint32_t runningFrames;
+static bool initPending;
+static uint32_t activeUsSum;
+static uint16_t activeMeanCount;
+
+// Bank task only
+static control_t standbyControl;
+static uint32_t standbyUsSum;
+static uint16_t standbyMeanCount;
+
+static uint8_t standbyParam = ControllerTypeAny;
+static uint8_t runningLog;
+static uint8_t warmLog;
+static float activeUs;
+static float standbyUs;
+static uint32_t droppedCount;
+static uint32_t warmSwitchCount;
+
+STATIC_MEM_TASK_ALLOC(controllerBankTask, CTRL_BANK_TASK_STACKSIZE);
+static TaskHandle_t taskHandle;
+static void controllerBankTask(void *param);
+
+void controllerBankInit(void)
+{
+  if (isInit) {
+    return;
+  }
+
+  taskHandle = STATIC_MEM_TASK_CREATE_PINNED(controllerBankTask, controllerBankTask, CTRL_BANK_TASK_NAME, NULL, CTRL_BANK_TASK_PRI, CTRL_BANK_TASK_CORE);
+
+  isInit = true;
+}
+
+bool controllerBankTest(void)
+{
+  return isInit;
+}
+
+static bool isBusy(void)
+{
+  return __atomic_load_n(&frameReady[0], __ATOMIC_ACQUIRE) || __atomic_load_n(&frameReady[1], __ATOMIC_ACQUIRE);
+}
+
+static bool isWarm(void)
+{
+  return running != ControllerTypeAny && !initPending && runningFrames >= CONTROLLER_BANK_WARMUP_FRAMES;
+}
+
+bool controllerBankSwitchTo(ControllerType controller)
+{
+  if (isBusy()) {
+    return false;
+  }
+
+  const ControllerType previous = getControllerType();
+
+  if (controller == running && isWarm()) {
+    controllerSwitchWarm(controller);
+
+    // The replaced controller ran until now, it is the warm standby
+    standbyParam = previous;
+    running = previous;
+    runningFrames = CONTROLLER_BANK_WARMUP_FRAMES;
+    warmSwitchCount++;
+  } else {
+    // A standby that can not run next to the new controller is dropped by the
+    // next update
+    controllerInit(controller);
+  }
+
+  return true;
+}
+
+/* Follows the standby param, the standby starts over with its init when it changes. */
+static void selectStandby(void)
+{
+  ControllerType wanted = standbyParam;
+
+  if (!controllerCanRunTogether(wanted, getControllerType())) {
+    wanted = ControllerTypeAny;
+  }
+
+  if (wanted != running) {
+    running = wanted;
+    runningFrames = 0;
+    initPending = (wanted != ControllerTypeAny);
+  }
+
+  runningLog = running;
+  warmLog = isWarm();
+}
+
+static void publishFrame(setpoint_t *setpoint, const sensorData_t *sensors, const state_t *state, const uint32_t tick)
+{
+  const uint8_t other = activeFrame ^ 1;
+
+  if (__atomic_load_n(&frameReady[other], __ATOMIC_ACQUIRE)) {
+    // Still running the previous frame
+    droppedCount++;
+    return;
+  }
+
+  bankFrame_t *frame = &frames[activeFrame];
+  frame->setpoint = *setpoint;
+  frame->sensors = *sensors;
+  frame->state = *state;
+  frame->tick = tick;
+  frame->controller = running;
+  frame->init = initPending;
+
+  __atomic_store_n(&frameReady[activeFrame], true, __ATOMIC_RELEASE);
+  xTaskNotifyGive(taskHandle);
+  activeFrame = other;
+
+  initPending = false;
+  runningFrames++;
+}
+
+void controllerBankUpdate(control_t *control, setpoint_t *setpoint,
+                          const sensorData_t *sensors,
+                          const state_t *state,
+                          const uint32_t tick)
+{
+  const uint64_t start = usecTimestamp();
+  controller(control, setpoint, sensors, state, tick);
+  activeUsSum += (uint32_t)(usecTimestamp() - start);
+
+  if (!RATE_DO_EXECUTE(ATTITUDE_RATE, tick)) {
+    return;
+  }
+
+  // Per ATTITUDE_RATE loop, the same as the standby
+  if (++activeMeanCount >= CONTROLLER_BANK_MEAN_FRAMES) {
+    activeUs = (float)activeUsSum / activeMeanCount;
+    activeUsSum = 0;
+    activeMeanCount = 0;
+  }
+
+  if (!isInit) {
+    return;
+  }
+
+  selectStandby();
+  if (running != ControllerTypeAny) {
+    publishFrame(setpoint, sensors, state, tick);
+  }
+}
+
+static void runFrame(bankFrame_t *frame)
+{
+  if (frame->init) {
+    controllerInitOther(frame->controller);
+    standbyUsSum = 0;
+    standbyMeanCount = 0;
+  }
+
+  const uint64_t start = usecTimestamp();
+  controllerOther(frame->controller, &standbyControl, &frame->setpoint, &frame->sensors, &frame->state, frame->tick);
+  standbyUsSum += (uint32_t)(usecTimestamp() - start);
+
+  if (++standbyMeanCount >= CONTROLLER_BANK_MEAN_FRAMES) {
+    standbyUs = (float)standbyUsSum / standbyMeanCount;
+    standbyUsSum = 0;
+    standbyMeanCount = 0;
+  }
+}
+
+static void controllerBankTask(void *param)
+{
+  uint8_t nextFrame = 0;
+
+  while (1) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+    while (__atomic_load_n(&frameReady[nextFrame], __ATOMIC_ACQUIRE)) {
+      runFrame(&frames[nextFrame]);
+      __atomic_store_n(&frameReady[nextFrame], false, __ATOMIC_RELEASE);
+      nextFrame ^= 1;
+    }
+  }
+}
+
+PARAM_GROUP_START(ctrlBank)
+PARAM_ADD(PARAM_UINT8, standby, &standbyParam)
+PARAM_GROUP_STOP(ctrlBank)
+
+/**
+ * The standby controller that runs, 0 for none, and its output. activeUs and
+ * standbyUs are the CPU times of the two controllers per ATTITUDE_RATE loop.
+ */
+LOG_GROUP_START(ctrlBank)
+LOG_ADD(LOG_UINT8, standby, &runningLog)
+LOG_ADD(LOG_UINT8, warm, &warmLog)
+LOG_ADD(LOG_FLOAT, activeUs, &activeUs)
+LOG_ADD(LOG_FLOAT, standbyUs, &standbyUs)
+LOG_ADD(LOG_INT16, sbRoll, &standbyControl.roll)
+LOG_ADD(LOG_INT16, sbPitch, &standbyControl.pitch)
+LOG_ADD(LOG_INT16, sbYaw, &standbyControl.yaw)
+LOG_ADD(LOG_FLOAT, sbThrust, &standbyControl.thrust)
+LOG_ADD(LOG_UINT32, dropped, &droppedCount)
+LOG_ADD(LOG_UINT32, warmSwitches, &warmSwitchCount)
+LOG_GROUP_STOP(ctrlBank)
+
+#endif // CONFIG_CONTROLLER_BANK
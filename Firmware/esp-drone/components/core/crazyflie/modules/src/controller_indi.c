@@ -23,6 +23,8 @@
  * http://arc.aiaa.org/doi/pdf/10.2514/1.G001490
  */
 
+#include <math.h>
+
 #include "controller_indi.h"
 #include "math3d.h"
 
@@ -62,53 +64,85 @@ static struct IndiVariables indi = {
 		.filt_cutoff_r = STABILIZATION_INDI_FILT_CUTOFF_R,
 };
 
+// Set by the param callbacks, applied by the stabilizer at the next INDI step
+static bool filt_cutoff_changed;
+static bool act_dyn_changed;
+// indi.act_dyn for one INDI_RATE step
+static struct FloatRates act_dyn_step;
+
 static inline void float_rates_zero(struct FloatRates *fr) {
 	fr->p = 0.0f;
 	fr->q = 0.0f;
 	fr->r = 0.0f;
 }
 
-void indi_init_filters(void)
+static void indi_filter_tau(float tau_axis[3])
 {
 	// tau = 1/(2*pi*Fc)
 	float tau = 1.0f / (2.0f * M_PI_F * indi.filt_cutoff);
 	float tau_r = 1.0f / (2.0f * M_PI_F * indi.filt_cutoff_r);
-	float tau_axis[3] = {tau, tau, tau_r};
-	float sample_time = 1.0f / ATTITUDE_RATE;
-	// Filtering of gyroscope and actuators
-	for (int8_t i = 0; i < 3; i++) {
-		init_butterworth_2_low_pass(&indi.u[i], tau_axis[i], sample_time, 0.0f);
-		init_butterworth_2_low_pass(&indi.rate[i], tau_axis[i], sample_time, 0.0f);
-	}
+	tau_axis[0] = tau;
+	tau_axis[1] = tau;
+	tau_axis[2] = tau_r;
 }
 
-/**
- * @brief Update butterworth filter for p, q and r of a FloatRates struct
- *
- * @param filter The filter array to use
- * @param new_values The new values
- */
-static inline void filter_pqr(Butterworth2LowPass *filter, struct FloatRates *new_values)
+static float act_dyn_per_step(float act_dyn)
+{
+#if INDI_RATE == ATTITUDE_RATE
+	return act_dyn;
+#else
+	// The same first order lag with more, smaller steps
+	return 1.0f - powf(1.0f - act_dyn, (float)ATTITUDE_RATE / INDI_RATE);
+#endif
+}
+
+static void indi_update_act_dyn(void)
+{
+	act_dyn_step.p = act_dyn_per_step(indi.act_dyn.p);
+	act_dyn_step.q = act_dyn_per_step(indi.act_dyn.q);
+	act_dyn_step.r = act_dyn_per_step(indi.act_dyn.r);
+}
+
+void indi_init_filters(void)
 {
-	update_butterworth_2_low_pass(&filter[0], new_values->p);
-	update_butterworth_2_low_pass(&filter[1], new_values->q);
-	update_butterworth_2_low_pass(&filter[2], new_values->r);
+	float tau_axis[3];
+
+	indi_filter_tau(tau_axis);
+	// Filtering of gyroscope and actuators
+	init_butterworth_2_low_pass_3(&indi.u, tau_axis, INDI_UPDATE_DT, 0.0f);
+	init_butterworth_2_low_pass_3(&indi.rate, tau_axis, INDI_UPDATE_DT, 0.0f);
+	indi_update_act_dyn();
 }
 
 /**
- * @brief Caclulate finite difference form a filter array
- * The filter already contains the previous values
- *
- * @param output The output array
- * @param filter The filter array input
+ * @brief Recompute the filter coefficients and the actuator model if their params changed
+ * The history of the filters is kept
  */
-static inline void finite_difference_from_filter(float *output, Butterworth2LowPass *filter)
+static void indi_apply_params(void)
 {
-	for (int8_t i = 0; i < 3; i++) {
-		output[i] = (filter[i].o[0] - filter[i].o[1]) * ATTITUDE_RATE;
+	if (__atomic_exchange_n(&filt_cutoff_changed, false, __ATOMIC_ACQUIRE)) {
+		float tau_axis[3];
+
+		indi_filter_tau(tau_axis);
+		set_butterworth_2_low_pass_3_tau(&indi.u, tau_axis, INDI_UPDATE_DT);
+		set_butterworth_2_low_pass_3_tau(&indi.rate, tau_axis, INDI_UPDATE_DT);
+	}
+
+	if (__atomic_exchange_n(&act_dyn_changed, false, __ATOMIC_ACQUIRE)) {
+		indi_update_act_dyn();
 	}
 }
 
+static void indi_filt_cutoff_written(void)
+{
+	__atomic_store_n(&filt_cutoff_changed, true, __ATOMIC_RELEASE);
+}
+
+static void indi_act_dyn_written(void)
+{
+	__atomic_store_n(&act_dyn_changed, true, __ATOMIC_RELEASE);
+}
+
 static float capAngle(float angle) {
   float result = angle;
 
@@ -176,12 +210,14 @@ void controllerINDI(control_t *control, setpoint_t *setpoint,
 	}
 
 	/*
-	 * Skipping calls faster than ATTITUDE_RATE
+	 * Skipping calls faster than INDI_RATE
 	 */
-	if (RATE_DO_EXECUTE(ATTITUDE_RATE, tick)) {
+	if (RATE_DO_EXECUTE(INDI_RATE, tick)) {
+
+		indi_apply_params();
 
 		// Call outer loop INDI (position controller)
-		if (outerLoopActive) {
+		if (outerLoopActive && RATE_DO_EXECUTE(ATTITUDE_RATE, tick)) {
 			positionControllerINDI(sensors, setpoint, state, &refOuterINDI);
 		}
 
@@ -252,25 +288,24 @@ void controllerINDI(control_t *control, setpoint_t *setpoint,
 		float stateAttitudeRatePitch = -radians(sensors->gyro.y); // Account for Crazyflie coordinate system
 		float stateAttitudeRateYaw = radians(sensors->gyro.z);
 
-		struct FloatRates body_rates = {
-				.p = stateAttitudeRateRoll,
-				.q = stateAttitudeRatePitch,
-				.r = stateAttitudeRateYaw,
+		const float body_rates[3] = {
+				stateAttitudeRateRoll,
+				stateAttitudeRatePitch,
+				stateAttitudeRateYaw,
 		};
-		filter_pqr(indi.rate, &body_rates);
-
 
 		/*
-		 * 2 - Calculate the derivative with finite difference.
+		 * 2 - Calculate the derivative with finite difference, in the same pass.
 		 */
 
-		finite_difference_from_filter(indi.rate_d, indi.rate);
+		update_butterworth_2_low_pass_3(&indi.rate, body_rates, indi.rate_d, INDI_RATE);
 
 
 		/*
 		 * 3 - same filter on the actuators (or control_t values), using the commands from the previous timestep.
 		 */
-		filter_pqr(indi.u, &indi.u_act_dyn);
+		const float u_act_dyn[3] = { indi.u_act_dyn.p, indi.u_act_dyn.q, indi.u_act_dyn.r };
+		update_butterworth_2_low_pass_3(&indi.u, u_act_dyn, NULL, 0.0f);
 
 
 		/*
@@ -308,9 +343,9 @@ void controllerINDI(control_t *control, setpoint_t *setpoint,
 		 * 6. Add delta_commands to commands and bound to allowable values
 		 */
 
-		indi.u_in.p = indi.u[0].o[0] + indi.du.p;
-		indi.u_in.q = indi.u[1].o[0] + indi.du.q;
-		indi.u_in.r = indi.u[2].o[0] + indi.du.r;
+		indi.u_in.p = indi.u.o[0][0] + indi.du.p;
+		indi.u_in.q = indi.u.o[0][1] + indi.du.q;
+		indi.u_in.r = indi.u.o[0][2] + indi.du.r;
 
 		//bound the total control input
 		indi.u_in.p = clamp(indi.u_in.p, -1.0f*bound_control_input, bound_control_input);
@@ -319,9 +354,9 @@ void controllerINDI(control_t *control, setpoint_t *setpoint,
 
 		//Propagate input filters
 		//first order actuator dynamics
-		indi.u_act_dyn.p = indi.u_act_dyn.p + indi.act_dyn.p * (indi.u_in.p - indi.u_act_dyn.p);
-		indi.u_act_dyn.q = indi.u_act_dyn.q + indi.act_dyn.q * (indi.u_in.q - indi.u_act_dyn.q);
-		indi.u_act_dyn.r = indi.u_act_dyn.r + indi.act_dyn.r * (indi.u_in.r - indi.u_act_dyn.r);
+		indi.u_act_dyn.p = indi.u_act_dyn.p + act_dyn_step.p * (indi.u_in.p - indi.u_act_dyn.p);
+		indi.u_act_dyn.q = indi.u_act_dyn.q + act_dyn_step.q * (indi.u_in.q - indi.u_act_dyn.q);
+		indi.u_act_dyn.r = indi.u_act_dyn.r + act_dyn_step.r * (indi.u_in.r - indi.u_act_dyn.r);
 
 	}
 
@@ -372,11 +407,11 @@ PARAM_ADD(PARAM_FLOAT, ref_err_r, &indi.reference_acceleration.err_r)
 PARAM_ADD(PARAM_FLOAT, ref_rate_p, &indi.reference_acceleration.rate_p)
 PARAM_ADD(PARAM_FLOAT, ref_rate_q, &indi.reference_acceleration.rate_q)
 PARAM_ADD(PARAM_FLOAT, ref_rate_r, &indi.reference_acceleration.rate_r)
-PARAM_ADD(PARAM_FLOAT, act_dyn_p, &indi.act_dyn.p)
-PARAM_ADD(PARAM_FLOAT, act_dyn_q, &indi.act_dyn.q)
-PARAM_ADD(PARAM_FLOAT, act_dyn_r, &indi.act_dyn.r)
-PARAM_ADD(PARAM_FLOAT, filt_cutoff, &indi.filt_cutoff)
-PARAM_ADD(PARAM_FLOAT, filt_cutoff_r, &indi.filt_cutoff_r)
+PARAM_ADD_WITH_CALLBACK(PARAM_FLOAT, act_dyn_p, &indi.act_dyn.p, indi_act_dyn_written)
+PARAM_ADD_WITH_CALLBACK(PARAM_FLOAT, act_dyn_q, &indi.act_dyn.q, indi_act_dyn_written)
+PARAM_ADD_WITH_CALLBACK(PARAM_FLOAT, act_dyn_r, &indi.act_dyn.r, indi_act_dyn_written)
+PARAM_ADD_WITH_CALLBACK(PARAM_FLOAT, filt_cutoff, &indi.filt_cutoff, indi_filt_cutoff_written)
+PARAM_ADD_WITH_CALLBACK(PARAM_FLOAT, filt_cutoff_r, &indi.filt_cutoff_r, indi_filt_cutoff_written)
 PARAM_ADD(PARAM_UINT8, outerLoopActive, &outerLoopActive)
 PARAM_GROUP_STOP(ctrlINDI)
 
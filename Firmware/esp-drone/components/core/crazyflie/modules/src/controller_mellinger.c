@@ -43,6 +43,7 @@ We added the following:
 #include "position_controller.h"
 #include "controller_mellinger.h"
 #include "physicalConstants.h"
+#include "xtensa_math.h"
 
 static float g_vehicleMass = CF_MASS;
 static float massThrust = 132000;
@@ -101,6 +102,12 @@ static float r_pitch;
 static float r_yaw;
 static float accelz;
 
+// One division for the three components where vnormalize() takes three
+static inline struct vec vunit(struct vec v)
+{
+  return vscl(1.0f / sqrtf(vmag2(v)), v);
+}
+
 void controllerMellingerReset(void)
 {
   i_error_x = 0;
@@ -170,8 +177,8 @@ void controllerMellinger(control_t *control, setpoint_t *setpoint,
     target_thrust.y = g_vehicleMass * setpoint->acceleration.y                       + kp_xy * r_error.y + kd_xy * v_error.y + ki_xy * i_error_y;
     target_thrust.z = g_vehicleMass * (setpoint->acceleration.z + GRAVITY_MAGNITUDE) + kp_z  * r_error.z + kd_z  * v_error.z + ki_z  * i_error_z;
   } else {
-    target_thrust.x = -sinf(radians(setpoint->attitude.pitch));
-    target_thrust.y = -sinf(radians(setpoint->attitude.roll));
+    target_thrust.x = -xtensa_sin_f32(radians(setpoint->attitude.pitch));
+    target_thrust.y = -xtensa_sin_f32(radians(setpoint->attitude.roll));
     // In case of a timeout, the commander tries to level, ie. x/y are disabled, but z will use the previous setting
     // In that case we ignore the last feedforward term for acceleration
     if (setpoint->mode.z == modeAbs) {
@@ -187,39 +194,62 @@ void controllerMellinger(control_t *control, setpoint_t *setpoint,
   } else if (setpoint->mode.yaw == modeAbs) {
     desiredYaw = setpoint->attitude.yaw;
   } else if (setpoint->mode.quat == modeAbs) {
-    struct quat setpoint_quat = mkquat(setpoint->attitudeQuaternion.x, setpoint->attitudeQuaternion.y, setpoint->attitudeQuaternion.z, setpoint->attitudeQuaternion.w);
-    struct vec rpy = quat2rpy(setpoint_quat);
-    desiredYaw = degrees(rpy.z);
+    // The yaw of quat2rpy(), without the roll and the pitch
+    const float qx = setpoint->attitudeQuaternion.x;
+    const float qy = setpoint->attitudeQuaternion.y;
+    const float qz = setpoint->attitudeQuaternion.z;
+    const float qw = setpoint->attitudeQuaternion.w;
+    desiredYaw = degrees(atan2f(2.0f * (qw * qz + qx * qy), 1 - 2 * (fsqr(qy) + fsqr(qz))));
   }
 
-  // Z-Axis [zB]
   struct quat q = mkquat(state->attitudeQuaternion.x, state->attitudeQuaternion.y, state->attitudeQuaternion.z, state->attitudeQuaternion.w);
-  struct mat33 R = quat2rotmat(q);
-  z_axis = mcolumn(R, 2);
+  float x = q.x;
+  float y = q.y;
+  float z = q.z;
+  float w = q.w;
+
+  // Z-Axis [zB] and the heading, the third and the first column of R. Taken
+  // from the estimator when it has R, else only the columns in use are made of q
+  float headingX;
+  float headingY;
+  if (state->rotation.version != 0) {
+    const float (*R)[3] = state->rotation.R;
+    z_axis = mkvec(R[0][2], R[1][2], R[2][2]);
+    headingX = R[0][0];
+    headingY = R[1][0];
+  } else {
+    z_axis = mkvec(2 * (x*z + w*y), 2 * (y*z - w*x), 1 - 2 * (fsqr(x) + fsqr(y)));
+    headingX = 1 - 2 * (fsqr(y) + fsqr(z));
+    headingY = 2 * (x*y + w*z);
+  }
 
   // yaw correction (only if position control is not used)
   if (setpoint->mode.x != modeAbs) {
-    struct vec x_yaw = mcolumn(R, 0);
-    x_yaw.z = 0;
-    x_yaw = vnormalize(x_yaw);
-    struct vec y_yaw = vcross(mkvec(0, 0, 1), x_yaw);
-    struct mat33 R_yaw_only = mcolumns(x_yaw, y_yaw, mkvec(0, 0, 1));
-    target_thrust = mvmul(R_yaw_only, target_thrust);
+    // The thrust turns about Z with the heading
+    const float scale = 1.0f / sqrtf(fsqr(headingX) + fsqr(headingY));
+    headingX *= scale;
+    headingY *= scale;
+    const float thrustX = target_thrust.x;
+    target_thrust.x = headingX * thrustX - headingY * target_thrust.y;
+    target_thrust.y = headingY * thrustX + headingX * target_thrust.y;
   }
 
   // Current thrust [F]
   current_thrust = vdot(target_thrust, z_axis);
 
   // Calculate axis [zB_des]
-  z_axis_desired = vnormalize(target_thrust);
+  z_axis_desired = vunit(target_thrust);
 
   // [xC_des]
   // x_axis_desired = z_axis_desired x [sin(yaw), cos(yaw), 0]^T
-  x_c_des.x = cosf(radians(desiredYaw));
-  x_c_des.y = sinf(radians(desiredYaw));
+  const float desiredYawRad = radians(desiredYaw);
+  x_c_des.x = xtensa_cos_f32(desiredYawRad);
+  x_c_des.y = xtensa_sin_f32(desiredYawRad);
   x_c_des.z = 0;
-  // [yB_des]
-  y_axis_desired = vnormalize(vcross(z_axis_desired, x_c_des));
+  // [yB_des], the cross product with the zero z of x_c_des left out
+  y_axis_desired = vunit(mkvec(-z_axis_desired.z * x_c_des.y,
+                               z_axis_desired.z * x_c_des.x,
+                               z_axis_desired.x * x_c_des.y - z_axis_desired.y * x_c_des.x));
   // [xB_des]
   x_axis_desired = vcross(y_axis_desired, z_axis_desired);
 
@@ -240,10 +270,6 @@ void controllerMellinger(control_t *control, setpoint_t *setpoint,
   // eR.z = eRM.m[1][0];
 
   // Fast version (generated using Mathematica)
-  float x = q.x;
-  float y = q.y;
-  float z = q.z;
-  float w = q.w;
   eR.x = (-1 + 2*fsqr(x) + 2*fsqr(y))*y_axis_desired.z + z_axis_desired.y - 2*(x*y_axis_desired.x*z + y*y_axis_desired.y*z - x*y*z_axis_desired.x + fsqr(x)*z_axis_desired.y + fsqr(z)*z_axis_desired.y - y*z*z_axis_desired.z) +    2*w*(-(y*y_axis_desired.x) - z*z_axis_desired.x + x*(y_axis_desired.y + z_axis_desired.z));
   eR.y = x_axis_desired.z - z_axis_desired.x - 2*(fsqr(x)*x_axis_desired.z + y*(x_axis_desired.z*y - x_axis_desired.y*z) - (fsqr(y) + fsqr(z))*z_axis_desired.x + x*(-(x_axis_desired.x*z) + y*z_axis_desired.y + z*z_axis_desired.z) + w*(x*x_axis_desired.y + z*z_axis_desired.y - y*(x_axis_desired.x + z_axis_desired.z)));
   eR.z = y_axis_desired.x - 2*(y*(x*x_axis_desired.x + y*y_axis_desired.x - x*y_axis_desired.y) + w*(x*x_axis_desired.z + y*y_axis_desired.z)) + 2*(-(x_axis_desired.z*y) + w*(x_axis_desired.x + y_axis_desired.y) + x*y_axis_desired.z)*z - 2*y_axis_desired.x*fsqr(z) + x_axis_desired.y*(-1 + 2*fsqr(x) + 2*fsqr(z));
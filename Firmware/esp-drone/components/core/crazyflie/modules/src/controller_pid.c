@@ -12,7 +12,17 @@
 #include "param.h"
 #include "math3d.h"
 
-#define ATTITUDE_UPDATE_DT    (float)(1.0f/ATTITUDE_RATE)
+// The rate loop runs on the gyro and the attitude loop on every so many of its
+// ticks. The position loop runs at POSITION_RATE.
+#define PID_RATE_RATE         CONFIG_CONTROLLER_PID_RATE_HZ
+#define PID_ATTITUDE_RATE     CONFIG_CONTROLLER_PID_ATTITUDE_HZ
+
+#if (RATE_MAIN_LOOP % PID_RATE_RATE) || (PID_RATE_RATE % PID_ATTITUDE_RATE) || (RATE_MAIN_LOOP % POSITION_RATE)
+#error "The PID controller rates must divide the main loop rate, and the attitude rate the rate loop rate"
+#endif
+
+#define RATE_UPDATE_DT        (float)(1.0f/PID_RATE_RATE)
+#define ATTITUDE_UPDATE_DT    (float)(1.0f/PID_ATTITUDE_RATE)
 
 static bool tiltCompensationEnabled = false;
 
@@ -31,7 +41,7 @@ static float accelz;
 
 void controllerPidInit(void)
 {
-  attitudeControllerInit(ATTITUDE_UPDATE_DT);
+  attitudeControllerInitDt(ATTITUDE_UPDATE_DT, RATE_UPDATE_DT);
   positionControllerInit();
 }
 
@@ -64,7 +74,7 @@ void controllerPid(control_t *control, setpoint_t *setpoint,
                                          const state_t *state,
                                          const uint32_t tick)
 {
-  if (RATE_DO_EXECUTE(ATTITUDE_RATE, tick)) {
+  if (RATE_DO_EXECUTE(PID_ATTITUDE_RATE, tick)) {
     // Rate-controled YAW is moving YAW angle setpoint
     if (setpoint->mode.yaw == modeVelocity) {
        attitudeDesired.yaw += setpoint->attitudeRate.yaw * ATTITUDE_UPDATE_DT;
@@ -79,7 +89,7 @@ void controllerPid(control_t *control, setpoint_t *setpoint,
     positionController(&actuatorThrust, &attitudeDesired, setpoint, state);
   }
 
-  if (RATE_DO_EXECUTE(ATTITUDE_RATE, tick)) {
+  if (RATE_DO_EXECUTE(PID_ATTITUDE_RATE, tick)) {
     // Switch between manual and automatic position control
     if (setpoint->mode.z == modeDisable) {
       actuatorThrust = setpoint->thrust;
@@ -104,7 +114,9 @@ void controllerPid(control_t *control, setpoint_t *setpoint,
       rateDesired.pitch = setpoint->attitudeRate.pitch;
       attitudeControllerResetPitchAttitudePID();
     }
+  }
 
+  if (RATE_DO_EXECUTE(PID_RATE_RATE, tick)) {
     // TODO: Investigate possibility to subtract gyro drift.
     attitudeControllerCorrectRatePID(sensors->gyro.x, -sensors->gyro.y, sensors->gyro.z,
                              rateDesired.roll, rateDesired.pitch, rateDesired.yaw);
@@ -26,6 +26,7 @@
 
 #include <stdbool.h>
 #include <errno.h>
+#include <string.h>
 
 /*FreeRtos includes*/
 #include "FreeRTOS.h"
@@ -67,21 +68,89 @@ static struct {
   uint16_t rxRate;
   uint16_t txRate;
 
+  // Counted by the receive task of the link
+  uint32_t rxDirectCount;
+  uint32_t rxDirectDropped;
+
+  uint32_t txLargeCount;
+  uint32_t txLargeDropped;
+
   uint32_t nextStatisticsTime;
   uint32_t previousStatisticsTime;
 } stats;
 
-static xQueueHandle  txQueue;
+/*
+ * The TX packets are queued per class. The control class, replies and acks,
+ * always goes first, the bulk classes share the rest of the link in a
+ * weighted round robin. A packet the link refuses stays at the head of its
+ * queue, so a packet of another class can go out first.
+ */
+typedef enum {
+  crtpTxControl = 0,    // Everything not below
+  crtpTxLog,            // Log blocks, the TOC and settings replies are control
+  crtpTxConsole,
+  crtpTxMem,
+  CRTP_TX_NBR_OF_CLASSES
+} CrtpTxClass;
+
+STATIC_MEM_QUEUE_ALLOC(crtpTxControlQueue, 32, sizeof(CRTPPacket));
+STATIC_MEM_QUEUE_ALLOC(crtpTxLogQueue, 48, sizeof(CRTPPacket));
+STATIC_MEM_QUEUE_ALLOC(crtpTxConsoleQueue, 16, sizeof(CRTPPacket));
+STATIC_MEM_QUEUE_ALLOC(crtpTxMemQueue, 24, sizeof(CRTPPacket));
+
+// Packets per round of the bulk classes
+static const uint8_t txWeights[CRTP_TX_NBR_OF_CLASSES] = {
+  [crtpTxLog]     = 4,
+  [crtpTxConsole] = 2,
+  [crtpTxMem]     = 2,
+};
+
+static xQueueHandle txQueues[CRTP_TX_NBR_OF_CLASSES];
+static TaskHandle_t txTaskHandle;
+static uint32_t txDropped[CRTP_TX_NBR_OF_CLASSES];
 
 #define CRTP_NBR_OF_PORTS 16
-#define CRTP_TX_QUEUE_SIZE 120
+// Of a port that is not in rxQueueConfigs
 #define CRTP_RX_QUEUE_SIZE 16
+// Packets of all the port queues: param, mem, log, high level and AutoNav
+#define CRTP_RX_POOL_SIZE 96
+#define CRTP_LOG_DATA_CHANNEL 2
+#define CRTP_TX_RETRY_MS 1
 
 static void crtpTxTask(void *param);
 static void crtpRxTask(void *param);
 
+/*
+ * What a full port queue does with a packet. A command the next one replaces
+ * drops the oldest. A request the host retries drops the new one, and the
+ * host is told on the busy channel of the link port so it can slow down.
+ */
+typedef enum {
+  crtpDropNewest = 0,
+  crtpDropOldest,
+} CrtpOverflowPolicy;
+
+static const struct {
+  uint8_t length;       // Packets, CRTP_RX_QUEUE_SIZE if 0
+  uint8_t policy;
+} rxQueueConfigs[CRTP_NBR_OF_PORTS] = {
+  // A TOC download or a trajectory upload comes in bursts
+  [CRTP_PORT_PARAM]       = {24, crtpDropNewest},
+  [CRTP_PORT_MEM]         = {32, crtpDropNewest},
+  [CRTP_PORT_LOG]         = {16, crtpDropNewest},
+  [CRTP_PORT_SETPOINT_HL] = {12, crtpDropOldest},
+  [CRTP_PORT_PLATFORM]    = {8,  crtpDropOldest},   // AutoNav, see autonav_crtp.h
+};
+
 static xQueueHandle queues[CRTP_NBR_OF_PORTS];
+NO_DMA_CCM_SAFE_ZERO_INIT static uint8_t rxQueuePool[CRTP_RX_POOL_SIZE * sizeof(CRTPPacket)];
+NO_DMA_CCM_SAFE_ZERO_INIT static StaticQueue_t rxQueueBuffers[CRTP_NBR_OF_PORTS];
+static int rxPoolUsed;
+static uint32_t rxDropped[CRTP_NBR_OF_PORTS];
+static uint32_t rxBusySent;
+static TickType_t rxBusyTicks[CRTP_NBR_OF_PORTS];
 static volatile CrtpCallback callbacks[CRTP_NBR_OF_PORTS];
+static volatile bool isDirect[CRTP_NBR_OF_PORTS];
 static void updateStats();
 
 STATIC_MEM_TASK_ALLOC_STACK_NO_DMA_CCM_SAFE(crtpTxTask, CRTP_TX_TASK_STACKSIZE);
@@ -92,11 +161,13 @@ void crtpInit(void)
   if(isInit)
     return;
 
-  txQueue = xQueueCreate(CRTP_TX_QUEUE_SIZE, sizeof(CRTPPacket));
-  DEBUG_QUEUE_MONITOR_REGISTER(txQueue);
+  txQueues[crtpTxControl] = STATIC_MEM_QUEUE_CREATE(crtpTxControlQueue);
+  txQueues[crtpTxLog] = STATIC_MEM_QUEUE_CREATE(crtpTxLogQueue);
+  txQueues[crtpTxConsole] = STATIC_MEM_QUEUE_CREATE(crtpTxConsoleQueue);
+  txQueues[crtpTxMem] = STATIC_MEM_QUEUE_CREATE(crtpTxMemQueue);
 
-  STATIC_MEM_TASK_CREATE(crtpTxTask, crtpTxTask, CRTP_TX_TASK_NAME, NULL, CRTP_TX_TASK_PRI);
-  STATIC_MEM_TASK_CREATE(crtpRxTask, crtpRxTask, CRTP_RX_TASK_NAME, NULL, CRTP_RX_TASK_PRI);
+  txTaskHandle = STATIC_MEM_TASK_CREATE_PINNED(crtpTxTask, crtpTxTask, CRTP_TX_TASK_NAME, NULL, CRTP_TX_TASK_PRI, CRTP_TX_TASK_CORE);
+  STATIC_MEM_TASK_CREATE_PINNED(crtpRxTask, crtpRxTask, CRTP_RX_TASK_NAME, NULL, CRTP_RX_TASK_PRI, CRTP_RX_TASK_CORE);
 
   isInit = true;
 }
@@ -109,9 +180,14 @@ bool crtpTest(void)
 void crtpInitTaskQueue(CRTPPort portId)
 {
   ASSERT(queues[portId] == NULL);
+  ASSERT(!isDirect[portId]);
 
-  queues[portId] = xQueueCreate(CRTP_RX_QUEUE_SIZE, sizeof(CRTPPacket));
-  DEBUG_QUEUE_MONITOR_REGISTER(queues[portId]);
+  const int length = rxQueueConfigs[portId].length ? rxQueueConfigs[portId].length : CRTP_RX_QUEUE_SIZE;
+  ASSERT(rxPoolUsed + length <= CRTP_RX_POOL_SIZE);
+
+  queues[portId] = xQueueCreateStatic(length, sizeof(CRTPPacket),
+                                      &rxQueuePool[rxPoolUsed * sizeof(CRTPPacket)], &rxQueueBuffers[portId]);
+  rxPoolUsed += length;
 }
 
 int crtpReceivePacket(CRTPPort portId, CRTPPacket *p)
@@ -139,30 +215,120 @@ int crtpReceivePacketWait(CRTPPort portId, CRTPPacket *p, int wait)
   return xQueueReceive(queues[portId], p, M2T(wait));
 }
 
+int crtpPostPacket(const CRTPPacket *p)
+{
+  ASSERT(p);
+
+  xQueueHandle queue = queues[p->port];
+  if (queue == NULL) {
+    return pdFALSE;
+  }
+
+  const BaseType_t result = xQueueSend(queue, p, 0);
+  queueMonitorSent(qmCrtpRx, queue, result);
+  return result;
+}
+
+static CrtpTxClass txClassOf(uint8_t port, uint8_t channel)
+{
+  switch (port) {
+    case CRTP_PORT_LOG:
+      return (channel == CRTP_LOG_DATA_CHANNEL) ? crtpTxLog : crtpTxControl;
+    case CRTP_PORT_CONSOLE:
+      return crtpTxConsole;
+    case CRTP_PORT_MEM:
+      return crtpTxMem;
+    default:
+      return crtpTxControl;
+  }
+}
+
 int crtpGetFreeTxQueuePackets(void)
 {
-  return (CRTP_TX_QUEUE_SIZE - uxQueueMessagesWaiting(txQueue));
+  int free = 0;
+
+  for (int i = 0; i < CRTP_TX_NBR_OF_CLASSES; i++) {
+    free += uxQueueSpacesAvailable(txQueues[i]);
+  }
+
+  return free;
+}
+
+int crtpGetFreeTxQueuePacketsOfPort(CRTPPort port)
+{
+  return uxQueueSpacesAvailable(txQueues[txClassOf(port, CRTP_LOG_DATA_CHANNEL)]);
+}
+
+/* The class of the next packet to send, or -1 if all queues are empty. The
+ * credits are spent by the caller once the packet is out. */
+static int nextTxClass(uint8_t credits[CRTP_TX_NBR_OF_CLASSES])
+{
+  if (uxQueueMessagesWaiting(txQueues[crtpTxControl]) > 0) {
+    return crtpTxControl;
+  }
+
+  bool isWaiting = false;
+  for (int i = crtpTxLog; i < CRTP_TX_NBR_OF_CLASSES; i++) {
+    if (uxQueueMessagesWaiting(txQueues[i]) > 0) {
+      if (credits[i] > 0) {
+        return i;
+      }
+      isWaiting = true;
+    }
+  }
+
+  if (!isWaiting) {
+    return -1;
+  }
+
+  // The waiting classes spent their share of the round, start the next one
+  int next = -1;
+  for (int i = CRTP_TX_NBR_OF_CLASSES - 1; i >= crtpTxLog; i--) {
+    credits[i] = txWeights[i];
+    if (uxQueueMessagesWaiting(txQueues[i]) > 0) {
+      next = i;
+    }
+  }
+
+  return next;
 }
 
 void crtpTxTask(void *param)
 {
   CRTPPacket p;
+  uint8_t credits[CRTP_TX_NBR_OF_CLASSES] = { 0 };
 
   while (true)
   {
     if (link != &nopLink)
     {
-      if (xQueueReceive(txQueue, &p, portMAX_DELAY) == pdTRUE)
+      const int txClass = nextTxClass(credits);
+      if (txClass < 0)
       {
-        // Keep testing, if the link changes to USB it will go though
-        while (link->sendPacket(&p) == false)
-        {
-          // Relaxation time
-          vTaskDelay(M2T(10));
-        }
-        stats.txCount++;
-        updateStats();
+        // Woken by the next send
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        continue;
       }
+
+      xQueuePeek(txQueues[txClass], &p, 0);
+      if (link->sendPacket(&p) == false)
+      {
+        // Keep it queued, the link may take a packet of another class first
+        vTaskDelay(M2T(CRTP_TX_RETRY_MS));
+        continue;
+      }
+
+      BaseType_t result = xQueueReceive(txQueues[txClass], &p, 0);
+      if (txClass == crtpTxControl)
+      {
+        queueMonitorReceived(qmCrtpTx, result);
+      }
+      else if (credits[txClass] > 0)
+      {
+        credits[txClass]--;
+      }
+      stats.txCount++;
+      updateStats();
     }
     else
     {
@@ -171,6 +337,53 @@ void crtpTxTask(void *param)
   }
 }
 
+/* Tell the host a packet was dropped, once per tick and port, the replies
+ * to what was queued need the room in the TX queue more */
+static void sendBusy(const CRTPPacket *dropped)
+{
+  const TickType_t now = xTaskGetTickCount();
+
+  if (rxBusyTicks[dropped->port] == now) {
+    return;
+  }
+  rxBusyTicks[dropped->port] = now;
+
+  CRTPPacket busy = { .size = sizeof(crtpLinkBusy_t) };
+  const crtpLinkBusy_t info = {
+    .port = dropped->port,
+    .channel = dropped->channel,
+    .dropped = (uint16_t)rxDropped[dropped->port],
+  };
+
+  busy.port = CRTP_PORT_LINK;
+  busy.channel = CRTP_LINK_BUSY_CHANNEL;
+  memcpy(busy.data, &info, sizeof(info));
+  if (crtpSendPacket(&busy) == pdTRUE) {
+    rxBusySent++;
+  }
+}
+
+/* Queue a packet for the task of its port, a full queue drops by the policy of the port */
+static void queuePacket(const CRTPPacket *pk)
+{
+  xQueueHandle queue = queues[pk->port];
+  BaseType_t result = xQueueSend(queue, pk, 0);
+
+  if (result == errQUEUE_FULL) {
+    rxDropped[pk->port]++;
+    if (rxQueueConfigs[pk->port].policy == crtpDropOldest) {
+      CRTPPacket oldest;
+
+      // The task may have taken one meanwhile, then there is room already
+      xQueueReceive(queue, &oldest, 0);
+      result = xQueueSend(queue, pk, 0);
+    } else {
+      sendBusy(pk);
+    }
+  }
+  queueMonitorSent(qmCrtpRx, queue, result);
+}
+
 void crtpRxTask(void *param)
 {
   CRTPPacket p;
@@ -179,20 +392,26 @@ void crtpRxTask(void *param)
   {
     if (link != &nopLink)
     {
-      if (!link->receivePacket(&p))
+      // The link may change while a borrowed packet is dispatched
+      struct crtpLinkOperations *rxLink = link;
+      CRTPPacket *pk = &p;
+      bool isRef = (rxLink->receivePacketRef != NULL);
+
+      if (!(isRef ? rxLink->receivePacketRef(&pk) : rxLink->receivePacket(&p)))
       {
-        if (queues[p.port])
+        if (queues[pk->port])
         {
-          if (xQueueSend(queues[p.port], &p, 0) == errQUEUE_FULL)
-          {
-            // We should never drop packet
-            ASSERT(0);
-          }
+          queuePacket(pk);
         }
 
-        if (callbacks[p.port])
+        if (callbacks[pk->port])
         {
-          callbacks[p.port](&p);
+          callbacks[pk->port](pk);
+        }
+
+        if (isRef)
+        {
+          rxLink->releasePacket(pk);
         }
 
         stats.rxCount++;
@@ -214,25 +433,114 @@ void crtpRegisterPortCB(int port, CrtpCallback cb)
   callbacks[port] = cb;
 }
 
-int crtpSendPacket(CRTPPacket *p)
+void crtpRegisterPortCBDirect(int port, CrtpCallback cb)
+{
+  if (port < 0 || port >= CRTP_NBR_OF_PORTS)
+    return;
+
+  ASSERT(queues[port] == NULL);
+
+  callbacks[port] = cb;
+  isDirect[port] = true;
+}
+
+bool crtpIsPortDirect(int port)
+{
+  return port >= 0 && port < CRTP_NBR_OF_PORTS && isDirect[port];
+}
+
+void crtpDispatchDirect(CRTPPacket *pk)
+{
+  const CrtpCallback cb = callbacks[pk->port];
+
+  // The link checked its framing, what is left is what the decoders rely on
+  if (!isDirect[pk->port] || cb == NULL || pk->size == 0 || pk->size > CRTP_MAX_DATA_SIZE) {
+    stats.rxDirectDropped++;
+    return;
+  }
+
+  cb(pk);
+  stats.rxDirectCount++;
+}
+
+static int sendPacketWait(CRTPPacket *p, TickType_t wait)
 {
   ASSERT(p);
   ASSERT(p->size <= CRTP_MAX_DATA_SIZE);
 
-  return xQueueSend(txQueue, p, 0);
+  const CrtpTxClass txClass = txClassOf(p->port, p->channel);
+  BaseType_t result = xQueueSend(txQueues[txClass], p, wait);
+  if (txClass == crtpTxControl) {
+    queueMonitorSent(qmCrtpTx, txQueues[txClass], result);
+  }
+
+  if (result == pdTRUE) {
+    xTaskNotifyGive(txTaskHandle);
+  } else {
+    txDropped[txClass]++;
+  }
+
+  return result;
+}
+
+int crtpSendPacket(CRTPPacket *p)
+{
+  return sendPacketWait(p, 0);
 }
 
 int crtpSendPacketBlock(CRTPPacket *p)
 {
-  ASSERT(p);
-  ASSERT(p->size <= CRTP_MAX_DATA_SIZE);
+  return sendPacketWait(p, portMAX_DELAY);
+}
+
+static uint16_t maxDataSizeOf(const struct crtpLinkOperations *lk)
+{
+#ifdef CONFIG_CRTP_LARGE_FRAMES
+  if (lk->getMaxDataSize && lk->sendLargePacket) {
+    const uint16_t size = lk->getMaxDataSize();
+
+    if (size > CRTP_MAX_DATA_SIZE) {
+      return size < CRTP_LARGE_MAX_DATA_SIZE ? size : CRTP_LARGE_MAX_DATA_SIZE;
+    }
+  }
+#endif
+
+  return CRTP_MAX_DATA_SIZE;
+}
+
+uint16_t crtpGetMaxDataSize(void)
+{
+  return maxDataSizeOf(link);
+}
+
+int crtpSendLargePacket(uint8_t header, const uint8_t *data, uint16_t size)
+{
+  if (size <= CRTP_MAX_DATA_SIZE) {
+    CRTPPacket p = { .size = size };
+
+    p.header = header;
+    memcpy(p.data, data, size);
+    return crtpSendPacket(&p);
+  }
+
+  // The link may change while the frame is sent
+  struct crtpLinkOperations *txLink = link;
 
-  return xQueueSend(txQueue, p, portMAX_DELAY);
+  if (size > maxDataSizeOf(txLink) || !txLink->sendLargePacket(header, data, size)) {
+    stats.txLargeDropped++;
+    return pdFALSE;
+  }
+
+  stats.txLargeCount++;
+  return pdTRUE;
 }
 
 int crtpReset(void)
 {
-  xQueueReset(txQueue);
+  for (int i = 0; i < CRTP_TX_NBR_OF_CLASSES; i++) {
+    xQueueReset(txQueues[i]);
+  }
+  queueMonitorReset(qmCrtpTx);
   if (link->reset) {
     link->reset();
   }
@@ -288,4 +596,18 @@ static void updateStats()
 LOG_GROUP_START(crtp)
 LOG_ADD(LOG_UINT16, rxRate, &stats.rxRate)
 LOG_ADD(LOG_UINT16, txRate, &stats.txRate)
+LOG_ADD(LOG_UINT32, txDropCtrl, &txDropped[crtpTxControl])
+LOG_ADD(LOG_UINT32, txDropLog, &txDropped[crtpTxLog])
+LOG_ADD(LOG_UINT32, txDropCons, &txDropped[crtpTxConsole])
+LOG_ADD(LOG_UINT32, txDropMem, &txDropped[crtpTxMem])
+LOG_ADD(LOG_UINT32, rxDirect, &stats.rxDirectCount)
+LOG_ADD(LOG_UINT32, rxDirectDrop, &stats.rxDirectDropped)
+LOG_ADD(LOG_UINT32, txLarge, &stats.txLargeCount)
+LOG_ADD(LOG_UINT32, txLargeDrop, &stats.txLargeDropped)
+LOG_ADD(LOG_UINT32, rxDropParam, &rxDropped[CRTP_PORT_PARAM])
+LOG_ADD(LOG_UINT32, rxDropMem, &rxDropped[CRTP_PORT_MEM])
+LOG_ADD(LOG_UINT32, rxDropLog, &rxDropped[CRTP_PORT_LOG])
+LOG_ADD(LOG_UINT32, rxDropHl, &rxDropped[CRTP_PORT_SETPOINT_HL])
+LOG_ADD(LOG_UINT32, rxDropNav, &rxDropped[CRTP_PORT_PLATFORM])
+LOG_ADD(LOG_UINT32, rxBusy, &rxBusySent)
 LOG_GROUP_STOP(tdoa)
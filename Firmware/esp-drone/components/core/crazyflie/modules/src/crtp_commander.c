@@ -44,8 +44,9 @@ void crtpCommanderInit(void)
   }
 
   crtpInit();
-  crtpRegisterPortCB(CRTP_PORT_SETPOINT, commanderCrtpCB);
-  crtpRegisterPortCB(CRTP_PORT_SETPOINT_GENERIC, commanderCrtpCB);
+  // Straight from the link, commanderSetSetpoint() only overwrites a mailbox
+  crtpRegisterPortCBDirect(CRTP_PORT_SETPOINT, commanderCrtpCB);
+  crtpRegisterPortCBDirect(CRTP_PORT_SETPOINT_GENERIC, commanderCrtpCB);
   isInit = true;
 }
 
@@ -144,8 +145,7 @@ static void commanderCrtpCB(CRTPPacket* pk)
       autonavEnableManualOverride(false);
       break;
     case SET_SETPOINT_CHANNEL:
-      crtpCommanderGenericDecodeSetpoint(&setpoint, pk);
-      commanderSetSetpoint(&setpoint, COMMANDER_PRIORITY_CRTP);
+      crtpCommanderGenericSetSetpoint(pk, COMMANDER_PRIORITY_CRTP);
       break;
     case META_COMMAND_CHANNEL: {
         uint8_t metaCmd = pk->data[0];
@@ -49,6 +49,11 @@
  * The type is defined bellow together with a decoder function that should take
  * the data buffer in and fill up a setpoint_t structure.
  * The maximum data size is 29 bytes.
+ *
+ * The data is copied to a word aligned buffer before decoding, so the packets
+ * are declared aligned(4) and their fields are read with aligned loads
+ * instead of byte by byte. Streamed setpoints are decoded straight into the
+ * setpoint of the commander, see commanderDecodeSetpoint().
  */
 
 /* To add a new packet:
@@ -76,7 +81,8 @@ enum packet_type {
 
 /* ---===== 2 - Decoding functions =====--- */
 /* The setpoint structure is reinitialized to 0 before being passed to the
- * functions
+ * functions, except the quaternion which is only read with mode.quat. A
+ * decoder that sets mode.quat writes the quaternion.
  */
 
 /* stopDecoder
@@ -95,7 +101,7 @@ struct velocityPacket_s {
   float vy;        // ...
   float vz;        // ...
   float yawrate;  // deg/s
-} __attribute__((packed));
+} __attribute__((packed, aligned(4)));
 static void velocityDecoder(setpoint_t *setpoint, uint8_t type, const void *data, size_t datalen)
 {
   const struct velocityPacket_s *values = data;
@@ -123,7 +129,7 @@ struct zDistancePacket_s {
   float pitch;           // ...
   float yawrate;         // deg/s
   float zDistance;        // m in the world frame of reference
-} __attribute__((packed));
+} __attribute__((packed, aligned(4)));
 static void zDistanceDecoder(setpoint_t *setpoint, uint8_t type, const void *data, size_t datalen)
 {
   const struct zDistancePacket_s *values = data;
@@ -241,7 +247,7 @@ struct altHoldPacket_s {
   float pitch;           // ...
   float yawrate;         // deg/s
   float zVelocity;       // m/s in the world frame of reference
-} __attribute__((packed));
+} __attribute__((packed, aligned(4)));
 static void altHoldDecoder(setpoint_t *setpoint, uint8_t type, const void *data, size_t datalen)
 {
   const struct altHoldPacket_s *values = data;
@@ -274,7 +280,7 @@ struct hoverPacket_s {
   float vy;           // ...
   float yawrate;      // deg/s
   float zDistance;    // m in the world frame of reference
-} __attribute__((packed));
+} __attribute__((packed, aligned(4)));
 static void hoverDecoder(setpoint_t *setpoint, uint8_t type, const void *data, size_t datalen)
 {
   const struct hoverPacket_s *values = data;
@@ -311,7 +317,7 @@ struct fullStatePacket_s {
   int16_t rateRoll;  // angular velocity - milliradians / sec
   int16_t ratePitch; //  (NOTE: limits to about 5 full circles per sec.
   int16_t rateYaw;   //   may not be enough for extremely aggressive flight.)
-} __attribute__((packed));
+} __attribute__((packed, aligned(4)));
 static void fullStateDecoder(setpoint_t *setpoint, uint8_t type, const void *data, size_t datalen)
 {
   const struct fullStatePacket_s *values = data;
@@ -354,7 +360,7 @@ setpoint->attitudeQuaternion.q3 = qtmp[3];
    float y;
    float z;
    float yaw;   // Orientation in degree
- } __attribute__((packed));
+ } __attribute__((packed, aligned(4)));
 static void positionDecoder(setpoint_t *setpoint, uint8_t type, const void *data, size_t datalen)
 {
   const struct positionPacket_s *values = data;
@@ -386,23 +392,54 @@ const static packetDecoder_t packetDecoders[] = {
 };
 
 /* Decoder switch */
-void crtpCommanderGenericDecodeSetpoint(setpoint_t *setpoint, CRTPPacket *pk)
+// A packet with its data moved to an aligned buffer
+struct genericPacket_s {
+  uint8_t type;
+  size_t datalen;
+  union {
+    uint32_t words[CRTP_MAX_DATA_SIZE / 4];
+    uint8_t bytes[CRTP_MAX_DATA_SIZE];
+  } data;
+};
+
+// Unknown types decode as stop, as they always did
+static void genericPacketUnpack(struct genericPacket_s *packet, const CRTPPacket *pk)
 {
-  static int nTypes = -1;
+  const int nTypes = sizeof(packetDecoders)/sizeof(packetDecoders[0]);
 
   ASSERT(pk->size > 0);
 
-  if (nTypes<0) {
-    nTypes = sizeof(packetDecoders)/sizeof(packetDecoders[0]);
+  packet->type = pk->data[0];
+  packet->datalen = pk->size - 1;
+  if (packet->type >= nTypes || packetDecoders[packet->type] == NULL) {
+    packet->type = stopType;
+    packet->datalen = 0;
   }
+  memcpy(packet->data.bytes, &pk->data[1], packet->datalen);
+}
 
-  uint8_t type = pk->data[0];
+static void genericPacketDecode(setpoint_t *setpoint, const void *data)
+{
+  const struct genericPacket_s *packet = data;
+
+  packetDecoders[packet->type](setpoint, packet->type, packet->data.bytes, packet->datalen);
+}
+
+void crtpCommanderGenericDecodeSetpoint(setpoint_t *setpoint, CRTPPacket *pk)
+{
+  struct genericPacket_s packet;
 
+  genericPacketUnpack(&packet, pk);
   memset(setpoint, 0, sizeof(setpoint_t));
+  genericPacketDecode(setpoint, &packet);
+}
 
-  if (type<nTypes && (packetDecoders[type] != NULL)) {
-    packetDecoders[type](setpoint, type, ((char*)pk->data)+1, pk->size-1);
-  }
+bool crtpCommanderGenericSetSetpoint(CRTPPacket *pk, int priority)
+{
+  struct genericPacket_s packet;
+
+  genericPacketUnpack(&packet, pk);
+  return commanderDecodeSetpoint(genericPacketDecode, &packet, priority);
 }
 
 // Params for generic CRTP handlers
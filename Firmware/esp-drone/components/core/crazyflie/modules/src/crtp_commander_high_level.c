@@ -47,14 +47,18 @@ such as: take-off, landing, polynomial trajectories.
 #include "task.h"
 #include "semphr.h"
 
+#include "esp_partition.h"
+
 // Crazyswarm includes
 #include "crtp.h"
 #include "crtp_commander_high_level.h"
+#include "commander.h"
 #include "planner.h"
 #include "log.h"
 #include "param.h"
 #include "stm32_legacy.h"
 #include "static_mem.h"
+#include "stabilizer.h"
 
 #define DEBUG_MODULE "CTRL_HL"
 #include "debug_cf.h"
@@ -64,7 +68,7 @@ such as: take-off, landing, polynomial trajectories.
 enum TrajectoryLocation_e {
   TRAJECTORY_LOCATION_INVALID = 0,
   TRAJECTORY_LOCATION_MEM     = 1, // for trajectories that are uploaded dynamically
-  // Future features might include trajectories on flash or uSD card
+  TRAJECTORY_LOCATION_FLASH   = 2, // uploaded to the traj flash partition, offset in it
 };
 
 struct trajectoryDescription
@@ -76,7 +80,7 @@ struct trajectoryDescription
     struct {
       uint32_t offset;  // offset in uploaded memory
       uint8_t n_pieces;
-    } __attribute__((packed)) mem; // if trajectoryLocation is TRAJECTORY_LOCATION_MEM
+    } __attribute__((packed)) mem; // if trajectoryLocation is TRAJECTORY_LOCATION_MEM or _FLASH
   } trajectoryIdentifier;
 } __attribute__((packed));
 
@@ -86,22 +90,94 @@ struct trajectoryDescription
 #define TRAJECTORY_MEMORY_SIZE 4096
 extern uint8_t trajectories_memory[TRAJECTORY_MEMORY_SIZE];
 
+/*
+ * Trajectories too large for trajectories_memory are uploaded to the traj
+ * flash partition through the MEM_TYPE_TRAJ_FLASH memory. The partition is
+ * memory mapped, the planner reads the pieces from flash through the cache
+ * and the compressed reader decodes them as it goes, nothing is copied to RAM.
+ *
+ * A write at address 0 starts a new upload. The client must wait for its ack
+ * before sending the rest, then it can keep a window of writes in flight:
+ * sectors are erased as the writes reach them. Erasing stalls both cores, so
+ * uploads are only accepted while not flying, with the planner stopped. A
+ * trajectory only starts once all of it is found in its memory.
+ */
+#define TRAJ_FLASH_PARTITION_TYPE     0x40
+#define TRAJ_FLASH_PARTITION_SUBTYPE  0x01
+#define TRAJ_FLASH_PARTITION_LABEL    "traj"
+#define TRAJ_FLASH_SECTOR_SIZE        4096
+
 #define ALL_GROUPS 0
 
+// The commands posted to the HL task by the tasks that may not wait on
+// lockTraj, see crtpCommanderHighLevelPostLandWithVelocity(). They are not
+// answered.
+#define HL_CHANNEL_POSTED 1
+
 // Global variables
-uint8_t trajectories_memory[TRAJECTORY_MEMORY_SIZE];
+BULK_EXT_RAM_ZERO_INIT uint8_t trajectories_memory[TRAJECTORY_MEMORY_SIZE] __attribute__((aligned(4)));
 static struct trajectoryDescription trajectory_descriptions[NUM_TRAJECTORY_DEFINITIONS];
 
 static bool isInit = false;
-static struct planner planner;
 static uint8_t group_mask;
-static struct vec pos; // last known setpoint (position [m])
-static struct vec vel; // last known setpoint (velocity [m/s])
-static float yaw; // last known setpoint yaw (yaw [rad])
-static struct piecewise_traj trajectory;
-static struct piecewise_traj_compressed  compressed_trajectory;
 
-// makes sure that we don't evaluate the trajectory while it is being changed
+/*
+ * A plan and the trajectories it flies, evaluating it moves their cursors.
+ *
+ * The commands plan into draft, one at a time under lockTraj, and publish a
+ * copy of it once planned. The stabilizer takes the copy over into live at
+ * its next setpoint and evaluates live without any lock, a command taking
+ * long to plan never holds up a setpoint. published is written and read like
+ * the setpoint mailbox of the commander: the sequence is odd while it is
+ * written, the stabilizer copies it again if the sequence changed meanwhile.
+ */
+struct planSlot {
+  struct planner planner;
+  struct piecewise_traj trajectory;
+  struct piecewise_traj_compressed compressed_trajectory;
+};
+
+static struct planSlot draft;
+static uint32_t draftSequence; // of the copy of draft last published
+static struct {
+  uint32_t sequence;
+  struct planSlot slot;
+} published;
+static portMUX_TYPE publishedLock = portMUX_INITIALIZER_UNLOCKED;
+// Stabilizer only
+static struct planSlot live;
+static uint32_t liveSequence;
+
+/*
+ * The state of the plan last published, with its sequence above. The
+ * stabilizer sets it to idle when live lands or stops, unless a newer plan
+ * was published since, and the next command stops draft as well.
+ */
+// The states of planner.h take two bits, LANDING is 3
+#define PLAN_STATUS_STATE_BITS 2
+#define PLAN_STATUS_STATE_MASK ((1u << PLAN_STATUS_STATE_BITS) - 1)
+#define PLAN_STATUS(sequence, state) (((sequence) << PLAN_STATUS_STATE_BITS) | (state))
+static uint32_t planStatus;
+
+// The last known setpoint, written by the stabilizer and by
+// crtpCommanderHighLevelTellState(), sequenced like published
+struct lastSetpoint {
+  struct vec pos; // position [m]
+  struct vec vel; // velocity [m/s]
+  float yaw;      // yaw [rad]
+};
+static struct {
+  uint32_t sequence;
+  struct lastSetpoint setpoint;
+} last;
+static portMUX_TYPE lastLock = portMUX_INITIALIZER_UNLOCKED;
+
+// The last known setpoint as the command being planned started
+static struct vec pos;
+static struct vec vel;
+static float yaw;
+
+// serializes the commands, the stabilizer never waits on it to evaluate
 static xSemaphoreHandle lockTraj;
 static StaticSemaphore_t lockTrajBuffer;
 
@@ -109,17 +185,44 @@ static StaticSemaphore_t lockTrajBuffer;
 static float defaultTakeoffVelocity = 0.5f;
 static float defaultLandingVelocity = 0.5f;
 
-// TODO
+// The scheduled command, HL task only
+static struct {
+  bool isPending;
+  uint64_t startUs;
+  uint8_t command;
+  uint8_t data[CRTP_MAX_DATA_SIZE];
+  uint8_t id;
+  bool hasId;
+} scheduled;
+static uint32_t scheduledLateUs; // of the last command run, from its start time
+
+static const esp_partition_t *trajFlashPartition;
+static const uint8_t *trajFlashMemory;
+static esp_partition_mmap_handle_t trajFlashMapHandle;
+// Sectors below this offset have been erased since the upload started
+static uint32_t trajFlashErasedEnd;
+static bool trajFlashIsUploading;
+
 // Trajectory memory handling from the memory module
-// static uint32_t handleMemGetSize(void) { return crtpCommanderHighLevelTrajectoryMemSize(); }
-// static bool handleMemRead(const uint32_t memAddr, const uint8_t readLen, uint8_t* buffer);
-// static bool handleMemWrite(const uint32_t memAddr, const uint8_t writeLen, const uint8_t* buffer);
-// static const MemoryHandlerDef_t memDef = {
-//   .type = MEM_TYPE_TRAJ,
-//   .getSize = handleMemGetSize,
-//   .read = handleMemRead,
-//   .write = handleMemWrite,
-// };
+static uint32_t handleMemGetSize(void) { return crtpCommanderHighLevelTrajectoryMemSize(); }
+static bool handleMemRead(const uint32_t memAddr, const uint8_t readLen, uint8_t* buffer);
+static bool handleMemWrite(const uint32_t memAddr, const uint8_t writeLen, const uint8_t* buffer);
+static const MemoryHandlerDef_t memDef = {
+  .type = MEM_TYPE_TRAJ,
+  .getSize = handleMemGetSize,
+  .read = handleMemRead,
+  .write = handleMemWrite,
+};
+
+static uint32_t handleFlashMemGetSize(void) { return trajFlashPartition->size; }
+static bool handleFlashMemRead(const uint32_t memAddr, const uint8_t readLen, uint8_t* buffer);
+static bool handleFlashMemWrite(const uint32_t memAddr, const uint8_t writeLen, const uint8_t* buffer);
+static const MemoryHandlerDef_t flashMemDef = {
+  .type = MEM_TYPE_TRAJ_FLASH,
+  .getSize = handleFlashMemGetSize,
+  .read = handleFlashMemRead,
+  .write = handleFlashMemWrite,
+};
 
 STATIC_MEM_TASK_ALLOC(crtpCommanderHighLevelTask, CMD_HIGH_LEVEL_TASK_STACKSIZE);
 
@@ -138,6 +241,8 @@ enum TrajectoryCommand_e {
   COMMAND_LAND_2                  = 8,
   COMMAND_TAKEOFF_WITH_VELOCITY   = 9,
   COMMAND_LAND_WITH_VELOCITY      = 10,
+  // Away from the ids of the upstream firmware
+  COMMAND_SCHEDULED               = 32,
 };
 
 struct data_set_group_mask {
@@ -231,6 +336,18 @@ struct data_define_trajectory {
   struct trajectoryDescription description;
 } __attribute__((packed));
 
+// runs another command at a time given relative to the sending of the packet,
+// e.g. broadcast to a swarm that starts all at once. The host may repeat the
+// packet to make up for losses, with the same id and startInMs counted down.
+// Only the commands with a groupMask first can be scheduled, a CF not in the
+// group ignores the packet, there is one command scheduled at a time.
+struct data_scheduled {
+  uint8_t id;          // of the scheduled command, the same for all its repeats
+  uint16_t startInMs;  // ms (from sending this packet to running the command)
+  uint8_t command;     // one of TrajectoryCommand_e
+  uint8_t data[];      // the data of the command
+} __attribute__((packed));
+
 // Private functions
 static void crtpCommanderHighLevelTask(void * prm);
 
@@ -245,6 +362,7 @@ static int stop(const struct data_stop* data);
 static int go_to(const struct data_go_to* data);
 static int start_trajectory(const struct data_start_trajectory* data);
 static int define_trajectory(const struct data_define_trajectory* data);
+static int schedule(const struct data_scheduled* data, const size_t size);
 
 // Helper functions
 static struct vec state2vec(struct vec3_s v)
@@ -256,57 +374,159 @@ bool isInGroup(uint8_t g) {
   return g == ALL_GROUPS || (g & group_mask) != 0;
 }
 
+static void sequenceWriteBegin(portMUX_TYPE *lock, uint32_t *sequence)
+{
+  portENTER_CRITICAL(lock);
+  __atomic_store_n(sequence, *sequence + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void sequenceWriteEnd(portMUX_TYPE *lock, uint32_t *sequence)
+{
+  __atomic_store_n(sequence, *sequence + 1, __ATOMIC_RELEASE);
+  portEXIT_CRITICAL(lock);
+}
+
+// Copy what the sequence guards, returns the sequence of the copy
+static uint32_t sequenceRead(const uint32_t *sequence, void *to, const void *from, size_t size)
+{
+  uint32_t start;
+
+  do {
+    start = __atomic_load_n(sequence, __ATOMIC_ACQUIRE);
+    memcpy(to, from, size);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  } while ((start & 1) || __atomic_load_n(sequence, __ATOMIC_RELAXED) != start);
+
+  return start;
+}
+
+static void lastSetpointWrite(struct vec setpointPos, struct vec setpointVel, float setpointYaw)
+{
+  sequenceWriteBegin(&lastLock, &last.sequence);
+  last.setpoint.pos = setpointPos;
+  last.setpoint.vel = setpointVel;
+  last.setpoint.yaw = setpointYaw;
+  sequenceWriteEnd(&lastLock, &last.sequence);
+}
+
+// Point a copy of a slot at its own trajectories instead of those of the original
+static void planSlotRelocate(struct planSlot *slot, const struct planSlot *original)
+{
+  struct planner *p = &slot->planner;
+
+  p->planned_trajectory.pieces = p->pieces;
+  if (p->type == TRAJECTORY_TYPE_PIECEWISE_COMPRESSED) {
+    p->compressed_trajectory = &slot->compressed_trajectory;
+  } else if (p->trajectory == &original->planner.planned_trajectory) {
+    p->trajectory = &p->planned_trajectory;
+  } else if (p->trajectory != NULL) {
+    p->trajectory = &slot->trajectory;
+  }
+}
+
+static void planPublish(void)
+{
+  sequenceWriteBegin(&publishedLock, &published.sequence);
+  memcpy(&published.slot, &draft, sizeof(draft));
+  planSlotRelocate(&published.slot, &draft);
+  draftSequence = published.sequence + 1;
+  __atomic_store_n(&planStatus, PLAN_STATUS(draftSequence, draft.planner.state), __ATOMIC_RELEASE);
+  sequenceWriteEnd(&publishedLock, &published.sequence);
+}
+
+// Start a command on draft, with the last setpoint and what the stabilizer did since
+static void planBegin(void)
+{
+  xSemaphoreTake(lockTraj, portMAX_DELAY);
+
+  if (__atomic_load_n(&planStatus, __ATOMIC_ACQUIRE) == PLAN_STATUS(draftSequence, TRAJECTORY_STATE_IDLE)) {
+    plan_stop(&draft.planner);
+  }
+
+  struct lastSetpoint setpoint;
+  sequenceRead(&last.sequence, &setpoint, &last.setpoint, sizeof(setpoint));
+  pos = setpoint.pos;
+  vel = setpoint.vel;
+  yaw = setpoint.yaw;
+}
+
+// End a command, draft is published if it was planned
+static void planEnd(int result)
+{
+  if (result == 0) {
+    planPublish();
+  }
+
+  xSemaphoreGive(lockTraj);
+}
+
 void crtpCommanderHighLevelInit(void)
 {
   if (isInit) {
     return;
   }
 
-  //memoryRegisterHandler(&memDef);
-  plan_init(&planner);
-
-  //Start the trajectory task
-  STATIC_MEM_TASK_CREATE(crtpCommanderHighLevelTask, crtpCommanderHighLevelTask, CMD_HIGH_LEVEL_TASK_NAME, NULL, CMD_HIGH_LEVEL_TASK_PRI);
+  memoryRegisterHandler(&memDef);
+
+  trajFlashPartition = esp_partition_find_first(TRAJ_FLASH_PARTITION_TYPE, TRAJ_FLASH_PARTITION_SUBTYPE, TRAJ_FLASH_PARTITION_LABEL);
+  if (trajFlashPartition == NULL) {
+    DEBUG_PRINTI("No %s partition, trajectories are in RAM only\n", TRAJ_FLASH_PARTITION_LABEL);
+  } else if (esp_partition_mmap(trajFlashPartition, 0, trajFlashPartition->size, ESP_PARTITION_MMAP_DATA,
+                                (const void **)&trajFlashMemory, &trajFlashMapHandle) != ESP_OK) {
+    DEBUG_PRINTW("Could not map the %s partition\n", TRAJ_FLASH_PARTITION_LABEL);
+    trajFlashMemory = NULL;
+  } else {
+    memoryRegisterHandler(&flashMemDef);
+  }
 
   lockTraj = xSemaphoreCreateMutexStatic(&lockTrajBuffer);
 
-  pos = vzero();
-  vel = vzero();
-  yaw = 0;
+  plan_init(&draft.planner);
+  planPublish();
+  lastSetpointWrite(vzero(), vzero(), 0);
+
+  //Start the trajectory task
+  STATIC_MEM_TASK_CREATE(crtpCommanderHighLevelTask, crtpCommanderHighLevelTask, CMD_HIGH_LEVEL_TASK_NAME, NULL, CMD_HIGH_LEVEL_TASK_PRI);
 
   isInit = true;
 }
 
 bool crtpCommanderHighLevelIsStopped()
 {
-  return plan_is_stopped(&planner);
+  return (__atomic_load_n(&planStatus, __ATOMIC_ACQUIRE) & PLAN_STATUS_STATE_MASK) == TRAJECTORY_STATE_IDLE;
 }
 
 void crtpCommanderHighLevelTellState(const state_t *state)
 {
-  xSemaphoreTake(lockTraj, portMAX_DELAY);
-  pos = state2vec(state->position);
-  vel = state2vec(state->velocity);
-  yaw = radians(state->attitude.yaw);
-  xSemaphoreGive(lockTraj);
+  lastSetpointWrite(state2vec(state->position), state2vec(state->velocity), radians(state->attitude.yaw));
 }
 
 void crtpCommanderHighLevelGetSetpoint(setpoint_t* setpoint, const state_t *state)
 {
-  xSemaphoreTake(lockTraj, portMAX_DELAY);
+  // A plan published since the last setpoint takes over from now on
+  if (__atomic_load_n(&published.sequence, __ATOMIC_ACQUIRE) != liveSequence) {
+    liveSequence = sequenceRead(&published.sequence, &live, &published.slot, sizeof(live));
+    planSlotRelocate(&live, &published.slot);
+  }
+
+  const enum trajectory_state liveState = live.planner.state;
   float t = usecTimestamp() / 1e6;
-  struct traj_eval ev = plan_current_goal(&planner, t);
+  struct traj_eval ev = plan_current_goal(&live.planner, t);
   if (!is_traj_eval_valid(&ev)) {
     // programming error
-    plan_stop(&planner);
+    plan_stop(&live.planner);
+  }
+
+  if (live.planner.state != liveState) {
+    uint32_t status = PLAN_STATUS(liveSequence, liveState);
+    __atomic_compare_exchange_n(&planStatus, &status, PLAN_STATUS(liveSequence, live.planner.state),
+                                false, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
   }
-  xSemaphoreGive(lockTraj);
 
   // if we are on the ground, update the last setpoint with the current state estimate
-  if (plan_is_stopped(&planner)) {
-    pos = state2vec(state->position);
-    vel = state2vec(state->velocity);
-    yaw = radians(state->attitude.yaw);
+  if (!is_traj_eval_valid(&ev) && plan_is_stopped(&live.planner)) {
+    lastSetpointWrite(state2vec(state->position), state2vec(state->velocity), radians(state->attitude.yaw));
   }
 
   if (is_traj_eval_valid(&ev)) {
@@ -332,9 +552,7 @@ void crtpCommanderHighLevelGetSetpoint(setpoint_t* setpoint, const state_t *stat
     setpoint->acceleration.z = ev.acc.z;
 
     // store the last setpoint
-    pos = ev.pos;
-    vel = ev.vel;
-    yaw = ev.yaw;
+    lastSetpointWrite(ev.pos, ev.vel, ev.yaw);
   }
 }
 
@@ -385,15 +603,55 @@ static int handleCommand(const enum TrajectoryCommand_e command, const uint8_t*
   return ret;
 }
 
+/* Runs the scheduled command once its time has come, returns the ms until then */
+static int runScheduled(void)
+{
+  const uint64_t now = usecTimestamp();
+
+  if (now < scheduled.startUs) {
+    // Rounded up, the command runs in the first tick at or after its time
+    return (scheduled.startUs - now + 999) / 1000;
+  }
+
+  scheduled.isPending = false;
+  // The link was lost since, the landing of the commander goes first
+  if (commanderIsFailsafeLanding()) {
+    return 0;
+  }
+  scheduledLateUs = now - scheduled.startUs;
+  handleCommand(scheduled.command, scheduled.data);
+  return 0;
+}
+
 void crtpCommanderHighLevelTask(void * prm)
 {
   CRTPPacket p;
   crtpInitTaskQueue(CRTP_PORT_SETPOINT_HL);
 
   while(1) {
-    crtpReceivePacketBlock(CRTP_PORT_SETPOINT_HL, &p);
+    if (scheduled.isPending) {
+      const int waitMs = runScheduled();
+      if (waitMs == 0 ||
+          crtpReceivePacketWait(CRTP_PORT_SETPOINT_HL, &p, waitMs) != pdTRUE) {
+        continue;
+      }
+    } else {
+      crtpReceivePacketBlock(CRTP_PORT_SETPOINT_HL, &p);
+    }
 
-    int ret = handleCommand(p.data[0], &p.data[1]);
+    int ret;
+    if (p.data[0] == COMMAND_SCHEDULED) {
+      ret = schedule((const struct data_scheduled*)&p.data[1], p.size - 1);
+    } else {
+      if (p.data[0] == COMMAND_STOP && isInGroup(p.data[1])) {
+        scheduled.isPending = false;
+      }
+      ret = handleCommand(p.data[0], &p.data[1]);
+    }
+
+    if (p.channel == HL_CHANNEL_POSTED) {
+      continue;
+    }
 
     //answer
     p.data[3] = ret;
@@ -402,6 +660,52 @@ void crtpCommanderHighLevelTask(void * prm)
   }
 }
 
+int schedule(const struct data_scheduled* data, const size_t size)
+{
+  const uint64_t received = usecTimestamp();
+
+  if (size < sizeof(struct data_scheduled) + 1) {
+    return ENOEXEC;
+  }
+
+  switch (data->command) {
+    case COMMAND_TAKEOFF:
+    case COMMAND_LAND:
+    case COMMAND_TAKEOFF_2:
+    case COMMAND_LAND_2:
+    case COMMAND_TAKEOFF_WITH_VELOCITY:
+    case COMMAND_LAND_WITH_VELOCITY:
+    case COMMAND_STOP:
+    case COMMAND_GO_TO:
+    case COMMAND_START_TRAJECTORY:
+      break;
+    default:
+      return ENOEXEC;
+  }
+
+  // Checked here too, not to drop the command scheduled for this CF
+  const uint8_t groupMask = data->data[0];
+  if (!isInGroup(groupMask)) {
+    return 0;
+  }
+
+  // A repeat, the command is already scheduled or has run
+  if (scheduled.hasId && data->id == scheduled.id) {
+    return 0;
+  }
+
+  const size_t dataSize = size - sizeof(struct data_scheduled);
+  memset(scheduled.data, 0, sizeof(scheduled.data));
+  memcpy(scheduled.data, data->data, dataSize);
+  scheduled.command = data->command;
+  scheduled.id = data->id;
+  scheduled.startUs = received + data->startInMs * 1000ull;
+  scheduled.isPending = true;
+  scheduled.hasId = true;
+
+  return 0;
+}
+
 int set_group_mask(const struct data_set_group_mask* data)
 {
   group_mask = data->groupMask;
@@ -413,11 +717,11 @@ int takeoff(const struct data_takeoff* data)
 {
   int result = 0;
   if (isInGroup(data->groupMask)) {
-    xSemaphoreTake(lockTraj, portMAX_DELAY);
+    planBegin();
     DEBUG_PRINTD("take off !!!!!");
     float t = usecTimestamp() / 1e6;
-    result = plan_takeoff(&planner, pos, yaw, data->height, 0.0f, data->duration, t);
-    xSemaphoreGive(lockTraj);
+    result = plan_takeoff(&draft.planner, pos, yaw, data->height, 0.0f, data->duration, t);
+    planEnd(result);
   }
   return result;
 }
@@ -426,7 +730,7 @@ int takeoff2(const struct data_takeoff_2* data)
 {
   int result = 0;
   if (isInGroup(data->groupMask)) {
-    xSemaphoreTake(lockTraj, portMAX_DELAY);
+    planBegin();
     float t = usecTimestamp() / 1e6;
 
     float hover_yaw = data->yaw;
@@ -434,8 +738,8 @@ int takeoff2(const struct data_takeoff_2* data)
       hover_yaw = yaw;
     }
 
-    result = plan_takeoff(&planner, pos, yaw, data->height, hover_yaw, data->duration, t);
-    xSemaphoreGive(lockTraj);
+    result = plan_takeoff(&draft.planner, pos, yaw, data->height, hover_yaw, data->duration, t);
+    planEnd(result);
   }
   return result;
 }
@@ -444,7 +748,7 @@ int takeoff_with_velocity(const struct data_takeoff_with_velocity* data)
 {
   int result = 0;
   if (isInGroup(data->groupMask)) {
-    xSemaphoreTake(lockTraj, portMAX_DELAY);
+    planBegin();
     float t = usecTimestamp() / 1e6;
 
     float hover_yaw = data->yaw;
@@ -459,8 +763,8 @@ int takeoff_with_velocity(const struct data_takeoff_with_velocity* data)
 
     float velocity = data->velocity > 0 ? data->velocity : defaultTakeoffVelocity;
     float duration = fabsf(height - pos.z) / velocity;
-    result = plan_takeoff(&planner, pos, yaw, height, hover_yaw, duration, t);
-    xSemaphoreGive(lockTraj);
+    result = plan_takeoff(&draft.planner, pos, yaw, height, hover_yaw, duration, t);
+    planEnd(result);
   }
   return result;
 }
@@ -469,10 +773,10 @@ int land(const struct data_land* data)
 {
   int result = 0;
   if (isInGroup(data->groupMask)) {
-    xSemaphoreTake(lockTraj, portMAX_DELAY);
+    planBegin();
     float t = usecTimestamp() / 1e6;
-    result = plan_land(&planner, pos, yaw, data->height, 0.0f, data->duration, t);
-    xSemaphoreGive(lockTraj);
+    result = plan_land(&draft.planner, pos, yaw, data->height, 0.0f, data->duration, t);
+    planEnd(result);
   }
   return result;
 }
@@ -481,7 +785,7 @@ int land2(const struct data_land_2* data)
 {
   int result = 0;
   if (isInGroup(data->groupMask)) {
-    xSemaphoreTake(lockTraj, portMAX_DELAY);
+    planBegin();
     float t = usecTimestamp() / 1e6;
 
     float hover_yaw = data->yaw;
@@ -489,8 +793,8 @@ int land2(const struct data_land_2* data)
       hover_yaw = yaw;
     }
 
-    result = plan_land(&planner, pos, yaw, data->height, hover_yaw, data->duration, t);
-    xSemaphoreGive(lockTraj);
+    result = plan_land(&draft.planner, pos, yaw, data->height, hover_yaw, data->duration, t);
+    planEnd(result);
   }
   return result;
 }
@@ -499,7 +803,7 @@ int land_with_velocity(const struct data_land_with_velocity* data)
 {
   int result = 0;
   if (isInGroup(data->groupMask)) {
-    xSemaphoreTake(lockTraj, portMAX_DELAY);
+    planBegin();
     float t = usecTimestamp() / 1e6;
 
     float hover_yaw = data->yaw;
@@ -514,8 +818,8 @@ int land_with_velocity(const struct data_land_with_velocity* data)
 
     float velocity = data->velocity > 0 ? data->velocity : defaultLandingVelocity;
     float duration = fabsf(height - pos.z) / velocity;
-    result = plan_land(&planner, pos, yaw, height, hover_yaw, duration, t);
-    xSemaphoreGive(lockTraj);
+    result = plan_land(&draft.planner, pos, yaw, height, hover_yaw, duration, t);
+    planEnd(result);
   }
   return result;
 }
@@ -524,9 +828,9 @@ int stop(const struct data_stop* data)
 {
   int result = 0;
   if (isInGroup(data->groupMask)) {
-    xSemaphoreTake(lockTraj, portMAX_DELAY);
-    plan_stop(&planner);
-    xSemaphoreGive(lockTraj);
+    planBegin();
+    plan_stop(&draft.planner);
+    planEnd(result);
   }
   return result;
 }
@@ -542,76 +846,116 @@ int go_to(const struct data_go_to* data)
   int result = 0;
   if (isInGroup(data->groupMask)) {
     struct vec hover_pos = mkvec(data->x, data->y, data->z);
-    xSemaphoreTake(lockTraj, portMAX_DELAY);
+    planBegin();
     float t = usecTimestamp() / 1e6;
-    if (plan_is_stopped(&planner)) {
+    if (plan_is_stopped(&draft.planner)) {
       ev.pos = pos;
       ev.vel = vel;
       ev.yaw = yaw;
-      result = plan_go_to_from(&planner, &ev, data->relative, hover_pos, data->yaw, data->duration, t);
+      result = plan_go_to_from(&draft.planner, &ev, data->relative, hover_pos, data->yaw, data->duration, t);
     }
     else {
-      result = plan_go_to(&planner, data->relative, hover_pos, data->yaw, data->duration, t);
+      result = plan_go_to(&draft.planner, data->relative, hover_pos, data->yaw, data->duration, t);
     }
-    xSemaphoreGive(lockTraj);
+    planEnd(result);
   }
   return result;
 }
 
+// Start of the trajectory data and the bytes of its memory from there, NULL
+// if the offset is past the end of the memory
+static const uint8_t* trajectoryMemory(const struct trajectoryDescription* trajDesc, uint32_t* available)
+{
+  const uint32_t offset = trajDesc->trajectoryIdentifier.mem.offset;
+
+  if (trajDesc->trajectoryLocation == TRAJECTORY_LOCATION_MEM) {
+    if (offset < sizeof(trajectories_memory)) {
+      *available = sizeof(trajectories_memory) - offset;
+      return &trajectories_memory[offset];
+    }
+  } else if (trajDesc->trajectoryLocation == TRAJECTORY_LOCATION_FLASH) {
+    if (trajFlashMemory != NULL && offset < trajFlashPartition->size) {
+      *available = trajFlashPartition->size - offset;
+      return &trajFlashMemory[offset];
+    }
+  }
+
+  return NULL;
+}
+
+// Start of the trajectory data, NULL unless all of it is in the memory. A
+// compressed trajectory is walked up to its last piece.
+static const uint8_t* trajectoryData(const struct trajectoryDescription* trajDesc)
+{
+  uint32_t available;
+  const uint8_t* data = trajectoryMemory(trajDesc, &available);
+
+  if (data == NULL) {
+    return NULL;
+  }
+
+  if (trajDesc->trajectoryType == CRTP_CHL_TRAJECTORY_TYPE_POLY4D) {
+    const uint32_t size = trajDesc->trajectoryIdentifier.mem.n_pieces * sizeof(struct poly4d);
+    const bool isAligned = ((uintptr_t)data % __alignof__(struct poly4d)) == 0;
+    return isAligned && size <= available ? data : NULL;
+  }
+
+  return piecewise_compressed_size(data, available) > 0 ? data : NULL;
+}
+
 int start_trajectory(const struct data_start_trajectory* data)
 {
   int result = 0;
   if (isInGroup(data->groupMask)) {
     if (data->trajectoryId < NUM_TRAJECTORY_DEFINITIONS) {
       struct trajectoryDescription* trajDesc = &trajectory_descriptions[data->trajectoryId];
-      if (   trajDesc->trajectoryLocation == TRAJECTORY_LOCATION_MEM
+      const uint8_t* trajData = trajectoryData(trajDesc);
+      if (   trajData != NULL
           && trajDesc->trajectoryType == CRTP_CHL_TRAJECTORY_TYPE_POLY4D) {
-        xSemaphoreTake(lockTraj, portMAX_DELAY);
+        planBegin();
         float t = usecTimestamp() / 1e6;
-        trajectory.t_begin = t;
-        trajectory.timescale = data->timescale;
-        trajectory.n_pieces = trajDesc->trajectoryIdentifier.mem.n_pieces;
-        trajectory.pieces = (struct poly4d*)&trajectories_memory[trajDesc->trajectoryIdentifier.mem.offset];
+        draft.trajectory.t_begin = t;
+        draft.trajectory.timescale = data->timescale;
+        draft.trajectory.n_pieces = trajDesc->trajectoryIdentifier.mem.n_pieces;
+        draft.trajectory.pieces = (struct poly4d*)trajData;
         if (data->relative) {
-          trajectory.shift = vzero();
+          draft.trajectory.shift = vzero();
+          piecewise_rewind(&draft.trajectory);
           struct traj_eval traj_init;
           if (data->reversed) {
-            traj_init = piecewise_eval_reversed(&trajectory, trajectory.t_begin);
+            traj_init = piecewise_eval_reversed(&draft.trajectory, draft.trajectory.t_begin);
           }
           else {
-            traj_init = piecewise_eval(&trajectory, trajectory.t_begin);
+            traj_init = piecewise_eval(&draft.trajectory, draft.trajectory.t_begin);
           }
           struct vec shift_pos = vsub(pos, traj_init.pos);
-          trajectory.shift = shift_pos;
+          draft.trajectory.shift = shift_pos;
         } else {
-          trajectory.shift = vzero();
+          draft.trajectory.shift = vzero();
         }
-        result = plan_start_trajectory(&planner, &trajectory, data->reversed);
-        xSemaphoreGive(lockTraj);
-      } else if (trajDesc->trajectoryLocation == TRAJECTORY_LOCATION_MEM
+        result = plan_start_trajectory(&draft.planner, &draft.trajectory, data->reversed);
+        planEnd(result);
+      } else if (trajData != NULL
           && trajDesc->trajectoryType == CRTP_CHL_TRAJECTORY_TYPE_POLY4D_COMPRESSED) {
 
         if (data->timescale != 1 || data->reversed) {
           result = ENOEXEC;
         } else {
-          xSemaphoreTake(lockTraj, portMAX_DELAY);
+          planBegin();
           float t = usecTimestamp() / 1e6;
-          piecewise_compressed_load(
-            &compressed_trajectory,
-            &trajectories_memory[trajDesc->trajectoryIdentifier.mem.offset]
-          );
-          compressed_trajectory.t_begin = t;
+          piecewise_compressed_load(&draft.compressed_trajectory, trajData);
+          draft.compressed_trajectory.t_begin = t;
           if (data->relative) {
             struct traj_eval traj_init = piecewise_compressed_eval(
-              &compressed_trajectory, compressed_trajectory.t_begin
+              &draft.compressed_trajectory, draft.compressed_trajectory.t_begin
             );
             struct vec shift_pos = vsub(pos, traj_init.pos);
-            compressed_trajectory.shift = shift_pos;
+            draft.compressed_trajectory.shift = shift_pos;
           } else {
-            compressed_trajectory.shift = vzero();
+            draft.compressed_trajectory.shift = vzero();
           }
-          result = plan_start_compressed_trajectory(&planner, &compressed_trajectory);
-          xSemaphoreGive(lockTraj);
+          result = plan_start_compressed_trajectory(&draft.planner, &draft.compressed_trajectory);
+          planEnd(result);
         }
 
       }
@@ -629,13 +973,47 @@ int define_trajectory(const struct data_define_trajectory* data)
   return 0;
 }
 
-// static bool handleMemRead(const uint32_t memAddr, const uint8_t readLen, uint8_t* buffer) {
-//   return crtpCommanderHighLevelReadTrajectory(memAddr, readLen, buffer);
-// }
+static bool handleMemRead(const uint32_t memAddr, const uint8_t readLen, uint8_t* buffer) {
+  return crtpCommanderHighLevelReadTrajectory(memAddr, readLen, buffer);
+}
+
+static bool handleMemWrite(const uint32_t memAddr, const uint8_t writeLen, const uint8_t* buffer) {
+  return crtpCommanderHighLevelWriteTrajectory(memAddr, writeLen, buffer);
+}
+
+static bool handleFlashMemRead(const uint32_t memAddr, const uint8_t readLen, uint8_t* buffer) {
+  if (memAddr + readLen > trajFlashPartition->size) {
+    return false;
+  }
+
+  memcpy(buffer, &trajFlashMemory[memAddr], readLen);
+  return true;
+}
+
+static bool handleFlashMemWrite(const uint32_t memAddr, const uint8_t writeLen, const uint8_t* buffer) {
+  const uint32_t end = memAddr + writeLen;
+
+  if (end > trajFlashPartition->size || stabilizerIsFlying()) {
+    return false;
+  }
+
+  if (memAddr == 0) {
+    trajFlashErasedEnd = 0;
+    trajFlashIsUploading = true;
+  } else if (!trajFlashIsUploading) {
+    return false;
+  }
+
+  while (end > trajFlashErasedEnd) {
+    if (esp_partition_erase_range(trajFlashPartition, trajFlashErasedEnd, TRAJ_FLASH_SECTOR_SIZE) != ESP_OK) {
+      trajFlashIsUploading = false;
+      return false;
+    }
+    trajFlashErasedEnd += TRAJ_FLASH_SECTOR_SIZE;
+  }
 
-// static bool handleMemWrite(const uint32_t memAddr, const uint8_t writeLen, const uint8_t* buffer) {
-//   return crtpCommanderHighLevelWriteTrajectory(memAddr, writeLen, buffer);
-// }
+  return esp_partition_write(trajFlashPartition, memAddr, buffer, writeLen) == ESP_OK;
+}
 
 uint8_t* initCrtpPacket(CRTPPacket* packet, const enum TrajectoryCommand_e command)
 {
@@ -712,6 +1090,27 @@ int crtpCommanderHighLevelLandWithVelocity(const float height_m, const float vel
   return handleCommand(COMMAND_LAND_WITH_VELOCITY, (const uint8_t*)&data);
 }
 
+bool crtpCommanderHighLevelPostLandWithVelocity(const float height_m, const float velocity_m_s, bool relative)
+{
+  struct data_land_with_velocity data =
+  {
+    .height = height_m,
+    .heightIsRelative = relative,
+    .velocity = velocity_m_s,
+    .useCurrentYaw = true,
+    .groupMask = ALL_GROUPS,
+  };
+  CRTPPacket p = {
+    .port = CRTP_PORT_SETPOINT_HL,
+    .channel = HL_CHANNEL_POSTED,
+    .size = 1 + sizeof(data),
+  };
+
+  p.data[0] = COMMAND_LAND_WITH_VELOCITY;
+  memcpy(&p.data[1], &data, sizeof(data));
+  return crtpPostPacket(&p) == pdTRUE;
+}
+
 int crtpCommanderHighLevelLandYaw(const float absoluteHeight_m, const float duration_s, const float yaw)
 {
   struct data_land_2 data =
@@ -817,10 +1216,20 @@ bool crtpCommanderHighLevelReadTrajectory(const uint32_t offset, const uint32_t
 }
 
 bool crtpCommanderHighLevelIsTrajectoryFinished() {
+  xSemaphoreTake(lockTraj, portMAX_DELAY);
   float t = usecTimestamp() / 1e6;
-  return plan_is_finished(&planner, t);
+  const bool isFinished = plan_is_finished(&draft.planner, t);
+  xSemaphoreGive(lockTraj);
+  return isFinished;
 }
 
+/**
+ * lateUs is how long after its start time the last scheduled command ran.
+ */
+LOG_GROUP_START(hlCommander)
+LOG_ADD(LOG_UINT32, lateUs, &scheduledLateUs)
+LOG_GROUP_STOP(hlCommander)
+
 PARAM_GROUP_START(hlCommander)
 PARAM_ADD(PARAM_FLOAT, vtoff, &defaultTakeoffVelocity)
 PARAM_ADD(PARAM_FLOAT, vland, &defaultLandingVelocity)
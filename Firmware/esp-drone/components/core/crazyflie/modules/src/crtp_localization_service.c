@@ -28,6 +28,7 @@
 
 #include "FreeRTOS.h"
 #include "task.h"
+#include "usec_time.h"
 
 #include "crtp.h"
 #include "crtp_localization_service.h"
@@ -37,22 +38,16 @@
 #include "stabilizer_types.h"
 #include "stabilizer.h"
 #include "configblock.h"
-//#include "worker.h"
-//#include "lighthouse_core.h"
-
-//#include "locodeck.h"
 
 #include "estimator.h"
 #include "quatcompress.h"
 
 #include "peer_localization.h"
+#include "clockOffsetEngine.h"
 
-#include "num.h"
+#include "cfassert.h"
 
 #define NBR_OF_RANGES_IN_PACKET   5
-#define NBR_OF_SWEEPS_IN_PACKET   2
-#define NBR_OF_SENSOR_DIFFS_IN_PACKET   3
-#define NBR_OF_BASESTATIONS   2
 #define NBR_OF_
 #define DEFAULT_EMERGENCY_STOP_TIMEOUT (1 * RATE_MAIN_LOOP)
 
@@ -73,17 +68,6 @@ typedef struct
   } __attribute__((packed)) ranges[NBR_OF_RANGES_IN_PACKET];
 } __attribute__((packed)) rangePacket;
 
-typedef struct {
-  uint8_t type;
-  uint8_t basestation;
-  struct {
-  float sweep;
-    struct {
-      uint16_t angleDiff;
-    } __attribute__((packed)) angleDiffs [NBR_OF_SENSOR_DIFFS_IN_PACKET];
-  } __attribute__((packed)) sweeps [NBR_OF_SWEEPS_IN_PACKET];
-} __attribute__((packed)) anglePacket;
-
 // up to 4 items per CRTP packet
 typedef struct {
   uint8_t id; // last 8 bit of the Crazyflie address
@@ -101,6 +85,26 @@ typedef struct {
   uint32_t quat; // compressed quaternion, see quatcompress.h
 } __attribute__((packed)) extPosePackedItem;
 
+// The stamped packets start with the time of the measurement by the host, in
+// units of 16 us of its clock. It wraps every 1.05 s, the clock offset engine
+// unwraps it with the local clock.
+#define EXT_STAMP_UNIT_SHIFT 4
+#define EXT_STAMP_MASK ((((uint64_t)UINT16_MAX + 1) << EXT_STAMP_UNIT_SHIFT) - 1)
+
+// up to 2 items per CRTP packet
+typedef struct {
+  uint8_t type;
+  uint16_t timestamp; // host clock, 16 us
+  extPosePackedItem items[];
+} __attribute__((packed)) extPosePackedStamped;
+
+// up to 3 items per CRTP packet
+typedef struct {
+  uint8_t type;
+  uint16_t timestamp; // host clock, 16 us
+  extPositionPackedItem items[];
+} __attribute__((packed)) extPositionPackedStamped;
+
 // Struct for logging position information
 static positionMeasurement_t ext_pos;
 // Struct for logging pose information
@@ -110,18 +114,24 @@ static CRTPPacket pkRange;
 static uint8_t rangeIndex;
 static bool enableRangeStreamFloat = false;
 
-static CRTPPacket LhAngle;
-static bool enableLighthouseAngleStream = false;
 static float extPosStdDev = 0.01;
 static float extQuatStdDev = 4.5e-3;
 static bool isInit = false;
 static uint8_t my_id;
 static uint16_t tickOfLastPacket; // tick when last packet was received
 
+static clockOffsetStorage_t hostClock;
+// Least delay from the measurement to the reception, not seen by the clock
+// offset which only sees the jitter on top of it
+static uint16_t extMinLatencyUs = 2000;
+static float extDelayMs; // of the last stamped packet
+static uint32_t extStampRejectedCount;
+
 static void locSrvCrtpCB(CRTPPacket* pk);
 static void extPositionHandler(CRTPPacket* pk);
 static void genericLocHandle(CRTPPacket* pk);
 static void extPositionPackedHandler(CRTPPacket* pk);
+static void extPositionPackedStampedHandler(const CRTPPacket* pk);
 
 void locSrvInit()
 {
@@ -132,6 +142,7 @@ void locSrvInit()
   uint64_t address = configblockGetRadioAddress();
   my_id = address & 0xFF;
 
+  clockOffsetEngineReset(&hostClock);
   crtpRegisterPortCB(CRTP_PORT_LOCALIZATION, locSrvCrtpCB);
   isInit = true;
 }
@@ -161,6 +172,7 @@ static void extPositionHandler(CRTPPacket* pk) {
   ext_pos.y = data->y;
   ext_pos.z = data->z;
   ext_pos.stdDev = extPosStdDev;
+  ext_pos.timestampUs = 0;
 
   estimatorEnqueuePosition(&ext_pos);
   tickOfLastPacket = xTaskGetTickCount();
@@ -178,86 +190,76 @@ static void extPoseHandler(const CRTPPacket* pk) {
   ext_pose.quat.w = data->qw;
   ext_pose.stdDevPos = extPosStdDev;
   ext_pose.stdDevQuat = extQuatStdDev;
+  ext_pose.timestampUs = 0;
 
   estimatorEnqueuePose(&ext_pose);
   tickOfLastPacket = xTaskGetTickCount();
 }
 
+static void extPosePackedItemHandler(const extPosePackedItem* item, uint32_t timestampUs) {
+  if (item->id == my_id) {
+    ext_pose.x = item->x / 1000.0f;
+    ext_pose.y = item->y / 1000.0f;
+    ext_pose.z = item->z / 1000.0f;
+    quatdecompress(item->quat, (float *)&ext_pose.quat.q0);
+    ext_pose.stdDevPos = extPosStdDev;
+    ext_pose.stdDevQuat = extQuatStdDev;
+    ext_pose.timestampUs = timestampUs;
+    estimatorEnqueuePose(&ext_pose);
+    tickOfLastPacket = xTaskGetTickCount();
+  } else {
+    ext_pos.x = item->x / 1000.0f;
+    ext_pos.y = item->y / 1000.0f;
+    ext_pos.z = item->z / 1000.0f;
+    ext_pos.stdDev = extPosStdDev;
+    ext_pos.timestampUs = timestampUs;
+    peerLocalizationTellPosition(item->id, &ext_pos);
+  }
+}
+
 static void extPosePackedHandler(const CRTPPacket* pk) {
   uint8_t numItems = (pk->size - 1) / sizeof(extPosePackedItem);
   for (uint8_t i = 0; i < numItems; ++i) {
     const extPosePackedItem* item = (const extPosePackedItem*)&pk->data[1 + i * sizeof(extPosePackedItem)];
-    if (item->id == my_id) {
-      ext_pose.x = item->x / 1000.0f;
-      ext_pose.y = item->y / 1000.0f;
-      ext_pose.z = item->z / 1000.0f;
-      quatdecompress(item->quat, (float *)&ext_pose.quat.q0);
-      ext_pose.stdDevPos = extPosStdDev;
-      ext_pose.stdDevQuat = extQuatStdDev;
-      estimatorEnqueuePose(&ext_pose);
-      tickOfLastPacket = xTaskGetTickCount();
-    } else {
-      ext_pos.x = item->x / 1000.0f;
-      ext_pos.y = item->y / 1000.0f;
-      ext_pos.z = item->z / 1000.0f;
-      ext_pos.stdDev = extPosStdDev;
-      peerLocalizationTellPosition(item->id, &ext_pos);
-    }
+    extPosePackedItemHandler(item, 0);
   }
 }
 
-static void lpsShortLppPacketHandler(CRTPPacket* pk) {
-  if (pk->size >= 2) {
-    bool success = lpsSendLppShort(pk->data[1], &pk->data[2], pk->size-2);
+/**
+ * The local time a stamped packet was measured at, from the clock offset to
+ * the host. False if the stamp does not fit the offset, the items should then
+ * be dropped rather than fused as if they were current.
+ */
+static bool extStampToLocal(uint16_t timestamp, uint32_t* timestampUs) {
+  const uint64_t nowUs = usecTimestamp();
+  const uint64_t remoteUs = (uint64_t)timestamp << EXT_STAMP_UNIT_SHIFT;
 
-    pk->port = CRTP_PORT_LOCALIZATION;
-    pk->channel = GENERIC_TYPE;
-    pk->size = 3;
-    pk->data[0] = LPS_SHORT_LPP_PACKET;
-    pk->data[2] = success?1:0;
-    crtpSendPacket(pk);
+  if (!clockOffsetEngineUpdate(&hostClock, remoteUs, nowUs, EXT_STAMP_MASK)) {
+    extStampRejectedCount++;
+    return false;
   }
+
+  const uint64_t measuredUs = clockOffsetEngineLocalTime(&hostClock) - extMinLatencyUs;
+  extDelayMs = (nowUs - measuredUs) / 1000.0f;
+  // 0 stands for a current measurement
+  *timestampUs = (uint32_t)measuredUs ? (uint32_t)measuredUs : 1;
+  return true;
 }
 
-typedef union {
-  struct {
-    // A bit field indicating for which base stations to store geometry data
-    uint16_t geoDataBsField;
-    // A bit field indicating for which base stations to store calibration data
-    uint16_t calibrationDataBsField;
-  } __attribute__((packed));
-  uint32_t combinedField;
-} __attribute__((packed)) LhPersistArgs_t;
-
-static void lhPersistDataWorker(void* arg) {
-  LhPersistArgs_t* args = (LhPersistArgs_t*) &arg;
-
-  bool result = true;
-
-  for (int baseStation = 0; baseStation < PULSE_PROCESSOR_N_BASE_STATIONS; baseStation++) {
-    uint16_t mask = 1 << baseStation;
-    bool storeGeo = (args->geoDataBsField & mask) != 0;
-    bool storeCalibration = (args->calibrationDataBsField & mask) != 0;
-    if (! lighthouseCorePersistData(baseStation, storeGeo, storeCalibration)) {
-      result = false;
-      break;
-    }
+static void extPosePackedStampedHandler(const CRTPPacket* pk) {
+  const extPosePackedStamped* data = (const extPosePackedStamped*)pk->data;
+  if (pk->size < sizeof(extPosePackedStamped)) {
+    return;
   }
 
-  CRTPPacket response = {
-    .port = CRTP_PORT_LOCALIZATION,
-    .channel = GENERIC_TYPE,
-    .size = 2,
-    .data = {LH_PERSIST_DATA, result}
-  };
-
-  crtpSendPacket(&response);
-}
+  uint32_t timestampUs;
+  if (!extStampToLocal(data->timestamp, &timestampUs)) {
+    return;
+  }
 
-static void lhPersistDataHandler(CRTPPacket* pk) {
-  if (pk->size >= (1 + sizeof(LhPersistArgs_t))) {
-    LhPersistArgs_t* args = (LhPersistArgs_t*) &pk->data[1];
-    workerSchedule(lhPersistDataWorker, (void*)args->combinedField);
+  uint8_t numItems = (pk->size - sizeof(extPosePackedStamped)) / sizeof(extPosePackedItem);
+  for (uint8_t i = 0; i < numItems; ++i) {
+    extPosePackedItemHandler(&data->items[i], timestampUs);
   }
 }
 
@@ -267,9 +269,6 @@ static void genericLocHandle(CRTPPacket* pk)
   if (pk->size < 1) return;
 
   switch (type) {
-    case LPS_SHORT_LPP_PACKET:
-      lpsShortLppPacketHandler(pk);
-      break;
     case EMERGENCY_STOP:
       stabilizerSetEmergencyStop();
       break;
@@ -282,8 +281,11 @@ static void genericLocHandle(CRTPPacket* pk)
     case EXT_POSE_PACKED:
       extPosePackedHandler(pk);
       break;
-    case LH_PERSIST_DATA:
-      lhPersistDataHandler(pk);
+    case EXT_POSE_PACKED_STAMPED:
+      extPosePackedStampedHandler(pk);
+      break;
+    case EXT_POSITION_PACKED_STAMPED:
+      extPositionPackedStampedHandler(pk);
       break;
     default:
       // Nothing here
@@ -291,22 +293,46 @@ static void genericLocHandle(CRTPPacket* pk)
   }
 }
 
+static void extPositionPackedItemHandler(const extPositionPackedItem* item, uint32_t timestampUs)
+{
+  ext_pos.x = item->x / 1000.0f;
+  ext_pos.y = item->y / 1000.0f;
+  ext_pos.z = item->z / 1000.0f;
+  ext_pos.stdDev = extPosStdDev;
+  ext_pos.timestampUs = timestampUs;
+  if (item->id == my_id) {
+    estimatorEnqueuePosition(&ext_pos);
+    tickOfLastPacket = xTaskGetTickCount();
+  }
+  else {
+    peerLocalizationTellPosition(item->id, &ext_pos);
+  }
+}
+
 static void extPositionPackedHandler(CRTPPacket* pk)
 {
   uint8_t numItems = pk->size / sizeof(extPositionPackedItem);
   for (uint8_t i = 0; i < numItems; ++i) {
     const extPositionPackedItem* item = (const extPositionPackedItem*)&pk->data[i * sizeof(extPositionPackedItem)];
-    ext_pos.x = item->x / 1000.0f;
-    ext_pos.y = item->y / 1000.0f;
-    ext_pos.z = item->z / 1000.0f;
-    ext_pos.stdDev = extPosStdDev;
-    if (item->id == my_id) {
-      estimatorEnqueuePosition(&ext_pos);
-      tickOfLastPacket = xTaskGetTickCount();
-    }
-    else {
-      peerLocalizationTellPosition(item->id, &ext_pos);
-    }
+    extPositionPackedItemHandler(item, 0);
+  }
+}
+
+static void extPositionPackedStampedHandler(const CRTPPacket* pk)
+{
+  const extPositionPackedStamped* data = (const extPositionPackedStamped*)pk->data;
+  if (pk->size < sizeof(extPositionPackedStamped)) {
+    return;
+  }
+
+  uint32_t timestampUs;
+  if (!extStampToLocal(data->timestamp, &timestampUs)) {
+    return;
+  }
+
+  uint8_t numItems = (pk->size - sizeof(extPositionPackedStamped)) / sizeof(extPositionPackedItem);
+  for (uint8_t i = 0; i < numItems; ++i) {
+    extPositionPackedItemHandler(&data->items[i], timestampUs);
   }
 }
 
@@ -334,32 +360,6 @@ void locSrvSendRangeFloat(uint8_t id, float range)
   }
 }
 
-void locSrvSendLighthouseAngle(int basestation, pulseProcessorResult_t* angles)
-{
-  anglePacket *ap = (anglePacket *)LhAngle.data;
-
-  if (enableLighthouseAngleStream) {
-    ap->basestation = basestation;
-
-    for(uint8_t its = 0; its < NBR_OF_SWEEPS_IN_PACKET; its++) {
-      float angle_first_sensor =  angles->sensorMeasurementsLh1[0].baseStatonMeasurements[basestation].correctedAngles[its];
-      ap->sweeps[its].sweep = angle_first_sensor;
-
-      for(uint8_t itd = 0; itd < NBR_OF_SENSOR_DIFFS_IN_PACKET; itd++) {
-        float angle_other_sensor = angles->sensorMeasurementsLh1[itd + 1].baseStatonMeasurements[basestation].correctedAngles[its];
-        uint16_t angle_diff = single2half(angle_first_sensor - angle_other_sensor);
-        ap->sweeps[its].angleDiffs[itd].angleDiff = angle_diff;
-      }
-    }
-
-    ap->type = LH_ANGLE_STREAM;
-    LhAngle.port = CRTP_PORT_LOCALIZATION;
-    LhAngle.channel = GENERIC_TYPE;
-    LhAngle.size = sizeof(anglePacket);
-    crtpSendPacket(&LhAngle);
-  }
-}
-
 
 LOG_GROUP_START(ext_pos)
   LOG_ADD(LOG_FLOAT, X, &ext_pos.x)
@@ -371,9 +371,15 @@ LOG_GROUP_START(locSrvZ)
   LOG_ADD(LOG_UINT16, tick, &tickOfLastPacket)  // time when data was received last (ms/ticks)
 LOG_GROUP_STOP(locSrvZ)
 
+// The stamped packets
+LOG_GROUP_START(locSrvStamp)
+  LOG_ADD(LOG_FLOAT, delay, &extDelayMs)  // from the measurement to the reception (ms)
+  LOG_ADD(LOG_UINT32, rejected, &extStampRejectedCount)
+LOG_GROUP_STOP(locSrvStamp)
+
 PARAM_GROUP_START(locSrv)
   PARAM_ADD(PARAM_UINT8, enRangeStreamFP32, &enableRangeStreamFloat)
-  PARAM_ADD(PARAM_UINT8, enLhAngleStream, &enableLighthouseAngleStream)
   PARAM_ADD(PARAM_FLOAT, extPosStdDev, &extPosStdDev)
   PARAM_ADD(PARAM_FLOAT, extQuatStdDev, &extQuatStdDev)
+  PARAM_ADD(PARAM_UINT16, extMinLatUs, &extMinLatencyUs)
 PARAM_GROUP_STOP(locSrv)
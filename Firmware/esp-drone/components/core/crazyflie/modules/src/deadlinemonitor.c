@@ -0,0 +1,247 @@
+/**
+ *    ||          ____  _ __
+ * +------+      / __ )(_) /_______________ _____  ___
+ * | 0xBC |     / __  / / __/ ___/ ___/ __ `/_  / / _ \
+ * +------+    / /_/ / / /_/ /__/ /  / /_/ / / /_/  __/
+ *  ||  ||    /_____/_/\__/\___/_/   \__,_/ /___/\___/
+ *
+ * Crazyflie control firmware
+ *
+ * Copyright (C) 2012 BitCraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * deadlinemonitor.c - Timing budgets of the periodic tasks
+ */
+#define DEBUG_MODULE "DM"
+
+#include "deadlinemonitor.h"
+
+#ifdef CONFIG_DEADLINE_MONITOR
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "log.h"
+#include "param.h"
+#include "usec_time.h"
+
+// Bucket b of the histograms counts latenesses of [2^(6+b), 2^(7+b)) us, the
+// first and the last bucket are open ended
+#define DM_NBR_OF_BUCKETS     6
+#define DM_FIRST_BUCKET_LOG2  7
+
+#define DM_ALL_TASKS ((1u << DM_NBR_OF_TASKS) - 1)
+
+typedef struct
+{
+  uint32_t periodUs;
+  uint32_t budgetUs;
+
+  uint32_t lateCount;
+  uint32_t overrunCount;
+  uint32_t latenessMax;   // In us
+  uint32_t runTimeMax;    // In us
+  uint16_t histogram[DM_NBR_OF_BUCKETS];
+
+  uint64_t cycleStart;    // 0 until the first check in
+  uint16_t overrunStreak;
+  uint16_t onBudgetStreak;
+} Data;
+
+static Data data[DM_NBR_OF_TASKS];
+static uint8_t resetRequest;
+static uint32_t resetPending;   // One bit per task still to reset
+static uint32_t degradedTasks;  // One bit per critical task overrunning
+
+// The tasks the others back off for
+static const bool isCritical[DM_NBR_OF_TASKS] = {
+  [dmStabilizer] = true,
+  [dmSensors] = true,
+};
+
+static void resetCounters(Data* taskData)
+{
+  taskData->lateCount = 0;
+  taskData->overrunCount = 0;
+  taskData->latenessMax = 0;
+  taskData->runTimeMax = 0;
+  memset(taskData->histogram, 0, sizeof(taskData->histogram));
+}
+
+static void addLateness(Data* taskData, uint32_t lateness)
+{
+  int bucket = 0;
+
+  if (lateness > taskData->latenessMax) {
+    taskData->latenessMax = lateness;
+  }
+  if (lateness + taskData->budgetUs > taskData->periodUs) {
+    taskData->lateCount++;
+  }
+
+  while (bucket < DM_NBR_OF_BUCKETS - 1 && lateness >= (1u << (DM_FIRST_BUCKET_LOG2 + bucket))) {
+    bucket++;
+  }
+  if (taskData->histogram[bucket] < UINT16_MAX) {
+    taskData->histogram[bucket]++;
+  }
+}
+
+static void updateDegraded(dmTaskId_t id, bool isOverrun)
+{
+  const uint32_t limit = CONFIG_DEADLINE_DEGRADE_OVERRUNS;
+  Data* taskData = &data[id];
+
+  if (limit == 0 || !isCritical[id]) {
+    return;
+  }
+
+  if (isOverrun) {
+    taskData->onBudgetStreak = 0;
+    if (taskData->overrunStreak < UINT16_MAX && ++taskData->overrunStreak == limit) {
+      __atomic_or_fetch(&degradedTasks, 1u << id, __ATOMIC_RELAXED);
+    }
+  } else {
+    taskData->overrunStreak = 0;
+    // As many cycles on budget in a row to recover
+    if (taskData->onBudgetStreak < UINT16_MAX && ++taskData->onBudgetStreak == limit) {
+      __atomic_and_fetch(&degradedTasks, ~(1u << id), __ATOMIC_RELAXED);
+    }
+  }
+}
+
+void deadlineMonitorRegister(dmTaskId_t id, uint32_t periodUs, uint32_t budgetUs)
+{
+  Data* taskData = &data[id];
+
+  taskData->periodUs = periodUs;
+  taskData->budgetUs = budgetUs;
+  taskData->cycleStart = 0;
+}
+
+void deadlineMonitorCheckIn(dmTaskId_t id)
+{
+  Data* taskData = &data[id];
+  const uint64_t now = usecTimestamp();
+
+  if (__atomic_exchange_n(&resetRequest, 0, __ATOMIC_RELAXED)) {
+    __atomic_or_fetch(&resetPending, DM_ALL_TASKS, __ATOMIC_RELAXED);
+  }
+  if (__atomic_load_n(&resetPending, __ATOMIC_RELAXED) & (1u << id)) {
+    resetCounters(taskData);
+    __atomic_and_fetch(&resetPending, ~(1u << id), __ATOMIC_RELAXED);
+  }
+
+  if (taskData->cycleStart != 0) {
+    const uint32_t interval = now - taskData->cycleStart;
+    addLateness(taskData, interval > taskData->periodUs ? interval - taskData->periodUs : 0);
+  }
+  taskData->cycleStart = now;
+}
+
+void deadlineMonitorCheckOut(dmTaskId_t id)
+{
+  Data* taskData = &data[id];
+  const uint32_t runTime = usecTimestamp() - taskData->cycleStart;
+  const bool isOverrun = runTime > taskData->budgetUs;
+
+  if (runTime > taskData->runTimeMax) {
+    taskData->runTimeMax = runTime;
+  }
+  if (isOverrun) {
+    taskData->overrunCount++;
+  }
+  updateDegraded(id, isOverrun);
+}
+
+bool deadlineMonitorIsDegraded(void)
+{
+  return __atomic_load_n(&degradedTasks, __ATOMIC_RELAXED) != 0;
+}
+
+PARAM_GROUP_START(deadline)
+PARAM_ADD(PARAM_UINT8, reset, &resetRequest)
+PARAM_GROUP_STOP(deadline)
+
+// Times in us
+LOG_GROUP_START(deadline)
+LOG_ADD(LOG_UINT32, stabLate, &data[dmStabilizer].lateCount)
+LOG_ADD(LOG_UINT32, stabOver, &data[dmStabilizer].overrunCount)
+LOG_ADD(LOG_UINT32, stabLateMax, &data[dmStabilizer].latenessMax)
+LOG_ADD(LOG_UINT32, stabRunMax, &data[dmStabilizer].runTimeMax)
+LOG_ADD(LOG_UINT32, sensLate, &data[dmSensors].lateCount)
+LOG_ADD(LOG_UINT32, sensOver, &data[dmSensors].overrunCount)
+LOG_ADD(LOG_UINT32, sensLateMax, &data[dmSensors].latenessMax)
+LOG_ADD(LOG_UINT32, sensRunMax, &data[dmSensors].runTimeMax)
+LOG_ADD(LOG_UINT32, kalmanLate, &data[dmKalman].lateCount)
+LOG_ADD(LOG_UINT32, kalmanOver, &data[dmKalman].overrunCount)
+LOG_ADD(LOG_UINT32, kalmanLateMax, &data[dmKalman].latenessMax)
+LOG_ADD(LOG_UINT32, kalmanRunMax, &data[dmKalman].runTimeMax)
+LOG_ADD(LOG_UINT32, flowLate, &data[dmFlow].lateCount)
+LOG_ADD(LOG_UINT32, flowOver, &data[dmFlow].overrunCount)
+LOG_ADD(LOG_UINT32, flowLateMax, &data[dmFlow].latenessMax)
+LOG_ADD(LOG_UINT32, flowRunMax, &data[dmFlow].runTimeMax)
+LOG_ADD(LOG_UINT32, zrLate, &data[dmZranger].lateCount)
+LOG_ADD(LOG_UINT32, zrOver, &data[dmZranger].overrunCount)
+LOG_ADD(LOG_UINT32, zrLateMax, &data[dmZranger].latenessMax)
+LOG_ADD(LOG_UINT32, zrRunMax, &data[dmZranger].runTimeMax)
+LOG_ADD(LOG_UINT32, mrLate, &data[dmMultiranger].lateCount)
+LOG_ADD(LOG_UINT32, mrOver, &data[dmMultiranger].overrunCount)
+LOG_ADD(LOG_UINT32, mrLateMax, &data[dmMultiranger].latenessMax)
+LOG_ADD(LOG_UINT32, mrRunMax, &data[dmMultiranger].runTimeMax)
+LOG_ADD(LOG_UINT32, degraded, &degradedTasks)
+LOG_GROUP_STOP(deadline)
+
+// Number of cycles per bucket of lateness, see DM_FIRST_BUCKET_LOG2
+LOG_GROUP_START(deadlineHist)
+LOG_ADD(LOG_UINT16, stab0, &data[dmStabilizer].histogram[0])
+LOG_ADD(LOG_UINT16, stab1, &data[dmStabilizer].histogram[1])
+LOG_ADD(LOG_UINT16, stab2, &data[dmStabilizer].histogram[2])
+LOG_ADD(LOG_UINT16, stab3, &data[dmStabilizer].histogram[3])
+LOG_ADD(LOG_UINT16, stab4, &data[dmStabilizer].histogram[4])
+LOG_ADD(LOG_UINT16, stab5, &data[dmStabilizer].histogram[5])
+LOG_ADD(LOG_UINT16, sens0, &data[dmSensors].histogram[0])
+LOG_ADD(LOG_UINT16, sens1, &data[dmSensors].histogram[1])
+LOG_ADD(LOG_UINT16, sens2, &data[dmSensors].histogram[2])
+LOG_ADD(LOG_UINT16, sens3, &data[dmSensors].histogram[3])
+LOG_ADD(LOG_UINT16, sens4, &data[dmSensors].histogram[4])
+LOG_ADD(LOG_UINT16, sens5, &data[dmSensors].histogram[5])
+LOG_ADD(LOG_UINT16, kalman0, &data[dmKalman].histogram[0])
+LOG_ADD(LOG_UINT16, kalman1, &data[dmKalman].histogram[1])
+LOG_ADD(LOG_UINT16, kalman2, &data[dmKalman].histogram[2])
+LOG_ADD(LOG_UINT16, kalman3, &data[dmKalman].histogram[3])
+LOG_ADD(LOG_UINT16, kalman4, &data[dmKalman].histogram[4])
+LOG_ADD(LOG_UINT16, kalman5, &data[dmKalman].histogram[5])
+LOG_ADD(LOG_UINT16, flow0, &data[dmFlow].histogram[0])
+LOG_ADD(LOG_UINT16, flow1, &data[dmFlow].histogram[1])
+LOG_ADD(LOG_UINT16, flow2, &data[dmFlow].histogram[2])
+LOG_ADD(LOG_UINT16, flow3, &data[dmFlow].histogram[3])
+LOG_ADD(LOG_UINT16, flow4, &data[dmFlow].histogram[4])
+LOG_ADD(LOG_UINT16, flow5, &data[dmFlow].histogram[5])
+LOG_ADD(LOG_UINT16, zr0, &data[dmZranger].histogram[0])
+LOG_ADD(LOG_UINT16, zr1, &data[dmZranger].histogram[1])
+LOG_ADD(LOG_UINT16, zr2, &data[dmZranger].histogram[2])
+LOG_ADD(LOG_UINT16, zr3, &data[dmZranger].histogram[3])
+LOG_ADD(LOG_UINT16, zr4, &data[dmZranger].histogram[4])
+LOG_ADD(LOG_UINT16, zr5, &data[dmZranger].histogram[5])
+LOG_ADD(LOG_UINT16, mr0, &data[dmMultiranger].histogram[0])
+LOG_ADD(LOG_UINT16, mr1, &data[dmMultiranger].histogram[1])
+LOG_ADD(LOG_UINT16, mr2, &data[dmMultiranger].histogram[2])
+LOG_ADD(LOG_UINT16, mr3, &data[dmMultiranger].histogram[3])
+LOG_ADD(LOG_UINT16, mr4, &data[dmMultiranger].histogram[4])
+LOG_ADD(LOG_UINT16, mr5, &data[dmMultiranger].histogram[5])
+LOG_GROUP_STOP(deadlineHist)
+
+#endif // CONFIG_DEADLINE_MONITOR
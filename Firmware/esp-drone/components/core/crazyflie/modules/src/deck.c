@@ -0,0 +1,159 @@
+/**
+ *
+ * ESP-Drone Firmware
+ *
+ * Copyright 2019-2020  Espressif Systems (Shanghai)
+ * Copyright (C) 2011-2012 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * deck.c - Finds the decks at boot and starts their drivers
+ *
+ * The init of each driver probes its sensor and only starts the driver task
+ * once the sensor answered, so a deck that is not there costs the time of its
+ * probe and nothing after. The I2C decks are probed from a task of their own
+ * while the system task probes the SPI ones, the probes mostly wait for the
+ * sensors to boot.
+ */
+#define DEBUG_MODULE "DECK"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
+
+#include "config.h"
+#include "deck.h"
+#include "estimator.h"
+#include "crtp_commander.h"
+#include "multiranger.h"
+#include "zranger.h"
+#include "zranger2.h"
+#include "flowdeck_v1v2.h"
+#include "debug_cf.h"
+
+typedef struct {
+  const char *name;
+  // Probes the sensor, starts the driver if it answers
+  void (*init)(void);
+  bool (*test)(void);
+  // Not probed if this deck was found, it answers on the same address
+  bool (*isTakenBy)(void);
+  // Needed to make use of the deck, anyEstimator if any does
+  StateEstimatorType requiredEstimator;
+} deckDriver_t;
+
+// In the order they are probed
+static const deckDriver_t i2cDecks[] = {
+#ifdef CONFIG_MULTIRANGER
+  // The sensors of the array all wake up on the address of the Z rangers
+  { .name = "Multiranger", .init = multirangerInit, .test = multirangerTest, .requiredEstimator = anyEstimator },
+#endif
+  { .name = "Z-ranger v2", .init = zRanger2Init, .test = zRanger2Test, .requiredEstimator = anyEstimator },
+  { .name = "Z-ranger", .init = zRangerInit, .test = zRangerTest, .isTakenBy = zRanger2Test, .requiredEstimator = anyEstimator },
+};
+
+static const deckDriver_t spiDecks[] = {
+  { .name = "Flow v2", .init = flowdeck2Init, .test = flowdeck2Test, .requiredEstimator = kalmanEstimator },
+};
+
+#define DECK_COUNT(decks) (sizeof(decks) / sizeof((decks)[0]))
+
+static bool i2cFound[DECK_COUNT(i2cDecks)];
+static bool spiFound[DECK_COUNT(spiDecks)];
+
+static bool isInit = false;
+static SemaphoreHandle_t i2cProbed;
+
+static void probeDecks(const deckDriver_t *decks, bool *found, size_t count)
+{
+  for (size_t i = 0; i < count; i++) {
+    if (decks[i].isTakenBy && decks[i].isTakenBy()) {
+      continue;
+    }
+
+    decks[i].init();
+    found[i] = decks[i].test();
+  }
+}
+
+static void deckProbeTask(void *param)
+{
+  probeDecks(i2cDecks, i2cFound, DECK_COUNT(i2cDecks));
+  xSemaphoreGive(i2cProbed);
+
+  vTaskDelete(NULL);
+}
+
+static void registerDecks(const deckDriver_t *decks, const bool *found, size_t count)
+{
+  for (size_t i = 0; i < count; i++) {
+    if (found[i]) {
+      DEBUG_PRINTI("%s deck found\n", decks[i].name);
+      registerRequiredEstimator(decks[i].requiredEstimator);
+    }
+  }
+}
+
+void deckInit(void)
+{
+  if (isInit) {
+    return;
+  }
+
+  i2cProbed = xSemaphoreCreateBinary();
+  const bool isParallel = xTaskCreate(deckProbeTask, DECK_PROBE_TASK_NAME, DECK_PROBE_TASK_STACKSIZE, NULL, DECK_PROBE_TASK_PRI, NULL) == pdPASS;
+
+  probeDecks(spiDecks, spiFound, DECK_COUNT(spiDecks));
+  if (isParallel) {
+    xSemaphoreTake(i2cProbed, portMAX_DELAY);
+  } else {
+    probeDecks(i2cDecks, i2cFound, DECK_COUNT(i2cDecks));
+  }
+  vSemaphoreDelete(i2cProbed);
+
+  registerDecks(i2cDecks, i2cFound, DECK_COUNT(i2cDecks));
+  registerDecks(spiDecks, spiFound, DECK_COUNT(spiDecks));
+
+  if (flowdeck2Test()) {
+    setCommandermode(POSHOLD_MODE);
+  }
+
+  isInit = true;
+}
+
+static bool testDecks(const deckDriver_t *decks, const bool *found, size_t count)
+{
+  bool pass = true;
+
+  for (size_t i = 0; i < count; i++) {
+    if (found[i] && !decks[i].test()) {
+      DEBUG_PRINTW("%s deck test [FAIL]\n", decks[i].name);
+      pass = false;
+    }
+  }
+
+  return pass;
+}
+
+bool deckTest(void)
+{
+  bool pass = isInit;
+
+  pass &= testDecks(i2cDecks, i2cFound, DECK_COUNT(i2cDecks));
+  pass &= testDecks(spiDecks, spiFound, DECK_COUNT(spiDecks));
+
+  return pass;
+}
@@ -0,0 +1,269 @@
+/**
+ *
+ * ESP-Drone Firmware
+ *
+ * Copyright 2019-2020  Espressif Systems (Shanghai)
+ * Copyright (C) 2011-2012 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * dyn_notch.c - Tracks the motor vibration peak of the gyro for a notch filter
+ *
+ * The samples are collected in two frames. The sensors task fills one while
+ * the analysis task owns the other, a frame that fills up while the analysis
+ * is still busy is dropped. At 1 kHz a frame of 256 samples is 256 ms and one
+ * FFT bin is 3.9 Hz wide, the peak is interpolated between bins.
+ */
+#define DEBUG_MODULE "DNOTCH"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "config.h"
+#include "dyn_notch.h"
+#include "log.h"
+#include "param.h"
+#include "static_mem.h"
+#include "physicalConstants.h"
+#include "xtensa_math.h"
+#include "debug_cf.h"
+
+#ifdef CONFIG_GYRO_DYN_NOTCH
+
+#define DYN_NOTCH_MIN_FREQ      ((float)CONFIG_GYRO_DYN_NOTCH_MIN_FREQ)
+#define DYN_NOTCH_MAX_FREQ      ((float)CONFIG_GYRO_DYN_NOTCH_MAX_FREQ)
+#define DYN_NOTCH_BIN_WIDTH     ((float)DYN_NOTCH_SAMPLE_RATE / DYN_NOTCH_FFT_LEN)
+// A peak must stand out of the mean power of the band to be motor noise
+#define DYN_NOTCH_PEAK_RATIO    5.0f
+// Share of a new peak in the center frequency, per frame
+#define DYN_NOTCH_SMOOTHING     0.5f
+
+_Static_assert(DYN_NOTCH_FFT_LEN == 256, "The FFT is initialized for 256 samples");
+_Static_assert(CONFIG_GYRO_DYN_NOTCH_MIN_FREQ < CONFIG_GYRO_DYN_NOTCH_MAX_FREQ, "Empty dynamic notch band");
+// The bin above the band is needed for the interpolation
+_Static_assert(CONFIG_GYRO_DYN_NOTCH_MAX_FREQ * DYN_NOTCH_FFT_LEN / DYN_NOTCH_SAMPLE_RATE + 1 < DYN_NOTCH_FFT_LEN / 2,
+               "Dynamic notch band too close to Nyquist");
+
+static bool isInit = false;
+
+// Frame i belongs to the analysis task while frameReady[i] is set, to the
+// sensors task otherwise
+static float frames[2][3][DYN_NOTCH_FFT_LEN];
+static bool frameReady[2];
+static uint8_t activeFrame;     // Sensors task only
+static uint16_t activeFill;     // Sensors task only
+
+// Analysis task only
+static xtensa_rfft_fast_instance_f32 fft;
+static float window[DYN_NOTCH_FFT_LEN];
+static float fftIn[DYN_NOTCH_FFT_LEN];
+static float fftOut[DYN_NOTCH_FFT_LEN];
+static float power[DYN_NOTCH_FFT_LEN / 2];
+
+// Published by the analysis task
+static float centerFreq = DYN_NOTCH_MAX_FREQ;
+static bool centerChanged;
+
+static float peakFreq;
+static uint32_t framesCount;
+static uint32_t droppedCount;
+static uint8_t enableParam = 1;
+
+static TaskHandle_t taskHandle;
+STATIC_MEM_TASK_ALLOC(dynNotchTask, DYN_NOTCH_TASK_STACKSIZE);
+static void dynNotchTask(void *param);
+
+void dynNotchInit(void)
+{
+  if (isInit) {
+    return;
+  }
+
+  // Only the tables of this length are linked in
+  xtensa_rfft_fast_init_256_f32(&fft);
+
+  // Hann window, the motor peak is strong and the leakage of the others matters more than the resolution
+  for (int i = 0; i < DYN_NOTCH_FFT_LEN; i++) {
+    window[i] = 0.5f - 0.5f * cosf(2.0f * M_PI_F * i / (DYN_NOTCH_FFT_LEN - 1));
+  }
+
+  taskHandle = STATIC_MEM_TASK_CREATE_PINNED(dynNotchTask, dynNotchTask, DYN_NOTCH_TASK_NAME, NULL, DYN_NOTCH_TASK_PRI, DYN_NOTCH_TASK_CORE);
+
+  isInit = true;
+}
+
+bool dynNotchTest(void)
+{
+  return isInit;
+}
+
+void dynNotchAddSample(const Axis3f *gyro)
+{
+  if (!isInit) {
+    return;
+  }
+
+  frames[activeFrame][0][activeFill] = gyro->x;
+  frames[activeFrame][1][activeFill] = gyro->y;
+  frames[activeFrame][2][activeFill] = gyro->z;
+
+  if (++activeFill < DYN_NOTCH_FFT_LEN) {
+    return;
+  }
+  activeFill = 0;
+
+  const uint8_t other = activeFrame ^ 1;
+  if (__atomic_load_n(&frameReady[other], __ATOMIC_ACQUIRE)) {
+    // Still analysing the previous frame, collect this one again
+    droppedCount++;
+    return;
+  }
+
+  __atomic_store_n(&frameReady[activeFrame], true, __ATOMIC_RELEASE);
+  xTaskNotifyGive(taskHandle);
+  activeFrame = other;
+}
+
+bool dynNotchGetCenterFreq(float *freq)
+{
+  if (!__atomic_exchange_n(&centerChanged, false, __ATOMIC_ACQUIRE)) {
+    return false;
+  }
+
+  __atomic_load(&centerFreq, freq, __ATOMIC_RELAXED);
+  return true;
+}
+
+/* Sums the power spectra of the three axes into power. */
+static void computePowerSpectrum(float samples[3][DYN_NOTCH_FFT_LEN])
+{
+  memset(power, 0, sizeof(power));
+
+  for (int axis = 0; axis < 3; axis++) {
+    float mean = 0.0f;
+    for (int i = 0; i < DYN_NOTCH_FFT_LEN; i++) {
+      mean += samples[axis][i];
+    }
+    mean /= DYN_NOTCH_FFT_LEN;
+
+    for (int i = 0; i < DYN_NOTCH_FFT_LEN; i++) {
+      fftIn[i] = (samples[axis][i] - mean) * window[i];
+    }
+
+    // fftIn is used as scratch. Bin k is in fftOut[2k] and fftOut[2k + 1],
+    // except for bin 0 and the Nyquist bin, which share fftOut[0] and fftOut[1]
+    xtensa_rfft_fast_f32(&fft, fftIn, fftOut, 0);
+
+    for (int k = 1; k < DYN_NOTCH_FFT_LEN / 2; k++) {
+      power[k] += fftOut[2 * k] * fftOut[2 * k] + fftOut[2 * k + 1] * fftOut[2 * k + 1];
+    }
+  }
+}
+
+/* Returns the interpolated frequency of the strongest peak of the band, 0 if none stands out. */
+static float findPeak(void)
+{
+  const int first = (int)ceilf(DYN_NOTCH_MIN_FREQ / DYN_NOTCH_BIN_WIDTH);
+  const int last = (int)(DYN_NOTCH_MAX_FREQ / DYN_NOTCH_BIN_WIDTH);
+  int peak = first;
+  float sum = 0.0f;
+
+  for (int k = first; k <= last; k++) {
+    sum += power[k];
+    if (power[k] > power[peak]) {
+      peak = k;
+    }
+  }
+
+  const float mean = sum / (last - first + 1);
+  if (power[peak] <= 0.0f || power[peak] < DYN_NOTCH_PEAK_RATIO * mean) {
+    return 0.0f;
+  }
+
+  // Parabola through the peak bin and its neighbours
+  float offset = 0.0f;
+  const float left = power[peak - 1];
+  const float right = power[peak + 1];
+  const float curvature = left - 2.0f * power[peak] + right;
+  if (curvature < 0.0f) {
+    offset = 0.5f * (left - right) / curvature;
+  }
+
+  return (peak + offset) * DYN_NOTCH_BIN_WIDTH;
+}
+
+static void publishCenterFreq(float freq)
+{
+  if (freq < DYN_NOTCH_MIN_FREQ) {
+    freq = DYN_NOTCH_MIN_FREQ;
+  } else if (freq > DYN_NOTCH_MAX_FREQ) {
+    freq = DYN_NOTCH_MAX_FREQ;
+  }
+
+  __atomic_store(&centerFreq, &freq, __ATOMIC_RELAXED);
+  __atomic_store_n(&centerChanged, true, __ATOMIC_RELEASE);
+}
+
+static void analyseFrame(float samples[3][DYN_NOTCH_FFT_LEN])
+{
+  computePowerSpectrum(samples);
+  peakFreq = findPeak();
+  framesCount++;
+
+  if (!enableParam) {
+    // Parked at the top of the band, where the low pass already removes most of the noise
+    if (centerFreq != DYN_NOTCH_MAX_FREQ) {
+      publishCenterFreq(DYN_NOTCH_MAX_FREQ);
+    }
+    return;
+  }
+
+  // Without a clear peak, the notch stays where it is
+  if (peakFreq > 0.0f) {
+    publishCenterFreq(centerFreq + DYN_NOTCH_SMOOTHING * (peakFreq - centerFreq));
+  }
+}
+
+static void dynNotchTask(void *param)
+{
+  uint8_t nextFrame = 0;
+
+  while (1) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+    while (__atomic_load_n(&frameReady[nextFrame], __ATOMIC_ACQUIRE)) {
+      analyseFrame(frames[nextFrame]);
+      __atomic_store_n(&frameReady[nextFrame], false, __ATOMIC_RELEASE);
+      nextFrame ^= 1;
+    }
+  }
+}
+
+PARAM_GROUP_START(dynNotch)
+PARAM_ADD(PARAM_UINT8, enable, &enableParam)
+PARAM_GROUP_STOP(dynNotch)
+
+LOG_GROUP_START(dynNotch)
+LOG_ADD(LOG_FLOAT, peak, &peakFreq)
+LOG_ADD(LOG_FLOAT, center, &centerFreq)
+LOG_ADD(LOG_UINT32, frames, &framesCount)
+LOG_ADD(LOG_UINT32, dropped, &droppedCount)
+LOG_GROUP_STOP(dynNotch)
+
+#endif // CONFIG_GYRO_DYN_NOTCH
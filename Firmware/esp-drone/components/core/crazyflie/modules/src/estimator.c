@@ -9,6 +9,8 @@
 #define DEFAULT_ESTIMATOR complementaryEstimator
 static StateEstimatorType currentEstimator = anyEstimator;
 static StateEstimatorType requiredEstimator = anyEstimator;
+// Runs next to the current one and gets the measurements enqueued as well
+static StateEstimatorType otherEstimator = anyEstimator;
 
 static void initEstimator(const StateEstimatorType estimator);
 static void deinitEstimator(const StateEstimatorType estimator);
@@ -18,6 +20,7 @@ typedef struct {
   void (*deinit)(void);
   bool (*test)(void);
   void (*update)(state_t *state, sensorData_t *sensors, control_t *control, const uint32_t tick);
+  void (*updateWithSensors)(state_t *state, const sensorData_t *sensors, const control_t *control, const uint32_t tick);
   const char* name;
   bool (*estimatorEnqueueTDOA)(const tdoaMeasurement_t *uwb);
   bool (*estimatorEnqueuePosition)(const positionMeasurement_t *pos);
@@ -38,6 +41,7 @@ static EstimatorFcns estimatorFunctions[] = {
         .deinit = NOT_IMPLEMENTED,
         .test = NOT_IMPLEMENTED,
         .update = NOT_IMPLEMENTED,
+        .updateWithSensors = NOT_IMPLEMENTED,
         .name = "None",
         .estimatorEnqueueTDOA = NOT_IMPLEMENTED,
         .estimatorEnqueuePosition = NOT_IMPLEMENTED,
@@ -54,6 +58,7 @@ static EstimatorFcns estimatorFunctions[] = {
         .deinit = NOT_IMPLEMENTED,
         .test = estimatorComplementaryTest,
         .update = estimatorComplementary,
+        .updateWithSensors = estimatorComplementaryWithSensors,
         .name = "Complementary",
         .estimatorEnqueueTDOA = NOT_IMPLEMENTED,
         .estimatorEnqueuePosition = NOT_IMPLEMENTED,
@@ -70,6 +75,7 @@ static EstimatorFcns estimatorFunctions[] = {
         .deinit = NOT_IMPLEMENTED,
         .test = estimatorKalmanTest,
         .update = estimatorKalman,
+        .updateWithSensors = estimatorKalmanWithSensors,
         .name = "Kalman",
         .estimatorEnqueueTDOA = estimatorKalmanEnqueueTDOA,
         .estimatorEnqueuePosition = estimatorKalmanEnqueuePosition,
@@ -164,8 +170,38 @@ const char* stateEstimatorGetName() {
   return estimatorFunctions[currentEstimator].name;
 }
 
+static bool isValidEstimator(StateEstimatorType estimator) {
+  return estimator > anyEstimator && estimator < StateEstimatorTypeCount;
+}
+
+void stateEstimatorSetOther(StateEstimatorType estimator) {
+  otherEstimator = isValidEstimator(estimator) ? estimator : anyEstimator;
+}
+
+void stateEstimatorInitOther(StateEstimatorType estimator) {
+  if (isValidEstimator(estimator)) {
+    initEstimator(estimator);
+  }
+}
+
+void stateEstimatorOther(StateEstimatorType estimator, state_t *state, const sensorData_t *sensors, const control_t *control, const uint32_t tick) {
+  if (isValidEstimator(estimator)) {
+    estimatorFunctions[estimator].updateWithSensors(state, sensors, control, tick);
+  }
+}
+
+// The other estimator takes the measurement as well, whether the current one does or not
+#define ENQUEUE_OTHER(FCN, MEASUREMENT) do { \
+    const StateEstimatorType other = otherEstimator; \
+    if (other != anyEstimator && estimatorFunctions[other].FCN) { \
+      estimatorFunctions[other].FCN(MEASUREMENT); \
+    } \
+  } while (0)
+
 
 bool estimatorEnqueueTDOA(const tdoaMeasurement_t *uwb) {
+  ENQUEUE_OTHER(estimatorEnqueueTDOA, uwb);
+
   if (estimatorFunctions[currentEstimator].estimatorEnqueueTDOA) {
     return estimatorFunctions[currentEstimator].estimatorEnqueueTDOA(uwb);
   }
@@ -174,6 +210,8 @@ bool estimatorEnqueueTDOA(const tdoaMeasurement_t *uwb) {
 }
 
 bool estimatorEnqueueYawError(const yawErrorMeasurement_t* error) {
+  ENQUEUE_OTHER(estimatorEnqueueYawError, error);
+
   if (estimatorFunctions[currentEstimator].estimatorEnqueueYawError) {
     return estimatorFunctions[currentEstimator].estimatorEnqueueYawError(error);
   }
@@ -182,6 +220,8 @@ bool estimatorEnqueueYawError(const yawErrorMeasurement_t* error) {
 }
 
 bool estimatorEnqueuePosition(const positionMeasurement_t *pos) {
+  ENQUEUE_OTHER(estimatorEnqueuePosition, pos);
+
   if (estimatorFunctions[currentEstimator].estimatorEnqueuePosition) {
     return estimatorFunctions[currentEstimator].estimatorEnqueuePosition(pos);
   }
@@ -190,6 +230,8 @@ bool estimatorEnqueuePosition(const positionMeasurement_t *pos) {
 }
 
 bool estimatorEnqueuePose(const poseMeasurement_t *pose) {
+  ENQUEUE_OTHER(estimatorEnqueuePose, pose);
+
   if (estimatorFunctions[currentEstimator].estimatorEnqueuePose) {
     return estimatorFunctions[currentEstimator].estimatorEnqueuePose(pose);
   }
@@ -198,6 +240,8 @@ bool estimatorEnqueuePose(const poseMeasurement_t *pose) {
 }
 
 bool estimatorEnqueueDistance(const distanceMeasurement_t *dist) {
+  ENQUEUE_OTHER(estimatorEnqueueDistance, dist);
+
   if (estimatorFunctions[currentEstimator].estimatorEnqueueDistance) {
     return estimatorFunctions[currentEstimator].estimatorEnqueueDistance(dist);
   }
@@ -206,6 +250,8 @@ bool estimatorEnqueueDistance(const distanceMeasurement_t *dist) {
 }
 
 bool estimatorEnqueueTOF(const tofMeasurement_t *tof) {
+  ENQUEUE_OTHER(estimatorEnqueueTOF, tof);
+
   if (estimatorFunctions[currentEstimator].estimatorEnqueueTOF) {
     return estimatorFunctions[currentEstimator].estimatorEnqueueTOF(tof);
   }
@@ -214,6 +260,8 @@ bool estimatorEnqueueTOF(const tofMeasurement_t *tof) {
 }
 
 bool estimatorEnqueueAbsoluteHeight(const heightMeasurement_t *height) {
+  ENQUEUE_OTHER(estimatorEnqueueAbsoluteHeight, height);
+
   if (estimatorFunctions[currentEstimator].estimatorEnqueueAbsoluteHeight) {
     return estimatorFunctions[currentEstimator].estimatorEnqueueAbsoluteHeight(height);
   }
@@ -222,6 +270,8 @@ bool estimatorEnqueueAbsoluteHeight(const heightMeasurement_t *height) {
 }
 
 bool estimatorEnqueueFlow(const flowMeasurement_t *flow) {
+  ENQUEUE_OTHER(estimatorEnqueueFlow, flow);
+
   if (estimatorFunctions[currentEstimator].estimatorEnqueueFlow) {
     return estimatorFunctions[currentEstimator].estimatorEnqueueFlow(flow);
   }
@@ -29,14 +29,18 @@
 
 #include "FreeRTOS.h"
 #include "queue.h"
+#include "queuemonitor.h"
 #include "stabilizer.h"
 #include "estimator_complementary.h"
 #include "sensfusion6.h"
 #include "position_estimator.h"
 #include "sensors.h"
+#include "estimator.h"
 #include "stabilizer_types.h"
 #include "static_mem.h"
 
+#define SENSOR_UPDATE_DT 1.0f/RATE_MAIN_LOOP
+
 #define ATTITUDE_UPDATE_RATE RATE_250_HZ
 #define ATTITUDE_UPDATE_DT 1.0/ATTITUDE_UPDATE_RATE
 
@@ -67,30 +71,72 @@ bool estimatorComplementaryTest(void)
   return pass;
 }
 
-void estimatorComplementary(state_t *state, sensorData_t *sensorData, control_t *control, const uint32_t tick)
+static void updateAttitudeState(state_t *state)
 {
-  sensorsAcquire(sensorData, tick); // Read sensors at full rate (1000Hz)
-  if (RATE_DO_EXECUTE(ATTITUDE_UPDATE_RATE, tick)) {
-    sensfusion6UpdateQ(sensorData->gyro.x, sensorData->gyro.y, sensorData->gyro.z,
-                       sensorData->acc.x, sensorData->acc.y, sensorData->acc.z,
-                       ATTITUDE_UPDATE_DT);
+  // Save attitude, adjusted for the legacy CF2 body coordinate system
+  sensfusion6GetEulerRPY(&state->attitude.roll, &state->attitude.pitch, &state->attitude.yaw);
+
+  // Save quaternion, hopefully one day this could be used in a better controller.
+  // Note that this is not adjusted for the legacy coordinate system
+  sensfusion6GetQuaternion(
+    &state->attitudeQuaternion.x,
+    &state->attitudeQuaternion.y,
+    &state->attitudeQuaternion.z,
+    &state->attitudeQuaternion.w);
+
+  const float x = state->attitudeQuaternion.x;
+  const float y = state->attitudeQuaternion.y;
+  const float z = state->attitudeQuaternion.z;
+  const float w = state->attitudeQuaternion.w;
+  const float R[3][3] = {
+    {1 - 2*(y*y + z*z), 2*(x*y - w*z),     2*(x*z + w*y)},
+    {2*(x*y + w*z),     1 - 2*(x*x + z*z), 2*(y*z - w*x)},
+    {2*(x*z - w*y),     2*(y*z + w*x),     1 - 2*(x*x + y*y)},
+  };
+  stateSetRotation(state, R);
+}
 
-    // Save attitude, adjusted for the legacy CF2 body coordinate system
-    sensfusion6GetEulerRPY(&state->attitude.roll, &state->attitude.pitch, &state->attitude.yaw);
+#ifdef CONFIG_ESTIMATOR_MEASURED_DT
+static uint64_t lastSensorTimestamp;
+static uint64_t lastAttitudeTimestamp;
+#endif
 
-    // Save quaternion, hopefully one day this could be used in a better controller.
-    // Note that this is not adjusted for the legacy coordinate system
-    sensfusion6GetQuaternion(
-      &state->attitudeQuaternion.x,
-      &state->attitudeQuaternion.y,
-      &state->attitudeQuaternion.z,
-      &state->attitudeQuaternion.w);
+static void complementaryUpdate(state_t *state, const sensorData_t *sensorData, const uint32_t tick)
+{
+  const bool isAttitudeUpdate = RATE_DO_EXECUTE(ATTITUDE_UPDATE_RATE, tick);
+#ifdef CONFIG_ESTIMATOR_MEASURED_DT
+  const float sensorDt = estimatorSampleDt(&lastSensorTimestamp, sensorData->interruptTimestamp, SENSOR_UPDATE_DT);
+  const float attitudeDt = isAttitudeUpdate ?
+    estimatorSampleDt(&lastAttitudeTimestamp, sensorData->interruptTimestamp, ATTITUDE_UPDATE_DT) : 0.0f;
+#else
+  const float sensorDt = SENSOR_UPDATE_DT;
+  const float attitudeDt = ATTITUDE_UPDATE_DT;
+#endif
+
+#ifdef CONFIG_COMPLEMENTARY_FULL_RATE_GYRO
+  // The gyro is integrated on every tick, the accelerometer corrects at the attitude rate
+  sensfusion6PredictQ(sensorData->gyro.x, sensorData->gyro.y, sensorData->gyro.z, sensorDt);
+  if (isAttitudeUpdate) {
+    sensfusion6CorrectQ(sensorData->acc.x, sensorData->acc.y, sensorData->acc.z, attitudeDt);
+  }
+  updateAttitudeState(state);
+#else
+  (void)sensorDt;
+#endif
+
+  if (isAttitudeUpdate) {
+#ifndef CONFIG_COMPLEMENTARY_FULL_RATE_GYRO
+    sensfusion6UpdateQ(sensorData->gyro.x, sensorData->gyro.y, sensorData->gyro.z,
+                       sensorData->acc.x, sensorData->acc.y, sensorData->acc.z,
+                       attitudeDt);
+    updateAttitudeState(state);
+#endif
 
     state->acc.z = sensfusion6GetAccZWithoutGravity(sensorData->acc.x,
                                                     sensorData->acc.y,
                                                     sensorData->acc.z);
 
-    positionUpdateVelocity(state->acc.z, ATTITUDE_UPDATE_DT);
+    positionUpdateVelocity(state->acc.z, attitudeDt);
   }
 
   if (RATE_DO_EXECUTE(POS_UPDATE_RATE, tick)) {
@@ -101,8 +147,22 @@ void estimatorComplementary(state_t *state, sensorData_t *sensorData, control_t
   }
 }
 
+void estimatorComplementary(state_t *state, sensorData_t *sensorData, control_t *control, const uint32_t tick)
+{
+  sensorsAcquire(sensorData, tick); // Read sensors at full rate (1000Hz)
+  complementaryUpdate(state, sensorData, tick);
+}
+
+void estimatorComplementaryWithSensors(state_t *state, const sensorData_t *sensors, const control_t *control, const uint32_t tick)
+{
+  complementaryUpdate(state, sensors, tick);
+}
+
 static bool latestTofMeasurement(tofMeasurement_t* tofMeasurement) {
-  return xQueuePeek(tofDataQueue, tofMeasurement, 0) == pdTRUE;
+  BaseType_t result = xQueuePeek(tofDataQueue, tofMeasurement, 0);
+  queueMonitorPeeked(qmTof, result);
+
+  return result == pdTRUE;
 }
 
 static bool overwriteMeasurement(xQueueHandle queue, void *measurement)
@@ -127,5 +187,8 @@ static bool overwriteMeasurement(xQueueHandle queue, void *measurement)
 bool estimatorComplementaryEnqueueTOF(const tofMeasurement_t *tof)
 {
   // A distance (distance) [m] to the ground along the z_B axis.
-  return overwriteMeasurement(tofDataQueue, (void *)tof);
+  bool result = overwriteMeasurement(tofDataQueue, (void *)tof);
+  queueMonitorSent(qmTof, tofDataQueue, result ? pdTRUE : pdFALSE);
+
+  return result;
 }
@@ -56,9 +56,14 @@
  *
  */
 #include <inttypes.h>
+#include <math.h>
 #include "kalman_core.h"
 #include "estimator_kalman.h"
+#include "estimator.h"
+#include "deadlinemonitor.h"
+#include "sysview_markers.h"
 #include "kalman_supervisor.h"
+#include "kalman_trace.h"
 
 
 #include "stm32_legacy.h"
@@ -76,8 +81,10 @@
 #include "physicalConstants.h"
 
 #include "statsCnt.h"
+#include "spsc_ring.h"
 #include "rateSupervisor.h"
 #include "config.h"
+#include "usec_time.h"
 
 #define DEBUG_MODULE "ESTKALMAN"
 #include "debug_cf.h"
@@ -97,69 +104,65 @@
  * As well as by the following internal functions and datatypes
  */
 
+// The measurements are passed in lock-free rings, every ring must only have one
+// producer task. The Kalman task is the only consumer.
+#define MEASUREMENT_RING_LENGTH 16
+
 // Distance-to-point measurements
-static xQueueHandle distDataQueue;
-STATIC_MEM_QUEUE_ALLOC(distDataQueue, 10, sizeof(distanceMeasurement_t));
+SPSC_RING_ALLOC(distDataRing, MEASUREMENT_RING_LENGTH, sizeof(distanceMeasurement_t));
 
 static inline bool stateEstimatorHasDistanceMeasurement(distanceMeasurement_t *dist) {
-  return (pdTRUE == xQueueReceive(distDataQueue, dist, 0));
+  return spscRingPop(&distDataRing, dist);
 }
 
 // Direct measurements of Crazyflie position
-static xQueueHandle posDataQueue;
-STATIC_MEM_QUEUE_ALLOC(posDataQueue, 10, sizeof(positionMeasurement_t));
+SPSC_RING_ALLOC(posDataRing, MEASUREMENT_RING_LENGTH, sizeof(positionMeasurement_t));
 
 static inline bool stateEstimatorHasPositionMeasurement(positionMeasurement_t *pos) {
-  return (pdTRUE == xQueueReceive(posDataQueue, pos, 0));
+  return spscRingPop(&posDataRing, pos);
 }
 
 // Direct measurements of Crazyflie pose
-static xQueueHandle poseDataQueue;
-STATIC_MEM_QUEUE_ALLOC(poseDataQueue, 10, sizeof(poseMeasurement_t));
+SPSC_RING_ALLOC(poseDataRing, MEASUREMENT_RING_LENGTH, sizeof(poseMeasurement_t));
 
 static inline bool stateEstimatorHasPoseMeasurement(poseMeasurement_t *pose) {
-  return (pdTRUE == xQueueReceive(poseDataQueue, pose, 0));
+  return spscRingPop(&poseDataRing, pose);
 }
 
 // Measurements of a UWB Tx/Rx
-static xQueueHandle tdoaDataQueue;
-STATIC_MEM_QUEUE_ALLOC(tdoaDataQueue, 10, sizeof(tdoaMeasurement_t));
+SPSC_RING_ALLOC(tdoaDataRing, MEASUREMENT_RING_LENGTH, sizeof(tdoaMeasurement_t));
 
 static inline bool stateEstimatorHasTDOAPacket(tdoaMeasurement_t *uwb) {
-  return (pdTRUE == xQueueReceive(tdoaDataQueue, uwb, 0));
+  return spscRingPop(&tdoaDataRing, uwb);
 }
 
 // Measurements of flow (dnx, dny)
-static xQueueHandle flowDataQueue;
-STATIC_MEM_QUEUE_ALLOC(flowDataQueue, 10, sizeof(flowMeasurement_t));
+SPSC_RING_ALLOC(flowDataRing, MEASUREMENT_RING_LENGTH, sizeof(flowMeasurement_t));
 
 static inline bool stateEstimatorHasFlowPacket(flowMeasurement_t *flow) {
-  return (pdTRUE == xQueueReceive(flowDataQueue, flow, 0));
+  return spscRingPop(&flowDataRing, flow);
 }
 
 // Measurements of TOF from laser sensor
-static xQueueHandle tofDataQueue;
-STATIC_MEM_QUEUE_ALLOC(tofDataQueue, 10, sizeof(tofMeasurement_t));
+SPSC_RING_ALLOC(tofDataRing, MEASUREMENT_RING_LENGTH, sizeof(tofMeasurement_t));
 
 static inline bool stateEstimatorHasTOFPacket(tofMeasurement_t *tof) {
-  return (pdTRUE == xQueueReceive(tofDataQueue, tof, 0));
+  return spscRingPop(&tofDataRing, tof);
 }
 
 // Absolute height measurement along the room Z
-static xQueueHandle heightDataQueue;
-STATIC_MEM_QUEUE_ALLOC(heightDataQueue, 10, sizeof(heightMeasurement_t));
+SPSC_RING_ALLOC(heightDataRing, MEASUREMENT_RING_LENGTH, sizeof(heightMeasurement_t));
 
 static inline bool stateEstimatorHasHeightPacket(heightMeasurement_t *height) {
-  return (pdTRUE == xQueueReceive(heightDataQueue, height, 0));
+  return spscRingPop(&heightDataRing, height);
 }
 
 
-static xQueueHandle yawErrorDataQueue;
-STATIC_MEM_QUEUE_ALLOC(yawErrorDataQueue, 10, sizeof(yawErrorMeasurement_t));
+SPSC_RING_ALLOC(yawErrorDataRing, MEASUREMENT_RING_LENGTH, sizeof(yawErrorMeasurement_t));
 
 static inline bool stateEstimatorHasYawErrorPacket(yawErrorMeasurement_t *error)
 {
-  return (pdTRUE == xQueueReceive(yawErrorDataQueue, error, 0));
+  return spscRingPop(&yawErrorDataRing, error);
 }
 
 // static xQueueHandle sweepAnglesDataQueue;
@@ -173,11 +176,6 @@ static inline bool stateEstimatorHasYawErrorPacket(yawErrorMeasurement_t *error)
 // Semaphore to signal that we got data from the stabilzer loop to process
 static SemaphoreHandle_t runTaskSemaphore;
 
-// Mutex to protect data that is shared between the task and
-// functions called by the stabilizer loop
-static SemaphoreHandle_t dataMutex;
-static StaticSemaphore_t dataMutexBuffer;
-
 
 /**
  * Constants used in the estimator
@@ -193,6 +191,16 @@ static StaticSemaphore_t dataMutexBuffer;
 #define PREDICT_RATE RATE_100_HZ // this is slower than the IMU update rate of 500Hz
 #define BARO_RATE RATE_25_HZ
 
+#ifdef CONFIG_KALMAN_ADAPTIVE_PREDICT_RATE
+// The prediction rates the task picks from, the fastest still averages two
+// IMU samples of the 1kHz stabilizer loop
+static const uint16_t predictRates[] = { RATE_100_HZ, RATE_250_HZ, RATE_500_HZ };
+#define PREDICT_RATE_LEVELS (sizeof(predictRates) / sizeof(predictRates[0]))
+#define PREDICT_RATE_EVALUATION_MS 500
+// A faster rate is only picked if its estimated load stays below this share of the max
+#define PREDICT_RATE_RAISE_MARGIN 0.8f
+#endif
+
 // the point at which the dynamics change from stationary to flying
 #define IN_FLIGHT_THRUST_THRESHOLD (GRAVITY_MAGNITUDE*0.1f)
 #define IN_FLIGHT_TIME_THRESHOLD (500)
@@ -230,15 +238,46 @@ static uint32_t accAccumulatorCount;
 static uint32_t thrustAccumulatorCount;
 static uint32_t gyroAccumulatorCount;
 static uint32_t baroAccumulatorCount;
+#ifdef CONFIG_ESTIMATOR_MEASURED_DT
+static uint64_t gyroAccumulatorTimestamp; // Of the last gyro sample accumulated
+static uint64_t lastPredictionTimestamp;  // Task only
+#endif
 static bool quadIsFlying = false;
 static uint32_t lastFlightCmd;
 static uint32_t takeoffTime;
 
-// Data used to enable the task and stabilizer loop to run with minimal locking
-static state_t taskEstimatorState; // The estimator state produced by the task, copied to the stabilzer when needed.
 static Axis3f gyroSnapshot; // A snpashot of the latest gyro data, used by the task
 static Axis3f accSnapshot; // A snpashot of the latest acc data, used by the task
 
+// The stabilizer and the task share no lock. The stabilizer accumulates its
+// samples into one of two banks, the task flips the bank at the start of a
+// round and merges the full one into the accumulators and the snapshots above,
+// which are then only used by the task. The task publishes the state into one
+// of two slots when a prediction or an update changed it, the stabilizer copies
+// the newest one. Both work on the same core, where the stabilizer preempts the
+// task, and with CONFIG_KALMAN_CORE_SPLIT on two.
+typedef struct {
+  Axis3f acc;
+  Axis3f gyro;
+  float thrust;
+  float baroAsl;
+  uint32_t accCount;
+  uint32_t gyroCount;
+  uint32_t thrustCount;
+  uint32_t baroCount;
+  Axis3f lastAcc;
+  Axis3f lastGyro;
+#ifdef CONFIG_ESTIMATOR_MEASURED_DT
+  uint64_t gyroTimestamp;
+#endif
+} sensorBank_t;
+
+static sensorBank_t sensorBanks[2];
+static uint32_t sensorWriteBank;  // The bank the stabilizer accumulates into
+static uint32_t sensorBankBusy;   // Set while the stabilizer writes a bank
+static state_t publishedStates[2];
+static uint32_t stateSequence;    // The newest state is in publishedStates[stateSequence & 1]
+
 // Statistics
 #define ONE_SECOND 1000
 static STATS_CNT_RATE_DEFINE(updateCounter, ONE_SECOND);
@@ -250,6 +289,30 @@ static STATS_CNT_RATE_DEFINE(measurementNotAppendedCounter, ONE_SECOND);
 
 static rateSupervisor_t rateSupervisorContext;
 
+static uint16_t predictRate = PREDICT_RATE;
+// Predictions that were due but did not run, the task was late or had no IMU sample
+static uint32_t predictDroppedCount;
+
+#ifdef CONFIG_KALMAN_ADAPTIVE_PREDICT_RATE
+static uint8_t predictRateLevel;
+static uint32_t predictEvaluationTick;
+static uint32_t predictDroppedAtEvaluation;
+// Time spent in the rounds of the task since the last evaluation, preemptions included
+static uint64_t predictBusyUs;
+static float predictLoad; // percent
+#endif
+
+#ifdef CONFIG_ESTIMATOR_SHADOW
+// Time spent in the rounds of the task since boot, wraps
+static uint32_t taskBusyUs;
+#endif
+
+// Measurements with a timestamp are extrapolated to the time of the state,
+// older ones are dropped
+static float maxMeasurementDelay = 0.2f; // s
+static float measurementDelay; // of the last timestamped measurement, s
+static uint32_t delayedDroppedCount;
+
 #define WARNING_HOLD_BACK_TIME M2T(2000)
 static uint32_t warningBlockTime = 0;
 
@@ -262,6 +325,11 @@ static const bool useBaroUpdate = false;
 static void kalmanTask(void* parameters);
 static bool predictStateForward(uint32_t osTick, float dt);
 static bool updateQueuedMeasurments(const Axis3f *gyro, const uint32_t tick);
+#ifdef CONFIG_KALMAN_ADAPTIVE_PREDICT_RATE
+static void updatePredictRate(uint32_t osTick);
+#endif
+static void mergeSensorBank(void);
+static void publishState(uint32_t osTick);
 
 STATIC_MEM_TASK_ALLOC_STACK_NO_DMA_CCM_SAFE(kalmanTask, 3 * configMINIMAL_STACK_SIZE);
 
@@ -269,21 +337,11 @@ STATIC_MEM_TASK_ALLOC_STACK_NO_DMA_CCM_SAFE(kalmanTask, 3 * configMINIMAL_STACK_
 
 // Called one time during system startup
 void estimatorKalmanTaskInit() {
-  distDataQueue = STATIC_MEM_QUEUE_CREATE(distDataQueue);
-  posDataQueue = STATIC_MEM_QUEUE_CREATE(posDataQueue);
-  poseDataQueue = STATIC_MEM_QUEUE_CREATE(poseDataQueue);
-  tdoaDataQueue = STATIC_MEM_QUEUE_CREATE(tdoaDataQueue);
-  flowDataQueue = STATIC_MEM_QUEUE_CREATE(flowDataQueue);
-  tofDataQueue = STATIC_MEM_QUEUE_CREATE(tofDataQueue);
-  heightDataQueue = STATIC_MEM_QUEUE_CREATE(heightDataQueue);
-  yawErrorDataQueue = STATIC_MEM_QUEUE_CREATE(yawErrorDataQueue);
   //sweepAnglesDataQueue = STATIC_MEM_QUEUE_CREATE(sweepAnglesDataQueue);
 
   vSemaphoreCreateBinary(runTaskSemaphore);
 
-  dataMutex = xSemaphoreCreateMutexStatic(&dataMutexBuffer);
-
-  STATIC_MEM_TASK_CREATE(kalmanTask, kalmanTask, KALMAN_TASK_NAME, NULL, KALMAN_TASK_PRI);
+  STATIC_MEM_TASK_CREATE_PINNED(kalmanTask, kalmanTask, KALMAN_TASK_NAME, NULL, KALMAN_TASK_PRI, KALMAN_TASK_CORE);
 
   isInit = true;
 }
@@ -300,10 +358,20 @@ static void kalmanTask(void* parameters) {
   uint32_t lastPNUpdate = xTaskGetTickCount();
   uint32_t nextBaroUpdate = xTaskGetTickCount();
 
-  rateSupervisorInit(&rateSupervisorContext, xTaskGetTickCount(), M2T(1000), 99, 101, 1);
+  rateSupervisorInit(&rateSupervisorContext, xTaskGetTickCount(), M2T(1000), predictRate - 1, predictRate + 1, 1);
+#ifdef CONFIG_KALMAN_ADAPTIVE_PREDICT_RATE
+  predictEvaluationTick = xTaskGetTickCount();
+#endif
+  // A round per stabilizer loop
+  deadlineMonitorRegister(dmKalman, 1000000 / RATE_MAIN_LOOP, KALMAN_TASK_BUDGET_US);
 
   while (true) {
     xSemaphoreTake(runTaskSemaphore, portMAX_DELAY);
+    deadlineMonitorCheckIn(dmKalman);
+    SYSVIEW_MARKER_START(svKalmanUpdate);
+#if defined(CONFIG_KALMAN_ADAPTIVE_PREDICT_RATE) || defined(CONFIG_ESTIMATOR_SHADOW)
+    const uint64_t roundStartUs = usecTimestamp();
+#endif
 
     // If the client triggers an estimator reset via parameter update
     if (coreData.resetEstimation) {
@@ -311,25 +379,33 @@ static void kalmanTask(void* parameters) {
       paramSetInt(paramGetVarId("kalman", "resetEstimation"), 0);
     }
 
+    mergeSensorBank();
+
     // Tracks whether an update to the state has been made, and the state therefore requires finalization
     bool doneUpdate = false;
 
     uint32_t osTick = xTaskGetTickCount(); // would be nice if this had a precision higher than 1ms...
 
   #ifdef KALMAN_DECOUPLE_XY
+    KALMAN_TRACE(KALMAN_TRACE_DECOUPLE_XY, osTick, NULL, 0);
     kalmanCoreDecoupleXY(&coreData);
   #endif
 
     // Run the system dynamics to predict the state forward.
-    if (osTick >= nextPrediction) { // update at the PREDICT_RATE
+    if (osTick >= nextPrediction) { // update at the predictRate
+      const uint32_t predictPeriod = S2T(1.0f / predictRate);
+      predictDroppedCount += (osTick - nextPrediction) / predictPeriod;
+
       float dt = T2S(osTick - lastPrediction);
       if (predictStateForward(osTick, dt)) {
         lastPrediction = osTick;
         doneUpdate = true;
         STATS_CNT_RATE_EVENT(&predictionCounter);
+      } else {
+        predictDroppedCount++;
       }
 
-      nextPrediction = osTick + S2T(1.0f / PREDICT_RATE);
+      nextPrediction = osTick + predictPeriod;
 
       if (!rateSupervisorValidate(&rateSupervisorContext, T2M(osTick))) {
         DEBUG_PRINT("WARNING: Kalman prediction rate low (%"PRIu32")\n", rateSupervisorLatestCount(&rateSupervisorContext));
@@ -342,11 +418,18 @@ static void kalmanTask(void* parameters) {
     {
       float dt = T2S(osTick - lastPNUpdate);
       if (dt > 0.0f) {
+        KALMAN_TRACE(KALMAN_TRACE_PROCESS_NOISE, osTick, &dt, sizeof(dt));
         kalmanCoreAddProcessNoise(&coreData, dt);
         lastPNUpdate = osTick;
       }
     }
 
+#ifdef CONFIG_KALMAN_BATCHED_UPDATE
+    // Stack all measurements since the last round into one vector update
+    KALMAN_TRACE(KALMAN_TRACE_BATCH_BEGIN, osTick, NULL, 0);
+    kalmanCoreBatchBegin(&coreData);
+#endif
+
     /**
      * Update the state estimate with the barometer measurements
      */
@@ -355,12 +438,14 @@ static void kalmanTask(void* parameters) {
       if (osTick > nextBaroUpdate // update at BARO_RATE
           && baroAccumulatorCount > 0)
       {
-        xSemaphoreTake(dataMutex, portMAX_DELAY);
         float baroAslAverage = baroAslAccumulator / baroAccumulatorCount;
         baroAslAccumulator = 0;
         baroAccumulatorCount = 0;
-        xSemaphoreGive(dataMutex);
 
+  #ifdef CONFIG_KALMAN_TRACE
+        const kalmanTraceBaro_t baroTrace = { .asl = baroAslAverage, .quadIsFlying = quadIsFlying };
+        KALMAN_TRACE(KALMAN_TRACE_BARO, osTick, &baroTrace, sizeof(baroTrace));
+  #endif
         kalmanCoreUpdateWithBaro(&coreData, baroAslAverage, quadIsFlying);
 
         nextBaroUpdate = osTick + S2T(1.0f / BARO_RATE);
@@ -370,17 +455,15 @@ static void kalmanTask(void* parameters) {
       }
     }
 
-    {
-      Axis3f gyro;
-      xSemaphoreTake(dataMutex, portMAX_DELAY);
-      memcpy(&gyro, &gyroSnapshot, sizeof(gyro));
-      xSemaphoreGive(dataMutex);
-
-      if(updateQueuedMeasurments(&gyro, osTick)) {
-        doneUpdate = true;
-      }
+    if(updateQueuedMeasurments(&gyroSnapshot, osTick)) {
+      doneUpdate = true;
     }
 
+#ifdef CONFIG_KALMAN_BATCHED_UPDATE
+    KALMAN_TRACE(KALMAN_TRACE_BATCH_END, osTick, NULL, 0);
+    kalmanCoreBatchEnd(&coreData);
+#endif
+
     /**
      * If an update has been made, the state is finalized:
      * - the attitude error is moved into the body attitude quaternion,
@@ -390,7 +473,9 @@ static void kalmanTask(void* parameters) {
 
     if (doneUpdate)
     {
+      KALMAN_TRACE(KALMAN_TRACE_FINALIZE, osTick, NULL, 0);
       kalmanCoreFinalize(&coreData, osTick);
+      KALMAN_TRACE_STATE(&coreData, osTick);
       STATS_CNT_RATE_EVENT(&finalizeCounter);
       if (! kalmanSupervisorIsStateWithinBounds(&coreData)) {
         coreData.resetEstimation = true;
@@ -400,62 +485,212 @@ static void kalmanTask(void* parameters) {
           DEBUG_PRINT("State out of bounds, resetting\n");
         }
       }
+#ifdef CONFIG_KALMAN_HEALTH_MONITOR
+      if (! kalmanSupervisorIsHealthy(&coreData, osTick)) {
+        coreData.resetEstimation = true;
+
+        if (osTick > warningBlockTime) {
+          warningBlockTime = osTick + WARNING_HOLD_BACK_TIME;
+          DEBUG_PRINT("State not finite, resetting\n");
+        }
+      }
+#endif
     }
 
     /**
-     * Finally, the internal state is externalized.
-     * This is done every round, since the external state includes some sensor data
+     * Finally, the internal state is externalized, only when it changed. The
+     * rounds without a prediction or an update leave the stabilizer the last
+     * one, its acceleration included.
      */
-    xSemaphoreTake(dataMutex, portMAX_DELAY);
-    kalmanCoreExternalizeState(&coreData, &taskEstimatorState, &accSnapshot, osTick);
-    xSemaphoreGive(dataMutex);
+    if (doneUpdate) {
+      publishState(osTick);
+    }
 
     STATS_CNT_RATE_EVENT(&updateCounter);
+
+#ifdef CONFIG_KALMAN_ADAPTIVE_PREDICT_RATE
+    predictBusyUs += usecTimestamp() - roundStartUs;
+    if (osTick - predictEvaluationTick >= M2T(PREDICT_RATE_EVALUATION_MS)) {
+      updatePredictRate(osTick);
+    }
+#endif
+#ifdef CONFIG_ESTIMATOR_SHADOW
+    __atomic_store_n(&taskBusyUs, taskBusyUs + (uint32_t)(usecTimestamp() - roundStartUs), __ATOMIC_RELAXED);
+#endif
+    SYSVIEW_MARKER_STOP(svKalmanUpdate);
+    deadlineMonitorCheckOut(dmKalman);
   }
 }
 
-void estimatorKalman(state_t *state, sensorData_t *sensors, control_t *control, const uint32_t tick)
+#ifdef CONFIG_ESTIMATOR_SHADOW
+uint32_t estimatorKalmanTaskBusyUs(void)
 {
-  // This function is called from the stabilizer loop. It is important that this call returns
-  // as quickly as possible. The dataMutex must only be locked short periods by the task.
-  xSemaphoreTake(dataMutex, portMAX_DELAY);
-
-  // Average the last IMU measurements. We do this because the prediction loop is
-  // slower than the IMU loop, but the IMU information is required externally at
-  // a higher rate (for body rate control).
-  if (sensorsReadAcc(&sensors->acc)) {
-    accAccumulator.x += sensors->acc.x;
-    accAccumulator.y += sensors->acc.y;
-    accAccumulator.z += sensors->acc.z;
-    accAccumulatorCount++;
+  return __atomic_load_n(&taskBusyUs, __ATOMIC_RELAXED);
+}
+#endif
+
+#ifdef CONFIG_KALMAN_ADAPTIVE_PREDICT_RATE
+/**
+ * Pick the prediction rate from the load of the task since the last evaluation.
+ * The rate backs off when the task takes more than CONFIG_KALMAN_PREDICT_LOAD_MAX
+ * percent of the time or dropped a prediction, and goes up when the load at the
+ * faster rate is expected to stay below the max. Most of the cost of a round is
+ * the prediction and the finalization, so the load is scaled with the rate.
+ */
+static void updatePredictRate(uint32_t osTick)
+{
+  const uint32_t windowUs = T2M(osTick - predictEvaluationTick) * 1000;
+  const bool dropped = predictDroppedCount != predictDroppedAtEvaluation;
+  uint8_t level = predictRateLevel;
+
+  predictLoad = 100.0f * predictBusyUs / windowUs;
+
+  if (predictLoad > CONFIG_KALMAN_PREDICT_LOAD_MAX || dropped) {
+    if (level > 0) {
+      level--;
+    }
+  } else if (level + 1 < PREDICT_RATE_LEVELS) {
+    const float raisedLoad = predictLoad * predictRates[level + 1] / predictRates[level];
+    if (raisedLoad < PREDICT_RATE_RAISE_MARGIN * CONFIG_KALMAN_PREDICT_LOAD_MAX) {
+      level++;
+    }
   }
 
-  if (sensorsReadGyro(&sensors->gyro)) {
-    gyroAccumulator.x += sensors->gyro.x;
-    gyroAccumulator.y += sensors->gyro.y;
-    gyroAccumulator.z += sensors->gyro.z;
-    gyroAccumulatorCount++;
+  if (level != predictRateLevel) {
+    predictRateLevel = level;
+    predictRate = predictRates[level];
+    rateSupervisorInit(&rateSupervisorContext, T2M(osTick), M2T(1000), predictRate - 1, predictRate + 1, 1);
   }
 
-  // Average the thrust command from the last time steps, generated externally by the controller
-  thrustAccumulator += control->thrust;
-  thrustAccumulatorCount++;
+  predictBusyUs = 0;
+  predictEvaluationTick = osTick;
+  predictDroppedAtEvaluation = predictDroppedCount;
+}
+#endif
 
-  // Average barometer data
-  if (useBaroUpdate) {
-    if (sensorsReadBaro(&sensors->baro)) {
-      baroAslAccumulator += sensors->baro.asl;
-      baroAccumulatorCount++;
-    }
+/**
+ * Flip the bank of the stabilizer and add the samples of the full one to the
+ * accumulators of the task. The stabilizer sets sensorBankBusy before it picks
+ * its bank, once it is clear after the flip the stabilizer can only write to
+ * the other bank. It is clear within the few additions of one accumulation.
+ */
+static void mergeSensorBank(void)
+{
+  const uint32_t full = sensorWriteBank;
+  __atomic_store_n(&sensorWriteBank, full ^ 1, __ATOMIC_SEQ_CST);
+  while (__atomic_load_n(&sensorBankBusy, __ATOMIC_SEQ_CST)) {
+  }
+
+  sensorBank_t *bank = &sensorBanks[full];
+
+  accAccumulator.x += bank->acc.x;
+  accAccumulator.y += bank->acc.y;
+  accAccumulator.z += bank->acc.z;
+  accAccumulatorCount += bank->accCount;
+  gyroAccumulator.x += bank->gyro.x;
+  gyroAccumulator.y += bank->gyro.y;
+  gyroAccumulator.z += bank->gyro.z;
+  gyroAccumulatorCount += bank->gyroCount;
+  thrustAccumulator += bank->thrust;
+  thrustAccumulatorCount += bank->thrustCount;
+  baroAslAccumulator += bank->baroAsl;
+  baroAccumulatorCount += bank->baroCount;
+
+  if (bank->accCount > 0) {
+    accSnapshot = bank->lastAcc;
+  }
+  if (bank->gyroCount > 0) {
+    gyroSnapshot = bank->lastGyro;
+#ifdef CONFIG_ESTIMATOR_MEASURED_DT
+    gyroAccumulatorTimestamp = bank->gyroTimestamp;
+#endif
   }
 
-  // Make a copy of sensor data to be used by the task
-  memcpy(&gyroSnapshot, &sensors->gyro, sizeof(gyroSnapshot));
-  memcpy(&accSnapshot, &sensors->acc, sizeof(accSnapshot));
+  memset(bank, 0, sizeof(*bank));
+}
+
+/**
+ * Externalize the state into the slot the stabilizer is not reading. Its slot
+ * is only written by the next publication, after the stabilizer saw this one.
+ */
+static void publishState(uint32_t osTick)
+{
+  const uint32_t sequence = stateSequence + 1;
+  kalmanCoreExternalizeState(&coreData, &publishedStates[sequence & 1], &accSnapshot, osTick);
+  __atomic_store_n(&stateSequence, sequence, __ATOMIC_SEQ_CST);
+}
+
+// Retries if the task published twice while the state was copied
+static void copyPublishedState(state_t *state)
+{
+  uint32_t sequence;
+  do {
+    sequence = __atomic_load_n(&stateSequence, __ATOMIC_ACQUIRE);
+    memcpy(state, &publishedStates[sequence & 1], sizeof(state_t));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  } while (__atomic_load_n(&stateSequence, __ATOMIC_RELAXED) != sequence);
+}
+
+// Lock-free, from the stabilizer only
+static void accumulateSensors(const sensorData_t *sensors, const control_t *control, bool hasAcc, bool hasGyro, bool hasBaro)
+{
+  __atomic_store_n(&sensorBankBusy, 1, __ATOMIC_SEQ_CST);
+  sensorBank_t *bank = &sensorBanks[__atomic_load_n(&sensorWriteBank, __ATOMIC_SEQ_CST)];
+
+  if (hasAcc) {
+    bank->acc.x += sensors->acc.x;
+    bank->acc.y += sensors->acc.y;
+    bank->acc.z += sensors->acc.z;
+    bank->accCount++;
+    bank->lastAcc = sensors->acc;
+  }
+
+  if (hasGyro) {
+    bank->gyro.x += sensors->gyro.x;
+    bank->gyro.y += sensors->gyro.y;
+    bank->gyro.z += sensors->gyro.z;
+    bank->gyroCount++;
+    bank->lastGyro = sensors->gyro;
+#ifdef CONFIG_ESTIMATOR_MEASURED_DT
+    bank->gyroTimestamp = sensors->interruptTimestamp;
+#endif
+  }
+
+  bank->thrust += control->thrust;
+  bank->thrustCount++;
+
+  if (hasBaro) {
+    bank->baroAsl += sensors->baro.asl;
+    bank->baroCount++;
+  }
+
+  __atomic_store_n(&sensorBankBusy, 0, __ATOMIC_RELEASE);
+}
+
+void estimatorKalman(state_t *state, sensorData_t *sensors, control_t *control, const uint32_t tick)
+{
+  // This function is called from the stabilizer loop. It is important that this call returns
+  // as quickly as possible, it never waits for the task.
+
+  const bool hasAcc = sensorsReadAcc(&sensors->acc);
+  const bool hasGyro = sensorsReadGyro(&sensors->gyro);
+  const bool hasBaro = useBaroUpdate && sensorsReadBaro(&sensors->baro);
+  if (hasGyro) {
+    sensors->interruptTimestamp = sensorsGyroTimestamp();
+  }
+  accumulateSensors(sensors, control, hasAcc, hasGyro, hasBaro);
 
   // Copy the latest state, calculated by the task
-  memcpy(state, &taskEstimatorState, sizeof(state_t));
-  xSemaphoreGive(dataMutex);
+  copyPublishedState(state);
+
+  xSemaphoreGive(runTaskSemaphore);
+}
+
+void estimatorKalmanWithSensors(state_t *state, const sensorData_t *sensors, const control_t *control, const uint32_t tick)
+{
+  // The samples of every loop are taken as new, the loop read them for the other estimator
+  accumulateSensors(sensors, control, true, true, useBaroUpdate);
+  copyPublishedState(state);
 
   xSemaphoreGive(runTaskSemaphore);
 }
@@ -468,8 +703,6 @@ static bool predictStateForward(uint32_t osTick, float dt) {
     return false;
   }
 
-  xSemaphoreTake(dataMutex, portMAX_DELAY);
-
   // gyro is in deg/sec but the estimator requires rad/sec
   Axis3f gyroAverage;
   gyroAverage.x = gyroAccumulator.x * DEG_TO_RAD / gyroAccumulatorCount;
@@ -492,7 +725,10 @@ static bool predictStateForward(uint32_t osTick, float dt) {
   thrustAccumulator = 0;
   thrustAccumulatorCount = 0;
 
-  xSemaphoreGive(dataMutex);
+#ifdef CONFIG_ESTIMATOR_MEASURED_DT
+  // The averages cover the samples from the last one of the previous prediction on
+  dt = estimatorSampleDt(&lastPredictionTimestamp, gyroAccumulatorTimestamp, dt);
+#endif
 
   // TODO: Find a better check for whether the quad is flying
   // Assume that the flight begins when the thrust is large enough and for now we never stop "flying".
@@ -504,14 +740,72 @@ static bool predictStateForward(uint32_t osTick, float dt) {
   }
   quadIsFlying = (osTick-lastFlightCmd) < IN_FLIGHT_TIME_THRESHOLD;
 
+#ifdef CONFIG_KALMAN_TRACE
+  const kalmanTracePredict_t predictTrace = {
+    .thrust = thrustAverage, .acc = accAverage, .gyro = gyroAverage, .dt = dt, .quadIsFlying = quadIsFlying,
+  };
+  KALMAN_TRACE(KALMAN_TRACE_PREDICT, osTick, &predictTrace, sizeof(predictTrace));
+#endif
   kalmanCorePredict(&coreData, thrustAverage, &accAverage, &gyroAverage, dt, quadIsFlying);
 
   return true;
 }
 
 
+/**
+ * Moves a position, and the orientation if any, measured at timestampUs to
+ * nowUs, with the estimated velocity and the gyro. Forward propagating the
+ * measurement is much cheaper than keeping a history of the states to fuse
+ * it into, and as good over the few tens of ms of a mocap over Wi-Fi.
+ *
+ * @return False if the measurement is too old to be fused
+ */
+static bool compensateMeasurementDelay(uint32_t timestampUs, uint32_t nowUs, float pos[3], quaternion_t *quat, const Axis3f *gyro)
+{
+  if (timestampUs == 0) {
+    return true;
+  }
+
+  const int32_t delayUs = (int32_t)(nowUs - timestampUs);
+  if (delayUs <= 0) {
+    return true;
+  }
+
+  const float dt = delayUs * 1e-6f;
+  if (dt > maxMeasurementDelay) {
+    delayedDroppedCount++;
+    return false;
+  }
+  measurementDelay = dt;
+
+  // The velocity of the state is in the body frame
+  const float *S = coreData.S;
+  for (int i = 0; i < 3; i++) {
+    pos[i] += dt * (coreData.R[i][0] * S[KC_STATE_PX] + coreData.R[i][1] * S[KC_STATE_PY] + coreData.R[i][2] * S[KC_STATE_PZ]);
+  }
+
+  if (quat) {
+    // q = q * [1, w * dt / 2], the gyro is in deg/s in the body frame
+    const float hx = gyro->x * DEG_TO_RAD * dt / 2.0f;
+    const float hy = gyro->y * DEG_TO_RAD * dt / 2.0f;
+    const float hz = gyro->z * DEG_TO_RAD * dt / 2.0f;
+    const float qx = quat->x + quat->w * hx + quat->y * hz - quat->z * hy;
+    const float qy = quat->y + quat->w * hy + quat->z * hx - quat->x * hz;
+    const float qz = quat->z + quat->w * hz + quat->x * hy - quat->y * hx;
+    const float qw = quat->w - quat->x * hx - quat->y * hy - quat->z * hz;
+    const float norm = sqrtf(qx * qx + qy * qy + qz * qz + qw * qw);
+    quat->x = qx / norm;
+    quat->y = qy / norm;
+    quat->z = qz / norm;
+    quat->w = qw / norm;
+  }
+
+  return true;
+}
+
 static bool updateQueuedMeasurments(const Axis3f *gyro, const uint32_t tick) {
   bool doneUpdate = false;
+  const uint32_t nowUs = (uint32_t)usecTimestamp();
   /**
    * Sensor measurements can come in sporadically and faster than the stabilizer loop frequency,
    * we therefore consume all measurements since the last loop, rather than accumulating
@@ -520,6 +814,7 @@ static bool updateQueuedMeasurments(const Axis3f *gyro, const uint32_t tick) {
   tofMeasurement_t tof;
   while (stateEstimatorHasTOFPacket(&tof))
   {
+    KALMAN_TRACE(KALMAN_TRACE_TOF, tick, &tof, sizeof(tof));
     kalmanCoreUpdateWithTof(&coreData, &tof);
     doneUpdate = true;
   }
@@ -527,6 +822,7 @@ static bool updateQueuedMeasurments(const Axis3f *gyro, const uint32_t tick) {
   yawErrorMeasurement_t yawError;
   while (stateEstimatorHasYawErrorPacket(&yawError))
   {
+    KALMAN_TRACE(KALMAN_TRACE_YAW_ERROR, tick, &yawError, sizeof(yawError));
     kalmanCoreUpdateWithYawError(&coreData, &yawError);
     doneUpdate = true;
   }
@@ -534,6 +830,7 @@ static bool updateQueuedMeasurments(const Axis3f *gyro, const uint32_t tick) {
   heightMeasurement_t height;
   while (stateEstimatorHasHeightPacket(&height))
   {
+    KALMAN_TRACE(KALMAN_TRACE_HEIGHT, tick, &height, sizeof(height));
     kalmanCoreUpdateWithAbsoluteHeight(&coreData, &height);
     doneUpdate = true;
   }
@@ -541,6 +838,7 @@ static bool updateQueuedMeasurments(const Axis3f *gyro, const uint32_t tick) {
   distanceMeasurement_t dist;
   while (stateEstimatorHasDistanceMeasurement(&dist))
   {
+    KALMAN_TRACE(KALMAN_TRACE_DISTANCE, tick, &dist, sizeof(dist));
     kalmanCoreUpdateWithDistance(&coreData, &dist);
     doneUpdate = true;
   }
@@ -548,6 +846,10 @@ static bool updateQueuedMeasurments(const Axis3f *gyro, const uint32_t tick) {
   positionMeasurement_t pos;
   while (stateEstimatorHasPositionMeasurement(&pos))
   {
+    if (!compensateMeasurementDelay(pos.timestampUs, nowUs, pos.pos, NULL, gyro)) {
+      continue;
+    }
+    KALMAN_TRACE(KALMAN_TRACE_POSITION, tick, &pos, sizeof(pos));
     kalmanCoreUpdateWithPosition(&coreData, &pos);
     doneUpdate = true;
   }
@@ -555,6 +857,10 @@ static bool updateQueuedMeasurments(const Axis3f *gyro, const uint32_t tick) {
   poseMeasurement_t pose;
   while (stateEstimatorHasPoseMeasurement(&pose))
   {
+    if (!compensateMeasurementDelay(pose.timestampUs, nowUs, pose.pos, &pose.quat, gyro)) {
+      continue;
+    }
+    KALMAN_TRACE(KALMAN_TRACE_POSE, tick, &pose, sizeof(pose));
     kalmanCoreUpdateWithPose(&coreData, &pose);
     doneUpdate = true;
   }
@@ -562,6 +868,7 @@ static bool updateQueuedMeasurments(const Axis3f *gyro, const uint32_t tick) {
   tdoaMeasurement_t tdoa;
   while (stateEstimatorHasTDOAPacket(&tdoa))
   {
+    KALMAN_TRACE(KALMAN_TRACE_TDOA, tick, &tdoa, sizeof(tdoa));
     kalmanCoreUpdateWithTDOA(&coreData, &tdoa);
     doneUpdate = true;
   }
@@ -569,6 +876,10 @@ static bool updateQueuedMeasurments(const Axis3f *gyro, const uint32_t tick) {
   flowMeasurement_t flow;
   while (stateEstimatorHasFlowPacket(&flow))
   {
+  #ifdef CONFIG_KALMAN_TRACE
+    const kalmanTraceFlow_t flowTrace = { .flow = flow, .gyro = *gyro };
+    KALMAN_TRACE(KALMAN_TRACE_FLOW, tick, &flowTrace, sizeof(flowTrace));
+  #endif
     kalmanCoreUpdateWithFlow(&coreData, &flow, gyro);
     doneUpdate = true;
   }
@@ -585,14 +896,14 @@ static bool updateQueuedMeasurments(const Axis3f *gyro, const uint32_t tick) {
 
 // Called when this estimator is activated
 void estimatorKalmanInit(void) {
-  xQueueReset(distDataQueue);
-  xQueueReset(posDataQueue);
-  xQueueReset(poseDataQueue);
-  xQueueReset(tdoaDataQueue);
-  xQueueReset(flowDataQueue);
-  xQueueReset(tofDataQueue);
-
-  xSemaphoreTake(dataMutex, portMAX_DELAY);
+  spscRingReset(&distDataRing);
+  spscRingReset(&posDataRing);
+  spscRingReset(&poseDataRing);
+  spscRingReset(&tdoaDataRing);
+  spscRingReset(&flowDataRing);
+  spscRingReset(&tofDataRing);
+
+  // Only the task uses the accumulators, it is idle while the estimator is switched to
   accAccumulator = (Axis3f){.axis={0}};
   gyroAccumulator = (Axis3f){.axis={0}};
   thrustAccumulator = 0;
@@ -602,28 +913,14 @@ void estimatorKalmanInit(void) {
   gyroAccumulatorCount = 0;
   thrustAccumulatorCount = 0;
   baroAccumulatorCount = 0;
-  xSemaphoreGive(dataMutex);
 
+  KALMAN_TRACE(KALMAN_TRACE_INIT, xTaskGetTickCount(), NULL, 0);
   kalmanCoreInit(&coreData);
 }
 
-static bool appendMeasurement(xQueueHandle queue, void *measurement)
+static bool appendMeasurement(SpscRing_t *ring, void *measurement)
 {
-  portBASE_TYPE result;
-  bool isInInterrupt = 0; //TODO:= (SCB->ICSR & SCB_ICSR_VECTACTIVE_Msk) != 0;
-
-  if (isInInterrupt) {
-    portBASE_TYPE xHigherPriorityTaskWoken = pdFALSE;
-    result = xQueueSendFromISR(queue, measurement, &xHigherPriorityTaskWoken);
-    if(xHigherPriorityTaskWoken == pdTRUE)
-    {
-      portYIELD();
-    }
-  } else {
-    result = xQueueSend(queue, measurement, 0);
-  }
-
-  if (result == pdTRUE) {
+  if (spscRingPush(ring, measurement)) {
     STATS_CNT_RATE_EVENT(&measurementAppendedCounter);
     return true;
   } else {
@@ -635,52 +932,52 @@ static bool appendMeasurement(xQueueHandle queue, void *measurement)
 bool estimatorKalmanEnqueueTDOA(const tdoaMeasurement_t *uwb)
 {
   ASSERT(isInit);
-  return appendMeasurement(tdoaDataQueue, (void *)uwb);
+  return appendMeasurement(&tdoaDataRing, (void *)uwb);
 }
 
 bool estimatorKalmanEnqueuePosition(const positionMeasurement_t *pos)
 {
   ASSERT(isInit);
-  return appendMeasurement(posDataQueue, (void *)pos);
+  return appendMeasurement(&posDataRing, (void *)pos);
 }
 
 bool estimatorKalmanEnqueuePose(const poseMeasurement_t *pose)
 {
   ASSERT(isInit);
-  return appendMeasurement(poseDataQueue, (void *)pose);
+  return appendMeasurement(&poseDataRing, (void *)pose);
 }
 
 bool estimatorKalmanEnqueueDistance(const distanceMeasurement_t *dist)
 {
   ASSERT(isInit);
-  return appendMeasurement(distDataQueue, (void *)dist);
+  return appendMeasurement(&distDataRing, (void *)dist);
 }
 
 bool estimatorKalmanEnqueueFlow(const flowMeasurement_t *flow)
 {
   // A flow measurement (dnx,  dny) [accumulated pixels]
   ASSERT(isInit);
-  return appendMeasurement(flowDataQueue, (void *)flow);
+  return appendMeasurement(&flowDataRing, (void *)flow);
 }
 
 bool estimatorKalmanEnqueueTOF(const tofMeasurement_t *tof)
 {
   // A distance (distance) [m] to the ground along the z_B axis.
   ASSERT(isInit);
-  return appendMeasurement(tofDataQueue, (void *)tof);
+  return appendMeasurement(&tofDataRing, (void *)tof);
 }
 
 bool estimatorKalmanEnqueueAbsoluteHeight(const heightMeasurement_t *height)
 {
   // A distance (height) [m] to the ground along the z axis.
   ASSERT(isInit);
-  return appendMeasurement(heightDataQueue, (void *)height);
+  return appendMeasurement(&heightDataRing, (void *)height);
 }
 
 bool estimatorKalmanEnqueueYawError(const yawErrorMeasurement_t* error)
 {
   ASSERT(isInit);
-  return appendMeasurement(yawErrorDataQueue, (void *)error);
+  return appendMeasurement(&yawErrorDataRing, (void *)error);
 }
 
 // bool estimatorKalmanEnqueueSweepAngles(const sweepAngleMeasurement_t *angles)
@@ -725,15 +1022,15 @@ LOG_GROUP_START(kalman)
   LOG_ADD(LOG_FLOAT, stateD0, &coreData.S[KC_STATE_D0])
   LOG_ADD(LOG_FLOAT, stateD1, &coreData.S[KC_STATE_D1])
   LOG_ADD(LOG_FLOAT, stateD2, &coreData.S[KC_STATE_D2])
-  LOG_ADD(LOG_FLOAT, varX, &coreData.P[KC_STATE_X][KC_STATE_X])
-  LOG_ADD(LOG_FLOAT, varY, &coreData.P[KC_STATE_Y][KC_STATE_Y])
-  LOG_ADD(LOG_FLOAT, varZ, &coreData.P[KC_STATE_Z][KC_STATE_Z])
-  LOG_ADD(LOG_FLOAT, varPX, &coreData.P[KC_STATE_PX][KC_STATE_PX])
-  LOG_ADD(LOG_FLOAT, varPY, &coreData.P[KC_STATE_PY][KC_STATE_PY])
-  LOG_ADD(LOG_FLOAT, varPZ, &coreData.P[KC_STATE_PZ][KC_STATE_PZ])
-  LOG_ADD(LOG_FLOAT, varD0, &coreData.P[KC_STATE_D0][KC_STATE_D0])
-  LOG_ADD(LOG_FLOAT, varD1, &coreData.P[KC_STATE_D1][KC_STATE_D1])
-  LOG_ADD(LOG_FLOAT, varD2, &coreData.P[KC_STATE_D2][KC_STATE_D2])
+  LOG_ADD(LOG_FLOAT, varX, &coreData.P[KC_P_INDEX(KC_STATE_X, KC_STATE_X)])
+  LOG_ADD(LOG_FLOAT, varY, &coreData.P[KC_P_INDEX(KC_STATE_Y, KC_STATE_Y)])
+  LOG_ADD(LOG_FLOAT, varZ, &coreData.P[KC_P_INDEX(KC_STATE_Z, KC_STATE_Z)])
+  LOG_ADD(LOG_FLOAT, varPX, &coreData.P[KC_P_INDEX(KC_STATE_PX, KC_STATE_PX)])
+  LOG_ADD(LOG_FLOAT, varPY, &coreData.P[KC_P_INDEX(KC_STATE_PY, KC_STATE_PY)])
+  LOG_ADD(LOG_FLOAT, varPZ, &coreData.P[KC_P_INDEX(KC_STATE_PZ, KC_STATE_PZ)])
+  LOG_ADD(LOG_FLOAT, varD0, &coreData.P[KC_P_INDEX(KC_STATE_D0, KC_STATE_D0)])
+  LOG_ADD(LOG_FLOAT, varD1, &coreData.P[KC_P_INDEX(KC_STATE_D1, KC_STATE_D1)])
+  LOG_ADD(LOG_FLOAT, varD2, &coreData.P[KC_P_INDEX(KC_STATE_D2, KC_STATE_D2)])
   LOG_ADD(LOG_FLOAT, q0, &coreData.q[0])
   LOG_ADD(LOG_FLOAT, q1, &coreData.q[1])
   LOG_ADD(LOG_FLOAT, q2, &coreData.q[2])
@@ -747,7 +1044,34 @@ LOG_GROUP_START(kalman)
   STATS_CNT_RATE_LOG_ADD(rtRej, &measurementNotAppendedCounter)
 LOG_GROUP_STOP(kalman)
 
+LOG_GROUP_START(kalman_rate)
+  LOG_ADD(LOG_UINT16, rate, &predictRate)
+  LOG_ADD(LOG_UINT32, dropped, &predictDroppedCount)
+#ifdef CONFIG_KALMAN_ADAPTIVE_PREDICT_RATE
+  LOG_ADD(LOG_FLOAT, load, &predictLoad)
+#endif
+LOG_GROUP_STOP(kalman_rate)
+
+// Measurements dropped because the ring was full
+LOG_GROUP_START(kalman_drop)
+  LOG_ADD(LOG_UINT32, dist, &distDataRing.droppedCount)
+  LOG_ADD(LOG_UINT32, pos, &posDataRing.droppedCount)
+  LOG_ADD(LOG_UINT32, pose, &poseDataRing.droppedCount)
+  LOG_ADD(LOG_UINT32, tdoa, &tdoaDataRing.droppedCount)
+  LOG_ADD(LOG_UINT32, flow, &flowDataRing.droppedCount)
+  LOG_ADD(LOG_UINT32, tof, &tofDataRing.droppedCount)
+  LOG_ADD(LOG_UINT32, height, &heightDataRing.droppedCount)
+  LOG_ADD(LOG_UINT32, yawErr, &yawErrorDataRing.droppedCount)
+LOG_GROUP_STOP(kalman_drop)
+
+// Timestamped position and pose measurements
+LOG_GROUP_START(kalman_delay)
+  LOG_ADD(LOG_FLOAT, delay, &measurementDelay)
+  LOG_ADD(LOG_UINT32, dropped, &delayedDroppedCount)
+LOG_GROUP_STOP(kalman_delay)
+
 PARAM_GROUP_START(kalman)
   PARAM_ADD(PARAM_UINT8, resetEstimation, &coreData.resetEstimation)
   PARAM_ADD(PARAM_UINT8, quadIsFlying, &quadIsFlying)
+  PARAM_ADD(PARAM_FLOAT, maxMeasDelay, &maxMeasurementDelay)
 PARAM_GROUP_STOP(kalman)
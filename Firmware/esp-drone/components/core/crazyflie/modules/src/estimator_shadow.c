@@ -0,0 +1,277 @@
+/**
+ *
+ * ESP-Drone Firmware
+ *
+ * Copyright 2019-2020  Espressif Systems (Shanghai)
+ * Copyright (C) 2011-2012 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * estimator_shadow.c - Runs a shadow estimator next to the current one
+ *
+ * Every stabilizer loop the sensors read by the current estimator and the
+ * thrust it was given are copied into one of two frames and handed to the
+ * shadow task, which runs the shadow estimator on them. A frame that is ready
+ * while the task is still busy with the other one is dropped. The shadow is
+ * only started, stopped and the current estimator switched while the task
+ * owns no frame, so the two tasks never touch the same estimator.
+ */
+#define DEBUG_MODULE "ESTSHADOW"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "config.h"
+#include "estimator_shadow.h"
+#include "estimator_kalman.h"
+#include "log.h"
+#include "param.h"
+#include "static_mem.h"
+#include "usec_time.h"
+#include "debug_cf.h"
+
+#ifdef CONFIG_ESTIMATOR_SHADOW
+
+// The CPU times are averaged over one second
+#define ESTIMATOR_SHADOW_MEAN_FRAMES  RATE_MAIN_LOOP
+
+typedef struct {
+  sensorData_t sensors;
+  control_t control;
+  uint32_t tick;
+  uint8_t estimator;
+  // Init the estimator before this update
+  bool init;
+} shadowFrame_t;
+
+static bool isInit = false;
+
+// Frame i belongs to the shadow task while frameReady[i] is set, to the
+// stabilizer task otherwise
+static shadowFrame_t frames[2];
+static bool frameReady[2];
+
+// Stabilizer task only
+static uint8_t activeFrame;
+static StateEstimatorType running = anyEstimator;
+static bool initPending;
+static uint32_t currentUsSum;
+static uint16_t currentMeanCount;
+static uint32_t currentKalmanUs;
+
+// Shadow task only
+static state_t shadowState;
+static uint32_t shadowUsSum;
+static uint16_t shadowMeanCount;
+static uint32_t shadowKalmanUs;
+
+static uint8_t shadowParam = anyEstimator;
+static uint8_t runningLog;
+static float currentUs;
+static float shadowUs;
+static uint32_t droppedCount;
+
+STATIC_MEM_TASK_ALLOC(estimatorShadowTask, EST_SHADOW_TASK_STACKSIZE);
+static TaskHandle_t taskHandle;
+static void estimatorShadowTask(void *param);
+
+void estimatorShadowInit(void)
+{
+  if (isInit) {
+    return;
+  }
+
+  taskHandle = STATIC_MEM_TASK_CREATE_PINNED(estimatorShadowTask, estimatorShadowTask, EST_SHADOW_TASK_NAME, NULL, EST_SHADOW_TASK_PRI, EST_SHADOW_TASK_CORE);
+
+  isInit = true;
+}
+
+bool estimatorShadowTest(void)
+{
+  return isInit;
+}
+
+static bool isBusy(void)
+{
+  return __atomic_load_n(&frameReady[0], __ATOMIC_ACQUIRE) || __atomic_load_n(&frameReady[1], __ATOMIC_ACQUIRE);
+}
+
+/* The Kalman filter runs in a task of its own, its time since the last call goes to the Kalman estimator. */
+static uint32_t kalmanTaskUs(StateEstimatorType estimator, uint32_t *since)
+{
+  const uint32_t now = estimatorKalmanTaskBusyUs();
+  const uint32_t elapsed = now - *since;
+
+  *since = now;
+  return (estimator == kalmanEstimator) ? elapsed : 0;
+}
+
+static void stopShadow(void)
+{
+  running = anyEstimator;
+  initPending = false;
+  stateEstimatorSetOther(anyEstimator);
+}
+
+bool estimatorShadowSwitchTo(StateEstimatorType estimator)
+{
+  if (isBusy()) {
+    return false;
+  }
+
+  if (estimator == running) {
+    stopShadow();
+  }
+  stateEstimatorSwitchTo(estimator);
+
+  currentUsSum = 0;
+  currentMeanCount = 0;
+  currentKalmanUs = estimatorKalmanTaskBusyUs();
+
+  return true;
+}
+
+/* Follows the shadow param, the shadow starts over with its init when it changes. */
+static void selectShadow(void)
+{
+  StateEstimatorType wanted = shadowParam;
+
+  if (wanted >= StateEstimatorTypeCount || wanted == getStateEstimator()) {
+    wanted = anyEstimator;
+  }
+
+  if (wanted != running && !isBusy()) {
+    stopShadow();
+    // The task points the measurements to it once it is initialized
+    running = wanted;
+    initPending = (wanted != anyEstimator);
+  }
+
+  runningLog = running;
+}
+
+static void publishFrame(const sensorData_t *sensors, const control_t *control, const uint32_t tick)
+{
+  const uint8_t other = activeFrame ^ 1;
+
+  if (__atomic_load_n(&frameReady[other], __ATOMIC_ACQUIRE)) {
+    // Still running the previous frame
+    droppedCount++;
+    return;
+  }
+
+  shadowFrame_t *frame = &frames[activeFrame];
+  frame->sensors = *sensors;
+  frame->control = *control;
+  frame->tick = tick;
+  frame->estimator = running;
+  frame->init = initPending;
+
+  __atomic_store_n(&frameReady[activeFrame], true, __ATOMIC_RELEASE);
+  xTaskNotifyGive(taskHandle);
+  activeFrame = other;
+
+  initPending = false;
+}
+
+void estimatorShadowUpdate(state_t *state, sensorData_t *sensors, control_t *control, const uint32_t tick)
+{
+  const uint64_t start = usecTimestamp();
+  stateEstimator(state, sensors, control, tick);
+  currentUsSum += (uint32_t)(usecTimestamp() - start);
+
+  if (++currentMeanCount >= ESTIMATOR_SHADOW_MEAN_FRAMES) {
+    currentUsSum += kalmanTaskUs(getStateEstimator(), &currentKalmanUs);
+    currentUs = (float)currentUsSum / currentMeanCount;
+    currentUsSum = 0;
+    currentMeanCount = 0;
+  }
+
+  if (!isInit) {
+    return;
+  }
+
+  selectShadow();
+  if (running != anyEstimator) {
+    publishFrame(sensors, control, tick);
+  }
+}
+
+static void runFrame(shadowFrame_t *frame)
+{
+  if (frame->init) {
+    stateEstimatorInitOther(frame->estimator);
+    stateEstimatorSetOther(frame->estimator);
+    memset(&shadowState, 0, sizeof(shadowState));
+    shadowUsSum = 0;
+    shadowMeanCount = 0;
+    shadowKalmanUs = estimatorKalmanTaskBusyUs();
+  }
+
+  const uint64_t start = usecTimestamp();
+  stateEstimatorOther(frame->estimator, &shadowState, &frame->sensors, &frame->control, frame->tick);
+  shadowUsSum += (uint32_t)(usecTimestamp() - start);
+
+  if (++shadowMeanCount >= ESTIMATOR_SHADOW_MEAN_FRAMES) {
+    shadowUsSum += kalmanTaskUs(frame->estimator, &shadowKalmanUs);
+    shadowUs = (float)shadowUsSum / shadowMeanCount;
+    shadowUsSum = 0;
+    shadowMeanCount = 0;
+  }
+}
+
+static void estimatorShadowTask(void *param)
+{
+  uint8_t nextFrame = 0;
+
+  while (1) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+    while (__atomic_load_n(&frameReady[nextFrame], __ATOMIC_ACQUIRE)) {
+      runFrame(&frames[nextFrame]);
+      __atomic_store_n(&frameReady[nextFrame], false, __ATOMIC_RELEASE);
+      nextFrame ^= 1;
+    }
+  }
+}
+
+PARAM_GROUP_START(estShadow)
+PARAM_ADD(PARAM_UINT8, estimator, &shadowParam)
+PARAM_GROUP_STOP(estShadow)
+
+/**
+ * The shadow estimator that runs, 0 for none, and its state, to compare with
+ * the stateEstimate group. currentUs and shadowUs are the CPU times of the two
+ * estimators per stabilizer loop, for Kalman with the rounds of its task.
+ */
+LOG_GROUP_START(estShadow)
+LOG_ADD(LOG_UINT8, estimator, &runningLog)
+LOG_ADD(LOG_FLOAT, currentUs, &currentUs)
+LOG_ADD(LOG_FLOAT, shadowUs, &shadowUs)
+LOG_ADD(LOG_FLOAT, x, &shadowState.position.x)
+LOG_ADD(LOG_FLOAT, y, &shadowState.position.y)
+LOG_ADD(LOG_FLOAT, z, &shadowState.position.z)
+LOG_ADD(LOG_FLOAT, vx, &shadowState.velocity.x)
+LOG_ADD(LOG_FLOAT, vy, &shadowState.velocity.y)
+LOG_ADD(LOG_FLOAT, vz, &shadowState.velocity.z)
+LOG_ADD(LOG_FLOAT, roll, &shadowState.attitude.roll)
+LOG_ADD(LOG_FLOAT, pitch, &shadowState.attitude.pitch)
+LOG_ADD(LOG_FLOAT, yaw, &shadowState.attitude.yaw)
+LOG_ADD(LOG_UINT32, dropped, &droppedCount)
+LOG_GROUP_STOP(estShadow)
+
+#endif // CONFIG_ESTIMATOR_SHADOW
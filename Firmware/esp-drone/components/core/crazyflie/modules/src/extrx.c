@@ -23,8 +23,16 @@
  *
  *
  * extrx.c - Module to handle external receiver inputs
+ *
+ * The frames of the receiver come whole from rc_receiver_esp32.c, PPM on the
+ * RMT or SBUS on a UART. Each frame is one setpoint, a frame the receiver
+ * flags as failsafe is dropped and the commander watchdog takes over.
  */
 
+#include "sdkconfig.h"
+
+#ifdef CONFIG_EXTRX
+
 /* FreeRtos includes */
 #include "FreeRTOS.h"
 #include "task.h"
@@ -34,17 +42,17 @@
 #include "stm32_legacy.h"
 #include "config.h"
 #include "system.h"
-#include "nvicconf.h"
 #include "commander.h"
-#include "uart1.h"
-#include "cppm.h"
+#include "rc_receiver.h"
+#include "usec_time.h"
+#include "num.h"
+#include "extrx.h"
 
 #define DEBUG_MODULE  "EXTRX"
 #include "debug_cf.h"
 #include "log.h"
 #include "static_mem.h"
 
-//#define ENABLE_CPPM
 #define ENABLE_EXTRX_LOG
 
 
@@ -63,11 +71,22 @@
 #define EXTRX_SCALE_PITCH  (40.0f)
 #define EXTRX_SCALE_YAW    (400.0f)
 
+// Channel pulse widths, in us
+#define EXTRX_CH_MIN       1000
+#define EXTRX_CH_MAX       2000
+
+// Wake up at least this often to count the time without frames
+#define EXTRX_WAIT_MS      100
+
 static setpoint_t extrxSetpoint;
 static uint16_t ch[EXTRX_NR_CHANNELS];
 
+static uint64_t lastFrameUs;
+static uint32_t framePeriodUs;
+static uint32_t latencyUs;
+static uint32_t failsafeCount;
+
 static void extRxTask(void *param);
-static void extRxDecodeCppm(void);
 static void extRxDecodeChannels(void);
 
 STATIC_MEM_TASK_ALLOC(extRxTask, EXTRX_TASK_STACKSIZE);
@@ -79,59 +98,67 @@ void extRxInit(void)
   extrxSetpoint.mode.pitch = modeAbs;
   extrxSetpoint.mode.yaw = modeVelocity;
 
-#ifdef ENABLE_CPPM
-  cppmInit();
-#endif
-
-#ifdef ENABLE_SPEKTRUM
-  uart1Init();
-#endif
+  if (!rcReceiverInit())
+  {
+    DEBUG_PRINT("Receiver init failed\n");
+    return;
+  }
 
   STATIC_MEM_TASK_CREATE(extRxTask, extRxTask, EXTRX_TASK_NAME, NULL, EXTRX_TASK_PRI);
 }
 
 static void extRxTask(void *param)
 {
+  rcReceiverFrame_t frame;
 
   //Wait for the system to be fully started
   systemWaitStart();
 
   while (true)
   {
-    extRxDecodeCppm();
+    if (!rcReceiverWaitFrame(&frame, EXTRX_WAIT_MS))
+    {
+      continue;
+    }
+
+    if (frame.failsafe || frame.count <= EXTRX_CH_YAW)
+    {
+      failsafeCount++;
+      continue;
+    }
+
+    for (int i = 0; i < EXTRX_NR_CHANNELS; i++)
+    {
+      ch[i] = (i < frame.count) ? frame.channels[i] : 0;
+    }
+    framePeriodUs = frame.timestampUs - lastFrameUs;
+    lastFrameUs = frame.timestampUs;
+
+    extRxDecodeChannels();
+    latencyUs = usecTimestamp() - frame.timestampUs;
   }
 }
 
-static void extRxDecodeChannels(void)
+static float extRxConvert2Float(uint16_t value, float min, float max)
 {
-  extrxSetpoint.thrust = cppmConvert2uint16(ch[EXTRX_CH_TRUST]);
-  extrxSetpoint.attitude.roll = EXTRX_SIGN_ROLL * cppmConvert2Float(ch[EXTRX_CH_ROLL], -EXTRX_SCALE_ROLL, EXTRX_SCALE_ROLL);
-  extrxSetpoint.attitude.pitch = EXTRX_SIGN_PITCH * cppmConvert2Float(ch[EXTRX_CH_PITCH], -EXTRX_SCALE_PITCH, EXTRX_SCALE_PITCH);
-  extrxSetpoint.attitude.yaw = EXTRX_SIGN_YAW * cppmConvert2Float(ch[EXTRX_CH_YAW], -EXTRX_SCALE_YAW, EXTRX_SCALE_YAW);
-  commanderSetSetpoint(&extrxSetpoint, COMMANDER_PRIORITY_EXTRX);
+  const float ratio = (float)((int)value - EXTRX_CH_MIN) / (EXTRX_CH_MAX - EXTRX_CH_MIN);
+
+  return constrain(min + ratio * (max - min), min, max);
 }
 
-static void extRxDecodeCppm(void)
+static uint16_t extRxConvert2uint16(uint16_t value)
 {
-  uint16_t ppm;
-  static uint8_t currChannel = 0;
+  return (uint16_t)extRxConvert2Float(value, 0, UINT16_MAX);
+}
 
-  if (cppmGetTimestamp(&ppm) == pdTRUE)
-  {
-    if (cppmIsAvailible() && ppm < 2100)
-    {
-      if (currChannel < EXTRX_NR_CHANNELS)
-      {
-        ch[currChannel] = ppm;
-      }
-      currChannel++;
-    }
-    else
-    {
-      extRxDecodeChannels();
-      currChannel = 0;
-    }
-  }
+static void extRxDecodeChannels(void)
+{
+  extrxSetpoint.thrust = extRxConvert2uint16(ch[EXTRX_CH_TRUST]);
+  extrxSetpoint.attitude.roll = EXTRX_SIGN_ROLL * extRxConvert2Float(ch[EXTRX_CH_ROLL], -EXTRX_SCALE_ROLL, EXTRX_SCALE_ROLL);
+  extrxSetpoint.attitude.pitch = EXTRX_SIGN_PITCH * extRxConvert2Float(ch[EXTRX_CH_PITCH], -EXTRX_SCALE_PITCH, EXTRX_SCALE_PITCH);
+  // The yaw is a rate in modeVelocity
+  extrxSetpoint.attitudeRate.yaw = EXTRX_SIGN_YAW * extRxConvert2Float(ch[EXTRX_CH_YAW], -EXTRX_SCALE_YAW, EXTRX_SCALE_YAW);
+  commanderSetSetpoint(&extrxSetpoint, COMMANDER_PRIORITY_EXTRX);
 }
 
 #if 0
@@ -186,6 +213,11 @@ LOG_ADD(LOG_UINT16, ch3, &ch[3])
 LOG_ADD(LOG_UINT16, thrust, &extrxSetpoint.thrust)
 LOG_ADD(LOG_FLOAT, roll, &extrxSetpoint.attitude.roll)
 LOG_ADD(LOG_FLOAT, pitch, &extrxSetpoint.attitude.pitch)
-LOG_ADD(LOG_FLOAT, yaw, &extrxSetpoint.attitude.yaw)
+LOG_ADD(LOG_FLOAT, yaw, &extrxSetpoint.attitudeRate.yaw)
+LOG_ADD(LOG_UINT32, periodUs, &framePeriodUs)
+LOG_ADD(LOG_UINT32, latencyUs, &latencyUs)
+LOG_ADD(LOG_UINT32, failsafe, &failsafeCount)
 LOG_GROUP_STOP(extrx)
 #endif
+
+#endif // CONFIG_EXTRX
@@ -0,0 +1,314 @@
+/**
+ *
+ * ESP-Drone Firmware
+ *
+ * Copyright 2019-2020  Espressif Systems (Shanghai)
+ * Copyright (C) 2011-2012 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * firmware_update.c - Firmware updates written to the next OTA partition
+ *
+ * The stream is parsed and written by the memory task as the writes come,
+ * the flash erases slow the writes down and with them the acks of the
+ * windowed transfers, that is all the flow control there is.
+ */
+#define DEBUG_MODULE "FWUP"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "sdkconfig.h"
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
+
+#include "firmware_update.h"
+#include "log.h"
+#include "mem.h"
+#include "stabilizer.h"
+#include "debug_cf.h"
+
+#ifdef CONFIG_FIRMWARE_UPDATE
+
+#define FW_UPDATE_COPY_CHUNK 256
+
+enum {
+  fwUpdateIdle = 0,
+  fwUpdateReceiving,
+  fwUpdateReady,     // Booted from at the next reset
+  fwUpdateFailed,
+};
+
+static bool isInit = false;
+static const esp_partition_t *runningPartition;
+static const esp_partition_t *updatePartition;
+static esp_ota_handle_t otaHandle;
+static bool isOtaBegun;
+
+static uint8_t state = fwUpdateIdle;
+static uint32_t receivedSize;  // Of the stream
+static uint32_t writtenSize;   // Of the image
+
+static firmwareUpdateHeader_t header;
+static uint8_t headerFill;
+// The delta operation being received, and the data it has left
+static uint8_t op[9];
+static uint8_t opFill;
+static uint8_t opSize;
+static uint32_t dataLeft;
+
+static uint8_t copyBuffer[FW_UPDATE_COPY_CHUNK];
+
+static uint32_t handleMemGetSize(void) { return 2 * updatePartition->size; }
+static bool handleMemWrite(const uint32_t memAddr, const uint8_t writeLen, const uint8_t* buffer);
+static const MemoryHandlerDef_t memDef = {
+  .type = MEM_TYPE_FIRMWARE,
+  .getSize = handleMemGetSize,
+  .read = 0, // Read is not supported
+  .write = handleMemWrite,
+};
+
+void firmwareUpdateInit(void)
+{
+  if (isInit) {
+    return;
+  }
+
+  runningPartition = esp_ota_get_running_partition();
+  updatePartition = esp_ota_get_next_update_partition(NULL);
+  if (updatePartition == NULL) {
+    DEBUG_PRINTW("No OTA partition to update to, firmware updates are disabled\n");
+    return;
+  }
+
+  memoryRegisterHandler(&memDef);
+
+  isInit = true;
+}
+
+bool firmwareUpdateTest(void)
+{
+  return isInit;
+}
+
+void firmwareUpdateBootCheck(bool selfTestPassed)
+{
+  esp_ota_img_states_t imageState;
+  const esp_partition_t *running = esp_ota_get_running_partition();
+
+  if (esp_ota_get_state_partition(running, &imageState) != ESP_OK || imageState != ESP_OTA_IMG_PENDING_VERIFY) {
+    return;
+  }
+
+  if (selfTestPassed) {
+    DEBUG_PRINT("Updated firmware passed the self test, keeping it\n");
+    esp_ota_mark_app_valid_cancel_rollback();
+  } else {
+    DEBUG_PRINT("Updated firmware failed the self test, going back\n");
+    esp_ota_mark_app_invalid_rollback_and_reboot();
+  }
+}
+
+static void updateAbort(uint8_t newState)
+{
+  if (isOtaBegun) {
+    esp_ota_abort(otaHandle);
+    isOtaBegun = false;
+  }
+  state = newState;
+}
+
+static bool writeImage(const uint8_t *data, size_t length)
+{
+  if (writtenSize + length > header.imageSize) {
+    return false;
+  }
+
+  if (esp_ota_write(otaHandle, data, length) != ESP_OK) {
+    return false;
+  }
+  writtenSize += length;
+  return true;
+}
+
+static bool copyRunning(uint32_t offset, uint32_t length)
+{
+  if (offset > runningPartition->size || length > runningPartition->size - offset) {
+    return false;
+  }
+
+  while (length > 0) {
+    const uint32_t chunk = length < sizeof(copyBuffer) ? length : sizeof(copyBuffer);
+    if (esp_partition_read(runningPartition, offset, copyBuffer, chunk) != ESP_OK || !writeImage(copyBuffer, chunk)) {
+      return false;
+    }
+    offset += chunk;
+    length -= chunk;
+  }
+
+  return true;
+}
+
+/* Runs the operation in op once it is complete */
+static bool runOperation(void)
+{
+  uint32_t offset;
+  uint32_t length;
+  uint16_t dataLength;
+
+  switch (op[0]) {
+    case FW_UPDATE_OP_COPY:
+      memcpy(&offset, &op[1], sizeof(offset));
+      memcpy(&length, &op[5], sizeof(length));
+      return copyRunning(offset, length);
+    case FW_UPDATE_OP_DATA:
+      memcpy(&dataLength, &op[1], sizeof(dataLength));
+      dataLeft = dataLength;
+      return true;
+    default:
+      return false;
+  }
+}
+
+static bool feedDelta(const uint8_t *data, size_t length)
+{
+  while (length > 0) {
+    size_t taken;
+
+    if (dataLeft > 0) {
+      taken = length < dataLeft ? length : dataLeft;
+      if (!writeImage(data, taken)) {
+        return false;
+      }
+      dataLeft -= taken;
+    } else if (opFill == 0) {
+      op[0] = data[0];
+      opSize = (op[0] == FW_UPDATE_OP_COPY) ? 9 : ((op[0] == FW_UPDATE_OP_DATA) ? 3 : 0);
+      if (opSize == 0) {
+        return false;
+      }
+      opFill = 1;
+      taken = 1;
+    } else {
+      taken = (length < (size_t)(opSize - opFill)) ? length : (size_t)(opSize - opFill);
+      memcpy(&op[opFill], data, taken);
+      opFill += taken;
+      if (opFill == opSize) {
+        opFill = 0;
+        if (!runOperation()) {
+          return false;
+        }
+      }
+    }
+
+    data += taken;
+    length -= taken;
+  }
+
+  return true;
+}
+
+static bool feedStream(const uint8_t *data, size_t length)
+{
+  if (headerFill < sizeof(header)) {
+    const size_t taken = (length < sizeof(header) - headerFill) ? length : sizeof(header) - headerFill;
+    memcpy((uint8_t *)&header + headerFill, data, taken);
+    headerFill += taken;
+    data += taken;
+    length -= taken;
+
+    if (headerFill < sizeof(header)) {
+      return true;
+    }
+    if (header.magic != FW_UPDATE_MAGIC || header.version != FW_UPDATE_VERSION ||
+        header.kind > FW_UPDATE_KIND_DELTA || header.imageSize == 0 || header.imageSize > updatePartition->size) {
+      return false;
+    }
+    // Erases the sectors as the writes reach them
+    if (esp_ota_begin(updatePartition, OTA_WITH_SEQUENTIAL_WRITES, &otaHandle) != ESP_OK) {
+      return false;
+    }
+    isOtaBegun = true;
+  }
+
+  if (length > 0) {
+    const bool isFed = (header.kind == FW_UPDATE_KIND_IMAGE) ? writeImage(data, length) : feedDelta(data, length);
+    if (!isFed) {
+      return false;
+    }
+  }
+
+  if (writtenSize == header.imageSize) {
+    // Checks the image before it can be booted
+    isOtaBegun = false;
+    if (esp_ota_end(otaHandle) != ESP_OK || esp_ota_set_boot_partition(updatePartition) != ESP_OK) {
+      return false;
+    }
+    DEBUG_PRINT("Firmware update of %lu bytes done, it runs after the next reset\n", (unsigned long)writtenSize);
+    state = fwUpdateReady;
+  }
+
+  return true;
+}
+
+static bool handleMemWrite(const uint32_t memAddr, const uint8_t writeLen, const uint8_t* buffer)
+{
+  if (stabilizerIsFlying()) {
+    if (state == fwUpdateReceiving) {
+      updateAbort(fwUpdateFailed);
+    }
+    return false;
+  }
+
+  if (memAddr == 0) {
+    updateAbort(fwUpdateReceiving);
+    receivedSize = 0;
+    writtenSize = 0;
+    headerFill = 0;
+    opFill = 0;
+    dataLeft = 0;
+  } else if (state != fwUpdateReceiving && state != fwUpdateReady) {
+    return false;
+  }
+
+  // Sent again, the reply was lost
+  if (memAddr + writeLen <= receivedSize) {
+    return true;
+  }
+  if (memAddr != receivedSize || state != fwUpdateReceiving) {
+    return false;
+  }
+
+  if (!feedStream(buffer, writeLen)) {
+    updateAbort(fwUpdateFailed);
+    return false;
+  }
+
+  receivedSize += writeLen;
+  return true;
+}
+
+/**
+ * state is 0 idle, 1 receiving, 2 ready to run after a reset and 3 failed.
+ * received counts the bytes of the stream, written those of the image.
+ */
+LOG_GROUP_START(fwUpdate)
+LOG_ADD(LOG_UINT8, state, &state)
+LOG_ADD(LOG_UINT32, received, &receivedSize)
+LOG_ADD(LOG_UINT32, written, &writtenSize)
+LOG_GROUP_STOP(fwUpdate)
+
+#endif // CONFIG_FIRMWARE_UPDATE
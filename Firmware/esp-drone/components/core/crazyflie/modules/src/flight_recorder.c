@@ -0,0 +1,450 @@
+/**
+ *
+ * ESP-Drone Firmware
+ *
+ * Copyright 2019-2020  Espressif Systems (Shanghai)
+ * Copyright (C) 2011-2012 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * flight_recorder.c - Records log variables at the stabilizer rate to flash
+ *
+ * The stabilizer fills one of two RAM pages with records and hands it to the
+ * recorder task when it is full, the task writes it to the flightrec
+ * partition on the network core. While the flash is written the caches are
+ * off on both cores, so pages are written in flash page sized chunks, one per
+ * FreeRTOS tick, which keeps every stall well below one stabilizer loop. The
+ * whole partition is erased when a recording starts, that takes seconds and
+ * is only allowed while the drone is not flying, see stabilizerIsFlying().
+ *
+ * Set the frec.record param to 1 to start a recording and back to 0 to stop
+ * it, it also stops when the partition is full.
+ */
+#define DEBUG_MODULE "FREC"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "esp_partition.h"
+
+#include "config.h"
+#include "flight_recorder.h"
+#include "log.h"
+#include "param.h"
+#include "mem.h"
+#include "stabilizer.h"
+#include "stabilizer_types.h"
+#include "stm32_legacy.h"
+#include "static_mem.h"
+#include "debug_cf.h"
+
+#ifdef CONFIG_FLIGHT_RECORDER
+
+#define FREC_PARTITION_TYPE     0x40
+#define FREC_PARTITION_SUBTYPE  0x00
+#define FREC_PARTITION_LABEL    "flightrec"
+
+#define FREC_MAX_VARIABLES      24
+#define FREC_NAMES_MAX_LEN      (FLIGHT_REC_DATA_OFFSET - FLIGHT_REC_NAMES_OFFSET)
+#define FREC_PAGE_SIZE          2048
+#define FREC_FLASH_PAGE_SIZE    256
+#define FREC_POLL_MS            20
+// The stabilizer hands over the last page within one loop, unless it is stopped
+#define FREC_STOP_TIMEOUT_MS    100
+
+_Static_assert(FREC_PAGE_SIZE >= 4 + 4 * FREC_MAX_VARIABLES, "A record must fit in a page");
+
+enum {
+  frecIdle = 0,
+  frecErasing,
+  frecRecording,
+  frecStopping,
+  frecError,
+};
+
+static const esp_partition_t *partition;
+static bool isInit = false;
+
+// Set up by flightRecorderStart(), constant while recording
+static uint8_t variablesCount;
+// NULL for a variable added by function, which is read through its id
+static void *addresses[FREC_MAX_VARIABLES];
+static logVarId_t varIds[FREC_MAX_VARIABLES];
+static uint8_t types[FREC_MAX_VARIABLES];
+static char names[FREC_NAMES_MAX_LEN];
+static uint16_t namesLength;
+static uint16_t recordSize;
+static uint32_t divisor;
+
+// Page i belongs to the recorder task while pageReady[i] is set, to the
+// stabilizer otherwise
+BULK_EXT_RAM_ZERO_INIT static uint8_t pages[2][FREC_PAGE_SIZE];
+static uint16_t pageLength[2];
+static bool pageReady[2];
+static uint8_t activePage;      // Stabilizer only
+static uint16_t activeFill;     // Stabilizer only
+static uint8_t nextWritePage;   // Recorder task only
+static bool isFlushed;
+
+static uint8_t state = frecIdle;
+static uint32_t writeOffset;
+static uint32_t recordsCount;
+static uint32_t droppedCount;
+// Size of the last complete recording, as served by the memory
+static uint32_t recordedSize;
+
+static uint8_t recordParam = 0;
+
+static TaskHandle_t taskHandle;
+STATIC_MEM_TASK_ALLOC(flightRecorderTask, FLIGHTREC_TASK_STACKSIZE);
+static void flightRecorderTask(void *param);
+
+static uint32_t handleMemGetSize(void) { return recordedSize; }
+static bool handleMemRead(const uint32_t memAddr, const uint8_t readLen, uint8_t* buffer);
+static const MemoryHandlerDef_t memDef = {
+  .type = MEM_TYPE_FLIGHT_REC,
+  .getSize = handleMemGetSize,
+  .read = handleMemRead,
+  .write = 0, // Write is not supported
+};
+
+void flightRecorderInit(void)
+{
+  flightRecorderHeader_t header;
+
+  if (isInit) {
+    return;
+  }
+
+  partition = esp_partition_find_first(FREC_PARTITION_TYPE, FREC_PARTITION_SUBTYPE, FREC_PARTITION_LABEL);
+  if (partition == NULL) {
+    DEBUG_PRINTW("No %s partition, the flight recorder is disabled\n", FREC_PARTITION_LABEL);
+    return;
+  }
+
+  // Serve the recording of the previous flight
+  if (esp_partition_read(partition, 0, &header, sizeof(header)) == ESP_OK
+      && header.magic == FLIGHT_REC_MAGIC && header.version == FLIGHT_REC_VERSION) {
+    if (header.recordsCount != 0xffffffff) {
+      recordedSize = FLIGHT_REC_DATA_OFFSET + header.recordsCount * header.recordSize;
+    } else {
+      // Not stopped, the records end where the flash is still erased
+      recordedSize = partition->size;
+    }
+  }
+
+  memoryRegisterHandler(&memDef);
+
+  taskHandle = STATIC_MEM_TASK_CREATE_PINNED(flightRecorderTask, flightRecorderTask, FLIGHTREC_TASK_NAME, NULL, FLIGHTREC_TASK_PRI, FLIGHTREC_TASK_CORE);
+
+  isInit = true;
+}
+
+bool flightRecorderTest(void)
+{
+  return isInit;
+}
+
+/* Hands the active page to the recorder task, false if the other page is
+ * still being written. */
+static bool publishPage(void)
+{
+  const uint8_t other = activePage ^ 1;
+
+  if (__atomic_load_n(&pageReady[other], __ATOMIC_ACQUIRE)) {
+    return false;
+  }
+
+  pageLength[activePage] = activeFill;
+  __atomic_store_n(&pageReady[activePage], true, __ATOMIC_RELEASE);
+  xTaskNotifyGive(taskHandle);
+
+  activePage = other;
+  activeFill = 0;
+
+  return true;
+}
+
+void flightRecorderTick(uint32_t tick)
+{
+  const uint8_t current = __atomic_load_n(&state, __ATOMIC_ACQUIRE);
+
+  if (current == frecStopping) {
+    if (!__atomic_load_n(&isFlushed, __ATOMIC_ACQUIRE) && (activeFill == 0 || publishPage())) {
+      __atomic_store_n(&isFlushed, true, __ATOMIC_RELEASE);
+      xTaskNotifyGive(taskHandle);
+    }
+    return;
+  }
+
+  if (current != frecRecording || (tick % divisor) != 0) {
+    return;
+  }
+
+  if (activeFill + recordSize > FREC_PAGE_SIZE && !publishPage()) {
+    droppedCount++;
+    return;
+  }
+
+  uint8_t *record = &pages[activePage][activeFill];
+
+  memcpy(record, &tick, sizeof(tick));
+  for (int i = 0; i < variablesCount; i++) {
+    float value;
+
+    if (addresses[i] == NULL) {
+      value = logGetFloat(varIds[i]);
+    } else {
+      switch (types[i]) {
+        case LOG_UINT8:  value = *(uint8_t *)addresses[i]; break;
+        case LOG_INT8:   value = *(int8_t *)addresses[i]; break;
+        case LOG_UINT16: value = *(uint16_t *)addresses[i]; break;
+        case LOG_INT16:  value = *(int16_t *)addresses[i]; break;
+        case LOG_UINT32: value = *(uint32_t *)addresses[i]; break;
+        case LOG_INT32:  value = *(int32_t *)addresses[i]; break;
+        default:         value = *(float *)addresses[i]; break;
+      }
+    }
+    memcpy(&record[4 + 4 * i], &value, sizeof(value));
+  }
+
+  activeFill += recordSize;
+}
+
+/* Resolves the variables of CONFIG_FLIGHT_RECORDER_VARIABLES, unknown ones
+ * are skipped. */
+static void resolveVariables(void)
+{
+  char list[] = CONFIG_FLIGHT_RECORDER_VARIABLES;
+  char *saveList;
+
+  variablesCount = 0;
+  namesLength = 0;
+
+  for (char *entry = strtok_r(list, ",", &saveList); entry; entry = strtok_r(NULL, ",", &saveList)) {
+    char *dot = strchr(entry, '.');
+    logVarId_t varId;
+
+    if (variablesCount >= FREC_MAX_VARIABLES) {
+      DEBUG_PRINTW("More than %d variables, the rest is not recorded\n", FREC_MAX_VARIABLES);
+      break;
+    }
+
+    if (dot == NULL) {
+      DEBUG_PRINTW("%s is not group.name\n", entry);
+      continue;
+    }
+
+    *dot = '\0';
+    varId = logGetVarId(entry, dot + 1);
+    *dot = '.';
+
+    if (!LOG_VARID_IS_VALID(varId)) {
+      DEBUG_PRINTW("%s can not be recorded\n", entry);
+      continue;
+    }
+
+    const size_t length = strlen(entry);
+    if (namesLength + length + 1 >= FREC_NAMES_MAX_LEN) {
+      DEBUG_PRINTW("Variable names too long, the rest is not recorded\n");
+      break;
+    }
+
+    if (namesLength > 0) {
+      names[namesLength++] = ',';
+    }
+    memcpy(&names[namesLength], entry, length);
+    namesLength += length;
+
+    types[variablesCount] = logGetType(varId);
+    addresses[variablesCount] = (types[variablesCount] & LOG_BY_FUNCTION) ? NULL : logGetAddress(varId);
+    varIds[variablesCount] = varId;
+    variablesCount++;
+  }
+
+  names[namesLength] = '\0';
+  recordSize = 4 + 4 * variablesCount;
+}
+
+static void flightRecorderStart(void)
+{
+  flightRecorderHeader_t header;
+
+  if (stabilizerIsFlying()) {
+    DEBUG_PRINTW("Can not start a recording in flight\n");
+    recordParam = 0;
+    return;
+  }
+
+  resolveVariables();
+  if (variablesCount == 0) {
+    DEBUG_PRINTW("Nothing to record\n");
+    recordParam = 0;
+    return;
+  }
+
+  __atomic_store_n(&state, frecErasing, __ATOMIC_RELEASE);
+  recordedSize = 0;
+
+  if (esp_partition_erase_range(partition, 0, partition->size) != ESP_OK) {
+    DEBUG_PRINTE("Erase failed\n");
+    __atomic_store_n(&state, frecError, __ATOMIC_RELEASE);
+    recordParam = 0;
+    return;
+  }
+
+  // recordsCount and droppedCount are written when the recording stops
+  header.magic = FLIGHT_REC_MAGIC;
+  header.version = FLIGHT_REC_VERSION;
+  header.variablesCount = variablesCount;
+  header.recordSize = recordSize;
+  header.rateHz = RATE_MAIN_LOOP / divisor;
+  header.namesLength = namesLength;
+  header.startTick = xTaskGetTickCount();
+
+  if (esp_partition_write(partition, 0, &header, offsetof(flightRecorderHeader_t, recordsCount)) != ESP_OK
+      || esp_partition_write(partition, FLIGHT_REC_NAMES_OFFSET, names, namesLength + 1) != ESP_OK) {
+    DEBUG_PRINTE("Header write failed\n");
+    __atomic_store_n(&state, frecError, __ATOMIC_RELEASE);
+    recordParam = 0;
+    return;
+  }
+
+  pageReady[0] = false;
+  pageReady[1] = false;
+  activePage = 0;
+  activeFill = 0;
+  nextWritePage = 0;
+  isFlushed = false;
+  writeOffset = FLIGHT_REC_DATA_OFFSET;
+  recordsCount = 0;
+  droppedCount = 0;
+
+  DEBUG_PRINTI("Recording %d variables at %dHz\n", variablesCount, header.rateHz);
+  __atomic_store_n(&state, frecRecording, __ATOMIC_RELEASE);
+}
+
+/* Writes the pages handed over by the stabilizer, false when the partition
+ * is full. */
+static bool writePages(void)
+{
+  while (__atomic_load_n(&pageReady[nextWritePage], __ATOMIC_ACQUIRE)) {
+    const uint8_t *page = pages[nextWritePage];
+    uint32_t length = pageLength[nextWritePage];
+
+    if (writeOffset + length > partition->size) {
+      return false;
+    }
+
+    // One flash page per chunk, so each cache stall is short
+    for (uint32_t done = 0; done < length; ) {
+      uint32_t chunk = FREC_FLASH_PAGE_SIZE - (writeOffset % FREC_FLASH_PAGE_SIZE);
+
+      if (chunk > length - done) {
+        chunk = length - done;
+      }
+
+      if (esp_partition_write(partition, writeOffset, &page[done], chunk) != ESP_OK) {
+        DEBUG_PRINTE("Write failed at 0x%x\n", (unsigned int)writeOffset);
+        return false;
+      }
+
+      writeOffset += chunk;
+      done += chunk;
+      vTaskDelay(1);
+    }
+
+    recordsCount += length / recordSize;
+    __atomic_store_n(&pageReady[nextWritePage], false, __ATOMIC_RELEASE);
+    nextWritePage ^= 1;
+  }
+
+  return true;
+}
+
+static void flightRecorderFinish(void)
+{
+  const uint32_t counts[2] = {recordsCount, droppedCount};
+
+  esp_partition_write(partition, offsetof(flightRecorderHeader_t, recordsCount), counts, sizeof(counts));
+
+  recordedSize = writeOffset;
+  recordParam = 0;
+
+  DEBUG_PRINTI("Recorded %u records, %u dropped\n", (unsigned int)recordsCount, (unsigned int)droppedCount);
+  __atomic_store_n(&state, frecIdle, __ATOMIC_RELEASE);
+}
+
+static void flightRecorderTask(void *param)
+{
+  TickType_t stopStart = 0;
+
+  divisor = RATE_MAIN_LOOP / CONFIG_FLIGHT_RECORDER_RATE_HZ;
+
+  while (1) {
+    ulTaskNotifyTake(pdTRUE, M2T(FREC_POLL_MS));
+
+    switch (__atomic_load_n(&state, __ATOMIC_ACQUIRE)) {
+      case frecIdle:
+      case frecError:
+        if (recordParam) {
+          flightRecorderStart();
+        }
+        break;
+      case frecRecording:
+        if (!writePages() || !recordParam) {
+          stopStart = xTaskGetTickCount();
+          __atomic_store_n(&state, frecStopping, __ATOMIC_RELEASE);
+        }
+        break;
+      case frecStopping:
+        // The last pages may not fit, they are dropped
+        writePages();
+        if (__atomic_load_n(&isFlushed, __ATOMIC_ACQUIRE) || xTaskGetTickCount() - stopStart > M2T(FREC_STOP_TIMEOUT_MS)) {
+          writePages();
+          flightRecorderFinish();
+        }
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+static bool handleMemRead(const uint32_t memAddr, const uint8_t readLen, uint8_t* buffer)
+{
+  // The flash is only read back between recordings
+  if (__atomic_load_n(&state, __ATOMIC_ACQUIRE) != frecIdle || memAddr + readLen > recordedSize) {
+    return false;
+  }
+
+  return esp_partition_read(partition, memAddr, buffer, readLen) == ESP_OK;
+}
+
+PARAM_GROUP_START(frec)
+PARAM_ADD(PARAM_UINT8, record, &recordParam)
+PARAM_GROUP_STOP(frec)
+
+LOG_GROUP_START(frec)
+LOG_ADD(LOG_UINT8, state, &state)
+LOG_ADD(LOG_UINT32, records, &recordsCount)
+LOG_ADD(LOG_UINT32, dropped, &droppedCount)
+LOG_GROUP_STOP(frec)
+
+#endif // CONFIG_FLIGHT_RECORDER
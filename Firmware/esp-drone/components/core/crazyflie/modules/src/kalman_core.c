@@ -67,6 +67,10 @@
 #include "math3d.h"
 #include "xtensa_math.h"
 #include "static_mem.h"
+#include <string.h>
+#ifdef CONFIG_KALMAN_SCALAR_UPDATE_BENCH
+#include "usec_time.h"
+#endif
 
 //#include "lighthouse_calibration.h"
 
@@ -79,6 +83,12 @@
 #define ROLLPITCH_ZERO_REVERSION (0.001f)
 #endif
 
+// Keeps the rotation axis defined when the gyro reads exactly zero
+#define EPS (1e-6f)
+
+// The covariance updates use the fixed size kernels of cf_math.h
+_Static_assert(KC_STATE_DIM == 9, "use the mat_*_NxN kernels of the new state size");
+
 
 /**
  * Supporting and utility functions
@@ -103,13 +113,10 @@ static void assertStateNotNaN(const kalmanCoreData_t* this) {
     ASSERT(false);
   }
 
-  for(int i=0; i<KC_STATE_DIM; i++) {
-    for(int j=0; j<KC_STATE_DIM; j++)
+  for(int i=0; i<KC_P_SIZE; i++) {
+    if (isnan(this->P[i]))
     {
-      if (isnan(this->P[i][j]))
-      {
-        ASSERT(false);
-      }
+      ASSERT(false);
     }
   }
 }
@@ -122,8 +129,24 @@ static void assertStateNotNaN(const kalmanCoreData_t* this)
 
 
 // The bounds on the covariance, these shouldn't be hit, but sometimes are... why?
-#define MAX_COVARIANCE (100)
-#define MIN_COVARIANCE (1e-6f)
+#define MAX_COVARIANCE KC_MAX_COVARIANCE
+#define MIN_COVARIANCE KC_MIN_COVARIANCE
+
+#ifdef CONFIG_KALMAN_HEALTH_MONITOR
+static inline void healthInnovation(kalmanCoreData_t* this, kalmanCoreMeasurement_t measurement, float error, float HPHR)
+{
+  this->health.updates[measurement]++;
+  this->health.nisSum[measurement] += error * error / HPHR;
+}
+
+static inline void healthRejected(kalmanCoreData_t* this, kalmanCoreMeasurement_t measurement)
+{
+  this->health.rejected[measurement]++;
+}
+#else
+#define healthInnovation(this, measurement, error, HPHR)
+#define healthRejected(this, measurement)
+#endif
 
 // Initial variances, uncertain of position, but know we're stationary and roughly flat
 static const float stdDevInitialPosition_xy = 100;
@@ -158,6 +181,7 @@ static float initialQuaternion[4] = {0.0, 0.0, 0.0, 0.0};
 static uint32_t tdoaCount;
 
 static OutlierFilterLhState_t sweepOutlierFilterState;
+static OutlierFilterTdoaState_t tdoaOutlierFilterState;
 
 
 void kalmanCoreInit(kalmanCoreData_t* this) {
@@ -187,70 +211,307 @@ void kalmanCoreInit(kalmanCoreData_t* this) {
   // the first prediction step, since in the finalization, after shifting
   // attitude errors into the attitude state, the rotation matrix is updated.
   for(int i=0; i<3; i++) { for(int j=0; j<3; j++) { this->R[i][j] = i==j ? 1 : 0; }}
+  this->invR22 = 1;
 
-  for (int i=0; i< KC_STATE_DIM; i++) {
-    for (int j=0; j < KC_STATE_DIM; j++) {
-      this->P[i][j] = 0; // set covariances to zero (diagonals will be changed from zero in the next section)
-    }
+  for (int i=0; i< KC_P_SIZE; i++) {
+    this->P[i] = 0; // set covariances to zero (diagonals will be changed from zero in the next section)
   }
 
   // initialize state variances
-  this->P[KC_STATE_X][KC_STATE_X]  = powf(stdDevInitialPosition_xy, 2);
-  this->P[KC_STATE_Y][KC_STATE_Y]  = powf(stdDevInitialPosition_xy, 2);
-  this->P[KC_STATE_Z][KC_STATE_Z]  = powf(stdDevInitialPosition_z, 2);
-
-  this->P[KC_STATE_PX][KC_STATE_PX] = powf(stdDevInitialVelocity, 2);
-  this->P[KC_STATE_PY][KC_STATE_PY] = powf(stdDevInitialVelocity, 2);
-  this->P[KC_STATE_PZ][KC_STATE_PZ] = powf(stdDevInitialVelocity, 2);
+  this->P[KC_P_INDEX(KC_STATE_X, KC_STATE_X)]  = powf(stdDevInitialPosition_xy, 2);
+  this->P[KC_P_INDEX(KC_STATE_Y, KC_STATE_Y)]  = powf(stdDevInitialPosition_xy, 2);
+  this->P[KC_P_INDEX(KC_STATE_Z, KC_STATE_Z)]  = powf(stdDevInitialPosition_z, 2);
 
-  this->P[KC_STATE_D0][KC_STATE_D0] = powf(stdDevInitialAttitude_rollpitch, 2);
-  this->P[KC_STATE_D1][KC_STATE_D1] = powf(stdDevInitialAttitude_rollpitch, 2);
-  this->P[KC_STATE_D2][KC_STATE_D2] = powf(stdDevInitialAttitude_yaw, 2);
+  this->P[KC_P_INDEX(KC_STATE_PX, KC_STATE_PX)] = powf(stdDevInitialVelocity, 2);
+  this->P[KC_P_INDEX(KC_STATE_PY, KC_STATE_PY)] = powf(stdDevInitialVelocity, 2);
+  this->P[KC_P_INDEX(KC_STATE_PZ, KC_STATE_PZ)] = powf(stdDevInitialVelocity, 2);
 
-  this->Pm.numRows = KC_STATE_DIM;
-  this->Pm.numCols = KC_STATE_DIM;
-  this->Pm.pData = (float*)this->P;
+  this->P[KC_P_INDEX(KC_STATE_D0, KC_STATE_D0)] = powf(stdDevInitialAttitude_rollpitch, 2);
+  this->P[KC_P_INDEX(KC_STATE_D1, KC_STATE_D1)] = powf(stdDevInitialAttitude_rollpitch, 2);
+  this->P[KC_P_INDEX(KC_STATE_D2, KC_STATE_D2)] = powf(stdDevInitialAttitude_yaw, 2);
 
   this->baroReferenceHeight = 0.0;
 
   outlierFilterReset(&sweepOutlierFilterState, 0);
+  outlierFilterTdoaReset(&tdoaOutlierFilterState);
 }
 
-static void scalarUpdate(kalmanCoreData_t* this, xtensa_matrix_instance_f32 *Hm, float error, float stdMeasNoise)
+#if defined(CONFIG_KALMAN_SCALAR_UPDATE_BENCH) || defined(CONFIG_KALMAN_GENERIC_MATRIX)
+// The covariance as a full row-major matrix, for the dense matrix functions
+static void unpackCovariance(const kalmanCoreData_t* this, float *Pd)
 {
-  // The Kalman gain as a column vector
-  NO_DMA_CCM_SAFE_ZERO_INIT static float K[KC_STATE_DIM];
-  static xtensa_matrix_instance_f32 Km = {KC_STATE_DIM, 1, (float *)K};
+  for (int i=0; i<KC_STATE_DIM; i++) {
+    for (int j=0; j<KC_STATE_DIM; j++) {
+      Pd[KC_STATE_DIM*i+j] = this->P[kalmanCorePIndex(i, j)];
+    }
+  }
+}
+#endif
 
-  // Temporary matrices for the covariance updates
+#ifdef CONFIG_KALMAN_GENERIC_MATRIX
+// Back from a full matrix that is only symmetric up to rounding
+static void packCovariance(kalmanCoreData_t* this, const float *Pd)
+{
+  for (int i=0; i<KC_STATE_DIM; i++) {
+    for (int j=i; j<KC_STATE_DIM; j++) {
+      this->P[KC_P_INDEX(i, j)] = 0.5f*Pd[KC_STATE_DIM*i+j] + 0.5f*Pd[KC_STATE_DIM*j+i];
+    }
+  }
+}
+#endif
+
+#ifdef CONFIG_KALMAN_SCALAR_UPDATE_BENCH
+// Compare the rank-1 covariance update with the dense (KH - I)*P*(KH - I)' path
+#define BENCH_WINDOW 100
+NO_DMA_CCM_SAFE_ZERO_INIT __attribute__((aligned(4))) static float benchPd[KC_STATE_DIM * KC_STATE_DIM];
+static uint32_t benchCount;
+static uint64_t benchDenseSum;
+static uint64_t benchRank1Sum;
+static float benchDenseUs;
+static float benchRank1Us;
+static float benchMaxDiff;
+
+static void denseCovarianceUpdate(float *Pd, xtensa_matrix_instance_f32 *Hm, const float *K, float R)
+{
+  static xtensa_matrix_instance_f32 Km = {KC_STATE_DIM, 1, NULL};
   NO_DMA_CCM_SAFE_ZERO_INIT __attribute__((aligned(4))) static float tmpNN1d[KC_STATE_DIM * KC_STATE_DIM];
   static xtensa_matrix_instance_f32 tmpNN1m = {KC_STATE_DIM, KC_STATE_DIM, tmpNN1d};
-
   NO_DMA_CCM_SAFE_ZERO_INIT __attribute__((aligned(4))) static float tmpNN2d[KC_STATE_DIM * KC_STATE_DIM];
   static xtensa_matrix_instance_f32 tmpNN2m = {KC_STATE_DIM, KC_STATE_DIM, tmpNN2d};
-
   NO_DMA_CCM_SAFE_ZERO_INIT __attribute__((aligned(4))) static float tmpNN3d[KC_STATE_DIM * KC_STATE_DIM];
   static xtensa_matrix_instance_f32 tmpNN3m = {KC_STATE_DIM, KC_STATE_DIM, tmpNN3d};
+  xtensa_matrix_instance_f32 Pm = {KC_STATE_DIM, KC_STATE_DIM, Pd};
 
-  NO_DMA_CCM_SAFE_ZERO_INIT __attribute__((aligned(4))) static float HTd[KC_STATE_DIM * 1];
-  static xtensa_matrix_instance_f32 HTm = {KC_STATE_DIM, 1, HTd};
+  Km.pData = (float *)K;
+  mat_mult(&Km, Hm, &tmpNN1m); // KH
+  for (int i=0; i<KC_STATE_DIM; i++) { tmpNN1d[KC_STATE_DIM*i+i] -= 1; } // KH - I
+  mat_trans(&tmpNN1m, &tmpNN2m); // (KH - I)'
+  mat_mult(&tmpNN1m, &Pm, &tmpNN3m); // (KH - I)*P
+  mat_mult(&tmpNN3m, &tmpNN2m, &Pm); // (KH - I)*P*(KH - I)'
+  for (int i=0; i<KC_STATE_DIM; i++) {
+    for (int j=i; j<KC_STATE_DIM; j++) {
+      float p = 0.5f*Pd[KC_STATE_DIM*i+j] + 0.5f*Pd[KC_STATE_DIM*j+i] + K[i] * R * K[j];
+      Pd[KC_STATE_DIM*i+j] = Pd[KC_STATE_DIM*j+i] = p;
+    }
+  }
+}
+#endif
 
-  NO_DMA_CCM_SAFE_ZERO_INIT __attribute__((aligned(4))) static float PHTd[KC_STATE_DIM * 1];
-  static xtensa_matrix_instance_f32 PHTm = {KC_STATE_DIM, 1, PHTd};
+// Store a covariance element, i <= j, ensuring boundedness
+// TODO: Why would it hit these bounds? Needs to be investigated.
+static inline void setCovarianceBounded(kalmanCoreData_t* this, int i, int j, float p)
+{
+  if (isnan(p) || p > MAX_COVARIANCE) {
+    this->P[KC_P_INDEX(i, j)] = MAX_COVARIANCE;
+  } else if ( i==j && p < MIN_COVARIANCE ) {
+    this->P[KC_P_INDEX(i, j)] = MIN_COVARIANCE;
+  } else {
+    this->P[KC_P_INDEX(i, j)] = p;
+  }
+}
+
+// Ensure the boundedness of the whole covariance
+static void boundCovariance(kalmanCoreData_t* this)
+{
+  for (int i=0; i<KC_STATE_DIM; i++) {
+    for (int j=i; j<KC_STATE_DIM; j++) {
+      setCovarianceBounded(this, i, j, this->P[KC_P_INDEX(i, j)]);
+    }
+  }
+}
+
+#ifdef CONFIG_KALMAN_BATCHED_UPDATE
+static void batchUpdate(kalmanCoreData_t* this)
+{
+  kalmanCoreBatch_t *batch = &this->batch;
+  const int m = batch->rows;
+
+  // PH', the Kalman gain and (I - KH)*P*H', KC_STATE_DIM x m
+  NO_DMA_CCM_SAFE_ZERO_INIT static float G[KC_STATE_DIM][KC_BATCH_MAX_ROWS];
+  NO_DMA_CCM_SAFE_ZERO_INIT static float K[KC_STATE_DIM][KC_BATCH_MAX_ROWS];
+  NO_DMA_CCM_SAFE_ZERO_INIT static float C[KC_STATE_DIM][KC_BATCH_MAX_ROWS];
+
+  // (I - KH)*P
+  NO_DMA_CCM_SAFE_ZERO_INIT static float B[KC_STATE_DIM][KC_STATE_DIM];
+
+  // Innovation covariance HPH' + R and its inverse, m x m
+  NO_DMA_CCM_SAFE_ZERO_INIT __attribute__((aligned(4))) static float Sd[KC_BATCH_MAX_ROWS * KC_BATCH_MAX_ROWS];
+  NO_DMA_CCM_SAFE_ZERO_INIT __attribute__((aligned(4))) static float SInvd[KC_BATCH_MAX_ROWS * KC_BATCH_MAX_ROWS];
+
+  if (m == 0) {
+    return;
+  }
+
+  // ====== INNOVATION COVARIANCE ======
+
+  for (int i=0; i<KC_STATE_DIM; i++) { // PH'
+    for (int k=0; k<m; k++) {
+      float sum = 0;
+      for (int j=0; j<KC_STATE_DIM; j++) {
+        if (batch->H[k][j] != 0.0f) {
+          sum += this->P[kalmanCorePIndex(i, j)] * batch->H[k][j];
+        }
+      }
+      G[i][k] = sum;
+    }
+  }
+
+  for (int k=0; k<m; k++) { // HPH' + R, symmetric
+    for (int l=k; l<m; l++) {
+      float sum = (k == l) ? batch->R[k] : 0.0f;
+      for (int i=0; i<KC_STATE_DIM; i++) {
+        sum += batch->H[k][i] * G[i][l];
+      }
+      Sd[k*m+l] = Sd[l*m+k] = sum;
+    }
+    // each row on its own, as if it were a scalar update
+    healthInnovation(this, batch->measurement[k], batch->error[k], Sd[k*m+k]);
+  }
+
+  // Note: the inversion overwrites Sd
+  xtensa_matrix_instance_f32 Sm = {m, m, Sd};
+  xtensa_matrix_instance_f32 SInvm = {m, m, SInvd};
+  mat_inv(&Sm, &SInvm);
+
+  // ====== MEASUREMENT UPDATE ======
+  // Calculate the Kalman gain and perform the state update
+  for (int i=0; i<KC_STATE_DIM; i++) {
+    for (int k=0; k<m; k++) { // kalman gain = (PH' (HPH' + R )^-1)
+      float sum = 0;
+      for (int l=0; l<m; l++) {
+        sum += G[i][l] * SInvd[l*m+k];
+      }
+      K[i][k] = sum;
+      this->S[i] = this->S[i] + K[i][k] * batch->error[k]; // state update
+    }
+  }
+  assertStateNotNaN(this);
+
+  // ====== COVARIANCE UPDATE ======
+  // Joseph form (KH - I)*P*(KH - I)' + KRK', same factorization as scalarUpdate()
+  // with m columns instead of one, R is diagonal
+  for (int i=0; i<KC_STATE_DIM; i++) {
+    for (int j=0; j<KC_STATE_DIM; j++) {
+      float sum = this->P[kalmanCorePIndex(i, j)];
+      for (int k=0; k<m; k++) {
+        sum -= K[i][k]*G[j][k];
+      }
+      B[i][j] = sum;
+    }
+  }
+  for (int i=0; i<KC_STATE_DIM; i++) { // BH'
+    for (int k=0; k<m; k++) {
+      float sum = 0;
+      for (int j=0; j<KC_STATE_DIM; j++) {
+        if (batch->H[k][j] != 0.0f) {
+          sum += B[i][j] * batch->H[k][j];
+        }
+      }
+      C[i][k] = sum;
+    }
+  }
+  // add the measurement variance and ensure boundedness and symmetry
+  for (int i=0; i<KC_STATE_DIM; i++) {
+    for (int j=i; j<KC_STATE_DIM; j++) {
+      float pij = B[i][j];
+      float pji = B[j][i];
+      float v = 0;
+      for (int k=0; k<m; k++) {
+        pij -= C[i][k]*K[j][k];
+        pji -= C[j][k]*K[i][k];
+        v += K[i][k] * batch->R[k] * K[j][k];
+      }
+      setCovarianceBounded(this, i, j, 0.5f*pij + 0.5f*pji + v);
+    }
+  }
+
+  assertStateNotNaN(this);
+
+  batch->rows = 0;
+}
+
+static void batchAppend(kalmanCoreData_t* this, kalmanCoreMeasurement_t measurement, xtensa_matrix_instance_f32 *Hm, float error, float stdMeasNoise)
+{
+  kalmanCoreBatch_t *batch = &this->batch;
 
   ASSERT(Hm->numRows == 1);
   ASSERT(Hm->numCols == KC_STATE_DIM);
 
+  if (batch->rows >= KC_BATCH_MAX_ROWS) {
+    batchUpdate(this);
+  }
+
+  memcpy(batch->H[batch->rows], Hm->pData, sizeof(batch->H[0]));
+  batch->error[batch->rows] = error;
+  batch->R[batch->rows] = stdMeasNoise*stdMeasNoise;
+#ifdef CONFIG_KALMAN_HEALTH_MONITOR
+  batch->measurement[batch->rows] = measurement;
+#endif
+  batch->rows++;
+}
+
+void kalmanCoreBatchBegin(kalmanCoreData_t* this)
+{
+  this->batch.rows = 0;
+  this->batch.isActive = true;
+}
+
+void kalmanCoreBatchEnd(kalmanCoreData_t* this)
+{
+  batchUpdate(this);
+  this->batch.isActive = false;
+}
+#endif
+
+/**
+ * The scalar update with the non-zero elements of H only, hValue[k] is
+ * H(hIndex[k]). The measurement models that know their few states pass them
+ * directly, instead of a full row that is searched for them.
+ */
+static void scalarUpdateSparse(kalmanCoreData_t* this, kalmanCoreMeasurement_t measurement, int hCount, const int *hIndex, const float *hValue, float error, float stdMeasNoise)
+{
+#if defined(CONFIG_KALMAN_BATCHED_UPDATE) || defined(CONFIG_KALMAN_SCALAR_UPDATE_BENCH)
+  float h[KC_STATE_DIM] = {0};
+  xtensa_matrix_instance_f32 H = {1, KC_STATE_DIM, h};
+  for (int k=0; k<hCount; k++) {
+    h[hIndex[k]] = hValue[k];
+  }
+#endif
+#ifdef CONFIG_KALMAN_BATCHED_UPDATE
+  if (this->batch.isActive) {
+    batchAppend(this, measurement, &H, error, stdMeasNoise);
+    return;
+  }
+#endif
+
+  // The Kalman gain as a column vector
+  NO_DMA_CCM_SAFE_ZERO_INIT static float K[KC_STATE_DIM];
+
+  // PH', the covariance column(s) selected by H
+  NO_DMA_CCM_SAFE_ZERO_INIT __attribute__((aligned(4))) static float PHTd[KC_STATE_DIM * 1];
+
+  // The product of (I - KH)*P with H'
+  NO_DMA_CCM_SAFE_ZERO_INIT __attribute__((aligned(4))) static float BHTd[KC_STATE_DIM * 1];
+
+  ASSERT(hCount <= KC_STATE_DIM);
+
   // ====== INNOVATION COVARIANCE ======
 
-  mat_trans(Hm, &HTm);
-  mat_mult(&this->Pm, &HTm, &PHTm); // PH'
+  for (int i=0; i<KC_STATE_DIM; i++) { // PH'
+    float sum = 0;
+    for (int k=0; k<hCount; k++) {
+      sum += this->P[kalmanCorePIndex(i, hIndex[k])] * hValue[k];
+    }
+    PHTd[i] = sum;
+  }
   float R = stdMeasNoise*stdMeasNoise;
-  float HPHR = R; // HPH' + R
-  for (int i=0; i<KC_STATE_DIM; i++) { // Add the element of HPH' to the above
-    HPHR += Hm->pData[i]*PHTd[i]; // this obviously only works if the update is scalar (as in this function)
+  float HPH = 0; // HPH'
+  for (int k=0; k<hCount; k++) {
+    HPH += hValue[k]*PHTd[hIndex[k]]; // this obviously only works if the update is scalar (as in this function)
   }
+  float HPHR = HPH + R; // HPH' + R
   ASSERT(!isnan(HPHR));
+  healthInnovation(this, measurement, error, HPHR);
 
   // ====== MEASUREMENT UPDATE ======
   // Calculate the Kalman gain and perform the state update
@@ -260,32 +521,79 @@ static void scalarUpdate(kalmanCoreData_t* this, xtensa_matrix_instance_f32 *Hm,
   }
   assertStateNotNaN(this);
 
+#ifdef CONFIG_KALMAN_SCALAR_UPDATE_BENCH
+  unpackCovariance(this, benchPd);
+  uint64_t benchStart = usecTimestamp();
+  denseCovarianceUpdate(benchPd, &H, K, R);
+  uint64_t benchMid = usecTimestamp();
+#endif
+
   // ====== COVARIANCE UPDATE ======
-  mat_mult(&Km, Hm, &tmpNN1m); // KH
-  for (int i=0; i<KC_STATE_DIM; i++) { tmpNN1d[KC_STATE_DIM*i+i] -= 1; } // KH - I
-  mat_trans(&tmpNN1m, &tmpNN2m); // (KH - I)'
-  mat_mult(&tmpNN1m, &this->Pm, &tmpNN3m); // (KH - I)*P
-  mat_mult(&tmpNN3m, &tmpNN2m, &this->Pm); // (KH - I)*P*(KH - I)'
-  assertStateNotNaN(this);
+  // Joseph form (KH - I)*P*(KH - I)' + KRK', using that KH is rank-1:
+  // B = (I - KH)*P = P - K(PH')'  (P is symmetric, so HP = (PH')')
+  // B*(I - KH)' = B - (BH')K'
+  // Expanding the full product instead cancels badly in float when P >> R.
+  // B is not symmetric, its elements are computed where they are used.
+  for (int i=0; i<KC_STATE_DIM; i++) { // BH'
+    float sum = 0;
+    for (int k=0; k<hCount; k++) {
+      sum += (this->P[kalmanCorePIndex(i, hIndex[k])] - K[i]*PHTd[hIndex[k]]) * hValue[k];
+    }
+    BHTd[i] = sum;
+  }
   // add the measurement variance and ensure boundedness and symmetry
-  // TODO: Why would it hit these bounds? Needs to be investigated.
   for (int i=0; i<KC_STATE_DIM; i++) {
     for (int j=i; j<KC_STATE_DIM; j++) {
+      const float p = this->P[KC_P_INDEX(i, j)];
+      float pij = (p - K[i]*PHTd[j]) - BHTd[i]*K[j];
+      float pji = (p - K[j]*PHTd[i]) - BHTd[j]*K[i];
       float v = K[i] * R * K[j];
-      float p = 0.5f*this->P[i][j] + 0.5f*this->P[j][i] + v; // add measurement noise
-      if (isnan(p) || p > MAX_COVARIANCE) {
-        this->P[i][j] = this->P[j][i] = MAX_COVARIANCE;
-      } else if ( i==j && p < MIN_COVARIANCE ) {
-        this->P[i][j] = this->P[j][i] = MIN_COVARIANCE;
-      } else {
-        this->P[i][j] = this->P[j][i] = p;
-      }
+      setCovarianceBounded(this, i, j, 0.5f*pij + 0.5f*pji + v); // add measurement noise
+    }
+  }
+
+#ifdef CONFIG_KALMAN_SCALAR_UPDATE_BENCH
+  benchDenseSum += benchMid - benchStart;
+  benchRank1Sum += usecTimestamp() - benchMid;
+  for (int i=0; i<KC_STATE_DIM * KC_STATE_DIM; i++) {
+    float dense = fminf(benchPd[i], MAX_COVARIANCE);
+    float diff = fabsf(dense - this->P[kalmanCorePIndex(i / KC_STATE_DIM, i % KC_STATE_DIM)]);
+    if (diff > benchMaxDiff && !isnan(dense)) {
+      benchMaxDiff = diff;
     }
   }
+  if (++benchCount >= BENCH_WINDOW) {
+    benchDenseUs = (float)benchDenseSum / BENCH_WINDOW;
+    benchRank1Us = (float)benchRank1Sum / BENCH_WINDOW;
+    benchCount = 0;
+    benchDenseSum = 0;
+    benchRank1Sum = 0;
+  }
+#endif
 
   assertStateNotNaN(this);
 }
 
+static void scalarUpdate(kalmanCoreData_t* this, kalmanCoreMeasurement_t measurement, xtensa_matrix_instance_f32 *Hm, float error, float stdMeasNoise)
+{
+  // Measurement models only touch a few states, only those columns of P are used
+  int hIndex[KC_STATE_DIM];
+  float hValue[KC_STATE_DIM];
+  int hCount = 0;
+
+  ASSERT(Hm->numRows == 1);
+  ASSERT(Hm->numCols == KC_STATE_DIM);
+
+  for (int i=0; i<KC_STATE_DIM; i++) {
+    if (Hm->pData[i] != 0.0f) {
+      hIndex[hCount] = i;
+      hValue[hCount++] = Hm->pData[i];
+    }
+  }
+
+  scalarUpdateSparse(this, measurement, hCount, hIndex, hValue, error, stdMeasNoise);
+}
+
 
 void kalmanCoreUpdateWithBaro(kalmanCoreData_t* this, float baroAsl, bool quadIsFlying)
 {
@@ -300,14 +608,14 @@ void kalmanCoreUpdateWithBaro(kalmanCoreData_t* this, float baroAsl, bool quadIs
   }
 
   float meas = (baroAsl - this->baroReferenceHeight);
-  scalarUpdate(this, &H, meas - this->S[KC_STATE_Z], measNoiseBaro);
+  scalarUpdate(this, KC_MEAS_BARO, &H, meas - this->S[KC_STATE_Z], measNoiseBaro);
 }
 
 void kalmanCoreUpdateWithAbsoluteHeight(kalmanCoreData_t* this, heightMeasurement_t* height) {
   float h[KC_STATE_DIM] = {0};
   xtensa_matrix_instance_f32 H = {1, KC_STATE_DIM, h};
   h[KC_STATE_Z] = 1;
-  scalarUpdate(this, &H, height->height - this->S[KC_STATE_Z], height->stdDev);
+  scalarUpdate(this, KC_MEAS_HEIGHT, &H, height->height - this->S[KC_STATE_Z], height->stdDev);
 }
 
 void kalmanCoreUpdateWithPosition(kalmanCoreData_t* this, positionMeasurement_t *xyz)
@@ -318,7 +626,7 @@ void kalmanCoreUpdateWithPosition(kalmanCoreData_t* this, positionMeasurement_t
     float h[KC_STATE_DIM] = {0};
     xtensa_matrix_instance_f32 H = {1, KC_STATE_DIM, h};
     h[KC_STATE_X+i] = 1;
-    scalarUpdate(this, &H, xyz->pos[i] - this->S[KC_STATE_X+i], xyz->stdDev);
+    scalarUpdate(this, KC_MEAS_POSITION, &H, xyz->pos[i] - this->S[KC_STATE_X+i], xyz->stdDev);
   }
 }
 
@@ -330,7 +638,7 @@ void kalmanCoreUpdateWithPose(kalmanCoreData_t* this, poseMeasurement_t *pose)
     float h[KC_STATE_DIM] = {0};
     xtensa_matrix_instance_f32 H = {1, KC_STATE_DIM, h};
     h[KC_STATE_X+i] = 1;
-    scalarUpdate(this, &H, pose->pos[i] - this->S[KC_STATE_X+i], pose->stdDevPos);
+    scalarUpdate(this, KC_MEAS_POSE, &H, pose->pos[i] - this->S[KC_STATE_X+i], pose->stdDevPos);
   }
 
   // compute orientation error
@@ -345,15 +653,15 @@ void kalmanCoreUpdateWithPose(kalmanCoreData_t* this, poseMeasurement_t *pose)
     float h[KC_STATE_DIM] = {0};
     xtensa_matrix_instance_f32 H = {1, KC_STATE_DIM, h};
     h[KC_STATE_D0] = 1;
-    scalarUpdate(this, &H, err_quat.x, pose->stdDevQuat);
+    scalarUpdate(this, KC_MEAS_POSE, &H, err_quat.x, pose->stdDevQuat);
     h[KC_STATE_D0] = 0;
 
     h[KC_STATE_D1] = 1;
-    scalarUpdate(this, &H, err_quat.y, pose->stdDevQuat);
+    scalarUpdate(this, KC_MEAS_POSE, &H, err_quat.y, pose->stdDevQuat);
     h[KC_STATE_D1] = 0;
 
     h[KC_STATE_D2] = 1;
-    scalarUpdate(this, &H, err_quat.z, pose->stdDevQuat);
+    scalarUpdate(this, KC_MEAS_POSE, &H, err_quat.z, pose->stdDevQuat);
   }
 }
 
@@ -385,7 +693,7 @@ void kalmanCoreUpdateWithDistance(kalmanCoreData_t* this, distanceMeasurement_t
     h[KC_STATE_Z] = 0.0f;
   }
 
-  scalarUpdate(this, &H, measuredDistance-predictedDistance, d->stdDev);
+  scalarUpdate(this, KC_MEAS_DISTANCE, &H, measuredDistance-predictedDistance, d->stdDev);
 }
 
 
@@ -442,9 +750,11 @@ void kalmanCoreUpdateWithTDOA(kalmanCoreData_t* this, tdoaMeasurement_t *tdoa)
         .z = this->S[KC_STATE_Z],
       };
 
-      bool sampleIsGood = outlierFilterValidateTdoaSteps(tdoa, error, &jacobian, &estimatedPosition);
+      bool sampleIsGood = outlierFilterValidateTdoaSteps(&tdoaOutlierFilterState, tdoa, error, &jacobian, &estimatedPosition);
       if (sampleIsGood) {
-        scalarUpdate(this, &H, error, tdoa->stdDev);
+        scalarUpdate(this, KC_MEAS_TDOA, &H, error, tdoa->stdDev);
+      } else {
+        healthRejected(this, KC_MEAS_TDOA);
       }
     }
   }
@@ -460,15 +770,18 @@ static float predictedNY;
 static float measuredNX;
 static float measuredNY;
 
+// ~~~ Camera constants ~~~
+// The angle of aperture is guessed from the raw data register and thankfully look to be symmetric
+#define FLOW_NPIX 30.0f                         // [pixels] (same in x and y)
+#define FLOW_THETAPIX (DEG_TO_RAD * 4.2f)       // [rad]    (same in x and y), 4.0 before
+#define FLOW_PIXELS_PER_RAD (FLOW_NPIX / FLOW_THETAPIX)
+#define FLOW_OMEGA_FACTOR 1.25f
+#define FLOW_MIN_HEIGHT 0.1f                    // [m]
+
 void kalmanCoreUpdateWithFlow(kalmanCoreData_t* this, const flowMeasurement_t *flow, const Axis3f *gyro)
 {
   // Inclusion of flow measurements in the EKF done by two scalar updates
 
-  // ~~~ Camera constants ~~~
-  // The angle of aperture is guessed from the raw data register and thankfully look to be symmetric
-  float Npix = 30.0;                      // [pixels] (same in x and y)
-  //float thetapix = DEG_TO_RAD * 4.0f;     // [rad]    (same in x and y)
-  float thetapix = DEG_TO_RAD * 4.2f;
   //~~~ Body rates ~~~
   // TODO check if this is feasible or if some filtering has to be done
   float omegax_b = gyro->x * DEG_TO_RAD;
@@ -490,68 +803,59 @@ void kalmanCoreUpdateWithFlow(kalmanCoreData_t* this, const flowMeasurement_t *f
 
   float dx_g = this->S[KC_STATE_PX];
   float dy_g = this->S[KC_STATE_PY];
-  float z_g = 0.0;
   // Saturate elevation in prediction and correction to avoid singularities
-  if ( this->S[KC_STATE_Z] < 0.1f ) {
-      z_g = 0.1;
-  } else {
-      z_g = this->S[KC_STATE_Z];
-  }
+  const float z_g = fmaxf(this->S[KC_STATE_Z], FLOW_MIN_HEIGHT);
+
+  // The pixels per m/s of the velocity, same in x and y, and per m of the height
+  const float pixelsPerVelocity = flow->dt * FLOW_PIXELS_PER_RAD * this->R[2][2] / z_g;
+  const float pixelsPerRate = flow->dt * FLOW_PIXELS_PER_RAD * FLOW_OMEGA_FACTOR;
+  const float hz = -pixelsPerVelocity / z_g;
 
   // ~~~ X velocity prediction and update ~~~
   // predics the number of accumulated pixels in the x-direction
-  float omegaFactor = 1.25f;
-  float hx[KC_STATE_DIM] = {0};
-  xtensa_matrix_instance_f32 Hx = {1, KC_STATE_DIM, hx};
-  predictedNX = (flow->dt * Npix / thetapix ) * ((dx_g * this->R[2][2] / z_g) - omegaFactor * omegay_b);
+  static const int hxIndex[] = {KC_STATE_Z, KC_STATE_PX};
+  predictedNX = pixelsPerVelocity * dx_g - pixelsPerRate * omegay_b;
   measuredNX = flow->dpixelx;
 
-  // derive measurement equation with respect to dx (and z?)
-  hx[KC_STATE_Z] = (Npix * flow->dt / thetapix) * ((this->R[2][2] * dx_g) / (-z_g * z_g));
-  hx[KC_STATE_PX] = (Npix * flow->dt / thetapix) * (this->R[2][2] / z_g);
+  // derive measurement equation with respect to dx and z
+  const float hx[] = {hz * dx_g, pixelsPerVelocity};
 
   //First update
-  scalarUpdate(this, &Hx, measuredNX-predictedNX, flow->stdDevX);
+  scalarUpdateSparse(this, KC_MEAS_FLOW, 2, hxIndex, hx, measuredNX-predictedNX, flow->stdDevX);
 
   // ~~~ Y velocity prediction and update ~~~
-  float hy[KC_STATE_DIM] = {0};
-  xtensa_matrix_instance_f32 Hy = {1, KC_STATE_DIM, hy};
-  predictedNY = (flow->dt * Npix / thetapix ) * ((dy_g * this->R[2][2] / z_g) + omegaFactor * omegax_b);
+  static const int hyIndex[] = {KC_STATE_Z, KC_STATE_PY};
+  predictedNY = pixelsPerVelocity * dy_g + pixelsPerRate * omegax_b;
   measuredNY = flow->dpixely;
 
-  // derive measurement equation with respect to dy (and z?)
-  hy[KC_STATE_Z] = (Npix * flow->dt / thetapix) * ((this->R[2][2] * dy_g) / (-z_g * z_g));
-  hy[KC_STATE_PY] = (Npix * flow->dt / thetapix) * (this->R[2][2] / z_g);
+  // derive measurement equation with respect to dy and z
+  const float hy[] = {hz * dy_g, pixelsPerVelocity};
 
   // Second update
-  scalarUpdate(this, &Hy, measuredNY-predictedNY, flow->stdDevY);
+  scalarUpdateSparse(this, KC_MEAS_FLOW, 2, hyIndex, hy, measuredNY-predictedNY, flow->stdDevY);
 }
 
 
 void kalmanCoreUpdateWithTof(kalmanCoreData_t* this, tofMeasurement_t *tof)
 {
   // Updates the filter with a measured distance in the zb direction using the
-  float h[KC_STATE_DIM] = {0};
-  xtensa_matrix_instance_f32 H = {1, KC_STATE_DIM, h};
+  static const int hIndex[] = {KC_STATE_Z};
 
   // Only update the filter if the measurement is reliable (\hat{h} -> infty when R[2][2] -> 0)
-  if (fabs(this->R[2][2]) > 0.1 && this->R[2][2] > 0){
-    float angle = fabsf(acosf(this->R[2][2])) - DEG_TO_RAD * (15.0f / 2.0f);
-    if (angle < 0.0f) {
-      angle = 0.0f;
-    }
+  if (this->invR22 > 0.0f) {
     //float predictedDistance = S[KC_STATE_Z] / cosf(angle);
-    float predictedDistance = this->S[KC_STATE_Z] / this->R[2][2];
+    float predictedDistance = this->S[KC_STATE_Z] * this->invR22;
     float measuredDistance = tof->distance; // [m]
 
     //Measurement equation
     //
     // h = z/((R*z_b)\dot z_b) = z/cos(alpha)
-    h[KC_STATE_Z] = 1 / this->R[2][2];
-    //h[KC_STATE_Z] = 1 / cosf(angle);
+    const float h[] = {this->invR22};
 
     // Scalar update
-    scalarUpdate(this, &H, measuredDistance-predictedDistance, tof->stdDev);
+    scalarUpdateSparse(this, KC_MEAS_TOF, 1, hIndex, h, measuredDistance-predictedDistance, tof->stdDev);
+  } else {
+    healthRejected(this, KC_MEAS_TOF);
   }
 }
 
@@ -561,7 +865,7 @@ void kalmanCoreUpdateWithYawError(kalmanCoreData_t *this, yawErrorMeasurement_t
     xtensa_matrix_instance_f32 H = {1, KC_STATE_DIM, h};
 
     h[KC_STATE_D2] = 1;
-    scalarUpdate(this, &H, this->S[KC_STATE_D2] - error->yawError, error->stdDev);
+    scalarUpdate(this, KC_MEAS_YAW_ERROR, &H, this->S[KC_STATE_D2] - error->yawError, error->stdDev);
 }
 
 //void kalmanCoreUpdateWithSweepAngles(kalmanCoreData_t *this, sweepAngleMeasurement_t *sweepInfo, const uint32_t tick) {
@@ -655,15 +959,21 @@ void kalmanCorePredict(kalmanCoreData_t* this, float cmdThrust, Axis3f *acc, Axi
 
   // The linearized update matrix
   NO_DMA_CCM_SAFE_ZERO_INIT static float A[KC_STATE_DIM][KC_STATE_DIM];
-  static __attribute__((aligned(4))) xtensa_matrix_instance_f32 Am = { KC_STATE_DIM, KC_STATE_DIM, (float *)A}; // linearized dynamics for covariance update;
 
   // Temporary matrices for the covariance updates
   NO_DMA_CCM_SAFE_ZERO_INIT static float tmpNN1d[KC_STATE_DIM * KC_STATE_DIM];
+
+#ifdef CONFIG_KALMAN_GENERIC_MATRIX
+  static __attribute__((aligned(4))) xtensa_matrix_instance_f32 Am = { KC_STATE_DIM, KC_STATE_DIM, (float *)A}; // linearized dynamics for covariance update;
   static __attribute__((aligned(4))) xtensa_matrix_instance_f32 tmpNN1m = { KC_STATE_DIM, KC_STATE_DIM, tmpNN1d};
 
   NO_DMA_CCM_SAFE_ZERO_INIT static float tmpNN2d[KC_STATE_DIM * KC_STATE_DIM];
   static __attribute__((aligned(4))) xtensa_matrix_instance_f32 tmpNN2m = { KC_STATE_DIM, KC_STATE_DIM, tmpNN2d};
 
+  NO_DMA_CCM_SAFE_ZERO_INIT static float Pd[KC_STATE_DIM * KC_STATE_DIM];
+  static __attribute__((aligned(4))) xtensa_matrix_instance_f32 Pm = { KC_STATE_DIM, KC_STATE_DIM, Pd};
+#endif
+
   float dt2 = dt*dt;
 
   // ====== DYNAMICS LINEARIZATION ======
@@ -766,9 +1076,16 @@ void kalmanCorePredict(kalmanCoreData_t* this, float cmdThrust, Axis3f *acc, Axi
 
 
   // ====== COVARIANCE UPDATE ======
-  mat_mult(&Am, &this->Pm, &tmpNN1m); // A P
+#ifdef CONFIG_KALMAN_GENERIC_MATRIX
+  unpackCovariance(this, Pd);
+  mat_mult(&Am, &Pm, &tmpNN1m); // A P
   mat_trans(&Am, &tmpNN2m); // A'
-  mat_mult(&tmpNN1m, &tmpNN2m, &this->Pm); // A P A'
+  mat_mult(&tmpNN1m, &tmpNN2m, &Pm); // A P A'
+  packCovariance(this, Pd);
+#else
+  // A is block upper triangular, position, velocity and attitude error
+  mat_abat_packed_blocktri_9x9((float *)A, this->P, tmpNN1d, this->P); // A P A'
+#endif
   // Process noise is added after the return from the prediction step
 
   // ====== PREDICTION STEP ======
@@ -837,7 +1154,7 @@ void kalmanCorePredict(kalmanCoreData_t* this, float cmdThrust, Axis3f *acc, Axi
   float dtwz = dt*gyro->z;
 
   // compute the quaternion values in [w,x,y,z] order
-  float angle = xtensa_sqrt(dtwx*dtwx + dtwy*dtwy + dtwz*dtwz);
+  float angle = xtensa_sqrt(dtwx*dtwx + dtwy*dtwy + dtwz*dtwz) + EPS;
   float ca = xtensa_cos_f32(angle/2.0f);
   float sa = xtensa_sin_f32(angle/2.0f);
   float dq[4] = {ca , sa*dtwx/angle , sa*dtwy/angle , sa*dtwz/angle};
@@ -873,31 +1190,20 @@ void kalmanCoreAddProcessNoise(kalmanCoreData_t* this, float dt)
 {
   if (dt>0)
   {
-    this->P[KC_STATE_X][KC_STATE_X] += powf(procNoiseAcc_xy*dt*dt + procNoiseVel*dt + procNoisePos, 2);  // add process noise on position
-    this->P[KC_STATE_Y][KC_STATE_Y] += powf(procNoiseAcc_xy*dt*dt + procNoiseVel*dt + procNoisePos, 2);  // add process noise on position
-    this->P[KC_STATE_Z][KC_STATE_Z] += powf(procNoiseAcc_z*dt*dt + procNoiseVel*dt + procNoisePos, 2);  // add process noise on position
+    this->P[KC_P_INDEX(KC_STATE_X, KC_STATE_X)] += powf(procNoiseAcc_xy*dt*dt + procNoiseVel*dt + procNoisePos, 2);  // add process noise on position
+    this->P[KC_P_INDEX(KC_STATE_Y, KC_STATE_Y)] += powf(procNoiseAcc_xy*dt*dt + procNoiseVel*dt + procNoisePos, 2);  // add process noise on position
+    this->P[KC_P_INDEX(KC_STATE_Z, KC_STATE_Z)] += powf(procNoiseAcc_z*dt*dt + procNoiseVel*dt + procNoisePos, 2);  // add process noise on position
 
-    this->P[KC_STATE_PX][KC_STATE_PX] += powf(procNoiseAcc_xy*dt + procNoiseVel, 2); // add process noise on velocity
-    this->P[KC_STATE_PY][KC_STATE_PY] += powf(procNoiseAcc_xy*dt + procNoiseVel, 2); // add process noise on velocity
-    this->P[KC_STATE_PZ][KC_STATE_PZ] += powf(procNoiseAcc_z*dt + procNoiseVel, 2); // add process noise on velocity
+    this->P[KC_P_INDEX(KC_STATE_PX, KC_STATE_PX)] += powf(procNoiseAcc_xy*dt + procNoiseVel, 2); // add process noise on velocity
+    this->P[KC_P_INDEX(KC_STATE_PY, KC_STATE_PY)] += powf(procNoiseAcc_xy*dt + procNoiseVel, 2); // add process noise on velocity
+    this->P[KC_P_INDEX(KC_STATE_PZ, KC_STATE_PZ)] += powf(procNoiseAcc_z*dt + procNoiseVel, 2); // add process noise on velocity
 
-    this->P[KC_STATE_D0][KC_STATE_D0] += powf(measNoiseGyro_rollpitch * dt + procNoiseAtt, 2);
-    this->P[KC_STATE_D1][KC_STATE_D1] += powf(measNoiseGyro_rollpitch * dt + procNoiseAtt, 2);
-    this->P[KC_STATE_D2][KC_STATE_D2] += powf(measNoiseGyro_yaw * dt + procNoiseAtt, 2);
+    this->P[KC_P_INDEX(KC_STATE_D0, KC_STATE_D0)] += powf(measNoiseGyro_rollpitch * dt + procNoiseAtt, 2);
+    this->P[KC_P_INDEX(KC_STATE_D1, KC_STATE_D1)] += powf(measNoiseGyro_rollpitch * dt + procNoiseAtt, 2);
+    this->P[KC_P_INDEX(KC_STATE_D2, KC_STATE_D2)] += powf(measNoiseGyro_yaw * dt + procNoiseAtt, 2);
   }
 
-  for (int i=0; i<KC_STATE_DIM; i++) {
-    for (int j=i; j<KC_STATE_DIM; j++) {
-      float p = 0.5f*this->P[i][j] + 0.5f*this->P[j][i];
-      if (isnan(p) || p > MAX_COVARIANCE) {
-        this->P[i][j] = this->P[j][i] = MAX_COVARIANCE;
-      } else if ( i==j && p < MIN_COVARIANCE ) {
-        this->P[i][j] = this->P[j][i] = MIN_COVARIANCE;
-      } else {
-        this->P[i][j] = this->P[j][i] = p;
-      }
-    }
-  }
+  boundCovariance(this);
 
   assertStateNotNaN(this);
 }
@@ -908,15 +1214,21 @@ void kalmanCoreFinalize(kalmanCoreData_t* this, uint32_t tick)
 {
   // Matrix to rotate the attitude covariances once updated
   NO_DMA_CCM_SAFE_ZERO_INIT static float A[KC_STATE_DIM][KC_STATE_DIM];
-  static xtensa_matrix_instance_f32 Am = {KC_STATE_DIM, KC_STATE_DIM, (float *)A};
 
   // Temporary matrices for the covariance updates
   NO_DMA_CCM_SAFE_ZERO_INIT static float tmpNN1d[KC_STATE_DIM * KC_STATE_DIM];
+
+#ifdef CONFIG_KALMAN_GENERIC_MATRIX
+  static xtensa_matrix_instance_f32 Am = {KC_STATE_DIM, KC_STATE_DIM, (float *)A};
   static xtensa_matrix_instance_f32 tmpNN1m = {KC_STATE_DIM, KC_STATE_DIM, tmpNN1d};
 
   NO_DMA_CCM_SAFE_ZERO_INIT static float tmpNN2d[KC_STATE_DIM * KC_STATE_DIM];
   static xtensa_matrix_instance_f32 tmpNN2m = {KC_STATE_DIM, KC_STATE_DIM, tmpNN2d};
 
+  NO_DMA_CCM_SAFE_ZERO_INIT static float Pd[KC_STATE_DIM * KC_STATE_DIM];
+  static xtensa_matrix_instance_f32 Pm = {KC_STATE_DIM, KC_STATE_DIM, Pd};
+#endif
+
   // Incorporate the attitude error (Kalman filter state) with the attitude
   float v0 = this->S[KC_STATE_D0];
   float v1 = this->S[KC_STATE_D1];
@@ -978,9 +1290,16 @@ void kalmanCoreFinalize(kalmanCoreData_t* this, uint32_t tick)
     A[KC_STATE_D2][KC_STATE_D1] = -d0 + d1*d2/2;
     A[KC_STATE_D2][KC_STATE_D2] = 1 - d0*d0/2 - d1*d1/2;
 
+#ifdef CONFIG_KALMAN_GENERIC_MATRIX
+    unpackCovariance(this, Pd);
     mat_trans(&Am, &tmpNN1m); // A'
-    mat_mult(&Am, &this->Pm, &tmpNN2m); // AP
-    mat_mult(&tmpNN2m, &tmpNN1m, &this->Pm); //APA'
+    mat_mult(&Am, &Pm, &tmpNN2m); // AP
+    mat_mult(&tmpNN2m, &tmpNN1m, &Pm); //APA'
+    packCovariance(this, Pd);
+#else
+    // Only the attitude error block of A is not the identity
+    mat_abat_packed_blocktri_9x9((float *)A, this->P, tmpNN1d, this->P); // APA'
+#endif
   }
 
   // convert the new attitude to a rotation matrix, such that we can rotate body-frame velocity and acc
@@ -995,25 +1314,16 @@ void kalmanCoreFinalize(kalmanCoreData_t* this, uint32_t tick)
   this->R[2][0] = 2 * this->q[1] * this->q[3] - 2 * this->q[0] * this->q[2];
   this->R[2][1] = 2 * this->q[2] * this->q[3] + 2 * this->q[0] * this->q[1];
   this->R[2][2] = this->q[0] * this->q[0] - this->q[1] * this->q[1] - this->q[2] * this->q[2] + this->q[3] * this->q[3];
+  // For the height measurements until the next finalization, 0 when tilted too much for them
+  this->invR22 = this->R[2][2] > KC_MIN_R22 ? 1 / this->R[2][2] : 0;
 
   // reset the attitude error
   this->S[KC_STATE_D0] = 0;
   this->S[KC_STATE_D1] = 0;
   this->S[KC_STATE_D2] = 0;
 
-  // enforce symmetry of the covariance matrix, and ensure the values stay bounded
-  for (int i=0; i<KC_STATE_DIM; i++) {
-    for (int j=i; j<KC_STATE_DIM; j++) {
-      float p = 0.5f*this->P[i][j] + 0.5f*this->P[j][i];
-      if (isnan(p) || p > MAX_COVARIANCE) {
-        this->P[i][j] = this->P[j][i] = MAX_COVARIANCE;
-      } else if ( i==j && p < MIN_COVARIANCE ) {
-        this->P[i][j] = this->P[j][i] = MIN_COVARIANCE;
-      } else {
-        this->P[i][j] = this->P[j][i] = p;
-      }
-    }
-  }
+  // ensure the values of the covariance matrix stay bounded, it is symmetric by construction
+  boundCovariance(this);
 
   assertStateNotNaN(this);
 }
@@ -1069,6 +1379,9 @@ void kalmanCoreExternalizeState(const kalmanCoreData_t* this, state_t *state, co
       .z = this->q[3]
   };
 
+  // R is already up to date with q, the controllers take it as it is
+  stateSetRotation(state, this->R);
+
   assertStateNotNaN(this);
 }
 
@@ -1078,11 +1391,10 @@ static void decoupleState(kalmanCoreData_t* this, kalmanCoreStateIdx_t state)
 {
   // Set all covariance to 0
   for(int i=0; i<KC_STATE_DIM; i++) {
-    this->P[state][i] = 0;
-    this->P[i][state] = 0;
+    this->P[kalmanCorePIndex(state, i)] = 0;
   }
   // Set state variance to maximum
-  this->P[state][state] = MAX_COVARIANCE;
+  this->P[KC_P_INDEX(state, state)] = MAX_COVARIANCE;
   // set state to zero
   this->S[state] = 0;
 }
@@ -1104,9 +1416,24 @@ LOG_GROUP_START(kalman_pred)
 LOG_GROUP_STOP(kalman_pred)
 
 LOG_GROUP_START(outlierf)
+  LOG_ADD(LOG_INT32, bucket0, &tdoaOutlierFilterState.bucket[0])
+  LOG_ADD(LOG_INT32, bucket1, &tdoaOutlierFilterState.bucket[1])
+  LOG_ADD(LOG_INT32, bucket2, &tdoaOutlierFilterState.bucket[2])
+  LOG_ADD(LOG_INT32, bucket3, &tdoaOutlierFilterState.bucket[3])
+  LOG_ADD(LOG_INT32, bucket4, &tdoaOutlierFilterState.bucket[4])
+  LOG_ADD(LOG_FLOAT, accLev, &tdoaOutlierFilterState.acceptanceLevel)
+  LOG_ADD(LOG_FLOAT, errD, &tdoaOutlierFilterState.errorDistance)
   LOG_ADD(LOG_INT32, lhWin, &sweepOutlierFilterState.openingWindow)
 LOG_GROUP_STOP(outlierf)
 
+#ifdef CONFIG_KALMAN_SCALAR_UPDATE_BENCH
+LOG_GROUP_START(kalman_bench)
+  LOG_ADD(LOG_FLOAT, denseUs, &benchDenseUs)
+  LOG_ADD(LOG_FLOAT, rank1Us, &benchRank1Us)
+  LOG_ADD(LOG_FLOAT, maxDiff, &benchMaxDiff)
+LOG_GROUP_STOP(kalman_bench)
+#endif
+
 PARAM_GROUP_START(kalman)
   PARAM_ADD(PARAM_FLOAT, pNAcc_xy, &procNoiseAcc_xy)
   PARAM_ADD(PARAM_FLOAT, pNAcc_z, &procNoiseAcc_z)
@@ -28,7 +28,14 @@
 
 #include "kalman_supervisor.h"
 
+#include <math.h>
+#include <string.h>
+
+#include "FreeRTOS.h"
+
 #include "param.h"
+#include "log.h"
+#include "stm32_legacy.h"
 
 // The bounds on states, these shouldn't be hit...
 float maxPosition = 100; //meters
@@ -56,6 +63,141 @@ bool kalmanSupervisorIsStateWithinBounds(const kalmanCoreData_t* this) {
   return true;
 }
 
+#ifdef CONFIG_KALMAN_HEALTH_MONITOR
+
+#define KALMAN_HEALTH_FULL_CHECK_MS 1000
+// Rounding of the covariance updates, P(i,j)^2 may exceed P(i,i)*P(j,j) by this much
+#define KALMAN_HEALTH_CORRELATION_SLACK 1.01f
+
+static int nextRow;
+static uint32_t nextFullCheck;
+
+// Rows found inconsistent since the last full check, and in the last full check
+static uint32_t rowsInconsistent;
+static uint16_t inconsistentCount;
+static uint16_t fullInconsistentCount;
+static uint8_t saturatedCount;
+static uint16_t notFiniteCount;
+static float covarianceTrace;
+// Average normalized innovation squared and share of the measurements rejected, in percent
+static float nis[KC_MEAS_COUNT];
+static uint8_t rejectedPercent[KC_MEAS_COUNT];
+
+/**
+ * Row i of the upper triangle of P, from the diagonal. A covariance has a
+ * positive diagonal and correlations of at most one, a row that has not is
+ * no longer a covariance, whether or not it is within the bounds.
+ */
+static bool isRowFinite(const kalmanCoreData_t* this, int i, bool *isConsistent)
+{
+  const float pii = this->P[KC_P_INDEX(i, i)];
+  *isConsistent = pii > 0.0f;
+
+  for (int j = i; j < KC_STATE_DIM; j++) {
+    const float pij = this->P[KC_P_INDEX(i, j)];
+    if (!isfinite(pij)) {
+      return false;
+    }
+    if (pij * pij > KALMAN_HEALTH_CORRELATION_SLACK * pii * this->P[KC_P_INDEX(j, j)]) {
+      *isConsistent = false;
+    }
+  }
+
+  return true;
+}
+
+static bool isStateFinite(const kalmanCoreData_t* this)
+{
+  for (int i = 0; i < KC_STATE_DIM; i++) {
+    if (!isfinite(this->S[i])) {
+      return false;
+    }
+  }
+  for (int i = 0; i < 4; i++) {
+    if (!isfinite(this->q[i])) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+static bool fullCheck(kalmanCoreData_t* this)
+{
+  bool isFinite = true;
+  uint16_t inconsistent = 0;
+  uint8_t saturated = 0;
+  float trace = 0;
+
+  for (int i = 0; i < KC_STATE_DIM; i++) {
+    bool isConsistent;
+    isFinite &= isRowFinite(this, i, &isConsistent);
+    inconsistent += !isConsistent;
+
+    const float pii = this->P[KC_P_INDEX(i, i)];
+    saturated += pii >= KC_MAX_COVARIANCE;
+    trace += pii;
+  }
+  fullInconsistentCount = inconsistent;
+  saturatedCount = saturated;
+  covarianceTrace = trace;
+
+  inconsistentCount = rowsInconsistent;
+  rowsInconsistent = 0;
+
+  kalmanCoreHealth_t *health = &this->health;
+  for (int m = 0; m < KC_MEAS_COUNT; m++) {
+    const uint32_t total = health->updates[m] + health->rejected[m];
+    nis[m] = (health->updates[m] > 0) ? health->nisSum[m] / health->updates[m] : 0.0f;
+    rejectedPercent[m] = (total > 0) ? (100 * health->rejected[m]) / total : 0;
+  }
+  memset(health, 0, sizeof(*health));
+
+  return isFinite;
+}
+
+bool kalmanSupervisorIsHealthy(kalmanCoreData_t* this, uint32_t tick)
+{
+  bool isHealthy = isStateFinite(this);
+
+  if (tick >= nextFullCheck) {
+    nextFullCheck = tick + M2T(KALMAN_HEALTH_FULL_CHECK_MS);
+    isHealthy &= fullCheck(this);
+  } else {
+    bool isConsistent;
+    isHealthy &= isRowFinite(this, nextRow, &isConsistent);
+    rowsInconsistent += !isConsistent;
+    nextRow = (nextRow + 1) % KC_STATE_DIM;
+  }
+
+  if (!isHealthy) {
+    notFiniteCount++;
+  }
+
+  return isHealthy;
+}
+
+LOG_GROUP_START(kalmanHealth)
+  LOG_ADD(LOG_FLOAT, trace, &covarianceTrace)
+  LOG_ADD(LOG_UINT8, saturated, &saturatedCount)
+  LOG_ADD(LOG_UINT16, inconsistent, &inconsistentCount)
+  LOG_ADD(LOG_UINT16, fullIncons, &fullInconsistentCount)
+  LOG_ADD(LOG_UINT16, notFinite, &notFiniteCount)
+  LOG_ADD(LOG_FLOAT, nisBaro, &nis[KC_MEAS_BARO])
+  LOG_ADD(LOG_FLOAT, nisHeight, &nis[KC_MEAS_HEIGHT])
+  LOG_ADD(LOG_FLOAT, nisPos, &nis[KC_MEAS_POSITION])
+  LOG_ADD(LOG_FLOAT, nisPose, &nis[KC_MEAS_POSE])
+  LOG_ADD(LOG_FLOAT, nisDist, &nis[KC_MEAS_DISTANCE])
+  LOG_ADD(LOG_FLOAT, nisTdoa, &nis[KC_MEAS_TDOA])
+  LOG_ADD(LOG_FLOAT, nisFlow, &nis[KC_MEAS_FLOW])
+  LOG_ADD(LOG_FLOAT, nisTof, &nis[KC_MEAS_TOF])
+  LOG_ADD(LOG_FLOAT, nisYaw, &nis[KC_MEAS_YAW_ERROR])
+  LOG_ADD(LOG_UINT8, rejTdoa, &rejectedPercent[KC_MEAS_TDOA])
+  LOG_ADD(LOG_UINT8, rejTof, &rejectedPercent[KC_MEAS_TOF])
+LOG_GROUP_STOP(kalmanHealth)
+
+#endif // CONFIG_KALMAN_HEALTH_MONITOR
+
 PARAM_GROUP_START(kalman)
   PARAM_ADD(PARAM_FLOAT, maxPos, &maxPosition)
   PARAM_ADD(PARAM_FLOAT, maxVel, &maxVelocity)
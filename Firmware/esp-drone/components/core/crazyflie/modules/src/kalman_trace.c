@@ -0,0 +1,87 @@
+/**
+ *
+ * ESP-Drone Firmware
+ *
+ * Copyright 2019-2020  Espressif Systems (Shanghai)
+ * Copyright (C) 2011-2012 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * kalman_trace.c - Trace of the calls of the kalman task into kalman_core.c
+ */
+
+#include <string.h>
+
+#include "kalman_trace.h"
+#include "cfassert.h"
+
+// The largest payload is the state checkpoint
+#define KALMAN_TRACE_MAX_RECORD (sizeof(kalmanTraceHeader_t) + sizeof(kalmanTraceState_t))
+
+static kalmanTraceSink_t traceSink;
+// Only the kalman task records, one buffer is enough
+static uint8_t record[KALMAN_TRACE_MAX_RECORD];
+
+void kalmanTraceSetSink(kalmanTraceSink_t sink)
+{
+  traceSink = sink;
+
+  if (sink) {
+    const kalmanTraceStart_t start = {
+      .magic = KALMAN_TRACE_MAGIC,
+      .version = KALMAN_TRACE_VERSION,
+      .stateDim = KC_STATE_DIM,
+      .stateSize = sizeof(kalmanTraceState_t),
+    };
+    kalmanTraceRecord(KALMAN_TRACE_START, 0, &start, sizeof(start));
+  }
+}
+
+bool kalmanTraceIsActive(void)
+{
+  return traceSink != NULL;
+}
+
+void kalmanTraceRecord(kalmanTraceType_t type, uint32_t tick, const void *payload, size_t size)
+{
+  if (traceSink == NULL) {
+    return;
+  }
+
+  ASSERT(size <= sizeof(record) - sizeof(kalmanTraceHeader_t));
+  const kalmanTraceHeader_t header = {
+    .type = type,
+    .size = size,
+    .tick = tick,
+  };
+  memcpy(record, &header, sizeof(header));
+  if (size > 0) {
+    memcpy(&record[sizeof(header)], payload, size);
+  }
+
+  traceSink(record, sizeof(header) + size);
+}
+
+void kalmanTraceRecordState(const kalmanCoreData_t *coreData, uint32_t tick)
+{
+  if (traceSink == NULL) {
+    return;
+  }
+
+  kalmanTraceState_t state;
+  memcpy(state.S, coreData->S, sizeof(state.S));
+  memcpy(state.q, coreData->q, sizeof(state.q));
+  memcpy(state.P, coreData->P, sizeof(state.P));
+  kalmanTraceRecord(KALMAN_TRACE_STATE, tick, &state, sizeof(state));
+}
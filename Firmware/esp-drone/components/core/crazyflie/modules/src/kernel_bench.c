@@ -0,0 +1,448 @@
+/**
+ *
+ * ESP-Drone Firmware
+ *
+ * Copyright 2019-2020  Espressif Systems (Shanghai)
+ * Copyright (C) 2011-2012 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * kernel_bench.c - Micro-benchmarks of the estimator, controller and math kernels
+ */
+
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "kernel_bench.h"
+#include "kalman_core.h"
+#include "sensfusion6.h"
+#include "filter.h"
+#include "controller_pid.h"
+#include "attitude_controller.h"
+#include "controller_mellinger.h"
+#include "controller_indi.h"
+#include "position_controller_indi.h"
+#include "pptraj.h"
+#include "cf_math.h"
+#include "crc.h"
+
+#define DEBUG_MODULE "BENCH"
+#include "debug_cf.h"
+
+#ifdef ESP_PLATFORM
+#include "esp_cpu.h"
+#include "esp_timer.h"
+
+static inline uint32_t benchCycles(void) { return esp_cpu_get_cycle_count(); }
+static inline int64_t benchNs(void) { return esp_timer_get_time() * 1000; }
+
+// Let the idle task feed the watchdog between runs
+#define BENCH_YIELD() vTaskDelay(1)
+#else
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+static inline uint32_t benchCycles(void) { return (uint32_t)__rdtsc(); }
+#else
+static inline uint32_t benchCycles(void) { return 0; }
+#endif
+
+static inline int64_t benchNs(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+#define BENCH_YIELD()
+#endif
+
+#define DT (1.0f / 1000.0f)
+#define MAT_DIM KC_STATE_DIM
+#define TRAJ_PIECES 4
+// A full CRTP packet, as the link checks them
+#define CRC_LEN 32
+
+typedef struct {
+  const char *name;
+  void (*setup)(void);
+  void (*call)(uint32_t i);
+  void (*teardown)(void);
+} benchmark_t;
+
+// Inputs of a hover with a little motion, so that no kernel takes a shortcut
+static const Axis3f acc = { .x = 0.01f, .y = -0.02f, .z = 1.0f };
+static const Axis3f gyro = { .x = 1.5f, .y = -0.8f, .z = 0.3f };
+
+static kalmanCoreData_t core;
+static lpf2pData lpf;
+static float lpfOut;
+static biquad3Data biquad;
+static Axis3f biquadOut;
+static control_t control;
+static setpoint_t setpoint;
+static sensorData_t sensors;
+static state_t state;
+static vector_t refOuterIndi;
+static struct poly4d pieces[TRAJ_PIECES];
+static struct piecewise_traj traj;
+static struct traj_eval trajOut;
+static float matA[MAT_DIM * MAT_DIM];
+static float matB[MAT_DIM * MAT_DIM];
+static float matC[MAT_DIM * MAT_DIM];
+static float matTmp[MAT_DIM * MAT_DIM];
+static xtensa_matrix_instance_f32 matAm = { MAT_DIM, MAT_DIM, matA };
+static xtensa_matrix_instance_f32 matBm = { MAT_DIM, MAT_DIM, matB };
+static xtensa_matrix_instance_f32 matCm = { MAT_DIM, MAT_DIM, matC };
+static uint8_t crcData[CRC_LEN];
+static uint32_t crcOut;
+
+static void kalmanSetup(void)
+{
+  kalmanCoreInit(&core);
+}
+
+static void kalmanPredictCall(uint32_t i)
+{
+  kalmanCorePredict(&core, 0.5f, (Axis3f *)&acc, (Axis3f *)&gyro, DT, true);
+}
+
+// scalarUpdate() is private, the height update is one call of it and nothing else
+static void kalmanScalarUpdateCall(uint32_t i)
+{
+  heightMeasurement_t height = { .height = 0.5f + (i & 7) * 0.001f, .stdDev = 0.01f };
+  kalmanCoreUpdateWithAbsoluteHeight(&core, &height);
+}
+
+static void sensfusion6Call(uint32_t i)
+{
+  // Level and still, the attitude stays where the complementary estimator expects it
+  sensfusion6UpdateQ(0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, DT);
+}
+
+static void sensfusion6PredictCall(uint32_t i)
+{
+  sensfusion6PredictQ(0.0f, 0.0f, 0.0f, DT);
+}
+
+static void lpfSetup(void)
+{
+  lpf2pInit(&lpf, 1000.0f, 80.0f);
+}
+
+static void lpfCall(uint32_t i)
+{
+  lpfOut = lpf2pApply(&lpf, (float)(i & 15));
+}
+
+static void biquadLpfSetup(void)
+{
+  biquad3Init(&biquad);
+  biquad3AddLpf(&biquad, 1000.0f, 80.0f);
+}
+
+static void biquadLpfNotchSetup(void)
+{
+  biquadLpfSetup();
+  biquad3AddNotch(&biquad, 1000.0f, 120.0f, 40.0f);
+}
+
+// All three axes of a sample, against three calls of lpf2pApply()
+static void biquadCall(uint32_t i)
+{
+  biquadOut = gyro;
+  biquadOut.x += (float)(i & 15);
+  biquad3Apply(&biquad, biquadOut.axis);
+}
+
+static void controllerSetup(void)
+{
+  memset(&setpoint, 0, sizeof(setpoint));
+  setpoint.mode.x = modeAbs;
+  setpoint.mode.y = modeAbs;
+  setpoint.mode.z = modeAbs;
+  setpoint.mode.yaw = modeAbs;
+  setpoint.position.z = 0.5f;
+
+  memset(&state, 0, sizeof(state));
+  state.position.z = 0.45f;
+  state.position.x = 0.02f;
+  state.attitude.roll = 1.0f;
+  state.attitudeQuaternion.w = 1.0f;
+
+  memset(&sensors, 0, sizeof(sensors));
+  sensors.acc = acc;
+  sensors.gyro = gyro;
+}
+
+// Consecutive ticks, so the slower position loops count as often as in flight
+static void controllerPidCall(uint32_t i)
+{
+  controllerPid(&control, &setpoint, &sensors, &state, i);
+}
+
+// Both levels of the cascade of controllerPid(), without the position loops
+static void attitudePidCall(uint32_t i)
+{
+  float rollRate, pitchRate, yawRate;
+  attitudeControllerCorrectAttitudePID(1.0f, -0.5f, 179.0f + (i & 3), 0.0f, 0.0f, -179.0f,
+                                       &rollRate, &pitchRate, &yawRate);
+  attitudeControllerCorrectRatePID(gyro.x, -gyro.y, gyro.z, rollRate, pitchRate, yawRate);
+}
+
+static void controllerMellingerCall(uint32_t i)
+{
+  controllerMellinger(&control, &setpoint, &sensors, &state, i);
+}
+
+static void controllerIndiCall(uint32_t i)
+{
+  controllerINDI(&control, &setpoint, &sensors, &state, i);
+}
+
+// The outer loop of controllerINDI() alone, it runs at ATTITUDE_RATE
+static void positionIndiCall(uint32_t i)
+{
+  positionControllerINDI(&sensors, &setpoint, &state, &refOuterIndi);
+}
+
+static void controllerPidSetup(void)
+{
+  controllerSetup();
+  controllerPidInit();
+}
+
+static void controllerMellingerSetup(void)
+{
+  controllerSetup();
+  controllerMellingerInit();
+}
+
+// Manual flight, the thrust direction is turned with the heading of the drone
+static void controllerMellingerAttitudeSetup(void)
+{
+  controllerMellingerSetup();
+  setpoint.mode.x = modeDisable;
+  setpoint.mode.y = modeDisable;
+  setpoint.mode.yaw = modeVelocity;
+  setpoint.attitude.roll = 5.0f;
+  setpoint.attitude.pitch = -3.0f;
+  setpoint.attitudeRate.yaw = 20.0f;
+  state.attitudeQuaternion.z = 0.1f;
+  state.attitudeQuaternion.w = 0.995f;
+}
+
+static void controllerIndiSetup(void)
+{
+  controllerSetup();
+  controllerINDIInit();
+}
+
+static void positionIndiSetup(void)
+{
+  controllerSetup();
+  state.attitude.pitch = -0.5f;
+  state.attitude.yaw = 30.0f;
+  positionControllerINDIInit();
+}
+
+static void trajSetup(void)
+{
+  traj.pieces = pieces;
+  piecewise_plan_7th_order_no_jerk(&traj, 1.0f,
+    vzero(), 0.0f, vzero(), 0.0f, vzero(),
+    mkvec(1.0f, 0.5f, 0.2f), 0.5f, vzero(), 0.0f, vzero());
+  for (int i = 1; i < TRAJ_PIECES; i++) {
+    pieces[i] = pieces[0];
+  }
+  traj.n_pieces = TRAJ_PIECES;
+  traj.t_begin = 0.0f;
+  piecewise_rewind(&traj);
+}
+
+// One stabilizer loop apart, crossing to the next piece every second
+static void trajCall(uint32_t i)
+{
+  trajOut = piecewise_eval(&traj, (i % (TRAJ_PIECES * 1000)) * DT);
+}
+
+static void matSetup(void)
+{
+  for (int i = 0; i < MAT_DIM * MAT_DIM; i++) {
+    matA[i] = 0.01f * i;
+    matB[i] = 1.0f - 0.01f * i;
+  }
+}
+
+static void matMultCall(uint32_t i)
+{
+  xtensa_mat_mult_f32(&matAm, &matBm, &matCm);
+}
+
+static void matTransCall(uint32_t i)
+{
+  xtensa_mat_trans_f32(&matAm, &matCm);
+}
+
+static void matMult9Call(uint32_t i)
+{
+  mat_mult_9x9(matA, matB, matC);
+}
+
+static void matAbat9Call(uint32_t i)
+{
+  mat_abat_sym_9x9(matA, matB, matTmp, matC);
+}
+
+static void matAbatPacked9Call(uint32_t i)
+{
+  // The first KC_P_SIZE elements of matB taken as a packed upper triangle
+  mat_abat_packed_9x9(matA, matB, matTmp, matC);
+}
+
+static void matAbatBlockTri9Call(uint32_t i)
+{
+  // Only the blocks of matA on and above the diagonal are read
+  mat_abat_packed_blocktri_9x9(matA, matB, matTmp, matC);
+}
+
+static void crcSetup(void)
+{
+  for (int i = 0; i < CRC_LEN; i++) {
+    crcData[i] = (uint8_t)(i * 37);
+  }
+}
+
+static void crc32Call(uint32_t i)
+{
+  crcOut = crc32Update(i, crcData, CRC_LEN);
+}
+
+static const benchmark_t benchmarks[] = {
+  { "kalmanCorePredict", kalmanSetup, kalmanPredictCall, NULL },
+  { "scalarUpdate", kalmanSetup, kalmanScalarUpdateCall, NULL },
+  { "sensfusion6UpdateQ", NULL, sensfusion6Call, NULL },
+  { "sensfusion6PredictQ", NULL, sensfusion6PredictCall, NULL },
+  { "lpf2pApply", lpfSetup, lpfCall, NULL },
+  { "biquad3Apply", biquadLpfSetup, biquadCall, NULL },
+  { "biquad3Apply_notch", biquadLpfNotchSetup, biquadCall, NULL },
+  { "controllerPid", controllerPidSetup, controllerPidCall, controllerPidInit },
+  { "attitudePid", controllerPidSetup, attitudePidCall, controllerPidInit },
+  { "controllerMellinger", controllerMellingerSetup, controllerMellingerCall, controllerMellingerInit },
+  { "controllerMellingerAtt", controllerMellingerAttitudeSetup, controllerMellingerCall, controllerMellingerInit },
+  { "controllerINDI", controllerIndiSetup, controllerIndiCall, controllerINDIInit },
+  { "positionControllerINDI", positionIndiSetup, positionIndiCall, positionControllerINDIInit },
+  { "piecewise_eval", trajSetup, trajCall, NULL },
+  // The size of the covariance matrix of the kalman filter
+  { "xtensa_mat_mult_f32", matSetup, matMultCall, NULL },
+  { "xtensa_mat_trans_f32", matSetup, matTransCall, NULL },
+  { "mat_mult_9x9", matSetup, matMult9Call, NULL },
+  { "mat_abat_sym_9x9", matSetup, matAbat9Call, NULL },
+  { "mat_abat_packed_9x9", matSetup, matAbatPacked9Call, NULL },
+  { "mat_abat_packed_blocktri_9x9", matSetup, matAbatBlockTri9Call, NULL },
+  { "crc32Update", crcSetup, crc32Call, NULL },
+};
+
+#define BENCHMARKS_COUNT (sizeof(benchmarks) / sizeof(benchmarks[0]))
+
+static void runBenchmark(const benchmark_t *benchmark, uint32_t calls, int runs, kernelBenchResult_t *result)
+{
+  int64_t bestNs = INT64_MAX;
+  uint32_t cycles[KERNEL_BENCH_MAX_RUNS];
+
+  if (runs < 1) {
+    runs = 1;
+  } else if (runs > KERNEL_BENCH_MAX_RUNS) {
+    runs = KERNEL_BENCH_MAX_RUNS;
+  }
+
+  for (int run = 0; run < runs; run++) {
+    if (benchmark->setup) {
+      benchmark->setup();
+    }
+
+    const int64_t startNs = benchNs();
+    const uint32_t startCycles = benchCycles();
+    for (uint32_t i = 0; i < calls; i++) {
+      benchmark->call(i);
+    }
+    const uint32_t runCycles = benchCycles() - startCycles;
+    const int64_t ns = benchNs() - startNs;
+
+    if (ns < bestNs) {
+      bestNs = ns;
+    }
+
+    // Sorted as they come
+    int j = run;
+    for (; j > 0 && cycles[j - 1] > runCycles; j--) {
+      cycles[j] = cycles[j - 1];
+    }
+    cycles[j] = runCycles;
+
+    BENCH_YIELD();
+  }
+
+  if (benchmark->teardown) {
+    benchmark->teardown();
+  }
+
+  result->name = benchmark->name;
+  result->nsPerCall = (float)bestNs / calls;
+  result->cyclesPerCall = (float)cycles[0] / calls;
+  result->cyclesMedian = (float)cycles[runs / 2] / calls;
+  result->cyclesMax = (float)cycles[runs - 1] / calls;
+}
+
+int kernelBenchRun(kernelBenchResult_t *results, int maxResults)
+{
+  int count = 0;
+
+  for (int i = 0; i < BENCHMARKS_COUNT && count < maxResults; i++) {
+    runBenchmark(&benchmarks[i], KERNEL_BENCH_CALLS, KERNEL_BENCH_RUNS, &results[count++]);
+  }
+
+  return count;
+}
+
+int kernelBenchCount(void)
+{
+  return BENCHMARKS_COUNT;
+}
+
+void kernelBenchRunOne(int index, int runs, kernelBenchResult_t *result)
+{
+  runBenchmark(&benchmarks[index], KERNEL_BENCH_CALLS, runs, result);
+}
+
+void kernelBenchMeasure(const char *name, void (*call)(uint32_t i), uint32_t calls, int runs,
+                        kernelBenchResult_t *result)
+{
+  const benchmark_t benchmark = { name, NULL, call, NULL };
+
+  runBenchmark(&benchmark, calls, runs, result);
+}
+
+void kernelBenchPrint(void)
+{
+  kernelBenchResult_t results[BENCHMARKS_COUNT];
+  const int count = kernelBenchRun(results, BENCHMARKS_COUNT);
+
+  for (int i = 0; i < count; i++) {
+    DEBUG_PRINTI("%-22s %10.1f ns %10.1f cycles", results[i].name, (double)results[i].nsPerCall,
+                 (double)results[i].cyclesPerCall);
+  }
+}
@@ -0,0 +1,204 @@
+/**
+ *
+ * ESP-Drone Firmware
+ *
+ * Copyright 2019-2020  Espressif Systems (Shanghai)
+ * Copyright (C) 2011-2012 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * kernel_bench_service.c - The kernel benchmarks on command, over the memory
+ *
+ * The benchmarks run in their own task at the lowest priority, on the core
+ * of the stabilizer, so the cache and the preemptions are those of flight:
+ * the fastest run is the kernel, the median and the slowest show the rest.
+ * The controllers and sensfusion6 are shared with the stabilizer, which
+ * still runs them on the ground, their outputs are only meaningful again
+ * once the benchmarks are done and both initialized them again. Taking off
+ * during the runs aborts them after the current benchmark.
+ */
+#define DEBUG_MODULE "BENCH"
+
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "esp_chip_info.h"
+
+#include "config.h"
+#include "kernel_bench.h"
+#include "mem.h"
+#include "stabilizer.h"
+#include "system.h"
+#include "static_mem.h"
+#include "debug_cf.h"
+#include "sdkconfig.h"
+#ifndef CONFIG_SENSORS_BMI088_SPI
+#include "i2cdev.h"
+#include "mpu6050.h"
+#endif
+
+#ifdef CONFIG_KERNEL_BENCH_SERVICE
+
+#define KERNEL_BENCH_MAX_RECORDS 32
+// An I2C round trip takes about as long as a thousand calls of a kernel
+#define I2C_BENCH_CALLS 100
+
+static bool isInit;
+static kernelBenchMemHeader_t header;
+static kernelBenchMemRecord_t records[KERNEL_BENCH_MAX_RECORDS];
+
+static TaskHandle_t taskHandle;
+STATIC_MEM_TASK_ALLOC(kernelBenchTask, KERNEL_BENCH_TASK_STACKSIZE);
+static void kernelBenchTask(void *param);
+
+static uint32_t handleMemGetSize(void);
+static bool handleMemRead(const uint32_t memAddr, const uint8_t readLen, uint8_t* buffer);
+static bool handleMemWrite(const uint32_t memAddr, const uint8_t writeLen, const uint8_t* buffer);
+static const MemoryHandlerDef_t memDef = {
+  .type = MEM_TYPE_KERNEL_BENCH,
+  .getSize = handleMemGetSize,
+  .read = handleMemRead,
+  .write = handleMemWrite,
+};
+
+void kernelBenchServiceInit(void)
+{
+  esp_chip_info_t chipInfo;
+
+  if (isInit) {
+    return;
+  }
+
+  esp_chip_info(&chipInfo);
+  header = (kernelBenchMemHeader_t) {
+    .magic = KERNEL_BENCH_MEM_MAGIC,
+    .version = KERNEL_BENCH_MEM_VERSION,
+    .state = kbIdle,
+    .recordSize = sizeof(kernelBenchMemRecord_t),
+    .cpuMhz = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+    .chipModel = chipInfo.model,
+  };
+
+  memoryRegisterHandler(&memDef);
+  taskHandle = STATIC_MEM_TASK_CREATE_PINNED(kernelBenchTask, kernelBenchTask, KERNEL_BENCH_TASK_NAME, NULL, KERNEL_BENCH_TASK_PRI, KERNEL_BENCH_TASK_CORE);
+
+  isInit = true;
+}
+
+#ifndef CONFIG_SENSORS_BMI088_SPI
+static uint8_t i2cOut;
+
+// A register of the IMU, through the driver, its lock and the bus
+static void i2cReadCall(uint32_t i)
+{
+  i2cdevReadByte(I2C0_DEV, MPU6050_ADDRESS_AD0_LOW, MPU6050_RA_WHO_AM_I, &i2cOut);
+}
+#endif
+
+static void addRecord(const kernelBenchResult_t *result, uint32_t calls)
+{
+  const uint8_t count = __atomic_load_n(&header.recordsCount, __ATOMIC_RELAXED);
+  kernelBenchMemRecord_t *record = &records[count];
+
+  memset(record, 0, sizeof(*record));
+  strncpy(record->name, result->name, KERNEL_BENCH_NAME_LEN - 1);
+  record->calls = calls;
+  record->nsPerCall = result->nsPerCall;
+  record->cyclesMin = result->cyclesPerCall;
+  record->cyclesMedian = result->cyclesMedian;
+  record->cyclesMax = result->cyclesMax;
+
+  // Served by the mem task once counted
+  __atomic_store_n(&header.recordsCount, count + 1, __ATOMIC_RELEASE);
+}
+
+static void kernelBenchTask(void *param)
+{
+  kernelBenchResult_t result;
+
+  systemWaitStart();
+
+  while (true) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+    const int runs = header.runs;
+    const int count = kernelBenchCount();
+    uint8_t state = kbDone;
+
+    DEBUG_PRINTI("Running %d benchmarks, %d runs\n", count, runs);
+    for (int i = 0; i < count && i < KERNEL_BENCH_MAX_RECORDS; i++) {
+      if (stabilizerIsFlying()) {
+        state = kbAborted;
+        break;
+      }
+      kernelBenchRunOne(i, runs, &result);
+      addRecord(&result, KERNEL_BENCH_CALLS);
+    }
+
+#ifndef CONFIG_SENSORS_BMI088_SPI
+    if (state == kbDone && header.recordsCount < KERNEL_BENCH_MAX_RECORDS) {
+      kernelBenchMeasure("i2cdevReadByte", i2cReadCall, I2C_BENCH_CALLS, runs, &result);
+      addRecord(&result, I2C_BENCH_CALLS);
+    }
+#endif
+
+    __atomic_store_n(&header.state, state, __ATOMIC_RELEASE);
+    DEBUG_PRINTI("Benchmarks %s\n", state == kbDone ? "done" : "aborted, flying");
+  }
+}
+
+static uint32_t handleMemGetSize(void)
+{
+  return sizeof(header) + __atomic_load_n(&header.recordsCount, __ATOMIC_ACQUIRE) * sizeof(kernelBenchMemRecord_t);
+}
+
+static bool handleMemRead(const uint32_t memAddr, const uint8_t readLen, uint8_t* buffer)
+{
+  const kernelBenchMemHeader_t current = header;
+
+  if (memAddr + readLen > handleMemGetSize()) {
+    return false;
+  }
+
+  for (uint32_t i = 0; i < readLen; i++) {
+    const uint32_t addr = memAddr + i;
+    if (addr < sizeof(current)) {
+      buffer[i] = ((const uint8_t *)&current)[addr];
+    } else {
+      buffer[i] = ((const uint8_t *)records)[addr - sizeof(current)];
+    }
+  }
+
+  return true;
+}
+
+static bool handleMemWrite(const uint32_t memAddr, const uint8_t writeLen, const uint8_t* buffer)
+{
+  if (memAddr != 0 || writeLen != 1 || buffer[0] < 1 || buffer[0] > KERNEL_BENCH_MAX_RUNS) {
+    return false;
+  }
+  if (stabilizerIsFlying() || __atomic_load_n(&header.state, __ATOMIC_ACQUIRE) == kbRunning) {
+    return false;
+  }
+
+  header.runs = buffer[0];
+  __atomic_store_n(&header.recordsCount, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&header.state, kbRunning, __ATOMIC_RELEASE);
+  xTaskNotifyGive(taskHandle);
+
+  return true;
+}
+
+#endif // CONFIG_KERNEL_BENCH_SERVICE
@@ -197,33 +197,38 @@ static float sweepStdLh2 = 0.001;
 static vec3d position;
 static float deltaLog;
 
+// Rays that miss the solution by more than this are down weighted, a bit more than the sensor spread
+#define CROSSING_BEAMS_ROBUST_THRESHOLD 0.05f
+#define CROSSING_BEAMS_ROBUST_ITERATIONS 2
+
+static lighthouseGeometryRaySet_t crossingBeamsRays;
+
 static void estimatePositionCrossingBeams(const pulseProcessor_t *state, pulseProcessorResult_t* angles, int baseStation) {
-  memset(&ext_pos, 0, sizeof(ext_pos));
-  int sensorsUsed = 0;
   float delta;
 
-  // Average over all sensors with valid data
+  // One solve over the rays of all sensors and base stations, the result is the center of the deck
+  lighthouseGeometryRaySetClear(&crossingBeamsRays);
   for (size_t sensor = 0; sensor < PULSE_PROCESSOR_N_SENSORS; sensor++) {
-      pulseProcessorBaseStationMeasuremnt_t* bs0Measurement = &angles->sensorMeasurementsLh1[sensor].baseStatonMeasurements[0];
-      pulseProcessorBaseStationMeasuremnt_t* bs1Measurement = &angles->sensorMeasurementsLh1[sensor].baseStatonMeasurements[1];
-
-      if (bs0Measurement->validCount == PULSE_PROCESSOR_N_SWEEPS && bs1Measurement->validCount == PULSE_PROCESSOR_N_SWEEPS) {
-        lighthouseGeometryGetPositionFromRayIntersection(state->bsGeometry, bs0Measurement->correctedAngles, bs1Measurement->correctedAngles, position, &delta);
-
-        deltaLog = delta;
-
-        ext_pos.x += position[0];
-        ext_pos.y += position[1];
-        ext_pos.z += position[2];
-        sensorsUsed++;
+    for (int bs = 0; bs < PULSE_PROCESSOR_N_BASE_STATIONS; bs++) {
+      pulseProcessorBaseStationMeasuremnt_t* bsMeasurement = &angles->sensorMeasurementsLh1[sensor].baseStatonMeasurements[bs];
 
-        STATS_CNT_RATE_EVENT(&positionRate);
+      if (state->bsGeometry[bs].valid && bsMeasurement->validCount == PULSE_PROCESSOR_N_SWEEPS) {
+        lighthouseGeometryRaySetAdd(&crossingBeamsRays, &state->bsGeometry[bs], bs, bsMeasurement->correctedAngles);
       }
+    }
+  }
+
+  if (!lighthouseGeometryGetPositionFromRays(&crossingBeamsRays, CROSSING_BEAMS_ROBUST_ITERATIONS, CROSSING_BEAMS_ROBUST_THRESHOLD, position, &delta)) {
+    return;
   }
 
-  ext_pos.x /= sensorsUsed;
-  ext_pos.y /= sensorsUsed;
-  ext_pos.z /= sensorsUsed;
+  deltaLog = delta;
+  STATS_CNT_RATE_EVENT(&positionRate);
+
+  memset(&ext_pos, 0, sizeof(ext_pos));
+  ext_pos.x = position[0];
+  ext_pos.y = position[1];
+  ext_pos.z = position[2];
 
   // Make sure we feed sane data into the estimator
   if (isfinite(ext_pos.pos[0]) && isfinite(ext_pos.pos[1]) && isfinite(ext_pos.pos[2])) {
@@ -390,8 +395,9 @@ static void estimateYaw(const pulseProcessor_t *state, pulseProcessorResult_t* a
 }
 
 void lighthousePositionEstimatePoseCrossingBeams(const pulseProcessor_t *state, pulseProcessorResult_t* angles, int baseStation) {
+  // Any two valid base stations give a position
+  estimatePositionCrossingBeams(state, angles, baseStation);
   if (state->bsGeometry[0].valid && state->bsGeometry[1].valid) {
-    estimatePositionCrossingBeams(state, angles, baseStation);
     estimateYaw(state, angles, baseStation);
   }
 }
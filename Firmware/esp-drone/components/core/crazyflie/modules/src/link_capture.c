@@ -0,0 +1,192 @@
+/**
+ *
+ * ESP-Drone Firmware
+ *
+ * Copyright 2019-2020  Espressif Systems (Shanghai)
+ * Copyright (C) 2011-2012 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * link_capture.c - Timestamps the CRTP packets of the link into RAM
+ *
+ * The UDP receive, CRTP RX and TX tasks and the stabilizer record from both
+ * cores without a lock. A writer claims its slot by incrementing the claimed
+ * count and increments the written count once the record is in place, the
+ * memory is only served once both counts agree. The capture does not wrap,
+ * the records of the start of a flight are the ones it keeps.
+ */
+#define DEBUG_MODULE "LCAP"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "FreeRTOS.h"
+
+#include "config.h"
+#include "link_capture.h"
+#include "log.h"
+#include "mem.h"
+#include "usec_time.h"
+#include "debug_cf.h"
+
+#ifdef CONFIG_LINK_CAPTURE
+
+#define LINK_CAPTURE_RECORDS CONFIG_LINK_CAPTURE_RECORDS
+
+static bool isInit;
+static linkCaptureRecord_t records[LINK_CAPTURE_RECORDS];
+static uint8_t isRecording;
+static uint32_t claimedCount;
+static uint32_t writtenCount;
+static uint32_t droppedCount;
+
+// Stabilizer only
+static uint32_t lastSetpointTimestamp;
+
+static uint32_t handleMemGetSize(void);
+static bool handleMemRead(const uint32_t memAddr, const uint8_t readLen, uint8_t* buffer);
+static bool handleMemWrite(const uint32_t memAddr, const uint8_t writeLen, const uint8_t* buffer);
+static const MemoryHandlerDef_t memDef = {
+  .type = MEM_TYPE_LINK_CAPTURE,
+  .getSize = handleMemGetSize,
+  .read = handleMemRead,
+  .write = handleMemWrite,
+};
+
+void linkCaptureInit(void)
+{
+  if (isInit) {
+    return;
+  }
+
+  memoryRegisterHandler(&memDef);
+  isInit = true;
+}
+
+static void record(linkCaptureEvent_t event, uint8_t header, uint8_t size, uint8_t sum)
+{
+  if (!__atomic_load_n(&isRecording, __ATOMIC_RELAXED)) {
+    return;
+  }
+
+  const uint32_t index = __atomic_fetch_add(&claimedCount, 1, __ATOMIC_RELAXED);
+  if (index >= LINK_CAPTURE_RECORDS) {
+    __atomic_fetch_add(&droppedCount, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&isRecording, false, __ATOMIC_RELAXED);
+    return;
+  }
+
+  records[index] = (linkCaptureRecord_t) {
+    .timestamp = (uint32_t)usecTimestamp(),
+    .event = event,
+    .header = header,
+    .size = size,
+    .sum = sum,
+  };
+  __atomic_fetch_add(&writtenCount, 1, __ATOMIC_RELEASE);
+}
+
+void linkCapturePacket(linkCaptureEvent_t event, const uint8_t *raw, uint8_t size)
+{
+  uint8_t sum = 0;
+
+  if (!__atomic_load_n(&isRecording, __ATOMIC_RELAXED)) {
+    return;
+  }
+
+  for (uint8_t i = 1; i <= size; i++) {
+    sum += raw[i];
+  }
+  record(event, raw[0], size, sum);
+}
+
+void linkCaptureActuation(uint32_t setpointTimestamp)
+{
+  if (setpointTimestamp == lastSetpointTimestamp) {
+    return;
+  }
+
+  lastSetpointTimestamp = setpointTimestamp;
+  record(lcActuation, 0, 0, 0);
+}
+
+static uint32_t recordsCount(void)
+{
+  const uint32_t claimed = __atomic_load_n(&claimedCount, __ATOMIC_RELAXED);
+
+  return claimed < LINK_CAPTURE_RECORDS ? claimed : LINK_CAPTURE_RECORDS;
+}
+
+static uint32_t handleMemGetSize(void)
+{
+  return LINK_CAPTURE_DATA_OFFSET + recordsCount() * sizeof(linkCaptureRecord_t);
+}
+
+static bool handleMemRead(const uint32_t memAddr, const uint8_t readLen, uint8_t* buffer)
+{
+  const uint32_t count = recordsCount();
+  const linkCaptureHeader_t header = {
+    .magic = LINK_CAPTURE_MAGIC,
+    .version = LINK_CAPTURE_VERSION,
+    .isRecording = __atomic_load_n(&isRecording, __ATOMIC_RELAXED),
+    .recordSize = sizeof(linkCaptureRecord_t),
+    .recordsCount = count,
+    .droppedCount = __atomic_load_n(&droppedCount, __ATOMIC_RELAXED),
+  };
+
+  // The records are read back between captures, once the last one is written
+  if (header.isRecording || __atomic_load_n(&writtenCount, __ATOMIC_ACQUIRE) < count ||
+      memAddr + readLen > handleMemGetSize()) {
+    return false;
+  }
+
+  for (uint32_t i = 0; i < readLen; i++) {
+    const uint32_t addr = memAddr + i;
+    if (addr < sizeof(header)) {
+      buffer[i] = ((const uint8_t *)&header)[addr];
+    } else if (addr < LINK_CAPTURE_DATA_OFFSET) {
+      buffer[i] = 0;
+    } else {
+      buffer[i] = ((const uint8_t *)records)[addr - LINK_CAPTURE_DATA_OFFSET];
+    }
+  }
+
+  return true;
+}
+
+static bool handleMemWrite(const uint32_t memAddr, const uint8_t writeLen, const uint8_t* buffer)
+{
+  if (memAddr != 0 || writeLen != 1 || buffer[0] > 1) {
+    return false;
+  }
+
+  __atomic_store_n(&isRecording, false, __ATOMIC_RELAXED);
+  if (buffer[0]) {
+    __atomic_store_n(&claimedCount, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&writtenCount, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&droppedCount, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&isRecording, true, __ATOMIC_RELEASE);
+    DEBUG_PRINTD("Capture started\n");
+  }
+
+  return true;
+}
+
+LOG_GROUP_START(linkCap)
+LOG_ADD(LOG_UINT8, recording, &isRecording)
+LOG_ADD(LOG_UINT32, records, &claimedCount)
+LOG_ADD(LOG_UINT32, dropped, &droppedCount)
+LOG_GROUP_STOP(linkCap)
+
+#endif // CONFIG_LINK_CAPTURE
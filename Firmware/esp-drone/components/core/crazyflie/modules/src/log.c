@@ -28,9 +28,11 @@
  * FIXME: See if we can factorise the TOC code */
 
 #include <string.h>
+#include <stdlib.h>
 #include <errno.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <math.h>
 
 /* FreeRtos includes */
 #include "FreeRTOS.h"
@@ -41,7 +43,9 @@
 #include "config.h"
 #include "crtp.h"
 #include "log.h"
+#include "param.h"
 #include "crc.h"
+#include "mem.h"
 #include "worker.h"
 #include "num.h"
 
@@ -51,6 +55,10 @@
 #include "debug_cf.h"
 #include "stm32_legacy.h"
 #include "static_mem.h"
+#ifdef CONFIG_LOG_SYNCHRONOUS_BLOCKS
+#include "stabilizer_types.h"
+#include "spsc_ring.h"
+#endif
 
 #if 0
 #define LOG_DEBUG(fmt, ...) DEBUG_PRINTD("D/log " fmt, ## __VA_ARGS__)
@@ -81,16 +89,54 @@ typedef enum {
 
 // Maximum log payload length (4 bytes are used for block id and timestamp)
 #define LOG_MAX_LEN 26
+// Largest raw size of a block, 4 bytes per op for a full packet of 1 byte ops
+#define LOG_MAX_RAW_LEN (4 * LOG_MAX_LEN)
+
+/*
+ * Encoded blocks (CONTROL_CREATE_BLOCK_V3) start their payload with a frame
+ * byte: LOG_FRAME_KEYFRAME and a 7 bit sequence number. A keyframe carries
+ * every variable in its log type, except scaled floats that are sent as
+ * int32 round(value * 10^scale). The other frames carry, for the
+ * LOG_ENCODING_DELTA variables, the difference to the previous frame as a
+ * zig-zag LEB128 varint (modulo 2^32, fp16 as its bit pattern). Raw variables
+ * keep their log type in every frame. A frame that would not fit is sent as a
+ * keyframe, and every LOG_KEYFRAME_INTERVAL frames is one, so a client that
+ * sees a gap in the sequence waits for the next keyframe.
+ */
+#define LOG_ENCODING_RAW        0
+#define LOG_ENCODING_DELTA      1
+#define LOG_ENCODING_MODE_MASK  0x0f
+#define LOG_ENCODING_SCALE_MAX  6   // Scale is in the high nibble of the encoding
+#define LOG_FRAME_KEYFRAME      0x80
+#define LOG_FRAME_SEQ_MASK      0x7f
+#define LOG_KEYFRAME_INTERVAL   16
 
 /* Log packet parameters storage */
+#if defined(CONFIG_BULK_BUFFERS_IN_PSRAM) && !defined(CONFIG_LOG_SYNCHRONOUS_BLOCKS)
+#define LOG_MAX_OPS 1024
+#define LOG_MAX_BLOCKS 64
+#else
 #define LOG_MAX_OPS 128
 #define LOG_MAX_BLOCKS 16
+#endif
+// The info packets have a byte for each
+#define LOG_INFO_MAX_OPS    (LOG_MAX_OPS < 255 ? LOG_MAX_OPS : 255)
+#define LOG_INFO_MAX_BLOCKS (LOG_MAX_BLOCKS < 255 ? LOG_MAX_BLOCKS : 255)
+
+// Size of the lookup tables built by logInit()
+#define LOG_MAX_VARIABLES 1024
+#define LOG_MAX_GROUPS    256
+
+#define LOG_MAX_WATCHES   8
+
 struct log_ops {
   struct log_ops * next;
   uint8_t storageType : 4;
   uint8_t logType     : 4;
   void * variable;
   acquisitionType_t acquisitionType;
+  uint8_t encoding;     // LOG_ENCODING_* and scale, encoded blocks only
+  uint32_t lastValue;   // Last value sent by a LOG_ENCODING_DELTA op
 };
 
 struct log_block {
@@ -98,13 +144,86 @@ struct log_block {
   xTimerHandle timer;
   StaticTimer_t timerBuffer;
   struct log_ops * ops;
+  bool isEncoded;
+  uint8_t seq;
+  uint8_t framesToKeyframe;
+  uint16_t period;          // ms, 0 for a single shot
+  uint8_t skipped;          // Samples skipped since the last one sent, see logCongestionAdmit()
+#ifdef CONFIG_LOG_SYNCHRONOUS_BLOCKS
+  uint16_t syncDivisor;     // Sampled every syncDivisor stabilizer ticks, 0 if not synchronous
+  uint16_t syncGeneration;  // Bumped when the ops change, older snapshots are dropped
+  bool syncBusy;            // Set by the stabilizer while it samples the block
+#endif
 };
 
-NO_DMA_CCM_SAFE_ZERO_INIT static struct log_ops logOps[LOG_MAX_OPS];
-NO_DMA_CCM_SAFE_ZERO_INIT static struct log_block logBlocks[LOG_MAX_BLOCKS];
+#ifdef CONFIG_LOG_SYNCHRONOUS_BLOCKS
+// The stabilizer reads them every loop
+#define LOG_BLOCKS_ZERO_INIT NO_DMA_CCM_SAFE_ZERO_INIT
+#else
+#define LOG_BLOCKS_ZERO_INIT BULK_EXT_RAM_ZERO_INIT
+#endif
+
+LOG_BLOCKS_ZERO_INIT static struct log_ops logOps[LOG_MAX_OPS];
+// The free ops, their variable is NULL
+static staticMemPool_t logOpsPool;
+LOG_BLOCKS_ZERO_INIT static struct log_block logBlocks[LOG_MAX_BLOCKS];
 static xSemaphoreHandle logLock;
 static StaticSemaphore_t logLockBuffer;
 
+// Written with logLock taken
+static logWatch_t * logWatches[LOG_MAX_WATCHES];
+static int logWatchesCount;
+
+#ifdef CONFIG_LOG_SYNCHRONOUS_BLOCKS
+/*
+ * Synchronous blocks are sampled by the stabilizer task, right after the
+ * power distribution, so all the variables of a block come from the same
+ * loop. The raw values are pushed to logSyncRing and the log task packs and
+ * sends them. The stabilizer never takes logLock, instead the log task pauses
+ * a block (logSyncPause()) before it touches its ops.
+ */
+#define LOG_SYNC_RING_LENGTH 16
+#define LOG_SYNC_SNAPSHOT_SIZE LOG_MAX_RAW_LEN
+// How often the log task drains the ring while synchronous blocks are running
+#define LOG_SYNC_FLUSH_PERIOD_MS 2
+
+typedef struct {
+  uint32_t timestamp;
+  uint16_t generation;
+  uint8_t blockIndex;
+  uint8_t size;
+  uint8_t data[LOG_SYNC_SNAPSHOT_SIZE];
+} logSyncSnapshot_t;
+
+SPSC_RING_ALLOC(logSyncRing, LOG_SYNC_RING_LENGTH, sizeof(logSyncSnapshot_t));
+static uint32_t logSyncBlocksCount;
+#endif
+
+/*
+ * The log blocks adapt to the congestion of the link. The log class of the
+ * CRTP TX queues only fills up when the link can not keep up, then the
+ * periods of the blocks are multiplied by logRateDivisor, which doubles at
+ * most every LOG_CONGESTION_HOLD_MS while the queue stays nearly full and
+ * halves once it stayed nearly empty for LOG_CONGESTION_RECOVER_MS. Blocks
+ * are not slowed down beyond LOG_CONGESTION_MAX_PERIOD_MS, those with a longer
+ * period (battery, status) keep it. The effective period of a block is
+ * period * min(rateDiv, max(1, LOG_CONGESTION_MAX_PERIOD_MS / period)).
+ */
+#define LOG_CONGESTION_MAX_DIVISOR    8
+#define LOG_CONGESTION_MAX_PERIOD_MS  500
+// Free packets of the 48 of the log class queue
+#define LOG_CONGESTION_FREE_LOW       12
+#define LOG_CONGESTION_FREE_HIGH      36
+#define LOG_CONGESTION_HOLD_MS        100
+#define LOG_CONGESTION_RECOVER_MS     1000
+
+static uint8_t logAdaptiveParam = 1;
+static uint8_t logRateDivisor = 1;
+static uint32_t logLastChange;
+static uint32_t logLastCongested;
+static uint32_t logSkippedCount;
+static uint32_t logCongestionCount;
+
 struct ops_setting {
     uint8_t logType;
     uint8_t id;
@@ -115,6 +234,12 @@ struct ops_setting_v2 {
     uint16_t id;
 } __attribute__((packed));
 
+struct ops_setting_v3 {
+    uint8_t logType;
+    uint16_t id;
+    uint8_t encoding;
+} __attribute__((packed));
+
 
 #define TOC_CH      0
 #define CONTROL_CH  1
@@ -133,6 +258,8 @@ struct ops_setting_v2 {
 #define CONTROL_RESET           5
 #define CONTROL_CREATE_BLOCK_V2 6
 #define CONTROL_APPEND_BLOCK_V2 7
+#define CONTROL_CREATE_BLOCK_V3 8
+#define CONTROL_APPEND_BLOCK_V3 9
 
 #define BLOCK_ID_FREE -1
 
@@ -154,8 +281,29 @@ static int logsLen;
 static uint32_t logsCrc;
 static uint16_t logsCount = 0;
 
+// Index of every variable in logs, by variable id
+NO_DMA_CCM_SAFE_ZERO_INIT static uint16_t variableIndex[LOG_MAX_VARIABLES];
+// Index of every group start in logs, in table order and sorted by name
+NO_DMA_CCM_SAFE_ZERO_INIT static uint16_t groupIndex[LOG_MAX_GROUPS];
+NO_DMA_CCM_SAFE_ZERO_INIT static uint16_t groupByName[LOG_MAX_GROUPS];
+static uint16_t groupsCount = 0;
+
 static CRTPPacket p;
 
+static uint32_t tocBlobGetSize(void);
+static bool tocBlobRead(const uint32_t memAddr, const uint8_t readLen, uint8_t* buffer);
+static const MemoryHandlerDef_t tocBlobDef = {
+  .type = MEM_TYPE_LOG_TOC,
+  .getSize = tocBlobGetSize,
+  .read = tocBlobRead,
+};
+static uint8_t tocBlobHeader[MEM_TOC_BLOB_HEADER_SIZE];
+static uint32_t tocBlobSize;
+// Start address of the record at tocBlobCursorPtr. Reads are sequential in
+// practice, so every read continues where the last one ended.
+static uint32_t tocBlobCursorAddr;
+static int tocBlobCursorPtr;
+
 static bool isInit = false;
 
 /* Log management functions */
@@ -163,14 +311,80 @@ static int logAppendBlock(int id, struct ops_setting * settings, int len);
 static int logAppendBlockV2(int id, struct ops_setting_v2 * settings, int len);
 static int logCreateBlock(unsigned char id, struct ops_setting * settings, int len);
 static int logCreateBlockV2(unsigned char id, struct ops_setting_v2 * settings, int len);
+static int logAppendBlockV3(int id, struct ops_setting_v3 * settings, int len);
+static int logCreateBlockV3(unsigned char id, struct ops_setting_v3 * settings, int len);
 static int logDeleteBlock(int id);
 static int logStartBlock(int id, unsigned int period);
 static int logStopBlock(int id);
 static void logReset();
+static void logResetRange(uint8_t first, uint8_t count);
 static acquisitionType_t acquisitionTypeFromLogType(uint8_t logType);
+static int variableGetIndex(int id);
+#ifdef CONFIG_LOG_SYNCHRONOUS_BLOCKS
+static uint16_t logSyncPause(struct log_block * block);
+static void logSyncResume(struct log_block * block, uint16_t divisor);
+static void logSyncFlush(void);
+#endif
+static int variableFind(const char *group, const char *name);
+static void logWatchUpdate(void);
+static char * groupGetName(int ptr);
 
 STATIC_MEM_TASK_ALLOC_STACK_NO_DMA_CCM_SAFE(logTask, LOG_TASK_STACKSIZE);
 
+/* Size of the TOC blob record of an entry, group stops have none */
+static uint32_t tocBlobRecordSize(int ptr)
+{
+  if ((logs[ptr].type & LOG_GROUP) && !(logs[ptr].type & LOG_START))
+    return 0;
+
+  return 1 + strlen(logs[ptr].name) + 1;
+}
+
+static uint32_t tocBlobGetSize(void)
+{
+  return tocBlobSize;
+}
+
+static bool tocBlobRead(const uint32_t memAddr, const uint8_t readLen, uint8_t* buffer)
+{
+  if (memAddr + readLen > tocBlobSize)
+    return false;
+
+  for (uint32_t addr = memAddr; addr < memAddr + readLen; addr++) {
+    if (addr < MEM_TOC_BLOB_HEADER_SIZE) {
+      *buffer++ = tocBlobHeader[addr];
+      continue;
+    }
+
+    if (addr < tocBlobCursorAddr) {
+      tocBlobCursorAddr = MEM_TOC_BLOB_HEADER_SIZE;
+      tocBlobCursorPtr = 0;
+    }
+    while (addr >= tocBlobCursorAddr + tocBlobRecordSize(tocBlobCursorPtr)) {
+      tocBlobCursorAddr += tocBlobRecordSize(tocBlobCursorPtr);
+      tocBlobCursorPtr++;
+    }
+
+    int ptr = tocBlobCursorPtr;
+    uint32_t pos = addr - tocBlobCursorAddr;
+    if (pos > 0) {
+      // The name is copied with its terminating zero
+      *buffer++ = logs[ptr].name[pos - 1];
+    } else if (logs[ptr].type & LOG_GROUP) {
+      *buffer++ = logs[ptr].type;
+    } else {
+      *buffer++ = logs[ptr].type & TYPE_MASK;
+    }
+  }
+
+  return true;
+}
+
+static int groupNameCompare(const void *a, const void *b)
+{
+  return strcmp(logs[*(const uint16_t *)a].name, logs[*(const uint16_t *)b].name);
+}
+
 void logInit(void)
 {
   int i;
@@ -207,7 +421,7 @@ void logInit(void)
       memcpy(&p.data[5], logs[i].name, strlen(logs[i].name));
       len += strlen(logs[i].name);
     }
-    logsCrc = crcSlow(p.data, len);
+    logsCrc = crc32Update(0, p.data, len);
   }
 
   // Big lock that protects the log datastructures
@@ -215,9 +429,27 @@ void logInit(void)
 
   for (i=0; i<logsLen; i++)
   {
-    if(!(logs[i].type & LOG_GROUP))
-      logsCount++;
+    if(!(logs[i].type & LOG_GROUP)) {
+      ASSERT(logsCount < LOG_MAX_VARIABLES);
+      variableIndex[logsCount++] = i;
+    } else if (logs[i].type & LOG_START) {
+      ASSERT(groupsCount < LOG_MAX_GROUPS);
+      groupIndex[groupsCount++] = i;
+    }
+  }
+
+  memcpy(groupByName, groupIndex, groupsCount * sizeof(groupIndex[0]));
+  qsort(groupByName, groupsCount, sizeof(groupByName[0]), groupNameCompare);
+
+  tocBlobHeader[0] = MEM_TOC_BLOB_VERSION;
+  memcpy(&tocBlobHeader[1], &logsCrc, 4);
+  memcpy(&tocBlobHeader[5], &logsCount, 2);
+  tocBlobSize = MEM_TOC_BLOB_HEADER_SIZE;
+  for (i=0; i<logsLen; i++) {
+    tocBlobSize += tocBlobRecordSize(i);
   }
+  tocBlobCursorAddr = MEM_TOC_BLOB_HEADER_SIZE;
+  memoryRegisterHandler(&tocBlobDef);
 
   //Manually free all log blocks
   for(i=0; i<LOG_MAX_BLOCKS; i++)
@@ -227,7 +459,7 @@ void logInit(void)
   logReset();
 
   //Start the log task
-  STATIC_MEM_TASK_CREATE(logTask, logTask, LOG_TASK_NAME, NULL, LOG_TASK_PRI);
+  STATIC_MEM_TASK_CREATE_PINNED(logTask, logTask, LOG_TASK_NAME, NULL, LOG_TASK_PRI, LOG_TASK_CORE);
 
   isInit = true;
 }
@@ -242,14 +474,25 @@ void logTask(void * prm)
 	crtpInitTaskQueue(CRTP_PORT_LOG);
 
 	while(1) {
-		crtpReceivePacketBlock(CRTP_PORT_LOG, &p);
+#ifdef CONFIG_LOG_SYNCHRONOUS_BLOCKS
+		int wait = __atomic_load_n(&logSyncBlocksCount, __ATOMIC_RELAXED) ? M2T(LOG_SYNC_FLUSH_PERIOD_MS) : portMAX_DELAY;
 
-		xSemaphoreTake(logLock, portMAX_DELAY);
-		if (p.channel==TOC_CH)
-		  logTOCProcess(p.data[0]);
-		if (p.channel==CONTROL_CH)
-		  logControlProcess();
-		xSemaphoreGive(logLock);
+		if (crtpReceivePacketWait(CRTP_PORT_LOG, &p, wait) == pdTRUE) {
+#else
+		crtpReceivePacketBlock(CRTP_PORT_LOG, &p);
+		{
+#endif
+		  xSemaphoreTake(logLock, portMAX_DELAY);
+		  if (p.channel==TOC_CH)
+		    logTOCProcess(p.data[0]);
+		  if (p.channel==CONTROL_CH)
+		    logControlProcess();
+		  xSemaphoreGive(logLock);
+		}
+
+#ifdef CONFIG_LOG_SYNCHRONOUS_BLOCKS
+		logSyncFlush();
+#endif
 	}
 }
 
@@ -276,30 +519,19 @@ void logTOCProcess(int command)
       p.data[1]=255;
     }
     memcpy(&p.data[2], &logsCrc, 4);
-    p.data[6]=LOG_MAX_BLOCKS;
-    p.data[7]=LOG_MAX_OPS;
+    p.data[6]=LOG_INFO_MAX_BLOCKS;
+    p.data[7]=LOG_INFO_MAX_OPS;
     crtpSendPacket(&p);
     break;
   case CMD_GET_ITEM:  //Get log variable
     LOG_DEBUG("Packet is TOC_GET_ITEM Id: %d\n", p.data[1]);
-    for (ptr=0; ptr<logsLen; ptr++) //Ptr points a group
-    {
-      if (logs[ptr].type & LOG_GROUP)
-      {
-        if (logs[ptr].type & LOG_START)
-          group = logs[ptr].name;
-        else
-          group = "";
-      }
-      else                          //Ptr points a variable
-      {
-        if (n==p.data[1])
-          break;
-        n++;
-      }
+    n = p.data[1];
+    ptr = variableGetIndex(n);
+    if (ptr >= 0) {
+      group = groupGetName(ptr);
     }
 
-    if (ptr<logsLen)
+    if (ptr >= 0)
     {
       LOG_DEBUG("    Item is \"%s\":\"%s\"\n", group, logs[ptr].name);
       p.header=CRTP_HEADER(CRTP_PORT_LOG, TOC_CH);
@@ -328,31 +560,19 @@ void logTOCProcess(int command)
     p.data[0]=CMD_GET_INFO_V2;
     memcpy(&p.data[1], &logsCount, 2);
     memcpy(&p.data[3], &logsCrc, 4);
-    p.data[7]=LOG_MAX_BLOCKS;
-    p.data[8]=LOG_MAX_OPS;
+    p.data[7]=LOG_INFO_MAX_BLOCKS;
+    p.data[8]=LOG_INFO_MAX_OPS;
     crtpSendPacket(&p);
     break;
   case CMD_GET_ITEM_V2:  //Get log variable
     memcpy(&logId, &p.data[1], 2);
     LOG_DEBUG("Packet is TOC_GET_ITEM Id: %d\n", logId);
-    for (ptr=0; ptr<logsLen; ptr++) //Ptr points a group
-    {
-      if (logs[ptr].type & LOG_GROUP)
-      {
-        if (logs[ptr].type & LOG_START)
-          group = logs[ptr].name;
-        else
-          group = "";
-      }
-      else                          //Ptr points a variable
-      {
-        if (n==logId)
-          break;
-        n++;
-      }
+    ptr = variableGetIndex(logId);
+    if (ptr >= 0) {
+      group = groupGetName(ptr);
     }
 
-    if (ptr<logsLen)
+    if (ptr >= 0)
     {
       LOG_DEBUG("    Item is \"%s\":\"%s\"\n", group, logs[ptr].name);
       p.header=CRTP_HEADER(CRTP_PORT_LOG, TOC_CH);
@@ -401,7 +621,12 @@ void logControlProcess()
       ret = logStopBlock( p.data[1] );
       break;
     case CONTROL_RESET:
-      logReset();
+      // [first id][count] resets the blocks of a range only, the answer keeps the first id
+      if (p.size >= 3) {
+        logResetRange(p.data[1], p.data[2]);
+      } else {
+        logReset();
+      }
       ret = 0;
       break;
     case CONTROL_CREATE_BLOCK_V2:
@@ -414,8 +639,20 @@ void logControlProcess()
                             (struct ops_setting_v2*)&p.data[2],
                             (p.size-2)/sizeof(struct ops_setting_v2) );
       break;
+    case CONTROL_CREATE_BLOCK_V3:
+      ret = logCreateBlockV3( p.data[1],
+                            (struct ops_setting_v3*)&p.data[2],
+                            (p.size-2)/sizeof(struct ops_setting_v3) );
+      break;
+    case CONTROL_APPEND_BLOCK_V3:
+      ret = logAppendBlockV3( p.data[1],
+                            (struct ops_setting_v3*)&p.data[2],
+                            (p.size-2)/sizeof(struct ops_setting_v3) );
+      break;
   }
 
+  logWatchUpdate();
+
   //Commands answer
   p.data[2] = ret;
   p.size = 3;
@@ -439,6 +676,7 @@ static int logCreateBlock(unsigned char id, struct ops_setting * settings, int l
   logBlocks[i].timer = xTimerCreateStatic("logTimer", M2T(1000), pdTRUE,
     &logBlocks[i], logBlockTimed, &logBlocks[i].timerBuffer);
   logBlocks[i].ops = NULL;
+  logBlocks[i].isEncoded = false;
 
   if (logBlocks[i].timer == NULL)
   {
@@ -468,6 +706,7 @@ static int logCreateBlockV2(unsigned char id, struct ops_setting_v2 * settings,
   logBlocks[i].timer = xTimerCreateStatic("logTimer", M2T(1000), pdTRUE,
     &logBlocks[i], logBlockTimed, &logBlocks[i].timerBuffer);
   logBlocks[i].ops = NULL;
+  logBlocks[i].isEncoded = false;
 
   if (logBlocks[i].timer == NULL)
   {
@@ -480,6 +719,36 @@ static int logCreateBlockV2(unsigned char id, struct ops_setting_v2 * settings,
   return logAppendBlockV2(id, settings, len);
 }
 
+static int logCreateBlockV3(unsigned char id, struct ops_setting_v3 * settings, int len)
+{
+  int i;
+
+  for (i=0; i<LOG_MAX_BLOCKS; i++)
+    if (id == logBlocks[i].id) return EEXIST;
+
+  for (i=0; i<LOG_MAX_BLOCKS; i++)
+    if (logBlocks[i].id == BLOCK_ID_FREE) break;
+
+  if (i == LOG_MAX_BLOCKS)
+    return ENOMEM;
+
+  logBlocks[i].id = id;
+  logBlocks[i].timer = xTimerCreateStatic("logTimer", M2T(1000), pdTRUE,
+    &logBlocks[i], logBlockTimed, &logBlocks[i].timerBuffer);
+  logBlocks[i].ops = NULL;
+  logBlocks[i].isEncoded = true;
+
+  if (logBlocks[i].timer == NULL)
+  {
+  logBlocks[i].id = BLOCK_ID_FREE;
+  return ENOMEM;
+  }
+
+  LOG_DEBUG("Added encoded block ID %d\n", id);
+
+  return logAppendBlockV3(id, settings, len);
+}
+
 static int blockCalcLength(struct log_block * block);
 static struct log_ops * opsMalloc();
 static void opsFree(struct log_ops * ops);
@@ -527,6 +796,7 @@ static int logAppendBlock(int id, struct ops_setting * settings, int len)
 
       if (varId<0) {
         LOG_ERROR("Trying to add variable Id %d that does not exists.", settings[i].id);
+        opsFree(ops);
         return ENOENT;
       }
 
@@ -534,6 +804,7 @@ static int logAppendBlock(int id, struct ops_setting * settings, int len)
       ops->storageType = logs[varId].type & TYPE_MASK;
       ops->logType     = settings[i].logType & TYPE_MASK;
       ops->acquisitionType = acquisitionTypeFromLogType(logs[varId].type);
+      ops->encoding    = LOG_ENCODING_RAW;
 
       LOG_DEBUG("Appended variable %d to block %d\n", settings[i].id, id);
     } else {                     //Memory variable
@@ -542,6 +813,7 @@ static int logAppendBlock(int id, struct ops_setting * settings, int len)
       ops->storageType = (settings[i].logType>>4) & TYPE_MASK;
       ops->logType     = settings[i].logType & TYPE_MASK;
       ops->acquisitionType = acqType_memory;
+      ops->encoding    = LOG_ENCODING_RAW;
       i += 2;
 
       LOG_DEBUG("Appended var addr 0x%x to block %d\n", (int)ops->variable, id);
@@ -595,6 +867,7 @@ static int logAppendBlockV2(int id, struct ops_setting_v2 * settings, int len)
 
       if (varId<0) {
         LOG_ERROR("Trying to add variable Id %d that does not exists.", settings[i].id);
+        opsFree(ops);
         return ENOENT;
       }
 
@@ -602,6 +875,7 @@ static int logAppendBlockV2(int id, struct ops_setting_v2 * settings, int len)
       ops->storageType = logs[varId].type & TYPE_MASK;
       ops->logType     = settings[i].logType & TYPE_MASK;
       ops->acquisitionType = acquisitionTypeFromLogType(logs[varId].type);
+      ops->encoding    = LOG_ENCODING_RAW;
 
       LOG_DEBUG("Appended variable %d to block %d\n", settings[i].id, id);
     } else {                     //Memory variable
@@ -610,6 +884,7 @@ static int logAppendBlockV2(int id, struct ops_setting_v2 * settings, int len)
       ops->storageType = (settings[i].logType>>4) & TYPE_MASK;
       ops->logType     = settings[i].logType & TYPE_MASK;
       ops->acquisitionType = acqType_memory;
+      ops->encoding    = LOG_ENCODING_RAW;
       i += 2;
 
       LOG_DEBUG("Appended var addr 0x%x to block %d\n", (int)ops->variable, id);
@@ -622,6 +897,75 @@ static int logAppendBlockV2(int id, struct ops_setting_v2 * settings, int len)
   return 0;
 }
 
+static int logAppendBlockV3(int id, struct ops_setting_v3 * settings, int len)
+{
+  int i;
+  struct log_block * block;
+
+  LOG_DEBUG("Appending %d encoded variable to block %d\n", len, id);
+
+  for (i=0; i<LOG_MAX_BLOCKS; i++)
+    if (logBlocks[i].id == id) break;
+
+  if (i >= LOG_MAX_BLOCKS) {
+    LOG_ERROR("Trying to append block id %d that doesn't exist.", id);
+    return ENOENT;
+  }
+
+  block = &logBlocks[i];
+
+  if (!block->isEncoded) {
+    LOG_ERROR("Block id %d is not an encoded block.\n", id);
+    return EINVAL;
+  }
+
+  for (i=0; i<len; i++)
+  {
+    int currentLength = blockCalcLength(block);
+    uint8_t mode = settings[i].encoding & LOG_ENCODING_MODE_MASK;
+    struct log_ops * ops;
+    int varId;
+
+    if ((currentLength + typeLength[settings[i].logType & TYPE_MASK])>LOG_MAX_LEN) {
+      LOG_ERROR("Trying to append a full block. Block id %d.\n", id);
+      return E2BIG;
+    }
+
+    // Memory variables are not supported, their address does not fit
+    varId = variableGetIndex(settings[i].id);
+
+    if (varId<0) {
+      LOG_ERROR("Trying to add variable Id %d that does not exists.", settings[i].id);
+      return ENOENT;
+    }
+
+    if (mode > LOG_ENCODING_DELTA || (settings[i].encoding >> 4) > LOG_ENCODING_SCALE_MAX) {
+      LOG_ERROR("Unknown encoding 0x%02x for variable Id %d.", settings[i].encoding, settings[i].id);
+      return EINVAL;
+    }
+
+    ops = opsMalloc();
+
+    if(!ops) {
+      LOG_ERROR("No more ops memory free!\n");
+      return ENOMEM;
+    }
+
+    ops->variable    = logs[varId].address;
+    ops->storageType = logs[varId].type & TYPE_MASK;
+    ops->logType     = settings[i].logType & TYPE_MASK;
+    ops->acquisitionType = acquisitionTypeFromLogType(logs[varId].type);
+    ops->encoding    = settings[i].encoding;
+
+    LOG_DEBUG("Appended variable %d to block %d\n", settings[i].id, id);
+    blockAppendOps(block, ops);
+
+    LOG_DEBUG("   Now lenght %d\n", blockCalcLength(block));
+  }
+
+  return 0;
+}
+
 static int logDeleteBlock(int id)
 {
   int i;
@@ -636,6 +980,10 @@ static int logDeleteBlock(int id)
     return ENOENT;
   }
 
+#ifdef CONFIG_LOG_SYNCHRONOUS_BLOCKS
+  logSyncPause(&logBlocks[i]);
+#endif
+
   ops = logBlocks[i].ops;
   while (ops)
   {
@@ -643,6 +991,7 @@ static int logDeleteBlock(int id)
     opsFree(ops);
     ops = opsNext;
   }
+  logBlocks[i].ops = NULL;
 
   if (logBlocks[i].timer != 0) {
     xTimerStop(logBlocks[i].timer, portMAX_DELAY);
@@ -668,13 +1017,29 @@ static int logStartBlock(int id, unsigned int period)
 
   LOG_DEBUG("Starting block %d with period %dms\n", id, period);
 
+  logBlocks[i].framesToKeyframe = 0;
+  logBlocks[i].period = period;
+  logBlocks[i].skipped = 0;
+
+#ifdef CONFIG_LOG_SYNCHRONOUS_BLOCKS
+  // Periods that are a whole number of stabilizer loops skip the timer
+  if (period > 0 && (period * RATE_MAIN_LOOP) % 1000 == 0)
+  {
+    xTimerStop(logBlocks[i].timer, portMAX_DELAY);
+    logSyncResume(&logBlocks[i], period * RATE_MAIN_LOOP / 1000);
+    return 0;
+  }
+
+  logSyncPause(&logBlocks[i]);
+#endif
+
   if (period>0)
   {
     xTimerChangePeriod(logBlocks[i].timer, M2T(period), 100);
     xTimerStart(logBlocks[i].timer, 100);
   } else {
     // single-shoot run
-    workerSchedule(logRunBlock, &logBlocks[i]);
+    workerScheduleWithPriority(WORKER_PRIORITY_HIGH, logRunBlock, &logBlocks[i]);
   }
 
   return 0;
@@ -693,6 +1058,9 @@ static int logStopBlock(int id)
   }
 
   xTimerStop(logBlocks[i].timer, portMAX_DELAY);
+#ifdef CONFIG_LOG_SYNCHRONOUS_BLOCKS
+  logSyncPause(&logBlocks[i]);
+#endif
 
   return 0;
 }
@@ -700,7 +1068,8 @@ static int logStopBlock(int id)
 /* This function is called by the timer subsystem */
 void logBlockTimed(xTimerHandle timer)
 {
-  workerSchedule(logRunBlock, pvTimerGetTimerID(timer));
+  // Not queued again if the last run of the block is still waiting
+  workerScheduleWithPriority(WORKER_PRIORITY_HIGH, logRunBlock, pvTimerGetTimerID(timer));
 }
 
 /* Appends data to a packet if space is available; returns false on failure. */
@@ -714,150 +1083,375 @@ static bool appendToPacket(CRTPPacket * pk, const void * data, size_t n) {
   else return false;
 }
 
-/* This function is usually called by the worker subsystem */
-void logRunBlock(void * arg)
+/* Copies the current value of a variable to raw, in its storage type */
+static void logAcquireValue(const struct log_ops * ops, unsigned int timestamp, void * raw)
 {
-  struct log_block *blk = arg;
-  struct log_ops *ops = blk->ops;
-  static CRTPPacket pk;
-  unsigned int timestamp;
-
-  xSemaphoreTake(logLock, portMAX_DELAY);
-
-  timestamp = ((long long)xTaskGetTickCount())/portTICK_RATE_MS;
-
-  pk.header = CRTP_HEADER(CRTP_PORT_LOG, LOG_CH);
-  pk.size = 4;
-  pk.data[0] = blk->id;
-  pk.data[1] = timestamp&0x0ff;
-  pk.data[2] = (timestamp>>8)&0x0ff;
-  pk.data[3] = (timestamp>>16)&0x0ff;
-
-  while (ops)
+  switch(ops->storageType)
   {
-    int valuei = 0;
-    float valuef = 0;
-
-    // FPU instructions must run on aligned data.
-    // We first copy the data to an (aligned) local variable, before assigning it
-    switch(ops->storageType)
+    case LOG_UINT8:
     {
-      case LOG_UINT8:
-      {
-        uint8_t v;
-        if (ops->acquisitionType == acqType_function) {
-          logByFunction_t* logByFunction = (logByFunction_t*)ops->variable;
-          v = logByFunction->acquireUInt8(timestamp, logByFunction->data);
-        } else {
-          memcpy(&v, ops->variable, sizeof(v));
-        }
-        valuei = v;
-        break;
+      uint8_t v;
+      if (ops->acquisitionType == acqType_function) {
+        logByFunction_t* logByFunction = (logByFunction_t*)ops->variable;
+        v = logByFunction->acquireUInt8(timestamp, logByFunction->data);
+        memcpy(raw, &v, sizeof(v));
+      } else {
+        memcpy(raw, ops->variable, sizeof(v));
       }
-      case LOG_INT8:
-      {
-        int8_t v;
-        if (ops->acquisitionType == acqType_function) {
-          logByFunction_t* logByFunction = (logByFunction_t*)ops->variable;
-          v = logByFunction->acquireInt8(timestamp, logByFunction->data);
-        } else {
-          memcpy(&v, ops->variable, sizeof(v));
-        }
-        valuei = v;
-        break;
+      break;
+    }
+    case LOG_INT8:
+    {
+      int8_t v;
+      if (ops->acquisitionType == acqType_function) {
+        logByFunction_t* logByFunction = (logByFunction_t*)ops->variable;
+        v = logByFunction->acquireInt8(timestamp, logByFunction->data);
+        memcpy(raw, &v, sizeof(v));
+      } else {
+        memcpy(raw, ops->variable, sizeof(v));
       }
-      case LOG_UINT16:
-      {
-        uint16_t v;
-        if (ops->acquisitionType == acqType_function) {
-          logByFunction_t* logByFunction = (logByFunction_t*)ops->variable;
-          v = logByFunction->acquireUInt16(timestamp, logByFunction->data);
-        } else {
-          memcpy(&v, ops->variable, sizeof(v));
-        }
-        valuei = v;
-        break;
+      break;
+    }
+    case LOG_UINT16:
+    {
+      uint16_t v;
+      if (ops->acquisitionType == acqType_function) {
+        logByFunction_t* logByFunction = (logByFunction_t*)ops->variable;
+        v = logByFunction->acquireUInt16(timestamp, logByFunction->data);
+        memcpy(raw, &v, sizeof(v));
+      } else {
+        memcpy(raw, ops->variable, sizeof(v));
       }
-      case LOG_INT16:
-      {
-        int16_t v;
-        if (ops->acquisitionType == acqType_function) {
-          logByFunction_t* logByFunction = (logByFunction_t*)ops->variable;
-          v = logByFunction->acquireInt16(timestamp, logByFunction->data);
-        } else {
-          memcpy(&v, ops->variable, sizeof(v));
-        }
-        valuei = v;
-        break;
+      break;
+    }
+    case LOG_INT16:
+    {
+      int16_t v;
+      if (ops->acquisitionType == acqType_function) {
+        logByFunction_t* logByFunction = (logByFunction_t*)ops->variable;
+        v = logByFunction->acquireInt16(timestamp, logByFunction->data);
+        memcpy(raw, &v, sizeof(v));
+      } else {
+        memcpy(raw, ops->variable, sizeof(v));
       }
-      case LOG_UINT32:
-      {
-        uint32_t v;
-        if (ops->acquisitionType == acqType_function) {
-          logByFunction_t* logByFunction = (logByFunction_t*)ops->variable;
-          v = logByFunction->acquireUInt32(timestamp, logByFunction->data);
-        } else {
-          memcpy(&v, ops->variable, sizeof(v));
-        }
-        valuei = v;
-        break;
+      break;
+    }
+    case LOG_UINT32:
+    {
+      uint32_t v;
+      if (ops->acquisitionType == acqType_function) {
+        logByFunction_t* logByFunction = (logByFunction_t*)ops->variable;
+        v = logByFunction->acquireUInt32(timestamp, logByFunction->data);
+        memcpy(raw, &v, sizeof(v));
+      } else {
+        memcpy(raw, ops->variable, sizeof(v));
       }
-      case LOG_INT32:
-      {
-        int32_t v;
-        if (ops->acquisitionType == acqType_function) {
-          logByFunction_t* logByFunction = (logByFunction_t*)ops->variable;
-          v = logByFunction->acquireInt32(timestamp, logByFunction->data);
-        } else {
-          memcpy(&v, ops->variable, sizeof(v));
-        }
-        valuei = v;
-        break;
+      break;
+    }
+    case LOG_INT32:
+    {
+      int32_t v;
+      if (ops->acquisitionType == acqType_function) {
+        logByFunction_t* logByFunction = (logByFunction_t*)ops->variable;
+        v = logByFunction->acquireInt32(timestamp, logByFunction->data);
+        memcpy(raw, &v, sizeof(v));
+      } else {
+        memcpy(raw, ops->variable, sizeof(v));
       }
-      case LOG_FLOAT:
-      {
-        float v;
-        if (ops->acquisitionType == acqType_function) {
-          logByFunction_t* logByFunction = (logByFunction_t*)ops->variable;
-          v = logByFunction->aquireFloat(timestamp, logByFunction->data);
-        } else {
-          memcpy(&v, ops->variable, sizeof(valuef));
-        }
-        valuei = v;
-        valuef = v;
-        break;
+      break;
+    }
+    case LOG_FLOAT:
+    {
+      float v;
+      if (ops->acquisitionType == acqType_function) {
+        logByFunction_t* logByFunction = (logByFunction_t*)ops->variable;
+        v = logByFunction->aquireFloat(timestamp, logByFunction->data);
+        memcpy(raw, &v, sizeof(v));
+      } else {
+        memcpy(raw, ops->variable, sizeof(v));
       }
+      break;
     }
+  }
+}
 
-    if (ops->logType == LOG_FLOAT || ops->logType == LOG_FP16)
+/* Reads a raw value of the storage type of ops as an int and a float */
+static void logConvertValue(const struct log_ops * ops, const void * raw, int * valueiOut, float * valuefOut)
+{
+  int valuei = 0;
+  float valuef = 0;
+
+  // FPU instructions must run on aligned data.
+  // We first copy the data to an (aligned) local variable, before assigning it
+  switch(ops->storageType)
+  {
+    case LOG_UINT8:
     {
-      if (ops->storageType != LOG_FLOAT)
-      {
-        valuef = valuei;
-      }
+      uint8_t v;
+      memcpy(&v, raw, sizeof(v));
+      valuei = v;
+      break;
+    }
+    case LOG_INT8:
+    {
+      int8_t v;
+      memcpy(&v, raw, sizeof(v));
+      valuei = v;
+      break;
+    }
+    case LOG_UINT16:
+    {
+      uint16_t v;
+      memcpy(&v, raw, sizeof(v));
+      valuei = v;
+      break;
+    }
+    case LOG_INT16:
+    {
+      int16_t v;
+      memcpy(&v, raw, sizeof(v));
+      valuei = v;
+      break;
+    }
+    case LOG_UINT32:
+    {
+      uint32_t v;
+      memcpy(&v, raw, sizeof(v));
+      valuei = v;
+      break;
+    }
+    case LOG_INT32:
+    {
+      int32_t v;
+      memcpy(&v, raw, sizeof(v));
+      valuei = v;
+      break;
+    }
+    case LOG_FLOAT:
+    {
+      float v;
+      memcpy(&v, raw, sizeof(v));
+      valuei = v;
+      valuef = v;
+      break;
+    }
+  }
 
-      // Try to append the next item to the packet.  If we run out of space,
-      // drop this and subsequent items.
-      if (ops->logType == LOG_FLOAT)
-      {
-        if (!appendToPacket(&pk, &valuef, 4)) break;
-      }
-      else
-      {
-        valuei = single2half(valuef);
-        if (!appendToPacket(&pk, &valuei, 2)) break;
-      }
+  if (ops->storageType != LOG_FLOAT)
+  {
+    valuef = valuei;
+  }
+
+  *valueiOut = valuei;
+  *valuefOut = valuef;
+}
+
+/* Converts a raw value to the log type of ops and appends it; returns false
+ * if the packet is full. */
+static bool logAppendValue(CRTPPacket * pk, const struct log_ops * ops, const void * raw)
+{
+  int valuei;
+  float valuef;
+
+  logConvertValue(ops, raw, &valuei, &valuef);
+
+  if (ops->logType == LOG_FLOAT || ops->logType == LOG_FP16)
+  {
+    if (ops->logType == LOG_FLOAT)
+    {
+      return appendToPacket(pk, &valuef, 4);
     }
-    else  //logType is an integer
+    else
     {
-      if (!appendToPacket(&pk, &valuei, typeLength[ops->logType])) break;
+      valuei = single2half(valuef);
+      return appendToPacket(pk, &valuei, 2);
     }
+  }
+  else  //logType is an integer
+  {
+    return appendToPacket(pk, &valuei, typeLength[ops->logType]);
+  }
+}
+
+/* The integer that is delta encoded for a raw value, in the log type of ops */
+static uint32_t logQuantize(const struct log_ops * ops, const void * raw)
+{
+  static const float scales[LOG_ENCODING_SCALE_MAX + 1] = {1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f};
+  int valuei;
+  float valuef;
+
+  logConvertValue(ops, raw, &valuei, &valuef);
+
+  switch (ops->logType)
+  {
+    case LOG_UINT8:  return (uint8_t)valuei;
+    case LOG_INT8:   return (int8_t)valuei;
+    case LOG_UINT16: return (uint16_t)valuei;
+    case LOG_INT16:  return (int16_t)valuei;
+    case LOG_FP16:   return single2half(valuef);
+    case LOG_FLOAT:
+    {
+      float scaled = valuef * scales[ops->encoding >> 4];
 
-    ops = ops->next;
+      // Also catches NaN
+      if (!(scaled > (float)INT32_MIN && scaled < (float)INT32_MAX))
+        return (scaled > 0) ? INT32_MAX : INT32_MIN;
+
+      return (int32_t)lroundf(scaled);
+    }
+    default:         return valuei;
   }
+}
 
-  xSemaphoreGive(logLock);
+static bool appendVarint(CRTPPacket * pk, uint32_t value)
+{
+  do {
+    uint8_t byte = value & 0x7f;
+
+    value >>= 7;
+    if (value)
+      byte |= 0x80;
+
+    if (!appendToPacket(pk, &byte, 1)) return false;
+  } while (value);
+
+  return true;
+}
+
+/* Appends the frame byte and the values of an encoded block */
+static void logPackEncoded(CRTPPacket * pk, struct log_block * blk, const uint8_t * raw, uint32_t rawSize)
+{
+  const uint8_t frameIndex = pk->size;
+  bool isKeyframe = (blk->framesToKeyframe == 0);
+  bool isComplete;
+
+  do {
+    uint32_t offset = 0;
+
+    pk->size = frameIndex + 1;
+    isComplete = true;
+
+    for (struct log_ops *ops = blk->ops; ops; ops = ops->next) {
+      uint8_t len = typeLength[ops->storageType];
+
+      if (offset + len > rawSize) break;
+
+      if ((ops->encoding & LOG_ENCODING_MODE_MASK) == LOG_ENCODING_RAW) {
+        isComplete = logAppendValue(pk, ops, &raw[offset]);
+      } else {
+        uint32_t value = logQuantize(ops, &raw[offset]);
+
+        if (isKeyframe) {
+          isComplete = appendToPacket(pk, &value, typeLength[ops->logType]);
+        } else {
+          int32_t delta = (int32_t)(value - ops->lastValue);
+          isComplete = appendVarint(pk, ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31));
+        }
+        ops->lastValue = value;
+      }
+
+      if (!isComplete) break;
+      offset += len;
+    }
+
+    // Keyframes always fit, blockCalcLength() is checked when ops are added
+    if (!isComplete && isKeyframe) break;
+
+    isKeyframe = isKeyframe || !isComplete;
+  } while (!isComplete);
+
+  pk->data[frameIndex] = (isKeyframe ? LOG_FRAME_KEYFRAME : 0) | (blk->seq & LOG_FRAME_SEQ_MASK);
+  blk->seq++;
+  blk->framesToKeyframe = (isKeyframe ? LOG_KEYFRAME_INTERVAL : blk->framesToKeyframe) - 1;
+}
+
+/* Appends the raw values of all the ops of the block, in op order */
+static void logPackBlock(CRTPPacket * pk, struct log_block * blk, const uint8_t * raw, uint32_t rawSize)
+{
+  uint32_t offset = 0;
+
+  if (blk->isEncoded) {
+    logPackEncoded(pk, blk, raw, rawSize);
+    return;
+  }
+
+  for (struct log_ops *ops = blk->ops; ops; ops = ops->next) {
+    uint8_t len = typeLength[ops->storageType];
+
+    if (offset + len > rawSize) break;
+
+    // Try to append the next item to the packet.  If we run out of space,
+    // drop this and subsequent items.
+    if (!logAppendValue(pk, ops, &raw[offset])) break;
+
+    offset += len;
+  }
+}
 
+static void logInitPacket(CRTPPacket * pk, const struct log_block * blk, unsigned int timestamp)
+{
+  pk->header = CRTP_HEADER(CRTP_PORT_LOG, LOG_CH);
+  pk->size = 4;
+  pk->data[0] = blk->id;
+  pk->data[1] = timestamp&0x0ff;
+  pk->data[2] = (timestamp>>8)&0x0ff;
+  pk->data[3] = (timestamp>>16)&0x0ff;
+}
+
+/* Follows the congestion of the link, called with logLock taken */
+static void logCongestionUpdate(uint32_t now)
+{
+  const int free = crtpGetFreeTxQueuePacketsOfPort(CRTP_PORT_LOG);
+
+  if (!logAdaptiveParam) {
+    logRateDivisor = 1;
+    return;
+  }
+
+  if (free < LOG_CONGESTION_FREE_LOW) {
+    logLastCongested = now;
+    // Give the queue time to drain at the lower rate before slowing down again
+    if (logRateDivisor < LOG_CONGESTION_MAX_DIVISOR && now - logLastChange >= M2T(LOG_CONGESTION_HOLD_MS)) {
+      logRateDivisor *= 2;
+      logLastChange = now;
+      logCongestionCount++;
+    }
+  } else if (free < LOG_CONGESTION_FREE_HIGH) {
+    logLastCongested = now;
+  } else if (logRateDivisor > 1 && now - logLastCongested >= M2T(LOG_CONGESTION_RECOVER_MS) &&
+             now - logLastChange >= M2T(LOG_CONGESTION_RECOVER_MS)) {
+    logRateDivisor /= 2;
+    logLastChange = now;
+  }
+}
+
+/* Returns false if the sample of a periodic block is skipped because of the
+ * congestion, called with logLock taken. Skipped samples are not packed, the
+ * delta encoded variables stay relative to the last frame sent. */
+static bool logCongestionAdmit(struct log_block * blk)
+{
+  logCongestionUpdate(xTaskGetTickCount());
+
+  if (blk->period == 0 || blk->period >= LOG_CONGESTION_MAX_PERIOD_MS) {
+    return true;
+  }
+
+  uint8_t divisor = logRateDivisor;
+  if (divisor > LOG_CONGESTION_MAX_PERIOD_MS / blk->period) {
+    divisor = LOG_CONGESTION_MAX_PERIOD_MS / blk->period;
+  }
+
+  if (++blk->skipped < divisor) {
+    logSkippedCount++;
+    return false;
+  }
+
+  blk->skipped = 0;
+  return true;
+}
+
+static void logSendPacket(CRTPPacket * pk)
+{
   // Check if the connection is still up, oherwise disable
   // all the logging and flush all the CRTP queues.
   if (!crtpIsConnected())
@@ -867,53 +1461,221 @@ void logRunBlock(void * arg)
   }
   else
   {
-    crtpSendPacket(&pk);
+    crtpSendPacket(pk);
   }
 }
 
-static int variableGetIndex(int id)
+/* This function is usually called by the worker subsystem */
+void logRunBlock(void * arg)
 {
-  int i;
-  int n=0;
+  struct log_block *blk = arg;
+  static CRTPPacket pk;
+  static uint8_t raw[LOG_MAX_RAW_LEN];
+  uint32_t rawSize = 0;
+  unsigned int timestamp;
 
-  for (i=0; i<logsLen; i++)
-  {
-    if(!(logs[i].type & LOG_GROUP))
-    {
-      if(n==id)
-        break;
-      n++;
+  xSemaphoreTake(logLock, portMAX_DELAY);
+
+  // The worker may still hold a run of a block deleted since its timer fired
+  if (blk->id == BLOCK_ID_FREE) {
+    xSemaphoreGive(logLock);
+    return;
+  }
+
+  if (!logCongestionAdmit(blk)) {
+    xSemaphoreGive(logLock);
+    return;
+  }
+
+  timestamp = ((long long)xTaskGetTickCount())/portTICK_RATE_MS;
+
+  for (struct log_ops *ops = blk->ops; ops; ops = ops->next) {
+    uint8_t len = typeLength[ops->storageType];
+
+    if (rawSize + len > LOG_MAX_RAW_LEN) break;
+
+    logAcquireValue(ops, timestamp, &raw[rawSize]);
+    rawSize += len;
+  }
+
+  logInitPacket(&pk, blk, timestamp);
+  logPackBlock(&pk, blk, raw, rawSize);
+
+  xSemaphoreGive(logLock);
+
+  logSendPacket(&pk);
+}
+
+#ifdef CONFIG_LOG_SYNCHRONOUS_BLOCKS
+/* Stops the stabilizer from sampling a block, returns the previous divisor.
+ * Called by the log task with logLock taken. */
+static uint16_t logSyncPause(struct log_block * block)
+{
+  uint16_t divisor = __atomic_exchange_n(&block->syncDivisor, 0, __ATOMIC_SEQ_CST);
+
+  if (divisor != 0) {
+    __atomic_fetch_sub(&logSyncBlocksCount, 1, __ATOMIC_RELAXED);
+  }
+
+  // The stabilizer may be sampling the block on the other core, it only
+  // takes a few microseconds
+  while (__atomic_load_n(&block->syncBusy, __ATOMIC_SEQ_CST));
+
+  block->syncGeneration++;
+
+  return divisor;
+}
+
+static void logSyncResume(struct log_block * block, uint16_t divisor)
+{
+  if (divisor == 0) {
+    return;
+  }
+
+  if (__atomic_exchange_n(&block->syncDivisor, divisor, __ATOMIC_SEQ_CST) == 0) {
+    __atomic_fetch_add(&logSyncBlocksCount, 1, __ATOMIC_RELAXED);
+  }
+}
+
+void logSynchronousTick(uint32_t tick)
+{
+  static logSyncSnapshot_t snapshot;
+
+  if (__atomic_load_n(&logSyncBlocksCount, __ATOMIC_RELAXED) == 0) {
+    return;
+  }
+
+  unsigned int timestamp = ((long long)xTaskGetTickCount())/portTICK_RATE_MS;
+
+  for (int i = 0; i < LOG_MAX_BLOCKS; i++) {
+    struct log_block *blk = &logBlocks[i];
+
+    // Pairs with logSyncPause(): either we see the divisor cleared, or the
+    // log task waits for us to finish
+    __atomic_store_n(&blk->syncBusy, true, __ATOMIC_SEQ_CST);
+    uint16_t divisor = __atomic_load_n(&blk->syncDivisor, __ATOMIC_SEQ_CST);
+
+    if (divisor != 0 && (tick % divisor) == 0) {
+      snapshot.timestamp = timestamp;
+      snapshot.generation = blk->syncGeneration;
+      snapshot.blockIndex = i;
+      snapshot.size = 0;
+
+      for (struct log_ops *ops = blk->ops; ops; ops = ops->next) {
+        uint8_t len = typeLength[ops->storageType];
+
+        if (snapshot.size + len > LOG_SYNC_SNAPSHOT_SIZE) break;
+
+        logAcquireValue(ops, timestamp, &snapshot.data[snapshot.size]);
+        snapshot.size += len;
+      }
+
+      // A full ring drops the snapshot, it is counted in droppedCount
+      spscRingPush(&logSyncRing, &snapshot);
     }
+
+    __atomic_store_n(&blk->syncBusy, false, __ATOMIC_RELEASE);
   }
+}
+
+/* Packs and sends the snapshots taken by the stabilizer, log task only */
+static void logSyncFlush(void)
+{
+  static logSyncSnapshot_t snapshot;
+  static CRTPPacket pk;
+
+  while (spscRingPop(&logSyncRing, &snapshot)) {
+    struct log_block *blk = &logBlocks[snapshot.blockIndex];
+    bool isValid;
 
-  if (i>=logsLen)
+    xSemaphoreTake(logLock, portMAX_DELAY);
+
+    // The ops have changed since the snapshot was taken
+    isValid = (blk->id != BLOCK_ID_FREE && snapshot.generation == blk->syncGeneration && logCongestionAdmit(blk));
+
+    if (isValid) {
+      logInitPacket(&pk, blk, snapshot.timestamp);
+      logPackBlock(&pk, blk, snapshot.data, snapshot.size);
+    }
+
+    xSemaphoreGive(logLock);
+
+    if (isValid) {
+      logSendPacket(&pk);
+    }
+  }
+}
+#endif
+
+static int variableGetIndex(int id)
+{
+  if (id < 0 || id >= logsCount)
     return -1;
 
-  return i;
+  return variableIndex[id];
 }
 
-static struct log_ops * opsMalloc()
+/* Name of the group that the entry at ptr belongs to, "" if none */
+static char * groupGetName(int ptr)
 {
-  int i;
+  // Find the last group that starts before ptr
+  int low = 0;
+  int high = groupsCount;
+
+  while (low < high) {
+    int mid = (low + high) / 2;
+    if (groupIndex[mid] <= ptr) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+
+  return (low > 0) ? logs[groupIndex[low - 1]].name : "";
+}
 
-  for (i=0;i<LOG_MAX_OPS; i++)
-      if (logOps[i].variable == NULL) break;
+static int variableFind(const char *group, const char *name)
+{
+  int low = 0;
+  int high = groupsCount;
 
-  if (i >= LOG_MAX_OPS)
-      return NULL;
+  while (low < high) {
+    int mid = (low + high) / 2;
+    if (strcmp(logs[groupByName[mid]].name, group) < 0) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
 
-  return &logOps[i];
+  // The same group may be defined in several places
+  for (int i = low; i < groupsCount && !strcmp(logs[groupByName[i]].name, group); i++) {
+    for (int ptr = groupByName[i] + 1; ptr < logsLen && !(logs[ptr].type & LOG_GROUP); ptr++) {
+      if (!strcmp(logs[ptr].name, name)) {
+        return ptr;
+      }
+    }
+  }
+
+  return -1;
+}
+
+static struct log_ops * opsMalloc()
+{
+  return staticMemPoolGet(&logOpsPool);
 }
 
 static void opsFree(struct log_ops * ops)
 {
   ops->variable = NULL;
+  staticMemPoolPut(&logOpsPool, ops);
 }
 
 static int blockCalcLength(struct log_block * block)
 {
   struct log_ops * ops;
-  int len = 0;
+  // Encoded blocks use one byte for the frame header
+  int len = block->isEncoded ? 1 : 0;
 
   for (ops = block->ops; ops; ops = ops->next)
     len += typeLength[ops->logType];
@@ -927,6 +1689,10 @@ void blockAppendOps(struct log_block * block, struct log_ops * ops)
 
   ops->next = NULL;
 
+#ifdef CONFIG_LOG_SYNCHRONOUS_BLOCKS
+  uint16_t divisor = logSyncPause(block);
+#endif
+
   if (block->ops == NULL)
     block->ops = ops;
   else
@@ -935,6 +1701,12 @@ void blockAppendOps(struct log_block * block, struct log_ops * ops)
 
     o->next = ops;
   }
+
+  block->framesToKeyframe = 0;
+
+#ifdef CONFIG_LOG_SYNCHRONOUS_BLOCKS
+  logSyncResume(block, divisor);
+#endif
 }
 
 static void logReset(void)
@@ -959,29 +1731,74 @@ static void logReset(void)
   //Force free the log ops
   for (i=0; i<LOG_MAX_OPS; i++)
     logOps[i].variable = NULL;
+  STATIC_MEM_POOL_INIT(logOpsPool, logOps);
+
+  logWatchUpdate();
+}
+
+static void logResetRange(uint8_t first, uint8_t count)
+{
+  for (int i = 0; i < LOG_MAX_BLOCKS; i++) {
+    const int id = logBlocks[i].id;
+
+    if (id != BLOCK_ID_FREE && id >= first && id < first + count) {
+      logStopBlock(id);
+      logDeleteBlock(id);
+    }
+  }
 }
 
 /* Public API to access log TOC from within the copter */
 static logVarId_t invalidVarId = 0xffffu;
 
+static bool logWatchCovers(const logWatch_t *watch, const void *address)
+{
+  const uint8_t *start = watch->start;
+
+  return (const uint8_t *)address >= start && (const uint8_t *)address < start + watch->size;
+}
+
+/* Called with logLock taken, after the ops changed */
+static void logWatchUpdate(void)
+{
+  for (int w = 0; w < logWatchesCount; w++) {
+    logWatch_t *watch = logWatches[w];
+    bool isLogged = watch->isPinned;
+
+    for (int i = 0; i < LOG_MAX_OPS && !isLogged; i++) {
+      isLogged = logOps[i].variable && logWatchCovers(watch, logOps[i].variable);
+    }
+    watch->isLogged = isLogged;
+  }
+}
+
+void logWatchRegister(logWatch_t *watch)
+{
+  xSemaphoreTake(logLock, portMAX_DELAY);
+  ASSERT(logWatchesCount < LOG_MAX_WATCHES);
+  logWatches[logWatchesCount++] = watch;
+  logWatchUpdate();
+  xSemaphoreGive(logLock);
+}
+
 logVarId_t logGetVarId(char* group, char* name)
 {
-  int i;
-  logVarId_t varId = invalidVarId;
-  char * currgroup = "";
+  int ptr = variableFind(group, name);
 
-  for(i=0; i<logsLen; i++)
-  {
-    if (logs[i].type & LOG_GROUP) {
-      if (logs[i].type & LOG_START)
-        currgroup = logs[i].name;
-    } if ((!strcmp(group, currgroup)) && (!strcmp(name, logs[i].name))) {
-      varId = (logVarId_t)i;
-      return varId;
+  if (ptr < 0) {
+    return invalidVarId;
+  }
+
+  xSemaphoreTake(logLock, portMAX_DELAY);
+  for (int w = 0; w < logWatchesCount; w++) {
+    if (logWatchCovers(logWatches[w], logs[ptr].address)) {
+      logWatches[w]->isPinned = true;
+      logWatches[w]->isLogged = true;
     }
   }
+  xSemaphoreGive(logLock);
 
-  return invalidVarId;
+  return (logVarId_t)ptr;
 }
 
 int logGetType(logVarId_t varid)
@@ -991,22 +1808,12 @@ int logGetType(logVarId_t varid)
 
 void logGetGroupAndName(logVarId_t varid, char** group, char** name)
 {
-  char * currgroup = "";
   *group = 0;
   *name = 0;
 
-  for(int i=0; i<logsLen; i++) {
-    if (logs[i].type & LOG_GROUP) {
-      if (logs[i].type & LOG_START) {
-        currgroup = logs[i].name;
-      }
-    }
-
-    if (i == varid) {
-      *group = currgroup;
-      *name = logs[i].name;
-      break;
-    }
+  if (varid < logsLen) {
+    *group = groupGetName(varid);
+    *name = logs[varid].name;
   }
 }
 
@@ -1020,48 +1827,40 @@ uint8_t logVarSize(int type)
   return typeLength[type];
 }
 
-int logGetInt(logVarId_t varid)
+/* Reads a variable like a log block does, by function or from memory */
+static void logGetValue(logVarId_t varid, int *valuei, float *valuef)
 {
-  int valuei = 0;
-
   ASSERT(LOG_VARID_IS_VALID(varid));
 
-  switch(logs[varid].type)
-  {
-    case LOG_UINT8:
-      valuei = *(uint8_t *)logs[varid].address;
-      break;
-    case LOG_INT8:
-      valuei = *(int8_t *)logs[varid].address;
-      break;
-    case LOG_UINT16:
-      valuei = *(uint16_t *)logs[varid].address;
-      break;
-    case LOG_INT16:
-      valuei = *(int16_t *)logs[varid].address;
-      break;
-    case LOG_UINT32:
-      valuei = *(uint32_t *)logs[varid].address;
-      break;
-    case LOG_INT32:
-      valuei = *(int32_t *)logs[varid].address;
-      break;
-    case LOG_FLOAT:
-      valuei = *(float *)logs[varid].address;
-      break;
-  }
+  const struct log_ops ops = {
+    .storageType = logs[varid].type & ~LOG_BY_FUNCTION,
+    .variable = logs[varid].address,
+    .acquisitionType = acquisitionTypeFromLogType(logs[varid].type),
+  };
+  uint32_t raw;
+
+  logAcquireValue(&ops, ((long long)xTaskGetTickCount())/portTICK_RATE_MS, &raw);
+  logConvertValue(&ops, &raw, valuei, valuef);
+}
+
+int logGetInt(logVarId_t varid)
+{
+  int valuei;
+  float valuef;
+
+  logGetValue(varid, &valuei, &valuef);
 
   return valuei;
 }
 
 float logGetFloat(logVarId_t varid)
 {
-  ASSERT(LOG_VARID_IS_VALID(varid));
+  int valuei;
+  float valuef;
 
-  if (logs[varid].type == LOG_FLOAT)
-    return *(float *)logs[varid].address;
+  logGetValue(varid, &valuei, &valuef);
 
-  return logGetInt(varid);
+  return valuef;
 }
 
 unsigned int logGetUint(logVarId_t varid)
@@ -1076,3 +1875,17 @@ static acquisitionType_t acquisitionTypeFromLogType(uint8_t logType) {
 
   return acqType_memory;
 }
+
+PARAM_GROUP_START(log)
+PARAM_ADD(PARAM_UINT8, adaptive, &logAdaptiveParam)
+PARAM_GROUP_STOP(log)
+
+/**
+ * The divisor of the log block rates, the samples skipped because of it and
+ * how often it was raised.
+ */
+LOG_GROUP_START(log)
+LOG_ADD(LOG_UINT8, rateDiv, &logRateDivisor)
+LOG_ADD(LOG_UINT32, skipped, &logSkippedCount)
+LOG_ADD(LOG_UINT32, congested, &logCongestionCount)
+LOG_GROUP_STOP(log)
@@ -46,6 +46,7 @@
 #include "log.h"
 #include "param.h"
 #include "static_mem.h"
+#include "stm32_legacy.h"
 
 #if 0
 #define MEM_DEBUG(fmt, ...) DEBUG_PRINT("D/log " fmt, ## __VA_ARGS__)
@@ -62,12 +63,60 @@
 #define MEM_SETTINGS_CH     0
 #define MEM_READ_CH         1
 #define MEM_WRITE_CH        2
+#define MEM_STREAM_CH       3
 
 #define MEM_CMD_GET_NBR     1
 #define MEM_CMD_GET_INFO    2
 
 #define STATUS_OK 0
 
+/*
+ * A read on MEM_READ_CH is [memId][addr:4][len], answered with
+ * [memId][addr:4][status][data]. A 16 bit length, [memId][addr:4][len:2],
+ * may ask for more than a CRTP packet holds: with CONFIG_CRTP_LARGE_FRAMES
+ * the answer comes in a single large frame, if the client asked the link for
+ * frames that large, see crtpGetMaxDataSize(). Else it fails with EIO.
+ */
+// The handlers take a one byte length, a large read is cut in chunks of this
+#define MEM_LARGE_READ_CHUNK 240
+
+/*
+ * Windowed transfers on MEM_STREAM_CH. A range of a memory is cut in chunks
+ * of MEM_STREAM_CHUNK_LEN bytes, chunk n starts at addr + n * MEM_STREAM_CHUNK_LEN.
+ * Up to window chunks are in flight, they are sent back to back without
+ * waiting for a reply each.
+ *
+ * [READ][memId][addr:4][len:4][window]   Host: stream the range to me
+ * [WRITE][memId][addr:4][len:4][window]  Host: I stream the range to you
+ * [DATA][seq:2][data]                    Chunk seq, from the side that streams
+ * [ACK][seq:2][mask:4]                   From the receiver: all chunks before
+ *                                        seq are in, bit i of mask for chunk
+ *                                        seq + 1 + i
+ * [STOP]                                 Host: abort the transfer
+ * [DONE][status]                         All chunks are in, or the transfer
+ *                                        failed with an errno
+ *
+ * On a read the host acks every few chunks, the chunks missing before the
+ * highest acked one are sent again right away. On a write the firmware acks
+ * every half window and as soon as it sees a gap. Chunks that arrive out of
+ * order are buffered, the memory is always written in order. When the other
+ * side stays silent for MEM_STREAM_TIMEOUT_MS, the unacked chunks are sent
+ * again, or the last ack, MEM_STREAM_MAX_RETRIES times at most.
+ */
+#define MEM_STREAM_CMD_READ   0
+#define MEM_STREAM_CMD_WRITE  1
+#define MEM_STREAM_CMD_ACK    2
+#define MEM_STREAM_CMD_DATA   3
+#define MEM_STREAM_CMD_STOP   4
+#define MEM_STREAM_CMD_DONE   5
+
+#define MEM_STREAM_CHUNK_LEN   (CRTP_MAX_DATA_SIZE - 3)
+#define MEM_STREAM_MAX_WINDOW  32
+#define MEM_STREAM_TIMEOUT_MS  200
+#define MEM_STREAM_MAX_RETRIES 10
+// While the TX queue of the memory class is full
+#define MEM_STREAM_POLL_MS     2
+
 #define MEM_TESTER_SIZE            0x1000
 
 //Private functions
@@ -75,6 +124,8 @@ static void memTask(void * prm);
 static void memSettingsProcess(CRTPPacket* p);
 static void memWriteProcess(CRTPPacket* p);
 static void memReadProcess(CRTPPacket* p);
+static void memStreamProcess(const CRTPPacket* p);
+static void memStreamRun(void);
 static void createNbrResponse(CRTPPacket* p);
 static void createInfoResponse(CRTPPacket* p, uint8_t memId);
 static void createInfoResponseBody(CRTPPacket* p, uint8_t type, uint32_t memSize, const uint8_t data[8]);
@@ -97,6 +148,33 @@ static bool registrationEnabled = true;
 static uint8_t nbrOwMems = 0;
 static const uint8_t NoSerialNr[MEMORY_SERIAL_LENGTH] = {0, 0, 0, 0, 0, 0, 0, 0};
 static CRTPPacket packet;
+#ifdef CONFIG_CRTP_LARGE_FRAMES
+static uint8_t largeReadReply[CRTP_LARGE_MAX_DATA_SIZE];
+#endif
+
+typedef struct {
+  bool isActive;
+  bool isWrite;
+  uint8_t memId;
+  uint32_t addr;
+  uint32_t len;
+  uint16_t chunkCount;
+  uint8_t window;
+  uint16_t base;        // First chunk that is not acked, or not written
+  uint16_t next;        // Next chunk that was never sent, reads only
+  uint32_t mask;        // Bit i for chunk base + 1 + i
+  uint8_t sinceAck;     // Chunks received since the last ack, writes only
+  TickType_t lastActivity;
+  uint8_t retries;
+} memStream_t;
+
+static memStream_t stream;
+static CRTPPacket streamPacket;
+// Chunks of a write that came before the ones they follow
+static uint8_t streamBuffer[MEM_STREAM_MAX_WINDOW][MEM_STREAM_CHUNK_LEN];
+
+static uint32_t streamResentCount = 0;
+static uint32_t streamTimeoutCount = 0;
 
 #define MAX_NR_HANDLERS 20
 static const MemoryHandlerDef_t* handlers[MAX_NR_HANDLERS];
@@ -114,7 +192,7 @@ void memInit(void)
   memoryRegisterHandler(&memTesterDef);
 
   //Start the mem task
-  STATIC_MEM_TASK_CREATE(memTask, memTask, MEM_TASK_NAME, NULL, MEM_TASK_PRI);
+  STATIC_MEM_TASK_CREATE_PINNED(memTask, memTask, MEM_TASK_NAME, NULL, MEM_TASK_PRI, MEM_TASK_CORE);
 
   isInit = true;
 }
@@ -158,22 +236,31 @@ static void memTask(void* param) {
   registrationEnabled = false;
 
 	while(1) {
-		crtpReceivePacketBlock(CRTP_PORT_MEM, &packet);
-
-		switch (packet.channel) {
-      case MEM_SETTINGS_CH:
-        memSettingsProcess(&packet);
-        break;
-      case MEM_READ_CH:
-        memReadProcess(&packet);
-        break;
-      case MEM_WRITE_CH:
-        memWriteProcess(&packet);
-        break;
-      default:
-        // Do nothing
-        break;
+    const int wait = stream.isActive ? M2T(MEM_STREAM_POLL_MS) : portMAX_DELAY;
+
+		if (crtpReceivePacketWait(CRTP_PORT_MEM, &packet, wait) == pdTRUE) {
+		  switch (packet.channel) {
+        case MEM_SETTINGS_CH:
+          memSettingsProcess(&packet);
+          break;
+        case MEM_READ_CH:
+          memReadProcess(&packet);
+          break;
+        case MEM_WRITE_CH:
+          memWriteProcess(&packet);
+          break;
+        case MEM_STREAM_CH:
+          memStreamProcess(&packet);
+          break;
+        default:
+          // Do nothing
+          break;
+		  }
 		}
+
+    if (stream.isActive) {
+      memStreamRun();
+    }
 	}
 }
 
@@ -202,7 +289,7 @@ static void createNbrResponse(CRTPPacket* p) {
   p->header = CRTP_HEADER(CRTP_PORT_MEM, MEM_SETTINGS_CH);
   p->size = 2;
   p->data[0] = MEM_CMD_GET_NBR;
-  p->data[1] = 0;//nbrOwMems + OW_FIRST_ID;
+  p->data[1] = nrOfHandlers + nbrOwMems;
 }
 
 static void createInfoResponse(CRTPPacket* p, uint8_t memId) {
@@ -213,7 +300,7 @@ static void createInfoResponse(CRTPPacket* p, uint8_t memId) {
 
   if (memId < nrOfHandlers) {
     createInfoResponseBody(p, handlers[memId]->type, handlers[memId]->getSize(), NoSerialNr);
-  } else {
+  } else if (memId < nrOfHandlers + nbrOwMems) {
     const uint8_t selectedMem = memId - nrOfHandlers;
     uint8_t serialNr[MEMORY_SERIAL_LENGTH];
 
@@ -236,6 +323,58 @@ static void createInfoResponseBody(CRTPPacket* p, uint8_t type, uint32_t memSize
 }
 
 
+static bool memRead(uint8_t memId, uint32_t memAddr, uint8_t readLen, uint8_t* buffer) {
+  if (memId < nrOfHandlers) {
+    if (handlers[memId]->read) {
+      return handlers[memId]->read(memAddr, readLen, buffer);
+    }
+  } else if (memId < nrOfHandlers + nbrOwMems) {
+    uint8_t selectedMem = memId - nrOfHandlers;
+    return owMemHandler->read(selectedMem, memAddr, readLen, buffer);
+  }
+
+  return false;
+}
+
+static bool memWrite(uint8_t memId, uint32_t memAddr, uint8_t writeLen, const uint8_t* buffer) {
+  if (memId < nrOfHandlers) {
+    if (handlers[memId]->write) {
+      return handlers[memId]->write(memAddr, writeLen, buffer);
+    }
+  } else if (memId < nrOfHandlers + nbrOwMems) {
+    uint8_t selectedMem = memId - nrOfHandlers;
+    return owMemHandler->write(selectedMem, memAddr, writeLen, buffer);
+  }
+
+  return false;
+}
+
+#ifdef CONFIG_CRTP_LARGE_FRAMES
+/* Answers a read too large for a CRTP packet, p holds the request */
+static void memReadLargeProcess(CRTPPacket* p, uint8_t memId, uint32_t memAddr, uint16_t readLen) {
+  bool result = (6 + readLen <= crtpGetMaxDataSize());
+
+  for (uint16_t offset = 0; result && offset < readLen; offset += MEM_LARGE_READ_CHUNK) {
+    const uint16_t left = readLen - offset;
+
+    result = memRead(memId, memAddr + offset, left < MEM_LARGE_READ_CHUNK ? left : MEM_LARGE_READ_CHUNK,
+                     &largeReadReply[6 + offset]);
+  }
+
+  if (!result) {
+    p->data[5] = EIO;
+    p->size = 6;
+    crtpSendPacket(p);
+    return;
+  }
+
+  memcpy(largeReadReply, p->data, 5);
+  largeReadReply[5] = STATUS_OK;
+  // Lost if the link is busy, the client asks again
+  crtpSendLargePacket(p->header, largeReadReply, 6 + readLen);
+}
+#endif
+
 static void memReadProcess(CRTPPacket* p) {
   uint32_t memAddr;
   bool result = false;
@@ -245,16 +384,22 @@ static void memReadProcess(CRTPPacket* p) {
 
   uint8_t memId = p->data[0];
   memcpy(&memAddr, &p->data[1], 4);
-  uint8_t readLen = p->data[5];
+  uint16_t readLen = p->data[5];
   uint8_t* startOfData = &p->data[6];
 
-  if (memId < nrOfHandlers) {
-    if (handlers[memId]->read) {
-      result = handlers[memId]->read(memAddr, readLen, startOfData);
-    }
-  } else {
-    uint8_t selectedMem = memId - nrOfHandlers;
-    result = owMemHandler->read(selectedMem, memAddr, readLen, startOfData);
+  if (p->size >= 7) {
+    readLen |= p->data[6] << 8;
+  }
+
+#ifdef CONFIG_CRTP_LARGE_FRAMES
+  if (readLen > MEM_MAX_LEN - 6) {
+    memReadLargeProcess(p, memId, memAddr, readLen);
+    return;
+  }
+#endif
+
+  if (readLen <= MEM_MAX_LEN - 6) {
+    result = memRead(memId, memAddr, readLen, startOfData);
   }
 
   p->data[5] = result ? STATUS_OK : EIO;
@@ -281,14 +426,7 @@ static void memWriteProcess(CRTPPacket* p) {
   p->header = CRTP_HEADER(CRTP_PORT_MEM, MEM_WRITE_CH);
   // Dont' touch the first 5 bytes, they will be the same.
 
-  if (memId < nrOfHandlers) {
-    if (handlers[memId]->write) {
-      result = handlers[memId]->write(memAddr, writeLen, startOfData);
-    }
-  } else {
-    uint8_t selectedMem = memId - nrOfHandlers;
-    result = owMemHandler->write(selectedMem, memAddr, writeLen, startOfData);
-  }
+  result = memWrite(memId, memAddr, writeLen, startOfData);
 
   p->data[5] = result ? STATUS_OK : EIO;
   p->size = 6;
@@ -296,6 +434,244 @@ static void memWriteProcess(CRTPPacket* p) {
   crtpSendPacket(p);
 }
 
+static uint8_t memStreamChunkLen(uint16_t seq) {
+  const uint32_t offset = (uint32_t)seq * MEM_STREAM_CHUNK_LEN;
+  const uint32_t left = stream.len - offset;
+
+  return left < MEM_STREAM_CHUNK_LEN ? left : MEM_STREAM_CHUNK_LEN;
+}
+
+static bool memStreamSend(uint8_t size) {
+  streamPacket.header = CRTP_HEADER(CRTP_PORT_MEM, MEM_STREAM_CH);
+  streamPacket.size = size;
+
+  return crtpSendPacket(&streamPacket) == pdTRUE;
+}
+
+static void memStreamDone(uint8_t status) {
+  stream.isActive = false;
+
+  streamPacket.data[0] = MEM_STREAM_CMD_DONE;
+  streamPacket.data[1] = status;
+  memStreamSend(2);
+}
+
+static bool memStreamSendAck(void) {
+  streamPacket.data[0] = MEM_STREAM_CMD_ACK;
+  memcpy(&streamPacket.data[1], &stream.base, 2);
+  memcpy(&streamPacket.data[3], &stream.mask, 4);
+
+  return memStreamSend(7);
+}
+
+/* Reads chunk seq into the stream packet and sends it, false if the link is busy */
+static bool memStreamSendChunk(uint16_t seq) {
+  const uint8_t len = memStreamChunkLen(seq);
+
+  if (crtpGetFreeTxQueuePacketsOfPort(CRTP_PORT_MEM) == 0) {
+    return false;
+  }
+
+  streamPacket.data[0] = MEM_STREAM_CMD_DATA;
+  memcpy(&streamPacket.data[1], &seq, 2);
+  if (!memRead(stream.memId, stream.addr + (uint32_t)seq * MEM_STREAM_CHUNK_LEN, len, &streamPacket.data[3])) {
+    memStreamDone(EIO);
+    return false;
+  }
+
+  return memStreamSend(3 + len);
+}
+
+static void memStreamStart(const CRTPPacket* p, bool isWrite) {
+  uint32_t addr;
+  uint32_t len;
+  const uint8_t memId = p->data[1];
+  const uint8_t window = p->data[10];
+
+  if (p->size < 11) {
+    memStreamDone(EINVAL);
+    return;
+  }
+  memcpy(&addr, &p->data[2], 4);
+  memcpy(&len, &p->data[6], 4);
+
+  if (memId >= nrOfHandlers + nbrOwMems) {
+    memStreamDone(ENOENT);
+    return;
+  }
+  // Longer transfers are split by the host
+  if (len == 0 || (len + MEM_STREAM_CHUNK_LEN - 1) / MEM_STREAM_CHUNK_LEN > UINT16_MAX) {
+    memStreamDone(EINVAL);
+    return;
+  }
+
+  stream = (memStream_t) {
+    .isActive = true,
+    .isWrite = isWrite,
+    .memId = memId,
+    .addr = addr,
+    .len = len,
+    .chunkCount = (len + MEM_STREAM_CHUNK_LEN - 1) / MEM_STREAM_CHUNK_LEN,
+    .window = window == 0 ? 1 : (window > MEM_STREAM_MAX_WINDOW ? MEM_STREAM_MAX_WINDOW : window),
+    .lastActivity = xTaskGetTickCount(),
+  };
+
+  if (isWrite) {
+    // Ready for the first chunks
+    memStreamSendAck();
+  }
+}
+
+/* The host acked the chunks of a read */
+static void memStreamReadAck(uint16_t seq, uint32_t mask) {
+  if (seq < stream.base || seq > stream.next) {
+    // An old ack
+    return;
+  }
+  stream.base = seq;
+  stream.mask = mask;
+
+  if (stream.base == stream.chunkCount) {
+    memStreamDone(STATUS_OK);
+    return;
+  }
+
+  // Send the gaps before the highest acked chunk again
+  if (mask != 0) {
+    const int highest = 31 - __builtin_clz(mask);
+
+    for (int i = -1; i < highest; i++) {
+      if (i < 0 || !(mask & (1u << i))) {
+        if (!memStreamSendChunk(stream.base + 1 + i)) {
+          break;
+        }
+        streamResentCount++;
+      }
+    }
+  }
+}
+
+/* The host sent a chunk of a write */
+static void memStreamWriteData(uint16_t seq, const uint8_t* data, uint8_t len) {
+  const uint16_t offset = seq - stream.base;
+
+  if (seq >= stream.chunkCount || len != memStreamChunkLen(seq)) {
+    memStreamDone(EINVAL);
+    return;
+  }
+  if (seq < stream.base || offset >= stream.window) {
+    // Sent again before our ack arrived, or too far ahead
+    memStreamSendAck();
+    return;
+  }
+
+  if (offset > 0) {
+    memcpy(streamBuffer[seq % MEM_STREAM_MAX_WINDOW], data, len);
+    stream.mask |= 1u << (offset - 1);
+    // A gap, ask for it right away
+    memStreamSendAck();
+    stream.sinceAck = 0;
+    return;
+  }
+
+  // Chunk base, write it and the buffered ones that follow
+  const uint8_t* chunk = data;
+  while (1) {
+    if (!memWrite(stream.memId, stream.addr + (uint32_t)stream.base * MEM_STREAM_CHUNK_LEN, memStreamChunkLen(stream.base), chunk)) {
+      memStreamDone(EIO);
+      return;
+    }
+
+    const bool isNextBuffered = stream.mask & 1;
+    stream.base++;
+    stream.mask >>= 1;
+    if (!isNextBuffered || stream.base == stream.chunkCount) {
+      break;
+    }
+    chunk = streamBuffer[stream.base % MEM_STREAM_MAX_WINDOW];
+  }
+
+  if (stream.base == stream.chunkCount) {
+    memStreamDone(STATUS_OK);
+  } else if (++stream.sinceAck >= (stream.window + 1) / 2) {
+    memStreamSendAck();
+    stream.sinceAck = 0;
+  }
+}
+
+static void memStreamProcess(const CRTPPacket* p) {
+  uint16_t seq;
+  uint32_t mask;
+
+  if (p->size < 1) {
+    return;
+  }
+
+  switch (p->data[0]) {
+    case MEM_STREAM_CMD_READ:
+    case MEM_STREAM_CMD_WRITE:
+      memStreamStart(p, p->data[0] == MEM_STREAM_CMD_WRITE);
+      return;
+    case MEM_STREAM_CMD_STOP:
+      stream.isActive = false;
+      return;
+    default:
+      break;
+  }
+
+  if (!stream.isActive || p->size < 3) {
+    return;
+  }
+  memcpy(&seq, &p->data[1], 2);
+  stream.lastActivity = xTaskGetTickCount();
+  stream.retries = 0;
+
+  if (p->data[0] == MEM_STREAM_CMD_ACK && !stream.isWrite && p->size >= 7) {
+    memcpy(&mask, &p->data[3], 4);
+    memStreamReadAck(seq, mask);
+  } else if (p->data[0] == MEM_STREAM_CMD_DATA && stream.isWrite) {
+    memStreamWriteData(seq, &p->data[3], p->size - 3);
+  }
+}
+
+/* Sends the new chunks of a read and handles the timeouts */
+static void memStreamRun(void) {
+  if (!stream.isWrite) {
+    while (stream.isActive && stream.next < stream.chunkCount && stream.next - stream.base < stream.window) {
+      if (!memStreamSendChunk(stream.next)) {
+        break;
+      }
+      stream.next++;
+    }
+  }
+
+  if (!stream.isActive || xTaskGetTickCount() - stream.lastActivity < M2T(MEM_STREAM_TIMEOUT_MS)) {
+    return;
+  }
+
+  streamTimeoutCount++;
+  if (++stream.retries > MEM_STREAM_MAX_RETRIES) {
+    memStreamDone(ETIMEDOUT);
+    return;
+  }
+  stream.lastActivity = xTaskGetTickCount();
+
+  if (stream.isWrite) {
+    memStreamSendAck();
+  } else {
+    // Everything that is not acked
+    for (uint16_t seq = stream.base; seq < stream.next; seq++) {
+      if (seq != stream.base && (stream.mask & (1u << (seq - stream.base - 1)))) {
+        continue;
+      }
+      if (!memStreamSendChunk(seq)) {
+        break;
+      }
+      streamResentCount++;
+    }
+  }
+}
+
 /**
  * @brief The memory tester is used to verify the functionality of the memory sub system.
  * It supports "virtual" read and writes that are used by a test script to
@@ -359,3 +735,11 @@ PARAM_GROUP_STOP(memTst)
 LOG_GROUP_START(memTst)
   LOG_ADD(LOG_UINT32, errCntW, &memTesterWriteErrorCount)
 LOG_GROUP_STOP(memTst)
+
+/**
+ * Chunks of windowed transfers sent again, and timeouts of the other side
+ */
+LOG_GROUP_START(memStream)
+  LOG_ADD(LOG_UINT32, resent, &streamResentCount)
+  LOG_ADD(LOG_UINT32, timeouts, &streamTimeoutCount)
+LOG_GROUP_STOP(memStream)
@@ -30,9 +30,11 @@
  *  - http://www.multiwii.com/forum/viewtopic.php?f=8&t=1516
  */
 
+#include <string.h>
+
 #include "msp.h"
-#include "sensfusion6.h"
 #include "commander.h"
+#include "pm_esplane.h"
 #define DEBUG_MODULE "MSP"
 #include "debug_cf.h"
 
@@ -40,6 +42,8 @@
 #define MSP_STATUS    101
 #define MSP_RC        105
 #define MSP_ATTITUDE  108
+#define MSP_ALTITUDE  109
+#define MSP_ANALOG    110
 #define MSP_BOXIDS    119
 
 // Misc MSP header defines
@@ -94,21 +98,101 @@ typedef struct _MspRc
   uint16_t throttle;  // Range [1000,2000] 
 }__attribute__((packed)) MspRc;
 
+typedef struct _MspAltitude
+{
+  int32_t estimatedAltitude; // Units: cm
+  int16_t vario;             // Units: cm/s
+}__attribute__((packed)) MspAltitude;
+
+typedef struct _MspAnalog
+{
+  uint8_t vbat;           // Units: 1/10th volts
+  uint16_t powerMeterSum; // Units: mAh drawn
+  uint16_t rssi;          // Range [0,1023]
+  int16_t amperage;       // Units: 1/100th amps
+}__attribute__((packed)) MspAnalog;
+
+#define MSP_CACHED_PAYLOAD_MAX  sizeof(MspStatus)
+
+/**
+ * A response frame, header, data and CRC, serialized by the stabilizer.
+ * The stabilizer writes the back buffer while the requests are answered
+ * from the front one. The sequence is odd while the back buffer is written
+ * and counts two per frame: a copy of the front buffer only tears if the
+ * stabilizer published one frame and started the next during the copy.
+ */
+typedef struct
+{
+  uint8_t frame[2][sizeof(MspHeader) + MSP_CACHED_PAYLOAD_MAX + 1];
+  uint8_t frameSize[2];
+  uint32_t sequence;
+} MspCachedFrame;
+
+static MspCachedFrame mspStatusCache;
+static MspCachedFrame mspAttitudeCache;
+static MspCachedFrame mspAltitudeCache;
+static MspCachedFrame mspAnalogCache;
+static bool isCacheActive;
+
 // Helpers
 static uint8_t mspComputeCrc(uint8_t* pBuffer, uint32_t bufferLen);
 static bool mspIsRequestValid(MspObject* pMspObject);
 static void mspProcessRequest(MspObject* pMspObject);
+static void mspCacheWrite(MspCachedFrame* pCache, const uint8_t command, const void* pData, const uint8_t size);
+static bool mspCacheRead(MspCachedFrame* pCache, MspObject* pMspObject);
 
 // Request handlers
-static void mspHandleRequestMspStatus(MspObject* pMspObject);
 static void mspHandleRequestMspRc(MspObject* pMspObject);
-static void mspHandleRequestMspAttitude(MspObject* pMspObject);
 static void mspHandleRequestMspBoxIds(MspObject* pMspObject);
 
 void mspInit(MspObject* pMspObject, const MspResponseCallback callback)
 {
   pMspObject->requestState = MSP_REQUEST_STATE_WAIT_FOR_START;
   pMspObject->responseCallback = callback;
+
+  __atomic_store_n(&isCacheActive, true, __ATOMIC_RELAXED);
+}
+
+void mspUpdateCache(const state_t *state, const uint32_t tick)
+{
+  if(!__atomic_load_n(&isCacheActive, __ATOMIC_RELAXED) || !RATE_DO_EXECUTE(MSP_CACHE_RATE, tick))
+  {
+    return;
+  }
+
+  const MspStatus status =
+  {
+    .cycleTime = 1000000 / RATE_MAIN_LOOP,
+    .i2cErrors = 0, // unused
+    .sensors = 0x0001, // no sensors supported yet, but need to report at least one to get the level bars to show
+    .flags = 0x00000001, // always report armed (bit zero)
+    .currentSet = 0x00,
+  };
+  mspCacheWrite(&mspStatusCache, MSP_STATUS, &status, sizeof(status));
+
+  const MspAttitude attitude =
+  {
+    .angX = (int16_t)(state->attitude.roll * 10),
+    .angY = (int16_t)(state->attitude.pitch * 10),
+    .heading = (int16_t)state->attitude.yaw, // of the estimate, no mag support
+  };
+  mspCacheWrite(&mspAttitudeCache, MSP_ATTITUDE, &attitude, sizeof(attitude));
+
+  const MspAltitude altitude =
+  {
+    .estimatedAltitude = (int32_t)(state->position.z * 100),
+    .vario = (int16_t)(state->velocity.z * 100),
+  };
+  mspCacheWrite(&mspAltitudeCache, MSP_ALTITUDE, &altitude, sizeof(altitude));
+
+  const MspAnalog analog =
+  {
+    .vbat = (uint8_t)(pmGetBatteryVoltage() * 10),
+    .powerMeterSum = 0, // no current sensor
+    .rssi = 0,
+    .amperage = 0,
+  };
+  mspCacheWrite(&mspAnalogCache, MSP_ANALOG, &analog, sizeof(analog));
 }
 
 void mspProcessByte(MspObject* pMspObject, const uint8_t data)
@@ -187,6 +271,55 @@ uint8_t mspComputeCrc(uint8_t* pBuffer, uint32_t bufferLen)
   return crc;
 }
 
+void mspCacheWrite(MspCachedFrame* pCache, const uint8_t command, const void* pData, const uint8_t size)
+{
+  const uint32_t sequence = pCache->sequence;
+  const int back = ((sequence >> 1) + 1) & 1;
+  uint8_t* pFrame = pCache->frame[back];
+  MspHeader* pHeader = (MspHeader*)pFrame;
+
+  __atomic_store_n(&pCache->sequence, sequence + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  // Header
+  pHeader->preamble[0] = MSP_PREAMBLE_0;
+  pHeader->preamble[1] = MSP_PREAMBLE_1;
+  pHeader->direction = MSP_DIRECTION_OUT;
+  pHeader->size = size;
+  pHeader->command = command;
+
+  // Data
+  memcpy(pFrame + sizeof(MspHeader), pData, size);
+
+  // CRC
+  pFrame[sizeof(MspHeader) + size] = mspComputeCrc(pFrame, sizeof(pCache->frame[back]));
+
+  pCache->frameSize[back] = sizeof(MspHeader) + size + 1;
+  __atomic_store_n(&pCache->sequence, sequence + 2, __ATOMIC_RELEASE);
+}
+
+bool mspCacheRead(MspCachedFrame* pCache, MspObject* pMspObject)
+{
+  uint32_t published;
+
+  do
+  {
+    published = __atomic_load_n(&pCache->sequence, __ATOMIC_ACQUIRE) & ~1u;
+    if(published == 0)
+    {
+      // Not serialized yet
+      return false;
+    }
+
+    const int front = (published >> 1) & 1;
+    pMspObject->mspResponseSize = pCache->frameSize[front];
+    memcpy(pMspObject->mspResponse, pCache->frame[front], sizeof(pCache->frame[front]));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  } while(__atomic_load_n(&pCache->sequence, __ATOMIC_RELAXED) - published > 2);
+
+  return true;
+}
+
 bool mspIsRequestValid(MspObject* pMspObject)
 {
   if(pMspObject->requestHeader.preamble[0] != MSP_PREAMBLE_0 ||
@@ -233,9 +366,7 @@ void mspProcessRequest(MspObject* pMspObject)
   switch(pMspObject->requestHeader.command)
   {
   case MSP_STATUS:
-    mspHandleRequestMspStatus(pMspObject);
-
-    if(pMspObject->responseCallback)
+    if(mspCacheRead(&mspStatusCache, pMspObject) && pMspObject->responseCallback)
     {
       pMspObject->responseCallback(pMspObject->mspResponse, pMspObject->mspResponseSize);
     }
@@ -251,9 +382,21 @@ void mspProcessRequest(MspObject* pMspObject)
     break;
 
   case MSP_ATTITUDE:
-    mspHandleRequestMspAttitude(pMspObject);
+    if(mspCacheRead(&mspAttitudeCache, pMspObject) && pMspObject->responseCallback)
+    {
+      pMspObject->responseCallback(pMspObject->mspResponse, pMspObject->mspResponseSize);
+    }
+    break;
 
-    if(pMspObject->responseCallback)
+  case MSP_ALTITUDE:
+    if(mspCacheRead(&mspAltitudeCache, pMspObject) && pMspObject->responseCallback)
+    {
+      pMspObject->responseCallback(pMspObject->mspResponse, pMspObject->mspResponseSize);
+    }
+    break;
+
+  case MSP_ANALOG:
+    if(mspCacheRead(&mspAnalogCache, pMspObject) && pMspObject->responseCallback)
     {
       pMspObject->responseCallback(pMspObject->mspResponse, pMspObject->mspResponseSize);
     }
@@ -274,33 +417,6 @@ void mspProcessRequest(MspObject* pMspObject)
   }
 }
 
-void mspHandleRequestMspStatus(MspObject* pMspObject)
-{
-  MspHeader* pHeader = (MspHeader*)pMspObject->mspResponse;
-  MspStatus* pData = (MspStatus*)(pMspObject->mspResponse + sizeof(MspHeader));
-  uint8_t* pCrc = (uint8_t*)(pMspObject->mspResponse + sizeof(MspHeader) + sizeof(*pData));
-
-  // Header
-  pHeader->preamble[0] = MSP_PREAMBLE_0;
-  pHeader->preamble[1] = MSP_PREAMBLE_1;
-  pHeader->direction = MSP_DIRECTION_OUT;
-  pHeader->size = sizeof(*pData);
-  pHeader->command = MSP_STATUS;
-
-  // Data
-  pData->cycleTime = 1000; // TODO: API to query this?
-  pData->i2cErrors = 0; // unused
-  pData->sensors = 0x0001; // no sensors supported yet, but need to report at least one to get the level bars to show
-  pData->flags = 0x00000001; // always report armed (bit zero)
-  pData->currentSet = 0x00;
-
-  // CRC
-  *pCrc = mspComputeCrc(pMspObject->mspResponse, sizeof(pMspObject->mspResponse));
-
-  // Update total response size
-  pMspObject->mspResponseSize = sizeof(MspHeader) + sizeof(*pData) + 1;
-}
-
 void mspHandleRequestMspRc(MspObject* pMspObject)
 {
   MspHeader* pHeader = (MspHeader*)pMspObject->mspResponse;
@@ -327,36 +443,6 @@ void mspHandleRequestMspRc(MspObject* pMspObject)
   pMspObject->mspResponseSize = sizeof(MspHeader) + sizeof(*pData) + 1;
 }
 
-static void mspHandleRequestMspAttitude(MspObject* pMspObject)
-{
-  MspHeader* pHeader = (MspHeader*)pMspObject->mspResponse;
-  MspAttitude* pData = (MspAttitude*)(pMspObject->mspResponse + sizeof(MspHeader));
-  uint8_t* pCrc = (uint8_t*)(pMspObject->mspResponse + sizeof(MspHeader) + sizeof(*pData));
-
-  // Header
-  pHeader->preamble[0] = MSP_PREAMBLE_0;
-  pHeader->preamble[1] = MSP_PREAMBLE_1;
-  pHeader->direction = MSP_DIRECTION_OUT;
-  pHeader->size = sizeof(*pData);
-  pHeader->command = MSP_ATTITUDE;
-
-  // Data
-  float roll;
-  float pitch;
-  float yaw;
-  sensfusion6GetEulerRPY(&roll, &pitch, &yaw); // TODO: handle kalman estimator
-
-  pData->angX = (int16_t)(roll * 10);
-  pData->angY = (int16_t)(pitch * 10);
-  pData->heading = 0; // TODO: mag support
-
-  // CRC
-  *pCrc = mspComputeCrc(pMspObject->mspResponse, sizeof(pMspObject->mspResponse));
-
-  // Update total response size
-  pMspObject->mspResponseSize = sizeof(MspHeader) + sizeof(*pData) + 1;
-}
-
 static void mspHandleRequestMspBoxIds(MspObject* pMspObject)
 {
   MspHeader* pHeader = (MspHeader*)pMspObject->mspResponse;
@@ -0,0 +1,152 @@
+/**
+ *
+ * ESP-Drone Firmware
+ *
+ * Copyright 2019-2020  Espressif Systems (Shanghai)
+ * Copyright (C) 2011-2012 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * obstacle_map.c - Polar occupancy grid around the drone
+ */
+
+#include <math.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "obstacle_map.h"
+#include "log.h"
+
+#define SECTOR_WIDTH (2.0f * (float)M_PI / OBSTACLE_MAP_SECTORS)
+
+// Log-odds increments, a single hit makes a bin occupied so that a new
+// obstacle is reported within one sensor period
+#define OCC_HIT        3
+#define OCC_FREE       1
+#define OCC_MAX        8
+#define OCC_THRESHOLD  0
+
+static bool isInit;
+
+static int8_t occupancy[OBSTACLE_MAP_SECTORS][OBSTACLE_MAP_BINS];
+static uint16_t sectorRange[OBSTACLE_MAP_SECTORS];
+static uint16_t nearestRange;
+
+static portMUX_TYPE mapLock = portMUX_INITIALIZER_UNLOCKED;
+
+void obstacleMapInit(void)
+{
+  if (isInit) {
+    return;
+  }
+
+  for (int i = 0; i < OBSTACLE_MAP_SECTORS; i++) {
+    sectorRange[i] = OBSTACLE_MAP_NONE;
+  }
+  nearestRange = OBSTACLE_MAP_NONE;
+
+  isInit = true;
+}
+
+static int sectorOf(float bearing)
+{
+  int sector = (int)floorf(bearing / SECTOR_WIDTH + 0.5f) % OBSTACLE_MAP_SECTORS;
+
+  return sector < 0 ? sector + OBSTACLE_MAP_SECTORS : sector;
+}
+
+static uint16_t sectorNearest(const int8_t *bins)
+{
+  for (int bin = 0; bin < OBSTACLE_MAP_BINS; bin++) {
+    if (bins[bin] > OCC_THRESHOLD) {
+      return bin * OBSTACLE_MAP_BIN_MM;
+    }
+  }
+
+  return OBSTACLE_MAP_NONE;
+}
+
+void obstacleMapUpdate(float bearing, float fov, uint16_t rangeMm)
+{
+  // The sensor only reports the nearest target in its cone, so everything
+  // closer is free and the target may be anywhere in the cone
+  const int first = sectorOf(bearing - fov / 2);
+  const int count = (sectorOf(bearing + fov / 2) - first + OBSTACLE_MAP_SECTORS) % OBSTACLE_MAP_SECTORS + 1;
+  const int hitBin = rangeMm < OBSTACLE_MAP_MAX_RANGE_MM ? rangeMm / OBSTACLE_MAP_BIN_MM : OBSTACLE_MAP_BINS;
+
+  taskENTER_CRITICAL(&mapLock);
+  for (int i = 0; i < count; i++) {
+    const int sector = (first + i) % OBSTACLE_MAP_SECTORS;
+    int8_t *bins = occupancy[sector];
+
+    for (int bin = 0; bin < hitBin; bin++) {
+      if (bins[bin] > -OCC_MAX) {
+        bins[bin] -= OCC_FREE;
+      }
+    }
+    if (hitBin < OBSTACLE_MAP_BINS) {
+      bins[hitBin] = bins[hitBin] + OCC_HIT > OCC_MAX ? OCC_MAX : bins[hitBin] + OCC_HIT;
+    }
+
+    sectorRange[sector] = sectorNearest(bins);
+  }
+
+  uint16_t nearest = OBSTACLE_MAP_NONE;
+  for (int sector = 0; sector < OBSTACLE_MAP_SECTORS; sector++) {
+    if (sectorRange[sector] < nearest) {
+      nearest = sectorRange[sector];
+    }
+  }
+  nearestRange = nearest;
+  taskEXIT_CRITICAL(&mapLock);
+}
+
+uint16_t obstacleMapSectorRange(int sector)
+{
+  return sectorRange[sector];
+}
+
+float obstacleMapSectorBearing(int sector)
+{
+  return sector * SECTOR_WIDTH;
+}
+
+uint16_t obstacleMapNearest(float bearing, float width)
+{
+  if (width >= 2.0f * (float)M_PI) {
+    return nearestRange;
+  }
+
+  const int first = sectorOf(bearing - width / 2);
+  const int count = (sectorOf(bearing + width / 2) - first + OBSTACLE_MAP_SECTORS) % OBSTACLE_MAP_SECTORS + 1;
+  uint16_t nearest = OBSTACLE_MAP_NONE;
+
+  for (int i = 0; i < count; i++) {
+    const uint16_t range = sectorRange[(first + i) % OBSTACLE_MAP_SECTORS];
+    if (range < nearest) {
+      nearest = range;
+    }
+  }
+
+  return nearest;
+}
+
+LOG_GROUP_START(obstMap)
+LOG_ADD(LOG_UINT16, nearest, &nearestRange)
+LOG_ADD(LOG_UINT16, front, &sectorRange[0])
+LOG_ADD(LOG_UINT16, left, &sectorRange[OBSTACLE_MAP_SECTORS / 4])
+LOG_ADD(LOG_UINT16, back, &sectorRange[OBSTACLE_MAP_SECTORS / 2])
+LOG_ADD(LOG_UINT16, right, &sectorRange[3 * OBSTACLE_MAP_SECTORS / 4])
+LOG_GROUP_STOP(obstMap)
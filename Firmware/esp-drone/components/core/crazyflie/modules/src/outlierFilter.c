@@ -25,42 +25,25 @@
  */
 
 #include <math.h>
+#include <string.h>
 #include "outlierFilter.h"
 #include "stabilizer_types.h"
-#include "log.h"
 #include "debug_cf.h"
 
 #define BUCKET_ACCEPTANCE_LEVEL 3
 #define MAX_BUCKET_FILL 10
 #define FILTER_CLOSE_DELAY_COUNT 30
 
-static float acceptanceLevel = 0.0;
-static float errorDistance;
-static int filterCloseDelayCounter = 0;
-static int previousFilterIndex = 0;
-
-typedef struct {
-  float acceptanceLevel;
-  int bucket;
-} filterLevel_t;
-
-#define FILTER_LEVELS 5
+#define FILTER_LEVELS OUTLIER_FILTER_TDOA_LEVELS
 #define FILTER_NONE FILTER_LEVELS
-filterLevel_t filterLevels[FILTER_LEVELS] = {
-  {.acceptanceLevel = 0.4},
-  {.acceptanceLevel = 0.8},
-  {.acceptanceLevel = 1.2},
-  {.acceptanceLevel = 1.6},
-  {.acceptanceLevel = 2.0},
-};
+// Ascending, the levels an error reaches are always the first ones
+static const float filterAcceptanceLevels[FILTER_LEVELS] = {0.4, 0.8, 1.2, 1.6, 2.0};
 
 
 static bool isDistanceDiffSmallerThanDistanceBetweenAnchors(const tdoaMeasurement_t* tdoa);
 static float distanceSq(const point_t* a, const point_t* b);
 static float sq(float a) {return a * a;}
-static void addToBucket(filterLevel_t* filter);
-static void removeFromBucket(filterLevel_t* filter);
-static int updateBuckets(float errorDistance);
+static int updateBuckets(OutlierFilterTdoaState_t* this, float errorDistance);
 
 
 
@@ -68,32 +51,32 @@ bool outlierFilterValidateTdoaSimple(const tdoaMeasurement_t* tdoa) {
   return isDistanceDiffSmallerThanDistanceBetweenAnchors(tdoa);
 }
 
-bool outlierFilterValidateTdoaSteps(const tdoaMeasurement_t* tdoa, const float error, const vector_t* jacobian, const point_t* estPos) {
+bool outlierFilterValidateTdoaSteps(OutlierFilterTdoaState_t* this, const tdoaMeasurement_t* tdoa, const float error, const vector_t* jacobian, const point_t* estPos) {
   bool sampleIsGood = false;
 
   if (isDistanceDiffSmallerThanDistanceBetweenAnchors(tdoa)) {
-    float errorBaseDistance = sqrtf(powf(jacobian->x, 2) + powf(jacobian->y, 2) + powf(jacobian->z, 2));
-    errorDistance = fabsf(error / errorBaseDistance);
+    float errorBaseDistance = sqrtf(sq(jacobian->x) + sq(jacobian->y) + sq(jacobian->z));
+    this->errorDistance = fabsf(error / errorBaseDistance);
 
-    int filterIndex = updateBuckets(errorDistance);
+    int filterIndex = updateBuckets(this, this->errorDistance);
 
-    if (filterIndex > previousFilterIndex) {
-      filterCloseDelayCounter = FILTER_CLOSE_DELAY_COUNT;
-    } else if (filterIndex < previousFilterIndex) {
-      if (filterCloseDelayCounter > 0) {
-        filterCloseDelayCounter--;
-        filterIndex = previousFilterIndex;
+    if (filterIndex > this->previousFilterIndex) {
+      this->filterCloseDelayCounter = FILTER_CLOSE_DELAY_COUNT;
+    } else if (filterIndex < this->previousFilterIndex) {
+      if (this->filterCloseDelayCounter > 0) {
+        this->filterCloseDelayCounter--;
+        filterIndex = this->previousFilterIndex;
       }
     }
-    previousFilterIndex = filterIndex;
+    this->previousFilterIndex = filterIndex;
 
     if (filterIndex == FILTER_NONE) {
       // Lost tracking, open up to let the kalman filter converge
-      acceptanceLevel = 100.0;
+      this->acceptanceLevel = 100.0;
       sampleIsGood = true;
     } else {
-      acceptanceLevel = filterLevels[filterIndex].acceptanceLevel;
-      if (errorDistance < acceptanceLevel) {
+      this->acceptanceLevel = filterAcceptanceLevels[filterIndex];
+      if (this->errorDistance < this->acceptanceLevel) {
         sampleIsGood = true;
       }
     }
@@ -102,6 +85,10 @@ bool outlierFilterValidateTdoaSteps(const tdoaMeasurement_t* tdoa, const float e
   return sampleIsGood;
 }
 
+void outlierFilterTdoaReset(OutlierFilterTdoaState_t* this) {
+  memset(this, 0, sizeof(*this));
+}
+
 
 #define LH_TICKS_PER_FRAME (1000 / 120)
 static const int32_t lhMinWindowTime = -2 * LH_TICKS_PER_FRAME;
@@ -157,44 +144,32 @@ static float distanceSq(const point_t* a, const point_t* b) {
 }
 
 
-static void addToBucket(filterLevel_t* filter) {
-  if (filter->bucket < MAX_BUCKET_FILL) {
-    filter->bucket++;
+/*
+ * A sample fills the buckets of the levels it reaches and drains the others,
+ * the levels are ascending so the reached ones come first. The filter index
+ * is the first level with a bucket below the acceptance level, or FILTER_NONE.
+ */
+static int updateBuckets(OutlierFilterTdoaState_t* this, float errorDistance) {
+  int reached = 0;
+  while (reached < FILTER_LEVELS && errorDistance >= filterAcceptanceLevels[reached]) {
+    reached++;
   }
-}
 
-static void removeFromBucket(filterLevel_t* filter) {
-  if (filter->bucket > 0) {
-    filter->bucket--;
+  for (int i = 0; i < reached; i++) {
+    if (this->bucket[i] < MAX_BUCKET_FILL) {
+      this->bucket[i]++;
+    }
   }
-}
-
-static int updateBuckets(float errorDistance) {
-  int filterIndex = FILTER_NONE;
-
-  for (int i = FILTER_LEVELS - 1; i >= 0; i--) {
-    filterLevel_t* filter = &filterLevels[i];
-
-    if (errorDistance < filter->acceptanceLevel) {
-      removeFromBucket(filter);
-    } else {
-      addToBucket(filter);
+  for (int i = reached; i < FILTER_LEVELS; i++) {
+    if (this->bucket[i] > 0) {
+      this->bucket[i]--;
     }
+  }
 
-    if (filter->bucket < BUCKET_ACCEPTANCE_LEVEL) {
-      filterIndex = i;
-    }
+  int filterIndex = 0;
+  while (filterIndex < FILTER_LEVELS && this->bucket[filterIndex] >= BUCKET_ACCEPTANCE_LEVEL) {
+    filterIndex++;
   }
 
   return filterIndex;
 }
-
-LOG_GROUP_START(outlierf)
-  LOG_ADD(LOG_INT32, bucket0, &filterLevels[0].bucket)
-  LOG_ADD(LOG_INT32, bucket1, &filterLevels[1].bucket)
-  LOG_ADD(LOG_INT32, bucket2, &filterLevels[2].bucket)
-  LOG_ADD(LOG_INT32, bucket3, &filterLevels[3].bucket)
-  LOG_ADD(LOG_INT32, bucket4, &filterLevels[4].bucket)
-  LOG_ADD(LOG_FLOAT, accLev, &acceptanceLevel)
-  LOG_ADD(LOG_FLOAT, errD, &errorDistance)
-LOG_GROUP_STOP(outlierf)
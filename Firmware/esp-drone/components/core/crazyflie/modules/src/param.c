@@ -24,6 +24,7 @@
  * param.h - Crazy parameter system source file.
  */
 #include <string.h>
+#include <stdlib.h>
 #include <errno.h>
 
 /* FreeRtos includes */
@@ -34,11 +35,17 @@
 #include "crtp.h"
 #include "param.h"
 #include "crc.h"
+#include "mem.h"
 #include "console.h"
 #define DEBUG_MODULE "PARAM"
 #include "debug_cf.h"
 #include "stm32_legacy.h"
 #include "static_mem.h"
+#ifdef CONFIG_PARAM_PERSISTENT_STORE
+#include <stdio.h>
+#include "nvs.h"
+#include "stabilizer.h"
+#endif
 
 #if 0
 #define PARAM_DEBUG(fmt, ...) DEBUG_PRINTD("D/param " fmt, ## __VA_ARGS__)
@@ -74,6 +81,15 @@ static const uint8_t typeLength[] = {
 
 #define MISC_SETBYNAME 0
 #define MISC_VALUE_UPDATED 1
+#define MISC_PERSISTENT_STORE 2
+#define MISC_PERSISTENT_GET_STATE 3
+#define MISC_PERSISTENT_CLEAR 4
+#define MISC_BATCH_WRITE 5
+#define MISC_BATCH_COMMIT 6
+
+// Size of the lookup tables built by paramInit()
+#define PARAM_MAX_VARIABLES 1024
+#define PARAM_MAX_GROUPS    256
 
 //Private functions
 static void paramTask(void * prm);
@@ -88,7 +104,13 @@ extern struct param_s _param_end;
 static void paramWriteProcess();
 static void paramReadProcess();
 static int variableGetIndex(int id);
+static int variableFind(const char *group, const char *name);
+static char * groupGetName(int ptr);
 static char paramWriteByNameProcess(char* group, char* name, int type, void *valptr);
+static void paramNotifyWrite(int ptr);
+static int paramSize(int ptr);
+static void paramBatchWriteProcess(void);
+static void paramBatchCommitProcess(void);
 
 //Pointer to the parameters list and length of it
 static struct param_s * params;
@@ -99,12 +121,160 @@ static uint16_t paramsCount = 0;
 // This is set to true, if a client uses TOC_CH in V2
 static bool useV2 = false;
 
+// Index of every variable in params, by variable id
+NO_DMA_CCM_SAFE_ZERO_INIT static uint16_t variableIndex[PARAM_MAX_VARIABLES];
+// Index of every group start in params, in table order and sorted by name
+NO_DMA_CCM_SAFE_ZERO_INIT static uint16_t groupIndex[PARAM_MAX_GROUPS];
+NO_DMA_CCM_SAFE_ZERO_INIT static uint16_t groupByName[PARAM_MAX_GROUPS];
+static uint16_t groupsCount = 0;
+
 static CRTPPacket p;
 
+/*
+ * A batch of writes is applied at once, between two stabilizer loops, so the
+ * controllers never run with half of a new gain set.
+ *
+ * [MISC_BATCH_WRITE][seq][id:2][value]...  stages the writes of the batch
+ * seq, as many as fit, values in the size of their param, without reply. A
+ * new seq drops the writes staged before.
+ * [MISC_BATCH_COMMIT][seq][count:2] applies the count writes of batch seq,
+ * answered with [MISC_BATCH_COMMIT][seq][count:2][status]. The status is 0,
+ * or the errno of the first write that failed to stage: ENOENT, EACCES or
+ * ENOMEM, EIO if not all count writes came or EINVAL if seq is not the one
+ * staged. A failed batch is dropped,
+ * the client starts over with another seq. A commit of the batch applied last
+ * is answered again, for an answer that got lost.
+ *
+ * The stabilizer applies the batch in paramBatchTick(). If it does not run,
+ * before the sensors are calibrated, the param task does it after
+ * PARAM_BATCH_APPLY_TIMEOUT_MS.
+ */
+#define PARAM_BATCH_MAX_WRITES 64
+#define PARAM_BATCH_APPLY_TIMEOUT_MS 20
+
+typedef enum {
+  batchIdle = 0,
+  batchPending,   // Committed, for the stabilizer
+  batchApplying,  // Claimed by the stabilizer or the param task
+  batchApplied,
+} paramBatchState_t;
+
+typedef struct {
+  uint16_t ptr;
+  uint64_t value;
+} paramBatchWrite_t;
+
+static paramBatchWrite_t batchWrites[PARAM_BATCH_MAX_WRITES];
+static uint16_t batchCount;
+static uint8_t batchSeq;
+static bool isBatchOpen;
+static uint8_t batchStatus;
+static uint8_t batchState = batchIdle;
+static bool hasBatchApplied;
+static uint8_t appliedBatchSeq;
+static uint16_t appliedBatchCount;
+
+#ifdef CONFIG_PARAM_PERSISTENT_STORE
+/*
+ * Stored params live in the "param" NVS namespace. The key is the crc of
+ * "group.name", NVS keys are too short for the name itself, and the blob is
+ * "group.name\0" followed by the value. All of them are applied in one pass
+ * over the namespace by paramInit().
+ *
+ * MISC_PERSISTENT_STORE and MISC_PERSISTENT_CLEAR only update storeEntries,
+ * the changes are committed together once no new one has come for
+ * PARAM_STORE_COMMIT_DELAY_MS, and never in flight since flash writes stall
+ * both cores. Params whose "group.name" is PARAM_STORE_MAX_NAME_LEN or longer
+ * can not be stored.
+ */
+#define PARAM_STORE_NAMESPACE "param"
+#define PARAM_STORE_MAX_ENTRIES 64
+#define PARAM_STORE_COMMIT_DELAY_MS 500
+#define PARAM_STORE_MAX_NAME_LEN 28
+
+typedef struct {
+  uint16_t ptr;           // Index in params
+  uint8_t isStored : 1;   // In flash, or will be at the next commit
+  uint8_t isDirty  : 1;   // Not committed yet
+  uint64_t value;
+} paramStoreEntry_t;
+
+static paramStoreEntry_t storeEntries[PARAM_STORE_MAX_ENTRIES];
+static int storeEntriesCount = 0;
+static bool storeIsDirty = false;
+static TickType_t storeLastChange;
+
+static void paramStorePreload(void);
+static void paramStoreProcess(void);
+static void paramStoreCommit(void);
+#endif
+
+static uint32_t tocBlobGetSize(void);
+static bool tocBlobRead(const uint32_t memAddr, const uint8_t readLen, uint8_t* buffer);
+static const MemoryHandlerDef_t tocBlobDef = {
+  .type = MEM_TYPE_PARAM_TOC,
+  .getSize = tocBlobGetSize,
+  .read = tocBlobRead,
+};
+static uint8_t tocBlobHeader[MEM_TOC_BLOB_HEADER_SIZE];
+static uint32_t tocBlobSize;
+// Start address of the record at tocBlobCursorPtr. Reads are sequential in
+// practice, so every read continues where the last one ended.
+static uint32_t tocBlobCursorAddr;
+static int tocBlobCursorPtr;
+
 static bool isInit = false;
 
 STATIC_MEM_TASK_ALLOC_STACK_NO_DMA_CCM_SAFE(paramTask, PARAM_TASK_STACKSIZE);
 
+/* Size of the TOC blob record of an entry, group stops have none */
+static uint32_t tocBlobRecordSize(int ptr)
+{
+  if ((params[ptr].type & PARAM_GROUP) && !(params[ptr].type & PARAM_START))
+    return 0;
+
+  return 1 + strlen(params[ptr].name) + 1;
+}
+
+static uint32_t tocBlobGetSize(void)
+{
+  return tocBlobSize;
+}
+
+static bool tocBlobRead(const uint32_t memAddr, const uint8_t readLen, uint8_t* buffer)
+{
+  if (memAddr + readLen > tocBlobSize)
+    return false;
+
+  for (uint32_t addr = memAddr; addr < memAddr + readLen; addr++) {
+    if (addr < MEM_TOC_BLOB_HEADER_SIZE) {
+      *buffer++ = tocBlobHeader[addr];
+      continue;
+    }
+
+    if (addr < tocBlobCursorAddr) {
+      tocBlobCursorAddr = MEM_TOC_BLOB_HEADER_SIZE;
+      tocBlobCursorPtr = 0;
+    }
+    while (addr >= tocBlobCursorAddr + tocBlobRecordSize(tocBlobCursorPtr)) {
+      tocBlobCursorAddr += tocBlobRecordSize(tocBlobCursorPtr);
+      tocBlobCursorPtr++;
+    }
+
+    int ptr = tocBlobCursorPtr;
+    uint32_t pos = addr - tocBlobCursorAddr;
+    // The name is copied with its terminating zero
+    *buffer++ = (pos == 0) ? (params[ptr].type) : params[ptr].name[pos - 1];
+  }
+
+  return true;
+}
+
+static int groupNameCompare(const void *a, const void *b)
+{
+  return strcmp(params[*(const uint16_t *)a].name, params[*(const uint16_t *)b].name);
+}
+
 void paramInit(void)
 {
   int i;
@@ -142,20 +312,40 @@ void paramInit(void)
       memcpy(&p.data[5], params[i].name, strlen(params[i].name));
       len += strlen(params[i].name);
     }
-    paramsCrc = crcSlow(p.data, len);
+    paramsCrc = crc32Update(0, p.data, len);
   }
 
   for (i=0; i<paramsLen; i++)
   {
-    if(!(params[i].type & PARAM_GROUP))
-      paramsCount++;
+    if(!(params[i].type & PARAM_GROUP)) {
+      ASSERT(paramsCount < PARAM_MAX_VARIABLES);
+      variableIndex[paramsCount++] = i;
+    } else if (params[i].type & PARAM_START) {
+      ASSERT(groupsCount < PARAM_MAX_GROUPS);
+      groupIndex[groupsCount++] = i;
+    }
   }
 
+  memcpy(groupByName, groupIndex, groupsCount * sizeof(groupIndex[0]));
+  qsort(groupByName, groupsCount, sizeof(groupByName[0]), groupNameCompare);
 
-  //Start the param task
-  STATIC_MEM_TASK_CREATE(paramTask, paramTask, PARAM_TASK_NAME, NULL, PARAM_TASK_PRI);
+  tocBlobHeader[0] = MEM_TOC_BLOB_VERSION;
+  memcpy(&tocBlobHeader[1], &paramsCrc, 4);
+  memcpy(&tocBlobHeader[5], &paramsCount, 2);
+  tocBlobSize = MEM_TOC_BLOB_HEADER_SIZE;
+  for (i=0; i<paramsLen; i++) {
+    tocBlobSize += tocBlobRecordSize(i);
+  }
+  tocBlobCursorAddr = MEM_TOC_BLOB_HEADER_SIZE;
+  memoryRegisterHandler(&tocBlobDef);
 
-  //TODO: Handle stored parameters!
+
+#ifdef CONFIG_PARAM_PERSISTENT_STORE
+  paramStorePreload();
+#endif
+
+  //Start the param task
+  STATIC_MEM_TASK_CREATE_PINNED(paramTask, paramTask, PARAM_TASK_NAME, NULL, PARAM_TASK_PRI, PARAM_TASK_CORE);
 
   isInit = true;
 }
@@ -170,7 +360,14 @@ void paramTask(void * prm)
 	crtpInitTaskQueue(CRTP_PORT_PARAM);
 
 	while(1) {
+#ifdef CONFIG_PARAM_PERSISTENT_STORE
+		paramStoreCommit();
+
+		if (crtpReceivePacketWait(CRTP_PORT_PARAM, &p, storeIsDirty ? M2T(PARAM_STORE_COMMIT_DELAY_MS) : portMAX_DELAY) != pdTRUE)
+		  continue;
+#else
 		crtpReceivePacketBlock(CRTP_PORT_PARAM, &p);
+#endif
 
 		if (p.channel==TOC_CH)
 		  paramTOCProcess(p.data[0]);
@@ -206,6 +403,19 @@ void paramTask(void * prm)
         p.size = 1+strlen(group)+1+strlen(name)+1+1;
         crtpSendPacket(&p);
       }
+      else if (p.data[0] == MISC_BATCH_WRITE && p.size >= 2) {
+        paramBatchWriteProcess();
+      }
+      else if (p.data[0] == MISC_BATCH_COMMIT && p.size >= 4) {
+        paramBatchCommitProcess();
+      }
+#ifdef CONFIG_PARAM_PERSISTENT_STORE
+      else if (p.data[0] == MISC_PERSISTENT_STORE ||
+               p.data[0] == MISC_PERSISTENT_GET_STATE ||
+               p.data[0] == MISC_PERSISTENT_CLEAR) {
+        paramStoreProcess();
+      }
+#endif
     }
 	}
 }
@@ -235,24 +445,13 @@ void paramTOCProcess(int command)
     crtpSendPacket(&p);
     break;
   case CMD_GET_ITEM:  //Get param variable
-    for (ptr=0; ptr<paramsLen; ptr++) //Ptr points a group
-    {
-      if (params[ptr].type & PARAM_GROUP)
-      {
-        if (params[ptr].type & PARAM_START)
-          group = params[ptr].name;
-        else
-          group = "";
-      }
-      else                          //Ptr points a variable
-      {
-        if (n==p.data[1])
-          break;
-        n++;
-      }
+    n = p.data[1];
+    ptr = variableGetIndex(n);
+    if (ptr >= 0) {
+      group = groupGetName(ptr);
     }
 
-    if (ptr<paramsLen)
+    if (ptr >= 0)
     {
       p.header=CRTP_HEADER(CRTP_PORT_PARAM, TOC_CH);
       p.data[0]=CMD_GET_ITEM;
@@ -283,24 +482,12 @@ void paramTOCProcess(int command)
     break;
   case CMD_GET_ITEM_V2:  //Get param variable
     memcpy(&paramId, &p.data[1], 2);
-    for (ptr=0; ptr<paramsLen; ptr++) //Ptr points a group
-    {
-      if (params[ptr].type & PARAM_GROUP)
-      {
-        if (params[ptr].type & PARAM_START)
-          group = params[ptr].name;
-        else
-          group = "";
-      }
-      else                          //Ptr points a variable
-      {
-        if (n==paramId)
-          break;
-        n++;
-      }
+    ptr = variableGetIndex(paramId);
+    if (ptr >= 0) {
+      group = groupGetName(ptr);
     }
 
-    if (ptr<paramsLen)
+    if (ptr >= 0)
     {
       p.header=CRTP_HEADER(CRTP_PORT_PARAM, TOC_CH);
       p.data[0]=CMD_GET_ITEM_V2;
@@ -358,6 +545,7 @@ static void paramWriteProcess()
         *(uint64_t*)params[id].address = *(uint64_t*)valptr;
         break;
     }
+    paramNotifyWrite(id);
 
     crtpSendPacket(&p);
   } else {
@@ -395,32 +583,16 @@ static void paramWriteProcess()
         *(uint64_t*)params[id].address = *(uint64_t*)valptr;
         break;
     }
+    paramNotifyWrite(id);
 
     crtpSendPacket(&p);
   }
 }
 
 static char paramWriteByNameProcess(char* group, char* name, int type, void *valptr) {
-  int ptr;
-  char *pgroup = "";
+  int ptr = variableFind(group, name);
 
-  for (ptr=0; ptr<paramsLen; ptr++) //Ptr points a group
-  {
-    if (params[ptr].type & PARAM_GROUP)
-    {
-      if (params[ptr].type & PARAM_START)
-        pgroup = params[ptr].name;
-      else
-        pgroup = "";
-    }
-    else                          //Ptr points a variable
-    {
-      if (!strcmp(params[ptr].name, name) && !strcmp(pgroup, group))
-        break;
-    }
-  }
-
-  if (ptr >= paramsLen) {
+  if (ptr < 0) {
     return ENOENT;
   }
 
@@ -447,10 +619,19 @@ static char paramWriteByNameProcess(char* group, char* name, int type, void *val
       *(uint64_t*)params[ptr].address = *(uint64_t*)valptr;
       break;
   }
+  paramNotifyWrite(ptr);
 
   return 0;
 }
 
+/* Calls the callback of a variable after its value was written */
+static void paramNotifyWrite(int ptr)
+{
+  if (params[ptr].callback) {
+    params[ptr].callback();
+  }
+}
+
 static void paramReadProcess()
 {
   if (useV2) {
@@ -528,23 +709,63 @@ static void paramReadProcess()
 
 static int variableGetIndex(int id)
 {
-  int i;
-  int n=0;
+  if (id < 0 || id >= paramsCount)
+    return -1;
 
-  for (i=0; i<paramsLen; i++)
-  {
-    if(!(params[i].type & PARAM_GROUP))
-    {
-      if(n==id)
-        break;
-      n++;
+  return variableIndex[id];
+}
+
+/* Index of the first entry in a sorted table that is >= value */
+static int lowerBound(const uint16_t *table, int len, uint16_t value)
+{
+  int low = 0;
+  int high = len;
+
+  while (low < high) {
+    int mid = (low + high) / 2;
+    if (table[mid] < value) {
+      low = mid + 1;
+    } else {
+      high = mid;
     }
   }
 
-  if (i>=paramsLen)
-    return -1;
+  return low;
+}
 
-  return i;
+/* Name of the group that the entry at ptr belongs to, "" if none */
+static char * groupGetName(int ptr)
+{
+  // The last group that starts before ptr
+  int i = lowerBound(groupIndex, groupsCount, ptr + 1) - 1;
+
+  return (i >= 0) ? params[groupIndex[i]].name : "";
+}
+
+static int variableFind(const char *group, const char *name)
+{
+  int low = 0;
+  int high = groupsCount;
+
+  while (low < high) {
+    int mid = (low + high) / 2;
+    if (strcmp(params[groupByName[mid]].name, group) < 0) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+
+  // The same group may be defined in several places
+  for (int i = low; i < groupsCount && !strcmp(params[groupByName[i]].name, group); i++) {
+    for (int ptr = groupByName[i] + 1; ptr < paramsLen && !(params[ptr].type & PARAM_GROUP); ptr++) {
+      if (!strcmp(params[ptr].name, name)) {
+        return ptr;
+      }
+    }
+  }
+
+  return -1;
 }
 
 /* Public API to access param TOC from within the copter */
@@ -552,29 +773,15 @@ static paramVarId_t invalidVarId = {0xffffu, 0xffffu};
 
 paramVarId_t paramGetVarId(char* group, char* name)
 {
-  int ptr;
-  int id = 0;
   paramVarId_t varId = invalidVarId;
-  char * currgroup = "";
+  int ptr = variableFind(group, name);
 
-  for(ptr=0; ptr<paramsLen; ptr++)
-  {
-    if (params[ptr].type & PARAM_GROUP) {
-      if (params[ptr].type & PARAM_START) {
-        currgroup = params[ptr].name;
-      }
-    } else {
-      id += 1;
-    }
-    
-    if ((!strcmp(group, currgroup)) && (!strcmp(name, params[ptr].name))) {
-      varId.ptr = ptr;
-      varId.id = id - 1;
-      return varId;
-    }
+  if (ptr >= 0) {
+    varId.ptr = ptr;
+    varId.id = lowerBound(variableIndex, paramsCount, ptr);
   }
 
-  return invalidVarId;
+  return varId;
 }
 
 int paramGetType(paramVarId_t varid)
@@ -584,22 +791,12 @@ int paramGetType(paramVarId_t varid)
 
 void paramGetGroupAndName(paramVarId_t varid, char** group, char** name)
 {
-  char * currgroup = "";
   *group = 0;
   *name = 0;
 
-  for(int i=0; i<paramsLen; i++) {
-    if (params[i].type & PARAM_GROUP) {
-      if (params[i].type & PARAM_START) {
-        currgroup = params[i].name;
-      }
-    }
-
-    if (i == varid.ptr) {
-      *group = currgroup;
-      *name = params[i].name;
-      break;
-    }
+  if (varid.ptr < paramsLen) {
+    *group = groupGetName(varid.ptr);
+    *name = params[varid.ptr].name;
   }
 }
 
@@ -729,6 +926,7 @@ void paramSetInt(paramVarId_t varid, int valuei)
 
       break;
   }
+  paramNotifyWrite(varid.ptr);
 
 #ifndef SILENT_PARAM_UPDATES
   crtpSendPacket(&pk);
@@ -751,9 +949,347 @@ void paramSetFloat(paramVarId_t varid, float valuef)
 
       memcpy(&pk.data[2], &valuef, 4);
       pk.size += 4;
+      paramNotifyWrite(varid.ptr);
   }
 
 #ifndef SILENT_PARAM_UPDATES
   crtpSendPacket(&pk);
 #endif
 }
+
+static int paramSize(int ptr)
+{
+  return 1 << (params[ptr].type & PARAM_BYTES_MASK);
+}
+
+static void paramBatchWriteProcess(void)
+{
+  const uint8_t seq = p.data[1];
+  int offset = 2;
+
+  if (!isBatchOpen || seq != batchSeq) {
+    isBatchOpen = true;
+    batchSeq = seq;
+    batchCount = 0;
+    batchStatus = 0;
+  }
+
+  while (batchStatus == 0 && offset + 2 <= p.size) {
+    uint16_t ident;
+    int ptr;
+
+    memcpy(&ident, &p.data[offset], 2);
+    ptr = variableGetIndex(ident);
+
+    // The size of the value is not known, the rest of the packet is lost
+    if (ptr < 0) {
+      batchStatus = ENOENT;
+    } else if (offset + 2 + paramSize(ptr) > p.size) {
+      batchStatus = EIO;
+    } else if (params[ptr].type & PARAM_RONLY) {
+      batchStatus = EACCES;
+    } else if (batchCount >= PARAM_BATCH_MAX_WRITES) {
+      batchStatus = ENOMEM;
+    } else {
+      paramBatchWrite_t *write = &batchWrites[batchCount++];
+
+      write->ptr = ptr;
+      write->value = 0;
+      memcpy(&write->value, &p.data[offset + 2], paramSize(ptr));
+      offset += 2 + paramSize(ptr);
+    }
+  }
+}
+
+/* Writes the values of the batch, in the stabilizer between two loops or in
+ * the param task */
+static void paramBatchApply(void)
+{
+  for (int i = 0; i < batchCount; i++) {
+    memcpy(params[batchWrites[i].ptr].address, &batchWrites[i].value, paramSize(batchWrites[i].ptr));
+  }
+  for (int i = 0; i < batchCount; i++) {
+    paramNotifyWrite(batchWrites[i].ptr);
+  }
+
+  __atomic_store_n(&batchState, batchApplied, __ATOMIC_RELEASE);
+}
+
+static bool paramBatchClaim(void)
+{
+  uint8_t expected = batchPending;
+
+  return __atomic_compare_exchange_n(&batchState, &expected, batchApplying, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+void paramBatchTick(void)
+{
+  if (__atomic_load_n(&batchState, __ATOMIC_RELAXED) == batchPending && paramBatchClaim()) {
+    paramBatchApply();
+  }
+}
+
+static void paramBatchCommitProcess(void)
+{
+  const uint8_t seq = p.data[1];
+  uint16_t count;
+  uint8_t status;
+
+  memcpy(&count, &p.data[2], 2);
+
+  if (hasBatchApplied && seq == appliedBatchSeq && count == appliedBatchCount && !(isBatchOpen && seq == batchSeq)) {
+    status = 0;
+  } else if (!isBatchOpen || seq != batchSeq) {
+    status = EINVAL;
+  } else if (batchStatus != 0) {
+    status = batchStatus;
+  } else if (count != batchCount) {
+    status = EIO;
+  } else {
+    const TickType_t start = xTaskGetTickCount();
+
+    __atomic_store_n(&batchState, batchPending, __ATOMIC_RELEASE);
+    while (__atomic_load_n(&batchState, __ATOMIC_ACQUIRE) != batchApplied) {
+      if (xTaskGetTickCount() - start >= M2T(PARAM_BATCH_APPLY_TIMEOUT_MS) && paramBatchClaim()) {
+        paramBatchApply();
+      } else {
+        vTaskDelay(1);
+      }
+    }
+    __atomic_store_n(&batchState, batchIdle, __ATOMIC_RELAXED);
+
+    hasBatchApplied = true;
+    appliedBatchSeq = seq;
+    appliedBatchCount = count;
+    status = 0;
+  }
+
+  if (isBatchOpen && seq == batchSeq) {
+    isBatchOpen = false;
+  }
+
+  p.data[4] = status;
+  p.size = 5;
+  crtpSendPacket(&p);
+}
+
+#ifdef CONFIG_PARAM_PERSISTENT_STORE
+
+/* Writes "group.name" to buffer, returns its length or -1 if it does not fit */
+static int paramStoreName(int ptr, char *buffer)
+{
+  const int length = snprintf(buffer, PARAM_STORE_MAX_NAME_LEN, "%s.%s", groupGetName(ptr), params[ptr].name);
+
+  return (length >= 0 && length < PARAM_STORE_MAX_NAME_LEN) ? length : -1;
+}
+
+static void paramStoreKey(const char *name, int nameLength, char key[NVS_KEY_NAME_MAX_SIZE])
+{
+  snprintf(key, NVS_KEY_NAME_MAX_SIZE, "%08x", (unsigned int)crc32Update(0, name, nameLength));
+}
+
+static paramStoreEntry_t *paramStoreFind(int ptr)
+{
+  for (int i = 0; i < storeEntriesCount; i++) {
+    if (storeEntries[i].ptr == ptr) {
+      return &storeEntries[i];
+    }
+  }
+
+  return NULL;
+}
+
+static paramStoreEntry_t *paramStoreAdd(int ptr)
+{
+  paramStoreEntry_t *entry = paramStoreFind(ptr);
+
+  if (entry == NULL && storeEntriesCount < PARAM_STORE_MAX_ENTRIES) {
+    entry = &storeEntries[storeEntriesCount++];
+    entry->ptr = ptr;
+    entry->isStored = 0;
+    entry->isDirty = 0;
+  }
+
+  return entry;
+}
+
+static void paramStorePreload(void)
+{
+  nvs_iterator_t it = NULL;
+  esp_err_t err = nvs_entry_find(NVS_DEFAULT_PART_NAME, PARAM_STORE_NAMESPACE, NVS_TYPE_BLOB, &it);
+  nvs_handle_t handle;
+  int applied = 0;
+
+  if (err != ESP_OK) {
+    // Nothing stored yet
+    return;
+  }
+
+  if (nvs_open(PARAM_STORE_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+    nvs_release_iterator(it);
+    return;
+  }
+
+  while (err == ESP_OK) {
+    nvs_entry_info_t info;
+    uint8_t blob[PARAM_STORE_MAX_NAME_LEN + sizeof(uint64_t)];
+    size_t blobLength = sizeof(blob);
+
+    nvs_entry_info(it, &info);
+
+    if (nvs_get_blob(handle, info.key, blob, &blobLength) == ESP_OK) {
+      char *name = (char *)blob;
+      size_t nameLength = strnlen(name, blobLength);
+      char *dot = memchr(name, '.', nameLength);
+      int ptr = -1;
+
+      if (dot != NULL && nameLength < blobLength) {
+        *dot = '\0';
+        ptr = variableFind(name, dot + 1);
+        *dot = '.';
+      }
+
+      // Params that are gone, read only or changed type are left alone
+      if (ptr >= 0 && !(params[ptr].type & PARAM_RONLY) && blobLength == nameLength + 1 + paramSize(ptr)) {
+        paramStoreEntry_t *entry = paramStoreAdd(ptr);
+
+        if (entry) {
+          memcpy(params[ptr].address, &blob[nameLength + 1], paramSize(ptr));
+          paramNotifyWrite(ptr);
+          memcpy(&entry->value, &blob[nameLength + 1], paramSize(ptr));
+          entry->isStored = 1;
+          applied++;
+        }
+      } else {
+        PARAM_ERROR("Stored param %s does not match\n", name);
+      }
+    }
+
+    err = nvs_entry_next(&it);
+  }
+
+  nvs_release_iterator(it);
+  nvs_close(handle);
+
+  DEBUG_PRINTI("Applied %d stored params\n", applied);
+}
+
+static void paramStoreCommit(void)
+{
+  nvs_handle_t handle;
+
+  if (!storeIsDirty || stabilizerIsFlying() ||
+      xTaskGetTickCount() - storeLastChange < M2T(PARAM_STORE_COMMIT_DELAY_MS)) {
+    return;
+  }
+
+  if (nvs_open(PARAM_STORE_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK) {
+    return;
+  }
+
+  for (int i = 0; i < storeEntriesCount; ) {
+    paramStoreEntry_t *entry = &storeEntries[i];
+    uint8_t blob[PARAM_STORE_MAX_NAME_LEN + sizeof(uint64_t)];
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    int nameLength = paramStoreName(entry->ptr, (char *)blob);
+
+    if (!entry->isDirty) {
+      i++;
+      continue;
+    }
+
+    if (nameLength < 0) {
+      *entry = storeEntries[--storeEntriesCount];
+      continue;
+    }
+
+    paramStoreKey((char *)blob, nameLength, key);
+
+    if (entry->isStored) {
+      memcpy(&blob[nameLength + 1], &entry->value, paramSize(entry->ptr));
+      nvs_set_blob(handle, key, blob, nameLength + 1 + paramSize(entry->ptr));
+      entry->isDirty = 0;
+      i++;
+    } else {
+      nvs_erase_key(handle, key);
+      *entry = storeEntries[--storeEntriesCount];
+    }
+  }
+
+  if (nvs_commit(handle) == ESP_OK) {
+    storeIsDirty = false;
+  }
+  nvs_close(handle);
+}
+
+/* MISC_PERSISTENT_* requests are [cmd][id:2], the replies add a status byte
+ * (0 or an errno). MISC_PERSISTENT_GET_STATE then adds 1 and the stored
+ * value if the param is stored, 0 otherwise. */
+static void paramStoreProcess(void)
+{
+  uint16_t ident;
+  int ptr;
+  paramStoreEntry_t *entry;
+  uint8_t status = 0;
+
+  memcpy(&ident, &p.data[1], 2);
+  ptr = variableGetIndex(ident);
+  p.size = 4;
+
+  if (ptr < 0) {
+    p.data[3] = ENOENT;
+    crtpSendPacket(&p);
+    return;
+  }
+
+  entry = paramStoreFind(ptr);
+
+  switch (p.data[0]) {
+    case MISC_PERSISTENT_STORE:
+      if (params[ptr].type & PARAM_RONLY) {
+        status = EACCES;
+        break;
+      }
+
+      char name[PARAM_STORE_MAX_NAME_LEN];
+      if (paramStoreName(ptr, name) < 0) {
+        status = ENAMETOOLONG;
+        break;
+      }
+
+      entry = paramStoreAdd(ptr);
+      if (entry == NULL) {
+        status = ENOMEM;
+        break;
+      }
+
+      memcpy(&entry->value, params[ptr].address, paramSize(ptr));
+      entry->isStored = 1;
+      entry->isDirty = 1;
+      storeIsDirty = true;
+      storeLastChange = xTaskGetTickCount();
+      break;
+    case MISC_PERSISTENT_CLEAR:
+      if (entry && entry->isStored) {
+        entry->isStored = 0;
+        entry->isDirty = 1;
+        storeIsDirty = true;
+        storeLastChange = xTaskGetTickCount();
+      }
+      break;
+    case MISC_PERSISTENT_GET_STATE:
+      if (entry && entry->isStored) {
+        p.data[4] = 1;
+        memcpy(&p.data[5], &entry->value, paramSize(ptr));
+        p.size = 5 + paramSize(ptr);
+      } else {
+        p.data[4] = 0;
+        p.size = 5;
+      }
+      break;
+  }
+
+  p.data[3] = status;
+  crtpSendPacket(&p);
+}
+#endif
@@ -1,14 +1,20 @@
 #include "config.h"
-#include "debug.h"
+#include "debug_cf.h"
 #include "FreeRTOS.h"
 #include "task.h"
+#include "stm32_legacy.h"
 #include "peer_localization.h"
 
+// Positions of the others, the first neighborCount are in use
+static peerLocalizationOtherPosition_t other_positions[PEER_LOCALIZATION_MAX_NEIGHBORS];
+static uint8_t neighborCount;
+// Slot in other_positions plus one of every radio ID, zero for none
+static uint8_t slotOfId[256];
 
 void peerLocalizationInit()
 {
-  // All other_positions[in].id will be set to zero due to static initialization.
-  // If we ever switch to dynamic allocation, we need to set them to zero explicitly.
+  // The table starts empty due to static initialization.
+  // If we ever switch to dynamic allocation, we need to clear it explicitly.
 }
 
 bool peerLocalizationTest()
@@ -16,48 +22,92 @@ bool peerLocalizationTest()
   return true;
 }
 
-// array of other's position
-static peerLocalizationOtherPosition_t other_positions[PEER_LOCALIZATION_MAX_NEIGHBORS];
+static bool isStale(const peerLocalizationOtherPosition_t *other, uint32_t now)
+{
+  return now - other->pos.timestamp > M2T(PEER_LOCALIZATION_MAX_AGE_MS);
+}
 
-bool peerLocalizationTellPosition(int cfid, positionMeasurement_t const *pos)
+// Move the last neighbor into the slot, the list stays without holes
+static void evict(uint8_t slot)
+{
+  const uint8_t last = neighborCount - 1;
+
+  slotOfId[other_positions[slot].id] = 0;
+  if (slot != last) {
+    other_positions[slot] = other_positions[last];
+    slotOfId[other_positions[slot].id] = slot + 1;
+  }
+  other_positions[last].id = 0;
+  neighborCount = last;
+}
+
+static void evictStale(uint32_t now)
 {
-  for (uint8_t i = 0; i < PEER_LOCALIZATION_MAX_NEIGHBORS; ++i) {
-    if (other_positions[i].id == 0 || other_positions[i].id == cfid) {
-      other_positions[i].id = cfid;
-      other_positions[i].pos.x = pos->x;
-      other_positions[i].pos.y = pos->y;
-      other_positions[i].pos.z = pos->z;
-      other_positions[i].pos.timestamp = xTaskGetTickCount();
-      return true;
+  for (int slot = neighborCount - 1; slot >= 0; slot--) {
+    if (isStale(&other_positions[slot], now)) {
+      evict(slot);
     }
   }
-  return false;
 }
 
-bool peerLocalizationIsIDActive(uint8_t cfid)
+bool peerLocalizationTellPosition(int cfid, positionMeasurement_t const *pos)
 {
-  for (uint8_t i = 0; i < PEER_LOCALIZATION_MAX_NEIGHBORS; ++i) {
-    if (other_positions[i].id == cfid) {
-      return true;
+  if (cfid <= 0 || cfid >= sizeof(slotOfId)) {
+    return false;
+  }
+
+  const uint32_t now = xTaskGetTickCount();
+  uint8_t slot;
+
+  if (slotOfId[cfid] != 0) {
+    slot = slotOfId[cfid] - 1;
+  } else {
+    // A new ID only takes a slot the table has or the stale ones leave
+    if (neighborCount == PEER_LOCALIZATION_MAX_NEIGHBORS) {
+      evictStale(now);
+      if (neighborCount == PEER_LOCALIZATION_MAX_NEIGHBORS) {
+        return false;
+      }
     }
+    slot = neighborCount;
+    other_positions[slot].id = cfid;
+    slotOfId[cfid] = slot + 1;
+    neighborCount++;
   }
-  return false;
+
+  other_positions[slot].pos.x = pos->x;
+  other_positions[slot].pos.y = pos->y;
+  other_positions[slot].pos.z = pos->z;
+  other_positions[slot].pos.timestamp = now;
+  return true;
+}
+
+bool peerLocalizationIsIDActive(uint8_t cfid)
+{
+  return peerLocalizationGetPositionByID(cfid) != NULL;
 }
 
 peerLocalizationOtherPosition_t *peerLocalizationGetPositionByID(uint8_t cfid)
 {
-  for (uint8_t i = 0; i < PEER_LOCALIZATION_MAX_NEIGHBORS; ++i) {
-    if (other_positions[i].id == cfid) {
-      return &other_positions[i];
-    }
+  if (slotOfId[cfid] == 0) {
+    return NULL;
   }
-  return NULL;
+
+  peerLocalizationOtherPosition_t *other = &other_positions[slotOfId[cfid] - 1];
+  if (isStale(other, xTaskGetTickCount())) {
+    return NULL;
+  }
+  return other;
+}
+
+uint8_t peerLocalizationGetNeighborCount(void)
+{
+  return neighborCount;
 }
 
 peerLocalizationOtherPosition_t *peerLocalizationGetPositionByIdx(uint8_t idx)
 {
-  // TODO: should we return NULL if the id == 0?
-  if (idx < PEER_LOCALIZATION_MAX_NEIGHBORS) {
+  if (idx < neighborCount) {
     return &other_positions[idx];
   }
   return NULL;
@@ -158,3 +158,124 @@ void pidSetKd(PidObject* pid, const float kd)
 void pidSetDt(PidObject* pid, const float dt) {
     pid->dt = dt;
 }
+
+void pidBankInit(PidBank* bank, const float dt, const float samplingRate,
+                 const float cutoffFreq, bool enableDFilter)
+{
+  for (int axis = 0; axis < PID_BANK_AXES; axis++)
+  {
+    pidBankSetAxis(bank, axis, 0, 0, 0, DEFAULT_PID_INTEGRATION_LIMIT);
+    bank->outputLimit[axis] = DEFAULT_PID_OUTPUT_LIMIT;
+    bank->dFilterDelay1[axis] = 0;
+    bank->dFilterDelay2[axis] = 0;
+  }
+  pidBankReset(bank);
+
+  bank->dt = dt;
+  bank->enableDFilter = enableDFilter;
+  if (bank->enableDFilter)
+  {
+    lpf2pInit(&bank->dFilter, samplingRate, cutoffFreq);
+  }
+}
+
+void pidBankSetAxis(PidBank* bank, const int axis, const float kp,
+                    const float ki, const float kd, const float iLimit)
+{
+  bank->kp[axis] = kp;
+  bank->ki[axis] = ki;
+  bank->kd[axis] = kd;
+  bank->iLimit[axis] = iLimit;
+}
+
+// The steps and the float operations of pidUpdate() and constrain(), so that
+// the outputs are the same to the bit. Dividing by dt stays: times 1/dt rounds
+// differently.
+void pidBankUpdate(PidBank* bank, const float error[PID_BANK_AXES], float output[PID_BANK_AXES])
+{
+  const float dt = bank->dt;
+  float deriv[PID_BANK_AXES];
+
+  for (int axis = 0; axis < PID_BANK_AXES; axis++)
+  {
+    bank->error[axis] = error[axis];
+    deriv[axis] = (error[axis] - bank->prevError[axis]) / dt;
+  }
+
+  if (bank->enableDFilter)
+  {
+    // lpf2pApply() on each axis
+    const lpf2pData* f = &bank->dFilter;
+    for (int axis = 0; axis < PID_BANK_AXES; axis++)
+    {
+      const float delay1 = bank->dFilterDelay1[axis];
+      const float delay2 = bank->dFilterDelay2[axis];
+      float delay0 = deriv[axis] - delay1 * f->a1 - delay2 * f->a2;
+      if (!isfinite(delay0))
+      {
+        delay0 = deriv[axis];
+      }
+      deriv[axis] = delay0 * f->b0 + delay1 * f->b1 + delay2 * f->b2;
+      bank->dFilterDelay2[axis] = delay1;
+      bank->dFilterDelay1[axis] = delay0;
+    }
+  }
+
+  for (int axis = 0; axis < PID_BANK_AXES; axis++)
+  {
+    const float e = error[axis];
+    const float d = isnan(deriv[axis]) ? 0 : deriv[axis];
+    float integ = bank->integ[axis] + e * dt;
+    if (bank->iLimit[axis] != 0)
+    {
+      integ = fminf(bank->iLimit[axis], fmaxf(-bank->iLimit[axis], integ));
+    }
+
+    const float outP = bank->kp[axis] * e;
+    const float outD = bank->kd[axis] * d;
+    const float outI = bank->ki[axis] * integ;
+    float out = 0.0f + outP + outD + outI;
+    if (bank->outputLimit[axis] != 0)
+    {
+      out = fminf(bank->outputLimit[axis], fmaxf(-bank->outputLimit[axis], out));
+    }
+
+    bank->deriv[axis] = d;
+    bank->integ[axis] = integ;
+    bank->outP[axis] = outP;
+    bank->outD[axis] = outD;
+    bank->outI[axis] = outI;
+    bank->prevError[axis] = e;
+    output[axis] = out;
+  }
+}
+
+void pidBankSetDt(PidBank* bank, const float dt, const float samplingRate, const float cutoffFreq)
+{
+  if (dt == bank->dt)
+  {
+    return;
+  }
+
+  bank->dt = dt;
+  if (bank->enableDFilter)
+  {
+    lpf2pInit(&bank->dFilter, samplingRate, cutoffFreq);
+  }
+}
+
+void pidBankResetAxis(PidBank* bank, const int axis)
+{
+  bank->error[axis]     = 0;
+  bank->prevError[axis] = 0;
+  bank->integ[axis]     = 0;
+  bank->deriv[axis]     = 0;
+}
+
+void pidBankReset(PidBank* bank)
+{
+  for (int axis = 0; axis < PID_BANK_AXES; axis++)
+  {
+    pidBankResetAxis(bank, axis);
+  }
+}
@@ -188,8 +188,9 @@ int plan_go_to(struct planner *p, bool relative, struct vec hover_pos, float hov
 	return plan_go_to_from(p, &setpoint, relative, hover_pos, hover_yaw, duration, t);
 }
 
-int plan_start_trajectory( struct planner *p, const struct piecewise_traj* trajectory, bool reversed)
+int plan_start_trajectory( struct planner *p, struct piecewise_traj* trajectory, bool reversed)
 {
+	piecewise_rewind(trajectory);
 	p->reversed = reversed;
 	p->state = TRAJECTORY_STATE_FLYING;
 	p->type = TRAJECTORY_TYPE_PIECEWISE;
@@ -122,6 +122,24 @@ void platformserviceSendAppchannelPacket(CRTPPacket *p)
   crtpSendPacket(p);
 }
 
+void platformserviceSendAppchannelPacketBlock(CRTPPacket *p)
+{
+  p->port = CRTP_PORT_PLATFORM;
+  p->channel = appChannel;
+  crtpSendPacketBlock(p);
+}
+
+/* Answers with the text after the command, without its terminator, cut to
+ * the packet if too long */
+static void sendText(CRTPPacket *p, const char *text)
+{
+  const size_t length = strnlen(text, CRTP_MAX_DATA_SIZE - 1);
+
+  memcpy(&p->data[1], text, length);
+  p->size = 1 + length;
+  crtpSendPacket(p);
+}
+
 static void versionCommandProcess(CRTPPacket *p)
 {
   switch (p->data[0]) {
@@ -131,17 +149,10 @@ static void versionCommandProcess(CRTPPacket *p)
       crtpSendPacket(p);
       break;
     case getFirmwareVersion:
-      strncpy((char*)&p->data[1], V_STAG, CRTP_MAX_DATA_SIZE-1);
-      p->size = (strlen(V_STAG)>CRTP_MAX_DATA_SIZE-1)?CRTP_MAX_DATA_SIZE:strlen(V_STAG)+1;
-      crtpSendPacket(p);
+      sendText(p, V_STAG);
       break;
     case getDeviceTypeName:
-      {
-      const char* name = platformConfigGetDeviceTypeName();
-      strncpy((char*)&p->data[1], name, CRTP_MAX_DATA_SIZE-1);
-      p->size = (strlen(name)>CRTP_MAX_DATA_SIZE-1)?CRTP_MAX_DATA_SIZE:strlen(name)+1;
-      crtpSendPacket(p);
-      }
+      sendText(p, platformConfigGetDeviceTypeName());
       break;
     default:
       break;
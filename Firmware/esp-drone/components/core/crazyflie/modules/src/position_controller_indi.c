@@ -27,6 +27,7 @@
 
 #include "position_controller_indi.h"
 #include "math3d.h"
+#include "xtensa_math.h"
 
 // Position controller gains
 float K_xi_x = 1.0f;
@@ -60,49 +61,64 @@ void position_indi_init_filters(void)
 	float tau = 1.0f / (2.0f * M_PI_F * indiOuter.filt_cutoff);
 	float tau_axis[3] = {tau, tau, tau};
 	float sample_time = 1.0f / ATTITUDE_RATE;
-	// Filtering of linear acceleration, attitude and thrust 
-	for (int8_t i = 0; i < 3; i++) {
-		init_butterworth_2_low_pass(&indiOuter.ddxi[i], tau_axis[i], sample_time, 0.0f);
-		init_butterworth_2_low_pass(&indiOuter.ang[i], tau_axis[i], sample_time, 0.0f);
-		init_butterworth_2_low_pass(&indiOuter.thr[i], tau_axis[i], sample_time, 0.0f);
-	}
+	// Filtering of linear acceleration, attitude and thrust, the three axes in one pass
+	init_butterworth_2_low_pass_3(&indiOuter.ddxi, tau_axis, sample_time, 0.0f);
+	init_butterworth_2_low_pass_3(&indiOuter.ang, tau_axis, sample_time, 0.0f);
+	init_butterworth_2_low_pass(&indiOuter.thr, tau, sample_time, 0.0f);
 }
 
 // Linear acceleration filter
-static inline void filter_ddxi(Butterworth2LowPass *filter, struct Vectr *old_values, struct Vectr *new_values)
+static inline void filter_ddxi(Butterworth2LowPass3 *filter, struct Vectr *old_values, struct Vectr *new_values)
 {
-	new_values->x = update_butterworth_2_low_pass(&filter[0], old_values->x);
-	new_values->y = update_butterworth_2_low_pass(&filter[1], old_values->y);
-	new_values->z = update_butterworth_2_low_pass(&filter[2], old_values->z);
+	const float values[3] = {old_values->x, old_values->y, old_values->z};
+	update_butterworth_2_low_pass_3(filter, values, NULL, 0.0f);
+	new_values->x = filter->o[0][0];
+	new_values->y = filter->o[0][1];
+	new_values->z = filter->o[0][2];
 }
 
 // Attitude filter
-static inline void filter_ang(Butterworth2LowPass *filter, struct Angles *old_values, struct Angles *new_values)
+static inline void filter_ang(Butterworth2LowPass3 *filter, struct Angles *old_values, struct Angles *new_values)
 {
-	new_values->phi = update_butterworth_2_low_pass(&filter[0], old_values->phi);
-	new_values->theta = update_butterworth_2_low_pass(&filter[1], old_values->theta);
-	new_values->psi = update_butterworth_2_low_pass(&filter[2], old_values->psi);
+	const float values[3] = {old_values->phi, old_values->theta, old_values->psi};
+	update_butterworth_2_low_pass_3(filter, values, NULL, 0.0f);
+	new_values->phi = filter->o[0][0];
+	new_values->theta = filter->o[0][1];
+	new_values->psi = filter->o[0][2];
 }
 
 // Thrust filter
 static inline void filter_thrust(Butterworth2LowPass *filter, float *old_thrust, float *new_thrust) 
 {
-	*new_thrust = update_butterworth_2_low_pass(&filter[0], *old_thrust);
+	*new_thrust = update_butterworth_2_low_pass(filter, *old_thrust);
 }
 
+// Sine and cosine of an attitude, the trig of a tick is done once here
+struct AnglesSinCos {
+	float sphi, cphi;
+	float stheta, ctheta;
+	float spsi, cpsi;
+};
+
+static inline void angles_sin_cos(const struct Angles *att_deg, struct AnglesSinCos *sc)
+{
+	xtensa_sin_cos_f32(att_deg->phi, &sc->sphi, &sc->cphi);
+	xtensa_sin_cos_f32(att_deg->theta, &sc->stheta, &sc->ctheta);
+	xtensa_sin_cos_f32(att_deg->psi, &sc->spsi, &sc->cpsi);
+}
 
 // Computes transformation matrix from body frame (index B) into NED frame (index O)
-void m_ob(struct Angles att, float matrix[3][3]) {
-
-	matrix[0][0] = cosf(att.theta)*cosf(att.psi);
-	matrix[0][1] = sinf(att.phi)*sinf(att.theta)*cosf(att.psi) - cosf(att.phi)*sinf(att.psi); 
-	matrix[0][2] = cosf(att.phi)*sinf(att.theta)*cosf(att.psi) + sinf(att.phi)*sinf(att.psi);
-	matrix[1][0] = cosf(att.theta)*sinf(att.psi);
-	matrix[1][1] = sinf(att.phi)*sinf(att.theta)*sinf(att.psi) + cosf(att.phi)*cosf(att.psi);
-	matrix[1][2] = cosf(att.phi)*sinf(att.theta)*sinf(att.psi) - sinf(att.phi)*cosf(att.psi);
-	matrix[2][0] = -sinf(att.theta);
-	matrix[2][1] = sinf(att.phi)*cosf(att.theta);
-	matrix[2][2] = cosf(att.phi)*cosf(att.theta);
+static void m_ob(const struct AnglesSinCos *sc, float matrix[3][3]) {
+
+	matrix[0][0] = sc->ctheta*sc->cpsi;
+	matrix[0][1] = sc->sphi*sc->stheta*sc->cpsi - sc->cphi*sc->spsi;
+	matrix[0][2] = sc->cphi*sc->stheta*sc->cpsi + sc->sphi*sc->spsi;
+	matrix[1][0] = sc->ctheta*sc->spsi;
+	matrix[1][1] = sc->sphi*sc->stheta*sc->spsi + sc->cphi*sc->cpsi;
+	matrix[1][2] = sc->cphi*sc->stheta*sc->spsi - sc->sphi*sc->cpsi;
+	matrix[2][0] = -sc->stheta;
+	matrix[2][1] = sc->sphi*sc->ctheta;
+	matrix[2][2] = sc->cphi*sc->ctheta;
 }
 
 
@@ -160,25 +176,21 @@ void positionControllerINDI(const sensorData_t *sensors,
 	indiOuter.linear_accel_s.z = (-sensors->acc.z)*9.81f;
 
 	// Filter lin. acceleration 
-	filter_ddxi(indiOuter.ddxi, &indiOuter.linear_accel_s, &indiOuter.linear_accel_f);
+	filter_ddxi(&indiOuter.ddxi, &indiOuter.linear_accel_s, &indiOuter.linear_accel_f);
 
 	// Obtain actual attitude values (in deg)
 	indiOuter.attitude_s.phi = state->attitude.roll; 
 	indiOuter.attitude_s.theta = state->attitude.pitch;
 	indiOuter.attitude_s.psi = -state->attitude.yaw;
-	filter_ang(indiOuter.ang, &indiOuter.attitude_s, &indiOuter.attitude_f);
-
+	filter_ang(&indiOuter.ang, &indiOuter.attitude_s, &indiOuter.attitude_f);
 
-	// Actual attitude (in rad)
-	struct Angles att = {
-		.phi = indiOuter.attitude_f.phi/180*M_PI_F,
-		.theta = indiOuter.attitude_f.theta/180*M_PI_F,
-		.psi = indiOuter.attitude_f.psi/180*M_PI_F,
-	};
+	// Trig of the actual attitude, straight from the degrees
+	struct AnglesSinCos sc;
+	angles_sin_cos(&indiOuter.attitude_f, &sc);
 
 	// Compute transformation matrix from body frame (index B) into NED frame (index O)
-	float M_OB[3][3] = {0};
-	m_ob(att, M_OB);
+	float M_OB[3][3];
+	m_ob(&sc, M_OB);
 
 	// Transform lin. acceleration in NED (add gravity to the z-component)
 	indiOuter.linear_accel_ft.x = M_OB[0][0]*indiOuter.linear_accel_f.x + M_OB[0][1]*indiOuter.linear_accel_f.y + M_OB[0][2]*indiOuter.linear_accel_f.z;
@@ -193,52 +205,32 @@ void positionControllerINDI(const sensorData_t *sensors,
 	// Elements of the G matrix (see publication for more information) 
 	// ("-" because T points in neg. z-direction, "*9.81" because T/m=a=g, 
 	// negative psi to account for wrong coordinate frame in the implementation of the inner loop)
-	float g11 = (cosf(att.phi)*sinf(-att.psi) - sinf(att.phi)*sinf(att.theta)*cosf(-att.psi))*(-9.81f);
-	float g12 = (cosf(att.phi)*cosf(-att.theta)*cosf(-att.psi))*(-9.81f);
-	float g13 = (sinf(att.phi)*sinf(-att.psi) + cosf(att.phi)*sinf(att.theta)*cosf(-att.psi));
-	float g21 = (-cosf(att.phi)*cosf(-att.psi) - sinf(att.phi)*sinf(att.theta)*sinf(-att.psi))*(-9.81f);
-	float g22 = (cosf(att.phi)*cosf(att.theta)*sinf(-att.psi))*(-9.81f);
-	float g23 = (-sinf(att.phi)*cosf(-att.psi) + cosf(att.phi)*sinf(att.theta)*sinf(-att.psi));
-	float g31 = (-sinf(att.phi)*cosf(att.theta))*(-9.81f);
-	float g32 = (-cosf(att.phi)*sinf(att.theta))*(-9.81f);
-	float g33 = (cosf(att.phi)*cosf(att.theta));
-
-	// Next four blocks of the code are to compute the Moore-Penrose inverse of the G matrix
-	// (G'*G)
-	float a11 = g11*g11 + g21*g21 + g31*g31;
-	float a12 = g11*g12 + g21*g22 + g31*g32;
-	float a13 = g11*g13 + g21*g23 + g31*g33;
-	float a21 = g12*g11 + g22*g21 + g32*g31;
-	float a22 = g12*g12 + g22*g22 + g32*g32;
-	float a23 = g12*g13 + g22*g23 + g32*g33;
-	float a31 = g13*g11 + g23*g21 + g33*g31;
-	float a32 = g13*g12 + g23*g22 + g33*g32;
-	float a33 = g13*g13 + g23*g23 + g33*g33;
-
-	// Determinant of (G'*G)
-	float detG = (a11*a22*a33 + a12*a23*a31 + a21*a32*a13) - (a13*a22*a31 + a11*a32*a23 + a12*a21*a33); 
-
-	// Inverse of (G'*G)
-	float a11_inv = (a22*a33 - a23*a32)/detG;
-	float a12_inv = (a13*a32 - a12*a33)/detG;
-	float a13_inv = (a12*a23 - a13*a22)/detG;
-	float a21_inv = (a23*a31 - a21*a33)/detG;
-	float a22_inv = (a11*a33 - a13*a31)/detG;
-	float a23_inv = (a13*a21 - a11*a23)/detG;
-	float a31_inv = (a21*a32 - a22*a31)/detG;
-	float a32_inv = (a12*a31 - a11*a32)/detG;
-	float a33_inv = (a11*a22 - a12*a21)/detG; 
-
-	// G_inv = (G'*G)_inv*G'
-	float g11_inv = a11_inv*g11 + a12_inv*g12 + a13_inv*g13;
-	float g12_inv = a11_inv*g21 + a12_inv*g22 + a13_inv*g23;
-	float g13_inv = a11_inv*g31 + a12_inv*g32 + a13_inv*g33;
-	float g21_inv = a21_inv*g11 + a22_inv*g12 + a23_inv*g13;
-	float g22_inv = a21_inv*g21 + a22_inv*g22 + a23_inv*g23;
-	float g23_inv = a21_inv*g31 + a22_inv*g32 + a23_inv*g33;
-	float g31_inv = a31_inv*g11 + a32_inv*g12 + a33_inv*g13;
-	float g32_inv = a31_inv*g21 + a32_inv*g22 + a33_inv*g23;
-	float g33_inv = a31_inv*g31 + a32_inv*g32 + a33_inv*g33;
+	float g11 = (-sc.cphi*sc.spsi - sc.sphi*sc.stheta*sc.cpsi)*(-9.81f);
+	float g12 = (sc.cphi*sc.ctheta*sc.cpsi)*(-9.81f);
+	float g13 = (-sc.sphi*sc.spsi + sc.cphi*sc.stheta*sc.cpsi);
+	float g21 = (-sc.cphi*sc.cpsi + sc.sphi*sc.stheta*sc.spsi)*(-9.81f);
+	float g22 = (-sc.cphi*sc.ctheta*sc.spsi)*(-9.81f);
+	float g23 = (-sc.sphi*sc.cpsi - sc.cphi*sc.stheta*sc.spsi);
+	float g31 = (-sc.sphi*sc.ctheta)*(-9.81f);
+	float g32 = (-sc.cphi*sc.stheta)*(-9.81f);
+	float g33 = (sc.cphi*sc.ctheta);
+
+	// G is square, its Moore-Penrose inverse (G'*G)_inv*G' is its inverse,
+	// the adjugate over the determinant
+	float c11 = g22*g33 - g23*g32;
+	float c12 = g23*g31 - g21*g33;
+	float c13 = g21*g32 - g22*g31;
+	float detG_inv = 1.0f / (g11*c11 + g12*c12 + g13*c13);
+
+	float g11_inv = c11*detG_inv;
+	float g12_inv = (g13*g32 - g12*g33)*detG_inv;
+	float g13_inv = (g12*g23 - g13*g22)*detG_inv;
+	float g21_inv = c12*detG_inv;
+	float g22_inv = (g11*g33 - g13*g31)*detG_inv;
+	float g23_inv = (g13*g21 - g11*g23)*detG_inv;
+	float g31_inv = c13*detG_inv;
+	float g32_inv = (g12*g31 - g11*g32)*detG_inv;
+	float g33_inv = (g11*g22 - g12*g21)*detG_inv;
 
 	// Lin. accel. error multiplied  G^(-1) matrix (T_tilde negated because motor accepts only positiv commands, angles are in rad)
 	indiOuter.phi_tilde   = (g11_inv*indiOuter.linear_accel_err.x + g12_inv*indiOuter.linear_accel_err.y + g13_inv*indiOuter.linear_accel_err.z);
@@ -246,7 +238,7 @@ void positionControllerINDI(const sensorData_t *sensors,
 	indiOuter.T_tilde     = -(g31_inv*indiOuter.linear_accel_err.x + g32_inv*indiOuter.linear_accel_err.y + g33_inv*indiOuter.linear_accel_err.z)/K_thr; 	
 
 	// Filter thrust
-	filter_thrust(indiOuter.thr, &indiOuter.T_incremented, &indiOuter.T_inner_f);
+	filter_thrust(&indiOuter.thr, &indiOuter.T_incremented, &indiOuter.T_inner_f);
 
 	// Pass thrust through the model of the actuator dynamics
 	indiOuter.T_inner = indiOuter.T_inner + indiOuter.act_dyn_posINDI*(indiOuter.T_inner_f - indiOuter.T_inner); 
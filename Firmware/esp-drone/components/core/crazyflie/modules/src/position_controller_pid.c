@@ -174,6 +174,27 @@ void positionControllerInit()
   DEBUG_PRINTI("thrustBase = %d,thrustMin  = %d",this.thrustBase,this.thrustMin);
 }
 
+// cos and sin of the yaw, of the heading of R when the estimator has set it
+static void yawCosSin(const state_t *state, float *cosyaw, float *sinyaw)
+{
+  if (state->rotation.version != 0) {
+    const float headingX = state->rotation.R[0][0];
+    const float headingY = state->rotation.R[1][0];
+    const float norm2 = headingX * headingX + headingY * headingY;
+    // Pointing straight up or down the heading is lost
+    if (norm2 > 1e-6f) {
+      const float scale = 1.0f / sqrtf(norm2);
+      *cosyaw = headingX * scale;
+      *sinyaw = headingY * scale;
+      return;
+    }
+  }
+
+  const float yawRad = state->attitude.yaw * (float)M_PI / 180.0f;
+  *cosyaw = cosf(yawRad);
+  *sinyaw = sinf(yawRad);
+}
+
 static float runPid(float input, struct pidAxis_s *axis, float setpoint, float dt) {
   axis->setpoint = setpoint;
 
@@ -190,8 +211,8 @@ void positionController(float* thrust, attitude_t *attitude, setpoint_t *setpoin
   // this value is below 0.5
   this.pidZ.pid.outputLimit = fmaxf(zVelMax, 0.5f)  * velMaxOverhead;
 
-  float cosyaw = cosf(state->attitude.yaw * (float)M_PI / 180.0f);
-  float sinyaw = sinf(state->attitude.yaw * (float)M_PI / 180.0f);
+  float cosyaw, sinyaw;
+  yawCosSin(state, &cosyaw, &sinyaw);
   float bodyvx = setpoint->velocity.x;
   float bodyvy = setpoint->velocity.y;
 
@@ -226,9 +247,10 @@ void velocityController(float* thrust, attitude_t *attitude, setpoint_t *setpoin
   float rollRaw  = runPid(state->velocity.x, &this.pidVX, setpoint->velocity.x, DT);
   float pitchRaw = runPid(state->velocity.y, &this.pidVY, setpoint->velocity.y, DT);
 
-  float yawRad = state->attitude.yaw * (float)M_PI / 180;
-  attitude->pitch = -(rollRaw  * cosf(yawRad)) - (pitchRaw * sinf(yawRad));
-  attitude->roll  = -(pitchRaw * cosf(yawRad)) + (rollRaw  * sinf(yawRad));
+  float cosyaw, sinyaw;
+  yawCosSin(state, &cosyaw, &sinyaw);
+  attitude->pitch = -(rollRaw  * cosyaw) - (pitchRaw * sinyaw);
+  attitude->roll  = -(pitchRaw * cosyaw) + (rollRaw  * sinyaw);
 
   attitude->roll  = constrain(attitude->roll,  -rpLimit, rpLimit);
   attitude->pitch = constrain(attitude->pitch, -rpLimit, rpLimit);
@@ -25,10 +25,10 @@
  */
 
 #include <string.h>
+#include <math.h>
 
 #include "power_distribution.h"
 
-#include <string.h>
 #include "log.h"
 #include "param.h"
 #include "num.h"
@@ -39,19 +39,8 @@
 
 static bool motorSetEnable = false;
 
-static struct {
-  uint32_t m1;
-  uint32_t m2;
-  uint32_t m3;
-  uint32_t m4;
-} motorPower;
-
-static struct {
-  uint16_t m1;
-  uint16_t m2;
-  uint16_t m3;
-  uint16_t m4;
-} motorPowerSet;
+static uint32_t motorPower[NBR_OF_MOTORS];
+static uint16_t motorPowerSet[NBR_OF_MOTORS];
 
 #ifndef DEFAULT_IDLE_THRUST
 #define DEFAULT_IDLE_THRUST 0
@@ -59,8 +48,42 @@ static struct {
 
 static uint32_t idleThrust = DEFAULT_IDLE_THRUST;
 
+/**
+ * Share of the roll, pitch and yaw commands of every motor. All motors take
+ * the whole thrust.
+ */
+typedef struct {
+  float roll;
+  float pitch;
+  float yaw;
+} mixerRow_t;
+
+static const mixerRow_t mixerQuadX[NBR_OF_MOTORS] = {
+  { -0.5f,  0.5f,  1.0f },
+  { -0.5f, -0.5f, -1.0f },
+  {  0.5f, -0.5f,  1.0f },
+  {  0.5f,  0.5f, -1.0f },
+};
+
+#ifndef QUAD_FORMATION_X
+static const mixerRow_t mixerQuadPlus[NBR_OF_MOTORS] = {
+  {  0.0f,  1.0f,  1.0f },
+  { -1.0f,  0.0f, -1.0f },
+  {  0.0f, -1.0f,  1.0f },
+  {  1.0f,  0.0f, -1.0f },
+};
+#endif
+
+static const mixerRow_t *mixer = mixerQuadX;
+
 void powerDistributionInit(void)
 {
+#ifdef QUAD_FORMATION_X
+  mixer = mixerQuadX;
+#else // QUAD_FORMATION_NORMAL
+  mixer = mixerQuadPlus;
+#endif
+
   motorsInit(platformConfigGetMotorMapping());
 }
 
@@ -77,67 +100,94 @@ bool powerDistributionTest(void)
 
 void powerStop()
 {
-  motorsSetRatio(MOTOR_M1, 0);
-  motorsSetRatio(MOTOR_M2, 0);
-  motorsSetRatio(MOTOR_M3, 0);
-  motorsSetRatio(MOTOR_M4, 0);
+  const uint16_t ratios[NBR_OF_MOTORS] = {0};
+
+  motorsSetRatios(ratios);
 }
 
+#ifdef CONFIG_POWER_DIST_ATTITUDE_PRIORITY
+/**
+ * Move the thrust so that the attitude commands fit between the idle thrust and
+ * full power, and scale them down only when their spread is more than that
+ * range. The attitude keeps its authority at full and low throttle, at the cost
+ * of the thrust.
+ */
+static float prioritizeAttitude(float thrust, float attitude[NBR_OF_MOTORS])
+{
+  const float floor = idleThrust;
+  const float ceiling = UINT16_MAX;
+  float low = attitude[0];
+  float high = attitude[0];
+
+  for (int i = 1; i < NBR_OF_MOTORS; i++) {
+    low = fminf(low, attitude[i]);
+    high = fmaxf(high, attitude[i]);
+  }
+
+  const float spread = high - low;
+  if (spread > ceiling - floor) {
+    const float scale = (ceiling - floor) / spread;
+    for (int i = 0; i < NBR_OF_MOTORS; i++) {
+      attitude[i] *= scale;
+    }
+    low *= scale;
+    high *= scale;
+  }
+
+  if (thrust + high > ceiling) {
+    thrust = ceiling - high;
+  } else if (thrust + low < floor) {
+    thrust = floor - low;
+  }
+
+  return thrust;
+}
+#endif
+
 void powerDistribution(const control_t *control)
 {
-  #ifdef QUAD_FORMATION_X
-    int16_t r = control->roll / 2.0f;
-    int16_t p = control->pitch / 2.0f;
-    motorPower.m1 = limitThrust(control->thrust - r + p + control->yaw);
-    motorPower.m2 = limitThrust(control->thrust - r - p - control->yaw);
-    motorPower.m3 =  limitThrust(control->thrust + r - p + control->yaw);
-    motorPower.m4 =  limitThrust(control->thrust + r + p - control->yaw);
-  #else // QUAD_FORMATION_NORMAL
-    motorPower.m1 = limitThrust(control->thrust + control->pitch +
-                               control->yaw);
-    motorPower.m2 = limitThrust(control->thrust - control->roll -
-                               control->yaw);
-    motorPower.m3 =  limitThrust(control->thrust - control->pitch +
-                               control->yaw);
-    motorPower.m4 =  limitThrust(control->thrust + control->roll -
-                               control->yaw);
-  #endif
+  float attitude[NBR_OF_MOTORS];
+  float thrust = control->thrust;
+
+  for (int i = 0; i < NBR_OF_MOTORS; i++) {
+    attitude[i] = mixer[i].roll * control->roll + mixer[i].pitch * control->pitch + mixer[i].yaw * control->yaw;
+  }
+
+#ifdef CONFIG_POWER_DIST_ATTITUDE_PRIORITY
+  // Without thrust the motors stay off
+  if (thrust > 0.0f) {
+    thrust = prioritizeAttitude(thrust, attitude);
+  }
+#endif
+
+  for (int i = 0; i < NBR_OF_MOTORS; i++) {
+    motorPower[i] = limitThrust(thrust + attitude[i]);
+  }
 
   if (motorSetEnable)
   {
-    motorsSetRatio(MOTOR_M1, motorPowerSet.m1);
-    motorsSetRatio(MOTOR_M2, motorPowerSet.m2);
-    motorsSetRatio(MOTOR_M3, motorPowerSet.m3);
-    motorsSetRatio(MOTOR_M4, motorPowerSet.m4);
+    motorsSetRatios(motorPowerSet);
   }
   else
   {
-    if (motorPower.m1 < idleThrust) {
-      motorPower.m1 = idleThrust;
-    }
-    if (motorPower.m2 < idleThrust) {
-      motorPower.m2 = idleThrust;
-    }
-    if (motorPower.m3 < idleThrust) {
-      motorPower.m3 = idleThrust;
-    }
-    if (motorPower.m4 < idleThrust) {
-      motorPower.m4 = idleThrust;
-    }
+    uint16_t ratios[NBR_OF_MOTORS];
 
-    motorsSetRatio(MOTOR_M1, motorPower.m1);
-    motorsSetRatio(MOTOR_M2, motorPower.m2);
-    motorsSetRatio(MOTOR_M3, motorPower.m3);
-    motorsSetRatio(MOTOR_M4, motorPower.m4);
+    for (int i = 0; i < NBR_OF_MOTORS; i++) {
+      if (motorPower[i] < idleThrust) {
+        motorPower[i] = idleThrust;
+      }
+      ratios[i] = motorPower[i];
+    }
+    motorsSetRatios(ratios);
   }
 }
 
 PARAM_GROUP_START(motorPowerSet)
 PARAM_ADD(PARAM_UINT8, enable, &motorSetEnable)
-PARAM_ADD(PARAM_UINT16, m1, &motorPowerSet.m1)
-PARAM_ADD(PARAM_UINT16, m2, &motorPowerSet.m2)
-PARAM_ADD(PARAM_UINT16, m3, &motorPowerSet.m3)
-PARAM_ADD(PARAM_UINT16, m4, &motorPowerSet.m4)
+PARAM_ADD(PARAM_UINT16, m1, &motorPowerSet[0])
+PARAM_ADD(PARAM_UINT16, m2, &motorPowerSet[1])
+PARAM_ADD(PARAM_UINT16, m3, &motorPowerSet[2])
+PARAM_ADD(PARAM_UINT16, m4, &motorPowerSet[3])
 PARAM_GROUP_STOP(motorPowerSet)
 
 PARAM_GROUP_START(powerDist)
@@ -145,8 +195,8 @@ PARAM_ADD(PARAM_UINT32, idleThrust, &idleThrust)
 PARAM_GROUP_STOP(powerDist)
 
 LOG_GROUP_START(motor)
-LOG_ADD(LOG_UINT32, m1, &motorPower.m1)
-LOG_ADD(LOG_UINT32, m2, &motorPower.m2)
-LOG_ADD(LOG_UINT32, m3, &motorPower.m3)
-LOG_ADD(LOG_UINT32, m4, &motorPower.m4)
+LOG_ADD(LOG_UINT32, m1, &motorPower[0])
+LOG_ADD(LOG_UINT32, m2, &motorPower[1])
+LOG_ADD(LOG_UINT32, m3, &motorPower[2])
+LOG_ADD(LOG_UINT32, m4, &motorPower[3])
 LOG_GROUP_STOP(motor)
@@ -0,0 +1,108 @@
+/**
+ *
+ * ESP-Drone Firmware
+ *
+ * Copyright 2019-2020  Espressif Systems (Shanghai)
+ * Copyright (C) 2011-2012 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * power_save.c - A slower CPU clock and stabilizer loop while on the ground
+ *
+ * Only the stabilizer task takes and gives the lock, on the loops where the
+ * drone becomes active or idle. The Wi-Fi driver holds locks of its own while
+ * the radio needs them, which keep the APB at 80 MHz and, in practice, the
+ * chip out of light sleep while the access point runs.
+ */
+#define DEBUG_MODULE "PSAVE"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "FreeRTOS.h"
+#include "esp_pm.h"
+#include "sdkconfig.h"
+
+#include "config.h"
+#include "power_save.h"
+#include "log.h"
+#include "debug_cf.h"
+
+#ifdef CONFIG_POWER_SAVE_IDLE
+
+// The I2C and SPI clocks are set up for the 80 MHz of the APB
+#define POWER_SAVE_MIN_FREQ_MHZ 80
+
+static bool isInit;
+static esp_pm_lock_handle_t flightLock;
+
+// Stabilizer only
+static bool isIdle;
+static uint16_t idleCount;
+
+void powerSaveInit(void)
+{
+  const esp_pm_config_t config = {
+    .max_freq_mhz = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+    .min_freq_mhz = POWER_SAVE_MIN_FREQ_MHZ,
+#ifdef CONFIG_FREERTOS_USE_TICKLESS_IDLE
+    .light_sleep_enable = true,
+#endif
+  };
+  esp_err_t err;
+
+  if (isInit) {
+    return;
+  }
+
+  err = esp_pm_configure(&config);
+  if (err == ESP_OK) {
+    err = esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "flight", &flightLock);
+  }
+  if (err == ESP_OK) {
+    err = esp_pm_lock_acquire(flightLock);
+  }
+  if (err != ESP_OK) {
+    // The clock stays at its maximum, as without the power management
+    DEBUG_PRINT("power management not configured (%d)\n", err);
+  }
+
+  isInit = true;
+}
+
+bool powerSaveTick(bool isActive, uint32_t tick)
+{
+  if (isIdle == !isActive) {
+    return isActive || (tick % POWER_SAVE_IDLE_DIVIDER) == 0;
+  }
+
+  isIdle = !isActive;
+  if (flightLock) {
+    if (isIdle) {
+      esp_pm_lock_release(flightLock);
+      idleCount++;
+    } else {
+      esp_pm_lock_acquire(flightLock);
+    }
+  }
+  // The first active loop runs right away
+  return true;
+}
+
+LOG_GROUP_START(powerSave)
+LOG_ADD(LOG_UINT8, idle, &isIdle)
+LOG_ADD(LOG_UINT16, idleCount, &idleCount)
+LOG_GROUP_STOP(powerSave)
+
+#endif // CONFIG_POWER_SAVE_IDLE
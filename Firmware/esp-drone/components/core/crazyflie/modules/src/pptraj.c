@@ -41,8 +41,6 @@ See Daniel Mellinger, Vijay Kumar: "Minimum snap trajectory generation and contr
 
 #define GRAV (9.81f)
 
-static struct poly4d poly4d_tmp;
-
 // polynomials are stored with ascending degree
 
 void polylinear(float p[PP_SIZE], float duration, float x0, float x1)
@@ -234,30 +232,38 @@ void polyder4d(struct poly4d *p)
 	}
 }
 
-static struct vec polyval_xyz(struct poly4d const *p, float t)
-{
-	return mkvec(polyval(p->p[0], t), polyval(p->p[1], t), polyval(p->p[2], t));
-}
-
-static float polyval_yaw(struct poly4d const *p, float t)
+// evaluate the 4 axes and their first 3 derivatives in one horner pass.
+// d[k][axis] is the k-th derivative divided by k!, see poly4d_eval()
+static void polyval4d_der3(struct poly4d const *p, float t, float d[4][4])
 {
-	return polyval(p->p[3], t);
+	for (int axis = 0; axis < 4; ++axis) {
+		d[0][axis] = 0.0f;
+		d[1][axis] = 0.0f;
+		d[2][axis] = 0.0f;
+		d[3][axis] = 0.0f;
+	}
+	for (int i = PP_DEGREE; i >= 0; --i) {
+		for (int axis = 0; axis < 4; ++axis) {
+			d[3][axis] = d[3][axis] * t + d[2][axis];
+			d[2][axis] = d[2][axis] * t + d[1][axis];
+			d[1][axis] = d[1][axis] * t + d[0][axis];
+			d[0][axis] = d[0][axis] * t + p->p[axis][i];
+		}
+	}
 }
 
 // compute loose maximum of acceleration -
 // uses L1 norm instead of Euclidean, evaluates polynomial instead of root-finding
 float poly4d_max_accel_approx(struct poly4d const *p)
 {
-	struct poly4d* acc = &poly4d_tmp;
-	*acc = *p;
-	polyder4d(acc);
-	polyder4d(acc);
 	int steps = 10 * p->duration;
 	float step = p->duration / (steps - 1);
 	float t = 0;
 	float amax = 0;
 	for (int i = 0; i < steps; ++i) {
-		struct vec ddx = polyval_xyz(acc, t);
+		float d[4][4];
+		polyval4d_der3(p, t, d);
+		struct vec ddx = vscl(2.0f, mkvec(d[2][0], d[2][1], d[2][2]));
 		float ddx_minkowski = vnorm1(ddx);
 		if (ddx_minkowski > amax) amax = ddx_minkowski;
 		t += step;
@@ -291,25 +297,17 @@ bool is_traj_eval_valid(struct traj_eval const *ev)
 
 struct traj_eval poly4d_eval(struct poly4d const *p, float t)
 {
-	// flat variables
-	struct traj_eval out;
-	out.pos = polyval_xyz(p, t);
-	out.yaw = polyval_yaw(p, t);
-
-	// 1st derivative
-	struct poly4d* deriv = &poly4d_tmp;
-	*deriv = *p;
-	polyder4d(deriv);
-	out.vel = polyval_xyz(deriv, t);
-	float dyaw = polyval_yaw(deriv, t);
-
-	// 2nd derivative
-	polyder4d(deriv);
-	out.acc = polyval_xyz(deriv, t);
+	// flat variables and their derivatives, without a copy of the polynomials
+	float d[4][4];
+	polyval4d_der3(p, t, d);
 
-	// 3rd derivative
-	polyder4d(deriv);
-	struct vec jerk = polyval_xyz(deriv, t);
+	struct traj_eval out;
+	out.pos = mkvec(d[0][0], d[0][1], d[0][2]);
+	out.yaw = d[0][3];
+	out.vel = mkvec(d[1][0], d[1][1], d[1][2]);
+	float dyaw = d[1][3];
+	out.acc = mkvec(2.0f * d[2][0], 2.0f * d[2][1], 2.0f * d[2][2]);
+	struct vec jerk = mkvec(6.0f * d[3][0], 6.0f * d[3][1], 6.0f * d[3][2]);
 
 	struct vec thrust = vadd(out.acc, mkvec(0, 0, GRAV));
 	// float thrust_mag = mass * vmag(thrust);
@@ -333,22 +331,55 @@ struct traj_eval poly4d_eval(struct poly4d const *p, float t)
 // piecewise 4d polynomials
 //
 
+void piecewise_rewind(struct piecewise_traj *traj)
+{
+	traj->cursor_valid = false;
+}
+
+// load the piece at the cursor in the cache
+static void piecewise_load_cursor(struct piecewise_traj *traj)
+{
+	struct poly4d *piece = &traj->cursor_piece;
+	*piece = traj->pieces[traj->cursor];
+	poly4d_shift(piece, traj->shift.x, traj->shift.y, traj->shift.z, 0);
+	poly4d_stretchtime(piece, traj->timescale);
+	if (traj->cursor_reversed) {
+		for (int i = 0; i < 4; ++i) {
+			polyreflect(piece->p[i]);
+		}
+	}
+}
+
+// move the cursor to the first piece, if t is before the current one
+static void piecewise_seek(struct piecewise_traj *traj, float t, bool reversed)
+{
+	if (!traj->cursor_valid || traj->cursor_reversed != reversed || t < traj->cursor_t_begin) {
+		traj->cursor_valid = true;
+		traj->cursor_reversed = reversed;
+		traj->cursor = reversed ? traj->n_pieces - 1 : 0;
+		traj->cursor_t_begin = 0;
+		piecewise_load_cursor(traj);
+	}
+}
+
 // piecewise eval
+// the cursor only moves forward in time, so evaluating the trajectory at
+// increasing times is O(1) per call
 struct traj_eval piecewise_eval(
-  struct piecewise_traj const *traj, float t)
+  struct piecewise_traj *traj, float t)
 {
-	int cursor = 0;
 	t = t - traj->t_begin;
-	while (cursor < traj->n_pieces) {
-		struct poly4d const *piece = &(traj->pieces[cursor]);
-		if (t <= piece->duration * traj->timescale) {
-			poly4d_tmp = *piece;
-			poly4d_shift(&poly4d_tmp, traj->shift.x, traj->shift.y, traj->shift.z, 0);
-			poly4d_stretchtime(&poly4d_tmp, traj->timescale);
-			return poly4d_eval(&poly4d_tmp, t);
+	piecewise_seek(traj, t, false);
+	while (traj->cursor < traj->n_pieces) {
+		float duration = traj->cursor_piece.duration;
+		if (t - traj->cursor_t_begin <= duration) {
+			return poly4d_eval(&traj->cursor_piece, t - traj->cursor_t_begin);
+		}
+		traj->cursor_t_begin += duration;
+		++traj->cursor;
+		if (traj->cursor < traj->n_pieces) {
+			piecewise_load_cursor(traj);
 		}
-		t -= piece->duration * traj->timescale;
-		++cursor;
 	}
 	// if we get here, the trajectory has ended
 	struct poly4d const *end_piece = &(traj->pieces[traj->n_pieces - 1]);
@@ -361,24 +392,20 @@ struct traj_eval piecewise_eval(
 }
 
 struct traj_eval piecewise_eval_reversed(
-  struct piecewise_traj const *traj, float t)
+  struct piecewise_traj *traj, float t)
 {
-	int cursor = traj->n_pieces - 1;
 	t = t - traj->t_begin;
-	while (cursor >= 0) {
-		struct poly4d const *piece = &(traj->pieces[cursor]);
-		if (t <= piece->duration * traj->timescale) {
-			poly4d_tmp = *piece;
-			poly4d_shift(&poly4d_tmp, traj->shift.x, traj->shift.y, traj->shift.z, 0);
-			poly4d_stretchtime(&poly4d_tmp, traj->timescale);
-			for (int i = 0; i < 4; ++i) {
-				polyreflect(poly4d_tmp.p[i]);
-			}
-			t = t - piece->duration * traj->timescale;
-			return poly4d_eval(&poly4d_tmp, t);
+	piecewise_seek(traj, t, true);
+	while (traj->cursor >= 0) {
+		float duration = traj->cursor_piece.duration;
+		if (t - traj->cursor_t_begin <= duration) {
+			return poly4d_eval(&traj->cursor_piece, t - traj->cursor_t_begin - duration);
+		}
+		traj->cursor_t_begin += duration;
+		--traj->cursor;
+		if (traj->cursor >= 0) {
+			piecewise_load_cursor(traj);
 		}
-		t -= piece->duration * traj->timescale;
-		--cursor;
 	}
 	// if we get here, the trajectory has ended
 	struct poly4d const *end_piece = &(traj->pieces[0]);
@@ -401,6 +428,7 @@ void piecewise_plan_5th_order(struct piecewise_traj *pp, float duration,
 	pp->timescale = 1.0;
 	pp->shift = vzero();
 	pp->n_pieces = 1;
+	piecewise_rewind(pp);
 	poly5(p->p[0], duration, p0.x, v0.x, a0.x, p1.x, v1.x, a1.x);
 	poly5(p->p[1], duration, p0.y, v0.y, a0.y, p1.y, v1.y, a1.y);
 	poly5(p->p[2], duration, p0.z, v0.z, a0.z, p1.z, v1.z, a1.z);
@@ -417,6 +445,7 @@ void piecewise_plan_7th_order_no_jerk(struct piecewise_traj *pp, float duration,
 	pp->timescale = 1.0;
 	pp->shift = vzero();
 	pp->n_pieces = 1;
+	piecewise_rewind(pp);
 	poly7_nojerk(p->p[0], duration, p0.x, v0.x, a0.x, p1.x, v1.x, a1.x);
 	poly7_nojerk(p->p[1], duration, p0.y, v0.y, a0.y, p1.y, v1.y, a1.y);
 	poly7_nojerk(p->p[2], duration, p0.z, v0.z, a0.z, p1.z, v1.z, a1.z);
@@ -240,6 +240,25 @@ void piecewise_compressed_load(struct piecewise_traj_compressed *traj, const voi
   traj->duration = calculate_total_duration(traj->current_piece.data);
 }
 
+size_t piecewise_compressed_size(const void* data, size_t available)
+{
+  // The start coordinates, then the pieces up to the one without duration
+  size_t size = 4 * sizeof(compressed_piece_coordinate);
+  compressed_piece_ptr ptr = data;
+
+  while (size + 1 + sizeof(uint16_t) <= available) {
+    struct compressed_piece_parsed_header header;
+    compressed_piece_ptr next = parse_header_of_current_piece(&header, ptr + size);
+
+    if (!next) {
+      return size + 1 + sizeof(uint16_t);
+    }
+    size = next - ptr;
+  }
+
+  return 0;
+}
+
 static void piecewise_compressed_rewind(struct piecewise_traj_compressed *traj)
 {
   struct traj_eval stopped;
@@ -28,147 +28,238 @@
 
 #include "queuemonitor.h"
 
-#ifdef DEBUG_QUEUE_MONITOR
+#ifdef CONFIG_QUEUE_MONITOR
 
 #include <stdbool.h>
-#include "timers.h"
-#include "debug_cf.h"
-#include "cfassert.h"
+#include <stdint.h>
+#include <string.h>
 
-#define MAX_NR_OF_QUEUES 20
-#define TIMER_PERIOD M2T(10000)
+#include "log.h"
+#include "param.h"
+#include "usec_time.h"
 
-#define RESET_COUNTERS_AFTER_DISPLAY true
-#define DISPLAY_ONLY_OVERFLOW_QUEUES true
+// Bucket b of the histograms counts latencies of [2^(9+b), 2^(10+b)) us, the
+// first and the last bucket are open ended
+#define QM_NBR_OF_BUCKETS     8
+#define QM_FIRST_BUCKET_LOG2  10
 
 typedef struct
 {
-  char* fileName;
-  char* queueName;
-  int sendCount;
-  int maxWaiting;
-  int fullCount;
+  uint32_t sentCount;
+  uint32_t receivedCount;
+  uint32_t droppedCount;
+  uint16_t peakDepth;
+  uint32_t latency;       // Last sample, in us
+  uint32_t latencyMax;
+  uint16_t histogram[QM_NBR_OF_BUCKETS];
+
+  // Sent item being timed
+  bool isSampling;
+  uint32_t sampleIndex;
+  uint64_t sampleTimestamp;
+  // Last value of a mailbox
+  uint64_t sentTimestamp;
 } Data;
 
-static Data data[MAX_NR_OF_QUEUES];
+static Data data[QM_NBR_OF_QUEUES];
+static uint8_t resetRequest;
 
-static xTimerHandle timer;
-static StaticTimer_t timerBuffer;
-static unsigned char nrOfQueues = 1; // Unregistered queues will end up at 0
-static bool initialized = false;
+// Queues are used from both cores and from ISRs
+static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
 
-static void timerHandler(xTimerHandle timer);
-static void debugPrint();
-static bool filter(Data* queueData);
-static void debugPrintQueue(Data* queueData);
-static Data* getQueueData(xQueueHandle* xQueue);
-static int getMaxWaiting(xQueueHandle* xQueue, int prevPeak);
-static void resetCounters();
-
-unsigned char ucQueueGetQueueNumber( xQueueHandle xQueue );
-
-
-void queueMonitorInit() {
-  ASSERT(!initialized);
-  timer = xTimerCreateStatic( "queueMonitorTimer", TIMER_PERIOD,
-    pdTRUE, NULL, timerHandler, &timerBuffer);
-  xTimerStart(timer, 100);
-
-  data[0].fileName = "Na";
-  data[0].queueName = "Na";
-
-  initialized = true;
+static void resetCounters()
+{
+  for (int i = 0; i < QM_NBR_OF_QUEUES; i++) {
+    // The counts keep matching the items in the queue
+    const uint32_t sentCount = data[i].sentCount;
+    const uint32_t receivedCount = data[i].receivedCount;
+    memset(&data[i], 0, sizeof(data[i]));
+    data[i].sentCount = sentCount;
+    data[i].receivedCount = receivedCount;
+  }
+  resetRequest = 0;
 }
 
-void qm_traceQUEUE_SEND(void* xQueue) {
-  if(initialized) {
-    Data* queueData = getQueueData(xQueue);
+static void addLatency(Data* queueData, uint32_t latency)
+{
+  int bucket = 0;
 
-    queueData->sendCount++;
-    queueData->maxWaiting = getMaxWaiting(xQueue, queueData->maxWaiting);
+  queueData->latency = latency;
+  if (latency > queueData->latencyMax) {
+    queueData->latencyMax = latency;
   }
-}
 
-void qm_traceQUEUE_SEND_FAILED(void* xQueue) {
-  if(initialized) {
-    Data* queueData = getQueueData(xQueue);
-
-    queueData->fullCount++;
+  while (bucket < QM_NBR_OF_BUCKETS - 1 && latency >= (1u << (QM_FIRST_BUCKET_LOG2 + bucket))) {
+    bucket++;
+  }
+  if (queueData->histogram[bucket] < UINT16_MAX) {
+    queueData->histogram[bucket]++;
   }
 }
 
-void qmRegisterQueue(xQueueHandle* xQueue, char* fileName, char* queueName) {
-  ASSERT(initialized);
-  ASSERT(nrOfQueues < MAX_NR_OF_QUEUES);
-  Data* queueData = &data[nrOfQueues];
-
-  queueData->fileName = fileName;
-  queueData->queueName = queueName;
-  vQueueSetQueueNumber(xQueue, nrOfQueues);
+void queueMonitorSent(qmQueueId_t id, xQueueHandle queue, BaseType_t result)
+{
+  Data* queueData = &data[id];
+  const uint64_t now = usecTimestamp();
+  const UBaseType_t depth = (queue != NULL) ? uxQueueMessagesWaitingFromISR(queue) : 1;
 
-  nrOfQueues++;
-}
+  portENTER_CRITICAL_SAFE(&lock);
+  if (resetRequest) {
+    resetCounters();
+  }
 
-static Data* getQueueData(xQueueHandle* xQueue) {
-  unsigned char number = uxQueueGetQueueNumber(xQueue);
-  ASSERT(number < MAX_NR_OF_QUEUES);
-  return &data[number];
-}
+  if (result != pdTRUE) {
+    queueData->droppedCount++;
+  } else {
+    const uint32_t index = queueData->sentCount++;
 
-static int getMaxWaiting(xQueueHandle* xQueue, int prevPeak) {
-  // We get here before the current item is added to the queue.
-  // Must add 1 to get the peak value.
-  unsigned portBASE_TYPE waiting = uxQueueMessagesWaitingFromISR(xQueue) + 1;
+    if (depth > queueData->peakDepth) {
+      queueData->peakDepth = depth;
+    }
+    queueData->sentTimestamp = now;
 
-  if (waiting > prevPeak) {
-    return waiting;
+    // Skip items received before they are reported as sent
+    if (!queueData->isSampling && (int32_t)(queueData->receivedCount - index) <= 0) {
+      queueData->isSampling = true;
+      queueData->sampleIndex = index;
+      queueData->sampleTimestamp = now;
+    }
   }
-  return prevPeak;
+  portEXIT_CRITICAL_SAFE(&lock);
 }
 
-static void debugPrint() {
-  int i = 0;
-  for (i = 0; i < nrOfQueues; i++) {
-    Data* queueData = &data[i];
-    if (filter(queueData)) {
-      debugPrintQueue(queueData);
-    }
-  }
+void queueMonitorReceived(qmQueueId_t id, BaseType_t result)
+{
+  Data* queueData = &data[id];
 
-  if (RESET_COUNTERS_AFTER_DISPLAY) {
-    resetCounters();
+  if (result != pdTRUE) {
+    return;
   }
-}
 
-static bool filter(Data* queueData) {
-  bool doDisplay = false;
-  if (DISPLAY_ONLY_OVERFLOW_QUEUES) {
-    doDisplay = (queueData->fullCount != 0);
-  } else {
-    doDisplay = true;
+  const uint64_t now = usecTimestamp();
+
+  portENTER_CRITICAL_SAFE(&lock);
+  const uint32_t index = queueData->receivedCount++;
+
+  if (queueData->isSampling) {
+    if (index == queueData->sampleIndex) {
+      addLatency(queueData, now - queueData->sampleTimestamp);
+      queueData->isSampling = false;
+    } else if ((int32_t)(index - queueData->sampleIndex) > 0) {
+      // Lost track of the item, e.g. after a reset of the queue
+      queueData->isSampling = false;
+    }
   }
-  return doDisplay;
+  portEXIT_CRITICAL_SAFE(&lock);
 }
 
-static void debugPrintQueue(Data* queueData) {
-  DEBUG_PRINT("%s:%s, sent: %i, peak: %i, full: %i\n",
-    queueData->fileName, queueData->queueName, queueData->sendCount,
-    queueData->maxWaiting, queueData->fullCount);
-}
+void queueMonitorPeeked(qmQueueId_t id, BaseType_t result)
+{
+  Data* queueData = &data[id];
 
-static void resetCounters() {
-  int i = 0;
-  for (i = 0; i < nrOfQueues; i++) {
-    Data* queueData = &data[i];
+  if (result != pdTRUE) {
+    return;
+  }
+
+  const uint64_t now = usecTimestamp();
 
-    queueData->sendCount = 0;
-    queueData->maxWaiting = 0;
-    queueData->fullCount = 0;
+  portENTER_CRITICAL_SAFE(&lock);
+  if (queueData->sentTimestamp != 0) {
+    addLatency(queueData, now - queueData->sentTimestamp);
   }
+  portEXIT_CRITICAL_SAFE(&lock);
 }
 
-static void timerHandler(xTimerHandle timer) {
-  debugPrint();
+void queueMonitorReset(qmQueueId_t id)
+{
+  Data* queueData = &data[id];
+
+  portENTER_CRITICAL_SAFE(&lock);
+  queueData->receivedCount = queueData->sentCount;
+  queueData->isSampling = false;
+  portEXIT_CRITICAL_SAFE(&lock);
 }
 
-#endif // DEBUG_QUEUE_MONITOR
+PARAM_GROUP_START(queueMon)
+PARAM_ADD(PARAM_UINT8, reset, &resetRequest)
+PARAM_GROUP_STOP(queueMon)
+
+// Latencies in us
+LOG_GROUP_START(queueMon)
+LOG_ADD(LOG_UINT32, udpRxDrop, &data[qmUdpRx].droppedCount)
+LOG_ADD(LOG_UINT16, udpRxPeak, &data[qmUdpRx].peakDepth)
+LOG_ADD(LOG_UINT32, udpRxLat, &data[qmUdpRx].latency)
+LOG_ADD(LOG_UINT32, udpRxLatMax, &data[qmUdpRx].latencyMax)
+LOG_ADD(LOG_UINT32, udpTxDrop, &data[qmUdpTx].droppedCount)
+LOG_ADD(LOG_UINT16, udpTxPeak, &data[qmUdpTx].peakDepth)
+LOG_ADD(LOG_UINT32, udpTxLat, &data[qmUdpTx].latency)
+LOG_ADD(LOG_UINT32, udpTxLatMax, &data[qmUdpTx].latencyMax)
+LOG_ADD(LOG_UINT32, crtpTxDrop, &data[qmCrtpTx].droppedCount)
+LOG_ADD(LOG_UINT16, crtpTxPeak, &data[qmCrtpTx].peakDepth)
+LOG_ADD(LOG_UINT32, crtpTxLat, &data[qmCrtpTx].latency)
+LOG_ADD(LOG_UINT32, crtpTxLatMax, &data[qmCrtpTx].latencyMax)
+LOG_ADD(LOG_UINT32, crtpRxDrop, &data[qmCrtpRx].droppedCount)
+LOG_ADD(LOG_UINT16, crtpRxPeak, &data[qmCrtpRx].peakDepth)
+LOG_ADD(LOG_UINT32, spAge, &data[qmSetpoint].latency)
+LOG_ADD(LOG_UINT32, spAgeMax, &data[qmSetpoint].latencyMax)
+LOG_ADD(LOG_UINT32, tofAge, &data[qmTof].latency)
+LOG_ADD(LOG_UINT32, tofAgeMax, &data[qmTof].latencyMax)
+LOG_ADD(LOG_UINT32, workerDrop, &data[qmWorker].droppedCount)
+LOG_ADD(LOG_UINT16, workerPeak, &data[qmWorker].peakDepth)
+LOG_ADD(LOG_UINT32, workerLat, &data[qmWorker].latency)
+LOG_ADD(LOG_UINT32, workerLatMax, &data[qmWorker].latencyMax)
+LOG_GROUP_STOP(queueMon)
+
+// Number of samples per bucket, see QM_FIRST_BUCKET_LOG2
+LOG_GROUP_START(queueMonHist)
+LOG_ADD(LOG_UINT16, udpRx0, &data[qmUdpRx].histogram[0])
+LOG_ADD(LOG_UINT16, udpRx1, &data[qmUdpRx].histogram[1])
+LOG_ADD(LOG_UINT16, udpRx2, &data[qmUdpRx].histogram[2])
+LOG_ADD(LOG_UINT16, udpRx3, &data[qmUdpRx].histogram[3])
+LOG_ADD(LOG_UINT16, udpRx4, &data[qmUdpRx].histogram[4])
+LOG_ADD(LOG_UINT16, udpRx5, &data[qmUdpRx].histogram[5])
+LOG_ADD(LOG_UINT16, udpRx6, &data[qmUdpRx].histogram[6])
+LOG_ADD(LOG_UINT16, udpRx7, &data[qmUdpRx].histogram[7])
+LOG_ADD(LOG_UINT16, udpTx0, &data[qmUdpTx].histogram[0])
+LOG_ADD(LOG_UINT16, udpTx1, &data[qmUdpTx].histogram[1])
+LOG_ADD(LOG_UINT16, udpTx2, &data[qmUdpTx].histogram[2])
+LOG_ADD(LOG_UINT16, udpTx3, &data[qmUdpTx].histogram[3])
+LOG_ADD(LOG_UINT16, udpTx4, &data[qmUdpTx].histogram[4])
+LOG_ADD(LOG_UINT16, udpTx5, &data[qmUdpTx].histogram[5])
+LOG_ADD(LOG_UINT16, udpTx6, &data[qmUdpTx].histogram[6])
+LOG_ADD(LOG_UINT16, udpTx7, &data[qmUdpTx].histogram[7])
+LOG_ADD(LOG_UINT16, crtpTx0, &data[qmCrtpTx].histogram[0])
+LOG_ADD(LOG_UINT16, crtpTx1, &data[qmCrtpTx].histogram[1])
+LOG_ADD(LOG_UINT16, crtpTx2, &data[qmCrtpTx].histogram[2])
+LOG_ADD(LOG_UINT16, crtpTx3, &data[qmCrtpTx].histogram[3])
+LOG_ADD(LOG_UINT16, crtpTx4, &data[qmCrtpTx].histogram[4])
+LOG_ADD(LOG_UINT16, crtpTx5, &data[qmCrtpTx].histogram[5])
+LOG_ADD(LOG_UINT16, crtpTx6, &data[qmCrtpTx].histogram[6])
+LOG_ADD(LOG_UINT16, crtpTx7, &data[qmCrtpTx].histogram[7])
+LOG_ADD(LOG_UINT16, sp0, &data[qmSetpoint].histogram[0])
+LOG_ADD(LOG_UINT16, sp1, &data[qmSetpoint].histogram[1])
+LOG_ADD(LOG_UINT16, sp2, &data[qmSetpoint].histogram[2])
+LOG_ADD(LOG_UINT16, sp3, &data[qmSetpoint].histogram[3])
+LOG_ADD(LOG_UINT16, sp4, &data[qmSetpoint].histogram[4])
+LOG_ADD(LOG_UINT16, sp5, &data[qmSetpoint].histogram[5])
+LOG_ADD(LOG_UINT16, sp6, &data[qmSetpoint].histogram[6])
+LOG_ADD(LOG_UINT16, sp7, &data[qmSetpoint].histogram[7])
+LOG_ADD(LOG_UINT16, tof0, &data[qmTof].histogram[0])
+LOG_ADD(LOG_UINT16, tof1, &data[qmTof].histogram[1])
+LOG_ADD(LOG_UINT16, tof2, &data[qmTof].histogram[2])
+LOG_ADD(LOG_UINT16, tof3, &data[qmTof].histogram[3])
+LOG_ADD(LOG_UINT16, tof4, &data[qmTof].histogram[4])
+LOG_ADD(LOG_UINT16, tof5, &data[qmTof].histogram[5])
+LOG_ADD(LOG_UINT16, tof6, &data[qmTof].histogram[6])
+LOG_ADD(LOG_UINT16, tof7, &data[qmTof].histogram[7])
+LOG_ADD(LOG_UINT16, worker0, &data[qmWorker].histogram[0])
+LOG_ADD(LOG_UINT16, worker1, &data[qmWorker].histogram[1])
+LOG_ADD(LOG_UINT16, worker2, &data[qmWorker].histogram[2])
+LOG_ADD(LOG_UINT16, worker3, &data[qmWorker].histogram[3])
+LOG_ADD(LOG_UINT16, worker4, &data[qmWorker].histogram[4])
+LOG_ADD(LOG_UINT16, worker5, &data[qmWorker].histogram[5])
+LOG_ADD(LOG_UINT16, worker6, &data[qmWorker].histogram[6])
+LOG_ADD(LOG_UINT16, worker7, &data[qmWorker].histogram[7])
+LOG_GROUP_STOP(queueMonHist)
+
+#endif // CONFIG_QUEUE_MONITOR
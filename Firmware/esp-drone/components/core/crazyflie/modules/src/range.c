@@ -25,6 +25,7 @@
  *           and make them available as log
  */
 #include <stdint.h>
+#include <math.h>
 
 #include "log.h"
 
@@ -54,7 +55,68 @@ bool rangeEnqueueDownRangeInEstimator(float distance, float stdDev, uint32_t tim
   tofData.distance = distance;
   tofData.stdDev = stdDev;
 
-  return estimatorEnqueueTOF(&tofData);
+  const bool enqueued = estimatorEnqueueTOF(&tofData);
+  rangeDownUpdated();
+
+  return enqueued;
+}
+
+void __attribute__((weak)) rangeDownUpdated(void)
+{
+}
+
+void rangeNoiseModelBuild(rangeNoiseModel_t *model, float xMin, float xMax,
+                          float (*stdDevOf)(float x, const void *arg), const void *arg)
+{
+  const float step = (xMax - xMin) / (RANGE_NOISE_MODEL_POINTS - 1);
+
+  model->xMin = xMin;
+  model->invStep = 1.0f / step;
+  for (int i = 0; i < RANGE_NOISE_MODEL_POINTS; i++) {
+    model->stdDev[i] = stdDevOf(xMin + i * step, arg);
+  }
+}
+
+typedef struct {
+  float pointA;
+  float stdA;
+  float coeff;
+} expModel_t;
+
+static float expStdDevOf(float x, const void *arg)
+{
+  const expModel_t *expModel = arg;
+
+  return expModel->stdA * (1.0f + expf(expModel->coeff * (x - expModel->pointA)));
+}
+
+void rangeNoiseModelBuildExp(rangeNoiseModel_t *model, float xMax,
+                             float pointA, float stdA, float pointB, float stdB)
+{
+  const expModel_t expModel = {
+    .pointA = pointA,
+    .stdA = stdA,
+    .coeff = logf(stdB / stdA) / (pointB - pointA),
+  };
+
+  rangeNoiseModelBuild(model, 0.0f, xMax, expStdDevOf, &expModel);
+}
+
+float rangeNoiseModelStdDev(const rangeNoiseModel_t *model, float x)
+{
+  const float t = (x - model->xMin) * model->invStep;
+
+  if (!(t > 0.0f)) {
+    return model->stdDev[0];
+  }
+  if (t >= RANGE_NOISE_MODEL_POINTS - 1) {
+    return model->stdDev[RANGE_NOISE_MODEL_POINTS - 1];
+  }
+
+  const int i = (int)t;
+  const float frac = t - i;
+
+  return model->stdDev[i] + frac * (model->stdDev[i + 1] - model->stdDev[i]);
 }
 
 LOG_GROUP_START(range)
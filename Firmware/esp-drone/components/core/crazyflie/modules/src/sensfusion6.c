@@ -24,6 +24,7 @@
  *
  */
 #include <math.h>
+#include <stdint.h>
 
 #include "sensfusion6.h"
 #include "log.h"
@@ -65,6 +66,10 @@ static bool isInit;
 
 static bool isCalibrated = false;
 
+// 0.5 * dt in rad per deg of the last sensfusion6PredictQ(), the dt rarely changes
+static float predictDt;
+static float predictScale;
+
 static void sensfusion6UpdateQImpl(float gx, float gy, float gz, float ax, float ay, float az, float dt);
 static float sensfusion6GetAccZ(const float ax, const float ay, const float az);
 static void estimatedGravityDirection(float* gx, float* gy, float* gz);
@@ -96,6 +101,47 @@ void sensfusion6UpdateQ(float gx, float gy, float gz, float ax, float ay, float
   }
 }
 
+void sensfusion6PredictQ(float gx, float gy, float gz, float dt)
+{
+  if (dt != predictDt) {
+    predictDt = dt;
+    predictScale = 0.5f * dt * M_PI_F / 180;
+  }
+  gx *= predictScale;
+  gy *= predictScale;
+  gz *= predictScale;
+
+  // First order integration, the same as in sensfusion6UpdateQImpl()
+  const float qa = qw;
+  const float qb = qx;
+  const float qc = qy;
+  qw += (-qb * gx - qc * gy - qz * gz);
+  qx += (qa * gx + qc * gz - qz * gy);
+  qy += (qa * gy - qb * gz + qz * gx);
+  qz += (qa * gz + qb * gy - qc * gx);
+
+  // The norm only drifts by the square of the small step, one Newton step from 1 is enough
+  const float recipNorm = 1.5f - 0.5f * (qw * qw + qx * qx + qy * qy + qz * qz);
+  qw *= recipNorm;
+  qx *= recipNorm;
+  qy *= recipNorm;
+  qz *= recipNorm;
+
+  estimatedGravityDirection(&gravX, &gravY, &gravZ);
+}
+
+void sensfusion6CorrectQ(float ax, float ay, float az, float dt)
+{
+  // No rotation from the gyro, only the feedback of the accelerometer
+  sensfusion6UpdateQImpl(0.0f, 0.0f, 0.0f, ax, ay, az, dt);
+  estimatedGravityDirection(&gravX, &gravY, &gravZ);
+
+  if (!isCalibrated) {
+    baseZacc = sensfusion6GetAccZ(ax, ay, az);
+    isCalibrated = true;
+  }
+}
+
 #ifdef MADWICK_QUATERNION_IMU
 // Implementation of Madgwick's IMU and AHRS algorithms.
 // See: http://www.x-io.co.uk/open-source-ahrs-with-x-imu
@@ -293,7 +339,7 @@ float invSqrt(float x)
 {
   float halfx = 0.5f * x;
   float y = x;
-  long i = *(long*)&y;
+  int32_t i = *(int32_t*)&y;
   i = 0x5f3759df - (i>>1);
   y = *(float*)&i;
   y = y * (1.5f - (halfx * y * y));
@@ -35,6 +35,7 @@
 #include "commander.h"
 #include "stabilizer.h"
 #include "motors.h"
+#include "spsc_ring.h"
 
 /* Trigger object used to detect Free Fall situation. */
 static trigger_t sitAwFFAccWZ;
@@ -91,6 +92,39 @@ PARAM_GROUP_STOP(sitAw)
 
 #endif /* SITAW_ENABLED */
 
+#if RATE_MAIN_LOOP % SITAW_RATE != 0
+#error "SITAW_RATE must divide RATE_MAIN_LOOP"
+#endif
+
+/* Statistics shared by the detectors, of the samples since their last run. */
+typedef struct {
+  Axis3f acc;       /* Mean acceleration in the body frame (g). */
+  float accMagSq;   /* Squared magnitude of the mean acceleration (g^2). */
+  float accWZ;      /* Mean vertical acceleration in the world frame, 0 at rest (g). */
+} sitAwStats_t;
+
+/* Sums of the samples since the last run of the detectors. */
+static Axis3f sitAwAccSum;
+static float sitAwAccWZSum;
+static uint32_t sitAwSampleCount;
+
+/* One event queue per subscriber, written by the stabilizer only. */
+NO_DMA_CCM_SAFE_ZERO_INIT static uint8_t sitAwEventStorage[SITAW_MAX_SUBSCRIBERS][SITAW_EVENT_QUEUE_LENGTH * sizeof(sitAwEvent_t)];
+static SpscRing_t sitAwEventQueues[SITAW_MAX_SUBSCRIBERS];
+static bool sitAwSubscriberReady[SITAW_MAX_SUBSCRIBERS];
+static uint32_t sitAwSubscriberCount;
+
+/* The detections the last events were published for. */
+#ifdef SITAW_FF_ENABLED
+static bool sitAwFFPublished;
+#endif
+#ifdef SITAW_AR_ENABLED
+static bool sitAwARPublished;
+#endif
+#ifdef SITAW_TU_ENABLED
+static bool sitAwTuPublished;
+#endif
+
 // forward declaration of private functions
 #ifdef SITAW_FF_ENABLED
 static void sitAwFFTest(float accWZ, float accMag);
@@ -102,19 +136,92 @@ static void sitAwARTest(float accX, float accY, float accZ);
 static void sitAwTuTest(float accz);
 #endif
 
-static void sitAwPostStateUpdateCallOut(const sensorData_t *sensorData,
-                                        const state_t *state)
+int sitAwSubscribe(void)
+{
+  const uint32_t subscriber = __atomic_fetch_add(&sitAwSubscriberCount, 1, __ATOMIC_RELAXED);
+  if (subscriber >= SITAW_MAX_SUBSCRIBERS) {
+    return -1;
+  }
+
+  sitAwEventQueues[subscriber] = (SpscRing_t){
+    .storage = sitAwEventStorage[subscriber],
+    .itemSize = sizeof(sitAwEvent_t),
+    .length = SITAW_EVENT_QUEUE_LENGTH,
+  };
+  /* The stabilizer only pushes to the queue once it is set up. */
+  __atomic_store_n(&sitAwSubscriberReady[subscriber], true, __ATOMIC_RELEASE);
+
+  return subscriber;
+}
+
+bool sitAwPollEvent(int subscriber, sitAwEvent_t *event)
+{
+  if (subscriber < 0 || subscriber >= SITAW_MAX_SUBSCRIBERS) {
+    return false;
+  }
+
+  return spscRingPop(&sitAwEventQueues[subscriber], event);
+}
+
+static void sitAwPublish(sitAwEventType_t type, bool detected, bool *published, uint32_t tick)
+{
+  if (detected == *published) {
+    return;
+  }
+  *published = detected;
+
+  const sitAwEvent_t event = {
+    .type = type,
+    .detected = detected,
+    .tick = tick,
+  };
+  for (int i = 0; i < SITAW_MAX_SUBSCRIBERS; i++) {
+    if (__atomic_load_n(&sitAwSubscriberReady[i], __ATOMIC_ACQUIRE)) {
+      spscRingPush(&sitAwEventQueues[i], &event);
+    }
+  }
+}
+
+/**
+ * The shared statistics stage. Every stabilizer tick only adds to the sums,
+ * the means are taken when the detectors run.
+ */
+static void sitAwAccumulate(const sensorData_t *sensorData, const state_t *state)
+{
+  sitAwAccSum.x += sensorData->acc.x;
+  sitAwAccSum.y += sensorData->acc.y;
+  sitAwAccSum.z += sensorData->acc.z;
+  sitAwAccWZSum += state->acc.z;
+  sitAwSampleCount++;
+}
+
+static void sitAwTakeStats(sitAwStats_t *stats)
+{
+  const float scale = 1.0f / sitAwSampleCount;
+
+  stats->acc.x = sitAwAccSum.x * scale;
+  stats->acc.y = sitAwAccSum.y * scale;
+  stats->acc.z = sitAwAccSum.z * scale;
+  stats->accMagSq = stats->acc.x * stats->acc.x + stats->acc.y * stats->acc.y + stats->acc.z * stats->acc.z;
+  stats->accWZ = sitAwAccWZSum * scale;
+
+  sitAwAccSum = (Axis3f){.axis = {0}};
+  sitAwAccWZSum = 0;
+  sitAwSampleCount = 0;
+}
+
+static void sitAwRunDetectors(uint32_t tick)
 {
   /* Code that shall run AFTER each attitude update, should be placed here. */
 
 #if defined(SITAW_ENABLED)
-#ifdef SITAW_FF_ENABLED
-  float accMAG = (sensorData->acc.x*sensorData->acc.x) +
-                 (sensorData->acc.y*sensorData->acc.y) +
-                 (sensorData->acc.z*sensorData->acc.z);
+  sitAwStats_t stats;
+  sitAwTakeStats(&stats);
 
+#ifdef SITAW_FF_ENABLED
   /* Test values for Free Fall detection. */
-  sitAwFFTest(state->acc.z, accMAG);
+  sitAwFFTest(stats.accWZ, stats.accMagSq);
+  sitAwPublish(sitAwEventFreeFall, sitAwFFDetected(), &sitAwFFPublished, tick);
 #endif
 #ifdef SITAW_TU_ENABLED
   /* check if we actually fly */
@@ -125,12 +232,14 @@ static void sitAwPostStateUpdateCallOut(const sensorData_t *sensorData,
   bool isFlying = sumRatio > SITAW_TU_IN_FLIGHT_THRESHOLD;
   if (isFlying) {
     /* Test values for Tumbled detection. */
-    sitAwTuTest(sensorData->acc.z);
+    sitAwTuTest(stats.acc.z);
   }
+  sitAwPublish(sitAwEventTumbled, sitAwTuDetected(), &sitAwTuPublished, tick);
 #endif
 #ifdef SITAW_AR_ENABLED
 /* Test values for At Rest detection. */
-  sitAwARTest(sensorData->acc.x, sensorData->acc.y, sensorData->acc.z);
+  sitAwARTest(stats.acc.x, stats.acc.y, stats.acc.z);
+  sitAwPublish(sitAwEventAtRest, sitAwARDetected(), &sitAwARPublished, tick);
 #endif
 #endif
 }
@@ -163,13 +272,18 @@ static void sitAwPreThrustUpdateCallOut(setpoint_t *setpoint)
 /**
  * Update setpoint according to current situation
  *
- * Called by the stabilizer after state and setpoint update. This function
- * should update the setpoint accordig to the current state situation
+ * Called by the stabilizer after state and setpoint update. The samples are
+ * summed on every tick, the detectors run at SITAW_RATE and publish their
+ * events. The setpoint is overridden on every tick while a situation lasts,
+ * as the commander hands a new one every tick.
  */
 void sitAwUpdateSetpoint(setpoint_t *setpoint, const sensorData_t *sensorData,
-                                               const state_t *state)
+                                               const state_t *state, const uint32_t tick)
 {
-  sitAwPostStateUpdateCallOut(sensorData, state);
+  sitAwAccumulate(sensorData, state);
+  if (RATE_DO_EXECUTE(SITAW_RATE, tick)) {
+    sitAwRunDetectors(tick);
+  }
   sitAwPreThrustUpdateCallOut(setpoint);
 }
 
@@ -207,7 +321,7 @@ void sitAwFFInit(void)
 void sitAwFFTest(float accWZ, float accMAG)
 {
   /* Check that the total acceleration is close to zero. */
-  if(fabs(accMAG) > SITAW_FF_THRESHOLD) {
+  if(fabsf(accMAG) > SITAW_FF_THRESHOLD) {
     /* If the total acceleration deviates from 0, this is not a free fall situation. */
     triggerReset(&sitAwFFAccWZ);
   } else {
@@ -216,7 +330,7 @@ void sitAwFFTest(float accWZ, float accMAG)
      * AccWZ approaches -1 in free fall. Check that the value stays within
      * SITAW_FF_THRESHOLD of -1 for the triggerCount specified.
      */
-    triggerTestValue(&sitAwFFAccWZ, fabs(accWZ + 1));
+    triggerTestValue(&sitAwFFAccWZ, fabsf(accWZ + 1));
   }
 }
 
@@ -263,7 +377,7 @@ void sitAwARInit(void)
 void sitAwARTest(float accX, float accY, float accZ)
 {
   /* Check that there are no horizontal accelerations. At rest, these are 0. */
-  if((fabs(accX) > SITAW_AR_THRESHOLD) || (fabs(accY) > SITAW_AR_THRESHOLD)) {
+  if((fabsf(accX) > SITAW_AR_THRESHOLD) || (fabsf(accY) > SITAW_AR_THRESHOLD)) {
     /* If the X or Y accelerations are different than 0, the crazyflie is not at rest. */
     triggerReset(&sitAwARAccZ);
   }
@@ -275,7 +389,7 @@ void sitAwARTest(float accX, float accY, float accZ)
    * The vertical acceleration must be close to 1, but is allowed to oscillate slightly
    * around 1. Testing that the deviation from 1 stays within SITAW_AR_THRESHOLD.
    */
-  triggerTestValue(&sitAwARAccZ, fabs(accZ - 1));
+  triggerTestValue(&sitAwARAccZ, fabsf(accZ - 1));
 }
 
 /**
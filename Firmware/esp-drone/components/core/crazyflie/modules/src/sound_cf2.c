@@ -159,6 +159,16 @@
 
 #define MAX_NOTE_LENGTH 80
 
+/*
+ * Each effect returns the time until it is called again. A melody wakes up
+ * once at the start of a note and once for the gap before the next one, the
+ * effects that follow a signal every SOUND_TICK_MS.
+ */
+#define SOUND_TICK_MS     10
+#define SOUND_NOTE_GAP_MS 10
+// Polls for a new sound.effect while nothing plays
+#define SOUND_IDLE_MS     100
+
 static bool isInit=false;
 
 typedef const struct {
@@ -205,10 +215,11 @@ static Melody valkyries = {.bpm = 140, .delay = 1, .notes = {{Gb3, Q}, {B3, Q},
     {D4, E}, {Gb4, H},
     REPEAT}};
 
-typedef void (*BuzzerEffect)(uint32_t timer, uint32_t * mi, Melody * melody);
+typedef uint32_t (*BuzzerEffect)(uint32_t timer, uint32_t * mi, Melody * melody);
 
-static void off(uint32_t counter, uint32_t * mi, Melody * m) {
+static uint32_t off(uint32_t counter, uint32_t * mi, Melody * m) {
   buzzerOff();
+  return SOUND_IDLE_MS;
 }
 
 static void turnCurrentEffectOff() {
@@ -219,45 +230,49 @@ static void turnCurrentEffectOff() {
   }
 }
 
-static uint32_t mcounter = 0;
-static void melodyplayer(uint32_t counter, uint32_t * mi, Melody * m) {
+static bool isNoteOn = false;
+static uint32_t melodyplayer(uint32_t counter, uint32_t * mi, Melody * m) {
   uint16_t tone = m->notes[(*mi)].tone;
   uint16_t duration = m->notes[(*mi)].duration;
 
-  if (mcounter == 0) {
-    if (tone == 0xFE) {
-      // Turn off buzzer since we're at the end
-      (*mi) = 0;
-      turnCurrentEffectOff();
-    } else if (tone == 0xFF) {
-      // Loop the melody
-      (*mi) = 0;
-    } else {
-      // Play current note
-      buzzerOn(tone);
-      mcounter = (100 * 4 * 60) / (m->bpm * duration) - 1;
-      (*mi)++;
-    }
+  if (isNoteOn) {
+    // The gap before the next note
+    buzzerOff();
+    isNoteOn = false;
+    return SOUND_NOTE_GAP_MS;
+  }
+
+  if (tone == 0xFE) {
+    // Turn off buzzer since we're at the end
+    (*mi) = 0;
+    turnCurrentEffectOff();
+  } else if (tone == 0xFF) {
+    // Loop the melody
+    (*mi) = 0;
   } else {
-    if (mcounter == 1) {
-        buzzerOff();
-    }
-    mcounter--;
+    // Play current note, a whole note is 4 beats
+    buzzerOn(tone);
+    isNoteOn = true;
+    (*mi)++;
+    return SOUND_TICK_MS * ((100 * 4 * 60) / (m->bpm * duration)) - SOUND_NOTE_GAP_MS;
   }
+
+  return SOUND_TICK_MS;
 }
 
 static uint8_t static_ratio = 0;
 static uint16_t static_freq = 4000;
-static void bypass(uint32_t counter, uint32_t * mi, Melody * melody)
+static uint32_t bypass(uint32_t counter, uint32_t * mi, Melody * melody)
 {
   buzzerOn(static_freq);
+  return SOUND_TICK_MS;
 }
 
 static uint16_t siren_start = 2000;
 static uint16_t siren_freq = 2000;
 static uint16_t siren_stop = 4000;
 static int16_t siren_step = 40;
-static void siren(uint32_t counter, uint32_t * mi, Melody * melody)
+static uint32_t siren(uint32_t counter, uint32_t * mi, Melody * melody)
 {
   siren_freq += siren_step;
   if (siren_freq > siren_stop) {
@@ -269,6 +284,7 @@ static void siren(uint32_t counter, uint32_t * mi, Melody * melody)
     siren_freq = siren_start;
   }
   buzzerOn(siren_freq);
+  return SOUND_TICK_MS;
 }
 
 static int pitchid;
@@ -277,7 +293,7 @@ static int pitch;
 static int roll;
 static int tilt_freq;
 static int tilt_ratio;
-static void tilt(uint32_t counter, uint32_t * mi, Melody * melody)
+static uint32_t tilt(uint32_t counter, uint32_t * mi, Melody * melody)
 {
   pitchid = logGetVarId("stabilizer", "pitch");
   rollid = logGetVarId("stabilizer", "roll");
@@ -292,6 +308,7 @@ static void tilt(uint32_t counter, uint32_t * mi, Melody * melody)
   }
 
   buzzerOn(tilt_freq);
+  return SOUND_TICK_MS;
 }
 
 typedef struct {
@@ -321,11 +338,12 @@ static EffectCall effects[] = {
 static xTimerHandle timer;
 static StaticTimer_t timerBuffer;
 static uint32_t counter = 0;
+static int lastEffect = SND_OFF;
 
 static void soundTimer(xTimerHandle timer)
 {
   int effect;
-  counter++;
+  uint32_t next = SOUND_IDLE_MS;
 
   if (sys_effect != 0) {
     effect = sys_effect;
@@ -333,8 +351,20 @@ static void soundTimer(xTimerHandle timer)
     effect = user_effect;
   }
 
+  if (effect != lastEffect) {
+    // The note of an effect cut short does not carry over
+    isNoteOn = false;
+    lastEffect = effect;
+  }
+
   if (effects[effect].call != 0) {
-    effects[effect].call(counter * 10, &effects[effect].mi, effects[effect].melody);
+    next = effects[effect].call(counter, &effects[effect].mi, effects[effect].melody);
+  }
+  counter += next;
+
+  // Auto-reloaded, it keeps the last period if the timer queue is full
+  if (xTimerGetPeriod(timer) != M2T(next)) {
+    xTimerChangePeriod(timer, M2T(next), 0);
   }
 }
 
@@ -347,7 +377,7 @@ void soundInit(void)
 
   neffect = sizeof(effects) / sizeof(effects[0]) - 1;
 
-  timer = xTimerCreateStatic("SoundTimer", M2T(10), pdTRUE, NULL, soundTimer, &timerBuffer);
+  timer = xTimerCreateStatic("SoundTimer", M2T(SOUND_TICK_MS), pdTRUE, NULL, soundTimer, &timerBuffer);
   xTimerStart(timer, 100);
 
   isInit = true;
@@ -361,7 +391,13 @@ bool soundTest(void)
 
 void soundSetEffect(uint32_t effect)
 {
+  const bool isNew = effect != sys_effect;
+
   sys_effect = effect;
+  // Start it now rather than at the end of the note playing
+  if (isInit && isNew) {
+    xTimerChangePeriod(timer, M2T(SOUND_TICK_MS), 0);
+  }
 }
 
 void soundSetFreq(uint32_t freq) {
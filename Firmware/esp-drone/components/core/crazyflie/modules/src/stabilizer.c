@@ -26,6 +26,7 @@
 
 #include <math.h>
 #include <inttypes.h>
+#include <string.h>
 
 #include "FreeRTOS.h"
 #include "task.h"
@@ -40,20 +41,35 @@
 #include "stabilizer.h"
 #include "sensors.h"
 #include "commander.h"
+#include "crtp_commander_high_level.h"
 #include "crtp_localization_service.h"
 #include "sitaw.h"
+#include "msp.h"
 #include "controller.h"
 #include "power_distribution.h"
-//#include "collision_avoidance.h"
+#ifdef CONFIG_COLLISION_AVOIDANCE_TASK
+#include "collision_avoidance.h"
+#endif
 
 #include "estimator.h"
 //#include "usddeck.h" //usddeckLoggingMode_e
 #include "quatcompress.h"
 #include "statsCnt.h"
+#include "welford.h"
 #define DEBUG_MODULE "STAB"
 #include "debug_cf.h"
 #include "static_mem.h"
 #include "rateSupervisor.h"
+#include "flight_recorder.h"
+#include "controller_bank.h"
+#include "estimator_shadow.h"
+#include "deadlinemonitor.h"
+#include "link_capture.h"
+#include "power_save.h"
+#include "sysview_markers.h"
+#ifdef CONFIG_STABILIZER_PROFILER
+#include "esp_cpu.h"
+#endif
 
 static bool isInit;
 static bool emergencyStop = false;
@@ -122,6 +138,46 @@ static struct {
   int16_t az;
 } setpointCompressed;
 
+// Only compressed while a log block or a logGetVarId() user reads them
+static logWatch_t stateCompressedWatch = { .start = &stateCompressed, .size = sizeof(stateCompressed) };
+static logWatch_t setpointCompressedWatch = { .start = &setpointCompressed, .size = sizeof(setpointCompressed) };
+
+#ifdef CONFIG_STABILIZER_PROFILER
+// Bucket b of the histograms counts stage times of [2^(10+b), 2^(11+b)) CPU
+// cycles, the first and the last bucket are open ended
+#define PROFILER_NBR_OF_BUCKETS     8
+#define PROFILER_FIRST_BUCKET_LOG2  11
+#define PROFILER_MEAN_INTERVAL      100
+
+typedef enum {
+  profileEstimator = 0,
+  profileCommander,
+  profileSitAw,
+  profileController,
+  profilePowerDistribution,
+  profileTotal,
+  PROFILER_NBR_OF_STAGES
+} profileStage_t;
+
+typedef struct {
+  uint32_t min;
+  uint32_t max;
+  uint32_t mean;
+  uint64_t sum;
+  uint32_t count;
+  uint16_t histogram[PROFILER_NBR_OF_BUCKETS];
+} profileStats_t;
+
+static profileStats_t profileStats[PROFILER_NBR_OF_STAGES];
+static uint8_t profileReset;
+
+#define PROFILE_START(T) T = esp_cpu_get_cycle_count()
+#define PROFILE_MARK(STAGE, T) T = profilerMark((STAGE), (T))
+#else
+#define PROFILE_START(T)
+#define PROFILE_MARK(STAGE, T)
+#endif
+
 static float accVarX[NBR_OF_MOTORS];
 static float accVarY[NBR_OF_MOTORS];
 static float accVarZ[NBR_OF_MOTORS];
@@ -144,6 +200,56 @@ static void calcSensorToOutputLatency(const sensorData_t *sensorData)
   inToOutLatency = outTimestamp - sensorData->interruptTimestamp;
 }
 
+#ifdef CONFIG_STABILIZER_PROFILER
+static void profilerReset()
+{
+  memset(profileStats, 0, sizeof(profileStats));
+  for (int i = 0; i < PROFILER_NBR_OF_STAGES; i++) {
+    profileStats[i].min = UINT32_MAX;
+  }
+  profileReset = 0;
+}
+
+static void profilerAdd(profileStats_t *stats, uint32_t cycles)
+{
+  if (cycles < stats->min) {
+    stats->min = cycles;
+  }
+  if (cycles > stats->max) {
+    stats->max = cycles;
+  }
+
+  stats->sum += cycles;
+  stats->count++;
+  // Keep the 64 bit division out of most loops
+  if (stats->count % PROFILER_MEAN_INTERVAL == 0) {
+    stats->mean = stats->sum / stats->count;
+  }
+
+  int bucket = 0;
+  if (cycles >= (1 << PROFILER_FIRST_BUCKET_LOG2)) {
+    bucket = (31 - __builtin_clz(cycles)) - (PROFILER_FIRST_BUCKET_LOG2 - 1);
+    if (bucket >= PROFILER_NBR_OF_BUCKETS) {
+      bucket = PROFILER_NBR_OF_BUCKETS - 1;
+    }
+  }
+  if (stats->histogram[bucket] < UINT16_MAX) {
+    stats->histogram[bucket]++;
+  }
+}
+
+/**
+ * Add the cycles since start to a stage.
+ * @return The current cycle count, the start of the next stage
+ */
+static uint32_t profilerMark(profileStage_t stage, uint32_t start)
+{
+  uint32_t now = esp_cpu_get_cycle_count();
+  profilerAdd(&profileStats[stage], now - start);
+  return now;
+}
+#endif
+
 static void compressState()
 {
   stateCompressed.x = state.position.x * 1000.0f;
@@ -196,14 +302,24 @@ void stabilizerInit(StateEstimatorType estimator)
     estimator = deckGetRequiredEstimator();
   }
   stateEstimatorInit(estimator);
+#ifdef CONFIG_ESTIMATOR_SHADOW
+  estimatorShadowInit();
+#endif
   controllerInit(ControllerTypeAny);
+#ifdef CONFIG_CONTROLLER_BANK
+  controllerBankInit();
+#endif
   powerDistributionInit();
   sitAwInit();
-  //collisionAvoidanceInit();
+#ifdef CONFIG_COLLISION_AVOIDANCE_TASK
+  collisionAvoidanceInit();
+#endif
   estimatorType = getStateEstimator();
   controllerType = getControllerType();
+  logWatchRegister(&stateCompressedWatch);
+  logWatchRegister(&setpointCompressedWatch);
 
-  STATIC_MEM_TASK_CREATE(stabilizerTask, stabilizerTask, STABILIZER_TASK_NAME, NULL, STABILIZER_TASK_PRI);
+  STATIC_MEM_TASK_CREATE_PINNED(stabilizerTask, stabilizerTask, STABILIZER_TASK_NAME, NULL, STABILIZER_TASK_PRI, STABILIZER_TASK_CORE);
 
   isInit = true;
 }
@@ -214,9 +330,17 @@ bool stabilizerTest(void)
 
   pass &= sensorsTest();
   pass &= stateEstimatorTest();
+#ifdef CONFIG_ESTIMATOR_SHADOW
+  pass &= estimatorShadowTest();
+#endif
   pass &= controllerTest();
+#ifdef CONFIG_CONTROLLER_BANK
+  pass &= controllerBankTest();
+#endif
   pass &= powerDistributionTest();
-  //pass &= collisionAvoidanceTest();
+#ifdef CONFIG_COLLISION_AVOIDANCE_TASK
+  pass &= collisionAvoidanceTest();
+#endif
 
   return pass;
 }
@@ -232,6 +356,13 @@ static void checkEmergencyStopTimeout()
   }
 }
 
+// Not idle, see power_save.h. A new setpoint is seen on the next loop that
+// runs the commander, within POWER_SAVE_IDLE_DIVIDER ms.
+static inline bool isActive(void)
+{
+  return systemIsArmed() && stabilizerIsFlying();
+}
+
 /* The stabilizer loop runs at 1kHz (stock) or 500Hz (kalman). It is the
  * responsibility of the different functions to run slower by skipping call
  * (ie. returning without modifying the output structure).
@@ -241,6 +372,12 @@ static void stabilizerTask(void* param)
 {
   uint32_t tick;
   uint32_t lastWakeTime;
+#ifdef CONFIG_STABILIZER_PROFILER
+  uint32_t loopStart;
+  uint32_t stageStart;
+
+  profilerReset();
+#endif
 
 #ifdef configUSE_APPLICATION_TASK_TAG
 	#if configUSE_APPLICATION_TASK_TAG == 1
@@ -262,12 +399,16 @@ static void stabilizerTask(void* param)
   tick = 1;
 
   rateSupervisorInit(&rateSupervisorContext, xTaskGetTickCount(), M2T(1000), 997, 1003, 1);
+  deadlineMonitorRegister(dmStabilizer, 1000000 / RATE_MAIN_LOOP, STABILIZER_TASK_BUDGET_US);
 
   DEBUG_PRINTI("Ready to fly.\n");
 
   while(1) {
     // The sensor should unlock at 1kHz
     sensorsWaitDataReady();
+    deadlineMonitorCheckIn(dmStabilizer);
+    paramBatchTick();
+    PROFILE_START(loopStart);
 
     if (startPropTest != false) {
       // TODO: What happens with estimator when we run tests after startup?
@@ -278,44 +419,105 @@ static void stabilizerTask(void* param)
     if (testState != testDone) {
       sensorsAcquire(&sensorData, tick);
       testProps(&sensorData);
-    } else {
+    } else if (powerSaveTick(isActive(), tick)) {
+#ifdef CONFIG_STABILIZER_PROFILER
+      // Start over when asked to or when the estimator or controller is switched
+      if (profileReset || getStateEstimator() != estimatorType || getControllerType() != controllerType) {
+        profilerReset();
+      }
+#endif
       // allow to update estimator dynamically
       if (getStateEstimator() != estimatorType) {
+#ifdef CONFIG_ESTIMATOR_SHADOW
+        if (estimatorShadowSwitchTo(estimatorType)) {
+          estimatorType = getStateEstimator();
+        }
+#else
         stateEstimatorSwitchTo(estimatorType);
         estimatorType = getStateEstimator();
+#endif
       }
       // allow to update controller dynamically
       if (getControllerType() != controllerType) {
+#ifdef CONFIG_CONTROLLER_BANK
+        if (controllerBankSwitchTo(controllerType)) {
+          controllerType = getControllerType();
+        }
+#else
         controllerInit(controllerType);
         controllerType = getControllerType();
+#endif
       }
 
+      PROFILE_START(stageStart);
+      SYSVIEW_MARKER_START(svEstimator);
+#ifdef CONFIG_ESTIMATOR_SHADOW
+      estimatorShadowUpdate(&state, &sensorData, &control, tick);
+#else
       stateEstimator(&state, &sensorData, &control, tick);
-      compressState();
+#endif
+      SYSVIEW_MARKER_STOP(svEstimator);
+      PROFILE_MARK(profileEstimator, stageStart);
+      if (stateCompressedWatch.isLogged) {
+        compressState();
+      }
 
+      PROFILE_START(stageStart);
+      SYSVIEW_MARKER_START(svCommander);
       commanderGetSetpoint(&setpoint, &state);
-      compressSetpoint();
+      SYSVIEW_MARKER_STOP(svCommander);
+      PROFILE_MARK(profileCommander, stageStart);
+      if (setpointCompressedWatch.isLogged) {
+        compressSetpoint();
+      }
 
-      sitAwUpdateSetpoint(&setpoint, &sensorData, &state);
-      //collisionAvoidanceUpdateSetpoint(&setpoint, &sensorData, &state, tick);
+      PROFILE_START(stageStart);
+      SYSVIEW_MARKER_START(svSitAw);
+      sitAwUpdateSetpoint(&setpoint, &sensorData, &state, tick);
+      SYSVIEW_MARKER_STOP(svSitAw);
+      PROFILE_MARK(profileSitAw, stageStart);
+#ifdef CONFIG_COLLISION_AVOIDANCE_TASK
+      collisionAvoidanceFilterSetpoint(&setpoint, &state, tick);
+#endif
 
+      SYSVIEW_MARKER_START(svController);
+#ifdef CONFIG_CONTROLLER_BANK
+      controllerBankUpdate(&control, &setpoint, &sensorData, &state, tick);
+#else
       controller(&control, &setpoint, &sensorData, &state, tick);
+#endif
+      SYSVIEW_MARKER_STOP(svController);
+      PROFILE_MARK(profileController, stageStart);
 
       checkEmergencyStopTimeout();
 
       checkStops = systemIsArmed();
+      SYSVIEW_MARKER_START(svPowerDistribution);
       if (emergencyStop || (systemIsArmed() == false)) {
         powerStop();
       } else {
         powerDistribution(&control);
       }
+      SYSVIEW_MARKER_STOP(svPowerDistribution);
+      linkCaptureActuation(setpoint.timestamp);
+      PROFILE_MARK(profilePowerDistribution, stageStart);
+      PROFILE_MARK(profileTotal, loopStart);
 
-      //TODO: Log data to uSD card if configured
-      /*if (usddeckLoggingEnabled()
-          && usddeckLoggingMode() == usddeckLoggingMode_SynchronousStabilizer
-          && RATE_DO_EXECUTE(usddeckFrequency(), tick)) {
-        usddeckTriggerLogging();
-      }*/
+#ifdef CONFIG_LOG_SYNCHRONOUS_BLOCKS
+      logSynchronousTick(tick);
+#endif
+#ifdef CONFIG_FLIGHT_RECORDER
+      flightRecorderTick(tick);
+#endif
+      mspUpdateCache(&state, tick);
+    } else {
+      // Idle, the motors are stopped and the rest waits for the next loop
+#ifdef CONFIG_LOG_SYNCHRONOUS_BLOCKS
+      logSynchronousTick(tick);
+#endif
+#ifdef CONFIG_FLIGHT_RECORDER
+      flightRecorderTick(tick);
+#endif
     }
     calcSensorToOutputLatency(&sensorData);
     tick++;
@@ -327,6 +529,7 @@ static void stabilizerTask(void* param)
         rateWarningDisplayed = true;
       }
     }
+    deadlineMonitorCheckOut(dmStabilizer);
   }
 }
 
@@ -346,19 +549,26 @@ void stabilizerSetEmergencyStopTimeout(int timeout)
   emergencyStopTimeout = timeout;
 }
 
-static float variance(float *buffer, uint32_t length)
+bool stabilizerIsFlying(void)
 {
-  uint32_t i;
-  float sum = 0;
-  float sumSq = 0;
+  return control.thrust > 0.0f || commanderGetInactivityTime() < M2T(POWER_SAVE_IDLE_DELAY_MS) ||
+    !crtpCommanderHighLevelIsStopped();
+}
 
-  for (i = 0; i < length; i++)
-  {
-    sum += buffer[i];
-    sumSq += buffer[i] * buffer[i];
-  }
+// The variances of the prop test are sums of the squared deviations, as the
+// thresholds are for PROPTEST_NBR_OF_VARIANCE_VALUES samples
+static void accStatsReset(welford_t *acc)
+{
+  welfordReset(&acc[0]);
+  welfordReset(&acc[1]);
+  welfordReset(&acc[2]);
+}
 
-  return sumSq - (sum * sum) / length;
+static void accStatsAdd(welford_t *acc, const Axis3f *sample)
+{
+  welfordAdd(&acc[0], sample->x);
+  welfordAdd(&acc[1], sample->y);
+  welfordAdd(&acc[2], sample->z);
 }
 
 /** Evaluate the values from the propeller test
@@ -386,9 +596,7 @@ static bool evaluateTest(float low, float high, float value, uint8_t motor)
 static void testProps(sensorData_t *sensors)
 {
   static uint32_t i = 0;
-  NO_DMA_CCM_SAFE_ZERO_INIT static float accX[PROPTEST_NBR_OF_VARIANCE_VALUES];
-  NO_DMA_CCM_SAFE_ZERO_INIT static float accY[PROPTEST_NBR_OF_VARIANCE_VALUES];
-  NO_DMA_CCM_SAFE_ZERO_INIT static float accZ[PROPTEST_NBR_OF_VARIANCE_VALUES];
+  static welford_t acc[3];
   static float accVarXnf;
   static float accVarYnf;
   static float accVarZnf;
@@ -403,6 +611,7 @@ static void testProps(sensorData_t *sensors)
     motorPass = 0;
     sensorsSetAccMode(ACC_MODE_PROPTEST);
     testState = measureNoiseFloor;
+    accStatsReset(acc);
     minLoadedVoltage = idleVoltage = pmGetBatteryVoltage();
     minSingleLoadedVoltage[MOTOR_M1] = minLoadedVoltage;
     minSingleLoadedVoltage[MOTOR_M2] = minLoadedVoltage;
@@ -411,16 +620,15 @@ static void testProps(sensorData_t *sensors)
   }
   if (testState == measureNoiseFloor)
   {
-    accX[i] = sensors->acc.x;
-    accY[i] = sensors->acc.y;
-    accZ[i] = sensors->acc.z;
+    accStatsAdd(acc, &sensors->acc);
 
     if (++i >= PROPTEST_NBR_OF_VARIANCE_VALUES)
     {
       i = 0;
-      accVarXnf = variance(accX, PROPTEST_NBR_OF_VARIANCE_VALUES);
-      accVarYnf = variance(accY, PROPTEST_NBR_OF_VARIANCE_VALUES);
-      accVarZnf = variance(accZ, PROPTEST_NBR_OF_VARIANCE_VALUES);
+      accVarXnf = welfordSumOfSquares(&acc[0]);
+      accVarYnf = welfordSumOfSquares(&acc[1]);
+      accVarZnf = welfordSumOfSquares(&acc[2]);
+      accStatsReset(acc);
       DEBUG_PRINTI("Acc noise floor variance X+Y:%f, (Z:%f)\n",
                   (double)accVarXnf + (double)accVarYnf, (double)accVarZnf);
       testState = measureProp;
@@ -431,9 +639,7 @@ static void testProps(sensorData_t *sensors)
   {
     if (i < PROPTEST_NBR_OF_VARIANCE_VALUES)
     {
-      accX[i] = sensors->acc.x;
-      accY[i] = sensors->acc.y;
-      accZ[i] = sensors->acc.z;
+      accStatsAdd(acc, &sensors->acc);
       if (pmGetBatteryVoltage() < minSingleLoadedVoltage[motorToTest])
       {
         minSingleLoadedVoltage[motorToTest] = pmGetBatteryVoltage();
@@ -451,9 +657,10 @@ static void testProps(sensorData_t *sensors)
     }
     else if (i == PROPTEST_NBR_OF_VARIANCE_VALUES)
     {
-      accVarX[motorToTest] = variance(accX, PROPTEST_NBR_OF_VARIANCE_VALUES);
-      accVarY[motorToTest] = variance(accY, PROPTEST_NBR_OF_VARIANCE_VALUES);
-      accVarZ[motorToTest] = variance(accZ, PROPTEST_NBR_OF_VARIANCE_VALUES);
+      accVarX[motorToTest] = welfordSumOfSquares(&acc[0]);
+      accVarY[motorToTest] = welfordSumOfSquares(&acc[1]);
+      accVarZ[motorToTest] = welfordSumOfSquares(&acc[2]);
+      accStatsReset(acc);
       DEBUG_PRINTI("Motor M%d variance X+Y:%f (Z:%f)\n",
                    motorToTest+1, (double)accVarX[motorToTest] + (double)accVarY[motorToTest],
                    (double)accVarZ[motorToTest]);
@@ -705,3 +912,83 @@ LOG_ADD(LOG_INT16, rateRoll, &stateCompressed.rateRoll)   // angular velocity -
 LOG_ADD(LOG_INT16, ratePitch, &stateCompressed.ratePitch)
 LOG_ADD(LOG_INT16, rateYaw, &stateCompressed.rateYaw)
 LOG_GROUP_STOP(stateEstimateZ)
+
+#ifdef CONFIG_STABILIZER_PROFILER
+PARAM_GROUP_START(stabProf)
+PARAM_ADD(PARAM_UINT8, reset, &profileReset)
+PARAM_GROUP_STOP(stabProf)
+
+// Stage times in CPU cycles
+LOG_GROUP_START(stabProf)
+LOG_ADD(LOG_UINT32, estMin, &profileStats[profileEstimator].min)
+LOG_ADD(LOG_UINT32, estMax, &profileStats[profileEstimator].max)
+LOG_ADD(LOG_UINT32, estMean, &profileStats[profileEstimator].mean)
+LOG_ADD(LOG_UINT32, cmdMin, &profileStats[profileCommander].min)
+LOG_ADD(LOG_UINT32, cmdMax, &profileStats[profileCommander].max)
+LOG_ADD(LOG_UINT32, cmdMean, &profileStats[profileCommander].mean)
+LOG_ADD(LOG_UINT32, sitAwMin, &profileStats[profileSitAw].min)
+LOG_ADD(LOG_UINT32, sitAwMax, &profileStats[profileSitAw].max)
+LOG_ADD(LOG_UINT32, sitAwMean, &profileStats[profileSitAw].mean)
+LOG_ADD(LOG_UINT32, ctrlMin, &profileStats[profileController].min)
+LOG_ADD(LOG_UINT32, ctrlMax, &profileStats[profileController].max)
+LOG_ADD(LOG_UINT32, ctrlMean, &profileStats[profileController].mean)
+LOG_ADD(LOG_UINT32, pwrMin, &profileStats[profilePowerDistribution].min)
+LOG_ADD(LOG_UINT32, pwrMax, &profileStats[profilePowerDistribution].max)
+LOG_ADD(LOG_UINT32, pwrMean, &profileStats[profilePowerDistribution].mean)
+LOG_ADD(LOG_UINT32, totalMin, &profileStats[profileTotal].min)
+LOG_ADD(LOG_UINT32, totalMax, &profileStats[profileTotal].max)
+LOG_ADD(LOG_UINT32, totalMean, &profileStats[profileTotal].mean)
+LOG_GROUP_STOP(stabProf)
+
+// Number of loops per bucket, see PROFILER_FIRST_BUCKET_LOG2
+LOG_GROUP_START(stabProfHist)
+LOG_ADD(LOG_UINT16, est0, &profileStats[profileEstimator].histogram[0])
+LOG_ADD(LOG_UINT16, est1, &profileStats[profileEstimator].histogram[1])
+LOG_ADD(LOG_UINT16, est2, &profileStats[profileEstimator].histogram[2])
+LOG_ADD(LOG_UINT16, est3, &profileStats[profileEstimator].histogram[3])
+LOG_ADD(LOG_UINT16, est4, &profileStats[profileEstimator].histogram[4])
+LOG_ADD(LOG_UINT16, est5, &profileStats[profileEstimator].histogram[5])
+LOG_ADD(LOG_UINT16, est6, &profileStats[profileEstimator].histogram[6])
+LOG_ADD(LOG_UINT16, est7, &profileStats[profileEstimator].histogram[7])
+LOG_ADD(LOG_UINT16, cmd0, &profileStats[profileCommander].histogram[0])
+LOG_ADD(LOG_UINT16, cmd1, &profileStats[profileCommander].histogram[1])
+LOG_ADD(LOG_UINT16, cmd2, &profileStats[profileCommander].histogram[2])
+LOG_ADD(LOG_UINT16, cmd3, &profileStats[profileCommander].histogram[3])
+LOG_ADD(LOG_UINT16, cmd4, &profileStats[profileCommander].histogram[4])
+LOG_ADD(LOG_UINT16, cmd5, &profileStats[profileCommander].histogram[5])
+LOG_ADD(LOG_UINT16, cmd6, &profileStats[profileCommander].histogram[6])
+LOG_ADD(LOG_UINT16, cmd7, &profileStats[profileCommander].histogram[7])
+LOG_ADD(LOG_UINT16, sitAw0, &profileStats[profileSitAw].histogram[0])
+LOG_ADD(LOG_UINT16, sitAw1, &profileStats[profileSitAw].histogram[1])
+LOG_ADD(LOG_UINT16, sitAw2, &profileStats[profileSitAw].histogram[2])
+LOG_ADD(LOG_UINT16, sitAw3, &profileStats[profileSitAw].histogram[3])
+LOG_ADD(LOG_UINT16, sitAw4, &profileStats[profileSitAw].histogram[4])
+LOG_ADD(LOG_UINT16, sitAw5, &profileStats[profileSitAw].histogram[5])
+LOG_ADD(LOG_UINT16, sitAw6, &profileStats[profileSitAw].histogram[6])
+LOG_ADD(LOG_UINT16, sitAw7, &profileStats[profileSitAw].histogram[7])
+LOG_ADD(LOG_UINT16, ctrl0, &profileStats[profileController].histogram[0])
+LOG_ADD(LOG_UINT16, ctrl1, &profileStats[profileController].histogram[1])
+LOG_ADD(LOG_UINT16, ctrl2, &profileStats[profileController].histogram[2])
+LOG_ADD(LOG_UINT16, ctrl3, &profileStats[profileController].histogram[3])
+LOG_ADD(LOG_UINT16, ctrl4, &profileStats[profileController].histogram[4])
+LOG_ADD(LOG_UINT16, ctrl5, &profileStats[profileController].histogram[5])
+LOG_ADD(LOG_UINT16, ctrl6, &profileStats[profileController].histogram[6])
+LOG_ADD(LOG_UINT16, ctrl7, &profileStats[profileController].histogram[7])
+LOG_ADD(LOG_UINT16, pwr0, &profileStats[profilePowerDistribution].histogram[0])
+LOG_ADD(LOG_UINT16, pwr1, &profileStats[profilePowerDistribution].histogram[1])
+LOG_ADD(LOG_UINT16, pwr2, &profileStats[profilePowerDistribution].histogram[2])
+LOG_ADD(LOG_UINT16, pwr3, &profileStats[profilePowerDistribution].histogram[3])
+LOG_ADD(LOG_UINT16, pwr4, &profileStats[profilePowerDistribution].histogram[4])
+LOG_ADD(LOG_UINT16, pwr5, &profileStats[profilePowerDistribution].histogram[5])
+LOG_ADD(LOG_UINT16, pwr6, &profileStats[profilePowerDistribution].histogram[6])
+LOG_ADD(LOG_UINT16, pwr7, &profileStats[profilePowerDistribution].histogram[7])
+LOG_ADD(LOG_UINT16, total0, &profileStats[profileTotal].histogram[0])
+LOG_ADD(LOG_UINT16, total1, &profileStats[profileTotal].histogram[1])
+LOG_ADD(LOG_UINT16, total2, &profileStats[profileTotal].histogram[2])
+LOG_ADD(LOG_UINT16, total3, &profileStats[profileTotal].histogram[3])
+LOG_ADD(LOG_UINT16, total4, &profileStats[profileTotal].histogram[4])
+LOG_ADD(LOG_UINT16, total5, &profileStats[profileTotal].histogram[5])
+LOG_ADD(LOG_UINT16, total6, &profileStats[profileTotal].histogram[6])
+LOG_ADD(LOG_UINT16, total7, &profileStats[profileTotal].histogram[7])
+LOG_GROUP_STOP(stabProfHist)
+#endif
@@ -0,0 +1,91 @@
+/**
+ *    ||          ____  _ __
+ * +------+      / __ )(_) /_______________ _____  ___
+ * | 0xBC |     / __  / / __/ ___/ ___/ __ `/_  / / _ \
+ * +------+    / /_/ / / /_/ /__/ /  / /_/ / / /_/  __/
+ *  ||  ||    /_____/_/\__/\___/_/   \__,_/ /___/\___/
+ *
+ * ESP-Drone Firmware
+ *
+ * Copyright 2019-2020  Espressif Systems (Shanghai)
+ * Copyright (C) 2011-2016 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * static_mem_registry.c - Registry of the tasks and queues created with static_mem.h
+ *
+ * The entries are collected by the linker in the .staticMem section. The
+ * stack peak of a task is its high water mark, the peak of a queue is only
+ * the most items seen waiting by staticMemSample(), which sysload.c calls
+ * with its timers.
+ */
+
+#include <stdint.h>
+#include <inttypes.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+
+#include "static_mem.h"
+#define DEBUG_MODULE "STATICMEM"
+#include "debug_cf.h"
+
+//These are set by the Linker
+extern const staticMemEntry_t _staticMem_start;
+extern const staticMemEntry_t _staticMem_end;
+
+void staticMemSample(void)
+{
+  for (const staticMemEntry_t *entry = &_staticMem_start; entry < &_staticMem_end; entry++) {
+    staticMemState_t *state = entry->state;
+
+    if (entry->type == STATIC_MEM_QUEUE && state->handle != NULL) {
+      const UBaseType_t waiting = uxQueueMessagesWaiting((xQueueHandle)state->handle);
+      if (waiting > state->peak) {
+        state->peak = waiting;
+      }
+    }
+  }
+}
+
+void staticMemDump(void)
+{
+  uint32_t total = 0;
+  uint32_t created = 0;
+
+  staticMemSample();
+
+  // Tasks: stack bytes used at the peak, queues: items waiting at the peak
+  DEBUG_PRINTI("Static memory");
+  DEBUG_PRINTI("Bytes\tDepth\tPeak\tName");
+  for (const staticMemEntry_t *entry = &_staticMem_start; entry < &_staticMem_end; entry++) {
+    const staticMemState_t *state = entry->state;
+
+    total += entry->size;
+    if (state->handle == NULL) {
+      DEBUG_PRINTI("%"PRIu32" \t%u \t- \t%s", entry->size, entry->length, entry->name);
+      continue;
+    }
+    created += entry->size;
+
+    if (entry->type == STATIC_MEM_TASK) {
+      const UBaseType_t unused = uxTaskGetStackHighWaterMark((TaskHandle_t)state->handle);
+      DEBUG_PRINTI("%"PRIu32" \t%u \t%u \t%s", entry->size, entry->length,
+                   (unsigned int)((entry->length - unused) * entry->itemSize), entry->name);
+    } else {
+      DEBUG_PRINTI("%"PRIu32" \t%u \t%u \t%s", entry->size, entry->length, state->peak, entry->name);
+    }
+  }
+  DEBUG_PRINTI("Total: %"PRIu32" bytes, %"PRIu32" of them created", total, created);
+}
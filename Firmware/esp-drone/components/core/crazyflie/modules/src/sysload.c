@@ -23,17 +23,31 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  *
  * sysload.c - System load monitor
+ *
+ * The system.taskDump param prints the load and stack of all tasks once, and
+ * system.memDump the static tasks and queues of static_mem.h, system.busDump
+ * the transactions of every device on the buses, see busStats.h. With
+ * CONFIG_SYSLOAD_TELEMETRY the load and stack of a fixed table of tasks, and the
+ * idle time of every core, are also updated continuously in the taskLoad and
+ * taskStack log groups.
  */
 
 
 
 #include <stdbool.h>
 #include <inttypes.h>
+#include "sdkconfig.h"
+#include "esp_idf_version.h"
 #include "FreeRTOS.h"
+#include "task.h"
 #include "timers.h"
 #include "cfassert.h"
+#include "config.h"
 #include "param.h"
+#include "log.h"
 #include "static_mem.h"
+#include "alloc_trace.h"
+#include "busStats.h"
 
 #include "sysload.h"
 #include "stm32_legacy.h"
@@ -46,6 +60,8 @@ static void timerHandler(xTimerHandle timer);
 
 static bool initialized = false;
 static uint8_t triggerDump = 1;
+static uint8_t triggerMemDump = 0;
+static uint8_t triggerBusDump = 0;
 
 typedef struct {
   uint32_t ulRunTimeCounter;
@@ -59,12 +75,80 @@ static uint32_t previousTotalRunTime = 0;
 
 static StaticTimer_t timerBuffer;
 
+#ifdef CONFIG_SYSLOAD_TELEMETRY
+#define TELEMETRY_PERIOD M2T(CONFIG_SYSLOAD_TELEMETRY_PERIOD_MS)
+
+typedef enum {
+  TASK_LOAD_SYSTEM,
+  TASK_LOAD_SENSORS,
+  TASK_LOAD_STABILIZER,
+  TASK_LOAD_KALMAN,
+  TASK_LOAD_WIFILINK,
+  TASK_LOAD_UDP_RX,
+  TASK_LOAD_UDP_TX,
+  TASK_LOAD_CRTP_RX,
+  TASK_LOAD_CRTP_TX,
+  TASK_LOAD_LOG,
+  TASK_LOAD_PARAM,
+  TASK_LOAD_PM,
+  TASK_LOAD_COUNT,
+} taskLoadIndex_t;
+
+typedef struct {
+  const char *name;
+  TaskHandle_t handle;
+  uint32_t previousRunTime;
+  float load;         // [%] of one core since the last update
+  uint16_t stackLeft; // Unused stack at the peak
+} taskLoad_t;
+
+// The handles are looked up by name until the task is created, tasks that are
+// not in the table are not followed
+static taskLoad_t taskTable[TASK_LOAD_COUNT] = {
+  [TASK_LOAD_SYSTEM]     = { .name = SYSTEM_TASK_NAME },
+  [TASK_LOAD_SENSORS]    = { .name = SENSORS_TASK_NAME },
+  [TASK_LOAD_STABILIZER] = { .name = STABILIZER_TASK_NAME },
+  [TASK_LOAD_KALMAN]     = { .name = KALMAN_TASK_NAME },
+  [TASK_LOAD_WIFILINK]   = { .name = WIFILINK_TASK_NAME },
+  [TASK_LOAD_UDP_RX]     = { .name = UDP_RX_TASK_NAME },
+  [TASK_LOAD_UDP_TX]     = { .name = UDP_TX_TASK_NAME },
+  [TASK_LOAD_CRTP_RX]    = { .name = CRTP_RX_TASK_NAME },
+  [TASK_LOAD_CRTP_TX]    = { .name = CRTP_TX_TASK_NAME },
+  [TASK_LOAD_LOG]        = { .name = LOG_TASK_NAME },
+  [TASK_LOAD_PARAM]      = { .name = PARAM_TASK_NAME },
+  [TASK_LOAD_PM]         = { .name = PM_TASK_NAME },
+};
+
+static taskLoad_t idleTable[portNUM_PROCESSORS];
+static uint32_t previousTelemetryTime;
+
+static StaticTimer_t telemetryTimerBuffer;
+
+static void updateTaskLoad(taskLoad_t *task, float f);
+static void telemetryTimerHandler(xTimerHandle timer);
+#endif
+
 void sysLoadInit() {
   ASSERT(!initialized);
 
   xTimerHandle timer = xTimerCreateStatic( "sysLoadMonitorTimer", TIMER_PERIOD, pdTRUE, NULL, timerHandler, &timerBuffer);
   xTimerStart(timer, 100);
 
+#ifdef CONFIG_SYSLOAD_TELEMETRY
+  for (int i = 0; i < portNUM_PROCESSORS; i++) {
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 3, 0)
+    idleTable[i].handle = xTaskGetIdleTaskHandleForCore(i);
+#else
+    idleTable[i].handle = xTaskGetIdleTaskHandleForCPU(i);
+#endif
+    updateTaskLoad(&idleTable[i], 0.0f);
+  }
+  previousTelemetryTime = portGET_RUN_TIME_COUNTER_VALUE();
+
+  xTimerHandle telemetryTimer = xTimerCreateStatic("sysLoadTelemetryTimer", TELEMETRY_PERIOD, pdTRUE, NULL, telemetryTimerHandler, &telemetryTimerBuffer);
+  xTimerStart(telemetryTimer, 100);
+#endif
+
   initialized = true;
 }
 
@@ -88,6 +172,19 @@ static taskData_t* getPreviousTaskData(uint32_t xTaskNumber) {
 }
 
 static void timerHandler(xTimerHandle timer) {
+  staticMemSample();
+
+  if (triggerMemDump != 0) {
+    staticMemDump();
+    allocTraceDump();
+    triggerMemDump = 0;
+  }
+
+  if (triggerBusDump != 0) {
+    busStatsDump();
+    triggerBusDump = 0;
+  }
+
   if (triggerDump != 0) {
     uint32_t totalRunTime;
 
@@ -96,7 +193,6 @@ static void timerHandler(xTimerHandle timer) {
     ASSERT(taskCount < TASK_MAX_COUNT);
 
     uint32_t totalDelta = totalRunTime - previousTotalRunTime;
-    float f = 100.0 / totalDelta;
 
     // Dumps the the CPU load and stack usage for all tasks
     // CPU usage is since last dump in % compared to total time spent in tasks. Note that time spent in interrupts will be included in measured time.
@@ -109,8 +205,9 @@ static void timerHandler(xTimerHandle timer) {
       taskData_t* previousTaskData = getPreviousTaskData(stats->xTaskNumber);
 
       uint32_t taskRunTime = stats->ulRunTimeCounter;
-      float load = f * (taskRunTime - previousTaskData->ulRunTimeCounter);
-      DEBUG_PRINTI("%.2f \t%"PRIu32" \t%s \t%d", (double)load, stats->usStackHighWaterMark, stats->pcTaskName,stats->uxBasePriority);
+      // In hundredths of a percent, printed without the floating point formatting
+      uint32_t load = (uint64_t)(taskRunTime - previousTaskData->ulRunTimeCounter) * 10000 / (totalDelta ? totalDelta : 1);
+      DEBUG_PRINTI("%"PRIu32".%02"PRIu32" \t%"PRIu32" \t%s \t%d", load / 100, load % 100, stats->usStackHighWaterMark, stats->pcTaskName,stats->uxBasePriority);
 
       previousTaskData->ulRunTimeCounter = taskRunTime;
     }
@@ -122,7 +219,88 @@ static void timerHandler(xTimerHandle timer) {
   }
 }
 
+#ifdef CONFIG_SYSLOAD_TELEMETRY
+static void updateTaskLoad(taskLoad_t *task, float f) {
+  TaskStatus_t stats;
+
+  // Only the run time counter of the task, no snapshot of all tasks
+  vTaskGetInfo(task->handle, &stats, pdTRUE, eInvalid);
+  task->load = f * (uint32_t)(stats.ulRunTimeCounter - task->previousRunTime);
+  task->stackLeft = stats.usStackHighWaterMark;
+  task->previousRunTime = stats.ulRunTimeCounter;
+}
+
+static void telemetryTimerHandler(xTimerHandle timer) {
+  uint32_t time = portGET_RUN_TIME_COUNTER_VALUE();
+  float f = 100.0f / (uint32_t)(time - previousTelemetryTime);
+
+  for (int i = 0; i < TASK_LOAD_COUNT; i++) {
+    taskLoad_t *task = &taskTable[i];
+
+    if (task->handle == NULL) {
+      task->handle = xTaskGetHandle(task->name);
+      if (task->handle != NULL) {
+        // Only the first run time count, there is no load yet
+        updateTaskLoad(task, 0.0f);
+      }
+      continue;
+    }
+    updateTaskLoad(task, f);
+  }
+
+  for (int i = 0; i < portNUM_PROCESSORS; i++) {
+    updateTaskLoad(&idleTable[i], f);
+  }
+
+  staticMemSample();
+  previousTelemetryTime = time;
+}
+#endif
 
 PARAM_GROUP_START(system)
 PARAM_ADD(PARAM_UINT8, taskDump, &triggerDump)
+PARAM_ADD(PARAM_UINT8, memDump, &triggerMemDump)
+PARAM_ADD(PARAM_UINT8, busDump, &triggerBusDump)
 PARAM_GROUP_STOP(system)
+
+#ifdef CONFIG_SYSLOAD_TELEMETRY
+/**
+ * CPU load of the tasks in % of one core, and idle time of the cores in %
+ */
+LOG_GROUP_START(taskLoad)
+LOG_ADD(LOG_FLOAT, system, &taskTable[TASK_LOAD_SYSTEM].load)
+LOG_ADD(LOG_FLOAT, sensors, &taskTable[TASK_LOAD_SENSORS].load)
+LOG_ADD(LOG_FLOAT, stab, &taskTable[TASK_LOAD_STABILIZER].load)
+LOG_ADD(LOG_FLOAT, kalman, &taskTable[TASK_LOAD_KALMAN].load)
+LOG_ADD(LOG_FLOAT, wifilink, &taskTable[TASK_LOAD_WIFILINK].load)
+LOG_ADD(LOG_FLOAT, udpRx, &taskTable[TASK_LOAD_UDP_RX].load)
+LOG_ADD(LOG_FLOAT, udpTx, &taskTable[TASK_LOAD_UDP_TX].load)
+LOG_ADD(LOG_FLOAT, crtpRx, &taskTable[TASK_LOAD_CRTP_RX].load)
+LOG_ADD(LOG_FLOAT, crtpTx, &taskTable[TASK_LOAD_CRTP_TX].load)
+LOG_ADD(LOG_FLOAT, log, &taskTable[TASK_LOAD_LOG].load)
+LOG_ADD(LOG_FLOAT, param, &taskTable[TASK_LOAD_PARAM].load)
+LOG_ADD(LOG_FLOAT, pm, &taskTable[TASK_LOAD_PM].load)
+LOG_ADD(LOG_FLOAT, idle0, &idleTable[0].load)
+#if portNUM_PROCESSORS > 1
+LOG_ADD(LOG_FLOAT, idle1, &idleTable[1].load)
+#endif
+LOG_GROUP_STOP(taskLoad)
+
+/**
+ * Unused stack of the tasks at their peak, in bytes
+ */
+LOG_GROUP_START(taskStack)
+LOG_ADD(LOG_UINT16, system, &taskTable[TASK_LOAD_SYSTEM].stackLeft)
+LOG_ADD(LOG_UINT16, sensors, &taskTable[TASK_LOAD_SENSORS].stackLeft)
+LOG_ADD(LOG_UINT16, stab, &taskTable[TASK_LOAD_STABILIZER].stackLeft)
+LOG_ADD(LOG_UINT16, kalman, &taskTable[TASK_LOAD_KALMAN].stackLeft)
+LOG_ADD(LOG_UINT16, wifilink, &taskTable[TASK_LOAD_WIFILINK].stackLeft)
+LOG_ADD(LOG_UINT16, udpRx, &taskTable[TASK_LOAD_UDP_RX].stackLeft)
+LOG_ADD(LOG_UINT16, udpTx, &taskTable[TASK_LOAD_UDP_TX].stackLeft)
+LOG_ADD(LOG_UINT16, crtpRx, &taskTable[TASK_LOAD_CRTP_RX].stackLeft)
+LOG_ADD(LOG_UINT16, crtpTx, &taskTable[TASK_LOAD_CRTP_TX].stackLeft)
+LOG_ADD(LOG_UINT16, log, &taskTable[TASK_LOAD_LOG].stackLeft)
+LOG_ADD(LOG_UINT16, param, &taskTable[TASK_LOAD_PARAM].stackLeft)
+LOG_ADD(LOG_UINT16, pm, &taskTable[TASK_LOAD_PM].stackLeft)
+LOG_GROUP_STOP(taskStack)
+#endif
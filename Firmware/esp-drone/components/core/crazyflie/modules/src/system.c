@@ -42,7 +42,7 @@
 #include "config.h"
 #include "system.h"
 #include "platform.h"
-//#include "storage.h"
+#include "storage.h"
 #include "configblock.h"
 #include "worker.h"
 #include "freeRTOSdebug.h"
@@ -56,15 +56,23 @@
 #include "console.h"
 #include "wifilink.h"
 #include "mem.h"
+#include "flight_recorder.h"
+#include "link_capture.h"
+#include "power_save.h"
+#include "alloc_trace.h"
+#include "firmware_update.h"
+#include "kernel_bench.h"
 //#include "proximity.h"
 //#include "watchdog.h"
 #include "queuemonitor.h"
+#include "usec_time.h"
 #include "buzzer.h"
 #include "sound.h"
 #include "sysload.h"
 #include "estimator_kalman.h"
-//#include "deck.h"
-//#include "extrx.h"
+#include "deck.h"
+#include "extrx.h"
+#include "thermal_camera.h"
 #include "app.h"
 #include "stm32_legacy.h"
 #define DEBUG_MODULE "SYS"
@@ -86,6 +94,21 @@ static bool armed = ARM_INIT;
 static bool forceArm;
 static bool isInit;
 
+/* Boot stages, in the order they are done. Only what it takes to fly is
+ * initialized before the start, see systemBackgroundInit() */
+typedef enum {
+  BOOT_WIFI,        // Access point started
+  BOOT_INIT,        // systemInit() done
+  BOOT_FLIGHT,      // Link, commander, estimator and stabilizer initialized
+  BOOT_TESTED,      // Self tests done
+  BOOT_STARTED,     // Flight tasks released
+  BOOT_BACKGROUND,  // The rest initialized
+  BOOT_STAGE_COUNT,
+} bootStage_t;
+
+// Time each stage was done at, in ms since the esp_timer started
+static uint32_t bootStageTime[BOOT_STAGE_COUNT];
+
 STATIC_MEM_TASK_ALLOC(systemTask, SYSTEM_TASK_STACKSIZE);
 
 /* System wide synchronisation */
@@ -94,6 +117,12 @@ static StaticSemaphore_t canStartMutexBuffer;
 
 /* Private functions */
 static void systemTask(void *arg);
+static void systemBackgroundInit(void);
+
+static void bootStageDone(bootStage_t stage)
+{
+  bootStageTime[stage] = usecTimestamp() / 1000;
+}
 
 /* Public functions */
 void systemLaunch(void)
@@ -134,19 +163,17 @@ void systemInit(void)
               *((int*)(MCU_ID_ADDRESS+8)), *((int*)(MCU_ID_ADDRESS+4)),
               *((int*)(MCU_ID_ADDRESS+0)), *((short*)(MCU_FLASH_SIZE_ADDRESS)));*/
 
+  powerSaveInit();
   configblockInit();
-  //storageInit();
+#ifdef CONFIG_STORAGE
+  storageInit();
+#endif
   workerInit();
   adcInit();
   ledseqInit();
   pmInit();
-  buzzerInit();
 //  peerLocalizationInit();
 
-#ifdef APP_ENABLED
-  appInit();
-#endif
-
   isInit = true;
 }
 
@@ -159,7 +186,6 @@ bool systemTest()
   DEBUG_PRINTI("pmTest = %d", pass);
   pass &= workerTest();
   DEBUG_PRINTI("workerTest = %d", pass);
-  pass &= buzzerTest();
   return pass;
 }
 
@@ -171,12 +197,9 @@ void systemTask(void *arg)
 
   ledInit();
   ledSet(CHG_LED, 1);
+  // The access point comes up in the background, nothing below waits for it
   wifiInit();
-  vTaskDelay(M2T(500));
-
-#ifdef DEBUG_QUEUE_MONITOR
-  queueMonitorInit();
-#endif
+  bootStageDone(BOOT_WIFI);
 
 #ifdef ENABLE_UART1
   uart1Init(9600);
@@ -187,24 +210,34 @@ void systemTask(void *arg)
 
   //Init the high-levels modules
   systemInit();
+  bootStageDone(BOOT_INIT);
+#ifdef CONFIG_KERNEL_BENCH
+  // Nothing else runs yet, and the stabilizer initializes its modules again
+  kernelBenchPrint();
+#endif
   commInit();
   commanderInit();
+#ifdef CONFIG_EXTRX
+  extRxInit();
+#endif
+#ifdef CONFIG_THERMAL_CAMERA
+  // Not a flight sensor, one missing does not fail the self test
+  thermalCameraInit();
+#endif
 
   StateEstimatorType estimator = anyEstimator;
   estimatorKalmanTaskInit();
-  //deckInit();
-  //estimator = deckGetRequiredEstimator();
+  // Before the stabilizer, it picks the estimator the decks found require
+  deckInit();
+  estimator = deckGetRequiredEstimator();
+  // Starts the sensors task, it brings the sensors up, tests them and
+  // calibrates the gyro while the rest of the system is initialized and tested
   stabilizerInit(estimator);
   //if (deckGetRequiredLowInterferenceRadioMode() && platformConfigPhysicalLayoutAntennasAreClose())
   //{
   //  platformSetLowInterferenceRadioMode();
   //}
-  soundInit();
-  memInit();
-
-#ifdef PROXIMITY_ENABLED
-  proximityInit();
-#endif
+  bootStageDone(BOOT_FLIGHT);
 
 	/* Test each modules */
   pass &= wifiTest();
@@ -213,7 +246,10 @@ void systemTask(void *arg)
   DEBUG_PRINTI("systemTest = %d ", pass);
   pass &= configblockTest();
   DEBUG_PRINTI("configblockTest = %d ", pass);
-  //pass &= storageTest();
+#ifdef CONFIG_STORAGE
+  pass &= storageTest();
+  DEBUG_PRINTI("storageTest = %d ", pass);
+#endif
   pass &= commTest();
   DEBUG_PRINTI("commTest = %d ", pass);
   pass &= commanderTest();
@@ -222,21 +258,27 @@ void systemTask(void *arg)
   DEBUG_PRINTI("stabilizerTest = %d ", pass);
   pass &= estimatorKalmanTaskTest();
   DEBUG_PRINTI("estimatorKalmanTaskTest = %d ", pass);
-  //pass &= deckTest();
+  pass &= deckTest();
+  DEBUG_PRINTI("deckTest = %d ", pass);
   //pass &= soundTest();
   //pass &= memTest();
   DEBUG_PRINTI("memTest = %d ", pass);
   //pass &= watchdogNormalStartTest();
   pass &= cfAssertNormalStartTest();
 //  pass &= peerLocalizationTest();
+  bootStageDone(BOOT_TESTED);
+#ifdef CONFIG_FIRMWARE_UPDATE
+  // A firmware on trial after an update goes back to the previous one here
+  firmwareUpdateBootCheck(pass);
+#endif
 
   //Start the firmware
   if(pass)
   {
     selftestPassed = 1;
     systemStart();
+    bootStageDone(BOOT_STARTED);
     DEBUG_PRINTI("systemStart ! selftestPassed = %d", selftestPassed);
-    soundSetEffect(SND_STARTUP);
     ledseqRun(&seq_alive);
     ledseqRun(&seq_testPassed);
   }
@@ -254,6 +296,7 @@ void systemTask(void *arg)
         {
 	        DEBUG_PRINT("Start forced.\n");
           systemStart();
+          bootStageDone(BOOT_STARTED);
           break;
         }
       }
@@ -264,7 +307,18 @@ void systemTask(void *arg)
       ledSet(SYS_LED, true);
     }
   }
+
+  systemBackgroundInit();
+  bootStageDone(BOOT_BACKGROUND);
+  if (selftestPassed) {
+    soundSetEffect(SND_STARTUP);
+  }
+  DEBUG_PRINTI("Boot in ms: wifi %"PRIu32" init %"PRIu32" flight %"PRIu32" tested %"PRIu32" started %"PRIu32" background %"PRIu32,
+               bootStageTime[BOOT_WIFI], bootStageTime[BOOT_INIT], bootStageTime[BOOT_FLIGHT],
+               bootStageTime[BOOT_TESTED], bootStageTime[BOOT_STARTED], bootStageTime[BOOT_BACKGROUND]);
   DEBUG_PRINT("Free heap: %u bytes\n", (unsigned int)xPortGetFreeHeapSize());
+  // Nothing allocates from the heap from here on, or alloc_trace.c tells who
+  allocTraceStart();
 
   workerLoop();
 
@@ -274,6 +328,34 @@ void systemTask(void *arg)
 }
 
 
+/* The modules that are not needed to fly, initialized by the system task once
+ * the flight tasks run. Their CRTP ports answer a little later after boot. */
+static void systemBackgroundInit(void)
+{
+  buzzerInit();
+  if (!buzzerTest()) {
+    DEBUG_PRINTW("buzzerTest failed");
+  }
+  soundInit();
+#ifdef CONFIG_FLIGHT_RECORDER
+  flightRecorderInit();
+#endif
+#ifdef CONFIG_FIRMWARE_UPDATE
+  firmwareUpdateInit();
+#endif
+  linkCaptureInit();
+  kernelBenchServiceInit();
+  memInit();
+
+#ifdef PROXIMITY_ENABLED
+  proximityInit();
+#endif
+
+#ifdef APP_ENABLED
+  appInit();
+#endif
+}
+
 /* Global system variables */
 void systemStart()
 {
@@ -351,3 +433,15 @@ LOG_GROUP_START(sys)
 LOG_ADD(LOG_INT8, canfly, &canFly)
 LOG_ADD(LOG_INT8, armed, &armed)
 LOG_GROUP_STOP(sys)
+
+/**
+ * Time each boot stage was done at, in ms since the esp_timer started
+ */
+LOG_GROUP_START(boot)
+LOG_ADD(LOG_UINT32, wifi, &bootStageTime[BOOT_WIFI])
+LOG_ADD(LOG_UINT32, init, &bootStageTime[BOOT_INIT])
+LOG_ADD(LOG_UINT32, flight, &bootStageTime[BOOT_FLIGHT])
+LOG_ADD(LOG_UINT32, tested, &bootStageTime[BOOT_TESTED])
+LOG_ADD(LOG_UINT32, started, &bootStageTime[BOOT_STARTED])
+LOG_ADD(LOG_UINT32, background, &bootStageTime[BOOT_BACKGROUND])
+LOG_GROUP_STOP(boot)
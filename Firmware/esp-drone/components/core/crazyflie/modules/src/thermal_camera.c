@@ -0,0 +1,248 @@
+/**
+ *
+ * ESP-Drone Firmware
+ *
+ * Copyright 2019-2020  Espressif Systems (Shanghai)
+ * Copyright (C) 2011-2012 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * thermal_camera.c - Frames and hotspots of an AMG8833 thermal camera
+ *
+ * The AMG8833 has no frame ready signal, its INT pin only compares the pixels
+ * with levels, so the task reads on its own clock at the frame rate. A frame
+ * may then be read while the sensor updates it, with its last rows from the
+ * next frame of the sensor.
+ */
+
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "config.h"
+#include "thermal_camera.h"
+#include "amg8833.h"
+#include "crtp.h"
+#include "system.h"
+#include "log.h"
+#include "param.h"
+#include "static_mem.h"
+#include "cf_math.h"
+#include "stm32_legacy.h"
+#define DEBUG_MODULE "THERMAL"
+#include "debug_cf.h"
+
+#ifdef CONFIG_THERMAL_CAMERA
+
+#define THERMAL_CAMERA_PERIOD_MS 100
+
+// The pixels of the first and of the last column in a bit mask of the frame
+#define COLUMN_FIRST 0x0101010101010101ULL
+#define COLUMN_LAST  0x8080808080808080ULL
+
+static bool isInit;
+static AMG8833_Dev_t dev;
+
+// The task fills one frame while the other is the latest
+static int16_t frames[2][THERMAL_CAMERA_PIXELS];
+static int8_t latestFrame = -1;
+
+static int16_t hotThreshold = 3000;
+static uint8_t streamEvery;
+static uint8_t streamCountdown;
+static uint8_t streamFrame;
+static CRTPPacket packet;
+
+static int16_t maxTemp;
+static int16_t minTemp;
+static uint8_t hotPixels;
+static uint8_t blobCount;
+static uint8_t hotspotPixels;
+static float hotspotX = -1.0f;
+static float hotspotY = -1.0f;
+static uint32_t framesCount;
+static uint32_t readErrorCount;
+
+STATIC_MEM_TASK_ALLOC(thermalCameraTask, THERMAL_CAMERA_TASK_STACKSIZE);
+static void thermalCameraTask(void *param);
+
+void thermalCameraInit(void)
+{
+  if (isInit) {
+    return;
+  }
+
+  if (!amg8833Begin(&dev, I2C1_DEV)) {
+    DEBUG_PRINTW("AMG8833 not found\n");
+    return;
+  }
+
+  STATIC_MEM_TASK_CREATE_PINNED(thermalCameraTask, thermalCameraTask, THERMAL_CAMERA_TASK_NAME, NULL, THERMAL_CAMERA_TASK_PRI, THERMAL_CAMERA_TASK_CORE);
+
+  isInit = true;
+}
+
+bool thermalCameraTest(void)
+{
+  return isInit;
+}
+
+bool thermalCameraGetFrame(int16_t *pixels)
+{
+  const int8_t latest = __atomic_load_n(&latestFrame, __ATOMIC_ACQUIRE);
+  if (latest < 0) {
+    return false;
+  }
+
+  // The task only writes the other frame, for the next 100 ms
+  memcpy(pixels, frames[latest], sizeof(frames[latest]));
+  return true;
+}
+
+// The pixels 4 connected to the blob, within the mask
+static uint64_t growBlob(uint64_t blob, uint64_t mask)
+{
+  uint64_t previous;
+
+  do {
+    previous = blob;
+    blob |= ((blob << 8) | (blob >> 8) | ((blob << 1) & ~COLUMN_FIRST) | ((blob >> 1) & ~COLUMN_LAST)) & mask;
+  } while (blob != previous);
+
+  return blob;
+}
+
+static void findHotspots(const int16_t *pixels)
+{
+  uint64_t hot = 0;
+  int hottest = 0;
+  int coldest = 0;
+
+  for (int i = 0; i < THERMAL_CAMERA_PIXELS; i++) {
+    if (pixels[i] > pixels[hottest]) {
+      hottest = i;
+    }
+    if (pixels[i] < pixels[coldest]) {
+      coldest = i;
+    }
+    if (pixels[i] >= hotThreshold) {
+      hot |= 1ULL << i;
+    }
+  }
+
+  maxTemp = pixels[hottest];
+  minTemp = pixels[coldest];
+  hotPixels = __builtin_popcountll(hot);
+
+  uint8_t blobs = 0;
+  for (uint64_t rest = hot; rest != 0; blobs++) {
+    rest &= ~growBlob(rest & -rest, hot);
+  }
+  blobCount = blobs;
+
+  if (!(hot & (1ULL << hottest))) {
+    hotspotPixels = 0;
+    hotspotX = -1.0f;
+    hotspotY = -1.0f;
+    return;
+  }
+
+  // The centroid of the blob of the hottest pixel, by the heat above the threshold
+  const uint64_t hotspot = growBlob(1ULL << hottest, hot);
+  int32_t weight = 0;
+  int32_t weightX = 0;
+  int32_t weightY = 0;
+  for (uint64_t rest = hotspot; rest != 0; rest &= rest - 1) {
+    const int i = __builtin_ctzll(rest);
+    const int32_t heat = pixels[i] - hotThreshold + 1;
+    weight += heat;
+    weightX += heat * (i % THERMAL_CAMERA_WIDTH);
+    weightY += heat * (i / THERMAL_CAMERA_WIDTH);
+  }
+  hotspotPixels = __builtin_popcountll(hotspot);
+  hotspotX = (float)weightX / weight;
+  hotspotY = (float)weightY / weight;
+}
+
+static void streamFrameOut(const int16_t *pixels)
+{
+  thermalCameraPacket_t fragment = {
+    .frame = streamFrame++,
+    .base = minTemp,
+  };
+
+  packet.header = CRTP_HEADER(CRTP_PORT_THERMAL, THERMAL_CAMERA_CH_FRAME);
+  for (int start = 0; start < THERMAL_CAMERA_PIXELS; start += THERMAL_CAMERA_FRAGMENT_PIXELS) {
+    const int count = MIN(THERMAL_CAMERA_PIXELS - start, THERMAL_CAMERA_FRAGMENT_PIXELS);
+
+    for (int i = 0; i < count; i++) {
+      const int steps = (pixels[start + i] - minTemp) / THERMAL_CAMERA_STEP_CENTI;
+      fragment.pixels[i] = MIN(steps, UINT8_MAX);
+    }
+
+    memcpy(packet.data, &fragment, sizeof(fragment));
+    packet.size = sizeof(fragment) - THERMAL_CAMERA_FRAGMENT_PIXELS + count;
+    // A frame that does not fit the link is dropped, the next one comes soon
+    crtpSendPacket(&packet);
+    fragment.index++;
+  }
+}
+
+static void thermalCameraTask(void *param)
+{
+  systemWaitStart();
+
+  TickType_t lastWakeTime = xTaskGetTickCount();
+  int back = 0;
+
+  while (1) {
+    vTaskDelayUntil(&lastWakeTime, M2T(THERMAL_CAMERA_PERIOD_MS));
+
+    if (!amg8833ReadPixelsCenti(&dev, frames[back])) {
+      readErrorCount++;
+      continue;
+    }
+    __atomic_store_n(&latestFrame, back, __ATOMIC_RELEASE);
+    framesCount++;
+
+    findHotspots(frames[back]);
+
+    if (streamEvery > 0 && ++streamCountdown >= streamEvery) {
+      streamCountdown = 0;
+      streamFrameOut(frames[back]);
+    }
+
+    back ^= 1;
+  }
+}
+
+PARAM_GROUP_START(thermal)
+PARAM_ADD(PARAM_INT16, hotThr, &hotThreshold)
+PARAM_ADD(PARAM_UINT8, stream, &streamEvery)
+PARAM_GROUP_STOP(thermal)
+
+LOG_GROUP_START(thermal)
+LOG_ADD(LOG_INT16, maxT, &maxTemp)
+LOG_ADD(LOG_INT16, minT, &minTemp)
+LOG_ADD(LOG_UINT8, hotPix, &hotPixels)
+LOG_ADD(LOG_UINT8, blobs, &blobCount)
+LOG_ADD(LOG_UINT8, spotPix, &hotspotPixels)
+LOG_ADD(LOG_FLOAT, spotX, &hotspotX)
+LOG_ADD(LOG_FLOAT, spotY, &hotspotY)
+LOG_ADD(LOG_UINT32, frames, &framesCount)
+LOG_ADD(LOG_UINT32, errors, &readErrorCount)
+LOG_GROUP_STOP(thermal)
+
+#endif // CONFIG_THERMAL_CAMERA
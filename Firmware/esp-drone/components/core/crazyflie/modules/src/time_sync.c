@@ -0,0 +1,213 @@
+/**
+ *
+ * ESP-Drone Firmware
+ *
+ * Copyright 2019-2020  Espressif Systems (Shanghai)
+ * Copyright (C) 2011-2012 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * time_sync.c - The clock of the host on the drone, for the log timestamps
+ *
+ * The samples are handled by the CRTP RX task. The host time of the last
+ * accepted one, its drone time and the drift are read by the log and the
+ * stabilizer tasks, from both cores, under a lock. Wi-Fi delays vary by
+ * milliseconds, only the samples within TIME_SYNC_DELAY_MARGIN_US of the
+ * shortest delay are used, and each moves the offset by a part of its error.
+ * The drift is measured from the first sample on, its noise shrinks as the
+ * span grows, the clock correction engine keeps it within the spec of the
+ * crystals.
+ */
+#define DEBUG_MODULE "TSYNC"
+
+#include <string.h>
+
+#include "FreeRTOS.h"
+
+#include "config.h"
+#include "crtp.h"
+#include "time_sync.h"
+#include "clockCorrectionEngine.h"
+#include "log.h"
+#include "usec_time.h"
+#include "debug_cf.h"
+
+#ifdef CONFIG_TIME_SYNC
+
+// Samples slower than the shortest delay by more are not used
+#define TIME_SYNC_DELAY_MARGIN_US 2000
+// The shortest delay grows by this per sample, it follows a link that got slower
+#define TIME_SYNC_DELAY_AGING_US 50
+// Part of the error of a sample that goes into the offset
+#define TIME_SYNC_OFFSET_GAIN 0.25f
+// A larger error, e.g. the host set its clock, starts the synchronization again
+#define TIME_SYNC_STEP_US 100000
+// The drift is measured once the samples span this much
+#define TIME_SYNC_DRIFT_SPAN_US 10000000
+
+typedef struct {
+  uint64_t hostUs;
+  uint64_t droneUs;
+  float deviation;  // Of the drone clock, see clockCorrectionEngineGetDeviation()
+  bool isSynced;
+} timeSyncAnchor_t;
+
+static bool isInit;
+static timeSyncAnchor_t anchor;
+static portMUX_TYPE anchorLock = portMUX_INITIALIZER_UNLOCKED;
+
+// CRTP RX task only
+static clockCorrectionStorage_t correction;
+static uint64_t firstHostUs;
+static uint64_t firstDroneUs;
+static uint32_t shortestDelayUs = UINT32_MAX;
+
+// Log
+static uint32_t lastDelayUs;
+static uint16_t rejectedCount;
+static uint16_t restartCount;
+static float driftPpm;
+
+static void timeSyncCrtpCB(CRTPPacket* pk);
+
+void timeSyncInit(void)
+{
+  if (isInit) {
+    return;
+  }
+
+  crtpRegisterPortCB(CRTP_PORT_TIME_SYNC, timeSyncCrtpCB);
+  isInit = true;
+}
+
+static void setAnchor(uint64_t hostUs, uint64_t droneUs, float deviation)
+{
+  taskENTER_CRITICAL(&anchorLock);
+  anchor = (timeSyncAnchor_t){.hostUs = hostUs, .droneUs = droneUs, .deviation = deviation, .isSynced = true};
+  taskEXIT_CRITICAL(&anchorLock);
+}
+
+static uint64_t toHostUs(const timeSyncAnchor_t* a, uint64_t droneUs)
+{
+  // Nothing in double, the correction of the drift is a few us per second
+  const int64_t elapsed = (int64_t)(droneUs - a->droneUs);
+  return a->hostUs + elapsed + (int64_t)((float)elapsed * a->deviation);
+}
+
+uint64_t timeSyncHostUs(uint64_t droneUs)
+{
+  timeSyncAnchor_t a;
+
+  taskENTER_CRITICAL(&anchorLock);
+  a = anchor;
+  taskEXIT_CRITICAL(&anchorLock);
+
+  return a.isSynced ? toHostUs(&a, droneUs) : 0;
+}
+
+static void restart(const timeSyncSample_t* sample)
+{
+  memset(&correction, 0, sizeof(correction));
+  firstHostUs = sample->hostUs;
+  firstDroneUs = sample->droneUs;
+  driftPpm = 0.0f;
+  restartCount++;
+  setAnchor(sample->hostUs, sample->droneUs, 0.0f);
+}
+
+static void handleSample(const timeSyncSample_t* sample)
+{
+  if (shortestDelayUs <= UINT32_MAX - TIME_SYNC_DELAY_AGING_US) {
+    shortestDelayUs += TIME_SYNC_DELAY_AGING_US;
+  }
+  if (sample->delayUs < shortestDelayUs) {
+    shortestDelayUs = sample->delayUs;
+  }
+  if (sample->delayUs > shortestDelayUs + TIME_SYNC_DELAY_MARGIN_US) {
+    rejectedCount++;
+    return;
+  }
+  lastDelayUs = sample->delayUs;
+
+  // Only this task writes the anchor
+  const timeSyncAnchor_t a = anchor;
+  if (!a.isSynced || sample->droneUs <= a.droneUs) {
+    restart(sample);
+    return;
+  }
+
+  const uint64_t predictedUs = toHostUs(&a, sample->droneUs);
+  const int64_t errorUs = (int64_t)(sample->hostUs - predictedUs);
+  if (errorUs > TIME_SYNC_STEP_US || errorUs < -TIME_SYNC_STEP_US) {
+    DEBUG_PRINT("host clock stepped by %d ms\n", (int)(errorUs / 1000));
+    restart(sample);
+    return;
+  }
+
+  if (sample->droneUs - firstDroneUs >= TIME_SYNC_DRIFT_SPAN_US) {
+    const float candidate = clockCorrectionEngineCalculate(sample->hostUs, firstHostUs, sample->droneUs, firstDroneUs, UINT64_MAX);
+    clockCorrectionEngineUpdate(&correction, candidate);
+    driftPpm = clockCorrectionEngineGetDeviation(&correction) * 1e6f;
+  }
+
+  setAnchor(predictedUs + (int64_t)((float)errorUs * TIME_SYNC_OFFSET_GAIN), sample->droneUs,
+            clockCorrectionEngineGetDeviation(&correction));
+}
+
+static void timeSyncCrtpCB(CRTPPacket* pk)
+{
+  const uint64_t receivedUs = usecTimestamp();
+
+  if (pk->channel != TIME_SYNC_CHANNEL || pk->size == 0) {
+    return;
+  }
+
+  if (pk->data[0] == TIME_SYNC_PING && pk->size == sizeof(timeSyncPing_t)) {
+    timeSyncAnswer_t answer;
+
+    memcpy(&answer, pk->data, sizeof(timeSyncPing_t));
+    answer.t2 = receivedUs;
+    answer.t3 = usecTimestamp();
+    memcpy(pk->data, &answer, sizeof(answer));
+    pk->size = sizeof(answer);
+    crtpSendPacket(pk);
+  } else if (pk->data[0] == TIME_SYNC_SAMPLE && pk->size == sizeof(timeSyncSample_t)) {
+    timeSyncSample_t sample;
+
+    memcpy(&sample, pk->data, sizeof(sample));
+    handleSample(&sample);
+  }
+}
+
+// The host time of the sample, wraps after 71 minutes
+static uint32_t logHostUs(uint32_t timestamp, void* data)
+{
+  return (uint32_t)timeSyncHostUs(usecTimestamp());
+}
+
+static uint8_t logSynced(uint32_t timestamp, void* data)
+{
+  return anchor.isSynced;
+}
+
+LOG_GROUP_START(timeSync)
+LOG_ADD_BY_GETTER(LOG_UINT32, hostUs, logHostUs, NULL)
+LOG_ADD_BY_GETTER(LOG_UINT8, synced, logSynced, NULL)
+LOG_ADD(LOG_UINT32, delay, &lastDelayUs)
+LOG_ADD(LOG_FLOAT, drift, &driftPpm)
+LOG_ADD(LOG_UINT16, rejected, &rejectedCount)
+LOG_ADD(LOG_UINT16, restarts, &restartCount)
+LOG_GROUP_STOP(timeSync)
+
+#endif // CONFIG_TIME_SYNC
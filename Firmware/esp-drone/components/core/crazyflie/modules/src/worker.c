@@ -29,63 +29,211 @@
 
 #include "FreeRTOS.h"
 #include "task.h"
-#include "queue.h"
+#include "semphr.h"
 #include "queuemonitor.h"
 #include "static_mem.h"
+#include "config.h"
+#include "log.h"
+#include "usec_time.h"
 
 #include "console.h"
 
+// Per priority
 #define WORKER_QUEUE_LENGTH 5
 
 struct worker_work {
   void (*function)(void*);
   void* arg;
+  uint64_t timestamp;
 };
 
-static xQueueHandle workerQueue;
-STATIC_MEM_QUEUE_ALLOC(workerQueue, WORKER_QUEUE_LENGTH, sizeof(struct worker_work));
+typedef struct {
+  struct worker_work work[WORKER_QUEUE_LENGTH];
+  uint8_t head;
+  uint8_t count;
+
+  // Statistics
+  uint32_t scheduledCount;
+  uint32_t mergedCount;   // Already waiting, not queued again
+  uint32_t droppedCount;
+  uint8_t peakDepth;
+  uint32_t maxLatency;    // [us] from schedule to execution
+} workerQueue_t;
+
+// The queues are used from both cores
+static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+static workerQueue_t queues[WORKER_PRIORITY_COUNT];
+// Count of the waiting work of each loop
+static xSemaphoreHandle pendingWork;
+#ifdef CONFIG_WORKER_HIGH_PRIORITY_TASK
+static xSemaphoreHandle pendingHighWork;
+STATIC_MEM_TASK_ALLOC(workerHighTask, WORKER_TASK_STACKSIZE);
+#endif
 
 void workerInit()
 {
-  if (workerQueue)
+  if (pendingWork)
     return;
 
-  workerQueue = STATIC_MEM_QUEUE_CREATE(workerQueue);
-  DEBUG_QUEUE_MONITOR_REGISTER(workerQueue);
+  pendingWork = xSemaphoreCreateCounting(WORKER_PRIORITY_COUNT * WORKER_QUEUE_LENGTH, 0);
+#ifdef CONFIG_WORKER_HIGH_PRIORITY_TASK
+  pendingHighWork = xSemaphoreCreateCounting(WORKER_QUEUE_LENGTH, 0);
+#endif
 }
 
 bool workerTest()
 {
-  return (workerQueue != NULL);
+  return (pendingWork != NULL);
 }
 
-void workerLoop()
+/* Takes the oldest work of the highest priority in [first, last] */
+static bool workerTake(workerPriority_t first, workerPriority_t last, struct worker_work *work)
 {
-  struct worker_work work;
+  bool isTaken = false;
+
+  portENTER_CRITICAL(&lock);
+  for (int i = first; i <= last; i++) {
+    workerQueue_t *queue = &queues[i];
+
+    if (queue->count > 0) {
+      *work = queue->work[queue->head];
+      queue->head = (queue->head + 1) % WORKER_QUEUE_LENGTH;
+      queue->count--;
+
+      const uint32_t latency = usecTimestamp() - work->timestamp;
+      if (latency > queue->maxLatency) {
+        queue->maxLatency = latency;
+      }
+      isTaken = true;
+      break;
+    }
+  }
+  portEXIT_CRITICAL(&lock);
 
-  if (!workerQueue)
-    return;
+  return isTaken;
+}
+
+static void workerRun(xSemaphoreHandle pending, workerPriority_t first, workerPriority_t last)
+{
+  struct worker_work work;
 
   while (1)
   {
-    xQueueReceive(workerQueue, &work, portMAX_DELAY);
+    xSemaphoreTake(pending, portMAX_DELAY);
+    const bool isTaken = workerTake(first, last, &work);
+    queueMonitorReceived(qmWorker, isTaken);
 
-    if (work.function)
+    if (isTaken && work.function)
       work.function(work.arg);
   }
 }
 
+#ifdef CONFIG_WORKER_HIGH_PRIORITY_TASK
+static void workerHighTask(void *param)
+{
+  workerRun(pendingHighWork, WORKER_PRIORITY_HIGH, WORKER_PRIORITY_HIGH);
+}
+#endif
+
+void workerLoop()
+{
+  if (!pendingWork)
+    return;
+
+#ifdef CONFIG_WORKER_HIGH_PRIORITY_TASK
+  // Started with the loop, the work is executed once the system is started
+  STATIC_MEM_TASK_CREATE_PINNED(workerHighTask, workerHighTask, WORKER_TASK_NAME, NULL, WORKER_TASK_PRI, portNUM_PROCESSORS - 1);
+  workerRun(pendingWork, WORKER_PRIORITY_NORMAL, WORKER_PRIORITY_LOW);
+#else
+  workerRun(pendingWork, WORKER_PRIORITY_HIGH, WORKER_PRIORITY_LOW);
+#endif
+}
+
 int workerSchedule(void (*function)(void*), void *arg)
 {
-  struct worker_work work;
+  return workerScheduleWithPriority(WORKER_PRIORITY_NORMAL, function, arg);
+}
+
+/* Work that is already waiting, at any priority */
+static bool workerIsWaiting(void (*function)(void*), void *arg)
+{
+  for (int i = 0; i < WORKER_PRIORITY_COUNT; i++) {
+    const workerQueue_t *queue = &queues[i];
+
+    for (int j = 0; j < queue->count; j++) {
+      const struct worker_work *work = &queue->work[(queue->head + j) % WORKER_QUEUE_LENGTH];
+      if (work->function == function && work->arg == arg) {
+        return true;
+      }
+    }
+  }
+
+  return false;
+}
+
+int workerScheduleWithPriority(workerPriority_t priority, void (*function)(void*), void *arg)
+{
+  workerQueue_t *queue = &queues[priority];
+  xSemaphoreHandle pending = pendingWork;
+  BaseType_t result = pdTRUE;
 
   if (!function)
     return ENOEXEC;
 
-  work.function = function;
-  work.arg = arg;
-  if (xQueueSend(workerQueue, &work, 0) == pdFALSE)
+#ifdef CONFIG_WORKER_HIGH_PRIORITY_TASK
+  if (priority == WORKER_PRIORITY_HIGH)
+    pending = pendingHighWork;
+#endif
+
+  portENTER_CRITICAL(&lock);
+  if (workerIsWaiting(function, arg)) {
+    queue->mergedCount++;
+    portEXIT_CRITICAL(&lock);
+    return 0;
+  }
+
+  if (queue->count >= WORKER_QUEUE_LENGTH) {
+    queue->droppedCount++;
+    result = pdFALSE;
+  } else {
+    struct worker_work *work = &queue->work[(queue->head + queue->count) % WORKER_QUEUE_LENGTH];
+    work->function = function;
+    work->arg = arg;
+    work->timestamp = usecTimestamp();
+    queue->count++;
+    queue->scheduledCount++;
+    if (queue->count > queue->peakDepth) {
+      queue->peakDepth = queue->count;
+    }
+  }
+  portEXIT_CRITICAL(&lock);
+
+  queueMonitorSent(qmWorker, NULL, result);
+  if (result == pdFALSE)
     return ENOMEM;
 
+  xSemaphoreGive(pending);
+
   return 0;
 }
+
+/**
+ * Statistics of the worker queues, per priority
+ */
+LOG_GROUP_START(worker)
+LOG_ADD(LOG_UINT32, hiSched, &queues[WORKER_PRIORITY_HIGH].scheduledCount)
+LOG_ADD(LOG_UINT32, hiMerged, &queues[WORKER_PRIORITY_HIGH].mergedCount)
+LOG_ADD(LOG_UINT32, hiDropped, &queues[WORKER_PRIORITY_HIGH].droppedCount)
+LOG_ADD(LOG_UINT8, hiPeak, &queues[WORKER_PRIORITY_HIGH].peakDepth)
+LOG_ADD(LOG_UINT32, hiMaxLat, &queues[WORKER_PRIORITY_HIGH].maxLatency)
+LOG_ADD(LOG_UINT32, normSched, &queues[WORKER_PRIORITY_NORMAL].scheduledCount)
+LOG_ADD(LOG_UINT32, normMerged, &queues[WORKER_PRIORITY_NORMAL].mergedCount)
+LOG_ADD(LOG_UINT32, normDropped, &queues[WORKER_PRIORITY_NORMAL].droppedCount)
+LOG_ADD(LOG_UINT8, normPeak, &queues[WORKER_PRIORITY_NORMAL].peakDepth)
+LOG_ADD(LOG_UINT32, normMaxLat, &queues[WORKER_PRIORITY_NORMAL].maxLatency)
+LOG_ADD(LOG_UINT32, lowSched, &queues[WORKER_PRIORITY_LOW].scheduledCount)
+LOG_ADD(LOG_UINT32, lowMerged, &queues[WORKER_PRIORITY_LOW].mergedCount)
+LOG_ADD(LOG_UINT32, lowDropped, &queues[WORKER_PRIORITY_LOW].droppedCount)
+LOG_ADD(LOG_UINT8, lowPeak, &queues[WORKER_PRIORITY_LOW].peakDepth)
+LOG_ADD(LOG_UINT32, lowMaxLat, &queues[WORKER_PRIORITY_LOW].maxLatency)
+LOG_GROUP_STOP(worker)
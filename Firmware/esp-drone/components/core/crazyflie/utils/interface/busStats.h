@@ -0,0 +1,128 @@
+/**
+ *
+ * ESP-Drone Firmware
+ *
+ * Copyright 2019-2020  Espressif Systems (Shanghai)
+ * Copyright (C) 2011-2012 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * busStats.h - Utilization and contention of the I2C and SPI buses
+ *
+ * The bus drivers record every transaction: the wait for the mutex of the
+ * bus, how long the bus was held and how the transaction ended, per bus and
+ * per device. Everything but the lock timeouts is recorded while holding
+ * the bus, so only those are counted atomically. The log group of a bus has
+ * its busy time in % and the wait histogram, the system.busDump param prints
+ * the devices of every bus.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "sdkconfig.h"
+#include "esp_err.h"
+#include "statsCnt.h"
+
+#define BUS_STATS_DEVICES    8
+#define BUS_STATS_WAIT_BINS  5     // Waits below 10 us, 100 us, 1 ms, 10 ms and longer
+#define BUS_STATS_NO_DEVICE  0xFF
+
+typedef struct {
+  uint8_t address;          // The 7 bit I2C address, or the SPI clock in MHz
+  uint32_t count;
+  uint32_t failCount;
+  uint32_t busyUs;
+  uint32_t maxUs;
+} busStatsDevice_t;
+
+typedef struct busStats_s {
+  const char *name;
+  statsCntRateCounter_t busyRate;      // us held per s
+  statsCntRateCounter_t transferRate;
+  uint32_t nackCount;
+  uint32_t timeoutCount;               // Of the transfers
+  uint32_t errorCount;
+  uint32_t lockTimeoutCount;           // Gave up waiting for the bus
+  uint32_t waitBins[BUS_STATS_WAIT_BINS];
+  uint32_t maxWaitUs;
+  uint32_t maxHoldUs;
+  uint8_t holder;                      // The device holding the bus, or the last one
+  uint8_t blocker;                     // The holder at the last lock timeout
+  uint8_t deviceCount;
+  uint32_t holdStartUs;
+  busStatsDevice_t devices[BUS_STATS_DEVICES];
+  struct busStats_s *next;
+} busStats_t;
+
+#ifdef CONFIG_BUS_STATS
+  /**
+   * Add a bus to the dump, called once by its driver before the first transaction.
+   */
+  void busStatsRegister(busStats_t *stats, const char *name);
+
+  uint32_t busStatsNowUs(void);
+
+  /**
+   * The mutex of the bus was not taken in time, from any task.
+   */
+  void busStatsLockTimeout(busStats_t *stats);
+
+  /**
+   * The mutex of the bus was taken, waitStartUs is the busStatsNowUs() before.
+   */
+  void busStatsAcquire(busStats_t *stats, uint8_t device, uint32_t waitStartUs);
+
+  /**
+   * The transaction ended with err and the bus is given back. ESP_FAIL is
+   * counted as a NACK, as the I2C driver of the IDF returns it for one.
+   */
+  void busStatsRelease(busStats_t *stats, esp_err_t err);
+
+  /**
+   * Prints the devices of every bus on the console.
+   */
+  void busStatsDump(void);
+
+  float busStatsLogBusy(uint32_t timestamp, void *data);
+  float busStatsLogRate(uint32_t timestamp, void *data);
+
+  /**
+   * The log variables of a bus, in a LOG_GROUP_START() - LOG_GROUP_STOP() block
+   */
+  #define BUS_STATS_LOG_ADD(STATS) \
+    LOG_ADD_BY_GETTER(LOG_FLOAT, busy, busStatsLogBusy, STATS) \
+    LOG_ADD_BY_GETTER(LOG_FLOAT, rate, busStatsLogRate, STATS) \
+    LOG_ADD(LOG_UINT32, nack, &(STATS)->nackCount) \
+    LOG_ADD(LOG_UINT32, timeout, &(STATS)->timeoutCount) \
+    LOG_ADD(LOG_UINT32, error, &(STATS)->errorCount) \
+    LOG_ADD(LOG_UINT32, lockTimeout, &(STATS)->lockTimeoutCount) \
+    LOG_ADD(LOG_UINT8, blocker, &(STATS)->blocker) \
+    LOG_ADD(LOG_UINT32, waitMax, &(STATS)->maxWaitUs) \
+    LOG_ADD(LOG_UINT32, holdMax, &(STATS)->maxHoldUs) \
+    LOG_ADD(LOG_UINT32, wait10us, &(STATS)->waitBins[0]) \
+    LOG_ADD(LOG_UINT32, wait100us, &(STATS)->waitBins[1]) \
+    LOG_ADD(LOG_UINT32, wait1ms, &(STATS)->waitBins[2]) \
+    LOG_ADD(LOG_UINT32, wait10ms, &(STATS)->waitBins[3]) \
+    LOG_ADD(LOG_UINT32, waitLong, &(STATS)->waitBins[4])
+#else
+  #define busStatsRegister(STATS, NAME)
+  #define busStatsNowUs() 0
+  #define busStatsLockTimeout(STATS)
+  #define busStatsAcquire(STATS, DEVICE, WAIT_START_US) ((void)(WAIT_START_US))
+  #define busStatsRelease(STATS, ERR)
+  #define busStatsDump()
+#endif
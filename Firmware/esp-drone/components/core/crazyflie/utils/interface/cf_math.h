@@ -28,6 +28,8 @@
 
 #pragma once
 
+#include <stdint.h>
+
 // Include "xtensa_math.h". This header generates some warnings, especially in
 // unit tests. We hide them to avoid noise.
 //TODO: NEED ESP32 SUPPORT
@@ -51,7 +53,7 @@
 // Matrix data must be aligned on 4 byte bundaries
 static inline void assert_aligned_4_bytes(const xtensa_matrix_instance_f32 *matrix)
 {
-    const uint32_t address = (uint32_t)matrix->pData;
+    const uintptr_t address = (uintptr_t)matrix->pData;
     ASSERT((address & 0x3) == 0);
 }
 
@@ -80,6 +82,115 @@ static inline void mat_mult(const xtensa_matrix_instance_f32 *pSrcA, const xtens
     ASSERT(XTENSA_MATH_SUCCESS == xtensa_mat_mult_f32(pSrcA, pSrcB, pDst));
 }
 
+// Fixed size kernels for row-major n x n float matrices in hot paths. The
+// size is known at compile time, so the loops unroll and there is nothing to
+// check, contrary to mat_mult() and mat_trans(). The output must not alias an
+// input.
+#define CF_MAT_UNROLL _Pragma("GCC unroll 16")
+
+// Symmetric n x n matrices may be stored as their packed upper triangle, row by
+// row, n * (n + 1) / 2 floats. Index of element (i, j) for i <= j:
+#define CF_PACKED_INDEX(n, i, j) ((i) * (n) - (i) * ((i) - 1) / 2 + (j) - (i))
+
+#define CF_MAT_KERNELS(n)                                                                                   \
+/* c = a * b */                                                                                             \
+static inline void mat_mult_##n##x##n(const float *restrict a, const float *restrict b, float *restrict c)  \
+{                                                                                                           \
+    for (int i = 0; i < n; i++) {                                                                           \
+        float row[n];                                                                                       \
+        CF_MAT_UNROLL for (int j = 0; j < n; j++) { row[j] = a[i * n] * b[j]; }                             \
+        for (int k = 1; k < n; k++) {                                                                       \
+            const float aik = a[i * n + k];                                                                 \
+            CF_MAT_UNROLL for (int j = 0; j < n; j++) { row[j] += aik * b[k * n + j]; }                     \
+        }                                                                                                   \
+        CF_MAT_UNROLL for (int j = 0; j < n; j++) { c[i * n + j] = row[j]; }                                \
+    }                                                                                                       \
+}                                                                                                           \
+                                                                                                            \
+/* c = a' */                                                                                                \
+static inline void mat_trans_##n##x##n(const float *restrict a, float *restrict c)                          \
+{                                                                                                           \
+    for (int i = 0; i < n; i++) {                                                                           \
+        CF_MAT_UNROLL for (int j = 0; j < n; j++) { c[j * n + i] = a[i * n + j]; }                          \
+    }                                                                                                       \
+}                                                                                                           \
+                                                                                                            \
+/* c = a * b * a' for a symmetric b, only the upper triangle is computed and c is exactly symmetric. */     \
+/* tmp holds a * b, c may be b */                                                                           \
+static inline void mat_abat_sym_##n##x##n(const float *restrict a, const float *b,                          \
+                                          float *restrict tmp, float *c)                                    \
+{                                                                                                           \
+    mat_mult_##n##x##n(a, b, tmp);                                                                          \
+    for (int i = 0; i < n; i++) {                                                                           \
+        for (int j = i; j < n; j++) {                                                                       \
+            float sum = 0.0f;                                                                               \
+            CF_MAT_UNROLL for (int k = 0; k < n; k++) { sum += tmp[i * n + k] * a[j * n + k]; }             \
+            c[i * n + j] = c[j * n + i] = sum;                                                              \
+        }                                                                                                   \
+    }                                                                                                       \
+}                                                                                                           \
+                                                                                                            \
+/* The same for b and c packed, see CF_PACKED_INDEX(). tmp holds b unpacked, n x n, c may be b */           \
+static inline void mat_abat_packed_##n##x##n(const float *restrict a, const float *b,                       \
+                                             float *restrict tmp, float *c)                                 \
+{                                                                                                           \
+    CF_MAT_UNROLL for (int i = 0; i < n; i++) {                                                             \
+        CF_MAT_UNROLL for (int j = 0; j < n; j++) {                                                         \
+            tmp[i * n + j] = b[i <= j ? CF_PACKED_INDEX(n, i, j) : CF_PACKED_INDEX(n, j, i)];               \
+        }                                                                                                   \
+    }                                                                                                       \
+    /* Row i of a * b is only needed for row i of the upper triangle of c */                                \
+    for (int i = 0, index = 0; i < n; i++) {                                                                \
+        float row[n];                                                                                       \
+        CF_MAT_UNROLL for (int j = 0; j < n; j++) { row[j] = a[i * n] * tmp[j]; }                           \
+        for (int k = 1; k < n; k++) {                                                                       \
+            const float aik = a[i * n + k];                                                                 \
+            CF_MAT_UNROLL for (int j = 0; j < n; j++) { row[j] += aik * tmp[k * n + j]; }                   \
+        }                                                                                                   \
+        for (int j = i; j < n; j++, index++) {                                                              \
+            float sum = 0.0f;                                                                               \
+            CF_MAT_UNROLL for (int k = 0; k < n; k++) { sum += row[k] * a[j * n + k]; }                     \
+            c[index] = sum;                                                                                 \
+        }                                                                                                   \
+    }                                                                                                       \
+}
+
+CF_MAT_KERNELS(3)
+CF_MAT_KERNELS(4)
+CF_MAT_KERNELS(9)
+
+/* mat_abat_packed_9x9() for an a that is block upper triangular in 3 x 3 blocks, as the linearized */
+/* dynamics of the kalman filter: the blocks below the diagonal are taken as zero and not read. Row i */
+/* of a * b is needed from the block of i on only, 378 + 216 multiply-adds instead of 729 + 405. */
+static inline void mat_abat_packed_blocktri_9x9(const float *restrict a, const float *b,
+                                                float *restrict tmp, float *c)
+{
+    CF_MAT_UNROLL for (int i = 0; i < 9; i++) {
+        CF_MAT_UNROLL for (int j = 0; j < 9; j++) {
+            tmp[i * 9 + j] = b[i <= j ? CF_PACKED_INDEX(9, i, j) : CF_PACKED_INDEX(9, j, i)];
+        }
+    }
+    /* The loops over the blocks unroll, the bounds of the inner ones are constants then */
+    CF_MAT_UNROLL for (int bi = 0; bi < 3; bi++) {
+        const int begin = 3 * bi;
+        for (int i = begin; i < begin + 3; i++) {
+            float row[9];
+            CF_MAT_UNROLL for (int j = begin; j < 9; j++) { row[j] = a[i * 9 + begin] * tmp[begin * 9 + j]; }
+            CF_MAT_UNROLL for (int k = begin + 1; k < 9; k++) {
+                const float aik = a[i * 9 + k];
+                CF_MAT_UNROLL for (int j = begin; j < 9; j++) { row[j] += aik * tmp[k * 9 + j]; }
+            }
+            CF_MAT_UNROLL for (int bj = bi; bj < 3; bj++) {
+                for (int j = bj == bi ? i : 3 * bj; j < 3 * bj + 3; j++) {
+                    float sum = 0.0f;
+                    CF_MAT_UNROLL for (int k = 3 * bj; k < 9; k++) { sum += row[k] * a[j * 9 + k]; }
+                    c[CF_PACKED_INDEX(9, i, j)] = sum;
+                }
+            }
+        }
+    }
+}
+
 static inline float xtensa_sqrt(float32_t in)
 {
     float pOut = 0;
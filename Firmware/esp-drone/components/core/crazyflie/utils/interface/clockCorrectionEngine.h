@@ -24,6 +24,12 @@
  *
  * clockCorrectionEngine.h - utitlity for keeping track of clock drift
  * in UWB positioning system.
+ *
+ * A clock correction is within a few ppm of 1. It is kept as its deviation
+ * from 1 in single precision, which resolves it far better than a double of
+ * the correction itself, and the deviation is computed from the exact
+ * difference of integer tick counts. Nothing is computed in double, which the
+ * single precision FPU of the ESP32 only emulates.
  */
 
 #ifndef clockCorrectionEngine_h
@@ -33,12 +39,14 @@
 #include <stdint.h>
 
 typedef struct {
-  double clockCorrection;
+  float clockCorrectionDeviation; // The clock correction - 1
   unsigned int clockCorrectionBucket;
+  bool hasClockCorrection;
 } clockCorrectionStorage_t;
 
-double clockCorrectionEngineGet(const clockCorrectionStorage_t* storage);
-double clockCorrectionEngineCalculate(const uint64_t new_t_in_cl_reference, const uint64_t old_t_in_cl_reference, const uint64_t new_t_in_cl_x, const uint64_t old_t_in_cl_x, const uint64_t mask);
-bool clockCorrectionEngineUpdate(clockCorrectionStorage_t* storage, const double clockCorrectionCandidate);
+float clockCorrectionEngineGet(const clockCorrectionStorage_t* storage);
+float clockCorrectionEngineGetDeviation(const clockCorrectionStorage_t* storage);
+float clockCorrectionEngineCalculate(const uint64_t new_t_in_cl_reference, const uint64_t old_t_in_cl_reference, const uint64_t new_t_in_cl_x, const uint64_t old_t_in_cl_x, const uint64_t mask);
+bool clockCorrectionEngineUpdate(clockCorrectionStorage_t* storage, const float clockCorrectionCandidate);
 
 #endif /* clockCorrectionEngine_h */
@@ -0,0 +1,66 @@
+/**
+ *
+ * ESP-Drone Firmware
+ *
+ * Copyright 2019-2020  Espressif Systems (Shanghai)
+ * Copyright (C) 2011-2012 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * clockOffsetEngine.h - Offset of the clock of a remote host to the local
+ * clock, from the timestamps of the packets it sends
+ *
+ * The packets only go one way, so the offset found is the clock offset plus
+ * the least delay of the link: the least (local time of reception - remote
+ * timestamp) over the last one to two windows. A sample later than that by
+ * the jitter of the link was delayed by as much. The windows follow the drift
+ * of the clocks. Like clockCorrectionEngine.c, samples far off are rejected,
+ * until a leaky bucket runs empty and a new reference is taken, e.g. after
+ * a restart of the host.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct {
+  int64_t offset;             // local - remote of the least delayed sample, us
+  int64_t windowMin[2];       // least delayed sample of the current and of the previous window
+  uint64_t windowStartUs;     // local time the current window started
+  uint64_t remoteUs;          // remote time of the last sample, unwrapped
+  uint64_t localUs;           // local time of the last sample
+  unsigned int bucket;
+  bool isValid;
+} clockOffsetStorage_t;
+
+void clockOffsetEngineReset(clockOffsetStorage_t* storage);
+
+/**
+ * Adds a sample, the remote timestamp of a packet received at localUs.
+ *
+ * @param remoteUs The remote timestamp in us, truncated to the bits of the mask
+ * @param localUs The local time of reception, usecTimestamp()
+ * @param mask The bits of the remote timestamp, it is unwrapped with the local clock
+ * @return True if the sample is reliable, it fits the current offset
+ */
+bool clockOffsetEngineUpdate(clockOffsetStorage_t* storage, const uint64_t remoteUs, const uint64_t localUs, const uint64_t mask);
+
+int64_t clockOffsetEngineGet(const clockOffsetStorage_t* storage);
+
+/**
+ * The local time of the remote timestamp of the last sample, had it come with
+ * the least delay. Only valid when the last update was reliable.
+ */
+uint64_t clockOffsetEngineLocalTime(const clockOffsetStorage_t* storage);
@@ -31,6 +31,7 @@
 #ifndef _crc_h
 #define _crc_h
 
+#include <stddef.h>
 #include <stdint.h>
 
 #define FALSE	0
@@ -119,5 +120,19 @@ crc   crcSlow(void * datas, int nBytes);
  */
 crc   crcFast(void * datas, int nBytes);
 
+/**
+ * CRC-32 of the data, table driven and with no init to call.
+ *
+ * On the ESP32 this is the CRC routine of the ROM, elsewhere a slicing-by-4
+ * loop. Chaining the calls over consecutive buffers gives the CRC of the
+ * whole, and for one buffer the result is the one of crcSlow() with CRC32.
+ *
+ * @param previous 0 for the first buffer, or the CRC of the preceding data.
+ * @param data Pointer to the data buffer onto the CRC will be calculated.
+ * @param nBytes Number of bytes to calculate the CRC from.
+ * @return The CRC of the data so far.
+ */
+uint32_t crc32Update(uint32_t previous, const void *data, size_t nBytes);
+
 
 #endif /* _crc_h */
@@ -27,6 +27,7 @@
 #ifndef _DEBUG_CF_H
 #define _DEBUG_CF_H
 
+#include "sdkconfig.h"
 #include "config.h"
 #include "console.h"
 //if enable, some message will print to remote client 
@@ -85,6 +86,20 @@ void debugInit(void);
   #define DEBUG_PRINT_OS(fmt, ...) ESP_LOG_LEVEL_LOCAL(ESP_LOG_INFO,DEBUG_MODULE,fmt, ##__VA_ARGS__)
 #endif
 
+// Formatted by the client, see debug_deferred.h. DEBUG_PRINTD, DEBUG_PRINTV
+// and DEBUG_PRINT_LOCAL stay local.
+#ifdef CONFIG_DEBUG_DEFERRED
+  #include "debug_deferred.h"
+  #undef DEBUG_PRINT
+  #undef DEBUG_PRINTE
+  #undef DEBUG_PRINTW
+  #undef DEBUG_PRINTI
+  #define DEBUG_PRINT(fmt, ...) DEBUG_PRINT_DEFERRED(DEBUG_MODULE ": " fmt, ##__VA_ARGS__)
+  #define DEBUG_PRINTE(fmt, ...) DEBUG_PRINT_DEFERRED(DEBUG_MODULE ": " fmt, ##__VA_ARGS__)
+  #define DEBUG_PRINTW(fmt, ...) DEBUG_PRINT_DEFERRED(DEBUG_MODULE ": " fmt, ##__VA_ARGS__)
+  #define DEBUG_PRINTI(fmt, ...) DEBUG_PRINT_DEFERRED(DEBUG_MODULE ": " fmt, ##__VA_ARGS__)
+#endif
+
 #ifndef PRINT_OS_DEBUG_INFO
   #undef DEBUG_PRINT_OS
   #define DEBUG_PRINT_OS(fmt, ...)
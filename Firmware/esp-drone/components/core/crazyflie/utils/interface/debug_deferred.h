@@ -0,0 +1,102 @@
+/**
+ *
+ * ESP-Drone Firmware
+ *
+ * Copyright 2019-2020  Espressif Systems (Shanghai)
+ * Copyright (C) 2011-2012 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * debug_deferred.h - Debug prints formatted by the client
+ *
+ * The format string is placed in the .dlog section, and only its offset in
+ * the section and the raw arguments are sent, as a record on channel 1 of
+ * the console port:
+ *
+ *   [argsCount:1][id:2][timestamp in ms:4][args:4*argsCount]
+ *
+ * Every argument is one 32 bit little endian word: integers are truncated to
+ * 32 bits, float and double are sent as float and string arguments as their
+ * address. tools/dlog/dlog.py extracts the format strings from the .elf and
+ * formats the records. At most DLOG_MAX_ARGS arguments are supported.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "console.h"
+#include "usec_time.h"
+
+#define DLOG_MAX_ARGS 8
+
+/* Section holding the format strings, see main/linker_fragment.lf */
+extern const char _dlog_start;
+
+static inline uint32_t dlogFromInt(uint32_t value) { return value; }
+static inline uint32_t dlogFromFloat(float value) { uint32_t word; memcpy(&word, &value, 4); return word; }
+static inline uint32_t dlogFromDouble(double value) { return dlogFromFloat((float)value); }
+static inline uint32_t dlogFromPointer(const void *value) { return (uint32_t)(uintptr_t)value; }
+
+#define DLOG_WORD(x) _Generic((x), \
+    float: dlogFromFloat, \
+    double: dlogFromDouble, \
+    char*: dlogFromPointer, \
+    const char*: dlogFromPointer, \
+    void*: dlogFromPointer, \
+    const void*: dlogFromPointer, \
+    default: dlogFromInt)(x)
+
+#define DLOG_MAP_0()
+#define DLOG_MAP_1(a) DLOG_WORD(a)
+#define DLOG_MAP_2(a, ...) DLOG_WORD(a), DLOG_MAP_1(__VA_ARGS__)
+#define DLOG_MAP_3(a, ...) DLOG_WORD(a), DLOG_MAP_2(__VA_ARGS__)
+#define DLOG_MAP_4(a, ...) DLOG_WORD(a), DLOG_MAP_3(__VA_ARGS__)
+#define DLOG_MAP_5(a, ...) DLOG_WORD(a), DLOG_MAP_4(__VA_ARGS__)
+#define DLOG_MAP_6(a, ...) DLOG_WORD(a), DLOG_MAP_5(__VA_ARGS__)
+#define DLOG_MAP_7(a, ...) DLOG_WORD(a), DLOG_MAP_6(__VA_ARGS__)
+#define DLOG_MAP_8(a, ...) DLOG_WORD(a), DLOG_MAP_7(__VA_ARGS__)
+
+#define DLOG_NARGS(...) DLOG_NARGS_(0, ##__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define DLOG_NARGS_(_0, _1, _2, _3, _4, _5, _6, _7, _8, N, ...) N
+#define DLOG_CAT(a, b) DLOG_CAT_(a, b)
+#define DLOG_CAT_(a, b) a ## b
+
+static inline void dlogWrite(const char *fmt, uint32_t argsCount, const uint32_t *args)
+{
+  uint8_t record[1 + 2 + 4 + 4 * DLOG_MAX_ARGS];
+  const uint16_t id = fmt - &_dlog_start;
+  const uint32_t timestamp = usecTimestamp() / 1000;
+
+  record[0] = argsCount;
+  memcpy(&record[1], &id, 2);
+  memcpy(&record[3], &timestamp, 4);
+  memcpy(&record[7], args, 4 * argsCount);
+
+  consoleWriteRecord(record, 7 + 4 * argsCount);
+}
+
+/**
+ * Deferred printf, only the format string ID and the arguments are sent
+ *
+ * @param FMT String format, must be a literal
+ * @param ... Up to DLOG_MAX_ARGS arguments
+ */
+#define DEBUG_PRINT_DEFERRED(FMT, ...) do { \
+    static const char dlogFmt[] __attribute__((section(".dlog"), used)) = FMT; \
+    const uint32_t dlogArgs[] = {0, DLOG_CAT(DLOG_MAP_, DLOG_NARGS(__VA_ARGS__))(__VA_ARGS__)}; \
+    dlogWrite(dlogFmt, DLOG_NARGS(__VA_ARGS__), &dlogArgs[1]); \
+  } while (0)
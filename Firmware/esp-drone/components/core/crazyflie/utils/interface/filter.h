@@ -25,6 +25,7 @@
  */
 #ifndef FILTER_H_
 #define FILTER_H_
+#include <stdbool.h>
 #include <stdint.h>
 #include "math.h"
 
@@ -47,6 +48,45 @@ void lpf2pSetCutoffFreq(lpf2pData* lpfData, float sample_freq, float cutoff_freq
 float lpf2pApply(lpf2pData* lpfData, float sample);
 float lpf2pReset(lpf2pData* lpfData, float sample);
 
+/**
+ * Cascade of biquads applied to the three axes of a sensor at once.
+ *
+ * The sections are in transposed direct form II and the state is kept per
+ * axis, structure of arrays, so that the three axes of a section are computed
+ * side by side and their chains of multiply-accumulates overlap. Up to
+ * BIQUAD3_MAX_STAGES low pass and notch sections are run in the order they
+ * were added.
+ */
+#define BIQUAD3_MAX_STAGES 4
+
+typedef struct {
+  float b0;
+  float b1;
+  float b2;
+  float a1;
+  float a2;
+  float d1[3];
+  float d2[3];
+} biquad3Stage;
+
+typedef struct {
+  biquad3Stage stages[BIQUAD3_MAX_STAGES];
+  uint8_t numStages;
+} biquad3Data;
+
+/** Remove all sections, the filter then passes the samples through. */
+void biquad3Init(biquad3Data* data);
+/** Append a second order Butterworth low pass, the same as lpf2pInit(). Returns false when full. */
+bool biquad3AddLpf(biquad3Data* data, float sample_freq, float cutoff_freq);
+/** Append a notch at center_freq, bandwidth_freq wide at -3 dB. Returns false when full. */
+bool biquad3AddNotch(biquad3Data* data, float sample_freq, float center_freq, float bandwidth_freq);
+/** Move the notch of section index, its state is kept so that it can follow a moving frequency. */
+bool biquad3SetNotch(biquad3Data* data, uint8_t index, float sample_freq, float center_freq, float bandwidth_freq);
+/** Filter one sample of every axis in place. */
+void biquad3Apply(biquad3Data* data, float sample[3]);
+/** Set the state as if sample had been applied forever, so that the output starts without a transient. */
+void biquad3Reset(biquad3Data* data, const float sample[3]);
+
 /** Second order low pass filter structure.
  *
  * using biquad filter with bilinear z transform
@@ -190,4 +230,77 @@ static inline float get_butterworth_2_low_pass(Butterworth2LowPass *filter)
   return filter->o[0];
 }
 
+/** Second order Butterworth low pass filters of the three axes of a vector.
+ *
+ * The same filters as Butterworth2LowPass, each axis with its own time
+ * constant, with the history of the three axes side by side so that they
+ * are updated in one pass.
+ */
+typedef struct {
+  float a[2][3]; ///< denominator gains
+  float b[2][3]; ///< numerator gains
+  float i[2][3]; ///< input history
+  float o[2][3]; ///< output history
+} Butterworth2LowPass3;
+
+/** Set the time constants of a 3-axis Butterworth filter, its history is kept.
+ *
+ * @param filter 3-axis Butterworth low pass filter structure
+ * @param tau time constant of the filter of every axis
+ * @param sample_time sampling period of the signal
+ */
+static inline void set_butterworth_2_low_pass_3_tau(Butterworth2LowPass3 *filter, const float tau[3], float sample_time)
+{
+  for (int j = 0; j < 3; j++) {
+    struct SecondOrderLowPass axis;
+    init_second_order_low_pass(&axis, tau[j], 0.7071, sample_time, 0.0f);
+    filter->a[0][j] = axis.a[0];
+    filter->a[1][j] = axis.a[1];
+    filter->b[0][j] = axis.b[0];
+    filter->b[1][j] = axis.b[1];
+  }
+}
+
+/** Init a 3-axis Butterworth filter.
+ *
+ * @param filter 3-axis Butterworth low pass filter structure
+ * @param tau time constant of the filter of every axis
+ * @param sample_time sampling period of the signal
+ * @param value initial value of the filter
+ */
+static inline void init_butterworth_2_low_pass_3(Butterworth2LowPass3 *filter, const float tau[3], float sample_time,
+    float value)
+{
+  set_butterworth_2_low_pass_3_tau(filter, tau, sample_time);
+  for (int j = 0; j < 3; j++) {
+    filter->i[0][j] = filter->i[1][j] = filter->o[0][j] = filter->o[1][j] = value;
+  }
+}
+
+/** Update a 3-axis Butterworth filter with a new value of every axis.
+ *
+ * @param filter 3-axis Butterworth low pass filter structure
+ * @param value new input value of every axis
+ * @param derivative if not NULL, set to the finite difference of the output of every axis times rate
+ * @param rate sampling rate of the signal, only used for derivative
+ */
+static inline void update_butterworth_2_low_pass_3(Butterworth2LowPass3 *filter, const float value[3],
+    float derivative[3], float rate)
+{
+  for (int j = 0; j < 3; j++) {
+    float out = filter->b[0][j] * value[j]
+                + filter->b[1][j] * filter->i[0][j]
+                + filter->b[0][j] * filter->i[1][j]
+                - filter->a[0][j] * filter->o[0][j]
+                - filter->a[1][j] * filter->o[1][j];
+    if (derivative) {
+      derivative[j] = (out - filter->o[0][j]) * rate;
+    }
+    filter->i[1][j] = filter->i[0][j];
+    filter->i[0][j] = value[j];
+    filter->o[1][j] = filter->o[0][j];
+    filter->o[0][j] = out;
+  }
+}
+
 #endif //FILTER_H_
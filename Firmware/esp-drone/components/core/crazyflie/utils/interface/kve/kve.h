@@ -33,8 +33,35 @@
 #include <stddef.h>
 #include <stdbool.h>
 
+/**
+ * Close the first hole of the table by one step: crop it at the end, join
+ * the hole after it, or move the item after it.
+ *
+ * An item moves into the hole when it fits, else to the end of the table,
+ * and its place becomes a hole once the copy is written. A reset leaves the
+ * item whole, twice at worst, kveCheck() removes the copy. Only when there
+ * is no room for the item at the end does it slide down over the hole,
+ * which a reset interrupts.
+ *
+ * @return false if there is no hole left
+ */
+bool kveDefragStep(kveMemory_t *kve);
+
+/**
+ * Defrag the whole table in one go.
+ */
 void kveDefrag(kveMemory_t *kve);
 
+/**
+ * Store an item. When the item does not fit, the store takes a few
+ * defragmentation steps before it gives up, kveDefragStep() is meant to be
+ * called in the background to keep the table packed ahead of the stores.
+ *
+ * The key is 1 to KVE_KEY_MAX_LENGTH characters long, for the fetch and the
+ * delete as well, other keys are refused.
+ *
+ * @return false if the item did not fit or the key is refused
+ */
 bool kveStore(kveMemory_t *kve, char* key, const void* buffer, size_t length);
 
 size_t kveFetch(kveMemory_t *kve, const char* key, void* buffer, size_t bufferLength);
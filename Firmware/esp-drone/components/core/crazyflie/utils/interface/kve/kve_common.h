@@ -29,10 +29,34 @@
 #pragma once
 
 #include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// The length of a key is a byte of the item headers
+#define KVE_KEY_MAX_LENGTH 255
+
+typedef struct {
+    uint32_t keyHash;
+    uint32_t address;
+} kveIndexEntry_t;
+
+/**
+ * Optional RAM index of the items in the table, built by kveCheck(). With it
+ * a key lookup is a single storage read instead of a scan of the table. If
+ * the table holds more items than the index can, lookups fall back to the
+ * scan.
+ */
+typedef struct {
+    kveIndexEntry_t *entries;
+    size_t length;
+    size_t count;
+    bool isValid;
+} kveIndex_t;
 
 typedef struct {
     size_t memorySize;
     size_t (*read)(size_t address, void* data, size_t length);
     size_t (*write)(size_t address, const void* data, size_t length);
     void (*flush)(void);
+    kveIndex_t *index;      // NULL to always scan the table
 } kveMemory_t;
@@ -0,0 +1,118 @@
+/**
+ * ,---------,       ____  _ __
+ * |  ,-^-,  |      / __ )(_) /_______________ _____  ___
+ * | (  O  ) |     / __  / / __/ ___/ ___/ __ `/_  / / _ \
+ * | / ,--´  |    / /_/ / / /_/ /__/ /  / /_/ / / /_/  __/
+ *    +------`   /_____/_/\__/\___/_/   \__,_/ /___/\___/
+ *
+ * Crazyflie control firmware
+ *
+ * Copyright (C) 2019 - 2020 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * kve_log.h - Key/value items in a log of flash sectors
+ *
+ * Unlike kve.h, which rewrites its table in place, the log only ever
+ * appends to erased flash. Every sector starts with a header holding its
+ * erase count and its sequence, the order in which the sectors were filled.
+ * An item is appended to the open sector with a CRC, a deleted key is
+ * appended as an item without data. The newest item of a key is the one
+ * that counts, the older ones are dead.
+ *
+ * The RAM index points at the newest item of every key, a store costs one
+ * item write and a fetch one read. Compaction copies the items still alive
+ * out of the sector with the most dead bytes and erases it, one item or one
+ * erase per kveLogCompactStep(). The least erased sectors are filled first,
+ * and a sector lagging the others in erase count is compacted even when all
+ * of it is alive, to move the data that never changes.
+ *
+ * An item interrupted by a reset fails its CRC, the rest of its sector is
+ * left unused. A sector interrupted while compacted only holds copies of
+ * items that are newer elsewhere.
+ */
+
+#pragma once
+
+#include "kve/kve_common.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct {
+    uint32_t sequence;      // KVE_LOG_FREE_SEQUENCE while the sector is free
+    uint32_t eraseCount;
+    uint16_t used;          // Bytes written, from the start of the sector
+    uint16_t live;          // Bytes of the items the index points at
+} kveLogSector_t;
+
+typedef struct {
+    size_t memorySize;      // A multiple of sectorSize, at most 65535 sectors
+    size_t sectorSize;      // At most 65535 bytes
+    // Flash writes may only clear bits, erase sets the sector back to 0xff
+    bool (*read)(size_t address, void* data, size_t length);
+    bool (*write)(size_t address, const void* data, size_t length);
+    bool (*erase)(size_t address);
+    kveLogSector_t *sectors; // memorySize / sectorSize of them
+    kveIndex_t *index;
+
+    // State of the log, set up by kveLogMount() or kveLogFormat()
+    int openSector;
+    uint32_t sequence;
+    int compactSector;      // -1 while not compacting
+    size_t compactOffset;
+} kveLog_t;
+
+#define KVE_LOG_FREE_SEQUENCE (0xffffffffu)
+
+/**
+ * Read the sector headers and the items, and build the index.
+ *
+ * @return false if the memory is not formatted or the index is too short
+ */
+bool kveLogMount(kveLog_t *log);
+
+/**
+ * Erase all sectors, keeping the erase counts of the sectors that had one.
+ */
+bool kveLogFormat(kveLog_t *log);
+
+/**
+ * Append an item, the previous item of the key is dead from then on.
+ *
+ * The key is 1 to KVE_KEY_MAX_LENGTH characters long, for the fetch and the
+ * delete as well, other keys are refused.
+ *
+ * @return false if the key is refused, if the key is new and the index is
+ *         full, or if there is no free space left until compaction
+ */
+bool kveLogStore(kveLog_t *log, const char* key, const void* buffer, size_t length);
+
+size_t kveLogFetch(kveLog_t *log, const char* key, void* buffer, size_t bufferLength);
+
+bool kveLogDelete(kveLog_t *log, const char* key);
+
+/**
+ * @return true if only the reserved sector is free, or a compaction is running
+ */
+bool kveLogNeedsCompaction(const kveLog_t *log);
+
+/**
+ * Copy one item out of the sector being compacted, or erase it when there is
+ * none left, starting the compaction of the next sector if none is running.
+ *
+ * @return false if there is nothing to compact
+ */
+bool kveLogCompactStep(kveLog_t *log);
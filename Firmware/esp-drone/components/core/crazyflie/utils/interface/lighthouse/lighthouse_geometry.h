@@ -16,6 +16,50 @@ typedef struct {
   __attribute__((aligned(4))) mat3d lh1Rotor2InvertedRotationMatrixes;
 } baseStationGeometryCache_t;
 
+// Most rays in one solve, one per sensor and base station
+#define LIGHTHOUSE_GEOMETRY_MAX_RAYS 16
+
+/**
+ * Rays of all base stations and sensors for one position solve. The set is
+ * preallocated by the caller, nothing is allocated while solving.
+ */
+typedef struct {
+  __attribute__((aligned(4))) vec3d origin[LIGHTHOUSE_GEOMETRY_MAX_RAYS];
+  __attribute__((aligned(4))) vec3d direction[LIGHTHOUSE_GEOMETRY_MAX_RAYS];
+  int count;
+  uint32_t baseStations; // Bit mask of the base stations with rays in the set
+} lighthouseGeometryRaySet_t;
+
+/**
+ * @brief Empty a ray set.
+ */
+void lighthouseGeometryRaySetClear(lighthouseGeometryRaySet_t* set);
+
+/**
+ * @brief Add the ray of a sweep angle pair of a base station to a set.
+ *
+ * @param set - the ray set
+ * @param baseStationGeometry - geometry of the base station
+ * @param baseStation - index of the base station, below 32
+ * @param angles - horizontal and vertical sweep angle
+ * @return false if the set is full
+ */
+bool lighthouseGeometryRaySetAdd(lighthouseGeometryRaySet_t* set, const baseStationGeometry_t* baseStationGeometry, int baseStation, const float angles[2]);
+
+/**
+ * @brief Find the point closest to all rays of a set, in the least squares sense. The 3x3
+ * normal equations are solved directly, robustIterations rounds of reweighting then reduce the
+ * weight of rays that miss the point by more than robustThreshold (Huber weights).
+ *
+ * @param set - rays of at least two base stations
+ * @param robustIterations - rounds of reweighting, 0 for a plain least squares solve
+ * @param robustThreshold - distance in m up to which a ray has full weight
+ * @param position - (output) the closest point
+ * @param residual - (output) the RMS distance between the rays and the point
+ * @return false if there are too few rays or they are close to parallel
+ */
+bool lighthouseGeometryGetPositionFromRays(const lighthouseGeometryRaySet_t* set, int robustIterations, float robustThreshold, vec3d position, float* residual);
+
 /**
  * @brief Find closest point between rays from two bases stations.
  *
@@ -68,7 +112,7 @@ bool lighthouseGeometryIntersectionPlaneVector(const vec3d linePoint, const vec3
  * @param sensorPosition - the sensor position relative to the center of the Crazyflie
  * @param pos - (output) the position of the sensor
  */
-void lighthouseGeometryGetSensorPosition(const vec3d cfPos, const arm_matrix_instance_f32 *R, vec3d sensorPosition, vec3d pos);
+void lighthouseGeometryGetSensorPosition(const vec3d cfPos, const xtensa_matrix_instance_f32 *R, vec3d sensorPosition, vec3d pos);
 
 /**
  * @brief Calculate the angle between two vectors. The vectors are assumed to be in a plane defined by
@@ -82,3 +126,17 @@ void lighthouseGeometryGetSensorPosition(const vec3d cfPos, const arm_matrix_ins
  * @return true if the angle could be calculated
 */
 bool lighthouseGeometryYawDelta(const vec3d ipv, const vec3d spv, const vec3d n, float* yawDelta);
+
+typedef struct {
+  float roll;
+  float pitch;
+  float yaw;
+} baseStationEulerAngles_t;
+
+/**
+ * @brief Calculate the roll, pitch and yaw of a base station from its rotation matrix
+ *
+ * @param baseStationGeometry - Geometry data for the base station
+ * @param baseStationEulerAngles - (output) the angles, in radians
+ */
+void lighthouseGeometryCalculateAnglesFromRotationMatrix(const baseStationGeometry_t* baseStationGeometry, baseStationEulerAngles_t* baseStationEulerAngles);
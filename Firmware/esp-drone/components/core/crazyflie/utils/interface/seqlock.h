@@ -0,0 +1,88 @@
+/**
+ *
+ * ESP-Drone Firmware
+ *
+ * Copyright 2019-2020  Espressif Systems (Shanghai)
+ * Copyright (C) 2011-2012 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * seqlock.h - Lock-free publication of the latest value, one writer, any readers
+ *
+ * The writer copies each value into the buffer of the two the readers do not
+ * copy from, then publishes it by bumping the sequence number. A reader that
+ * preempts the writer on its core so still gets a complete value and never
+ * waits for the writer, as it would with a single buffer. A reader copies
+ * again only when a value was published during its copy.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include "static_mem.h"
+
+typedef struct {
+  uint8_t *storage;         // Two items
+  uint16_t itemSize;
+  uint32_t seq;             // Values published so far, written by the writer only
+} Seqlock_t;
+
+/**
+ * @brief Define a seqlock using static memory, no init call is needed.
+ * seqlockRead() gives zeros and sequence 0 until the first seqlockWrite().
+ *
+ * Example:
+ * SEQLOCK_ALLOC(sensorsSnapshot, sizeof(sensorsSnapshot_t));
+ *
+ * @param NAME - the name of the Seqlock_t variable
+ * @param ITEM_SIZE - the size of the value
+ */
+#define SEQLOCK_ALLOC(NAME, ITEM_SIZE) \
+  NO_DMA_CCM_SAFE_ZERO_INIT static uint8_t seqlock_ ## NAME ## Storage[2 * (ITEM_SIZE)]; \
+  static Seqlock_t NAME = {.storage = seqlock_ ## NAME ## Storage, .itemSize = (ITEM_SIZE)}
+
+/**
+ * Publish a value (writer side).
+ */
+static inline void seqlockWrite(Seqlock_t *lock, const void *item)
+{
+  const uint32_t seq = lock->seq + 1;
+
+  // The buffer of seq - 1 may be read just now, the copy must not be seen
+  // before the publication of the previous value
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  memcpy(&lock->storage[(seq & 1) * lock->itemSize], item, lock->itemSize);
+  __atomic_store_n(&lock->seq, seq, __ATOMIC_RELEASE);
+}
+
+/**
+ * Copy the latest value (reader side), from any task or core.
+ *
+ * @return The sequence number of the value, the count of seqlockWrite() calls
+ */
+static inline uint32_t seqlockRead(const Seqlock_t *lock, void *item)
+{
+  uint32_t seq;
+
+  do {
+    seq = __atomic_load_n(&lock->seq, __ATOMIC_ACQUIRE);
+    memcpy(item, &lock->storage[(seq & 1) * lock->itemSize], lock->itemSize);
+    // Nothing of the copy may be read after the check
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  } while (__atomic_load_n(&lock->seq, __ATOMIC_RELAXED) != seq);
+
+  return seq;
+}
@@ -0,0 +1,130 @@
+/**
+ *
+ * ESP-Drone Firmware
+ *
+ * Copyright 2019-2020  Espressif Systems (Shanghai)
+ * Copyright (C) 2011-2012 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * spsc_ring.h - Lock-free single producer, single consumer ring buffer
+ *
+ * Items are copied in and out, like a FreeRTOS queue, but without critical
+ * sections or scheduler calls. Exactly one task (or ISR) may push and exactly
+ * one task may pop, they may run on different cores. The consumer has to poll,
+ * there is no blocking.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "static_mem.h"
+
+typedef struct {
+  uint8_t *storage;
+  uint16_t itemSize;
+  uint16_t length;          // Must be a power of 2
+  uint32_t head;            // Written by the producer only
+  uint32_t tail;            // Written by the consumer only
+  uint32_t droppedCount;    // Items pushed while full, written by the producer only
+} SpscRing_t;
+
+/**
+ * @brief Define a ring buffer using static memory, no init call is needed.
+ *
+ * Example:
+ * SPSC_RING_ALLOC(flowRing, 8, sizeof(flowMeasurement_t));
+ * // ...
+ * spscRingPush(&flowRing, &flow);
+ *
+ * @param NAME - the name of the SpscRing_t variable
+ * @param LENGTH - the length of the ring (in items), must be a power of 2
+ * @param ITEM_SIZE - the size of the items in the ring
+ */
+#define SPSC_RING_ALLOC(NAME, LENGTH, ITEM_SIZE) \
+  _Static_assert(((LENGTH) & ((LENGTH) - 1)) == 0, #NAME " length must be a power of 2"); \
+  NO_DMA_CCM_SAFE_ZERO_INIT static uint8_t spsc_ ## NAME ## Storage[(LENGTH) * (ITEM_SIZE)]; \
+  static SpscRing_t NAME = {.storage = spsc_ ## NAME ## Storage, .itemSize = (ITEM_SIZE), .length = (LENGTH)}
+
+static inline uint32_t spscRingCount(const SpscRing_t *ring)
+{
+  return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Push up to count items (producer side). Items that do not fit are dropped
+ * and counted in droppedCount.
+ *
+ * @return The number of items pushed.
+ */
+static inline uint32_t spscRingPushBatch(SpscRing_t *ring, const void *items, uint32_t count)
+{
+  const uint32_t head = ring->head;
+  const uint32_t space = ring->length - (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE));
+  const uint32_t n = (count < space) ? count : space;
+
+  for (uint32_t i = 0; i < n; i++) {
+    memcpy(&ring->storage[((head + i) & (ring->length - 1)) * ring->itemSize],
+           (const uint8_t *)items + i * ring->itemSize, ring->itemSize);
+  }
+
+  // Publish the items only after they are written
+  __atomic_store_n(&ring->head, head + n, __ATOMIC_RELEASE);
+  ring->droppedCount += count - n;
+
+  return n;
+}
+
+static inline bool spscRingPush(SpscRing_t *ring, const void *item)
+{
+  return spscRingPushBatch(ring, item, 1) == 1;
+}
+
+/**
+ * Pop up to count items (consumer side).
+ *
+ * @return The number of items copied to items.
+ */
+static inline uint32_t spscRingPopBatch(SpscRing_t *ring, void *items, uint32_t count)
+{
+  const uint32_t tail = ring->tail;
+  const uint32_t available = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) - tail;
+  const uint32_t n = (count < available) ? count : available;
+
+  for (uint32_t i = 0; i < n; i++) {
+    memcpy((uint8_t *)items + i * ring->itemSize,
+           &ring->storage[((tail + i) & (ring->length - 1)) * ring->itemSize], ring->itemSize);
+  }
+
+  // Hand the slots back only after they are read
+  __atomic_store_n(&ring->tail, tail + n, __ATOMIC_RELEASE);
+
+  return n;
+}
+
+static inline bool spscRingPop(SpscRing_t *ring, void *item)
+{
+  return spscRingPopBatch(ring, item, 1) == 1;
+}
+
+/**
+ * Drop all queued items (consumer side).
+ */
+static inline void spscRingReset(SpscRing_t *ring)
+{
+  __atomic_store_n(&ring->tail, __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+}
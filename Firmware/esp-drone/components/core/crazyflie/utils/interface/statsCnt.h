@@ -32,9 +32,13 @@
 
 /**
  * @brief A struct used to track event rates
+ *
+ * The events may come from any task on either core, count is only increased
+ * atomically. The rate is calculated from it when it is read.
  */
 typedef struct {
     uint32_t count;
+    uint32_t isUpdating;
     uint32_t latestCount;
     uint32_t latestAveragingMs;
     float latestRate;
@@ -51,7 +55,8 @@ void statsCntRateCounterInit(statsCntRateCounter_t* counter, uint32_t averagingI
 
 /**
  * @brief A new rate is calculated if the time since the previous calculation is longer
- * than the configured interval time.
+ * than the configured interval time. If another task is calculating it at the same
+ * time, the latest rate is returned.
  *
  * @param counter The rate counter to update
  * @param now_ms Current system time in ms
@@ -80,14 +85,14 @@ typedef struct {
  */
 #define STATS_CNT_RATE_INIT(LOGGER, INTERVAL_MS) statsCntRateLoggerInit(LOGGER, INTERVAL_MS)
 
-#define STATS_CNT_RATE_DEFINE(NAME, INTERVAL_MS) statsCntRateLogger_t NAME = {.logByFunction = {.data = &NAME, .aquireFloat = statsCntRateLogHandler}, .rateCounter = {.intervalMs = (INTERVAL_MS), .count = 0, .latestCount = 0, .latestAveragingMs = 0, .latestRate = 0}}
+#define STATS_CNT_RATE_DEFINE(NAME, INTERVAL_MS) statsCntRateLogger_t NAME = {.logByFunction = {.data = &NAME, .aquireFloat = statsCntRateLogHandler}, .rateCounter = {.intervalMs = (INTERVAL_MS), .count = 0, .isUpdating = 0, .latestCount = 0, .latestAveragingMs = 0, .latestRate = 0}}
 
 /**
  * @brief Macro to add an event to a statsCntRateLogger_t, that is to increase the internal counter
  *
  * @param LOGGER A pointer to a statsCntRateLogger_t
  */
-#define STATS_CNT_RATE_EVENT(LOGGER) ((LOGGER)->rateCounter.count++)
+#define STATS_CNT_RATE_EVENT(LOGGER) STATS_CNT_RATE_MULTI_EVENT(LOGGER, 1)
 
 /**
  * @brief Macro to add CNT events to a statsCntRateLogger_t, that is to increase the internal counter with CNT
@@ -95,7 +100,7 @@ typedef struct {
  * @param LOGGER A pointer to a statsCntRateLogger_t
  * @param CNT    Number of counts to add
  */
-#define STATS_CNT_RATE_MULTI_EVENT(LOGGER, CNT) ((LOGGER)->rateCounter.count += CNT)
+#define STATS_CNT_RATE_MULTI_EVENT(LOGGER, CNT) ((void)__atomic_fetch_add(&(LOGGER)->rateCounter.count, (CNT), __ATOMIC_RELAXED))
 
 /**
  * @brief Macro to add a statsCntRateLogger_t as a rate log. Used in a similar way as
@@ -0,0 +1,82 @@
+/**
+ *
+ * ESP-Drone Firmware
+ *
+ * Copyright 2019-2020  Espressif Systems (Shanghai)
+ * Copyright (C) 2011-2012 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * streamStats.h - Running median and mean of a sliding window of samples
+ *
+ * The window keeps the samples twice, in the order they came and sorted. A
+ * new sample takes the place of the oldest one in the sorted copy, found by
+ * a binary search, and only the samples between the two places move. The
+ * sum is kept along, so the mean and the median cost no pass over the
+ * window. The samples are integers, the sum never drifts.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+typedef struct {
+  int32_t *window;   // The samples in the order they came, a ring
+  int32_t *sorted;   // The same samples in increasing order
+  uint16_t size;
+  uint16_t count;
+  uint16_t next;     // Where the next sample goes in window
+  int64_t sum;
+} streamStats_t;
+
+/**
+ * Define a window of SIZE samples in static memory
+ */
+#define STREAM_STATS_DEFINE(NAME, SIZE) \
+  static int32_t NAME##Window[SIZE]; \
+  static int32_t NAME##Sorted[SIZE]; \
+  static streamStats_t NAME = {.window = NAME##Window, .sorted = NAME##Sorted, .size = (SIZE)}
+
+/**
+ * Initialize an empty window on the given storage
+ *
+ * @param stats The window
+ * @param window, sorted Room for size samples each
+ * @param size The number of samples in a full window
+ */
+void streamStatsInit(streamStats_t *stats, int32_t *window, int32_t *sorted, uint16_t size);
+
+/**
+ * Empty the window
+ */
+void streamStatsReset(streamStats_t *stats);
+
+/**
+ * Add a sample, once the window is full it replaces the oldest one
+ */
+void streamStatsAdd(streamStats_t *stats, int32_t value);
+
+/**
+ * The median of the samples in the window, the upper one of an even count,
+ * 0 for an empty window
+ */
+int32_t streamStatsMedian(const streamStats_t *stats);
+
+/**
+ * The mean of the samples in the window, rounded towards zero, 0 for an
+ * empty window
+ */
+int32_t streamStatsMean(const streamStats_t *stats);
+
+float streamStatsMeanf(const streamStats_t *stats);
@@ -4,7 +4,13 @@
 #include "tdoaStorage.h"
 #include "tdoaStats.h"
 
-typedef void (*tdoaEngineSendTdoaToEstimator)(tdoaMeasurement_t* tdoaMeasurement);
+typedef enum {
+  TdoaEngineMatchingAlgorithmNone = 0,
+  TdoaEngineMatchingAlgorithmRandom = 1,
+  TdoaEngineMatchingAlgorithmYoungest = 2,
+} tdoaEngineMatchingAlgorithm_t;
+
+typedef void (*tdoaEngineSendTdoaToEstimator)(tdoaMeasurement_t* tdoaMeasurement, const uint8_t idA, const uint8_t idB);
 
 typedef struct {
   // State
@@ -13,10 +19,19 @@ typedef struct {
 
   // Configuration
   tdoaEngineSendTdoaToEstimator sendTdoaToEstimator;
-  double locodeckTsFreq;
+  // Meters per tick of the locodeck timestamps, the distances are computed in single precision
+  float distancePerTick;
+  tdoaEngineMatchingAlgorithm_t matchingAlgorithm;
+
+  // Matching
+  struct {
+    uint8_t seqNr[REMOTE_ANCHOR_DATA_COUNT];
+    uint8_t id[REMOTE_ANCHOR_DATA_COUNT];
+    uint8_t offset;
+  } matching;
 } tdoaEngineState_t;
 
-void tdoaEngineInit(tdoaEngineState_t* state, const uint32_t now_ms, tdoaEngineSendTdoaToEstimator sendTdoaToEstimator, const double locodeckTsFreq);
+void tdoaEngineInit(tdoaEngineState_t* state, const uint32_t now_ms, tdoaEngineSendTdoaToEstimator sendTdoaToEstimator, const double locodeckTsFreq, const tdoaEngineMatchingAlgorithm_t matchingAlgorithm);
 
 void tdoaEngineGetAnchorCtxForPacketProcessing(tdoaEngineState_t* engineState, const uint8_t anchorId, const uint32_t currentTime_ms, tdoaAnchorContext_t* anchorCtx);
 void tdoaEngineProcessPacket(tdoaEngineState_t* engineState, tdoaAnchorContext_t* anchorCtx, const int64_t txAn_in_cl_An, const int64_t rxAn_by_T_in_cl_T);
@@ -67,7 +67,8 @@ clockCorrectionStorage_t* tdoaStorageGetClockCorrectionStorage(const tdoaAnchorC
 bool tdoaStorageGetAnchorPosition(const tdoaAnchorContext_t* anchorCtx, point_t* position);
 void tdoaStorageSetAnchorPosition(tdoaAnchorContext_t* anchorCtx, const float x, const float y, const float z);
 void tdoaStorageSetRxTxData(tdoaAnchorContext_t* anchorCtx, int64_t rxTime, int64_t txTime, uint8_t seqNr);
-double tdoaStorageGetClockCorrection(const tdoaAnchorContext_t* anchorCtx);
+float tdoaStorageGetClockCorrection(const tdoaAnchorContext_t* anchorCtx);
+float tdoaStorageGetClockCorrectionDeviation(const tdoaAnchorContext_t* anchorCtx);
 int64_t tdoaStorageGetRemoteRxTime(const tdoaAnchorContext_t* anchorCtx, const uint8_t remoteAnchor);
 void tdoaStorageSetRemoteRxTime(tdoaAnchorContext_t* anchorCtx, const uint8_t remoteAnchor, const int64_t remoteRxTime, const uint8_t remoteSeqNr);
 void tdoaStorageGetRemoteSeqNrList(const tdoaAnchorContext_t* anchorCtx, int* remoteCount, uint8_t seqNr[], uint8_t id[]);
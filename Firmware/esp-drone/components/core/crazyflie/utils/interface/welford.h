@@ -0,0 +1,64 @@
+/**
+ *
+ * ESP-Drone Firmware
+ *
+ * Copyright 2019-2020  Espressif Systems (Shanghai)
+ * Copyright (C) 2011-2012 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * welford.h - Streaming mean and variance of samples, Welford's method
+ *
+ * Each sample updates the mean and the sum of the squared deviations from
+ * it, so no samples are kept and the mean and the variance are ready after
+ * any sample. Unlike the sum of the squares less the squared sum, the
+ * result does not cancel out in float when the mean is large against the
+ * spread, as for a gyro bias.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+typedef struct {
+  uint32_t count;
+  float mean;
+  float m2;          // Sum of the squared deviations from the mean
+} welford_t;
+
+/**
+ * Forget all the samples
+ */
+void welfordReset(welford_t *stats);
+
+/**
+ * Add a sample
+ */
+void welfordAdd(welford_t *stats, float value);
+
+/**
+ * The mean of the samples, 0 without samples
+ */
+float welfordMean(const welford_t *stats);
+
+/**
+ * The sum of the squared deviations of the samples from their mean, that is
+ * the variance times the count. It never decreases while samples are added.
+ */
+float welfordSumOfSquares(const welford_t *stats);
+
+/**
+ * The variance of the samples, 0 without samples
+ */
+float welfordVariance(const welford_t *stats);
@@ -0,0 +1,166 @@
+/**
+ *
+ * ESP-Drone Firmware
+ *
+ * Copyright 2019-2020  Espressif Systems (Shanghai)
+ * Copyright (C) 2011-2012 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * busStats.c - Utilization and contention of the I2C and SPI buses
+ */
+#define DEBUG_MODULE "BUS"
+
+#include <inttypes.h>
+
+#include "FreeRTOS.h"
+#include "esp_timer.h"
+
+#include "busStats.h"
+#include "log.h"
+#include "debug_cf.h"
+
+#ifdef CONFIG_BUS_STATS
+
+#define BUS_STATS_INTERVAL_MS 1000
+
+static const uint32_t waitBinLimitsUs[BUS_STATS_WAIT_BINS - 1] = {10, 100, 1000, 10000};
+
+static busStats_t *buses;
+
+void busStatsRegister(busStats_t *stats, const char *name)
+{
+  stats->name = name;
+  stats->holder = BUS_STATS_NO_DEVICE;
+  stats->blocker = BUS_STATS_NO_DEVICE;
+  statsCntRateCounterInit(&stats->busyRate, BUS_STATS_INTERVAL_MS);
+  statsCntRateCounterInit(&stats->transferRate, BUS_STATS_INTERVAL_MS);
+
+  // The drivers register from their init, on the system task
+  stats->next = buses;
+  buses = stats;
+}
+
+uint32_t busStatsNowUs(void)
+{
+  return (uint32_t)esp_timer_get_time();
+}
+
+void busStatsLockTimeout(busStats_t *stats)
+{
+  __atomic_fetch_add(&stats->lockTimeoutCount, 1, __ATOMIC_RELAXED);
+  stats->blocker = stats->holder;
+}
+
+void busStatsAcquire(busStats_t *stats, uint8_t device, uint32_t waitStartUs)
+{
+  const uint32_t nowUs = busStatsNowUs();
+  const uint32_t waitUs = nowUs - waitStartUs;
+  int bin = 0;
+
+  while (bin < BUS_STATS_WAIT_BINS - 1 && waitUs >= waitBinLimitsUs[bin]) {
+    bin++;
+  }
+  stats->waitBins[bin]++;
+  if (waitUs > stats->maxWaitUs) {
+    stats->maxWaitUs = waitUs;
+  }
+
+  stats->holder = device;
+  stats->holdStartUs = nowUs;
+}
+
+static busStatsDevice_t *findDevice(busStats_t *stats, uint8_t address)
+{
+  for (int i = 0; i < stats->deviceCount; i++) {
+    if (stats->devices[i].address == address) {
+      return &stats->devices[i];
+    }
+  }
+
+  if (stats->deviceCount == BUS_STATS_DEVICES) {
+    return NULL;
+  }
+
+  busStatsDevice_t *device = &stats->devices[stats->deviceCount++];
+  device->address = address;
+  return device;
+}
+
+void busStatsRelease(busStats_t *stats, esp_err_t err)
+{
+  const uint32_t holdUs = busStatsNowUs() - stats->holdStartUs;
+  busStatsDevice_t *device = findDevice(stats, stats->holder);
+
+  const bool isFailed = (err != ESP_OK);
+
+  // The log task reads the rates from the counts
+  __atomic_fetch_add(&stats->busyRate.count, holdUs, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&stats->transferRate.count, 1, __ATOMIC_RELAXED);
+  if (holdUs > stats->maxHoldUs) {
+    stats->maxHoldUs = holdUs;
+  }
+
+  if (err == ESP_FAIL) {
+    stats->nackCount++;
+  } else if (err == ESP_ERR_TIMEOUT) {
+    stats->timeoutCount++;
+  } else if (isFailed) {
+    stats->errorCount++;
+  }
+
+  // Past BUS_STATS_DEVICES the bus counts them, their devices are not listed
+  if (device != NULL) {
+    device->count++;
+    device->busyUs += holdUs;
+    if (holdUs > device->maxUs) {
+      device->maxUs = holdUs;
+    }
+    if (isFailed) {
+      device->failCount++;
+    }
+  }
+}
+
+void busStatsDump(void)
+{
+  for (const busStats_t *stats = buses; stats != NULL; stats = stats->next) {
+    DEBUG_PRINTI("%s: %" PRIu32 " transfers, %" PRIu32 " NACK, %" PRIu32 " timeouts, %" PRIu32 " errors, %" PRIu32 " lock timeouts",
+                 stats->name, stats->transferRate.count, stats->nackCount, stats->timeoutCount, stats->errorCount,
+                 stats->lockTimeoutCount);
+    for (int i = 0; i < stats->deviceCount; i++) {
+      const busStatsDevice_t *device = &stats->devices[i];
+      const uint32_t meanUs = device->count > 0 ? device->busyUs / device->count : 0;
+
+      DEBUG_PRINTI("  0x%02x: %" PRIu32 " transfers, %" PRIu32 " failed, mean %" PRIu32 " us, max %" PRIu32 " us",
+                   device->address, device->count, device->failCount, meanUs, device->maxUs);
+    }
+  }
+}
+
+// The part of the time the bus was held, in %
+float busStatsLogBusy(uint32_t timestamp, void *data)
+{
+  busStats_t *stats = data;
+  return statsCntRateCounterUpdate(&stats->busyRate, timestamp) / 10000.0f;
+}
+
+// Transfers per s
+float busStatsLogRate(uint32_t timestamp, void *data)
+{
+  busStats_t *stats = data;
+  return statsCntRateCounterUpdate(&stats->transferRate, timestamp);
+}
+
+#endif // CONFIG_BUS_STATS
@@ -1,12 +1,15 @@
 #include "clockCorrectionEngine.h"
 
-#define MAX_CLOCK_DEVIATION_SPEC 10e-6
-#define CLOCK_CORRECTION_SPEC_MIN (1.0 - MAX_CLOCK_DEVIATION_SPEC * 2)
-#define CLOCK_CORRECTION_SPEC_MAX (1.0 + MAX_CLOCK_DEVIATION_SPEC * 2)
+// The limits are deviations from 1
+#define MAX_CLOCK_DEVIATION_SPEC 10e-6f
+#define CLOCK_CORRECTION_SPEC_MIN (-MAX_CLOCK_DEVIATION_SPEC * 2)
+#define CLOCK_CORRECTION_SPEC_MAX (MAX_CLOCK_DEVIATION_SPEC * 2)
 
-#define CLOCK_CORRECTION_ACCEPTED_NOISE 0.03e-6
-#define CLOCK_CORRECTION_FILTER 0.1
+#define CLOCK_CORRECTION_ACCEPTED_NOISE 0.03e-6f
+#define CLOCK_CORRECTION_FILTER 0.1f
 #define CLOCK_CORRECTION_BUCKET_MAX 4
+// A clock correction of 0
+#define CLOCK_CORRECTION_INVALID (-1.0f)
 
 /**
  Logging all the clock correction information requires scaling the values repeatedly, which is computer intense. Thus, the logging functionality is enabled at compile time with the CLOCK_CORRECTION_ENABLE_LOGGING flag.
@@ -21,16 +24,28 @@ static float logMaxSpecLimit = 0;
 static float logClockCorrection = 0;
 static float logClockCorrectionCandidate = 0;
 
-static float scaleValueForLogging(double value) {
-  return (float)((value - 1) * (1 / MAX_CLOCK_DEVIATION_SPEC) * 1000);
+static float scaleValueForLogging(float deviation) {
+  return deviation * (1 / MAX_CLOCK_DEVIATION_SPEC) * 1000;
 }
 #endif
 
 /**
  Obtains the clock correction from a clockCorrectionStorage_t object. This is the recommended public API to obtain the clock correction, instead of getting it directly from the storage object.
+ @return The clock correction, rounded to single precision, or 0 if there is none yet. Use clockCorrectionEngineGetDeviation() to correct timestamps.
  */
-double clockCorrectionEngineGet(const clockCorrectionStorage_t* storage) {
-  return storage->clockCorrection;
+float clockCorrectionEngineGet(const clockCorrectionStorage_t* storage) {
+  if (!storage->hasClockCorrection) {
+    return 0.0f;
+  }
+
+  return 1.0f + storage->clockCorrectionDeviation;
+}
+
+/**
+ Obtains the deviation of the clock correction from 1, 0 if there is none yet. A timestamp t measured by clock x is t + t * deviation in the clock of reference, with the large part t in integer ticks.
+ */
+float clockCorrectionEngineGetDeviation(const clockCorrectionStorage_t* storage) {
+  return storage->clockCorrectionDeviation;
 }
 
 /**
@@ -69,28 +84,30 @@ static bool emptyClockCorrectionBucket(clockCorrectionStorage_t* storage) {
  @param new_t_in_cl_x The newest time of occurrence for an event (t), measured by clock x
  @param old_t_in_cl_x The previous time of occurrence for an event (t), measured by clock x
  @param mask A mask as long as the number of bits used to represent the timestamps. Used to calculate a valid timestamp, even if wrapped arounds of the time counter happened at some point
- @return The necessary clock correction to apply to timestamps measured by clock x, in order to obtain their value like if the measurement was done by the reference clock. Or -1 if it was not possible to perform the computation. Example: timestamp_in_cl_reference = clockCorrection * timestamp_in_cl_x
+ @return The deviation from 1 of the necessary clock correction to apply to timestamps measured by clock x, in order to obtain their value like if the measurement was done by the reference clock. Or -1 (a clock correction of 0) if it was not possible to perform the computation. Example: timestamp_in_cl_reference = timestamp_in_cl_x + deviation * timestamp_in_cl_x
  */
-double clockCorrectionEngineCalculate(const uint64_t new_t_in_cl_reference, const uint64_t old_t_in_cl_reference, const uint64_t new_t_in_cl_x, const uint64_t old_t_in_cl_x, const uint64_t mask) {
+float clockCorrectionEngineCalculate(const uint64_t new_t_in_cl_reference, const uint64_t old_t_in_cl_reference, const uint64_t new_t_in_cl_x, const uint64_t old_t_in_cl_x, const uint64_t mask) {
   const uint64_t tickCount_in_cl_reference = truncateTimeStamp(new_t_in_cl_reference - old_t_in_cl_reference, mask);
   const uint64_t tickCount_in_cl_x = truncateTimeStamp(new_t_in_cl_x - old_t_in_cl_x, mask);
 
   if (tickCount_in_cl_x == 0) {
-    return -1;
+    return CLOCK_CORRECTION_INVALID;
   }
 
-  return (double)tickCount_in_cl_reference / (double)tickCount_in_cl_x;
+  // The difference of the tick counts is exact, only the ratio is rounded
+  const int64_t tickError = (int64_t)(tickCount_in_cl_reference - tickCount_in_cl_x);
+  return (float)tickError / (float)tickCount_in_cl_x;
 }
 
 /**
  Updates the clock correction only if the provided value follows certain conditions. This is used to discard wrong clock correction measurements.
  @return True if the provided clock correction sample ir reliable, false otherwise. A sample is reliable when it is in the accepted noise level (which means that we already have two or more samples that are similar) and has been LP filtered.
  */
-bool clockCorrectionEngineUpdate(clockCorrectionStorage_t* storage, const double clockCorrectionCandidate) {
+bool clockCorrectionEngineUpdate(clockCorrectionStorage_t* storage, const float clockCorrectionCandidate) {
   bool sampleIsReliable = false;
 
-  const double currentClockCorrection = storage->clockCorrection;
-  const double difference = clockCorrectionCandidate - currentClockCorrection;
+  const float currentClockCorrection = storage->clockCorrectionDeviation;
+  const float difference = clockCorrectionCandidate - currentClockCorrection;
 
 #ifdef CLOCK_CORRECTION_ENABLE_LOGGING
   logMinAcceptedNoiseLimit = scaleValueForLogging(currentClockCorrection - CLOCK_CORRECTION_ACCEPTED_NOISE);
@@ -101,19 +118,20 @@ bool clockCorrectionEngineUpdate(clockCorrectionStorage_t* storage, const double
   logClockCorrectionCandidate = scaleValueForLogging(clockCorrectionCandidate);
 #endif
 
-  if (-CLOCK_CORRECTION_ACCEPTED_NOISE < difference && difference < CLOCK_CORRECTION_ACCEPTED_NOISE) {
+  if (storage->hasClockCorrection && -CLOCK_CORRECTION_ACCEPTED_NOISE < difference && difference < CLOCK_CORRECTION_ACCEPTED_NOISE) {
     // Simple low pass filter
-    const double newClockCorrection = currentClockCorrection * CLOCK_CORRECTION_FILTER + clockCorrectionCandidate * (1.0 - CLOCK_CORRECTION_FILTER);
+    const float newClockCorrection = currentClockCorrection * CLOCK_CORRECTION_FILTER + clockCorrectionCandidate * (1.0f - CLOCK_CORRECTION_FILTER);
 
     sampleIsReliable = true;
     fillClockCorrectionBucket(storage);
-    storage->clockCorrection = newClockCorrection;
+    storage->clockCorrectionDeviation = newClockCorrection;
   } else {
     const bool shouldAcceptANewClockReference = emptyClockCorrectionBucket(storage);
     if (shouldAcceptANewClockReference) {
       if (CLOCK_CORRECTION_SPEC_MIN < clockCorrectionCandidate && clockCorrectionCandidate < CLOCK_CORRECTION_SPEC_MAX) {
         // We do not fill the bucket and accept the clock correction sample as reliable: a sample is reliable when it is in the accepted noise level (which means that we already have two or more samples that are similar) and has been LP filtered. See: https://github.com/bitcraze/crazyflie-firmware/pull/328
-        storage->clockCorrection = clockCorrectionCandidate;
+        storage->clockCorrectionDeviation = clockCorrectionCandidate;
+        storage->hasClockCorrection = true;
       }
     }
   }
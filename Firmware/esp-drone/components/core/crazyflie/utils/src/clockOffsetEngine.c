@@ -0,0 +1,110 @@
+/**
+ *
+ * ESP-Drone Firmware
+ *
+ * Copyright 2019-2020  Espressif Systems (Shanghai)
+ * Copyright (C) 2011-2012 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * clockOffsetEngine.c - Offset of the clock of a remote host to the local
+ * clock, from the timestamps of the packets it sends
+ */
+
+#include <string.h>
+
+#include "clockOffsetEngine.h"
+
+// A window of 1 s: 100 ppm of drift between the clocks is 0.2 ms over two windows
+#define CLOCK_OFFSET_WINDOW_US 1000000
+// Samples this much earlier or later than the offset are rejected
+#define CLOCK_OFFSET_ACCEPTED_EARLY_US 100000
+#define CLOCK_OFFSET_ACCEPTED_LATE_US 500000
+#define CLOCK_OFFSET_BUCKET_MAX 4
+
+void clockOffsetEngineReset(clockOffsetStorage_t* storage) {
+  memset(storage, 0, sizeof(*storage));
+}
+
+int64_t clockOffsetEngineGet(const clockOffsetStorage_t* storage) {
+  return storage->offset;
+}
+
+uint64_t clockOffsetEngineLocalTime(const clockOffsetStorage_t* storage) {
+  return storage->remoteUs + storage->offset;
+}
+
+/**
+ Extends a remote timestamp truncated to the mask to 64 bits. The remote clock is assumed to have advanced like the local clock since the last sample, so any gap between the samples is fine as long as the drift over it is less than half the range of the mask.
+ */
+static uint64_t unwrapTimeStamp(const clockOffsetStorage_t* storage, const uint64_t remoteUs, const uint64_t localUs, const uint64_t mask) {
+  const uint64_t expected = storage->remoteUs + (localUs - storage->localUs);
+  int64_t difference = (remoteUs - expected) & mask;
+  if (difference > (int64_t)(mask >> 1)) {
+    difference -= (int64_t)mask + 1;
+  }
+
+  return expected + difference;
+}
+
+static void takeNewReference(clockOffsetStorage_t* storage, const uint64_t remoteUs, const uint64_t localUs) {
+  const int64_t candidate = (int64_t)(localUs - remoteUs);
+
+  storage->offset = candidate;
+  storage->windowMin[0] = candidate;
+  storage->windowMin[1] = candidate;
+  storage->windowStartUs = localUs;
+  storage->remoteUs = remoteUs;
+  storage->localUs = localUs;
+  storage->bucket = 0;
+  storage->isValid = true;
+}
+
+bool clockOffsetEngineUpdate(clockOffsetStorage_t* storage, const uint64_t remoteUs, const uint64_t localUs, const uint64_t mask) {
+  if (!storage->isValid) {
+    takeNewReference(storage, remoteUs & mask, localUs);
+    return false;
+  }
+
+  const uint64_t remote = unwrapTimeStamp(storage, remoteUs, localUs, mask);
+  const int64_t candidate = (int64_t)(localUs - remote);
+  const int64_t difference = candidate - storage->offset;
+
+  if (-CLOCK_OFFSET_ACCEPTED_EARLY_US < difference && difference < CLOCK_OFFSET_ACCEPTED_LATE_US) {
+    if ((int64_t)(localUs - storage->windowStartUs) >= CLOCK_OFFSET_WINDOW_US) {
+      storage->windowMin[1] = storage->windowMin[0];
+      storage->windowMin[0] = candidate;
+      storage->windowStartUs = localUs;
+    } else if (candidate < storage->windowMin[0]) {
+      storage->windowMin[0] = candidate;
+    }
+    storage->offset = storage->windowMin[0] < storage->windowMin[1] ? storage->windowMin[0] : storage->windowMin[1];
+
+    if (storage->bucket < CLOCK_OFFSET_BUCKET_MAX) {
+      storage->bucket++;
+    }
+    storage->remoteUs = remote;
+    storage->localUs = localUs;
+    return true;
+  }
+
+  // Leaky bucket, as in clockCorrectionEngine.c
+  if (storage->bucket > 0) {
+    storage->bucket--;
+  } else {
+    takeNewReference(storage, remote, localUs);
+  }
+
+  return false;
+}
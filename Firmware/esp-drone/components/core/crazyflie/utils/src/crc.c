@@ -20,6 +20,10 @@
 
 #include "crc.h"
 
+#ifdef ESP_PLATFORM
+#include "esp_rom_crc.h"
+#endif
+
 /*
  * Derive parameters from the standard-specific parameters in crc.h.
  */
@@ -225,3 +229,88 @@ crc crcFast(void * datas, int nBytes)
 
 } /* crcFast() */
 #endif
+
+#ifndef ESP_PLATFORM
+#define CRC32_REFLECTED_POLYNOMIAL  0xEDB88320
+
+static uint32_t crc32Table[4][256];
+static int isCrc32TableInit = FALSE;
+
+static void crc32TableInit(void)
+{
+  int i;
+
+  for (i = 0; i < 256; i++)
+  {
+    uint32_t remainder = i;
+    unsigned char bit;
+
+    for (bit = 8; bit > 0; --bit)
+    {
+      remainder = (remainder & 1) ? (remainder >> 1) ^ CRC32_REFLECTED_POLYNOMIAL : (remainder >> 1);
+    }
+    crc32Table[0][i] = remainder;
+  }
+
+  /*
+   * Table n is the remainder of a byte followed by n zero bytes.
+   */
+  for (i = 0; i < 256; i++)
+  {
+    crc32Table[1][i] = (crc32Table[0][i] >> 8) ^ crc32Table[0][crc32Table[0][i] & 0xFF];
+    crc32Table[2][i] = (crc32Table[1][i] >> 8) ^ crc32Table[0][crc32Table[1][i] & 0xFF];
+    crc32Table[3][i] = (crc32Table[2][i] >> 8) ^ crc32Table[0][crc32Table[2][i] & 0xFF];
+  }
+
+  isCrc32TableInit = TRUE;
+}
+#endif
+
+/*********************************************************************
+ *
+ * Function:    crc32Update()
+ *
+ * Description: Compute the CRC-32 of a given message, or continue
+ *				the one of the message before it.
+ *
+ * Notes:		The ROM routine of the ESP32 inverts the remainder
+ *				on the way in and out, as this one does.
+ *
+ * Returns:		The CRC of the message.
+ *
+ *********************************************************************/
+uint32_t crc32Update(uint32_t previous, const void *data, size_t nBytes)
+{
+#ifdef ESP_PLATFORM
+  return esp_rom_crc32_le(previous, data, nBytes);
+#else
+  const unsigned char *message = data;
+  uint32_t remainder = ~previous;
+
+  if (!isCrc32TableInit)
+  {
+    crc32TableInit();
+  }
+
+  /*
+   * Four bytes at a time, the first byte is the lowest one of the CRC.
+   */
+  while (nBytes >= 4)
+  {
+    const uint32_t word = remainder ^ ((uint32_t)message[0] | ((uint32_t)message[1] << 8) |
+                        ((uint32_t)message[2] << 16) | ((uint32_t)message[3] << 24));
+    remainder = crc32Table[3][word & 0xFF] ^ crc32Table[2][(word >> 8) & 0xFF] ^
+                crc32Table[1][(word >> 16) & 0xFF] ^ crc32Table[0][word >> 24];
+    message += 4;
+    nBytes -= 4;
+  }
+
+  while (nBytes > 0)
+  {
+    remainder = crc32Table[0][(remainder ^ *message++) & 0xFF] ^ (remainder >> 8);
+    nBytes--;
+  }
+
+  return ~remainder;
+#endif
+} /* crc32Update() */
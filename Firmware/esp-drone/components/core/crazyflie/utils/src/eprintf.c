@@ -14,9 +14,14 @@
  * This implementation trades CPU cycle for data memory eficiency
  * (No malloc, no unecessary buffers, etc...)
  *
- * Functionality: Implements %s, %d, %x, %X and %f without print size settings.
- * The float handling is verry limited and without exponential notation (ie.
- * works good for number around 0 and within int32 value range).
+ * Functionality: Implements %s, %c, %d, %i, %u, %x, %X, %% and %f, with the l
+ * and ll sizes and a width padded with spaces or zeros. The float handling is
+ * verry limited and without exponential notation (ie. works good for number
+ * around 0 and within int64 value range).
+ *
+ * The integers are made in a fixed buffer with 32 bits divisions, only %ll
+ * takes the 64 bits path. Only %f takes the float path, kept out of
+ * evprintf() so that printing integers costs just the stack of the integers.
  *
  * To use this printf a 'putc' function shall be implemented with the prototype
  * 'int putc(int)'. Then a macro calling eprintf can be created. For example:
@@ -33,88 +38,84 @@
 static const char digit[] = {'0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 
                              'A', 'B', 'C', 'D', 'E', 'F'};
 
-static int getIntLen (long int value)
-{
-  int l = 1;
-  while(value > 9)
-  {
-    l++;
-    value /= 10;
-  }
-  return l;
-}
+// Digits of the largest uint64_t
+#define MAX_DIGITS 20
 
-int power(int a, int b)
+// Print the digits of a number, digits[0] being the last one
+static int putDigits(putc_t putcf, const char *digits, int count, bool isNegative, int width, char padChar)
 {
-  int i;
-  int x = a;
+  int len = 0;
+  int fill = width - count - (isNegative ? 1 : 0);
 
-  for (i = 1; i < b; i++)
+  if (isNegative && padChar == '0')
   {
-    x *= a;
+    putcf('-');
+    len++;
   }
 
-  return x;
-}
-
-static int itoa10Unsigned(putc_t putcf, unsigned long long int num)
-{
-  int len = 0;
-
-  if (num == 0)
+  while (fill > 0)
   {
-    putcf('0');
-    return 1;
+    putcf(padChar);
+    len++;
+    fill--;
   }
 
-  unsigned long long int i = 1;
-
-  while ((num / i) > 9)
+  if (isNegative && padChar != '0')
   {
-    i *= 10L;
+    putcf('-');
+    len++;
   }
 
-  do
+  while (count > 0)
   {
-    putcf(digit[(num / i) % 10L]);
+    putcf(digits[--count]);
     len++;
   }
-  while (i /= 10L);
 
   return len;
 }
 
-static int itoa10(putc_t putcf, long long int num, int precision)
+static int itoa10Unsigned(putc_t putcf, uint32_t num, bool isNegative, int width, char padChar)
 {
-  int len = 0;
+  char digits[MAX_DIGITS / 2];
+  int count = 0;
 
-  if (num == 0)
+  do
   {
-    putcf('0');
-    return 1;
+    digits[count++] = digit[num % 10];
+    num /= 10;
   }
+  while (num);
+
+  return putDigits(putcf, digits, count, isNegative, width, padChar);
+}
 
-  long long unsigned int n = num;
-  if (num < 0)
+static int __attribute__((noinline)) itoa10Unsigned64(putc_t putcf, uint64_t num, bool isNegative, int width, char padChar)
+{
+  if (num <= UINT32_MAX)
   {
-    n = -num;
-    putcf('-');
-    len++;
+    return itoa10Unsigned(putcf, (uint32_t)num, isNegative, width, padChar);
   }
 
-  int numLenght = getIntLen(num);
-  if (numLenght < precision)
+  char digits[MAX_DIGITS];
+  int count = 0;
+
+  do
   {
-    int fillWithZero = precision - numLenght;
-    while (fillWithZero > 0)
-    {
-      putcf('0');
-      len++;
-      fillWithZero--;
-    }
+    digits[count++] = digit[num % 10];
+    num /= 10;
   }
+  while (num);
+
+  return putDigits(putcf, digits, count, isNegative, width, padChar);
+}
+
+static int itoa10(putc_t putcf, int32_t num, int width, char padChar)
+{
+  const bool isNegative = num < 0;
+  const uint32_t n = isNegative ? 0u - (uint32_t)num : (uint32_t)num;
 
-  return itoa10Unsigned(putcf, n) + len;
+  return itoa10Unsigned(putcf, n, isNegative, width, padChar);
 }
 
 static int itoa16(putc_t putcf, uint64_t num, int width, char padChar)
@@ -128,7 +129,7 @@ static int itoa16(putc_t putcf, uint64_t num, int width, char padChar)
     uint64_t mask = (uint64_t)0x0F << shift;
     uint64_t val = (num & mask) >> shift;
 
-    if (val > 0)
+    if (val > 0 || i == 0)
     {
       foundFirst = true;
     }
@@ -151,6 +152,65 @@ static int itoa16(putc_t putcf, uint64_t num, int width, char padChar)
   return len;
 }
 
+static int putString(putc_t putcf, const char *str)
+{
+  int len = 0;
+
+  while (*str)
+  {
+    putcf(*str++);
+    len++;
+  }
+
+  return len;
+}
+
+static int __attribute__((noinline)) ftoa(putc_t putcf, float num, int precision, int width, char padChar)
+{
+  int len = 0;
+
+  if (num != num)
+  {
+    return putString(putcf, "nan");
+  }
+
+  const bool isNegative = num < 0;
+  if (isNegative)
+  {
+    num = -num;
+  }
+
+  if (num >= 18446744073709551616.0f)
+  {
+    return putString(putcf, isNegative ? "-inf" : "inf");
+  }
+
+  uint32_t scale = 1;
+  for (int i = 0; i < precision; i++)
+  {
+    scale *= 10;
+  }
+
+  uint64_t integer = (uint64_t)num;
+  uint32_t fraction = (uint32_t)((num - (float)integer) * scale + 0.5f);
+  if (fraction >= scale)
+  {
+    integer++;
+    fraction -= scale;
+  }
+
+  const int fractionWidth = precision > 0 ? precision + 1 : 0;
+  len += itoa10Unsigned64(putcf, integer, isNegative, width - fractionWidth, padChar);
+  if (precision > 0)
+  {
+    putcf('.');
+    len++;
+    len += itoa10Unsigned(putcf, fraction, false, precision, '0');
+  }
+
+  return len;
+}
+
 static int handleLongLong(putc_t putcf, char** fmt, unsigned long long int val, int width, char padChar)
 {
   int len = 0;
@@ -159,10 +219,17 @@ static int handleLongLong(putc_t putcf, char** fmt, unsigned long long int val,
   {
     case 'i':
     case 'd':
-      len = itoa10(putcf, (long long int)val, 0);
+      if ((long long int)val < 0)
+      {
+        len = itoa10Unsigned64(putcf, 0ull - val, true, width, padChar);
+      }
+      else
+      {
+        len = itoa10Unsigned64(putcf, val, false, width, padChar);
+      }
       break;
     case 'u':
-      len = itoa10Unsigned(putcf, val);
+      len = itoa10Unsigned64(putcf, val, false, width, padChar);
       break;
     case 'x':
     case 'X':
@@ -180,14 +247,19 @@ static int handleLong(putc_t putcf, char** fmt, unsigned long int val, int width
 {
   int len = 0;
 
+  if (sizeof(val) > sizeof(uint32_t))
+  {
+    return handleLongLong(putcf, fmt, val, width, padChar);
+  }
+
   switch(*((*fmt)++))
   {
     case 'i':
     case 'd':
-      len = itoa10(putcf, (long int)val, 0);
+      len = itoa10(putcf, (long int)val, width, padChar);
       break;
     case 'u':
-      len = itoa10Unsigned(putcf, val);
+      len = itoa10Unsigned(putcf, val, false, width, padChar);
       break;
     case 'x':
     case 'X':
@@ -204,8 +276,6 @@ static int handleLong(putc_t putcf, char** fmt, unsigned long int val, int width
 int evprintf(putc_t putcf, char * fmt, va_list ap)
 {
   int len=0;
-  float num;
-  char* str;
   int precision;
   int width;
   char padChar;
@@ -225,39 +295,52 @@ int evprintf(putc_t putcf, char * fmt, va_list ap)
         fmt++;
       }
 
-			while(isdigit((unsigned)*fmt))
-			{
-				width *= 10;
-				width += *fmt - '0';
-				fmt++;
-			}
+      while(isdigit((unsigned)*fmt))
+      {
+        width *= 10;
+        width += *fmt - '0';
+        fmt++;
+      }
 
-      while (!isalpha((unsigned) *fmt))
+      if (*fmt == '.')
       {
-        if (*fmt == '.')
+        fmt++;
+        precision = 0;
+        while (isdigit((unsigned)*fmt))
         {
+          precision *= 10;
+          precision += *fmt - '0';
           fmt++;
-          if (isdigit((unsigned)*fmt))
-          {
-            precision = *fmt - '0';
-            fmt++;
-          }
         }
+        if (precision > 9)
+        {
+          precision = 9;
+        }
+      }
+
+      // Flags that are not implemented
+      while (*fmt && !isalpha((unsigned)*fmt) && *fmt != '%')
+      {
+        fmt++;
       }
-      switch (*fmt++)
+
+      switch (*fmt)
       {
+        case '\0':
+          return len;
         case 'i':
         case 'd':
-          len += itoa10(putcf, va_arg(ap, int), 0);
+          len += itoa10(putcf, va_arg(ap, int), width, padChar);
           break;
         case 'u':
-          len += itoa10Unsigned(putcf, va_arg(ap, unsigned int));
+          len += itoa10Unsigned(putcf, va_arg(ap, unsigned int), false, width, padChar);
           break;
         case 'x':
         case 'X':
           len += itoa16(putcf, va_arg(ap, unsigned int), width, padChar);
           break;
         case 'l':
+          fmt++;
           // Look ahead for ll
           if (*fmt == 'l') {
             fmt++;
@@ -265,35 +348,25 @@ int evprintf(putc_t putcf, char * fmt, va_list ap)
           } else {
             len += handleLong(putcf, &fmt, va_arg(ap, unsigned long int), width, padChar);
           }
-
-          break;
+          continue;
         case 'f':
-          num = va_arg(ap, double);
-          if(num<0)
-          {
-            putcf('-');
-            num = -num;
-            len++;
-          }
-          len += itoa10(putcf, (int)num, 0);
-          putcf('.'); len++;
-          len += itoa10(putcf, (num - (int)num) * power(10,precision), precision);
+          len += ftoa(putcf, (float)va_arg(ap, double), precision, width, padChar);
           break;
         case 's':
-          str = va_arg(ap, char* );
-          while(*str)
-          {
-            putcf(*str++);
-            len++;
-          }
+          len += putString(putcf, va_arg(ap, char* ));
           break;
         case 'c':
           putcf((char)va_arg(ap, int));
           len++;
           break;
+        case '%':
+          putcf('%');
+          len++;
+          break;
         default:
           break;
       }
+      fmt++;
     }
     else
     {
@@ -26,6 +26,7 @@
 
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "filter.h"
 #include "physicalConstants.h"
@@ -107,3 +108,146 @@ float lpf2pReset(lpf2pData* lpfData, float sample)
   lpfData->delay_element_2 = dval;
   return lpf2pApply(lpfData, sample);
 }
+
+/**
+ * 3-axis biquad cascade
+ */
+void biquad3Init(biquad3Data* data)
+{
+  memset(data, 0, sizeof(*data));
+}
+
+static biquad3Stage* biquad3AddStage(biquad3Data* data)
+{
+  if (data->numStages >= BIQUAD3_MAX_STAGES) {
+    return NULL;
+  }
+
+  biquad3Stage* stage = &data->stages[data->numStages++];
+  memset(stage, 0, sizeof(*stage));
+  return stage;
+}
+
+bool biquad3AddLpf(biquad3Data* data, float sample_freq, float cutoff_freq)
+{
+  if (cutoff_freq <= 0.0f) {
+    return false;
+  }
+
+  biquad3Stage* stage = biquad3AddStage(data);
+  if (stage == NULL) {
+    return false;
+  }
+
+  float fr = sample_freq/cutoff_freq;
+  float ohm = tanf(M_PI_F/fr);
+  float c = 1.0f+2.0f*cosf(M_PI_F/4.0f)*ohm+ohm*ohm;
+  stage->b0 = ohm*ohm/c;
+  stage->b1 = 2.0f*stage->b0;
+  stage->b2 = stage->b0;
+  stage->a1 = 2.0f*(ohm*ohm-1.0f)/c;
+  stage->a2 = (1.0f-2.0f*cosf(M_PI_F/4.0f)*ohm+ohm*ohm)/c;
+  return true;
+}
+
+static bool biquad3NotchCoefficients(biquad3Stage* stage, float sample_freq, float center_freq, float bandwidth_freq)
+{
+  if (center_freq <= 0.0f || bandwidth_freq <= 0.0f || center_freq >= sample_freq / 2.0f) {
+    return false;
+  }
+
+  // Bilinear transform of s^2 + w^2 / (s^2 + s*w/Q + w^2), with Q = center / bandwidth
+  float omega = 2.0f*M_PI_F*center_freq/sample_freq;
+  float alpha = sinf(omega)*bandwidth_freq/(2.0f*center_freq);
+  float c = 1.0f+alpha;
+  stage->b0 = 1.0f/c;
+  stage->b1 = -2.0f*cosf(omega)/c;
+  stage->b2 = stage->b0;
+  stage->a1 = stage->b1;
+  stage->a2 = (1.0f-alpha)/c;
+  return true;
+}
+
+bool biquad3AddNotch(biquad3Data* data, float sample_freq, float center_freq, float bandwidth_freq)
+{
+  biquad3Stage stage = { 0 };
+
+  if (!biquad3NotchCoefficients(&stage, sample_freq, center_freq, bandwidth_freq)) {
+    return false;
+  }
+
+  biquad3Stage* added = biquad3AddStage(data);
+  if (added == NULL) {
+    return false;
+  }
+
+  *added = stage;
+  return true;
+}
+
+bool biquad3SetNotch(biquad3Data* data, uint8_t index, float sample_freq, float center_freq, float bandwidth_freq)
+{
+  if (index >= data->numStages) {
+    return false;
+  }
+
+  return biquad3NotchCoefficients(&data->stages[index], sample_freq, center_freq, bandwidth_freq);
+}
+
+void biquad3Apply(biquad3Data* data, float sample[3])
+{
+  float x0 = sample[0];
+  float x1 = sample[1];
+  float x2 = sample[2];
+
+  for (int i = 0; i < data->numStages; i++) {
+    biquad3Stage* stage = &data->stages[i];
+
+    float y0 = stage->b0 * x0 + stage->d1[0];
+    float y1 = stage->b0 * x1 + stage->d1[1];
+    float y2 = stage->b0 * x2 + stage->d1[2];
+
+    stage->d1[0] = stage->b1 * x0 - stage->a1 * y0 + stage->d2[0];
+    stage->d1[1] = stage->b1 * x1 - stage->a1 * y1 + stage->d2[1];
+    stage->d1[2] = stage->b1 * x2 - stage->a1 * y2 + stage->d2[2];
+
+    stage->d2[0] = stage->b2 * x0 - stage->a2 * y0;
+    stage->d2[1] = stage->b2 * x1 - stage->a2 * y1;
+    stage->d2[2] = stage->b2 * x2 - stage->a2 * y2;
+
+    x0 = y0;
+    x1 = y1;
+    x2 = y2;
+  }
+
+  float out[3] = { x0, x1, x2 };
+
+  for (int axis = 0; axis < 3; axis++) {
+    if (!isfinite(out[axis])) {
+      // don't allow bad values to propagate via the filter, restart the axis from the sample
+      for (int i = 0; i < data->numStages; i++) {
+        data->stages[i].d1[axis] = 0.0f;
+        data->stages[i].d2[axis] = 0.0f;
+      }
+      out[axis] = isfinite(sample[axis]) ? sample[axis] : 0.0f;
+    }
+    sample[axis] = out[axis];
+  }
+}
+
+void biquad3Reset(biquad3Data* data, const float sample[3])
+{
+  for (int axis = 0; axis < 3; axis++) {
+    float x = sample[axis];
+
+    for (int i = 0; i < data->numStages; i++) {
+      biquad3Stage* stage = &data->stages[i];
+      // Steady state of a section with a constant input: y = x * H(1)
+      float y = x * (stage->b0 + stage->b1 + stage->b2) / (1.0f + stage->a1 + stage->a2);
+
+      stage->d1[axis] = y - stage->b0 * x;
+      stage->d2[axis] = stage->b2 * x - stage->a2 * y;
+      x = y;
+    }
+  }
+}
@@ -13,6 +13,11 @@
 // Current version of the KVE table is 1
 #define KVE_VERSION (1)
 
+#define END_TAG (0xffffu)
+
+// Defragmentation steps a store may take when the table is full
+#define STORE_DEFRAG_STEPS (32)
+
 static size_t min(size_t a, size_t b)
 {
     if (a < b) {
@@ -22,6 +27,214 @@ static size_t min(size_t a, size_t b)
     }
 }
 
+// Index of the items in RAM
+
+static uint32_t hashKey(const char* key, size_t length)
+{
+    // 32 bits FNV-1a
+    uint32_t hash = 2166136261u;
+
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (uint8_t)key[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+static bool isIndexed(kveMemory_t *kve)
+{
+    return kve->index != NULL && kve->index->isValid;
+}
+
+static void indexAdd(kveMemory_t *kve, const char* key, size_t address)
+{
+    kveIndex_t *index = kve->index;
+
+    if (!isIndexed(kve)) {
+        return;
+    }
+
+    if (index->count >= index->length) {
+        // Too many items, the index cannot be trusted anymore
+        DEBUG_PRINT("Index full, falling back to scanning the table\n");
+        index->isValid = false;
+        return;
+    }
+
+    index->entries[index->count].keyHash = hashKey(key, strlen(key));
+    index->entries[index->count].address = address;
+    index->count++;
+}
+
+static void indexRemove(kveMemory_t *kve, size_t address)
+{
+    kveIndex_t *index = kve->index;
+
+    if (!isIndexed(kve)) {
+        return;
+    }
+
+    for (size_t i = 0; i < index->count; i++) {
+        if (index->entries[i].address == address) {
+            index->count--;
+            index->entries[i] = index->entries[index->count];
+            return;
+        }
+    }
+}
+
+static void indexMove(kveMemory_t *kve, size_t from, size_t to)
+{
+    kveIndex_t *index = kve->index;
+
+    if (!isIndexed(kve)) {
+        return;
+    }
+
+    for (size_t i = 0; i < index->count; i++) {
+        if (index->entries[i].address == from) {
+            index->entries[i].address = to;
+            return;
+        }
+    }
+}
+
+static void indexBuild(kveMemory_t *kve)
+{
+    kveIndex_t *index = kve->index;
+    char key[KVE_KEY_MAX_LENGTH + 1];
+    size_t address = FIRST_ITEM_ADDRESS;
+
+    if (index == NULL) {
+        return;
+    }
+
+    index->count = 0;
+    index->isValid = true;
+
+    while (address < (kve->memorySize - END_TAG_LENDTH)) {
+        kveItemHeader_t header = kveStorageGetItemInfo(kve, address);
+        if (header.full_length == END_TAG || header.full_length < sizeof(header)) {
+            break;
+        }
+
+        if (header.key_length != 0) {
+            kveStorageGetKey(kve, address, header, key, sizeof(key));
+            key[header.key_length] = '\0';
+            indexAdd(kve, key, address);
+        }
+
+        address += header.full_length;
+    }
+}
+
+// Find an item, using the index when it is available
+static size_t findItemByKey(kveMemory_t *kve, const char* key)
+{
+    kveIndex_t *index = kve->index;
+
+    if (!isIndexed(kve)) {
+        return kveStorageFindItemByKey(kve, FIRST_ITEM_ADDRESS, key);
+    }
+
+    const size_t keyLength = strlen(key);
+    const uint32_t keyHash = hashKey(key, keyLength);
+    uint8_t item[sizeof(kveItemHeader_t) + KVE_KEY_MAX_LENGTH];
+
+    for (size_t i = 0; i < index->count; i++) {
+        if (index->entries[i].keyHash != keyHash) {
+            continue;
+        }
+
+        // Header and key in one read, to rule out hash collisions
+        const size_t address = index->entries[i].address;
+        kve->read(address, item, sizeof(kveItemHeader_t) + keyLength);
+        const kveItemHeader_t *header = (const kveItemHeader_t*)item;
+        if (header->key_length == keyLength &&
+            !memcmp(&item[sizeof(kveItemHeader_t)], key, keyLength)) {
+            return address;
+        }
+    }
+
+    return KVE_STORAGE_INVALID_ADDRESS;
+}
+
+static bool isSameKey(kveMemory_t *kve, size_t a, size_t b, size_t keyLength)
+{
+    char keyA[KVE_KEY_MAX_LENGTH];
+    char keyB[KVE_KEY_MAX_LENGTH];
+
+    kve->read(a + sizeof(kveItemHeader_t), keyA, keyLength);
+    kve->read(b + sizeof(kveItemHeader_t), keyB, keyLength);
+
+    return !memcmp(keyA, keyB, keyLength);
+}
+
+/**
+ * An item being moved by the defragmentation is visible twice from the
+ * moment its copy is written until the original is made a hole. The copy
+ * is either in the hole right before the original, or at the end of the
+ * table. A reset in between leaves the two, the later one goes.
+ */
+static void removeMovedDuplicate(kveMemory_t *kve)
+{
+    size_t address = FIRST_ITEM_ADDRESS;
+    size_t previous = KVE_STORAGE_INVALID_ADDRESS;
+    size_t last = KVE_STORAGE_INVALID_ADDRESS;
+    kveItemHeader_t previousHeader = {0};
+    kveItemHeader_t lastHeader = {0};
+
+    while (address < (kve->memorySize - END_TAG_LENDTH)) {
+        kveItemHeader_t header = kveStorageGetItemInfo(kve, address);
+        if (header.full_length == END_TAG || header.full_length < sizeof(header)) {
+            break;
+        }
+
+        if (header.key_length != 0) {
+            if (KVE_STORAGE_IS_VALID(previous) &&
+                previousHeader.full_length == header.full_length &&
+                previousHeader.key_length == header.key_length &&
+                isSameKey(kve, previous, address, header.key_length)) {
+                DEBUG_PRINT("Removing the copy of a moved item\n");
+                kveStorageWriteHole(kve, address, header.full_length);
+                return;
+            }
+
+            previous = address;
+            previousHeader = header;
+            last = address;
+            lastHeader = header;
+        } else if (KVE_STORAGE_IS_VALID(previous) && previous + previousHeader.full_length != address) {
+            // Only one hole may sit between an item and its copy
+            previous = KVE_STORAGE_INVALID_ADDRESS;
+        }
+
+        address += header.full_length;
+    }
+
+    if (KVE_STORAGE_IS_VALID(last)) {
+        char key[KVE_KEY_MAX_LENGTH + 1];
+        kveStorageGetKey(kve, last, lastHeader, key, sizeof(key) - 1);
+        key[lastHeader.key_length] = '\0';
+
+        const size_t first = kveStorageFindItemByKey(kve, FIRST_ITEM_ADDRESS, key);
+        if (first != last && KVE_STORAGE_IS_VALID(first) &&
+            kveStorageGetItemInfo(kve, first).full_length == lastHeader.full_length) {
+            DEBUG_PRINT("Removing the copy of a moved item\n");
+            kveStorageWriteHole(kve, last, lastHeader.full_length);
+        }
+    }
+}
+
+// Copy an item to free memory, it is visible once its header is written
+static void copyItem(kveMemory_t *kve, size_t from, size_t to, kveItemHeader_t header)
+{
+    kveStorageMoveMemory(kve, from + sizeof(header), to + sizeof(header), header.full_length - sizeof(header));
+    kve->write(to, &header, sizeof(header));
+    kve->flush();
+}
+
 // Utility function
 static bool appendItemToEnd(kveMemory_t *kve, size_t address, const char* key, const void* buffer, size_t length) {
     size_t itemAddress = kveStorageFindEnd(kve, address);
@@ -35,19 +248,24 @@ static bool appendItemToEnd(kveMemory_t *kve, size_t address, const char* key, c
 
     // Test that there is enough space to write the item
     if ((itemAddress + sizeof(kveItemHeader_t) + strlen(key) + length + END_TAG_LENDTH) < kve->memorySize) {
+        indexAdd(kve, key, itemAddress);
         itemAddress += kveStorageWriteItem(kve, itemAddress, key, buffer, length);
         kveStorageWriteEnd(kve, itemAddress);
     } else {
-        // Otherwise, defrag and try to insert again!
-        kveDefrag(kve);
-
-        itemAddress = kveStorageFindEnd(kve, FIRST_ITEM_ADDRESS);
+        // Otherwise, defrag step by step and try to insert again!
+        bool hasRoom = false;
+        for (int i = 0; i < STORE_DEFRAG_STEPS && !hasRoom && kveDefragStep(kve); i++) {
+            itemAddress = kveStorageFindEnd(kve, FIRST_ITEM_ADDRESS);
+            hasRoom = KVE_STORAGE_IS_VALID(itemAddress) &&
+                      (itemAddress + sizeof(kveItemHeader_t) + strlen(key) + length + END_TAG_LENDTH) < kve->memorySize;
+        }
 
-        if ((itemAddress + sizeof(kveItemHeader_t) + strlen(key) + length + END_TAG_LENDTH) < kve->memorySize) {
+        if (hasRoom) {
+            indexAdd(kve, key, itemAddress);
             itemAddress += kveStorageWriteItem(kve, itemAddress, key, buffer, length);
             kveStorageWriteEnd(kve, itemAddress);
         } else {
-            // Memory full!
+            // Memory full, or not defragmented yet!
             DEBUG_PRINT("Error: memory full!");
             return false;
         }
@@ -58,42 +276,92 @@ static bool appendItemToEnd(kveMemory_t *kve, size_t address, const char* key, c
 
 // Public API
 
-void kveDefrag(kveMemory_t *kve) {
-    size_t holeAddress = kveStorageFindHole(kve, FIRST_ITEM_ADDRESS);
-    size_t itemAddress;
-    size_t nextHoleAddress;
+// The header holds the key length in a byte, the lookups read it in one go
+static bool isKeyValid(const char* key)
+{
+    const size_t keyLength = strlen(key);
+
+    return keyLength > 0 && keyLength <= KVE_KEY_MAX_LENGTH;
+}
 
-    while(KVE_STORAGE_IS_VALID(holeAddress)) {
-        itemAddress = kveStorageFindNextItem(kve, holeAddress);
+bool kveDefragStep(kveMemory_t *kve) {
+    size_t holeAddress = FIRST_ITEM_ADDRESS;
+    kveItemHeader_t hole;
 
-        if (KVE_STORAGE_IS_VALID(itemAddress) == false) {
-            // This hole is at the end, lets crop it
-            kveStorageWriteEnd(kve, holeAddress);
+    // The first hole, the table is packed up to there
+    while (true) {
+        if (holeAddress >= (kve->memorySize - END_TAG_LENDTH)) {
+            return false;
+        }
+        hole = kveStorageGetItemInfo(kve, holeAddress);
+        if (hole.full_length == END_TAG || hole.full_length < sizeof(hole)) {
+            return false;
+        }
+        if (hole.key_length == 0) {
             break;
         }
+        holeAddress += hole.full_length;
+    }
 
-        nextHoleAddress = kveStorageFindHole(kve, itemAddress);
+    const size_t itemAddress = holeAddress + hole.full_length;
+    if (itemAddress >= (kve->memorySize - END_TAG_LENDTH)) {
+        return false;
+    }
+    const kveItemHeader_t item = kveStorageGetItemInfo(kve, itemAddress);
 
-        if(KVE_STORAGE_IS_VALID(nextHoleAddress) == false) {
-            // If there is the end after this group of item, lets copy up to the end
-            nextHoleAddress = kveStorageFindEnd(kve, itemAddress);
+    if (item.full_length == END_TAG) {
+        // This hole is at the end, lets crop it
+        kveStorageWriteEnd(kve, holeAddress);
+    } else if (item.full_length < sizeof(item)) {
+        return false;
+    } else if (item.key_length == 0) {
+        kveStorageWriteHole(kve, holeAddress, hole.full_length + item.full_length);
+    } else if (item.full_length == hole.full_length ||
+               item.full_length + sizeof(kveItemHeader_t) < hole.full_length) {
+        // The item fits in the hole, the rest of the hole joins the item once moved
+        if (item.full_length != hole.full_length) {
+            kveStorageWriteHole(kve, holeAddress + item.full_length, hole.full_length - item.full_length);
+        }
+        copyItem(kve, itemAddress, holeAddress, item);
+        kveStorageWriteHole(kve, itemAddress, item.full_length);
+        indexMove(kve, itemAddress, holeAddress);
+    } else {
+        const size_t endAddress = kveStorageFindEnd(kve, itemAddress);
+        if (!KVE_STORAGE_IS_VALID(endAddress)) {
+            return false;
         }
 
-        size_t lenghtToMove = nextHoleAddress - itemAddress;
-
-        kveStorageMoveMemory(kve, itemAddress, holeAddress, lenghtToMove);
+        if ((endAddress + item.full_length + END_TAG_LENDTH) < kve->memorySize) {
+            // Move the item to the end, the hole then joins the place it had
+            kveStorageWriteEnd(kve, endAddress + item.full_length);
+            copyItem(kve, itemAddress, endAddress, item);
+            kveStorageWriteHole(kve, itemAddress, item.full_length);
+            indexMove(kve, itemAddress, endAddress);
+        } else {
+            // No room anywhere, the item slides down over the hole and is
+            // lost if that is interrupted
+            kveStorageMoveMemory(kve, itemAddress, holeAddress, item.full_length);
+            kveStorageWriteHole(kve, holeAddress + item.full_length, hole.full_length);
+            indexMove(kve, itemAddress, holeAddress);
+        }
+    }
 
-        kveStorageWriteHole(kve, holeAddress + lenghtToMove, itemAddress - holeAddress);
+    return true;
+}
 
-        holeAddress = holeAddress + lenghtToMove;
-    }
+void kveDefrag(kveMemory_t *kve) {
+    while (kveDefragStep(kve));
 }
 
 bool kveStore(kveMemory_t *kve, char* key, const void* buffer, size_t length) {
     size_t itemAddress;
 
+    if (!isKeyValid(key)) {
+        return false;
+    }
+
     // Search if the key is already present in the table
-    itemAddress = kveStorageFindItemByKey(kve, FIRST_ITEM_ADDRESS, key);
+    itemAddress = findItemByKey(kve, key);
     if (KVE_STORAGE_IS_VALID(itemAddress) == false) {
         // Item does not exit, find the end of the table to insert it
         return appendItemToEnd(kve, FIRST_ITEM_ADDRESS, key, buffer, length);
@@ -104,6 +372,7 @@ bool kveStore(kveMemory_t *kve, char* key, const void* buffer, size_t length) {
         if (currentItem.full_length != newLength) {
             // If not, delete the item and find the end of the table
             kveStorageWriteHole(kve, itemAddress, currentItem.full_length);
+            indexRemove(kve, itemAddress);
             return appendItemToEnd(kve, FIRST_ITEM_ADDRESS, key, buffer, length);
         } else {
             kveStorageWriteItem(kve, itemAddress, key, buffer, length);
@@ -116,7 +385,11 @@ bool kveStore(kveMemory_t *kve, char* key, const void* buffer, size_t length) {
 
 size_t kveFetch(kveMemory_t *kve, const char* key, void* buffer, size_t bufferLength)
 {
-    size_t itemAddress = kveStorageFindItemByKey(kve, FIRST_ITEM_ADDRESS, key);
+    if (!isKeyValid(key)) {
+        return 0;
+    }
+
+    size_t itemAddress = findItemByKey(kve, key);
 
     if (KVE_STORAGE_IS_VALID(itemAddress)) {
         kveItemHeader_t header = kveStorageGetItemInfo(kve, itemAddress);
@@ -128,11 +401,16 @@ size_t kveFetch(kveMemory_t *kve, const char* key, void* buffer, size_t bufferLe
 }
 
 bool kveDelete(kveMemory_t *kve, char* key) {
-    size_t itemAddress = kveStorageFindItemByKey(kve, FIRST_ITEM_ADDRESS, key);
+    if (!isKeyValid(key)) {
+        return false;
+    }
+
+    size_t itemAddress = findItemByKey(kve, key);
 
     if (KVE_STORAGE_IS_VALID(itemAddress)) {
         kveItemHeader_t itemInfo = kveStorageGetItemInfo(kve, itemAddress);
         kveStorageWriteHole(kve, itemAddress, itemInfo.full_length);
+        indexRemove(kve, itemAddress);
         return true;
     }
 
@@ -143,6 +421,7 @@ void kveFormat(kveMemory_t *kve) {
     uint8_t version = KVE_VERSION;
     kve->write(VERSION_ADDRESS, &version, 1);
     kveStorageWriteEnd(kve, FIRST_ITEM_ADDRESS);
+    indexBuild(kve);
 }
 
 bool kveCheck(kveMemory_t *kve) {
@@ -162,5 +441,8 @@ bool kveCheck(kveMemory_t *kve) {
         return false;
     }
 
+    removeMovedDuplicate(kve);
+    indexBuild(kve);
+
     return true;
 }
@@ -0,0 +1,687 @@
+/**
+ * ,---------,       ____  _ __
+ * |  ,-^-,  |      / __ )(_) /_______________ _____  ___
+ * | (  O  ) |     / __  / / __/ ___/ ___/ __ `/_  / / _ \
+ * | / ,--´  |    / /_/ / / /_/ /__/ /  / /_/ / / /_/  __/
+ *    +------`   /_____/_/\__/\___/_/   \__,_/ /___/\___/
+ *
+ * Crazyflie control firmware
+ *
+ * Copyright (C) 2019 - 2020 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * kve_log.c - Key/value items in a log of flash sectors
+ *
+ */
+
+#define DEBUG_MODULE "KVE"
+
+#include "kve/kve_log.h"
+#include "kve/kve_storage.h"
+
+#include "crc.h"
+
+#include "debug_cf.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#define SECTOR_MAGIC (0x474c564bu) // "KVLG"
+
+#define ITEM_DATA (0x5a)
+#define ITEM_DELETED (0xa5)
+
+// The index marks the keys whose newest item is a deletion
+#define INDEX_DELETED (0x80000000u)
+#define INDEX_ADDRESS(entry) ((entry)->address & ~INDEX_DELETED)
+
+// Reserve the last free sector for the compaction
+#define STORE_MIN_FREE_SECTORS 2
+#define COMPACT_MIN_FREE_SECTORS 1
+
+// Compact a sector even if it is all alive once it is this many erases behind
+#define WEAR_SPREAD (16)
+
+#define COPY_CHUNK (64)
+
+typedef struct {
+    uint32_t magic;
+    uint32_t eraseCount;
+    uint32_t sequence;
+} __attribute__((packed)) kveLogSectorHeader_t;
+
+typedef struct {
+    uint16_t length;
+    uint8_t keyLength;
+    uint8_t kind;
+    // Of the three fields above, the key and the data
+    uint32_t crc;
+} __attribute__((packed)) kveLogItemHeader_t;
+
+#define SECTOR_HEADER_SIZE sizeof(kveLogSectorHeader_t)
+
+static size_t itemSize(const kveLogItemHeader_t *header)
+{
+    return (sizeof(*header) + header->keyLength + header->length + 3) & ~3u;
+}
+
+static size_t sectorCount(const kveLog_t *log)
+{
+    return log->memorySize / log->sectorSize;
+}
+
+static size_t sectorOf(const kveLog_t *log, size_t address)
+{
+    return address / log->sectorSize;
+}
+
+static bool isFree(const kveLog_t *log, int sector)
+{
+    return log->sectors[sector].sequence == KVE_LOG_FREE_SEQUENCE;
+}
+
+static int freeSectors(const kveLog_t *log)
+{
+    int count = 0;
+
+    for (size_t i = 0; i < sectorCount(log); i++) {
+        count += isFree(log, i);
+    }
+
+    return count;
+}
+
+static uint32_t itemCrc(const kveLogItemHeader_t *header, const char* key, const void* buffer)
+{
+    uint32_t crc = crc32Update(0, header, offsetof(kveLogItemHeader_t, crc));
+    crc = crc32Update(crc, key, header->keyLength);
+    return crc32Update(crc, buffer, header->length);
+}
+
+static bool isHeaderValid(const kveLog_t *log, const kveLogItemHeader_t *header, size_t offset)
+{
+    return (header->kind == ITEM_DATA || header->kind == ITEM_DELETED) &&
+           header->keyLength != 0 &&
+           offset + itemSize(header) <= log->sectorSize;
+}
+
+// Index of the newest items in RAM
+
+static uint32_t hashKey(const char* key, size_t length)
+{
+    // 32 bits FNV-1a, as kve.c
+    uint32_t hash = 2166136261u;
+
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (uint8_t)key[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+// The header holds the key length in a byte, indexFind() reads it in one go
+static bool isKeyValid(size_t keyLength)
+{
+    return keyLength > 0 && keyLength <= KVE_KEY_MAX_LENGTH;
+}
+
+static kveIndexEntry_t* indexFind(kveLog_t *log, const char* key, size_t keyLength)
+{
+    kveIndex_t *index = log->index;
+    const uint32_t keyHash = hashKey(key, keyLength);
+    uint8_t item[sizeof(kveLogItemHeader_t) + KVE_KEY_MAX_LENGTH];
+
+    for (size_t i = 0; i < index->count; i++) {
+        if (index->entries[i].keyHash != keyHash) {
+            continue;
+        }
+
+        // Header and key in one read, to rule out hash collisions
+        log->read(INDEX_ADDRESS(&index->entries[i]), item, sizeof(kveLogItemHeader_t) + keyLength);
+        const kveLogItemHeader_t *header = (const kveLogItemHeader_t*)item;
+        if (header->keyLength == keyLength &&
+            !memcmp(&item[sizeof(kveLogItemHeader_t)], key, keyLength)) {
+            return &index->entries[i];
+        }
+    }
+
+    return NULL;
+}
+
+static void indexRemove(kveLog_t *log, kveIndexEntry_t *entry)
+{
+    kveIndex_t *index = log->index;
+
+    index->count--;
+    *entry = index->entries[index->count];
+}
+
+// The item the entry pointed at is dead, the entry points at address from now on
+static void indexReplace(kveLog_t *log, kveIndexEntry_t *entry, size_t address, bool isDeleted)
+{
+    kveLogItemHeader_t header;
+
+    log->read(INDEX_ADDRESS(entry), &header, sizeof(header));
+    log->sectors[sectorOf(log, INDEX_ADDRESS(entry))].live -= itemSize(&header);
+
+    entry->address = address | (isDeleted ? INDEX_DELETED : 0);
+}
+
+static bool indexAdd(kveLog_t *log, const char* key, size_t keyLength, size_t address, bool isDeleted)
+{
+    kveIndex_t *index = log->index;
+
+    if (index->count >= index->length) {
+        return false;
+    }
+
+    index->entries[index->count].keyHash = hashKey(key, keyLength);
+    index->entries[index->count].address = address | (isDeleted ? INDEX_DELETED : 0);
+    index->count++;
+
+    return true;
+}
+
+// Sectors
+
+static bool writeSectorHeader(kveLog_t *log, int sector)
+{
+    const kveLogSectorHeader_t header = {
+        .magic = SECTOR_MAGIC,
+        .eraseCount = log->sectors[sector].eraseCount,
+        .sequence = KVE_LOG_FREE_SEQUENCE,
+    };
+
+    log->sectors[sector].sequence = KVE_LOG_FREE_SEQUENCE;
+    log->sectors[sector].used = 0;
+    log->sectors[sector].live = 0;
+
+    // The magic last, a sector with its erase count but no magic was erased
+    const size_t address = sector * log->sectorSize;
+    return log->write(address + offsetof(kveLogSectorHeader_t, eraseCount), &header.eraseCount, sizeof(header.eraseCount)) &&
+           log->write(address, &header.magic, sizeof(header.magic));
+}
+
+static bool eraseSector(kveLog_t *log, int sector)
+{
+    if (!log->erase(sector * log->sectorSize)) {
+        return false;
+    }
+
+    log->sectors[sector].eraseCount++;
+    return writeSectorHeader(log, sector);
+}
+
+// Open the least erased free sector, leaving minFree sectors free before it
+static bool openSector(kveLog_t *log, int minFree)
+{
+    int sector = -1;
+
+    if (freeSectors(log) < minFree) {
+        return false;
+    }
+
+    for (size_t i = 0; i < sectorCount(log); i++) {
+        if (isFree(log, i) && (sector < 0 || log->sectors[i].eraseCount < log->sectors[sector].eraseCount)) {
+            sector = i;
+        }
+    }
+
+    const uint32_t sequence = log->sequence + 1;
+    if (!log->write(sector * log->sectorSize + offsetof(kveLogSectorHeader_t, sequence), &sequence, sizeof(sequence))) {
+        return false;
+    }
+
+    log->sequence = sequence;
+    log->sectors[sector].sequence = sequence;
+    log->sectors[sector].used = SECTOR_HEADER_SIZE;
+    log->openSector = sector;
+
+    return true;
+}
+
+// Room for size bytes in the open sector, opening the next one if needed
+static size_t reserve(kveLog_t *log, size_t size, int minFree)
+{
+    if (size > log->sectorSize - SECTOR_HEADER_SIZE) {
+        return KVE_STORAGE_INVALID_ADDRESS;
+    }
+
+    if (log->openSector < 0 || log->sectors[log->openSector].used + size > log->sectorSize) {
+        if (!openSector(log, minFree)) {
+            return KVE_STORAGE_INVALID_ADDRESS;
+        }
+    }
+
+    kveLogSector_t *sector = &log->sectors[log->openSector];
+    const size_t address = log->openSector * log->sectorSize + sector->used;
+    sector->used += size;
+    sector->live += size;
+
+    return address;
+}
+
+static size_t appendItem(kveLog_t *log, const char* key, const void* buffer, size_t length, uint8_t kind)
+{
+    const size_t keyLength = strlen(key);
+
+    if (keyLength == 0 || keyLength > KVE_KEY_MAX_LENGTH || length > log->sectorSize) {
+        return KVE_STORAGE_INVALID_ADDRESS;
+    }
+
+    kveLogItemHeader_t header = {
+        .length = length,
+        .keyLength = keyLength,
+        .kind = kind,
+    };
+    header.crc = itemCrc(&header, key, buffer);
+
+    const size_t address = reserve(log, itemSize(&header), STORE_MIN_FREE_SECTORS);
+    if (!KVE_STORAGE_IS_VALID(address)) {
+        return KVE_STORAGE_INVALID_ADDRESS;
+    }
+
+    // Written before the key and data, an item cut short fails its CRC
+    if (!log->write(address, &header, sizeof(header)) ||
+        !log->write(address + sizeof(header), key, header.keyLength) ||
+        !log->write(address + sizeof(header) + header.keyLength, buffer, length)) {
+        return KVE_STORAGE_INVALID_ADDRESS;
+    }
+
+    return address;
+}
+
+static size_t copyItem(kveLog_t *log, size_t from, size_t size)
+{
+    uint8_t chunk[COPY_CHUNK];
+
+    const size_t address = reserve(log, size, COMPACT_MIN_FREE_SECTORS);
+    if (!KVE_STORAGE_IS_VALID(address)) {
+        return KVE_STORAGE_INVALID_ADDRESS;
+    }
+
+    for (size_t done = 0; done < size; done += sizeof(chunk)) {
+        const size_t length = (size - done < sizeof(chunk)) ? size - done : sizeof(chunk);
+        if (!log->read(from + done, chunk, length) || !log->write(address + done, chunk, length)) {
+            return KVE_STORAGE_INVALID_ADDRESS;
+        }
+    }
+
+    return address;
+}
+
+/**
+ * Check the item at offset of the sector, and index it if it is the newest
+ * of its key so far.
+ *
+ * @return false at the end of the items of the sector
+ */
+static bool mountItem(kveLog_t *log, int sector, size_t offset, bool *isIndexFull)
+{
+    const size_t address = sector * log->sectorSize + offset;
+    kveLogItemHeader_t header;
+    char key[KVE_KEY_MAX_LENGTH];
+    uint8_t chunk[COPY_CHUNK];
+
+    if (offset + sizeof(header) > log->sectorSize || !log->read(address, &header, sizeof(header))) {
+        return false;
+    }
+
+    if (!isHeaderValid(log, &header, offset)) {
+        // Erased or cut short, nothing more in this sector can be trusted
+        if (header.length != 0xffffu || header.keyLength != 0xff || header.kind != 0xff) {
+            log->sectors[sector].used = log->sectorSize;
+        }
+        return false;
+    }
+
+    log->read(address + sizeof(header), key, header.keyLength);
+    uint32_t crc = crc32Update(0, &header, offsetof(kveLogItemHeader_t, crc));
+    crc = crc32Update(crc, key, header.keyLength);
+    for (size_t done = 0; done < header.length; done += sizeof(chunk)) {
+        const size_t length = (header.length - done < sizeof(chunk)) ? header.length - done : sizeof(chunk);
+        log->read(address + sizeof(header) + header.keyLength + done, chunk, length);
+        crc = crc32Update(crc, chunk, length);
+    }
+
+    log->sectors[sector].used = offset + itemSize(&header);
+    if (crc != header.crc) {
+        log->sectors[sector].used = log->sectorSize;
+        return false;
+    }
+
+    const bool isDeleted = header.kind == ITEM_DELETED;
+    kveIndexEntry_t *entry = indexFind(log, key, header.keyLength);
+    if (entry) {
+        indexReplace(log, entry, address, isDeleted);
+    } else if (!indexAdd(log, key, header.keyLength, address, isDeleted)) {
+        *isIndexFull = true;
+        return false;
+    }
+    log->sectors[sector].live += itemSize(&header);
+
+    return true;
+}
+
+// The sector with the most dead bytes, or the least erased one once it lags behind
+static int pickVictim(const kveLog_t *log)
+{
+    int victim = -1;
+    size_t victimDead = 0;
+    int leastErased = -1;
+    uint32_t mostErases = 0;
+
+    for (size_t i = 0; i < sectorCount(log); i++) {
+        const kveLogSector_t *sector = &log->sectors[i];
+
+        if (sector->eraseCount > mostErases) {
+            mostErases = sector->eraseCount;
+        }
+        if (isFree(log, i)) {
+            continue;
+        }
+
+        const size_t dead = sector->used - sector->live - SECTOR_HEADER_SIZE;
+        if (dead > victimDead) {
+            victim = i;
+            victimDead = dead;
+        }
+        if (leastErased < 0 || sector->eraseCount < log->sectors[leastErased].eraseCount) {
+            leastErased = i;
+        }
+    }
+
+    if (leastErased >= 0 && log->sectors[leastErased].eraseCount + WEAR_SPREAD < mostErases) {
+        return leastErased;
+    }
+
+    return victim;
+}
+
+static bool hasOlderSector(const kveLog_t *log, int sector)
+{
+    for (size_t i = 0; i < sectorCount(log); i++) {
+        if (!isFree(log, i) && log->sectors[i].sequence < log->sectors[sector].sequence) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Public API
+
+bool kveLogMount(kveLog_t *log)
+{
+    uint32_t mostErases = 0;
+    bool isFormatted = false;
+    bool isIndexFull = false;
+
+    log->index->count = 0;
+    log->index->isValid = true;
+    log->openSector = -1;
+    log->sequence = 0;
+    log->compactSector = -1;
+
+    for (size_t i = 0; i < sectorCount(log); i++) {
+        kveLogSectorHeader_t header;
+
+        if (!log->read(i * log->sectorSize, &header, sizeof(header))) {
+            return false;
+        }
+
+        if (header.magic == SECTOR_MAGIC) {
+            isFormatted = true;
+            log->sectors[i].eraseCount = header.eraseCount;
+            log->sectors[i].sequence = header.sequence;
+            if (header.eraseCount > mostErases) {
+                mostErases = header.eraseCount;
+            }
+        } else {
+            // Erased and the header cut short, or never formatted
+            log->sectors[i].sequence = 0;
+        }
+        log->sectors[i].used = 0;
+        log->sectors[i].live = 0;
+    }
+
+    if (!isFormatted) {
+        return false;
+    }
+
+    // Oldest first, so the newest item of every key ends up in the index
+    uint32_t last = 0;
+    while (true) {
+        int sector = -1;
+
+        for (size_t i = 0; i < sectorCount(log); i++) {
+            const uint32_t sequence = log->sectors[i].sequence;
+            if (sequence > last && sequence != KVE_LOG_FREE_SEQUENCE &&
+                (sector < 0 || sequence < log->sectors[sector].sequence)) {
+                sector = i;
+            }
+        }
+        if (sector < 0) {
+            break;
+        }
+
+        size_t offset = SECTOR_HEADER_SIZE;
+        log->sectors[sector].used = offset;
+        while (mountItem(log, sector, offset, &isIndexFull)) {
+            offset = log->sectors[sector].used;
+        }
+        if (isIndexFull) {
+            DEBUG_PRINT("Index full, can not mount\n");
+            return false;
+        }
+
+        last = log->sectors[sector].sequence;
+        if (offset == SECTOR_HEADER_SIZE && log->sectors[sector].used == offset) {
+            // Opened without an item, its sequence may be cut short
+            log->sectors[sector].sequence = 0;
+        } else {
+            log->openSector = sector;
+            log->sequence = last;
+        }
+    }
+
+    // Erasing may have been cut short too, so erase again
+    for (size_t i = 0; i < sectorCount(log); i++) {
+        if (log->sectors[i].sequence == 0) {
+            kveLogSectorHeader_t header;
+
+            log->read(i * log->sectorSize, &header, sizeof(header));
+            if (header.magic != SECTOR_MAGIC) {
+                log->sectors[i].eraseCount = (header.eraseCount <= mostErases) ? header.eraseCount : mostErases;
+            }
+            if (!eraseSector(log, i)) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+bool kveLogFormat(kveLog_t *log)
+{
+    for (size_t i = 0; i < sectorCount(log); i++) {
+        kveLogSectorHeader_t header;
+
+        log->sectors[i].eraseCount = 0;
+        if (log->read(i * log->sectorSize, &header, sizeof(header)) && header.magic == SECTOR_MAGIC) {
+            log->sectors[i].eraseCount = header.eraseCount;
+        }
+
+        if (!eraseSector(log, i)) {
+            return false;
+        }
+    }
+
+    log->index->count = 0;
+    log->index->isValid = true;
+    log->openSector = -1;
+    log->sequence = 0;
+    log->compactSector = -1;
+
+    return true;
+}
+
+bool kveLogStore(kveLog_t *log, const char* key, const void* buffer, size_t length)
+{
+    const size_t keyLength = strlen(key);
+
+    if (!isKeyValid(keyLength)) {
+        return false;
+    }
+
+    kveIndexEntry_t *entry = indexFind(log, key, keyLength);
+
+    if (!entry && log->index->count >= log->index->length) {
+        DEBUG_PRINT("Error: index full!\n");
+        return false;
+    }
+
+    const size_t address = appendItem(log, key, buffer, length, ITEM_DATA);
+    if (!KVE_STORAGE_IS_VALID(address)) {
+        return false;
+    }
+
+    if (entry) {
+        indexReplace(log, entry, address, false);
+    } else {
+        indexAdd(log, key, keyLength, address, false);
+    }
+
+    return true;
+}
+
+size_t kveLogFetch(kveLog_t *log, const char* key, void* buffer, size_t bufferLength)
+{
+    const size_t keyLength = strlen(key);
+
+    if (!isKeyValid(keyLength)) {
+        return 0;
+    }
+
+    const kveIndexEntry_t *entry = indexFind(log, key, keyLength);
+    kveLogItemHeader_t header;
+
+    if (!entry || (entry->address & INDEX_DELETED)) {
+        return 0;
+    }
+
+    log->read(entry->address, &header, sizeof(header));
+    const size_t length = (header.length < bufferLength) ? header.length : bufferLength;
+    if (!log->read(entry->address + sizeof(header) + header.keyLength, buffer, length)) {
+        return 0;
+    }
+
+    return length;
+}
+
+bool kveLogDelete(kveLog_t *log, const char* key)
+{
+    const size_t keyLength = strlen(key);
+
+    if (!isKeyValid(keyLength)) {
+        return false;
+    }
+
+    kveIndexEntry_t *entry = indexFind(log, key, keyLength);
+
+    if (!entry || (entry->address & INDEX_DELETED)) {
+        return false;
+    }
+
+    const size_t address = appendItem(log, key, NULL, 0, ITEM_DELETED);
+    if (!KVE_STORAGE_IS_VALID(address)) {
+        return false;
+    }
+
+    indexReplace(log, entry, address, true);
+
+    return true;
+}
+
+bool kveLogNeedsCompaction(const kveLog_t *log)
+{
+    return log->compactSector >= 0 || freeSectors(log) < STORE_MIN_FREE_SECTORS;
+}
+
+bool kveLogCompactStep(kveLog_t *log)
+{
+    uint8_t item[sizeof(kveLogItemHeader_t) + KVE_KEY_MAX_LENGTH];
+    const kveLogItemHeader_t *header = (const kveLogItemHeader_t*)item;
+
+    if (log->compactSector < 0) {
+        const int victim = pickVictim(log);
+        if (victim < 0) {
+            return false;
+        }
+
+        // The copies go to another sector
+        if (victim == log->openSector) {
+            log->openSector = -1;
+        }
+        log->compactSector = victim;
+        log->compactOffset = SECTOR_HEADER_SIZE;
+    }
+
+    const int sector = log->compactSector;
+    kveLogSector_t *compacted = &log->sectors[sector];
+
+    // Skip to the next item alive, copy it and stop there
+    while (compacted->live > 0 && log->compactOffset + sizeof(kveLogItemHeader_t) <= compacted->used) {
+        const size_t address = sector * log->sectorSize + log->compactOffset;
+
+        log->read(address, item, sizeof(kveLogItemHeader_t));
+        if (!isHeaderValid(log, header, log->compactOffset)) {
+            break;
+        }
+        log->read(address + sizeof(kveLogItemHeader_t), &item[sizeof(kveLogItemHeader_t)], header->keyLength);
+
+        const size_t size = itemSize(header);
+        log->compactOffset += size;
+
+        kveIndexEntry_t *entry = indexFind(log, (const char*)&item[sizeof(kveLogItemHeader_t)], header->keyLength);
+        if (!entry || INDEX_ADDRESS(entry) != address) {
+            continue;
+        }
+
+        const bool isDeleted = entry->address & INDEX_DELETED;
+        if (isDeleted && !hasOlderSector(log, sector)) {
+            // No older item of the key is left for the deletion to hide
+            compacted->live -= size;
+            indexRemove(log, entry);
+            continue;
+        }
+
+        const size_t copy = copyItem(log, address, size);
+        if (!KVE_STORAGE_IS_VALID(copy)) {
+            DEBUG_PRINT("Error: compaction failed!\n");
+            log->compactSector = -1;
+            return false;
+        }
+        compacted->live -= size;
+        entry->address = copy | (isDeleted ? INDEX_DELETED : 0);
+
+        return true;
+    }
+
+    log->compactSector = -1;
+    return eraseSector(log, sector);
+}
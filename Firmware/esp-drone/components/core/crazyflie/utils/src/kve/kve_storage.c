@@ -107,8 +107,8 @@ size_t kveStorageFindItemByKey(kveMemory_t *kve, size_t address, const char * ke
 
     while (currentAddress < (kve->memorySize - 3)) {
         kve->read(currentAddress, searchBuffer, 3);
-        length = searchBuffer[0] + (searchBuffer[1]<<8);
-        keyLength = searchBuffer[2];
+        length = (uint8_t)searchBuffer[0] + ((uint8_t)searchBuffer[1] << 8);
+        keyLength = (uint8_t)searchBuffer[2];
 
         if (length == END_TAG) {
             return SIZE_MAX;
@@ -56,7 +56,7 @@ static float vec_length(const vec3d vec) {
     float pow = vec_dot(vec, vec);
 
     float res;
-    arm_sqrt_f32(pow, &res);
+    xtensa_sqrt_f32(pow, &res);
     return res;
 }
 
@@ -64,14 +64,14 @@ static bool intersect_lines(vec3d orig1, vec3d vec1, vec3d orig2, vec3d vec2, ve
     // Algoritm: http://geomalgorithms.com/a07-_distance.html#Distance-between-Lines
 
     vec3d w0 = {};
-    arm_sub_f32(orig1, orig2, w0, vec3d_size);
+    xtensa_sub_f32(orig1, orig2, w0, vec3d_size);
 
     float a, b, c, d, e;
-    arm_dot_prod_f32(vec1, vec1, vec3d_size, &a);
-    arm_dot_prod_f32(vec1, vec2, vec3d_size, &b);
-    arm_dot_prod_f32(vec2, vec2, vec3d_size, &c);
-    arm_dot_prod_f32(vec1, w0, vec3d_size, &d);
-    arm_dot_prod_f32(vec2, w0, vec3d_size, &e);
+    xtensa_dot_prod_f32(vec1, vec1, vec3d_size, &a);
+    xtensa_dot_prod_f32(vec1, vec2, vec3d_size, &b);
+    xtensa_dot_prod_f32(vec2, vec2, vec3d_size, &c);
+    xtensa_dot_prod_f32(vec1, w0, vec3d_size, &d);
+    xtensa_dot_prod_f32(vec2, w0, vec3d_size, &e);
 
     float denom = a * c - b * b;
     if (fabsf(denom) < 1e-5f)
@@ -80,28 +80,28 @@ static bool intersect_lines(vec3d orig1, vec3d vec1, vec3d orig2, vec3d vec2, ve
     // Closest point to 2nd line on 1st line
     float t1 = (b * e - c * d) / denom;
     vec3d pt1 = {};
-    arm_scale_f32(vec1, t1, pt1, vec3d_size);
-    arm_add_f32(pt1, orig1, pt1, vec3d_size);
+    xtensa_scale_f32(vec1, t1, pt1, vec3d_size);
+    xtensa_add_f32(pt1, orig1, pt1, vec3d_size);
 
     // Closest point to 1st line on 2nd line
     float t2 = (a * e - b * d) / denom;
     vec3d pt2 = {};
-    arm_scale_f32(vec2, t2, pt2, vec3d_size);
-    arm_add_f32(pt2, orig2, pt2, vec3d_size);
+    xtensa_scale_f32(vec2, t2, pt2, vec3d_size);
+    xtensa_add_f32(pt2, orig2, pt2, vec3d_size);
 
     // Result is in the middle
     vec3d tmp = {};
-    arm_add_f32(pt1, pt2, tmp, vec3d_size);
-    arm_scale_f32(tmp, 0.5f, res, vec3d_size);
+    xtensa_add_f32(pt1, pt2, tmp, vec3d_size);
+    xtensa_scale_f32(tmp, 0.5f, res, vec3d_size);
 
     // Dist is distance between pt1 and pt2
-    arm_sub_f32(pt1, pt2, tmp, vec3d_size);
+    xtensa_sub_f32(pt1, pt2, tmp, vec3d_size);
     *dist = vec_length(tmp);
 
     return true;
 }
 
-bool lighthouseGeometryGetPositionFromRayIntersection(baseStationGeometry_t baseStations[2], float angles1[2], float angles2[2], vec3d position, float *position_delta)
+bool lighthouseGeometryGetPositionFromRayIntersection(const baseStationGeometry_t baseStations[2], float angles1[2], float angles2[2], vec3d position, float *position_delta)
 {
     static vec3d ray1, ray2, origin1, origin2;
 
@@ -114,29 +114,136 @@ bool lighthouseGeometryGetPositionFromRayIntersection(baseStationGeometry_t base
     return intersect_lines(origin1, ray1, origin2, ray2, position, position_delta);
 }
 
-void lighthouseGeometryGetBaseStationPosition(baseStationGeometry_t* bs, vec3d baseStationPos) {
+void lighthouseGeometryRaySetClear(lighthouseGeometryRaySet_t* set) {
+  set->count = 0;
+  set->baseStations = 0;
+}
+
+bool lighthouseGeometryRaySetAdd(lighthouseGeometryRaySet_t* set, const baseStationGeometry_t* baseStationGeometry, int baseStation, const float angles[2]) {
+  if (set->count >= LIGHTHOUSE_GEOMETRY_MAX_RAYS) {
+    return false;
+  }
+
+  lighthouseGeometryGetRay(baseStationGeometry, angles[0], angles[1], set->direction[set->count]);
+  lighthouseGeometryGetBaseStationPosition(baseStationGeometry, set->origin[set->count]);
+  set->baseStations |= 1u << baseStation;
+  set->count++;
+
+  return true;
+}
+
+// Squared distance between the point and the line through origin along the normalized direction
+static float ray_distance_sq(const vec3d origin, const vec3d direction, const vec3d point) {
+  vec3d w = {point[0] - origin[0], point[1] - origin[1], point[2] - origin[2]};
+  const float along = vec_dot(w, direction);
+
+  return fmaxf(vec_dot(w, w) - along * along, 0.0f);
+}
+
+/**
+ * Weighted least squares point of the rays: sum w (I - d d') p = sum w (I - d d') o,
+ * solved with Cramer's rule as the system is 3x3 and symmetric.
+ */
+static bool solve_rays(const lighthouseGeometryRaySet_t* set, const float* weights, vec3d position) {
+  float a[3][3] = {};
+  vec3d b = {};
+  float weightSum = 0.0f;
+
+  for (int i = 0; i < set->count; i++) {
+    const float* d = set->direction[i];
+    const float* o = set->origin[i];
+    const float w = weights ? weights[i] : 1.0f;
+    const float dDotO = vec_dot(d, o);
+
+    for (int row = 0; row < 3; row++) {
+      for (int col = row; col < 3; col++) {
+        a[row][col] += w * ((row == col ? 1.0f : 0.0f) - d[row] * d[col]);
+      }
+      b[row] += w * (o[row] - d[row] * dDotO);
+    }
+    weightSum += w;
+  }
+  a[1][0] = a[0][1];
+  a[2][0] = a[0][2];
+  a[2][1] = a[1][2];
+
+  const float c00 = a[1][1] * a[2][2] - a[1][2] * a[2][1];
+  const float c01 = a[1][2] * a[2][0] - a[1][0] * a[2][2];
+  const float c02 = a[1][0] * a[2][1] - a[1][1] * a[2][0];
+  const float det = a[0][0] * c00 + a[0][1] * c01 + a[0][2] * c02;
+
+  // Scale free test, the determinant grows with the cube of the weights
+  if (weightSum <= 0.0f || fabsf(det) < 1e-5f * weightSum * weightSum * weightSum) {
+    return false;
+  }
+
+  const float c11 = a[0][0] * a[2][2] - a[0][2] * a[2][0];
+  const float c12 = a[0][1] * a[2][0] - a[0][0] * a[2][1];
+  const float c22 = a[0][0] * a[1][1] - a[0][1] * a[1][0];
+
+  // The inverse of a symmetric matrix is its symmetric cofactor matrix over the determinant
+  position[0] = (c00 * b[0] + c01 * b[1] + c02 * b[2]) / det;
+  position[1] = (c01 * b[0] + c11 * b[1] + c12 * b[2]) / det;
+  position[2] = (c02 * b[0] + c12 * b[1] + c22 * b[2]) / det;
+
+  return true;
+}
+
+bool lighthouseGeometryGetPositionFromRays(const lighthouseGeometryRaySet_t* set, int robustIterations, float robustThreshold, vec3d position, float* residual) {
+  static float weights[LIGHTHOUSE_GEOMETRY_MAX_RAYS];
+
+  // Rays of a single base station meet at its origin
+  if (set->count < 2 || (set->baseStations & (set->baseStations - 1)) == 0) {
+    return false;
+  }
+
+  if (!solve_rays(set, 0, position)) {
+    return false;
+  }
+
+  for (int iteration = 0; iteration < robustIterations; iteration++) {
+    for (int i = 0; i < set->count; i++) {
+      const float distance = sqrtf(ray_distance_sq(set->origin[i], set->direction[i], position));
+      weights[i] = (distance <= robustThreshold) ? 1.0f : robustThreshold / distance;
+    }
+
+    if (!solve_rays(set, weights, position)) {
+      return false;
+    }
+  }
+
+  float sum = 0.0f;
+  for (int i = 0; i < set->count; i++) {
+    sum += ray_distance_sq(set->origin[i], set->direction[i], position);
+  }
+  *residual = sqrtf(sum / set->count);
+
+  return true;
+}
+
+void lighthouseGeometryGetBaseStationPosition(const baseStationGeometry_t* bs, vec3d baseStationPos) {
     // TODO: Make geometry adjustments within base station.
     vec3d rotated_origin_delta = {};
     //vec3d base_origin_delta = {-0.025f, -0.025f, 0.f};  // Rotors are slightly off center in base station.
     // arm_matrix_instance_f32 origin_vec = {3, 1, base_origin_delta};
     // arm_matrix_instance_f32 origin_rotated_vec = {3, 1, rotated_origin_delta};
     // arm_mat_mult_f32(&source_rotation_matrix, &origin_vec, &origin_rotated_vec);
-    arm_add_f32(bs->origin, rotated_origin_delta, baseStationPos, vec3d_size);
+    vec_add(bs->origin, rotated_origin_delta, baseStationPos);
 }
 
 void lighthouseGeometryGetRay(const baseStationGeometry_t* baseStationGeometry, const float angleH, const float angleV, vec3d ray) {
-    vec3d a = {arm_sin_f32(angleH), -arm_cos_f32(angleH), 0};  // Normal vector to X plane
-    vec3d b = {-arm_sin_f32(angleV), 0, arm_cos_f32(angleV)};  // Normal vector to Y plane
+    vec3d a = {xtensa_sin_f32(angleH), -xtensa_cos_f32(angleH), 0};  // Normal vector to X plane
+    vec3d b = {-xtensa_sin_f32(angleV), 0, xtensa_cos_f32(angleV)};  // Normal vector to Y plane
 
     vec3d raw_ray = {};
     vec_cross_product(b, a, raw_ray); // Intersection of two planes -> ray vector.
     float len = vec_length(raw_ray);
-    arm_scale_f32(raw_ray, 1 / len, raw_ray, vec3d_size); // Normalize raw ray length.
+    xtensa_scale_f32(raw_ray, 1 / len, raw_ray, vec3d_size); // Normalize raw ray length.
 
-    arm_matrix_instance_f32 source_rotation_matrix = {3, 3, (float32_t *)baseStationGeometry->mat};
-    arm_matrix_instance_f32 ray_vec = {3, 1, raw_ray};
-    arm_matrix_instance_f32 ray_rotated_vec = {3, 1, ray};
-    arm_mat_mult_f32(&source_rotation_matrix, &ray_vec, &ray_rotated_vec);
+    xtensa_matrix_instance_f32 source_rotation_matrix = {3, 3, (float32_t *)baseStationGeometry->mat};
+    xtensa_matrix_instance_f32 ray_vec = {3, 1, raw_ray};
+    xtensa_matrix_instance_f32 ray_rotated_vec = {3, 1, ray};
+    xtensa_mat_mult_f32(&source_rotation_matrix, &ray_vec, &ray_rotated_vec);
 }
 
 bool lighthouseGeometryIntersectionPlaneVector(const vec3d linePoint, const vec3d lineVec, const vec3d planePoint, const vec3d PlaneNormal, vec3d intersectionPoint) {
@@ -156,12 +263,12 @@ bool lighthouseGeometryIntersectionPlaneVector(const vec3d linePoint, const vec3
     return true;
 }
 
-void lighthouseGeometryGetSensorPosition(const vec3d cfPos, const arm_matrix_instance_f32 *R, vec3d sensorPosition, vec3d pos) {
-  arm_matrix_instance_f32 LOCAL_POS = {3, 1, sensorPosition};
+void lighthouseGeometryGetSensorPosition(const vec3d cfPos, const xtensa_matrix_instance_f32 *R, vec3d sensorPosition, vec3d pos) {
+  xtensa_matrix_instance_f32 LOCAL_POS = {3, 1, sensorPosition};
 
   vec3d rotatedPos = {0};
-  arm_matrix_instance_f32 ROTATED_POS = {1, 3, rotatedPos};
-  arm_mat_mult_f32(R, &LOCAL_POS, &ROTATED_POS);
+  xtensa_matrix_instance_f32 ROTATED_POS = {3, 1, rotatedPos};
+  xtensa_mat_mult_f32(R, &LOCAL_POS, &ROTATED_POS);
 
   vec_add(cfPos, rotatedPos, pos);
 }
@@ -200,7 +307,7 @@ bool lighthouseGeometryYawDelta(const vec3d ipv, const vec3d spv, const vec3d n,
     return true;
 }
 
-void lighthouseGeometryCalculateAnglesFromRotationMatrix(baseStationGeometry_t* baseStationGeometry, baseStationEulerAngles_t* baseStationEulerAngles) {
+void lighthouseGeometryCalculateAnglesFromRotationMatrix(const baseStationGeometry_t* baseStationGeometry, baseStationEulerAngles_t* baseStationEulerAngles) {
 
    /*
     * roll pitch yaw Rotation matrix
@@ -217,9 +324,9 @@ void lighthouseGeometryCalculateAnglesFromRotationMatrix(baseStationGeometry_t*
   float32_t R22 = (float32_t)baseStationGeometry->mat[2][2];
 
 
-  float pitchBaseStation = asin(R02);
-  float yawBaseStation = -1.0*atan2(R01,R00);
-  float rollBaseStation = -1.0*atan2(R12,R22);
+  float pitchBaseStation = asinf(R02);
+  float yawBaseStation = -atan2f(R01,R00);
+  float rollBaseStation = -atan2f(R12,R22);
 
   baseStationEulerAngles->roll=rollBaseStation;
   baseStationEulerAngles->pitch=pitchBaseStation;
@@ -175,7 +175,7 @@ static void calculateAzimuthElevation(const float firstBeam, const float secondB
 
     angles[0] = ((firstBeam + secondBeam) / 2.0f) - M_PI_F;
     float beta = (secondBeam - firstBeam) - a120;
-    angles[1] = atan(sinf(beta / 2.0f) / tan_p_2);
+    angles[1] = atanf(sinf(beta / 2.0f) / tan_p_2);
 }
 
 static void calculateAngles(const pulseProcessorV2SweepBlock_t* latestBlock, const pulseProcessorV2SweepBlock_t* previousBlock, pulseProcessorResult_t* angles) {
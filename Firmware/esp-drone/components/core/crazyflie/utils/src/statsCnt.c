@@ -32,24 +32,34 @@
 void statsCntRateCounterInit(statsCntRateCounter_t* counter, uint32_t averagingIntervalMs) {
     counter->intervalMs = averagingIntervalMs;
     counter->count = 0;
+    counter->isUpdating = 0;
     counter->latestCount = 0;
     counter->latestAveragingMs = 0;
     counter->latestRate = 0.0f;
 }
 
 float statsCntRateCounterUpdate(statsCntRateCounter_t* counter, uint32_t now_ms) {
+    // The log task and the flight recorder may both read the rate
+    if (__atomic_exchange_n(&counter->isUpdating, 1, __ATOMIC_ACQUIRE)) {
+        return counter->latestRate;
+    }
+
     uint32_t dt_ms = now_ms - counter->latestAveragingMs;
     if (dt_ms > counter->intervalMs) {
         float dt_s = dt_ms / 1000.0f;
-        float dv = counter->count - counter->latestCount;
+        uint32_t count = __atomic_load_n(&counter->count, __ATOMIC_RELAXED);
+        float dv = count - counter->latestCount;
 
         counter->latestRate = dv / dt_s;
 
-        counter->latestCount = counter->count;
+        counter->latestCount = count;
         counter->latestAveragingMs = now_ms;
     }
 
-    return counter->latestRate;
+    float rate = counter->latestRate;
+    __atomic_store_n(&counter->isUpdating, 0, __ATOMIC_RELEASE);
+
+    return rate;
 }
 
 void statsCntRateLoggerInit(statsCntRateLogger_t* logger, uint32_t averagingIntervalMs) {
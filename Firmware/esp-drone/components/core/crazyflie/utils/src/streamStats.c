@@ -0,0 +1,120 @@
+/**
+ *
+ * ESP-Drone Firmware
+ *
+ * Copyright 2019-2020  Espressif Systems (Shanghai)
+ * Copyright (C) 2011-2012 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * streamStats.c - Running median and mean of a sliding window of samples
+ */
+
+#include <string.h>
+
+#include "streamStats.h"
+
+void streamStatsInit(streamStats_t *stats, int32_t *window, int32_t *sorted, uint16_t size)
+{
+  stats->window = window;
+  stats->sorted = sorted;
+  stats->size = size;
+  streamStatsReset(stats);
+}
+
+void streamStatsReset(streamStats_t *stats)
+{
+  stats->count = 0;
+  stats->next = 0;
+  stats->sum = 0;
+}
+
+// The first place in sorted[0, count) with a sample not below value
+static uint16_t lowerBound(const int32_t *sorted, uint16_t count, int32_t value)
+{
+  uint16_t low = 0;
+  uint16_t high = count;
+
+  while (low < high) {
+    const uint16_t middle = low + (high - low) / 2;
+    if (sorted[middle] < value) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+
+  return low;
+}
+
+void streamStatsAdd(streamStats_t *stats, int32_t value)
+{
+  int32_t *sorted = stats->sorted;
+
+  if (stats->count < stats->size) {
+    const uint16_t place = lowerBound(sorted, stats->count, value);
+    memmove(&sorted[place + 1], &sorted[place], (stats->count - place) * sizeof(int32_t));
+    sorted[place] = value;
+    stats->count++;
+  } else {
+    const int32_t oldest = stats->window[stats->next];
+    uint16_t place = lowerBound(sorted, stats->count, oldest);
+
+    // Slide the samples between the place of the oldest and that of the new one
+    if (value > oldest) {
+      while (place + 1 < stats->count && sorted[place + 1] < value) {
+        sorted[place] = sorted[place + 1];
+        place++;
+      }
+    } else {
+      while (place > 0 && sorted[place - 1] > value) {
+        sorted[place] = sorted[place - 1];
+        place--;
+      }
+    }
+    sorted[place] = value;
+    stats->sum -= oldest;
+  }
+
+  stats->window[stats->next] = value;
+  stats->next = (stats->next + 1 == stats->size) ? 0 : stats->next + 1;
+  stats->sum += value;
+}
+
+int32_t streamStatsMedian(const streamStats_t *stats)
+{
+  if (stats->count == 0) {
+    return 0;
+  }
+
+  return stats->sorted[stats->count / 2];
+}
+
+int32_t streamStatsMean(const streamStats_t *stats)
+{
+  if (stats->count == 0) {
+    return 0;
+  }
+
+  return (int32_t)(stats->sum / stats->count);
+}
+
+float streamStatsMeanf(const streamStats_t *stats)
+{
+  if (stats->count == 0) {
+    return 0.0f;
+  }
+
+  return (float)stats->sum / stats->count;
+}
@@ -187,10 +187,14 @@ void tdoaStorageSetRxTxData(tdoaAnchorContext_t* anchorCtx, int64_t rxTime, int6
   anchorInfo->lastUpdateTime = now;
 }
 
-double tdoaStorageGetClockCorrection(const tdoaAnchorContext_t* anchorCtx) {
+float tdoaStorageGetClockCorrection(const tdoaAnchorContext_t* anchorCtx) {
   return clockCorrectionEngineGet(&anchorCtx->anchorInfo->clockCorrectionStorage);
 }
 
+float tdoaStorageGetClockCorrectionDeviation(const tdoaAnchorContext_t* anchorCtx) {
+  return clockCorrectionEngineGetDeviation(&anchorCtx->anchorInfo->clockCorrectionStorage);
+}
+
 int64_t tdoaStorageGetRemoteRxTime(const tdoaAnchorContext_t* anchorCtx, const uint8_t remoteAnchor) {
   const tdoaAnchorInfo_t* anchorInfo = anchorCtx->anchorInfo;
 
@@ -0,0 +1,58 @@
+/**
+ *
+ * ESP-Drone Firmware
+ *
+ * Copyright 2019-2020  Espressif Systems (Shanghai)
+ * Copyright (C) 2011-2012 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * welford.c - Streaming mean and variance of samples, Welford's method
+ */
+
+#include "welford.h"
+
+void welfordReset(welford_t *stats)
+{
+  stats->count = 0;
+  stats->mean = 0.0f;
+  stats->m2 = 0.0f;
+}
+
+void welfordAdd(welford_t *stats, float value)
+{
+  stats->count++;
+  const float delta = value - stats->mean;
+  stats->mean += delta / stats->count;
+  stats->m2 += delta * (value - stats->mean);
+}
+
+float welfordMean(const welford_t *stats)
+{
+  return stats->mean;
+}
+
+float welfordSumOfSquares(const welford_t *stats)
+{
+  return stats->m2;
+}
+
+float welfordVariance(const welford_t *stats)
+{
+  if (stats->count == 0) {
+    return 0.0f;
+  }
+
+  return stats->m2 / stats->count;
+}
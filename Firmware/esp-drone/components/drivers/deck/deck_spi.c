@@ -22,11 +22,14 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/semphr.h"
 #include "driver/spi_master.h"
+#include "esp_heap_caps.h"
 
 #include "deck_spi.h"
 #include "config.h"
 #include "cfassert.h"
 #include "nvicconf.h"
+#include "busStats.h"
+#include "log.h"
 #define DEBUG_MODULE "DECK_SPI"
 #include "debug_cf.h"
 
@@ -44,9 +47,58 @@
 static bool isInit = false;
 static SemaphoreHandle_t spiMutex;
 
+#define SPI_HOST_ID   SPI2_HOST
+#define SPI_QUEUE_SIZE 8
+// Longer reads go to the caller buffer instead of the rx_data of the transaction
+#define SPI_RXDATA_SIZE 4
+
 static void spiConfigureWithSpeed(uint32_t baudRatePrescaler);
 
+static struct {
+    uint32_t speed;
+    spi_device_handle_t handle;
+} devices[SPI_MAX_SPEEDS];
+static int devicesCount;
+
+// The device of the current speed, and the one the pending transfers were queued on
 static spi_device_handle_t spi;
+static spi_device_handle_t queuedSpi;
+static int pendingCount;
+
+#ifdef CONFIG_BUS_STATS
+static busStats_t spiStats;
+#endif
+// The first failure of the transaction, for the stats
+static esp_err_t transactionErr;
+
+static void IRAM_ATTR spiPostTransfer(spi_transaction_t *t)
+{
+    spiTransfer_t *transfer = t->user;
+
+    if (transfer != NULL && transfer->onDone != NULL) {
+        transfer->onDone(transfer);
+    }
+}
+
+static bool spiAddDevice(uint32_t speed)
+{
+    spi_device_interface_config_t devcfg = {
+        .clock_speed_hz = speed,
+        .mode = 3,
+        .spics_io_num = -1,             //CS pin driven by the deck drivers
+        .queue_size = SPI_QUEUE_SIZE,
+        .post_cb = spiPostTransfer,
+    };
+
+    if (devicesCount >= SPI_MAX_SPEEDS ||
+        spi_bus_add_device(SPI_HOST_ID, &devcfg, &devices[devicesCount].handle) != ESP_OK) {
+        return false;
+    }
+
+    devices[devicesCount].speed = speed;
+    devicesCount++;
+    return true;
+}
 
 void spiBegin(void)
 {
@@ -56,6 +108,7 @@ void spiBegin(void)
     }
 
     spiMutex = xSemaphoreCreateMutex();
+    busStatsRegister(&spiStats, "spi");
 
     esp_err_t ret;
     spi_bus_config_t buscfg = {
@@ -66,15 +119,8 @@ void spiBegin(void)
         .quadhd_io_num = -1,
         .max_transfer_sz = 0
     }; //Defaults to 4094 if 0
-    spi_device_interface_config_t devcfg = {
-        .clock_speed_hz = SPI_BAUDRATE_2MHZ, //Clock out at 10 MHz
-        .mode = 3,							 //SPI mode 0
-        .spics_io_num = -1,					 //CS pin
-        .queue_size = 8,					 //We want to be able to queue 7 transactions at a time
-        /*.pre_cb = lcd_spi_pre_transfer_callback, //Specify pre-transfer callback to handle D/C line*/
-    };
     //Initialize the SPI bus
-    spi_host_device_t host_id = SPI2_HOST;
+    spi_host_device_t host_id = SPI_HOST_ID;
 #if (ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(4, 3, 0))
     ret = spi_bus_initialize(host_id, &buscfg, SPI_DMA_CH_AUTO);
 #else
@@ -82,16 +128,32 @@ void spiBegin(void)
     ret = spi_bus_initialize(host_id, &buscfg, dma_chan);
 #endif
     ESP_ERROR_CHECK(ret);
-    //Attach the pmw3901 to the SPI bus
-    ret = spi_bus_add_device(host_id, &devcfg, &spi);
-    ESP_ERROR_CHECK(ret);
+    //The default speed, that of the pmw3901
+    if (!spiAddDevice(SPI_BAUDRATE_2MHZ)) {
+        ESP_ERROR_CHECK(ESP_FAIL);
+    }
+    spi = devices[0].handle;
 
     isInit = true;
 }
 
 static void spiConfigureWithSpeed(uint32_t baudRatePrescaler)
 {
-    //TODO:
+    ASSERT(pendingCount == 0);
+
+    for (int i = 0; i < devicesCount; i++) {
+        if (devices[i].speed == baudRatePrescaler) {
+            spi = devices[i].handle;
+            return;
+        }
+    }
+
+    if (spiAddDevice(baudRatePrescaler)) {
+        spi = devices[devicesCount - 1].handle;
+    } else {
+        DEBUG_PRINTW("No device left for %u Hz, using %u Hz\n", (unsigned)baudRatePrescaler, (unsigned)devices[0].speed);
+        spi = devices[0].handle;
+    }
 }
 
 bool spiTest(void)
@@ -109,6 +171,7 @@ bool spiExchange(size_t length, bool is_tx, const uint8_t *data_tx, uint8_t *dat
         return true;    //no need to send anything
     }
 
+    ASSERT(pendingCount == 0);
     esp_err_t ret;
 
     if (is_tx == true) {
@@ -118,6 +181,9 @@ bool spiExchange(size_t length, bool is_tx, const uint8_t *data_tx, uint8_t *dat
         t.length = length * 8;						//Len is in bytes, transaction length is in bits.
         t.tx_buffer = data_tx;						//Data
         ret = spi_device_polling_transmit(spi, &t); //Transmit!
+        if (ret != ESP_OK && transactionErr == ESP_OK) {
+            transactionErr = ret;
+        }
         assert(ret == ESP_OK);						//Should have had no issues.
         //DEBUG_PRINTD("spi send = %d",t.length);
         return true;
@@ -126,11 +192,18 @@ bool spiExchange(size_t length, bool is_tx, const uint8_t *data_tx, uint8_t *dat
     static spi_transaction_t r;
     memset(&r, 0, sizeof(r));
     r.length = length * 8;
-    r.flags = SPI_TRANS_USE_RXDATA;
+    if (length <= SPI_RXDATA_SIZE) {
+        r.flags = SPI_TRANS_USE_RXDATA;
+    } else {
+        r.rx_buffer = data_rx;
+    }
     ret = spi_device_polling_transmit(spi, &r);
+    if (ret != ESP_OK && transactionErr == ESP_OK) {
+        transactionErr = ret;
+    }
     assert(ret == ESP_OK);
 
-    if (r.rxlength > 0) {
+    if (r.rxlength > 0 && length <= SPI_RXDATA_SIZE) {
         //DEBUG_PRINTD("rxlength = %d",r.rxlength);
         memcpy(data_rx, r.rx_data, length);
     }
@@ -138,13 +211,77 @@ bool spiExchange(size_t length, bool is_tx, const uint8_t *data_tx, uint8_t *dat
     return true;
 }
 
+void *spiDmaMalloc(size_t size)
+{
+    return heap_caps_malloc(size, MALLOC_CAP_DMA);
+}
+
+bool spiQueueExchange(spiTransfer_t *transfer)
+{
+    if (isInit != true || transfer->length == 0) {
+        return false;
+    }
+
+    spi_transaction_t *t = &transfer->transaction;
+    memset(t, 0, sizeof(*t));
+    t->length = transfer->length * 8;
+    t->tx_buffer = transfer->txBuffer;
+    t->rx_buffer = transfer->rxBuffer;
+    t->user = transfer;
+
+    esp_err_t ret = spi_device_queue_trans(spi, t, portMAX_DELAY);
+    if (ret != ESP_OK) {
+        if (transactionErr == ESP_OK) {
+            transactionErr = ret;
+        }
+        return false;
+    }
+
+    queuedSpi = spi;
+    pendingCount++;
+    return true;
+}
+
+spiTransfer_t *spiWaitExchange(uint32_t timeout)
+{
+    spi_transaction_t *t;
+
+    if (pendingCount == 0) {
+        return NULL;
+    }
+    if (spi_device_get_trans_result(queuedSpi, &t, timeout) != ESP_OK) {
+        if (transactionErr == ESP_OK) {
+            transactionErr = ESP_ERR_TIMEOUT;
+        }
+        return NULL;
+    }
+
+    pendingCount--;
+    return t->user;
+}
+
 void spiBeginTransaction(uint32_t baudRatePrescaler)
 {
+    const uint32_t waitStartUs = busStatsNowUs();
+
     xSemaphoreTake(spiMutex, portMAX_DELAY);
+    // The devices share the bus and no address, they are told apart by their clock
+    busStatsAcquire(&spiStats, (uint8_t)(baudRatePrescaler / 1000000), waitStartUs);
+    transactionErr = ESP_OK;
     spiConfigureWithSpeed(baudRatePrescaler);
 }
 
 void spiEndTransaction()
 {
+    busStatsRelease(&spiStats, transactionErr);
     xSemaphoreGive(spiMutex);
 }
+
+#ifdef CONFIG_BUS_STATS
+/**
+ * The deck SPI bus, busy in % and transactions per s, the waits for the bus in us
+ */
+LOG_GROUP_START(busSpi)
+BUS_STATS_LOG_ADD(&spiStats)
+LOG_GROUP_STOP(busSpi)
+#endif
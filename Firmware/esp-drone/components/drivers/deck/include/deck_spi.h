@@ -26,21 +26,63 @@
 #include <stdbool.h>
 #include <string.h>
 
+#include "driver/spi_master.h"
+
 // Based on 84MHz peripheral clock
 #define SPI_BAUDRATE_21MHZ  21*1000*1000
 #define SPI_BAUDRATE_12MHZ  12*1000*1000
+#define SPI_BAUDRATE_10MHZ  10*1000*1000
 #define SPI_BAUDRATE_6MHZ   6*1000*1000
 #define SPI_BAUDRATE_3MHZ   3*1000*1000
 #define SPI_BAUDRATE_2MHZ   2*1000*1000
 
+// One bus device per speed, the chip selects are driven by the deck drivers
+#define SPI_MAX_SPEEDS      3
+
 /**
  * Initialize the SPI.
  */
 void spiBegin(void);
+/* Take the bus, at the baudrate of one of the SPI_BAUDRATE_ speeds */
 void spiBeginTransaction(uint32_t baudRatePrescaler);
 void spiEndTransaction();
 
 /* Send the data_tx buffer and receive into the data_rx buffer */
 bool spiExchange(size_t length, bool is_tx, const uint8_t *data_tx, uint8_t *data_rx);
 
+typedef struct spiTransfer_s spiTransfer_t;
+
+/* Called from the SPI interrupt when a queued transfer is done */
+typedef void (*spiTransferCallback_t)(spiTransfer_t *transfer);
+
+/**
+ * A DMA transfer. The buffers come from spiDmaMalloc() and, like the
+ * transfer itself, must stay valid until spiWaitExchange() has returned it.
+ */
+struct spiTransfer_s {
+    size_t length;                  // [bytes]
+    const uint8_t *txBuffer;        // NULL to only read
+    uint8_t *rxBuffer;              // NULL to drop the received bytes
+    spiTransferCallback_t onDone;   // NULL for none
+    void *arg;                      // for onDone
+    spi_transaction_t transaction;  // private to deck_spi.c
+};
+
+/* DMA capable memory for the buffers of a spiTransfer_t */
+void *spiDmaMalloc(size_t size);
+
+/**
+ * Queue a DMA transfer at the speed of the current spiBeginTransaction().
+ * The CPU is free until spiWaitExchange(); spiExchange() must not be used
+ * while queued transfers are pending.
+ */
+bool spiQueueExchange(spiTransfer_t *transfer);
+
+/**
+ * Wait for the oldest queued transfer, sleeping, for at most timeout ticks.
+ *
+ * @return  the finished transfer, NULL on timeout.
+ */
+spiTransfer_t *spiWaitExchange(uint32_t timeout);
+
 #endif /* SPI_H_ */
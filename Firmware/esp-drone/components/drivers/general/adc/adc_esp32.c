@@ -22,8 +22,13 @@
  */
 
 #include "esp_idf_version.h"
+#include "sdkconfig.h"
 #include "driver/adc.h"
 #include "esp_adc_cal.h"
+#if defined(CONFIG_ADC_CONTINUOUS) && ESP_IDF_VERSION_MAJOR > 4
+#include "esp_adc/adc_continuous.h"
+#define ADC_USE_CONTINUOUS
+#endif
 #include "adc_esp32.h"
 #include "config.h"
 #include "pm_esplane.h"
@@ -33,7 +38,8 @@
 
 static bool isInit;
 
-static esp_adc_cal_characteristics_t *adc_chars;
+static esp_adc_cal_characteristics_t adcCharsBuffer;
+static esp_adc_cal_characteristics_t *adc_chars = &adcCharsBuffer;
 #ifdef CONFIG_IDF_TARGET_ESP32
 static const adc_channel_t channel = ADC_CHANNEL_7; //GPIO35 if ADC1
 #elif defined(CONFIG_IDF_TARGET_ESP32S2) || defined(CONFIG_IDF_TARGET_ESP32S3)
@@ -46,6 +52,25 @@ static const adc_unit_t unit = ADC_UNIT_1;
 #define DEFAULT_VREF 1100 //Use adc2_vref_to_gpio() to obtain a better estimate
 #define NO_OF_SAMPLES   30          //Multisampling
 
+#ifdef ADC_USE_CONTINUOUS
+// The DMA fills frames of conversions at the lowest rate of the chip, the
+// reader averages everything that came since its last read
+#define ADC_FRAME_LEN        256
+#define ADC_STORE_LEN        (4 * ADC_FRAME_LEN)
+#ifdef CONFIG_IDF_TARGET_ESP32
+#define ADC_OUTPUT_TYPE      ADC_DIGI_OUTPUT_FORMAT_TYPE1
+#define ADC_GET_DATA(p)      ((p)->type1.data)
+#else
+#define ADC_OUTPUT_TYPE      ADC_DIGI_OUTPUT_FORMAT_TYPE2
+#define ADC_GET_DATA(p)      ((p)->type2.data)
+#endif
+
+static adc_continuous_handle_t continuousHandle;
+static bool isContinuous;
+static uint32_t lastReading;
+static uint8_t frame[ADC_FRAME_LEN];
+#endif
+
 static void print_char_val_type(esp_adc_cal_value_t val_type)
 {
     if (val_type == ESP_ADC_CAL_VAL_EFUSE_TP) {
@@ -57,9 +82,71 @@ static void print_char_val_type(esp_adc_cal_value_t val_type)
     }
 }
 
+#ifdef ADC_USE_CONTINUOUS
+static bool adcContinuousInit(void)
+{
+    adc_continuous_handle_cfg_t handleConfig = {
+        .max_store_buf_size = ADC_STORE_LEN,
+        .conv_frame_size = ADC_FRAME_LEN,
+    };
+    adc_digi_pattern_config_t pattern = {
+        .atten = atten,
+        .channel = channel,
+        .unit = unit,
+        .bit_width = SOC_ADC_DIGI_MAX_BITWIDTH,
+    };
+    adc_continuous_config_t config = {
+        .pattern_num = 1,
+        .adc_pattern = &pattern,
+        .sample_freq_hz = SOC_ADC_SAMPLE_FREQ_THRES_LOW,
+        .conv_mode = ADC_CONV_SINGLE_UNIT_1,
+        .format = ADC_OUTPUT_TYPE,
+    };
+
+    if (adc_continuous_new_handle(&handleConfig, &continuousHandle) != ESP_OK) {
+        return false;
+    }
+    if (adc_continuous_config(continuousHandle, &config) != ESP_OK ||
+            adc_continuous_start(continuousHandle) != ESP_OK) {
+        adc_continuous_deinit(continuousHandle);
+        return false;
+    }
+
+    return true;
+}
+
+/* Average of the conversions since the last call, the last one if there are none */
+static uint32_t adcContinuousRead(void)
+{
+    uint32_t sum = 0;
+    uint32_t count = 0;
+    uint32_t length;
+
+    // Never waits, the DMA ring is drained
+    while (adc_continuous_read(continuousHandle, frame, sizeof(frame), &length, 0) == ESP_OK) {
+        for (uint32_t i = 0; i + SOC_ADC_DIGI_RESULT_BYTES <= length; i += SOC_ADC_DIGI_RESULT_BYTES) {
+            sum += ADC_GET_DATA((adc_digi_output_data_t *)&frame[i]);
+            count++;
+        }
+    }
+
+    if (count > 0) {
+        lastReading = sum / count;
+    }
+
+    return lastReading;
+}
+#endif
+
 float analogReadVoltage(uint32_t pin)
 {
     uint32_t adc_reading = 0;
+#ifdef ADC_USE_CONTINUOUS
+    if (isContinuous) {
+        uint32_t voltage = esp_adc_cal_raw_to_voltage(adcContinuousRead(), adc_chars);
+        return voltage / 1000.0f;
+    }
+#endif
     for (int i = 0; i < NO_OF_SAMPLES; i++) {
         if (unit == ADC_UNIT_1) {
             adc_reading += adc1_get_raw((adc1_channel_t)channel);
@@ -72,7 +159,7 @@ float analogReadVoltage(uint32_t pin)
     adc_reading /= NO_OF_SAMPLES;
     //Convert adc_reading to voltage in mV
     uint32_t voltage = esp_adc_cal_raw_to_voltage(adc_reading, adc_chars);
-    return voltage / 1000.0;
+    return voltage / 1000.0f;
 }
 
 void adcInit(void)
@@ -89,10 +176,18 @@ void adcInit(void)
     }
 
     //Characterize ADC
-    adc_chars = calloc(1, sizeof(esp_adc_cal_characteristics_t));
     esp_adc_cal_value_t val_type = esp_adc_cal_characterize(unit, atten, width, DEFAULT_VREF, adc_chars);
     print_char_val_type(val_type);
 
+#ifdef ADC_USE_CONTINUOUS
+    // Until the first frame is in, the DMA owns the unit after this
+    lastReading = adc1_get_raw((adc1_channel_t)channel);
+    isContinuous = adcContinuousInit();
+    if (!isContinuous) {
+        DEBUG_PRINTW("Continuous ADC failed, one shot reads\n");
+    }
+#endif
+
     isInit = true;
 }
 
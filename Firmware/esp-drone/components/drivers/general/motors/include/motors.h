@@ -179,6 +179,20 @@ bool motorsTest(void);
  */
 void motorsSetRatio(uint32_t id, uint16_t ratio);
 
+/**
+ * Set the PWM ratio of all the motors, indexed by id. The battery voltage
+ * is read once and the new ratios apply from the same PWM period.
+ */
+void motorsSetRatios(const uint16_t ratios[NBR_OF_MOTORS]);
+
+#ifdef ENABLE_THRUST_BAT_COMPENSATED
+/**
+ * Battery voltage for the thrust compensation, called by the pm task at each
+ * new measurement. Also applies changes of the motorComp params.
+ */
+void motorsSetBatteryVoltage(float voltage);
+#endif
+
 /**
  * Get the PWM ratio of the motor 'id'. Return -1 if wrong ID.
  */
@@ -22,6 +22,8 @@
  */
 
 #include <stdbool.h>
+#include <string.h>
+#include <math.h>
 
 //FreeRTOS includes
 #include "freertos/FreeRTOS.h"
@@ -29,14 +31,12 @@
 
 #include "stm32_legacy.h"
 #include "motors.h"
-#include "pm_esplane.h"
+#include "motors_backend.h"
 #include "log.h"
+#include "param.h"
 #define DEBUG_MODULE "MOTORS"
 #include "debug_cf.h"
 
-static uint16_t motorsConvBitsTo16(uint16_t bits);
-static uint16_t motorsConv16ToBits(uint16_t bits);
-
 uint32_t motor_ratios[] = {0, 0, 0, 0};
 
 void motorsPlayTone(uint16_t frequency, uint16_t duration_msec);
@@ -50,85 +50,12 @@ const uint32_t MOTORS[] = {MOTOR_M1, MOTOR_M2, MOTOR_M3, MOTOR_M4};
 const uint16_t testsound[NBR_OF_MOTORS] = {A4, A5, F5, D5};
 
 static bool isInit = false;
-static bool isTimerInit = false;
-
-ledc_channel_config_t motors_channel[NBR_OF_MOTORS] = {
-    {
-        .channel = MOT_PWM_CH1,
-        .duty = 0,
-        .gpio_num = MOTOR1_GPIO,
-        .speed_mode = LEDC_LOW_SPEED_MODE,
-        .timer_sel = LEDC_TIMER_0
-    },
-    {
-        .channel = MOT_PWM_CH2,
-        .duty = 0,
-        .gpio_num = MOTOR2_GPIO,
-        .speed_mode = LEDC_LOW_SPEED_MODE,
-        .timer_sel = LEDC_TIMER_0
-    },
-    {
-        .channel = MOT_PWM_CH3,
-        .duty = 0,
-        .gpio_num = MOTOR3_GPIO,
-        .speed_mode = LEDC_LOW_SPEED_MODE,
-        .timer_sel = LEDC_TIMER_0
-    },
-    {
-        .channel = MOT_PWM_CH4,
-        .duty = 0,
-        .gpio_num = MOTOR4_GPIO,
-        .speed_mode = LEDC_LOW_SPEED_MODE,
-        .timer_sel = LEDC_TIMER_0
-    },
-};
-/* Private functions */
-
-static uint16_t motorsConvBitsTo16(uint16_t bits)
-{
-    return ((bits) << (16 - MOTORS_PWM_BITS));
-}
-
-static uint16_t motorsConv16ToBits(uint16_t bits)
-{
-    return ((bits) >> (16 - MOTORS_PWM_BITS) & ((1 << MOTORS_PWM_BITS) - 1));
-}
-
-bool pwm_timmer_init()
-{
-    if (isTimerInit) {
-        // First to init will configure it
-        return TRUE;
-    }
-
-    /*
-     * Prepare and set configuration of timers
-     * that will be used by MOTORS Controller
-     */
-    ledc_timer_config_t ledc_timer = {
-        .duty_resolution = MOTORS_PWM_BITS, // resolution of PWM duty
-        .freq_hz = 15000,					// frequency of PWM signal
-        .speed_mode = LEDC_LOW_SPEED_MODE, // timer mode
-        .timer_num = LEDC_TIMER_0,			// timer index
-        // .clk_cfg = LEDC_AUTO_CLK,              // Auto select the source clock
-    };
-
-    // Set configuration of timer0 for high speed channels
-    if (ledc_timer_config(&ledc_timer) == ESP_OK) {
-        isTimerInit = TRUE;
-        return TRUE;
-    }
-
-    return FALSE;
-}
 
 /* Public functions */
 
 //Initialization. Will set all motors ratio to 0%
 void motorsInit(const MotorPerifDef **motorMapSelect)
 {
-    int i;
-
     if (isInit) {
         // First to init will configure it
         return;
@@ -136,22 +63,16 @@ void motorsInit(const MotorPerifDef **motorMapSelect)
 
     motorMap = motorMapSelect;
 
-    if (pwm_timmer_init() != TRUE) {
+    if (!motorsBackendInit()) {
         return;
     }
 
-    for (i = 0; i < NBR_OF_MOTORS; i++) {
-        ledc_channel_config(&motors_channel[i]);
-    }
-
     isInit = true;
 }
 
 void motorsDeInit(const MotorPerifDef **motorMapSelect)
 {
-    for (int i = 0; i < NBR_OF_MOTORS; i++) {
-        ledc_stop(motors_channel[i].speed_mode, motors_channel[i].channel, 0);
-    }
+    motorsBackendDeInit();
 }
 
 bool motorsTest(void)
@@ -177,6 +98,94 @@ bool motorsTest(void)
     return isInit;
 }
 
+#ifdef ENABLE_THRUST_BAT_COMPENSATED
+/*
+ * The battery compensation looks up the duty in a table of
+ * MOTORS_COMP_TABLE_SIZE points over the thrust range, with linear
+ * interpolation in between. The table is computed for the battery voltage
+ * rounded to MOTORS_COMP_VOLTAGE_STEP, by the pm task, and only when that
+ * voltage changes or a motorComp param was written. It is built in the table not in use
+ * and then swapped in, the stabilizer never sees a partial table.
+ */
+#define MOTORS_COMP_TABLE_BITS    5
+#define MOTORS_COMP_TABLE_SIZE    ((1 << MOTORS_COMP_TABLE_BITS) + 1)
+#define MOTORS_COMP_FRAC_BITS     (16 - MOTORS_COMP_TABLE_BITS)
+#define MOTORS_COMP_VOLTAGE_STEP  0.02f
+
+typedef struct {
+    float maxThrust;  // Thrust at full ratio, in grams
+    float voltsA;     // Motor voltage for a thrust t: voltsA * t^2 + voltsB * t
+    float voltsB;
+} motorsCompParams_t;
+
+static motorsCompParams_t compParams = {
+    .maxThrust = 40, //根据实际重量修改
+    .voltsA = -0.0006239f,
+    .voltsB = 0.088f,
+};
+
+static motorsCompParams_t compTableParams;
+// Set by the param callback, the table is rebuilt at the next voltage
+static bool isCompParamsWritten;
+static int32_t compTableVoltageSteps;
+static uint16_t compTables[2][MOTORS_COMP_TABLE_SIZE];
+// NULL until the first battery voltage is known
+static const uint16_t * volatile compTable;
+
+void motorsSetBatteryVoltage(float voltage)
+{
+    const int32_t voltageSteps = lroundf(voltage / MOTORS_COMP_VOLTAGE_STEP);
+
+    if (voltageSteps <= 0) {
+        return;
+    }
+
+    // Cleared before the params are copied, a write meanwhile rebuilds again
+    const bool isWritten = __atomic_exchange_n(&isCompParamsWritten, false, __ATOMIC_ACQUIRE);
+
+    if (compTable != NULL && voltageSteps == compTableVoltageSteps && !isWritten) {
+        return;
+    }
+
+    uint16_t *table = (compTable == compTables[0]) ? compTables[1] : compTables[0];
+    const float supply_voltage = voltageSteps * MOTORS_COMP_VOLTAGE_STEP;
+
+    compTableParams = compParams;
+
+    for (int i = 0; i < MOTORS_COMP_TABLE_SIZE; i++) {
+        float thrust = ((float)i / (MOTORS_COMP_TABLE_SIZE - 1)) * compTableParams.maxThrust;
+        float volts = compTableParams.voltsA * thrust * thrust + compTableParams.voltsB * thrust;
+        float percentage = volts / supply_voltage;
+        percentage = percentage > 1.0f ? 1.0f : percentage;
+        percentage = percentage < 0.0f ? 0.0f : percentage;
+        table[i] = percentage * UINT16_MAX;
+    }
+
+    compTableVoltageSteps = voltageSteps;
+    compTable = table;
+}
+
+static void motorsCompParamsWritten(void)
+{
+    __atomic_store_n(&isCompParamsWritten, true, __ATOMIC_RELEASE);
+}
+
+static uint16_t motorsCompensateRatio(uint32_t id, uint16_t ithrust)
+{
+    const uint16_t *table = compTable;
+
+    if (motorMap[id]->drvType == BRUSHED && table != NULL) {
+        uint32_t index = ithrust >> MOTORS_COMP_FRAC_BITS;
+        int32_t frac = ithrust & ((1 << MOTORS_COMP_FRAC_BITS) - 1);
+        int32_t low = table[index];
+        int32_t high = table[index + 1];
+        return low + (((high - low) * frac) >> MOTORS_COMP_FRAC_BITS);
+    }
+
+    return ithrust;
+}
+#endif
+
 // Ithrust is thrust mapped for 65536 <==> 60 grams
 void motorsSetRatio(uint32_t id, uint16_t ithrust)
 {
@@ -188,50 +197,51 @@ void motorsSetRatio(uint32_t id, uint16_t ithrust)
         ratio = ithrust;
 
 #ifdef ENABLE_THRUST_BAT_COMPENSATED
-
-        if (motorMap[id]->drvType == BRUSHED) {
-            float thrust = ((float)ithrust / 65536.0f) * 40; //根据实际重量修改
-            float volts = -0.0006239f * thrust * thrust + 0.088f * thrust;
-            float supply_voltage = pmGetBatteryVoltage();
-            float percentage = volts / supply_voltage;
-            percentage = percentage > 1.0f ? 1.0f : percentage;
-            ratio = percentage * UINT16_MAX;
-            motor_ratios[id] = ratio;
-        }
-
+        ratio = motorsCompensateRatio(id, ithrust);
 #endif
-        ledc_set_duty(motors_channel[id].speed_mode, motors_channel[id].channel, (uint32_t)motorsConv16ToBits(ratio));
-        ledc_update_duty(motors_channel[id].speed_mode, motors_channel[id].channel);
+        motorsBackendSetRatio(id, ratio);
+        motorsBackendUpdate();
         motor_ratios[id] = ratio;
 #ifdef DEBUG_EP2
-        DEBUG_PRINT_LOCAL("motors ID = %d ,ithrust_10bit = %d", id, (uint32_t)motorsConv16ToBits(ratio));
+        DEBUG_PRINT_LOCAL("motors ID = %d ,ithrust = %d", id, ratio);
+#endif
+    }
+}
+
+void motorsSetRatios(const uint16_t ithrusts[NBR_OF_MOTORS])
+{
+    if (!isInit) {
+        return;
+    }
+
+    for (int id = 0; id < NBR_OF_MOTORS; id++) {
+        uint16_t ratio = ithrusts[id];
+#ifdef ENABLE_THRUST_BAT_COMPENSATED
+        ratio = motorsCompensateRatio(id, ithrusts[id]);
 #endif
+        motorsBackendSetRatio(id, ratio);
+        motor_ratios[id] = ratio;
     }
+
+    motorsBackendUpdate();
 }
 
 int motorsGetRatio(uint32_t id)
 {
     int ratio;
     ASSERT(id < NBR_OF_MOTORS);
-    ratio = motorsConvBitsTo16((uint16_t)ledc_get_duty(motors_channel[id].speed_mode, motors_channel[id].channel));
+    ratio = motorsBackendGetRatio(id);
     return ratio;
 }
 
 void motorsBeep(int id, bool enable, uint16_t frequency, uint16_t ratio)
 {
-    uint32_t freq_hz = 15000;
     ASSERT(id < NBR_OF_MOTORS);
     if (ratio != 0) {
         ratio = (uint16_t)(0.05*(1<<16));
     }
-    
-    if (enable) {
-        freq_hz = frequency;
-    }
-    
-    ledc_set_freq(LEDC_LOW_SPEED_MODE,LEDC_TIMER_0,freq_hz);
-    ledc_set_duty(motors_channel[id].speed_mode, motors_channel[id].channel, (uint32_t)motorsConv16ToBits(ratio));
-    ledc_update_duty(motors_channel[id].speed_mode, motors_channel[id].channel);
+
+    motorsBackendBeep(id, enable, frequency, ratio);
 }
 
 // Play a tone with a given frequency and a specific duration in milliseconds (ms)
@@ -268,3 +278,11 @@ LOG_ADD(LOG_UINT32, m2_pwm, &motor_ratios[1])
 LOG_ADD(LOG_UINT32, m3_pwm, &motor_ratios[2])
 LOG_ADD(LOG_UINT32, m4_pwm, &motor_ratios[3])
 LOG_GROUP_STOP(pwm)
+
+#ifdef ENABLE_THRUST_BAT_COMPENSATED
+PARAM_GROUP_START(motorComp)
+PARAM_ADD_WITH_CALLBACK(PARAM_FLOAT, maxThrust, &compParams.maxThrust, motorsCompParamsWritten)
+PARAM_ADD_WITH_CALLBACK(PARAM_FLOAT, voltsA, &compParams.voltsA, motorsCompParamsWritten)
+PARAM_ADD_WITH_CALLBACK(PARAM_FLOAT, voltsB, &compParams.voltsB, motorsCompParamsWritten)
+PARAM_GROUP_STOP(motorComp)
+#endif
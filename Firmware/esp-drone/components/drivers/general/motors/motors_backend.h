@@ -0,0 +1,62 @@
+/**
+ *
+ * ESP-Drone Firmware
+ *
+ * Copyright 2019-2020  Espressif Systems (Shanghai)
+ * Copyright (C) 2011-2012 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * motors_backend.h - Motor output peripherals
+ *
+ * motors.c handles the thrust compensation and the public interface, the
+ * output itself is done by one of motors_ledc.c, motors_mcpwm.c or
+ * motors_dshot.c, selected by CONFIG_MOTORS_BACKEND.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * Configure the peripheral, with all outputs at 0.
+ */
+bool motorsBackendInit(void);
+
+/**
+ * Stop all outputs.
+ */
+void motorsBackendDeInit(void);
+
+/**
+ * Set the ratio of the motor 'id', it is only output by the next call to
+ * motorsBackendUpdate().
+ */
+void motorsBackendSetRatio(uint32_t id, uint16_t ratio);
+
+/**
+ * Output the ratios of all motors together.
+ */
+void motorsBackendUpdate(void);
+
+/**
+ * Ratio currently output on the motor 'id', in the 16 bit range.
+ */
+uint16_t motorsBackendGetRatio(uint32_t id);
+
+/**
+ * Drive the motor 'id' at 'frequency' to make it beep, or back to the motor
+ * frequency when not enabled.
+ */
+void motorsBackendBeep(uint32_t id, bool enable, uint16_t frequency, uint16_t ratio);
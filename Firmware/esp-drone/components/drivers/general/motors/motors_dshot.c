@@ -0,0 +1,208 @@
+/**
+ *
+ * ESP-Drone Firmware
+ *
+ * Copyright 2019-2020  Espressif Systems (Shanghai)
+ * Copyright (C) 2011-2012 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * motors_dshot.c - DShot digital motor output on the RMT peripheral
+ *
+ * Every motorsBackendUpdate() sends one 16 bit DShot frame per motor: 11 bit
+ * throttle, telemetry request bit and 4 bit checksum, most significant bit
+ * first. Ratio 0 is sent as command 0 (motor stop), other ratios are mapped
+ * on the throttle range 48-2047. Where the RMT supports it, the four
+ * channels are started together by a sync manager.
+ */
+
+#include "sdkconfig.h"
+
+#ifdef CONFIG_MOTORS_BACKEND_DSHOT
+
+#include "freertos/FreeRTOS.h"
+#include "driver/rmt_tx.h"
+#include "soc/soc_caps.h"
+
+#include "motors.h"
+#include "motors_backend.h"
+#include "log.h"
+#define DEBUG_MODULE "MOTORS"
+#include "debug_cf.h"
+
+#define DSHOT_RESOLUTION_HZ   40000000
+#define DSHOT_BIT_TICKS       (DSHOT_RESOLUTION_HZ / (CONFIG_MOTORS_DSHOT_RATE * 1000))
+#define DSHOT_BIT1_HIGH_TICKS (DSHOT_BIT_TICKS * 3 / 4)
+#define DSHOT_BIT0_HIGH_TICKS (DSHOT_BIT_TICKS * 3 / 8)
+
+#define DSHOT_CMD_MOTOR_STOP  0
+#define DSHOT_CMD_BEACON1     1
+#define DSHOT_THROTTLE_MIN    48
+#define DSHOT_THROTTLE_MAX    2047
+
+static const int motorsGpio[NBR_OF_MOTORS] = {MOTOR1_GPIO, MOTOR2_GPIO, MOTOR3_GPIO, MOTOR4_GPIO};
+
+static rmt_channel_handle_t channels[NBR_OF_MOTORS];
+static rmt_encoder_handle_t encoder;
+#if SOC_RMT_SUPPORT_TX_SYNCHRO
+static rmt_sync_manager_handle_t synchro;
+#endif
+
+static uint16_t ratios[NBR_OF_MOTORS];
+// Command sent instead of the throttle while beeping, 0 if none
+static uint16_t beepCommands[NBR_OF_MOTORS];
+// Kept until the transmission is done, the RMT reads it on the fly
+static uint8_t frames[NBR_OF_MOTORS][2];
+
+static uint32_t droppedFrames;
+
+static uint16_t dshotValue(uint32_t id)
+{
+    if (beepCommands[id] != 0) {
+        return beepCommands[id];
+    }
+
+    if (ratios[id] == 0) {
+        return DSHOT_CMD_MOTOR_STOP;
+    }
+
+    return DSHOT_THROTTLE_MIN + ((uint32_t)ratios[id] * (DSHOT_THROTTLE_MAX - DSHOT_THROTTLE_MIN)) / UINT16_MAX;
+}
+
+static uint16_t dshotFrame(uint16_t value, bool telemetry)
+{
+    uint16_t packet = (value << 1) | (telemetry ? 1 : 0);
+    uint16_t crc = (packet ^ (packet >> 4) ^ (packet >> 8)) & 0x0f;
+
+    return (packet << 4) | crc;
+}
+
+bool motorsBackendInit(void)
+{
+    for (int id = 0; id < NBR_OF_MOTORS; id++) {
+        rmt_tx_channel_config_t channelConfig = {
+            .gpio_num = motorsGpio[id],
+            .clk_src = RMT_CLK_SRC_DEFAULT,
+            .resolution_hz = DSHOT_RESOLUTION_HZ,
+            .mem_block_symbols = SOC_RMT_MEM_WORDS_PER_CHANNEL,
+            .trans_queue_depth = 1,
+        };
+
+        if (rmt_new_tx_channel(&channelConfig, &channels[id]) != ESP_OK) {
+            DEBUG_PRINT("RMT channel %d allocation failed\n", id);
+            return false;
+        }
+    }
+
+    rmt_bytes_encoder_config_t encoderConfig = {
+        .bit0 = {
+            .level0 = 1,
+            .duration0 = DSHOT_BIT0_HIGH_TICKS,
+            .level1 = 0,
+            .duration1 = DSHOT_BIT_TICKS - DSHOT_BIT0_HIGH_TICKS,
+        },
+        .bit1 = {
+            .level0 = 1,
+            .duration0 = DSHOT_BIT1_HIGH_TICKS,
+            .level1 = 0,
+            .duration1 = DSHOT_BIT_TICKS - DSHOT_BIT1_HIGH_TICKS,
+        },
+        .flags.msb_first = 1,
+    };
+
+    if (rmt_new_bytes_encoder(&encoderConfig, &encoder) != ESP_OK) {
+        DEBUG_PRINT("RMT encoder allocation failed\n");
+        return false;
+    }
+
+    for (int id = 0; id < NBR_OF_MOTORS; id++) {
+        if (rmt_enable(channels[id]) != ESP_OK) {
+            return false;
+        }
+    }
+
+#if SOC_RMT_SUPPORT_TX_SYNCHRO
+    rmt_sync_manager_config_t synchroConfig = {
+        .tx_channel_array = channels,
+        .array_size = NBR_OF_MOTORS,
+    };
+
+    if (rmt_new_sync_manager(&synchroConfig, &synchro) != ESP_OK) {
+        DEBUG_PRINT("RMT sync manager allocation failed\n");
+        return false;
+    }
+#endif
+
+    return true;
+}
+
+void motorsBackendDeInit(void)
+{
+    for (int id = 0; id < NBR_OF_MOTORS; id++) {
+        ratios[id] = 0;
+        beepCommands[id] = 0;
+    }
+
+    motorsBackendUpdate();
+}
+
+void motorsBackendSetRatio(uint32_t id, uint16_t ratio)
+{
+    ratios[id] = ratio;
+}
+
+void motorsBackendUpdate(void)
+{
+    const rmt_transmit_config_t transmitConfig = {
+        .loop_count = 0,
+    };
+
+    // A frame lasts less than 110 us even at DShot150, the previous one is
+    // only still going if the caller is faster than the protocol
+    for (int id = 0; id < NBR_OF_MOTORS; id++) {
+        if (rmt_tx_wait_all_done(channels[id], 0) != ESP_OK) {
+            droppedFrames++;
+            return;
+        }
+    }
+
+#if SOC_RMT_SUPPORT_TX_SYNCHRO
+    rmt_sync_reset(synchro);
+#endif
+
+    for (int id = 0; id < NBR_OF_MOTORS; id++) {
+        uint16_t frame = dshotFrame(dshotValue(id), false);
+
+        frames[id][0] = frame >> 8;
+        frames[id][1] = frame & 0xff;
+        rmt_transmit(channels[id], encoder, frames[id], sizeof(frames[id]), &transmitConfig);
+    }
+}
+
+uint16_t motorsBackendGetRatio(uint32_t id)
+{
+    return ratios[id];
+}
+
+void motorsBackendBeep(uint32_t id, bool enable, uint16_t frequency, uint16_t ratio)
+{
+    // The ESC makes the sound itself, the frequency and ratio do not apply
+    beepCommands[id] = enable ? DSHOT_CMD_BEACON1 : 0;
+    motorsBackendUpdate();
+}
+
+LOG_GROUP_START(dshot)
+LOG_ADD(LOG_UINT32, dropped, &droppedFrames)
+LOG_GROUP_STOP(dshot)
+
+#endif
@@ -0,0 +1,175 @@
+/**
+ *
+ * ESP-Drone Firmware
+ *
+ * Copyright 2019-2020  Espressif Systems (Shanghai)
+ * Copyright (C) 2011-2012 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * motors_ledc.c - Motor output on the LEDC peripheral
+ *
+ */
+
+#include "sdkconfig.h"
+
+#ifdef CONFIG_MOTORS_BACKEND_LEDC
+
+#include "freertos/FreeRTOS.h"
+
+#include "motors.h"
+#include "motors_backend.h"
+
+#define MOTORS_LEDC_FREQ_HZ 15000
+#define MOTORS_LEDC_TIMER   LEDC_TIMER_0
+// A beeping motor is moved over to its own timer, the others keep their PWM
+#define MOTORS_BEEP_TIMER   LEDC_TIMER_2
+#define MOTORS_BEEP_FREQ_HZ 4000
+
+static bool isTimerInit = false;
+
+// Keeps the duty updates of motorsBackendUpdate() in the same PWM period
+static portMUX_TYPE motorsUpdateLock = portMUX_INITIALIZER_UNLOCKED;
+
+ledc_channel_config_t motors_channel[NBR_OF_MOTORS] = {
+    {
+        .channel = MOT_PWM_CH1,
+        .duty = 0,
+        .gpio_num = MOTOR1_GPIO,
+        .speed_mode = LEDC_LOW_SPEED_MODE,
+        .timer_sel = MOTORS_LEDC_TIMER
+    },
+    {
+        .channel = MOT_PWM_CH2,
+        .duty = 0,
+        .gpio_num = MOTOR2_GPIO,
+        .speed_mode = LEDC_LOW_SPEED_MODE,
+        .timer_sel = MOTORS_LEDC_TIMER
+    },
+    {
+        .channel = MOT_PWM_CH3,
+        .duty = 0,
+        .gpio_num = MOTOR3_GPIO,
+        .speed_mode = LEDC_LOW_SPEED_MODE,
+        .timer_sel = MOTORS_LEDC_TIMER
+    },
+    {
+        .channel = MOT_PWM_CH4,
+        .duty = 0,
+        .gpio_num = MOTOR4_GPIO,
+        .speed_mode = LEDC_LOW_SPEED_MODE,
+        .timer_sel = MOTORS_LEDC_TIMER
+    },
+};
+
+static uint16_t motorsConvBitsTo16(uint16_t bits)
+{
+    return ((bits) << (16 - MOTORS_PWM_BITS));
+}
+
+static uint16_t motorsConv16ToBits(uint16_t bits)
+{
+    return ((bits) >> (16 - MOTORS_PWM_BITS) & ((1 << MOTORS_PWM_BITS) - 1));
+}
+
+bool pwm_timmer_init()
+{
+    if (isTimerInit) {
+        // First to init will configure it
+        return TRUE;
+    }
+
+    /*
+     * Prepare and set configuration of timers
+     * that will be used by MOTORS Controller
+     */
+    ledc_timer_config_t ledc_timer = {
+        .duty_resolution = MOTORS_PWM_BITS, // resolution of PWM duty
+        .freq_hz = MOTORS_LEDC_FREQ_HZ,		// frequency of PWM signal
+        .speed_mode = LEDC_LOW_SPEED_MODE, // timer mode
+        .timer_num = MOTORS_LEDC_TIMER,			// timer index
+        // .clk_cfg = LEDC_AUTO_CLK,              // Auto select the source clock
+    };
+    ledc_timer_config_t beep_timer = {
+        .duty_resolution = MOTORS_PWM_BITS,
+        .freq_hz = MOTORS_BEEP_FREQ_HZ,
+        .speed_mode = LEDC_LOW_SPEED_MODE,
+        .timer_num = MOTORS_BEEP_TIMER,
+    };
+
+    // Set configuration of timer0 for high speed channels
+    if (ledc_timer_config(&ledc_timer) == ESP_OK && ledc_timer_config(&beep_timer) == ESP_OK) {
+        isTimerInit = TRUE;
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+bool motorsBackendInit(void)
+{
+    if (pwm_timmer_init() != TRUE) {
+        return false;
+    }
+
+    for (int i = 0; i < NBR_OF_MOTORS; i++) {
+        ledc_channel_config(&motors_channel[i]);
+    }
+
+    return true;
+}
+
+void motorsBackendDeInit(void)
+{
+    for (int i = 0; i < NBR_OF_MOTORS; i++) {
+        ledc_stop(motors_channel[i].speed_mode, motors_channel[i].channel, 0);
+    }
+}
+
+void motorsBackendSetRatio(uint32_t id, uint16_t ratio)
+{
+    ledc_set_duty(motors_channel[id].speed_mode, motors_channel[id].channel, (uint32_t)motorsConv16ToBits(ratio));
+}
+
+void motorsBackendUpdate(void)
+{
+    // The new duties are latched at the end of the current period, update
+    // all channels back to back so they start in the same one
+    portENTER_CRITICAL(&motorsUpdateLock);
+    for (int id = 0; id < NBR_OF_MOTORS; id++) {
+        ledc_update_duty(motors_channel[id].speed_mode, motors_channel[id].channel);
+    }
+    portEXIT_CRITICAL(&motorsUpdateLock);
+}
+
+uint16_t motorsBackendGetRatio(uint32_t id)
+{
+    return motorsConvBitsTo16((uint16_t)ledc_get_duty(motors_channel[id].speed_mode, motors_channel[id].channel));
+}
+
+void motorsBackendBeep(uint32_t id, bool enable, uint16_t frequency, uint16_t ratio)
+{
+    // Retuning the motor timer would change the PWM of all motors, the beeping
+    // ones share the beep timer instead, at the frequency of the last beep
+    if (enable) {
+        ledc_set_freq(LEDC_LOW_SPEED_MODE, MOTORS_BEEP_TIMER, frequency);
+        ledc_bind_channel_timer(motors_channel[id].speed_mode, motors_channel[id].channel, MOTORS_BEEP_TIMER);
+    } else {
+        ledc_bind_channel_timer(motors_channel[id].speed_mode, motors_channel[id].channel, MOTORS_LEDC_TIMER);
+    }
+
+    ledc_set_duty(motors_channel[id].speed_mode, motors_channel[id].channel, (uint32_t)motorsConv16ToBits(ratio));
+    ledc_update_duty(motors_channel[id].speed_mode, motors_channel[id].channel);
+}
+
+#endif
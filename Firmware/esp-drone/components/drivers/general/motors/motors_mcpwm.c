@@ -0,0 +1,162 @@
+/**
+ *
+ * ESP-Drone Firmware
+ *
+ * Copyright 2019-2020  Espressif Systems (Shanghai)
+ * Copyright (C) 2011-2012 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * motors_mcpwm.c - Motor output on the MCPWM peripheral
+ *
+ * All motors run on one MCPWM timer, at a higher resolution than the LEDC
+ * timer: 80 MHz / CONFIG_MOTORS_MCPWM_FREQ_HZ steps, 4000 at 20 kHz. The
+ * four comparators are only reloaded when the timer is back at zero, so the
+ * ratios of motorsBackendUpdate() start together in the same period.
+ */
+
+#include "sdkconfig.h"
+
+#ifdef CONFIG_MOTORS_BACKEND_MCPWM
+
+#include "freertos/FreeRTOS.h"
+#include "driver/mcpwm_prelude.h"
+
+#include "motors.h"
+#include "motors_backend.h"
+#define DEBUG_MODULE "MOTORS"
+#include "debug_cf.h"
+
+#define MOTORS_MCPWM_GROUP          0
+#define MOTORS_MCPWM_RESOLUTION_HZ  80000000
+#define MOTORS_MCPWM_PERIOD_TICKS   (MOTORS_MCPWM_RESOLUTION_HZ / CONFIG_MOTORS_MCPWM_FREQ_HZ)
+
+// Two motors per operator, one comparator and generator each
+#define MOTORS_MCPWM_OPERATORS      (NBR_OF_MOTORS / 2)
+
+static const int motorsGpio[NBR_OF_MOTORS] = {MOTOR1_GPIO, MOTOR2_GPIO, MOTOR3_GPIO, MOTOR4_GPIO};
+
+static mcpwm_timer_handle_t timer;
+static mcpwm_oper_handle_t operators[MOTORS_MCPWM_OPERATORS];
+static mcpwm_cmpr_handle_t comparators[NBR_OF_MOTORS];
+static mcpwm_gen_handle_t generators[NBR_OF_MOTORS];
+static uint32_t compareTicks[NBR_OF_MOTORS];
+
+// Keeps the comparator writes of motorsBackendUpdate() in the same period
+static portMUX_TYPE motorsUpdateLock = portMUX_INITIALIZER_UNLOCKED;
+
+static uint32_t motorsConv16ToTicks(uint16_t ratio)
+{
+    return ((uint32_t)ratio * MOTORS_MCPWM_PERIOD_TICKS) >> 16;
+}
+
+static uint16_t motorsConvTicksTo16(uint32_t ticks)
+{
+    return (ticks << 16) / MOTORS_MCPWM_PERIOD_TICKS;
+}
+
+bool motorsBackendInit(void)
+{
+    mcpwm_timer_config_t timerConfig = {
+        .group_id = MOTORS_MCPWM_GROUP,
+        .clk_src = MCPWM_TIMER_CLK_SRC_DEFAULT,
+        .resolution_hz = MOTORS_MCPWM_RESOLUTION_HZ,
+        .count_mode = MCPWM_TIMER_COUNT_MODE_UP,
+        .period_ticks = MOTORS_MCPWM_PERIOD_TICKS,
+    };
+
+    if (mcpwm_new_timer(&timerConfig, &timer) != ESP_OK) {
+        DEBUG_PRINT("MCPWM timer allocation failed\n");
+        return false;
+    }
+
+    for (int i = 0; i < MOTORS_MCPWM_OPERATORS; i++) {
+        mcpwm_operator_config_t operatorConfig = {
+            .group_id = MOTORS_MCPWM_GROUP,
+        };
+
+        if (mcpwm_new_operator(&operatorConfig, &operators[i]) != ESP_OK ||
+            mcpwm_operator_connect_timer(operators[i], timer) != ESP_OK) {
+            DEBUG_PRINT("MCPWM operator allocation failed\n");
+            return false;
+        }
+    }
+
+    for (int id = 0; id < NBR_OF_MOTORS; id++) {
+        mcpwm_oper_handle_t oper = operators[id / 2];
+        mcpwm_comparator_config_t comparatorConfig = {
+            .flags.update_cmp_on_tez = true,
+        };
+        mcpwm_generator_config_t generatorConfig = {
+            .gen_gpio_num = motorsGpio[id],
+        };
+
+        if (mcpwm_new_comparator(oper, &comparatorConfig, &comparators[id]) != ESP_OK ||
+            mcpwm_new_generator(oper, &generatorConfig, &generators[id]) != ESP_OK) {
+            DEBUG_PRINT("MCPWM output %d allocation failed\n", id);
+            return false;
+        }
+
+        compareTicks[id] = 0;
+        mcpwm_comparator_set_compare_value(comparators[id], 0);
+        // High from the start of the period until the compare value
+        mcpwm_generator_set_action_on_timer_event(generators[id],
+            MCPWM_GEN_TIMER_EVENT_ACTION(MCPWM_TIMER_DIRECTION_UP, MCPWM_TIMER_EVENT_EMPTY, MCPWM_GEN_ACTION_HIGH));
+        mcpwm_generator_set_action_on_compare_event(generators[id],
+            MCPWM_GEN_COMPARE_EVENT_ACTION(MCPWM_TIMER_DIRECTION_UP, comparators[id], MCPWM_GEN_ACTION_LOW));
+    }
+
+    if (mcpwm_timer_enable(timer) != ESP_OK ||
+        mcpwm_timer_start_stop(timer, MCPWM_TIMER_START_NO_STOP) != ESP_OK) {
+        DEBUG_PRINT("MCPWM timer start failed\n");
+        return false;
+    }
+
+    return true;
+}
+
+void motorsBackendDeInit(void)
+{
+    for (int id = 0; id < NBR_OF_MOTORS; id++) {
+        mcpwm_generator_set_force_level(generators[id], 0, true);
+    }
+}
+
+void motorsBackendSetRatio(uint32_t id, uint16_t ratio)
+{
+    compareTicks[id] = motorsConv16ToTicks(ratio);
+}
+
+void motorsBackendUpdate(void)
+{
+    portENTER_CRITICAL(&motorsUpdateLock);
+    for (int id = 0; id < NBR_OF_MOTORS; id++) {
+        mcpwm_comparator_set_compare_value(comparators[id], compareTicks[id]);
+    }
+    portEXIT_CRITICAL(&motorsUpdateLock);
+}
+
+uint16_t motorsBackendGetRatio(uint32_t id)
+{
+    return motorsConvTicksTo16(compareTicks[id]);
+}
+
+void motorsBackendBeep(uint32_t id, bool enable, uint16_t frequency, uint16_t ratio)
+{
+    // Audible frequencies need a longer period than the 16 bit timer allows
+    // at this resolution, only the ratio is applied
+    motorsBackendSetRatio(id, enable ? ratio : 0);
+    motorsBackendUpdate();
+}
+
+#endif
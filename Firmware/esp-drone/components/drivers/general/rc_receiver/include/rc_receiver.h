@@ -0,0 +1,52 @@
+/**
+ *
+ * ESP-Drone Firmware
+ *
+ * Copyright 2019-2020  Espressif Systems (Shanghai)
+ * Copyright (C) 2011-2012 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * rc_receiver.h - Frames of an RC receiver on CONFIG_EXTRX_PIN
+ *
+ * With CONFIG_EXTRX_PPM the RMT captures the pulses of a PPM (CPPM) frame up
+ * to the sync gap and hands the whole frame over at once. With
+ * CONFIG_EXTRX_SBUS a UART receives the inverted 100 kbaud 8E2 frames and
+ * signals at the gap after each frame. Either way the channels are decoded
+ * in one pass, with no interrupt per edge or per byte.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define RC_RECEIVER_MAX_CHANNELS 16
+
+typedef struct {
+    uint16_t channels[RC_RECEIVER_MAX_CHANNELS]; // Pulse widths in us, 1000 to 2000
+    uint8_t count;                               // Channels in the frame
+    bool failsafe;                               // The receiver lost the transmitter
+    uint64_t timestampUs;                        // usecTimestamp() at the end of the frame on the wire
+} rcReceiverFrame_t;
+
+bool rcReceiverInit(void);
+
+/**
+ * Wait for the next frame. Only one task may wait.
+ *
+ * @param frame The decoded frame
+ * @param timeoutMs Time to wait for a frame
+ * @return true if a frame was received
+ */
+bool rcReceiverWaitFrame(rcReceiverFrame_t *frame, uint32_t timeoutMs);
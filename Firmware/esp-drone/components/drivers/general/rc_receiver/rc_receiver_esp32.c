@@ -0,0 +1,260 @@
+/**
+ *
+ * ESP-Drone Firmware
+ *
+ * Copyright 2019-2020  Espressif Systems (Shanghai)
+ * Copyright (C) 2011-2012 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * rc_receiver_esp32.c - PPM capture on the RMT, SBUS on a UART
+ */
+
+#include "sdkconfig.h"
+
+#ifdef CONFIG_EXTRX
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#ifdef CONFIG_EXTRX_PPM
+#include "driver/rmt_rx.h"
+#include "soc/soc_caps.h"
+#else
+#include "driver/uart.h"
+#endif
+
+#include "rc_receiver.h"
+#include "usec_time.h"
+#include "cf_math.h"
+#include "stm32_legacy.h"
+#define DEBUG_MODULE "RCRX"
+#include "debug_cf.h"
+
+#define RC_PULSE_MIN_US 800
+#define RC_PULSE_MAX_US 2200
+
+#ifdef CONFIG_EXTRX_PPM
+
+#define PPM_RESOLUTION_HZ 1000000
+// Shorter pulses are glitches, the RMT filter takes up to about 3 us
+#define PPM_GLITCH_NS     2000
+// Longer than any channel: the sync gap, the RMT ends the frame there
+#define PPM_SYNC_GAP_US   3000
+
+typedef struct {
+    size_t count;
+    uint64_t timestampUs;
+} ppmEvent_t;
+
+static rmt_channel_handle_t ppmChannel;
+static xQueueHandle ppmQueue;
+// Written by the RMT until the frame is done, read before the next receive
+static rmt_symbol_word_t ppmSymbols[SOC_RMT_MEM_WORDS_PER_CHANNEL];
+static uint8_t ppmLastCount;
+
+static const rmt_receive_config_t ppmReceiveConfig = {
+    .signal_range_min_ns = PPM_GLITCH_NS,
+    .signal_range_max_ns = PPM_SYNC_GAP_US * 1000,
+};
+
+static bool IRAM_ATTR ppmRxDone(rmt_channel_handle_t channel, const rmt_rx_done_event_data_t *edata, void *userCtx)
+{
+    BaseType_t woken = pdFALSE;
+    const ppmEvent_t event = {
+        .count = edata->num_symbols,
+        .timestampUs = usecTimestamp(),
+    };
+
+    xQueueSendFromISR(ppmQueue, &event, &woken);
+    return woken == pdTRUE;
+}
+
+bool rcReceiverInit(void)
+{
+    rmt_rx_channel_config_t channelConfig = {
+        .gpio_num = CONFIG_EXTRX_PIN,
+        .clk_src = RMT_CLK_SRC_DEFAULT,
+        .resolution_hz = PPM_RESOLUTION_HZ,
+        .mem_block_symbols = SOC_RMT_MEM_WORDS_PER_CHANNEL,
+    };
+
+    if (rmt_new_rx_channel(&channelConfig, &ppmChannel) != ESP_OK) {
+        DEBUG_PRINT("RMT RX channel allocation failed\n");
+        return false;
+    }
+
+    ppmQueue = xQueueCreate(1, sizeof(ppmEvent_t));
+
+    const rmt_rx_event_callbacks_t callbacks = {
+        .on_recv_done = ppmRxDone,
+    };
+
+    if (rmt_rx_register_event_callbacks(ppmChannel, &callbacks, NULL) != ESP_OK ||
+        rmt_enable(ppmChannel) != ESP_OK ||
+        rmt_receive(ppmChannel, ppmSymbols, sizeof(ppmSymbols), &ppmReceiveConfig) != ESP_OK) {
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Every pulse starts a symbol, a channel is the time from one pulse to the
+ * next whatever the polarity. The last pulse only ends the last channel.
+ */
+static bool ppmDecode(size_t count, rcReceiverFrame_t *frame)
+{
+    if (count < 2 || count - 1 > RC_RECEIVER_MAX_CHANNELS) {
+        return false;
+    }
+
+    frame->count = count - 1;
+    for (int i = 0; i < frame->count; i++) {
+        const uint16_t width = ppmSymbols[i].duration0 + ppmSymbols[i].duration1;
+        if (width < RC_PULSE_MIN_US || width > RC_PULSE_MAX_US) {
+            return false;
+        }
+        frame->channels[i] = width;
+    }
+    frame->failsafe = false;
+
+    // The capture may have started within a frame, only take a frame as long as the last
+    const bool isComplete = frame->count == ppmLastCount;
+    ppmLastCount = frame->count;
+    return isComplete;
+}
+
+bool rcReceiverWaitFrame(rcReceiverFrame_t *frame, uint32_t timeoutMs)
+{
+    ppmEvent_t event;
+
+    if (xQueueReceive(ppmQueue, &event, M2T(timeoutMs)) != pdTRUE) {
+        return false;
+    }
+
+    const bool isValid = ppmDecode(event.count, frame);
+    frame->timestampUs = event.timestampUs - PPM_SYNC_GAP_US;
+
+    rmt_receive(ppmChannel, ppmSymbols, sizeof(ppmSymbols), &ppmReceiveConfig);
+
+    return isValid;
+}
+
+#else // CONFIG_EXTRX_SBUS
+
+#define SBUS_UART             UART_NUM_1
+#define SBUS_BAUDRATE         100000
+#define SBUS_FRAME_SIZE       25
+#define SBUS_HEADER           0x0f
+#define SBUS_FLAG_FAILSAFE    0x08
+#define SBUS_CHANNELS         16
+// One byte is 12 bits at 100 kbaud, the UART signals after this many idle bytes
+#define SBUS_BYTE_US          120
+#define SBUS_RX_TIMEOUT_BYTES 3
+#define SBUS_RX_BUFFER_SIZE   256
+
+static xQueueHandle sbusQueue;
+static uint8_t sbusBuffer[SBUS_RX_BUFFER_SIZE];
+
+bool rcReceiverInit(void)
+{
+    const uart_config_t uartConfig = {
+        .baud_rate = SBUS_BAUDRATE,
+        .data_bits = UART_DATA_8_BITS,
+        .parity = UART_PARITY_EVEN,
+        .stop_bits = UART_STOP_BITS_2,
+        .flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
+        .source_clk = UART_SCLK_DEFAULT,
+    };
+
+    if (uart_driver_install(SBUS_UART, SBUS_RX_BUFFER_SIZE, 0, 8, &sbusQueue, 0) != ESP_OK ||
+        uart_param_config(SBUS_UART, &uartConfig) != ESP_OK ||
+        uart_set_pin(SBUS_UART, UART_PIN_NO_CHANGE, CONFIG_EXTRX_PIN, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE) != ESP_OK) {
+        DEBUG_PRINT("SBUS UART setup failed\n");
+        return false;
+    }
+
+    // SBUS idles low, and a whole frame is in the FIFO by the time the gap after it is seen
+    uart_set_line_inverse(SBUS_UART, UART_SIGNAL_RXD_INV);
+    uart_set_rx_full_threshold(SBUS_UART, SBUS_FRAME_SIZE + 8);
+    uart_set_rx_timeout(SBUS_UART, SBUS_RX_TIMEOUT_BYTES);
+
+    return true;
+}
+
+static uint16_t sbusToUs(uint16_t value)
+{
+    // 172 to 1811, 992 in the middle, is 1000 to 2000 us
+    return 880 + (value * 5) / 8;
+}
+
+/**
+ * 16 channels of 11 bits, least significant bit first, then the flags
+ */
+static void sbusDecode(const uint8_t *data, rcReceiverFrame_t *frame)
+{
+    uint32_t bits = 0;
+    int bitCount = 0;
+    int channel = 0;
+
+    for (int i = 1; i < 23; i++) {
+        bits |= (uint32_t)data[i] << bitCount;
+        bitCount += 8;
+        if (bitCount >= 11) {
+            frame->channels[channel++] = sbusToUs(bits & 0x7ff);
+            bits >>= 11;
+            bitCount -= 11;
+        }
+    }
+
+    frame->count = SBUS_CHANNELS;
+    frame->failsafe = (data[23] & SBUS_FLAG_FAILSAFE) != 0;
+}
+
+bool rcReceiverWaitFrame(rcReceiverFrame_t *frame, uint32_t timeoutMs)
+{
+    const TickType_t start = xTaskGetTickCount();
+
+    while (true) {
+        const TickType_t elapsed = xTaskGetTickCount() - start;
+        uart_event_t event;
+
+        if (elapsed >= M2T(timeoutMs) || xQueueReceive(sbusQueue, &event, M2T(timeoutMs) - elapsed) != pdTRUE) {
+            return false;
+        }
+
+        if (event.type == UART_FIFO_OVF || event.type == UART_BUFFER_FULL) {
+            uart_flush_input(SBUS_UART);
+            xQueueReset(sbusQueue);
+            continue;
+        }
+        if (event.type != UART_DATA) {
+            continue;
+        }
+
+        // An event has the bytes since the last gap, a frame is all of them
+        const uint64_t now = usecTimestamp();
+        const int count = uart_read_bytes(SBUS_UART, sbusBuffer, MIN(event.size, sizeof(sbusBuffer)), 0);
+        if (count != SBUS_FRAME_SIZE || sbusBuffer[0] != SBUS_HEADER) {
+            continue;
+        }
+
+        sbusDecode(sbusBuffer, frame);
+        frame->timestampUs = now - SBUS_RX_TIMEOUT_BYTES * SBUS_BYTE_US;
+        return true;
+    }
+}
+
+#endif // CONFIG_EXTRX_PPM
+
+#endif // CONFIG_EXTRX
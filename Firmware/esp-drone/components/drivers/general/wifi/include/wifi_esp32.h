@@ -4,6 +4,52 @@
 #include <stdint.h>
 
 #define WIFI_RX_TX_PACKET_SIZE   (64)
+#define WIFI_RX_POOL_SIZE        (16) // Must be a power of 2
+
+/*
+ * Link control datagrams use the CRTP null packet header, which is never
+ * used for data. A client asks for batched mode by sending
+ * [WIFI_CTRL_HEADER][WIFI_CTRL_BATCH][1][cksum], [..][0][cksum] turns it off.
+ * The request is answered with the same three bytes. Any other null packet,
+ * e.g. the connect and disconnect packets of cflib, turns batched mode off.
+ * Batched mode is set per client address.
+ *
+ * In batched mode every datagram sent to the client is
+ * [WIFI_CTRL_HEADER][WIFI_CTRL_BATCH][len][CRTP packet]...[len][CRTP packet][cksum]
+ * where len is the size of the CRTP packet including its header.
+ *
+ * A client measures the round trip time with
+ * [WIFI_CTRL_HEADER][WIFI_CTRL_ECHO][payload][cksum], which is answered with
+ * [WIFI_CTRL_HEADER][WIFI_CTRL_ECHO][payload][drone time][cksum], the drone time
+ * is a little endian uint32 in us. The payload is at most
+ * WIFI_CTRL_ECHO_MAX_PAYLOAD bytes.
+ *
+ * A client that got an echo answer may number its datagrams:
+ * [WIFI_CTRL_HEADER][WIFI_CTRL_SEQ][seq][CRTP packet][cksum], where seq counts
+ * up by one per datagram and wraps. The CRTP packet is handled as if it came
+ * alone, the numbers are only used for the loss instrumentation.
+ * Neither of them changes the batched mode.
+ *
+ * A client asks for large frames with
+ * [WIFI_CTRL_HEADER][WIFI_CTRL_LARGE][max:2][cksum], answered with
+ * [WIFI_CTRL_HEADER][WIFI_CTRL_LARGE][accepted:2][cksum], both little endian
+ * sizes of CRTP data. From then on the drone may answer the client with
+ * datagrams of up to accepted bytes of data, [CRTP header][data][cksum],
+ * which are never batched. 0 is accepted without CONFIG_CRTP_LARGE_FRAMES, or
+ * when the client asks for 0, the datagrams stay at CRTP_MAX_DATA_SIZE then.
+ * Like the batched mode the large frames end with the session, or with any
+ * other link control datagram but the echo and the sequence numbers.
+ *
+ * The cksum is the byte sum of the datagram before it. With
+ * CONFIG_WIFI_LINK_CRC32 it is instead the CRC-32 of those bytes, 4 bytes
+ * little endian, both ways.
+ */
+#define WIFI_CTRL_HEADER         (0xFF)
+#define WIFI_CTRL_BATCH          (0x42)
+#define WIFI_CTRL_ECHO           (0x45)
+#define WIFI_CTRL_SEQ            (0x53)
+#define WIFI_CTRL_LARGE          (0x4C)
+#define WIFI_CTRL_ECHO_MAX_PAYLOAD  (24)
 
 /* Structure used for in/out data via USB */
 typedef struct
@@ -34,12 +80,57 @@ bool wifiTest(void);
 //struct crtpLinkOperations * wifiGetLink();
 
 /**
- * Get data from rx queue with timeout.
- * @param[out] c  Byte of data
+ * Get the next received packet from the rx queue, without copying it. The
+ * packet belongs to the caller until it is handed back with wifiReleasePacket().
+ * @param[in] timeout  Ticks to wait for a packet
+ *
+ * @return The packet, or NULL if the timeout was reached.
+ */
+UDPPacket *wifiGetPacketWait(uint32_t timeout);
+
+/**
+ * Hand a packet from wifiGetPacketWait() back to the rx pool. The pool is a
+ * single producer ring, packets must always be released from the same task.
+ * @param[in] packet  The packet to release
+ */
+void wifiReleasePacket(UDPPacket *packet);
+
+/**
+ * Called by the UDP receive task for every valid packet before it is queued
+ * for wifiGetPacketWait(). Must not block.
+ *
+ * @return true if the packet was consumed, it is not queued then
+ */
+typedef bool (*wifiRxHook_t)(UDPPacket *packet);
+
+/**
+ * Set the receive hook, NULL to queue all packets.
+ */
+void wifiSetRxHook(wifiRxHook_t hook);
+
+/**
+ * @return The largest CRTP data the session of the last request accepts in
+ *         one datagram, CRTP_MAX_DATA_SIZE if it did not ask for large frames
+ */
+uint16_t wifiGetMaxDataSize(void);
+
+/**
+ * Sends a large frame to the session of the last request, from the calling
+ * task. With CONFIG_CRTP_LARGE_FRAMES only.
+ *
+ * @return false if the session does not accept frames that large
+ */
+bool wifiSendLargeData(uint8_t header, const uint8_t *data, uint16_t size);
+
+/**
+ * Sends a CRTP packet to the sessions it is routed to, see wifi_esp32.c. The
+ * header and the data are copied straight into the datagram. With
+ * CONFIG_WIFI_DIRECT_TX it is sent from the calling task, which must be the
+ * only one, unless its sessions batch; otherwise it is queued for the TX task.
  *
- * @return true if byte received, false if timout reached.
+ * @return false if it was not taken and should be sent again
  */
-bool wifiGetDataBlocking(UDPPacket *in);
+bool wifiSendPacket(uint8_t header, const uint8_t *data, uint8_t size);
 
 /**
  * Sends raw data using a lock. Should be used from
@@ -0,0 +1,30 @@
+#ifndef WIFI_LINK_QUALITY_H_
+#define WIFI_LINK_QUALITY_H_
+#include <stdint.h>
+
+/*
+ * Receive statistics of the UDP link, exported in the wifiLink log group:
+ * the interarrival time of the datagrams from the client and its jitter, the
+ * loss seen in the sequence numbers of the client (WIFI_CTRL_SEQ) and the
+ * RSSI of the station. The functions are called by the UDP receive task only.
+ */
+
+/**
+ * Account a datagram with a valid checksum.
+ *
+ * @param timestampUs Time it was received, usecTimestamp()
+ */
+void wifiLinkQualityRx(int64_t timestampUs);
+
+/**
+ * Account the sequence number of a datagram. Numbers that are skipped count
+ * as lost, a number from before the last one as out of order.
+ */
+void wifiLinkQualitySequence(uint8_t sequence);
+
+/**
+ * Account an echo request that was answered.
+ */
+void wifiLinkQualityEcho(void);
+
+#endif
@@ -3,6 +3,7 @@
 #include "config.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/semphr.h"
 
 #include "esp_system.h"
 #include "esp_wifi.h"
@@ -12,17 +13,42 @@
 #include "lwip/sockets.h"
 #include "lwip/sys.h"
 #include <lwip/netdb.h>
+#ifdef CONFIG_WIFI_STATION
+#include "mdns.h"
+#endif
 
+#include "cfassert.h"
+#include "crc.h"
+#include "crtp.h"
+#include "log.h"
 #include "queuemonitor.h"
+#include "spsc_ring.h"
+#include "static_mem.h"
 #include "wifi_esp32.h"
+#include "wifi_link_quality.h"
 #include "stm32_legacy.h"
+#include "sysview_markers.h"
+#include "usec_time.h"
 #define DEBUG_MODULE  "WIFI_UDP"
 #include "debug_cf.h"
 
 #define UDP_SERVER_PORT         2390
-#define UDP_SERVER_BUFSIZE      128
+#define UDP_SERVER_BUFSIZE      512 // Largest datagram sent, a full batch
+#define UDP_TX_BATCH_TIMEOUT_MS 5   // Max time a packet waits for a batch to fill
+#define UDP_LARGE_TX_TIMEOUT_MS 20  // Max time a large frame waits for the one before
 
-static struct sockaddr_in6 source_addr; // Large enough for both IPv4 or IPv6
+#ifdef CONFIG_CRTP_LARGE_FRAMES
+#define WIFI_LARGE_MAX_DATA_SIZE CRTP_LARGE_MAX_DATA_SIZE
+#else
+#define WIFI_LARGE_MAX_DATA_SIZE 0
+#endif
+
+// The check that ends every datagram, see udp_cksum_write()
+#ifdef CONFIG_WIFI_LINK_CRC32
+#define UDP_CKSUM_SIZE          4
+#else
+#define UDP_CKSUM_SIZE          1
+#endif
 
 //#define WIFI_SSID      "Udp Server"
 static char WIFI_SSID[32] = "ESP-DRONE";
@@ -30,12 +56,112 @@ static char WIFI_PWD[64] = "12345678" ;
 static uint8_t WIFI_CH = 1;
 #define MAX_STA_CONN (3)
 
+#ifdef CONFIG_WIFI_STATION
+#define WIFI_LINK_IF WIFI_IF_STA
+#else
+#define WIFI_LINK_IF WIFI_IF_AP
+#endif
+
+/*
+ * The radio settings of the link, CONFIG_WIFI_LINK_PROFILE_* picks one. The
+ * default one leaves the radio as the IDF sets it up. The low latency one
+ * keeps the radio awake and on 20 MHz channels, and sends from a short TX
+ * queue: a packet that waited for long is dropped rather than sent late. The
+ * long range one adds the ESP32 long range mode next to 802.11b/g/n, sends at
+ * the lowest 802.11b rate with the highest power and keeps a longer TX queue.
+ * The wifiLink log group shows the effect on the packets from the client,
+ * wifiPhy what was applied.
+ */
+typedef struct {
+    const char *name;
+    bool isSet;                 // Else the IDF defaults
+    wifi_ps_type_t powerSave;
+    wifi_bandwidth_t bandwidth;
+    uint8_t protocols;
+    bool isFixedRate;
+    wifi_phy_rate_t txRate;
+    int8_t maxTxPower;          // 0.25 dBm, 0 for the default
+    uint16_t inactiveTimeS;     // A silent peer is given up on after this
+} wifiLinkProfile_t;
+
+#if defined(CONFIG_WIFI_LINK_PROFILE_LOW_LATENCY)
+// UDP packets waiting to be sent, the queue is allocated at build time
+#define WIFI_TX_QUEUE_SIZE 8
+static const wifiLinkProfile_t linkProfile = {
+    .name = "low latency",
+    .isSet = true,
+    .powerSave = WIFI_PS_NONE,
+    .bandwidth = WIFI_BW_HT20,
+    .protocols = WIFI_PROTOCOL_11B | WIFI_PROTOCOL_11G | WIFI_PROTOCOL_11N,
+    .isFixedRate = false,
+    .inactiveTimeS = 10,
+};
+#elif defined(CONFIG_WIFI_LINK_PROFILE_LONG_RANGE)
+#define WIFI_TX_QUEUE_SIZE 32
+static const wifiLinkProfile_t linkProfile = {
+    .name = "long range",
+    .isSet = true,
+    .powerSave = WIFI_PS_NONE,
+    .bandwidth = WIFI_BW_HT20,
+    .protocols = WIFI_PROTOCOL_11B | WIFI_PROTOCOL_11G | WIFI_PROTOCOL_11N | WIFI_PROTOCOL_LR,
+    .isFixedRate = true,
+    .txRate = WIFI_PHY_RATE_1M_L,
+    .maxTxPower = 84,
+    .inactiveTimeS = 60,
+};
+#else
+#define WIFI_TX_QUEUE_SIZE 16
+static const wifiLinkProfile_t linkProfile = {
+    .name = "default",
+    .isSet = false,
+};
+#endif
+
+static uint8_t appliedBandwidth;
+static int8_t appliedTxPower;
+
+/*
+ * Every client address has a session. The first client is the pilot, the
+ * only one whose setpoints are used, the others are observers, e.g. a
+ * telemetry logger next to the pilot app. When the pilot was silent for
+ * WIFI_SESSION_TIMEOUT_MS the next client that sends takes over.
+ *
+ * Each session has WIFI_SESSION_LOG_IDS log block ids of its own: the ids of
+ * session i are offset by i * WIFI_SESSION_LOG_IDS on the way in and back on
+ * the way out, so the log data and the log control answers go to the session
+ * of the block only, and a log reset of a client only deletes its own blocks.
+ * For the first client the offset is 0. Console packets go to all sessions,
+ * any other packet to the session that sent the last request.
+ */
+#define WIFI_MAX_SESSIONS         MAX_STA_CONN
+#define WIFI_SESSION_TIMEOUT_MS   3000
+#define WIFI_SESSION_LOG_IDS      64
+#define WIFI_SESSION_NONE         0xFF
+
+// Log port channels and the reset command, matches log.c
+#define WIFI_LOG_CONTROL_CH       1
+#define WIFI_LOG_DATA_CH          2
+#define WIFI_LOG_CONTROL_RESET    5
+
+typedef struct {
+    struct sockaddr_in addr;
+    TickType_t lastRxTick;
+    bool isActive;          // Written by the RX task, read by the TX task
+    bool isBatchMode;
+    uint16_t maxDataSize;   // Of the large frames, 0 if the client asked for none
+} wifiSession_t;
+
+// The TX queue routes a packet to the sessions in the mask, 0 to route by its content
+typedef struct {
+    UDPPacket packet;
+    uint8_t sessions;
+} udpTxItem_t;
+
 #ifndef MAC2STR
 #define MAC2STR(a) (a)[0], (a)[1], (a)[2], (a)[3], (a)[4], (a)[5]
 #define MACSTR "%02x:%02x:%02x:%02x:%02x:%02x"
 #endif
 
-static char rx_buffer[UDP_SERVER_BUFSIZE];
 static char tx_buffer[UDP_SERVER_BUFSIZE];
 const int addr_family = (int)AF_INET;
 const int ip_protocol = IPPROTO_IP;
@@ -43,27 +169,129 @@ static struct sockaddr_in dest_addr;
 static int sock;
 
 static xQueueHandle udpDataRx;
+STATIC_MEM_QUEUE_ALLOC(udpDataRx, WIFI_RX_POOL_SIZE, sizeof(UDPPacket *)); /* Pointers into rxPool */
 static xQueueHandle udpDataTx;
-static UDPPacket inPacket;
-static UDPPacket outPacket;
+STATIC_MEM_QUEUE_ALLOC(udpDataTx, WIFI_TX_QUEUE_SIZE, sizeof(udpTxItem_t)); /* Buffer packets (max 64 bytes) and their sessions */
+
+STATIC_MEM_TASK_ALLOC(udpTxTask, UDP_TX_TASK_STACKSIZE);
+STATIC_MEM_TASK_ALLOC(udpRxTask, UDP_RX_TASK_STACKSIZE);
+
+// Received packets stay in the pool, only pointers are passed on. The
+// receiver hands them back through rxFreeRing.
+static UDPPacket rxPool[WIFI_RX_POOL_SIZE];
+SPSC_RING_ALLOC(rxFreeRing, WIFI_RX_POOL_SIZE, sizeof(UDPPacket *));
+static udpTxItem_t outItem;
+
+static wifiSession_t sessions[WIFI_MAX_SESSIONS];
+static uint8_t pilotSession = WIFI_SESSION_NONE;     // RX task only
+static volatile uint8_t replySession;
+
+static uint8_t sessionCount;
+static uint32_t sessionRejectedCount;
+static uint32_t observerDroppedCount;
+static uint32_t fanoutCount;
+
+static uint8_t rxBurstMax;
+static uint32_t rxPoolEmptyCount;
 
 static bool isInit = false;
 static bool isUDPInit = false;
 static bool isUDPConnected = false;
+static volatile wifiRxHook_t rxHook;
+static size_t batchLen = 0;
+static uint8_t batchSessions;
+static TickType_t batchStartTick;
+
+#ifdef CONFIG_WIFI_DIRECT_TX
+// The packet the CRTP TX task is sending, and its check, see wifiSendPacket()
+static UDPPacket directTxPacket;
+static uint32_t directTxCount;
+static uint32_t directTxFailCount;
+#endif
+
+#ifdef CONFIG_CRTP_LARGE_FRAMES
+// Header, data and check of a large frame, sent by the tasks of the services
+static uint8_t largeTxBuffer[1 + CRTP_LARGE_MAX_DATA_SIZE + UDP_CKSUM_SIZE];
+static SemaphoreHandle_t largeTxMutex;
+static StaticSemaphore_t largeTxMutexBuffer;
+#endif
 
 static esp_err_t udp_server_create(void *arg);
+static uint8_t sessionRoute(UDPPacket *packet);
+static bool udp_is_batched(uint8_t mask);
+static bool udp_send_datagram(uint8_t *datagram, size_t len, uint8_t mask);
 
-static uint8_t calculate_cksum(void *data, size_t len)
+#ifndef CONFIG_WIFI_LINK_CRC32
+/*
+ * The byte sum of the data, a word at a time. The bytes of a word are added
+ * in two 16 bit lanes, which take 128 words before they can overflow. Only
+ * the low byte of the total matters, so the lanes are folded after each
+ * round of 128 words.
+ */
+static uint8_t calculate_cksum(const void *data, size_t len)
 {
-    unsigned char *c = data;
-    int i;
-    unsigned char cksum = 0;
+    const uint8_t *c = data;
+    uint32_t cksum = 0;
+
+    while (len >= sizeof(uint32_t)) {
+        size_t words = len / sizeof(uint32_t);
+        uint32_t lanes = 0;
 
-    for (i = 0; i < len; i++) {
+        if (words > 128) {
+            words = 128;
+        }
+        len -= words * sizeof(uint32_t);
+        for (; words > 0; words--) {
+            uint32_t word;
+
+            memcpy(&word, c, sizeof(word)); // Any alignment
+            lanes += (word & 0x00FF00FF) + ((word >> 8) & 0x00FF00FF);
+            c += sizeof(word);
+        }
+        cksum += (lanes & 0xFFFF) + (lanes >> 16);
+    }
+
+    while (len > 0) {
         cksum += *(c++);
+        len--;
     }
 
-    return cksum;
+    return (uint8_t)cksum;
+}
+#endif
+
+/*
+ * Writes the check of the len bytes of the datagram after them: the byte sum,
+ * or with CONFIG_WIFI_LINK_CRC32 their CRC-32, little endian.
+ */
+static void udp_cksum_write(void *datagram, size_t len)
+{
+    uint8_t *check = (uint8_t *)datagram + len;
+
+#ifdef CONFIG_WIFI_LINK_CRC32
+    const uint32_t crc = crc32Update(0, datagram, len);
+
+    check[0] = crc;
+    check[1] = crc >> 8;
+    check[2] = crc >> 16;
+    check[3] = crc >> 24;
+#else
+    check[0] = calculate_cksum(datagram, len);
+#endif
+}
+
+/* True if the check after the len bytes of the datagram matches them */
+static bool udp_cksum_is_valid(const void *datagram, size_t len)
+{
+    const uint8_t *check = (const uint8_t *)datagram + len;
+
+#ifdef CONFIG_WIFI_LINK_CRC32
+    const uint32_t crc = check[0] | (check[1] << 8) | (check[2] << 16) | ((uint32_t)check[3] << 24);
+
+    return crc == crc32Update(0, datagram, len);
+#else
+    return check[0] == calculate_cksum(datagram, len);
+#endif
 }
 
 static void wifi_event_handler(void *arg, esp_event_base_t event_base,
@@ -76,7 +304,16 @@ static void wifi_event_handler(void *arg, esp_event_base_t event_base,
     } else if (event_id == WIFI_EVENT_AP_STADISCONNECTED) {
         wifi_event_ap_stadisconnected_t *event = (wifi_event_ap_stadisconnected_t *) event_data;
         DEBUG_PRINT_LOCAL("station" MACSTR "leave, AID=%d", MAC2STR(event->mac), event->aid);
-    } 
+    }
+#ifdef CONFIG_WIFI_STATION
+    else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
+        // The access point may come back or another one of the network take over
+        esp_wifi_connect();
+    } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
+        ip_event_got_ip_t *event = (ip_event_got_ip_t *) event_data;
+        DEBUG_PRINT_LOCAL("got ip " IPSTR, IP2STR(&event->ip_info.ip));
+    }
+#endif
 }
 
 bool wifiTest(void)
@@ -84,25 +321,298 @@ bool wifiTest(void)
     return isInit;
 };
 
-bool wifiGetDataBlocking(UDPPacket *in)
+UDPPacket *wifiGetPacketWait(uint32_t timeout)
 {
+    UDPPacket *packet;
+
     /* command step - receive  02  from udp rx queue */
-    while (xQueueReceive(udpDataRx, in, portMAX_DELAY) != pdTRUE) {
-        vTaskDelay(1);
-    }; // Don't return until we get some data on the UDP
+    BaseType_t result = xQueueReceive(udpDataRx, &packet, timeout);
+    queueMonitorReceived(qmUdpRx, result);
+    if (result != pdTRUE) {
+        return NULL;
+    }
+
+    return packet;
+}
+
+void wifiReleasePacket(UDPPacket *packet)
+{
+    spscRingPush(&rxFreeRing, &packet);
+}
+
+void wifiSetRxHook(wifiRxHook_t hook)
+{
+    rxHook = hook;
+}
+
+uint16_t wifiGetMaxDataSize(void)
+{
+    const uint16_t size = sessions[replySession].maxDataSize;
+
+    return size > CRTP_MAX_DATA_SIZE ? size : CRTP_MAX_DATA_SIZE;
+}
+
+#ifdef CONFIG_CRTP_LARGE_FRAMES
+bool wifiSendLargeData(uint8_t header, const uint8_t *data, uint16_t size)
+{
+    const uint8_t session = replySession;
+    bool isSent = false;
+
+    if (!isUDPInit || size > sessions[session].maxDataSize ||
+        !__atomic_load_n(&sessions[session].isActive, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+
+    if (xSemaphoreTake(largeTxMutex, M2T(UDP_LARGE_TX_TIMEOUT_MS)) != pdTRUE) {
+        return false;
+    }
+
+    largeTxBuffer[0] = header;
+    memcpy(&largeTxBuffer[1], data, size);
+    udp_cksum_write(largeTxBuffer, 1 + size);
+
+    // Not batched and not through the TX queue, lwIP serializes the sends
+    const struct sockaddr_in addr = sessions[session].addr;
+    isSent = sendto(sock, largeTxBuffer, 1 + size + UDP_CKSUM_SIZE, 0, (struct sockaddr *)&addr, sizeof(addr)) >= 0;
+    xSemaphoreGive(largeTxMutex);
+
+    if (!isSent) {
+        DEBUG_PRINT_LOCAL("Error occurred during sending: errno %d", errno);
+    }
+    return isSent;
+}
+#endif
+
+bool wifiSendPacket(uint8_t header, const uint8_t *data, uint8_t size)
+{
+#ifdef CONFIG_WIFI_DIRECT_TX
+    UDPPacket *packet = &directTxPacket;
+#else
+    static udpTxItem_t outStage;
+    UDPPacket *packet = &outStage.packet;
+#endif
 
+    packet->size = 1 + size;
+    packet->data[0] = header;
+    memcpy(&packet->data[1], data, size);
+
+#ifdef CONFIG_WIFI_DIRECT_TX
+    if (!isUDPConnected) {
+        // No client yet, dropped as by the TX task
+        return true;
+    }
+
+    // The log ids are moved back to the session here, the packet is routed once
+    const uint8_t mask = sessionRoute(packet);
+    if (mask == 0) {
+        return true;
+    }
+
+    if (udp_is_batched(mask)) {
+        // The TX task fills and flushes the batches
+        udpTxItem_t item = {.packet = *packet, .sessions = mask};
+        BaseType_t result = xQueueSend(udpDataTx, &item, 0);
+
+        queueMonitorSent(qmUdpTx, udpDataTx, result);
+        return (result == pdTRUE);
+    }
+
+    // A batch of the TX task that is still open may be sent after this packet
+    if (!udp_send_datagram(packet->data, packet->size, mask)) {
+        directTxFailCount++;
+        return false;
+    }
+    directTxCount++;
     return true;
-};
+#else
+    outStage.sessions = 0;
+    // Dont' block when sending, the CRTP TX task retries and may send a more urgent packet first
+    BaseType_t result = xQueueSend(udpDataTx, &outStage, 0);
+    queueMonitorSent(qmUdpTx, udpDataTx, result);
+    return (result == pdTRUE);
+#endif
+}
 
 bool wifiSendData(uint32_t size, uint8_t *data)
 {
-    static UDPPacket outStage;
-    outStage.size = size;
-    memcpy(outStage.data, data, size);
-    // Dont' block when sending
-    return (xQueueSend(udpDataTx, &outStage, M2T(100)) == pdTRUE);
+    static udpTxItem_t outStage;
+    outStage.packet.size = size;
+    memcpy(outStage.packet.data, data, size);
+    outStage.sessions = 0;
+    // Dont' block when sending, the CRTP TX task retries and may send a more urgent packet first
+    BaseType_t result = xQueueSend(udpDataTx, &outStage, 0);
+    queueMonitorSent(qmUdpTx, udpDataTx, result);
+    return (result == pdTRUE);
 };
 
+static bool isSessionExpired(const wifiSession_t *session, TickType_t now)
+{
+    return !session->isActive || now - session->lastRxTick > M2T(WIFI_SESSION_TIMEOUT_MS);
+}
+
+/* The session of a client, a new one if it has none. Returns WIFI_SESSION_NONE if all are taken. */
+static uint8_t sessionOf(const struct sockaddr_in *from, TickType_t now)
+{
+    uint8_t found = WIFI_SESSION_NONE;
+    uint8_t expired = WIFI_SESSION_NONE;
+
+    for (uint8_t i = 0; i < WIFI_MAX_SESSIONS; i++) {
+        const wifiSession_t *session = &sessions[i];
+
+        if (session->isActive && session->addr.sin_addr.s_addr == from->sin_addr.s_addr &&
+            session->addr.sin_port == from->sin_port) {
+            found = i;
+            break;
+        }
+        if (expired == WIFI_SESSION_NONE && isSessionExpired(session, now)) {
+            expired = i;
+        }
+    }
+
+    if (found == WIFI_SESSION_NONE) {
+        if (expired == WIFI_SESSION_NONE) {
+            sessionRejectedCount++;
+            return WIFI_SESSION_NONE;
+        }
+
+        // Hidden from the TX task while the address changes
+        found = expired;
+        __atomic_store_n(&sessions[found].isActive, false, __ATOMIC_RELEASE);
+        sessions[found].addr = *from;
+        sessions[found].isBatchMode = false;
+        sessions[found].maxDataSize = 0;
+        __atomic_store_n(&sessions[found].isActive, true, __ATOMIC_RELEASE);
+        DEBUG_PRINT_LOCAL("session %d started", found);
+    }
+
+    sessions[found].lastRxTick = now;
+
+    if (pilotSession == WIFI_SESSION_NONE || isSessionExpired(&sessions[pilotSession], now)) {
+        pilotSession = found;
+        DEBUG_PRINT_LOCAL("session %d is the pilot", found);
+    }
+
+    sessionCount = 0;
+    for (uint8_t i = 0; i < WIFI_MAX_SESSIONS; i++) {
+        sessionCount += !isSessionExpired(&sessions[i], now);
+    }
+
+    return found;
+}
+
+static void sendLinkControl(const UDPPacket *packet, uint8_t session)
+{
+    udpTxItem_t item = {.packet = *packet, .sessions = 1 << session};
+
+    queueMonitorSent(qmUdpTx, udpDataTx, xQueueSend(udpDataTx, &item, 0));
+}
+
+static bool handleLinkControl(const UDPPacket *packet, uint8_t session)
+{
+    if (packet->size >= 3 && packet->data[1] == WIFI_CTRL_BATCH) {
+        UDPPacket ack = {.size = 3, .data = {WIFI_CTRL_HEADER, WIFI_CTRL_BATCH, packet->data[2] ? 1 : 0}};
+
+        sessions[session].isBatchMode = (packet->data[2] != 0);
+        sendLinkControl(&ack, session);
+        DEBUG_PRINT_LOCAL("batched mode %s", sessions[session].isBatchMode ? "on" : "off");
+        return true;
+    }
+
+    if (packet->size >= 2 && packet->data[1] == WIFI_CTRL_ECHO && packet->size <= 2 + WIFI_CTRL_ECHO_MAX_PAYLOAD) {
+        UDPPacket reply = {.size = packet->size + sizeof(uint32_t)};
+        const uint32_t timestamp = (uint32_t)usecTimestamp();
+
+        memcpy(reply.data, packet->data, packet->size);
+        memcpy(&reply.data[packet->size], &timestamp, sizeof(timestamp));
+        sendLinkControl(&reply, session);
+        wifiLinkQualityEcho();
+        return true;
+    }
+
+    if (packet->size >= 4 && packet->data[1] == WIFI_CTRL_LARGE) {
+        const uint16_t requested = packet->data[2] | (packet->data[3] << 8);
+        uint16_t accepted = requested < WIFI_LARGE_MAX_DATA_SIZE ? requested : WIFI_LARGE_MAX_DATA_SIZE;
+        UDPPacket ack = {.size = 4, .data = {WIFI_CTRL_HEADER, WIFI_CTRL_LARGE}};
+
+        if (accepted <= CRTP_MAX_DATA_SIZE) {
+            accepted = 0;
+        }
+        sessions[session].maxDataSize = accepted;
+        ack.data[2] = accepted & 0xFF;
+        ack.data[3] = accepted >> 8;
+        sendLinkControl(&ack, session);
+        DEBUG_PRINT_LOCAL("large frames of %d bytes", accepted);
+        return true;
+    }
+
+    // A client that connects or disconnects without asking for batching
+    sessions[session].isBatchMode = false;
+    sessions[session].maxDataSize = 0;
+    return false;
+}
+
+/* Applies the session to a received CRTP packet, returns false if it is dropped */
+static bool sessionReceive(UDPPacket *packet, uint8_t session)
+{
+    const uint8_t port = packet->data[0] >> 4;
+    const uint8_t channel = packet->data[0] & 0x03;
+
+    if (port == CRTP_PORT_SETPOINT || port == CRTP_PORT_SETPOINT_GENERIC || port == CRTP_PORT_SETPOINT_HL) {
+        if (session != pilotSession) {
+            observerDroppedCount++;
+            return false;
+        }
+        // The hot path, setpoints are no requests
+        return true;
+    }
+
+    if (port == CRTP_PORT_LOG && channel == WIFI_LOG_CONTROL_CH && packet->size >= 2) {
+        if (packet->data[1] == WIFI_LOG_CONTROL_RESET) {
+            // Only the blocks of the session, see logControlProcess()
+            packet->data[2] = session * WIFI_SESSION_LOG_IDS;
+            packet->data[3] = WIFI_SESSION_LOG_IDS;
+            packet->size = 4;
+        } else if (packet->size >= 3) {
+            if (packet->data[2] >= WIFI_SESSION_LOG_IDS) {
+                return false;
+            }
+            packet->data[2] += session * WIFI_SESSION_LOG_IDS;
+        }
+    }
+
+    if (port != CRTP_PORT_LINK) {
+        replySession = session;
+    }
+    return true;
+}
+
+/* The sessions a packet from the CRTP link goes to, log block ids are mapped back */
+static uint8_t sessionRoute(UDPPacket *packet)
+{
+    const uint8_t port = packet->data[0] >> 4;
+    const uint8_t channel = packet->data[0] & 0x03;
+    int idIndex = -1;
+
+    if (port == CRTP_PORT_CONSOLE) {
+        return (1 << WIFI_MAX_SESSIONS) - 1;
+    }
+
+    if (port == CRTP_PORT_LOG && channel == WIFI_LOG_DATA_CH) {
+        idIndex = 1;
+    } else if (port == CRTP_PORT_LOG && channel == WIFI_LOG_CONTROL_CH) {
+        idIndex = 2;
+    }
+
+    if (idIndex >= 0 && packet->size > idIndex) {
+        const uint8_t session = packet->data[idIndex] / WIFI_SESSION_LOG_IDS;
+
+        packet->data[idIndex] %= WIFI_SESSION_LOG_IDS;
+        return (session < WIFI_MAX_SESSIONS) ? 1 << session : 0;
+    }
+
+    return 1 << replySession;
+}
+
 static esp_err_t udp_server_create(void *arg)
 { 
     if (isUDPInit){
@@ -131,97 +641,300 @@ static esp_err_t udp_server_create(void *arg)
     return ESP_OK;
 }
 
+/* Checks and dispatches a received datagram, true if the packet is for the receiver */
+static bool udp_server_receive(UDPPacket *inPacket, int len, const struct sockaddr_in *from)
+{
+    if (len < UDP_CKSUM_SIZE || len > WIFI_RX_TX_PACKET_SIZE - 4) {
+        DEBUG_PRINT_LOCAL("Received data length = %d > 64", len);
+        return false;
+    }
+
+    //remove cksum, do not belong to CRTP
+    inPacket->size = len - UDP_CKSUM_SIZE;
+
+#ifdef DEBUG_UDP
+    DEBUG_PRINT_LOCAL("1.Received data size = %d  %02X", len, inPacket->data[0]);
+    for (size_t i = 0; i < len; i++) {
+        DEBUG_PRINT_LOCAL(" data[%d] = %02X ", i, inPacket->data[i]);
+    }
+#endif
+
+    //check packet
+    if (!udp_cksum_is_valid(inPacket->data, inPacket->size)) {
+        DEBUG_PRINT_LOCAL("udp packet cksum unmatched");
+        return false;
+    }
+
+    const wifiRxHook_t hook = rxHook;
+    const uint8_t session = sessionOf(from, xTaskGetTickCount());
+    bool isForReceiver = false;
+
+    if (session == WIFI_SESSION_NONE) {
+        return false;
+    }
+
+    // The link quality is the one of the pilot
+    if (session == pilotSession) {
+        wifiLinkQualityRx(usecTimestamp());
+    }
+    if (inPacket->size >= 4 && inPacket->data[0] == WIFI_CTRL_HEADER && inPacket->data[1] == WIFI_CTRL_SEQ) {
+        // Unwrap the sequenced packet, it is handled as if it came alone
+        if (session == pilotSession) {
+            wifiLinkQualitySequence(inPacket->data[2]);
+        }
+        inPacket->size -= 3;
+        memmove(inPacket->data, &inPacket->data[3], inPacket->size);
+    }
+
+    if (inPacket->data[0] == WIFI_CTRL_HEADER && handleLinkControl(inPacket, session)) {
+        // Consumed by the driver, reuse the packet
+    } else if (!sessionReceive(inPacket, session)) {
+        // Not for this session, reuse the packet
+    } else if (hook != NULL && hook(inPacket)) {
+        // Consumed by the link, reuse the packet
+    } else {
+        isForReceiver = true;
+    }
+    if(!isUDPConnected) isUDPConnected = true;
+
+    return isForReceiver;
+}
+
+/*
+ * Each wakeup drains the socket: the first recvfrom blocks, the next ones do
+ * not and stop at the first EWOULDBLOCK, so a burst of datagrams, e.g. a
+ * param upload of cfclient, is read in one go and the packets for the
+ * receiver are queued together once the socket is empty. When the pool runs
+ * dry the datagrams wait in the socket buffer of lwIP, which drops them once
+ * it is full.
+ */
 static void udp_server_rx_task(void *pvParameters)
 {
-    uint8_t cksum = 0;
-    socklen_t socklen = sizeof(source_addr);
-    
+    struct sockaddr_in6 source_addr; // Large enough for both IPv4 or IPv6
+    socklen_t socklen;
+    UDPPacket *inPacket = NULL;
+    UDPPacket *burst[WIFI_RX_POOL_SIZE];
+
     while (true) {
         if(isUDPInit == false) {
             vTaskDelay(20);
             continue;
         }
-        int len = recvfrom(sock, rx_buffer, sizeof(rx_buffer) - 1, 0, (struct sockaddr *)&source_addr, &socklen);
-        /* command step - receive  01 from Wi-Fi UDP */
-        if (len < 0) {
-            DEBUG_PRINT_LOCAL("recvfrom failed: errno %d", errno);
-            break;
-        } else if(len > WIFI_RX_TX_PACKET_SIZE - 4) {
-            DEBUG_PRINT_LOCAL("Received data length = %d > 64", len);
-        } else {
-            //copy part of the UDP packet
-            rx_buffer[len] = 0;// Null-terminate whatever we received and treat like a string...
-            memcpy(inPacket.data, rx_buffer, len);
-            cksum = inPacket.data[len - 1];
-            //remove cksum, do not belong to CRTP
-            inPacket.size = len - 1;
-            //check packet
-            if (cksum == calculate_cksum(inPacket.data, len - 1) && inPacket.size < 64){
-                xQueueSend(udpDataRx, &inPacket, M2T(2));
-                if(!isUDPConnected) isUDPConnected = true;
-            }else{
-                DEBUG_PRINT_LOCAL("udp packet cksum unmatched");
+
+        int flags = 0;
+        uint8_t received = 0;
+        size_t burstLen = 0;
+
+        while (burstLen < WIFI_RX_POOL_SIZE) {
+            if (inPacket == NULL && !spscRingPop(&rxFreeRing, &inPacket)) {
+                // All packets are still queued or in use
+                rxPoolEmptyCount++;
+                break;
             }
+            socklen = sizeof(source_addr);
+            int len = recvfrom(sock, inPacket->data, sizeof(inPacket->data), flags, (struct sockaddr *)&source_addr, &socklen);
+            /* command step - receive  01 from Wi-Fi UDP */
+            if (len < 0) {
+                if (errno != EWOULDBLOCK && errno != EAGAIN) {
+                    DEBUG_PRINT_LOCAL("recvfrom failed: errno %d", errno);
+                }
+                break;
+            }
+            flags = MSG_DONTWAIT;
+            received++;
+            SYSVIEW_MARKER_POINT(svUdpRx);
 
-#ifdef DEBUG_UDP
-            DEBUG_PRINT_LOCAL("1.Received data size = %d  %02X \n cksum = %02X", len, inPacket.data[0], cksum);
-            for (size_t i = 0; i < len; i++) {
-                DEBUG_PRINT_LOCAL(" data[%d] = %02X ", i, inPacket.data[i]);
+            if (udp_server_receive(inPacket, len, (struct sockaddr_in *)&source_addr)) {
+                // Owned by the receiver once it is queued
+                burst[burstLen++] = inPacket;
+                inPacket = NULL;
             }
+        }
+
+        for (size_t i = 0; i < burstLen; i++) {
+            BaseType_t result = xQueueSend(udpDataRx, &burst[i], 0);
+            queueMonitorSent(qmUdpRx, udpDataRx, result);
+            // The queue is as deep as the pool, it is never full
+            ASSERT(result == pdTRUE);
+        }
+
+        if (received > rxBurstMax) {
+            rxBurstMax = received;
+        }
+        if (received == 0) {
+            // No free packet or a socket error, let the receiver catch up
+            vTaskDelay(1);
+        }
+    }
+}
+
+/*
+ * Sends the datagram to every active session of the mask, the check is
+ * written after its len bytes. From the TX task, and with CONFIG_WIFI_DIRECT_TX
+ * from the CRTP TX task, lwIP serializes the sends.
+ * Returns false if every send failed, e.g. lwIP had no buffer.
+ */
+static bool udp_send_datagram(uint8_t *datagram, size_t len, uint8_t mask)
+{
+    uint8_t sent = 0;
+    uint8_t failed = 0;
+
+    udp_cksum_write(datagram, len);
+
+    SYSVIEW_MARKER_START(svUdpTx);
+    for (int i = 0; i < WIFI_MAX_SESSIONS; i++) {
+        if (!(mask & (1 << i)) || !__atomic_load_n(&sessions[i].isActive, __ATOMIC_ACQUIRE)) {
+            continue;
+        }
+
+        const struct sockaddr_in addr = sessions[i].addr;
+        int err = sendto(sock, datagram, len + UDP_CKSUM_SIZE, 0, (struct sockaddr *)&addr, sizeof(addr));
+        if (err < 0) {
+            DEBUG_PRINT_LOCAL("Error occurred during sending: errno %d", errno);
+            failed++;
+            continue;
+        }
+        sent++;
+    }
+    SYSVIEW_MARKER_STOP(svUdpTx);
+
+    if (sent > 1) {
+        fanoutCount++;
+    }
+#ifdef DEBUG_UDP
+    DEBUG_PRINT_LOCAL("Send data to");
+    for (size_t i = 0; i < len + UDP_CKSUM_SIZE; i++) {
+        DEBUG_PRINT_LOCAL(" data_send[%d] = %02X ", i, datagram[i]);
+    }
 #endif
+
+    return sent > 0 || failed == 0;
+}
+
+static void udp_batch_flush(void)
+{
+    if (batchLen > 2) {
+        udp_send_datagram((uint8_t *)tx_buffer, batchLen, batchSessions);
+    }
+
+    batchLen = 0;
+}
+
+/* True if every session of the mask is in batched mode */
+static bool udp_is_batched(uint8_t mask)
+{
+    for (int i = 0; i < WIFI_MAX_SESSIONS; i++) {
+        if ((mask & (1 << i)) && sessions[i].isActive && !sessions[i].isBatchMode) {
+            return false;
         }
     }
+
+    return true;
+}
+
+static void udp_batch_append(const UDPPacket *packet, uint8_t mask)
+{
+    // A batch goes to one set of sessions. Room for the length byte and the checksum
+    if (mask != batchSessions || batchLen + 1 + packet->size + UDP_CKSUM_SIZE > UDP_SERVER_BUFSIZE) {
+        udp_batch_flush();
+    }
+
+    if (batchLen == 0) {
+        tx_buffer[0] = WIFI_CTRL_HEADER;
+        tx_buffer[1] = WIFI_CTRL_BATCH;
+        batchLen = 2;
+        batchSessions = mask;
+        batchStartTick = xTaskGetTickCount();
+    }
+
+    tx_buffer[batchLen++] = packet->size;
+    memcpy(&tx_buffer[batchLen], packet->data, packet->size);
+    batchLen += packet->size;
 }
 
 static void udp_server_tx_task(void *pvParameters)
 {
- 
+    TickType_t timeout;
+
     while (TRUE) {
         if(isUDPInit == false) {
             vTaskDelay(20);
             continue;
         }
-        if ((xQueueReceive(udpDataTx, &outPacket, 5) == pdTRUE) && isUDPConnected) {           
-            memcpy(tx_buffer, outPacket.data, outPacket.size);       
-            tx_buffer[outPacket.size] =  calculate_cksum(tx_buffer, outPacket.size);
-            tx_buffer[outPacket.size + 1] = 0;
-
-            int err = sendto(sock, tx_buffer, outPacket.size + 1, 0, (struct sockaddr *)&source_addr, sizeof(source_addr));
-            if (err < 0) {
-                DEBUG_PRINT_LOCAL("Error occurred during sending: errno %d", errno);
-                continue;
-            }
-#ifdef DEBUG_UDP
-            DEBUG_PRINT_LOCAL("Send data to");
-            for (size_t i = 0; i < outPacket.size + 1; i++) {
-                DEBUG_PRINT_LOCAL(" data_send[%d] = %02X ", i, tx_buffer[i]);
-            }
-#endif
-        }    
+
+        timeout = 5;
+        if (batchLen > 0) {
+            TickType_t age = xTaskGetTickCount() - batchStartTick;
+            timeout = (age < M2T(UDP_TX_BATCH_TIMEOUT_MS)) ? M2T(UDP_TX_BATCH_TIMEOUT_MS) - age : 0;
+        }
+
+        BaseType_t result = xQueueReceive(udpDataTx, &outItem, timeout);
+        queueMonitorReceived(qmUdpTx, result);
+        bool isReceived = (result == pdTRUE) && isUDPConnected;
+        uint8_t mask = 0;
+
+        if (isReceived) {
+            mask = outItem.sessions ? outItem.sessions : sessionRoute(&outItem.packet);
+            isReceived = (mask != 0);
+        }
+
+        if (isReceived && !udp_is_batched(mask)) {
+            // Sessions that do not batch get one packet per datagram, the others accept both
+            udp_batch_flush();
+            memcpy(tx_buffer, outItem.packet.data, outItem.packet.size);
+            udp_send_datagram((uint8_t *)tx_buffer, outItem.packet.size, mask);
+            continue;
+        }
+
+        if (isReceived) {
+            udp_batch_append(&outItem.packet, mask);
+        }
+
+        // Flush when the queue ran dry or the oldest packet waited long enough
+        if (batchLen > 0 && (!isReceived || xTaskGetTickCount() - batchStartTick >= M2T(UDP_TX_BATCH_TIMEOUT_MS))) {
+            udp_batch_flush();
+        }
     }
 }
 
-
-void wifiInit(void)
+/* Before esp_wifi_start(), on the interface of the link */
+static void wifiApplyProfileBeforeStart(void)
 {
-    if (isInit) {
+    if (!linkProfile.isSet) {
         return;
     }
 
-    esp_netif_t *ap_netif = NULL;
-    ESP_ERROR_CHECK(esp_netif_init());
-    ESP_ERROR_CHECK(esp_event_loop_create_default());
-    ap_netif = esp_netif_create_default_wifi_ap();
-    uint8_t mac[6];
+    ESP_ERROR_CHECK(esp_wifi_set_protocol(WIFI_LINK_IF, linkProfile.protocols));
+    if (linkProfile.isFixedRate) {
+        ESP_ERROR_CHECK(esp_wifi_config_80211_tx_rate(WIFI_LINK_IF, linkProfile.txRate));
+    }
+}
 
-    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
-    ESP_ERROR_CHECK(esp_wifi_init(&cfg));
+static void wifiApplyProfileAfterStart(void)
+{
+    wifi_bandwidth_t bandwidth;
 
-    ESP_ERROR_CHECK(esp_event_handler_instance_register(WIFI_EVENT,
-                    ESP_EVENT_ANY_ID,
-                    &wifi_event_handler,
-                    NULL,
-                    NULL));
+    if (linkProfile.isSet) {
+        ESP_ERROR_CHECK(esp_wifi_set_ps(linkProfile.powerSave));
+        ESP_ERROR_CHECK(esp_wifi_set_bandwidth(WIFI_LINK_IF, linkProfile.bandwidth));
+        ESP_ERROR_CHECK(esp_wifi_set_inactive_time(WIFI_LINK_IF, linkProfile.inactiveTimeS));
+        if (linkProfile.maxTxPower != 0) {
+            ESP_ERROR_CHECK(esp_wifi_set_max_tx_power(linkProfile.maxTxPower));
+        }
+    }
+
+    if (esp_wifi_get_bandwidth(WIFI_LINK_IF, &bandwidth) == ESP_OK) {
+        appliedBandwidth = (bandwidth == WIFI_BW_HT40) ? 40 : 20;
+    }
+    esp_wifi_get_max_tx_power(&appliedTxPower);
+    DEBUG_PRINT_LOCAL("link profile %s, %d MHz, tx power %d/4 dBm", linkProfile.name, appliedBandwidth, appliedTxPower);
+}
+
+#ifndef CONFIG_WIFI_STATION
+static void wifiStartAccessPoint(void)
+{
+    esp_netif_t *ap_netif = esp_netif_create_default_wifi_ap();
+    uint8_t mac[6];
 
     ESP_ERROR_CHECK(esp_wifi_get_mac(ESP_IF_WIFI_AP, mac));
     sprintf(WIFI_SSID, "ESP-DRONE_%02X%02X%02X%02X%02X%02X", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
@@ -244,7 +957,9 @@ void wifiInit(void)
 
     ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_AP));
     ESP_ERROR_CHECK(esp_wifi_set_config(ESP_IF_WIFI_AP, &wifi_config));
+    wifiApplyProfileBeforeStart();
     ESP_ERROR_CHECK(esp_wifi_start());
+    wifiApplyProfileAfterStart();
 
     esp_netif_ip_info_t ip_info = {
         .ip.addr = ipaddr_addr("192.168.43.42"),
@@ -256,18 +971,148 @@ void wifiInit(void)
     ESP_ERROR_CHECK(esp_netif_dhcps_start(ap_netif));
 
     DEBUG_PRINT_LOCAL("wifi_init_softap complete.SSID:%s password:%s", WIFI_SSID, WIFI_PWD);
+}
+#else
+/*
+ * The drone joins CONFIG_WIFI_STA_SSID, or the network the IDF has kept in
+ * its NVS storage from an earlier esp_wifi_set_config(), e.g. by a
+ * provisioning tool, and keeps reconnecting to it. It announces itself as
+ * esp-drone-<mac>.local with a _crtp._udp service on UDP_SERVER_PORT, a
+ * ground station finds all the drones on the network by browsing for it.
+ */
+static void wifiStartStation(void)
+{
+    esp_netif_t *sta_netif = esp_netif_create_default_wifi_sta();
+    wifi_config_t wifi_config = { 0 };
+    uint8_t mac[6];
+    char hostname[32];
+
+    ESP_ERROR_CHECK(esp_event_handler_instance_register(IP_EVENT,
+                    IP_EVENT_STA_GOT_IP,
+                    &wifi_event_handler,
+                    NULL,
+                    NULL));
+
+    ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
+    ESP_ERROR_CHECK(esp_wifi_get_mac(WIFI_IF_STA, mac));
+
+    // Stored by the IDF, else the network of the build
+    if (esp_wifi_get_config(WIFI_IF_STA, &wifi_config) != ESP_OK || wifi_config.sta.ssid[0] == '\0') {
+        memset(&wifi_config, 0, sizeof(wifi_config));
+        strlcpy((char *)wifi_config.sta.ssid, CONFIG_WIFI_STA_SSID, sizeof(wifi_config.sta.ssid));
+        strlcpy((char *)wifi_config.sta.password, CONFIG_WIFI_STA_PASSWORD, sizeof(wifi_config.sta.password));
+    }
+    wifi_config.sta.scan_method = WIFI_ALL_CHANNEL_SCAN;
+    wifi_config.sta.sort_method = WIFI_CONNECT_AP_BY_SIGNAL;
+    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
+
+    snprintf(hostname, sizeof(hostname), "esp-drone-%02x%02x%02x%02x%02x%02x", MAC2STR(mac));
+    ESP_ERROR_CHECK(esp_netif_set_hostname(sta_netif, hostname));
+
+    wifiApplyProfileBeforeStart();
+    ESP_ERROR_CHECK(esp_wifi_start());
+    wifiApplyProfileAfterStart();
+    esp_wifi_connect();
+
+    if (mdns_init() == ESP_OK) {
+        char macText[18];
+        snprintf(macText, sizeof(macText), MACSTR, MAC2STR(mac));
+        mdns_txt_item_t txt[] = {
+            { "mac", macText },
+        };
+        mdns_hostname_set(hostname);
+        mdns_instance_name_set(hostname);
+        mdns_service_add(NULL, "_crtp", "_udp", UDP_SERVER_PORT, txt, sizeof(txt) / sizeof(txt[0]));
+    } else {
+        DEBUG_PRINT_LOCAL("mDNS init failed");
+    }
+
+    DEBUG_PRINT_LOCAL("wifi_init_sta complete, joining %s as %s", wifi_config.sta.ssid, hostname);
+}
+#endif
+
+void wifiInit(void)
+{
+    if (isInit) {
+        return;
+    }
+
+    ESP_ERROR_CHECK(esp_netif_init());
+    ESP_ERROR_CHECK(esp_event_loop_create_default());
+
+    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+    ESP_ERROR_CHECK(esp_wifi_init(&cfg));
+
+    ESP_ERROR_CHECK(esp_event_handler_instance_register(WIFI_EVENT,
+                    ESP_EVENT_ANY_ID,
+                    &wifi_event_handler,
+                    NULL,
+                    NULL));
+
+#ifdef CONFIG_WIFI_STATION
+    wifiStartStation();
+#else
+    wifiStartAccessPoint();
+#endif
 
     // This should probably be reduced to a CRTP packet size
-    udpDataRx = xQueueCreate(5, sizeof(UDPPacket)); /* Buffer packets (max 64 bytes) */
-    DEBUG_QUEUE_MONITOR_REGISTER(udpDataRx);
-    udpDataTx = xQueueCreate(5, sizeof(UDPPacket)); /* Buffer packets (max 64 bytes) */
-    DEBUG_QUEUE_MONITOR_REGISTER(udpDataTx);
+    for (int i = 0; i < WIFI_RX_POOL_SIZE; i++) {
+        wifiReleasePacket(&rxPool[i]);
+    }
+    udpDataRx = STATIC_MEM_QUEUE_CREATE(udpDataRx);
+    udpDataTx = STATIC_MEM_QUEUE_CREATE(udpDataTx);
+#ifdef CONFIG_CRTP_LARGE_FRAMES
+    largeTxMutex = xSemaphoreCreateMutexStatic(&largeTxMutexBuffer);
+#endif
     if (udp_server_create(NULL) == ESP_FAIL) {
         DEBUG_PRINT_LOCAL("UDP server create socket failed!!!");
     } else {
         DEBUG_PRINT_LOCAL("UDP server create socket succeed!!!");
     } 
-    xTaskCreate(udp_server_tx_task, UDP_TX_TASK_NAME, UDP_TX_TASK_STACKSIZE, NULL, UDP_TX_TASK_PRI, NULL);
-    xTaskCreate(udp_server_rx_task, UDP_RX_TASK_NAME, UDP_RX_TASK_STACKSIZE, NULL, UDP_RX_TASK_PRI, NULL);
+    STATIC_MEM_TASK_CREATE_PINNED(udpTxTask, udp_server_tx_task, UDP_TX_TASK_NAME, NULL, UDP_TX_TASK_PRI, UDP_TX_TASK_CORE);
+    STATIC_MEM_TASK_CREATE_PINNED(udpRxTask, udp_server_rx_task, UDP_RX_TASK_NAME, NULL, UDP_RX_TASK_PRI, UDP_RX_TASK_CORE);
     isInit = true;
-}
\ No newline at end of file
+}
+
+/**
+ * The number of client sessions and the one of the pilot. rejected counts the
+ * datagrams of clients that found no free session, observerDrop the setpoints
+ * of observers, fanout the datagrams sent to more than one session.
+ */
+LOG_GROUP_START(wifiSess)
+LOG_ADD(LOG_UINT8, count, &sessionCount)
+LOG_ADD(LOG_UINT8, pilot, &pilotSession)
+LOG_ADD(LOG_UINT32, rejected, &sessionRejectedCount)
+LOG_ADD(LOG_UINT32, observerDrop, &observerDroppedCount)
+LOG_ADD(LOG_UINT32, fanout, &fanoutCount)
+LOG_GROUP_STOP(wifiSess)
+
+/**
+ * The receive path. burstMax is the most datagrams read in one wakeup,
+ * poolEmpty counts the wakeups that stopped reading for lack of a free
+ * packet, every one of them risks drops in the socket buffer.
+ */
+LOG_GROUP_START(wifiRx)
+LOG_ADD(LOG_UINT8, burstMax, &rxBurstMax)
+LOG_ADD(LOG_UINT32, poolEmpty, &rxPoolEmptyCount)
+LOG_GROUP_STOP(wifiRx)
+
+#ifdef CONFIG_WIFI_DIRECT_TX
+/**
+ * The packets the CRTP TX task sent itself, and those lwIP took none of,
+ * which stayed in the CRTP queues.
+ */
+LOG_GROUP_START(wifiTx)
+LOG_ADD(LOG_UINT32, direct, &directTxCount)
+LOG_ADD(LOG_UINT32, directFail, &directTxFailCount)
+LOG_GROUP_STOP(wifiTx)
+#endif
+
+/**
+ * The radio settings of the link profile as applied: the channel width in
+ * MHz and the highest TX power in 0.25 dBm.
+ */
+LOG_GROUP_START(wifiPhy)
+LOG_ADD(LOG_UINT8, bandwidth, &appliedBandwidth)
+LOG_ADD(LOG_INT8, txPower, &appliedTxPower)
+LOG_GROUP_STOP(wifiPhy)
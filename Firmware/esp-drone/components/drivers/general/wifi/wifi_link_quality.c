@@ -0,0 +1,129 @@
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "esp_wifi.h"
+
+#include "log.h"
+#include "wifi_link_quality.h"
+
+// Bucket b of the histogram counts interarrival times of [2^(9+b), 2^(10+b))
+// us, the first and the last bucket are open ended
+#define LQ_NBR_OF_BUCKETS     8
+#define LQ_FIRST_BUCKET_LOG2  10
+// Share of a new sample in the jitter, as in RFC 3550
+#define LQ_JITTER_GAIN        (1.0f / 16.0f)
+#define LQ_RSSI_POLL_US       500000
+
+static int64_t lastRxUs;
+static uint32_t lastInterarrivalUs;
+static int64_t lastRssiPollUs;
+static bool isSequenced;
+static uint8_t lastSequence;
+
+static uint32_t interarrivalUs;
+static uint32_t interarrivalMaxUs;
+static float jitterUs;
+static uint16_t histogram[LQ_NBR_OF_BUCKETS];
+static uint32_t sequencedCount;
+static uint32_t lostCount;
+static uint32_t outOfOrderCount;
+static uint32_t echoCount;
+static int8_t rssi;
+static uint8_t stationCount;
+
+static void pollRssi(void)
+{
+    wifi_sta_list_t stations;
+
+    if (esp_wifi_ap_get_sta_list(&stations) != ESP_OK) {
+        return;
+    }
+
+    stationCount = stations.num;
+    if (stations.num > 0) {
+        // Usually there is only one client, the weakest one is the one that matters
+        int8_t weakest = stations.sta[0].rssi;
+        for (int i = 1; i < stations.num; i++) {
+            if (stations.sta[i].rssi < weakest) {
+                weakest = stations.sta[i].rssi;
+            }
+        }
+        rssi = weakest;
+    }
+}
+
+void wifiLinkQualityRx(int64_t timestampUs)
+{
+    if (lastRxUs != 0) {
+        const uint32_t interarrival = (uint32_t)(timestampUs - lastRxUs);
+        int bucket = 0;
+
+        interarrivalUs = interarrival;
+        if (interarrival > interarrivalMaxUs) {
+            interarrivalMaxUs = interarrival;
+        }
+        while (bucket < LQ_NBR_OF_BUCKETS - 1 && interarrival >= (1u << (LQ_FIRST_BUCKET_LOG2 + bucket))) {
+            bucket++;
+        }
+        if (histogram[bucket] < UINT16_MAX) {
+            histogram[bucket]++;
+        }
+
+        // The client sends at a steady rate, the variation of the interarrival is the jitter
+        const float delta = (float)abs((int32_t)(interarrival - lastInterarrivalUs));
+        jitterUs += LQ_JITTER_GAIN * (delta - jitterUs);
+        lastInterarrivalUs = interarrival;
+    }
+    lastRxUs = timestampUs;
+
+    if (timestampUs - lastRssiPollUs >= LQ_RSSI_POLL_US) {
+        lastRssiPollUs = timestampUs;
+        pollRssi();
+    }
+}
+
+void wifiLinkQualitySequence(uint8_t sequence)
+{
+    if (isSequenced) {
+        const uint8_t gap = (uint8_t)(sequence - lastSequence - 1);
+
+        if (gap >= 128) {
+            // Late or duplicated, it was counted as lost when it was skipped
+            outOfOrderCount++;
+            return;
+        }
+        lostCount += gap;
+    }
+
+    isSequenced = true;
+    lastSequence = sequence;
+    sequencedCount++;
+}
+
+void wifiLinkQualityEcho(void)
+{
+    echoCount++;
+}
+
+LOG_GROUP_START(wifiLink)
+LOG_ADD(LOG_UINT32, interarrival, &interarrivalUs)
+LOG_ADD(LOG_UINT32, interarrMax, &interarrivalMaxUs)
+LOG_ADD(LOG_FLOAT, jitter, &jitterUs)
+LOG_ADD(LOG_UINT32, seqRx, &sequencedCount)
+LOG_ADD(LOG_UINT32, seqLost, &lostCount)
+LOG_ADD(LOG_UINT32, seqLate, &outOfOrderCount)
+LOG_ADD(LOG_UINT32, echo, &echoCount)
+LOG_ADD(LOG_INT8, rssi, &rssi)
+LOG_ADD(LOG_UINT8, stations, &stationCount)
+LOG_GROUP_STOP(wifiLink)
+
+LOG_GROUP_START(wifiLinkHist)
+LOG_ADD(LOG_UINT16, ia0, &histogram[0])
+LOG_ADD(LOG_UINT16, ia1, &histogram[1])
+LOG_ADD(LOG_UINT16, ia2, &histogram[2])
+LOG_ADD(LOG_UINT16, ia3, &histogram[3])
+LOG_ADD(LOG_UINT16, ia4, &histogram[4])
+LOG_ADD(LOG_UINT16, ia5, &histogram[5])
+LOG_ADD(LOG_UINT16, ia6, &histogram[6])
+LOG_ADD(LOG_UINT16, ia7, &histogram[7])
+LOG_GROUP_STOP(wifiLinkHist)
@@ -41,6 +41,7 @@
 #include "stm32_legacy.h"
 #include "i2c_drv.h"
 #include "config.h"
+#include "log.h"
 #define DEBUG_MODULE "I2CDRV"
 #include "debug_cf.h"
 
@@ -98,6 +99,7 @@ static void i2cdrvInitBus(I2cDrv *i2c)
 
     DEBUG_PRINTI(" i2c %d driver install return = %d", i2c->def->i2cPort, err);
     i2c->isBusFreeMutex = xSemaphoreCreateMutex();
+    busStatsRegister(&i2c->stats, (i2c->def->i2cPort == I2C_NUM_0) ? "i2c0" : "i2c1");
     isinit_i2cPort[i2c->def->i2cPort] = true;
 }
 
@@ -114,3 +116,18 @@ void i2cdrvTryToRestartBus(I2cDrv *i2c)
     i2cdrvInitBus(i2c);
 }
 
+#ifdef CONFIG_BUS_STATS
+/**
+ * The sensors bus, busy in % and transfers per s, the waits for the bus in us
+ */
+LOG_GROUP_START(busI2c0)
+BUS_STATS_LOG_ADD(&sensorsBus.stats)
+LOG_GROUP_STOP(busI2c0)
+
+/**
+ * The deck and eeprom bus
+ */
+LOG_GROUP_START(busI2c1)
+BUS_STATS_LOG_ADD(&deckBus.stats)
+LOG_GROUP_STOP(busI2c1)
+#endif
@@ -0,0 +1,233 @@
+/**
+ *
+ * ESP-Drone Firmware
+ *
+ * Copyright 2019-2020  Espressif Systems (Shanghai)
+ * Copyright (C) 2011-2012 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * i2cdev_async.c - Queued, prioritized I2C transfers executed by a bus task
+ *
+ * Every bus gets one owner task that serves three request queues, highest
+ * priority first. Transfers are executed with the blocking i2cdev functions,
+ * so they still take isBusFreeMutex and can be mixed with direct calls. The
+ * mutex is released after every request, a higher priority request queued
+ * meanwhile goes first.
+ */
+#define DEBUG_MODULE "I2CASYNC"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+
+#include "stm32_legacy.h"
+#include "i2cdev.h"
+#include "i2cdev_async.h"
+#include "config.h"
+#include "static_mem.h"
+#include "debug_cf.h"
+
+#define I2CDEV_ASYNC_NBR_OF_BUSSES 2
+
+typedef struct {
+    I2C_Dev *dev;
+    TaskHandle_t task;
+    xQueueHandle queue[I2CDEV_ASYNC_PRIO_COUNT];
+    uint32_t droppedCount;
+    bool isInit;
+} I2cdevAsyncBus;
+
+static I2cdevAsyncBus busses[I2CDEV_ASYNC_NBR_OF_BUSSES];
+// The bus of each port, that of another port on the same pins
+static I2cdevAsyncBus *busOfPort[I2CDEV_ASYNC_NBR_OF_BUSSES];
+
+STATIC_MEM_TASK_ALLOC(i2cAsyncTask0, I2C_ASYNC_TASK_STACKSIZE);
+STATIC_MEM_TASK_ALLOC(i2cAsyncTask1, I2C_ASYNC_TASK_STACKSIZE);
+
+static void i2cdevAsyncTask(void *param);
+
+static I2cdevAsyncBus *getBus(I2C_Dev *dev)
+{
+    if (dev->def->i2cPort >= I2CDEV_ASYNC_NBR_OF_BUSSES) {
+        return NULL;
+    }
+
+    return busOfPort[dev->def->i2cPort];
+}
+
+bool i2cdevAsyncInit(I2C_Dev *dev)
+{
+    if (dev->def->i2cPort >= I2CDEV_ASYNC_NBR_OF_BUSSES) {
+        return false;
+    }
+
+    if (getBus(dev) != NULL) {
+        return true;
+    }
+
+    for (int i = 0; i < I2CDEV_ASYNC_NBR_OF_BUSSES; i++) {
+        if (busses[i].isInit && busses[i].dev->def->gpioSDAPin == dev->def->gpioSDAPin &&
+            busses[i].dev->def->gpioSCLPin == dev->def->gpioSCLPin) {
+            busOfPort[dev->def->i2cPort] = &busses[i];
+            return true;
+        }
+    }
+
+    I2cdevAsyncBus *bus = &busses[dev->def->i2cPort];
+    bus->dev = dev;
+
+    for (int prio = 0; prio < I2CDEV_ASYNC_PRIO_COUNT; prio++) {
+        bus->queue[prio] = xQueueCreate(I2CDEV_ASYNC_QUEUE_LENGTH, sizeof(I2cdevAsyncRequest *));
+
+        if (bus->queue[prio] == NULL) {
+            DEBUG_PRINTE("i2c %d async queue create failed", dev->def->i2cPort);
+            return false;
+        }
+    }
+
+    if (dev->def->i2cPort == I2C_NUM_0) {
+        bus->task = STATIC_MEM_TASK_CREATE_PINNED(i2cAsyncTask0, i2cdevAsyncTask, I2C_ASYNC_TASK_NAME, bus, I2C_ASYNC_TASK_PRI, I2C_ASYNC_TASK_CORE);
+    } else {
+        bus->task = STATIC_MEM_TASK_CREATE_PINNED(i2cAsyncTask1, i2cdevAsyncTask, I2C_ASYNC_TASK_NAME, bus, I2C_ASYNC_TASK_PRI, I2C_ASYNC_TASK_CORE);
+    }
+
+    bus->isInit = (bus->task != NULL);
+    if (bus->isInit) {
+        busOfPort[dev->def->i2cPort] = bus;
+    }
+    return bus->isInit;
+}
+
+bool i2cdevAsyncSubmit(I2C_Dev *dev, I2cdevAsyncRequest *request, I2cdevAsyncPriority prio)
+{
+    I2cdevAsyncBus *bus = getBus(dev);
+
+    if (bus == NULL || !bus->isInit || prio >= I2CDEV_ASYNC_PRIO_COUNT) {
+        return false;
+    }
+
+    request->dev = dev;
+    request->isDone = false;
+    request->success = false;
+
+    if (xQueueSend(bus->queue[prio], &request, 0) != pdTRUE) {
+        bus->droppedCount++;
+        return false;
+    }
+
+    xTaskNotifyGive(bus->task);
+    return true;
+}
+
+static bool executeRequest(I2C_Dev *dev, I2cdevAsyncRequest *request);
+
+bool i2cdevAsyncTransfer(I2C_Dev *dev, I2cdevAsyncRequest *request, I2cdevAsyncPriority prio)
+{
+    if (getBus(dev) == NULL) {
+        request->dev = dev;
+        request->success = executeRequest(dev, request);
+        __atomic_store_n(&request->isDone, true, __ATOMIC_RELEASE);
+        return request->success;
+    }
+
+    request->callback = NULL;
+    request->notifyTask = xTaskGetCurrentTaskHandle();
+
+    if (!i2cdevAsyncSubmit(dev, request, prio)) {
+        return false;
+    }
+
+    // A stale notification may wake us early, the request must not be left
+    // behind. The acquire pairs with the release of the bus task, success is
+    // valid once isDone is seen.
+    while (!__atomic_load_n(&request->isDone, __ATOMIC_ACQUIRE)) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    }
+
+    return request->success;
+}
+
+uint32_t i2cdevAsyncGetDroppedCount(I2C_Dev *dev)
+{
+    I2cdevAsyncBus *bus = getBus(dev);
+    return (bus != NULL) ? bus->droppedCount : 0;
+}
+
+static bool getNextRequest(I2cdevAsyncBus *bus, I2cdevAsyncRequest **request)
+{
+    for (int prio = 0; prio < I2CDEV_ASYNC_PRIO_COUNT; prio++) {
+        if (xQueueReceive(bus->queue[prio], request, 0) == pdTRUE) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool executeRequest(I2C_Dev *dev, I2cdevAsyncRequest *request)
+{
+    if (request->transaction) {
+        return i2cdevExecute(request->transaction);
+    }
+
+    if (request->direction == i2cRead) {
+        if (request->isMem16bit) {
+            return i2cdevReadReg16(dev, request->devAddress, request->memAddress, request->len, request->data);
+        }
+
+        return i2cdevReadReg8(dev, request->devAddress, (uint8_t)request->memAddress, request->len, request->data);
+    }
+
+    if (request->isMem16bit) {
+        return i2cdevWriteReg16(dev, request->devAddress, request->memAddress, request->len, request->data);
+    }
+
+    return i2cdevWriteReg8(dev, request->devAddress, (uint8_t)request->memAddress, request->len, request->data);
+}
+
+static void i2cdevAsyncTask(void *param)
+{
+    I2cdevAsyncBus *bus = (I2cdevAsyncBus *)param;
+    I2cdevAsyncRequest *request;
+    I2cdevAsyncCallback callback;
+    TaskHandle_t notifyTask;
+
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        // Re-check from the highest priority after every transfer
+        while (getNextRequest(bus, &request)) {
+            callback = request->callback;
+            notifyTask = request->notifyTask;
+            request->success = executeRequest(request->dev, request);
+
+            if (callback) {
+                callback(request);
+            }
+
+            // The owner may reuse or drop the request once isDone is set,
+            // it must be the last access to it
+            __atomic_store_n(&request->isDone, true, __ATOMIC_RELEASE);
+
+            if (notifyTask) {
+                xTaskNotifyGive(notifyTask);
+            }
+        }
+    }
+}
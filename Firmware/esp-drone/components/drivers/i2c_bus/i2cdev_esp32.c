@@ -32,16 +32,42 @@
 
 #include "stm32_legacy.h"
 #include "i2cdev.h"
+#include "i2cdev_async.h"
 #include "i2c_drv.h"
 #include "nvicconf.h"
 #include "debug_cf.h"
+#include "busStats.h"
 
 int i2cdevInit(I2C_Dev *dev)
 {
     i2cdrvInit(dev);
+
+    if (!i2cdevAsyncInit(dev)) {
+        DEBUG_PRINTW("i2c %d async task start failed", dev->def->i2cPort);
+    }
+
     return true;
 }
 
+static bool i2cdevTakeBus(I2C_Dev *dev, uint8_t devAddress)
+{
+    const uint32_t waitStartUs = busStatsNowUs();
+
+    if (xSemaphoreTake(dev->isBusFreeMutex, (TickType_t)5) == pdFALSE) {
+        busStatsLockTimeout(&dev->stats);
+        return false;
+    }
+
+    busStatsAcquire(&dev->stats, devAddress, waitStartUs);
+    return true;
+}
+
+static void i2cdevGiveBus(I2C_Dev *dev, esp_err_t err)
+{
+    busStatsRelease(&dev->stats, err);
+    xSemaphoreGive(dev->isBusFreeMutex);
+}
+
 bool i2cdevRead(I2C_Dev *dev, uint8_t devAddress, uint16_t len, uint8_t *data)
 {
     return i2cdevReadReg8(dev, devAddress, I2CDEV_NO_MEM_ADDR, len, data);
@@ -84,11 +110,11 @@ bool i2cdevReadBits(I2C_Dev *dev, uint8_t devAddress, uint8_t memAddress,
 bool i2cdevReadReg8(I2C_Dev *dev, uint8_t devAddress, uint8_t memAddress,
                     uint16_t len, uint8_t *data)
 {
-    if (xSemaphoreTake(dev->isBusFreeMutex, (TickType_t)5) == pdFALSE) {
+    if (!i2cdevTakeBus(dev, devAddress)) {
         return false;
     }
 
-    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
+    i2c_cmd_handle_t cmd = i2c_cmd_link_create_static(dev->cmdLinkBuffer, sizeof(dev->cmdLinkBuffer));
     if (memAddress != I2CDEV_NO_MEM_ADDR) {
         i2c_master_start(cmd);
         i2c_master_write_byte(cmd, (devAddress << 1) | I2C_MASTER_WRITE, I2C_MASTER_ACK_EN);
@@ -99,9 +125,9 @@ bool i2cdevReadReg8(I2C_Dev *dev, uint8_t devAddress, uint8_t memAddress,
     i2c_master_read(cmd, data, len, I2C_MASTER_LAST_NACK);
     i2c_master_stop(cmd);
     esp_err_t err = i2c_master_cmd_begin(dev->def->i2cPort, cmd, (TickType_t)5);
-    i2c_cmd_link_delete(cmd);
+    i2c_cmd_link_delete_static(cmd);
 
-    xSemaphoreGive(dev->isBusFreeMutex);
+    i2cdevGiveBus(dev, err);
 
 #if defined CONFIG_I2CBUS_LOG_READWRITES
 
@@ -140,14 +166,14 @@ bool i2cdevReadReg8(I2C_Dev *dev, uint8_t devAddress, uint8_t memAddress,
 bool i2cdevReadReg16(I2C_Dev *dev, uint8_t devAddress, uint16_t memAddress,
                      uint16_t len, uint8_t *data)
 {
-    if (xSemaphoreTake(dev->isBusFreeMutex, (TickType_t)5) == pdFALSE) {
+    if (!i2cdevTakeBus(dev, devAddress)) {
         return false;
     }
 
     uint8_t memAddress8[2];
     memAddress8[0] = (uint8_t)((memAddress >> 8) & 0x00FF);
     memAddress8[1] = (uint8_t)(memAddress & 0x00FF);
-    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
+    i2c_cmd_handle_t cmd = i2c_cmd_link_create_static(dev->cmdLinkBuffer, sizeof(dev->cmdLinkBuffer));
     if (memAddress != I2C_NO_INTERNAL_ADDRESS) {
         i2c_master_start(cmd);
         i2c_master_write_byte(cmd, (devAddress << 1) | I2C_MASTER_WRITE, I2C_MASTER_ACK_EN);
@@ -158,9 +184,9 @@ bool i2cdevReadReg16(I2C_Dev *dev, uint8_t devAddress, uint16_t memAddress,
     i2c_master_read(cmd, data, len, I2C_MASTER_LAST_NACK);
     i2c_master_stop(cmd);
     esp_err_t err = i2c_master_cmd_begin(dev->def->i2cPort, cmd, (TickType_t)5);
-    i2c_cmd_link_delete(cmd);
+    i2c_cmd_link_delete_static(cmd);
 
-    xSemaphoreGive(dev->isBusFreeMutex);
+    i2cdevGiveBus(dev, err);
 
 #if defined CONFIG_I2CBUS_LOG_READWRITES
 
@@ -233,11 +259,11 @@ bool i2cdevWriteBits(I2C_Dev *dev, uint8_t devAddress, uint8_t memAddress,
 bool i2cdevWriteReg8(I2C_Dev *dev, uint8_t devAddress, uint8_t memAddress,
                      uint16_t len, uint8_t *data)
 {
-    if (xSemaphoreTake(dev->isBusFreeMutex, (TickType_t)5) == pdFALSE) {
+    if (!i2cdevTakeBus(dev, devAddress)) {
         return false;
     }
 
-    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
+    i2c_cmd_handle_t cmd = i2c_cmd_link_create_static(dev->cmdLinkBuffer, sizeof(dev->cmdLinkBuffer));
     i2c_master_start(cmd);
     i2c_master_write_byte(cmd, (devAddress << 1) | I2C_MASTER_WRITE, I2C_MASTER_ACK_EN);
     if (memAddress != I2CDEV_NO_MEM_ADDR) {
@@ -246,9 +272,9 @@ bool i2cdevWriteReg8(I2C_Dev *dev, uint8_t devAddress, uint8_t memAddress,
     i2c_master_write(cmd, (uint8_t *)data, len, I2C_MASTER_ACK_EN);
     i2c_master_stop(cmd);
     esp_err_t err = i2c_master_cmd_begin(dev->def->i2cPort, cmd, (TickType_t)5);
-    i2c_cmd_link_delete(cmd);
+    i2c_cmd_link_delete_static(cmd);
 
-    xSemaphoreGive(dev->isBusFreeMutex);
+    i2cdevGiveBus(dev, err);
 
 #if defined CONFIG_I2CBUS_LOG_READWRITES
 
@@ -287,14 +313,14 @@ bool i2cdevWriteReg8(I2C_Dev *dev, uint8_t devAddress, uint8_t memAddress,
 bool i2cdevWriteReg16(I2C_Dev *dev, uint8_t devAddress, uint16_t memAddress,
                       uint16_t len, uint8_t *data)
 {
-    if (xSemaphoreTake(dev->isBusFreeMutex, (TickType_t)5) == pdFALSE) {
+    if (!i2cdevTakeBus(dev, devAddress)) {
         return false;
     }
 
     uint8_t memAddress8[2];
     memAddress8[0] = (uint8_t)((memAddress >> 8) & 0x00FF);
     memAddress8[1] = (uint8_t)(memAddress & 0x00FF);
-    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
+    i2c_cmd_handle_t cmd = i2c_cmd_link_create_static(dev->cmdLinkBuffer, sizeof(dev->cmdLinkBuffer));
     i2c_master_start(cmd);
     i2c_master_write_byte(cmd, (devAddress << 1) | I2C_MASTER_WRITE, I2C_MASTER_ACK_EN);
     if (memAddress != I2C_NO_INTERNAL_ADDRESS) {
@@ -303,9 +329,9 @@ bool i2cdevWriteReg16(I2C_Dev *dev, uint8_t devAddress, uint16_t memAddress,
     i2c_master_write(cmd, (uint8_t *)data, len, I2C_MASTER_ACK_EN);
     i2c_master_stop(cmd);
     esp_err_t err = i2c_master_cmd_begin(dev->def->i2cPort, cmd, (TickType_t)5);
-    i2c_cmd_link_delete(cmd);
+    i2c_cmd_link_delete_static(cmd);
 
-    xSemaphoreGive(dev->isBusFreeMutex);
+    i2cdevGiveBus(dev, err);
 #if defined CONFIG_I2CBUS_LOG_READWRITES
 
     if (!err) {
@@ -340,3 +366,75 @@ bool i2cdevWriteReg16(I2C_Dev *dev, uint8_t devAddress, uint16_t memAddress,
         return false;
     }
 }
+
+static bool i2cdevPrepareRead(I2cdevTransaction *xfer, I2C_Dev *dev, uint8_t devAddress,
+                              uint8_t memAddressLen, uint16_t len, uint8_t *data)
+{
+    xfer->dev = dev;
+    xfer->devAddress = devAddress;
+    xfer->cmd = i2c_cmd_link_create_static(xfer->linkBuffer, sizeof(xfer->linkBuffer));
+
+    if (xfer->cmd == NULL) {
+        return false;
+    }
+
+    esp_err_t err = ESP_OK;
+
+    if (memAddressLen > 0) {
+        err |= i2c_master_start(xfer->cmd);
+        err |= i2c_master_write_byte(xfer->cmd, (devAddress << 1) | I2C_MASTER_WRITE, I2C_MASTER_ACK_EN);
+        err |= i2c_master_write(xfer->cmd, xfer->memAddress, memAddressLen, I2C_MASTER_ACK_EN);
+    }
+    err |= i2c_master_start(xfer->cmd);
+    err |= i2c_master_write_byte(xfer->cmd, (devAddress << 1) | I2C_MASTER_READ, I2C_MASTER_ACK_EN);
+    err |= i2c_master_read(xfer->cmd, data, len, I2C_MASTER_LAST_NACK);
+    err |= i2c_master_stop(xfer->cmd);
+
+    if (err != ESP_OK) {
+        i2c_cmd_link_delete_static(xfer->cmd);
+        xfer->cmd = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+bool i2cdevPrepareReadReg8(I2cdevTransaction *xfer, I2C_Dev *dev, uint8_t devAddress,
+                           uint8_t memAddress, uint16_t len, uint8_t *data)
+{
+    xfer->memAddress[0] = memAddress;
+    return i2cdevPrepareRead(xfer, dev, devAddress, (memAddress != I2CDEV_NO_MEM_ADDR) ? 1 : 0, len, data);
+}
+
+bool i2cdevPrepareReadReg16(I2cdevTransaction *xfer, I2C_Dev *dev, uint8_t devAddress,
+                            uint16_t memAddress, uint16_t len, uint8_t *data)
+{
+    xfer->memAddress[0] = (uint8_t)((memAddress >> 8) & 0x00FF);
+    xfer->memAddress[1] = (uint8_t)(memAddress & 0x00FF);
+    return i2cdevPrepareRead(xfer, dev, devAddress, (memAddress != I2C_NO_INTERNAL_ADDRESS) ? 2 : 0, len, data);
+}
+
+bool i2cdevExecute(I2cdevTransaction *xfer)
+{
+    if (xfer->cmd == NULL) {
+        return false;
+    }
+
+    if (!i2cdevTakeBus(xfer->dev, xfer->devAddress)) {
+        return false;
+    }
+
+    esp_err_t err = i2c_master_cmd_begin(xfer->dev->def->i2cPort, xfer->cmd, (TickType_t)5);
+
+    i2cdevGiveBus(xfer->dev, err);
+
+    return (err == ESP_OK);
+}
+
+void i2cdevReleaseTransaction(I2cdevTransaction *xfer)
+{
+    if (xfer->cmd != NULL) {
+        i2c_cmd_link_delete_static(xfer->cmd);
+        xfer->cmd = NULL;
+    }
+}
@@ -7,9 +7,13 @@
 #include "driver/i2c.h"
 
 #include "stm32_legacy.h"
+#include "busStats.h"
 
 #define I2C_NO_INTERNAL_ADDRESS   0xFFFF
 
+// Command link storage for a register address write followed by a read or write
+#define I2CDRV_CMD_LINK_SIZE      I2C_LINK_RECOMMENDED_SIZE(2)
+
 typedef enum {
     i2cAck,
     i2cNack
@@ -47,6 +51,10 @@ typedef struct {
 typedef struct {
     const I2cDef *def;                    //< Definition of the i2c
     SemaphoreHandle_t isBusFreeMutex;     //< Mutex to protect buss
+    uint8_t cmdLinkBuffer[I2CDRV_CMD_LINK_SIZE]; //< Static command link, only used while holding isBusFreeMutex
+#ifdef CONFIG_BUS_STATS
+    busStats_t stats;                     //< Of the transactions on the bus
+#endif
 } I2cDrv;
 
 // Definitions of i2c busses found in c file.
@@ -203,4 +203,59 @@ bool i2cdevWriteBit(I2C_Dev *dev, uint8_t devAddress, uint8_t memAddress,
 bool i2cdevWriteBits(I2C_Dev *dev, uint8_t devAddress, uint8_t memAddress,
                      uint8_t bitStart, uint8_t length, uint8_t data);
 
+/**
+ * A read transaction that is built once and then replayed on every read.
+ * The command link is stored in linkBuffer, executing it does not allocate
+ * anything. Data is always read into the buffer given when preparing it.
+ */
+typedef struct {
+    I2C_Dev *dev;
+    i2c_cmd_handle_t cmd;
+    uint8_t devAddress;
+    uint8_t memAddress[2];
+    uint8_t linkBuffer[I2CDRV_CMD_LINK_SIZE];
+} I2cdevTransaction;
+
+/**
+ * Prepare a read from an I2C peripheral with an 8bit internal reg/mem address
+ * @param xfer  Transaction to build, must stay valid as long as it is used.
+ * @param dev  Pointer to I2C peripheral to read from
+ * @param devAddress  The device address to read from
+ * @param memAddress  The internal address to read from, I2CDEV_NO_MEM_ADDR if none.
+ * @param len  Number of bytes to read.
+ * @param data  Pointer to the buffer every execution reads the data to.
+ *
+ * @return TRUE if the transaction could be built, otherwise FALSE.
+ */
+bool i2cdevPrepareReadReg8(I2cdevTransaction *xfer, I2C_Dev *dev, uint8_t devAddress,
+                           uint8_t memAddress, uint16_t len, uint8_t *data);
+
+/**
+ * Prepare a read from an I2C peripheral with a 16bit internal reg/mem address
+ * @param xfer  Transaction to build, must stay valid as long as it is used.
+ * @param dev  Pointer to I2C peripheral to read from
+ * @param devAddress  The device address to read from
+ * @param memAddress  The internal address to read from, I2C_NO_INTERNAL_ADDRESS if none.
+ * @param len  Number of bytes to read.
+ * @param data  Pointer to the buffer every execution reads the data to.
+ *
+ * @return TRUE if the transaction could be built, otherwise FALSE.
+ */
+bool i2cdevPrepareReadReg16(I2cdevTransaction *xfer, I2C_Dev *dev, uint8_t devAddress,
+                            uint16_t memAddress, uint16_t len, uint8_t *data);
+
+/**
+ * Run a prepared transaction on its bus.
+ * @param xfer  Transaction built by one of the i2cdevPrepare functions.
+ *
+ * @return TRUE if the transfer was successful, otherwise FALSE.
+ */
+bool i2cdevExecute(I2cdevTransaction *xfer);
+
+/**
+ * Release a prepared transaction so that it can be prepared again.
+ * @param xfer  Transaction built by one of the i2cdevPrepare functions.
+ */
+void i2cdevReleaseTransaction(I2cdevTransaction *xfer);
+
 #endif //__I2CDEV_H__
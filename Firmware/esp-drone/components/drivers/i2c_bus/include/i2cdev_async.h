@@ -0,0 +1,124 @@
+/**
+ *
+ * ESP-Drone Firmware
+ *
+ * Copyright 2019-2020  Espressif Systems (Shanghai)
+ * Copyright (C) 2011-2012 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * i2cdev_async.h - Queued, prioritized I2C transfers executed by a bus task
+ *
+ * The IMU reads of the sensors task are queued at i2cdevAsyncPrioHigh, the
+ * VL53L1 transfers at i2cdevAsyncPrioNormal in chunks, so a ranging read
+ * delays an IMU read by one chunk at most. Ports configured on the same pins
+ * are one bus and share its task, as when the deck port is set to the pins
+ * of the sensors. On their own pins the two never wait for each other.
+ */
+
+#ifndef __I2CDEV_ASYNC_H__
+#define __I2CDEV_ASYNC_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "i2cdev.h"
+
+#define I2CDEV_ASYNC_QUEUE_LENGTH  8
+
+/**
+ * Request priority. The bus task always picks the oldest request of the
+ * highest priority that is queued.
+ */
+typedef enum {
+    i2cdevAsyncPrioHigh = 0,   //< Flight critical, e.g. IMU reads
+    i2cdevAsyncPrioNormal,     //< Ranging and other periodic sensors
+    i2cdevAsyncPrioLow,        //< EEPROM and other background traffic
+    I2CDEV_ASYNC_PRIO_COUNT,
+} I2cdevAsyncPriority;
+
+typedef struct I2cdevAsyncRequest_s I2cdevAsyncRequest;
+
+/**
+ * Completion callback, called from the bus task when the transfer is done,
+ * before isDone is set. Keep it short, the next request is not started until
+ * it returns.
+ */
+typedef void (*I2cdevAsyncCallback)(I2cdevAsyncRequest *request);
+
+/**
+ * An I2C request. The request is owned by the bus task from submit until
+ * isDone is set, it and its data buffer must stay valid until then. With a
+ * transaction, the prepared read is run instead of the transfer described
+ * by direction to data.
+ */
+struct I2cdevAsyncRequest_s {
+    // Set by the caller
+    I2cDirection        direction;    //< i2cWrite or i2cRead
+    uint8_t             devAddress;   //< The device address
+    bool                isMem16bit;   //< If true memAddress is 16 bit, else 8 bit
+    uint16_t            memAddress;   //< Internal address, I2CDEV_NO_MEM_ADDR/I2C_NO_INTERNAL_ADDRESS if none
+    uint16_t            len;          //< Number of bytes to transfer
+    uint8_t             *data;        //< Buffer to read to or write from
+    I2cdevTransaction   *transaction; //< Prepared read of i2cdevPrepareReadReg8/16, may be NULL
+    I2cdevAsyncCallback callback;     //< Called on completion, may be NULL
+    TaskHandle_t        notifyTask;   //< Gets a task notification on completion, may be NULL
+    void                *arg;         //< User data for the callback
+    // Set by i2cdevAsyncSubmit() and the bus task
+    I2C_Dev             *dev;
+    volatile bool       isDone;
+    bool                success;
+};
+
+/**
+ * Start the bus task for an I2C bus, or share the task of a port on the same
+ * pins. Called by i2cdevInit().
+ * @param dev  The bus to start the task for.
+ *
+ * @return TRUE if the bus task is running, otherwise FALSE.
+ */
+bool i2cdevAsyncInit(I2C_Dev *dev);
+
+/**
+ * Queue a request without waiting for it to finish.
+ * @param dev  The bus to use.
+ * @param request  The request, see I2cdevAsyncRequest for ownership.
+ * @param prio  Queue to put the request in.
+ *
+ * @return TRUE if queued, FALSE if the queue is full or the bus task is not running.
+ */
+bool i2cdevAsyncSubmit(I2C_Dev *dev, I2cdevAsyncRequest *request, I2cdevAsyncPriority prio);
+
+/**
+ * Queue a request and block until it is done. Uses the task notification
+ * of the calling task to wait. Every transfer is bounded by the bus timeout
+ * of the blocking i2cdev functions, so the wait is bounded as well. Without
+ * a bus task the transfer is done by the calling task.
+ * @param dev  The bus to use.
+ * @param request  The request, callback and notifyTask are overwritten.
+ * @param prio  Queue to put the request in.
+ *
+ * @return TRUE if the transfer was successful, otherwise FALSE.
+ */
+bool i2cdevAsyncTransfer(I2C_Dev *dev, I2cdevAsyncRequest *request, I2cdevAsyncPriority prio);
+
+/**
+ * Number of requests that could not be queued because the queue was full.
+ */
+uint32_t i2cdevAsyncGetDroppedCount(I2C_Dev *dev);
+
+#endif //__I2CDEV_ASYNC_H__
@@ -417,10 +417,10 @@ THE SOFTWARE.
 #define MPU6050_G_PER_LSB_8      (float)((2 * 8) / 65536.0)
 #define MPU6050_G_PER_LSB_16     (float)((2 * 16) / 65536.0)
 
-#define MPU6050_ST_GYRO_LOW      10.0   // deg/s
-#define MPU6050_ST_GYRO_HIGH     105.0  // deg/s
-#define MPU6050_ST_ACCEL_LOW     0.300  // G
-#define MPU6050_ST_ACCEL_HIGH    0.950  // G
+#define MPU6050_ST_GYRO_LOW      10.0f  // deg/s
+#define MPU6050_ST_GYRO_HIGH     105.0f // deg/s
+#define MPU6050_ST_ACCEL_LOW     0.300f // G
+#define MPU6050_ST_ACCEL_HIGH    0.950f // G
 
 // note: DMP code memory blocks defined at end of header file
 
@@ -55,14 +55,14 @@
 #define MS5611_PROM_REG_SIZE 2 // size in bytes of a prom registry.
 
 // Self test parameters. Only checks that values are sane
-#define MS5611_ST_PRESS_MAX   (1100.0) //mbar
-#define MS5611_ST_PRESS_MIN   (450.0)  //mbar
-#define MS5611_ST_TEMP_MAX    (60.0)   //degree celcius
-#define MS5611_ST_TEMP_MIN    (-20.0)  //degree celcius
+#define MS5611_ST_PRESS_MAX   (1100.0f) //mbar
+#define MS5611_ST_PRESS_MIN   (450.0f)  //mbar
+#define MS5611_ST_TEMP_MAX    (60.0f)   //degree celcius
+#define MS5611_ST_TEMP_MIN    (-20.0f)  //degree celcius
 
 // Constants used to determine altitude from pressure
 #define CONST_SEA_PRESSURE 102610.f //1026.1f //http://www.meteo.physik.uni-muenchen.de/dokuwiki/doku.php?id=wetter:stadt:messung
-#define CONST_PF 0.1902630958 //(1/5.25588f) Pressure factor
+#define CONST_PF 0.1902630958f //(1/5.25588f) Pressure factor
 #define CONST_PF2 44330.0f
 
 
@@ -82,6 +82,6 @@ void ms5611Reset();
 void ms5611StartConversion(uint8_t command);
 int32_t ms5611GetConversion(uint8_t command);
 
-void ms5611GetData(float *pressure, float *temperature, float *asl);
+bool ms5611Update(uint32_t tick, float *pressure, float *temperature);
 float ms5611PressureToAltitude(float *pressure);
 #endif // MS5611_H
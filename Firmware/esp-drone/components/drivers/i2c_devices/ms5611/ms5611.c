@@ -59,9 +59,25 @@ static uint32_t lastPresConv;
 static uint32_t lastTempConv;
 static int32_t  tempCache;
 
-static uint8_t readState = 0;
-static uint32_t lastConv = 0;
-static int32_t tempDeltaT;
+typedef enum {
+    MS5611_STATE_IDLE,
+    MS5611_STATE_TEMPERATURE,   // D2 conversion running
+    MS5611_STATE_PRESSURE,      // D1 conversion running
+} ms5611State_t;
+
+// Compensation terms of the datasheet, updated with each temperature reading
+typedef struct {
+    int32_t tref;   // C5 * 2^8
+    int64_t off;    // OFF at the last temperature
+    int64_t sens;   // SENS at the last temperature
+    int32_t temp;   // 0.01 degree celcius << EXTRA_PRECISION
+    bool isValid;
+} CalCache;
+
+static ms5611State_t state = MS5611_STATE_IDLE;
+static uint32_t conversionStartTick;
+static uint8_t pressureReadCount;
+static CalCache calCache;
 
 bool ms5611Init(I2C_Dev *i2cPort)
 {
@@ -79,6 +95,10 @@ bool ms5611Init(I2C_Dev *i2cPort)
         return false;
     }
 
+    calCache.tref = ((int32_t)calReg.tref) << 8;
+    calCache.isValid = false;
+    state = MS5611_STATE_IDLE;
+
     isInit = true;
 
     return true;
@@ -145,7 +165,7 @@ float ms5611GetPressure(uint8_t osr)
 
     if (rawPress != 0) {
         return ((((rawPress * sens) >> 21) - off) >> (15 - EXTRA_PRECISION))
-               / ((1 << EXTRA_PRECISION) * 100.0);
+               / ((1 << EXTRA_PRECISION) * 100.0f);
     } else {
         return 0;
     }
@@ -164,7 +184,7 @@ float ms5611CalcPressure(int32_t rawPress, int32_t dT)
     sens = (((int64_t)calReg.psens) << 15) + ((calReg.tcs * (int64_t)dT) >> 8);
 
     return ((((rawPress * sens) >> 21) - off) >> (15 - EXTRA_PRECISION))
-           / ((1 << EXTRA_PRECISION) * 100.0);
+           / ((1 << EXTRA_PRECISION) * 100.0f);
 }
 
 float ms5611GetTemperature(uint8_t osr)
@@ -306,55 +326,66 @@ void ms5611Reset()
 
 
 
+static void ms5611UpdateCalCache(int32_t rawTemp)
+{
+    int64_t dT = rawTemp - calCache.tref;
+
+    calCache.off = (((int64_t)calReg.off) << 16) + ((calReg.tco * dT) >> 7);
+    calCache.sens = (((int64_t)calReg.psens) << 15) + ((calReg.tcs * dT) >> 8);
+    calCache.temp = ((1 << EXTRA_PRECISION) * 2000) + (int32_t)((dT * calReg.tsens) >> (23 - EXTRA_PRECISION));
+    calCache.isValid = true;
+}
+
+static void ms5611StartState(ms5611State_t next, uint32_t tick)
+{
+    ms5611StartConversion(next == MS5611_STATE_TEMPERATURE ?
+                          MS5611_D2 + MS5611_OSR_DEFAULT : MS5611_D1 + MS5611_OSR_DEFAULT);
+    conversionStartTick = tick;
+    state = next;
+}
+
 /**
- * Gets pressure, temperature and above sea level altitude estimate (asl).
- * Best called at 100hz. For every PRESSURE_PER_TEMP-1 pressure readings temp is read once.
- * Effective 50-90hz baro update and 50-10hz temperature update if called at 100hz.
+ * Steps the conversion cycle, without ever waiting for the sensor. A call
+ * before the running conversion is done returns right away, the first one
+ * after reads its result and starts the next conversion. For every
+ * PRESSURE_PER_TEMP-1 pressure conversions the temperature is converted once.
+ * Only the integer compensation runs here, the terms depending on the
+ * temperature are computed once per temperature reading.
+ * @return true when pressure [mbar] and temperature [degree celcius] are new.
  */
-void ms5611GetData(float *pressure, float *temperature, float *asl)
+bool ms5611Update(uint32_t tick, float *pressure, float *temperature)
 {
-    int32_t tempPressureRaw, tempTemperatureRaw;
-    static float savedPress, savedTemp;
+    bool isNewPressure = false;
 
-    // Dont reader faster than we can
-    uint32_t now = xTaskGetTickCount();
+    if (!isInit) {
+        return false;
+    }
 
-    if ((now - lastConv) < CONVERSION_TIME_MS) {
-        *pressure = savedPress;
-        *temperature = savedTemp;
-        return;
+    if (state != MS5611_STATE_IDLE && (tick - conversionStartTick) < M2T(CONVERSION_TIME_MS)) {
+        return false;
+    }
+
+    if (state == MS5611_STATE_TEMPERATURE) {
+        ms5611UpdateCalCache(ms5611GetConversion(MS5611_D2 + MS5611_OSR_DEFAULT));
+        pressureReadCount = 0;
+    } else if (state == MS5611_STATE_PRESSURE) {
+        int64_t rawPress = ms5611GetConversion(MS5611_D1 + MS5611_OSR_DEFAULT);
+        // 0.01 mbar << EXTRA_PRECISION
+        int32_t press = (int32_t)((((rawPress * calCache.sens) >> 21) - calCache.off) >> (15 - EXTRA_PRECISION));
+
+        *pressure = press / ((1 << EXTRA_PRECISION) * 100.0f);
+        *temperature = calCache.temp / ((1 << EXTRA_PRECISION) * 100.0f);
+        isNewPressure = (rawPress != 0);
+        pressureReadCount++;
     }
 
-    lastConv = now;
-
-    if (readState == 0) {
-        // read temp
-        ++readState;
-        tempTemperatureRaw = ms5611GetConversion(MS5611_D2 + MS5611_OSR_DEFAULT);
-        tempDeltaT = ms5611CalcDeltaTemp(tempTemperatureRaw);
-        *temperature = ms5611CalcTemp(tempDeltaT);
-        savedTemp = *temperature;
-        *pressure = savedPress;
-        // cmd to read pressure
-        ms5611StartConversion(MS5611_D1 + MS5611_OSR_DEFAULT);
+    if (!calCache.isValid || pressureReadCount >= PRESSURE_PER_TEMP - 1) {
+        ms5611StartState(MS5611_STATE_TEMPERATURE, tick);
     } else {
-        // read pressure
-        ++readState;
-        tempPressureRaw = ms5611GetConversion(MS5611_D1 + MS5611_OSR_DEFAULT);
-        *pressure = ms5611CalcPressure(tempPressureRaw, tempDeltaT);
-        savedPress = *pressure;
-        *asl = ms5611PressureToAltitude(pressure);
-        *temperature = savedTemp;
-
-        if (readState == PRESSURE_PER_TEMP) {
-            // cmd to read temp
-            ms5611StartConversion(MS5611_D2 + MS5611_OSR_DEFAULT);
-            readState = 0;
-        } else {
-            // cmd to read pressure
-            ms5611StartConversion(MS5611_D1 + MS5611_OSR_DEFAULT);
-        }
+        ms5611StartState(MS5611_STATE_PRESSURE, tick);
     }
+
+    return isNewPressure;
 }
 
 //TODO: pretty expensive function. Rather smooth the pressure estimates and only call this when needed
@@ -38,13 +38,17 @@
 #include "stabilizer_types.h"
 #include "estimator.h"
 #include "cf_math.h"
+#include "streamStats.h"
+#include "static_mem.h"
 
 // Measurement noise model
-static const float expPointA = 1.0f;
-static const float expStdA = 0.0025f; // STD at elevation expPointA [m]
-static const float expPointB = 1.3f;
-static const float expStdB = 0.2f;    // STD at elevation expPointB [m]
-static float expCoeff;
+static float expPointA = 1.0f;
+static float expStdA = 0.0025f; // STD at elevation expPointA [m]
+static float expPointB = 1.3f;
+static float expStdB = 0.2f;    // STD at elevation expPointB [m]
+// Tabulated by the ranger task once the params change
+static rangeNoiseModel_t noiseModel;
+static bool isNoiseModelWritten = true;
 
 #define RANGE_OUTLIER_LIMIT 3000 // the measured range is in [mm]
 
@@ -52,6 +56,13 @@ static uint16_t range_last = 0;
 
 static bool isInit;
 
+STATIC_MEM_TASK_ALLOC(zRangerTask, ZRANGER_TASK_STACKSIZE);
+
+#if CONFIG_ZRANGER_MEDIAN_WINDOW > 1
+// The feasible ranges, the estimator gets their median
+STREAM_STATS_DEFINE(rangeWindow, CONFIG_ZRANGER_MEDIAN_WINDOW);
+#endif
+
 static VL53L0xDev dev;
 
 static uint8_t vl53l0dataReady = 0;
@@ -142,13 +153,15 @@ void zRangerInit(void)
 	{
     DEBUG_PRINT( "VL53L0X I2C commection [OK].\n");
   }
+  else
+  {
+    // No sensor, no task
+    return;
+  }
 
   vl53l0xInit(&dev, I2C1_DEV, true);
 
-  xTaskCreate(zRangerTask, ZRANGER_TASK_NAME, ZRANGER_TASK_STACKSIZE, NULL, ZRANGER_TASK_PRI, NULL);
-
-  // pre-compute constant in the measurement noise model for kalman
-  expCoeff = logf(expStdB / expStdA) / (expPointB - expPointA);
+  STATIC_MEM_TASK_CREATE(zRangerTask, zRangerTask, ZRANGER_TASK_NAME, NULL, ZRANGER_TASK_PRI);
 
   isInit = true;
 }
@@ -187,8 +200,16 @@ void zRangerTask(void* arg)
     // the sensor should not be able to measure >3 [m], and outliers typically
     // occur as >8 [m] measurements
     if (range_last < RANGE_OUTLIER_LIMIT) {
+#if CONFIG_ZRANGER_MEDIAN_WINDOW > 1
+      streamStatsAdd(&rangeWindow, range_last);
+      float distance = (float)streamStatsMedian(&rangeWindow) * 0.001f; // Scale from [mm] to [m]
+#else
       float distance = (float)range_last * 0.001f; // Scale from [mm] to [m]
-      float stdDev = expStdA * (1.0f  + expf( expCoeff * (distance - expPointA)));
+#endif
+      if (__atomic_exchange_n(&isNoiseModelWritten, false, __ATOMIC_ACQUIRE)) {
+        rangeNoiseModelBuildExp(&noiseModel, RANGE_OUTLIER_LIMIT * 0.001f, expPointA, expStdA, expPointB, expStdB);
+      }
+      float stdDev = rangeNoiseModelStdDev(&noiseModel, distance);
       rangeEnqueueDownRangeInEstimator(distance, stdDev, xTaskGetTickCount());
     }
   }
@@ -220,6 +241,18 @@ bool zRangerReadRange(zDistance_t* zrange, const uint32_t tick)
 
 // DECK_DRIVER(zranger_deck);
 
+static void noiseModelWritten(void)
+{
+  __atomic_store_n(&isNoiseModelWritten, true, __ATOMIC_RELEASE);
+}
+
+PARAM_GROUP_START(zRanger)
+PARAM_ADD_WITH_CALLBACK(PARAM_FLOAT, expPointA, &expPointA, noiseModelWritten)
+PARAM_ADD_WITH_CALLBACK(PARAM_FLOAT, expStdA, &expStdA, noiseModelWritten)
+PARAM_ADD_WITH_CALLBACK(PARAM_FLOAT, expPointB, &expPointB, noiseModelWritten)
+PARAM_ADD_WITH_CALLBACK(PARAM_FLOAT, expStdB, &expStdB, noiseModelWritten)
+PARAM_GROUP_STOP(zRanger)
+
 PARAM_GROUP_START(deck)
 PARAM_ADD(PARAM_UINT8 | PARAM_RONLY, bcZRanger, &isInit)
 PARAM_GROUP_STOP(deck)
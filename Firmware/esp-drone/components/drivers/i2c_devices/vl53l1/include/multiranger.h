@@ -0,0 +1,48 @@
+/**
+ *
+ * ESP-Drone Firmware
+ *
+ * Copyright 2019-2020  Espressif Systems (Shanghai)
+ * Copyright (C) 2012 BitCraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * multiranger.h: Array of VL53L1X ranging sensors on one I2C bus
+ */
+
+#ifndef _MULTIRANGER_H_
+#define _MULTIRANGER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "range.h"
+
+/**
+ * Bring up the sensors, must run before zRanger2Init() since the sensors all
+ * wake up on the default I2C address.
+ */
+void multirangerInit(void);
+
+bool multirangerTest(void);
+
+/**
+ * The last reading of the sensor looking in a direction
+ *
+ * @param direction Direction of the sensor
+ * @param rangeMm Range in mm, OBSTACLE_MAP_NONE if nothing was in range
+ * @return false if there is no such sensor or its last reading is stale
+ */
+bool multirangerGetRangeMm(rangeDirection_t direction, uint16_t *rangeMm);
+
+#endif /* _MULTIRANGER_H_ */
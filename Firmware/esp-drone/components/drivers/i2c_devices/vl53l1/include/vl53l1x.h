@@ -30,9 +30,14 @@
 #ifndef _VL53L1X_H_
 #define _VL53L1X_H_
 
+#include "sdkconfig.h"
+#ifdef CONFIG_VL53L1_LITE
+#include "vl53l1x_lite.h"
+#else
 #include "vl53l1_ll_def.h"
 #include "vl53l1_platform_user_data.h"
 #include "vl53l1_api.h"
+#endif
 #include "i2cdev.h"
 
 #ifdef __cplusplus
@@ -57,6 +62,12 @@ bool vl53l1xTestConnection(VL53L1_Dev_t* pdev);
 
 VL53L1_Error vl53l1xSetI2CAddress(VL53L1_Dev_t* pdev, uint8_t address);
 
+/**
+ * Read the device range status and the gain corrected range of the last
+ * measurement, in a single transfer from the result registers.
+ */
+VL53L1_Error vl53l1xReadRange(VL53L1_Dev_t *pdev, uint8_t *deviceStatus, uint16_t *rangeMm);
+
 /**
  * @brief Writes the supplied byte buffer to the device
  *
@@ -0,0 +1,95 @@
+/**
+ *
+ * ESP-Drone Firmware
+ *
+ * Copyright 2019-2020  Espressif Systems (Shanghai)
+ * Copyright (C) 2012 BitCraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * vl53l1x_lite.h: Register level VL53L1X driver
+ *
+ * Selected with CONFIG_VL53L1_LITE in place of the ST API of core/src. It
+ * implements the part of the API the ranging drivers use, under the same
+ * names, on a few bytes of state per sensor. Only the types, constants and
+ * register names of core/inc are used.
+ */
+
+#ifndef _VL53L1X_LITE_H_
+#define _VL53L1X_LITE_H_
+
+#include "vl53l1_def.h"
+#include "i2cdev.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+typedef struct {
+  uint8_t I2cDevAddr;
+  I2C_Dev *I2Cx;
+  VL53L1_PresetModes presetMode;
+  VL53L1_DistanceModes distanceMode;
+  uint16_t timingBudgetMs;
+} VL53L1_Dev_t;
+
+typedef VL53L1_Dev_t *VL53L1_DEV;
+
+/**
+ * As in the ST API, the 8 bit address, that is the 7 bit address shifted left
+ */
+VL53L1_Error VL53L1_SetDeviceAddress(VL53L1_DEV Dev, uint8_t DeviceAddress);
+
+/**
+ * VL53L1_PRESETMODE_LITE_RANGING ranges back to back, the other presets in
+ * the timed mode of VL53L1_SetInterMeasurementPeriodMilliSeconds()
+ */
+VL53L1_Error VL53L1_SetPresetMode(VL53L1_DEV Dev, VL53L1_PresetModes PresetMode);
+
+/**
+ * The short mode, or the long one for VL53L1_DISTANCEMODE_MEDIUM as well,
+ * there is no medium tuning at the register level
+ */
+VL53L1_Error VL53L1_SetDistanceMode(VL53L1_DEV Dev, VL53L1_DistanceModes DistanceMode);
+
+/**
+ * Rounded down to the nearest of 15 (short mode only), 20, 33, 50, 100, 200
+ * or 500 ms
+ */
+VL53L1_Error VL53L1_SetMeasurementTimingBudgetMicroSeconds(VL53L1_DEV Dev,
+    uint32_t MeasurementTimingBudgetMicroSeconds);
+
+VL53L1_Error VL53L1_SetInterMeasurementPeriodMilliSeconds(VL53L1_DEV Dev,
+    uint32_t InterMeasurementPeriodMilliSeconds);
+
+VL53L1_Error VL53L1_StartMeasurement(VL53L1_DEV Dev);
+
+VL53L1_Error VL53L1_StopMeasurement(VL53L1_DEV Dev);
+
+VL53L1_Error VL53L1_ClearInterruptAndStartMeasurement(VL53L1_DEV Dev);
+
+VL53L1_Error VL53L1_GetMeasurementDataReady(VL53L1_DEV Dev, uint8_t *pMeasurementDataReady);
+
+/**
+ * The range status is that of the device, mapped as by the ST API but
+ * without its sigma and signal limit checks, they are left to the device
+ */
+VL53L1_Error VL53L1_GetRangingMeasurementData(VL53L1_DEV Dev,
+    VL53L1_RangingMeasurementData_t *pRangingMeasurementData);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _VL53L1X_LITE_H_ */
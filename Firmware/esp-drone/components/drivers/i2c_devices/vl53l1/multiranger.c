@@ -0,0 +1,263 @@
+/**
+ *
+ * ESP-Drone Firmware
+ *
+ * Copyright 2019-2020  Espressif Systems (Shanghai)
+ * Copyright (C) 2012 BitCraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * multiranger.c: Array of VL53L1X ranging sensors on one I2C bus
+ *
+ * The sensors range back to back, each new measurement starts when the last
+ * one is handed back. One task owns them all and gives every sensor its own
+ * slot of the period, in which it collects its measurement and starts the
+ * next one. The measurement windows and the bus transfers of the sensors are
+ * spread over the period that way, and they do not drift into each other as
+ * free running sensors would. The readings feed the range log, the
+ * obstacle map and multirangerGetRangeMm().
+ */
+
+#include <math.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "driver/gpio.h"
+
+#include "config.h"
+#include "system.h"
+#include "range.h"
+#include "obstacle_map.h"
+#include "i2cdev.h"
+#include "multiranger.h"
+#include "vl53l1x.h"
+#include "stm32_legacy.h"
+#include "deadlinemonitor.h"
+#include "static_mem.h"
+
+#define DEBUG_MODULE "MR"
+#include "debug_cf.h"
+
+#ifdef CONFIG_MULTIRANGER
+
+#define MR_PERIOD_MS        25
+// A measurement is over before the slot of its sensor comes again
+#define MR_TIMING_BUDGET_US 20000
+#define MR_FOV              (27.0f * (float)M_PI / 180.0f)
+// Readings older than this are not handed out any more
+#define MR_STALE_MS         (3 * MR_PERIOD_MS)
+
+typedef struct {
+  int xshutPin;
+  rangeDirection_t direction;
+  bool mapped;      // feeds the horizontal obstacle map
+  float bearing;
+  bool present;
+  uint16_t rangeMm; // last reading, OBSTACLE_MAP_NONE if nothing was in range
+  TickType_t rangeTick;
+  VL53L1_Dev_t dev;
+} multirangerSensor_t;
+
+static multirangerSensor_t sensors[] = {
+  { .xshutPin = CONFIG_MULTIRANGER_FRONT_XSHUT_PIN, .direction = rangeFront, .mapped = true, .bearing = 0.0f },
+  { .xshutPin = CONFIG_MULTIRANGER_BACK_XSHUT_PIN, .direction = rangeBack, .mapped = true, .bearing = (float)M_PI },
+  { .xshutPin = CONFIG_MULTIRANGER_LEFT_XSHUT_PIN, .direction = rangeLeft, .mapped = true, .bearing = (float)M_PI / 2 },
+  { .xshutPin = CONFIG_MULTIRANGER_RIGHT_XSHUT_PIN, .direction = rangeRight, .mapped = true, .bearing = -(float)M_PI / 2 },
+  { .xshutPin = CONFIG_MULTIRANGER_UP_XSHUT_PIN, .direction = rangeUp, .mapped = false },
+};
+
+#define MR_SENSORS_COUNT (sizeof(sensors) / sizeof(sensors[0]))
+
+// The present sensors in the order of their slots
+static multirangerSensor_t *slots[MR_SENSORS_COUNT];
+static int slotsCount;
+
+static bool isInit;
+
+static void multirangerTask(void *arg);
+
+STATIC_MEM_TASK_ALLOC(multirangerTask, MULTIRANGER_TASK_STACKSIZE);
+
+static bool multirangerStart(multirangerSensor_t *sensor, uint8_t address)
+{
+  // Out of reset the sensor answers on the default address, move it away
+  gpio_set_level(sensor->xshutPin, 1);
+  vTaskDelay(M2T(2));
+
+  if (!vl53l1xInit(&sensor->dev, I2C1_DEV) ||
+      vl53l1xSetI2CAddress(&sensor->dev, address) != VL53L1_ERROR_NONE) {
+    return false;
+  }
+
+  // Back to back, the task starts every measurement in the slot of the sensor
+  VL53L1_SetPresetMode(&sensor->dev, VL53L1_PRESETMODE_LITE_RANGING);
+  VL53L1_SetDistanceMode(&sensor->dev, VL53L1_DISTANCEMODE_MEDIUM);
+
+  return VL53L1_SetMeasurementTimingBudgetMicroSeconds(&sensor->dev, MR_TIMING_BUDGET_US) == VL53L1_ERROR_NONE;
+}
+
+void multirangerInit(void)
+{
+  if (isInit) {
+    return;
+  }
+
+  // Hold every sensor in reset before giving them addresses one at a time
+  for (int i = 0; i < MR_SENSORS_COUNT; i++) {
+    if (sensors[i].xshutPin >= 0) {
+      gpio_reset_pin(sensors[i].xshutPin);
+      gpio_set_direction(sensors[i].xshutPin, GPIO_MODE_OUTPUT);
+      gpio_set_level(sensors[i].xshutPin, 0);
+    }
+  }
+  vTaskDelay(M2T(2));
+
+  obstacleMapInit();
+
+  for (int i = 0; i < MR_SENSORS_COUNT; i++) {
+    if (sensors[i].xshutPin < 0) {
+      continue;
+    }
+
+    sensors[i].present = multirangerStart(&sensors[i], VL53L1X_DEFAULT_ADDRESS + 1 + i);
+    if (sensors[i].present) {
+      slots[slotsCount++] = &sensors[i];
+    } else {
+      // Keep it off the bus so it does not clash with the next one
+      gpio_set_level(sensors[i].xshutPin, 0);
+      DEBUG_PRINTW("Ranger %d [FAIL]\n", i);
+    }
+  }
+
+  if (slotsCount == 0) {
+    return;
+  }
+  DEBUG_PRINTI("%d rangers [OK]\n", slotsCount);
+
+  STATIC_MEM_TASK_CREATE(multirangerTask, multirangerTask, MULTIRANGER_TASK_NAME, NULL, MULTIRANGER_TASK_PRI);
+  isInit = true;
+}
+
+bool multirangerTest(void)
+{
+  return isInit;
+}
+
+bool multirangerGetRangeMm(rangeDirection_t direction, uint16_t *rangeMm)
+{
+  for (int i = 0; i < slotsCount; i++) {
+    const multirangerSensor_t *sensor = slots[i];
+
+    if (sensor->direction == direction) {
+      const TickType_t tick = sensor->rangeTick;
+
+      if (tick == 0 || xTaskGetTickCount() - tick > M2T(MR_STALE_MS)) {
+        return false;
+      }
+      *rangeMm = sensor->rangeMm;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+static void multirangerCollect(multirangerSensor_t *sensor)
+{
+  VL53L1_RangingMeasurementData_t rangingData;
+  uint8_t dataReady = 0;
+
+  // Not over yet, it is collected in its next slot
+  if (VL53L1_GetMeasurementDataReady(&sensor->dev, &dataReady) != VL53L1_ERROR_NONE || !dataReady) {
+    return;
+  }
+
+  VL53L1_GetRangingMeasurementData(&sensor->dev, &rangingData);
+  VL53L1_ClearInterruptAndStartMeasurement(&sensor->dev);
+
+  switch (rangingData.RangeStatus) {
+    case VL53L1_RANGESTATUS_RANGE_VALID:
+      sensor->rangeMm = rangingData.RangeMilliMeter;
+      rangeSet(sensor->direction, rangingData.RangeMilliMeter / 1000.0f);
+      break;
+    case VL53L1_RANGESTATUS_SIGNAL_FAIL:
+    case VL53L1_RANGESTATUS_OUTOFBOUNDS_FAIL:
+      // Nothing in range, the whole cone is free
+      sensor->rangeMm = OBSTACLE_MAP_NONE;
+      break;
+    default:
+      return;
+  }
+
+  sensor->rangeTick = xTaskGetTickCount();
+  if (sensor->mapped) {
+    obstacleMapUpdate(sensor->bearing, MR_FOV, sensor->rangeMm);
+  }
+}
+
+static void multirangerTask(void *arg)
+{
+  const TickType_t slotTicks = M2T(MR_PERIOD_MS) / slotsCount;
+  TickType_t lastWakeTime;
+
+  systemWaitStart();
+  lastWakeTime = xTaskGetTickCount();
+
+  // The first measurements start one slot apart
+  for (int i = 0; i < slotsCount; i++) {
+    if (i > 0) {
+      vTaskDelayUntil(&lastWakeTime, slotTicks);
+    }
+    VL53L1_StartMeasurement(&slots[i]->dev);
+  }
+
+  bool wasDegraded = false;
+  deadlineMonitorRegister(dmMultiranger, 1000 * T2M(slotTicks), MULTIRANGER_TASK_BUDGET_US);
+
+  while (1) {
+    for (int i = 0; i < slotsCount; i++) {
+      // The slots take twice as long while the flight tasks overrun
+      const bool isDegraded = deadlineMonitorIsDegraded();
+      if (isDegraded != wasDegraded) {
+        deadlineMonitorRegister(dmMultiranger, 1000 * T2M(slotTicks) * (isDegraded ? 2 : 1), MULTIRANGER_TASK_BUDGET_US);
+        wasDegraded = isDegraded;
+      }
+      if (isDegraded) {
+        lastWakeTime += slotTicks;
+      }
+
+      vTaskDelayUntil(&lastWakeTime, slotTicks);
+      deadlineMonitorCheckIn(dmMultiranger);
+      multirangerCollect(slots[i]);
+      deadlineMonitorCheckOut(dmMultiranger);
+    }
+  }
+}
+
+#else
+
+void multirangerInit(void)
+{
+}
+
+bool multirangerTest(void)
+{
+  return false;
+}
+
+bool multirangerGetRangeMm(rangeDirection_t direction, uint16_t *rangeMm)
+{
+  return false;
+}
+
+#endif // CONFIG_MULTIRANGER
@@ -39,7 +39,10 @@
 #include "freertos/task.h"
 
 #include "i2cdev.h"
+#include "i2cdev_async.h"
 #include "vl53l1x.h"
+#include "vl53l1_register_map.h"
+#include "vl53l1_register_settings.h"
 #define DEBUG_MODULE "VLX1"
 #include "debug_cf.h"
 
@@ -49,10 +52,14 @@
 	#define VL53L1_get_register_name(a,b)
 #endif
 
+// Registers of a transfer per queued I2C request, see vl53l1xTransfer()
+#define VL53L1_I2C_CHUNK_SIZE 4
+
 // Set the start address 8 step after the VL53L0 dynamic addresses
 //static int nextI2CAddress = VL53L1X_DEFAULT_ADDRESS+8;
 
 
+#ifndef CONFIG_VL53L1_LITE
 bool vl53l1xInit(VL53L1_Dev_t *pdev, I2C_Dev *I2cHandle)
 {
   VL53L1_Error status = VL53L1_ERROR_NONE;
@@ -117,6 +124,7 @@ bool vl53l1xTestConnection(VL53L1_Dev_t* pdev)
 
   return status == VL53L1_ERROR_NONE;
 }
+#endif
 
 /** Set I2C address
  * Any subsequent communication will be on the new address
@@ -127,16 +135,60 @@ VL53L1_Error vl53l1xSetI2CAddress(VL53L1_Dev_t* pdev, uint8_t address)
 {
   VL53L1_Error status = VL53L1_ERROR_NONE;
 
-  status = VL53L1_SetDeviceAddress(pdev, address);
+  status = VL53L1_SetDeviceAddress(pdev, address << 1);
   pdev->I2cDevAddr = address;
   return  status;
 }
 
+#ifndef CONFIG_VL53L1_LITE
+VL53L1_Error vl53l1xReadRange(VL53L1_Dev_t *pdev, uint8_t *deviceStatus, uint16_t *rangeMm)
+{
+  // From the range status to the range of SD0 in one transfer
+  uint8_t result[VL53L1_RESULT__FINAL_CROSSTALK_CORRECTED_RANGE_MM_SD0 + 2 - VL53L1_RESULT__RANGE_STATUS];
+  VL53L1_Error status = VL53L1_ReadMulti(pdev, VL53L1_RESULT__RANGE_STATUS, result, sizeof(result));
+
+  if (status == VL53L1_ERROR_NONE) {
+    const uint8_t *rangeSd0 = &result[VL53L1_RESULT__FINAL_CROSSTALK_CORRECTED_RANGE_MM_SD0 - VL53L1_RESULT__RANGE_STATUS];
+    int32_t range = ((uint16_t)rangeSd0[0] << 8) | rangeSd0[1];
+
+    // The gain correction of VL53L1_GetRangingMeasurementData()
+    range = (range * pdev->Data.LLData.gain_cal.standard_ranging_gain_factor + 0x0400) / 0x0800;
+    *deviceStatus = result[0] & VL53L1_RANGE_STATUS__RANGE_STATUS_MASK;
+    *rangeMm = range;
+  }
+
+  return status;
+}
+#endif
+
 
 /*
  * ----------------- COMMS FUNCTIONS -----------------
  */
 
+/* Queues the transfer behind the IMU reads of the bus, see i2cdev_async.h,
+ * in chunks of VL53L1_I2C_CHUNK_SIZE registers. The bus is released between
+ * them, so an IMU read waits for one chunk at most, under 1ms at 100kHz. */
+static bool vl53l1xTransfer(VL53L1_Dev_t *pdev, I2cDirection direction, uint16_t index, uint8_t *data, uint32_t count)
+{
+  for (uint32_t offset = 0; offset < count; offset += VL53L1_I2C_CHUNK_SIZE) {
+    I2cdevAsyncRequest request = {
+      .direction = direction,
+      .devAddress = pdev->I2cDevAddr,
+      .isMem16bit = true,
+      .memAddress = index + offset,
+      .len = (count - offset < VL53L1_I2C_CHUNK_SIZE) ? count - offset : VL53L1_I2C_CHUNK_SIZE,
+      .data = &data[offset],
+    };
+
+    if (!i2cdevAsyncTransfer(pdev->I2Cx, &request, i2cdevAsyncPrioNormal)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
 VL53L1_Error VL53L1_WriteMulti(
 	VL53L1_Dev_t *pdev,
 	uint16_t      index,
@@ -145,7 +197,7 @@ VL53L1_Error VL53L1_WriteMulti(
 {
 	VL53L1_Error status         = VL53L1_ERROR_NONE;
 
-  if (!i2cdevWrite16(pdev->I2Cx, pdev->I2cDevAddr, index, count, pdata))
+  if (!vl53l1xTransfer(pdev, i2cWrite, index, pdata, count))
   {
     status = VL53L1_ERROR_CONTROL_INTERFACE;
   }
@@ -161,7 +213,7 @@ VL53L1_Error VL53L1_ReadMulti(
 {
 	VL53L1_Error status         = VL53L1_ERROR_NONE;
 
-  if (!i2cdevRead16(pdev->I2Cx, pdev->I2cDevAddr, index, count, pdata))
+  if (!vl53l1xTransfer(pdev, i2cRead, index, pdata, count))
   {
     status = VL53L1_ERROR_CONTROL_INTERFACE;
   }
@@ -177,7 +229,7 @@ VL53L1_Error VL53L1_WrByte(
 {
 	VL53L1_Error status         = VL53L1_ERROR_NONE;
 
-	if (!i2cdevWrite16(pdev->I2Cx, pdev->I2cDevAddr, index, 1, &data))
+	if (!vl53l1xTransfer(pdev, i2cWrite, index, &data, 1))
 	{
 	  status = VL53L1_ERROR_CONTROL_INTERFACE;
 	}
@@ -195,7 +247,7 @@ VL53L1_Error VL53L1_WrWord(
   uint8_t _I2CBuffer[2];
   _I2CBuffer[0] = data >> 8;
   _I2CBuffer[1] = data & 0x00FF;
-  if (!i2cdevWrite16(pdev->I2Cx, pdev->I2cDevAddr, index, 2, (uint8_t *)_I2CBuffer))
+  if (!vl53l1xTransfer(pdev, i2cWrite, index, (uint8_t *)_I2CBuffer, 2))
   {
     status = VL53L1_ERROR_CONTROL_INTERFACE;
   }
@@ -216,7 +268,7 @@ VL53L1_Error VL53L1_WrDWord(
 	_I2CBuffer[2] = (data >> 8) & 0xFF;
 	_I2CBuffer[3] = (data >> 0) & 0xFF;
 
-	if (!i2cdevWrite16(pdev->I2Cx, pdev->I2cDevAddr, index, 4, (uint8_t *)_I2CBuffer))
+	if (!vl53l1xTransfer(pdev, i2cWrite, index, (uint8_t *)_I2CBuffer, 4))
   {
     status = VL53L1_ERROR_CONTROL_INTERFACE;
   }
@@ -232,7 +284,7 @@ VL53L1_Error VL53L1_RdByte(
 {
 	VL53L1_Error status         = VL53L1_ERROR_NONE;
 
-	if (!i2cdevRead16(pdev->I2Cx, pdev->I2cDevAddr, index, 1, pdata))
+	if (!vl53l1xTransfer(pdev, i2cRead, index, pdata, 1))
   {
     status = VL53L1_ERROR_CONTROL_INTERFACE;
   }
@@ -248,7 +300,7 @@ VL53L1_Error VL53L1_RdWord(
 	VL53L1_Error status = VL53L1_ERROR_NONE;
 	uint8_t _I2CBuffer[2];
 
-	if (!i2cdevRead16(pdev->I2Cx, pdev->I2cDevAddr, index, 2, (uint8_t *)_I2CBuffer))
+	if (!vl53l1xTransfer(pdev, i2cRead, index, (uint8_t *)_I2CBuffer, 2))
 	{
 		status = VL53L1_ERROR_CONTROL_INTERFACE;
 	}
@@ -263,7 +315,7 @@ VL53L1_Error VL53L1_RdDWord(
 {
 	VL53L1_Error status = VL53L1_ERROR_NONE;
 	uint8_t _I2CBuffer[4];
-	if (!i2cdevRead16(pdev->I2Cx, pdev->I2cDevAddr, index, 4, (uint8_t *)_I2CBuffer))
+	if (!vl53l1xTransfer(pdev, i2cRead, index, (uint8_t *)_I2CBuffer, 4))
 	{
 		status = VL53L1_ERROR_CONTROL_INTERFACE;
 	}
@@ -316,6 +368,7 @@ VL53L1_Error VL53L1_GetTickCount(
 }
 
 
+#ifndef CONFIG_VL53L1_LITE
 VL53L1_Error VL53L1_WaitValueMaskEx(
 	VL53L1_Dev_t *pdev,
 	uint32_t      timeout_ms,
@@ -404,4 +457,5 @@ VL53L1_Error VL53L1_WaitValueMaskEx(
 
 	return status;
 }
+#endif
 
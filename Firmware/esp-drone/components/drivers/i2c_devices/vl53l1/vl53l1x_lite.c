@@ -0,0 +1,367 @@
+/**
+ *
+ * ESP-Drone Firmware
+ *
+ * Copyright 2019-2020  Espressif Systems (Shanghai)
+ * Copyright (C) 2012 BitCraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * vl53l1x_lite.c: Register level VL53L1X driver
+ *
+ * The sensor is brought up with the register values of ST's ultra lite
+ * driver in one bulk write, and is ranged from the few configuration and
+ * result registers this needs. The ST API reaches the same configuration
+ * through its preset, tuning and calibration structures, some 2 kB of RAM
+ * per sensor and a few hundred transfers.
+ */
+
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "vl53l1x.h"
+#include "vl53l1_register_map.h"
+#include "vl53l1_register_settings.h"
+#include "vl53l1_tuning_parm_defaults.h"
+#include "stm32_legacy.h"
+
+#define DEBUG_MODULE "VLX1"
+#include "debug_cf.h"
+
+#define VL53L1X_BOOT_TIMEOUT_MS 100
+#define VL53L1X_VHV_TIMEOUT_MS  100
+
+// GPIO1 active low, as the ST API configures it
+#define VL53L1X_INTERRUPT_ACTIVE_LOW 0x10
+
+// From VL53L1_GPIO_HV_MUX__CTRL to VL53L1_SYSTEM__MODE_START, the values of
+// the ultra lite driver but the interrupt polarity
+#define DEFAULT_CONFIG_START VL53L1_PAD_I2C_HV__CONFIG
+static const uint8_t defaultConfig[] = {
+  0x00, 0x00, 0x00, 0x01 | VL53L1X_INTERRUPT_ACTIVE_LOW, 0x02, 0x00, 0x02, 0x08, // 0x2D
+  0x00, 0x08, 0x10, 0x01, 0x01, 0x00, 0x00, 0x00, // 0x35
+  0x00, 0xff, 0x00, 0x0F, 0x00, 0x00, 0x00, 0x00, // 0x3D
+  0x00, 0x20, 0x0b, 0x00, 0x00, 0x02, 0x0a, 0x21, // 0x45
+  0x00, 0x00, 0x05, 0x00, 0x00, 0x00, 0x00, 0xc8, // 0x4D
+  0x00, 0x00, 0x38, 0xff, 0x01, 0x00, 0x08, 0x00, // 0x55
+  0x00, 0x01, 0xcc, 0x0f, 0x01, 0xf1, 0x0d, 0x01, // 0x5D
+  0x68, 0x00, 0x80, 0x08, 0xb8, 0x00, 0x00, 0x00, // 0x65
+  0x00, 0x0f, 0x89, 0x00, 0x00, 0x00, 0x00, 0x00, // 0x6D
+  0x00, 0x00, 0x01, 0x0f, 0x0d, 0x0e, 0x0e, 0x00, // 0x75
+  0x00, 0x02, 0xc7, 0xff, 0x9B, 0x00, 0x00, 0x00, // 0x7D
+  0x01, 0x00, 0x00, // 0x85
+};
+
+typedef struct {
+  uint8_t phasecalTimeout;
+  uint8_t vcselPeriodA;
+  uint8_t vcselPeriodB;
+  uint8_t validPhaseHigh;
+  uint8_t woiSd0[2];
+  uint8_t initialPhaseSd0[2];
+} distanceMode_t;
+
+static const distanceMode_t shortMode = { 0x14, 0x07, 0x05, 0x38, { 0x07, 0x05 }, { 0x06, 0x06 } };
+static const distanceMode_t longMode = { 0x0A, 0x0F, 0x0D, 0xB8, { 0x0F, 0x0D }, { 0x0E, 0x0E } };
+
+typedef struct {
+  uint16_t budgetMs;
+  uint16_t timeoutA;
+  uint16_t timeoutB;
+} timingBudget_t;
+
+// Increasing budgets, the macro period timeouts of ranges A and B
+static const timingBudget_t shortBudgets[] = {
+  { 15, 0x001D, 0x0027 }, { 20, 0x0051, 0x006E }, { 33, 0x00D6, 0x006E }, { 50, 0x01AE, 0x01E8 },
+  { 100, 0x02E1, 0x0388 }, { 200, 0x03E1, 0x0496 }, { 500, 0x0591, 0x05C1 },
+};
+
+static const timingBudget_t longBudgets[] = {
+  { 20, 0x001E, 0x0022 }, { 33, 0x0060, 0x006E }, { 50, 0x00AD, 0x00C6 },
+  { 100, 0x01CC, 0x01EA }, { 200, 0x02D9, 0x02F8 }, { 500, 0x048F, 0x04A4 },
+};
+
+#define TIMING_BUDGETS_COUNT(budgets) (sizeof(budgets) / sizeof(budgets[0]))
+
+// The ST API range status of every device error, VL53L1_RANGESTATUS_NONE if there is none
+static const uint8_t rangeStatus[] = {
+  [VL53L1_DEVICEERROR_NOUPDATE] = VL53L1_RANGESTATUS_NONE,
+  [VL53L1_DEVICEERROR_VCSELCONTINUITYTESTFAILURE] = VL53L1_RANGESTATUS_HARDWARE_FAIL,
+  [VL53L1_DEVICEERROR_VCSELWATCHDOGTESTFAILURE] = VL53L1_RANGESTATUS_HARDWARE_FAIL,
+  [VL53L1_DEVICEERROR_NOVHVVALUEFOUND] = VL53L1_RANGESTATUS_HARDWARE_FAIL,
+  [VL53L1_DEVICEERROR_MSRCNOTARGET] = VL53L1_RANGESTATUS_SIGNAL_FAIL,
+  [VL53L1_DEVICEERROR_RANGEPHASECHECK] = VL53L1_RANGESTATUS_OUTOFBOUNDS_FAIL,
+  [VL53L1_DEVICEERROR_SIGMATHRESHOLDCHECK] = VL53L1_RANGESTATUS_SIGMA_FAIL,
+  [VL53L1_DEVICEERROR_PHASECONSISTENCY] = VL53L1_RANGESTATUS_WRAP_TARGET_FAIL,
+  [VL53L1_DEVICEERROR_MINCLIP] = VL53L1_RANGESTATUS_RANGE_VALID_MIN_RANGE_CLIPPED,
+  [VL53L1_DEVICEERROR_RANGECOMPLETE] = VL53L1_RANGESTATUS_RANGE_VALID,
+  [VL53L1_DEVICEERROR_ALGOUNDERFLOW] = VL53L1_RANGESTATUS_PROCESSING_FAIL,
+  [VL53L1_DEVICEERROR_ALGOOVERFLOW] = VL53L1_RANGESTATUS_PROCESSING_FAIL,
+  [VL53L1_DEVICEERROR_RANGEIGNORETHRESHOLD] = VL53L1_RANGESTATUS_XTALK_SIGNAL_FAIL,
+  [VL53L1_DEVICEERROR_USERROICLIP] = VL53L1_RANGESTATUS_MIN_RANGE_FAIL,
+  [VL53L1_DEVICEERROR_REFSPADCHARNOTENOUGHDPADS] = VL53L1_RANGESTATUS_NONE,
+  [VL53L1_DEVICEERROR_REFSPADCHARMORETHANTARGET] = VL53L1_RANGESTATUS_NONE,
+  [VL53L1_DEVICEERROR_REFSPADCHARLESSTHANTARGET] = VL53L1_RANGESTATUS_NONE,
+  [VL53L1_DEVICEERROR_MULTCLIPFAIL] = VL53L1_RANGESTATUS_RANGE_INVALID,
+  [VL53L1_DEVICEERROR_GPHSTREAMCOUNT0READY] = VL53L1_RANGESTATUS_SYNCRONISATION_INT,
+  [VL53L1_DEVICEERROR_RANGECOMPLETE_NO_WRAP_CHECK] = VL53L1_RANGESTATUS_RANGE_VALID_NO_WRAP_CHECK_FAIL,
+  [VL53L1_DEVICEERROR_EVENTCONSISTENCY] = VL53L1_RANGESTATUS_RANGE_INVALID,
+  [VL53L1_DEVICEERROR_MINSIGNALEVENTCHECK] = VL53L1_RANGESTATUS_SIGNAL_FAIL,
+  [VL53L1_DEVICEERROR_RANGECOMPLETE_MERGED_PULSE] = VL53L1_RANGESTATUS_RANGE_VALID_MERGED_PULSE,
+  [VL53L1_DEVICEERROR_PREV_RANGE_NO_TARGETS] = VL53L1_RANGESTATUS_TARGET_PRESENT_LACK_OF_SIGNAL,
+};
+
+// From VL53L1_RESULT__RANGE_STATUS to the end of the crosstalk corrected signal rate of SD0
+#define RESULT_SIZE (VL53L1_RESULT__PEAK_SIGNAL_COUNT_RATE_CROSSTALK_CORRECTED_MCPS_SD0 + 2 - VL53L1_RESULT__RANGE_STATUS)
+#define RESULT_WORD(result, index) (((uint16_t)(result)[(index) - VL53L1_RESULT__RANGE_STATUS] << 8) | \
+                                    (result)[(index) - VL53L1_RESULT__RANGE_STATUS + 1])
+
+// Up to the range of SD0, all vl53l1xReadRange() needs
+#define RANGE_RESULT_SIZE (VL53L1_RESULT__FINAL_CROSSTALK_CORRECTED_RANGE_MM_SD0 + 2 - VL53L1_RESULT__RANGE_STATUS)
+
+static VL53L1_Error waitDataReady(VL53L1_Dev_t *pdev, uint32_t timeoutMs)
+{
+  uint8_t ready = 0;
+
+  for (uint32_t i = 0; i < timeoutMs; i++) {
+    VL53L1_Error status = VL53L1_GetMeasurementDataReady(pdev, &ready);
+    if (status != VL53L1_ERROR_NONE || ready) {
+      return status;
+    }
+    vTaskDelay(M2T(1));
+  }
+
+  return VL53L1_ERROR_TIME_OUT;
+}
+
+// Distance mode and timing budget, in three transfers
+static VL53L1_Error writeRangeConfig(VL53L1_Dev_t *pdev)
+{
+  const bool isShort = pdev->distanceMode == VL53L1_DISTANCEMODE_SHORT;
+  const distanceMode_t *mode = isShort ? &shortMode : &longMode;
+  const timingBudget_t *budgets = isShort ? shortBudgets : longBudgets;
+  const int count = isShort ? TIMING_BUDGETS_COUNT(shortBudgets) : TIMING_BUDGETS_COUNT(longBudgets);
+  VL53L1_Error status;
+
+  if (pdev->timingBudgetMs < budgets[0].budgetMs) {
+    return VL53L1_ERROR_INVALID_PARAMS;
+  }
+
+  int i = 0;
+  while (i + 1 < count && budgets[i + 1].budgetMs <= pdev->timingBudgetMs) {
+    i++;
+  }
+
+  // VL53L1_RANGE_CONFIG__TIMEOUT_MACROP_A_HI to VL53L1_RANGE_CONFIG__VCSEL_PERIOD_B
+  uint8_t range[] = {
+    budgets[i].timeoutA >> 8, budgets[i].timeoutA & 0xFF, mode->vcselPeriodA,
+    budgets[i].timeoutB >> 8, budgets[i].timeoutB & 0xFF, mode->vcselPeriodB,
+  };
+  // VL53L1_SD_CONFIG__WOI_SD0 to VL53L1_SD_CONFIG__INITIAL_PHASE_SD1
+  uint8_t sd[] = { mode->woiSd0[0], mode->woiSd0[1], mode->initialPhaseSd0[0], mode->initialPhaseSd0[1] };
+
+  status = VL53L1_WrByte(pdev, VL53L1_PHASECAL_CONFIG__TIMEOUT_MACROP, mode->phasecalTimeout);
+  if (status == VL53L1_ERROR_NONE) {
+    status = VL53L1_WriteMulti(pdev, VL53L1_RANGE_CONFIG__TIMEOUT_MACROP_A_HI, range, sizeof(range));
+  }
+  if (status == VL53L1_ERROR_NONE) {
+    status = VL53L1_WrByte(pdev, VL53L1_RANGE_CONFIG__VALID_PHASE_HIGH, mode->validPhaseHigh);
+  }
+  if (status == VL53L1_ERROR_NONE) {
+    status = VL53L1_WriteMulti(pdev, VL53L1_SD_CONFIG__WOI_SD0, sd, sizeof(sd));
+  }
+
+  return status;
+}
+
+static VL53L1_Error startRanging(VL53L1_Dev_t *pdev)
+{
+  // VL53L1_SYSTEM__INTERRUPT_CLEAR and VL53L1_SYSTEM__MODE_START in one transfer
+  uint8_t start[] = {
+    0x01,
+    pdev->presetMode == VL53L1_PRESETMODE_LITE_RANGING ?
+        VL53L1_DEVICEMEASUREMENTMODE_BACKTOBACK : VL53L1_DEVICEMEASUREMENTMODE_TIMED,
+  };
+
+  return VL53L1_WriteMulti(pdev, VL53L1_SYSTEM__INTERRUPT_CLEAR, start, sizeof(start));
+}
+
+bool vl53l1xInit(VL53L1_Dev_t *pdev, I2C_Dev *I2cHandle)
+{
+  VL53L1_Error status = VL53L1_ERROR_NONE;
+  uint8_t booted = 0;
+
+  pdev->I2cDevAddr = VL53L1X_DEFAULT_ADDRESS;
+  pdev->I2Cx = I2cHandle;
+  pdev->presetMode = VL53L1_PRESETMODE_AUTONOMOUS;
+  pdev->distanceMode = VL53L1_DISTANCEMODE_LONG;
+  pdev->timingBudgetMs = 100;
+  i2cdevInit(pdev->I2Cx);
+
+  for (int i = 0; i < VL53L1X_BOOT_TIMEOUT_MS && !(booted & 0x01); i++) {
+    status = VL53L1_RdByte(pdev, VL53L1_FIRMWARE__SYSTEM_STATUS, &booted);
+    if (status != VL53L1_ERROR_NONE) {
+      return false;
+    }
+    vTaskDelay(M2T(1));
+  }
+  if (!(booted & 0x01)) {
+    return false;
+  }
+
+  status = VL53L1_WriteMulti(pdev, DEFAULT_CONFIG_START, (uint8_t *)defaultConfig, sizeof(defaultConfig));
+
+  // One range for the VHV calibration, then the next ones start from its result
+  if (status == VL53L1_ERROR_NONE) {
+    status = startRanging(pdev);
+  }
+  if (status == VL53L1_ERROR_NONE) {
+    status = waitDataReady(pdev, VL53L1X_VHV_TIMEOUT_MS);
+  }
+  if (status == VL53L1_ERROR_NONE) {
+    status = VL53L1_StopMeasurement(pdev);
+  }
+  if (status == VL53L1_ERROR_NONE) {
+    status = VL53L1_WrByte(pdev, VL53L1_VHV_CONFIG__TIMEOUT_MACROP_LOOP_BOUND, 0x09);
+  }
+  if (status == VL53L1_ERROR_NONE) {
+    status = VL53L1_WrByte(pdev, VL53L1_VHV_CONFIG__INIT, 0x00);
+  }
+  if (status == VL53L1_ERROR_NONE) {
+    status = writeRangeConfig(pdev);
+  }
+
+  return status == VL53L1_ERROR_NONE;
+}
+
+bool vl53l1xTestConnection(VL53L1_Dev_t* pdev)
+{
+  uint16_t modelId = 0;
+
+  return VL53L1_RdWord(pdev, VL53L1_IDENTIFICATION__MODEL_ID, &modelId) == VL53L1_ERROR_NONE &&
+         modelId == VL53L1X_ID;
+}
+
+VL53L1_Error vl53l1xReadRange(VL53L1_Dev_t *pdev, uint8_t *deviceStatus, uint16_t *rangeMm)
+{
+  uint8_t result[RANGE_RESULT_SIZE];
+  VL53L1_Error status = VL53L1_ReadMulti(pdev, VL53L1_RESULT__RANGE_STATUS, result, sizeof(result));
+
+  if (status == VL53L1_ERROR_NONE) {
+    int32_t range = RESULT_WORD(result, VL53L1_RESULT__FINAL_CROSSTALK_CORRECTED_RANGE_MM_SD0);
+
+    // The default correction gain of the ST API
+    range = (range * VL53L1_TUNINGPARM_LITE_RANGING_GAIN_FACTOR_DEFAULT + 0x0400) / 0x0800;
+    *deviceStatus = result[0] & VL53L1_RANGE_STATUS__RANGE_STATUS_MASK;
+    *rangeMm = range;
+  }
+
+  return status;
+}
+
+VL53L1_Error VL53L1_SetDeviceAddress(VL53L1_DEV Dev, uint8_t DeviceAddress)
+{
+  return VL53L1_WrByte(Dev, VL53L1_I2C_SLAVE__DEVICE_ADDRESS, DeviceAddress / 2);
+}
+
+VL53L1_Error VL53L1_SetPresetMode(VL53L1_DEV Dev, VL53L1_PresetModes PresetMode)
+{
+  Dev->presetMode = PresetMode;
+  return VL53L1_ERROR_NONE;
+}
+
+VL53L1_Error VL53L1_SetDistanceMode(VL53L1_DEV Dev, VL53L1_DistanceModes DistanceMode)
+{
+  Dev->distanceMode = DistanceMode;
+  return writeRangeConfig(Dev);
+}
+
+VL53L1_Error VL53L1_SetMeasurementTimingBudgetMicroSeconds(VL53L1_DEV Dev,
+    uint32_t MeasurementTimingBudgetMicroSeconds)
+{
+  Dev->timingBudgetMs = MeasurementTimingBudgetMicroSeconds / 1000;
+  return writeRangeConfig(Dev);
+}
+
+VL53L1_Error VL53L1_SetInterMeasurementPeriodMilliSeconds(VL53L1_DEV Dev,
+    uint32_t InterMeasurementPeriodMilliSeconds)
+{
+  uint16_t clockPll;
+  VL53L1_Error status = VL53L1_RdWord(Dev, VL53L1_RESULT__OSC_CALIBRATE_VAL, &clockPll);
+
+  if (status == VL53L1_ERROR_NONE) {
+    // In oscillator periods, with the margin of the ultra lite driver
+    uint32_t period = (uint32_t)(clockPll & 0x3FF) * InterMeasurementPeriodMilliSeconds * 1075 / 1000;
+    status = VL53L1_WrDWord(Dev, VL53L1_SYSTEM__INTERMEASUREMENT_PERIOD, period);
+  }
+
+  return status;
+}
+
+VL53L1_Error VL53L1_StartMeasurement(VL53L1_DEV Dev)
+{
+  return startRanging(Dev);
+}
+
+VL53L1_Error VL53L1_StopMeasurement(VL53L1_DEV Dev)
+{
+  return VL53L1_WrByte(Dev, VL53L1_SYSTEM__MODE_START, VL53L1_DEVICEMEASUREMENTMODE_STOP);
+}
+
+VL53L1_Error VL53L1_ClearInterruptAndStartMeasurement(VL53L1_DEV Dev)
+{
+  return startRanging(Dev);
+}
+
+VL53L1_Error VL53L1_GetMeasurementDataReady(VL53L1_DEV Dev, uint8_t *pMeasurementDataReady)
+{
+  uint8_t gpio = 0;
+  VL53L1_Error status = VL53L1_RdByte(Dev, VL53L1_GPIO__TIO_HV_STATUS, &gpio);
+
+  // Active low
+  *pMeasurementDataReady = status == VL53L1_ERROR_NONE && (gpio & 0x01) == 0;
+
+  return status;
+}
+
+VL53L1_Error VL53L1_GetRangingMeasurementData(VL53L1_DEV Dev,
+    VL53L1_RangingMeasurementData_t *pRangingMeasurementData)
+{
+  uint8_t result[RESULT_SIZE];
+  VL53L1_RangingMeasurementData_t *data = pRangingMeasurementData;
+  VL53L1_Error status = VL53L1_ReadMulti(Dev, VL53L1_RESULT__RANGE_STATUS, result, sizeof(result));
+
+  if (status != VL53L1_ERROR_NONE) {
+    return status;
+  }
+
+  const uint8_t deviceStatus = result[0] & VL53L1_RANGE_STATUS__RANGE_STATUS_MASK;
+  int32_t range = RESULT_WORD(result, VL53L1_RESULT__FINAL_CROSSTALK_CORRECTED_RANGE_MM_SD0);
+
+  data->TimeStamp = 0;
+  data->StreamCount = result[VL53L1_RESULT__STREAM_COUNT - VL53L1_RESULT__RANGE_STATUS];
+  data->RangeQualityLevel = 0;
+  // 9.7 rates, 8.8 spads and 14.2 sigma to 16.16
+  data->SignalRateRtnMegaCps =
+      (FixPoint1616_t)RESULT_WORD(result, VL53L1_RESULT__PEAK_SIGNAL_COUNT_RATE_CROSSTALK_CORRECTED_MCPS_SD0) << 9;
+  data->AmbientRateRtnMegaCps = (FixPoint1616_t)RESULT_WORD(result, VL53L1_RESULT__AMBIENT_COUNT_RATE_MCPS_SD0) << 9;
+  data->EffectiveSpadRtnCount = RESULT_WORD(result, VL53L1_RESULT__DSS_ACTUAL_EFFECTIVE_SPADS_SD0);
+  data->SigmaMilliMeter = (FixPoint1616_t)RESULT_WORD(result, VL53L1_RESULT__SIGMA_SD0) << 14;
+  data->RangeMilliMeter = (range * VL53L1_TUNINGPARM_LITE_RANGING_GAIN_FACTOR_DEFAULT + 0x0400) / 0x0800;
+  data->RangeFractionalPart = 0;
+  data->RangeStatus = deviceStatus < sizeof(rangeStatus) ? rangeStatus[deviceStatus] : VL53L1_RANGESTATUS_NONE;
+
+  return status;
+}
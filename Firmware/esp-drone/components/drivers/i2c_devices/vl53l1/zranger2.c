@@ -28,6 +28,8 @@
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "driver/gpio.h"
 
 #include "config.h"
 #include "system.h"
@@ -38,45 +40,127 @@
 #include "zranger2.h"
 #include "vl53l1x.h"
 #include "cf_math.h"
+#include "streamStats.h"
+#include "deadlinemonitor.h"
+#include "static_mem.h"
 #define DEBUG_MODULE "ZR2"
 #include "debug_cf.h"
 
 // Measurement noise model
-static const float expPointA = 2.5f;
-static const float expStdA = 0.0025f; // STD at elevation expPointA [m]
-static const float expPointB = 4.0f;
-static const float expStdB = 0.2f; // STD at elevation expPointB [m]
-static float expCoeff;
+static float expPointA = 2.5f;
+static float expStdA = 0.0025f; // STD at elevation expPointA [m]
+static float expPointB = 4.0f;
+static float expStdB = 0.2f; // STD at elevation expPointB [m]
+// Tabulated by the ranger task once the params change
+static rangeNoiseModel_t noiseModel;
+static bool isNoiseModelWritten = true;
 
 #define RANGE_OUTLIER_LIMIT 5000 // the measured range is in [mm]
 
+// The sensor ranges on its own, one measurement every period
+#define ZR2_PERIOD_MS        25
+#define ZR2_TIMING_BUDGET_US 20000
+// Without the interrupt, data ready is polled from this long before it is due
+#define ZR2_POLL_MARGIN_MS   3
+// A missed edge must not stop the ranging, data ready is polled after this
+#define ZR2_INT_TIMEOUT_MS   (2 * ZR2_PERIOD_MS)
+
 static int16_t range_last = 0;
 
 static bool isInit;
 
+STATIC_MEM_TASK_ALLOC(zRanger2Task, ZRANGER2_TASK_STACKSIZE);
+
+#if CONFIG_ZRANGER_MEDIAN_WINDOW > 1
+// The feasible ranges, the estimator gets their median
+STREAM_STATS_DEFINE(rangeWindow, CONFIG_ZRANGER_MEDIAN_WINDOW);
+#endif
+
 static VL53L1_Dev_t dev;
+static SemaphoreHandle_t dataReady;
+static StaticSemaphore_t dataReadyBuffer;
+
+static void IRAM_ATTR zRanger2IsrHandler(void *arg)
+{
+  portBASE_TYPE xHigherPriorityTaskWoken = pdFALSE;
+
+  xSemaphoreGiveFromISR(dataReady, &xHigherPriorityTaskWoken);
+
+  if (xHigherPriorityTaskWoken) {
+    portYIELD_FROM_ISR();
+  }
+}
 
-static uint16_t zRanger2GetMeasurementAndRestart(VL53L1_Dev_t *dev)
+static void zRanger2InterruptInit(void)
 {
-    VL53L1_Error status = VL53L1_ERROR_NONE;
-    VL53L1_RangingMeasurementData_t rangingData;
-    uint8_t dataReady = 0;
-    uint16_t range;
-
-    while (dataReady == 0)
-    {
-        status = VL53L1_GetMeasurementDataReady(dev, &dataReady);
-        vTaskDelay(M2T(1));
+  gpio_config_t io_conf = {
+    // GPIO1 is open drain and active low, see the gpio_hv_mux__ctrl preset
+#if ESP_IDF_VERSION_MAJOR > 4
+    .intr_type = GPIO_INTR_NEGEDGE,
+#else
+    .intr_type = GPIO_PIN_INTR_NEGEDGE,
+#endif
+    .pin_bit_mask = (1ULL << CONFIG_ZRANGER2_INT_PIN),
+    .mode = GPIO_MODE_INPUT,
+    .pull_down_en = 0,
+    .pull_up_en = 1,
+  };
+
+  dataReady = xSemaphoreCreateBinaryStatic(&dataReadyBuffer);
+  gpio_config(&io_conf);
+  // Usually installed by the IMU interrupt already
+  gpio_install_isr_service(0);
+  gpio_isr_handler_add(CONFIG_ZRANGER2_INT_PIN, zRanger2IsrHandler, NULL);
+}
+
+static bool zRanger2WaitDataReady(TickType_t lastSampleTime)
+{
+  uint8_t ready = 0;
+
+  if (dataReady != NULL) {
+    if (xSemaphoreTake(dataReady, M2T(ZR2_INT_TIMEOUT_MS)) == pdTRUE) {
+      return true;
+    }
+  } else {
+    vTaskDelayUntil(&lastSampleTime, M2T(ZR2_PERIOD_MS - ZR2_POLL_MARGIN_MS));
+  }
+
+  for (int i = 0; i < ZR2_PERIOD_MS; i++) {
+    if (VL53L1_GetMeasurementDataReady(&dev, &ready) != VL53L1_ERROR_NONE || ready) {
+      break;
     }
+    vTaskDelay(M2T(1));
+  }
 
-    status = VL53L1_GetRangingMeasurementData(dev, &rangingData);
-    range = rangingData.RangeMilliMeter;
+  return ready;
+}
 
-    VL53L1_StopMeasurement(dev);
-    status = VL53L1_StartMeasurement(dev);
-    status = status;
+/**
+ * Read the range of the last measurement and hand the sensor back for the
+ * next one. VL53L1_GetRangingMeasurementData() reads and converts the whole
+ * result bank instead.
+ */
+static bool zRanger2GetMeasurement(uint16_t *range)
+{
+  uint8_t deviceStatus;
+  VL53L1_Error status;
+
+  status = vl53l1xReadRange(&dev, &deviceStatus, range);
+  VL53L1_ClearInterruptAndStartMeasurement(&dev);
+
+  if (status != VL53L1_ERROR_NONE) {
+    return false;
+  }
 
-    return range;
+  // The self test failures carry no range
+  switch (deviceStatus) {
+    case VL53L1_DEVICEERROR_VCSELCONTINUITYTESTFAILURE:
+    case VL53L1_DEVICEERROR_VCSELWATCHDOGTESTFAILURE:
+    case VL53L1_DEVICEERROR_NOVHVVALUEFOUND:
+      return false;
+    default:
+      return true;
+  }
 }
 
 void zRanger2Init(void)
@@ -94,10 +178,11 @@ void zRanger2Init(void)
     return;
   }
 
-  xTaskCreate(zRanger2Task, ZRANGER2_TASK_NAME, ZRANGER2_TASK_STACKSIZE, NULL, ZRANGER2_TASK_PRI, NULL);
+  if (CONFIG_ZRANGER2_INT_PIN >= 0) {
+    zRanger2InterruptInit();
+  }
 
-  // pre-compute constant in the measurement noise model for kalman
-  expCoeff = logf(expStdB / expStdA) / (expPointB - expPointA);
+  STATIC_MEM_TASK_CREATE(zRanger2Task, zRanger2Task, ZRANGER2_TASK_NAME, NULL, ZRANGER2_TASK_PRI);
 
   isInit = true;
 }
@@ -112,36 +197,70 @@ bool zRanger2Test(void)
 
 void zRanger2Task(void* arg)
 {
-  TickType_t lastWakeTime;
+  TickType_t lastSampleTime;
+  uint16_t range;
 
   systemWaitStart();
 
-  // Restart sensor
+  // Restart sensor, in the continuous timed mode it is never stopped again
   VL53L1_StopMeasurement(&dev);
   VL53L1_SetDistanceMode(&dev, VL53L1_DISTANCEMODE_MEDIUM);
-  VL53L1_SetMeasurementTimingBudgetMicroSeconds(&dev, 25000);
+  VL53L1_SetMeasurementTimingBudgetMicroSeconds(&dev, ZR2_TIMING_BUDGET_US);
+  VL53L1_SetInterMeasurementPeriodMilliSeconds(&dev, ZR2_PERIOD_MS);
 
+  if (dataReady != NULL) {
+    xSemaphoreTake(dataReady, 0);
+  }
   VL53L1_StartMeasurement(&dev);
 
-  lastWakeTime = xTaskGetTickCount();
+  lastSampleTime = xTaskGetTickCount();
+  deadlineMonitorRegister(dmZranger, 1000 * ZR2_PERIOD_MS, ZRANGER2_TASK_BUDGET_US);
 
   while (1) {
-    vTaskDelayUntil(&lastWakeTime, M2T(25));
+    bool ready = zRanger2WaitDataReady(lastSampleTime);
+    deadlineMonitorCheckIn(dmZranger);
+    // Also after a failure, so that polling backs off for a period
+    lastSampleTime = xTaskGetTickCount();
 
-    range_last = zRanger2GetMeasurementAndRestart(&dev);
+    if (!ready || !zRanger2GetMeasurement(&range)) {
+      deadlineMonitorCheckOut(dmZranger);
+      continue;
+    }
+    range_last = range;
     rangeSet(rangeDown, range_last / 1000.0f);
 
     // check if range is feasible and push into the estimator
     // the sensor should not be able to measure >5 [m], and outliers typically
     // occur as >8 [m] measurements
     if (range_last < RANGE_OUTLIER_LIMIT) {
+#if CONFIG_ZRANGER_MEDIAN_WINDOW > 1
+      streamStatsAdd(&rangeWindow, range_last);
+      float distance = (float)streamStatsMedian(&rangeWindow) * 0.001f; // Scale from [mm] to [m]
+#else
       float distance = (float)range_last * 0.001f; // Scale from [mm] to [m]
-      float stdDev = expStdA * (1.0f  + expf( expCoeff * (distance - expPointA)));
-      rangeEnqueueDownRangeInEstimator(distance, stdDev, xTaskGetTickCount());
+#endif
+      if (__atomic_exchange_n(&isNoiseModelWritten, false, __ATOMIC_ACQUIRE)) {
+        rangeNoiseModelBuildExp(&noiseModel, RANGE_OUTLIER_LIMIT * 0.001f, expPointA, expStdA, expPointB, expStdB);
+      }
+      float stdDev = rangeNoiseModelStdDev(&noiseModel, distance);
+      rangeEnqueueDownRangeInEstimator(distance, stdDev, lastSampleTime);
     }
+    deadlineMonitorCheckOut(dmZranger);
   }
 }
 
+static void noiseModelWritten(void)
+{
+  __atomic_store_n(&isNoiseModelWritten, true, __ATOMIC_RELEASE);
+}
+
+PARAM_GROUP_START(zRanger2)
+PARAM_ADD_WITH_CALLBACK(PARAM_FLOAT, expPointA, &expPointA, noiseModelWritten)
+PARAM_ADD_WITH_CALLBACK(PARAM_FLOAT, expStdA, &expStdA, noiseModelWritten)
+PARAM_ADD_WITH_CALLBACK(PARAM_FLOAT, expPointB, &expPointB, noiseModelWritten)
+PARAM_ADD_WITH_CALLBACK(PARAM_FLOAT, expStdB, &expStdB, noiseModelWritten)
+PARAM_GROUP_STOP(zRanger2)
+
 PARAM_GROUP_START(deck)
 PARAM_ADD(PARAM_UINT8 | PARAM_RONLY, bcZRanger2, &isInit)
 PARAM_GROUP_STOP(deck)
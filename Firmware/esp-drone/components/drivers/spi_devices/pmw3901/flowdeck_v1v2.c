@@ -37,6 +37,9 @@
 #include "stabilizer_types.h"
 #include "estimator.h"
 #include "cf_math.h"
+#include "streamStats.h"
+#include "deadlinemonitor.h"
+#include "static_mem.h"
 #define DEBUG_MODULE "FLOW"
 #include "debug_cf.h"
 
@@ -47,11 +50,8 @@
 //#define USE_MA_SMOOTHING
 
 #if defined(USE_MA_SMOOTHING)
-static struct {
-    float32_t averageX[AVERAGE_HISTORY_LENGTH];
-    float32_t averageY[AVERAGE_HISTORY_LENGTH];
-    size_t ptr;
-} pixelAverages;
+STREAM_STATS_DEFINE(pixelAverageX, AVERAGE_HISTORY_LENGTH);
+STREAM_STATS_DEFINE(pixelAverageY, AVERAGE_HISTORY_LENGTH);
 #endif
 
 float dpixelx_previous = 0;
@@ -63,6 +63,8 @@ static float stdFlow = 2.0f;
 static bool isInit1 = false;
 static bool isInit2 = false;
 
+STATIC_MEM_TASK_ALLOC(flowdeckTask, FLOW_TASK_STACKSIZE);
+
 motionBurst_t currentMotion;
 
 // Disables pushing the flow measurement in the EKF
@@ -77,22 +79,46 @@ static float flowStdFixed = 2.0f;
 
 #define NCS_PIN CONFIG_SPI_PIN_CS0
 
+// The sensor frames at about 120 Hz, MOTION falls on the first frame with motion
+#define FLOW_MOTION_TIMEOUT_MS 20
+
+// Without the interrupt, if task watchdog triggered,flow frequency should set lower
+#ifdef CONFIG_IDF_TARGET_ESP32S2
+#define FLOW_POLL_PERIOD_MS 10
+#else
+#define FLOW_POLL_PERIOD_MS 5
+#endif
+
+// Motion since the previous read, with the frame and raw data status of a valid frame
+#define FLOW_MOTION_VALID 0xB0
+
 
 static void flowdeckTask(void *param)
 {
     systemWaitStart();
     initUsecTimer();
-    uint64_t lastTime  = usecTimestamp();
+
+    const bool useInterrupt = pmw3901EnableMotionInterrupt(CONFIG_FLOW_MOTION_PIN);
+    // Clears the motion accumulated so far, and brings MOTION back high
+    pmw3901ReadMotion(NCS_PIN, &currentMotion);
+    uint64_t lastTime = usecTimestamp();
+    // On the interrupt a cycle is late once it waited longer than the timeout
+    deadlineMonitorRegister(dmFlow, 1000 * (useInterrupt ? FLOW_MOTION_TIMEOUT_MS : FLOW_POLL_PERIOD_MS), FLOW_TASK_BUDGET_US);
 
     while (1) {
-// if task watchdog triggered,flow frequency should set lower
-#ifdef CONFIG_IDF_TARGET_ESP32S2
-        vTaskDelay(10);
-#elif defined(CONFIG_IDF_TARGET_ESP32S3) || defined(CONFIG_IDF_TARGET_ESP32)
-        vTaskDelay(5);
-#endif
+        pmw3901WaitMotion(useInterrupt ? FLOW_MOTION_TIMEOUT_MS : FLOW_POLL_PERIOD_MS);
+        deadlineMonitorCheckIn(dmFlow);
 
         pmw3901ReadMotion(NCS_PIN, &currentMotion);
+        // The deltas accumulate from the previous read, whether it was used or not
+        const uint64_t now = usecTimestamp();
+        const float dt = (float)(now - lastTime) / 1000000.0f;
+        lastTime = now;
+
+        if (currentMotion.motion != FLOW_MOTION_VALID) {
+            deadlineMonitorCheckOut(dmFlow);
+            continue;
+        }
 
         // Flip motion information to comply with sensor mounting
         // (might need to be changed if mounted differently)
@@ -120,29 +146,15 @@ static void flowdeckTask(void *param)
             flowMeasurement_t flowData;
             flowData.stdDevX = stdFlow;    // [pixels] should perhaps be made larger?
             flowData.stdDevY = stdFlow;    // [pixels] should perhaps be made larger?
-
-// if task watchdog triggered,flow frequency should set lower
-#ifdef CONFIG_IDF_TARGET_ESP32S2
-            flowData.dt = 0.01;
-#elif defined(CONFIG_IDF_TARGET_ESP32S3) || defined(CONFIG_IDF_TARGET_ESP32)
-            flowData.dt = 0.005;
-#endif
+            flowData.dt = dt;
 
 #if defined(USE_MA_SMOOTHING)
             // Use MA Smoothing
-            pixelAverages.averageX[pixelAverages.ptr] = (float32_t)accpx;
-            pixelAverages.averageY[pixelAverages.ptr] = (float32_t)accpy;
-
-            float32_t meanX;
-            float32_t meanY;
-
-            xtensa_mean_f32(pixelAverages.averageX, AVERAGE_HISTORY_LENGTH, &meanX);
-            xtensa_mean_f32(pixelAverages.averageY, AVERAGE_HISTORY_LENGTH, &meanY);
-
-            pixelAverages.ptr = (pixelAverages.ptr + 1) % AVERAGE_HISTORY_LENGTH;
+            streamStatsAdd(&pixelAverageX, accpx);
+            streamStatsAdd(&pixelAverageY, accpy);
 
-            flowData.dpixelx = (float)meanX;   // [pixels]
-            flowData.dpixely = (float)meanY;   // [pixels]
+            flowData.dpixelx = streamStatsMeanf(&pixelAverageX);   // [pixels]
+            flowData.dpixely = streamStatsMeanf(&pixelAverageY);   // [pixels]
 #elif defined(USE_LP_FILTER)
             // Use LP filter measurements
             flowData.dpixelx = LP_CONSTANT * dpixelx_previous + (1.0f - LP_CONSTANT) * (float)accpx;
@@ -156,14 +168,13 @@ static void flowdeckTask(void *param)
 #endif
 
             // Push measurements into the estimator
-            if (!useFlowDisabled && currentMotion.motion == 0xB0) {
-                flowData.dt = (float)(usecTimestamp()-lastTime)/1000000.0f;
-                lastTime = usecTimestamp();
+            if (!useFlowDisabled) {
                 estimatorEnqueueFlow(&flowData);
             }
         } else {
             outlierCount++;
         }
+        deadlineMonitorCheckOut(dmFlow);
     }
 }
 
@@ -209,7 +220,7 @@ void flowdeck2Init()
     // zRanger->init(NULL);
 
     if (pmw3901Init(NCS_PIN)) {
-        xTaskCreate(flowdeckTask, FLOW_TASK_NAME, FLOW_TASK_STACKSIZE, NULL, FLOW_TASK_PRI, NULL);
+        STATIC_MEM_TASK_CREATE(flowdeckTask, flowdeckTask, FLOW_TASK_NAME, NULL, FLOW_TASK_PRI);
 
         isInit2 = true;
     }
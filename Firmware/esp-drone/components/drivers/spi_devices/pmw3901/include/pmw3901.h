@@ -24,6 +24,7 @@
 #define PMW3901_H_
 
 #include <stdint.h>
+#include <stdbool.h>
 
 typedef struct motionBurst_s {
     union {
@@ -68,5 +69,24 @@ bool pmw3901Init(uint32_t csPin);
  */
 void pmw3901ReadMotion(uint32_t csPin, motionBurst_t *motion);
 
+/**
+ * Wake pmw3901WaitMotion() on the MOTION pin of the sensor. The pin stays low
+ * from a new motion until the next pmw3901ReadMotion(), so read the motion once
+ * after enabling the interrupt.
+ *
+ * @param motionPin  GPIO number of the MOTION pin, negative for none.
+ *
+ * @return  true if the interrupt is enabled.
+ */
+bool pmw3901EnableMotionInterrupt(int motionPin);
+
+/**
+ * Wait for new motion, at most timeoutMs. Without the motion interrupt this
+ * just sleeps for timeoutMs.
+ *
+ * @return  true if the MOTION pin signalled new motion.
+ */
+bool pmw3901WaitMotion(uint32_t timeoutMs);
+
 
 #endif /* PMW3901_H_ */
@@ -23,6 +23,8 @@
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "driver/gpio.h"
 
 #include "pmw3901.h"
 #include "system.h"
@@ -37,6 +39,23 @@
 
 static bool isInit = false;
 
+// The motion burst is read by DMA, the task sleeps meanwhile
+static spiTransfer_t motionTransfer;
+
+// Given on the falling edge of the MOTION pin, NULL without the interrupt
+static SemaphoreHandle_t motionReady;
+
+static void IRAM_ATTR motionIsrHandler(void *arg)
+{
+    portBASE_TYPE xHigherPriorityTaskWoken = pdFALSE;
+
+    xSemaphoreGiveFromISR(motionReady, &xHigherPriorityTaskWoken);
+
+    if (xHigherPriorityTaskWoken) {
+        portYIELD_FROM_ISR();
+    }
+}
+
 static void registerWrite(uint32_t csPin, uint8_t reg, uint8_t value)
 {
     // Set MSB to 1 for write
@@ -208,12 +227,52 @@ bool pmw3901Init(uint32_t csPin)
 
         InitRegisters(csPin);
 
-        isInit = true;
+        motionTransfer.length = sizeof(motionBurst_t);
+        motionTransfer.rxBuffer = spiDmaMalloc(sizeof(motionBurst_t));
+        isInit = motionTransfer.rxBuffer != NULL;
     }
 
     return isInit;
 }
 
+bool pmw3901EnableMotionInterrupt(int motionPin)
+{
+    if (motionPin < 0 || motionReady != NULL) {
+        return motionReady != NULL;
+    }
+
+    gpio_config_t io_conf = {
+        // MOTION is active low, from a new motion until the motion registers are read
+#if ESP_IDF_VERSION_MAJOR > 4
+        .intr_type = GPIO_INTR_NEGEDGE,
+#else
+        .intr_type = GPIO_PIN_INTR_NEGEDGE,
+#endif
+        .pin_bit_mask = (1ULL << motionPin),
+        .mode = GPIO_MODE_INPUT,
+        .pull_down_en = 0,
+        .pull_up_en = 1,
+    };
+
+    motionReady = xSemaphoreCreateBinary();
+    gpio_config(&io_conf);
+    // Usually installed by the IMU interrupt already
+    gpio_install_isr_service(0);
+    gpio_isr_handler_add(motionPin, motionIsrHandler, NULL);
+
+    return true;
+}
+
+bool pmw3901WaitMotion(uint32_t timeoutMs)
+{
+    if (motionReady == NULL) {
+        vTaskDelay(M2T(timeoutMs));
+        return false;
+    }
+
+    return xSemaphoreTake(motionReady, M2T(timeoutMs)) == pdTRUE;
+}
+
 void pmw3901ReadMotion(uint32_t csPin, motionBurst_t *motion)
 {
     uint8_t address = 0x16;
@@ -223,7 +282,11 @@ void pmw3901ReadMotion(uint32_t csPin, motionBurst_t *motion)
     sleepus(50);
     spiExchange(1, 1, &address, &address);
     sleepus(50);
-    spiExchange(sizeof(motionBurst_t), 0, (uint8_t *)motion, (uint8_t *)motion);
+    if (spiQueueExchange(&motionTransfer) && spiWaitExchange(portMAX_DELAY) != NULL) {
+        memcpy(motion, motionTransfer.rxBuffer, sizeof(motionBurst_t));
+    } else {
+        memset(motion, 0, sizeof(motionBurst_t));
+    }
     sleepus(50);
     digitalWrite(csPin, HIGH);
     spiEndTransaction();
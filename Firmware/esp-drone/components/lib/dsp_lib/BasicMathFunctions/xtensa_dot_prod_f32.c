@@ -43,13 +43,39 @@ void xtensa_dot_prod_f32(
   float32_t sum = 0.0f;                          /* Temporary result storage */
   uint32_t blkCnt;                               /* loop counter */
 
+#if defined (XTENSA_MATH_LOOPUNROLL)
 
+  /* Four independent partial sums, so that a multiply-accumulate does not
+   * wait for the result of the previous one. The sum is reassociated. */
+  float32_t sum0 = 0.0f, sum1 = 0.0f, sum2 = 0.0f, sum3 = 0.0f;
 
+  blkCnt = blockSize >> 2U;
+
+  while (blkCnt > 0U)
+  {
+    sum0 += pSrcA[0] * pSrcB[0];
+    sum1 += pSrcA[1] * pSrcB[1];
+    sum2 += pSrcA[2] * pSrcB[2];
+    sum3 += pSrcA[3] * pSrcB[3];
+
+    pSrcA += 4U;
+    pSrcB += 4U;
+
+    /* Decrement the loop counter */
+    blkCnt--;
+  }
+
+  sum = (sum0 + sum1) + (sum2 + sum3);
+
+  /* The remaining samples */
+  blkCnt = blockSize & 0x3U;
+
+#else
 
   /* Initialize blkCnt with number of samples */
   blkCnt = blockSize;
 
-
+#endif /* #if defined (XTENSA_MATH_LOOPUNROLL) */
 
   while (blkCnt > 0U)
   {
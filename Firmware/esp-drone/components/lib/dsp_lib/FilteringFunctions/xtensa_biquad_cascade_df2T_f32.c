@@ -155,8 +155,74 @@ uint32_t blockSize)
    float32_t d1, d2;                              /*  state variables           */
    uint32_t sample, stage = S->numStages;         /*  loop counters             */
 
+#if defined (XTENSA_MATH_LOOPUNROLL)
 
+   float32_t acc2;                                /*  output of the second stage */
+   float32_t c0, c1, c2, c3, c4;                  /*  coefficients of the second stage */
+   float32_t e1, e2;                              /*  state of the second stage  */
 
+   /* Two stages at a time. The recursion of a stage is serial, but the second
+    * stage of a sample only depends on the first one, so both chains of
+    * multiply-accumulates overlap. Every stage computes exactly what it
+    * computes on its own. */
+   while (stage >= 2U)
+   {
+      b0 = pCoeffs[0];
+      b1 = pCoeffs[1];
+      b2 = pCoeffs[2];
+      a1 = pCoeffs[3];
+      a2 = pCoeffs[4];
+      c0 = pCoeffs[5];
+      c1 = pCoeffs[6];
+      c2 = pCoeffs[7];
+      c3 = pCoeffs[8];
+      c4 = pCoeffs[9];
+      pCoeffs += 10U;
+
+      d1 = pState[0];
+      d2 = pState[1];
+      e1 = pState[2];
+      e2 = pState[3];
+
+      sample = blockSize;
+
+      while (sample > 0U)
+      {
+         Xn1 = *pIn++;
+
+         acc1 = (b0 * Xn1) + d1;
+         d1 = ((b1 * Xn1) + (a1 * acc1)) + d2;
+         d2 = (b2 * Xn1) + (a2 * acc1);
+
+         acc2 = (c0 * acc1) + e1;
+         e1 = ((c1 * acc1) + (c3 * acc2)) + e2;
+         e2 = (c2 * acc1) + (c4 * acc2);
+
+         *pOut++ = acc2;
+
+         sample--;
+      }
+
+      *pState++ = d1;
+      *pState++ = d2;
+      *pState++ = e1;
+      *pState++ = e2;
+
+      /* The current stage input is given as the output to the next stage */
+      pIn = pDst;
+
+      /*Reset the output working pointer */
+      pOut = pDst;
+
+      stage -= 2U;
+   }
+
+   if (stage == 0U)
+   {
+      return;
+   }
+
+#endif /* #if defined (XTENSA_MATH_LOOPUNROLL) */
 
    do
    {
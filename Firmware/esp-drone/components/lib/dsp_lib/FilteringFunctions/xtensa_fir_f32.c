@@ -143,9 +143,76 @@ uint32_t blockSize)
    /* pStateCurnt points to the location where the new input data should be written */
    pStateCurnt = &(S->pState[(numTaps - 1U)]);
 
+#if defined (XTENSA_MATH_LOOPUNROLL)
+
+   float32_t acc0, acc1, acc2, acc3;              /* Accumulators of four consecutive outputs */
+   float32_t x0, x1, x2, x3, c0;                  /* Sliding window of the state and the current coefficient */
+
+   /* Four outputs at a time, every coefficient is loaded once for all four
+    * and their sums are independent. Each output is summed in the same order
+    * as by the loop below. */
+   blkCnt = blockSize >> 2U;
+
+   while (blkCnt > 0U)
+   {
+      /* Copy four new samples into the state buffer */
+      *pStateCurnt++ = *pSrc++;
+      *pStateCurnt++ = *pSrc++;
+      *pStateCurnt++ = *pSrc++;
+      *pStateCurnt++ = *pSrc++;
+
+      acc0 = 0.0f;
+      acc1 = 0.0f;
+      acc2 = 0.0f;
+      acc3 = 0.0f;
+
+      px = pState;
+      pb = pCoeffs;
+
+      x0 = *px++;
+      x1 = *px++;
+      x2 = *px++;
+
+      i = numTaps;
+
+      do
+      {
+         c0 = *pb++;
+         x3 = *px++;
+
+         acc0 += x0 * c0;
+         acc1 += x1 * c0;
+         acc2 += x2 * c0;
+         acc3 += x3 * c0;
+
+         x0 = x1;
+         x1 = x2;
+         x2 = x3;
+
+         i--;
+      } while (i > 0U);
+
+      *pDst++ = acc0;
+      *pDst++ = acc1;
+      *pDst++ = acc2;
+      *pDst++ = acc3;
+
+      /* Advance state pointer by 4 for the next four samples */
+      pState = pState + 4;
+
+      blkCnt--;
+   }
+
+   /* The remaining samples */
+   blkCnt = blockSize & 0x3U;
+
+#else
+
    /* Initialize blkCnt with blockSize */
    blkCnt = blockSize;
 
+#endif /* #if defined (XTENSA_MATH_LOOPUNROLL) */
+
    while (blkCnt > 0U)
    {
       /* Copy one sample at a time into state buffer */
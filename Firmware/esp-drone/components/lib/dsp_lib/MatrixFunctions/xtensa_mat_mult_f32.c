@@ -112,6 +112,46 @@ xtensa_status xtensa_mat_mult_f32(
        ** to the starting address of the pSrcB data */
       pIn2 = pSrcB->pData;
 
+#if defined (XTENSA_MATH_LOOPUNROLL)
+
+      /* Four columns at a time, each element of the row of A is loaded once
+       * for all four and their sums are independent. Every output is summed
+       * in the same order as by the loop below. */
+      while (col >= 4U)
+      {
+        float32_t sum0 = 0.0f, sum1 = 0.0f, sum2 = 0.0f, sum3 = 0.0f;
+        float32_t a;
+
+        pIn1 = pInA;
+        colCnt = numColsA;
+
+        while (colCnt > 0U)
+        {
+          a = *pIn1++;
+          sum0 += a * pIn2[0];
+          sum1 += a * pIn2[1];
+          sum2 += a * pIn2[2];
+          sum3 += a * pIn2[3];
+          pIn2 += numColsB;
+
+          colCnt--;
+        }
+
+        *px++ = sum0;
+        *px++ = sum1;
+        *px++ = sum2;
+        *px++ = sum3;
+
+        col -= 4U;
+
+        /* Update the pointer pIn2 to point to the  starting address of the next column */
+        pIn2 = pInB + (numColsB - col);
+      }
+
+      if (col > 0U)
+
+#endif /* #if defined (XTENSA_MATH_LOOPUNROLL) */
+
       /* column loop */
       do
       {
@@ -33,8 +33,8 @@ void xtensa_bitreversal_32(uint32_t *pSrc, const uint16_t bitRevLen, const uint1
   uint32_t r4, r5;	
   while(r3--)
   {
-    r2 = (uint32_t *)((uint32_t)pSrc + pBitRevTab[0]);
-    r6 = (uint32_t *)((uint32_t)pSrc + pBitRevTab[1]);
+    r2 = (uint32_t *)((uintptr_t)pSrc + pBitRevTab[0]);
+    r6 = (uint32_t *)((uintptr_t)pSrc + pBitRevTab[1]);
 
     r5 = r2[0];
     r4 = r6[0];
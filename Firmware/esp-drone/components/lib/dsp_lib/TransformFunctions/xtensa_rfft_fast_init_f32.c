@@ -38,6 +38,99 @@
  * @{
  */
 
+/**
+* @brief  Initialization of a real FFT from the tables of its length.
+*/
+static xtensa_status xtensa_rfft_fast_init_tables_f32(
+  xtensa_rfft_fast_instance_f32 * S,
+  uint16_t fftLen,
+  uint16_t bitRevLength,
+  const uint16_t * pBitRevTable,
+  const float32_t * pTwiddle,
+  const float32_t * pTwiddleRFFT)
+{
+  xtensa_cfft_instance_f32 * Sint = &(S->Sint);
+
+  /*  Initialise the FFT length */
+  Sint->fftLen = fftLen/2;
+  S->fftLenRFFT = fftLen;
+  /*  Initialise the bit reversal table length and pointer */
+  Sint->bitRevLength = bitRevLength;
+  Sint->pBitRevTable = (uint16_t *)pBitRevTable;
+  /*  Initialise the Twiddle coefficient pointers */
+  Sint->pTwiddle     = (float32_t *)pTwiddle;
+  S->pTwiddleRFFT    = (float32_t *)pTwiddleRFFT;
+
+  return (XTENSA_MATH_SUCCESS);
+}
+
+/**
+* @brief  Initialization functions for the floating-point real FFT of one length.
+* @param[in,out] *S             points to an xtensa_rfft_fast_instance_f32 structure.
+* @return        XTENSA_MATH_SUCCESS
+*
+* \par Description:
+* \par
+* Each of these only references the tables of its own length, which lets the
+* linker drop the tables of all the lengths that are not used.
+* xtensa_rfft_fast_init_f32() references all of them.
+*/
+xtensa_status xtensa_rfft_fast_init_32_f32(
+  xtensa_rfft_fast_instance_f32 * S)
+{
+  return xtensa_rfft_fast_init_tables_f32(S, 32U, XTENSABITREVINDEXTABLE_16_TABLE_LENGTH,
+    xtensaBitRevIndexTable16, twiddleCoef_16, twiddleCoef_rfft_32);
+}
+
+xtensa_status xtensa_rfft_fast_init_64_f32(
+  xtensa_rfft_fast_instance_f32 * S)
+{
+  return xtensa_rfft_fast_init_tables_f32(S, 64U, XTENSABITREVINDEXTABLE_32_TABLE_LENGTH,
+    xtensaBitRevIndexTable32, twiddleCoef_32, twiddleCoef_rfft_64);
+}
+
+xtensa_status xtensa_rfft_fast_init_128_f32(
+  xtensa_rfft_fast_instance_f32 * S)
+{
+  return xtensa_rfft_fast_init_tables_f32(S, 128U, XTENSABITREVINDEXTABLE_64_TABLE_LENGTH,
+    xtensaBitRevIndexTable64, twiddleCoef_64, twiddleCoef_rfft_128);
+}
+
+xtensa_status xtensa_rfft_fast_init_256_f32(
+  xtensa_rfft_fast_instance_f32 * S)
+{
+  return xtensa_rfft_fast_init_tables_f32(S, 256U, XTENSABITREVINDEXTABLE_128_TABLE_LENGTH,
+    xtensaBitRevIndexTable128, twiddleCoef_128, twiddleCoef_rfft_256);
+}
+
+xtensa_status xtensa_rfft_fast_init_512_f32(
+  xtensa_rfft_fast_instance_f32 * S)
+{
+  return xtensa_rfft_fast_init_tables_f32(S, 512U, XTENSABITREVINDEXTABLE_256_TABLE_LENGTH,
+    xtensaBitRevIndexTable256, twiddleCoef_256, twiddleCoef_rfft_512);
+}
+
+xtensa_status xtensa_rfft_fast_init_1024_f32(
+  xtensa_rfft_fast_instance_f32 * S)
+{
+  return xtensa_rfft_fast_init_tables_f32(S, 1024U, XTENSABITREVINDEXTABLE_512_TABLE_LENGTH,
+    xtensaBitRevIndexTable512, twiddleCoef_512, twiddleCoef_rfft_1024);
+}
+
+xtensa_status xtensa_rfft_fast_init_2048_f32(
+  xtensa_rfft_fast_instance_f32 * S)
+{
+  return xtensa_rfft_fast_init_tables_f32(S, 2048U, XTENSABITREVINDEXTABLE_1024_TABLE_LENGTH,
+    xtensaBitRevIndexTable1024, twiddleCoef_1024, twiddleCoef_rfft_2048);
+}
+
+xtensa_status xtensa_rfft_fast_init_4096_f32(
+  xtensa_rfft_fast_instance_f32 * S)
+{
+  return xtensa_rfft_fast_init_tables_f32(S, 4096U, XTENSABITREVINDEXTABLE_2048_TABLE_LENGTH,
+    xtensaBitRevIndexTable2048, twiddleCoef_2048, twiddleCoef_rfft_4096);
+}
+
 /**
 * @brief  Initialization function for the floating-point real FFT.
 * @param[in,out] *S             points to an xtensa_rfft_fast_instance_f32 structure.
@@ -49,81 +142,36 @@
 * The parameter <code>fftLen</code>	Specifies length of RFFT/CIFFT process. Supported FFT Lengths are 32, 64, 128, 256, 512, 1024, 2048, 4096.
 * \par
 * This Function also initializes Twiddle factor table pointer and Bit reversal table pointer.
+* \par
+* The tables of every length are linked in, use xtensa_rfft_fast_init_<length>_f32() when the length is known.
 */
 xtensa_status xtensa_rfft_fast_init_f32(
   xtensa_rfft_fast_instance_f32 * S,
   uint16_t fftLen)
 {
-  xtensa_cfft_instance_f32 * Sint;
-  /*  Initialise the default xtensa status */
-  xtensa_status status = XTENSA_MATH_SUCCESS;
-  /*  Initialise the FFT length */
-  Sint = &(S->Sint);
-  Sint->fftLen = fftLen/2;
-  S->fftLenRFFT = fftLen;
-
   /*  Initializations of structure parameters depending on the FFT length */
-  switch (Sint->fftLen)
+  switch (fftLen)
   {
+  case 4096U:
+    return xtensa_rfft_fast_init_4096_f32(S);
   case 2048U:
-    /*  Initializations of structure parameters for 2048 point FFT */
-    /*  Initialise the bit reversal table length */
-    Sint->bitRevLength = XTENSABITREVINDEXTABLE_2048_TABLE_LENGTH;
-    /*  Initialise the bit reversal table pointer */
-    Sint->pBitRevTable = (uint16_t *)xtensaBitRevIndexTable2048;
-    /*  Initialise the Twiddle coefficient pointers */
-		Sint->pTwiddle     = (float32_t *) twiddleCoef_2048;
-		S->pTwiddleRFFT    = (float32_t *) twiddleCoef_rfft_4096;
-    break;
+    return xtensa_rfft_fast_init_2048_f32(S);
   case 1024U:
-    Sint->bitRevLength = XTENSABITREVINDEXTABLE_1024_TABLE_LENGTH;
-    Sint->pBitRevTable = (uint16_t *)xtensaBitRevIndexTable1024;
-		Sint->pTwiddle     = (float32_t *) twiddleCoef_1024;
-		S->pTwiddleRFFT    = (float32_t *) twiddleCoef_rfft_2048;
-    break;
+    return xtensa_rfft_fast_init_1024_f32(S);
   case 512U:
-    Sint->bitRevLength = XTENSABITREVINDEXTABLE_512_TABLE_LENGTH;
-    Sint->pBitRevTable = (uint16_t *)xtensaBitRevIndexTable512;
-		Sint->pTwiddle     = (float32_t *) twiddleCoef_512;
-		S->pTwiddleRFFT    = (float32_t *) twiddleCoef_rfft_1024;
-    break;
+    return xtensa_rfft_fast_init_512_f32(S);
   case 256U:
-    Sint->bitRevLength = XTENSABITREVINDEXTABLE_256_TABLE_LENGTH;
-    Sint->pBitRevTable = (uint16_t *)xtensaBitRevIndexTable256;
-		Sint->pTwiddle     = (float32_t *) twiddleCoef_256;
-		S->pTwiddleRFFT    = (float32_t *) twiddleCoef_rfft_512;
-    break;
+    return xtensa_rfft_fast_init_256_f32(S);
   case 128U:
-    Sint->bitRevLength = XTENSABITREVINDEXTABLE_128_TABLE_LENGTH;
-    Sint->pBitRevTable = (uint16_t *)xtensaBitRevIndexTable128;
-		Sint->pTwiddle     = (float32_t *) twiddleCoef_128;
-		S->pTwiddleRFFT    = (float32_t *) twiddleCoef_rfft_256;
-    break;
+    return xtensa_rfft_fast_init_128_f32(S);
   case 64U:
-    Sint->bitRevLength = XTENSABITREVINDEXTABLE_64_TABLE_LENGTH;
-    Sint->pBitRevTable = (uint16_t *)xtensaBitRevIndexTable64;
-		Sint->pTwiddle     = (float32_t *) twiddleCoef_64;
-		S->pTwiddleRFFT    = (float32_t *) twiddleCoef_rfft_128;
-    break;
+    return xtensa_rfft_fast_init_64_f32(S);
   case 32U:
-    Sint->bitRevLength = XTENSABITREVINDEXTABLE_32_TABLE_LENGTH;
-    Sint->pBitRevTable = (uint16_t *)xtensaBitRevIndexTable32;
-		Sint->pTwiddle     = (float32_t *) twiddleCoef_32;
-		S->pTwiddleRFFT    = (float32_t *) twiddleCoef_rfft_64;
-    break;
-  case 16U:
-    Sint->bitRevLength = XTENSABITREVINDEXTABLE_16_TABLE_LENGTH;
-    Sint->pBitRevTable = (uint16_t *)xtensaBitRevIndexTable16;
-		Sint->pTwiddle     = (float32_t *) twiddleCoef_16;
-		S->pTwiddleRFFT    = (float32_t *) twiddleCoef_rfft_32;
-    break;
+    return xtensa_rfft_fast_init_32_f32(S);
   default:
     /*  Reporting argument error if fftSize is not valid value */
-    status = XTENSA_MATH_ARGUMENT_ERROR;
-    break;
+    return (XTENSA_MATH_ARGUMENT_ERROR);
   }
-
-  return (status);
 }
 
 /**
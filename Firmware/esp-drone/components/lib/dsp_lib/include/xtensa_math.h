@@ -802,6 +802,15 @@ xtensa_status xtensa_rfft_fast_init_f32 (
    xtensa_rfft_fast_instance_f32 * S,
    uint16_t fftLen);
 
+xtensa_status xtensa_rfft_fast_init_32_f32(xtensa_rfft_fast_instance_f32 * S);
+xtensa_status xtensa_rfft_fast_init_64_f32(xtensa_rfft_fast_instance_f32 * S);
+xtensa_status xtensa_rfft_fast_init_128_f32(xtensa_rfft_fast_instance_f32 * S);
+xtensa_status xtensa_rfft_fast_init_256_f32(xtensa_rfft_fast_instance_f32 * S);
+xtensa_status xtensa_rfft_fast_init_512_f32(xtensa_rfft_fast_instance_f32 * S);
+xtensa_status xtensa_rfft_fast_init_1024_f32(xtensa_rfft_fast_instance_f32 * S);
+xtensa_status xtensa_rfft_fast_init_2048_f32(xtensa_rfft_fast_instance_f32 * S);
+xtensa_status xtensa_rfft_fast_init_4096_f32(xtensa_rfft_fast_instance_f32 * S);
+
 void xtensa_rfft_fast_f32(
   xtensa_rfft_fast_instance_f32 * S,
   float32_t * p, float32_t * pOut,
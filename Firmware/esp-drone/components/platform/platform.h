@@ -24,11 +24,17 @@
 
 #include <stdbool.h>
 
+#include "sdkconfig.h"
 #include "motors.h"
 
 #define PLATFORM_DEVICE_TYPE_STRING_MAX_LEN (32 + 1)
 #define PLATFORM_DEVICE_TYPE_MAX_LEN (4 + 1)
+#if !defined(CONFIG_SENSORS_SINGLE_BACKEND) || !defined(CONFIG_SENSORS_BMI088_SPI)
 #define SENSOR_INCLUDED_MPU6050_HMC5883L_MS5611
+#endif
+#ifdef CONFIG_SENSORS_BMI088_SPI
+#define SENSOR_INCLUDED_BMI088_SPI_BMP388
+#endif
 
 typedef enum {
 #ifdef SENSOR_INCLUDED_BMI088_BMP388
@@ -28,20 +28,26 @@
 #define DEBUG_MODULE "PLATFORM"
 #include "debug_cf.h"
 
+#ifdef CONFIG_SENSORS_BMI088_SPI
+#define PLATFORM_SENSOR_IMPLEMENTATION SensorImplementation_bmi088_spi_bmp388
+#else
+#define PLATFORM_SENSOR_IMPLEMENTATION SensorImplementation_mpu6050_HMC5883L_MS5611
+#endif
+
 /*to support different hardware platform */
 static platformConfig_t configs[] = {
 
     {
         .deviceType = "EP20",
         .deviceTypeName = "ESPlane 2.0 ",
-        .sensorImplementation = SensorImplementation_mpu6050_HMC5883L_MS5611,
+        .sensorImplementation = PLATFORM_SENSOR_IMPLEMENTATION,
         .physicalLayoutAntennasAreClose = false,
         .motorMap = motorMapDefaultBrushed,
     },
     {
         .deviceType = "ED12",
         .deviceTypeName = "ESP_Drone_v1_2",
-        .sensorImplementation = SensorImplementation_mpu6050_HMC5883L_MS5611,
+        .sensorImplementation = PLATFORM_SENSOR_IMPLEMENTATION,
         .physicalLayoutAntennasAreClose = false,
         .motorMap = motorMapDefaultBrushed,
     },
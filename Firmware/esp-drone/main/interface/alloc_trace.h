@@ -0,0 +1,51 @@
+/**
+ *
+ * ESP-Drone Firmware
+ *
+ * Copyright 2019-2020  Espressif Systems (Shanghai)
+ * Copyright (C) 2011-2012 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * alloc_trace.h - The heap allocations made once the flight tasks run
+ *
+ * The flight components allocate their tasks, queues and buffers statically
+ * with static_mem.h, or from the heap in their init. Once the boot is done,
+ * after systemStart() and the background modules, every allocation of the
+ * heap, e.g. by the IDF drivers, Wi-Fi and lwIP, is counted by the
+ * allocation hook of the IDF, the first ALLOC_TRACE_RECORDS with their size,
+ * task and backtrace. Set the system.memDump param to print them next to the
+ * static memory, the addresses decode as a panic backtrace does, e.g. with
+ * idf.py monitor.
+ */
+
+#pragma once
+
+#define ALLOC_TRACE_RECORDS  16
+#define ALLOC_TRACE_DEPTH    6   // Return addresses per allocation, from the hook up
+
+#ifdef CONFIG_ALLOC_TRACE
+  /**
+   * Starts recording, called by the system task at the end of the boot.
+   */
+  void allocTraceStart(void);
+
+  /**
+   * Prints the count and the recorded allocations on the console.
+   */
+  void allocTraceDump(void);
+#else
+  #define allocTraceStart()
+  #define allocTraceDump()
+#endif
@@ -31,7 +31,7 @@
 #include "crtp.h"
 
 #define APPCHANNEL_WAIT_FOREVER (-1)
-#define APPCHANNEL_MTU (31)
+#define APPCHANNEL_MTU CRTP_MAX_DATA_SIZE
 
 /**
  * Send an app-channel packet
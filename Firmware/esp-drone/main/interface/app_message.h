@@ -0,0 +1,119 @@
+/**
+ *
+ * ESP-Drone Firmware
+ *
+ * Copyright 2019-2020  Espressif Systems (Shanghai)
+ * Copyright (C) 2011-2012 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * app_message.h - Messages of up to CONFIG_APP_MESSAGE_MAX_SIZE bytes over
+ * the app channel, fragmented and acked
+ *
+ * With CONFIG_APP_MESSAGE the app channel carries the frames of this layer
+ * instead of raw packets. Every frame starts with an appMessageHeader_t:
+ *
+ * - APP_MESSAGE_DATA: fragment index of count of message id, with up to
+ *   APP_MESSAGE_FRAGMENT_SIZE bytes of the message. All fragments but the last
+ *   are full, the length of the message follows from the last one.
+ * - APP_MESSAGE_ACK: all fragments of message id below index were received,
+ *   index == count once the whole message is in.
+ *
+ * The sender keeps up to APP_MESSAGE_WINDOW fragments in flight and goes back
+ * to the first fragment not acked on a retry. The receiver only takes the
+ * fragments in order. Both ends work the same, one message at a time per
+ * direction.
+ *
+ * The fragments are received straight into a preallocated buffer, the app
+ * reads the message in place and then releases the buffer. The fragments to
+ * send are taken straight from the buffer of the app.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "sdkconfig.h"
+#include "app_channel.h"
+
+#define APP_MESSAGE_DATA 0
+#define APP_MESSAGE_ACK  1
+
+typedef struct {
+  uint8_t kind;   // APP_MESSAGE_DATA or APP_MESSAGE_ACK
+  uint8_t id;     // of the message, increments from one message to the next
+  uint8_t index;  // of the fragment, of an ack the next fragment expected
+  uint8_t count;  // fragments in the message
+} __attribute__((packed)) appMessageHeader_t;
+
+// What is left of a packet after the 4 bytes of the header
+#define APP_MESSAGE_FRAGMENT_SIZE (APPCHANNEL_MTU - 4)
+#define APP_MESSAGE_MAX_FRAGMENTS 255
+#define APP_MESSAGE_WINDOW 8
+
+// A received message, valid until appMessageRelease()
+typedef struct {
+  const uint8_t *data;
+  size_t length;
+  uint8_t buffer;
+} appMessage_t;
+
+/**
+ * Send a message and wait until the other end has acked all of it
+ *
+ * The data is not copied but for the fragments going out, the buffer must stay
+ * untouched until the function returns. Only one task sends at a time, the
+ * others wait.
+ *
+ * @param data The message
+ * @param length Length of the message, up to CONFIG_APP_MESSAGE_MAX_SIZE
+ * @param timeout_ms Time to wait for the acks, or APPCHANNEL_WAIT_FOREVER
+ * @return true if the message was acked
+ *
+ * \app_api
+ */
+bool appMessageSend(const void *data, size_t length, int timeout_ms);
+
+/**
+ * Receive a message
+ *
+ * The message is in a receive buffer, hand it back with appMessageRelease()
+ * once done with it. The fragments of a new message are not acked while all
+ * the buffers are held, the sender retries until one is released.
+ *
+ * @param message The received message
+ * @param timeout_ms Time to wait for a message in millisecond, 0 to not wait
+ *                   or APPCHANNEL_WAIT_FOREVER
+ * @return true if a message was received
+ *
+ * \app_api
+ */
+bool appMessageReceive(appMessage_t *message, int timeout_ms);
+
+/**
+ * Hand the buffer of a received message back for the next messages
+ *
+ * \app_api
+ */
+void appMessageRelease(appMessage_t *message);
+
+
+// Function declared bellow are private to the Crazyflie firmware and
+// should not be called from an app
+
+void appMessageInit(void);
+
+// A frame from the app channel, called from the CRTP task
+void appMessageIncomingPacket(CRTPPacket *p);
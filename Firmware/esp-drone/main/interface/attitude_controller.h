@@ -32,6 +32,12 @@
 
 
 void attitudeControllerInit(const float updateDt);
+
+/**
+ * Init with a dt of its own for each level. Called again, only the dts
+ * change.
+ */
+void attitudeControllerInitDt(const float attitudeDt, const float rateDt);
 bool attitudeControllerTest(void);
 
 /**
@@ -17,9 +17,12 @@ typedef enum {
 // Initialize the autonomous navigation module
 void autonavInit(void);
 
-// Called periodically from the stabilizer loop
+// Run by the autonav task started by autonavInit()
 void autonavUpdate(uint32_t tickMs);
 
+// Wake the autonav task, e.g. after a command changed the state
+void autonavNotify(void);
+
 // Start a shape flight (0 = stop, 1 = square, 2 = circle, etc.)
 void autonavStartShape(uint8_t shapeId);
 
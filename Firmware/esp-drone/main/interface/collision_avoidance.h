@@ -95,6 +95,19 @@ typedef struct collision_avoidance_state_s
   // state as a setpoint.
   struct vec lastFeasibleSetPosition;
 
+  // Optional storage for the multipliers of the cell faces, of no less than
+  // nOthers + 6 floats. The projection into the cell starts from the ones of
+  // the previous call, which converges in fewer iterations while the cell
+  // changes little. NULL to start cold on every call.
+  float *duals;
+  int dualsCapacity;
+
+  // Number of faces the duals are for. They start over when it changes.
+  int dualsRows;
+
+  // Iterations the projection took in the last call, for time budgets.
+  int projectionIters;
+
 } collision_avoidance_state_t;
 
 
@@ -113,7 +126,7 @@ typedef struct collision_avoidance_state_s
 //   collisionState: Algorithm mutable state.
 //   nOthers: Number of other Crazyflies in array arguments.
 //   otherPositons: [nOthers * 3] array of positions (meters).
-//   workspace: Space of no less than 7 * (nOthers + 6) floats. Used for
+//   workspace: Space of no less than 5 * (nOthers + 6) floats. Used for
 //     temporary storage during computation. This can be the same address as
 //     otherPositions - otherPositions is copied into workspace immediately.
 //   setpoint: Setpoint from commander that will be mutated.
@@ -131,7 +144,7 @@ void collisionAvoidanceUpdateSetpointCore(
 // For ease of use, in a firmware build we include this wrapper that handles
 // the interaction with peer_localization and gets all parameter values via the
 // param system.
-#ifdef CRAZYFLIE_FW
+#if defined(CRAZYFLIE_FW) || defined(ESP_PLATFORM)
 
 void collisionAvoidanceInit(void);
 bool collisionAvoidanceTest(void);
@@ -141,6 +154,13 @@ bool collisionAvoidanceTest(void);
 void collisionAvoidanceUpdateSetpoint(
   setpoint_t *setpoint, sensorData_t const *sensorData, state_t const *state, uint32_t tick);
 
-#endif // CRAZYFLIE_FW defined
+// With CONFIG_COLLISION_AVOIDANCE_TASK the solve runs in a task of its own at
+// CONFIG_COLLISION_AVOIDANCE_RATE_HZ, on the setpoint and state this function
+// hands it. It moves the setpoint by what the last solve moved its setpoint,
+// low pass filtered, and leaves it as is when that solve is too old or was
+// for other modes. Cheap enough for every stabilizer loop.
+void collisionAvoidanceFilterSetpoint(setpoint_t *setpoint, state_t const *state, uint32_t tick);
+
+#endif // CRAZYFLIE_FW or ESP_PLATFORM defined
 
 #endif //__COLLISION_AVOIDANCE_H__
@@ -35,6 +35,9 @@
 #define COMMANDER_WDT_TIMEOUT_STABILIZE  M2T(500)
 #define COMMANDER_WDT_TIMEOUT_SHUTDOWN   M2T(2000)
 
+// Below this height the failsafe does not land, it was on the ground already (m)
+#define COMMANDER_FAILSAFE_MIN_HEIGHT    0.05f
+
 #define COMMANDER_PRIORITY_DISABLE 0
 #define COMMANDER_PRIORITY_CRTP    1
 #define COMMANDER_PRIORITY_EXTRX   2
@@ -44,6 +47,15 @@ bool commanderTest(void);
 uint32_t commanderGetInactivityTime(void);
 
 void commanderSetSetpoint(setpoint_t *setpoint, int priority);
+
+/* Decodes a streamed setpoint straight into the setpoint of the commander,
+ * without a copy. The decoder runs inside the lock of the commander, so it
+ * must be short and never block. It gets the setpoint cleared except the
+ * quaternion, which is only read with mode.quat and has to be written by the
+ * decoders that set it. Returns false if a higher priority has the commander.
+ */
+typedef void (*commanderSetpointDecoder_t)(setpoint_t *setpoint, const void *data);
+bool commanderDecodeSetpoint(commanderSetpointDecoder_t decoder, const void *data, int priority);
 int commanderGetActivePriority(void);
 
 /* Inform the commander that streaming setpoints are about to stop.
@@ -53,6 +65,16 @@ int commanderGetActivePriority(void);
  */
 void commanderNotifySetpointsStop(int remainValidMillisecs);
 
+/* Let the high-level commander fly when no setpoints are streamed, same as
+ * the commander.enHighLevel param.
+ */
+void commanderEnableHighLevel(bool enable);
+
 void commanderGetSetpoint(setpoint_t *setpoint, const state_t *state);
 
+/* True while the commander lands on its own after the setpoints timed out,
+ * see the commander.fsLand param.
+ */
+bool commanderIsFailsafeLanding(void);
+
 #endif /* COMMANDER_H_ */
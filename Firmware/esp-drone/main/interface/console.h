@@ -28,6 +28,7 @@
 #define CONSOLE_H_
 
 #include <stdbool.h>
+#include <stdint.h>
 #include "eprintf.h"
 
 /**
@@ -51,9 +52,9 @@ int consolePutchar(int ch);
  * @param ch character that shall be printed
  * @return The character casted to unsigned int or EOF in case of error
  *
- * @note This version can be called by interrup. In such case the internal
- * buffer is going to be used. If a task currently is printing or if the
- * interrupts prints too much the data will be ignored.
+ * @note consolePutchar() never blocks either, this version is kept for
+ * callers that want to be explicit about it. If the console buffer is full
+ * the character is dropped.
  */
 int consolePutcharFromISR(int ch);
 
@@ -66,10 +67,20 @@ int consolePutcharFromISR(int ch);
 int consolePuts(char *str);
 
 /**
- * Flush the console buffer
+ * Ask the console task to send the buffered characters, even if the line is
+ * not complete
  */
 void consoleFlush(void);
 
+/**
+ * Queue a record of debug_deferred.h, sent on channel 1
+ *
+ * @param data The record
+ * @param length Length of the record, at most 1024 bytes
+ * @return false if the record did not fit and was dropped
+ */
+bool consoleWriteRecord(const uint8_t *data, uint32_t length);
+
 /**
  * Macro implementing consolePrintf with eprintf
  *
@@ -45,4 +45,19 @@ void controller(control_t *control, setpoint_t *setpoint,
 ControllerType getControllerType(void);
 const char* controllerGetName();
 
+/*
+ * For the controller bank, that runs a second controller next to the current one
+ */
+
+// Make an already running controller the current one, without its init
+void controllerSwitchWarm(ControllerType controller);
+// Init and update of any controller, the current one does not change
+void controllerInitOther(ControllerType controller);
+void controllerOther(ControllerType controller, control_t *control, setpoint_t *setpoint,
+                                         const sensorData_t *sensors,
+                                         const state_t *state,
+                                         const uint32_t tick);
+// False if the two controllers share state, or are the same
+bool controllerCanRunTogether(ControllerType a, ControllerType b);
+
 #endif //__CONTROLLER_H__
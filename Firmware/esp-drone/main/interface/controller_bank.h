@@ -0,0 +1,63 @@
+/**
+ *
+ * ESP-Drone Firmware
+ *
+ * Copyright 2019-2020  Espressif Systems (Shanghai)
+ * Copyright (C) 2011-2012 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * controller_bank.h - Keeps a standby controller warm next to the current one
+ *
+ * The controller selected with the ctrlBank.standby param runs on the network
+ * core at ATTITUDE_RATE, on the same setpoint, sensors and state as the
+ * current controller, and its output is thrown away. Once it ran for
+ * CONTROLLER_BANK_WARMUP_MS, switching stabilizer.controller to it takes it
+ * over as it is, without the init that resets its integrators and filters,
+ * and the controller it replaced becomes the standby. Any other switch inits
+ * the new controller as before.
+ *
+ * Only controllers that share no state can run together, see
+ * controllerCanRunTogether(): the Mellinger controller with PID or INDI.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "controller.h"
+#include "stabilizer_types.h"
+
+#define CONTROLLER_BANK_WARMUP_MS   500
+
+void controllerBankInit(void);
+bool controllerBankTest(void);
+
+/**
+ * Switch the current controller, to the standby one if it is warm. Must be
+ * called by the stabilizer task instead of controllerInit(), and only by it.
+ *
+ * @return false if the standby controller was busy, try again next loop
+ */
+bool controllerBankSwitchTo(ControllerType controller);
+
+/**
+ * Run the current controller and hand its inputs to the standby one. Called
+ * by the stabilizer task instead of controller().
+ */
+void controllerBankUpdate(control_t *control, setpoint_t *setpoint,
+                          const sensorData_t *sensors,
+                          const state_t *state,
+                          const uint32_t tick);
@@ -37,6 +37,14 @@
 
 #define ATTITUDE_UPDATE_DT    (float)(1.0f/ATTITUDE_RATE)
 
+// Rate of the INDI inner loop, the gyro filters and the actuator model
+#ifdef CONFIG_CONTROLLER_INDI_FULL_RATE
+#define INDI_RATE             RATE_MAIN_LOOP
+#else
+#define INDI_RATE             ATTITUDE_RATE
+#endif
+#define INDI_UPDATE_DT        (float)(1.0f/INDI_RATE)
+
 // these parameters are used in the filtering of the angular acceleration
 #define STABILIZATION_INDI_FILT_CUTOFF 8.0f
 
@@ -84,13 +92,13 @@ struct IndiVariables {
   struct FloatRates u_act_dyn;
   float rate_d[3];
 
-  Butterworth2LowPass u[3];
-  Butterworth2LowPass rate[3];
+  Butterworth2LowPass3 u;
+  Butterworth2LowPass3 rate;
   struct FloatRates g1;
   float g2;
 
   struct ReferenceSystem reference_acceleration;
-  struct FloatRates act_dyn;
+  struct FloatRates act_dyn;          ///< per ATTITUDE_RATE step
   float filt_cutoff;
   float filt_cutoff_r;
 };
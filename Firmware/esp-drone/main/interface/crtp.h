@@ -31,6 +31,8 @@
 #include <stdbool.h>
 
 #define CRTP_MAX_DATA_SIZE 30
+// Largest data of a large frame, see crtpSendLargePacket()
+#define CRTP_LARGE_MAX_DATA_SIZE 1024
 
 #define CRTP_HEADER(port, channel) (((port & 0x0F) << 4) | (channel & 0x0F))
 
@@ -45,7 +47,9 @@ typedef enum {
   CRTP_PORT_LOCALIZATION     = 0x06,
   CRTP_PORT_SETPOINT_GENERIC = 0x07,
   CRTP_PORT_SETPOINT_HL      = 0x08,
+  CRTP_PORT_TIME_SYNC        = 0x09,
   CRTP_PORT_PLATFORM         = 0x0D,
+  CRTP_PORT_THERMAL          = 0x0E,
   CRTP_PORT_LINK             = 0x0F,
 } CRTPPort;
 
@@ -76,6 +80,20 @@ typedef struct _CRTPPacket
 
 typedef void (*CrtpCallback)(CRTPPacket *);
 
+/*
+ * Sent on this channel of CRTP_PORT_LINK when the queue of a port was full
+ * and a packet from the host was dropped, the host should retry it later and
+ * slow down. Ports whose new packets replace the old ones, the high level
+ * commander and AutoNav, drop their oldest packet instead and send nothing.
+ */
+#define CRTP_LINK_BUSY_CHANNEL 3
+
+typedef struct {
+  uint8_t port;
+  uint8_t channel;
+  uint16_t dropped;     // Packets of the port dropped so far, wraps
+} __attribute__((packed)) crtpLinkBusy_t;
+
 /**
  * Initialize the CRTP stack
  */
@@ -84,12 +102,23 @@ void crtpInit(void);
 bool crtpTest(void);
 
 /**
- * Initializes the queue and dispatch of an task.
+ * Initializes the queue and dispatch of an task. The length of the queue
+ * and what it does when full are set per port in crtp.c.
  *
  * @param[in] taskId The id of the CRTP task
  */
 void crtpInitTaskQueue(CRTPPort taskId);
 
+/**
+ * Queue a packet for the task of its port as if the link received it, for a
+ * task of the firmware that hands work to a port task without waiting on it.
+ * Never blocks, a full queue does not take the packet.
+ *
+ * @param[in] p CRTPPacket to queue, with the port of the task
+ * @return pdTRUE if the packet was queued
+ */
+int crtpPostPacket(const CRTPPacket *p);
+
 /**
  * Register a callback to be called for a particular port.
  *
@@ -102,15 +131,60 @@ void crtpInitTaskQueue(CRTPPort taskId);
  */
 void crtpRegisterPortCB(int port, CrtpCallback cb);
 
+/**
+ * Register a callback for a latency critical port. A link that supports it
+ * calls the callback straight from its receive task, through
+ * crtpDispatchDirect(), instead of handing the packet to the CRTP RX task.
+ * Packets of other links still go through the RX task.
+ *
+ * @note The callback may run in the receive task of the link, it must not
+ *       block. Ports with a queue can not be direct.
+ */
+void crtpRegisterPortCBDirect(int port, CrtpCallback cb);
+
+/**
+ * @return true if the packets of the port are dispatched by crtpDispatchDirect()
+ */
+bool crtpIsPortDirect(int port);
+
+/**
+ * Check a packet of a direct port and call its callback, for links. Packets
+ * that are empty or too long are dropped.
+ */
+void crtpDispatchDirect(CRTPPacket *pk);
+
 /**
  * Put a packet in the TX task
  *
- * If the TX stack is full, the oldest lowest priority packet is dropped
+ * The packets are queued per class: control replies, log blocks, console and
+ * memory. If the queue of the class of the packet is full, the packet is not
+ * queued and pdFALSE is returned, the other classes are not held up.
  *
  * @param[in] p CRTPPacket to send
  */
 int crtpSendPacket(CRTPPacket *p);
 
+/**
+ * Send data that may not fit a CRTP packet. Up to CRTP_MAX_DATA_SIZE bytes
+ * it is a packet like any other, queued by crtpSendPacket(). Larger data goes
+ * out in a single large frame, if the link supports them and its peer asked
+ * for frames that large, see crtpGetMaxDataSize().
+ *
+ * A large frame is not queued, it is sent by the calling task, which may
+ * block for the time of the transfer. It may go out before packets queued
+ * earlier, it is meant for the replies to a request.
+ *
+ * @return pdTRUE if sent or queued, pdFALSE if the link is busy or the data
+ *         too large for it
+ */
+int crtpSendLargePacket(uint8_t header, const uint8_t *data, uint16_t size);
+
+/**
+ * @return The largest data size crtpSendLargePacket() can send now,
+ *         CRTP_MAX_DATA_SIZE on links or peers without large frames
+ */
+uint16_t crtpGetMaxDataSize(void);
+
 /**
  * Put a packet in the TX task
  *
@@ -142,10 +216,18 @@ int crtpReceivePacketWait(CRTPPort taskId, CRTPPacket *p, int wait);
 /**
  * Get the number of free tx packets in the queue
  *
- * @return Number of free packets
+ * @return Number of free packets, of all the classes together
  */
 int crtpGetFreeTxQueuePackets(void);
 
+/**
+ * Get the number of free tx packets in the queue of the class of a port, to
+ * back off before crtpSendPacket() fails. For the log port, of the log blocks.
+ *
+ * @return Number of free packets
+ */
+int crtpGetFreeTxQueuePacketsOfPort(CRTPPort port);
+
 /**
  * Wait for a packet to arrive for the specified taskID
  *
@@ -167,6 +249,14 @@ struct crtpLinkOperations
   int (*receivePacket)(CRTPPacket *pk);
   bool (*isConnected)(void);
   int (*reset)(void);
+  // Optional zero-copy receive. The link lends out one of its own buffers and
+  // gets it back through releasePacket() once the packet has been dispatched.
+  int (*receivePacketRef)(CRTPPacket **pk);
+  void (*releasePacket)(CRTPPacket *pk);
+  // Optional large frames, with CONFIG_CRTP_LARGE_FRAMES. The largest data
+  // the peer accepted in one frame, and the send of a frame that large.
+  uint16_t (*getMaxDataSize)(void);
+  int (*sendLargePacket)(uint8_t header, const uint8_t *data, uint16_t size);
 };
 
 void crtpSetLink(struct crtpLinkOperations * lk);
@@ -26,6 +26,7 @@
 #ifndef CRTP_COMMANDER_H_
 #define CRTP_COMMANDER_H_
 
+#include <stdbool.h>
 #include <stdint.h>
 #include "stabilizer_types.h"
 #include "crtp.h"
@@ -40,6 +41,8 @@ typedef enum {
 void crtpCommanderInit(void);
 void crtpCommanderRpytDecodeSetpoint(setpoint_t *setpoint, CRTPPacket *pk);
 void crtpCommanderGenericDecodeSetpoint(setpoint_t *setpoint, CRTPPacket *pk);
+// Decodes into the commander without a copy, false if a higher priority has it
+bool crtpCommanderGenericSetSetpoint(CRTPPacket *pk, int priority);
 void setCommandermode(FlightMode mode);
 
 #endif /* CRTP_COMMANDER_H_ */
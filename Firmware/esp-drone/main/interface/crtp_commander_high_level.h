@@ -124,6 +124,20 @@ int crtpCommanderHighLevelLand(const float absoluteHeight_m, const float duratio
  */
 int crtpCommanderHighLevelLandWithVelocity(const float height_m, const float velocity_m_s, bool relative);
 
+/**
+ * @brief crtpCommanderHighLevelLandWithVelocity() for the tasks that may not
+ * wait on a command being planned, like the stabilizer. The landing is
+ * posted to the high-level commander task and planned there, from the state
+ * last told with crtpCommanderHighLevelTellState(). Never blocks, the planner
+ * stays stopped until the task planned it.
+ *
+ * @param height_m         absolute or relative target height (m)
+ * @param velocity_m_s     landing velocity (m/s)
+ * @param relative         whether the height is relative to the current position
+ * @return true if the landing was posted, false if the queue of the task is full
+ */
+bool crtpCommanderHighLevelPostLandWithVelocity(const float height_m, const float velocity_m_s, bool relative);
+
 /**
  * @brief vertical land from current x-y position to given height
  *
@@ -63,6 +63,8 @@ typedef enum
   EXT_POSE_PACKED          = 9,
   LH_ANGLE_STREAM          = 10,
   LH_PERSIST_DATA          = 11,
+  EXT_POSE_PACKED_STAMPED  = 12,
+  EXT_POSITION_PACKED_STAMPED = 13,
 } locsrv_t;
 
 // Set up the callback for the CRTP_PORT_LOCALIZATION
@@ -0,0 +1,75 @@
+/**
+ *    ||          ____  _ __
+ * +------+      / __ )(_) /_______________ _____  ___
+ * | 0xBC |     / __  / / __/ ___/ ___/ __ `/_  / / _ \
+ * +------+    / /_/ / / /_/ /__/ /  / /_/ / / /_/  __/
+ *  ||  ||    /_____/_/\__/\___/_/   \__,_/ /___/\___/
+ *
+ * Crazyflie control firmware
+ *
+ * Copyright (C) 2012 BitCraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * deadlinemonitor.h - Timing budgets of the periodic tasks
+ */
+
+#ifndef __DEADLINE_MONITOR_H__
+#define __DEADLINE_MONITOR_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Lateness and overrun statistics of the periodic tasks, exported in the
+ * deadline and deadlineHist log groups.
+ *
+ * A task registers its period and the budget of a cycle, checks in when a
+ * cycle starts and out when its work is done. A cycle is late when it starts
+ * so late that it cannot end within its period on budget, and an overrun when
+ * its work takes longer than the budget. Each task only updates its own
+ * statistics, the calls take no lock.
+ */
+typedef enum {
+  dmStabilizer = 0,
+  dmSensors,
+  dmKalman,
+  dmFlow,
+  dmZranger,
+  dmMultiranger,
+  DM_NBR_OF_TASKS
+} dmTaskId_t;
+
+#ifdef CONFIG_DEADLINE_MONITOR
+  /**
+   * Set the period and the budget of a task. Can be called again when the
+   * period changes, the statistics are kept but the next cycle is not timed.
+   */
+  void deadlineMonitorRegister(dmTaskId_t id, uint32_t periodUs, uint32_t budgetUs);
+  void deadlineMonitorCheckIn(dmTaskId_t id);
+  void deadlineMonitorCheckOut(dmTaskId_t id);
+
+  /**
+   * True while the stabilizer or the sensors task keeps overrunning, see
+   * CONFIG_DEADLINE_DEGRADE_OVERRUNS. The tasks that are not needed to fly
+   * then back off. Always false when the option is 0.
+   */
+  bool deadlineMonitorIsDegraded(void);
+#else
+  #define deadlineMonitorRegister(id, periodUs, budgetUs)
+  #define deadlineMonitorCheckIn(id)
+  #define deadlineMonitorCheckOut(id)
+  #define deadlineMonitorIsDegraded() false
+#endif
+
+#endif // __DEADLINE_MONITOR_H__
@@ -0,0 +1,41 @@
+/**
+ *
+ * ESP-Drone Firmware
+ *
+ * Copyright 2019-2020  Espressif Systems (Shanghai)
+ * Copyright (C) 2011-2012 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * deck.h - Finds the decks at boot and starts their drivers
+ *
+ * The decks are probed once, the ones on the deck I2C bus and the ones on the
+ * SPI bus at the same time. Only the drivers of the decks that answered start
+ * their tasks, and each of them registers the estimator it needs with
+ * registerRequiredEstimator() before the stabilizer picks one.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+/**
+ * Probe the decks and start the drivers of the ones found. Returns once all
+ * buses were probed, must run before stabilizerInit().
+ */
+void deckInit(void);
+
+/**
+ * @return true if the drivers of all the decks found pass their test
+ */
+bool deckTest(void);
@@ -0,0 +1,52 @@
+/**
+ *
+ * ESP-Drone Firmware
+ *
+ * Copyright 2019-2020  Espressif Systems (Shanghai)
+ * Copyright (C) 2011-2012 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * dyn_notch.h - Tracks the motor vibration peak of the gyro for a notch filter
+ *
+ * The sensors task hands over every gyro sample. Once DYN_NOTCH_FFT_LEN of
+ * them are collected, a low priority task windows them and runs a real FFT
+ * per axis, looks for the strongest peak of the summed spectrum between the
+ * configured frequencies and smooths it into the notch center frequency. The
+ * sensors task picks that up and moves the notch of its gyro filter.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+#include "imu_types.h"
+
+#define DYN_NOTCH_FFT_LEN       256
+#define DYN_NOTCH_SAMPLE_RATE   1000   // Hz
+
+void dynNotchInit(void);
+bool dynNotchTest(void);
+
+/**
+ * Queue one bias free gyro sample for the analysis. Must be called at
+ * DYN_NOTCH_SAMPLE_RATE by the sensors task, and only by it.
+ */
+void dynNotchAddSample(const Axis3f *gyro);
+
+/**
+ * @param centerFreq Set to the frequency the notch should be moved to
+ * @return true if it changed since the last call
+ */
+bool dynNotchGetCenterFreq(float *centerFreq);
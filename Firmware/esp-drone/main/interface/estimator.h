@@ -44,6 +44,18 @@ void stateEstimator(state_t *state, sensorData_t *sensors, control_t *control, c
 StateEstimatorType getStateEstimator(void);
 const char* stateEstimatorGetName();
 
+/*
+ * For the estimator shadow, that runs a second estimator next to the current one
+ */
+
+// The estimator that gets the measurements enqueued next to the current one, anyEstimator for none
+void stateEstimatorSetOther(StateEstimatorType estimator);
+// Init and update of any estimator, the current one does not change. The
+// update takes the sensors the current estimator read in this loop.
+void stateEstimatorInitOther(StateEstimatorType estimator);
+void stateEstimatorOther(StateEstimatorType estimator, state_t *state, const sensorData_t *sensors,
+                         const control_t *control, const uint32_t tick);
+
 // Support to incorporate additional sensors into the state estimate via the following functions:
 bool estimatorEnqueueTDOA(const tdoaMeasurement_t *uwb);
 bool estimatorEnqueuePosition(const positionMeasurement_t *pos);
@@ -55,4 +67,30 @@ bool estimatorEnqueueFlow(const flowMeasurement_t *flow);
 bool estimatorEnqueueYawError(const yawErrorMeasurement_t *error);
 //bool estimatorEnqueueSweepAngles(const sweepAngleMeasurement_t *angles);
 
+// Longest time integrated at once, a stream stalled longer than that restarts
+#define ESTIMATOR_MAX_SAMPLE_DT 0.1f
+
+/**
+ * The time in s from the IMU sample of *lastUs to the one of nowUs, from
+ * their interrupt timestamps, and *lastUs moves on to nowUs. nominalDt
+ * without a timestamp for both, 0 for the same sample again.
+ */
+static inline float estimatorSampleDt(uint64_t *lastUs, const uint64_t nowUs, const float nominalDt)
+{
+  float dt = nominalDt;
+
+  if (*lastUs != 0 && nowUs != 0) {
+    dt = (nowUs > *lastUs) ? (nowUs - *lastUs) * 1e-6f : 0.0f;
+    if (dt > ESTIMATOR_MAX_SAMPLE_DT) {
+      dt = ESTIMATOR_MAX_SAMPLE_DT;
+    }
+  }
+
+  if (nowUs != 0) {
+    *lastUs = nowUs;
+  }
+
+  return dt;
+}
+
 #endif //__ESTIMATOR_H__
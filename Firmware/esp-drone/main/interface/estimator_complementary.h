@@ -31,6 +31,8 @@
 void estimatorComplementaryInit(void);
 bool estimatorComplementaryTest(void);
 void estimatorComplementary(state_t *state, sensorData_t *sensors, control_t *control, const uint32_t tick);
+// The update with the sensors another estimator read in this loop
+void estimatorComplementaryWithSensors(state_t *state, const sensorData_t *sensors, const control_t *control, const uint32_t tick);
 
 bool estimatorComplementaryEnqueueTOF(const tofMeasurement_t *tof);
 
@@ -60,6 +60,10 @@
 void estimatorKalmanInit(void);
 bool estimatorKalmanTest(void);
 void estimatorKalman(state_t *state, sensorData_t *sensors, control_t *control, const uint32_t tick);
+// The update with the sensors another estimator read in this loop
+void estimatorKalmanWithSensors(state_t *state, const sensorData_t *sensors, const control_t *control, const uint32_t tick);
+// The time the task spent filtering since boot, in us, wraps
+uint32_t estimatorKalmanTaskBusyUs(void);
 
 
 void estimatorKalmanTaskInit();
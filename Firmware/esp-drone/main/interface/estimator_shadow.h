@@ -0,0 +1,53 @@
+/**
+ *
+ * ESP-Drone Firmware
+ *
+ * Copyright 2019-2020  Espressif Systems (Shanghai)
+ * Copyright (C) 2011-2012 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * estimator_shadow.h - Runs a shadow estimator next to the current one
+ *
+ * The estimator selected with the estShadow.estimator param runs on the
+ * network core on every stabilizer loop, on the sensors the current estimator
+ * read and the thrust of the loop before, and it gets the measurements
+ * enqueued as well. Its state is only logged, next to the CPU time of both
+ * estimators, to compare the two on the same flight.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "estimator.h"
+#include "stabilizer_types.h"
+
+void estimatorShadowInit(void);
+bool estimatorShadowTest(void);
+
+/**
+ * Switch the current estimator, a shadow estimator that becomes the current
+ * one stops. Must be called by the stabilizer task instead of
+ * stateEstimatorSwitchTo(), and only by it.
+ *
+ * @return false if the shadow estimator was busy, try again next loop
+ */
+bool estimatorShadowSwitchTo(StateEstimatorType estimator);
+
+/**
+ * Run the current estimator and hand the sensors it read to the shadow one.
+ * Called by the stabilizer task instead of stateEstimator().
+ */
+void estimatorShadowUpdate(state_t *state, sensorData_t *sensors, control_t *control, const uint32_t tick);
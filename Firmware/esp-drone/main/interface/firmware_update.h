@@ -0,0 +1,71 @@
+/**
+ *
+ * ESP-Drone Firmware
+ *
+ * Copyright 2019-2020  Espressif Systems (Shanghai)
+ * Copyright (C) 2011-2012 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * firmware_update.h - Firmware updates written to the next OTA partition
+ *
+ * An update is written to the MEM_TYPE_FIRMWARE memory from address 0 on, in
+ * order, as one stream: a firmwareUpdateHeader_t, then either the image or a
+ * delta against the image that is running. A delta is a list of operations:
+ *
+ * - FW_UPDATE_OP_COPY [op][offset:4][length:4]: length bytes of the running
+ *   image from offset
+ * - FW_UPDATE_OP_DATA [op][length:2][data]: length bytes of data
+ *
+ * The image goes to the next OTA partition as it comes. Once imageSize bytes
+ * are in, the image is verified and booted from at the next reset. The new
+ * firmware is on trial until its self test passed: if it fails, or the
+ * firmware resets before, the bootloader goes back to the previous one.
+ *
+ * A write at address 0 starts over. Updates are refused while flying, see
+ * stabilizerIsFlying(), the flash writes stall both cores. tools/ota/fwupdate.py makes the stream.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define FW_UPDATE_MAGIC       0x55574645  // "EFWU"
+#define FW_UPDATE_VERSION     1
+
+#define FW_UPDATE_KIND_IMAGE  0
+#define FW_UPDATE_KIND_DELTA  1
+
+#define FW_UPDATE_OP_COPY     1
+#define FW_UPDATE_OP_DATA     2
+
+typedef struct {
+  uint32_t magic;
+  uint8_t version;
+  uint8_t kind;
+  uint16_t reserved;
+  uint32_t imageSize;  // Of the image the stream makes
+} __attribute__((packed)) firmwareUpdateHeader_t;
+
+void firmwareUpdateInit(void);
+bool firmwareUpdateTest(void);
+
+/**
+ * Keep or drop the firmware that is running if it is on trial after an
+ * update. Dropping it resets to the previous firmware.
+ *
+ * @param selfTestPassed The result of the self test
+ */
+void firmwareUpdateBootCheck(bool selfTestPassed);
@@ -0,0 +1,61 @@
+/**
+ *
+ * ESP-Drone Firmware
+ *
+ * Copyright 2019-2020  Espressif Systems (Shanghai)
+ * Copyright (C) 2011-2012 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * flight_recorder.h - Records log variables at the stabilizer rate to flash
+ *
+ * The recording is read back through the MEM_TYPE_FLIGHT_REC memory. It
+ * starts with a header, followed by the comma separated names of the
+ * variables, and the records from FLIGHT_REC_DATA_OFFSET on. Every record is
+ * the stabilizer tick (uint32) followed by one float per variable.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define FLIGHT_REC_MAGIC          0x43455246  // "FREC"
+#define FLIGHT_REC_VERSION        1
+#define FLIGHT_REC_NAMES_OFFSET   32
+#define FLIGHT_REC_DATA_OFFSET    0x1000
+
+typedef struct {
+  uint32_t magic;
+  uint8_t version;
+  uint8_t variablesCount;
+  uint16_t recordSize;
+  uint16_t rateHz;
+  uint16_t namesLength;
+  uint32_t startTick;
+  // Written when the recording stops, 0xffffffff if it never did
+  uint32_t recordsCount;
+  uint32_t droppedCount;
+} __attribute__((packed)) flightRecorderHeader_t;
+
+void flightRecorderInit(void);
+bool flightRecorderTest(void);
+
+/**
+ * Record the variables if a recording is running. Must be called once per
+ * loop by the stabilizer task, and only by it.
+ *
+ * @param tick The stabilizer loop tick
+ */
+void flightRecorderTick(uint32_t tick);
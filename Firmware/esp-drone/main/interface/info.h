@@ -37,7 +37,7 @@ void infoInit();
 /**
  * Battery minimum voltage before sending an automatic warning message
  */
-#define INFO_BAT_WARNING 3.3
+#define INFO_BAT_WARNING 3.3f
 
 #endif //__INFO_H__
 
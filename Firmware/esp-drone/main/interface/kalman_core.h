@@ -63,6 +63,51 @@ typedef enum
   KC_STATE_X, KC_STATE_Y, KC_STATE_Z, KC_STATE_PX, KC_STATE_PY, KC_STATE_PZ, KC_STATE_D0, KC_STATE_D1, KC_STATE_D2, KC_STATE_DIM
 } kalmanCoreStateIdx_t;
 
+// The covariance is symmetric, only its upper triangle is stored, row by row:
+// P(0,0) .. P(0,8), P(1,1) .. P(1,8), .., P(8,8)
+#define KC_P_SIZE (KC_STATE_DIM * (KC_STATE_DIM + 1) / 2)
+// Index of P(i,j) in the packed covariance, i <= j
+#define KC_P_INDEX(i, j) CF_PACKED_INDEX(KC_STATE_DIM, i, j)
+
+// The bounds the covariance is kept within, an element at the upper bound was clamped
+#define KC_MAX_COVARIANCE (100)
+#define KC_MIN_COVARIANCE (1e-6f)
+
+// The kinds of measurements, for the health statistics of the updates
+typedef enum
+{
+  KC_MEAS_BARO, KC_MEAS_HEIGHT, KC_MEAS_POSITION, KC_MEAS_POSE, KC_MEAS_DISTANCE, KC_MEAS_TDOA, KC_MEAS_FLOW, KC_MEAS_TOF, KC_MEAS_YAW_ERROR, KC_MEAS_COUNT
+} kalmanCoreMeasurement_t;
+
+#ifdef CONFIG_KALMAN_HEALTH_MONITOR
+// Measurement statistics since the supervisor last took them, see kalman_supervisor.h
+typedef struct {
+  uint32_t updates[KC_MEAS_COUNT];
+  uint32_t rejected[KC_MEAS_COUNT];
+  // Sum of the normalized innovations squared, error^2 / (HPH' + R)
+  float nisSum[KC_MEAS_COUNT];
+} kalmanCoreHealth_t;
+#endif
+
+#ifdef CONFIG_KALMAN_BATCHED_UPDATE
+// Max number of scalar measurements stacked into one vector update
+#define KC_BATCH_MAX_ROWS 12
+
+// Scalar measurements collected between kalmanCoreBatchBegin() and kalmanCoreBatchEnd()
+typedef struct {
+  bool isActive;
+  int rows;
+  float H[KC_BATCH_MAX_ROWS][KC_STATE_DIM];
+  float error[KC_BATCH_MAX_ROWS];
+  float R[KC_BATCH_MAX_ROWS];
+#ifdef CONFIG_KALMAN_HEALTH_MONITOR
+  kalmanCoreMeasurement_t measurement[KC_BATCH_MAX_ROWS];
+#endif
+} kalmanCoreBatch_t;
+#endif
+
+// The cos of the tilt the range measurements are used up to
+#define KC_MIN_R22 0.1f
 
 // The data used by the kalman core implementation.
 typedef struct {
@@ -85,17 +130,32 @@ typedef struct {
 
   // The quad's attitude as a rotation matrix (used by the prediction, updated by the finalization)
   float R[3][3];
+  // 1 / R[2][2], the height of the body z axis, for the ToF model. 0 above 84 deg of tilt, see KC_MIN_R22
+  float invR22;
 
-  // The covariance matrix
-  __attribute__((aligned(4))) float P[KC_STATE_DIM][KC_STATE_DIM];
-  xtensa_matrix_instance_f32 Pm;
+  // The covariance matrix, packed, see KC_P_INDEX()
+  __attribute__((aligned(4))) float P[KC_P_SIZE];
 
   // Indicates that the internal state is corrupt and should be reset
   bool resetEstimation;
 
   float baroReferenceHeight;
+
+#ifdef CONFIG_KALMAN_BATCHED_UPDATE
+  kalmanCoreBatch_t batch;
+#endif
+
+#ifdef CONFIG_KALMAN_HEALTH_MONITOR
+  kalmanCoreHealth_t health;
+#endif
 } kalmanCoreData_t;
 
+// Index of P(i,j) in the packed covariance, for any i and j
+static inline int kalmanCorePIndex(int i, int j)
+{
+  return i <= j ? KC_P_INDEX(i, j) : KC_P_INDEX(j, i);
+}
+
 
 void kalmanCoreInit(kalmanCoreData_t* this);
 
@@ -128,6 +188,17 @@ void kalmanCoreUpdateWithTof(kalmanCoreData_t* this, tofMeasurement_t *tof);
 // Measurement of yaw error (outside measurement Vs current estimation)
 void kalmanCoreUpdateWithYawError(kalmanCoreData_t *this, yawErrorMeasurement_t *error);
 
+#ifdef CONFIG_KALMAN_BATCHED_UPDATE
+/*  - Batched measurement updates
+ *
+ * Between kalmanCoreBatchBegin() and kalmanCoreBatchEnd() the kalmanCoreUpdateWith*()
+ * functions only linearize around the current state and queue their rows. The rows
+ * are applied as one vector update with a single covariance update when the batch
+ * ends, or earlier if KC_BATCH_MAX_ROWS is reached. */
+void kalmanCoreBatchBegin(kalmanCoreData_t* this);
+void kalmanCoreBatchEnd(kalmanCoreData_t* this);
+#endif
+
 // Measurement of sweep angles from a Lighthouse base station
 //void kalmanCoreUpdateWithSweepAngles(kalmanCoreData_t *this, sweepAngleMeasurement_t *angles, const uint32_t tick);
 
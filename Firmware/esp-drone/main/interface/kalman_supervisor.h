@@ -30,3 +30,16 @@
 #include "kalman_core.h"
 
 bool kalmanSupervisorIsStateWithinBounds(const kalmanCoreData_t* this);
+
+#ifdef CONFIG_KALMAN_HEALTH_MONITOR
+/**
+ * Check the health of the filter after a finalization, at a cost of a few
+ * elements each call. The state and one row of the covariance are checked
+ * each call, the rows in turn. Once per KALMAN_HEALTH_FULL_CHECK_MS the whole
+ * covariance is checked, and the health metrics of the kalmanHealth log
+ * group are taken from the measurement statistics of the core.
+ *
+ * @return false if the filter holds values that are not finite and should be reset
+ */
+bool kalmanSupervisorIsHealthy(kalmanCoreData_t* this, uint32_t tick);
+#endif
@@ -0,0 +1,127 @@
+/**
+ *
+ * ESP-Drone Firmware
+ *
+ * Copyright 2019-2020  Espressif Systems (Shanghai)
+ * Copyright (C) 2011-2012 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * kalman_trace.h - Trace of the calls of the kalman task into kalman_core.c
+ *
+ * With CONFIG_KALMAN_TRACE, estimator_kalman.c records every call into the
+ * kalman core with its inputs, and a checkpoint of the state after every
+ * finalization. Fed the records in order, kalman_core.c computes the same
+ * states again, bit for bit on the same build, see tools/sim/src/replay_main.c.
+ *
+ * A trace starts with a KALMAN_TRACE_START record. Every record is a
+ * kalmanTraceHeader_t followed by size bytes of the payload of its type, in the
+ * byte order of the recorder. Nothing is recorded until a sink is set.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "sdkconfig.h"
+#include "kalman_core.h"
+
+#define KALMAN_TRACE_MAGIC    0x4352544b  // "KTRC"
+#define KALMAN_TRACE_VERSION  3
+
+typedef enum {
+  KALMAN_TRACE_START = 0,
+  KALMAN_TRACE_INIT,
+  KALMAN_TRACE_DECOUPLE_XY,
+  KALMAN_TRACE_PREDICT,
+  KALMAN_TRACE_PROCESS_NOISE,
+  KALMAN_TRACE_BARO,
+  KALMAN_TRACE_TOF,
+  KALMAN_TRACE_YAW_ERROR,
+  KALMAN_TRACE_HEIGHT,
+  KALMAN_TRACE_DISTANCE,
+  KALMAN_TRACE_POSITION,
+  KALMAN_TRACE_POSE,
+  KALMAN_TRACE_TDOA,
+  KALMAN_TRACE_FLOW,
+  KALMAN_TRACE_BATCH_BEGIN,
+  KALMAN_TRACE_BATCH_END,
+  KALMAN_TRACE_FINALIZE,
+  KALMAN_TRACE_STATE,
+  KALMAN_TRACE_TYPE_COUNT,
+} kalmanTraceType_t;
+
+typedef struct {
+  uint8_t type;
+  uint8_t reserved;
+  uint16_t size;
+  uint32_t tick;
+} __attribute__((packed)) kalmanTraceHeader_t;
+
+typedef struct {
+  uint32_t magic;
+  uint8_t version;
+  uint8_t stateDim;
+  uint16_t stateSize;  // sizeof(kalmanTraceState_t) of the recorder
+} __attribute__((packed)) kalmanTraceStart_t;
+
+typedef struct {
+  float thrust;
+  Axis3f acc;
+  Axis3f gyro;
+  float dt;
+  bool quadIsFlying;
+} kalmanTracePredict_t;
+
+typedef struct {
+  float asl;
+  bool quadIsFlying;
+} kalmanTraceBaro_t;
+
+typedef struct {
+  flowMeasurement_t flow;
+  Axis3f gyro;
+} kalmanTraceFlow_t;
+
+// The checkpoint compared by the replay
+typedef struct {
+  float S[KC_STATE_DIM];
+  float q[4];
+  float P[KC_P_SIZE];  // packed, see KC_P_INDEX()
+} kalmanTraceState_t;
+
+// Called from the kalman task for every record, header and payload in one buffer
+typedef void (*kalmanTraceSink_t)(const void *record, size_t size);
+
+/**
+ * Start a trace into the sink, or stop it with NULL. The KALMAN_TRACE_START
+ * record goes out right away.
+ */
+void kalmanTraceSetSink(kalmanTraceSink_t sink);
+
+bool kalmanTraceIsActive(void);
+
+void kalmanTraceRecord(kalmanTraceType_t type, uint32_t tick, const void *payload, size_t size);
+
+void kalmanTraceRecordState(const kalmanCoreData_t *coreData, uint32_t tick);
+
+#ifdef CONFIG_KALMAN_TRACE
+  #define KALMAN_TRACE(type, tick, payload, size) kalmanTraceRecord((type), (tick), (payload), (size))
+  #define KALMAN_TRACE_STATE(coreData, tick) kalmanTraceRecordState((coreData), (tick))
+#else
+  #define KALMAN_TRACE(type, tick, payload, size)
+  #define KALMAN_TRACE_STATE(coreData, tick)
+#endif
@@ -0,0 +1,120 @@
+/**
+ *
+ * ESP-Drone Firmware
+ *
+ * Copyright 2019-2020  Espressif Systems (Shanghai)
+ * Copyright (C) 2011-2012 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * kernel_bench.h - Micro-benchmarks of the estimator, controller and math kernels
+ *
+ * Every kernel of the stabilizer loop is called KERNEL_BENCH_CALLS times in a
+ * row on fixed inputs, and the fastest of KERNEL_BENCH_RUNS runs is kept so
+ * that interrupts and task switches do not count. The median and the slowest
+ * run tell how much they do. The same source builds in the firmware, where
+ * the cycles come from the CPU cycle counter, and in tools/sim for the host.
+ *
+ * With CONFIG_KERNEL_BENCH_SERVICE the benchmarks also run on command while
+ * not flying, see stabilizerIsFlying(), through the MEM_TYPE_KERNEL_BENCH
+ * memory. Writing the number of runs, 1 to KERNEL_BENCH_MAX_RUNS, to the
+ * first byte starts them, reading gives a kernelBenchMemHeader_t followed by
+ * one kernelBenchMemRecord_t per benchmark once the state is done.
+ * Controller/kernel_bench.py collects and compares them.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#define KERNEL_BENCH_CALLS  1000
+#define KERNEL_BENCH_RUNS   5
+#define KERNEL_BENCH_MAX_RUNS 15
+
+typedef struct {
+  const char *name;
+  float nsPerCall;
+  float cyclesPerCall;  // CPU cycles on the target, time stamp counter ticks on the host, 0 if unknown
+  float cyclesMedian;
+  float cyclesMax;
+} kernelBenchResult_t;
+
+#define KERNEL_BENCH_MEM_MAGIC   0x48434e42  // "BNCH"
+#define KERNEL_BENCH_MEM_VERSION 1
+#define KERNEL_BENCH_NAME_LEN    24
+
+typedef enum {
+  kbIdle = 0,
+  kbRunning,
+  kbDone,
+  kbAborted,    // Flying during the runs, the records so far are kept
+} kernelBenchState_t;
+
+typedef struct {
+  uint32_t magic;
+  uint8_t version;
+  uint8_t state;
+  uint8_t runs;
+  uint8_t recordsCount;   // Done so far
+  uint16_t recordSize;
+  uint16_t cpuMhz;        // 0 on the host
+  uint32_t chipModel;     // esp_chip_model_t, 0 on the host
+} __attribute__((packed)) kernelBenchMemHeader_t;
+
+typedef struct {
+  char name[KERNEL_BENCH_NAME_LEN];
+  uint32_t calls;         // Per run
+  float nsPerCall;        // Of the fastest run
+  float cyclesMin;
+  float cyclesMedian;
+  float cyclesMax;
+} __attribute__((packed)) kernelBenchMemRecord_t;
+
+/**
+ * Run the benchmarks. The controllers are initialized again afterwards, the
+ * attitude of sensfusion6 is left near level.
+ *
+ * @param results Filled in the order of the benchmarks
+ * @param maxResults Size of results
+ * @return Number of results written
+ */
+int kernelBenchRun(kernelBenchResult_t *results, int maxResults);
+
+/**
+ * Run the benchmarks and print one line per kernel on the debug console.
+ */
+void kernelBenchPrint(void);
+
+/**
+ * @return Number of benchmarks of kernelBenchRunOne()
+ */
+int kernelBenchCount(void);
+
+/**
+ * Run one benchmark runs times, at most KERNEL_BENCH_MAX_RUNS.
+ */
+void kernelBenchRunOne(int index, int runs, kernelBenchResult_t *result);
+
+/**
+ * Time call, calls times a run, for benchmarks that are not kernels of the
+ * stabilizer loop.
+ */
+void kernelBenchMeasure(const char *name, void (*call)(uint32_t i), uint32_t calls, int runs,
+                        kernelBenchResult_t *result);
+
+#ifdef CONFIG_KERNEL_BENCH_SERVICE
+  void kernelBenchServiceInit(void);
+#else
+  #define kernelBenchServiceInit()
+#endif
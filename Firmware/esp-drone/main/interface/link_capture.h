@@ -0,0 +1,91 @@
+/**
+ *
+ * ESP-Drone Firmware
+ *
+ * Copyright 2019-2020  Espressif Systems (Shanghai)
+ * Copyright (C) 2011-2012 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * link_capture.h - Timestamps the CRTP packets of the link into RAM
+ *
+ * The capture is read back through the MEM_TYPE_LINK_CAPTURE memory, a
+ * header followed by the records from LINK_CAPTURE_DATA_OFFSET on. Writing 1
+ * to the first byte of the memory clears the capture and starts it, writing
+ * 0 stops it. It also stops when the records are full, and can only be read
+ * while stopped. tools/linkcap/linkcap.py matches the records with those of
+ * the host to measure the link.
+ *
+ * A record only holds the header, size and byte sum of a packet, which is
+ * enough to find it in the capture of the host.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define LINK_CAPTURE_MAGIC        0x5041434c  // "LCAP"
+#define LINK_CAPTURE_VERSION      1
+#define LINK_CAPTURE_DATA_OFFSET  16
+
+/* The events of the firmware, the host tools number their own after them */
+typedef enum {
+  lcRx = 1,         // Arrived on the link, in the UDP receive task
+  lcDequeued = 2,   // Taken out of the RX queue by the CRTP RX task
+  lcTx = 3,         // Handed to the link by the CRTP TX task
+  lcActuation = 4,  // First motor output of a new setpoint, no packet
+} linkCaptureEvent_t;
+
+typedef struct {
+  uint32_t timestamp;   // usecTimestamp(), wraps after 71 minutes
+  uint8_t event;
+  uint8_t header;
+  uint8_t size;
+  uint8_t sum;          // Byte sum of the data
+} __attribute__((packed)) linkCaptureRecord_t;
+
+typedef struct {
+  uint32_t magic;
+  uint8_t version;
+  uint8_t isRecording;
+  uint16_t recordSize;
+  uint32_t recordsCount;
+  // Records that did not fit
+  uint32_t droppedCount;
+} __attribute__((packed)) linkCaptureHeader_t;
+
+#ifdef CONFIG_LINK_CAPTURE
+  void linkCaptureInit(void);
+
+  /**
+   * Record a packet if the capture runs. Can be called from any task.
+   *
+   * @param raw The CRTP header followed by the data
+   * @param size The size of the data
+   */
+  void linkCapturePacket(linkCaptureEvent_t event, const uint8_t *raw, uint8_t size);
+
+  /**
+   * Record the actuation of a new setpoint. Must be called by the stabilizer
+   * task once per loop, after the motors are set.
+   *
+   * @param setpointTimestamp The timestamp of the setpoint of the loop
+   */
+  void linkCaptureActuation(uint32_t setpointTimestamp);
+#else
+  #define linkCaptureInit()
+  #define linkCapturePacket(event, raw, size)
+  #define linkCaptureActuation(setpointTimestamp)
+#endif
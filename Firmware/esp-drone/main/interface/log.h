@@ -34,6 +34,15 @@
 void logInit(void);
 bool logTest(void);
 
+/**
+ * Sample the running synchronous log blocks that are due at this tick. Must
+ * be called once per loop by the stabilizer task, and only by it. Only built
+ * with CONFIG_LOG_SYNCHRONOUS_BLOCKS.
+ *
+ * @param tick The stabilizer loop tick
+ */
+void logSynchronousTick(uint32_t tick);
+
 /* Public API to access of log variables */
 
 /** Variable identifier.
@@ -58,7 +67,7 @@ logVarId_t logGetVarId(char* group, char* name);
  * @param varId variable ID, returned by logGetLogId()
  * @return true if the variable ID is valid, false otherwise.
  */
-#define LOG_VARID_IS_VALID(varId) (varId != 0xffffu)
+#define LOG_VARID_IS_VALID(varId) ((varId) != 0xffffu)
 
 /** Return the logging type
  * 
@@ -113,6 +122,29 @@ int logGetInt(logVarId_t varid);
  */
 unsigned int logGetUint(logVarId_t varid);
 
+/** Memory of log variables that is only filled while it is logged
+ *
+ * isLogged is kept up to date by the log task: it is set while a log block
+ * reads a variable between start and start + size, by TOC id or by address.
+ * Once logGetVarId() returned a variable in there it stays set, the reads of
+ * that caller are not known. Variables added by function are not seen.
+ */
+typedef struct {
+  const void *start;
+  uint32_t size;
+  volatile bool isLogged;
+  bool isPinned;
+} logWatch_t;
+
+/** Start watching the memory of a logWatch_t
+ *
+ * The watch must stay valid for good. The first read of a block that was just
+ * set up may come before the producer saw isLogged.
+ *
+ * @param watch The memory to watch, with start and size set
+ */
+void logWatchRegister(logWatch_t *watch);
+
 /* Basic log structure */
 struct log_s {
   uint8_t type;
@@ -152,6 +184,15 @@ typedef struct {
   void* data;
 } logByFunction_t;
 
+// The member of logByFunction_t for each type, see LOG_ADD_BY_GETTER()
+#define LOG_ACQUIRE_LOG_UINT8   acquireUInt8
+#define LOG_ACQUIRE_LOG_UINT16  acquireUInt16
+#define LOG_ACQUIRE_LOG_UINT32  acquireUInt32
+#define LOG_ACQUIRE_LOG_INT8    acquireInt8
+#define LOG_ACQUIRE_LOG_INT16   acquireInt16
+#define LOG_ACQUIRE_LOG_INT32   acquireInt32
+#define LOG_ACQUIRE_LOG_FLOAT   aquireFloat
+
 /* Internal defines */
 #define LOG_GROUP 0x80
 #define LOG_BY_FUNCTION 0x40
@@ -168,6 +209,16 @@ typedef struct {
 #define LOG_ADD_BY_FUNCTION(TYPE, NAME, ADDRESS) \
    { .type = TYPE | LOG_BY_FUNCTION, .name = #NAME, .address = (void*)(ADDRESS), },
 
+/**
+ * A variable that is GETTER(timestamp, DATA), called only when a log block,
+ * the flight recorder or logGetFloat() and the like read it. For values
+ * derived from others, which are then not computed on every loop in case
+ * they are logged. TYPE is written as LOG_UINT8 to LOG_FLOAT, not LOG_FP16,
+ * and GETTER returns that type.
+ */
+#define LOG_ADD_BY_GETTER(TYPE, NAME, GETTER, DATA) \
+   LOG_ADD_BY_FUNCTION(TYPE, NAME, &((logByFunction_t){ .LOG_ACQUIRE_##TYPE = (GETTER), .data = (void*)(DATA) }))
+
 #define LOG_ADD_GROUP(TYPE, NAME, ADDRESS) \
    { \
   .type = TYPE, .name = #NAME, .address = (void*)(ADDRESS), },
@@ -187,6 +238,7 @@ typedef struct {
 // Empty defines when running unit tests
 #define LOG_ADD(TYPE, NAME, ADDRESS)
 #define LOG_ADD_BY_FUNCTION(TYPE, NAME, ADDRESS)
+#define LOG_ADD_BY_GETTER(TYPE, NAME, GETTER, DATA)
 #define LOG_ADD_GROUP(TYPE, NAME, ADDRESS)
 #define LOG_GROUP_START(NAME)
 #define LOG_GROUP_STOP(NAME)
@@ -41,10 +41,31 @@ typedef enum {
   MEM_TYPE_USD    = 0x16,
   MEM_TYPE_LEDMEM = 0x17,
   MEM_TYPE_APP    = 0x18,
+  // ESP-Drone specific, see MEM_TOC_BLOB_VERSION
+  MEM_TYPE_LOG_TOC   = 0x20,
+  MEM_TYPE_PARAM_TOC = 0x21,
+  MEM_TYPE_FLIGHT_REC = 0x22, // See flight_recorder.h
+  MEM_TYPE_TRAJ_FLASH = 0x23, // See crtp_commander_high_level.c
+  MEM_TYPE_FIRMWARE = 0x24, // See firmware_update.h
+  MEM_TYPE_LINK_CAPTURE = 0x25, // See link_capture.h
+  MEM_TYPE_KERNEL_BENCH = 0x26, // See kernel_bench.h
+  MEM_TYPE_AUTONAV_MISSION = 0x27, // See autonav_mission.h
 } MemoryType_t;
 
 #define MEMORY_SERIAL_LENGTH 8
 
+/*
+ * The log and param TOCs can be read in one go from the read only
+ * MEM_TYPE_LOG_TOC and MEM_TYPE_PARAM_TOC memories. The content is
+ * [version][crc:4][count:2] followed by one [type][name]\0 record per group
+ * and per variable, in TOC order. Records with the group bit (0x80) set start
+ * a group, the variables in it get consecutive ids, starting at 0. The crc,
+ * count and types are the same as in the TOC_CH replies, so a client can
+ * cache the TOC by crc.
+ */
+#define MEM_TOC_BLOB_VERSION      1
+#define MEM_TOC_BLOB_HEADER_SIZE  7
+
 typedef struct {
   const MemoryType_t type;
   uint32_t (*getSize)(void);
@@ -35,6 +35,10 @@
 #define MSP_H_
 #include <stdint.h>
 #include <stdbool.h>
+#include "stabilizer_types.h"
+
+// Rate at which the stabilizer serializes the polled responses
+#define MSP_CACHE_RATE RATE_50_HZ
 
 /**
  * Function signature for a response callback to be provided by a client
@@ -93,4 +97,14 @@ void mspInit(MspObject* pMspObject, const MspResponseCallback callback);
  */
 void mspProcessByte(MspObject* pMspObject, const uint8_t data);
 
+/**
+ * Serializes the responses to the status, attitude, altitude and analog
+ * requests. Called by the stabilizer on every tick, the frames are built at
+ * MSP_CACHE_RATE and only once an MSP object was initialized. The requests
+ * are then answered with a copy of the last frames.
+ * @param[in]   state           The current state estimate
+ * @param[in]   tick            The stabilizer tick
+ */
+void mspUpdateCache(const state_t *state, const uint32_t tick);
+
 #endif /* MSP_H_ */
@@ -0,0 +1,74 @@
+/**
+ *
+ * ESP-Drone Firmware
+ *
+ * Copyright 2019-2020  Espressif Systems (Shanghai)
+ * Copyright (C) 2011-2012 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * obstacle_map.h - Polar occupancy grid around the drone
+ *
+ * The horizontal plane around the drone, in the body frame, is split in
+ * OBSTACLE_MAP_SECTORS sectors of OBSTACLE_MAP_BINS range bins each. Every
+ * bin holds a saturated log-odds occupancy that range readings update
+ * incrementally: the bins in front of the measured range are seen free and
+ * the bin of the range is seen occupied. The distance to the nearest
+ * occupied bin of every sector is cached for the readers.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define OBSTACLE_MAP_SECTORS      16
+#define OBSTACLE_MAP_BINS         20
+#define OBSTACLE_MAP_BIN_MM       100
+#define OBSTACLE_MAP_MAX_RANGE_MM (OBSTACLE_MAP_BINS * OBSTACLE_MAP_BIN_MM)
+
+// Sector range when nothing was seen in the sector
+#define OBSTACLE_MAP_NONE         UINT16_MAX
+
+void obstacleMapInit(void);
+
+/**
+ * Add a range reading. Safe to call from any task.
+ *
+ * @param bearing Direction of the sensor in the body frame (rad, 0 = front, counter clockwise)
+ * @param fov Field of view of the sensor (rad)
+ * @param rangeMm Measured range, OBSTACLE_MAP_NONE if nothing was in range
+ */
+void obstacleMapUpdate(float bearing, float fov, uint16_t rangeMm);
+
+/**
+ * Distance to the nearest obstacle of a sector.
+ *
+ * @return Range in mm, or OBSTACLE_MAP_NONE
+ */
+uint16_t obstacleMapSectorRange(int sector);
+
+/**
+ * Direction of the middle of a sector in the body frame, in rad.
+ */
+float obstacleMapSectorBearing(int sector);
+
+/**
+ * Distance to the nearest obstacle in a cone.
+ *
+ * @param bearing Direction of the middle of the cone in the body frame (rad)
+ * @param width Width of the cone (rad), 2 * M_PI for all around
+ * @return Range in mm, or OBSTACLE_MAP_NONE
+ */
+uint16_t obstacleMapNearest(float bearing, float width);
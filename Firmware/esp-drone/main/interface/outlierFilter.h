@@ -27,8 +27,20 @@
 
 #include "stabilizer_types.h"
 
+#define OUTLIER_FILTER_TDOA_LEVELS 5
+
+// The state of a TDoA outlier filter, one per measurement source
+typedef struct {
+    int bucket[OUTLIER_FILTER_TDOA_LEVELS];
+    int filterCloseDelayCounter;
+    int previousFilterIndex;
+    float acceptanceLevel;
+    float errorDistance;
+} OutlierFilterTdoaState_t;
+
 bool outlierFilterValidateTdoaSimple(const tdoaMeasurement_t* tdoa);
-bool outlierFilterValidateTdoaSteps(const tdoaMeasurement_t* tdoa, const float error, const vector_t* jacobian, const point_t* estPos);
+bool outlierFilterValidateTdoaSteps(OutlierFilterTdoaState_t* this, const tdoaMeasurement_t* tdoa, const float error, const vector_t* jacobian, const point_t* estPos);
+void outlierFilterTdoaReset(OutlierFilterTdoaState_t* this);
 
 typedef struct {
     uint32_t openingTime;
@@ -123,12 +123,20 @@ void paramSetInt(paramVarId_t varid, int valuei);
  */
 void paramSetFloat(paramVarId_t varid, float valuef);
 
+/** Apply the batch of param writes committed by the client, if any
+ *
+ * Called by the stabilizer between two loops, so that the writes of a batch
+ * come into effect together.
+ */
+void paramBatchTick(void);
+
 
 /* Basic parameter structure */
 struct param_s {
   uint8_t type;
   char * name;
   void * address;
+  void (* callback)(void);    // Called after a write, NULL for none
 };
 
 #define PARAM_BYTES_MASK 0x03
@@ -173,6 +181,18 @@ struct param_s {
    { \
   .type = TYPE, .name = #NAME, .address = (void*)(ADDRESS), },
 
+/*
+ * A variable whose callback is called after each write of its value: by a
+ * client, by paramSetInt() or paramSetFloat(), or when paramInit() restores
+ * it from flash. The callback runs in the task of the writer, the param task
+ * for the clients, and possibly before the module of the variable is
+ * initialized. It must be short and must not block: state that another task
+ * uses, e.g. the stabilizer, is best marked stale by the callback and
+ * recomputed by that task.
+ */
+#define PARAM_ADD_WITH_CALLBACK(TYPE, NAME, ADDRESS, CALLBACK) \
+   { .type = TYPE, .name = #NAME, .address = (void*)(ADDRESS), .callback = (CALLBACK), },
+
 #define PARAM_GROUP_START(NAME)  \
   static const struct param_s __params_##NAME[] __attribute__((section(".param." #NAME), used)) = { \
   PARAM_ADD_GROUP(PARAM_GROUP | PARAM_START, NAME, 0x0)
@@ -187,6 +207,7 @@ struct param_s {
 
 // Empty defines when running unit tests
 #define PARAM_ADD(TYPE, NAME, ADDRESS)
+#define PARAM_ADD_WITH_CALLBACK(TYPE, NAME, ADDRESS, CALLBACK)
 #define PARAM_ADD_GROUP(TYPE, NAME, ADDRESS)
 #define PARAM_GROUP_START(NAME)
 #define PARAM_GROUP_STOP(NAME)
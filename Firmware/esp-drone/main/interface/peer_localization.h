@@ -15,6 +15,10 @@
 // needed for static allocations in other modules, e.g. collision avoidance.
 #define PEER_LOCALIZATION_MAX_NEIGHBORS 10
 
+// A position older than this counts as gone. The slots of the positions this
+// old are given to new IDs once the table is full.
+#define PEER_LOCALIZATION_MAX_AGE_MS 5000
+
 // Initialize and test the module.
 void peerLocalizationInit();
 bool peerLocalizationTest();
@@ -29,15 +33,21 @@ typedef struct peerLocalizationOtherPosition_s {
 // e.g. when a motion capture measurement packet is received.
 bool peerLocalizationTellPosition(int id, positionMeasurement_t const *pos);
 
-// Returns true if we have a position value for the given radio ID.
+// Returns true if we have a position value for the given radio ID that is not
+// older than PEER_LOCALIZATION_MAX_AGE_MS.
 bool peerLocalizationIsIDActive(uint8_t id);
 
-// Returns the position value for the given radio ID, or NULL if none exists.
-// Performs a linear search.
+// Returns the position value for the given radio ID, or NULL if none exists
+// or it is older than PEER_LOCALIZATION_MAX_AGE_MS. Looked up in a table by ID.
 peerLocalizationOtherPosition_t *peerLocalizationGetPositionByID(uint8_t id);
 
-// Returns the position value based on index, uncorrelated with radio ID. More
-// efficient if iterating over all peers is needed.
+// Number of neighbors in the table, the indices below it are all in use.
+// Stale ones stay until a new ID needs their slot, check the timestamp.
+uint8_t peerLocalizationGetNeighborCount(void);
+
+// Returns the position value based on index, uncorrelated with radio ID, or
+// NULL past the neighbor count. More efficient if iterating over all peers is
+// needed.
 peerLocalizationOtherPosition_t *peerLocalizationGetPositionByIdx(uint8_t idx);
 
 #endif // __PEER_LOCALIZATION_H__
@@ -224,4 +224,74 @@ void pidSetKd(PidObject* pid, const float kd);
  * @param[in] dt    Delta time
  */
 void pidSetDt(PidObject* pid, const float dt);
+
+#define PID_BANK_AXES 3
+
+/**
+ * The PIDs of the three axes of one level of a cascade, one array per field.
+ * pidBankUpdate() computes the same as pidUpdate() on each of the axes, in
+ * one pass and without the calls. All axes share dt and the D filter setup.
+ */
+typedef struct
+{
+  float error[PID_BANK_AXES];       //< error
+  float prevError[PID_BANK_AXES];   //< previous error
+  float integ[PID_BANK_AXES];       //< integral
+  float deriv[PID_BANK_AXES];       //< derivative
+  float kp[PID_BANK_AXES];          //< proportional gain
+  float ki[PID_BANK_AXES];          //< integral gain
+  float kd[PID_BANK_AXES];          //< derivative gain
+  float outP[PID_BANK_AXES];        //< proportional output (debugging)
+  float outI[PID_BANK_AXES];        //< integral output (debugging)
+  float outD[PID_BANK_AXES];        //< derivative output (debugging)
+  float iLimit[PID_BANK_AXES];      //< integral limit, absolute value. '0' means no limit.
+  float outputLimit[PID_BANK_AXES]; //< total PID output limit, absolute value. '0' means no limit.
+  float dFilterDelay1[PID_BANK_AXES]; //< D filter state, the coefficients are in dFilter
+  float dFilterDelay2[PID_BANK_AXES];
+  float dt;                         //< delta-time dt
+  lpf2pData dFilter;                //< coefficients of the D filter of all axes
+  bool enableDFilter;               //< filter for D term enable flag
+} PidBank;
+
+/**
+ * PID bank initialization, the gains are set per axis with pidBankSetAxis().
+ *
+ * @param[out] bank         A pointer to the pid bank to initialize.
+ * @param[in] dt            Delta time since the last call
+ * @param[in] samplingRate  Frequency the update will be called
+ * @param[in] cutoffFreq    Frequency to set the low pass filter cutoff at
+ * @param[in] enableDFilter Enable setting for the D lowpass filter
+ */
+void pidBankInit(PidBank* bank, const float dt, const float samplingRate,
+                 const float cutoffFreq, bool enableDFilter);
+
+/**
+ * Set the gains and the integral limit of one axis of the bank.
+ */
+void pidBankSetAxis(PidBank* bank, const int axis, const float kp,
+                    const float ki, const float kd, const float iLimit);
+
+/**
+ * Update the PIDs of all axes, as pidUpdate() with pidSetError().
+ *
+ * @param[in] bank    A pointer to the pid bank.
+ * @param[in] error   The error of each axis, set point minus measured
+ * @param[out] output PID algorithm output of each axis
+ */
+void pidBankUpdate(PidBank* bank, const float error[PID_BANK_AXES], float output[PID_BANK_AXES]);
+
+/**
+ * Set a new dt for all axes, and the sampling rate of the D filter if enabled.
+ */
+void pidBankSetDt(PidBank* bank, const float dt, const float samplingRate, const float cutoffFreq);
+
+/**
+ * Reset the PID error values of one axis
+ */
+void pidBankResetAxis(PidBank* bank, const int axis);
+
+/**
+ * Reset the PID error values of all axes
+ */
+void pidBankReset(PidBank* bank);
 #endif /* PID_H_ */
@@ -62,7 +62,7 @@ struct planner
 	bool reversed;					// true, if trajectory should be evaluated in reverse
 
 	union {
-		const struct piecewise_traj* trajectory; // pointer to trajectory
+		struct piecewise_traj* trajectory; // pointer to trajectory
 		struct piecewise_traj_compressed* compressed_trajectory; // pointer to compressed trajectory
 	};
 
@@ -99,7 +99,7 @@ int plan_go_to(struct planner *p, bool relative, struct vec hover_pos, float hov
 int plan_go_to_from(struct planner *p, const struct traj_eval *curr_eval, bool relative, struct vec hover_pos, float hover_yaw, float duration, float t);
 
 // start trajectory
-int plan_start_trajectory(struct planner *p, const struct piecewise_traj* trajectory, bool reversed);
+int plan_start_trajectory(struct planner *p, struct piecewise_traj* trajectory, bool reversed);
 
 // start compressed trajectory
 int plan_start_compressed_trajectory(struct planner *p, struct piecewise_traj_compressed* trajectory);
@@ -40,5 +40,8 @@ bool platformserviceTest(void);
 
 void platformserviceSendAppchannelPacket(CRTPPacket *p);
 
+// Waits for room in the TX queue instead of dropping the packet
+void platformserviceSendAppchannelPacketBlock(CRTPPacket *p);
+
 #endif /* __PLATFORMSERVICE_H__ */
 
@@ -0,0 +1,60 @@
+/**
+ *
+ * ESP-Drone Firmware
+ *
+ * Copyright 2019-2020  Espressif Systems (Shanghai)
+ * Copyright (C) 2011-2012 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * power_save.h - A slower CPU clock and stabilizer loop while on the ground
+ *
+ * The drone is idle when it is disarmed, or armed with the motors stopped,
+ * no trajectory of the high-level commander and no setpoint younger than
+ * POWER_SAVE_IDLE_DELAY_MS, commanderNotifySetpointsStop() ages them. While it is idle the esp_pm lock of the maximum CPU
+ * frequency is released, the power management of the IDF scales the clock
+ * down and, with FREERTOS_USE_TICKLESS_IDLE, lets the chip light sleep. The
+ * stabilizer then runs its estimator, commander and controller only every
+ * POWER_SAVE_IDLE_DIVIDER sensor samples, the sensors keep their rate. The
+ * estimators integrate the measured time between the samples they are given,
+ * POWER_SAVE_IDLE selects ESTIMATOR_MEASURED_DT.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define POWER_SAVE_IDLE_DELAY_MS  2000
+#define POWER_SAVE_IDLE_DIVIDER   10
+
+#ifdef CONFIG_POWER_SAVE_IDLE
+  /**
+   * Configures the power management, at full speed until the first idle
+   * loop, so that the calibration of the sensors is done at full rate.
+   */
+  void powerSaveInit(void);
+
+  /**
+   * Called by the stabilizer task once per loop.
+   *
+   * @param isActive False if the drone is idle
+   * @param tick The tick of the stabilizer loop
+   * @return True if the loop runs the estimator and the controller
+   */
+  bool powerSaveTick(bool isActive, uint32_t tick);
+#else
+  #define powerSaveInit()
+  #define powerSaveTick(isActive, tick) (true)
+#endif
@@ -81,11 +81,13 @@ void polyreflect(float p[PP_SIZE]);
 // 4d single polynomial piece for x-y-z-yaw, includes duration.
 //
 
+// Packed as uploaded, aligned for its floats: the pieces are only read from
+// 4 byte aligned offsets of the trajectory memory
 struct poly4d
 {
 	float p[4][PP_SIZE];
 	float duration; // TODO use int millis instead?
-} __attribute__((packed));
+} __attribute__((packed, aligned(4)));
 
 // construct a 4d zero polynomial.
 struct poly4d poly4d_zero(float duration);
@@ -149,6 +151,15 @@ struct piecewise_traj
 	struct vec shift;
 	unsigned char n_pieces;
 	struct poly4d* pieces;
+
+	// playhead of piecewise_eval() and piecewise_eval_reversed(): the piece
+	// at the cursor, already shifted and stretched in time. Must be reset by
+	// piecewise_rewind() when the fields above change.
+	bool cursor_valid;
+	bool cursor_reversed;
+	int cursor;
+	float cursor_t_begin; // start of the piece, relative to t_begin
+	struct poly4d cursor_piece;
 };
 
 static inline float piecewise_duration(struct piecewise_traj const *pp)
@@ -168,11 +179,14 @@ void piecewise_plan_7th_order_no_jerk(struct piecewise_traj *p, float duration,
 	struct vec p0, float y0, struct vec v0, float dy0, struct vec a0,
 	struct vec p1, float y1, struct vec v1, float dy1, struct vec a1);
 
+// forget the cached piece, after the trajectory has been modified
+void piecewise_rewind(struct piecewise_traj *traj);
+
 struct traj_eval piecewise_eval(
-	struct piecewise_traj const *traj, float t);
+	struct piecewise_traj *traj, float t);
 
 struct traj_eval piecewise_eval_reversed(
-	struct piecewise_traj const *traj, float t);
+	struct piecewise_traj *traj, float t);
 
 
 static inline bool piecewise_is_finished(struct piecewise_traj const *traj, float t)
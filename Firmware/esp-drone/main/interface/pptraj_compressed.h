@@ -83,3 +83,8 @@ struct traj_eval piecewise_compressed_eval(
 // Loads the compressed trajectory at the given pointer
 void piecewise_compressed_load(
 	struct piecewise_traj_compressed *traj, const void* data);
+
+// Returns the number of bytes of the compressed trajectory at the given
+// pointer, the last piece included, or 0 if it does not end within the
+// available bytes. Nothing past the available bytes is read.
+size_t piecewise_compressed_size(const void* data, size_t available);
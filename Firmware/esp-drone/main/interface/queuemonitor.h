@@ -21,7 +21,7 @@
  * You should have received a copy of the GNU General Public License
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  *
- * log.h - Dynamic log system
+ * queuemonitor.h - Monitoring functionality for queues
  */
 
 #ifndef __QUEUE_MONITOR_H__
@@ -29,18 +29,50 @@
 
 
 #include "FreeRTOS.h"
+#include "queue.h"
 
-#ifdef DEBUG_QUEUE_MONITOR
-  #include "queue.h"
-
-  void queueMonitorInit();
-  #define DEBUG_QUEUE_MONITOR_REGISTER(queue) qmRegisterQueue(queue, __FILE__, #queue)
+/*
+ * Depth, drop and latency statistics of the queues of the link and of the
+ * flight pipeline, exported in the queueMon and queueMonHist log groups.
+ *
+ * The owner of a queue reports every operation with its result. The
+ * latency of FIFO queues is sampled: one item at a time is timestamped when
+ * it is sent and measured when it is received. For mailboxes, which are
+ * overwritten and peeked, the latency is the age of the value when it is
+ * peeked.
+ */
+typedef enum {
+  qmUdpRx = 0,
+  qmUdpTx,
+  qmCrtpTx,     // The control class of the TX scheduler
+  qmCrtpRx,     // All the port queues together, drops and depth only
+  qmSetpoint,   // Mailbox
+  qmTof,        // Mailbox
+  qmWorker,
+  QM_NBR_OF_QUEUES
+} qmQueueId_t;
 
-  void qm_traceQUEUE_SEND(void* xQueue);
-  void qm_traceQUEUE_SEND_FAILED(void* xQueue);
-  void qmRegisterQueue(xQueueHandle* xQueue, char* fileName, char* queueName);
+#ifdef CONFIG_QUEUE_MONITOR
+  /**
+   * Report a send, or an overwrite, to a queue. Can be called from an ISR.
+   *
+   * @param id The monitored queue
+   * @param queue The queue, for its depth, NULL for a mailbox that is not a queue
+   * @param result The result of the send
+   */
+  void queueMonitorSent(qmQueueId_t id, xQueueHandle queue, BaseType_t result);
+  void queueMonitorReceived(qmQueueId_t id, BaseType_t result);
+  void queueMonitorPeeked(qmQueueId_t id, BaseType_t result);
+  void queueMonitorReset(qmQueueId_t id);
 #else
-  #define DEBUG_QUEUE_MONITOR_REGISTER(queue)
-#endif // DEBUG_QUEUE_MONITOR
+  // The result is often the queue call itself, it must still be made
+  #define queueMonitorSent(id, queue, result) ((void)(result))
+  #define queueMonitorReceived(id, result) ((void)(result))
+  #define queueMonitorPeeked(id, result) ((void)(result))
+  #define queueMonitorReset(id)
+#endif
+
+// Queues are identified by qmQueueId_t, registration is not needed anymore
+#define DEBUG_QUEUE_MONITOR_REGISTER(queue)
 
-#endif // __QUEUE_MONITOR_H__
\ No newline at end of file
+#endif // __QUEUE_MONITOR_H__
@@ -27,6 +27,9 @@
 
 #pragma once
 
+#include <stdbool.h>
+#include <stdint.h>
+
 typedef enum {
     rangeFront=0,
     rangeBack,
@@ -62,3 +65,47 @@ float rangeGet(rangeDirection_t direction);
  * @return true if the sample was successfuly enqueued
  */
 bool rangeEnqueueDownRangeInEstimator(float distance, float stdDev, uint32_t timeStamp);
+
+/**
+ * Called from the ranger task after every down range measurement was
+ * enqueued in the estimator. The default weak function does nothing, modules
+ * that react to new measurements implement it.
+ */
+void rangeDownUpdated(void);
+
+/**
+ * Measurement noise model, the standard deviation of a sample as a function
+ * of what was measured, tabulated so that a sample costs one lookup and one
+ * interpolation instead of the model itself. Linear between the points, the
+ * ends hold outside of the table.
+ */
+#define RANGE_NOISE_MODEL_POINTS 129
+
+typedef struct {
+  float xMin;
+  float invStep;
+  float stdDev[RANGE_NOISE_MODEL_POINTS];
+} rangeNoiseModel_t;
+
+/**
+ * Tabulate a noise model over [xMin, xMax]. The table is written in place,
+ * build it from the task that evaluates it.
+ *
+ * @param model The table to build
+ * @param stdDevOf The model, called RANGE_NOISE_MODEL_POINTS times with arg
+ */
+void rangeNoiseModelBuild(rangeNoiseModel_t *model, float xMin, float xMax,
+                          float (*stdDevOf)(float x, const void *arg), const void *arg);
+
+/**
+ * Tabulate the exponential model of the ToF rangers over [0, xMax],
+ * stdDev = stdA * (1 + exp(k * (x - pointA))) with k such that the model is
+ * about stdB at pointB.
+ */
+void rangeNoiseModelBuildExp(rangeNoiseModel_t *model, float xMax,
+                             float pointA, float stdA, float pointB, float stdB);
+
+/**
+ * @return The standard deviation of a sample x
+ */
+float rangeNoiseModelStdDev(const rangeNoiseModel_t *model, float x);
@@ -31,6 +31,14 @@ void sensfusion6Init(void);
 bool sensfusion6Test(void);
 
 void sensfusion6UpdateQ(float gx, float gy, float gz, float ax, float ay, float az, float dt);
+/**
+ * The update of sensfusion6UpdateQ() in two steps, for a gyro integration
+ * at a higher rate than the accelerometer correction: sensfusion6PredictQ()
+ * integrates the gyro only, sensfusion6CorrectQ() applies the accelerometer
+ * feedback of its own period dt.
+ */
+void sensfusion6PredictQ(float gx, float gy, float gz, float dt);
+void sensfusion6CorrectQ(float ax, float ay, float az, float dt);
 void sensfusion6GetQuaternion(float* qx, float* qy, float* qz, float* qw);
 void sensfusion6GetEulerRPY(float* roll, float* pitch, float* yaw);
 float sensfusion6GetAccZWithoutGravity(const float ax, const float ay, const float az);
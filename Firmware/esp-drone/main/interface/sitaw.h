@@ -34,7 +34,7 @@
 
 void sitAwInit(void);
 void sitAwUpdateSetpoint(setpoint_t *setpoint, const sensorData_t *sensorData,
-                                               const state_t *state);
+                                               const state_t *state, const uint32_t tick);
 /* Enable the situation awareness framework. */
 #define SITAW_ENABLED
 /* Enable the different functions of the situation awareness framework. */
@@ -42,12 +42,19 @@ void sitAwUpdateSetpoint(setpoint_t *setpoint, const sensorData_t *sensorData,
 //#define SITAW_AR_ENABLED           /* Uncomment to enable */
 #define SITAW_TU_ENABLED           /* Uncomment to enable */
 
+/* The detectors run at this rate on the means of the samples since their last run. */
+#define SITAW_RATE RATE_250_HZ
+
+/* Event queues, one per subscriber. */
+#define SITAW_MAX_SUBSCRIBERS 4
+#define SITAW_EVENT_QUEUE_LENGTH 8 /* Must be a power of 2. */
+
 /* Configuration options for the 'Free Fall' detection. */
-#define SITAW_FF_THRESHOLD 0.1     /* The default tolerance for AccWZ deviations from -1, indicating Free Fall. */
+#define SITAW_FF_THRESHOLD 0.1f    /* The default tolerance for AccWZ deviations from -1, indicating Free Fall. */
 #define SITAW_FF_TRIGGER_COUNT 15  /* The number of consecutive tests for Free Fall to be detected. Configured for 250Hz testing. */
 
 /* Configuration options for the 'At Rest' detection. */
-#define SITAW_AR_THRESHOLD 0.05    /* The default tolerance for AccZ deviations from 1 and AccX, AccY deviations from 0, indicating At Rest. */
+#define SITAW_AR_THRESHOLD 0.05f   /* The default tolerance for AccZ deviations from 1 and AccX, AccY deviations from 0, indicating At Rest. */
 #define SITAW_AR_TRIGGER_COUNT 500 /* The number of consecutive tests for At Rest to be detected. Configured for 250Hz testing. */
 
 /* Configuration options for the 'Tumbled' detection. */
@@ -68,6 +75,36 @@ void sitAwUpdateSetpoint(setpoint_t *setpoint, const sensorData_t *sensorData,
 //#define SITAW_AR_PARAM_ENABLED     /* Uncomment to enable PARAM framework for the At Rest detection. */
 //#define SITAW_TU_PARAM_ENABLED     /* Uncomment to enable PARAM framework for the Tumbled detection. */
 
+/* A situation that was detected, or that is over. */
+typedef enum {
+  sitAwEventFreeFall = 0,
+  sitAwEventAtRest,
+  sitAwEventTumbled,
+} sitAwEventType_t;
+
+typedef struct {
+  uint8_t type;      /* sitAwEventType_t */
+  bool detected;     /* True when the situation starts, false when it ends. */
+  uint32_t tick;     /* Stabilizer tick of the detection. */
+} sitAwEvent_t;
+
+/**
+ * Subscribe to the events of the detectors.
+ *
+ * Every subscriber has its own queue, which only one task may poll. The
+ * detectors never wait on a queue, the events that do not fit are dropped.
+ *
+ * @return The subscriber to poll with, or -1 if there are SITAW_MAX_SUBSCRIBERS already.
+ */
+int sitAwSubscribe(void);
+
+/**
+ * Get the next event of a subscriber.
+ *
+ * @return True if there was an event.
+ */
+bool sitAwPollEvent(int subscriber, sitAwEvent_t *event);
+
 #ifdef SITAW_FF_ENABLED
 bool sitAwFFDetected(void);
 #endif
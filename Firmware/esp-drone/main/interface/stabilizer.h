@@ -64,5 +64,12 @@ void stabilizerResetEmergencyStop();
  */
 void stabilizerSetEmergencyStopTimeout(int timeout);
 
+/**
+ * Whether the motors run, a setpoint came in the last POWER_SAVE_IDLE_DELAY_MS
+ * or the high level commander flies a plan. The system is armed on every
+ * build, what must not run in flight checks this instead.
+ */
+bool stabilizerIsFlying(void);
+
 
 #endif /* STABILIZER_H_ */
@@ -29,6 +29,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include "imu_types.h"
+#include "sdkconfig.h"
 //#include "lighthouse_calibration.h"
 
 /* Data structure used by the stabilizer subsystem.
@@ -83,6 +84,12 @@ typedef struct quaternion_s {
   };
 } quaternion_t;
 
+/* Rotation matrix of the attitude, from the body to the world frame */
+typedef struct rotation_s {
+  uint32_t version;         // Changes with every new R, 0 until an estimator has set R
+  float R[3][3];
+} rotation_t;
+
 typedef struct tdoaMeasurement_s {
   point_t anchorPosition[2];
   float distanceDiff;
@@ -105,6 +112,7 @@ typedef struct positionMeasurement_s {
     float pos[3];
   };
   float stdDev;
+  uint32_t timestampUs;     // usecTimestamp() when measured, 0 if the measurement is current
 } positionMeasurement_t;
 
 typedef struct poseMeasurement_s {
@@ -119,6 +127,7 @@ typedef struct poseMeasurement_s {
   quaternion_t quat;
   float stdDevPos;
   float stdDevQuat;
+  uint32_t timestampUs;     // usecTimestamp() when measured, 0 if the measurement is current
 } poseMeasurement_t;
 
 typedef struct distanceMeasurement_s {
@@ -154,11 +163,26 @@ typedef struct sensorData_s {
 typedef struct state_s {
   attitude_t attitude;      // deg (legacy CF2 body coordinate system, where pitch is inverted)
   quaternion_t attitudeQuaternion;
+  rotation_t rotation;      // of attitudeQuaternion, R[2] is the world z axis in the body frame
   point_t position;         // m
   velocity_t velocity;      // m/s
   acc_t acc;                // Gs (but acc.z without considering gravity)
 } state_t;
 
+// Hand the rotation matrix of the new attitude over to the controllers
+static inline void stateSetRotation(state_t *state, const float R[3][3])
+{
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 3; j++) {
+      state->rotation.R[i][j] = R[i][j];
+    }
+  }
+  // 0 is for no rotation yet
+  if (++state->rotation.version == 0) {
+    state->rotation.version = 1;
+  }
+}
+
 typedef struct control_s {
   int16_t roll;
   int16_t pitch;
@@ -269,7 +293,7 @@ typedef struct {
 
 #define RATE_MAIN_LOOP RATE_1000_HZ
 #define ATTITUDE_RATE RATE_500_HZ
-#define POSITION_RATE RATE_100_HZ
+#define POSITION_RATE CONFIG_CONTROLLER_POSITION_RATE_HZ
 
 #define RATE_DO_EXECUTE(RATE_HZ, TICK) ((TICK % (RATE_MAIN_LOOP / RATE_HZ)) == 0)
 
@@ -31,6 +31,9 @@
 
 #pragma once
 
+#include <stddef.h>
+#include <stdint.h>
+#include "sdkconfig.h"
 #include "cfassert.h"
 
 #define CCM_NOT_SUPPORTED
@@ -79,6 +82,145 @@
   #define FORCE_CCM_ZERO_INIT __attribute__((section(".ccmbss")))
 #endif
 
+/**
+ * @brief Macro to indicate that a large buffer may be placed in the PSRAM
+ * of the module, instead of the internal RAM, with
+ * CONFIG_BULK_BUFFERS_IN_PSRAM.
+ *
+ * Only for buffers that are not read or written in a hurry: every access
+ * that misses the cache goes over the SPI bus, the buffer can not be used
+ * for DMA transfers and not from an ISR that runs while the flash is
+ * written. The data of the 1 kHz loop stays in the internal RAM.
+ *
+ * The memory is zero initialized at start up, like NO_DMA_CCM_SAFE_ZERO_INIT.
+ * Without PSRAM the variable stays in the internal RAM.
+ */
+#if defined(UNIT_TEST_MODE) || !defined(CONFIG_BULK_BUFFERS_IN_PSRAM)
+  #define BULK_EXT_RAM_ZERO_INIT
+#else
+  #include "esp_attr.h"
+  #define BULK_EXT_RAM_ZERO_INIT EXT_RAM_BSS_ATTR
+#endif
+
+
+/**
+ * @brief Pool of fixed size items, taken and put back in constant time.
+ *
+ * The items are a static array of the caller, STATIC_MEM_POOL_INIT() links
+ * them all into the free list of the pool. A free item holds the link in its
+ * first bytes, so the item type must be at least a pointer in size and
+ * alignment, the rest of a free item keeps what it held when put back. The
+ * pool is not thread safe, the caller serializes the calls.
+ *
+ * Example:
+ * static struct myItem items[32];
+ * static staticMemPool_t itemsPool;
+ * // ...
+ * void init() {
+ *   STATIC_MEM_POOL_INIT(itemsPool, items);
+ * }
+ * struct myItem *item = staticMemPoolGet(&itemsPool);  // NULL when all are taken
+ * staticMemPoolPut(&itemsPool, item);
+ */
+typedef struct staticMemPoolItem_s {
+  struct staticMemPoolItem_s *next;
+} staticMemPoolItem_t;
+
+typedef struct {
+  staticMemPoolItem_t *free;
+} staticMemPool_t;
+
+/**
+ * @brief Put all the items in the free list, forgetting the ones taken.
+ *
+ * @param pool The pool
+ * @param items The first item
+ * @param itemSize The size of an item, in bytes
+ * @param length The number of items
+ */
+static inline void staticMemPoolInit(staticMemPool_t *pool, void *items, size_t itemSize, size_t length)
+{
+  pool->free = NULL;
+  // Backwards, the first item is the first one taken
+  for (size_t i = length; i > 0; i--) {
+    staticMemPoolItem_t *item = (staticMemPoolItem_t *)((uint8_t *)items + (i - 1) * itemSize);
+    item->next = pool->free;
+    pool->free = item;
+  }
+}
+
+#define STATIC_MEM_POOL_INIT(POOL, ITEMS) \
+  staticMemPoolInit(&(POOL), (ITEMS), sizeof((ITEMS)[0]), sizeof(ITEMS) / sizeof((ITEMS)[0]))
+
+/**
+ * @brief Take an item out of the pool.
+ *
+ * @return The item, or NULL if all the items are taken
+ */
+static inline void *staticMemPoolGet(staticMemPool_t *pool)
+{
+  staticMemPoolItem_t *item = pool->free;
+
+  if (item) {
+    pool->free = item->next;
+  }
+  return item;
+}
+
+/**
+ * @brief Put an item taken by staticMemPoolGet() back into the pool.
+ */
+static inline void staticMemPoolPut(staticMemPool_t *pool, void *item)
+{
+  ((staticMemPoolItem_t *)item)->next = pool->free;
+  pool->free = item;
+}
+
+
+/**
+ * @brief Registry of the static tasks and queues.
+ *
+ * Every STATIC_MEM_TASK_ALLOC() and STATIC_MEM_QUEUE_ALLOC() also places a
+ * staticMemEntry_t in the .staticMem section, and the CREATE macros keep the
+ * handle of the object in its state. staticMemDump() prints the size and the
+ * peak use of every entry, see static_mem_registry.c.
+ */
+typedef enum {
+  STATIC_MEM_TASK = 0,
+  STATIC_MEM_QUEUE,
+} staticMemType_t;
+
+typedef struct {
+  void *handle;     // NULL until created
+  uint16_t peak;    // Queues: most items seen waiting by staticMemSample()
+} staticMemState_t;
+
+typedef struct {
+  const char *name;
+  uint8_t type;     // staticMemType_t
+  uint16_t length;  // Tasks: stack depth in StackType_t, queues: items
+  uint16_t itemSize;
+  uint32_t size;    // All the static memory of the object, in bytes
+  staticMemState_t *state;
+} staticMemEntry_t;
+
+#define STATIC_MEM_REGISTER(NAME, TYPE, LENGTH, ITEM_SIZE, SIZE) \
+  static staticMemState_t osSys_ ## NAME ## State; \
+  static const staticMemEntry_t osSys_ ## NAME ## Entry __attribute__((section(".staticMem." #NAME), used)) = { \
+    .name = #NAME, .type = (TYPE), .length = (LENGTH), .itemSize = (ITEM_SIZE), .size = (SIZE), \
+    .state = &osSys_ ## NAME ## State, \
+  };
+
+/**
+ * @brief Update the peaks of the registered queues, call it periodically.
+ */
+void staticMemSample(void);
+
+/**
+ * @brief Print the size and peak use of the registered tasks and queues on the console.
+ */
+void staticMemDump(void);
+
 
 /**
  * @brief Creation of queues using static memory.
@@ -115,6 +257,8 @@
  * // static uint8_t osSys_myQueueStorage[5 * sizeof(int)];
  * // static StaticQueue_t osSys_myQueueSMgm;
  *
+ * // plus the staticMemEntry_t of the registry
+ *
  * Note: the memory is allocated in CCM RAM. Read/write to the queue is done by copy
  * and the special properties of CCM RAM should not have any impact on the behaviour.
  *
@@ -127,7 +271,9 @@
   static const int osSys_ ## NAME ## Length = (LENGTH); \
   static const int osSys_ ## NAME ## ItemSize = (ITEM_SIZE); \
   NO_DMA_CCM_SAFE_ZERO_INIT static uint8_t osSys_ ## NAME ## Storage[(LENGTH) * (ITEM_SIZE)]; \
-  NO_DMA_CCM_SAFE_ZERO_INIT static StaticQueue_t osSys_ ## NAME ## Mgm;
+  NO_DMA_CCM_SAFE_ZERO_INIT static StaticQueue_t osSys_ ## NAME ## Mgm; \
+  STATIC_MEM_REGISTER(NAME, STATIC_MEM_QUEUE, (LENGTH), (ITEM_SIZE), \
+                      (LENGTH) * (ITEM_SIZE) + sizeof(StaticQueue_t))
 
 /**
  * @brief Creates a queue using static memory
@@ -142,7 +288,7 @@
  *
  * @param NAME - the name of the queue handle
  */
-#define STATIC_MEM_QUEUE_CREATE(NAME) xQueueCreateStatic(osSys_ ## NAME ## Length, osSys_ ## NAME ## ItemSize, osSys_ ## NAME ## Storage, &osSys_ ## NAME ## Mgm)
+#define STATIC_MEM_QUEUE_CREATE(NAME) ((xQueueHandle)(osSys_ ## NAME ## State.handle = xQueueCreateStatic(osSys_ ## NAME ## Length, osSys_ ## NAME ## ItemSize, osSys_ ## NAME ## Storage, &osSys_ ## NAME ## Mgm)))
 
 
 /**
@@ -181,7 +327,9 @@
 #define STATIC_MEM_TASK_ALLOC(NAME, STACK_DEPTH) \
   static const int osSys_ ## NAME ## StackDepth = (STACK_DEPTH); \
   static StackType_t osSys_ ## NAME ## StackBuffer[(STACK_DEPTH)]; \
-  NO_DMA_CCM_SAFE_ZERO_INIT static StaticTask_t osSys_ ## NAME ## TaskBuffer;
+  NO_DMA_CCM_SAFE_ZERO_INIT static StaticTask_t osSys_ ## NAME ## TaskBuffer;  \
+  STATIC_MEM_REGISTER(NAME, STATIC_MEM_TASK, (STACK_DEPTH), sizeof(StackType_t), \
+                      (STACK_DEPTH) * sizeof(StackType_t) + sizeof(StaticTask_t))
 
 /**
  * @brief Allocate variables and stack for a task using static memory.
@@ -197,7 +345,9 @@
 #define STATIC_MEM_TASK_ALLOC_STACK_NO_DMA_CCM_SAFE(NAME, STACK_DEPTH) \
   static const int osSys_ ## NAME ## StackDepth = (STACK_DEPTH); \
   NO_DMA_CCM_SAFE_ZERO_INIT static StackType_t osSys_ ## NAME ## StackBuffer[(STACK_DEPTH)]; \
-  NO_DMA_CCM_SAFE_ZERO_INIT static StaticTask_t osSys_ ## NAME ## TaskBuffer;
+  NO_DMA_CCM_SAFE_ZERO_INIT static StaticTask_t osSys_ ## NAME ## TaskBuffer;  \
+  STATIC_MEM_REGISTER(NAME, STATIC_MEM_TASK, (STACK_DEPTH), sizeof(StackType_t), \
+                      (STACK_DEPTH) * sizeof(StackType_t) + sizeof(StaticTask_t))
 
 /**
  * @brief Create a task using static memory
@@ -211,4 +361,19 @@
  * @param PARAMETERS Passed on as argument to the function implementing the task
  * @param PRIORITY The task priority
  */
-#define STATIC_MEM_TASK_CREATE(NAME, FUNCTION, TASK_NAME, PARAMETERS, PRIORITY) xTaskCreateStatic((FUNCTION), (TASK_NAME), osSys_ ## NAME ## StackDepth, (PARAMETERS), (PRIORITY), osSys_ ## NAME ## StackBuffer, &osSys_ ## NAME ## TaskBuffer)
+#define STATIC_MEM_TASK_CREATE(NAME, FUNCTION, TASK_NAME, PARAMETERS, PRIORITY) ((TaskHandle_t)(osSys_ ## NAME ## State.handle = xTaskCreateStatic((FUNCTION), (TASK_NAME), osSys_ ## NAME ## StackDepth, (PARAMETERS), (PRIORITY), osSys_ ## NAME ## StackBuffer, &osSys_ ## NAME ## TaskBuffer)))
+
+/**
+ * @brief Create a task using static memory, pinned to a core
+ *
+ * Same as STATIC_MEM_TASK_CREATE() but the task only runs on CORE. Use the
+ * *_TASK_CORE defines in config.h, they are tskNO_AFFINITY on single core builds.
+ *
+ * @param NAME A name used as base name for the variables, same name that was used in STATIC_MEM_TASK_ALLOC()
+ * @param FUNCTION The function that implements the task
+ * @param TASK_NAME A descriptive name for the task
+ * @param PARAMETERS Passed on as argument to the function implementing the task
+ * @param PRIORITY The task priority
+ * @param CORE The core to run the task on, or tskNO_AFFINITY
+ */
+#define STATIC_MEM_TASK_CREATE_PINNED(NAME, FUNCTION, TASK_NAME, PARAMETERS, PRIORITY, CORE) ((TaskHandle_t)(osSys_ ## NAME ## State.handle = xTaskCreateStaticPinnedToCore((FUNCTION), (TASK_NAME), osSys_ ## NAME ## StackDepth, (PARAMETERS), (PRIORITY), osSys_ ## NAME ## StackBuffer, &osSys_ ## NAME ## TaskBuffer, (CORE))))
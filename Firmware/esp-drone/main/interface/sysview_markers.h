@@ -0,0 +1,62 @@
+/**
+ *
+ * ESP-Drone Firmware
+ *
+ * Copyright 2019-2020  Espressif Systems (Shanghai)
+ * Copyright (C) 2011-2012 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * sysview_markers.h - The flight pipeline on the SystemView timeline
+ *
+ * With the SystemView tracing of ESP-IDF (APPTRACE_SV_ENABLE) the task
+ * switches, interrupts and queue and semaphore operations are recorded by
+ * FreeRTOS itself. CONFIG_SYSVIEW_MARKERS adds the stages of the flight
+ * pipeline as user events, numbered by svMarker_t: a span has a start and a
+ * stop event, a point both at once. They are NOPs otherwise.
+ *
+ * Record over JTAG with the OpenOCD sysview command, or over the UART of
+ * APPTRACE_DEST_UART, and open the trace in SystemView.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+typedef enum {
+  svSensorsIsr = 0,         // Point, in the IMU data ready interrupt
+  svSensorsRead,            // Point, the sensors task read and queued a sample
+  svEstimator,              // Span, stages of the stabilizer loop
+  svCommander,
+  svSitAw,
+  svController,
+  svPowerDistribution,
+  svKalmanUpdate,           // Span, a round of the kalman task
+  svUdpRx,                  // Point, a datagram was received
+  svUdpTx,                  // Span, a datagram is sent to the sessions
+  SV_NBR_OF_MARKERS
+} svMarker_t;
+
+#ifdef CONFIG_SYSVIEW_MARKERS
+  #include "SEGGER_SYSVIEW.h"
+
+  #define SYSVIEW_MARKER_START(MARKER) SEGGER_SYSVIEW_OnUserStart(MARKER)
+  #define SYSVIEW_MARKER_STOP(MARKER)  SEGGER_SYSVIEW_OnUserStop(MARKER)
+  #define SYSVIEW_MARKER_POINT(MARKER) \
+    do { SEGGER_SYSVIEW_OnUserStart(MARKER); SEGGER_SYSVIEW_OnUserStop(MARKER); } while (0)
+#else
+  #define SYSVIEW_MARKER_START(MARKER)
+  #define SYSVIEW_MARKER_STOP(MARKER)
+  #define SYSVIEW_MARKER_POINT(MARKER)
+#endif
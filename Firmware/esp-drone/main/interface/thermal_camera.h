@@ -0,0 +1,73 @@
+/**
+ *
+ * ESP-Drone Firmware
+ *
+ * Copyright 2019-2020  Espressif Systems (Shanghai)
+ * Copyright (C) 2011-2012 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * thermal_camera.h - Frames and hotspots of an AMG8833 thermal camera
+ *
+ * A task reads the 8x8 pixels at the 10 fps of the sensor, as int16
+ * centi-degrees straight from the counts of the sensor, into one of two
+ * frames while the other holds the latest frame. The hot pixels are those at
+ * or above the thermal.hotThr param. Each frame they are grouped into 4
+ * connected blobs, and the hotspot is the blob with the hottest pixel. The
+ * features go to the thermal log group.
+ *
+ * With the thermal.stream param at N > 0 every Nth frame goes out on
+ * CRTP_PORT_THERMAL, channel THERMAL_CAMERA_CH_FRAME, in
+ * THERMAL_CAMERA_FRAGMENTS packets of thermalCameraPacket_t. A pixel is sent
+ * as its height above the coldest pixel of the frame in 0.25 degree steps,
+ * the resolution of the sensor, one byte for the two of a raw pixel. It is
+ * lossless for a frame spanning less than 63.75 degrees, the hotter pixels
+ * are sent at 255.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define THERMAL_CAMERA_WIDTH  8
+#define THERMAL_CAMERA_HEIGHT 8
+#define THERMAL_CAMERA_PIXELS (THERMAL_CAMERA_WIDTH * THERMAL_CAMERA_HEIGHT)
+
+#define THERMAL_CAMERA_CH_FRAME 0
+
+// Centi-degrees per step of a streamed pixel
+#define THERMAL_CAMERA_STEP_CENTI 25
+#define THERMAL_CAMERA_FRAGMENT_PIXELS 26
+#define THERMAL_CAMERA_FRAGMENTS \
+  ((THERMAL_CAMERA_PIXELS + THERMAL_CAMERA_FRAGMENT_PIXELS - 1) / THERMAL_CAMERA_FRAGMENT_PIXELS)
+
+typedef struct {
+  uint8_t frame;    // Counts the frames streamed
+  uint8_t index;    // Of the fragment, its pixels start at index * THERMAL_CAMERA_FRAGMENT_PIXELS
+  int16_t base;     // The coldest pixel of the frame, centi-degrees
+  uint8_t pixels[THERMAL_CAMERA_FRAGMENT_PIXELS]; // Row by row, fewer in the last fragment
+} __attribute__((packed)) thermalCameraPacket_t;
+
+void thermalCameraInit(void);
+
+bool thermalCameraTest(void);
+
+/**
+ * Copy the latest frame
+ *
+ * @param pixels THERMAL_CAMERA_PIXELS pixels in centi-degrees, row by row
+ * @return false if no frame was read yet
+ */
+bool thermalCameraGetFrame(int16_t *pixels);
@@ -0,0 +1,86 @@
+/**
+ *
+ * ESP-Drone Firmware
+ *
+ * Copyright 2019-2020  Espressif Systems (Shanghai)
+ * Copyright (C) 2011-2012 Bitcraze AB
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, in version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * time_sync.h - The clock of the host on the drone, for the log timestamps
+ *
+ * The host pings CRTP_PORT_TIME_SYNC, channel 0, with its time and the drone
+ * answers with its times of reception and answer, as NTP does:
+ *
+ *   ping, host to drone:    [TIME_SYNC_PING][seq][t1:8]
+ *   answer, drone to host:  [TIME_SYNC_PING][seq][t1:8][t2:8][t3:8]
+ *   sample, host to drone:  [TIME_SYNC_SAMPLE][t2:8][host:8][delay:4]
+ *
+ * t1 is the host time when the ping was sent, t2 and t3 the usecTimestamp()
+ * when it was received and answered. The host gets the answer at t4, the
+ * delay of the link is (t4 - t1) - (t3 - t2) and the host time at t2 is
+ * t1 + delay / 2, which the sample gives back to the drone. Everything is
+ * little endian in us, the host picks its time base, e.g. the Unix time.
+ *
+ * The drone follows the offset of the samples of the shortest delays and
+ * estimates the drift of its clock with the clock correction engine. The
+ * log variable timeSync.hostUs is the host time of the log block, or any
+ * other sample of the log, without another packet.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define TIME_SYNC_CHANNEL  0
+
+typedef enum {
+  TIME_SYNC_PING = 0,
+  TIME_SYNC_SAMPLE = 1,
+} timeSyncType_t;
+
+typedef struct {
+  uint8_t type;
+  uint8_t seq;
+  uint64_t t1;
+} __attribute__((packed)) timeSyncPing_t;
+
+typedef struct {
+  uint8_t type;
+  uint8_t seq;
+  uint64_t t1;
+  uint64_t t2;
+  uint64_t t3;
+} __attribute__((packed)) timeSyncAnswer_t;
+
+typedef struct {
+  uint8_t type;
+  uint64_t droneUs;  // t2 of the ping
+  uint64_t hostUs;   // The host time at t2
+  uint32_t delayUs;  // Of the link, both ways
+} __attribute__((packed)) timeSyncSample_t;
+
+#ifdef CONFIG_TIME_SYNC
+  void timeSyncInit(void);
+
+  /**
+   * The host time of a usecTimestamp(). Can be called from any task.
+   *
+   * @return The host time in us, 0 while the host did not synchronize
+   */
+  uint64_t timeSyncHostUs(uint64_t droneUs);
+#else
+  #define timeSyncInit()
+#endif
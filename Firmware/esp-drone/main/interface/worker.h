@@ -28,6 +28,18 @@
 
 #include <stdbool.h>
 
+/**
+ * Work of a higher priority is always executed first. With
+ * CONFIG_WORKER_HIGH_PRIORITY_TASK the high priority work is executed by a
+ * task of its own on the other core, so it does not wait for slow work.
+ */
+typedef enum {
+  WORKER_PRIORITY_HIGH = 0,
+  WORKER_PRIORITY_NORMAL,
+  WORKER_PRIORITY_LOW,
+  WORKER_PRIORITY_COUNT,
+} workerPriority_t;
+
 void workerInit();
 
 bool workerTest();
@@ -41,7 +53,7 @@ bool workerTest();
 void workerLoop();
 
 /**
- * Schedule a function for execution by the worker loop
+ * Schedule a function for execution by the worker loop, with normal priority
  * The function will be executed as soon as possible by the worker loop.
  * Scheduled functions are stacked in a FIFO queue.
  *
@@ -51,4 +63,16 @@ void workerLoop();
  */
 int workerSchedule(void (*function)(void*), void *arg);
 
+/**
+ * Schedule a function for execution by the worker loop in the FIFO queue of a
+ * priority. If the same function with the same argument is already waiting,
+ * in any queue, it is not queued again and 0 is returned.
+ *
+ * @param priority Priority of the work
+ * @param function Function to be executed
+ * @param arg      Argument that will be passed to the function when executed
+ * @return         0 in case of success, ENOMEM if the queue is full.
+ */
+int workerScheduleWithPriority(workerPriority_t priority, void (*function)(void*), void *arg);
+
 #endif //__WORKER_H
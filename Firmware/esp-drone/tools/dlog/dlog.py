@@ -0,0 +1,111 @@
+#!/usr/bin/env python3
+"""
+Extract the table of deferred debug prints from the firmware .elf.
+
+With CONFIG_DEBUG_DEFERRED the firmware only sends the ID of the format
+string and the raw arguments of every DEBUG_PRINT (see debug_deferred.h).
+The ID is the offset of the format string in the .dlog section, the table
+maps it back to the string. String arguments are sent as their address, so
+the table also holds the strings of the flash rodata they can point to.
+
+Usage: dlog.py ESPDrone.elf dlog_table.json
+"""
+
+import json
+import struct
+import sys
+
+TABLE_VERSION = 1
+
+SHT_PROGBITS = 1
+SHT_SYMTAB = 2
+
+
+class Elf32:
+    """Just enough of a little endian ELF32 reader to find the tables."""
+
+    def __init__(self, path):
+        with open(path, 'rb') as f:
+            self.data = f.read()
+        if self.data[:4] != b'\x7fELF' or self.data[4] != 1 or self.data[5] != 1:
+            raise ValueError(f'{path} is not a little endian ELF32 file')
+
+        shoff, = struct.unpack_from('<I', self.data, 0x20)
+        shentsize, shnum = struct.unpack_from('<HH', self.data, 0x2E)
+        self.sections = []
+        for i in range(shnum):
+            name, sh_type, _, addr, offset, size, link = \
+                struct.unpack_from('<IIIIIII', self.data, shoff + i * shentsize)
+            self.sections.append({'type': sh_type, 'addr': addr, 'offset': offset,
+                                  'size': size, 'link': link})
+
+    def symbols(self):
+        symbols = {}
+        for section in self.sections:
+            if section['type'] != SHT_SYMTAB:
+                continue
+            strtab = self.sections[section['link']]
+            for off in range(section['offset'], section['offset'] + section['size'], 16):
+                name, value = struct.unpack_from('<II', self.data, off)
+                start = strtab['offset'] + name
+                symbols[self.data[start:self.data.index(b'\0', start)].decode()] = value
+        return symbols
+
+    def section_at(self, addr):
+        for section in self.sections:
+            if section['type'] == SHT_PROGBITS and section['addr'] <= addr < section['addr'] + section['size']:
+                return section
+        raise ValueError(f'No section at 0x{addr:08x}')
+
+    def read(self, addr, size):
+        section = self.section_at(addr)
+        start = section['offset'] + addr - section['addr']
+        return self.data[start:start + size]
+
+
+def split_strings(data, base):
+    """Map of address to string, for the printable NUL terminated strings."""
+    strings = {}
+    start = 0
+    for end in range(len(data)):
+        if data[end] != 0:
+            continue
+        chunk = data[start:end]
+        if chunk and all(0x20 <= c < 0x7f or c in (0x09, 0x0a, 0x0d) for c in chunk):
+            strings[base + start] = chunk.decode('ascii')
+        start = end + 1
+    return strings
+
+
+def extract(elf_path):
+    elf = Elf32(elf_path)
+    symbols = elf.symbols()
+    start, end = symbols['_dlog_start'], symbols['_dlog_end']
+
+    formats = {addr - start: s for addr, s in
+               split_strings(elf.read(start, end - start), start).items()}
+
+    rodata = elf.section_at(start)
+    strings = split_strings(elf.read(rodata['addr'], rodata['size']), rodata['addr'])
+
+    return {
+        'version': TABLE_VERSION,
+        'formats': {str(k): v for k, v in sorted(formats.items())},
+        'strings': {str(k): v for k, v in sorted(strings.items())},
+    }
+
+
+def main():
+    if len(sys.argv) != 3:
+        print(__doc__.strip().splitlines()[-1], file=sys.stderr)
+        return 1
+
+    table = extract(sys.argv[1])
+    with open(sys.argv[2], 'w') as f:
+        json.dump(table, f)
+    print(f'{len(table["formats"])} deferred debug prints')
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,504 @@
+#!/usr/bin/env python3
+"""
+Capture, replay and analyze the CRTP traffic of the Wi-Fi link.
+
+A capture is b'LCAP', [version:1][source:1][reserved:2][origin_us:8] and the
+records [timestamp_us:4][event:1][header:1][size:1][sum:1], sum being the
+byte sum of the data of the packet. The host captures of
+Controller/drone_connection.py and of replay (source 0) count their
+timestamps from origin_us of time.monotonic_ns() and follow every record
+with the size bytes of data. The firmware capture of CONFIG_LINK_CAPTURE
+(source 1, see link_capture.h) has the usecTimestamp() of the drone and no
+data, download saves it in the same format.
+
+The clocks are aligned with the echo replies in the host capture, the drone
+time of the echo with the shortest round trip is the middle of the trip.
+Without echoes the lowest uplink delay is taken as 0. The packets of both
+captures are matched by header, size and sum, the ones not matched in time
+are lost. The queueing delay is the one-way delay above the lowest of the
+direction, the part the queues and the retries add to the radio.
+
+The command-to-actuation latency runs from a setpoint packet to the first
+motor output of a new setpoint after it, from the arrival at the drone and
+from the send of the host when both captures are there.
+
+Replay sends the packets of a host capture on their schedule to a drone,
+usually tools/sim with --link, captures both ends and reports. The mem port
+is left out, its writes could stop the capture or touch the flash.
+
+Usage:
+  linkcap.py start [--addr IP:PORT]
+  linkcap.py download [--addr IP:PORT] -o drone.lcap
+  linkcap.py replay [--addr IP:PORT] [-o host.lcap] [--drone drone.lcap] capture.lcap
+  linkcap.py report capture.lcap [capture.lcap]
+"""
+
+import argparse
+import socket
+import statistics
+import struct
+import sys
+import threading
+import time
+from collections import defaultdict, deque
+
+CAPTURE_MAGIC = b'LCAP'
+CAPTURE_VERSION = 1
+FILE_HEADER = struct.Struct('<4sBBHQ')
+RECORD = struct.Struct('<IBBBB')
+SOURCE_HOST = 0
+SOURCE_DRONE = 1
+
+EV_HOST_SENT = 0
+EV_DRONE_RX = 1
+EV_DRONE_DEQUEUED = 2
+EV_DRONE_TX = 3
+EV_ACTUATION = 4
+EV_HOST_RECEIVED = 5
+EV_ECHO = 6
+
+# link_capture.h
+LINK_CAPTURE_MAGIC = 0x5041434c
+LINK_CAPTURE_HEADER = struct.Struct('<IBBHII')
+LINK_CAPTURE_DATA_OFFSET = 16
+
+WIFI_CTRL_HEADER = 0xFF
+WIFI_CTRL_ECHO = 0x45
+ECHO_PERIOD = 1.0  # s
+
+CRTP_PORT_MEM = 0x04
+CRTP_LINK_BITS = 0x0C
+MEM_SETTINGS_CH = 0
+MEM_READ_CH = 1
+MEM_WRITE_CH = 2
+MEM_CMD_GET_NBR = 1
+MEM_CMD_GET_INFO = 2
+MEM_TYPE_LINK_CAPTURE = 0x25
+MEM_READ_MAX_LEN = 24
+
+PORT_NAMES = {
+    0x00: 'console', 0x02: 'param', 0x03: 'setpoint', 0x04: 'mem', 0x05: 'log',
+    0x06: 'localization', 0x07: 'setpointGeneric', 0x08: 'setpointHL',
+    0x0D: 'platform', 0x0E: 'debug', 0x0F: 'link',
+}
+COMMAND_PORTS = (0x03, 0x07)
+
+# Drone packets reach the host at most that late, and the clocks are aligned
+# to within the slack
+MATCH_WINDOW_US = 1000000
+MATCH_SLACK_US = 2000
+
+
+def checksum(data) -> int:
+    return sum(data) & 0xFF
+
+
+class Capture:
+    def __init__(self, source: int, origin_us: int = 0):
+        self.source = source
+        self.origin_us = origin_us
+        self.records = []   # (timestamp_us, event, header, size, sum, data)
+
+    @classmethod
+    def load(cls, path):
+        with open(path, 'rb') as f:
+            blob = f.read()
+        magic, version, source, _, origin_us = FILE_HEADER.unpack_from(blob)
+        if magic != CAPTURE_MAGIC or version != CAPTURE_VERSION:
+            raise ValueError(f'{path} is not a link capture of version {CAPTURE_VERSION}')
+
+        capture = cls(source, origin_us)
+        offset = FILE_HEADER.size
+        last = None
+        while offset + RECORD.size <= len(blob):
+            timestamp, event, header, size, total = RECORD.unpack_from(blob, offset)
+            offset += RECORD.size
+            data = b''
+            if source == SOURCE_HOST:
+                data = blob[offset:offset + size]
+                offset += size
+            # The 32 bit timestamps wrap, records of several tasks are not quite in order
+            if last is not None:
+                timestamp += (last - timestamp + (1 << 31)) >> 32 << 32
+            last = timestamp
+            capture.records.append((timestamp, event, header, size, total, data))
+        return capture
+
+    def save(self, path):
+        with open(path, 'wb') as f:
+            f.write(FILE_HEADER.pack(CAPTURE_MAGIC, CAPTURE_VERSION, self.source, 0, self.origin_us))
+            for timestamp, event, header, size, total, data in self.records:
+                f.write(RECORD.pack(timestamp & 0xFFFFFFFF, event, header, size, total) + data)
+
+    def add(self, event: int, raw: bytes, timestamp: int = None):
+        if timestamp is None:
+            timestamp = time.monotonic_ns() // 1000 - self.origin_us
+        data = bytes(raw[1:])
+        self.records.append((timestamp, event, raw[0], len(data), checksum(data), data))
+
+    def events(self, *events):
+        return [r for r in self.records if r[1] in events]
+
+
+def port_name(port: int) -> str:
+    return f'{PORT_NAMES.get(port, "port")} ({port})'
+
+
+class Link:
+    """A UDP socket to the drone, one CRTP packet per datagram."""
+
+    def __init__(self, addr):
+        self.addr = addr
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+
+    def send(self, raw: bytes):
+        self.sock.sendto(raw + bytes([checksum(raw)]), self.addr)
+
+    def receive(self, timeout: float):
+        """The raw CRTP packet of the next datagram, None on a timeout."""
+        self.sock.settimeout(timeout)
+        try:
+            datagram = self.sock.recv(1024)
+        except socket.timeout:
+            return None
+        if len(datagram) < 2 or checksum(datagram[:-1]) != datagram[-1]:
+            return b''
+        return datagram[:-1]
+
+    def mem_request(self, channel: int, data: bytes, match: bytes, retries: int = 5) -> bytes:
+        """Send a mem packet and return the data of the reply that starts with match."""
+        header = (CRTP_PORT_MEM << 4) | CRTP_LINK_BITS | channel
+        for _ in range(retries):
+            self.send(bytes([header]) + data)
+            deadline = time.monotonic() + 0.3
+            while time.monotonic() < deadline:
+                raw = self.receive(max(deadline - time.monotonic(), 0.001))
+                if raw and raw[0] >> 4 == CRTP_PORT_MEM and raw[0] & 0x03 == channel and \
+                   raw[1:1 + len(match)] == match:
+                    return raw[1:]
+        raise TimeoutError(f'No reply to mem request {data.hex()}')
+
+    def find_capture_memory(self) -> int:
+        nbr = self.mem_request(MEM_SETTINGS_CH, bytes([MEM_CMD_GET_NBR]), bytes([MEM_CMD_GET_NBR]))[1]
+        for mem_id in range(nbr):
+            info = self.mem_request(MEM_SETTINGS_CH, bytes([MEM_CMD_GET_INFO, mem_id]),
+                                    bytes([MEM_CMD_GET_INFO, mem_id]))
+            if info[2] == MEM_TYPE_LINK_CAPTURE:
+                return mem_id
+        raise RuntimeError('The firmware has no link capture, see CONFIG_LINK_CAPTURE')
+
+    def mem_write(self, mem_id: int, addr: int, data: bytes):
+        request = struct.pack('<BI', mem_id, addr)
+        reply = self.mem_request(MEM_WRITE_CH, request + data, request)
+        if reply[5] != 0:
+            raise RuntimeError(f'Write of memory {mem_id} failed')
+
+    def mem_read(self, mem_id: int, addr: int, length: int) -> bytes:
+        chunks = []
+        for start in range(addr, addr + length, MEM_READ_MAX_LEN):
+            size = min(MEM_READ_MAX_LEN, addr + length - start)
+            request = struct.pack('<BI', mem_id, start)
+            reply = self.mem_request(MEM_READ_CH, request + bytes([size]), request)
+            if reply[5] != 0:
+                raise RuntimeError(f'Read of memory {mem_id} at {start} failed')
+            chunks.append(reply[6:6 + size])
+        return b''.join(chunks)
+
+
+def start_capture(link: Link):
+    link.mem_write(link.find_capture_memory(), 0, b'\x01')
+
+
+def download_capture(link: Link) -> Capture:
+    mem_id = link.find_capture_memory()
+    link.mem_write(mem_id, 0, b'\x00')
+    header = link.mem_read(mem_id, 0, LINK_CAPTURE_HEADER.size)
+    magic, version, _, record_size, count, dropped = LINK_CAPTURE_HEADER.unpack(header)
+    if magic != LINK_CAPTURE_MAGIC or version != CAPTURE_VERSION or record_size != RECORD.size:
+        raise RuntimeError('Unknown link capture of the firmware')
+    if dropped:
+        print(f'The drone capture was full, {dropped} records did not fit', file=sys.stderr)
+
+    blob = link.mem_read(mem_id, LINK_CAPTURE_DATA_OFFSET, count * RECORD.size)
+    capture = Capture(SOURCE_DRONE)
+    last = None
+    for i in range(count):
+        timestamp, event, header, size, total = RECORD.unpack_from(blob, i * RECORD.size)
+        if last is not None:
+            timestamp += (last - timestamp + (1 << 31)) >> 32 << 32
+        last = timestamp
+        capture.records.append((timestamp, event, header, size, total, b''))
+    return capture
+
+
+def replay(link: Link, source: Capture) -> (Capture, Capture):
+    """Send the packets of a host capture on their schedule, capture both ends."""
+    sent = [r for r in source.events(EV_HOST_SENT) if r[2] >> 4 != CRTP_PORT_MEM]
+    if not sent:
+        raise ValueError('The capture has no packets sent by the host')
+
+    start_capture(link)
+    host = Capture(SOURCE_HOST, time.monotonic_ns() // 1000)
+    running = True
+
+    def receive():
+        while running:
+            raw = link.receive(0.1)
+            if not raw:
+                continue
+            if raw[0] == WIFI_CTRL_HEADER and len(raw) > 1 and raw[1] == WIFI_CTRL_ECHO:
+                host.add(EV_ECHO, raw)
+            elif raw[0] != WIFI_CTRL_HEADER:
+                host.add(EV_HOST_RECEIVED, raw)
+
+    receiver = threading.Thread(target=receive, daemon=True)
+    receiver.start()
+
+    first = sent[0][0]
+    start = time.monotonic()
+    next_echo = start
+    for timestamp, _, header, _, _, data in sent:
+        due = start + (timestamp - first) / 1e6
+        while True:
+            now = time.monotonic()
+            if now >= next_echo:
+                echo = bytes([WIFI_CTRL_HEADER, WIFI_CTRL_ECHO]) + struct.pack('<Q', time.monotonic_ns() // 1000)
+                link.send(echo)
+                next_echo += ECHO_PERIOD
+            if now >= due:
+                break
+            time.sleep(min(due, next_echo) - now)
+        raw = bytes([header]) + data
+        link.send(raw)
+        host.add(EV_HOST_SENT, raw)
+
+    # The answers to the last packets
+    time.sleep(MATCH_WINDOW_US / 1e6)
+    running = False
+    receiver.join()
+
+    return host, download_capture(link)
+
+
+def percentile(values, fraction):
+    ordered = sorted(values)
+    return ordered[min(int(fraction * len(ordered)), len(ordered) - 1)]
+
+
+def summary(values_us):
+    """n, median, p95 and max, in ms."""
+    if not values_us:
+        return '     0'
+    ms = [v / 1000 for v in values_us]
+    return f'{len(ms):6d} {statistics.median(ms):8.2f} {percentile(ms, 0.95):8.2f} {max(ms):8.2f}'
+
+
+def clock_offset(host: Capture, drone: Capture):
+    """Drone time minus host time, and how it was found."""
+    best = None
+    first = drone.records[0][0]
+    for timestamp, _, _, size, _, data in host.events(EV_ECHO):
+        if size != 1 + 8 + 4:
+            continue
+        sent_us, drone_us = struct.unpack_from('<QI', data, 1)
+        # The drone time of the echo is 32 bits too, unwrapped as the records
+        drone_us += (first - drone_us + (1 << 31)) >> 32 << 32
+        sent = sent_us - host.origin_us
+        rtt = timestamp - sent
+        if best is None or rtt < best[0]:
+            best = (rtt, drone_us - (sent + timestamp) // 2)
+
+    if best is not None:
+        rtt, offset = best
+        return offset, f'echo with a round trip of {rtt / 1000:.2f} ms'
+
+    pairs = match(host.events(EV_HOST_SENT), drone.events(EV_DRONE_RX), in_time=False)
+    if not pairs:
+        raise ValueError('The captures have no packets in common')
+    return min(d[0] - h[0] for h, d in pairs), 'lowest uplink delay, the uplink delays start at 0'
+
+
+def match(sources, targets, in_time=True):
+    """
+    Pairs of a source record and the first target record of the same packet
+    after it, on one clock, or in order if the clocks are not aligned.
+    """
+    pending = defaultdict(deque)
+    for target in targets:
+        pending[target[2:5]].append(target)
+
+    pairs = []
+    for source in sources:
+        queue = pending[source[2:5]]
+        if in_time:
+            while queue and queue[0][0] < source[0] - MATCH_SLACK_US:
+                queue.popleft()
+            if queue and queue[0][0] <= source[0] + MATCH_WINDOW_US:
+                pairs.append((source, queue.popleft()))
+        elif queue:
+            pairs.append((source, queue.popleft()))
+    return pairs
+
+
+def report_throughput(name, capture, up, down):
+    if not capture.records:
+        return
+    duration = max((capture.records[-1][0] - capture.records[0][0]) / 1e6, 1e-6)
+    counts = defaultdict(lambda: [0, 0, 0, 0])
+    for _, event, header, size, _, _ in capture.records:
+        if event in (up, down):
+            column = 0 if event == up else 2
+            counts[header >> 4][column] += 1
+            counts[header >> 4][column + 1] += size + 1
+
+    print(f'\nThroughput seen by the {name}, {duration:.1f} s')
+    print(f'  {"port":22} {"up pk/s":>9} {"up B/s":>9} {"down pk/s":>9} {"down B/s":>9}')
+    for port in sorted(counts):
+        c = counts[port]
+        print(f'  {port_name(port):22} {c[0] / duration:9.1f} {c[1] / duration:9.0f} '
+              f'{c[2] / duration:9.1f} {c[3] / duration:9.0f}')
+
+
+def report_delays(host: Capture, drone: Capture, offset):
+    drone_records = [(r[0] - offset,) + r[1:] for r in drone.records]
+
+    def observed(records, other):
+        # Only the packets the other end could have captured count for the losses
+        start, end = other[0][0], other[-1][0] - MATCH_WINDOW_US
+        return [r for r in records if start <= r[0] <= end]
+
+    def events(records, event):
+        return [r for r in records if r[1] == event]
+
+    directions = (
+        ('up', observed(host.events(EV_HOST_SENT), drone_records), events(drone_records, EV_DRONE_RX)),
+        ('down', observed(events(drone_records, EV_DRONE_TX), host.records), host.events(EV_HOST_RECEIVED)),
+    )
+
+    print('\nOne-way delay, ms               n   median      p95      max  queueing median/p95  lost')
+    for name, sources, targets in directions:
+        delays = defaultdict(list)
+        for source, target in match(sources, targets):
+            delays[source[2] >> 4].append(target[0] - source[0])
+        if not delays:
+            continue
+        sent = defaultdict(int)
+        for source in sources:
+            sent[source[2] >> 4] += 1
+
+        lowest = min(min(v) for v in delays.values())
+        for port in sorted(sent):
+            values = delays.get(port, [])
+            lost = sent[port] - len(values)
+            queueing = ' ' * 17
+            if values:
+                excess = [v - lowest for v in values]
+                queueing = f'{statistics.median(excess) / 1000:8.2f} {percentile(excess, 0.95) / 1000:8.2f}'
+            print(f'  {name:4} {port_name(port):20} {summary(values)}  {queueing}  '
+                  f'{lost} ({100 * lost / sent[port]:.1f}%)')
+
+
+def report_drone_queue(drone: Capture):
+    delays = defaultdict(list)
+    for rx, dequeued in match(drone.events(EV_DRONE_RX), drone.events(EV_DRONE_DEQUEUED)):
+        delays[rx[2] >> 4].append(dequeued[0] - rx[0])
+    if not delays:
+        return
+    print('\nDrone RX queue, arrival to CRTP RX task, ms    n   median      p95      max')
+    for port in sorted(delays):
+        print(f'  {port_name(port):39} {summary(delays[port])}')
+
+
+def actuation_latencies(commands, actuations):
+    """Time from every command to the first actuation after it."""
+    times = [a[0] for a in actuations]
+    latencies = []
+    i = 0
+    for command in commands:
+        while i < len(times) and times[i] < command[0]:
+            i += 1
+        if i < len(times) and times[i] - command[0] <= MATCH_WINDOW_US:
+            latencies.append(times[i] - command[0])
+    return latencies
+
+
+def report_actuation(host: Capture, drone: Capture, offset):
+    actuations = drone.events(EV_ACTUATION)
+    if not actuations:
+        return
+    print('\nCommand to actuation, ms                         n   median      p95      max')
+    arrivals = [r for r in drone.events(EV_DRONE_RX) if r[2] >> 4 in COMMAND_PORTS]
+    print(f'  {"from the arrival at the drone":40} {summary(actuation_latencies(arrivals, actuations))}')
+    if host is not None and offset is not None:
+        sent = [(r[0] + offset,) + r[1:] for r in host.events(EV_HOST_SENT) if r[2] >> 4 in COMMAND_PORTS]
+        print(f'  {"from the send of the host":40} {summary(actuation_latencies(sent, actuations))}')
+
+
+def report(captures):
+    host = next((c for c in captures if c.source == SOURCE_HOST), None)
+    drone = next((c for c in captures if c.source == SOURCE_DRONE), None)
+    offset = None
+
+    if host is not None:
+        report_throughput('host', host, EV_HOST_SENT, EV_HOST_RECEIVED)
+    if drone is not None:
+        report_throughput('drone', drone, EV_DRONE_RX, EV_DRONE_TX)
+        report_drone_queue(drone)
+    if host is not None and drone is not None and host.records and drone.records:
+        offset, how = clock_offset(host, drone)
+        print(f'\nClocks aligned by the {how}')
+        report_delays(host, drone, offset)
+    if drone is not None:
+        report_actuation(host, drone, offset)
+
+
+def parse_addr(text):
+    ip, _, port = text.partition(':')
+    return ip, int(port or 2390)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    commands = parser.add_subparsers(dest='command', required=True)
+
+    start = commands.add_parser('start', help='start the capture of the drone')
+    download = commands.add_parser('download', help='stop the capture of the drone and read it back')
+    download.add_argument('-o', '--output', required=True)
+    replayer = commands.add_parser('replay', help='replay a host capture and report')
+    replayer.add_argument('capture')
+    replayer.add_argument('-o', '--output', help='host capture of the replay')
+    replayer.add_argument('--drone', help='drone capture of the replay')
+    for command in (start, download, replayer):
+        command.add_argument('--addr', default='127.0.0.1:2390', type=parse_addr,
+                             help='the drone, or tools/sim with --link (default)')
+    reporter = commands.add_parser('report', help='report on one or two captures')
+    reporter.add_argument('captures', nargs='+')
+    args = parser.parse_args()
+
+    if args.command == 'report':
+        report([Capture.load(path) for path in args.captures])
+        return 0
+
+    link = Link(args.addr)
+    try:
+        if args.command == 'start':
+            start_capture(link)
+        elif args.command == 'download':
+            capture = download_capture(link)
+            capture.save(args.output)
+            print(f'{len(capture.records)} records')
+        else:
+            host, drone = replay(link, Capture.load(args.capture))
+            if args.output:
+                host.save(args.output)
+            if args.drone:
+                drone.save(args.drone)
+            report([host, drone])
+    except (TimeoutError, RuntimeError) as e:
+        print(e, file=sys.stderr)
+        return 1
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
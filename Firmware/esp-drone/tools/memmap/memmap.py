@@ -0,0 +1,149 @@
+#!/usr/bin/env python3
+"""
+Static memory of the firmware per object file, from the map file of the link.
+
+The linker writes ESPDrone.map next to ESPDrone.elf. Every input section of
+the map is accounted to the object file it comes from and to the region of
+its output section: DRAM data and bss, IRAM, and flash code and rodata. The
+sections are compiled one per function and per variable, so --sections
+lists the largest variables in RAM, e.g. the task stacks of static_mem.h as
+.bss.osSys_<name>StackBuffer.
+
+The host map of tools/sim, with .data, .bss, .text and .rodata, works too.
+
+Usage: memmap.py [--archives] [--sections] [--sort COLUMN] [--top N] [--filter TEXT] ESPDrone.map
+"""
+
+import argparse
+import re
+import sys
+from collections import defaultdict
+
+COLUMNS = ('data', 'bss', 'iram', 'code', 'rodata')
+
+# Output section of the ESP-IDF and the GNU ld scripts to column
+REGIONS = [
+    (re.compile(r'^\.dram0\.data$|^\.data$|^\.rtc\.data$'), 'data'),
+    (re.compile(r'^\.dram0\.bss$|^\.bss$|^\.noinit$|^\.rtc\.bss$|^\.ext_ram\.bss$'), 'bss'),
+    (re.compile(r'^\.iram0\.'), 'iram'),
+    (re.compile(r'^\.flash\.text$|^\.text$|^\.rtc\.text$'), 'code'),
+    (re.compile(r'^\.flash\.(rodata|appdesc)$|^\.rodata$|^\.param$|^\.log$'), 'rodata'),
+]
+
+OUTPUT_SECTION = re.compile(r'^(\.[\w.]+)(?:\s+0x[0-9a-f]+\s+0x[0-9a-f]+)?\s*$')
+INPUT_SECTION = re.compile(r'^ (\.[\w.$]+|COMMON)(?:\s+(0x[0-9a-f]+)\s+(0x[0-9a-f]+)\s+(\S.*))?$')
+WRAPPED = re.compile(r'^\s+(0x[0-9a-f]+)\s+(0x[0-9a-f]+)\s+(\S.*)$')
+OBJECT = re.compile(r'(?:.*/)?([^/(]+)\(([^)]+)\)$|(?:.*/)?([^/]+)$')
+
+
+def region_of(output):
+    for pattern, column in REGIONS:
+        if pattern.match(output):
+            return column
+    return None
+
+
+def module_of(path, archives):
+    match = OBJECT.match(path.strip())
+    if match is None:
+        return path
+    if match.group(1):
+        return match.group(1) if archives else match.group(2)
+    return match.group(3)
+
+
+def parse(path, archives):
+    """Per module bytes per column, and the (size, column, section, module) of the input sections"""
+    modules = defaultdict(lambda: dict.fromkeys(COLUMNS, 0))
+    sections = []
+    column = None
+    pending = None
+
+    with open(path) as f:
+        lines = iter(f)
+        for line in lines:
+            if line.startswith('Linker script and memory map'):
+                break
+        for line in lines:
+            line = line.rstrip('\n')
+            if pending is not None:
+                match = WRAPPED.match(line)
+                name, pending = pending, None
+                if match:
+                    address, size, source = match.groups()
+                    add(modules, sections, column, name, int(address, 16), int(size, 16), source, archives)
+                    continue
+
+            match = OUTPUT_SECTION.match(line)
+            if match:
+                column = region_of(match.group(1))
+                continue
+
+            match = INPUT_SECTION.match(line)
+            if match is None or column is None:
+                continue
+            name, address, size, source = match.groups()
+            if address is None:
+                # Long names go on a line of their own
+                pending = name
+                continue
+            add(modules, sections, column, name, int(address, 16), int(size, 16), source, archives)
+
+    return modules, sections
+
+
+def add(modules, sections, column, name, address, size, source, archives):
+    if size == 0 or address == 0:
+        return
+    module = module_of(source, archives)
+    modules[module][column] += size
+    sections.append((size, column, name, module))
+
+
+def ram(usage):
+    return usage['data'] + usage['bss'] + usage['iram']
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument('map', help='map file of the link, e.g. build/ESPDrone.map')
+    parser.add_argument('--archives', action='store_true', help='per archive (component) instead of per object file')
+    parser.add_argument('--sections', action='store_true', help='list the largest input sections in RAM')
+    parser.add_argument('--sort', choices=('ram',) + COLUMNS, default='ram', help='column to sort by, ram by default')
+    parser.add_argument('--top', type=int, default=40, help='number of rows, 0 for all')
+    parser.add_argument('--filter', default='', help='only the modules that contain TEXT')
+    args = parser.parse_args()
+
+    modules, sections = parse(args.map, args.archives)
+    if not modules:
+        print(f'{args.map}: no memory map found', file=sys.stderr)
+        return 1
+
+    def key(row):
+        usage = row[1]
+        first = ram(usage) if args.sort == 'ram' else usage[args.sort]
+        return (first, ram(usage), usage['code'] + usage['rodata'])
+
+    rows = sorted(((name, usage) for name, usage in modules.items() if args.filter in name), key=key, reverse=True)
+    if args.sort != 'ram':
+        rows = [row for row in rows if row[1][args.sort] > 0]
+    total = {column: sum(usage[column] for _, usage in rows) for column in COLUMNS}
+
+    print(f'{"module":40} {"ram":>8} ' + ' '.join(f'{column:>8}' for column in COLUMNS))
+    for name, usage in rows[:args.top or None]:
+        print(f'{name[:40]:40} {ram(usage):8} ' + ' '.join(f'{usage[column]:8}' for column in COLUMNS))
+    print(f'{"total":40} {ram(total):8} ' + ' '.join(f'{total[column]:8}' for column in COLUMNS))
+
+    if args.sections:
+        print()
+        print(f'{"section":56} {"column":>6} {"bytes":>8}  module')
+        ramSections = sorted((s for s in sections if s[1] in ('data', 'bss', 'iram') and args.filter in s[3]),
+                             reverse=True)
+        for size, column, name, module in ramSections[:args.top or None]:
+            print(f'{name[:56]:56} {column:>6} {size:8}  {module}')
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,149 @@
+#!/usr/bin/env python3
+"""
+Make the firmware update stream of firmware_update.h from the .bin files.
+
+With --base the stream is a delta against the firmware that runs on the
+drone, the stream copies the parts of the new image that are found in the
+base image and carries the rest as data. Without it the stream carries the
+whole image. The delta is applied again to the base before it is written,
+and the result compared with the new image.
+
+The stream is written as is to the firmware memory (MEM_TYPE_FIRMWARE, 0x24)
+from address 0, e.g. with the windowed memory transfers.
+
+Usage: fwupdate.py [--base running.bin] ESPDrone.bin update.fwu
+"""
+
+import argparse
+import struct
+import sys
+
+FW_UPDATE_MAGIC = 0x55574645
+FW_UPDATE_VERSION = 1
+FW_UPDATE_KIND_IMAGE = 0
+FW_UPDATE_KIND_DELTA = 1
+FW_UPDATE_OP_COPY = 1
+FW_UPDATE_OP_DATA = 2
+
+HEADER = struct.Struct('<IBBHI')
+COPY = struct.Struct('<BII')
+DATA = struct.Struct('<BH')
+MAX_DATA = 0xFFFF
+
+# Blocks of the base are looked up at every BLOCK_STEP bytes, the code of the
+# two images moves by whole instructions, the data by words
+BLOCK = 32
+BLOCK_STEP = 4
+# A shorter copy costs more than its data
+MIN_COPY = COPY.size + DATA.size + 8
+
+
+def index_blocks(base):
+    blocks = {}
+    for offset in range(0, len(base) - BLOCK + 1, BLOCK_STEP):
+        blocks.setdefault(base[offset:offset + BLOCK], offset)
+    return blocks
+
+
+def delta_ops(base, image):
+    """Yield ('copy', offset, length) and ('data', bytes) covering the image."""
+    blocks = index_blocks(base)
+    literal_start = 0
+    i = 0
+    while i + BLOCK <= len(image):
+        offset = blocks.get(image[i:i + BLOCK])
+        if offset is None:
+            i += 1
+            continue
+
+        length = BLOCK
+        while i + length < len(image) and offset + length < len(base) \
+                and image[i + length] == base[offset + length]:
+            length += 1
+        # Grow back into the data not sent yet
+        while i > literal_start and offset > 0 and image[i - 1] == base[offset - 1]:
+            i -= 1
+            offset -= 1
+            length += 1
+
+        if length < MIN_COPY:
+            i += 1
+            continue
+
+        if i > literal_start:
+            yield ('data', image[literal_start:i])
+        yield ('copy', offset, length)
+        i += length
+        literal_start = i
+
+    if literal_start < len(image):
+        yield ('data', image[literal_start:])
+
+
+def encode_delta(base, image):
+    out = bytearray()
+    copied = 0
+    for op in delta_ops(base, image):
+        if op[0] == 'copy':
+            out += COPY.pack(FW_UPDATE_OP_COPY, op[1], op[2])
+            copied += op[2]
+        else:
+            data = op[1]
+            for start in range(0, len(data), MAX_DATA):
+                chunk = data[start:start + MAX_DATA]
+                out += DATA.pack(FW_UPDATE_OP_DATA, len(chunk)) + chunk
+    return bytes(out), copied
+
+
+def apply_delta(base, delta):
+    """The image the firmware makes of the delta, as firmware_update.c does."""
+    image = bytearray()
+    i = 0
+    while i < len(delta):
+        op = delta[i]
+        if op == FW_UPDATE_OP_COPY:
+            _, offset, length = COPY.unpack_from(delta, i)
+            if offset + length > len(base):
+                raise ValueError(f'Copy past the end of the base at {i}')
+            image += base[offset:offset + length]
+            i += COPY.size
+        elif op == FW_UPDATE_OP_DATA:
+            _, length = DATA.unpack_from(delta, i)
+            i += DATA.size
+            image += delta[i:i + length]
+            i += length
+        else:
+            raise ValueError(f'Unknown operation {op} at {i}')
+    return bytes(image)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Make a firmware update stream')
+    parser.add_argument('--base', help='the .bin that runs on the drone, for a delta')
+    parser.add_argument('image', help='the new .bin')
+    parser.add_argument('output', help='the update stream')
+    args = parser.parse_args()
+
+    with open(args.image, 'rb') as f:
+        image = f.read()
+
+    if args.base:
+        with open(args.base, 'rb') as f:
+            base = f.read()
+        body, copied = encode_delta(base, image)
+        if apply_delta(base, body) != image:
+            sys.exit('The delta does not make the image, not written')
+        kind = FW_UPDATE_KIND_DELTA
+        print(f'{len(image)} bytes, {copied} copied from the base, {len(body)} bytes of delta')
+    else:
+        body = image
+        kind = FW_UPDATE_KIND_IMAGE
+        print(f'{len(image)} bytes')
+
+    with open(args.output, 'wb') as f:
+        f.write(HEADER.pack(FW_UPDATE_MAGIC, FW_UPDATE_VERSION, kind, 0, len(image)))
+        f.write(body)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,81 @@
+/*
+ * FreeRTOS.h - Virtual time FreeRTOS for the host simulator
+ *
+ * Only the API used by the flight stack is provided. The tasks are
+ * coroutines scheduled by sim_os.c: a task runs until it blocks, and the
+ * tick only advances when no task is ready, so the firmware sees a
+ * consistent 1 kHz tick whatever the host speed is.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Like FreeRTOSConfig.h of ESP-IDF
+#include "sdkconfig.h"
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t StackType_t;
+
+typedef struct simTask *TaskHandle_t;
+typedef struct simQueue *QueueHandle_t;
+typedef QueueHandle_t SemaphoreHandle_t;
+
+typedef TaskHandle_t xTaskHandle;
+typedef QueueHandle_t xQueueHandle;
+typedef SemaphoreHandle_t xSemaphoreHandle;
+typedef BaseType_t portBASE_TYPE;
+typedef TickType_t portTickType;
+
+// Storage is allocated by the simulator, the static buffers are unused
+typedef struct { int unused; } StaticTask_t;
+typedef struct { int unused; } StaticQueue_t;
+typedef StaticQueue_t StaticSemaphore_t;
+
+typedef int portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED 0
+
+#define configTICK_RATE_HZ         1000
+#define portTICK_PERIOD_MS         (1000 / configTICK_RATE_HZ)
+#define portTICK_RATE_MS           portTICK_PERIOD_MS
+#define configMINIMAL_STACK_SIZE   768
+#define configMAX_PRIORITIES       25
+#define tskIDLE_PRIORITY           0
+#define tskNO_AFFINITY             0x7FFFFFFF
+#define portNUM_PROCESSORS         1
+
+#define portMAX_DELAY   ((TickType_t)0xffffffffUL)
+// Spelled like stm32_legacy.h, which defines them again
+#define pdFALSE			( ( BaseType_t ) 0 )
+#define pdTRUE			( ( BaseType_t ) 1 )
+#define pdPASS			( pdTRUE )
+#define pdFAIL			( pdFALSE )
+#define errQUEUE_EMPTY	( ( BaseType_t ) 0 )
+#define errQUEUE_FULL	( ( BaseType_t ) 0 )
+
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms) * configTICK_RATE_HZ / 1000)
+
+// Only one task runs at a time and only blocking calls switch tasks
+#define portENTER_CRITICAL(mux)           ((void)(mux))
+#define portEXIT_CRITICAL(mux)            ((void)(mux))
+#define portENTER_CRITICAL_ISR(mux)       ((void)(mux))
+#define portEXIT_CRITICAL_ISR(mux)        ((void)(mux))
+#define taskENTER_CRITICAL(mux)           ((void)(mux))
+#define taskEXIT_CRITICAL(mux)            ((void)(mux))
+#define taskENTER_CRITICAL_ISR(mux)       ((void)(mux))
+#define taskEXIT_CRITICAL_ISR(mux)        ((void)(mux))
+#define taskDISABLE_INTERRUPTS()
+#define taskENABLE_INTERRUPTS()
+
+#define portYIELD()                       vTaskYieldSim()
+#define taskYIELD()                       vTaskYieldSim()
+#define portYIELD_FROM_ISR(...)           ((void)0)
+#define portEND_SWITCHING_ISR(x)          ((void)(x))
+
+#define IRAM_ATTR
+
+void vTaskYieldSim(void);
@@ -0,0 +1,5 @@
+/*
+ * driver/adc.h - ESP-IDF stand-in for the host simulator
+ */
+
+#pragma once
@@ -0,0 +1,10 @@
+/*
+ * driver/ledc.h - ESP-IDF stand-in for the host simulator
+ */
+
+#pragma once
+
+typedef enum {
+  LEDC_TIMER_8_BIT = 8,
+  LEDC_TIMER_16_BIT = 16,
+} ledc_timer_bit_t;
@@ -0,0 +1,22 @@
+/*
+ * esp_chip_info.h - ESP-IDF stand-in for the host simulator, no chip
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+typedef enum { CHIP_HOST = 0 } esp_chip_model_t;
+
+typedef struct {
+  esp_chip_model_t model;
+  uint32_t features;
+  uint16_t revision;
+  uint8_t cores;
+} esp_chip_info_t;
+
+static inline void esp_chip_info(esp_chip_info_t *info)
+{
+  memset(info, 0, sizeof(*info));
+}
@@ -0,0 +1,18 @@
+/*
+ * esp_cpu.h - ESP-IDF stand-in for the host simulator
+ *
+ * The cycle count is the time stamp counter of the host, like the host build
+ * of kernel_bench.c. It is the host cost of the code, not its cost on the
+ * target.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+static inline uint32_t esp_cpu_get_cycle_count(void) { return (uint32_t)__rdtsc(); }
+#else
+static inline uint32_t esp_cpu_get_cycle_count(void) { return 0; }
+#endif
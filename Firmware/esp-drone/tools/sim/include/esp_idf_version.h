@@ -0,0 +1,8 @@
+/*
+ * esp_idf_version.h - ESP-IDF stand-in for the host simulator
+ */
+
+#pragma once
+
+#define ESP_IDF_VERSION_VAL(major, minor, patch) (((major) << 16) | ((minor) << 8) | (patch))
+#define ESP_IDF_VERSION ESP_IDF_VERSION_VAL(5, 2, 0)
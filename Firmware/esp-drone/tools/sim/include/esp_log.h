@@ -0,0 +1,24 @@
+/*
+ * esp_log.h - ESP-IDF stand-in for the host simulator
+ */
+
+#pragma once
+
+typedef enum {
+  ESP_LOG_NONE,
+  ESP_LOG_ERROR,
+  ESP_LOG_WARN,
+  ESP_LOG_INFO,
+  ESP_LOG_DEBUG,
+  ESP_LOG_VERBOSE,
+} esp_log_level_t;
+
+void simLog(esp_log_level_t level, const char *tag, const char *format, ...) __attribute__((format(printf, 3, 4)));
+
+#define ESP_LOG_LEVEL_LOCAL(level, tag, format, ...) simLog((level), (tag), format, ##__VA_ARGS__)
+#define ESP_LOG_LEVEL(level, tag, format, ...) simLog((level), (tag), format, ##__VA_ARGS__)
+#define ESP_LOGE(tag, format, ...) simLog(ESP_LOG_ERROR, (tag), format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) simLog(ESP_LOG_WARN, (tag), format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) simLog(ESP_LOG_INFO, (tag), format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) simLog(ESP_LOG_DEBUG, (tag), format, ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...) simLog(ESP_LOG_VERBOSE, (tag), format, ##__VA_ARGS__)
@@ -0,0 +1,40 @@
+/*
+ * esp_pm.h - ESP-IDF stand-in for the host simulator
+ *
+ * The power management of power_save.c has nothing to scale on the host, its
+ * lock is taken and released without an effect.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+#include "esp_err.h"
+
+typedef enum {
+  ESP_PM_CPU_FREQ_MAX,
+  ESP_PM_APB_FREQ_MAX,
+  ESP_PM_NO_LIGHT_SLEEP,
+} esp_pm_lock_type_t;
+
+typedef struct {
+  int max_freq_mhz;
+  int min_freq_mhz;
+  bool light_sleep_enable;
+} esp_pm_config_t;
+
+typedef int *esp_pm_lock_handle_t;
+
+static inline esp_err_t esp_pm_configure(const void *config) { return ESP_OK; }
+
+static inline esp_err_t esp_pm_lock_create(esp_pm_lock_type_t type, int arg, const char *name,
+                                           esp_pm_lock_handle_t *handle)
+{
+  static int lock;
+
+  *handle = &lock;
+  return ESP_OK;
+}
+
+static inline esp_err_t esp_pm_lock_acquire(esp_pm_lock_handle_t handle) { return ESP_OK; }
+static inline esp_err_t esp_pm_lock_release(esp_pm_lock_handle_t handle) { return ESP_OK; }
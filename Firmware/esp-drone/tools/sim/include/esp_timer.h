@@ -1,3 +1,9 @@
+/*
+ * esp_timer.h - ESP-IDF stand-in for the host simulator, on the virtual clock
+ */
+
 #pragma once
+
 #include <stdint.h>
-uint64_t esp_timer_get_time(void);
+
+int64_t esp_timer_get_time(void);
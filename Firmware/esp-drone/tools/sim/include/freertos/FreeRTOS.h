@@ -1,4 +1,2 @@
 #pragma once
-#include <stdint.h>
-#define portTICK_PERIOD_MS 1
-typedef uint32_t TickType_t;
+#include "../FreeRTOS.h"
@@ -0,0 +1,29 @@
+/*
+ * queue.h - Virtual time FreeRTOS for the host simulator
+ */
+
+#pragma once
+
+#include "FreeRTOS.h"
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize);
+#define xQueueCreateStatic(length, itemSize, storage, buffer) ((void)(storage), (void)(buffer), xQueueCreate((length), (itemSize)))
+
+BaseType_t xQueueGenericSend(QueueHandle_t queue, const void *item, TickType_t ticksToWait, bool overwrite);
+BaseType_t xQueueGenericReceive(QueueHandle_t queue, void *item, TickType_t ticksToWait, bool peek);
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue);
+BaseType_t xQueueReset(QueueHandle_t queue);
+
+#define xQueueSend(q, item, wait)              xQueueGenericSend((q), (item), (wait), false)
+#define xQueueSendToBack(q, item, wait)        xQueueGenericSend((q), (item), (wait), false)
+#define xQueueSendFromISR(q, item, woken)      ((void)(woken), xQueueGenericSend((q), (item), 0, false))
+#define xQueueSendToBackFromISR(q, item, woken) ((void)(woken), xQueueGenericSend((q), (item), 0, false))
+#define xQueueOverwrite(q, item)               xQueueGenericSend((q), (item), 0, true)
+#define xQueueOverwriteFromISR(q, item, woken) ((void)(woken), xQueueGenericSend((q), (item), 0, true))
+#define xQueueReceive(q, item, wait)           xQueueGenericReceive((q), (item), (wait), false)
+#define xQueueReceiveFromISR(q, item, woken)   ((void)(woken), xQueueGenericReceive((q), (item), 0, false))
+#define xQueuePeek(q, item, wait)              xQueueGenericReceive((q), (item), (wait), true)
+#define uxQueueMessagesWaitingFromISR(q)       uxQueueMessagesWaiting(q)
+#define uxQueueSpacesAvailable(q)              uxQueueSpacesAvailableSim(q)
+UBaseType_t uxQueueSpacesAvailableSim(QueueHandle_t queue);
+void vQueueAddToRegistry(QueueHandle_t queue, const char *name);
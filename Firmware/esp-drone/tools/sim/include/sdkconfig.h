@@ -0,0 +1,40 @@
+/*
+ * sdkconfig.h - Configuration of the firmware sources in the host simulator
+ */
+
+#pragma once
+
+#define CONFIG_IDF_TARGET_ESP32S3 1
+#define CONFIG_TARGET_ESP32_S2_DRONE_V1_2 1
+#define CONFIG_BASE_STACK_SIZE 1024
+#define CONFIG_ENABLE_LEGACY_APP 0
+#define CONFIG_MOTORS_BACKEND_LEDC 1
+#define CONFIG_MOTOR_BRUSHED_720 1
+#define CONFIG_KALMAN_TRACE 1
+// For the replays of tools/linkcap, about two minutes of a flight
+#define CONFIG_LINK_CAPTURE 1
+#define CONFIG_LINK_CAPTURE_RECORDS 65536
+#define CONFIG_CRTP_LARGE_FRAMES 1
+#define CONFIG_TIME_SYNC 1
+// The stage times of the performance reports of sim_perf.c
+#define CONFIG_STABILIZER_PROFILER 1
+#define CONFIG_CONTROLLER_PID_RATE_HZ 500
+#define CONFIG_CONTROLLER_PID_ATTITUDE_HZ 500
+#define CONFIG_CONTROLLER_POSITION_RATE_HZ 100
+// storage.c of ./check, on the RAM partition of sim_flash.c
+#define CONFIG_STORAGE 1
+// kernel_bench_service.c of ./check. The sensors of sim_hal.c are on no I2C
+// bus, like the BMI088 on SPI, so there is no I2C benchmark.
+#define CONFIG_KERNEL_BENCH_SERVICE 1
+#define CONFIG_SENSORS_BMI088_SPI 1
+// 0 on the host, see kernelBenchMemHeader_t
+#define CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ 0
+// flight_recorder.c of the recorder scenario, about 2 minutes of the
+// flightrec partition of sim_flash.c
+#define CONFIG_FLIGHT_RECORDER 1
+#define CONFIG_FLIGHT_RECORDER_RATE_HZ 100
+#define CONFIG_FLIGHT_RECORDER_VARIABLES "stateEstimate.x,stateEstimate.y,stateEstimate.z,ctrltarget.z"
+// power_save.c of the idleyaw scenario, on the esp_pm.h stand-in. It selects
+// ESTIMATOR_MEASURED_DT in Kconfig.
+#define CONFIG_POWER_SAVE_IDLE 1
+#define CONFIG_ESTIMATOR_MEASURED_DT 1
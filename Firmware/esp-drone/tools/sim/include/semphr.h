@@ -0,0 +1,28 @@
+/*
+ * semphr.h - Virtual time FreeRTOS for the host simulator
+ *
+ * Semaphores are queues of empty items, as in FreeRTOS.
+ */
+
+#pragma once
+
+#include "queue.h"
+
+QueueHandle_t xSemaphoreCreateCountingSim(UBaseType_t maxCount, UBaseType_t initialCount);
+
+#define xSemaphoreCreateBinary()                  xSemaphoreCreateCountingSim(1, 0)
+#define xSemaphoreCreateBinaryStatic(buffer)      ((void)(buffer), xSemaphoreCreateCountingSim(1, 0))
+#define vSemaphoreCreateBinary(sem)               ((sem) = xSemaphoreCreateCountingSim(1, 1))
+#define xSemaphoreCreateMutex()                   xSemaphoreCreateCountingSim(1, 1)
+#define xSemaphoreCreateMutexStatic(buffer)       ((void)(buffer), xSemaphoreCreateCountingSim(1, 1))
+#define xSemaphoreCreateRecursiveMutex()          xSemaphoreCreateCountingSim(1, 1)
+#define xSemaphoreCreateCounting(max, initial)    xSemaphoreCreateCountingSim((max), (initial))
+#define xSemaphoreCreateCountingStatic(max, initial, buffer) ((void)(buffer), xSemaphoreCreateCountingSim((max), (initial)))
+
+#define xSemaphoreTake(sem, wait)                 xQueueGenericReceive((sem), NULL, (wait), false)
+#define xSemaphoreGive(sem)                       xQueueGenericSend((sem), NULL, 0, false)
+#define xSemaphoreTakeFromISR(sem, woken)         ((void)(woken), xQueueGenericReceive((sem), NULL, 0, false))
+#define xSemaphoreGiveFromISR(sem, woken)         ((void)(woken), xQueueGenericSend((sem), NULL, 0, false))
+#define xSemaphoreTakeRecursive(sem, wait)        xSemaphoreTake((sem), (wait))
+#define xSemaphoreGiveRecursive(sem)              xSemaphoreGive(sem)
+#define vSemaphoreDelete(sem)                     ((void)(sem))
@@ -0,0 +1,23 @@
+/*
+ * sim_tables.h - Param and log tables of the firmware, packed for the host
+ *
+ * Included before every source. The host compiler aligns large arrays to
+ * 32 bytes, which would leave holes between the tables once sim.ld puts
+ * them back to back. Asking for the alignment of the entries keeps them
+ * contiguous like on the target.
+ */
+
+#pragma once
+
+#include "../../../main/interface/param.h"
+#include "../../../main/interface/log.h"
+
+#undef PARAM_GROUP_START
+#define PARAM_GROUP_START(NAME)  \
+  static const struct param_s __params_##NAME[] __attribute__((section(".param." #NAME), used, aligned(8))) = { \
+  PARAM_ADD_GROUP(PARAM_GROUP | PARAM_START, NAME, 0x0)
+
+#undef LOG_GROUP_START
+#define LOG_GROUP_START(NAME)  \
+  static const struct log_s __logs_##NAME[] __attribute__((section(".log." #NAME), used, aligned(8))) = { \
+  LOG_ADD_GROUP(LOG_GROUP | LOG_START, NAME, 0x0)
@@ -0,0 +1,44 @@
+/*
+ * task.h - Virtual time FreeRTOS for the host simulator
+ */
+
+#pragma once
+
+#include "FreeRTOS.h"
+
+typedef void (*TaskFunction_t)(void *);
+
+typedef enum {
+  eNoAction = 0,
+  eSetBits,
+  eIncrement,
+  eSetValueWithOverwrite,
+  eSetValueWithoutOverwrite,
+} eNotifyAction;
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char *name, uint32_t stackDepth,
+                       void *parameters, UBaseType_t priority, TaskHandle_t *handle);
+TaskHandle_t xTaskCreateStatic(TaskFunction_t function, const char *name, uint32_t stackDepth,
+                               void *parameters, UBaseType_t priority, StackType_t *stack, StaticTask_t *buffer);
+
+#define xTaskCreatePinnedToCore(f, n, s, p, prio, h, core) xTaskCreate((f), (n), (s), (p), (prio), (h))
+#define xTaskCreateStaticPinnedToCore(f, n, s, p, prio, st, b, core) xTaskCreateStatic((f), (n), (s), (p), (prio), (st), (b))
+
+void vTaskDelete(TaskHandle_t task);
+void vTaskDelay(TickType_t ticks);
+void vTaskDelayUntil(TickType_t *previousWakeTime, TickType_t increment);
+#define xTaskDelayUntil(prev, inc) (vTaskDelayUntil((prev), (inc)), pdTRUE)
+
+TickType_t xTaskGetTickCount(void);
+#define xTaskGetTickCountFromISR() xTaskGetTickCount()
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+
+uint32_t ulTaskNotifyTake(BaseType_t clearCountOnExit, TickType_t ticksToWait);
+BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value, eNotifyAction action);
+BaseType_t xTaskNotifyWait(uint32_t clearOnEntry, uint32_t clearOnExit, uint32_t *value, TickType_t ticksToWait);
+#define xTaskNotifyGive(task) xTaskNotify((task), 0, eIncrement)
+#define vTaskNotifyGiveFromISR(task, woken) ((void)(woken), (void)xTaskNotifyGive(task))
+#define xTaskNotifyFromISR(task, value, action, woken) ((void)(woken), xTaskNotify((task), (value), (action)))
+
+#define vTaskSetApplicationTaskTag(task, tag) ((void)(task), (void)(tag))
+#define uxTaskGetStackHighWaterMark(task) ((UBaseType_t)1024)
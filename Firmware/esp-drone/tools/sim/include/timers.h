@@ -0,0 +1,33 @@
+/*
+ * timers.h - Virtual time FreeRTOS for the host simulator
+ *
+ * The callbacks run in a timer task, as in FreeRTOS, on the tick they are
+ * due. The calls taking a wait never block.
+ */
+
+#pragma once
+
+#include "FreeRTOS.h"
+
+typedef struct simTimer *TimerHandle_t;
+typedef TimerHandle_t xTimerHandle;
+typedef struct { int unused; } StaticTimer_t;
+typedef void (*TimerCallbackFunction_t)(TimerHandle_t timer);
+
+TimerHandle_t xTimerCreate(const char *name, TickType_t period, UBaseType_t autoReload, void *id,
+                           TimerCallbackFunction_t callback);
+#define xTimerCreateStatic(name, period, autoReload, id, callback, buffer) \
+  ((void)(buffer), xTimerCreate((name), (period), (autoReload), (id), (callback)))
+
+BaseType_t xTimerStartSim(TimerHandle_t timer);
+BaseType_t xTimerStopSim(TimerHandle_t timer);
+BaseType_t xTimerChangePeriodSim(TimerHandle_t timer, TickType_t period);
+BaseType_t xTimerDeleteSim(TimerHandle_t timer);
+BaseType_t xTimerIsTimerActive(TimerHandle_t timer);
+void *pvTimerGetTimerID(TimerHandle_t timer);
+
+#define xTimerStart(timer, wait)                 xTimerStartSim(timer)
+#define xTimerStop(timer, wait)                  xTimerStopSim(timer)
+#define xTimerReset(timer, wait)                 xTimerStartSim(timer)
+#define xTimerChangePeriod(timer, period, wait)  xTimerChangePeriodSim((timer), (period))
+#define xTimerDelete(timer, wait)                xTimerDeleteSim(timer)
@@ -0,0 +1,187 @@
+#!/usr/bin/env python3
+"""Fly the performance scenarios and compare what they cost with a baseline.
+
+Every scenario of the suite is flown with --report, in parallel on all the
+cores, and the reports are put together in one JSON file with the commit
+they were flown on. With a baseline every metric is compared, and the
+comparison fails on a regression past the tolerance.
+
+The flight, the queue peaks, the setpoint latency and the counters are on
+the virtual clock and the same on every run. The task times are the CPU time
+of the host: each scenario is flown --repeat times and the fastest run is
+kept, and they only compare with a baseline of the same host. The stage
+cycles of the stabilizer count whatever else the host ran meanwhile, they are
+reported but not compared.
+
+    ./perf.py -o base.json
+    ./perf.py -b base.json -o new.json
+"""
+
+import argparse
+import json
+import os
+import subprocess
+import sys
+import tempfile
+from concurrent.futures import ThreadPoolExecutor
+
+DIR = os.path.dirname(os.path.abspath(__file__))
+SIM = os.path.join(DIR, "sim")
+
+SUITE = ["hover", "aggressive", "flowhold", "logging", "lossy"]
+
+# Lower is better for all of them
+FLIGHT_METRICS = ["crashed", "rms", "max", "land_error", "touchdown_speed"]
+LATENCY_METRICS = ["mean", "p95", "max"]
+COUNTER_GROUPS = ["link", "crtp", "log"]
+# Below this the time of a task is noise
+MIN_TASK_US_PER_S = 200.0
+
+
+def commit():
+    try:
+        return subprocess.run(["git", "rev-parse", "--short", "HEAD"], cwd=DIR, capture_output=True,
+                              text=True, check=True).stdout.strip()
+    except (OSError, subprocess.CalledProcessError):
+        return "unknown"
+
+
+def fly(scenario, extra, directory, run):
+    path = os.path.join(directory, "%s-%d.json" % (scenario, run))
+    command = [SIM, "-s", scenario, "--report", path] + extra
+    subprocess.run(command, capture_output=True, text=True)
+    if not os.path.exists(path):
+        sys.exit("%s failed" % " ".join(command))
+    with open(path) as file:
+        return json.load(file)
+
+
+def fastest(reports):
+    """The first report, with the smallest host times of all the runs."""
+    report = reports[0]
+    for task in report["tasks"]:
+        task["us_per_s"] = min(t["us_per_s"] for r in reports for t in r["tasks"] if t["name"] == task["name"])
+    for name, stage in report["stages"].items():
+        stage["mean"] = min(r["stages"][name]["mean"] for r in reports)
+        stage["max"] = min(r["stages"][name]["max"] for r in reports)
+    report["flight"]["host_time"] = min(r["flight"]["host_time"] for r in reports)
+    return report
+
+
+def fly_suite(args):
+    # The runs of a scenario are spread over the suite, a busy moment of the
+    # host slows down one of each
+    runs = [(scenario, run) for run in range(args.repeat) for scenario in args.scenarios]
+    with tempfile.TemporaryDirectory() as directory, ThreadPoolExecutor(args.jobs) as pool:
+        reports = list(pool.map(lambda flight: fly(flight[0], args.extra, directory, flight[1]), runs))
+
+    return {scenario: fastest(reports[i::len(args.scenarios)]) for i, scenario in enumerate(args.scenarios)}
+
+
+def metrics(report):
+    """(name, value, is on the host clock) of everything that is compared."""
+    for name in FLIGHT_METRICS:
+        if report["flight"].get(name) is not None:
+            yield "flight." + name, report["flight"][name], False
+    for queue in report["queues"]:
+        yield "queue.%s.peak" % queue["name"], queue["peak"], False
+    for name in LATENCY_METRICS:
+        if name in report["latency_ms"]:
+            yield "latency_ms." + name, report["latency_ms"][name], False
+    for group in COUNTER_GROUPS:
+        for name, value in report[group].items():
+            yield "%s.%s" % (group, name), value, False
+    for task in report["tasks"]:
+        yield "task.%s.us_per_s" % task["name"], task["us_per_s"], True
+
+
+def compare(baseline, current, args, is_quiet=False):
+    """The number of regressions, and the scenarios in which the host times regressed."""
+    regressions = 0
+    slower = set()
+    if not is_quiet:
+        print("%-11s %-34s %12s %12s %8s" % ("scenario", "metric", "baseline", "current", "change"))
+    for scenario, report in current.items():
+        if scenario not in baseline:
+            if not is_quiet:
+                print("%-11s not in the baseline" % scenario)
+            continue
+        base = {name: value for name, value, _ in metrics(baseline[scenario])}
+        for name, value, is_host in metrics(report):
+            if name not in base or value == base[name]:
+                continue
+            if is_host and max(value, base[name]) < MIN_TASK_US_PER_S:
+                continue
+            tolerance = args.host_tolerance if is_host else args.tolerance
+            change = (value - base[name]) / base[name] if base[name] else float("inf")
+            is_regression = change > tolerance
+            # The host times are never quite the same
+            if is_host and abs(change) <= tolerance:
+                continue
+            regressions += is_regression
+            if is_host and is_regression:
+                slower.add(scenario)
+            if not is_quiet:
+                print("%-11s %-34s %12.6g %12.6g %+7.1f%% %s" % (scenario, name, base[name], value, change * 100,
+                                                                   "REGRESSION" if is_regression else ""))
+    return regressions, slower
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("-s", "--scenario", dest="scenarios", action="append",
+                        help="scenario to fly, repeatable (%s)" % ", ".join(SUITE))
+    parser.add_argument("-o", "--output", help="write the reports of the suite to this JSON file")
+    parser.add_argument("-b", "--baseline", help="compare with the JSON file of an earlier -o")
+    parser.add_argument("--repeat", type=int, default=5, help="flights per scenario for the host times")
+    parser.add_argument("--tolerance", type=float, default=0.02,
+                        help="relative increase of a virtual clock metric that is a regression")
+    parser.add_argument("--host-tolerance", type=float, default=0.25,
+                        help="relative increase of a host time that is a regression")
+    parser.add_argument("-j", "--jobs", type=int, default=os.cpu_count())
+    parser.add_argument("extra", nargs=argparse.REMAINDER, help="options passed to sim after --")
+    args = parser.parse_args()
+    args.extra = [a for a in args.extra if a != "--"]
+    args.scenarios = args.scenarios or SUITE
+
+    if not os.path.exists(SIM):
+        sys.exit("Build the simulator first with make")
+
+    results = {"commit": commit(), "options": args.extra, "scenarios": fly_suite(args)}
+    baseline = None
+    if args.baseline:
+        with open(args.baseline) as file:
+            baseline = json.load(file)
+        # A host that was busy for a while slows down every run of a scenario,
+        # the scenarios that got slower are flown once more to be sure
+        _, slower = compare(baseline["scenarios"], results["scenarios"], args, is_quiet=True)
+        if slower:
+            args.scenarios = sorted(slower)
+            for scenario, report in fly_suite(args).items():
+                results["scenarios"][scenario] = fastest([results["scenarios"][scenario], report])
+
+    if args.output:
+        with open(args.output, "w") as file:
+            json.dump(results, file, indent=2)
+            file.write("\n")
+
+    for scenario, report in results["scenarios"].items():
+        flight = report["flight"]
+        cpu = sum(task["us_per_s"] for task in report["tasks"])
+        print("%-11s rms=%.4f max=%.4f cpu=%.0f us/s loop=%d cycles latency_p95=%s ms%s" % (
+            scenario, flight["rms"], flight["max"], cpu, report["stages"]["total"]["mean"],
+            report["latency_ms"].get("p95", "-"), " CRASH" if flight["crashed"] else ""))
+
+    if baseline:
+        print("\nAgainst %s of %s" % (args.baseline, baseline["commit"]))
+        regressions, slower = compare(baseline["scenarios"], results["scenarios"], args)
+        print("%d regressions" % regressions)
+        if len(slower) > 1 and slower == set(results["scenarios"]):
+            print("Every scenario is slower, run again once the host is idle")
+        return 1 if regressions else 0
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,70 @@
+/*
+ * bench_main.c - Host build of the kernel micro-benchmarks
+ *
+ * Prints one line per kernel of kernel_bench.c. Given the output of an
+ * earlier run, the change of every kernel is printed next to it:
+ *
+ *   ./bench > before.txt
+ *   ... change the firmware, make bench ...
+ *   ./bench before.txt
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "kernel_bench.h"
+
+#define MAX_RESULTS 32
+
+typedef struct {
+  char name[64];
+  float ns;
+} baseline_t;
+
+static int readBaseline(const char *path, baseline_t *baseline, int maxCount)
+{
+  FILE *file = fopen(path, "r");
+  char line[256];
+  int count = 0;
+
+  if (file == NULL) {
+    perror(path);
+    return -1;
+  }
+
+  while (count < maxCount && fgets(line, sizeof(line), file)) {
+    if (sscanf(line, "%63s %f", baseline[count].name, &baseline[count].ns) == 2) {
+      count++;
+    }
+  }
+  fclose(file);
+
+  return count;
+}
+
+int main(int argc, char **argv)
+{
+  kernelBenchResult_t results[MAX_RESULTS];
+  baseline_t baseline[MAX_RESULTS];
+  int baselineCount = 0;
+
+  if (argc > 1 && (baselineCount = readBaseline(argv[1], baseline, MAX_RESULTS)) < 0) {
+    return 2;
+  }
+
+  const int count = kernelBenchRun(results, MAX_RESULTS);
+
+  printf("%-22s %10s %12s\n", "# kernel", "ns/call", "cycles/call");
+  for (int i = 0; i < count; i++) {
+    printf("%-22s %10.1f %12.1f", results[i].name, results[i].nsPerCall, results[i].cyclesPerCall);
+
+    for (int j = 0; j < baselineCount; j++) {
+      if (strcmp(baseline[j].name, results[i].name) == 0 && baseline[j].ns > 0) {
+        printf("  %+6.1f%%", 100.0f * (results[i].nsPerCall - baseline[j].ns) / baseline[j].ns);
+      }
+    }
+    printf("\n");
+  }
+
+  return 0;
+}
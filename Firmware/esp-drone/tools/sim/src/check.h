@@ -0,0 +1,36 @@
+/*
+ * check.h - Host checks of the firmware modules no flight of ./sim covers
+ *
+ * Every check runs in a task of sim_os.c on the virtual clock, one after the
+ * other in the same process, and returns false when it failed, after
+ * printing why on stderr.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "mem.h"
+
+// The memories of mem.h, read and written as by the requests of a client.
+// Reads and writes fail whenever one of the requests fails.
+uint32_t checkMemSize(MemoryType_t type);
+bool checkMemRead(MemoryType_t type, uint32_t address, uint32_t length, void *buffer);
+bool checkMemWrite(MemoryType_t type, uint32_t address, uint32_t length, const void *buffer);
+
+// Fills the kve log of storage.c until it needs compacting, in flight and
+// on the ground
+bool checkStorage(void);
+
+// Runs the benchmarks of kernel_bench_service.c on the ground, as
+// Controller/kernel_bench.py does, after they were refused in flight
+bool checkKernelBench(void);
+
+// Uploads a trajectory to the traj flash, refused in flight, and starts
+// compressed trajectories that end in and past the trajectory memory
+bool checkTrajectory(void);
+
+// Solves the crossing beams of lighthouse_geometry.c from rays of two base
+// stations, with and without an outlier
+bool checkLighthouse(void);
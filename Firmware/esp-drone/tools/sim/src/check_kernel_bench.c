@@ -0,0 +1,78 @@
+/*
+ * check_kernel_bench.c - The kernel benchmarks on command, see kernel_bench.h
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "crtp_commander_high_level.h"
+#include "kernel_bench.h"
+#include "power_save.h"
+#include "stabilizer.h"
+#include "stm32_legacy.h"
+
+#include "check.h"
+
+#define POLL_MS 10
+
+static kernelBenchMemRecord_t records[32];
+
+static bool start(uint8_t runs)
+{
+  return checkMemWrite(MEM_TYPE_KERNEL_BENCH, 0, sizeof(runs), &runs);
+}
+
+bool checkKernelBench(void)
+{
+  kernelBenchMemHeader_t header;
+
+  kernelBenchServiceInit();
+
+  crtpCommanderHighLevelTakeoff(0.5f, 10.0f);
+  if (start(1)) {
+    fprintf(stderr, "kernel_bench: started in flight\n");
+    return false;
+  }
+
+  crtpCommanderHighLevelStop();
+  vTaskDelay(M2T(POWER_SAVE_IDLE_DELAY_MS));
+  if (!start(1)) {
+    fprintf(stderr, "kernel_bench: refused on the ground\n");
+    return false;
+  }
+
+  do {
+    vTaskDelay(M2T(POLL_MS));
+    if (!checkMemRead(MEM_TYPE_KERNEL_BENCH, 0, sizeof(header), &header)) {
+      fprintf(stderr, "kernel_bench: the header does not read\n");
+      return false;
+    }
+  } while (header.state == kbRunning);
+
+  if (header.magic != KERNEL_BENCH_MEM_MAGIC || header.state != kbDone || header.runs != 1 ||
+      header.recordSize != sizeof(kernelBenchMemRecord_t)) {
+    fprintf(stderr, "kernel_bench: state %u after the runs\n", header.state);
+    return false;
+  }
+
+  const int count = kernelBenchCount();
+  if (header.recordsCount != count || count > (int)(sizeof(records) / sizeof(records[0])) ||
+      checkMemSize(MEM_TYPE_KERNEL_BENCH) != sizeof(header) + count * sizeof(records[0]) ||
+      !checkMemRead(MEM_TYPE_KERNEL_BENCH, sizeof(header), count * sizeof(records[0]), records)) {
+    fprintf(stderr, "kernel_bench: %u of %d records\n", header.recordsCount, count);
+    return false;
+  }
+
+  for (int i = 0; i < count; i++) {
+    if (records[i].name[0] == '\0' || records[i].calls != KERNEL_BENCH_CALLS || !(records[i].nsPerCall > 0.0f) ||
+        records[i].cyclesMin > records[i].cyclesMedian || records[i].cyclesMedian > records[i].cyclesMax) {
+      fprintf(stderr, "kernel_bench: record %d of %.*s is wrong\n", i, KERNEL_BENCH_NAME_LEN, records[i].name);
+      return false;
+    }
+  }
+
+  return true;
+}
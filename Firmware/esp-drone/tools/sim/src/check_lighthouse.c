@@ -0,0 +1,124 @@
+/*
+ * check_lighthouse.c - Crossing beams of lighthouse_geometry.c
+ *
+ * Two base stations, one of them turned, see a point. The sweep angles of
+ * the rays are computed back from the geometry, so the solves must find the
+ * point again. One ray aimed 50 cm off must not pull the robust solve away.
+ */
+
+#include <math.h>
+#include <stdio.h>
+
+#include "lighthouse_geometry.h"
+
+#include "check.h"
+
+// Those of lighthouse_position_est.c
+#define ROBUST_THRESHOLD 0.05f
+#define ROBUST_ITERATIONS 2
+
+#define GOOD_RAYS 4
+#define TOLERANCE 0.001f
+#define ROBUST_TOLERANCE 0.01f
+
+static const baseStationGeometry_t baseStations[2] = {
+  { .origin = {-2.0f, 0.5f, 2.5f}, .mat = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}}, .valid = true },
+  // Turned by 90 degrees around z
+  { .origin = {0.5f, -2.0f, 2.5f}, .mat = {{0, -1, 0}, {1, 0, 0}, {0, 0, 1}}, .valid = true },
+};
+
+static const vec3d point = {0.3f, 0.2f, 0.8f};
+
+static lighthouseGeometryRaySet_t rays;
+
+// The angles of the ray of the base station through target, the inverse of
+// lighthouseGeometryGetRay()
+static void anglesTo(const baseStationGeometry_t *bs, const vec3d target, float angles[2])
+{
+  const vec3d delta = {target[0] - bs->origin[0], target[1] - bs->origin[1], target[2] - bs->origin[2]};
+  vec3d local = {0};
+
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 3; j++) {
+      local[i] += bs->mat[j][i] * delta[j];
+    }
+  }
+
+  angles[0] = atan2f(local[1], local[0]);
+  angles[1] = atan2f(local[2], local[0]);
+}
+
+static float distanceToPoint(const vec3d position)
+{
+  const float dx = position[0] - point[0];
+  const float dy = position[1] - point[1];
+  const float dz = position[2] - point[2];
+
+  return sqrtf(dx * dx + dy * dy + dz * dz);
+}
+
+static void addRay(int bs, const vec3d target)
+{
+  float angles[2];
+
+  anglesTo(&baseStations[bs], target, angles);
+  lighthouseGeometryRaySetAdd(&rays, &baseStations[bs], bs, angles);
+}
+
+bool checkLighthouse(void)
+{
+  float angles1[2];
+  float angles2[2];
+  vec3d position;
+  float delta;
+
+  anglesTo(&baseStations[0], point, angles1);
+  anglesTo(&baseStations[1], point, angles2);
+  if (!lighthouseGeometryGetPositionFromRayIntersection(baseStations, angles1, angles2, position, &delta) ||
+      distanceToPoint(position) > TOLERANCE) {
+    fprintf(stderr, "lighthouse: the pairwise intersection misses the point\n");
+    return false;
+  }
+
+  // All the rays of one base station meet at its origin only
+  lighthouseGeometryRaySetClear(&rays);
+  for (int i = 0; i < GOOD_RAYS; i++) {
+    addRay(0, point);
+  }
+  if (lighthouseGeometryGetPositionFromRays(&rays, 0, ROBUST_THRESHOLD, position, &delta)) {
+    fprintf(stderr, "lighthouse: solved with the rays of a single base station\n");
+    return false;
+  }
+
+  for (int i = 0; i < GOOD_RAYS; i++) {
+    addRay(1, point);
+  }
+  if (!lighthouseGeometryGetPositionFromRays(&rays, 0, ROBUST_THRESHOLD, position, &delta) ||
+      distanceToPoint(position) > TOLERANCE || delta > TOLERANCE) {
+    fprintf(stderr, "lighthouse: the rays of two base stations miss the point\n");
+    return false;
+  }
+
+  const vec3d outlier = {point[0], point[1] + 0.5f, point[2]};
+  addRay(1, outlier);
+  if (!lighthouseGeometryGetPositionFromRays(&rays, 0, ROBUST_THRESHOLD, position, &delta)) {
+    fprintf(stderr, "lighthouse: no solve with an outlier\n");
+    return false;
+  }
+  const float plainError = distanceToPoint(position);
+  if (!lighthouseGeometryGetPositionFromRays(&rays, ROBUST_ITERATIONS, ROBUST_THRESHOLD, position, &delta) ||
+      distanceToPoint(position) > ROBUST_TOLERANCE || distanceToPoint(position) >= plainError) {
+    fprintf(stderr, "lighthouse: the outlier pulls the robust solve %.3f m off\n", (double)distanceToPoint(position));
+    return false;
+  }
+
+  while (rays.count < LIGHTHOUSE_GEOMETRY_MAX_RAYS) {
+    addRay(0, point);
+  }
+  if (lighthouseGeometryRaySetAdd(&rays, &baseStations[0], 0, angles1)) {
+    fprintf(stderr, "lighthouse: added a ray to a full set\n");
+    return false;
+  }
+
+  return true;
+}
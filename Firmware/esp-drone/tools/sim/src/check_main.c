@@ -0,0 +1,104 @@
+/*
+ * check_main.c - Host checks of the firmware, see check.h
+ *
+ * Runs every check, or those named on the command line, and prints one line
+ * per check. Exits with 1 when one of them failed:
+ *
+ *   ./check
+ *   ./check storage
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "commander.h"
+#include "system.h"
+
+#include "check.h"
+#include "sim_hal.h"
+#include "sim_os.h"
+
+// Virtual time a check may take before it is failed
+#define CHECK_TIMEOUT_TICKS (10 * 60 * configTICK_RATE_HZ)
+
+static const struct {
+  const char *name;
+  bool (*run)(void);
+} checks[] = {
+  { "storage", checkStorage },
+  { "kernel_bench", checkKernelBench },
+  { "trajectory", checkTrajectory },
+  { "lighthouse", checkLighthouse },
+};
+
+#define CHECK_COUNT (sizeof(checks) / sizeof(checks[0]))
+
+static int checkIndex;
+static bool isDone;
+static bool isPassed;
+
+static void checkTask(void *parameters)
+{
+  isPassed = checks[checkIndex].run();
+  isDone = true;
+  vTaskDelete(NULL);
+}
+
+static bool isSelected(int index, int argc, char **argv)
+{
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], checks[index].name) == 0) {
+      return true;
+    }
+  }
+
+  return argc == 1;
+}
+
+int main(int argc, char **argv)
+{
+  int failed = 0;
+
+  for (int i = 1; i < argc; i++) {
+    bool isKnown = false;
+    for (size_t j = 0; j < CHECK_COUNT; j++) {
+      isKnown = isKnown || strcmp(argv[i], checks[j].name) == 0;
+    }
+    if (!isKnown) {
+      fprintf(stderr, "No check %s\n", argv[i]);
+      return 2;
+    }
+  }
+
+  simHalSetLogLevel(ESP_LOG_ERROR);
+  commanderInit();
+  systemStart();
+
+  for (checkIndex = 0; checkIndex < (int)CHECK_COUNT; checkIndex++) {
+    if (!isSelected(checkIndex, argc, argv)) {
+      continue;
+    }
+
+    TaskHandle_t task;
+    const TickType_t start = xTaskGetTickCount();
+
+    isDone = false;
+    xTaskCreate(checkTask, checks[checkIndex].name, configMINIMAL_STACK_SIZE, NULL, 0, &task);
+    while (!isDone && xTaskGetTickCount() - start < CHECK_TIMEOUT_TICKS) {
+      simOsRunUntilIdle();
+      simOsTick();
+    }
+    if (!isDone) {
+      fprintf(stderr, "%s: timed out\n", checks[checkIndex].name);
+      vTaskDelete(task);
+    }
+    const bool isOk = isDone && isPassed;
+    printf("%-16s %s\n", checks[checkIndex].name, isOk ? "ok" : "FAIL");
+    failed += !isOk;
+  }
+
+  return failed ? 1 : 0;
+}
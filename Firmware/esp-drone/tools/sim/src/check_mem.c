@@ -0,0 +1,98 @@
+/*
+ * check_mem.c - The memories of the checks, in place of mem.c
+ *
+ * The handlers register here, and the checks read and write them directly,
+ * as the mem task does for the requests of a client.
+ */
+
+#include <stddef.h>
+
+#include "mem.h"
+
+#include "check.h"
+
+#define MAX_HANDLERS 16
+// The data of a read or write request of a client, in a classic CRTP packet
+#define CHECK_MEM_CHUNK 24
+
+static const MemoryHandlerDef_t *handlers[MAX_HANDLERS];
+static int handlersCount;
+
+void memInit(void)
+{
+}
+
+bool memTest(void)
+{
+  return true;
+}
+
+void memoryRegisterHandler(const MemoryHandlerDef_t* handlerDef)
+{
+  if (handlersCount < MAX_HANDLERS) {
+    handlers[handlersCount++] = handlerDef;
+  }
+}
+
+void memoryRegisterOwHandler(const MemoryOwHandlerDef_t* handlerDef)
+{
+}
+
+static const MemoryHandlerDef_t *handlerOf(MemoryType_t type)
+{
+  for (int i = 0; i < handlersCount; i++) {
+    if (handlers[i]->type == type) {
+      return handlers[i];
+    }
+  }
+
+  return NULL;
+}
+
+uint32_t checkMemSize(MemoryType_t type)
+{
+  const MemoryHandlerDef_t *handler = handlerOf(type);
+
+  return handler ? handler->getSize() : 0;
+}
+
+bool checkMemRead(MemoryType_t type, uint32_t address, uint32_t length, void *buffer)
+{
+  const MemoryHandlerDef_t *handler = handlerOf(type);
+
+  if (handler == NULL || handler->read == NULL) {
+    return false;
+  }
+
+  // In the chunks of the read requests of a client
+  for (uint32_t done = 0; done < length; ) {
+    const uint8_t chunk = length - done < CHECK_MEM_CHUNK ? length - done : CHECK_MEM_CHUNK;
+
+    if (!handler->read(address + done, chunk, (uint8_t *)buffer + done)) {
+      return false;
+    }
+    done += chunk;
+  }
+
+  return true;
+}
+
+bool checkMemWrite(MemoryType_t type, uint32_t address, uint32_t length, const void *buffer)
+{
+  const MemoryHandlerDef_t *handler = handlerOf(type);
+
+  if (handler == NULL || handler->write == NULL) {
+    return false;
+  }
+
+  for (uint32_t done = 0; done < length; ) {
+    const uint8_t chunk = length - done < CHECK_MEM_CHUNK ? length - done : CHECK_MEM_CHUNK;
+
+    if (!handler->write(address + done, chunk, (const uint8_t *)buffer + done)) {
+      return false;
+    }
+    done += chunk;
+  }
+
+  return true;
+}
@@ -0,0 +1,96 @@
+/*
+ * check_storage.c - Compaction of the kve log of storage.c
+ *
+ * The same key is stored over and over, every store leaves the previous
+ * item dead. In flight the log fills up and the stores fail, as the
+ * sectors may not be erased. Once landed and idle the compaction takes the
+ * dead items back, and the log holds many times its size in stores. A key
+ * longer than the 255 characters of the item header is refused.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "crtp_commander_high_level.h"
+#include "power_save.h"
+#include "stabilizer.h"
+#include "stm32_legacy.h"
+#include "storage.h"
+#include "kve/kve_common.h"
+
+#include "check.h"
+
+#define VALUE_SIZE 1000
+// The kve partition of sim_flash.c
+#define PARTITION_SIZE (64 * 1024)
+#define GROUND_STORES (4 * PARTITION_SIZE / VALUE_SIZE)
+
+static uint8_t value[VALUE_SIZE];
+static uint8_t fetched[VALUE_SIZE];
+static char longKey[KVE_KEY_MAX_LENGTH + 2];
+
+static bool store(int i)
+{
+  memset(value, i, sizeof(value));
+  return storageStore("check", value, sizeof(value));
+}
+
+bool checkStorage(void)
+{
+  int stores = 0;
+
+  storageInit();
+  if (!storageTest()) {
+    fprintf(stderr, "storage: does not mount\n");
+    return false;
+  }
+
+  // Flying, the log fills up once
+  crtpCommanderHighLevelTakeoff(0.5f, 10.0f);
+  if (!stabilizerIsFlying()) {
+    fprintf(stderr, "storage: not flying after the takeoff\n");
+    return false;
+  }
+  while (stores <= PARTITION_SIZE / VALUE_SIZE && store(stores)) {
+    stores++;
+  }
+  if (stores > PARTITION_SIZE / VALUE_SIZE) {
+    fprintf(stderr, "storage: %d stores of %d bytes in flight\n", stores, VALUE_SIZE);
+    return false;
+  }
+
+  // Landed, and idle for long enough
+  crtpCommanderHighLevelStop();
+  vTaskDelay(M2T(POWER_SAVE_IDLE_DELAY_MS));
+  if (stabilizerIsFlying()) {
+    fprintf(stderr, "storage: still flying once landed\n");
+    return false;
+  }
+  for (int i = 0; i < GROUND_STORES; i++) {
+    if (!store(i)) {
+      fprintf(stderr, "storage: store %d of %d failed on the ground\n", i, GROUND_STORES);
+      return false;
+    }
+  }
+
+  if (storageFetch("check", fetched, sizeof(fetched)) != sizeof(fetched) || memcmp(fetched, value, sizeof(value)) != 0) {
+    fprintf(stderr, "storage: the last store does not read back\n");
+    return false;
+  }
+
+  memset(longKey, 'k', KVE_KEY_MAX_LENGTH);
+  if (!storageStore(longKey, value, 1) || storageFetch(longKey, fetched, 1) != 1) {
+    fprintf(stderr, "storage: a key of %d characters does not store\n", KVE_KEY_MAX_LENGTH);
+    return false;
+  }
+  longKey[KVE_KEY_MAX_LENGTH] = 'k';
+  if (storageStore(longKey, value, 1) || storageFetch(longKey, fetched, 1) != 0) {
+    fprintf(stderr, "storage: a key of %d characters is not refused\n", KVE_KEY_MAX_LENGTH + 1);
+    return false;
+  }
+
+  return true;
+}
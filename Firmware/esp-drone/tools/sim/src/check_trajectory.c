@@ -0,0 +1,82 @@
+/*
+ * check_trajectory.c - Trajectory uploads of crtp_commander_high_level.c
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "crtp_commander_high_level.h"
+#include "power_save.h"
+#include "stm32_legacy.h"
+
+#include "check.h"
+
+// The start position, one piece of a second that holds it, and the piece
+// without duration that ends the trajectory, see pptraj_compressed.c
+static const uint8_t compressed[] = {
+  0, 0, 0, 0, 0xf4, 0x01, 0, 0,
+  0x00, 0xe8, 0x03,
+  0x00, 0x00, 0x00,
+};
+#define COMPRESSED_END_SIZE 3
+
+static uint8_t uploaded[1000];
+static uint8_t readBack[sizeof(uploaded)];
+
+// false if the compressed trajectory at offset started
+static bool isRefused(uint32_t offset)
+{
+  crtpCommanderHighLevelDefineTrajectory(0, CRTP_CHL_TRAJECTORY_TYPE_POLY4D_COMPRESSED, offset, 0);
+  crtpCommanderHighLevelStartTrajectory(0, 1.0f, false, false);
+  const bool isStopped = crtpCommanderHighLevelIsStopped();
+  crtpCommanderHighLevelStop();
+
+  return isStopped;
+}
+
+bool checkTrajectory(void)
+{
+  const uint32_t memSize = crtpCommanderHighLevelTrajectoryMemSize();
+
+  for (size_t i = 0; i < sizeof(uploaded); i++) {
+    uploaded[i] = i * 7;
+  }
+
+  crtpCommanderHighLevelTakeoff(0.5f, 10.0f);
+  if (checkMemWrite(MEM_TYPE_TRAJ_FLASH, 0, sizeof(uploaded), uploaded)) {
+    fprintf(stderr, "trajectory: uploaded to flash in flight\n");
+    return false;
+  }
+
+  crtpCommanderHighLevelStop();
+  vTaskDelay(M2T(POWER_SAVE_IDLE_DELAY_MS));
+  if (!checkMemWrite(MEM_TYPE_TRAJ_FLASH, 0, sizeof(uploaded), uploaded) ||
+      !checkMemRead(MEM_TYPE_TRAJ_FLASH, 0, sizeof(readBack), readBack) ||
+      memcmp(uploaded, readBack, sizeof(uploaded)) != 0) {
+    fprintf(stderr, "trajectory: the flash upload does not read back\n");
+    return false;
+  }
+
+  // All of it in the memory, then its end past it
+  const uint32_t lastOffset = memSize - sizeof(compressed);
+  if (!crtpCommanderHighLevelWriteTrajectory(lastOffset, sizeof(compressed), compressed) || isRefused(lastOffset)) {
+    fprintf(stderr, "trajectory: the compressed trajectory at the end of the memory does not start\n");
+    return false;
+  }
+  for (uint32_t cut = 1; cut <= COMPRESSED_END_SIZE; cut++) {
+    const uint32_t offset = lastOffset + cut;
+    if (!crtpCommanderHighLevelWriteTrajectory(offset, sizeof(compressed) - cut, compressed) || !isRefused(offset)) {
+      fprintf(stderr, "trajectory: started %u bytes short of its end\n", cut);
+      return false;
+    }
+  }
+  if (!isRefused(memSize - 1)) {
+    fprintf(stderr, "trajectory: started from the last byte of the memory\n");
+    return false;
+  }
+
+  return true;
+}
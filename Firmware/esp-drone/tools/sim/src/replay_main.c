@@ -0,0 +1,403 @@
+/*
+ * replay_main.c - Replay of a kalman trace through kalman_core.c
+ *
+ * Feeds the records of a trace of ./sim --trace, see kalman_trace.h, to the
+ * kalman core in order and compares the state after every finalization with
+ * the checkpoint of the recorder. Built from the same sources on the same
+ * host both runs compute the same floats, so any mismatch is a change of
+ * the core, the params or the compiler:
+ *
+ *   ./sim -s square --trace square.trc
+ *   ... change kalman_core.c, make replay ...
+ *   ./replay square.trc
+ *
+ * It also prints the cost of every kind of call, the average over all
+ * the runs of the trace. Params set with -p must be those of the recording,
+ * they are applied after the first init of the kalman core, as by ./sim.
+ * Exits with 1 on a mismatch, 2 on a bad trace.
+ */
+
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "crtp.h"
+#include "param.h"
+#include "kalman_core.h"
+#include "kalman_trace.h"
+
+#include "sim_vars.h"
+
+#define MAX_PARAMS 64
+
+static const char *typeNames[KALMAN_TRACE_TYPE_COUNT] = {
+  [KALMAN_TRACE_START] = "start",
+  [KALMAN_TRACE_INIT] = "init",
+  [KALMAN_TRACE_DECOUPLE_XY] = "decoupleXY",
+  [KALMAN_TRACE_PREDICT] = "predict",
+  [KALMAN_TRACE_PROCESS_NOISE] = "processNoise",
+  [KALMAN_TRACE_BARO] = "baro",
+  [KALMAN_TRACE_TOF] = "tof",
+  [KALMAN_TRACE_YAW_ERROR] = "yawError",
+  [KALMAN_TRACE_HEIGHT] = "height",
+  [KALMAN_TRACE_DISTANCE] = "distance",
+  [KALMAN_TRACE_POSITION] = "position",
+  [KALMAN_TRACE_POSE] = "pose",
+  [KALMAN_TRACE_TDOA] = "tdoa",
+  [KALMAN_TRACE_FLOW] = "flow",
+  [KALMAN_TRACE_BATCH_BEGIN] = "batchBegin",
+  [KALMAN_TRACE_BATCH_END] = "batchEnd",
+  [KALMAN_TRACE_FINALIZE] = "finalize",
+  [KALMAN_TRACE_STATE] = "state",
+};
+
+static const uint16_t payloadSizes[KALMAN_TRACE_TYPE_COUNT] = {
+  [KALMAN_TRACE_START] = sizeof(kalmanTraceStart_t),
+  [KALMAN_TRACE_PREDICT] = sizeof(kalmanTracePredict_t),
+  [KALMAN_TRACE_PROCESS_NOISE] = sizeof(float),
+  [KALMAN_TRACE_BARO] = sizeof(kalmanTraceBaro_t),
+  [KALMAN_TRACE_TOF] = sizeof(tofMeasurement_t),
+  [KALMAN_TRACE_YAW_ERROR] = sizeof(yawErrorMeasurement_t),
+  [KALMAN_TRACE_HEIGHT] = sizeof(heightMeasurement_t),
+  [KALMAN_TRACE_DISTANCE] = sizeof(distanceMeasurement_t),
+  [KALMAN_TRACE_POSITION] = sizeof(positionMeasurement_t),
+  [KALMAN_TRACE_POSE] = sizeof(poseMeasurement_t),
+  [KALMAN_TRACE_TDOA] = sizeof(tdoaMeasurement_t),
+  [KALMAN_TRACE_FLOW] = sizeof(kalmanTraceFlow_t),
+  [KALMAN_TRACE_STATE] = sizeof(kalmanTraceState_t),
+};
+
+static struct {
+  int runs;
+  const char *params[MAX_PARAMS];
+  int paramCount;
+} options = {
+  .runs = 1,
+};
+
+typedef struct {
+  uint32_t records;
+  uint32_t checkpoints;
+  uint32_t mismatches;
+  uint32_t firstMismatchTick;
+  float maxStateError;
+  uint32_t calls[KALMAN_TRACE_TYPE_COUNT];
+  double ns[KALMAN_TRACE_TYPE_COUNT];
+} replayResult_t;
+
+static kalmanCoreData_t coreData;
+static bool paramsApplied;
+
+static void usage(const char *name)
+{
+  fprintf(stderr,
+          "Usage: %s [options] TRACE\n"
+          "  -p, --param G.N=V      set a firmware param as for the recording, repeatable\n"
+          "  -n, --runs N           replay the trace N times for the timing (1)\n",
+          name);
+}
+
+static void parseOptions(int argc, char **argv)
+{
+  static const struct option longOptions[] = {
+    { "param", required_argument, NULL, 'p' },
+    { "runs", required_argument, NULL, 'n' },
+    { "help", no_argument, NULL, 'h' },
+    { 0 },
+  };
+  int option;
+
+  while ((option = getopt_long(argc, argv, "p:n:h", longOptions, NULL)) != -1) {
+    switch (option) {
+      case 'p':
+        if (options.paramCount < MAX_PARAMS) {
+          options.params[options.paramCount++] = optarg;
+        }
+        break;
+      case 'n':
+        options.runs = strtol(optarg, NULL, 0);
+        break;
+      default:
+        usage(argv[0]);
+        exit(option == 'h' ? 0 : 2);
+    }
+  }
+
+  if (optind != argc - 1 || options.runs < 1) {
+    usage(argv[0]);
+    exit(2);
+  }
+}
+
+static uint8_t *readTrace(const char *path, size_t *size)
+{
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) {
+    perror(path);
+    exit(2);
+  }
+
+  fseek(file, 0, SEEK_END);
+  *size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+
+  uint8_t *trace = malloc(*size + 1);
+  if (fread(trace, 1, *size, file) != *size) {
+    perror(path);
+    exit(2);
+  }
+  fclose(file);
+
+  return trace;
+}
+
+static void checkStart(const uint8_t *trace, size_t size)
+{
+  kalmanTraceHeader_t header;
+  kalmanTraceStart_t start;
+
+  if (size < sizeof(header) + sizeof(start)) {
+    fprintf(stderr, "Not a kalman trace\n");
+    exit(2);
+  }
+  memcpy(&header, trace, sizeof(header));
+  memcpy(&start, &trace[sizeof(header)], sizeof(start));
+
+  if (header.type != KALMAN_TRACE_START || start.magic != KALMAN_TRACE_MAGIC) {
+    fprintf(stderr, "Not a kalman trace\n");
+    exit(2);
+  }
+  if (start.version != KALMAN_TRACE_VERSION || start.stateDim != KC_STATE_DIM ||
+      start.stateSize != sizeof(kalmanTraceState_t)) {
+    fprintf(stderr, "Trace of version %u with %u states, this replay is version %u with %u\n",
+            start.version, start.stateDim, KALMAN_TRACE_VERSION, KC_STATE_DIM);
+    exit(2);
+  }
+}
+
+static void compareState(const kalmanTraceState_t *expected, uint32_t tick, replayResult_t *result)
+{
+  kalmanTraceState_t state;
+
+  memcpy(state.S, coreData.S, sizeof(state.S));
+  memcpy(state.q, coreData.q, sizeof(state.q));
+  memcpy(state.P, coreData.P, sizeof(state.P));
+  result->checkpoints++;
+
+  if (memcmp(&state, expected, sizeof(state)) == 0) {
+    return;
+  }
+
+  if (result->mismatches++ == 0) {
+    result->firstMismatchTick = tick;
+  }
+  for (int i = 0; i < KC_STATE_DIM; i++) {
+    result->maxStateError = fmaxf(result->maxStateError, fabsf(state.S[i] - expected->S[i]));
+  }
+}
+
+// Calls the kalman core for the record, false for the records that are not calls
+static bool replayRecord(uint8_t type, uint32_t tick, const void *payload)
+{
+  switch (type) {
+    case KALMAN_TRACE_INIT:
+      kalmanCoreInit(&coreData);
+      break;
+    case KALMAN_TRACE_DECOUPLE_XY:
+      kalmanCoreDecoupleXY(&coreData);
+      break;
+    case KALMAN_TRACE_PREDICT: {
+      kalmanTracePredict_t predict;
+      memcpy(&predict, payload, sizeof(predict));
+      kalmanCorePredict(&coreData, predict.thrust, &predict.acc, &predict.gyro, predict.dt, predict.quadIsFlying);
+      break;
+    }
+    case KALMAN_TRACE_PROCESS_NOISE: {
+      float dt;
+      memcpy(&dt, payload, sizeof(dt));
+      kalmanCoreAddProcessNoise(&coreData, dt);
+      break;
+    }
+    case KALMAN_TRACE_BARO: {
+      kalmanTraceBaro_t baro;
+      memcpy(&baro, payload, sizeof(baro));
+      kalmanCoreUpdateWithBaro(&coreData, baro.asl, baro.quadIsFlying);
+      break;
+    }
+    case KALMAN_TRACE_TOF: {
+      tofMeasurement_t tof;
+      memcpy(&tof, payload, sizeof(tof));
+      kalmanCoreUpdateWithTof(&coreData, &tof);
+      break;
+    }
+    case KALMAN_TRACE_YAW_ERROR: {
+      yawErrorMeasurement_t yawError;
+      memcpy(&yawError, payload, sizeof(yawError));
+      kalmanCoreUpdateWithYawError(&coreData, &yawError);
+      break;
+    }
+    case KALMAN_TRACE_HEIGHT: {
+      heightMeasurement_t height;
+      memcpy(&height, payload, sizeof(height));
+      kalmanCoreUpdateWithAbsoluteHeight(&coreData, &height);
+      break;
+    }
+    case KALMAN_TRACE_DISTANCE: {
+      distanceMeasurement_t dist;
+      memcpy(&dist, payload, sizeof(dist));
+      kalmanCoreUpdateWithDistance(&coreData, &dist);
+      break;
+    }
+    case KALMAN_TRACE_POSITION: {
+      positionMeasurement_t pos;
+      memcpy(&pos, payload, sizeof(pos));
+      kalmanCoreUpdateWithPosition(&coreData, &pos);
+      break;
+    }
+    case KALMAN_TRACE_POSE: {
+      poseMeasurement_t pose;
+      memcpy(&pose, payload, sizeof(pose));
+      kalmanCoreUpdateWithPose(&coreData, &pose);
+      break;
+    }
+    case KALMAN_TRACE_TDOA: {
+      tdoaMeasurement_t tdoa;
+      memcpy(&tdoa, payload, sizeof(tdoa));
+      kalmanCoreUpdateWithTDOA(&coreData, &tdoa);
+      break;
+    }
+    case KALMAN_TRACE_FLOW: {
+      kalmanTraceFlow_t flow;
+      memcpy(&flow, payload, sizeof(flow));
+      kalmanCoreUpdateWithFlow(&coreData, &flow.flow, &flow.gyro);
+      break;
+    }
+#ifdef CONFIG_KALMAN_BATCHED_UPDATE
+    case KALMAN_TRACE_BATCH_BEGIN:
+      kalmanCoreBatchBegin(&coreData);
+      break;
+    case KALMAN_TRACE_BATCH_END:
+      kalmanCoreBatchEnd(&coreData);
+      break;
+#endif
+    case KALMAN_TRACE_FINALIZE:
+      kalmanCoreFinalize(&coreData, tick);
+      break;
+    default:
+      return false;
+  }
+
+  return true;
+}
+
+// Once, after the first init, where ./sim sets them
+static void applyParams(void)
+{
+  for (int i = 0; i < options.paramCount; i++) {
+    if (!simVarsAssign(options.params[i])) {
+      fprintf(stderr, "Unknown param %s\n", options.params[i]);
+      exit(2);
+    }
+  }
+  paramsApplied = true;
+}
+
+static double elapsedNs(const struct timespec *start, const struct timespec *end)
+{
+  return (end->tv_sec - start->tv_sec) * 1e9 + (end->tv_nsec - start->tv_nsec);
+}
+
+static void replay(const uint8_t *trace, size_t size, bool compare, replayResult_t *result)
+{
+  size_t offset = 0;
+
+  memset(&coreData, 0, sizeof(coreData));
+  kalmanCoreInit(&coreData);
+
+  while (offset + sizeof(kalmanTraceHeader_t) <= size) {
+    kalmanTraceHeader_t header;
+    memcpy(&header, &trace[offset], sizeof(header));
+    const uint8_t *payload = &trace[offset + sizeof(header)];
+
+    if (header.type >= KALMAN_TRACE_TYPE_COUNT || header.size != payloadSizes[header.type] ||
+        offset + sizeof(header) + header.size > size) {
+      fprintf(stderr, "Bad record of type %u and %u bytes at offset %zu\n", header.type, header.size, offset);
+      exit(2);
+    }
+    offset += sizeof(header) + header.size;
+    result->records++;
+
+    if (header.type == KALMAN_TRACE_STATE) {
+      if (compare) {
+        kalmanTraceState_t expected;
+        memcpy(&expected, payload, sizeof(expected));
+        compareState(&expected, header.tick, result);
+      }
+      continue;
+    }
+
+    struct timespec start;
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (replayRecord(header.type, header.tick, payload)) {
+      clock_gettime(CLOCK_MONOTONIC, &end);
+      result->calls[header.type]++;
+      result->ns[header.type] += elapsedNs(&start, &end);
+    }
+
+    if (header.type == KALMAN_TRACE_INIT && !paramsApplied) {
+      applyParams();
+    }
+  }
+
+  if (offset != size) {
+    fprintf(stderr, "Truncated record at offset %zu\n", offset);
+    exit(2);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  parseOptions(argc, argv);
+
+  size_t size;
+  uint8_t *trace = readTrace(argv[optind], &size);
+  checkStart(trace, size);
+
+  crtpInit();
+  paramInit();
+
+  replayResult_t result = { 0 };
+  for (int run = 0; run < options.runs; run++) {
+    replayResult_t runResult = { 0 };
+    replay(trace, size, run == 0, &runResult);
+    if (run == 0) {
+      result = runResult;
+    } else {
+      for (int type = 0; type < KALMAN_TRACE_TYPE_COUNT; type++) {
+        result.calls[type] += runResult.calls[type];
+        result.ns[type] += runResult.ns[type];
+      }
+    }
+  }
+  free(trace);
+
+  printf("records=%u checkpoints=%u mismatches=%u", result.records, result.checkpoints, result.mismatches);
+  if (result.mismatches) {
+    printf(" first_mismatch_tick=%u max_state_error=%g", result.firstMismatchTick, result.maxStateError);
+  }
+  printf("\n");
+
+  printf("%-22s %10s %10s\n", "# call", "calls", "ns/call");
+  for (int type = 0; type < KALMAN_TRACE_TYPE_COUNT; type++) {
+    if (result.calls[type] > 0) {
+      printf("%-22s %10u %10.1f\n", typeNames[type], result.calls[type] / options.runs,
+             result.ns[type] / result.calls[type]);
+    }
+  }
+
+  return result.mismatches ? 1 : 0;
+}
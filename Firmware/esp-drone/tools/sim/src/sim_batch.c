@@ -0,0 +1,183 @@
+/*
+ * sim_batch.c - Monte Carlo batches of simulated flights
+ *
+ * Every flight is a child process forked before the firmware starts, so it
+ * begins from the same state as a single flight and nothing it does leaks
+ * into the next one. A result is a few dozen bytes, less than PIPE_BUF, so the
+ * children share one pipe and every write arrives whole.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "sim_batch.h"
+
+typedef struct {
+  uint32_t index;
+  simFlightResult_t result;
+} record_t;
+
+_Static_assert(sizeof(record_t) <= PIPE_BUF, "a record must be written atomically");
+
+static pid_t launch(simFlight_t fly, uint64_t seed, uint32_t index, int pipeFds[2])
+{
+  fflush(NULL);
+
+  const pid_t pid = fork();
+  if (pid != 0) {
+    return pid;
+  }
+
+  close(pipeFds[0]);
+
+  record_t record = { .index = index };
+  fly(seed, &record.result);
+
+  if (write(pipeFds[1], &record, sizeof(record)) != sizeof(record)) {
+    _exit(2);
+  }
+  _exit(0);
+}
+
+void simBatchRun(simFlight_t fly, uint64_t firstSeed, uint32_t count, int jobs, simFlightResult_t *results)
+{
+  int pipeFds[2];
+  pid_t *pids = calloc(jobs, sizeof(pid_t));
+  uint32_t next = 0;
+  int running = 0;
+
+  if (pipe(pipeFds) != 0 || pids == NULL) {
+    perror("batch");
+    exit(2);
+  }
+
+  for (uint32_t i = 0; i < count; i++) {
+    results[i] = (simFlightResult_t){ .seed = firstSeed + i, .failed = true };
+  }
+
+  while (next < count || running > 0) {
+    // Keep every job busy
+    for (int job = 0; job < jobs && next < count; job++) {
+      if (pids[job] == 0) {
+        pids[job] = launch(fly, firstSeed + next, next, pipeFds);
+        if (pids[job] < 0) {
+          perror("fork");
+          exit(2);
+        }
+        next++;
+        running++;
+      }
+    }
+
+    int status;
+    const pid_t pid = waitpid(-1, &status, 0);
+    if (pid < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("waitpid");
+      exit(2);
+    }
+
+    for (int job = 0; job < jobs; job++) {
+      if (pids[job] == pid) {
+        pids[job] = 0;
+        running--;
+      }
+    }
+
+    // The record of a flight is in the pipe before its process exits, but
+    // not necessarily the first one, so the index comes with it
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+      record_t record;
+
+      if (read(pipeFds[0], &record, sizeof(record)) == sizeof(record) && record.index < count) {
+        results[record.index] = record.result;
+      }
+    }
+  }
+
+  close(pipeFds[0]);
+  close(pipeFds[1]);
+  free(pids);
+}
+
+void simBatchWriteCsv(FILE *file, const simFlightResult_t *results, uint32_t count)
+{
+  fprintf(file, "seed,crashed,failed,time,rms,max,wind,land_error,touchdown_speed,time_to_land,holds,hold_time\n");
+
+  for (uint32_t i = 0; i < count; i++) {
+    const simFlightResult_t *r = &results[i];
+
+    fprintf(file, "%llu,%d,%d,%.3f,%.4f,%.4f,%.3f,%.4f,%.3f,%.3f,%u,%.3f\n", (unsigned long long)r->seed,
+            r->crashed, r->failed, r->time, r->rms, r->max, r->wind, r->landError, r->touchdownSpeed,
+            r->timeToLand, r->holds, r->holdTime);
+  }
+}
+
+static int compareFloats(const void *a, const void *b)
+{
+  const float x = *(const float *)a;
+  const float y = *(const float *)b;
+
+  return (x > y) - (x < y);
+}
+
+static void writeStatistics(FILE *file, const char *name, const simFlightResult_t *results, uint32_t count,
+                            size_t offset)
+{
+  float *values = malloc(count * sizeof(float));
+  uint32_t n = 0;
+  double sum = 0;
+
+  for (uint32_t i = 0; i < count; i++) {
+    const float value = *(const float *)((const char *)&results[i] + offset);
+
+    if (!results[i].failed && isfinite(value)) {
+      values[n++] = value;
+      sum += value;
+    }
+  }
+
+  if (n == 0) {
+    fprintf(file, "%-16s %9s\n", name, "-");
+  } else {
+    qsort(values, n, sizeof(float), compareFloats);
+    fprintf(file, "%-16s %9.4f %9.4f %9.4f %9.4f %6u\n", name, sum / n, values[n / 2],
+            values[(uint32_t)(0.95f * (n - 1) + 0.5f)], values[n - 1], n);
+  }
+
+  free(values);
+}
+
+void simBatchWriteSummary(FILE *file, const simFlightResult_t *results, uint32_t count, double wallTime)
+{
+  uint32_t crashed = 0;
+  uint32_t failed = 0;
+  uint32_t holds = 0;
+  double simTime = 0;
+
+  for (uint32_t i = 0; i < count; i++) {
+    crashed += results[i].crashed && !results[i].failed;
+    failed += results[i].failed;
+    holds += results[i].failed ? 0 : results[i].holds;
+    simTime += results[i].failed ? 0 : results[i].time;
+  }
+
+  fprintf(file, "flights=%u crashed=%u failed=%u holds=%u speedup=%.1f\n", count, crashed, failed, holds,
+          wallTime > 0 ? simTime / wallTime : 0.0);
+  fprintf(file, "%-16s %9s %9s %9s %9s %6s\n", "", "mean", "p50", "p95", "max", "n");
+  writeStatistics(file, "rms", results, count, offsetof(simFlightResult_t, rms));
+  writeStatistics(file, "max", results, count, offsetof(simFlightResult_t, max));
+  writeStatistics(file, "wind", results, count, offsetof(simFlightResult_t, wind));
+  writeStatistics(file, "land_error", results, count, offsetof(simFlightResult_t, landError));
+  writeStatistics(file, "touchdown_speed", results, count, offsetof(simFlightResult_t, touchdownSpeed));
+  writeStatistics(file, "time_to_land", results, count, offsetof(simFlightResult_t, timeToLand));
+  writeStatistics(file, "hold_time", results, count, offsetof(simFlightResult_t, holdTime));
+}
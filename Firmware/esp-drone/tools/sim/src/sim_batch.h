@@ -0,0 +1,43 @@
+/*
+ * sim_batch.h - Monte Carlo batches of simulated flights
+ *
+ * The flight stack keeps its state in file scope variables, so a flight owns
+ * the whole process. A batch forks one process per flight, before the
+ * firmware is started, and keeps as many of them running as there are jobs.
+ * Each one sends back its result through a pipe as it exits.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+typedef struct {
+  uint64_t seed;
+  bool crashed;
+  bool failed;          // The process died before the end of the flight, nothing else is valid
+  float time;           // s, simulated
+  float rms;            // m, tracking error after the takeoff and before the landing
+  float max;            // m
+  float pos[3];     // m, where the flight ended
+  float wind;           // m/s, mean wind speed
+  float landError;      // m, horizontal distance from where the landing started to the touchdown
+  float touchdownSpeed; // m/s, vertical
+  float timeToLand;     // s, from the autonav safety timeout to the touchdown, NAN without one
+  float holdTime;       // s, in total held in front of obstacles
+  uint16_t holds;
+  double hostTime;      // s, spent computing the flight
+} simFlightResult_t;
+
+typedef void (*simFlight_t)(uint64_t seed, simFlightResult_t *result);
+
+// Fly seeds firstSeed to firstSeed + count - 1 on at most jobs processes, in
+// results[0] to results[count - 1]
+void simBatchRun(simFlight_t fly, uint64_t firstSeed, uint32_t count, int jobs, simFlightResult_t *results);
+
+// One csv row per flight
+void simBatchWriteCsv(FILE *file, const simFlightResult_t *results, uint32_t count);
+
+// Mean, median, 95th percentile and maximum of every metric
+void simBatchWriteSummary(FILE *file, const simFlightResult_t *results, uint32_t count, double wallTime);
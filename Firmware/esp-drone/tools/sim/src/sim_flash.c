@@ -0,0 +1,130 @@
+/*
+ * sim_flash.c - Data partitions of the host simulator, in RAM
+ *
+ * Only the partitions listed below exist, the others are not found, as on a
+ * drone flashed without them. They start erased, and like the flash a write
+ * only clears bits, an erase sets whole sectors back to 0xff.
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_partition.h"
+
+#define SIM_FLASH_SECTOR_SIZE 4096
+
+typedef struct {
+  esp_partition_t partition;
+  uint8_t *data;
+} simPartition_t;
+
+static simPartition_t partitions[] = {
+  // The kve partition of storage.c
+  { .partition = { .type = 0x40, .subtype = 0x02, .size = 64 * 1024, .label = "kve" } },
+  // The traj partition of crtp_commander_high_level.c
+  { .partition = { .type = 0x40, .subtype = 0x01, .size = 64 * 1024, .label = "traj" } },
+  // The flightrec partition of flight_recorder.c
+  { .partition = { .type = 0x40, .subtype = 0x00, .size = 256 * 1024, .label = "flightrec" } },
+};
+
+#define PARTITION_COUNT (sizeof(partitions) / sizeof(partitions[0]))
+
+static simPartition_t *partitionOf(const esp_partition_t *partition)
+{
+  for (size_t i = 0; i < PARTITION_COUNT; i++) {
+    if (&partitions[i].partition == partition) {
+      return &partitions[i];
+    }
+  }
+
+  return NULL;
+}
+
+static bool isInRange(const esp_partition_t *partition, size_t offset, size_t size)
+{
+  return offset <= partition->size && size <= partition->size - offset;
+}
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char *label)
+{
+  for (size_t i = 0; i < PARTITION_COUNT; i++) {
+    simPartition_t *p = &partitions[i];
+
+    if (p->partition.type != type || p->partition.subtype != subtype ||
+        (label && strcmp(p->partition.label, label) != 0)) {
+      continue;
+    }
+
+    if (p->data == NULL) {
+      p->partition.erase_size = SIM_FLASH_SECTOR_SIZE;
+      p->data = malloc(p->partition.size);
+      if (p->data == NULL) {
+        return NULL;
+      }
+      memset(p->data, 0xff, p->partition.size);
+    }
+
+    return &p->partition;
+  }
+
+  return NULL;
+}
+
+esp_err_t esp_partition_mmap(const esp_partition_t *partition, size_t offset, size_t size,
+                             esp_partition_mmap_memory_t memory, const void **out, esp_partition_mmap_handle_t *handle)
+{
+  simPartition_t *p = partitionOf(partition);
+
+  if (p == NULL || !isInRange(partition, offset, size)) {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  *out = p->data + offset;
+  *handle = 0;
+
+  return ESP_OK;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t offset, void *dst, size_t size)
+{
+  simPartition_t *p = partitionOf(partition);
+
+  if (p == NULL || !isInRange(partition, offset, size)) {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  memcpy(dst, p->data + offset, size);
+
+  return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t offset, const void *src, size_t size)
+{
+  simPartition_t *p = partitionOf(partition);
+  const uint8_t *bytes = src;
+
+  if (p == NULL || !isInRange(partition, offset, size)) {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  for (size_t i = 0; i < size; i++) {
+    p->data[offset + i] &= bytes[i];
+  }
+
+  return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size)
+{
+  simPartition_t *p = partitionOf(partition);
+
+  if (p == NULL || !isInRange(partition, offset, size) ||
+      offset % SIM_FLASH_SECTOR_SIZE != 0 || size % SIM_FLASH_SECTOR_SIZE != 0) {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  memset(p->data + offset, 0xff, size);
+
+  return ESP_OK;
+}
@@ -0,0 +1,287 @@
+/*
+ * sim_hal.c - Drivers of the host simulator
+ *
+ * The sensors hand out the sample of the current tick, the motors keep the
+ * last ratios for the model and the time is the virtual clock. CRTP runs
+ * over sim_link.c.
+ */
+
+#include <execinfo.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
+#include "esp_timer.h"
+
+#include "sensors.h"
+#include "motors.h"
+#include "platform.h"
+#include "pm_esplane.h"
+#include "system.h"
+#include "cfassert.h"
+#include "usec_time.h"
+
+#include "sim_os.h"
+#include "sim_hal.h"
+
+// Like the IMU driver, the stabilizer only starts once the gyro bias is
+// known, well after every other task is waiting for it
+#define CALIBRATION_TICKS 200
+
+static esp_log_level_t logLevel = ESP_LOG_WARN;
+
+static SemaphoreHandle_t dataReady;
+static Axis3f gyroSample;
+static Axis3f accSample;
+static baro_t baroSample;
+static bool gyroFresh;
+static bool accFresh;
+static bool baroFresh;
+
+static uint16_t frontRange = UINT16_MAX;
+
+static uint16_t motorRatios[NBR_OF_MOTORS];
+
+static bool isStarted;
+static bool isArmed = true;
+static bool canFly;
+
+void simHalSetImu(const float gyro[3], const float acc[3], float asl)
+{
+  gyroSample = (Axis3f){ .x = gyro[0], .y = gyro[1], .z = gyro[2] };
+  accSample = (Axis3f){ .x = acc[0], .y = acc[1], .z = acc[2] };
+  baroSample = (baro_t){ .pressure = 1013.25f, .temperature = 25.0f, .asl = asl };
+  gyroFresh = accFresh = baroFresh = true;
+
+  if (dataReady) {
+    xSemaphoreGive(dataReady);
+  }
+}
+
+void simHalSetFrontRange(uint16_t rangeMm)
+{
+  frontRange = rangeMm;
+}
+
+void simHalGetMotorRatios(uint16_t ratios[4])
+{
+  memcpy(ratios, motorRatios, sizeof(motorRatios));
+}
+
+void simHalSetLogLevel(esp_log_level_t level)
+{
+  logLevel = level;
+}
+
+void simLog(esp_log_level_t level, const char *tag, const char *format, ...)
+{
+  if (level > logLevel) {
+    return;
+  }
+
+  va_list args;
+  va_start(args, format);
+  fprintf(stderr, "[%8.3f] %s: ", simOsTimeUs() / 1e6, tag);
+  vfprintf(stderr, format, args);
+  va_end(args);
+}
+
+void assertFail(char *exp, char *file, int line)
+{
+  void *frames[32];
+
+  fprintf(stderr, "Assert failed %s:%d: %s\n", file, line, exp);
+  backtrace_symbols_fd(frames, backtrace(frames, 32), 2);
+  abort();
+}
+
+int64_t esp_timer_get_time(void)
+{
+  return simOsTimeUs();
+}
+
+uint64_t usecTimestamp(void)
+{
+  return simOsTimeUs();
+}
+
+// Sensors
+
+void sensorsInit(void)
+{
+  if (dataReady == NULL) {
+    dataReady = xSemaphoreCreateBinary();
+  }
+}
+
+bool sensorsTest(void)
+{
+  return true;
+}
+
+bool sensorsAreCalibrated(void)
+{
+  return xTaskGetTickCount() >= CALIBRATION_TICKS;
+}
+
+void sensorsAcquire(sensorData_t *sensors, const uint32_t tick)
+{
+  sensorsReadGyro(&sensors->gyro);
+  sensorsReadAcc(&sensors->acc);
+  sensorsReadBaro(&sensors->baro);
+  sensors->interruptTimestamp = simOsTimeUs();
+}
+
+void sensorsWaitDataReady(void)
+{
+  xSemaphoreTake(dataReady, portMAX_DELAY);
+}
+
+bool sensorsReadGyro(Axis3f *gyro)
+{
+  const bool fresh = gyroFresh;
+
+  *gyro = gyroSample;
+  gyroFresh = false;
+
+  return fresh;
+}
+
+uint64_t sensorsGyroTimestamp(void)
+{
+  return simOsTimeUs();
+}
+
+bool sensorsReadAcc(Axis3f *acc)
+{
+  const bool fresh = accFresh;
+
+  *acc = accSample;
+  accFresh = false;
+
+  return fresh;
+}
+
+bool sensorsReadMag(Axis3f *mag)
+{
+  return false;
+}
+
+bool sensorsReadBaro(baro_t *baro)
+{
+  const bool fresh = baroFresh;
+
+  *baro = baroSample;
+  baroFresh = false;
+
+  return fresh;
+}
+
+void sensorsSetAccMode(accModes accMode)
+{
+}
+
+bool sensorsGetFrontTofMm(uint16_t *rangeMm)
+{
+  *rangeMm = frontRange;
+  return true;
+}
+
+// Motors
+
+const uint16_t testsound[NBR_OF_MOTORS] = { 0 };
+
+static const MotorPerifDef simMotor = { .drvType = BRUSHED };
+static const MotorPerifDef *simMotorMap[NBR_OF_MOTORS] = { &simMotor, &simMotor, &simMotor, &simMotor };
+
+const MotorPerifDef **platformConfigGetMotorMapping()
+{
+  return simMotorMap;
+}
+
+// What platformservice.c tells the clients
+const char *V_STAG = "sim";
+
+const char *platformConfigGetDeviceTypeName()
+{
+  return "ESP_Drone_sim";
+}
+
+void motorsInit(const MotorPerifDef **motorMapSelect)
+{
+}
+
+bool motorsTest(void)
+{
+  return true;
+}
+
+void motorsSetRatio(uint32_t id, uint16_t ratio)
+{
+  if (id < NBR_OF_MOTORS) {
+    motorRatios[id] = ratio;
+  }
+}
+
+void motorsSetRatios(const uint16_t ratios[NBR_OF_MOTORS])
+{
+  memcpy(motorRatios, ratios, sizeof(motorRatios));
+}
+
+int motorsGetRatio(uint32_t id)
+{
+  return id < NBR_OF_MOTORS ? motorRatios[id] : 0;
+}
+
+void motorsBeep(int id, bool enable, uint16_t frequency, uint16_t ratio)
+{
+}
+
+float pmGetBatteryVoltage(void)
+{
+  return 4.0f;
+}
+
+// System
+
+void systemStart()
+{
+  isStarted = true;
+}
+
+void systemWaitStart(void)
+{
+  while (!isStarted) {
+    vTaskDelay(1);
+  }
+}
+
+void systemSetCanFly(bool val)
+{
+  canFly = val;
+}
+
+bool systemCanFly(void)
+{
+  return canFly;
+}
+
+void systemSetArmed(bool val)
+{
+  isArmed = val;
+}
+
+bool systemIsArmed()
+{
+  return isArmed;
+}
+
+// autonav_crtp.c does not build for the host, the AutoNav port stays closed
+
+void autonav_crtp_start(void)
+{
+}
@@ -0,0 +1,27 @@
+/*
+ * sim_hal.h - Drivers of the host simulator
+ *
+ * Stand-ins for the sensor, motor and system drivers the flight stack links
+ * against. The simulation loop writes a new IMU sample every tick and reads
+ * back the motor ratios the stabilizer set.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_log.h"
+
+// Publish the IMU sample of this tick and release the stabilizer loop.
+// gyro in deg/s and acc in Gs, body frame, asl in m
+void simHalSetImu(const float gyro[3], const float acc[3], float asl);
+
+// Range of the front ranger in mm, UINT16_MAX when nothing is in range
+void simHalSetFrontRange(uint16_t rangeMm);
+
+// Motor ratios last set by the power distribution, 0..65535
+void simHalGetMotorRatios(uint16_t ratios[4]);
+
+// Lowest level printed by the firmware debug messages
+void simHalSetLogLevel(esp_log_level_t level);
@@ -0,0 +1,354 @@
+/*
+ * sim_link.c - CRTP link of the host simulator over localhost UDP
+ *
+ * The datagrams are those of wifi_esp32.c, a CRTP packet and a checksum,
+ * and the link control of WIFI_CTRL_HEADER: echo requests are answered with
+ * the virtual time, sequence numbers are dropped, and batching is refused,
+ * so every packet goes out in a datagram of its own. Large frames are
+ * accepted up to CRTP_LARGE_MAX_DATA_SIZE. There is a single client, the
+ * address the last datagram came from.
+ *
+ * The socket never blocks. The simulation loop polls it once per tick, the
+ * packets of the direct ports are dispatched right away as by wifilink.c,
+ * the others are queued for the CRTP receive task. A linked simulation runs
+ * at the pace of the host clock, see sim_main.c, or cflib would time out.
+ *
+ * Without a port the client is the simulation loop itself, which hands its
+ * packets over with simLinkSendFromClient() and only gets the downlink
+ * counted. Either way simLinkSetImpairment() loses datagrams both ways and
+ * delays those to the drone.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+
+#include "crtp.h"
+#include "stm32_legacy.h"
+#include "log.h"
+#include "wifi_esp32.h"
+#include "link_capture.h"
+
+#include "sim_link.h"
+#include "sim_os.h"
+
+#define SIM_LINK_RX_QUEUE_SIZE 16
+#define SIM_LINK_ACTIVITY_TIMEOUT_MS 1000
+// Datagrams of the client on their way to the drone
+#define SIM_LINK_DELAY_LINE_SIZE 64
+
+typedef struct {
+  uint32_t dueTick;
+  uint8_t len;
+  uint8_t data[WIFI_RX_TX_PACKET_SIZE];
+} delayedDatagram_t;
+
+static int sock = -1;
+static struct sockaddr_in client;
+static bool hasClient;
+static uint16_t maxDataSize;
+static uint32_t lastPacketTick;
+static xQueueHandle rxQueue;
+
+static float lossRatio;
+static uint32_t maxDelayTicks;
+static float (*impairmentUniform)(void);
+static void (*clientReceiver)(const uint8_t *raw, size_t size);
+static delayedDatagram_t delayLine[SIM_LINK_DELAY_LINE_SIZE];
+static uint32_t delayHead;
+static uint32_t delayCount;
+
+static uint32_t rxCount;
+static uint32_t txCount;
+static uint32_t droppedCount;
+static uint32_t lostCount;
+
+static uint8_t checksum(const uint8_t *data, size_t len)
+{
+  uint8_t sum = 0;
+
+  for (size_t i = 0; i < len; i++) {
+    sum += data[i];
+  }
+
+  return sum;
+}
+
+static bool isLost(void)
+{
+  if (lossRatio > 0 && impairmentUniform() < lossRatio) {
+    lostCount++;
+    return true;
+  }
+
+  return false;
+}
+
+static void sendDatagram(uint8_t *buffer, size_t len)
+{
+  if (!hasClient || isLost()) {
+    return;
+  }
+
+  buffer[len] = checksum(buffer, len);
+  if (sock < 0) {
+    txCount++;
+    if (clientReceiver) {
+      clientReceiver(buffer, len);
+    }
+  } else if (sendto(sock, buffer, len + 1, MSG_DONTWAIT, (struct sockaddr *)&client, sizeof(client)) == (ssize_t)(len + 1)) {
+    txCount++;
+  }
+}
+
+/* Answers the link control datagrams, false for the null packets of cflib */
+static bool handleLinkControl(const uint8_t *data, size_t len)
+{
+  if (len >= 3 && data[1] == WIFI_CTRL_BATCH) {
+    // One packet per datagram, both formats are fine with the clients
+    uint8_t ack[4] = { WIFI_CTRL_HEADER, WIFI_CTRL_BATCH, 0 };
+
+    sendDatagram(ack, 3);
+    return true;
+  }
+
+  if (len >= 2 && data[1] == WIFI_CTRL_ECHO && len <= 2 + WIFI_CTRL_ECHO_MAX_PAYLOAD) {
+    uint8_t reply[2 + WIFI_CTRL_ECHO_MAX_PAYLOAD + sizeof(uint32_t) + 1];
+    const uint32_t timestamp = (uint32_t)simOsTimeUs();
+
+    memcpy(reply, data, len);
+    memcpy(&reply[len], &timestamp, sizeof(timestamp));
+    sendDatagram(reply, len + sizeof(timestamp));
+    return true;
+  }
+
+  if (len >= 4 && data[1] == WIFI_CTRL_LARGE) {
+    const uint16_t requested = data[2] | (data[3] << 8);
+    uint8_t ack[5] = { WIFI_CTRL_HEADER, WIFI_CTRL_LARGE };
+
+    maxDataSize = requested < CRTP_LARGE_MAX_DATA_SIZE ? requested : CRTP_LARGE_MAX_DATA_SIZE;
+    if (maxDataSize <= CRTP_MAX_DATA_SIZE) {
+      maxDataSize = 0;
+    }
+    ack[2] = maxDataSize & 0xFF;
+    ack[3] = maxDataSize >> 8;
+    sendDatagram(ack, 4);
+    return true;
+  }
+
+  maxDataSize = 0;
+  return false;
+}
+
+static void receiveDatagram(uint8_t *data, size_t len)
+{
+  CRTPPacket packet;
+
+  if (len < 2 || checksum(data, len - 1) != data[len - 1]) {
+    droppedCount++;
+    return;
+  }
+  len--;
+
+  if (data[0] == WIFI_CTRL_HEADER) {
+    if (len >= 4 && data[1] == WIFI_CTRL_SEQ) {
+      data += 3;
+      len -= 3;
+    } else if (handleLinkControl(data, len)) {
+      return;
+    }
+  }
+
+  if (len > sizeof(packet.raw)) {
+    droppedCount++;
+    return;
+  }
+
+  memcpy(packet.raw, data, len);
+  packet.size = len - 1;
+  lastPacketTick = xTaskGetTickCount();
+  rxCount++;
+  linkCapturePacket(lcRx, packet.raw, packet.size);
+
+  if (crtpIsPortDirect(packet.port)) {
+    crtpDispatchDirect(&packet);
+  } else if (xQueueSend(rxQueue, &packet, 0) != pdTRUE) {
+    droppedCount++;
+  }
+}
+
+// Into the delay line, in the order they were sent
+static void uplink(const uint8_t *data, size_t len)
+{
+  if (isLost()) {
+    return;
+  }
+  if (delayCount == SIM_LINK_DELAY_LINE_SIZE || len > WIFI_RX_TX_PACKET_SIZE) {
+    droppedCount++;
+    return;
+  }
+
+  const uint32_t now = xTaskGetTickCount();
+  uint32_t dueTick = now + (maxDelayTicks > 0 ? (uint32_t)(impairmentUniform() * (maxDelayTicks + 1)) : 0);
+  if (delayCount > 0) {
+    const delayedDatagram_t *last = &delayLine[(delayHead + delayCount - 1) % SIM_LINK_DELAY_LINE_SIZE];
+    if ((int32_t)(last->dueTick - dueTick) > 0) {
+      dueTick = last->dueTick;
+    }
+  }
+
+  delayedDatagram_t *datagram = &delayLine[(delayHead + delayCount) % SIM_LINK_DELAY_LINE_SIZE];
+  datagram->dueTick = dueTick;
+  datagram->len = len;
+  memcpy(datagram->data, data, len);
+  delayCount++;
+}
+
+void simLinkPoll(void)
+{
+  uint8_t buffer[WIFI_RX_TX_PACKET_SIZE];
+  struct sockaddr_in source;
+  socklen_t sourceLen = sizeof(source);
+  ssize_t len;
+
+  while (sock >= 0 && (len = recvfrom(sock, buffer, sizeof(buffer), MSG_DONTWAIT, (struct sockaddr *)&source, &sourceLen)) >= 0) {
+    client = source;
+    hasClient = true;
+    uplink(buffer, len);
+    sourceLen = sizeof(source);
+  }
+
+  const uint32_t now = xTaskGetTickCount();
+  while (delayCount > 0 && (int32_t)(now - delayLine[delayHead].dueTick) >= 0) {
+    delayedDatagram_t *datagram = &delayLine[delayHead];
+
+    delayHead = (delayHead + 1) % SIM_LINK_DELAY_LINE_SIZE;
+    delayCount--;
+    receiveDatagram(datagram->data, datagram->len);
+  }
+}
+
+void simLinkSendFromClient(const uint8_t *raw, uint8_t size)
+{
+  uint8_t datagram[WIFI_RX_TX_PACKET_SIZE];
+
+  if (size + 1 > WIFI_RX_TX_PACKET_SIZE) {
+    droppedCount++;
+    return;
+  }
+
+  memcpy(datagram, raw, size);
+  datagram[size] = checksum(raw, size);
+  hasClient = true;
+  uplink(datagram, size + 1);
+}
+
+void simLinkSetClientReceiver(void (*receive)(const uint8_t *raw, size_t size))
+{
+  clientReceiver = receive;
+}
+
+void simLinkSetImpairment(float loss, uint32_t maxDelayMs, float (*uniform)(void))
+{
+  lossRatio = loss;
+  maxDelayTicks = M2T(maxDelayMs);
+  impairmentUniform = uniform;
+}
+
+static int simLinkSendPacket(CRTPPacket *p)
+{
+  uint8_t buffer[CRTP_MAX_DATA_SIZE + 2];
+
+  linkCapturePacket(lcTx, p->raw, p->size);
+  memcpy(buffer, p->raw, p->size + 1);
+  sendDatagram(buffer, p->size + 1);
+
+  return true;
+}
+
+static uint16_t simLinkGetMaxDataSize(void)
+{
+  return maxDataSize > CRTP_MAX_DATA_SIZE ? maxDataSize : CRTP_MAX_DATA_SIZE;
+}
+
+static int simLinkSendLargePacket(uint8_t header, const uint8_t *data, uint16_t size)
+{
+  static uint8_t buffer[1 + CRTP_LARGE_MAX_DATA_SIZE + 1];
+
+  if (size > maxDataSize) {
+    return false;
+  }
+
+  buffer[0] = header;
+  memcpy(&buffer[1], data, size);
+  sendDatagram(buffer, 1 + size);
+
+  return true;
+}
+
+static int simLinkReceivePacket(CRTPPacket *p)
+{
+  if (xQueueReceive(rxQueue, p, M2T(100)) != pdTRUE) {
+    return -1;
+  }
+
+  linkCapturePacket(lcDequeued, p->raw, p->size);
+  return 0;
+}
+
+static bool simLinkIsConnected(void)
+{
+  return hasClient && (xTaskGetTickCount() - lastPacketTick) < M2T(SIM_LINK_ACTIVITY_TIMEOUT_MS);
+}
+
+static int simLinkSetEnable(bool enable)
+{
+  return 0;
+}
+
+static struct crtpLinkOperations simLinkOp = {
+  .setEnable         = simLinkSetEnable,
+  .sendPacket        = simLinkSendPacket,
+  .receivePacket     = simLinkReceivePacket,
+  .isConnected       = simLinkIsConnected,
+  .getMaxDataSize    = simLinkGetMaxDataSize,
+  .sendLargePacket   = simLinkSendLargePacket,
+};
+
+bool simLinkInit(uint16_t port)
+{
+  struct sockaddr_in address = {
+    .sin_family = AF_INET,
+    .sin_port = htons(port),
+    .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+  };
+
+  if (port != 0) {
+    sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0 || bind(sock, (struct sockaddr *)&address, sizeof(address)) < 0) {
+      fprintf(stderr, "sim: link on port %u: %s\n", port, strerror(errno));
+      return false;
+    }
+  }
+
+  rxQueue = xQueueCreate(SIM_LINK_RX_QUEUE_SIZE, sizeof(CRTPPacket));
+  vQueueAddToRegistry(rxQueue, "simLinkRx");
+  crtpSetLink(&simLinkOp);
+
+  return true;
+}
+
+LOG_GROUP_START(simLink)
+LOG_ADD(LOG_UINT32, rx, &rxCount)
+LOG_ADD(LOG_UINT32, tx, &txCount)
+LOG_ADD(LOG_UINT32, dropped, &droppedCount)
+LOG_ADD(LOG_UINT32, lost, &lostCount)
+LOG_GROUP_STOP(simLink)
@@ -0,0 +1,32 @@
+/*
+ * sim_link.h - CRTP link of the host simulator over localhost UDP
+ *
+ * Speaks the datagrams of wifi_esp32.c, so the Controller and cflib connect
+ * to the simulator like to the drone, at udp://127.0.0.1:2390.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SIM_LINK_DEFAULT_PORT 2390
+
+// Open the socket and make it the CRTP link, false if the port is taken.
+// Port 0 opens none, the simulation loop is the client.
+bool simLinkInit(uint16_t port);
+
+// Hand the datagrams that arrived since the last call to CRTP, once per tick
+void simLinkPoll(void);
+
+// Send a CRTP packet, header and data, from the client of a link without a port
+void simLinkSendFromClient(const uint8_t *raw, uint8_t size);
+
+// Hand the CRTP packets to the client of a link without a port, header and
+// data, as they are sent. NULL drops them.
+void simLinkSetClientReceiver(void (*receive)(const uint8_t *raw, size_t size));
+
+// Lose the given ratio of the datagrams both ways, and delay those to the
+// drone by 0 to maxDelayMs without reordering them. uniform is in [0, 1).
+void simLinkSetImpairment(float loss, uint32_t maxDelayMs, float (*uniform)(void));
@@ -0,0 +1,1410 @@
+/*
+ * sim_main.c - Software in the loop simulator of the flight stack
+ *
+ * Runs the stabilizer, the estimators, the controllers, the commanders and
+ * the power distribution of the firmware against sim_quad.c on a virtual
+ * 1 kHz tick. Each tick the model integrates the motor ratios of the last
+ * loop, the IMU sample is published and every firmware task runs until it
+ * blocks again, then the tick advances. Nothing waits on the host clock, a
+ * flight takes as long as the host needs to compute it, and the same
+ * options always give the same flight.
+ *
+ * With --link the Controller or any cflib client connects over
+ * sim_link.c and flies the drone instead of a scenario, and the loop keeps
+ * pace with the host clock.
+ *
+ * The logging, lossy and recorder scenarios are flown by a client inside the
+ * loop, over sim_link.c without a socket: the first logs full blocks, the
+ * second streams position setpoints over a link that loses and delays
+ * datagrams, the third reads back what the flight recorder recorded of a
+ * hover through its memory.
+ *
+ * With --trace the inputs of the kalman core are written to a file for
+ * replay_main.c, see kalman_trace.h. With --report what the flight cost the
+ * flight stack is written as JSON for perf.py, see sim_perf.h.
+ *
+ * At the end one line of key=value metrics is printed on stdout for
+ * sweep.py and other scripts. With --batch the flights of consecutive seeds
+ * run in parallel processes, see sim_batch.c, and a summary of their metrics
+ * is printed instead.
+ */
+
+#include <getopt.h>
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "system.h"
+#include "config.h"
+#include "crtp.h"
+#include "console.h"
+#include "worker.h"
+#include "crtpservice.h"
+#include "platformservice.h"
+#include "param.h"
+#include "mem.h"
+#include "flight_recorder.h"
+#include "power_save.h"
+#include "commander.h"
+#include "crtp_commander_high_level.h"
+#include "estimator.h"
+#include "estimator_kalman.h"
+#include "kalman_trace.h"
+#include "link_capture.h"
+#include "time_sync.h"
+#include "stabilizer.h"
+#include "range.h"
+#include "autonav.h"
+#include "autonav_mission.h"
+#include "log.h"
+
+#include "sim_batch.h"
+#include "sim_os.h"
+#include "sim_hal.h"
+#include "sim_link.h"
+#include "sim_perf.h"
+#include "sim_quad.h"
+#include "sim_vars.h"
+
+#define SIM_DT 0.001f
+#define GRAVITY 9.81f
+
+#define MOCAP_PERIOD_TICKS 10
+#define TOF_PERIOD_TICKS 25
+#define TOF_MAX_RANGE 4.0f
+#define FLOW_PERIOD_TICKS 10
+#define FLOW_MIN_HEIGHT 0.1f
+#define FLOW_STD_DEV 2.0f // pixels, as the flow deck tells the estimator
+#define CSV_PERIOD_TICKS 10
+
+// Noise of the sensors at --noise 1, one standard deviation
+#define GYRO_NOISE_DEG   0.1f
+#define ACC_NOISE_G      0.003f
+#define BARO_NOISE_M     0.2f
+#define MOCAP_NOISE_M    0.001f
+#define TOF_NOISE_M      0.002f
+#define FLOW_NOISE_PX    0.5f
+
+// Gusts on top of the mean wind, one standard deviation over the mean speed
+// and correlation time
+#define GUST_RATIO       0.3f
+#define GUST_TAU         2.0f
+
+#define MAX_PARAMS 64
+#define MAX_LOG_COLUMNS 32
+
+typedef enum {
+  scenarioHover,
+  scenarioStep,
+  scenarioSquare,
+  scenarioAggressive,
+  scenarioFlowHold,
+  scenarioLogging,
+  scenarioLossy,
+  scenarioAutonav,
+  scenarioRecorder,
+  scenarioIdleYaw,
+  scenarioLink,
+} scenario_t;
+
+// The names of -s, --link is the link scenario
+static const char *const scenarioNames[] = {
+  [scenarioHover] = "hover",
+  [scenarioStep] = "step",
+  [scenarioSquare] = "square",
+  [scenarioAggressive] = "aggressive",
+  [scenarioFlowHold] = "flowhold",
+  [scenarioLogging] = "logging",
+  [scenarioLossy] = "lossy",
+  [scenarioAutonav] = "autonav",
+  [scenarioRecorder] = "recorder",
+  [scenarioIdleYaw] = "idleyaw",
+  [scenarioLink] = "link",
+};
+
+static struct {
+  float duration;
+  float height;
+  scenario_t scenario;
+  uint8_t shape;
+  uint8_t mission[AUTONAV_MISSION_SIZE];
+  size_t missionSize;
+  uint64_t seed;
+  float noise;
+  float wind;
+  bool mocap;
+  bool flow;
+  uint32_t batch;
+  int jobs;
+  uint16_t linkPort;
+  float pace;
+  float loss;
+  int delayMs;
+  const char *csvPath;
+  const char *tracePath;
+  const char *reportPath;
+  const char *params[MAX_PARAMS];
+  int paramCount;
+  const char *logs[MAX_LOG_COLUMNS];
+  int logCount;
+  simQuadParams_t model;
+} options = {
+  .height = 0.5f,
+  .scenario = scenarioHover,
+  .shape = AUTONAV_SHAPE_SQUARE,
+  .seed = 1,
+  .noise = 1.0f,
+  .mocap = true,
+  .pace = 1.0f,
+  .loss = -1.0f,
+  .delayMs = -1,
+};
+
+// Set by SIGINT, ends the flight with its metrics
+static volatile sig_atomic_t isInterrupted;
+
+static uint64_t rngState;
+
+static float uniform(void)
+{
+  // xorshift64*, the same sequence on every host
+  rngState ^= rngState >> 12;
+  rngState ^= rngState << 25;
+  rngState ^= rngState >> 27;
+
+  return ((rngState * 0x2545F4914F6CDD1DULL) >> 40) / (float)(1 << 24);
+}
+
+static float normal(void)
+{
+  const float u = uniform() + 1e-9f;
+  const float v = uniform();
+
+  return sqrtf(-2.0f * logf(u)) * cosf(2.0f * (float)M_PI * v);
+}
+
+static float gaussian(float stdDev)
+{
+  return stdDev * options.noise * normal();
+}
+
+// The client of the recorder scenario starts a recording on the ground once
+// the commander is idle, see stabilizerIsFlying(), and takes off when it
+// runs. RECORDER_STOP_TIME after the touchdown it stops the recording and
+// reads it back, RECORDER_READ_LEN a request, the flight lasts until then.
+#define RECORDER_START         (POWER_SAVE_IDLE_DELAY_MS / 1000.0f + 0.5f)
+#define RECORDER_TAKEOFF_START (RECORDER_START + 0.5f)
+#define RECORDER_STOP_TIME     0.5f
+#define RECORDER_READ_LEN      24
+#define RECORDER_REPLY_TIMEOUT_TICKS 100
+
+// The drone of the idleyaw scenario stays on the ground and is turned by hand
+// once the stabilizer is idle, see powerSaveTick(). On the thinned loops the
+// complementary estimator has to follow the heading within IDLE_YAW_TOLERANCE.
+#define IDLE_YAW_START     (POWER_SAVE_IDLE_DELAY_MS / 1000.0f + 0.5f)
+#define IDLE_YAW_TIME      2.0f
+#define IDLE_YAW_RATE      90.0f // deg/s
+#define IDLE_YAW_TOLERANCE 2.0f  // deg
+
+// The flying part of each scenario starts once the takeoff is over
+#define TAKEOFF_START    (options.scenario == scenarioRecorder ? RECORDER_TAKEOFF_START : 0.5f)
+#define TAKEOFF_DURATION 2.0f
+#define SETTLE_TIME      (TAKEOFF_START + TAKEOFF_DURATION + 1.0f)
+#define LAND_DURATION    2.0f
+
+// The autonav flies its shape until the app heartbeat is lost, somewhere in
+// the first HEARTBEAT_LOSS_S, and lands SAFETY_TIMEOUT_MS later. One obstacle
+// shows up in front of the drone on the way.
+#define HEARTBEAT_PERIOD_TICKS 1000
+#define HEARTBEAT_LOSS_S       10.0f
+#define OBSTACLE_START_S       20.0f
+#define OBSTACLE_DURATION_S    4.5f
+#define OBSTACLE_MIN_S         0.5f
+#define OBSTACLE_RANGE_MM      500
+#define AUTONAV_DURATION       60.0f
+#define LANDED_TIME            1.0f
+
+// A day, a linked flight ends on SIGINT
+#define LINK_DURATION          86400.0f
+
+// The aggressive scenario flies the square faster than the position
+// controller lets the drone, which flies it saturated on its tilt and speed
+#define AGGRESSIVE_SIDE        1.0f
+#define AGGRESSIVE_LEG_TICKS   1000
+#define AGGRESSIVE_LEG_DURATION 0.8f
+
+// The client of the logging scenario starts LOG_BLOCKS full blocks of
+// floats every LOG_BLOCK_PERIOD_MS, and then only keeps the link up
+#define LOG_BLOCKS             4
+#define LOG_BLOCK_FLOATS       6
+#define LOG_BLOCK_PERIOD_MS    10
+#define KEEPALIVE_PERIOD_TICKS 100
+
+// The client of the lossy scenario streams position setpoints on a circle
+// through the start, over a link with LOSSY_LOSS and LOSSY_DELAY_MS
+#define STREAM_PERIOD_TICKS    10
+#define CIRCLE_RADIUS          0.5f
+#define CIRCLE_PERIOD          4.0f
+#define LOSSY_LOSS             0.1f
+#define LOSSY_DELAY_MS         20
+
+// Of log.c, crtp_commander.c, crtp_commander_generic.c, crtpservice.c and mem.c
+#define LOG_CONTROL_CHANNEL     1
+#define LOG_CREATE_BLOCK_V2     6
+#define LOG_START_BLOCK         3
+#define SET_SETPOINT_CHANNEL    0
+#define SETPOINT_POSITION_TYPE  7
+#define LINK_SINK_CHANNEL       2
+#define MEM_SETTINGS_CHANNEL    0
+#define MEM_READ_CHANNEL        1
+#define MEM_CMD_GET_NBR         1
+#define MEM_CMD_GET_INFO        2
+
+// What happens in this flight and what it did so far
+static struct {
+  float wind[3];
+  float gust[3];
+  uint32_t heartbeatLossTick;
+  uint32_t lastKickTick;
+  uint32_t obstacleStartTick;
+  uint32_t obstacleEndTick;
+  autonav_state_t navState;
+  uint32_t holdStartTick;
+  bool landing;
+  float landStart[2];
+  bool airborne;
+  uint32_t touchdownTick;
+  bool done;
+  float headingError;
+} flight;
+
+static float scenarioDuration(void)
+{
+  if (options.duration > 0) {
+    return options.duration;
+  }
+  if (options.scenario == scenarioLink) {
+    // Until the client is done and the simulator is interrupted
+    return LINK_DURATION;
+  }
+  if (options.scenario == scenarioRecorder) {
+    // The flight of the hover scenario after the wait on the ground
+    return 10.0f + (RECORDER_TAKEOFF_START - 0.5f);
+  }
+  if (options.scenario == scenarioIdleYaw) {
+    return IDLE_YAW_START + IDLE_YAW_TIME + 1.0f;
+  }
+  // Long enough for the autonav to lose the heartbeat and time out
+  return options.scenario == scenarioAutonav ? AUTONAV_DURATION : 10.0f;
+}
+
+static float scenarioEnd(void)
+{
+  const float duration = scenarioDuration();
+
+  // Leave time to land when the flight is long enough
+  return duration > SETTLE_TIME + LAND_DURATION + 1.0f ? duration - LAND_DURATION - 0.5f : duration;
+}
+
+static void scenarioPlan(simFlightResult_t *result)
+{
+  const float windSpeed = options.wind * uniform();
+  const float windHeading = 2.0f * (float)M_PI * uniform();
+
+  memset(&flight, 0, sizeof(flight));
+  flight.wind[0] = windSpeed * cosf(windHeading);
+  flight.wind[1] = windSpeed * sinf(windHeading);
+  result->wind = windSpeed;
+
+  const float heartbeatLoss = SETTLE_TIME + 2.0f + HEARTBEAT_LOSS_S * uniform();
+  const float obstacleStart = SETTLE_TIME + 1.0f + OBSTACLE_START_S * uniform();
+  const float obstacleDuration = OBSTACLE_MIN_S + OBSTACLE_DURATION_S * uniform();
+
+  flight.heartbeatLossTick = heartbeatLoss * configTICK_RATE_HZ;
+  flight.obstacleStartTick = obstacleStart * configTICK_RATE_HZ;
+  flight.obstacleEndTick = (obstacleStart + obstacleDuration) * configTICK_RATE_HZ;
+  flight.navState = AUTONAV_IDLE;
+}
+
+static void windUpdate(simQuadState_t *quad)
+{
+  // Ornstein-Uhlenbeck gusts around the mean wind
+  const float stdDev = GUST_RATIO * sqrtf(flight.wind[0] * flight.wind[0] + flight.wind[1] * flight.wind[1]);
+
+  for (int i = 0; i < 2; i++) {
+    flight.gust[i] += -flight.gust[i] * SIM_DT / GUST_TAU + stdDev * sqrtf(2.0f * SIM_DT / GUST_TAU) * normal();
+    quad->wind[i] = flight.wind[i] + flight.gust[i];
+  }
+}
+
+static void landingStarted(const simQuadState_t *quad)
+{
+  flight.landing = true;
+  flight.landStart[0] = quad->pos[0];
+  flight.landStart[1] = quad->pos[1];
+}
+
+static void autonavScenarioUpdate(const simQuadState_t *quad, uint32_t tick, simFlightResult_t *result)
+{
+  const uint32_t startTick = SETTLE_TIME * configTICK_RATE_HZ;
+
+  if (tick == startTick) {
+    autonavInit();
+    autonavSetTargetAltMm(options.height * 1000.0f);
+    if (options.missionSize > 0) {
+      if (!autonavMissionWrite(0, options.missionSize, options.mission) || !autonavStartMission()) {
+        fprintf(stderr, "Invalid mission\n");
+        exit(2);
+      }
+    } else {
+      autonavStartShape(options.shape);
+    }
+  }
+
+  if (tick > startTick && tick < flight.heartbeatLossTick && tick % HEARTBEAT_PERIOD_TICKS == 0) {
+    autonavKickSafety();
+    flight.lastKickTick = tick;
+  }
+
+  const bool obstacle = tick >= flight.obstacleStartTick && tick < flight.obstacleEndTick;
+  simHalSetFrontRange(obstacle ? OBSTACLE_RANGE_MM : UINT16_MAX);
+
+  // What the last tick of the autonav task did
+  const autonav_state_t state = autonavGetState();
+  if (state == AUTONAV_HOLD_OBSTACLE && flight.navState != AUTONAV_HOLD_OBSTACLE) {
+    flight.holdStartTick = tick;
+    result->holds++;
+  } else if (state != AUTONAV_HOLD_OBSTACLE && flight.navState == AUTONAV_HOLD_OBSTACLE) {
+    result->holdTime += (tick - flight.holdStartTick) * SIM_DT;
+  }
+  if ((state == AUTONAV_LANDING || state == AUTONAV_LANDED) && !flight.landing) {
+    landingStarted(quad);
+  }
+  flight.navState = state;
+}
+
+// The in-process client of the logging, lossy and recorder scenarios
+static bool hasClient(void)
+{
+  return options.scenario == scenarioLogging || options.scenario == scenarioLossy ||
+         options.scenario == scenarioRecorder;
+}
+
+static void clientSend(uint8_t port, uint8_t channel, const void *data, uint8_t size)
+{
+  uint8_t raw[1 + CRTP_MAX_DATA_SIZE];
+
+  raw[0] = CRTP_HEADER(port, channel);
+  memcpy(&raw[1], data, size);
+  simLinkSendFromClient(raw, 1 + size);
+}
+
+extern struct log_s _log_start;
+
+// The id of a variable in the TOC of the log port, variables only are counted
+static uint16_t logTocId(logVarId_t varId)
+{
+  const struct log_s *logs = &_log_start;
+  uint16_t id = 0;
+
+  for (int i = 0; i < varId; i++) {
+    if (!(logs[i].type & LOG_GROUP)) {
+      id++;
+    }
+  }
+
+  return id;
+}
+
+static void loggingClientUpdate(uint32_t tick)
+{
+  static const char *const variables[LOG_BLOCKS][LOG_BLOCK_FLOATS] = {
+    { "stateEstimate.x", "stateEstimate.y", "stateEstimate.z", "stateEstimate.vx", "stateEstimate.vy", "stateEstimate.vz" },
+    { "stateEstimate.ax", "stateEstimate.ay", "stateEstimate.az", "stateEstimate.roll", "stateEstimate.pitch", "stateEstimate.yaw" },
+    { "stateEstimate.qx", "stateEstimate.qy", "stateEstimate.qz", "stateEstimate.qw", "ctrltarget.x", "ctrltarget.y" },
+    { "acc.x", "acc.y", "acc.z", "gyro.x", "gyro.y", "gyro.z" },
+  };
+  const uint32_t startTick = SETTLE_TIME * configTICK_RATE_HZ;
+
+  if (tick == startTick) {
+    // As cflib does it, a V2 block of TOC ids and then its start
+    for (int block = 0; block < LOG_BLOCKS; block++) {
+      uint8_t create[2 + LOG_BLOCK_FLOATS * 3] = { LOG_CREATE_BLOCK_V2, block };
+
+      for (int i = 0; i < LOG_BLOCK_FLOATS; i++) {
+        char group[32];
+        char name[32];
+        logVarId_t varId;
+
+        if (sscanf(variables[block][i], "%31[^.].%31s", group, name) != 2 ||
+            !LOG_VARID_IS_VALID(varId = logGetVarId(group, name)) || logGetType(varId) != LOG_FLOAT) {
+          fprintf(stderr, "No float log variable %s\n", variables[block][i]);
+          exit(2);
+        }
+        const uint16_t tocId = logTocId(varId);
+        create[2 + 3 * i] = LOG_FLOAT;
+        memcpy(&create[3 + 3 * i], &tocId, sizeof(tocId));
+      }
+      clientSend(CRTP_PORT_LOG, LOG_CONTROL_CHANNEL, create, sizeof(create));
+
+      const uint8_t start[] = { LOG_START_BLOCK, block, LOG_BLOCK_PERIOD_MS / 10 };
+      clientSend(CRTP_PORT_LOG, LOG_CONTROL_CHANNEL, start, sizeof(start));
+    }
+  } else if (tick > startTick && (tick - startTick) % KEEPALIVE_PERIOD_TICKS == 0) {
+    // The link times out without a datagram from the client, and the log with it
+    clientSend(CRTP_PORT_LINK, LINK_SINK_CHANNEL, NULL, 0);
+  }
+}
+
+static void lossyClientUpdate(const simQuadState_t *quad, uint32_t tick)
+{
+  const uint32_t startTick = SETTLE_TIME * configTICK_RATE_HZ;
+  const uint32_t landTick = scenarioEnd() * configTICK_RATE_HZ;
+  // The last setpoints are through the link, no late one stops the landing
+  const uint32_t drainedTick = landTick + options.delayMs * configTICK_RATE_HZ / 1000 + 1;
+
+  if (tick >= startTick && tick < landTick && (tick - startTick) % STREAM_PERIOD_TICKS == 0) {
+    const float angle = 2.0f * (float)M_PI * (tick - startTick) * SIM_DT / CIRCLE_PERIOD;
+    const float setpoint[4] = {
+      CIRCLE_RADIUS * cosf(angle) - CIRCLE_RADIUS,
+      CIRCLE_RADIUS * sinf(angle),
+      options.height,
+      0.0f,
+    };
+    uint8_t data[1 + sizeof(setpoint)] = { SETPOINT_POSITION_TYPE };
+
+    memcpy(&data[1], setpoint, sizeof(setpoint));
+    clientSend(CRTP_PORT_SETPOINT_GENERIC, SET_SETPOINT_CHANNEL, data, sizeof(data));
+    simPerfSetpointSent(tick, setpoint);
+  } else if (tick == drainedTick && drainedTick < scenarioDuration() * configTICK_RATE_HZ) {
+    // Back to the high level commander, from where the setpoints left it
+    commanderNotifySetpointsStop(0);
+    crtpCommanderHighLevelLand(0.0f, LAND_DURATION);
+    landingStarted(quad);
+  }
+}
+
+// What the client of the recorder scenario read back so far
+static struct {
+  uint8_t reply[1 + CRTP_MAX_DATA_SIZE];
+  size_t replySize;
+  uint32_t requestTick;
+  uint8_t memCount;
+  uint8_t memId;
+  uint32_t size;
+  uint32_t address;   // Read back up to there
+  uint8_t *data;
+  uint32_t records;
+  bool isReading;
+  bool done;
+  const char *error;
+} recorder;
+
+static void recorderReceive(const uint8_t *raw, size_t size)
+{
+  // The memory replies only, not the console
+  if ((raw[0] >> 4) != CRTP_PORT_MEM || size > sizeof(recorder.reply)) {
+    return;
+  }
+
+  memcpy(recorder.reply, raw, size);
+  recorder.replySize = size;
+}
+
+static void recorderRequest(uint8_t channel, const void *data, uint8_t size, uint32_t tick)
+{
+  recorder.replySize = 0;
+  recorder.requestTick = tick;
+  clientSend(CRTP_PORT_MEM, channel, data, size);
+}
+
+static void recorderReadNext(uint32_t tick)
+{
+  const uint32_t left = recorder.size - recorder.address;
+  uint8_t request[6] = { recorder.memId };
+
+  memcpy(&request[1], &recorder.address, sizeof(recorder.address));
+  request[5] = left < RECORDER_READ_LEN ? left : RECORDER_READ_LEN;
+  recorderRequest(MEM_READ_CHANNEL, request, sizeof(request), tick);
+}
+
+/* What is wrong with the recording of the flight, NULL if nothing is.
+ * stateEstimate.z is the third of CONFIG_FLIGHT_RECORDER_VARIABLES, it must
+ * reach the takeoff height, give or take the overshoot. */
+static const char *recordingError(float height)
+{
+  static const char names[] = CONFIG_FLIGHT_RECORDER_VARIABLES;
+  const uint32_t divisor = RATE_MAIN_LOOP / CONFIG_FLIGHT_RECORDER_RATE_HZ;
+  const uint32_t startTick = RECORDER_START * configTICK_RATE_HZ;
+  flightRecorderHeader_t header;
+  float maxZ = 0.0f;
+
+  if (recorder.size < FLIGHT_REC_DATA_OFFSET) {
+    return "The recording is shorter than its header";
+  }
+  memcpy(&header, recorder.data, sizeof(header));
+  if (header.magic != FLIGHT_REC_MAGIC || header.version != FLIGHT_REC_VERSION) {
+    return "The flight recorder memory holds no recording";
+  }
+  if (header.variablesCount != 4 || header.recordSize != 4 + 4 * header.variablesCount ||
+      header.namesLength != strlen(names) ||
+      memcmp(&recorder.data[FLIGHT_REC_NAMES_OFFSET], names, sizeof(names)) != 0) {
+    return "The recording is of other variables";
+  }
+  if (header.rateHz != CONFIG_FLIGHT_RECORDER_RATE_HZ || header.startTick < startTick ||
+      header.startTick > startTick + configTICK_RATE_HZ / 10) {
+    return "The recording did not start on the ground";
+  }
+  if (header.recordsCount == 0 || header.droppedCount != 0 ||
+      FLIGHT_REC_DATA_OFFSET + header.recordsCount * header.recordSize != recorder.size) {
+    return "The records do not fill the recording";
+  }
+
+  for (uint32_t i = 0; i < header.recordsCount; i++) {
+    const uint8_t *record = &recorder.data[FLIGHT_REC_DATA_OFFSET + i * header.recordSize];
+    uint32_t recordTick;
+    uint32_t previousTick;
+    float z;
+
+    memcpy(&recordTick, record, sizeof(recordTick));
+    if (i > 0) {
+      memcpy(&previousTick, record - header.recordSize, sizeof(previousTick));
+      if (recordTick != previousTick + divisor) {
+        return "The recording misses records";
+      }
+    }
+    memcpy(&z, &record[4 + 4 * 2], sizeof(z));
+    maxZ = z > maxZ ? z : maxZ;
+  }
+  if (maxZ < 0.9f * height || maxZ > 1.25f * height) {
+    return "The recording is not of the hover";
+  }
+
+  recorder.records = header.recordsCount;
+  return NULL;
+}
+
+// After the touchdown until the recording is read back
+static bool recorderIsReading(void)
+{
+  return options.scenario == scenarioRecorder && flight.touchdownTick != 0 && !recorder.done;
+}
+
+// Recording or stopping, the memory is served once not
+static bool recorderIsBusy(void)
+{
+  return logGetUint(logGetVarId("frec", "state")) != 0;
+}
+
+static void recorderFail(const char *error)
+{
+  recorder.error = error;
+  recorder.done = true;
+}
+
+static void recorderClientUpdate(uint32_t tick)
+{
+  const uint32_t startTick = RECORDER_START * configTICK_RATE_HZ;
+  const uint32_t takeoffTick = TAKEOFF_START * configTICK_RATE_HZ;
+  const uint32_t stopTick = flight.touchdownTick + RECORDER_STOP_TIME * configTICK_RATE_HZ;
+  const uint8_t *reply = &recorder.reply[1];
+
+  if (recorder.done) {
+    return;
+  }
+
+  if (tick == startTick) {
+    simLinkSetClientReceiver(recorderReceive);
+    simVarsAssign("frec.record=1");
+  } else if (tick == takeoffTick && !recorderIsBusy()) {
+    recorderFail("The recording did not start on the ground");
+  } else if (flight.touchdownTick != 0 && tick == stopTick) {
+    simVarsAssign("frec.record=0");
+  } else if (flight.touchdownTick != 0 && tick > stopTick && recorder.requestTick == 0 && !recorderIsBusy()) {
+    // As cflib finds a memory, the number of them and then the type of each
+    const uint8_t request[] = { MEM_CMD_GET_NBR };
+    recorderRequest(MEM_SETTINGS_CHANNEL, request, sizeof(request), tick);
+  } else if (recorder.requestTick != 0 && recorder.replySize == 0) {
+    if (tick - recorder.requestTick > RECORDER_REPLY_TIMEOUT_TICKS) {
+      recorderFail("The memory did not reply");
+    }
+  } else if (recorder.requestTick != 0 && !recorder.isReading) {
+    if (reply[0] == MEM_CMD_GET_NBR && recorder.replySize == 3) {
+      recorder.memCount = reply[1];
+      recorder.memId = 0;
+    } else if (reply[0] == MEM_CMD_GET_INFO && recorder.replySize == 16 && reply[1] == recorder.memId) {
+      if (reply[2] == MEM_TYPE_FLIGHT_REC) {
+        memcpy(&recorder.size, &reply[3], sizeof(recorder.size));
+        recorder.data = malloc(recorder.size);
+        recorder.isReading = true;
+        recorderReadNext(tick);
+        return;
+      }
+      recorder.memId++;
+    } else {
+      recorderFail("Unexpected memory settings reply");
+      return;
+    }
+
+    if (recorder.memId >= recorder.memCount) {
+      recorderFail("No flight recorder memory");
+    } else {
+      const uint8_t request[] = { MEM_CMD_GET_INFO, recorder.memId };
+      recorderRequest(MEM_SETTINGS_CHANNEL, request, sizeof(request), tick);
+    }
+  } else if (recorder.isReading) {
+    // Memory, address, status and the data
+    const uint8_t length = recorder.replySize - 7;
+    uint32_t address;
+
+    memcpy(&address, &reply[1], sizeof(address));
+    if (recorder.replySize < 7 || reply[0] != recorder.memId || address != recorder.address || reply[5] != 0 ||
+        length > recorder.size - recorder.address) {
+      recorderFail("A read of the recording failed");
+      return;
+    }
+
+    memcpy(&recorder.data[recorder.address], &reply[6], length);
+    recorder.address += length;
+    if (recorder.address < recorder.size) {
+      recorderReadNext(tick);
+    } else {
+      recorder.error = recordingError(options.height);
+      recorder.done = true;
+    }
+  }
+}
+
+static void scenarioUpdate(const simQuadState_t *quad, uint32_t tick, simFlightResult_t *result)
+{
+  static const float square[][2] = { { 1, 0 }, { 1, 1 }, { 0, 1 }, { 0, 0 } };
+  const uint32_t legTicks = options.scenario == scenarioAggressive ? AGGRESSIVE_LEG_TICKS : 3000;
+  const float legDuration = options.scenario == scenarioAggressive ? AGGRESSIVE_LEG_DURATION : 2.0f;
+  const float side = options.scenario == scenarioAggressive ? AGGRESSIVE_SIDE : 1.0f;
+  const uint32_t takeoffTick = TAKEOFF_START * configTICK_RATE_HZ;
+  const uint32_t startTick = SETTLE_TIME * configTICK_RATE_HZ;
+  const uint32_t landTick = scenarioEnd() * configTICK_RATE_HZ;
+  const float h = options.height;
+
+  if (options.scenario == scenarioLink || options.scenario == scenarioIdleYaw) {
+    // The client flies, or nothing does
+    return;
+  }
+  if (options.scenario == scenarioRecorder) {
+    // The flight is the hover
+    recorderClientUpdate(tick);
+  }
+
+  if (tick == takeoffTick) {
+    commanderEnableHighLevel(true);
+    crtpCommanderHighLevelTakeoff(h, TAKEOFF_DURATION);
+  } else if (options.scenario == scenarioAutonav) {
+    autonavScenarioUpdate(quad, tick, result);
+  } else if (options.scenario == scenarioLossy) {
+    lossyClientUpdate(quad, tick);
+  } else if (tick == landTick && landTick < scenarioDuration() * configTICK_RATE_HZ) {
+    crtpCommanderHighLevelLand(0.0f, LAND_DURATION);
+    landingStarted(quad);
+  } else if (tick >= startTick && tick < landTick) {
+    const uint32_t elapsed = tick - startTick;
+
+    switch (options.scenario) {
+      case scenarioStep:
+        // A 1 m step, as fast as the planner allows
+        if (elapsed == 0) {
+          crtpCommanderHighLevelGoTo(1.0f, 0.0f, h, 0.0f, 0.5f, false);
+        }
+        break;
+      case scenarioSquare:
+      case scenarioAggressive:
+        if (elapsed % legTicks == 0) {
+          const float *corner = square[(elapsed / legTicks) % 4];
+          crtpCommanderHighLevelGoTo(side * corner[0], side * corner[1], h, 0.0f, legDuration, false);
+        }
+        break;
+      case scenarioLogging:
+        loggingClientUpdate(tick);
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+// Turn the drone of the idleyaw scenario on the ground, after the model step
+// which keeps its heading but stops it
+static void idleYawTurn(simQuadState_t *quad, uint32_t tick)
+{
+  const float t = tick * SIM_DT - IDLE_YAW_START;
+
+  if (t < 0 || t > IDLE_YAW_TIME) {
+    return;
+  }
+
+  const float rate = IDLE_YAW_RATE * (float)M_PI / 180.0f;
+  quad->q[0] = cosf(rate * t / 2);
+  quad->q[1] = 0;
+  quad->q[2] = 0;
+  quad->q[3] = sinf(rate * t / 2);
+  quad->omega[2] = rate;
+}
+
+// The heading of the estimator against the one of the model, in deg
+static float headingError(const simQuadState_t *quad)
+{
+  float euler[3];
+  simQuadEuler(quad, euler);
+
+  const float yaw = logGetFloat(logGetVarId("stateEstimate", "yaw"));
+  return fabsf(fmodf(yaw - euler[2] * 180.0f / (float)M_PI + 540.0f, 360.0f) - 180.0f);
+}
+
+// The pixels of the flow deck over the last period, in the model of kalman_core.c
+static void flowUpdate(const simQuadState_t *quad)
+{
+  const float *q = quad->q;
+  const float *v = quad->vel;
+  const float upZ = 1 - 2 * (q[1] * q[1] + q[2] * q[2]);
+  const float dt = FLOW_PERIOD_TICKS * SIM_DT;
+  const float pixelsPerRad = 30.0f / (4.2f * (float)M_PI / 180.0f);
+
+  if (quad->pos[2] < FLOW_MIN_HEIGHT || upZ < 0.5f) {
+    return;
+  }
+
+  // The velocity in the body frame, the transpose of the attitude
+  const float bodyVx = (1 - 2 * (q[2] * q[2] + q[3] * q[3])) * v[0] + 2 * (q[1] * q[2] + q[0] * q[3]) * v[1] +
+                       2 * (q[1] * q[3] - q[0] * q[2]) * v[2];
+  const float bodyVy = 2 * (q[1] * q[2] - q[0] * q[3]) * v[0] + (1 - 2 * (q[1] * q[1] + q[3] * q[3])) * v[1] +
+                       2 * (q[2] * q[3] + q[0] * q[1]) * v[2];
+  const float pixelsPerVelocity = dt * pixelsPerRad * upZ / quad->pos[2];
+  flowMeasurement_t flow = {
+    .timestamp = xTaskGetTickCount(),
+    .dpixelx = pixelsPerVelocity * bodyVx - dt * pixelsPerRad * 1.25f * quad->omega[1] + gaussian(FLOW_NOISE_PX),
+    .dpixely = pixelsPerVelocity * bodyVy + dt * pixelsPerRad * 1.25f * quad->omega[0] + gaussian(FLOW_NOISE_PX),
+    .stdDevX = FLOW_STD_DEV,
+    .stdDevY = FLOW_STD_DEV,
+    .dt = dt,
+  };
+
+  estimatorEnqueueFlow(&flow);
+}
+
+static void sensorsUpdate(const simQuadState_t *quad, uint32_t tick)
+{
+  float gyro[3];
+  float acc[3];
+
+  for (int i = 0; i < 3; i++) {
+    gyro[i] = quad->omega[i] * 180.0f / (float)M_PI + gaussian(GYRO_NOISE_DEG);
+    acc[i] = quad->specificForce[i] / GRAVITY + gaussian(ACC_NOISE_G);
+  }
+
+  if (options.mocap && tick % MOCAP_PERIOD_TICKS == 0) {
+    positionMeasurement_t position = {
+      .x = quad->pos[0] + gaussian(MOCAP_NOISE_M),
+      .y = quad->pos[1] + gaussian(MOCAP_NOISE_M),
+      .z = quad->pos[2] + gaussian(MOCAP_NOISE_M),
+      .stdDev = MOCAP_NOISE_M * options.noise + 0.001f,
+    };
+    estimatorEnqueuePosition(&position);
+  }
+
+  if (tick % TOF_PERIOD_TICKS == 0) {
+    // Along the body z axis, as the down looking ranger sees the ground
+    const float *q = quad->q;
+    const float upZ = 1 - 2 * (q[1] * q[1] + q[2] * q[2]);
+    const float range = quad->pos[2] / upZ;
+
+    if (upZ > 0.5f && range < TOF_MAX_RANGE) {
+      rangeSet(rangeDown, range);
+      rangeEnqueueDownRangeInEstimator(range + gaussian(TOF_NOISE_M), TOF_NOISE_M * options.noise + 0.0025f,
+                                       xTaskGetTickCount());
+    }
+  }
+
+  if (options.flow && tick % FLOW_PERIOD_TICKS == 0) {
+    flowUpdate(quad);
+  }
+
+  simHalSetImu(gyro, acc, quad->pos[2] + gaussian(BARO_NOISE_M));
+}
+
+// The end of systemTask()
+static void workerTask(void *parameters)
+{
+  systemWaitStart();
+  workerLoop();
+}
+
+static void systemLaunchSim(void)
+{
+  // The order of systemInit(), commInit() and systemTask()
+  crtpInit();
+  consoleInit();
+  powerSaveInit();
+  workerInit();
+
+  if (options.linkPort || hasClient()) {
+    if (!simLinkInit(options.linkPort)) {
+      exit(2);
+    }
+    simLinkSetImpairment(options.loss, options.delayMs, uniform);
+  }
+  crtpserviceInit();
+  platformserviceInit();
+  logInit();
+  paramInit();
+  timeSyncInit();
+
+  commanderInit();
+  estimatorKalmanTaskInit();
+  // The complementary estimator integrates the gyro on the loops power_save.c thins
+  stabilizerInit(options.scenario == scenarioIdleYaw ? complementaryEstimator : kalmanEstimator);
+  flightRecorderInit();
+  linkCaptureInit();
+  autonavMissionInit();
+  memInit();
+  xTaskCreate(workerTask, SYSTEM_TASK_NAME, SYSTEM_TASK_STACKSIZE, NULL, SYSTEM_TASK_PRI, NULL);
+
+  for (int i = 0; i < options.paramCount; i++) {
+    if (!simVarsAssign(options.params[i])) {
+      fprintf(stderr, "Unknown param %s\n", options.params[i]);
+      exit(2);
+    }
+  }
+
+  systemStart();
+}
+
+// Follow the touchdown after the landing started, vz is the vertical speed
+// before the model step of this tick
+static void touchdownUpdate(const simQuadState_t *quad, float vz, uint32_t tick, simFlightResult_t *result)
+{
+  if (!quad->onGround && !quad->crashed) {
+    flight.airborne = true;
+    return;
+  }
+
+  if (!flight.airborne || flight.touchdownTick != 0 || !(flight.landing || quad->crashed)) {
+    return;
+  }
+
+  flight.touchdownTick = tick;
+  result->touchdownSpeed = -vz;
+  if (flight.landing) {
+    result->landError = hypotf(quad->pos[0] - flight.landStart[0], quad->pos[1] - flight.landStart[1]);
+  }
+  // A mission lands on its own, not on the heartbeat timeout
+  if (options.scenario == scenarioAutonav && options.missionSize == 0 && flight.lastKickTick != 0 && flight.landing) {
+    const uint32_t timeoutTick = flight.lastKickTick + SAFETY_TIMEOUT_MS * configTICK_RATE_HZ / 1000;
+    result->timeToLand = ((float)tick - (float)timeoutTick) * SIM_DT;
+  }
+}
+
+static void usage(const char *name)
+{
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          "  -t, --time S           simulated flight time (10, 60 for autonav, 12.5 for\n"
+          "                         recorder, and the read back, 5.5 for idleyaw)\n"
+          "  -s, --scenario NAME    hover, step, square, aggressive, flowhold, logging,\n"
+          "                         lossy, autonav, recorder or idleyaw (hover)\n"
+          "      --shape ID         shape flown by the autonav scenario (1)\n"
+          "      --mission FILE     mission bytecode flown by the autonav scenario instead\n"
+          "  -z, --height M         takeoff height (0.5)\n"
+          "  -p, --param G.N=V      set a firmware param, repeatable\n"
+          "  -l, --log G.N          add a log variable to the csv, repeatable\n"
+          "  -o, --csv FILE         write the flight every 10 ms, or a row per flight\n"
+          "                         with --batch\n"
+          "  -r, --seed N           seed of the sensor noise, wind and obstacles (1)\n"
+          "  -n, --noise K          scale of the sensor noise (1)\n"
+          "  -w, --wind M/S         highest mean wind, random speed and heading (0)\n"
+          "  -b, --batch N          fly N flights from the seed on\n"
+          "  -j, --jobs J           parallel flights of a batch (all the cores)\n"
+          "  -m, --model KEY=V      mass, arm, hover, tau or drag of the model\n"
+          "      --no-mocap         fly on the IMU and the down ranger only\n"
+          "      --link[=PORT]      let a cflib client fly over localhost UDP (2390)\n"
+          "      --pace K           host clock rate of a linked flight, 0 for unpaced (1)\n"
+          "      --loss P           ratio of the datagrams the link loses (0, 0.1 for lossy)\n"
+          "      --delay MS         highest delay of the link to the drone (0, 20 for lossy)\n"
+          "      --trace FILE       record the inputs of the kalman core for ./replay\n"
+          "      --report FILE      write the performance report of the flight as JSON\n"
+          "  -v, --verbose          print the firmware debug messages\n",
+          name);
+}
+
+static bool setModel(const char *assignment)
+{
+  char key[16];
+  float value;
+
+  if (sscanf(assignment, "%15[^=]=%f", key, &value) != 2) {
+    return false;
+  }
+
+  if (strcmp(key, "mass") == 0) {
+    options.model.mass = value;
+  } else if (strcmp(key, "arm") == 0) {
+    options.model.armLength = value;
+  } else if (strcmp(key, "hover") == 0) {
+    options.model.hoverRatio = value;
+  } else if (strcmp(key, "tau") == 0) {
+    options.model.motorTau = value;
+  } else if (strcmp(key, "drag") == 0) {
+    options.model.drag = value;
+  } else {
+    return false;
+  }
+
+  return true;
+}
+
+static void readMission(const char *path)
+{
+  FILE *file = fopen(path, "rb");
+
+  if (file == NULL) {
+    perror(path);
+    exit(2);
+  }
+  options.missionSize = fread(options.mission, 1, sizeof(options.mission), file);
+  if (options.missionSize == 0 || fgetc(file) != EOF) {
+    fprintf(stderr, "%s is empty or larger than %d bytes\n", path, AUTONAV_MISSION_SIZE);
+    exit(2);
+  }
+  fclose(file);
+}
+
+static scenario_t scenarioFind(const char *name)
+{
+  for (int i = 0; i < scenarioLink; i++) {
+    if (strcmp(name, scenarioNames[i]) == 0) {
+      return i;
+    }
+  }
+
+  fprintf(stderr, "Unknown scenario %s\n", name);
+  exit(2);
+}
+
+static void parseOptions(int argc, char **argv)
+{
+  static const struct option longOptions[] = {
+    { "time", required_argument, NULL, 't' },
+    { "scenario", required_argument, NULL, 's' },
+    { "height", required_argument, NULL, 'z' },
+    { "param", required_argument, NULL, 'p' },
+    { "log", required_argument, NULL, 'l' },
+    { "csv", required_argument, NULL, 'o' },
+    { "seed", required_argument, NULL, 'r' },
+    { "noise", required_argument, NULL, 'n' },
+    { "wind", required_argument, NULL, 'w' },
+    { "shape", required_argument, NULL, 'S' },
+    { "mission", required_argument, NULL, 'X' },
+    { "batch", required_argument, NULL, 'b' },
+    { "jobs", required_argument, NULL, 'j' },
+    { "model", required_argument, NULL, 'm' },
+    { "no-mocap", no_argument, NULL, 'M' },
+    { "link", optional_argument, NULL, 'L' },
+    { "pace", required_argument, NULL, 'P' },
+    { "loss", required_argument, NULL, 'Q' },
+    { "delay", required_argument, NULL, 'D' },
+    { "trace", required_argument, NULL, 'T' },
+    { "report", required_argument, NULL, 'R' },
+    { "verbose", no_argument, NULL, 'v' },
+    { "help", no_argument, NULL, 'h' },
+    { 0 },
+  };
+  int option;
+
+  simQuadDefaultParams(&options.model);
+
+  while ((option = getopt_long(argc, argv, "t:s:z:p:l:o:r:n:w:b:j:m:vh", longOptions, NULL)) != -1) {
+    switch (option) {
+      case 't':
+        options.duration = strtof(optarg, NULL);
+        break;
+      case 's':
+        options.scenario = scenarioFind(optarg);
+        if (options.scenario == scenarioFlowHold) {
+          // On the flow deck and the down ranger only
+          options.flow = true;
+          options.mocap = false;
+        }
+        break;
+      case 'z':
+        options.height = strtof(optarg, NULL);
+        break;
+      case 'p':
+        if (options.paramCount < MAX_PARAMS) {
+          options.params[options.paramCount++] = optarg;
+        }
+        break;
+      case 'l':
+        if (options.logCount < MAX_LOG_COLUMNS) {
+          options.logs[options.logCount++] = optarg;
+        }
+        break;
+      case 'o':
+        options.csvPath = optarg;
+        break;
+      case 'r':
+        options.seed = strtoull(optarg, NULL, 0);
+        break;
+      case 'n':
+        options.noise = strtof(optarg, NULL);
+        break;
+      case 'w':
+        options.wind = strtof(optarg, NULL);
+        break;
+      case 'S':
+        options.shape = strtoul(optarg, NULL, 0);
+        break;
+      case 'X':
+        readMission(optarg);
+        break;
+      case 'b':
+        options.batch = strtoul(optarg, NULL, 0);
+        break;
+      case 'j':
+        options.jobs = strtol(optarg, NULL, 0);
+        break;
+      case 'm':
+        if (!setModel(optarg)) {
+          fprintf(stderr, "Unknown model parameter %s\n", optarg);
+          exit(2);
+        }
+        break;
+      case 'M':
+        options.mocap = false;
+        break;
+      case 'L':
+        options.scenario = scenarioLink;
+        options.linkPort = optarg ? strtoul(optarg, NULL, 0) : SIM_LINK_DEFAULT_PORT;
+        break;
+      case 'P':
+        options.pace = strtof(optarg, NULL);
+        break;
+      case 'Q':
+        options.loss = strtof(optarg, NULL);
+        break;
+      case 'D':
+        options.delayMs = strtol(optarg, NULL, 0);
+        break;
+      case 'T':
+        options.tracePath = optarg;
+        break;
+      case 'R':
+        options.reportPath = optarg;
+        break;
+      case 'v':
+        simHalSetLogLevel(ESP_LOG_INFO);
+        break;
+      default:
+        usage(argv[0]);
+        exit(option == 'h' ? 0 : 2);
+    }
+  }
+
+  // Only the lossy scenario impairs the link unless told to
+  if (options.loss < 0) {
+    options.loss = options.scenario == scenarioLossy ? LOSSY_LOSS : 0.0f;
+  }
+  if (options.delayMs < 0) {
+    options.delayMs = options.scenario == scenarioLossy ? LOSSY_DELAY_MS : 0;
+  }
+}
+
+static logVarId_t logColumns[MAX_LOG_COLUMNS];
+
+static FILE *csvOpen(void)
+{
+  if (options.csvPath == NULL) {
+    return NULL;
+  }
+
+  FILE *csv = fopen(options.csvPath, "w");
+  if (csv == NULL) {
+    perror(options.csvPath);
+    exit(2);
+  }
+
+  fprintf(csv, "t,x,y,z,roll,pitch,yaw,sp_x,sp_y,sp_z,m1,m2,m3,m4");
+  for (int i = 0; i < options.logCount; i++) {
+    char group[32];
+    char name[32];
+
+    if (sscanf(options.logs[i], "%31[^.].%31s", group, name) != 2 ||
+        !LOG_VARID_IS_VALID(logColumns[i] = logGetVarId(group, name))) {
+      fprintf(stderr, "Unknown log variable %s\n", options.logs[i]);
+      exit(2);
+    }
+    fprintf(csv, ",%s", options.logs[i]);
+  }
+  fprintf(csv, "\n");
+
+  return csv;
+}
+
+static FILE *traceFile;
+
+static void traceWrite(const void *record, size_t size)
+{
+  fwrite(record, 1, size, traceFile);
+}
+
+// Before the launch, the kalman core is initialized by stabilizerInit()
+static void traceOpen(void)
+{
+  if (options.tracePath == NULL) {
+    return;
+  }
+
+  traceFile = fopen(options.tracePath, "wb");
+  if (traceFile == NULL) {
+    perror(options.tracePath);
+    exit(2);
+  }
+  kalmanTraceSetSink(traceWrite);
+}
+
+static void onInterrupt(int signal)
+{
+  isInterrupted = 1;
+}
+
+// Sleep until the host clock reaches the tick
+static void paceTo(const struct timespec *start, uint32_t tick)
+{
+  if (options.pace <= 0) {
+    return;
+  }
+
+  const uint64_t ns = (uint64_t)(tick * (double)SIM_DT / options.pace * 1e9);
+  struct timespec due = {
+    .tv_sec = start->tv_sec + ns / 1000000000,
+    .tv_nsec = start->tv_nsec + ns % 1000000000,
+  };
+  if (due.tv_nsec >= 1000000000) {
+    due.tv_sec++;
+    due.tv_nsec -= 1000000000;
+  }
+
+  clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL);
+}
+
+static void fly(uint64_t seed, simFlightResult_t *result)
+{
+  memset(result, 0, sizeof(*result));
+  result->seed = seed;
+  result->timeToLand = NAN;
+  rngState = seed * 0x9E3779B97F4A7C15ULL + 1;
+
+  simQuadState_t quad;
+  simQuadInit(&quad, 0.0f, 0.0f);
+  scenarioPlan(result);
+  memset(&recorder, 0, sizeof(recorder));
+
+  traceOpen();
+  if (options.reportPath) {
+    simPerfStart();
+  }
+  systemLaunchSim();
+  // After logInit(), the log variables of the columns are looked up
+  FILE *csv = options.batch ? NULL : csvOpen();
+
+  const logVarId_t setpointX = logGetVarId("ctrltarget", "x");
+  const logVarId_t setpointY = logGetVarId("ctrltarget", "y");
+  const logVarId_t setpointZ = logGetVarId("ctrltarget", "z");
+
+  const uint32_t ticks = scenarioDuration() * configTICK_RATE_HZ;
+  const uint32_t settleTick = SETTLE_TIME * configTICK_RATE_HZ;
+  double errorSquareSum = 0;
+  uint32_t errorCount = 0;
+  uint32_t tick;
+
+  const clock_t hostStart = clock();
+  struct timespec paceStart;
+  clock_gettime(CLOCK_MONOTONIC, &paceStart);
+
+  for (tick = 0; (tick < ticks || recorderIsReading()) && !quad.crashed && !flight.done && !isInterrupted; tick++) {
+    uint16_t ratios[4];
+    const float vz = quad.vel[2];
+
+    windUpdate(&quad);
+    simHalGetMotorRatios(ratios);
+    simQuadStep(&quad, &options.model, ratios, SIM_DT);
+    touchdownUpdate(&quad, vz, tick, result);
+    if (options.scenario == scenarioIdleYaw) {
+      idleYawTurn(&quad, tick);
+    }
+
+    scenarioUpdate(&quad, tick, result);
+    sensorsUpdate(&quad, tick);
+    if (options.linkPort || hasClient()) {
+      simLinkPoll();
+    }
+    simOsRunUntilIdle();
+
+    const float setpoint[3] = { logGetFloat(setpointX), logGetFloat(setpointY), logGetFloat(setpointZ) };
+    if (options.scenario == scenarioLossy) {
+      simPerfSetpointUsed(tick, setpoint);
+    }
+
+    if (tick >= settleTick && !flight.landing) {
+      float error = 0;
+      for (int i = 0; i < 3; i++) {
+        error += (quad.pos[i] - setpoint[i]) * (quad.pos[i] - setpoint[i]);
+      }
+      errorSquareSum += error;
+      errorCount++;
+      if (sqrtf(error) > result->max) {
+        result->max = sqrtf(error);
+      }
+    }
+
+    if (csv && tick % CSV_PERIOD_TICKS == 0) {
+      float euler[3];
+      simQuadEuler(&quad, euler);
+
+      fprintf(csv, "%.3f,%.4f,%.4f,%.4f,%.2f,%.2f,%.2f,%.4f,%.4f,%.4f,%u,%u,%u,%u", tick * SIM_DT,
+              quad.pos[0], quad.pos[1], quad.pos[2],
+              euler[0] * 180 / M_PI, euler[1] * 180 / M_PI, euler[2] * 180 / M_PI,
+              setpoint[0], setpoint[1], setpoint[2], ratios[0], ratios[1], ratios[2], ratios[3]);
+      for (int i = 0; i < options.logCount; i++) {
+        fprintf(csv, ",%g", logGetFloat(logColumns[i]));
+      }
+      fprintf(csv, "\n");
+    }
+
+    // Nothing more to learn once the drone sits on the ground, and the recording is read back
+    if (flight.touchdownTick != 0 && tick >= flight.touchdownTick + LANDED_TIME * configTICK_RATE_HZ &&
+        (options.scenario != scenarioRecorder || recorder.done)) {
+      flight.done = true;
+    }
+
+    simOsTick();
+    if (options.linkPort) {
+      paceTo(&paceStart, tick + 1);
+    }
+  }
+
+  if (csv) {
+    fclose(csv);
+  }
+  if (traceFile) {
+    kalmanTraceSetSink(NULL);
+    fclose(traceFile);
+  }
+
+  if (flight.navState == AUTONAV_HOLD_OBSTACLE) {
+    result->holdTime += (tick - flight.holdStartTick) * SIM_DT;
+  }
+
+  result->crashed = quad.crashed;
+  result->time = tick * SIM_DT;
+  result->rms = errorCount ? sqrt(errorSquareSum / errorCount) : 0.0;
+  result->hostTime = (double)(clock() - hostStart) / CLOCKS_PER_SEC;
+  result->pos[0] = quad.pos[0];
+  result->pos[1] = quad.pos[1];
+  result->pos[2] = quad.pos[2];
+
+  if (options.scenario == scenarioRecorder && !recorder.done) {
+    recorderFail("The recording was not read back");
+  }
+  if (options.scenario == scenarioIdleYaw) {
+    flight.headingError = headingError(&quad);
+    if (flight.headingError > IDLE_YAW_TOLERANCE) {
+      fprintf(stderr, "The estimated heading is %.1f deg off\n", (double)flight.headingError);
+    }
+  }
+  if (recorder.error) {
+    fprintf(stderr, "%s\n", recorder.error);
+  }
+  free(recorder.data);
+  recorder.data = NULL;
+}
+
+static int flyBatch(void)
+{
+  const int jobs = options.jobs > 0 ? options.jobs : sysconf(_SC_NPROCESSORS_ONLN);
+  simFlightResult_t *results = calloc(options.batch, sizeof(simFlightResult_t));
+  struct timespec start;
+  struct timespec end;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  simBatchRun(fly, options.seed, options.batch, jobs, results);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  if (options.csvPath) {
+    FILE *file = fopen(options.csvPath, "w");
+    if (file == NULL) {
+      perror(options.csvPath);
+      exit(2);
+    }
+    simBatchWriteCsv(file, results, options.batch);
+    fclose(file);
+  }
+
+  simBatchWriteSummary(stdout, results, options.batch,
+                       (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+
+  bool crashed = false;
+  for (uint32_t i = 0; i < options.batch; i++) {
+    crashed |= results[i].crashed || results[i].failed;
+  }
+  free(results);
+
+  return crashed ? 1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+  parseOptions(argc, argv);
+
+  if ((options.linkPort || options.tracePath || options.reportPath) && options.batch > 0) {
+    fprintf(stderr, "--link, --trace and --report fly a single flight\n");
+    exit(2);
+  }
+  signal(SIGINT, onInterrupt);
+
+  if (options.batch > 0) {
+    return flyBatch();
+  }
+
+  simFlightResult_t result;
+  fly(options.seed, &result);
+
+  printf("crashed=%d time=%.3f rms=%.4f max=%.4f x=%.3f y=%.3f z=%.3f land_error=%.4f touchdown_speed=%.3f "
+         "time_to_land=%.3f holds=%u hold_time=%.3f speedup=%.1f",
+         result.crashed, result.time, result.rms, result.max, result.pos[0], result.pos[1],
+         result.pos[2], result.landError, result.touchdownSpeed, result.timeToLand, result.holds,
+         result.holdTime, result.hostTime > 0 ? result.time / result.hostTime : 0.0);
+  if (options.scenario == scenarioRecorder) {
+    printf(" records=%u", (unsigned int)recorder.records);
+  }
+  if (options.scenario == scenarioIdleYaw) {
+    printf(" heading_error=%.2f", flight.headingError);
+  }
+  printf("\n");
+
+  if (options.reportPath) {
+    FILE *report = fopen(options.reportPath, "w");
+    if (report == NULL) {
+      perror(options.reportPath);
+      exit(2);
+    }
+    simPerfWriteReport(report, scenarioNames[options.scenario], &result);
+    fclose(report);
+  }
+
+  return result.crashed || recorder.error || flight.headingError > IDLE_YAW_TOLERANCE ? 1 : 0;
+}
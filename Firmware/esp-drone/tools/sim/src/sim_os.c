@@ -0,0 +1,640 @@
+/*
+ * sim_os.c - Virtual time FreeRTOS for the host simulator
+ *
+ * The tasks are ucontext coroutines on the simulator thread. A task runs
+ * until it blocks or yields, the ready task with the highest priority runs
+ * next, and tasks of the same priority run in the order they became ready.
+ * The same inputs therefore always give the same schedule, and no host
+ * thread or lock is involved.
+ *
+ * Blocked tasks wait on an object, a queue or their notification value. Any
+ * change of the object wakes all its waiters, which check again.
+ *
+ * Every queue keeps the most items it ever held. With simOsSetProfiling()
+ * the host CPU time every task runs for is added up too, the virtual clock
+ * stands still while the tasks run.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <ucontext.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+#include "semphr.h"
+#include "timers.h"
+#include "sim_os.h"
+
+// Host code takes more stack than the target, and the Kalman filter keeps
+// its matrices on the stack
+#define SIM_STACK_SIZE (512 * 1024)
+
+// CONFIG_FREERTOS_TIMER_TASK_PRIORITY of the firmware
+#define SIM_TIMER_TASK_PRI 1
+
+struct simTask {
+  ucontext_t context;
+  TaskFunction_t function;
+  void *parameters;
+  const char *name;
+  UBaseType_t priority;
+
+  bool ready;
+  bool deleted;
+  uint64_t readySequence;
+
+  const void *waitObject;
+  bool timed;
+  bool timedOut;
+  TickType_t wakeTick;
+
+  uint32_t notifyValue;
+  bool notifyPending;
+
+  uint32_t runs;
+  uint64_t busyNs;
+
+  struct simTask *next;
+};
+
+struct simQueue {
+  uint8_t *storage;
+  UBaseType_t length;
+  UBaseType_t itemSize;
+  UBaseType_t count;
+  UBaseType_t head;
+  UBaseType_t peak;
+  const char *name;
+
+  struct simQueue *next;
+};
+
+struct simTimer {
+  TimerCallbackFunction_t callback;
+  void *id;
+  TickType_t period;
+  bool autoReload;
+
+  bool active;
+  TickType_t expiry;
+
+  struct simTimer *next;
+};
+
+static struct simTask *tasks;
+static struct simTask *current;
+static ucontext_t schedulerContext;
+static TickType_t tickCount;
+static uint64_t readySequence;
+static bool isProfiling;
+
+static struct simQueue *queues;
+static struct simQueue **lastQueue = &queues;
+
+// Object of the tasks in vTaskDelay()
+static const char delayObject;
+
+static struct simTimer *timers;
+static TaskHandle_t timerTaskHandle;
+// Object of the timer task, changed by every timer call
+static const char timerObject;
+
+static void makeReady(struct simTask *task)
+{
+  task->ready = true;
+  task->waitObject = NULL;
+  task->readySequence = ++readySequence;
+}
+
+static void wakeWaiters(const void *object)
+{
+  for (struct simTask *task = tasks; task; task = task->next) {
+    if (!task->ready && task->waitObject == object) {
+      task->timedOut = false;
+      makeReady(task);
+    }
+  }
+}
+
+static void switchToScheduler(void)
+{
+  swapcontext(&current->context, &schedulerContext);
+}
+
+// Block the current task until the object changes or the tick reaches the
+// deadline. Returns false on timeout.
+static bool blockUntil(const void *object, bool timed, TickType_t deadline)
+{
+  if (current == NULL) {
+    fprintf(stderr, "sim: blocking call outside of a task\n");
+    abort();
+  }
+
+  current->ready = false;
+  current->waitObject = object;
+  current->timed = timed;
+  current->wakeTick = deadline;
+  current->timedOut = false;
+  switchToScheduler();
+
+  return !current->timedOut;
+}
+
+typedef struct {
+  bool timed;
+  TickType_t deadline;
+} timeout_t;
+
+static timeout_t timeoutFrom(TickType_t ticksToWait)
+{
+  timeout_t timeout = { .timed = ticksToWait != portMAX_DELAY, .deadline = tickCount + ticksToWait };
+  return timeout;
+}
+
+static void taskEntry(void)
+{
+  current->function(current->parameters);
+
+  // Returning from a task function is a bug in FreeRTOS, end it anyway
+  current->deleted = true;
+  current->ready = false;
+  switchToScheduler();
+}
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char *name, uint32_t stackDepth,
+                       void *parameters, UBaseType_t priority, TaskHandle_t *handle)
+{
+  struct simTask *task = calloc(1, sizeof(*task));
+  void *stack = malloc(SIM_STACK_SIZE);
+
+  if (task == NULL || stack == NULL) {
+    return pdFAIL;
+  }
+
+  task->function = function;
+  task->parameters = parameters;
+  task->name = name;
+  task->priority = priority;
+
+  getcontext(&task->context);
+  task->context.uc_stack.ss_sp = stack;
+  task->context.uc_stack.ss_size = SIM_STACK_SIZE;
+  task->context.uc_link = &schedulerContext;
+  makecontext(&task->context, taskEntry, 0);
+
+  // Appended, so that the wake up order is the creation order
+  struct simTask **last = &tasks;
+  while (*last) {
+    last = &(*last)->next;
+  }
+  *last = task;
+  makeReady(task);
+
+  if (handle) {
+    *handle = task;
+  }
+
+  return pdPASS;
+}
+
+TaskHandle_t xTaskCreateStatic(TaskFunction_t function, const char *name, uint32_t stackDepth,
+                               void *parameters, UBaseType_t priority, StackType_t *stack, StaticTask_t *buffer)
+{
+  TaskHandle_t handle = NULL;
+
+  xTaskCreate(function, name, stackDepth, parameters, priority, &handle);
+
+  return handle;
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+  if (task == NULL) {
+    task = current;
+  }
+
+  task->deleted = true;
+  task->ready = false;
+  task->waitObject = NULL;
+
+  if (task == current) {
+    switchToScheduler();
+  }
+}
+
+void vTaskYieldSim(void)
+{
+  if (current) {
+    makeReady(current);
+    switchToScheduler();
+  }
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+  if (ticks == 0) {
+    vTaskYieldSim();
+    return;
+  }
+
+  blockUntil(&delayObject, true, tickCount + ticks);
+}
+
+void vTaskDelayUntil(TickType_t *previousWakeTime, TickType_t increment)
+{
+  const TickType_t wakeTime = *previousWakeTime + increment;
+
+  *previousWakeTime = wakeTime;
+  if ((int32_t)(wakeTime - tickCount) > 0) {
+    blockUntil(&delayObject, true, wakeTime);
+  }
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+  return tickCount;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+  return current;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearCountOnExit, TickType_t ticksToWait)
+{
+  const timeout_t timeout = timeoutFrom(ticksToWait);
+
+  while (current->notifyValue == 0) {
+    if (ticksToWait == 0 || !blockUntil(&current->notifyValue, timeout.timed, timeout.deadline)) {
+      return 0;
+    }
+  }
+
+  const uint32_t value = current->notifyValue;
+  current->notifyValue = clearCountOnExit ? 0 : value - 1;
+  current->notifyPending = false;
+
+  return value;
+}
+
+BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value, eNotifyAction action)
+{
+  BaseType_t result = pdPASS;
+
+  switch (action) {
+    case eSetBits:
+      task->notifyValue |= value;
+      break;
+    case eIncrement:
+      task->notifyValue++;
+      break;
+    case eSetValueWithOverwrite:
+      task->notifyValue = value;
+      break;
+    case eSetValueWithoutOverwrite:
+      if (task->notifyPending) {
+        result = pdFAIL;
+      } else {
+        task->notifyValue = value;
+      }
+      break;
+    default:
+      break;
+  }
+
+  task->notifyPending = true;
+  wakeWaiters(&task->notifyValue);
+
+  return result;
+}
+
+BaseType_t xTaskNotifyWait(uint32_t clearOnEntry, uint32_t clearOnExit, uint32_t *value, TickType_t ticksToWait)
+{
+  const timeout_t timeout = timeoutFrom(ticksToWait);
+
+  if (!current->notifyPending) {
+    current->notifyValue &= ~clearOnEntry;
+  }
+
+  while (!current->notifyPending) {
+    if (ticksToWait == 0 || !blockUntil(&current->notifyValue, timeout.timed, timeout.deadline)) {
+      if (value) {
+        *value = current->notifyValue;
+      }
+      return pdFALSE;
+    }
+  }
+
+  if (value) {
+    *value = current->notifyValue;
+  }
+  current->notifyValue &= ~clearOnExit;
+  current->notifyPending = false;
+
+  return pdTRUE;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize)
+{
+  struct simQueue *queue = calloc(1, sizeof(*queue));
+
+  queue->length = length;
+  queue->itemSize = itemSize;
+  if (itemSize > 0) {
+    queue->storage = calloc(length, itemSize);
+  }
+
+  // Appended, the list is in the order of creation
+  *lastQueue = queue;
+  lastQueue = &queue->next;
+
+  return queue;
+}
+
+void vQueueAddToRegistry(QueueHandle_t queue, const char *name)
+{
+  queue->name = name;
+}
+
+QueueHandle_t xSemaphoreCreateCountingSim(UBaseType_t maxCount, UBaseType_t initialCount)
+{
+  QueueHandle_t semaphore = xQueueCreate(maxCount, 0);
+
+  semaphore->count = initialCount;
+  semaphore->peak = initialCount;
+
+  return semaphore;
+}
+
+BaseType_t xQueueGenericSend(QueueHandle_t queue, const void *item, TickType_t ticksToWait, bool overwrite)
+{
+  const timeout_t timeout = timeoutFrom(ticksToWait);
+
+  if (overwrite && queue->count == queue->length) {
+    // Only used on queues of length 1
+    queue->count--;
+  }
+
+  while (queue->count == queue->length) {
+    if (ticksToWait == 0 || current == NULL || !blockUntil(queue, timeout.timed, timeout.deadline)) {
+      return errQUEUE_FULL;
+    }
+  }
+
+  if (queue->itemSize > 0) {
+    const UBaseType_t tail = (queue->head + queue->count) % queue->length;
+    memcpy(queue->storage + tail * queue->itemSize, item, queue->itemSize);
+  }
+  queue->count++;
+  if (queue->count > queue->peak) {
+    queue->peak = queue->count;
+  }
+  wakeWaiters(queue);
+
+  return pdPASS;
+}
+
+BaseType_t xQueueGenericReceive(QueueHandle_t queue, void *item, TickType_t ticksToWait, bool peek)
+{
+  const timeout_t timeout = timeoutFrom(ticksToWait);
+
+  while (queue->count == 0) {
+    if (ticksToWait == 0 || current == NULL || !blockUntil(queue, timeout.timed, timeout.deadline)) {
+      return pdFALSE;
+    }
+  }
+
+  if (queue->itemSize > 0 && item) {
+    memcpy(item, queue->storage + queue->head * queue->itemSize, queue->itemSize);
+  }
+  if (!peek) {
+    queue->head = (queue->head + 1) % queue->length;
+    queue->count--;
+    wakeWaiters(queue);
+  }
+
+  return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+  return queue->count;
+}
+
+UBaseType_t uxQueueSpacesAvailableSim(QueueHandle_t queue)
+{
+  return queue->length - queue->count;
+}
+
+BaseType_t xQueueReset(QueueHandle_t queue)
+{
+  queue->count = 0;
+  queue->head = 0;
+  wakeWaiters(queue);
+
+  return pdPASS;
+}
+
+// The timer service task of FreeRTOS, created with the first timer
+static void timerTask(void *parameters)
+{
+  while (true) {
+    struct simTimer *due = NULL;
+    bool isWaiting = false;
+    TickType_t nextExpiry = 0;
+
+    for (struct simTimer *timer = timers; timer; timer = timer->next) {
+      if (!timer->active) {
+        continue;
+      }
+      if ((int32_t)(tickCount - timer->expiry) >= 0) {
+        due = timer;
+        break;
+      }
+      if (!isWaiting || (int32_t)(timer->expiry - nextExpiry) < 0) {
+        nextExpiry = timer->expiry;
+        isWaiting = true;
+      }
+    }
+
+    if (due) {
+      if (due->autoReload) {
+        due->expiry += due->period;
+      } else {
+        due->active = false;
+      }
+      due->callback(due);
+    } else {
+      blockUntil(&timerObject, isWaiting, nextExpiry);
+    }
+  }
+}
+
+TimerHandle_t xTimerCreate(const char *name, TickType_t period, UBaseType_t autoReload, void *id,
+                           TimerCallbackFunction_t callback)
+{
+  struct simTimer *timer = calloc(1, sizeof(*timer));
+
+  if (timer == NULL) {
+    return NULL;
+  }
+
+  if (timerTaskHandle == NULL) {
+    xTaskCreate(timerTask, "Tmr Svc", configMINIMAL_STACK_SIZE, NULL, SIM_TIMER_TASK_PRI, &timerTaskHandle);
+  }
+
+  timer->callback = callback;
+  timer->id = id;
+  timer->period = period;
+  timer->autoReload = autoReload;
+  timer->next = timers;
+  timers = timer;
+
+  return timer;
+}
+
+BaseType_t xTimerStartSim(TimerHandle_t timer)
+{
+  timer->active = true;
+  timer->expiry = tickCount + timer->period;
+  wakeWaiters(&timerObject);
+
+  return pdPASS;
+}
+
+BaseType_t xTimerStopSim(TimerHandle_t timer)
+{
+  timer->active = false;
+  wakeWaiters(&timerObject);
+
+  return pdPASS;
+}
+
+BaseType_t xTimerChangePeriodSim(TimerHandle_t timer, TickType_t period)
+{
+  // Starts a stopped timer too, as in FreeRTOS
+  timer->period = period;
+
+  return xTimerStartSim(timer);
+}
+
+BaseType_t xTimerDeleteSim(TimerHandle_t timer)
+{
+  for (struct simTimer **link = &timers; *link; link = &(*link)->next) {
+    if (*link == timer) {
+      *link = timer->next;
+      free(timer);
+      break;
+    }
+  }
+  wakeWaiters(&timerObject);
+
+  return pdPASS;
+}
+
+BaseType_t xTimerIsTimerActive(TimerHandle_t timer)
+{
+  return timer->active ? pdTRUE : pdFALSE;
+}
+
+void *pvTimerGetTimerID(TimerHandle_t timer)
+{
+  return timer->id;
+}
+
+static uint64_t hostNs(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+void simOsRunUntilIdle(void)
+{
+  while (true) {
+    struct simTask *next = NULL;
+
+    for (struct simTask *task = tasks; task; task = task->next) {
+      if (task->ready && !task->deleted &&
+          (next == NULL || task->priority > next->priority ||
+           (task->priority == next->priority && task->readySequence < next->readySequence))) {
+        next = task;
+      }
+    }
+
+    if (next == NULL) {
+      return;
+    }
+
+    next->ready = false;
+    next->runs++;
+    current = next;
+    if (isProfiling) {
+      const uint64_t startNs = hostNs();
+      swapcontext(&schedulerContext, &next->context);
+      next->busyNs += hostNs() - startNs;
+    } else {
+      swapcontext(&schedulerContext, &next->context);
+    }
+    current = NULL;
+  }
+}
+
+void simOsTick(void)
+{
+  tickCount++;
+
+  for (struct simTask *task = tasks; task; task = task->next) {
+    if (!task->ready && !task->deleted && task->waitObject && task->timed &&
+        (int32_t)(tickCount - task->wakeTick) >= 0) {
+      task->timedOut = task->waitObject != &delayObject;
+      makeReady(task);
+    }
+  }
+}
+
+uint64_t simOsTimeUs(void)
+{
+  return (uint64_t)tickCount * 1000;
+}
+
+void simOsSetProfiling(bool enable)
+{
+  isProfiling = enable;
+}
+
+int simOsGetTasks(simOsTaskInfo_t *info, int max)
+{
+  int count = 0;
+
+  for (struct simTask *task = tasks; task; task = task->next, count++) {
+    if (count < max) {
+      info[count] = (simOsTaskInfo_t){
+        .name = task->name, .priority = task->priority, .runs = task->runs, .busyNs = task->busyNs,
+      };
+    }
+  }
+
+  return count;
+}
+
+int simOsGetQueues(simOsQueueInfo_t *info, int max)
+{
+  int count = 0;
+
+  for (struct simQueue *queue = queues; queue; queue = queue->next, count++) {
+    if (count < max) {
+      info[count] = (simOsQueueInfo_t){
+        .handle = queue, .name = queue->name, .length = queue->length, .peak = queue->peak,
+      };
+    }
+  }
+
+  return count;
+}
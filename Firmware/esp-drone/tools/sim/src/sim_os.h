@@ -0,0 +1,45 @@
+/*
+ * sim_os.h - Scheduler of the virtual time FreeRTOS
+ *
+ * The simulation loop alternates between running every ready task until
+ * they all block, and advancing the tick, which wakes up the tasks whose
+ * delay or timeout expired.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "FreeRTOS.h"
+
+// Run the ready tasks, returns when all of them are blocked
+void simOsRunUntilIdle(void);
+
+// Advance the tick by one
+void simOsTick(void);
+
+// Virtual time since the start of the simulation
+uint64_t simOsTimeUs(void);
+
+typedef struct {
+  const char *name;
+  UBaseType_t priority;
+  uint32_t runs;    // Times the task was switched to
+  uint64_t busyNs;  // Host CPU time the task ran for, while profiling
+} simOsTaskInfo_t;
+
+typedef struct {
+  QueueHandle_t handle;
+  const char *name;   // Of vQueueAddToRegistry(), NULL without
+  UBaseType_t length;
+  UBaseType_t peak;   // Most items held at once, semaphores included
+} simOsQueueInfo_t;
+
+// Add up the host CPU time every task runs for from now on
+void simOsSetProfiling(bool enable);
+
+// The tasks and the queues in the order of their creation. At most max are
+// filled in, the total is returned.
+int simOsGetTasks(simOsTaskInfo_t *info, int max);
+int simOsGetQueues(simOsQueueInfo_t *info, int max);
@@ -0,0 +1,247 @@
+/*
+ * sim_perf.c - Performance report of a simulated flight
+ *
+ * The task times come from sim_os.c and the stage cycles from the profiler
+ * of stabilizer.c, both on the host clock, so they only compare between runs
+ * on the same machine. Everything else is on the virtual clock and the same
+ * on every run of the same options.
+ *
+ * A setpoint of the client is recognized by its position once the stabilizer
+ * uses it, the client gives every setpoint another one. Those that never
+ * show up were lost or overtaken by a newer one on the way.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "log.h"
+#include "static_mem.h"
+
+#include "sim_os.h"
+#include "sim_perf.h"
+
+#define SENT_SETPOINTS 64
+#define MAX_LATENCIES 65536
+#define MAX_TASKS 64
+#define MAX_QUEUES 128
+
+typedef struct {
+  uint32_t tick;
+  float position[3];
+} sentSetpoint_t;
+
+static sentSetpoint_t sentSetpoints[SENT_SETPOINTS];
+static uint32_t sentHead;
+static uint32_t sentCount;
+
+static uint16_t latencies[MAX_LATENCIES]; // ticks
+static uint32_t latencyCount;
+
+// The registry of static_mem.h names the queues of the firmware
+extern const staticMemEntry_t _staticMem_start;
+extern const staticMemEntry_t _staticMem_end;
+
+void simPerfStart(void)
+{
+  simOsSetProfiling(true);
+}
+
+void simPerfSetpointSent(uint32_t tick, const float position[3])
+{
+  if (sentCount == SENT_SETPOINTS) {
+    sentHead = (sentHead + 1) % SENT_SETPOINTS;
+    sentCount--;
+  }
+
+  sentSetpoint_t *sent = &sentSetpoints[(sentHead + sentCount) % SENT_SETPOINTS];
+  sent->tick = tick;
+  memcpy(sent->position, position, sizeof(sent->position));
+  sentCount++;
+}
+
+void simPerfSetpointUsed(uint32_t tick, const float position[3])
+{
+  for (uint32_t i = 0; i < sentCount; i++) {
+    const sentSetpoint_t *sent = &sentSetpoints[(sentHead + i) % SENT_SETPOINTS];
+
+    if (memcmp(sent->position, position, sizeof(sent->position)) == 0) {
+      if (latencyCount < MAX_LATENCIES) {
+        latencies[latencyCount++] = tick - sent->tick;
+      }
+      // This one and the older ones are done with
+      sentHead = (sentHead + i + 1) % SENT_SETPOINTS;
+      sentCount -= i + 1;
+      return;
+    }
+  }
+}
+
+// JSON has no NaN
+static void writeNumber(FILE *file, const char *name, double value, bool isLast)
+{
+  if (isfinite(value)) {
+    fprintf(file, "\"%s\": %.6g%s", name, value, isLast ? "" : ", ");
+  } else {
+    fprintf(file, "\"%s\": null%s", name, isLast ? "" : ", ");
+  }
+}
+
+static void writeFlight(FILE *file, const simFlightResult_t *result)
+{
+  fprintf(file, "  \"flight\": {");
+  writeNumber(file, "crashed", result->crashed, false);
+  writeNumber(file, "time", result->time, false);
+  writeNumber(file, "rms", result->rms, false);
+  writeNumber(file, "max", result->max, false);
+  writeNumber(file, "land_error", result->landError, false);
+  writeNumber(file, "touchdown_speed", result->touchdownSpeed, false);
+  writeNumber(file, "time_to_land", result->timeToLand, false);
+  writeNumber(file, "holds", result->holds, false);
+  writeNumber(file, "hold_time", result->holdTime, false);
+  writeNumber(file, "host_time", result->hostTime, true);
+  fprintf(file, "},\n");
+}
+
+static void writeTasks(FILE *file, float time)
+{
+  static simOsTaskInfo_t tasks[MAX_TASKS];
+  int count = simOsGetTasks(tasks, MAX_TASKS);
+
+  if (count > MAX_TASKS) {
+    count = MAX_TASKS;
+  }
+
+  // Per simulated second, a flight that ended early compares with a full one
+  fprintf(file, "  \"tasks\": [\n");
+  for (int i = 0; i < count; i++) {
+    const simOsTaskInfo_t *task = &tasks[i];
+
+    fprintf(file, "    {\"name\": \"%s\", \"priority\": %u, \"runs_per_s\": %.6g, \"us_per_s\": %.6g}%s\n",
+            task->name, task->priority, task->runs / time, task->busyNs / 1000.0 / time,
+            i + 1 < count ? "," : "");
+  }
+  fprintf(file, "  ],\n");
+}
+
+// Cycles of the host, see esp_cpu.h
+static void writeStages(FILE *file)
+{
+  static const char *stages[] = { "est", "cmd", "sitAw", "ctrl", "pwr", "total" };
+  const int count = sizeof(stages) / sizeof(stages[0]);
+
+  fprintf(file, "  \"stages\": {");
+  for (int i = 0; i < count; i++) {
+    char mean[16];
+    char max[16];
+
+    snprintf(mean, sizeof(mean), "%sMean", stages[i]);
+    snprintf(max, sizeof(max), "%sMax", stages[i]);
+    const logVarId_t meanId = logGetVarId("stabProf", mean);
+    const logVarId_t maxId = logGetVarId("stabProf", max);
+
+    fprintf(file, "\"%s\": {\"mean\": %u, \"max\": %u}%s", stages[i],
+            LOG_VARID_IS_VALID(meanId) ? logGetUint(meanId) : 0,
+            LOG_VARID_IS_VALID(maxId) ? logGetUint(maxId) : 0, i + 1 < count ? ", " : "");
+  }
+  fprintf(file, "},\n");
+}
+
+static const char *queueName(QueueHandle_t handle, const char *registered)
+{
+  for (const staticMemEntry_t *entry = &_staticMem_start; entry < &_staticMem_end; entry++) {
+    if (entry->type == STATIC_MEM_QUEUE && entry->state->handle == handle) {
+      return entry->name;
+    }
+  }
+
+  return registered;
+}
+
+// The queues without a name, the semaphores among them, are left out
+static void writeQueues(FILE *file)
+{
+  static simOsQueueInfo_t queues[MAX_QUEUES];
+  int count = simOsGetQueues(queues, MAX_QUEUES);
+  bool isFirst = true;
+
+  if (count > MAX_QUEUES) {
+    count = MAX_QUEUES;
+  }
+
+  fprintf(file, "  \"queues\": [");
+  for (int i = 0; i < count; i++) {
+    const char *name = queueName(queues[i].handle, queues[i].name);
+
+    if (name == NULL) {
+      continue;
+    }
+    fprintf(file, "%s\n    {\"name\": \"%s\", \"length\": %u, \"peak\": %u}", isFirst ? "" : ",", name,
+            queues[i].length, queues[i].peak);
+    isFirst = false;
+  }
+  fprintf(file, "\n  ],\n");
+}
+
+static int compareTicks(const void *a, const void *b)
+{
+  return (int)*(const uint16_t *)a - (int)*(const uint16_t *)b;
+}
+
+static void writeLatency(FILE *file)
+{
+  const float msPerTick = 1000.0f / configTICK_RATE_HZ;
+  const uint32_t n = latencyCount;
+
+  fprintf(file, "  \"latency_ms\": {\"n\": %u", n);
+  if (n > 0) {
+    double sum = 0;
+
+    qsort(latencies, n, sizeof(latencies[0]), compareTicks);
+    for (uint32_t i = 0; i < n; i++) {
+      sum += latencies[i];
+    }
+    fprintf(file, ", \"mean\": %.6g, \"median\": %.6g, \"p95\": %.6g, \"max\": %.6g", sum / n * msPerTick,
+            latencies[n / 2] * msPerTick, latencies[(uint32_t)(0.95f * (n - 1) + 0.5f)] * msPerTick,
+            latencies[n - 1] * msPerTick);
+  }
+  fprintf(file, "},\n");
+}
+
+static void writeCounters(FILE *file, const char *key, const char *group, const char *const *names, int count)
+{
+  bool isFirst = true;
+
+  fprintf(file, "  \"%s\": {", key);
+  for (int i = 0; i < count; i++) {
+    const logVarId_t id = logGetVarId((char *)group, (char *)names[i]);
+
+    if (LOG_VARID_IS_VALID(id)) {
+      fprintf(file, "%s\"%s\": %u", isFirst ? "" : ", ", names[i], logGetUint(id));
+      isFirst = false;
+    }
+  }
+  fprintf(file, "}");
+}
+
+void simPerfWriteReport(FILE *file, const char *scenario, const simFlightResult_t *result)
+{
+  static const char *const linkCounters[] = { "rx", "tx", "dropped", "lost" };
+  static const char *const crtpCounters[] = { "txDropCtrl", "txDropLog", "txDropCons", "txDropMem", "rxBusy" };
+  static const char *const logCounters[] = { "skipped" };
+  const float time = result->time > 0 ? result->time : 1.0f;
+
+  fprintf(file, "{\n  \"scenario\": \"%s\",\n  \"seed\": %llu,\n", scenario, (unsigned long long)result->seed);
+  writeFlight(file, result);
+  writeTasks(file, time);
+  writeStages(file);
+  writeQueues(file);
+  writeLatency(file);
+  writeCounters(file, "link", "simLink", linkCounters, sizeof(linkCounters) / sizeof(linkCounters[0]));
+  fprintf(file, ",\n");
+  writeCounters(file, "crtp", "crtp", crtpCounters, sizeof(crtpCounters) / sizeof(crtpCounters[0]));
+  fprintf(file, ",\n");
+  writeCounters(file, "log", "log", logCounters, sizeof(logCounters) / sizeof(logCounters[0]));
+  fprintf(file, "\n}\n");
+}
@@ -0,0 +1,28 @@
+/*
+ * sim_perf.h - Performance report of a simulated flight
+ *
+ * What a flight cost the flight stack, next to how it flew: the host time
+ * of every firmware task, the cycles of the stages of the stabilizer loop,
+ * the peak of every named queue, the delay from a setpoint sent over the
+ * link to the loop that drove the motors with it, and the counters of the
+ * link. The report is one JSON object, perf.py puts those of the scenarios
+ * of a commit together and compares them with a baseline.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "sim_batch.h"
+
+// Time the tasks from now on, before the firmware starts
+void simPerfStart(void);
+
+// The client sent a position setpoint over the link
+void simPerfSetpointSent(uint32_t tick, const float position[3]);
+
+// The position setpoint of the stabilizer after the tasks of the tick ran
+void simPerfSetpointUsed(uint32_t tick, const float position[3]);
+
+void simPerfWriteReport(FILE *file, const char *scenario, const simFlightResult_t *result);
@@ -0,0 +1,183 @@
+/*
+ * sim_quad.c - Rigid body model of the quadrotor
+ *
+ * Thrust grows with the square of the motor ratio and follows it with a
+ * first order lag. Each call is split in fixed substeps integrated with
+ * semi-implicit Euler, so the model stays stable at the 1 kHz tick.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "sim_quad.h"
+
+#define GRAVITY 9.81f
+#define SUBSTEPS 4
+
+// Attitude beyond which touching the ground is a crash, cos(60 deg)
+#define CRASH_TILT_COS 0.5f
+
+void simQuadDefaultParams(simQuadParams_t *params)
+{
+  // Close to an ESP-Drone with 720 motors and its 3D printed frame
+  *params = (simQuadParams_t) {
+    .mass = 0.035f,
+    .armLength = 0.046f,
+    .inertia = { 2.3e-5f, 2.3e-5f, 4.0e-5f },
+    .hoverRatio = 0.40f,
+    .torqueRatio = 0.006f,
+    .motorTau = 0.03f,
+    .drag = 0.01f,
+    .crashSpeed = 3.0f,
+  };
+}
+
+void simQuadInit(simQuadState_t *state, float x, float y)
+{
+  memset(state, 0, sizeof(*state));
+  state->pos[0] = x;
+  state->pos[1] = y;
+  state->q[0] = 1.0f;
+  state->specificForce[2] = GRAVITY;
+  state->onGround = true;
+}
+
+// v' = R v, R from the body to the world frame
+static void rotate(const float q[4], const float v[3], float out[3])
+{
+  const float w = q[0], x = q[1], y = q[2], z = q[3];
+
+  out[0] = (1 - 2 * (y * y + z * z)) * v[0] + 2 * (x * y - w * z) * v[1] + 2 * (x * z + w * y) * v[2];
+  out[1] = 2 * (x * y + w * z) * v[0] + (1 - 2 * (x * x + z * z)) * v[1] + 2 * (y * z - w * x) * v[2];
+  out[2] = 2 * (x * z - w * y) * v[0] + 2 * (y * z + w * x) * v[1] + (1 - 2 * (x * x + y * y)) * v[2];
+}
+
+static void rotateInverse(const float q[4], const float v[3], float out[3])
+{
+  const float conjugate[4] = { q[0], -q[1], -q[2], -q[3] };
+
+  rotate(conjugate, v, out);
+}
+
+static void substep(simQuadState_t *state, const simQuadParams_t *params, const float target[4], float dt)
+{
+  const float alpha = dt / (params->motorTau + dt);
+  float *f = state->thrust;
+
+  for (int i = 0; i < 4; i++) {
+    f[i] += alpha * (target[i] - f[i]);
+  }
+
+  // Motors on the diagonals of the X, at +-45 deg from the x axis
+  const float d = params->armLength * (float)M_SQRT1_2;
+  const float torque[3] = {
+    d * (f[2] + f[3] - f[0] - f[1]),
+    d * (f[1] + f[2] - f[0] - f[3]),
+    params->torqueRatio * (f[1] + f[3] - f[0] - f[2]),
+  };
+
+  // Euler's equations, the inertia is diagonal
+  const float *I = params->inertia;
+  float *w = state->omega;
+  const float wDot[3] = {
+    (torque[0] - (I[2] - I[1]) * w[1] * w[2]) / I[0],
+    (torque[1] - (I[0] - I[2]) * w[2] * w[0]) / I[1],
+    (torque[2] - (I[1] - I[0]) * w[0] * w[1]) / I[2],
+  };
+  for (int i = 0; i < 3; i++) {
+    w[i] += wDot[i] * dt;
+  }
+
+  // q' = q + 1/2 q * (0, w) dt
+  float *q = state->q;
+  const float qDot[4] = {
+    0.5f * (-q[1] * w[0] - q[2] * w[1] - q[3] * w[2]),
+    0.5f * (q[0] * w[0] + q[2] * w[2] - q[3] * w[1]),
+    0.5f * (q[0] * w[1] - q[1] * w[2] + q[3] * w[0]),
+    0.5f * (q[0] * w[2] + q[1] * w[1] - q[2] * w[0]),
+  };
+  float norm = 0;
+  for (int i = 0; i < 4; i++) {
+    q[i] += qDot[i] * dt;
+    norm += q[i] * q[i];
+  }
+  norm = sqrtf(norm);
+  for (int i = 0; i < 4; i++) {
+    q[i] /= norm;
+  }
+
+  const float bodyThrust[3] = { 0, 0, f[0] + f[1] + f[2] + f[3] };
+  float force[3];
+  rotate(q, bodyThrust, force);
+  for (int i = 0; i < 3; i++) {
+    force[i] += params->drag * (state->wind[i] - state->vel[i]);
+  }
+
+  float acc[3];
+  for (int i = 0; i < 3; i++) {
+    acc[i] = force[i] / params->mass;
+  }
+  acc[2] -= GRAVITY;
+
+  for (int i = 0; i < 3; i++) {
+    state->vel[i] += acc[i] * dt;
+    state->pos[i] += state->vel[i] * dt;
+  }
+
+  state->onGround = false;
+  if (state->pos[2] <= 0.0f) {
+    const float up[3] = { 0, 0, 1 };
+    float bodyUp[3];
+    rotate(q, up, bodyUp);
+
+    if (state->vel[2] < -params->crashSpeed || bodyUp[2] < CRASH_TILT_COS) {
+      state->crashed = true;
+    }
+
+    // Resting on the legs until the thrust lifts the weight
+    state->pos[2] = 0.0f;
+    if (state->vel[2] < 0.0f) {
+      state->vel[2] = 0.0f;
+    }
+    if (force[2] <= params->mass * GRAVITY) {
+      const float yaw = atan2f(2 * (q[0] * q[3] + q[1] * q[2]), 1 - 2 * (q[2] * q[2] + q[3] * q[3]));
+
+      memset(state->vel, 0, sizeof(state->vel));
+      memset(state->omega, 0, sizeof(state->omega));
+      q[0] = cosf(yaw / 2);
+      q[1] = 0;
+      q[2] = 0;
+      q[3] = sinf(yaw / 2);
+      acc[0] = acc[1] = acc[2] = 0;
+      state->onGround = true;
+    }
+  }
+
+  const float world[3] = { acc[0], acc[1], acc[2] + GRAVITY };
+  rotateInverse(q, world, state->specificForce);
+}
+
+void simQuadStep(simQuadState_t *state, const simQuadParams_t *params, const uint16_t ratios[4], float dt)
+{
+  const float thrustMax = params->mass * GRAVITY / 4 / (params->hoverRatio * params->hoverRatio);
+  float target[4];
+
+  for (int i = 0; i < 4; i++) {
+    const float ratio = ratios[i] / 65535.0f;
+    target[i] = thrustMax * ratio * ratio;
+  }
+
+  for (int i = 0; i < SUBSTEPS; i++) {
+    substep(state, params, target, dt / SUBSTEPS);
+  }
+}
+
+void simQuadEuler(const simQuadState_t *state, float euler[3])
+{
+  const float *q = state->q;
+  const float sinPitch = 2 * (q[0] * q[2] - q[3] * q[1]);
+
+  euler[0] = atan2f(2 * (q[0] * q[1] + q[2] * q[3]), 1 - 2 * (q[1] * q[1] + q[2] * q[2]));
+  euler[1] = fabsf(sinPitch) >= 1 ? copysignf((float)M_PI / 2, sinPitch) : asinf(sinPitch);
+  euler[2] = atan2f(2 * (q[0] * q[3] + q[1] * q[2]), 1 - 2 * (q[2] * q[2] + q[3] * q[3]));
+}
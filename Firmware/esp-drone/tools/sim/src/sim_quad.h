@@ -0,0 +1,47 @@
+/*
+ * sim_quad.h - Rigid body model of the quadrotor
+ *
+ * The body frame is x forward, y left and z up like the firmware, the world
+ * frame is z up with the origin on the ground. Motors are numbered like
+ * power_distribution_stock.c in X formation: M1 front right, M2 back right,
+ * M3 back left and M4 front left, M1 and M3 spin counter clockwise.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct {
+  float mass;          // kg
+  float armLength;     // m, from the center to a motor
+  float inertia[3];    // kg m^2, about the body axes
+  float hoverRatio;    // Motor ratio that holds the mass, 0..1
+  float torqueRatio;   // m, reaction torque over thrust of a propeller
+  float motorTau;      // s, time constant of the thrust
+  float drag;          // N s/m, linear drag of the frame
+  float crashSpeed;    // m/s, vertical speed that breaks the drone on the ground
+} simQuadParams_t;
+
+typedef struct {
+  float pos[3];        // m, world
+  float vel[3];        // m/s, world
+  float q[4];          // w, x, y, z, body to world
+  float omega[3];      // rad/s, body
+  float thrust[4];     // N, per motor after the motor lag
+  float specificForce[3]; // m/s^2, body, what the accelerometer measures
+  float wind[3];       // m/s, world, the air the drag acts against, set by the caller
+  bool onGround;
+  bool crashed;
+} simQuadState_t;
+
+void simQuadDefaultParams(simQuadParams_t *params);
+
+// Start at rest and level on the ground at (x, y)
+void simQuadInit(simQuadState_t *state, float x, float y);
+
+// Advance by dt seconds with the motor ratios held, 0..65535
+void simQuadStep(simQuadState_t *state, const simQuadParams_t *params, const uint16_t ratios[4], float dt);
+
+// Roll, pitch and yaw in rad, pitch positive nose down
+void simQuadEuler(const simQuadState_t *state, float euler[3]);
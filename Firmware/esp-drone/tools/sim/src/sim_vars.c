@@ -0,0 +1,37 @@
+/*
+ * sim_vars.c - Param and log variables of the host simulator
+ *
+ * The PARAM_GROUP and LOG_GROUP tables are collected by sim.ld like the
+ * linker fragment of the firmware does, and param.c and log.c serve them,
+ * over the sim link too. This only adds the command line side.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "param.h"
+#include "sim_vars.h"
+
+bool simVarsAssign(const char *assignment)
+{
+  char group[32];
+  char name[32];
+  char value[32];
+
+  if (sscanf(assignment, "%31[^.].%31[^=]=%31s", group, name, value) != 3) {
+    return false;
+  }
+
+  const paramVarId_t varId = paramGetVarId(group, name);
+  if (!PARAM_VARID_IS_VALID(varId)) {
+    return false;
+  }
+
+  if (paramGetType(varId) & PARAM_TYPE_FLOAT) {
+    paramSetFloat(varId, strtof(value, NULL));
+  } else {
+    paramSetInt(varId, (int)strtol(value, NULL, 0));
+  }
+
+  return true;
+}
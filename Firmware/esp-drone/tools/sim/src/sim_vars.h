@@ -0,0 +1,10 @@
+/*
+ * sim_vars.h - Param and log variables of the host simulator
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+// Set a param from "group.name=value", false if it does not exist
+bool simVarsAssign(const char *assignment);
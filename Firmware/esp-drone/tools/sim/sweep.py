@@ -0,0 +1,84 @@
+#!/usr/bin/env python3
+"""Fly the simulator over a grid of firmware params and rank the flights.
+
+Every combination of the swept values is flown with each seed, in parallel
+on all the cores, and the combinations are ranked by their worst RMS
+tracking error. A crash ranks last.
+
+    ./sweep.py -p posCtlPid.zKp=1:4:7 -p posCtlPid.zKi=0,0.5,1 -s step
+"""
+
+import argparse
+import itertools
+import os
+import subprocess
+import sys
+from concurrent.futures import ThreadPoolExecutor
+
+SIM = os.path.join(os.path.dirname(os.path.abspath(__file__)), "sim")
+
+
+def parse_values(spec):
+    """Values of 'a,b,c' or of 'start:stop:count' evenly spaced."""
+    if ":" in spec:
+        start, stop, count = spec.split(":")
+        start, stop, count = float(start), float(stop), int(count)
+        step = (stop - start) / (count - 1) if count > 1 else 0
+        return [round(start + i * step, 6) for i in range(count)]
+    return [float(v) for v in spec.split(",")]
+
+
+def parse_sweep(assignment):
+    name, spec = assignment.split("=", 1)
+    return name, parse_values(spec)
+
+
+def fly(args, params, seed):
+    command = [SIM, "-t", str(args.time), "-s", args.scenario, "-r", str(seed)]
+    for name, value in params:
+        command += ["-p", "%s=%g" % (name, value)]
+    command += args.extra
+
+    output = subprocess.run(command, capture_output=True, text=True).stdout
+    metrics = dict(field.split("=") for field in output.split())
+    return {key: float(value) for key, value in metrics.items()}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("-p", "--param", action="append", type=parse_sweep, default=[],
+                        help="group.name=a,b,c or group.name=start:stop:count, repeatable")
+    parser.add_argument("-s", "--scenario", default="step")
+    parser.add_argument("-t", "--time", type=float, default=10)
+    parser.add_argument("--seeds", type=int, default=3, help="flights per combination")
+    parser.add_argument("-j", "--jobs", type=int, default=os.cpu_count())
+    parser.add_argument("-n", "--top", type=int, default=10, help="combinations to print")
+    parser.add_argument("extra", nargs=argparse.REMAINDER, help="options passed to sim after --")
+    args = parser.parse_args()
+    args.extra = [a for a in args.extra if a != "--"]
+
+    if not os.path.exists(SIM):
+        sys.exit("Build the simulator first with make")
+
+    names = [name for name, _ in args.param]
+    combinations = [list(zip(names, values)) for values in itertools.product(*[v for _, v in args.param])]
+    flights = [(c, seed) for c in combinations for seed in range(1, args.seeds + 1)]
+
+    with ThreadPoolExecutor(args.jobs) as pool:
+        results = list(pool.map(lambda flight: fly(args, *flight), flights))
+
+    scores = []
+    for i, combination in enumerate(combinations):
+        runs = results[i * args.seeds:(i + 1) * args.seeds]
+        crashed = any(run["crashed"] for run in runs)
+        scores.append((crashed, max(run["rms"] for run in runs), max(run["max"] for run in runs), combination))
+    scores.sort(key=lambda score: score[:2])
+
+    print("%d flights" % len(flights))
+    for crashed, rms, worst, combination in scores[:args.top]:
+        values = " ".join("%s=%g" % (name, value) for name, value in combination)
+        print("%s rms=%.4f max=%.4f %s" % ("CRASH" if crashed else "ok   ", rms, worst, values))
+
+
+if __name__ == "__main__":
+    main()